@@ -67,6 +67,7 @@ struct jit_ctx {
 	int idx;
 	int epilogue_offset;
 	int *offset;
+	unsigned long *func_entry;	/* targets of BPF_CALL_ARGS */
 	u32 *image;
 };
 
@@ -582,6 +583,17 @@ emit_cond_jmp:
 		emit(A64_MOV(1, r0, A64_R(0)), ctx);
 		break;
 	}
+	/* call of a function of this program
+	 *
+	 * Its entry has a prologue of its own and it leaves through the
+	 * common epilogue, so this is a plain BL; R0 stays in x7 and
+	 * R6-R9 are restored on return.
+	 */
+	case BPF_JMP | BPF_CALL_ARGS:
+		jmp_offset = bpf2a64_offset(i + imm, i, ctx);
+		check_imm26(jmp_offset);
+		emit(A64_BL(jmp_offset), ctx);
+		break;
 	/* tail call */
 	case BPF_JMP | BPF_CALL | BPF_X:
 		if (emit_bpf_tail_call(ctx))
@@ -778,6 +790,9 @@ static int build_body(struct jit_ctx *ctx)
 		const struct bpf_insn *insn = &prog->insnsi[i];
 		int ret;
 
+		if (test_bit(i, ctx->func_entry) && build_prologue(ctx))
+			return -EFAULT;
+
 		ret = build_insn(insn, ctx);
 
 		if (ctx->image == NULL)
@@ -794,6 +809,27 @@ static int build_body(struct jit_ctx *ctx)
 	return 0;
 }
 
+static int find_func_entries(struct jit_ctx *ctx)
+{
+	const struct bpf_prog *prog = ctx->prog;
+	int i;
+
+	ctx->func_entry = kcalloc(BITS_TO_LONGS(prog->len),
+				  sizeof(unsigned long), GFP_KERNEL);
+	if (ctx->func_entry == NULL)
+		return -ENOMEM;
+
+	for (i = 0; i < prog->len; i++) {
+		const struct bpf_insn *insn = &prog->insnsi[i];
+
+		/* the verifier made sure the target is inside the program */
+		if (insn->code == (BPF_JMP | BPF_CALL_ARGS))
+			set_bit(i + insn->imm + 1, ctx->func_entry);
+	}
+
+	return 0;
+}
+
 static int validate_code(struct jit_ctx *ctx)
 {
 	int i;
@@ -845,6 +881,11 @@ struct bpf_prog *bpf_int_jit_compile(struct bpf_prog *prog)
 		goto out;
 	}
 
+	if (find_func_entries(&ctx)) {
+		prog = orig_prog;
+		goto out_off;
+	}
+
 	/* 1. Initial fake pass to compute ctx->idx. */
 
 	/* Fake pass to fill in ctx->offset. */
@@ -903,6 +944,7 @@ struct bpf_prog *bpf_int_jit_compile(struct bpf_prog *prog)
 	prog->jited = 1;
 
 out_off:
+	kfree(ctx.func_entry);
 	kfree(ctx.offset);
 out:
 	if (tmp_blinded)
@@ -148,6 +148,8 @@ struct kvm_vcpu_stat {
 	u64 halt_successful_poll;
 	u64 halt_attempted_poll;
 	u64 halt_poll_invalid;
+	u64 halt_poll_skipped;
+	u64 halt_poll_yield;
 	u64 halt_wakeup;
 };
 
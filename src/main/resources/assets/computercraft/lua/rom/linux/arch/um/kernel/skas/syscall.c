@@ -6,6 +6,7 @@
 #include <linux/kernel.h>
 #include <linux/ptrace.h>
 #include <linux/seccomp.h>
+#include <linux/lathist.h>
 #include <kern_util.h>
 #include <sysdep/ptrace.h>
 #include <sysdep/ptrace_user.h>
@@ -28,9 +29,13 @@ void handle_syscall(struct uml_pt_regs *r)
 		goto out;
 
 	syscall = UPT_SYSCALL_NR(r);
-	if (syscall >= 0 && syscall <= __NR_syscall_max)
+	if (syscall >= 0 && syscall <= __NR_syscall_max) {
+		u64 start = lathist_start();
+
 		PT_REGS_SET_SYSCALL_RETURN(regs,
 				EXECUTE_SYSCALL(syscall, regs));
+		lathist_syscall(syscall, start);
+	}
 
 out:
 	syscall_trace_leave(regs);
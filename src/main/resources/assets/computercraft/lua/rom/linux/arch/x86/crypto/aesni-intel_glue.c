@@ -610,6 +610,30 @@ static int xts_decrypt(struct skcipher_request *req)
 				   aes_ctx(ctx->raw_crypt_ctx));
 }
 
+static int xts_encrypt_batch(struct skcipher_request **reqs, unsigned int nr,
+			     struct crypto_batch *batch)
+{
+	struct crypto_skcipher *tfm = crypto_skcipher_reqtfm(reqs[0]);
+	struct aesni_xts_ctx *ctx = crypto_skcipher_ctx(tfm);
+
+	return glue_xts_req_128bit_batch(&aesni_enc_xts, reqs, nr,
+					 XTS_TWEAK_CAST(aesni_xts_tweak),
+					 aes_ctx(ctx->raw_tweak_ctx),
+					 aes_ctx(ctx->raw_crypt_ctx));
+}
+
+static int xts_decrypt_batch(struct skcipher_request **reqs, unsigned int nr,
+			     struct crypto_batch *batch)
+{
+	struct crypto_skcipher *tfm = crypto_skcipher_reqtfm(reqs[0]);
+	struct aesni_xts_ctx *ctx = crypto_skcipher_ctx(tfm);
+
+	return glue_xts_req_128bit_batch(&aesni_dec_xts, reqs, nr,
+					 XTS_TWEAK_CAST(aesni_xts_tweak),
+					 aes_ctx(ctx->raw_tweak_ctx),
+					 aes_ctx(ctx->raw_crypt_ctx));
+}
+
 static int rfc4106_init(struct crypto_aead *aead)
 {
 	struct cryptd_aead *cryptd_tfm;
@@ -712,6 +736,62 @@ static int rfc4106_set_authsize(struct crypto_aead *parent,
 	return crypto_aead_setauthsize(&cryptd_tfm->base, authsize);
 }
 
+/*
+ * ESP packets usually come as a few fragments, which the asm can't walk.
+ * Bounce them through a per-cpu buffer instead of an atomic allocation
+ * per request; only larger requests and hardirq callers allocate.
+ */
+#define AESNI_GCM_BOUNCE_SIZE	(4 * PAGE_SIZE)
+
+static DEFINE_PER_CPU(u8 *, aesni_gcm_bounce);
+
+static u8 *aesni_gcm_get_bounce(unsigned int len)
+{
+	u8 *buf;
+
+	if (len > AESNI_GCM_BOUNCE_SIZE || in_irq() || in_nmi() ||
+	    irqs_disabled())
+		return kmalloc(len, GFP_ATOMIC);
+
+	/* keeps softirqs on this cpu off the buffer, and disables preemption */
+	local_bh_disable();
+	buf = this_cpu_read(aesni_gcm_bounce);
+	if (unlikely(!buf)) {
+		local_bh_enable();
+		return kmalloc(len, GFP_ATOMIC);
+	}
+	return buf;
+}
+
+static void aesni_gcm_put_bounce(u8 *buf)
+{
+	if (buf == this_cpu_read(aesni_gcm_bounce))
+		local_bh_enable();
+	else
+		kfree(buf);
+}
+
+static void aesni_gcm_free_bounce(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		kfree(per_cpu(aesni_gcm_bounce, cpu));
+		per_cpu(aesni_gcm_bounce, cpu) = NULL;
+	}
+}
+
+static void aesni_gcm_alloc_bounce(void)
+{
+	int cpu;
+
+	/* not fatal, requests just fall back to kmalloc() */
+	for_each_possible_cpu(cpu)
+		per_cpu(aesni_gcm_bounce, cpu) =
+			kmalloc_node(AESNI_GCM_BOUNCE_SIZE, GFP_KERNEL,
+				     cpu_to_node(cpu));
+}
+
 static int helper_rfc4106_encrypt(struct aead_request *req)
 {
 	u8 one_entry_in_sg = 0;
@@ -756,8 +836,8 @@ static int helper_rfc4106_encrypt(struct aead_request *req)
 		}
 	} else {
 		/* Allocate memory for src, dst, assoc */
-		assoc = kmalloc(req->cryptlen + auth_tag_len + req->assoclen,
-			GFP_ATOMIC);
+		assoc = aesni_gcm_get_bounce(req->cryptlen + auth_tag_len +
+					     req->assoclen);
 		if (unlikely(!assoc))
 			return -ENOMEM;
 		scatterwalk_map_and_copy(assoc, req->src, 0,
@@ -786,7 +866,7 @@ static int helper_rfc4106_encrypt(struct aead_request *req)
 	} else {
 		scatterwalk_map_and_copy(dst, req->dst, req->assoclen,
 					 req->cryptlen + auth_tag_len, 1);
-		kfree(assoc);
+		aesni_gcm_put_bounce(assoc);
 	}
 	return 0;
 }
@@ -841,7 +921,7 @@ static int helper_rfc4106_decrypt(struct aead_request *req)
 
 	} else {
 		/* Allocate memory for src, dst, assoc */
-		assoc = kmalloc(req->cryptlen + req->assoclen, GFP_ATOMIC);
+		assoc = aesni_gcm_get_bounce(req->cryptlen + req->assoclen);
 		if (!assoc)
 			return -ENOMEM;
 		scatterwalk_map_and_copy(assoc, req->src, 0,
@@ -872,7 +952,7 @@ static int helper_rfc4106_decrypt(struct aead_request *req)
 	} else {
 		scatterwalk_map_and_copy(dst, req->dst, req->assoclen,
 					 tempCipherLen, 1);
-		kfree(assoc);
+		aesni_gcm_put_bounce(assoc);
 	}
 	return retval;
 }
@@ -1012,6 +1092,8 @@ static struct skcipher_alg aesni_skciphers[] = {
 		.setkey		= xts_aesni_setkey,
 		.encrypt	= xts_encrypt,
 		.decrypt	= xts_decrypt,
+		.encrypt_batch	= xts_encrypt_batch,
+		.decrypt_batch	= xts_decrypt_batch,
 #endif
 	}
 };
@@ -1133,6 +1215,7 @@ static int __init aesni_init(void)
 		pr_info("AES CTR mode by8 optimization enabled\n");
 	}
 #endif
+	aesni_gcm_alloc_bounce();
 #endif
 
 	err = crypto_fpu_init();
@@ -1189,6 +1272,9 @@ unregister_algs:
 	crypto_unregister_algs(aesni_algs, ARRAY_SIZE(aesni_algs));
 fpu_exit:
 	crypto_fpu_exit();
+#ifdef CONFIG_X86_64
+	aesni_gcm_free_bounce();
+#endif
 	return err;
 }
 
@@ -1201,6 +1287,9 @@ static void __exit aesni_exit(void)
 	crypto_unregister_algs(aesni_algs, ARRAY_SIZE(aesni_algs));
 
 	crypto_fpu_exit();
+#ifdef CONFIG_X86_64
+	aesni_gcm_free_bounce();
+#endif
 }
 
 late_initcall(aesni_init);
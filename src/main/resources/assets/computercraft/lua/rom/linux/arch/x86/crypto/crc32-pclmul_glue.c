@@ -55,13 +55,13 @@ static u32 __attribute__((pure))
 	unsigned int prealign;
 
 	if (len < PCLMUL_MIN_LEN + SCALE_F_MASK || !irq_fpu_usable())
-		return crc32_le(crc, p, len);
+		return crc32_le_base(crc, p, len);
 
 	if ((long)p & SCALE_F_MASK) {
 		/* align p to 16 byte */
 		prealign = SCALE_F - ((long)p & SCALE_F_MASK);
 
-		crc = crc32_le(crc, p, prealign);
+		crc = crc32_le_base(crc, p, prealign);
 		len -= prealign;
 		p = (unsigned char *)(((unsigned long)p + SCALE_F_MASK) &
 				     ~SCALE_F_MASK);
@@ -74,7 +74,7 @@ static u32 __attribute__((pure))
 	kernel_fpu_end();
 
 	if (iremainder)
-		crc = crc32_le(crc, p + iquotient, iremainder);
+		crc = crc32_le_base(crc, p + iquotient, iremainder);
 
 	return crc;
 }
@@ -175,19 +175,33 @@ static const struct x86_cpu_id crc32pclmul_cpu_id[] = {
 };
 MODULE_DEVICE_TABLE(x86cpu, crc32pclmul_cpu_id);
 
+/* Also speeds up direct crc32_le() callers, not only crypto API users */
+static struct crc32_arch crc32_pclmul_arch = {
+	.name		= "crc32-pclmul",
+	.priority	= 200,
+	.crc32_le	= crc32_pclmul_le,
+};
 
 static int __init crc32_pclmul_mod_init(void)
 {
+	int ret;
 
 	if (!x86_match_cpu(crc32pclmul_cpu_id)) {
 		pr_info("PCLMULQDQ-NI instructions are not detected.\n");
 		return -ENODEV;
 	}
-	return crypto_register_shash(&alg);
+
+	ret = crypto_register_shash(&alg);
+	if (ret)
+		return ret;
+
+	crc32_register_arch(&crc32_pclmul_arch);
+	return 0;
 }
 
 static void __exit crc32_pclmul_mod_fini(void)
 {
+	crc32_unregister_arch(&crc32_pclmul_arch);
 	crypto_unregister_shash(&alg);
 }
 
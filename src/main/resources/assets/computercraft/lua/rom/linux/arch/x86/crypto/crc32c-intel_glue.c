@@ -28,6 +28,7 @@
 #include <linux/module.h>
 #include <linux/string.h>
 #include <linux/kernel.h>
+#include <linux/crc32.h>
 #include <crypto/internal/hash.h>
 
 #include <asm/cpufeatures.h>
@@ -186,6 +187,18 @@ static int crc32c_pcl_intel_update(struct shash_desc *desc, const u8 *data,
 	return 0;
 }
 
+static u32 __pure crc32c_pcl_intel_le(u32 crc, unsigned char const *p,
+					size_t len)
+{
+	if (len >= CRC32C_PCL_BREAKEVEN && irq_fpu_usable()) {
+		kernel_fpu_begin();
+		crc = crc_pcl(p, len, crc);
+		kernel_fpu_end();
+		return crc;
+	}
+	return crc32c_intel_le_hw(crc, p, len);
+}
+
 static int __crc32c_pcl_intel_finup(u32 *crcp, const u8 *data, unsigned int len,
 				u8 *out)
 {
@@ -239,8 +252,17 @@ static const struct x86_cpu_id crc32c_cpu_id[] = {
 };
 MODULE_DEVICE_TABLE(x86cpu, crc32c_cpu_id);
 
+/* __crc32c_le() callers get the same implementation as the crypto API */
+static struct crc32_arch crc32c_intel_arch = {
+	.name		= "crc32c-intel",
+	.priority	= 200,
+	.crc32c_le	= crc32c_intel_le_hw,
+};
+
 static int __init crc32c_intel_mod_init(void)
 {
+	int ret;
+
 	if (!x86_match_cpu(crc32c_cpu_id))
 		return -ENODEV;
 #ifdef CONFIG_X86_64
@@ -248,13 +270,20 @@ static int __init crc32c_intel_mod_init(void)
 		alg.update = crc32c_pcl_intel_update;
 		alg.finup = crc32c_pcl_intel_finup;
 		alg.digest = crc32c_pcl_intel_digest;
+		crc32c_intel_arch.crc32c_le = crc32c_pcl_intel_le;
 	}
 #endif
-	return crypto_register_shash(&alg);
+	ret = crypto_register_shash(&alg);
+	if (ret)
+		return ret;
+
+	crc32_register_arch(&crc32c_intel_arch);
+	return 0;
 }
 
 static void __exit crc32c_intel_mod_fini(void)
 {
+	crc32_unregister_arch(&crc32c_intel_arch);
 	crypto_unregister_shash(&alg);
 }
 
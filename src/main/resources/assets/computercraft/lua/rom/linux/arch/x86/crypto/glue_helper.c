@@ -451,6 +451,59 @@ int glue_xts_req_128bit(const struct common_glue_ctx *gctx,
 }
 EXPORT_SYMBOL_GPL(glue_xts_req_128bit);
 
+/*
+ * Same as glue_xts_req_128bit() for an array of requests on one tfm, but
+ * the FPU is kept across requests unless a reschedule is due.
+ */
+int glue_xts_req_128bit_batch(const struct common_glue_ctx *gctx,
+			      struct skcipher_request **reqs, unsigned int nr,
+			      common_glue_func_t tweak_fn, void *tweak_ctx,
+			      void *crypt_ctx)
+{
+	const unsigned int bsize = 128 / 8;
+	struct skcipher_walk walk;
+	bool fpu_enabled = false;
+	unsigned int nbytes, i;
+	int err, ret = 0;
+
+	for (i = 0; i < nr; i++) {
+		/* with the FPU held the walk must not sleep */
+		err = skcipher_walk_virt(&walk, reqs[i], fpu_enabled);
+		nbytes = walk.nbytes;
+		if (!nbytes)
+			goto next;
+
+		/* set minimum length to bsize, for tweak_fn */
+		fpu_enabled = glue_skwalk_fpu_begin(bsize,
+						    gctx->fpu_blocks_limit,
+						    &walk, fpu_enabled,
+						    nbytes < bsize ? bsize : nbytes);
+
+		/* calculate first value of T */
+		tweak_fn(tweak_ctx, walk.iv, walk.iv);
+
+		while (nbytes) {
+			nbytes = __glue_xts_req_128bit(gctx, crypt_ctx, &walk);
+
+			err = skcipher_walk_done(&walk, nbytes);
+			nbytes = walk.nbytes;
+		}
+next:
+		if (err && !ret)
+			ret = err;
+
+		if (fpu_enabled && need_resched()) {
+			glue_fpu_end(fpu_enabled);
+			fpu_enabled = false;
+		}
+	}
+
+	glue_fpu_end(fpu_enabled);
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(glue_xts_req_128bit_batch);
+
 void glue_xts_crypt_128bit_one(void *ctx, u128 *dst, const u128 *src, le128 *iv,
 			       common_glue_func_t fn)
 {
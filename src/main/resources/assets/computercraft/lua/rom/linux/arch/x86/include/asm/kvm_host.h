@@ -46,6 +46,10 @@
 #define KVM_PIO_PAGE_OFFSET 1
 #define KVM_COALESCED_MMIO_PAGE_OFFSET 2
 #define KVM_HALT_POLL_NS_DEFAULT 400000
+/* faults that only add a leaf SPTE run under the read side of mmu_lock */
+#define KVM_HAVE_MMU_RWLOCK
+/* a PML buffer full of GFNs can be flushed to the dirty ring at once */
+#define KVM_CPU_DIRTY_LOG_SIZE 512
 
 #define KVM_IRQCHIP_NUM_PINS  KVM_IOAPIC_NUM_PINS
 
@@ -731,6 +735,8 @@ enum kvm_irqchip_mode {
 	KVM_IRQCHIP_SPLIT,        /* created with KVM_CAP_SPLIT_IRQCHIP */
 };
 
+#define KVM_MMU_RMAP_LOCKS_SHIFT 6
+
 struct kvm_arch {
 	unsigned int n_used_mmu_pages;
 	unsigned int n_requested_mmu_pages;
@@ -741,6 +747,8 @@ struct kvm_arch {
 	/*
 	 * Hash table of struct kvm_mmu_page.
 	 */
+	/* rmap heads updated with mmu_lock held for read, hashed by gfn */
+	spinlock_t mmu_rmap_locks[1 << KVM_MMU_RMAP_LOCKS_SHIFT];
 	struct list_head active_mmu_pages;
 	struct list_head zapped_obsolete_pages;
 	struct kvm_page_track_notifier_node mmu_sp_tracker;
@@ -849,6 +857,8 @@ struct kvm_vcpu_stat {
 	u64 halt_successful_poll;
 	u64 halt_attempted_poll;
 	u64 halt_poll_invalid;
+	u64 halt_poll_skipped;
+	u64 halt_poll_yield;
 	u64 halt_wakeup;
 	u64 request_irq_exits;
 	u64 irq_exits;
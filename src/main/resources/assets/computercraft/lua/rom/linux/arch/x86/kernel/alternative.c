@@ -10,6 +10,7 @@
 #include <linux/memory.h>
 #include <linux/stop_machine.h>
 #include <linux/slab.h>
+#include <linux/sort.h>
 #include <linux/kdebug.h>
 #include <asm/text-patching.h>
 #include <asm/alternative.h>
@@ -733,54 +734,89 @@ static void do_sync_core(void *info)
 }
 
 static bool bp_patching_in_progress;
-static void *bp_int3_handler, *bp_int3_addr;
+static struct text_poke_loc *bp_vec;
+static unsigned int bp_nr_entries;
+
+/* bp_vec is sorted by address, see text_poke_bp_batch() */
+static struct text_poke_loc *bp_find(void *addr)
+{
+	unsigned int lo = 0, hi = bp_nr_entries;
+
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+
+		if (bp_vec[mid].addr == addr)
+			return &bp_vec[mid];
+		if (bp_vec[mid].addr < addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return NULL;
+}
 
 int poke_int3_handler(struct pt_regs *regs)
 {
+	struct text_poke_loc *tp;
+
 	/* bp_patching_in_progress */
 	smp_rmb();
 
 	if (likely(!bp_patching_in_progress))
 		return 0;
 
-	if (user_mode(regs) || regs->ip != (unsigned long)bp_int3_addr)
+	if (user_mode(regs))
+		return 0;
+
+	/* regs->ip points past the trapping int3 */
+	tp = bp_find((void *)(regs->ip - 1));
+	if (!tp)
 		return 0;
 
 	/* set up the specified breakpoint handler */
-	regs->ip = (unsigned long) bp_int3_handler;
+	regs->ip = (unsigned long) tp->handler;
 
 	return 1;
 
 }
 
+static int tp_cmp(const void *a, const void *b)
+{
+	const struct text_poke_loc *tp_a = a, *tp_b = b;
+
+	if (tp_a->addr < tp_b->addr)
+		return -1;
+	if (tp_a->addr > tp_b->addr)
+		return 1;
+	return 0;
+}
+
 /**
- * text_poke_bp() -- update instructions on live kernel on SMP
- * @addr:	address to patch
- * @opcode:	opcode of new instruction
- * @len:	length to copy
- * @handler:	address to jump to when the temporary breakpoint is hit
+ * text_poke_bp_batch() -- update several instruction sites on SMP at once
+ * @tp:		array of sites to patch
+ * @nr_entries:	number of entries in @tp
  *
- * Modify multi-byte instruction by using int3 breakpoint on SMP.
- * We completely avoid stop_machine() here, and achieve the
- * synchronization using int3 breakpoint.
- *
- * The way it is done:
- *	- add a int3 trap to the address that will be patched
- *	- sync cores
- *	- update all but the first byte of the patched range
- *	- sync cores
- *	- replace the first byte (int3) by the first byte of
- *	  replacing opcode
- *	- sync cores
+ * Same protocol as text_poke_bp(), but every step is applied to all the
+ * sites before the cores are synchronized, so the cost in cross-CPU
+ * sync rounds is the same for a whole batch as for a single site.
+ * @tp is sorted by address in place. The sites must not overlap.
  *
  * Note: must be called under text_mutex.
  */
-void *text_poke_bp(void *addr, const void *opcode, size_t len, void *handler)
+void text_poke_bp_batch(struct text_poke_loc *tp, unsigned int nr_entries)
 {
 	unsigned char int3 = 0xcc;
+	bool do_sync = false;
+	unsigned int i;
+
+	if (!nr_entries)
+		return;
+
+	sort(tp, nr_entries, sizeof(*tp), tp_cmp, NULL);
 
-	bp_int3_handler = handler;
-	bp_int3_addr = (u8 *)addr + sizeof(int3);
+	bp_vec = tp;
+	bp_nr_entries = nr_entries;
 	bp_patching_in_progress = true;
 	/*
 	 * Corresponding read barrier in int3 notifier for
@@ -789,30 +825,74 @@ void *text_poke_bp(void *addr, const void *opcode, size_t len, void *handler)
 	 */
 	smp_wmb();
 
-	text_poke(addr, &int3, sizeof(int3));
+	for (i = 0; i < nr_entries; i++)
+		text_poke(tp[i].addr, &int3, sizeof(int3));
 
 	on_each_cpu(do_sync_core, NULL, 1);
 
-	if (len - sizeof(int3) > 0) {
-		/* patch all but the first byte */
-		text_poke((char *)addr + sizeof(int3),
-			  (const char *) opcode + sizeof(int3),
-			  len - sizeof(int3));
-		/*
-		 * According to Intel, this core syncing is very likely
-		 * not necessary and we'd be safe even without it. But
-		 * better safe than sorry (plus there's not only Intel).
-		 */
-		on_each_cpu(do_sync_core, NULL, 1);
+	/* patch all but the first byte */
+	for (i = 0; i < nr_entries; i++) {
+		if (tp[i].len - sizeof(int3) > 0) {
+			text_poke((char *)tp[i].addr + sizeof(int3),
+				  (const char *)tp[i].opcode + sizeof(int3),
+				  tp[i].len - sizeof(int3));
+			do_sync = true;
+		}
 	}
 
+	/*
+	 * According to Intel, this core syncing is very likely
+	 * not necessary and we'd be safe even without it. But
+	 * better safe than sorry (plus there's not only Intel).
+	 */
+	if (do_sync)
+		on_each_cpu(do_sync_core, NULL, 1);
+
 	/* patch the first byte */
-	text_poke(addr, opcode, sizeof(int3));
+	for (i = 0; i < nr_entries; i++)
+		text_poke(tp[i].addr, tp[i].opcode, sizeof(int3));
 
 	on_each_cpu(do_sync_core, NULL, 1);
 
 	bp_patching_in_progress = false;
 	smp_wmb();
+}
+
+/**
+ * text_poke_bp() -- update instructions on live kernel on SMP
+ * @addr:	address to patch
+ * @opcode:	opcode of new instruction
+ * @len:	length to copy
+ * @handler:	address to jump to when the temporary breakpoint is hit
+ *
+ * Modify multi-byte instruction by using int3 breakpoint on SMP.
+ * We completely avoid stop_machine() here, and achieve the
+ * synchronization using int3 breakpoint.
+ *
+ * The way it is done:
+ *	- add a int3 trap to the address that will be patched
+ *	- sync cores
+ *	- update all but the first byte of the patched range
+ *	- sync cores
+ *	- replace the first byte (int3) by the first byte of
+ *	  replacing opcode
+ *	- sync cores
+ *
+ * Note: must be called under text_mutex.
+ */
+void *text_poke_bp(void *addr, const void *opcode, size_t len, void *handler)
+{
+	struct text_poke_loc tp = {
+		.addr = addr,
+		.handler = handler,
+		.len = len,
+	};
+
+	if (WARN_ON_ONCE(len > POKE_MAX_OPCODE_SIZE))
+		return NULL;
+	memcpy(tp.opcode, opcode, len);
+
+	text_poke_bp_batch(&tp, 1);
 
 	return addr;
 }
@@ -385,6 +385,36 @@ int arch_prepare_optimized_kprobe(struct optimized_kprobe *op,
 	return 0;
 }
 
+/*
+ * Sites queued for one text_poke_bp_batch(), so that a whole optimizer
+ * round costs a handful of cross-CPU syncs rather than three per probe.
+ * Protected by text_mutex.
+ */
+#define OPTPROBE_BATCH_MAX	(PAGE_SIZE / sizeof(struct text_poke_loc))
+static struct text_poke_loc optprobe_batch[OPTPROBE_BATCH_MAX];
+static unsigned int optprobe_batch_nr;
+
+static void optprobe_batch_add(struct optimized_kprobe *op, const u8 *insn)
+{
+	struct text_poke_loc *tp = &optprobe_batch[optprobe_batch_nr++];
+
+	tp->addr = op->kp.addr;
+	tp->handler = op->optinsn.insn;
+	tp->len = RELATIVEJUMP_SIZE;
+	memcpy(tp->opcode, insn, RELATIVEJUMP_SIZE);
+
+	if (optprobe_batch_nr == OPTPROBE_BATCH_MAX) {
+		text_poke_bp_batch(optprobe_batch, optprobe_batch_nr);
+		optprobe_batch_nr = 0;
+	}
+}
+
+static void optprobe_batch_flush(void)
+{
+	text_poke_bp_batch(optprobe_batch, optprobe_batch_nr);
+	optprobe_batch_nr = 0;
+}
+
 /*
  * Replace breakpoints (int3) with relative jumps.
  * Caller must call with locking kprobe_mutex and text_mutex.
@@ -407,11 +437,19 @@ void arch_optimize_kprobes(struct list_head *oplist)
 		insn_buf[0] = RELATIVEJUMP_OPCODE;
 		*(s32 *)(&insn_buf[1]) = rel;
 
-		text_poke_bp(op->kp.addr, insn_buf, RELATIVEJUMP_SIZE,
-			     op->optinsn.insn);
+		optprobe_batch_add(op, insn_buf);
 
 		list_del_init(&op->list);
 	}
+
+	optprobe_batch_flush();
+}
+
+static void unoptimize_insn(struct optimized_kprobe *op, u8 *insn_buf)
+{
+	/* Set int3 to first byte for kprobes */
+	insn_buf[0] = BREAKPOINT_INSTRUCTION;
+	memcpy(insn_buf + 1, op->optinsn.copied_insn, RELATIVE_ADDR_SIZE);
 }
 
 /* Replace a relative jump with a breakpoint (int3).  */
@@ -419,9 +457,7 @@ void arch_unoptimize_kprobe(struct optimized_kprobe *op)
 {
 	u8 insn_buf[RELATIVEJUMP_SIZE];
 
-	/* Set int3 to first byte for kprobes */
-	insn_buf[0] = BREAKPOINT_INSTRUCTION;
-	memcpy(insn_buf + 1, op->optinsn.copied_insn, RELATIVE_ADDR_SIZE);
+	unoptimize_insn(op, insn_buf);
 	text_poke_bp(op->kp.addr, insn_buf, RELATIVEJUMP_SIZE,
 		     op->optinsn.insn);
 }
@@ -434,11 +470,15 @@ extern void arch_unoptimize_kprobes(struct list_head *oplist,
 				    struct list_head *done_list)
 {
 	struct optimized_kprobe *op, *tmp;
+	u8 insn_buf[RELATIVEJUMP_SIZE];
 
 	list_for_each_entry_safe(op, tmp, oplist, list) {
-		arch_unoptimize_kprobe(op);
+		unoptimize_insn(op, insn_buf);
+		optprobe_batch_add(op, insn_buf);
 		list_move(&op->list, done_list);
 	}
+
+	optprobe_batch_flush();
 }
 
 int setup_detour_execution(struct kprobe *p, struct pt_regs *regs, int reenter)
@@ -1365,6 +1365,25 @@ __do_page_fault(struct pt_regs *regs, unsigned long error_code,
 	if (error_code & PF_INSTR)
 		flags |= FAULT_FLAG_INSTRUCTION;
 
+	/*
+	 * Try the fault without mmap_sem first. Anything it can't handle,
+	 * including errors, comes back as VM_FAULT_RETRY and is redone
+	 * below the regular way.
+	 *
+	 * It only checks the vma flags, not error_code: a read or an
+	 * instruction fetch on a present pte (PF_PROT without PF_WRITE) is
+	 * always an access_error(), e.g. executing from an NX page, and
+	 * must get its SIGSEGV below rather than be refaulted for ever.
+	 */
+	if ((error_code & PF_USER) && !(error_code & PF_PK) &&
+	    (!(error_code & PF_PROT) || (error_code & PF_WRITE))) {
+		fault = handle_speculative_fault(mm, address, flags);
+		if (fault != VM_FAULT_RETRY) {
+			major |= fault & VM_FAULT_MAJOR;
+			goto done;
+		}
+	}
+
 	/*
 	 * When running in the kernel we expect faults to occur only to
 	 * addresses in user space.  All other faults represent errors in
@@ -1474,6 +1493,7 @@ good_area:
 		return;
 	}
 
+done:
 	/*
 	 * Major/minor page fault accounting. If any of the events
 	 * returned VM_FAULT_MAJOR, we account it as a major fault.
@@ -256,6 +256,9 @@ static int gup_pmd_range(pud_t pud, unsigned long addr, unsigned long end,
 			if (!gup_huge_pmd(pmd, addr, next, write, pages, nr))
 				return 0;
 		} else {
+			/* Tables shared by fork are write protected */
+			if (write && pmd_table_shared(pmd))
+				return 0;
 			if (!gup_pte_range(pmd, addr, next, write, pages, nr))
 				return 0;
 		}
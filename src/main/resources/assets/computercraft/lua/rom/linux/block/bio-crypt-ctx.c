@@ -0,0 +1,168 @@
+/*
+ * bio-crypt-ctx.c - inline encryption contexts of bios
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ */
+
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/blk-crypto.h>
+#include <linux/export.h>
+#include <linux/init.h>
+#include <linux/keyslot-manager.h>
+#include <linux/mempool.h>
+#include <linux/slab.h>
+
+static int num_prealloc_crypt_ctxs = 128;
+static struct kmem_cache *bio_crypt_ctx_cache;
+static mempool_t *bio_crypt_ctx_pool;
+
+/**
+ * bio_crypt_set_ctx - attach an inline encryption context to a bio
+ * @bio:	bio to attach the context to
+ * @key:	key to en/decrypt the bio's data with, must outlive the bio
+ * @dun:	data unit number of the first data unit of the bio
+ * @gfp_mask:	allocation flags
+ *
+ * Description: @bio is en/decrypted with @key on submission, either by the
+ * device it is submitted to or by the crypto API fallback. The data of @bio
+ * has to be aligned to the data unit size of @key.
+ */
+int bio_crypt_set_ctx(struct bio *bio, const struct blk_crypto_key *key,
+		      u64 dun, gfp_t gfp_mask)
+{
+	struct bio_crypt_ctx *bc;
+
+	bc = mempool_alloc(bio_crypt_ctx_pool, gfp_mask);
+	if (!bc)
+		return -ENOMEM;
+
+	bc->bc_key = key;
+	bc->bc_dun = dun;
+	bc->bc_keyslot = -1;
+	bc->bc_ksm = NULL;
+
+	bio->bi_crypt_context = bc;
+	return 0;
+}
+EXPORT_SYMBOL_GPL(bio_crypt_set_ctx);
+
+static void bio_crypt_ctx_release_keyslot(struct bio_crypt_ctx *bc)
+{
+	keyslot_manager_put_slot(bc->bc_ksm, bc->bc_keyslot);
+	bc->bc_ksm = NULL;
+	bc->bc_keyslot = -1;
+}
+
+void bio_crypt_free_ctx(struct bio *bio)
+{
+	struct bio_crypt_ctx *bc = bio->bi_crypt_context;
+
+	if (!bc)
+		return;
+
+	if (bc->bc_keyslot >= 0)
+		bio_crypt_ctx_release_keyslot(bc);
+	mempool_free(bc, bio_crypt_ctx_pool);
+	bio->bi_crypt_context = NULL;
+}
+
+/*
+ * The clone takes its own reference to the keyslot of @src, if it holds
+ * one, so that either bio may complete first.
+ */
+int bio_crypt_clone(struct bio *dst, struct bio *src, gfp_t gfp_mask)
+{
+	if (!bio_has_crypt_ctx(src))
+		return 0;
+
+	dst->bi_crypt_context = mempool_alloc(bio_crypt_ctx_pool, gfp_mask);
+	if (!dst->bi_crypt_context)
+		return -ENOMEM;
+
+	*dst->bi_crypt_context = *src->bi_crypt_context;
+
+	if (dst->bi_crypt_context->bc_keyslot >= 0)
+		keyslot_manager_get_slot(dst->bi_crypt_context->bc_ksm,
+					 dst->bi_crypt_context->bc_keyslot);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(bio_crypt_clone);
+
+/*
+ * @bytes is expected to be a multiple of the data unit size; a bio split in
+ * the middle of a data unit cannot be en/decrypted on its own anyway.
+ */
+void bio_crypt_advance(struct bio *bio, unsigned int bytes)
+{
+	struct bio_crypt_ctx *bc = bio->bi_crypt_context;
+
+	if (!bc)
+		return;
+
+	bc->bc_dun += bytes >> bc->bc_key->data_unit_size_bits;
+}
+
+/* The keyslot is only needed while the bio is in flight */
+void bio_crypt_endio(struct bio *bio)
+{
+	struct bio_crypt_ctx *bc = bio->bi_crypt_context;
+
+	if (bc && bc->bc_keyslot >= 0)
+		bio_crypt_ctx_release_keyslot(bc);
+}
+
+/*
+ * Checks that two bios can share a request: either both are unencrypted,
+ * or both use the same key.
+ */
+bool bio_crypt_ctx_compatible(struct bio *b_1, struct bio *b_2)
+{
+	struct bio_crypt_ctx *bc1 = b_1->bi_crypt_context;
+	struct bio_crypt_ctx *bc2 = b_2->bi_crypt_context;
+
+	if (!bc1 || !bc2)
+		return !bc1 && !bc2;
+
+	return bc1->bc_key == bc2->bc_key;
+}
+
+/*
+ * Checks that @b_2 can be appended to the @b1_bytes long run of data starting
+ * at @b_1: same key and keyslot, and @b_2 starts at the data unit right after
+ * the end of that run.
+ */
+bool bio_crypt_ctx_mergeable(struct bio *b_1, unsigned int b1_bytes,
+			     struct bio *b_2)
+{
+	struct bio_crypt_ctx *bc1 = b_1->bi_crypt_context;
+	struct bio_crypt_ctx *bc2 = b_2->bi_crypt_context;
+
+	if (!bio_crypt_ctx_compatible(b_1, b_2))
+		return false;
+	if (!bc1)
+		return true;
+
+	if (bc1->bc_keyslot != bc2->bc_keyslot || bc1->bc_ksm != bc2->bc_ksm)
+		return false;
+
+	return bc1->bc_dun + (b1_bytes >> bc1->bc_key->data_unit_size_bits) ==
+		bc2->bc_dun;
+}
+
+static int __init bio_crypt_ctx_init(void)
+{
+	bio_crypt_ctx_cache = KMEM_CACHE(bio_crypt_ctx, 0);
+	if (!bio_crypt_ctx_cache)
+		panic("Failed to allocate mem for bio crypt ctxs\n");
+
+	bio_crypt_ctx_pool = mempool_create_slab_pool(num_prealloc_crypt_ctxs,
+						      bio_crypt_ctx_cache);
+	if (!bio_crypt_ctx_pool)
+		panic("Failed to allocate mem for bio crypt ctx pool\n");
+
+	return 0;
+}
+subsys_initcall(bio_crypt_ctx_init);
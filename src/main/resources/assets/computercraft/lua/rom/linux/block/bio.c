@@ -19,6 +19,7 @@
 #include <linux/swap.h>
 #include <linux/bio.h>
 #include <linux/blkdev.h>
+#include <linux/blk-crypto.h>
 #include <linux/uio.h>
 #include <linux/iocontext.h>
 #include <linux/slab.h>
@@ -246,6 +247,71 @@ static void __bio_free(struct bio *bio)
 
 	if (bio_integrity(bio))
 		bio_integrity_free(bio);
+
+	bio_crypt_free_ctx(bio);
+}
+
+/*
+ * Per cpu bio caches: the number of freed bios a cpu may hold on to, and how
+ * many to give back to the mempool once it has too many.
+ */
+#define ALLOC_CACHE_MAX		256
+#define ALLOC_CACHE_SLACK	64
+
+static void bio_alloc_cache_prune(struct bio_set *bs, struct bio_list *list,
+				  unsigned int *nr, unsigned int nr_keep)
+{
+	struct bio *bio;
+
+	while (*nr > nr_keep && (bio = bio_list_pop(list))) {
+		mempool_free((void *)bio - bs->front_pad, bs->bio_pool);
+		(*nr)--;
+	}
+}
+
+static struct bio *bio_alloc_percpu_cache(struct bio_set *bs)
+{
+	struct bio_alloc_cache *cache;
+	struct bio *bio;
+
+	cache = per_cpu_ptr(bs->cache, get_cpu());
+	if (bio_list_empty(&cache->free_list) && cache->nr_irq) {
+		local_irq_disable();
+		bio_list_merge(&cache->free_list, &cache->free_list_irq);
+		bio_list_init(&cache->free_list_irq);
+		cache->nr += cache->nr_irq;
+		cache->nr_irq = 0;
+		local_irq_enable();
+	}
+	bio = bio_list_pop(&cache->free_list);
+	if (bio)
+		cache->nr--;
+	put_cpu();
+
+	return bio;
+}
+
+static void bio_put_percpu_cache(struct bio_set *bs, struct bio *bio)
+{
+	struct bio_alloc_cache *cache;
+	unsigned long flags;
+
+	cache = per_cpu_ptr(bs->cache, get_cpu());
+	if (in_task()) {
+		bio_list_add_head(&cache->free_list, bio);
+		if (++cache->nr > ALLOC_CACHE_MAX)
+			bio_alloc_cache_prune(bs, &cache->free_list, &cache->nr,
+					      ALLOC_CACHE_MAX - ALLOC_CACHE_SLACK);
+	} else {
+		local_irq_save(flags);
+		bio_list_add_head(&cache->free_list_irq, bio);
+		if (++cache->nr_irq > ALLOC_CACHE_MAX)
+			bio_alloc_cache_prune(bs, &cache->free_list_irq,
+					      &cache->nr_irq,
+					      ALLOC_CACHE_MAX - ALLOC_CACHE_SLACK);
+		local_irq_restore(flags);
+	}
+	put_cpu();
 }
 
 static void bio_free(struct bio *bio)
@@ -258,6 +324,11 @@ static void bio_free(struct bio *bio)
 	if (bs) {
 		bvec_free(bs->bvec_pool, bio->bi_io_vec, BVEC_POOL_IDX(bio));
 
+		if (bio_flagged(bio, BIO_PERCPU_CACHE)) {
+			bio_put_percpu_cache(bs, bio);
+			return;
+		}
+
 		/*
 		 * If we have front padding, adjust the bio pointer before freeing
 		 */
@@ -425,6 +496,9 @@ static void punt_bios_to_rescuer(struct bio_set *bs)
  *   generic_make_request() should be avoided - instead, use bio_set's front_pad
  *   for per bio allocations.
  *
+ *   If @bs has a per cpu cache, bios that fit their vecs inline are taken
+ *   from and freed to that cache when possible.
+ *
  *   RETURNS:
  *   Pointer to new bio on success, NULL on failure.
  */
@@ -451,6 +525,17 @@ struct bio *bio_alloc_bioset(gfp_t gfp_mask, unsigned int nr_iovecs,
 		/* should not use nobvec bioset for nr_iovecs > 0 */
 		if (WARN_ON_ONCE(!bs->bvec_pool && nr_iovecs > 0))
 			return NULL;
+
+		if (bs->cache && nr_iovecs <= BIO_INLINE_VECS && in_task()) {
+			bio = bio_alloc_percpu_cache(bs);
+			if (bio) {
+				bio_init(bio, nr_iovecs ? bio->bi_inline_vecs :
+					 NULL, nr_iovecs);
+				bio_set_flag(bio, BIO_PERCPU_CACHE);
+				bio->bi_pool = bs;
+				return bio;
+			}
+		}
 		/*
 		 * generic_make_request() converts recursion to iteration; this
 		 * means if we're running beneath it, any bios we allocate and
@@ -512,6 +597,9 @@ struct bio *bio_alloc_bioset(gfp_t gfp_mask, unsigned int nr_iovecs,
 		bvl = bio->bi_inline_vecs;
 	}
 
+	if (bs && bs->cache && nr_iovecs <= inline_vecs)
+		bio_set_flag(bio, BIO_PERCPU_CACHE);
+
 	bio->bi_pool = bs;
 	bio->bi_max_vecs = nr_iovecs;
 	bio->bi_io_vec = bvl;
@@ -618,6 +706,11 @@ struct bio *bio_clone_fast(struct bio *bio, gfp_t gfp_mask, struct bio_set *bs)
 
 	__bio_clone_fast(b, bio);
 
+	if (bio_crypt_clone(b, bio, gfp_mask) < 0) {
+		bio_put(b);
+		return NULL;
+	}
+
 	if (bio_integrity(bio)) {
 		int ret;
 
@@ -693,6 +786,11 @@ static struct bio *__bio_clone_bioset(struct bio *bio_src, gfp_t gfp_mask,
 		break;
 	}
 
+	if (bio_crypt_clone(bio, bio_src, gfp_mask) < 0) {
+		bio_put(bio);
+		return NULL;
+	}
+
 	if (bio_integrity(bio_src)) {
 		int ret;
 
@@ -995,6 +1093,7 @@ void bio_advance(struct bio *bio, unsigned bytes)
 	if (bio_integrity(bio))
 		bio_integrity_advance(bio, bytes);
 
+	bio_crypt_advance(bio, bytes);
 	bio_advance_iter(bio, &bio->bi_iter, bytes);
 }
 EXPORT_SYMBOL(bio_advance);
@@ -1858,6 +1957,7 @@ again:
 	}
 
 	blk_throtl_bio_endio(bio);
+	bio_crypt_endio(bio);
 	if (bio->bi_end_io)
 		bio->bi_end_io(bio);
 }
@@ -1938,11 +2038,31 @@ mempool_t *biovec_create_pool(int pool_entries)
 	return mempool_create_slab_pool(pool_entries, bp->slab);
 }
 
+static void bio_alloc_cache_destroy(struct bio_set *bs)
+{
+	int cpu;
+
+	if (!bs->cache)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		struct bio_alloc_cache *cache = per_cpu_ptr(bs->cache, cpu);
+
+		bio_alloc_cache_prune(bs, &cache->free_list, &cache->nr, 0);
+		bio_alloc_cache_prune(bs, &cache->free_list_irq,
+				      &cache->nr_irq, 0);
+	}
+	free_percpu(bs->cache);
+	bs->cache = NULL;
+}
+
 void bioset_free(struct bio_set *bs)
 {
 	if (bs->rescue_workqueue)
 		destroy_workqueue(bs->rescue_workqueue);
 
+	bio_alloc_cache_destroy(bs);
+
 	if (bs->bio_pool)
 		mempool_destroy(bs->bio_pool);
 
@@ -2033,6 +2153,24 @@ struct bio_set *bioset_create_nobvec(unsigned int pool_size, unsigned int front_
 }
 EXPORT_SYMBOL(bioset_create_nobvec);
 
+/**
+ * bioset_enable_percpu_cache - let a bio_set keep freed bios per cpu
+ * @bs:		bio_set to enable the cache for
+ *
+ * Description:
+ *    Bios that fit their vecs inline are then freed to a per cpu list, and
+ *    allocated from it again on the same cpu, instead of going through the
+ *    mempool each time.  Meant for bio_sets that see a lot of small I/O.
+ */
+int bioset_enable_percpu_cache(struct bio_set *bs)
+{
+	bs->cache = alloc_percpu(struct bio_alloc_cache);
+	if (!bs->cache)
+		return -ENOMEM;
+	return 0;
+}
+EXPORT_SYMBOL(bioset_enable_percpu_cache);
+
 #ifdef CONFIG_BLK_CGROUP
 
 /**
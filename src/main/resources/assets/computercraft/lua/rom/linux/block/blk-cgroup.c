@@ -1160,6 +1160,11 @@ int blkcg_init_queue(struct request_queue *q)
 	q->root_rl.blkg = blkg;
 
 	ret = blk_throtl_init(q);
+	if (!ret) {
+		ret = blk_iocost_init(q);
+		if (ret)
+			blk_throtl_exit(q);
+	}
 	if (ret) {
 		spin_lock_irq(q->queue_lock);
 		blkg_destroy_all(q);
@@ -1200,6 +1205,7 @@ void blkcg_exit_queue(struct request_queue *q)
 	blkg_destroy_all(q);
 	spin_unlock_irq(q->queue_lock);
 
+	blk_iocost_exit(q);
 	blk_throtl_exit(q);
 }
 
@@ -16,6 +16,7 @@
 #include <linux/backing-dev.h>
 #include <linux/bio.h>
 #include <linux/blkdev.h>
+#include <linux/blk-crypto.h>
 #include <linux/blk-mq.h>
 #include <linux/highmem.h>
 #include <linux/mm.h>
@@ -2020,6 +2021,9 @@ blk_qc_t generic_make_request(struct bio *bio)
 	if (!generic_make_request_checks(bio))
 		goto out;
 
+	if (!blk_crypto_submit_bio(&bio))
+		goto out;
+
 	/*
 	 * We only want one ->make_request_fn to be active at a time, else
 	 * stack usage with stacked devices could be a problem.  So use
@@ -2724,7 +2728,7 @@ void blk_finish_request(struct request *req, int error)
 	struct request_queue *q = req->q;
 
 	if (req->rq_flags & RQF_STATS)
-		blk_stat_add(req);
+		blk_stat_add(req, ktime_get_ns());
 
 	if (req->rq_flags & RQF_QUEUED)
 		blk_queue_end_tag(q, req);
@@ -3110,6 +3114,22 @@ EXPORT_SYMBOL(kblockd_schedule_delayed_work_on);
  *   this kind of deadlock.
  */
 void blk_start_plug(struct blk_plug *plug)
+{
+	blk_start_plug_nr_ios(plug, 1);
+}
+EXPORT_SYMBOL(blk_start_plug);
+
+/**
+ * blk_start_plug_nr_ios - initialize blk_plug for a known number of I/Os
+ * @plug:	The &struct blk_plug that needs to be initialized
+ * @nr_ios:	Number of requests the caller expects to submit under @plug
+ *
+ * Description:
+ *   Like blk_start_plug(), but when @nr_ios is larger than one, blk-mq
+ *   allocates driver tags for that many requests at once on the first
+ *   allocation, and hands them out for the rest of the plug.
+ */
+void blk_start_plug_nr_ios(struct blk_plug *plug, unsigned short nr_ios)
 {
 	struct task_struct *tsk = current;
 
@@ -3122,13 +3142,16 @@ void blk_start_plug(struct blk_plug *plug)
 	INIT_LIST_HEAD(&plug->list);
 	INIT_LIST_HEAD(&plug->mq_list);
 	INIT_LIST_HEAD(&plug->cb_list);
+	plug->tag_hctx = NULL;
+	plug->tag_mask = 0;
+	plug->nr_ios = nr_ios;
 	/*
 	 * Store ordering should not be needed here, since a potential
 	 * preempt will imply a full memory barrier
 	 */
 	tsk->plug = plug;
 }
-EXPORT_SYMBOL(blk_start_plug);
+EXPORT_SYMBOL(blk_start_plug_nr_ios);
 
 static int plug_rq_cmp(void *priv, struct list_head *a, struct list_head *b)
 {
@@ -3210,6 +3233,9 @@ void blk_flush_plug_list(struct blk_plug *plug, bool from_schedule)
 
 	flush_plug_callbacks(plug, from_schedule);
 
+	if (plug->tag_hctx)
+		blk_mq_plug_put_tags(plug);
+
 	if (!list_empty(&plug->mq_list))
 		blk_mq_flush_plug_list(plug, from_schedule);
 
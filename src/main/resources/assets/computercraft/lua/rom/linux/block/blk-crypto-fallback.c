@@ -0,0 +1,493 @@
+/*
+ * blk-crypto-fallback.c - crypto API fallback for inline encryption
+ *
+ * Handles bios with a crypt context for queues without (suitable) inline
+ * encryption hardware. Keys are programmed into the keyslots of a keyslot
+ * manager of our own, each slot keeping a crypto API tfm per mode, so the
+ * expensive key setup is done once per key rather than once per bio.
+ *
+ * Writes are encrypted into bounce pages, and a clone of the bio pointing at
+ * those is what gets submitted. Reads are submitted as they are and decrypted
+ * in place from a workqueue once they complete.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ */
+
+#define pr_fmt(fmt) "blk-crypto-fallback: " fmt
+
+#include <crypto/skcipher.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/blk-crypto.h>
+#include <linux/completion.h>
+#include <linux/init.h>
+#include <linux/keyslot-manager.h>
+#include <linux/mempool.h>
+#include <linux/module.h>
+#include <linux/random.h>
+#include <linux/scatterlist.h>
+#include <linux/sched/mm.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
+
+#include "blk-crypto-internal.h"
+
+static unsigned int num_prealloc_bounce_pg = 32;
+module_param(num_prealloc_bounce_pg, uint, 0);
+MODULE_PARM_DESC(num_prealloc_bounce_pg,
+		 "Number of preallocated bounce pages for the blk-crypto crypto API fallback");
+
+static unsigned int blk_crypto_num_keyslots = 100;
+module_param_named(num_keyslots, blk_crypto_num_keyslots, uint, 0);
+MODULE_PARM_DESC(num_keyslots,
+		 "Number of keyslots for the blk-crypto crypto API fallback");
+
+static unsigned int num_prealloc_fallback_crypt_ctxs = 128;
+module_param(num_prealloc_fallback_crypt_ctxs, uint, 0);
+MODULE_PARM_DESC(num_prealloc_fallback_crypt_ctxs,
+		 "Number of preallocated bio fallback crypto contexts for blk-crypto to use during crypto API fallback");
+
+/* State of a read in flight, restored before it is completed for real */
+struct bio_fallback_crypt_ctx {
+	struct bio_crypt_ctx *crypt_ctx;
+	struct bvec_iter crypt_iter;
+	bio_end_io_t *bi_end_io_orig;
+	void *bi_private_orig;
+	struct bio *bio;
+	struct work_struct work;
+};
+
+struct blk_crypto_keyslot {
+	struct crypto_skcipher *tfms[BLK_ENCRYPTION_MODE_MAX];
+};
+
+struct blk_crypto_fallback_result {
+	struct completion completion;
+	int err;
+};
+
+union blk_crypto_iv {
+	__le64 dun[BLK_CRYPTO_MAX_IV_SIZE / sizeof(__le64)];
+	u8 bytes[BLK_CRYPTO_MAX_IV_SIZE];
+};
+
+static struct keyslot_manager *blk_crypto_ksm;
+static struct blk_crypto_keyslot *blk_crypto_keyslots;
+static struct workqueue_struct *blk_crypto_wq;
+static mempool_t *blk_crypto_bounce_page_pool;
+static struct bio_set *blk_crypto_bio_set;
+static struct kmem_cache *bio_fallback_crypt_ctx_cache;
+static mempool_t *bio_fallback_crypt_ctx_pool;
+
+/*
+ * Evicted slots are keyed with this rather than left with the old key, so
+ * that the old key does not linger in the tfm.
+ */
+static u8 blank_key[BLK_CRYPTO_MAX_KEY_SIZE];
+
+static int blk_crypto_keyslot_program(struct keyslot_manager *ksm,
+				      const struct blk_crypto_key *key,
+				      unsigned int slot)
+{
+	struct blk_crypto_keyslot *slotp = &blk_crypto_keyslots[slot];
+	const enum blk_crypto_mode_num mode_num = key->crypto_mode;
+	struct crypto_skcipher *tfm = slotp->tfms[mode_num];
+	unsigned int noio_flag;
+
+	if (!tfm) {
+		/* We may be called from the I/O path */
+		noio_flag = memalloc_noio_save();
+		tfm = crypto_alloc_skcipher(blk_crypto_modes[mode_num].cipher_str,
+					    0, 0);
+		memalloc_noio_restore(noio_flag);
+		if (IS_ERR(tfm))
+			return PTR_ERR(tfm);
+		slotp->tfms[mode_num] = tfm;
+	}
+
+	return crypto_skcipher_setkey(tfm, key->raw, key->size);
+}
+
+static int blk_crypto_keyslot_evict(struct keyslot_manager *ksm,
+				    const struct blk_crypto_key *key,
+				    unsigned int slot)
+{
+	struct blk_crypto_keyslot *slotp = &blk_crypto_keyslots[slot];
+	struct crypto_skcipher *tfm = slotp->tfms[key->crypto_mode];
+
+	if (!tfm)
+		return 0;
+
+	WARN_ON(crypto_skcipher_setkey(tfm, blank_key, key->size));
+	return 0;
+}
+
+static const struct keyslot_mgmt_ll_ops blk_crypto_ksm_ll_ops = {
+	.keyslot_program	= blk_crypto_keyslot_program,
+	.keyslot_evict		= blk_crypto_keyslot_evict,
+};
+
+static void blk_crypto_fallback_done(struct crypto_async_request *req,
+				     int err)
+{
+	struct blk_crypto_fallback_result *res = req->data;
+
+	if (err == -EINPROGRESS)
+		return;
+
+	res->err = err;
+	complete(&res->completion);
+}
+
+static int blk_crypto_fallback_wait(int err,
+				    struct blk_crypto_fallback_result *res)
+{
+	if (err == -EINPROGRESS || err == -EBUSY) {
+		wait_for_completion(&res->completion);
+		reinit_completion(&res->completion);
+		err = res->err;
+	}
+	return err;
+}
+
+static struct skcipher_request *
+blk_crypto_alloc_cipher_req(struct bio_crypt_ctx *bc, int slot,
+			    struct blk_crypto_fallback_result *res)
+{
+	const struct blk_crypto_keyslot *slotp = &blk_crypto_keyslots[slot];
+	struct skcipher_request *ciph_req;
+
+	ciph_req = skcipher_request_alloc(slotp->tfms[bc->bc_key->crypto_mode],
+					  GFP_NOIO);
+	if (!ciph_req)
+		return NULL;
+
+	init_completion(&res->completion);
+	skcipher_request_set_callback(ciph_req,
+				      CRYPTO_TFM_REQ_MAY_BACKLOG |
+				      CRYPTO_TFM_REQ_MAY_SLEEP,
+				      blk_crypto_fallback_done, res);
+	return ciph_req;
+}
+
+static void blk_crypto_set_iv(union blk_crypto_iv *iv, u64 dun)
+{
+	memset(iv, 0, sizeof(*iv));
+	iv->dun[0] = cpu_to_le64(dun);
+}
+
+static void blk_crypto_encrypt_endio(struct bio *enc_bio)
+{
+	struct bio *src_bio = enc_bio->bi_private;
+	struct bio_vec *bv;
+	int i;
+
+	bio_for_each_segment_all(bv, enc_bio, i)
+		mempool_free(bv->bv_page, blk_crypto_bounce_page_pool);
+
+	src_bio->bi_error = enc_bio->bi_error;
+	bio_put(enc_bio);
+	bio_endio(src_bio);
+}
+
+/*
+ * Replaces *@bio_ptr by a clone whose pages hold the encrypted data. The
+ * source bio is completed when the clone is.
+ */
+static bool blk_crypto_encrypt_bio(struct bio **bio_ptr)
+{
+	struct bio *src_bio = *bio_ptr;
+	struct bio_crypt_ctx *bc = src_bio->bi_crypt_context;
+	const unsigned int data_unit_size = bc->bc_key->data_unit_size;
+	struct blk_crypto_fallback_result res;
+	struct skcipher_request *ciph_req;
+	struct scatterlist src, dst;
+	union blk_crypto_iv iv;
+	struct bio_vec *enc_bvec;
+	struct bio *enc_bio;
+	u64 dun = bc->bc_dun;
+	unsigned int j;
+	int slot, i;
+	int err;
+
+	enc_bio = bio_clone_bioset(src_bio, GFP_NOIO, blk_crypto_bio_set);
+	if (!enc_bio) {
+		err = -ENOMEM;
+		goto out_end;
+	}
+	/* The clone carries ciphertext, lower layers must not touch it */
+	bio_crypt_free_ctx(enc_bio);
+
+	slot = keyslot_manager_get_slot_for_key(blk_crypto_ksm, bc->bc_key);
+	if (slot < 0) {
+		err = slot;
+		goto out_put_enc_bio;
+	}
+
+	ciph_req = blk_crypto_alloc_cipher_req(bc, slot, &res);
+	if (!ciph_req) {
+		err = -ENOMEM;
+		goto out_release_keyslot;
+	}
+
+	sg_init_table(&src, 1);
+	sg_init_table(&dst, 1);
+	skcipher_request_set_crypt(ciph_req, &src, &dst, data_unit_size,
+				   iv.bytes);
+
+	bio_for_each_segment_all(enc_bvec, enc_bio, i) {
+		struct page *plaintext_page = enc_bvec->bv_page;
+		struct page *ciphertext_page =
+			mempool_alloc(blk_crypto_bounce_page_pool, GFP_NOIO);
+
+		enc_bvec->bv_page = ciphertext_page;
+
+		for (j = 0; j < enc_bvec->bv_len; j += data_unit_size) {
+			blk_crypto_set_iv(&iv, dun);
+			sg_set_page(&src, plaintext_page, data_unit_size,
+				    enc_bvec->bv_offset + j);
+			sg_set_page(&dst, ciphertext_page, data_unit_size,
+				    enc_bvec->bv_offset + j);
+
+			err = blk_crypto_fallback_wait(
+					crypto_skcipher_encrypt(ciph_req), &res);
+			if (err) {
+				i++;
+				goto out_free_bounce_pages;
+			}
+			dun++;
+		}
+	}
+
+	enc_bio->bi_private = src_bio;
+	enc_bio->bi_end_io = blk_crypto_encrypt_endio;
+	*bio_ptr = enc_bio;
+
+	skcipher_request_free(ciph_req);
+	keyslot_manager_put_slot(blk_crypto_ksm, slot);
+	return true;
+
+out_free_bounce_pages:
+	while (i > 0)
+		mempool_free(enc_bio->bi_io_vec[--i].bv_page,
+			     blk_crypto_bounce_page_pool);
+	skcipher_request_free(ciph_req);
+out_release_keyslot:
+	keyslot_manager_put_slot(blk_crypto_ksm, slot);
+out_put_enc_bio:
+	bio_put(enc_bio);
+out_end:
+	src_bio->bi_error = err;
+	bio_endio(src_bio);
+	return false;
+}
+
+static void blk_crypto_decrypt_bio(struct work_struct *work)
+{
+	struct bio_fallback_crypt_ctx *f_ctx =
+		container_of(work, struct bio_fallback_crypt_ctx, work);
+	struct bio *bio = f_ctx->bio;
+	struct bio_crypt_ctx *bc = f_ctx->crypt_ctx;
+	const unsigned int data_unit_size = bc->bc_key->data_unit_size;
+	struct blk_crypto_fallback_result res;
+	struct skcipher_request *ciph_req;
+	struct scatterlist sg;
+	union blk_crypto_iv iv;
+	struct bvec_iter iter;
+	struct bio_vec bv;
+	u64 dun = bc->bc_dun;
+	unsigned int i;
+	int slot;
+	int err;
+
+	slot = keyslot_manager_get_slot_for_key(blk_crypto_ksm, bc->bc_key);
+	if (slot < 0) {
+		err = slot;
+		goto out_restore;
+	}
+
+	ciph_req = blk_crypto_alloc_cipher_req(bc, slot, &res);
+	if (!ciph_req) {
+		err = -ENOMEM;
+		goto out_release_keyslot;
+	}
+
+	sg_init_table(&sg, 1);
+	skcipher_request_set_crypt(ciph_req, &sg, &sg, data_unit_size,
+				   iv.bytes);
+
+	err = 0;
+	__bio_for_each_segment(bv, bio, iter, f_ctx->crypt_iter) {
+		for (i = 0; i < bv.bv_len; i += data_unit_size) {
+			blk_crypto_set_iv(&iv, dun);
+			sg_set_page(&sg, bv.bv_page, data_unit_size,
+				    bv.bv_offset + i);
+
+			err = blk_crypto_fallback_wait(
+					crypto_skcipher_decrypt(ciph_req), &res);
+			if (err)
+				goto out_free_req;
+			dun++;
+		}
+	}
+
+out_free_req:
+	skcipher_request_free(ciph_req);
+out_release_keyslot:
+	keyslot_manager_put_slot(blk_crypto_ksm, slot);
+out_restore:
+	if (err)
+		bio->bi_error = err;
+	bio->bi_crypt_context = f_ctx->crypt_ctx;
+	bio->bi_end_io = f_ctx->bi_end_io_orig;
+	bio->bi_private = f_ctx->bi_private_orig;
+	mempool_free(f_ctx, bio_fallback_crypt_ctx_pool);
+	bio_endio(bio);
+}
+
+static void blk_crypto_decrypt_endio(struct bio *bio)
+{
+	struct bio_fallback_crypt_ctx *f_ctx = bio->bi_private;
+
+	if (bio->bi_error) {
+		bio->bi_crypt_context = f_ctx->crypt_ctx;
+		bio->bi_end_io = f_ctx->bi_end_io_orig;
+		bio->bi_private = f_ctx->bi_private_orig;
+		mempool_free(f_ctx, bio_fallback_crypt_ctx_pool);
+		bio_endio(bio);
+		return;
+	}
+
+	INIT_WORK(&f_ctx->work, blk_crypto_decrypt_bio);
+	f_ctx->bio = bio;
+	queue_work(blk_crypto_wq, &f_ctx->work);
+}
+
+/*
+ * The crypt context is taken off the bio while it is in flight, so that
+ * stacked devices below do not try to decrypt it a second time.
+ */
+static bool blk_crypto_queue_decrypt_bio(struct bio *bio)
+{
+	struct bio_fallback_crypt_ctx *f_ctx;
+
+	f_ctx = mempool_alloc(bio_fallback_crypt_ctx_pool, GFP_NOIO);
+	f_ctx->crypt_ctx = bio->bi_crypt_context;
+	f_ctx->crypt_iter = bio->bi_iter;
+	f_ctx->bi_end_io_orig = bio->bi_end_io;
+	f_ctx->bi_private_orig = bio->bi_private;
+
+	bio->bi_crypt_context = NULL;
+	bio->bi_private = f_ctx;
+	bio->bi_end_io = blk_crypto_decrypt_endio;
+	return true;
+}
+
+/**
+ * blk_crypto_fallback_submit_bio - en/decrypt a bio with the crypto API
+ * @bio_ptr: pointer to the bio being submitted
+ *
+ * Description: Writes are encrypted right away and *@bio_ptr is replaced by
+ * the bio of bounce pages, reads are set up to be decrypted on completion.
+ *
+ * Returns true if *@bio_ptr should be submitted, false if it was completed
+ * with an error.
+ */
+bool blk_crypto_fallback_submit_bio(struct bio **bio_ptr)
+{
+	struct bio *bio = *bio_ptr;
+
+	if (!blk_crypto_ksm) {
+		pr_warn_once("not initialized; failing request\n");
+		bio->bi_error = -EIO;
+		bio_endio(bio);
+		return false;
+	}
+
+	if (bio_data_dir(bio) == WRITE)
+		return blk_crypto_encrypt_bio(bio_ptr);
+
+	return blk_crypto_queue_decrypt_bio(bio);
+}
+
+int blk_crypto_fallback_evict_key(const struct blk_crypto_key *key)
+{
+	if (!blk_crypto_ksm)
+		return 0;
+	return keyslot_manager_evict_key(blk_crypto_ksm, key);
+}
+
+static int __init blk_crypto_fallback_init(void)
+{
+	unsigned int crypto_mode_supported[BLK_ENCRYPTION_MODE_MAX];
+	struct keyslot_manager *ksm;
+	int i;
+
+	get_random_bytes(blank_key, BLK_CRYPTO_MAX_KEY_SIZE);
+
+	blk_crypto_bio_set = bioset_create(num_prealloc_bounce_pg, 0);
+	if (!blk_crypto_bio_set)
+		goto out;
+
+	/* Any power of 2 data unit size will do */
+	crypto_mode_supported[BLK_ENCRYPTION_MODE_INVALID] = 0;
+	for (i = BLK_ENCRYPTION_MODE_INVALID + 1;
+	     i < BLK_ENCRYPTION_MODE_MAX; i++)
+		crypto_mode_supported[i] = 0xFFFFFFFF;
+
+	ksm = keyslot_manager_create(blk_crypto_num_keyslots,
+				     &blk_crypto_ksm_ll_ops,
+				     crypto_mode_supported, NULL);
+	if (!ksm)
+		goto out_free_bio_set;
+
+	blk_crypto_wq = alloc_workqueue("blk_crypto_wq",
+					WQ_UNBOUND | WQ_HIGHPRI |
+					WQ_MEM_RECLAIM, num_online_cpus());
+	if (!blk_crypto_wq)
+		goto out_free_ksm;
+
+	blk_crypto_keyslots = kcalloc(blk_crypto_num_keyslots,
+				      sizeof(blk_crypto_keyslots[0]),
+				      GFP_KERNEL);
+	if (!blk_crypto_keyslots)
+		goto out_free_wq;
+
+	blk_crypto_bounce_page_pool =
+		mempool_create_page_pool(num_prealloc_bounce_pg, 0);
+	if (!blk_crypto_bounce_page_pool)
+		goto out_free_keyslots;
+
+	bio_fallback_crypt_ctx_cache = KMEM_CACHE(bio_fallback_crypt_ctx, 0);
+	if (!bio_fallback_crypt_ctx_cache)
+		goto out_free_page_pool;
+
+	bio_fallback_crypt_ctx_pool =
+		mempool_create_slab_pool(num_prealloc_fallback_crypt_ctxs,
+					 bio_fallback_crypt_ctx_cache);
+	if (!bio_fallback_crypt_ctx_pool)
+		goto out_free_ctx_cache;
+
+	/* Publish last, submission checks it to see if we are usable */
+	blk_crypto_ksm = ksm;
+	return 0;
+
+out_free_ctx_cache:
+	kmem_cache_destroy(bio_fallback_crypt_ctx_cache);
+out_free_page_pool:
+	mempool_destroy(blk_crypto_bounce_page_pool);
+out_free_keyslots:
+	kfree(blk_crypto_keyslots);
+out_free_wq:
+	destroy_workqueue(blk_crypto_wq);
+out_free_ksm:
+	keyslot_manager_destroy(ksm);
+out_free_bio_set:
+	bioset_free(blk_crypto_bio_set);
+out:
+	pr_err("failed to initialize\n");
+	return -ENOMEM;
+}
+subsys_initcall(blk_crypto_fallback_init);
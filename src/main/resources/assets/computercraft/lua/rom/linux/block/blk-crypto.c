@@ -0,0 +1,176 @@
+/*
+ * blk-crypto.c - inline encryption of bios
+ *
+ * Bios with a crypt context are en/decrypted by the device they are
+ * submitted to when its queue has a keyslot manager supporting the key's
+ * mode and data unit size. Otherwise they are handed to the crypto API
+ * fallback, which encrypts writes into bounce pages before submission and
+ * decrypts reads in place on completion.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ */
+
+#define pr_fmt(fmt) "blk-crypto: " fmt
+
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/blk-crypto.h>
+#include <linux/export.h>
+#include <linux/jhash.h>
+#include <linux/keyslot-manager.h>
+#include <linux/log2.h>
+#include <linux/string.h>
+
+#include "blk-crypto-internal.h"
+
+const struct blk_crypto_mode blk_crypto_modes[] = {
+	[BLK_ENCRYPTION_MODE_AES_256_XTS] = {
+		.cipher_str = "xts(aes)",
+		.keysize = 64,
+		.ivsize = 16,
+	},
+};
+
+/*
+ * The fallback and most hardware can only handle data that does not straddle
+ * data units.
+ */
+static bool bio_crypt_check_alignment(struct bio *bio)
+{
+	const unsigned int data_unit_size =
+		bio->bi_crypt_context->bc_key->data_unit_size;
+	struct bvec_iter iter;
+	struct bio_vec bv;
+
+	bio_for_each_segment(bv, bio, iter) {
+		if (!IS_ALIGNED(bv.bv_len | bv.bv_offset, data_unit_size))
+			return false;
+	}
+	return true;
+}
+
+/**
+ * blk_crypto_submit_bio - prepare a bio with a crypt context for submission
+ * @bio_ptr: pointer to the bio being submitted
+ *
+ * Description: Called by generic_make_request() for every bio. If the queue
+ * of the bio supports its key, a keyslot programmed with the key is attached
+ * to the bio. Otherwise the bio is handed to the crypto API fallback; for
+ * writes, *@bio_ptr is replaced by a bio of encrypted bounce pages.
+ *
+ * Returns true if *@bio_ptr should be submitted, false if it was completed
+ * with an error.
+ */
+bool blk_crypto_submit_bio(struct bio **bio_ptr)
+{
+	struct bio *bio = *bio_ptr;
+	struct bio_crypt_ctx *bc = bio->bi_crypt_context;
+	struct request_queue *q;
+	int slot;
+	int err;
+
+	if (!bc || !bio_has_data(bio))
+		return true;
+
+	q = bdev_get_queue(bio->bi_bdev);
+
+	/* Already prepared for this queue, e.g. the remainder of a split */
+	if (bc->bc_keyslot >= 0 && bc->bc_ksm == q->ksm)
+		return true;
+
+	if (!bio_crypt_check_alignment(bio)) {
+		err = -EIO;
+		goto fail;
+	}
+
+	if (!keyslot_manager_crypto_mode_supported(q->ksm,
+						   bc->bc_key->crypto_mode,
+						   bc->bc_key->data_unit_size))
+		return blk_crypto_fallback_submit_bio(bio_ptr);
+
+	/* Stacked devices hand bios down with the slot of the upper queue */
+	if (bc->bc_keyslot >= 0) {
+		keyslot_manager_put_slot(bc->bc_ksm, bc->bc_keyslot);
+		bc->bc_keyslot = -1;
+	}
+
+	slot = keyslot_manager_get_slot_for_key(q->ksm, bc->bc_key);
+	if (slot < 0) {
+		err = slot;
+		goto fail;
+	}
+	bc->bc_keyslot = slot;
+	bc->bc_ksm = q->ksm;
+	return true;
+
+fail:
+	bio->bi_error = err;
+	bio_endio(bio);
+	return false;
+}
+
+/**
+ * blk_crypto_init_key - prepare a key for use with blk-crypto
+ * @blk_key:	key to initialize
+ * @raw_key:	raw bytes of the key, of the size @crypto_mode needs
+ * @crypto_mode: encryption algorithm the key is for
+ * @data_unit_size: data unit size to use for en/decryption
+ *
+ * Returns 0 on success, -EINVAL if the mode or data unit size is invalid.
+ */
+int blk_crypto_init_key(struct blk_crypto_key *blk_key, const u8 *raw_key,
+			enum blk_crypto_mode_num crypto_mode,
+			unsigned int data_unit_size)
+{
+	const struct blk_crypto_mode *mode;
+
+	memset(blk_key, 0, sizeof(*blk_key));
+
+	if (crypto_mode <= BLK_ENCRYPTION_MODE_INVALID ||
+	    crypto_mode >= BLK_ENCRYPTION_MODE_MAX)
+		return -EINVAL;
+
+	if (!is_power_of_2(data_unit_size) || data_unit_size < 512 ||
+	    data_unit_size > PAGE_SIZE)
+		return -EINVAL;
+
+	mode = &blk_crypto_modes[crypto_mode];
+
+	blk_key->crypto_mode = crypto_mode;
+	blk_key->data_unit_size = data_unit_size;
+	blk_key->data_unit_size_bits = ilog2(data_unit_size);
+	blk_key->size = mode->keysize;
+	memcpy(blk_key->raw, raw_key, mode->keysize);
+	blk_key->hash = jhash(blk_key->raw, blk_key->size, 0);
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(blk_crypto_init_key);
+
+/**
+ * blk_crypto_evict_key - evict a key from the keyslots of a queue
+ * @q:		queue the key was used on
+ * @key:	key to evict
+ *
+ * Description: Has to be called for every queue a key was used on before
+ * the key is freed, once no more bios using it are in flight.
+ *
+ * Returns 0 on success (also if the key was not programmed), -EBUSY if the
+ * key is still in use.
+ */
+int blk_crypto_evict_key(struct request_queue *q,
+			 const struct blk_crypto_key *key)
+{
+	int err;
+
+	if (keyslot_manager_crypto_mode_supported(q->ksm, key->crypto_mode,
+						  key->data_unit_size))
+		err = keyslot_manager_evict_key(q->ksm, key);
+	else
+		err = blk_crypto_fallback_evict_key(key);
+
+	return err == -ENOKEY ? 0 : err;
+}
+EXPORT_SYMBOL_GPL(blk_crypto_evict_key);
@@ -0,0 +1,821 @@
+/*
+ * IO cost model based proportional controller
+ *
+ * Every bio is charged an estimate of the device time it occupies.  The
+ * estimate comes from a linear model of the device built from its
+ * sequential and random IOPS and its bandwidth, for reads and writes
+ * separately.  The model is either the default for the device class or
+ * the one configured through io.cost.model.
+ *
+ * The device owns a virtual time (vtime) which runs at vrate times the
+ * wall clock.  Each active cgroup owns a share of the device, hweight,
+ * which is its weight relative to its active siblings multiplied up the
+ * hierarchy.  The cost of its IOs is scaled up by the inverse of that
+ * share and added to its local vtime.  A cgroup whose local vtime runs
+ * ahead of the device's by more than a margin has its submitter put to
+ * sleep until the device catches up, so both buffered writeback and
+ * direct IO are paced by what the cgroup is entitled to, not by the
+ * bandwidth it manages to grab.
+ *
+ * vrate is adjusted once a period from the read and write completion
+ * latencies collected through blk-stat.  If a latency target set in
+ * io.cost.qos is missed, the device is considered to be overloaded by
+ * the model and vrate is lowered.  If the targets are met and some
+ * cgroup had to wait, vrate is raised.  It always stays within the
+ * configured min and max percentage.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/blkdev.h>
+#include <linux/bio.h>
+#include <linux/blk-cgroup.h>
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
+#include <linux/sched.h>
+#include "blk.h"
+#include "blk-stat.h"
+
+/* period over which latencies are sampled and vrate is adjusted */
+#define IOC_PERIOD_MSECS	50
+
+/* how far a cgroup may run ahead of the device before it has to wait */
+#define IOC_MARGIN_NSECS	(10 * NSEC_PER_MSEC)
+
+/* never put a submitter to sleep for longer than this at once */
+#define IOC_MAX_DELAY_NSECS	(250 * NSEC_PER_MSEC)
+
+/* an IO starting within this distance of the previous one is sequential */
+#define IOC_SEQ_SECTORS		128
+
+#define IOC_PAGE_SIZE		4096
+#define WEIGHT_ONE		(1 << 16)
+#define VRATE_SHIFT		16
+#define VRATE_PCT(pct)		(((u64)(pct) << VRATE_SHIFT) / 100)
+#define VRATE_MIN_PCT		1
+#define VRATE_MAX_PCT		10000
+
+enum {
+	IOC_READ,
+	IOC_WRITE,
+	IOC_NR_DIRS,
+};
+
+/* device model as configured or the device class default */
+struct ioc_params {
+	u64 bps[IOC_NR_DIRS];
+	u64 seqiops[IOC_NR_DIRS];
+	u64 randiops[IOC_NR_DIRS];
+};
+
+/* the model turned into device nsecs per page and per IO */
+struct ioc_coefs {
+	u64 page[IOC_NR_DIRS];
+	u64 seqio[IOC_NR_DIRS];
+	u64 randio[IOC_NR_DIRS];
+};
+
+/* from the measurements of a typical SATA SSD and a 7200rpm disk */
+static const struct ioc_params ioc_params_ssd = {
+	.bps		= { 488636629, 427891549 },
+	.seqiops	= { 8932, 28755 },
+	.randiops	= { 8518, 21940 },
+};
+
+static const struct ioc_params ioc_params_hdd = {
+	.bps		= { 174019176, 178075866 },
+	.seqiops	= { 41708, 42705 },
+	.randiops	= { 370, 378 },
+};
+
+struct blk_iocost {
+	struct request_queue *queue;
+	spinlock_t lock;
+	bool enabled;
+	bool user_params;
+	struct ioc_params params;
+	struct ioc_coefs coefs;
+
+	/* qos, latencies in usecs, 0 if there's no target */
+	u64 lat_target[IOC_NR_DIRS];
+	unsigned int vrate_min_pct;
+	unsigned int vrate_max_pct;
+
+	/* vtime at period_at is period_at_vtime, advancing at vrate */
+	seqcount_t vtime_seq;
+	u64 vrate;
+	u64 period_at;
+	u64 period_at_vtime;
+	u64 period;
+	bool saturated;
+
+	unsigned int hweight_gen;
+	struct list_head active_iocgs;
+	struct blk_stat_callback *cb;
+	bool cb_added;
+};
+
+/* per blkg, per device */
+struct ioc_gq {
+	struct blkg_policy_data pd;
+	struct blk_iocost *ioc;
+	unsigned int weight;
+
+	atomic64_t vtime;
+	sector_t cursor;
+
+	/* protected by ioc->lock */
+	bool active;
+	u64 active_period;
+	struct list_head active_list;
+	unsigned int hweight_gen;
+	unsigned int child_active_sum;
+	unsigned int hweight;
+};
+
+/* per cgroup */
+struct ioc_cgrp {
+	struct blkcg_policy_data cpd;
+	unsigned int dfl_weight;
+};
+
+static struct blkcg_policy blkcg_policy_iocost;
+
+static inline struct ioc_gq *pd_to_iocg(struct blkg_policy_data *pd)
+{
+	return pd ? container_of(pd, struct ioc_gq, pd) : NULL;
+}
+
+static inline struct ioc_gq *blkg_to_iocg(struct blkcg_gq *blkg)
+{
+	return pd_to_iocg(blkg_to_pd(blkg, &blkcg_policy_iocost));
+}
+
+static inline struct blkcg_gq *iocg_to_blkg(struct ioc_gq *iocg)
+{
+	return pd_to_blkg(&iocg->pd);
+}
+
+static inline struct ioc_gq *iocg_parent(struct ioc_gq *iocg)
+{
+	struct blkcg_gq *parent = iocg_to_blkg(iocg)->parent;
+
+	return parent ? blkg_to_iocg(parent) : NULL;
+}
+
+static inline struct ioc_cgrp *blkcg_to_iocc(struct blkcg *blkcg)
+{
+	return container_of(blkcg_to_cpd(blkcg, &blkcg_policy_iocost),
+			    struct ioc_cgrp, cpd);
+}
+
+static void ioc_refresh_coefs(struct blk_iocost *ioc)
+{
+	struct ioc_params *p = &ioc->params;
+	struct ioc_coefs *c = &ioc->coefs;
+	int dir;
+
+	for (dir = IOC_READ; dir < IOC_NR_DIRS; dir++) {
+		u64 seqio = div64_u64(NSEC_PER_SEC, p->seqiops[dir]);
+		u64 randio = div64_u64(NSEC_PER_SEC, p->randiops[dir]);
+
+		/* IOPS are for page sized IOs, take the transfer out */
+		c->page[dir] = div64_u64(NSEC_PER_SEC * IOC_PAGE_SIZE,
+					 p->bps[dir]);
+		c->seqio[dir] = seqio > c->page[dir] ? seqio - c->page[dir] : 0;
+		c->randio[dir] = randio > c->page[dir] ?
+				 randio - c->page[dir] : 0;
+	}
+}
+
+static u64 __ioc_vnow(struct blk_iocost *ioc, u64 now)
+{
+	return ioc->period_at_vtime +
+		mul_u64_u32_shr(max(now, ioc->period_at) - ioc->period_at,
+				ioc->vrate, VRATE_SHIFT);
+}
+
+static u64 ioc_vnow(struct blk_iocost *ioc, u64 now)
+{
+	unsigned int seq;
+	u64 vnow;
+
+	do {
+		seq = read_seqcount_begin(&ioc->vtime_seq);
+		vnow = __ioc_vnow(ioc, now);
+	} while (read_seqcount_retry(&ioc->vtime_seq, seq));
+
+	return vnow;
+}
+
+/*
+ * Recompute the share of every active iocg: the weight of each iocg on
+ * the path to the root relative to the active siblings at that level.
+ * Called with ioc->lock held.
+ */
+static void ioc_refresh_hweights(struct blk_iocost *ioc)
+{
+	unsigned int gen = ++ioc->hweight_gen;
+	struct ioc_gq *iocg, *g, *p;
+
+	list_for_each_entry(iocg, &ioc->active_iocgs, active_list)
+		for (g = iocg; g; g = iocg_parent(g))
+			g->child_active_sum = 0;
+
+	list_for_each_entry(iocg, &ioc->active_iocgs, active_list) {
+		for (g = iocg; (p = iocg_parent(g)); g = p) {
+			if (g->hweight_gen == gen)
+				break;
+			g->hweight_gen = gen;
+			p->child_active_sum += g->weight;
+		}
+	}
+
+	list_for_each_entry(iocg, &ioc->active_iocgs, active_list) {
+		u64 hweight = WEIGHT_ONE;
+
+		for (g = iocg; (p = iocg_parent(g)); g = p)
+			hweight = div_u64(hweight * g->weight,
+					  max(p->child_active_sum, 1U));
+		WRITE_ONCE(iocg->hweight, max_t(u64, hweight, 1));
+	}
+}
+
+/* Don't let an iocg bank more than the margin while it was idle */
+static void iocg_forgive_idle(struct ioc_gq *iocg, u64 vnow)
+{
+	u64 vmin = vnow - min_t(u64, vnow, IOC_MARGIN_NSECS);
+	u64 vtime = atomic64_read(&iocg->vtime);
+
+	if (vtime < vmin)
+		atomic64_cmpxchg(&iocg->vtime, vtime, vmin);
+}
+
+static void iocg_activate(struct ioc_gq *iocg, u64 now)
+{
+	struct blk_iocost *ioc = iocg->ioc;
+	unsigned long flags;
+
+	spin_lock_irqsave(&ioc->lock, flags);
+	if (!iocg->active) {
+		iocg->active = true;
+		list_add(&iocg->active_list, &ioc->active_iocgs);
+		iocg_forgive_idle(iocg, __ioc_vnow(ioc, now));
+		ioc_refresh_hweights(ioc);
+	}
+	WRITE_ONCE(iocg->active_period, ioc->period);
+
+	if (!blk_stat_is_active(ioc->cb))
+		blk_stat_activate_msecs(ioc->cb, IOC_PERIOD_MSECS);
+	spin_unlock_irqrestore(&ioc->lock, flags);
+}
+
+static u64 iocg_abs_cost(struct blk_iocost *ioc, struct ioc_gq *iocg,
+			 struct bio *bio, int dir)
+{
+	sector_t sector = bio->bi_iter.bi_sector;
+	sector_t cursor = READ_ONCE(iocg->cursor);
+	u64 pages = DIV_ROUND_UP(bio->bi_iter.bi_size, IOC_PAGE_SIZE);
+	u64 cost;
+
+	if (cursor && abs((long long)(sector - cursor)) <= IOC_SEQ_SECTORS)
+		cost = ioc->coefs.seqio[dir];
+	else
+		cost = ioc->coefs.randio[dir];
+	WRITE_ONCE(iocg->cursor, bio_end_sector(bio));
+
+	return cost + pages * ioc->coefs.page[dir];
+}
+
+/**
+ * blk_iocost_charge - charge a bio to its cgroup
+ * @q: the request_queue @bio is being issued to
+ * @blkg: the blkg @bio belongs to
+ * @bio: the bio
+ *
+ * Called under RCU from blkcg_bio_issue_check().  Returns the number of
+ * nsecs the submitter should sleep for once the RCU read lock has been
+ * dropped, see blk_iocost_delay().
+ */
+u64 blk_iocost_charge(struct request_queue *q, struct blkcg_gq *blkg,
+		      struct bio *bio)
+{
+	struct blk_iocost *ioc = q->iocost;
+	struct ioc_gq *iocg;
+	u64 now, vnow, vtime, cost;
+	int dir;
+
+	if (!ioc || !READ_ONCE(ioc->enabled) || !blkg)
+		return 0;
+
+	switch (bio_op(bio)) {
+	case REQ_OP_READ:
+		dir = IOC_READ;
+		break;
+	case REQ_OP_WRITE:
+		dir = IOC_WRITE;
+		break;
+	default:
+		return 0;
+	}
+	if (!bio->bi_iter.bi_size)
+		return 0;
+
+	iocg = blkg_to_iocg(blkg);
+	if (!iocg)
+		return 0;
+
+	now = ktime_get_ns();
+	if (READ_ONCE(iocg->active_period) != READ_ONCE(ioc->period) ||
+	    !READ_ONCE(iocg->active))
+		iocg_activate(iocg, now);
+
+	cost = div_u64(iocg_abs_cost(ioc, iocg, bio, dir) * WEIGHT_ONE,
+		       READ_ONCE(iocg->hweight));
+	vtime = atomic64_add_return(cost, &iocg->vtime);
+	vnow = ioc_vnow(ioc, now);
+
+	if (vtime <= vnow + IOC_MARGIN_NSECS)
+		return 0;
+
+	WRITE_ONCE(ioc->saturated, true);
+
+	/*
+	 * Metadata and reclaim IO, IO which must not block and IO issued
+	 * from inside another make_request_fn is charged but not delayed,
+	 * the submitter may hold resources others are waiting for.
+	 */
+	if ((bio->bi_opf & (REQ_META | REQ_NOWAIT)) || current->bio_list ||
+	    (current->flags & PF_MEMALLOC) || bio_flagged(bio, BIO_THROTTLED))
+		return 0;
+
+	return min_t(u64, div64_u64((vtime - vnow - IOC_MARGIN_NSECS) <<
+				    VRATE_SHIFT, ioc->vrate),
+		     IOC_MAX_DELAY_NSECS);
+}
+
+void blk_iocost_delay(u64 delay)
+{
+	ktime_t expires = ns_to_ktime(delay);
+
+	set_current_state(TASK_UNINTERRUPTIBLE);
+	schedule_hrtimeout(&expires, HRTIMER_MODE_REL);
+}
+
+static int ioc_stat_bucket(const struct request *rq)
+{
+	switch (req_op(rq)) {
+	case REQ_OP_READ:
+		return IOC_READ;
+	case REQ_OP_WRITE:
+		return IOC_WRITE;
+	default:
+		return -1;
+	}
+}
+
+static void ioc_timer_fn(struct blk_stat_callback *cb)
+{
+	struct blk_iocost *ioc = cb->data;
+	struct ioc_gq *iocg, *tmp;
+	u64 now, vnow, vrate;
+	bool missed = false;
+	int dir;
+
+	spin_lock_irq(&ioc->lock);
+
+	for (dir = IOC_READ; dir < IOC_NR_DIRS; dir++) {
+		if (ioc->lat_target[dir] && cb->stat[dir].nr_samples &&
+		    cb->stat[dir].mean > ioc->lat_target[dir] * NSEC_PER_USEC)
+			missed = true;
+	}
+
+	vrate = ioc->vrate;
+	if (missed)
+		vrate = max(vrate - (vrate >> 3),
+			    VRATE_PCT(ioc->vrate_min_pct));
+	else if (ioc->saturated)
+		vrate = min(vrate + (vrate >> 4),
+			    VRATE_PCT(ioc->vrate_max_pct));
+
+	now = ktime_get_ns();
+	write_seqcount_begin(&ioc->vtime_seq);
+	vnow = __ioc_vnow(ioc, now);
+	ioc->period_at = now;
+	ioc->period_at_vtime = vnow;
+	ioc->vrate = vrate;
+	write_seqcount_end(&ioc->vtime_seq);
+
+	WRITE_ONCE(ioc->period, ioc->period + 1);
+	ioc->saturated = false;
+
+	/* an iocg which issued nothing for a whole period goes idle */
+	list_for_each_entry_safe(iocg, tmp, &ioc->active_iocgs, active_list) {
+		if (iocg->active_period + 1 < ioc->period) {
+			iocg->active = false;
+			list_del_init(&iocg->active_list);
+		} else {
+			iocg_forgive_idle(iocg, vnow);
+		}
+	}
+	ioc_refresh_hweights(ioc);
+
+	if (!list_empty(&ioc->active_iocgs))
+		blk_stat_activate_msecs(cb, IOC_PERIOD_MSECS);
+
+	spin_unlock_irq(&ioc->lock);
+}
+
+static struct blkcg_policy_data *ioc_cpd_alloc(gfp_t gfp)
+{
+	struct ioc_cgrp *iocc;
+
+	iocc = kzalloc(sizeof(*iocc), gfp);
+	if (!iocc)
+		return NULL;
+	iocc->dfl_weight = CGROUP_WEIGHT_DFL;
+	return &iocc->cpd;
+}
+
+static void ioc_cpd_free(struct blkcg_policy_data *cpd)
+{
+	kfree(container_of(cpd, struct ioc_cgrp, cpd));
+}
+
+static struct blkg_policy_data *ioc_pd_alloc(gfp_t gfp, int node)
+{
+	struct ioc_gq *iocg;
+
+	iocg = kzalloc_node(sizeof(*iocg), gfp, node);
+	if (!iocg)
+		return NULL;
+
+	atomic64_set(&iocg->vtime, 0);
+	INIT_LIST_HEAD(&iocg->active_list);
+	return &iocg->pd;
+}
+
+static void ioc_pd_init(struct blkg_policy_data *pd)
+{
+	struct ioc_gq *iocg = pd_to_iocg(pd);
+	struct blkcg_gq *blkg = pd_to_blkg(pd);
+
+	iocg->ioc = blkg->q->iocost;
+	iocg->weight = blkcg_to_iocc(blkg->blkcg)->dfl_weight;
+	iocg->hweight = WEIGHT_ONE;
+}
+
+static void ioc_pd_offline(struct blkg_policy_data *pd)
+{
+	struct ioc_gq *iocg = pd_to_iocg(pd);
+	struct blk_iocost *ioc = iocg->ioc;
+	unsigned long flags;
+
+	spin_lock_irqsave(&ioc->lock, flags);
+	if (iocg->active) {
+		iocg->active = false;
+		list_del_init(&iocg->active_list);
+		ioc_refresh_hweights(ioc);
+	}
+	spin_unlock_irqrestore(&ioc->lock, flags);
+}
+
+static void ioc_pd_free(struct blkg_policy_data *pd)
+{
+	kfree(pd_to_iocg(pd));
+}
+
+static int ioc_weight_show(struct seq_file *sf, void *v)
+{
+	struct blkcg *blkcg = css_to_blkcg(seq_css(sf));
+
+	seq_printf(sf, "default %u\n", blkcg_to_iocc(blkcg)->dfl_weight);
+	return 0;
+}
+
+static ssize_t ioc_weight_write(struct kernfs_open_file *of, char *buf,
+				size_t nbytes, loff_t off)
+{
+	struct blkcg *blkcg = css_to_blkcg(of_css(of));
+	struct blkcg_gq *blkg;
+	char *endp;
+	u64 v;
+
+	buf = strim(buf);
+
+	/* "WEIGHT" or "default WEIGHT" */
+	v = simple_strtoull(buf, &endp, 0);
+	if (*endp != '\0' && sscanf(buf, "default %llu", &v) != 1)
+		return -EINVAL;
+	if (v < CGROUP_WEIGHT_MIN || v > CGROUP_WEIGHT_MAX)
+		return -ERANGE;
+
+	/* picked up by the hweights at the next period */
+	spin_lock_irq(&blkcg->lock);
+	blkcg_to_iocc(blkcg)->dfl_weight = v;
+	hlist_for_each_entry(blkg, &blkcg->blkg_list, blkcg_node) {
+		struct ioc_gq *iocg = blkg_to_iocg(blkg);
+
+		if (iocg)
+			iocg->weight = v;
+	}
+	spin_unlock_irq(&blkcg->lock);
+
+	return nbytes;
+}
+
+static u64 ioc_qos_prfill(struct seq_file *sf, struct blkg_policy_data *pd,
+			  int off)
+{
+	const char *dname = blkg_dev_name(pd->blkg);
+	struct blk_iocost *ioc = pd_to_iocg(pd)->ioc;
+
+	if (!dname || !ioc->enabled)
+		return 0;
+
+	seq_printf(sf, "%s enable=%d rlat=%llu wlat=%llu min=%u max=%u\n",
+		   dname, ioc->enabled, ioc->lat_target[IOC_READ],
+		   ioc->lat_target[IOC_WRITE], ioc->vrate_min_pct,
+		   ioc->vrate_max_pct);
+	return 0;
+}
+
+static int ioc_qos_show(struct seq_file *sf, void *v)
+{
+	blkcg_print_blkgs(sf, css_to_blkcg(seq_css(sf)), ioc_qos_prfill,
+			  &blkcg_policy_iocost, 0, false);
+	return 0;
+}
+
+static ssize_t ioc_qos_write(struct kernfs_open_file *of, char *buf,
+			     size_t nbytes, loff_t off)
+{
+	struct blkcg *blkcg = css_to_blkcg(of_css(of));
+	struct blkg_conf_ctx ctx;
+	struct blk_iocost *ioc;
+	u64 lat[IOC_NR_DIRS];
+	u64 vmin, vmax, enable;
+	int ret;
+
+	ret = blkg_conf_prep(blkcg, &blkcg_policy_iocost, buf, &ctx);
+	if (ret)
+		return ret;
+
+	ioc = ctx.blkg->q->iocost;
+	enable = ioc->enabled;
+	lat[IOC_READ] = ioc->lat_target[IOC_READ];
+	lat[IOC_WRITE] = ioc->lat_target[IOC_WRITE];
+	vmin = ioc->vrate_min_pct;
+	vmax = ioc->vrate_max_pct;
+
+	while (true) {
+		char tok[27];	/* rlat=18446744073709551616 */
+		char *p;
+		u64 val;
+		int len;
+
+		if (sscanf(ctx.body, "%26s%n", tok, &len) != 1)
+			break;
+		if (tok[0] == '\0')
+			break;
+		ctx.body += len;
+
+		ret = -EINVAL;
+		p = tok;
+		strsep(&p, "=");
+		if (!p || sscanf(p, "%llu", &val) != 1)
+			goto out_finish;
+
+		if (!strcmp(tok, "enable"))
+			enable = !!val;
+		else if (!strcmp(tok, "rlat"))
+			lat[IOC_READ] = val;
+		else if (!strcmp(tok, "wlat"))
+			lat[IOC_WRITE] = val;
+		else if (!strcmp(tok, "min"))
+			vmin = val;
+		else if (!strcmp(tok, "max"))
+			vmax = val;
+		else
+			goto out_finish;
+	}
+
+	ret = -ERANGE;
+	if (vmin < VRATE_MIN_PCT || vmax > VRATE_MAX_PCT || vmin > vmax)
+		goto out_finish;
+
+	spin_lock(&ioc->lock);
+	ioc->lat_target[IOC_READ] = lat[IOC_READ];
+	ioc->lat_target[IOC_WRITE] = lat[IOC_WRITE];
+	ioc->vrate_min_pct = vmin;
+	ioc->vrate_max_pct = vmax;
+
+	write_seqcount_begin(&ioc->vtime_seq);
+	ioc->period_at_vtime = __ioc_vnow(ioc, ktime_get_ns());
+	ioc->period_at = ktime_get_ns();
+	ioc->vrate = clamp(ioc->vrate, VRATE_PCT(vmin), VRATE_PCT(vmax));
+	write_seqcount_end(&ioc->vtime_seq);
+
+	if (!ioc->user_params) {
+		ioc->params = blk_queue_nonrot(ioc->queue) ? ioc_params_ssd :
+							     ioc_params_hdd;
+		ioc_refresh_coefs(ioc);
+	}
+	if (enable && !ioc->cb_added) {
+		blk_stat_add_callback(ioc->queue, ioc->cb);
+		ioc->cb_added = true;
+	}
+	WRITE_ONCE(ioc->enabled, enable);
+	spin_unlock(&ioc->lock);
+	ret = 0;
+out_finish:
+	blkg_conf_finish(&ctx);
+	return ret ?: nbytes;
+}
+
+static u64 ioc_model_prfill(struct seq_file *sf, struct blkg_policy_data *pd,
+			    int off)
+{
+	const char *dname = blkg_dev_name(pd->blkg);
+	struct ioc_params *p = &pd_to_iocg(pd)->ioc->params;
+
+	if (!dname || !p->bps[IOC_READ])
+		return 0;
+
+	seq_printf(sf, "%s rbps=%llu rseqiops=%llu rrandiops=%llu "
+		   "wbps=%llu wseqiops=%llu wrandiops=%llu\n", dname,
+		   p->bps[IOC_READ], p->seqiops[IOC_READ],
+		   p->randiops[IOC_READ], p->bps[IOC_WRITE],
+		   p->seqiops[IOC_WRITE], p->randiops[IOC_WRITE]);
+	return 0;
+}
+
+static int ioc_model_show(struct seq_file *sf, void *v)
+{
+	blkcg_print_blkgs(sf, css_to_blkcg(seq_css(sf)), ioc_model_prfill,
+			  &blkcg_policy_iocost, 0, false);
+	return 0;
+}
+
+static ssize_t ioc_model_write(struct kernfs_open_file *of, char *buf,
+			       size_t nbytes, loff_t off)
+{
+	struct blkcg *blkcg = css_to_blkcg(of_css(of));
+	struct blkg_conf_ctx ctx;
+	struct blk_iocost *ioc;
+	struct ioc_params p;
+	int ret;
+
+	ret = blkg_conf_prep(blkcg, &blkcg_policy_iocost, buf, &ctx);
+	if (ret)
+		return ret;
+
+	ioc = ctx.blkg->q->iocost;
+	p = ioc->params;
+	if (!p.bps[IOC_READ])
+		p = blk_queue_nonrot(ioc->queue) ? ioc_params_ssd :
+						   ioc_params_hdd;
+
+	while (true) {
+		char tok[32];	/* wrandiops=18446744073709551616 */
+		char *s;
+		u64 val;
+		int len;
+
+		if (sscanf(ctx.body, "%31s%n", tok, &len) != 1)
+			break;
+		if (tok[0] == '\0')
+			break;
+		ctx.body += len;
+
+		ret = -EINVAL;
+		s = tok;
+		strsep(&s, "=");
+		if (!s || sscanf(s, "%llu", &val) != 1)
+			goto out_finish;
+
+		ret = -ERANGE;
+		if (!val)
+			goto out_finish;
+
+		ret = -EINVAL;
+		if (!strcmp(tok, "rbps"))
+			p.bps[IOC_READ] = val;
+		else if (!strcmp(tok, "rseqiops"))
+			p.seqiops[IOC_READ] = val;
+		else if (!strcmp(tok, "rrandiops"))
+			p.randiops[IOC_READ] = val;
+		else if (!strcmp(tok, "wbps"))
+			p.bps[IOC_WRITE] = val;
+		else if (!strcmp(tok, "wseqiops"))
+			p.seqiops[IOC_WRITE] = val;
+		else if (!strcmp(tok, "wrandiops"))
+			p.randiops[IOC_WRITE] = val;
+		else
+			goto out_finish;
+	}
+
+	spin_lock(&ioc->lock);
+	ioc->params = p;
+	ioc->user_params = true;
+	ioc_refresh_coefs(ioc);
+	spin_unlock(&ioc->lock);
+	ret = 0;
+out_finish:
+	blkg_conf_finish(&ctx);
+	return ret ?: nbytes;
+}
+
+static struct cftype ioc_files[] = {
+	{
+		.name = "cost.weight",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.seq_show = ioc_weight_show,
+		.write = ioc_weight_write,
+	},
+	{
+		.name = "cost.qos",
+		.flags = CFTYPE_ONLY_ON_ROOT,
+		.seq_show = ioc_qos_show,
+		.write = ioc_qos_write,
+	},
+	{
+		.name = "cost.model",
+		.flags = CFTYPE_ONLY_ON_ROOT,
+		.seq_show = ioc_model_show,
+		.write = ioc_model_write,
+	},
+	{ }	/* terminate */
+};
+
+static struct blkcg_policy blkcg_policy_iocost = {
+	.dfl_cftypes		= ioc_files,
+
+	.cpd_alloc_fn		= ioc_cpd_alloc,
+	.cpd_free_fn		= ioc_cpd_free,
+
+	.pd_alloc_fn		= ioc_pd_alloc,
+	.pd_init_fn		= ioc_pd_init,
+	.pd_offline_fn		= ioc_pd_offline,
+	.pd_free_fn		= ioc_pd_free,
+};
+
+int blk_iocost_init(struct request_queue *q)
+{
+	struct blk_iocost *ioc;
+	int ret;
+
+	ioc = kzalloc_node(sizeof(*ioc), GFP_KERNEL, q->node);
+	if (!ioc)
+		return -ENOMEM;
+
+	ioc->cb = blk_stat_alloc_callback(ioc_timer_fn, ioc_stat_bucket,
+					  IOC_NR_DIRS, ioc);
+	if (!ioc->cb) {
+		kfree(ioc);
+		return -ENOMEM;
+	}
+
+	ioc->queue = q;
+	spin_lock_init(&ioc->lock);
+	seqcount_init(&ioc->vtime_seq);
+	INIT_LIST_HEAD(&ioc->active_iocgs);
+	ioc->vrate_min_pct = 100;
+	ioc->vrate_max_pct = 100;
+	ioc->vrate = VRATE_PCT(100);
+	ioc->period_at = ktime_get_ns();
+
+	q->iocost = ioc;
+
+	/* activate policy, it stays disabled until io.cost.qos says so */
+	ret = blkcg_activate_policy(q, &blkcg_policy_iocost);
+	if (ret) {
+		q->iocost = NULL;
+		blk_stat_free_callback(ioc->cb);
+		kfree(ioc);
+	}
+	return ret;
+}
+
+void blk_iocost_exit(struct request_queue *q)
+{
+	struct blk_iocost *ioc = q->iocost;
+
+	if (!ioc)
+		return;
+
+	blkcg_deactivate_policy(q, &blkcg_policy_iocost);
+	if (ioc->cb_added)
+		blk_stat_remove_callback(q, ioc->cb);
+	blk_stat_free_callback(ioc->cb);
+	kfree(ioc);
+	q->iocost = NULL;
+}
+
+static int __init ioc_init(void)
+{
+	return blkcg_policy_register(&blkcg_policy_iocost);
+}
+
+module_init(ioc_init);
@@ -34,7 +34,7 @@ static int get_first_sibling(unsigned int cpu)
 int blk_mq_map_queues(struct blk_mq_tag_set *set)
 {
 	unsigned int *map = set->mq_map;
-	unsigned int nr_queues = set->nr_hw_queues;
+	unsigned int nr_queues = set->nr_hw_queues - set->nr_poll_queues;
 	const struct cpumask *online_mask = cpu_online_mask;
 	unsigned int i, nr_cpus, nr_uniq_cpus, queue, first_sibling;
 	cpumask_var_t cpus;
@@ -89,6 +89,33 @@ int blk_mq_map_queues(struct blk_mq_tag_set *set)
 }
 EXPORT_SYMBOL_GPL(blk_mq_map_queues);
 
+/*
+ * Poll queues are the last nr_poll_queues hardware queues of the set.
+ * They have no interrupt and hence no affinity to follow, so just
+ * spread the online CPUs evenly over them.
+ */
+int blk_mq_map_poll_queues(struct blk_mq_tag_set *set)
+{
+	unsigned int first = set->nr_hw_queues - set->nr_poll_queues;
+	unsigned int nr_cpus = num_online_cpus();
+	unsigned int i, queue = 0;
+
+	if (!set->nr_poll_queues)
+		return 0;
+
+	for_each_possible_cpu(i) {
+		if (!cpu_online(i)) {
+			set->mq_poll_map[i] = first;
+			continue;
+		}
+		set->mq_poll_map[i] = first +
+			cpu_to_queue_index(nr_cpus, set->nr_poll_queues,
+					   queue++);
+	}
+
+	return 0;
+}
+
 /*
  * We have no quick way of doing reverse lookups. This is only used at
  * queue init time, so runtime isn't important.
@@ -283,6 +283,7 @@ static const char *const cmd_flag_name[] = {
 	[__REQ_PREFLUSH]		= "PREFLUSH",
 	[__REQ_RAHEAD]			= "RAHEAD",
 	[__REQ_BACKGROUND]		= "BACKGROUND",
+	[__REQ_HIPRI]			= "HIPRI",
 	[__REQ_NR_BITS]			= "NR_BITS",
 };
 
@@ -306,6 +307,7 @@ static const char *const rqf_name[] = {
 	[ilog2((__force u32)RQF_HASHED)]		= "HASHED",
 	[ilog2((__force u32)RQF_STATS)]			= "STATS",
 	[ilog2((__force u32)RQF_SPECIAL_PAYLOAD)]	= "SPECIAL_PAYLOAD",
+	[ilog2((__force u32)RQF_MQ_POLL)]		= "MQ_POLL",
 };
 
 static int blk_mq_debugfs_rq_show(struct seq_file *m, void *v)
@@ -532,10 +534,18 @@ static const struct file_operations hctx_sched_tags_bitmap_fops = {
 static int hctx_io_poll_show(struct seq_file *m, void *v)
 {
 	struct blk_mq_hw_ctx *hctx = m->private;
+	int bucket;
 
 	seq_printf(m, "considered=%lu\n", hctx->poll_considered);
 	seq_printf(m, "invoked=%lu\n", hctx->poll_invoked);
 	seq_printf(m, "success=%lu\n", hctx->poll_success);
+
+	for (bucket = 0; bucket < BLK_MQ_POLL_STATS_BKTS/2; bucket++) {
+		seq_printf(m, "sleep read  (%d Bytes)=%u\n", 1 << (9+bucket),
+			   READ_ONCE(hctx->poll_sleep_nsec[2*bucket]));
+		seq_printf(m, "sleep write (%d Bytes)=%u\n", 1 << (9+bucket),
+			   READ_ONCE(hctx->poll_sleep_nsec[2*bucket+1]));
+	}
 	return 0;
 }
 
@@ -79,14 +79,24 @@ struct request *blk_mq_sched_get_request(struct request_queue *q,
 	data->q = q;
 	if (likely(!data->ctx))
 		data->ctx = blk_mq_get_ctx(q);
-	if (likely(!data->hctx))
-		data->hctx = blk_mq_map_queue(q, data->ctx->cpu);
+	if (likely(!data->hctx)) {
+		data->hctx = blk_mq_map_queue_flags(q, data->flags,
+						    data->ctx->cpu);
+		if ((data->flags & BLK_MQ_REQ_POLL) &&
+		    unlikely(!data->hctx || !data->hctx->tags)) {
+			data->flags &= ~BLK_MQ_REQ_POLL;
+			data->hctx = blk_mq_map_queue(q, data->ctx->cpu);
+		}
+	}
 
 	/*
 	 * For a reserved tag, allocate a normal request since we might
 	 * have driver dependencies on the value of the internal tag.
+	 * Requests for a poll queue skip the scheduler, nothing but the
+	 * submitter runs that queue and it has no software queues to
+	 * schedule from.
 	 */
-	if (e && !(data->flags & BLK_MQ_REQ_RESERVED)) {
+	if (e && !(data->flags & (BLK_MQ_REQ_RESERVED | BLK_MQ_REQ_POLL))) {
 		data->flags |= BLK_MQ_REQ_INTERNAL;
 
 		/*
@@ -106,7 +116,8 @@ struct request *blk_mq_sched_get_request(struct request_queue *q,
 	if (rq) {
 		if (!op_is_flush(op)) {
 			rq->elv.icq = NULL;
-			if (e && e->type->icq_cache)
+			if (e && e->type->icq_cache &&
+			    !(rq->rq_flags & RQF_MQ_POLL))
 				blk_mq_sched_assign_ioc(q, rq, bio);
 		}
 		data->hctx->queued++;
@@ -140,7 +151,8 @@ void blk_mq_sched_dispatch_requests(struct blk_mq_hw_ctx *hctx)
 {
 	struct request_queue *q = hctx->queue;
 	struct elevator_queue *e = q->elevator;
-	const bool has_sched_dispatch = e && e->type->ops.mq.dispatch_request;
+	const bool has_sched_dispatch = e && e->type->ops.mq.dispatch_request &&
+					!blk_mq_hctx_is_poll(hctx);
 	bool did_work = false;
 	LIST_HEAD(rq_list);
 
@@ -357,13 +369,24 @@ void blk_mq_sched_insert_request(struct request *rq, bool at_head,
 	struct request_queue *q = rq->q;
 	struct elevator_queue *e = q->elevator;
 	struct blk_mq_ctx *ctx = rq->mq_ctx;
-	struct blk_mq_hw_ctx *hctx = blk_mq_map_queue(q, ctx->cpu);
+	struct blk_mq_hw_ctx *hctx = blk_mq_rq_hctx(rq);
 
 	if (rq->tag == -1 && op_is_flush(rq->cmd_flags)) {
 		blk_mq_sched_insert_flush(hctx, rq, can_block);
 		return;
 	}
 
+	/* Poll queues have no software queues, and always a driver tag */
+	if (rq->rq_flags & RQF_MQ_POLL) {
+		spin_lock(&hctx->lock);
+		if (at_head)
+			list_add(&rq->queuelist, &hctx->dispatch);
+		else
+			list_add_tail(&rq->queuelist, &hctx->dispatch);
+		spin_unlock(&hctx->lock);
+		goto run;
+	}
+
 	if (e && blk_mq_sched_bypass_insert(hctx, rq))
 		goto run;
 
@@ -109,7 +109,7 @@ static inline bool blk_mq_sched_has_work(struct blk_mq_hw_ctx *hctx)
 {
 	struct elevator_queue *e = hctx->queue->elevator;
 
-	if (e && e->type->ops.mq.has_work)
+	if (e && e->type->ops.mq.has_work && !blk_mq_hctx_is_poll(hctx))
 		return e->type->ops.mq.has_work(hctx);
 
 	return false;
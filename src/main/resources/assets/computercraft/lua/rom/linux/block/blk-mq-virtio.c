@@ -27,7 +27,7 @@
  * interrupt vetors as @set has queues.  It will then queuery the vector
  * corresponding to each queue for it's affinity mask and built queue mapping
  * that maps a queue to the CPUs that have irq affinity for the corresponding
- * vector.
+ * vector.  Poll queues have no vector and are left to blk_mq_map_poll_queues().
  */
 int blk_mq_virtio_map_queues(struct blk_mq_tag_set *set,
 		struct virtio_device *vdev, int first_vec)
@@ -38,7 +38,8 @@ int blk_mq_virtio_map_queues(struct blk_mq_tag_set *set,
 	if (!vdev->config->get_vq_affinity)
 		goto fallback;
 
-	for (queue = 0; queue < set->nr_hw_queues; queue++) {
+	for (queue = 0; queue < set->nr_hw_queues - set->nr_poll_queues;
+	     queue++) {
 		mask = vdev->config->get_vq_affinity(vdev, first_vec + queue);
 		if (!mask)
 			goto fallback;
@@ -41,6 +41,7 @@ static LIST_HEAD(all_q_list);
 
 static void blk_mq_poll_stats_start(struct request_queue *q);
 static void blk_mq_poll_stats_fn(struct blk_stat_callback *cb);
+static void blk_mq_poll_hist_add(struct request *rq, u64 now);
 
 static int blk_mq_poll_stats_bkt(const struct request *rq)
 {
@@ -243,13 +244,77 @@ void blk_mq_rq_ctx_init(struct request_queue *q, struct blk_mq_ctx *ctx,
 }
 EXPORT_SYMBOL_GPL(blk_mq_rq_ctx_init);
 
+/*
+ * A plug started with blk_start_plug_nr_ios() allocates the driver tags for
+ * its requests in one go, and keeps them in the plug until they are used or
+ * the plug is flushed.  The cached tags hold a queue reference, so the tag
+ * maps can't go away under them.
+ */
+static unsigned int blk_mq_plug_get_tag(struct blk_mq_alloc_data *data)
+{
+	struct blk_plug *plug = current->plug;
+	unsigned long mask;
+	unsigned int tag;
+
+	if (!plug || (data->flags & (BLK_MQ_REQ_RESERVED | BLK_MQ_REQ_INTERNAL)) ||
+	    data->shallow_depth)
+		return BLK_MQ_TAG_FAIL;
+
+	if (plug->tag_hctx != data->hctx) {
+		if (plug->nr_ios <= 1)
+			return BLK_MQ_TAG_FAIL;
+		if (plug->tag_hctx)
+			blk_mq_plug_put_tags(plug);
+
+		mask = blk_mq_get_tags(data, min_t(int, plug->nr_ios,
+						   BITS_PER_LONG),
+				       &plug->tag_offset);
+		if (!mask)
+			return BLK_MQ_TAG_FAIL;
+
+		percpu_ref_get(&data->q->q_usage_counter);
+		plug->tag_hctx = data->hctx;
+		plug->tag_mask = mask;
+		/* Don't allocate another batch for I/O that was just covered */
+		plug->nr_ios -= min_t(int, plug->nr_ios - 1, hweight_long(mask));
+	}
+
+	tag = __ffs(plug->tag_mask);
+	plug->tag_mask &= ~(1UL << tag);
+	tag += plug->tag_offset;
+	if (!plug->tag_mask) {
+		plug->tag_hctx = NULL;
+		percpu_ref_put(&data->q->q_usage_counter);
+	}
+
+	return tag;
+}
+
+/* Give the tags left in the plug back, called when it is flushed */
+void blk_mq_plug_put_tags(struct blk_plug *plug)
+{
+	struct blk_mq_hw_ctx *hctx = plug->tag_hctx;
+	int tags[BITS_PER_LONG], nr_tags = 0;
+	unsigned long bit;
+
+	for_each_set_bit(bit, &plug->tag_mask, BITS_PER_LONG)
+		tags[nr_tags++] = plug->tag_offset + bit;
+	blk_mq_put_tags(hctx->tags, tags, nr_tags);
+
+	plug->tag_hctx = NULL;
+	plug->tag_mask = 0;
+	percpu_ref_put(&hctx->queue->q_usage_counter);
+}
+
 struct request *__blk_mq_alloc_request(struct blk_mq_alloc_data *data,
 				       unsigned int op)
 {
 	struct request *rq;
 	unsigned int tag;
 
-	tag = blk_mq_get_tag(data);
+	tag = blk_mq_plug_get_tag(data);
+	if (tag == BLK_MQ_TAG_FAIL)
+		tag = blk_mq_get_tag(data);
 	if (tag != BLK_MQ_TAG_FAIL) {
 		struct blk_mq_tags *tags = blk_mq_tags_from_data(data);
 
@@ -269,6 +334,8 @@ struct request *__blk_mq_alloc_request(struct blk_mq_alloc_data *data,
 		}
 
 		blk_mq_rq_ctx_init(data->q, data->ctx, rq, op);
+		if (data->flags & BLK_MQ_REQ_POLL)
+			rq->rq_flags |= RQF_MQ_POLL;
 		return rq;
 	}
 
@@ -382,7 +449,7 @@ static void blk_mq_finish_hctx_request(struct blk_mq_hw_ctx *hctx,
 
 void blk_mq_finish_request(struct request *rq)
 {
-	blk_mq_finish_hctx_request(blk_mq_map_queue(rq->q, rq->mq_ctx->cpu), rq);
+	blk_mq_finish_hctx_request(blk_mq_rq_hctx(rq), rq);
 }
 EXPORT_SYMBOL_GPL(blk_mq_finish_request);
 
@@ -422,6 +489,13 @@ static void __blk_mq_complete_request_remote(void *data)
 	rq->q->softirq_done_fn(rq);
 }
 
+static void blk_mq_stat_add(struct request *rq, u64 now)
+{
+	blk_mq_poll_stats_start(rq->q);
+	blk_stat_add(rq, now);
+	blk_mq_poll_hist_add(rq, now);
+}
+
 static void __blk_mq_complete_request(struct request *rq)
 {
 	struct blk_mq_ctx *ctx = rq->mq_ctx;
@@ -430,10 +504,8 @@ static void __blk_mq_complete_request(struct request *rq)
 
 	if (rq->internal_tag != -1)
 		blk_mq_sched_completed_request(rq);
-	if (rq->rq_flags & RQF_STATS) {
-		blk_mq_poll_stats_start(rq->q);
-		blk_stat_add(rq);
-	}
+	if (rq->rq_flags & RQF_STATS)
+		blk_mq_stat_add(rq, ktime_get_ns());
 
 	if (!test_bit(QUEUE_FLAG_SAME_COMP, &rq->q->queue_flags)) {
 		rq->q->softirq_done_fn(rq);
@@ -474,6 +546,123 @@ void blk_mq_complete_request(struct request *rq)
 }
 EXPORT_SYMBOL(blk_mq_complete_request);
 
+/*
+ * A request can be ended as part of a batch if nothing but the plain
+ * blk_mq_end_request() path would run for it, and it would run on this CPU.
+ */
+static bool blk_mq_rq_can_batch(struct request *rq)
+{
+	struct request_queue *q = rq->q;
+	struct blk_mq_ctx *ctx = rq->mq_ctx;
+	int cpu;
+
+	if (rq->internal_tag != -1 || rq->tag == -1 || rq->end_io ||
+	    blk_bidi_rq(rq) || (rq->rq_flags & RQF_ELVPRIV) ||
+	    blk_mq_tag_is_reserved(blk_mq_rq_hctx(rq)->tags, rq->tag))
+		return false;
+
+	if (!test_bit(QUEUE_FLAG_SAME_COMP, &q->queue_flags))
+		return true;
+
+	cpu = smp_processor_id();
+	if (cpu == ctx->cpu || !cpu_online(ctx->cpu))
+		return true;
+
+	return !test_bit(QUEUE_FLAG_SAME_FORCE, &q->queue_flags) &&
+		cpus_share_cache(cpu, ctx->cpu);
+}
+
+/**
+ * blk_mq_complete_request_batch - end I/O on a request as part of a batch
+ * @rq:		the request being processed, completed without error
+ * @list:	batch to add @rq to
+ *
+ * Description:
+ *	Like blk_mq_complete_request(), but if @rq can be ended on this CPU
+ *	without going through ->complete, it is added to @list instead.  The
+ *	driver then does its own per request completion work for everything
+ *	on @list, and ends them all at once with blk_mq_end_request_batch().
+ *	Must be called with preemption disabled.
+ **/
+void blk_mq_complete_request_batch(struct request *rq, struct list_head *list)
+{
+	if (unlikely(blk_should_fake_timeout(rq->q)))
+		return;
+	if (blk_mark_rq_complete(rq))
+		return;
+
+	if (blk_mq_rq_can_batch(rq))
+		list_add_tail(&rq->queuelist, list);
+	else
+		__blk_mq_complete_request(rq);
+}
+EXPORT_SYMBOL_GPL(blk_mq_complete_request_batch);
+
+#define BLK_MQ_BATCH_TAGS	32
+
+static void blk_mq_end_tag_batch(struct blk_mq_hw_ctx *hctx, int *tags,
+				 int nr_tags)
+{
+	blk_mq_put_tags(hctx->tags, tags, nr_tags);
+	blk_mq_sched_restart(hctx);
+	percpu_ref_put_many(&hctx->queue->q_usage_counter, nr_tags);
+}
+
+/**
+ * blk_mq_end_request_batch - end a batch of requests
+ * @list:	requests added by blk_mq_complete_request_batch()
+ *
+ * Description:
+ *	Fully ends every request on @list without error.  The stats are
+ *	taken with a single timestamp, and the driver tags are freed with
+ *	one bitmap update for each run of requests from the same hardware
+ *	queue.  @list is empty on return.
+ **/
+void blk_mq_end_request_batch(struct list_head *list)
+{
+	struct blk_mq_hw_ctx *cur_hctx = NULL;
+	int tags[BLK_MQ_BATCH_TAGS], nr_tags = 0;
+	struct request *rq, *next;
+	u64 now = 0;
+
+	list_for_each_entry_safe(rq, next, list, queuelist) {
+		struct blk_mq_hw_ctx *hctx = blk_mq_rq_hctx(rq);
+
+		list_del_init(&rq->queuelist);
+
+		if (rq->rq_flags & RQF_STATS) {
+			if (!now)
+				now = ktime_get_ns();
+			blk_mq_stat_add(rq, now);
+		}
+
+		if (blk_update_request(rq, 0, blk_rq_bytes(rq)))
+			BUG();
+		blk_account_io_done(rq);
+
+		/* The rest of __blk_mq_finish_request(), minus the tag */
+		rq->mq_ctx->rq_completed[rq_is_sync(rq)]++;
+		if (rq->rq_flags & RQF_MQ_INFLIGHT)
+			atomic_dec(&hctx->nr_active);
+		wbt_done(rq->q->rq_wb, &rq->issue_stat);
+		rq->rq_flags = 0;
+		clear_bit(REQ_ATOM_STARTED, &rq->atomic_flags);
+		clear_bit(REQ_ATOM_POLL_SLEPT, &rq->atomic_flags);
+
+		if (nr_tags == BLK_MQ_BATCH_TAGS ||
+		    (cur_hctx && cur_hctx != hctx)) {
+			blk_mq_end_tag_batch(cur_hctx, tags, nr_tags);
+			nr_tags = 0;
+		}
+		cur_hctx = hctx;
+		tags[nr_tags++] = rq->tag;
+	}
+
+	if (nr_tags)
+		blk_mq_end_tag_batch(cur_hctx, tags, nr_tags);
+}
+EXPORT_SYMBOL_GPL(blk_mq_end_request_batch);
+
 int blk_mq_request_started(struct request *rq)
 {
 	return test_bit(REQ_ATOM_STARTED, &rq->atomic_flags);
@@ -860,7 +1049,7 @@ bool blk_mq_get_driver_tag(struct request *rq, struct blk_mq_hw_ctx **hctx,
 {
 	struct blk_mq_alloc_data data = {
 		.q = rq->q,
-		.hctx = blk_mq_map_queue(rq->q, rq->mq_ctx->cpu),
+		.hctx = blk_mq_rq_hctx(rq),
 		.flags = wait ? 0 : BLK_MQ_REQ_NOWAIT,
 	};
 
@@ -915,7 +1104,7 @@ static void blk_mq_put_driver_tag(struct request *rq)
 	if (rq->tag == -1 || rq->internal_tag == -1)
 		return;
 
-	hctx = blk_mq_map_queue(rq->q, rq->mq_ctx->cpu);
+	hctx = blk_mq_rq_hctx(rq);
 	__blk_mq_put_driver_tag(hctx, rq);
 }
 
@@ -1524,6 +1713,17 @@ static void blk_mq_try_issue_directly(struct blk_mq_hw_ctx *hctx,
 	}
 }
 
+/*
+ * Polled bios go to the dedicated poll queues, if the driver has any. Flushes
+ * are left to the default queues, the flush machinery shares their tags.
+ */
+static bool blk_mq_poll_queue_bio(struct request_queue *q, struct bio *bio)
+{
+	return (bio->bi_opf & REQ_HIPRI) && !op_is_flush(bio->bi_opf) &&
+		q->tag_set->nr_poll_queues &&
+		test_bit(QUEUE_FLAG_POLL, &q->queue_flags);
+}
+
 static blk_qc_t blk_mq_make_request(struct request_queue *q, struct bio *bio)
 {
 	const int is_sync = op_is_sync(bio->bi_opf);
@@ -1556,6 +1756,9 @@ static blk_qc_t blk_mq_make_request(struct request_queue *q, struct bio *bio)
 
 	trace_block_getrq(q, bio, bio->bi_opf);
 
+	if (blk_mq_poll_queue_bio(q, bio))
+		data.flags |= BLK_MQ_REQ_POLL;
+
 	rq = blk_mq_sched_get_request(q, bio, bio->bi_opf, &data);
 	if (unlikely(!rq)) {
 		__wbt_done(q->rq_wb, wb_acct);
@@ -1567,7 +1770,15 @@ static blk_qc_t blk_mq_make_request(struct request_queue *q, struct bio *bio)
 	cookie = request_to_qc_t(data.hctx, rq);
 
 	plug = current->plug;
-	if (unlikely(is_flush_fua)) {
+	if (rq->rq_flags & RQF_MQ_POLL) {
+		/*
+		 * Nothing but the submitter runs a poll queue, so there is
+		 * no point in plugging or merging: issue right away.
+		 */
+		blk_mq_put_ctx(data.ctx);
+		blk_mq_bio_to_request(rq, bio);
+		blk_mq_try_issue_directly(data.hctx, rq, &cookie);
+	} else if (unlikely(is_flush_fua)) {
 		blk_mq_put_ctx(data.ctx);
 		blk_mq_bio_to_request(rq, bio);
 		if (q->elevator) {
@@ -2062,6 +2273,19 @@ static void blk_mq_map_swqueue(struct request_queue *q,
 		cpumask_set_cpu(i, hctx->cpumask);
 		ctx->index_hw = hctx->nr_ctx;
 		hctx->ctxs[hctx->nr_ctx++] = ctx;
+
+		/*
+		 * Poll queues get no software queues, their requests go
+		 * straight to the dispatch list.  A poll queue without tags
+		 * makes blk_mq_sched_get_request() fall back to the default
+		 * queue.
+		 */
+		if (set->nr_poll_queues && q->mq_poll_map[i] < q->nr_hw_queues) {
+			hctx_idx = q->mq_poll_map[i];
+			if (set->tags[hctx_idx] ||
+			    __blk_mq_alloc_rq_map(set, hctx_idx))
+				cpumask_set_cpu(i, q->queue_hw_ctx[hctx_idx]->cpumask);
+		}
 	}
 
 	mutex_unlock(&q->sysfs_lock);
@@ -2071,7 +2295,7 @@ static void blk_mq_map_swqueue(struct request_queue *q,
 		 * If no software queues are mapped to this hardware queue,
 		 * disable it and free the request entries.
 		 */
-		if (!hctx->nr_ctx) {
+		if (!hctx->nr_ctx && !blk_mq_hctx_is_poll(hctx)) {
 			/* Never unmap queue 0.  We need it as a
 			 * fallback in case of a new remap fails
 			 * allocation
@@ -2084,7 +2308,7 @@ static void blk_mq_map_swqueue(struct request_queue *q,
 		}
 
 		hctx->tags = set->tags[i];
-		WARN_ON(!hctx->tags);
+		WARN_ON(!hctx->tags && !blk_mq_hctx_is_poll(hctx));
 
 		/*
 		 * Set the map size to the number of mapped software queues.
@@ -2291,6 +2515,7 @@ struct request_queue *blk_mq_init_allocated_queue(struct blk_mq_tag_set *set,
 		goto err_percpu;
 
 	q->mq_map = set->mq_map;
+	q->mq_poll_map = set->mq_poll_map;
 
 	blk_mq_realloc_hw_ctxs(set, q);
 	if (!q->nr_hw_queues)
@@ -2509,10 +2734,16 @@ static int blk_mq_alloc_rq_maps(struct blk_mq_tag_set *set)
 
 static int blk_mq_update_queue_map(struct blk_mq_tag_set *set)
 {
+	int ret;
+
 	if (set->ops->map_queues)
-		return set->ops->map_queues(set);
+		ret = set->ops->map_queues(set);
 	else
-		return blk_mq_map_queues(set);
+		ret = blk_mq_map_queues(set);
+	if (ret)
+		return ret;
+
+	return blk_mq_map_poll_queues(set);
 }
 
 /*
@@ -2557,6 +2788,9 @@ int blk_mq_alloc_tag_set(struct blk_mq_tag_set *set)
 	 */
 	if (set->nr_hw_queues > nr_cpu_ids)
 		set->nr_hw_queues = nr_cpu_ids;
+	/* Keep at least one default queue */
+	if (set->nr_poll_queues >= set->nr_hw_queues)
+		set->nr_poll_queues = 0;
 
 	set->tags = kzalloc_node(nr_cpu_ids * sizeof(struct blk_mq_tags *),
 				 GFP_KERNEL, set->numa_node);
@@ -2569,6 +2803,11 @@ int blk_mq_alloc_tag_set(struct blk_mq_tag_set *set)
 	if (!set->mq_map)
 		goto out_free_tags;
 
+	set->mq_poll_map = kzalloc_node(sizeof(*set->mq_poll_map) * nr_cpu_ids,
+			GFP_KERNEL, set->numa_node);
+	if (!set->mq_poll_map)
+		goto out_free_mq_map;
+
 	ret = blk_mq_update_queue_map(set);
 	if (ret)
 		goto out_free_mq_map;
@@ -2583,6 +2822,8 @@ int blk_mq_alloc_tag_set(struct blk_mq_tag_set *set)
 	return 0;
 
 out_free_mq_map:
+	kfree(set->mq_poll_map);
+	set->mq_poll_map = NULL;
 	kfree(set->mq_map);
 	set->mq_map = NULL;
 out_free_tags:
@@ -2599,6 +2840,8 @@ void blk_mq_free_tag_set(struct blk_mq_tag_set *set)
 	for (i = 0; i < nr_cpu_ids; i++)
 		blk_mq_free_map_and_requests(set, i);
 
+	kfree(set->mq_poll_map);
+	set->mq_poll_map = NULL;
 	kfree(set->mq_map);
 	set->mq_map = NULL;
 
@@ -2658,9 +2901,17 @@ void blk_mq_update_nr_hw_queues(struct blk_mq_tag_set *set, int nr_hw_queues)
 		nr_hw_queues = nr_cpu_ids;
 	if (nr_hw_queues < 1 || nr_hw_queues == set->nr_hw_queues)
 		return;
+	if (set->nr_poll_queues >= nr_hw_queues)
+		set->nr_poll_queues = 0;
 
-	list_for_each_entry(q, &set->tag_list, tag_set_list)
+	/*
+	 * The poll stats window looks at the hardware queues, let it
+	 * finish before they are reallocated.
+	 */
+	list_for_each_entry(q, &set->tag_list, tag_set_list) {
 		blk_mq_freeze_queue(q);
+		blk_stat_deactivate(q->poll_cb);
+	}
 
 	set->nr_hw_queues = nr_hw_queues;
 	blk_mq_update_queue_map(set);
@@ -2697,15 +2948,101 @@ static void blk_mq_poll_stats_start(struct request_queue *q)
 	blk_stat_activate_msecs(q->poll_cb, 100);
 }
 
+/*
+ * Hybrid polling sleeps until the fastest BLK_MQ_POLL_SLEEP_PCT percent of
+ * the requests of the same size on the same hardware queue have completed in
+ * the last stats window.  That rarely oversleeps, and gets a lot closer to the
+ * completion than half the mean when completion times are tight.
+ */
+#define BLK_MQ_POLL_SLEEP_PCT		10
+#define BLK_MQ_POLL_HIST_MIN_SAMPLES	16
+
+static int blk_mq_poll_hist_bkt(u64 nsecs)
+{
+	u64 units = nsecs >> 8;
+	int order, bucket;
+
+	if (units < 4)
+		return units;
+
+	order = ilog2(units);
+	bucket = (order - 1) * 4 + ((units >> (order - 2)) & 3);
+	return min(bucket, BLK_MQ_POLL_HIST_BKTS - 1);
+}
+
+/* Lower bound of a histogram bucket, in nanoseconds */
+static unsigned int blk_mq_poll_hist_nsecs(int bucket)
+{
+	if (bucket < 4)
+		return bucket << 8;
+
+	return (4 + (bucket & 3)) << (bucket / 4 - 1) << 8;
+}
+
+static void blk_mq_poll_hist_add(struct request *rq, u64 now)
+{
+	struct request_queue *q = rq->q;
+	struct blk_mq_hw_ctx *hctx;
+	int bucket;
+
+	if (!(rq->cmd_flags & REQ_HIPRI) ||
+	    !test_bit(QUEUE_FLAG_POLL_STATS, &q->queue_flags))
+		return;
+
+	bucket = blk_mq_poll_stats_bkt(rq);
+	if (bucket < 0)
+		return;
+
+	now = __blk_stat_time(now);
+	if (now < blk_stat_time(&rq->issue_stat))
+		return;
+
+	hctx = blk_mq_rq_hctx(rq);
+	now -= blk_stat_time(&rq->issue_stat);
+	atomic_inc(&hctx->poll_hist[bucket][blk_mq_poll_hist_bkt(now)]);
+}
+
+static void blk_mq_poll_hist_update(struct blk_mq_hw_ctx *hctx, int bucket)
+{
+	unsigned int hist[BLK_MQ_POLL_HIST_BKTS];
+	unsigned int nr = 0, sum = 0;
+	int i;
+
+	for (i = 0; i < BLK_MQ_POLL_HIST_BKTS; i++) {
+		hist[i] = atomic_xchg(&hctx->poll_hist[bucket][i], 0);
+		nr += hist[i];
+	}
+
+	/* Keep the last estimate until there is enough to go on */
+	if (nr < BLK_MQ_POLL_HIST_MIN_SAMPLES)
+		return;
+
+	for (i = 0; i < BLK_MQ_POLL_HIST_BKTS - 1; i++) {
+		sum += hist[i];
+		if (sum * 100 >= nr * BLK_MQ_POLL_SLEEP_PCT)
+			break;
+	}
+
+	/* Zero means no estimate, so never store less than one bucket */
+	WRITE_ONCE(hctx->poll_sleep_nsec[bucket],
+		   blk_mq_poll_hist_nsecs(max(i, 1)));
+}
+
 static void blk_mq_poll_stats_fn(struct blk_stat_callback *cb)
 {
 	struct request_queue *q = cb->data;
-	int bucket;
+	struct blk_mq_hw_ctx *hctx;
+	int bucket, i;
 
 	for (bucket = 0; bucket < BLK_MQ_POLL_STATS_BKTS; bucket++) {
 		if (cb->stat[bucket].nr_samples)
 			q->poll_stat[bucket] = cb->stat[bucket];
 	}
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		for (bucket = 0; bucket < BLK_MQ_POLL_STATS_BKTS; bucket++)
+			blk_mq_poll_hist_update(hctx, bucket);
+	}
 }
 
 static unsigned long blk_mq_poll_nsecs(struct request_queue *q,
@@ -2723,19 +3060,17 @@ static unsigned long blk_mq_poll_nsecs(struct request_queue *q,
 		return 0;
 
 	/*
-	 * As an optimistic guess, use half of the mean service time
-	 * for this type of request. We can (and should) make this smarter.
-	 * For instance, if the completion latencies are tight, we can
-	 * get closer than just half the mean. This is especially
-	 * important on devices where the completion latencies are longer
-	 * than ~10 usec. We do use the stats for the relevant IO size
-	 * if available which does lead to better estimates.
+	 * Use the completion time histogram of this hardware queue for
+	 * this size of request, see blk_mq_poll_hist_update().  Until it
+	 * has seen enough polled requests, fall back to the optimistic
+	 * guess of half the queue wide mean service time.
 	 */
 	bucket = blk_mq_poll_stats_bkt(rq);
 	if (bucket < 0)
 		return ret;
 
-	if (q->poll_stat[bucket].nr_samples)
+	ret = READ_ONCE(hctx->poll_sleep_nsec[bucket]);
+	if (!ret && q->poll_stat[bucket].nr_samples)
 		ret = (q->poll_stat[bucket].mean + 1) / 2;
 
 	return ret;
@@ -2848,15 +3183,23 @@ bool blk_mq_poll(struct request_queue *q, blk_qc_t cookie)
 	struct blk_plug *plug;
 	struct request *rq;
 
-	if (!q->mq_ops || !q->mq_ops->poll || !blk_qc_t_valid(cookie) ||
-	    !test_bit(QUEUE_FLAG_POLL, &q->queue_flags))
+	if (!q->mq_ops || !q->mq_ops->poll || !blk_qc_t_valid(cookie))
+		return false;
+
+	hctx = q->queue_hw_ctx[blk_qc_t_to_queue_num(cookie)];
+
+	/*
+	 * A poll queue may not have a completion interrupt, so keep polling
+	 * what was queued on one even if io_poll got turned off meanwhile.
+	 */
+	if (!test_bit(QUEUE_FLAG_POLL, &q->queue_flags) &&
+	    !blk_mq_hctx_is_poll(hctx))
 		return false;
 
 	plug = current->plug;
 	if (plug)
 		blk_flush_plug_list(plug, false);
 
-	hctx = q->queue_hw_ctx[blk_qc_t_to_queue_num(cookie)];
 	if (!blk_qc_t_is_internal(cookie))
 		rq = blk_mq_tag_to_rq(hctx->tags, blk_qc_t_to_tag(cookie));
 	else {
@@ -66,6 +66,7 @@ void blk_mq_disable_hotplug(void);
  * CPU -> queue mappings
  */
 extern int blk_mq_hw_queue_to_node(unsigned int *map, unsigned int);
+extern int blk_mq_map_poll_queues(struct blk_mq_tag_set *set);
 
 static inline struct blk_mq_hw_ctx *blk_mq_map_queue(struct request_queue *q,
 		int cpu)
@@ -73,6 +74,36 @@ static inline struct blk_mq_hw_ctx *blk_mq_map_queue(struct request_queue *q,
 	return q->queue_hw_ctx[q->mq_map[cpu]];
 }
 
+static inline struct blk_mq_hw_ctx *blk_mq_map_queue_poll(struct request_queue *q,
+		int cpu)
+{
+	return q->queue_hw_ctx[q->mq_poll_map[cpu]];
+}
+
+/* Map with the BLK_MQ_REQ_* flags of an allocation */
+static inline struct blk_mq_hw_ctx *blk_mq_map_queue_flags(struct request_queue *q,
+		unsigned int flags, int cpu)
+{
+	if (flags & BLK_MQ_REQ_POLL)
+		return blk_mq_map_queue_poll(q, cpu);
+	return blk_mq_map_queue(q, cpu);
+}
+
+/* The hardware queue a request was allocated from */
+static inline struct blk_mq_hw_ctx *blk_mq_rq_hctx(struct request *rq)
+{
+	if (rq->rq_flags & RQF_MQ_POLL)
+		return blk_mq_map_queue_poll(rq->q, rq->mq_ctx->cpu);
+	return blk_mq_map_queue(rq->q, rq->mq_ctx->cpu);
+}
+
+static inline bool blk_mq_hctx_is_poll(struct blk_mq_hw_ctx *hctx)
+{
+	struct blk_mq_tag_set *set = hctx->queue->tag_set;
+
+	return hctx->queue_num >= set->nr_hw_queues - set->nr_poll_queues;
+}
+
 /*
  * sysfs helpers
  */
@@ -174,7 +205,8 @@ static inline bool blk_mq_hctx_stopped(struct blk_mq_hw_ctx *hctx)
 
 static inline bool blk_mq_hw_queue_mapped(struct blk_mq_hw_ctx *hctx)
 {
-	return hctx->nr_ctx && hctx->tags;
+	/* Poll queues have no software queues, only their dispatch list */
+	return (hctx->nr_ctx || blk_mq_hctx_is_poll(hctx)) && hctx->tags;
 }
 
 #endif
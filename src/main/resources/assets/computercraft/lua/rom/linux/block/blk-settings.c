@@ -671,6 +671,8 @@ int blk_stack_limits(struct queue_limits *t, struct queue_limits *b,
 		t->chunk_sectors = min_not_zero(t->chunk_sectors,
 						b->chunk_sectors);
 
+	t->zoned = max(t->zoned, b->zoned);
+
 	return ret;
 }
 EXPORT_SYMBOL(blk_stack_limits);
@@ -78,15 +78,15 @@ static void __blk_stat_add(struct blk_rq_stat *stat, u64 value)
 	stat->nr_batch++;
 }
 
-void blk_stat_add(struct request *rq)
+void blk_stat_add(struct request *rq, u64 now)
 {
 	struct request_queue *q = rq->q;
 	struct blk_stat_callback *cb;
 	struct blk_rq_stat *stat;
 	int bucket;
-	s64 now, value;
+	s64 value;
 
-	now = __blk_stat_time(ktime_to_ns(ktime_get()));
+	now = __blk_stat_time(now);
 	if (now < blk_stat_time(&rq->issue_stat))
 		return;
 
@@ -79,7 +79,7 @@ struct blk_stat_callback {
 struct blk_queue_stats *blk_alloc_queue_stats(void);
 void blk_free_queue_stats(struct blk_queue_stats *);
 
-void blk_stat_add(struct request *);
+void blk_stat_add(struct request *rq, u64 now);
 
 static inline u64 __blk_stat_time(u64 time)
 {
@@ -201,4 +201,14 @@ static inline void blk_stat_activate_msecs(struct blk_stat_callback *cb,
 	mod_timer(&cb->timer, jiffies + msecs_to_jiffies(msecs));
 }
 
+/**
+ * blk_stat_deactivate() - Stop gathering block statistics, waiting for a
+ * running timer callback to finish.
+ * @cb: The callback.
+ */
+static inline void blk_stat_deactivate(struct blk_stat_callback *cb)
+{
+	del_timer_sync(&cb->timer);
+}
+
 #endif
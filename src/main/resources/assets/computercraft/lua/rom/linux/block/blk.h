@@ -323,6 +323,13 @@ static inline int blk_throtl_init(struct request_queue *q) { return 0; }
 static inline void blk_throtl_exit(struct request_queue *q) { }
 static inline void blk_throtl_register_queue(struct request_queue *q) { }
 #endif /* CONFIG_BLK_DEV_THROTTLING */
+#ifdef CONFIG_BLK_CGROUP_IOCOST
+extern int blk_iocost_init(struct request_queue *q);
+extern void blk_iocost_exit(struct request_queue *q);
+#else
+static inline int blk_iocost_init(struct request_queue *q) { return 0; }
+static inline void blk_iocost_exit(struct request_queue *q) { }
+#endif /* CONFIG_BLK_CGROUP_IOCOST */
 #ifdef CONFIG_BLK_DEV_THROTTLING_LOW
 extern ssize_t blk_throtl_sample_time_show(struct request_queue *q, char *page);
 extern ssize_t blk_throtl_sample_time_store(struct request_queue *q,
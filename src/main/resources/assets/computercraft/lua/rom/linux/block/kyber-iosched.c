@@ -20,6 +20,7 @@
 #include <linux/kernel.h>
 #include <linux/blkdev.h>
 #include <linux/blk-mq.h>
+#include <linux/blk-cgroup.h>
 #include <linux/elevator.h>
 #include <linux/module.h>
 #include <linux/sbitmap.h>
@@ -91,6 +92,16 @@ struct kyber_queue_data {
 
 	/* Target latencies in nanoseconds. */
 	u64 read_lat_nsec, write_lat_nsec;
+
+#ifdef CONFIG_KYBER_GROUP_IOSCHED
+	/*
+	 * Cgroups with no latency target or one looser than cg_throttle_target
+	 * are limited to kyber_group_depth(cg_step) in-flight requests.
+	 */
+	struct timer_list cg_timer;
+	unsigned int cg_step;
+	u64 cg_throttle_target;
+#endif
 };
 
 struct kyber_hctx_data {
@@ -270,6 +281,381 @@ static void kyber_stat_timer_fn(struct blk_stat_callback *cb)
 		blk_stat_activate_msecs(kqd->cb, 100);
 }
 
+#ifdef CONFIG_KYBER_GROUP_IOSCHED
+/*
+ * Per-cgroup latency targets.
+ *
+ * A cgroup with a latency target is protected. Every KYBER_CG_WINDOW_MSECS,
+ * the mean latency of its requests over the window is compared against its
+ * target. While some protected cgroup misses, the cgroups with no target or a
+ * looser one than the tightest missed target are squeezed to fewer in-flight
+ * requests, halving the limit on each window that misses again and doubling it
+ * back on each window where all the targets are met.
+ */
+enum {
+	KYBER_CG_WINDOW_MSECS = 100,
+	KYBER_CG_MAX_STEP = 8,
+};
+
+struct kyber_cg_data {
+	struct blkcg_policy_data cpd;
+	u64 target_lat_nsec;
+};
+
+struct kyber_group {
+	struct blkg_policy_data pd;
+	atomic_t inflight;
+	atomic_t nr_samples;
+	atomic64_t lat_sum;
+};
+
+static struct blkcg_policy blkcg_policy_kyber;
+
+/* Cgroups with a latency target. While there are none, nothing is tracked. */
+static atomic_t kyber_nr_protected = ATOMIC_INIT(0);
+
+static struct kyber_cg_data *cpd_to_kcd(struct blkcg_policy_data *cpd)
+{
+	return cpd ? container_of(cpd, struct kyber_cg_data, cpd) : NULL;
+}
+
+static struct kyber_cg_data *blkcg_to_kcd(struct blkcg *blkcg)
+{
+	return cpd_to_kcd(blkcg_to_cpd(blkcg, &blkcg_policy_kyber));
+}
+
+static struct kyber_group *pd_to_kg(struct blkg_policy_data *pd)
+{
+	return pd ? container_of(pd, struct kyber_group, pd) : NULL;
+}
+
+static struct kyber_group *blkg_to_kg(struct blkcg_gq *blkg)
+{
+	return pd_to_kg(blkg_to_pd(blkg, &blkcg_policy_kyber));
+}
+
+static u64 kyber_group_target(struct kyber_group *kg)
+{
+	return READ_ONCE(blkcg_to_kcd(kg->pd.blkg->blkcg)->target_lat_nsec);
+}
+
+static unsigned int kyber_group_depth(unsigned int step)
+{
+	return max(kyber_depth[KYBER_READ] >> step, 1U);
+}
+
+static struct kyber_group *rq_group(struct request *rq)
+{
+	return rq->elv.priv[1];
+}
+
+/*
+ * Requests are charged to the cgroup of the task allocating them, which is
+ * the one blkcg_bio_issue_check() just looked up or created a blkg for.
+ */
+static void kyber_rq_set_group(struct request *rq)
+{
+	struct kyber_group *kg = NULL;
+	struct blkcg_gq *blkg;
+
+	rq->elv.priv[1] = NULL;
+	if (!atomic_read(&kyber_nr_protected))
+		return;
+
+	rcu_read_lock();
+	blkg = blkg_lookup(task_blkcg(current), rq->q);
+	if (blkg)
+		kg = blkg_to_kg(blkg);
+	if (kg) {
+		blkg_get(blkg);
+		rq->elv.priv[1] = kg;
+	}
+	rcu_read_unlock();
+}
+
+static void kyber_rq_put_group(struct request *rq)
+{
+	struct kyber_group *kg = rq_group(rq);
+
+	if (kg)
+		blkg_put(kg->pd.blkg);
+}
+
+static bool kyber_group_throttled(struct kyber_queue_data *kqd,
+				  struct request *rq)
+{
+	struct kyber_group *kg = rq_group(rq);
+	unsigned int step = READ_ONCE(kqd->cg_step);
+	u64 target;
+
+	if (!kg || !step)
+		return false;
+
+	target = kyber_group_target(kg);
+	if (target && target <= READ_ONCE(kqd->cg_throttle_target))
+		return false;
+
+	return atomic_read(&kg->inflight) >= kyber_group_depth(step);
+}
+
+static void kyber_group_dispatched(struct request *rq)
+{
+	struct kyber_group *kg = rq_group(rq);
+
+	if (kg)
+		atomic_inc(&kg->inflight);
+}
+
+static void kyber_group_finished(struct kyber_queue_data *kqd,
+				 struct request *rq)
+{
+	struct kyber_group *kg = rq_group(rq);
+	unsigned int step;
+	int inflight;
+
+	if (!kg)
+		return;
+
+	/*
+	 * A throttled cgroup dropping back under its limit may have requests
+	 * waiting that nothing else is going to dispatch.
+	 */
+	inflight = atomic_dec_return(&kg->inflight);
+	step = READ_ONCE(kqd->cg_step);
+	if (step && inflight == kyber_group_depth(step) - 1)
+		blk_mq_run_hw_queues(kqd->q, true);
+}
+
+static void kyber_group_completed(struct kyber_queue_data *kqd,
+				  struct request *rq)
+{
+	struct kyber_group *kg = rq_group(rq);
+	u64 now;
+
+	if (!kg || !kyber_group_target(kg))
+		return;
+
+	now = __blk_stat_time(ktime_to_ns(ktime_get()));
+	if (now < blk_stat_time(&rq->issue_stat))
+		return;
+
+	atomic64_add(now - blk_stat_time(&rq->issue_stat), &kg->lat_sum);
+	atomic_inc(&kg->nr_samples);
+
+	if (!timer_pending(&kqd->cg_timer))
+		mod_timer(&kqd->cg_timer,
+			  jiffies + msecs_to_jiffies(KYBER_CG_WINDOW_MSECS));
+}
+
+static void kyber_cg_timer_fn(unsigned long data)
+{
+	struct kyber_queue_data *kqd = (struct kyber_queue_data *)data;
+	struct request_queue *q = kqd->q;
+	unsigned int step = kqd->cg_step;
+	struct blkcg_gq *blkg;
+	bool active = false;
+	u64 missed = 0;
+
+	spin_lock_irq(q->queue_lock);
+	list_for_each_entry(blkg, &q->blkg_list, q_node) {
+		struct kyber_group *kg = blkg_to_kg(blkg);
+		unsigned int nr = atomic_xchg(&kg->nr_samples, 0);
+		u64 sum = atomic64_xchg(&kg->lat_sum, 0);
+		u64 target = kyber_group_target(kg);
+
+		if (!nr || !target)
+			continue;
+
+		active = true;
+		if (div_u64(sum, nr) > target && (!missed || target < missed))
+			missed = target;
+	}
+	spin_unlock_irq(q->queue_lock);
+
+	if (missed) {
+		step = min_t(unsigned int, step + 1, KYBER_CG_MAX_STEP);
+		WRITE_ONCE(kqd->cg_throttle_target, missed);
+	} else if (step) {
+		step--;
+	}
+
+	if (step != kqd->cg_step || missed) {
+		WRITE_ONCE(kqd->cg_step, step);
+		/* The set of throttled cgroups or their limit changed. */
+		blk_mq_run_hw_queues(q, true);
+	}
+
+	/* Keep watching while throttling or protected cgroups are busy. */
+	if (step || active)
+		mod_timer(&kqd->cg_timer,
+			  jiffies + msecs_to_jiffies(KYBER_CG_WINDOW_MSECS));
+}
+
+static int kyber_cg_init_queue(struct kyber_queue_data *kqd)
+{
+	kqd->cg_step = 0;
+	kqd->cg_throttle_target = 0;
+	setup_timer(&kqd->cg_timer, kyber_cg_timer_fn, (unsigned long)kqd);
+
+	return blkcg_activate_policy(kqd->q, &blkcg_policy_kyber);
+}
+
+static void kyber_cg_exit_queue(struct kyber_queue_data *kqd)
+{
+	del_timer_sync(&kqd->cg_timer);
+	blkcg_deactivate_policy(kqd->q, &blkcg_policy_kyber);
+}
+
+static struct blkcg_policy_data *kyber_cpd_alloc(gfp_t gfp)
+{
+	struct kyber_cg_data *kcd;
+
+	kcd = kzalloc(sizeof(*kcd), gfp);
+	if (!kcd)
+		return NULL;
+	return &kcd->cpd;
+}
+
+static void kyber_cpd_free(struct blkcg_policy_data *cpd)
+{
+	struct kyber_cg_data *kcd = cpd_to_kcd(cpd);
+
+	if (kcd->target_lat_nsec)
+		atomic_dec(&kyber_nr_protected);
+	kfree(kcd);
+}
+
+static struct blkg_policy_data *kyber_pd_alloc(gfp_t gfp, int node)
+{
+	struct kyber_group *kg;
+
+	kg = kzalloc_node(sizeof(*kg), gfp, node);
+	if (!kg)
+		return NULL;
+	return &kg->pd;
+}
+
+static void kyber_pd_free(struct blkg_policy_data *pd)
+{
+	kfree(pd_to_kg(pd));
+}
+
+static u64 kyber_cg_read_target(struct cgroup_subsys_state *css,
+				struct cftype *cft)
+{
+	struct kyber_cg_data *kcd = blkcg_to_kcd(css_to_blkcg(css));
+
+	return kcd ? kcd->target_lat_nsec : 0;
+}
+
+static int kyber_cg_write_target(struct cgroup_subsys_state *css,
+				 struct cftype *cft, u64 val)
+{
+	struct blkcg *blkcg = css_to_blkcg(css);
+	struct kyber_cg_data *kcd = blkcg_to_kcd(blkcg);
+
+	if (!kcd)
+		return -EINVAL;
+
+	spin_lock_irq(&blkcg->lock);
+	if (!kcd->target_lat_nsec && val)
+		atomic_inc(&kyber_nr_protected);
+	else if (kcd->target_lat_nsec && !val)
+		atomic_dec(&kyber_nr_protected);
+	WRITE_ONCE(kcd->target_lat_nsec, val);
+	spin_unlock_irq(&blkcg->lock);
+
+	return 0;
+}
+
+static struct cftype kyber_blkcg_legacy_files[] = {
+	{
+		.name = "kyber.target_lat_nsec",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.read_u64 = kyber_cg_read_target,
+		.write_u64 = kyber_cg_write_target,
+	},
+	{ }	/* terminate */
+};
+
+static struct cftype kyber_blkg_files[] = {
+	{
+		.name = "kyber.target_lat_nsec",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.read_u64 = kyber_cg_read_target,
+		.write_u64 = kyber_cg_write_target,
+	},
+	{ }	/* terminate */
+};
+
+static struct blkcg_policy blkcg_policy_kyber = {
+	.dfl_cftypes		= kyber_blkg_files,
+	.legacy_cftypes		= kyber_blkcg_legacy_files,
+
+	.cpd_alloc_fn		= kyber_cpd_alloc,
+	.cpd_free_fn		= kyber_cpd_free,
+
+	.pd_alloc_fn		= kyber_pd_alloc,
+	.pd_free_fn		= kyber_pd_free,
+};
+
+static int kyber_cg_register(void)
+{
+	return blkcg_policy_register(&blkcg_policy_kyber);
+}
+
+static void kyber_cg_unregister(void)
+{
+	blkcg_policy_unregister(&blkcg_policy_kyber);
+}
+#else
+static void kyber_rq_set_group(struct request *rq)
+{
+}
+
+static void kyber_rq_put_group(struct request *rq)
+{
+}
+
+static bool kyber_group_throttled(struct kyber_queue_data *kqd,
+				  struct request *rq)
+{
+	return false;
+}
+
+static void kyber_group_dispatched(struct request *rq)
+{
+}
+
+static void kyber_group_finished(struct kyber_queue_data *kqd,
+				 struct request *rq)
+{
+}
+
+static void kyber_group_completed(struct kyber_queue_data *kqd,
+				  struct request *rq)
+{
+}
+
+static int kyber_cg_init_queue(struct kyber_queue_data *kqd)
+{
+	return 0;
+}
+
+static void kyber_cg_exit_queue(struct kyber_queue_data *kqd)
+{
+}
+
+static int kyber_cg_register(void)
+{
+	return 0;
+}
+
+static void kyber_cg_unregister(void)
+{
+}
+#endif /* CONFIG_KYBER_GROUP_IOSCHED */
+
 static unsigned int kyber_sched_tags_shift(struct kyber_queue_data *kqd)
 {
 	/*
@@ -334,10 +720,21 @@ err:
 	return ERR_PTR(ret);
 }
 
+static void kyber_queue_data_free(struct kyber_queue_data *kqd)
+{
+	int i;
+
+	for (i = 0; i < KYBER_NUM_DOMAINS; i++)
+		sbitmap_queue_free(&kqd->domain_tokens[i]);
+	blk_stat_free_callback(kqd->cb);
+	kfree(kqd);
+}
+
 static int kyber_init_sched(struct request_queue *q, struct elevator_type *e)
 {
 	struct kyber_queue_data *kqd;
 	struct elevator_queue *eq;
+	int ret;
 
 	eq = elevator_alloc(q, e);
 	if (!eq)
@@ -349,6 +746,13 @@ static int kyber_init_sched(struct request_queue *q, struct elevator_type *e)
 		return PTR_ERR(kqd);
 	}
 
+	ret = kyber_cg_init_queue(kqd);
+	if (ret) {
+		kyber_queue_data_free(kqd);
+		kobject_put(&eq->kobj);
+		return ret;
+	}
+
 	eq->elevator_data = kqd;
 	q->elevator = eq;
 
@@ -361,14 +765,10 @@ static void kyber_exit_sched(struct elevator_queue *e)
 {
 	struct kyber_queue_data *kqd = e->elevator_data;
 	struct request_queue *q = kqd->q;
-	int i;
 
 	blk_stat_remove_callback(q, kqd->cb);
-
-	for (i = 0; i < KYBER_NUM_DOMAINS; i++)
-		sbitmap_queue_free(&kqd->domain_tokens[i]);
-	blk_stat_free_callback(kqd->cb);
-	kfree(kqd);
+	kyber_cg_exit_queue(kqd);
+	kyber_queue_data_free(kqd);
 }
 
 static int kyber_init_hctx(struct blk_mq_hw_ctx *hctx, unsigned int hctx_idx)
@@ -422,6 +822,7 @@ static void rq_clear_domain_token(struct kyber_queue_data *kqd,
 		sched_domain = rq_sched_domain(rq);
 		sbitmap_queue_clear(&kqd->domain_tokens[sched_domain], nr,
 				    rq->mq_ctx->cpu);
+		kyber_group_finished(kqd, rq);
 	}
 }
 
@@ -440,8 +841,10 @@ static struct request *kyber_get_request(struct request_queue *q,
 		data->shallow_depth = kqd->async_depth;
 
 	rq = __blk_mq_alloc_request(data, op);
-	if (rq)
+	if (rq) {
 		rq_set_domain_token(rq, -1);
+		kyber_rq_set_group(rq);
+	}
 	return rq;
 }
 
@@ -451,6 +854,7 @@ static void kyber_put_request(struct request *rq)
 	struct kyber_queue_data *kqd = q->elevator->elevator_data;
 
 	rq_clear_domain_token(kqd, rq);
+	kyber_rq_put_group(rq);
 	blk_mq_finish_request(rq);
 }
 
@@ -461,6 +865,8 @@ static void kyber_completed_request(struct request *rq)
 	unsigned int sched_domain;
 	u64 now, latency, target;
 
+	kyber_group_completed(kqd, rq);
+
 	/*
 	 * Check if this request met our latency goal. If not, quickly gather
 	 * some statistics and start throttling.
@@ -551,6 +957,22 @@ static int kyber_get_domain_token(struct kyber_queue_data *kqd,
 	return nr;
 }
 
+/*
+ * Pick the oldest request of the domain that doesn't belong to a cgroup over
+ * its throttled depth.
+ */
+static struct request *kyber_first_request(struct kyber_queue_data *kqd,
+					   struct list_head *rqs)
+{
+	struct request *rq;
+
+	list_for_each_entry(rq, rqs, queuelist) {
+		if (!kyber_group_throttled(kqd, rq))
+			return rq;
+	}
+	return NULL;
+}
+
 static struct request *
 kyber_dispatch_cur_domain(struct kyber_queue_data *kqd,
 			  struct kyber_hctx_data *khd,
@@ -562,7 +984,7 @@ kyber_dispatch_cur_domain(struct kyber_queue_data *kqd,
 	int nr;
 
 	rqs = &khd->rqs[khd->cur_domain];
-	rq = list_first_entry_or_null(rqs, struct request, queuelist);
+	rq = kyber_first_request(kqd, rqs);
 
 	/*
 	 * If there wasn't already a pending request and we haven't flushed the
@@ -571,7 +993,7 @@ kyber_dispatch_cur_domain(struct kyber_queue_data *kqd,
 	if (!rq && !*flushed) {
 		kyber_flush_busy_ctxs(khd, hctx);
 		*flushed = true;
-		rq = list_first_entry_or_null(rqs, struct request, queuelist);
+		rq = kyber_first_request(kqd, rqs);
 	}
 
 	if (rq) {
@@ -579,6 +1001,7 @@ kyber_dispatch_cur_domain(struct kyber_queue_data *kqd,
 		if (nr >= 0) {
 			khd->batching++;
 			rq_set_domain_token(rq, nr);
+			kyber_group_dispatched(rq);
 			list_del_init(&rq->queuelist);
 			return rq;
 		}
@@ -703,12 +1126,22 @@ static struct elevator_type kyber_sched = {
 
 static int __init kyber_init(void)
 {
-	return elv_register(&kyber_sched);
+	int ret;
+
+	ret = kyber_cg_register();
+	if (ret)
+		return ret;
+
+	ret = elv_register(&kyber_sched);
+	if (ret)
+		kyber_cg_unregister();
+	return ret;
 }
 
 static void __exit kyber_exit(void)
 {
 	elv_unregister(&kyber_sched);
+	kyber_cg_unregister();
 }
 
 module_init(kyber_init);
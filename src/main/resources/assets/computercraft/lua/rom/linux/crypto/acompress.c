@@ -18,6 +18,7 @@
 #include <linux/slab.h>
 #include <linux/string.h>
 #include <linux/crypto.h>
+#include <linux/workqueue.h>
 #include <crypto/algapi.h>
 #include <linux/cryptouser.h>
 #include <linux/compiler.h>
@@ -76,6 +77,8 @@ static int crypto_acomp_init_tfm(struct crypto_tfm *tfm)
 
 	acomp->compress = alg->compress;
 	acomp->decompress = alg->decompress;
+	acomp->compress_batch = alg->compress_batch;
+	acomp->decompress_batch = alg->decompress_batch;
 	acomp->dst_free = alg->dst_free;
 	acomp->reqsize = alg->reqsize;
 
@@ -148,6 +151,103 @@ void acomp_request_free(struct acomp_req *req)
 }
 EXPORT_SYMBOL_GPL(acomp_request_free);
 
+struct acomp_batch_work {
+	struct work_struct work;
+	struct acomp_req *req;
+	bool compress;
+};
+
+static int acomp_submit(struct acomp_req *req, bool compress)
+{
+	return compress ? crypto_acomp_compress(req) :
+			  crypto_acomp_decompress(req);
+}
+
+static void acomp_batch_work_fn(struct work_struct *work)
+{
+	struct acomp_batch_work *bw =
+		container_of(work, struct acomp_batch_work, work);
+	struct acomp_req *req = bw->req;
+	bool compress = bw->compress;
+
+	kfree(bw);
+	crypto_batch_complete(&req->base, acomp_submit(req, compress));
+}
+
+/*
+ * Requests to synchronous algorithms only overlap when they run on other
+ * CPUs, so all but the last are handed to the unbound workqueue if they
+ * are allowed to sleep. The submitter does the last one itself.
+ */
+static int crypto_acomp_submit_batch(struct acomp_req **reqs, unsigned int nr,
+				     struct crypto_batch *batch, bool compress)
+{
+	struct crypto_tfm *tfm = crypto_acomp_tfm(crypto_acomp_reqtfm(reqs[0]));
+	bool spread = !(tfm->__crt_alg->cra_flags & CRYPTO_ALG_ASYNC);
+	struct acomp_batch_work *bw;
+	struct acomp_req *req;
+	unsigned int i;
+	int err;
+
+	crypto_batch_start(batch, nr);
+
+	for (i = 0; i < nr; i++) {
+		req = reqs[i];
+		acomp_request_set_callback(req, req->base.flags,
+					   crypto_batch_complete, batch);
+
+		bw = NULL;
+		if (spread && i < nr - 1 &&
+		    (req->base.flags & CRYPTO_TFM_REQ_MAY_SLEEP))
+			bw = kmalloc(sizeof(*bw), GFP_KERNEL);
+		if (bw) {
+			INIT_WORK(&bw->work, acomp_batch_work_fn);
+			bw->req = req;
+			bw->compress = compress;
+			queue_work(system_unbound_wq, &bw->work);
+			continue;
+		}
+
+		err = acomp_submit(req, compress);
+		if (!crypto_batch_queued(&req->base, err))
+			crypto_batch_complete(&req->base, err);
+	}
+
+	return crypto_batch_end(batch);
+}
+
+int crypto_acomp_compress_batch(struct acomp_req **reqs, unsigned int nr,
+				struct crypto_batch *batch)
+{
+	struct crypto_acomp *tfm;
+
+	if (!nr)
+		return 0;
+
+	tfm = crypto_acomp_reqtfm(reqs[0]);
+	if (tfm->compress_batch)
+		return tfm->compress_batch(reqs, nr, batch);
+
+	return crypto_acomp_submit_batch(reqs, nr, batch, true);
+}
+EXPORT_SYMBOL_GPL(crypto_acomp_compress_batch);
+
+int crypto_acomp_decompress_batch(struct acomp_req **reqs, unsigned int nr,
+				  struct crypto_batch *batch)
+{
+	struct crypto_acomp *tfm;
+
+	if (!nr)
+		return 0;
+
+	tfm = crypto_acomp_reqtfm(reqs[0]);
+	if (tfm->decompress_batch)
+		return tfm->decompress_batch(reqs, nr, batch);
+
+	return crypto_acomp_submit_batch(reqs, nr, batch, false);
+}
+EXPORT_SYMBOL_GPL(crypto_acomp_decompress_batch);
+
 int crypto_register_acomp(struct acomp_alg *alg)
 {
 	struct crypto_alg *base = &alg->base;
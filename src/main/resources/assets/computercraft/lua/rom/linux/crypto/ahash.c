@@ -374,6 +374,31 @@ int crypto_ahash_digest(struct ahash_request *req)
 }
 EXPORT_SYMBOL_GPL(crypto_ahash_digest);
 
+int crypto_ahash_digest_batch(struct ahash_request **reqs, unsigned int nr,
+			      struct crypto_batch *batch)
+{
+	struct ahash_request *req;
+	unsigned int i;
+	int err;
+
+	if (!nr)
+		return 0;
+
+	crypto_batch_start(batch, nr);
+
+	for (i = 0; i < nr; i++) {
+		req = reqs[i];
+		ahash_request_set_callback(req, req->base.flags,
+					   crypto_batch_complete, batch);
+		err = crypto_ahash_digest(req);
+		if (!crypto_batch_queued(&req->base, err))
+			crypto_batch_complete(&req->base, err);
+	}
+
+	return crypto_batch_end(batch);
+}
+EXPORT_SYMBOL_GPL(crypto_ahash_digest_batch);
+
 static void ahash_def_finup_done2(struct crypto_async_request *req, int err)
 {
 	struct ahash_request *areq = req->data;
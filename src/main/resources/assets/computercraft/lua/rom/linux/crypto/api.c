@@ -595,5 +595,24 @@ int crypto_has_alg(const char *name, u32 type, u32 mask)
 }
 EXPORT_SYMBOL_GPL(crypto_has_alg);
 
+/*
+ * Completion installed on each request of a batch. The last one to
+ * finish, if that is not the submitter, completes the batch.
+ */
+void crypto_batch_complete(struct crypto_async_request *req, int err)
+{
+	struct crypto_batch *batch = req->data;
+
+	if (err == -EINPROGRESS)
+		return;
+
+	if (err)
+		cmpxchg(&batch->err, 0, err);
+
+	if (atomic_dec_and_test(&batch->pending))
+		batch->complete(batch, READ_ONCE(batch->err));
+}
+EXPORT_SYMBOL_GPL(crypto_batch_complete);
+
 MODULE_DESCRIPTION("Cryptographic core API");
 MODULE_LICENSE("GPL");
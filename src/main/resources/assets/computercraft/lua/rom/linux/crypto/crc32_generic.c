@@ -41,7 +41,7 @@
 
 static u32 __crc32_le(u32 crc, unsigned char const *p, size_t len)
 {
-	return crc32_le(crc, p, len);
+	return crc32_le_base(crc, p, len);
 }
 
 /** No default init with ~0 */
@@ -210,6 +210,46 @@ int crypto_transfer_cipher_request_to_engine(struct crypto_engine *engine,
 }
 EXPORT_SYMBOL_GPL(crypto_transfer_cipher_request_to_engine);
 
+/**
+ * crypto_transfer_cipher_request_batch - transfer several requests into the
+ * engine queue and pump it once
+ * @engine: the hardware engine
+ * @reqs: the requests need to be listed into the engine queue
+ * @rets: enqueue result of each request
+ * @nr: number of requests in @reqs
+ *
+ * Return: the number of requests that will be completed by the engine
+ */
+int crypto_transfer_cipher_request_batch(struct crypto_engine *engine,
+					 struct ablkcipher_request **reqs,
+					 int *rets, unsigned int nr)
+{
+	unsigned long flags;
+	unsigned int i;
+	int queued = 0;
+
+	spin_lock_irqsave(&engine->queue_lock, flags);
+
+	for (i = 0; i < nr; i++) {
+		if (!engine->running) {
+			rets[i] = -ESHUTDOWN;
+			continue;
+		}
+
+		rets[i] = ablkcipher_enqueue_request(&engine->queue, reqs[i]);
+		if (rets[i] == -EINPROGRESS || (rets[i] == -EBUSY &&
+		    (reqs[i]->base.flags & CRYPTO_TFM_REQ_MAY_BACKLOG)))
+			queued++;
+	}
+
+	if (!engine->busy && queued)
+		kthread_queue_work(engine->kworker, &engine->pump_requests);
+
+	spin_unlock_irqrestore(&engine->queue_lock, flags);
+	return queued;
+}
+EXPORT_SYMBOL_GPL(crypto_transfer_cipher_request_batch);
+
 /**
  * crypto_transfer_hash_request - transfer the new request into the
  * enginequeue
@@ -252,6 +292,46 @@ int crypto_transfer_hash_request_to_engine(struct crypto_engine *engine,
 }
 EXPORT_SYMBOL_GPL(crypto_transfer_hash_request_to_engine);
 
+/**
+ * crypto_transfer_hash_request_batch - transfer several requests into the
+ * engine queue and pump it once
+ * @engine: the hardware engine
+ * @reqs: the requests need to be listed into the engine queue
+ * @rets: enqueue result of each request
+ * @nr: number of requests in @reqs
+ *
+ * Return: the number of requests that will be completed by the engine
+ */
+int crypto_transfer_hash_request_batch(struct crypto_engine *engine,
+				       struct ahash_request **reqs,
+				       int *rets, unsigned int nr)
+{
+	unsigned long flags;
+	unsigned int i;
+	int queued = 0;
+
+	spin_lock_irqsave(&engine->queue_lock, flags);
+
+	for (i = 0; i < nr; i++) {
+		if (!engine->running) {
+			rets[i] = -ESHUTDOWN;
+			continue;
+		}
+
+		rets[i] = ahash_enqueue_request(&engine->queue, reqs[i]);
+		if (rets[i] == -EINPROGRESS || (rets[i] == -EBUSY &&
+		    (reqs[i]->base.flags & CRYPTO_TFM_REQ_MAY_BACKLOG)))
+			queued++;
+	}
+
+	if (!engine->busy && queued)
+		kthread_queue_work(engine->kworker, &engine->pump_requests);
+
+	spin_unlock_irqrestore(&engine->queue_lock, flags);
+	return queued;
+}
+EXPORT_SYMBOL_GPL(crypto_transfer_hash_request_batch);
+
 /**
  * crypto_finalize_cipher_request - finalize one request if the request is done
  * @engine: the hardware engine
@@ -146,5 +146,29 @@ static inline void crypto_notify(unsigned long val, void *v)
 	blocking_notifier_call_chain(&crypto_chain, val, v);
 }
 
+void crypto_batch_complete(struct crypto_async_request *req, int err);
+
+static inline void crypto_batch_start(struct crypto_batch *batch,
+				      unsigned int nr)
+{
+	atomic_set(&batch->pending, nr + 1);
+	batch->err = 0;
+}
+
+/* Submit return value of a request, true if it will complete later. */
+static inline bool crypto_batch_queued(struct crypto_async_request *req,
+				       int err)
+{
+	return err == -EINPROGRESS ||
+	       (err == -EBUSY && (req->flags & CRYPTO_TFM_REQ_MAY_BACKLOG));
+}
+
+static inline int crypto_batch_end(struct crypto_batch *batch)
+{
+	if (atomic_dec_and_test(&batch->pending))
+		return READ_ONCE(batch->err);
+	return -EINPROGRESS;
+}
+
 #endif	/* _CRYPTO_INTERNAL_H */
 
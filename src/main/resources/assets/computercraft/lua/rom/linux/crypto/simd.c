@@ -100,6 +100,49 @@ static int simd_skcipher_decrypt(struct skcipher_request *req)
 	return crypto_skcipher_decrypt(subreq);
 }
 
+static int simd_skcipher_batch(struct skcipher_request **reqs, unsigned int nr,
+			       struct crypto_batch *batch, bool encrypt)
+{
+	struct crypto_skcipher *tfm = crypto_skcipher_reqtfm(reqs[0]);
+	struct simd_skcipher_ctx *ctx = crypto_skcipher_ctx(tfm);
+	struct crypto_skcipher *child;
+	unsigned int i;
+	int err;
+
+	if (!may_use_simd() ||
+	    (in_atomic() && cryptd_skcipher_queued(ctx->cryptd_tfm)))
+		return crypto_skcipher_submit_batch(reqs, nr, batch, encrypt);
+
+	/*
+	 * The child is synchronous and needs less request context than
+	 * cryptd, so the requests can be handed to it as they are.
+	 */
+	child = cryptd_skcipher_child(ctx->cryptd_tfm);
+	for (i = 0; i < nr; i++)
+		skcipher_request_set_tfm(reqs[i], child);
+
+	err = encrypt ? crypto_skcipher_encrypt_batch(reqs, nr, batch) :
+			crypto_skcipher_decrypt_batch(reqs, nr, batch);
+
+	for (i = 0; i < nr; i++)
+		skcipher_request_set_tfm(reqs[i], tfm);
+	return err;
+}
+
+static int simd_skcipher_encrypt_batch(struct skcipher_request **reqs,
+				       unsigned int nr,
+				       struct crypto_batch *batch)
+{
+	return simd_skcipher_batch(reqs, nr, batch, true);
+}
+
+static int simd_skcipher_decrypt_batch(struct skcipher_request **reqs,
+				       unsigned int nr,
+				       struct crypto_batch *batch)
+{
+	return simd_skcipher_batch(reqs, nr, batch, false);
+}
+
 static void simd_skcipher_exit(struct crypto_skcipher *tfm)
 {
 	struct simd_skcipher_ctx *ctx = crypto_skcipher_ctx(tfm);
@@ -187,6 +230,8 @@ struct simd_skcipher_alg *simd_skcipher_create_compat(const char *algname,
 	alg->setkey = simd_skcipher_setkey;
 	alg->encrypt = simd_skcipher_encrypt;
 	alg->decrypt = simd_skcipher_decrypt;
+	alg->encrypt_batch = simd_skcipher_encrypt_batch;
+	alg->decrypt_batch = simd_skcipher_decrypt_batch;
 
 	err = crypto_register_skcipher(alg);
 	if (err)
@@ -787,6 +787,8 @@ static int crypto_skcipher_init_tfm(struct crypto_tfm *tfm)
 	skcipher->setkey = alg->setkey;
 	skcipher->encrypt = alg->encrypt;
 	skcipher->decrypt = alg->decrypt;
+	skcipher->encrypt_batch = alg->encrypt_batch;
+	skcipher->decrypt_batch = alg->decrypt_batch;
 	skcipher->ivsize = alg->ivsize;
 	skcipher->keysize = alg->max_keysize;
 
@@ -799,6 +801,62 @@ static int crypto_skcipher_init_tfm(struct crypto_tfm *tfm)
 	return 0;
 }
 
+int crypto_skcipher_submit_batch(struct skcipher_request **reqs,
+				 unsigned int nr, struct crypto_batch *batch,
+				 bool encrypt)
+{
+	struct skcipher_request *req;
+	unsigned int i;
+	int err;
+
+	crypto_batch_start(batch, nr);
+
+	for (i = 0; i < nr; i++) {
+		req = reqs[i];
+		skcipher_request_set_callback(req, req->base.flags,
+					      crypto_batch_complete, batch);
+		err = encrypt ? crypto_skcipher_encrypt(req) :
+				crypto_skcipher_decrypt(req);
+		if (!crypto_batch_queued(&req->base, err))
+			crypto_batch_complete(&req->base, err);
+	}
+
+	return crypto_batch_end(batch);
+}
+EXPORT_SYMBOL_GPL(crypto_skcipher_submit_batch);
+
+int crypto_skcipher_encrypt_batch(struct skcipher_request **reqs,
+				  unsigned int nr, struct crypto_batch *batch)
+{
+	struct crypto_skcipher *tfm;
+
+	if (!nr)
+		return 0;
+
+	tfm = crypto_skcipher_reqtfm(reqs[0]);
+	if (tfm->encrypt_batch)
+		return tfm->encrypt_batch(reqs, nr, batch);
+
+	return crypto_skcipher_submit_batch(reqs, nr, batch, true);
+}
+EXPORT_SYMBOL_GPL(crypto_skcipher_encrypt_batch);
+
+int crypto_skcipher_decrypt_batch(struct skcipher_request **reqs,
+				  unsigned int nr, struct crypto_batch *batch)
+{
+	struct crypto_skcipher *tfm;
+
+	if (!nr)
+		return 0;
+
+	tfm = crypto_skcipher_reqtfm(reqs[0]);
+	if (tfm->decrypt_batch)
+		return tfm->decrypt_batch(reqs, nr, batch);
+
+	return crypto_skcipher_submit_batch(reqs, nr, batch, false);
+}
+EXPORT_SYMBOL_GPL(crypto_skcipher_decrypt_batch);
+
 static void crypto_skcipher_free_instance(struct crypto_instance *inst)
 {
 	struct skcipher_instance *skcipher =
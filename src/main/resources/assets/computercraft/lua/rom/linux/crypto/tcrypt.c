@@ -1716,6 +1716,40 @@ static int do_test(const char *alg, u32 type, u32 mask, int m)
 		test_hash_speed("sha3-512", sec, generic_hash_speed_template);
 		if (mode > 300 && mode < 400) break;
 
+	case 326:
+		test_hash_speed("crc32", sec, generic_hash_speed_template);
+		if (mode > 300 && mode < 400) break;
+
+	case 327:
+		test_hash_speed("crc32-generic", sec,
+				generic_hash_speed_template);
+		if (mode > 300 && mode < 400) break;
+
+	case 328:
+		test_hash_speed("crc32-pclmul", sec,
+				generic_hash_speed_template);
+		if (mode > 300 && mode < 400) break;
+
+	case 329:
+		test_hash_speed("crc32c-generic", sec,
+				generic_hash_speed_template);
+		if (mode > 300 && mode < 400) break;
+
+	case 330:
+		test_hash_speed("crc32c-intel", sec,
+				generic_hash_speed_template);
+		if (mode > 300 && mode < 400) break;
+
+	case 331:
+		test_hash_speed("crct10dif-generic", sec,
+				generic_hash_speed_template);
+		if (mode > 300 && mode < 400) break;
+
+	case 332:
+		test_hash_speed("crct10dif-pclmul", sec,
+				generic_hash_speed_template);
+		if (mode > 300 && mode < 400) break;
+
 	case 399:
 		break;
 
@@ -23,6 +23,7 @@
 #include <linux/kthread.h>
 #include <linux/wait.h>
 #include <linux/async.h>
+#include <linux/ktime.h>
 #include <linux/pm_runtime.h>
 #include <linux/pinctrl/devinfo.h>
 
@@ -321,6 +322,67 @@ EXPORT_SYMBOL_GPL(device_bind_driver);
 static atomic_t probe_count = ATOMIC_INIT(0);
 static DECLARE_WAIT_QUEUE_HEAD(probe_waitqueue);
 
+/*
+ * With initcall_debug the slowest probes of the boot are remembered so
+ * that the critical path can be reported once the system is up.
+ */
+#define PROBE_TIMING_SLOWEST	8
+
+struct probe_timing {
+	char dev_name[32];
+	char drv_name[32];
+	s64 usecs;
+	bool async;
+};
+
+static struct probe_timing probe_slowest[PROBE_TIMING_SLOWEST];
+static s64 probe_wait_usecs;
+static DEFINE_SPINLOCK(probe_timing_lock);
+
+static void probe_timing_record(struct device *dev, struct device_driver *drv,
+				s64 usecs)
+{
+	struct probe_timing *t;
+	unsigned long flags;
+	int i;
+
+	spin_lock_irqsave(&probe_timing_lock, flags);
+	for (i = 0; i < PROBE_TIMING_SLOWEST; i++)
+		if (usecs > probe_slowest[i].usecs)
+			break;
+	if (i < PROBE_TIMING_SLOWEST) {
+		memmove(&probe_slowest[i + 1], &probe_slowest[i],
+			(PROBE_TIMING_SLOWEST - i - 1) * sizeof(*t));
+		t = &probe_slowest[i];
+		strlcpy(t->dev_name, dev_name(dev), sizeof(t->dev_name));
+		strlcpy(t->drv_name, drv->name, sizeof(t->drv_name));
+		t->usecs = usecs;
+		t->async = current_is_async();
+	}
+	spin_unlock_irqrestore(&probe_timing_lock, flags);
+}
+
+/**
+ * driver_probe_timing_report - print the slowest driver probes
+ *
+ * Called by init at the end of boot when initcall_debug is set.
+ */
+void driver_probe_timing_report(void)
+{
+	struct probe_timing *t;
+	int i;
+
+	pr_info("probe: %lld usecs waiting for device probing\n",
+		probe_wait_usecs);
+	for (i = 0; i < PROBE_TIMING_SLOWEST; i++) {
+		t = &probe_slowest[i];
+		if (!t->usecs)
+			break;
+		pr_info("probe: %8lld usecs %s %s (%s)\n", t->usecs,
+			t->drv_name, t->dev_name, t->async ? "async" : "sync");
+	}
+}
+
 static int really_probe(struct device *dev, struct device_driver *drv)
 {
 	int ret = -EPROBE_DEFER;
@@ -467,6 +529,23 @@ done:
  *
  * Should somehow figure out how to use a semaphore, not an atomic variable...
  */
+static int really_probe_debug(struct device *dev, struct device_driver *drv)
+{
+	ktime_t calltime, rettime;
+	s64 usecs;
+	int ret;
+
+	calltime = ktime_get();
+	ret = really_probe(dev, drv);
+	rettime = ktime_get();
+	usecs = ktime_to_us(ktime_sub(rettime, calltime));
+	printk(KERN_DEBUG "probe of %s returned %d after %lld usecs\n",
+	       dev_name(dev), ret, usecs);
+	if (system_state == SYSTEM_BOOTING)
+		probe_timing_record(dev, drv, usecs);
+	return ret;
+}
+
 int driver_probe_done(void)
 {
 	pr_debug("%s: probe_count = %d\n", __func__,
@@ -482,12 +561,18 @@ int driver_probe_done(void)
  */
 void wait_for_device_probe(void)
 {
+	ktime_t calltime = ktime_get();
+
 	/* wait for the deferred probe workqueue to finish */
 	flush_work(&deferred_probe_work);
 
 	/* wait for the known devices to complete their probing */
 	wait_event(probe_waitqueue, atomic_read(&probe_count) == 0);
 	async_synchronize_full();
+
+	if (system_state == SYSTEM_BOOTING)
+		probe_wait_usecs += ktime_to_us(ktime_sub(ktime_get(),
+							  calltime));
 }
 EXPORT_SYMBOL_GPL(wait_for_device_probe);
 
@@ -519,7 +604,10 @@ int driver_probe_device(struct device_driver *drv, struct device *dev)
 		pm_runtime_get_sync(dev->parent);
 
 	pm_runtime_barrier(dev);
-	ret = really_probe(dev, drv);
+	if (initcall_debug)
+		ret = really_probe_debug(dev, drv);
+	else
+		ret = really_probe(dev, drv);
 	pm_request_idle(dev);
 
 	if (dev->parent)
@@ -529,6 +617,41 @@ int driver_probe_device(struct device_driver *drv, struct device *dev)
 	return ret;
 }
 
+/*
+ * While booting, drivers that did not state a preference are probed
+ * asynchronously so that independent devices initialize in parallel.
+ * Dependencies are still honoured: a consumer whose device-link
+ * suppliers are not bound yet defers until they are.
+ * "driver_async_probe=off" restores synchronous probing at boot, and a
+ * list of driver names makes those drivers probe asynchronously also
+ * after boot.
+ */
+#define ASYNC_DRV_NAMES_MAX_LEN	256
+static char async_probe_drv_names[ASYNC_DRV_NAMES_MAX_LEN];
+static bool async_probe_boot = true;
+
+static int __init save_async_options(char *buf)
+{
+	if (!strcmp(buf, "off")) {
+		async_probe_boot = false;
+		return 1;
+	}
+	if (strlen(buf) >= ASYNC_DRV_NAMES_MAX_LEN)
+		pr_warn("Too long list of driver names for 'driver_async_probe'!\n");
+
+	strlcpy(async_probe_drv_names, buf, ASYNC_DRV_NAMES_MAX_LEN);
+	return 1;
+}
+__setup("driver_async_probe=", save_async_options);
+
+static bool driver_async_probe_default(struct device_driver *drv)
+{
+	if (parse_option_str(async_probe_drv_names, drv->name))
+		return true;
+
+	return async_probe_boot && system_state == SYSTEM_BOOTING;
+}
+
 bool driver_allows_async_probing(struct device_driver *drv)
 {
 	switch (drv->probe_type) {
@@ -542,7 +665,7 @@ bool driver_allows_async_probing(struct device_driver *drv)
 		if (module_requested_async_probing(drv->owner))
 			return true;
 
-		return false;
+		return driver_async_probe_default(drv);
 	}
 }
 
@@ -722,6 +845,29 @@ void device_initial_probe(struct device *dev)
 	__device_attach(dev, true);
 }
 
+static void __driver_attach_async_helper(void *_dev, async_cookie_t cookie)
+{
+	struct device *dev = _dev;
+	struct device_driver *drv;
+
+	if (dev->parent)
+		device_lock(dev->parent);
+	device_lock(dev);
+
+	drv = dev->p->async_driver;
+	dev->p->async_driver = NULL;
+	if (!dev->p->dead && !dev->driver)
+		driver_probe_device(drv, dev);
+
+	dev_dbg(dev, "driver %s async attach completed\n", drv->name);
+
+	device_unlock(dev);
+	if (dev->parent)
+		device_unlock(dev->parent);
+
+	put_device(dev);
+}
+
 static int __driver_attach(struct device *dev, void *data)
 {
 	struct device_driver *drv = data;
@@ -749,6 +895,25 @@ static int __driver_attach(struct device *dev, void *data)
 		return ret;
 	} /* ret > 0 means positive match */
 
+	if (driver_allows_async_probing(drv)) {
+		/*
+		 * Instead of probing the device synchronously we will
+		 * probe it asynchronously to allow for more parallelism.
+		 *
+		 * We only take the device lock here in order to guarantee
+		 * that the dev->driver and async_driver fields are protected
+		 */
+		dev_dbg(dev, "probing driver %s asynchronously\n", drv->name);
+		device_lock(dev);
+		if (!dev->driver && !dev->p->async_driver) {
+			get_device(dev);
+			dev->p->async_driver = drv;
+			async_schedule(__driver_attach_async_helper, dev);
+		}
+		device_unlock(dev);
+		return 0;
+	}
+
 	if (dev->parent)	/* Needed for USB */
 		device_lock(dev->parent);
 	device_lock(dev);
@@ -889,6 +1054,10 @@ void driver_detach(struct device_driver *drv)
 	struct device_private *dev_prv;
 	struct device *dev;
 
+	/* Let pending asynchronous attaches finish before dropping @drv */
+	if (driver_allows_async_probing(drv))
+		async_synchronize_full();
+
 	for (;;) {
 		spin_lock(&drv->p->klist_devices.k_lock);
 		if (list_empty(&drv->p->klist_devices.k_list)) {
@@ -32,6 +32,8 @@
 #include <linux/idr.h>
 #include <linux/sysfs.h>
 #include <linux/cpuhotplug.h>
+#include <linux/file.h>
+#include <linux/workqueue.h>
 
 #include "zram_drv.h"
 
@@ -41,6 +43,8 @@ static DEFINE_MUTEX(zram_index_mutex);
 
 static int zram_major;
 static const char *default_compressor = "lzo";
+/* Compresses the pages of large writes in parallel, see parallel_comp */
+static struct workqueue_struct *zram_comp_wq;
 
 /* Module params (documentation at end) */
 static unsigned int num_devices = 1;
@@ -325,6 +329,27 @@ static ssize_t comp_algorithm_store(struct device *dev,
 	return len;
 }
 
+static ssize_t parallel_comp_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return scnprintf(buf, PAGE_SIZE, "%d\n", READ_ONCE(zram->parallel_comp));
+}
+
+static ssize_t parallel_comp_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	bool val;
+
+	if (kstrtobool(buf, &val))
+		return -EINVAL;
+
+	WRITE_ONCE(zram->parallel_comp, val);
+	return len;
+}
+
 static ssize_t compact_store(struct device *dev,
 		struct device_attribute *attr, const char *buf, size_t len)
 {
@@ -413,9 +438,283 @@ static ssize_t debug_stat_show(struct device *dev,
 	return ret;
 }
 
+#ifdef CONFIG_ZRAM_WRITEBACK
+/* Pages written back per batch of bios */
+#define ZRAM_WB_BATCH	32
+
+static void zram_reset_bdev(struct zram *zram)
+{
+	if (!zram->backing_dev)
+		return;
+
+	set_blocksize(zram->bdev, zram->old_block_size);
+	blkdev_put(zram->bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+	filp_close(zram->backing_dev, NULL);
+	vfree(zram->bitmap);
+
+	zram->backing_dev = NULL;
+	zram->bdev = NULL;
+	zram->old_block_size = 0;
+	zram->bitmap = NULL;
+	zram->nr_pages = 0;
+}
+
+static ssize_t backing_dev_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+	char *p;
+	ssize_t ret;
+
+	down_read(&zram->init_lock);
+	if (!zram->backing_dev) {
+		up_read(&zram->init_lock);
+		return scnprintf(buf, PAGE_SIZE, "none\n");
+	}
+
+	p = file_path(zram->backing_dev, buf, PAGE_SIZE - 1);
+	if (IS_ERR(p)) {
+		ret = PTR_ERR(p);
+	} else {
+		ret = strlen(p);
+		memmove(buf, p, ret);
+		buf[ret++] = '\n';
+	}
+	up_read(&zram->init_lock);
+
+	return ret;
+}
+
+static ssize_t backing_dev_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	char *file_name;
+	size_t sz;
+	struct file *backing_dev;
+	struct inode *inode;
+	struct block_device *bdev;
+	unsigned long nr_pages, *bitmap;
+	int err;
+
+	file_name = kmalloc(PATH_MAX, GFP_KERNEL);
+	if (!file_name)
+		return -ENOMEM;
+
+	strlcpy(file_name, buf, PATH_MAX);
+	/* ignore trailing newline */
+	sz = strlen(file_name);
+	if (sz > 0 && file_name[sz - 1] == '\n')
+		file_name[sz - 1] = 0x00;
+
+	down_write(&zram->init_lock);
+	if (init_done(zram)) {
+		pr_info("Can't setup backing device for initialized device\n");
+		err = -EBUSY;
+		goto out;
+	}
+
+	backing_dev = filp_open(file_name, O_RDWR | O_LARGEFILE, 0);
+	if (IS_ERR(backing_dev)) {
+		err = PTR_ERR(backing_dev);
+		goto out;
+	}
+
+	inode = backing_dev->f_mapping->host;
+	if (!S_ISBLK(inode->i_mode)) {
+		err = -ENOTBLK;
+		goto out_close;
+	}
+
+	/* blkdev_get() drops the reference on failure */
+	bdev = bdgrab(I_BDEV(inode));
+	err = blkdev_get(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL, zram);
+	if (err < 0)
+		goto out_close;
+
+	nr_pages = i_size_read(inode) >> PAGE_SHIFT;
+	bitmap = vzalloc(BITS_TO_LONGS(nr_pages) * sizeof(long));
+	if (!bitmap) {
+		err = -ENOMEM;
+		goto out_put;
+	}
+
+	zram_reset_bdev(zram);
+
+	zram->old_block_size = block_size(bdev);
+	err = set_blocksize(bdev, PAGE_SIZE);
+	if (err) {
+		vfree(bitmap);
+		goto out_put;
+	}
+
+	zram->backing_dev = backing_dev;
+	zram->bdev = bdev;
+	zram->bitmap = bitmap;
+	zram->nr_pages = nr_pages;
+	up_write(&zram->init_lock);
+
+	pr_info("setup backing device %s\n", file_name);
+	kfree(file_name);
+
+	return len;
+
+out_put:
+	blkdev_put(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+out_close:
+	filp_close(backing_dev, NULL);
+out:
+	up_write(&zram->init_lock);
+	kfree(file_name);
+	return err;
+}
+
+/*
+ * Blocks are looked for from @hint on, so that a batch of writeback
+ * mostly ends up contiguous.  Returns 0 if the device is full.
+ */
+static unsigned long zram_alloc_bdev_block(struct zram *zram,
+					   unsigned long hint)
+{
+	unsigned long blk_idx = hint ? hint : 1;
+	bool wrapped = false;
+
+retry:
+	/* block 0 is never handed out, 0 means "no block" */
+	blk_idx = find_next_zero_bit(zram->bitmap, zram->nr_pages, blk_idx);
+	if (blk_idx >= zram->nr_pages) {
+		if (wrapped)
+			return 0;
+		wrapped = true;
+		blk_idx = 1;
+		goto retry;
+	}
+
+	if (test_and_set_bit(blk_idx, zram->bitmap))
+		goto retry;
+
+	return blk_idx;
+}
+
+static void zram_free_bdev_block(struct zram *zram, unsigned long blk_idx)
+{
+	WARN_ON_ONCE(!test_and_clear_bit(blk_idx, zram->bitmap));
+}
+
+/* Synchronously read block @blk_idx of the backing device into @page */
+static int zram_read_bdev_block(struct zram *zram, struct page *page,
+				unsigned long blk_idx)
+{
+	struct bio *bio;
+	int ret;
+
+	bio = bio_alloc(GFP_NOIO, 1);
+	if (!bio)
+		return -ENOMEM;
+
+	bio->bi_iter.bi_sector = blk_idx << SECTORS_PER_PAGE_SHIFT;
+	bio->bi_bdev = zram->bdev;
+	bio_set_op_attrs(bio, REQ_OP_READ, 0);
+	bio_add_page(bio, page, PAGE_SIZE, 0);
+
+	ret = submit_bio_wait(bio);
+	bio_put(bio);
+	atomic64_inc(&zram->stats.bd_reads);
+
+	if (ret)
+		pr_err("Backing device read failed! err=%d, block=%lu\n",
+			ret, blk_idx);
+	return ret;
+}
+
+/* Copy @len bytes at @offset of block @blk_idx to @mem */
+static int zram_read_from_bdev(struct zram *zram, char *mem,
+			       unsigned long blk_idx, int offset, int len)
+{
+	struct page *page;
+	char *src;
+	int ret;
+
+	page = alloc_page(GFP_NOIO);
+	if (!page)
+		return -ENOMEM;
+
+	ret = zram_read_bdev_block(zram, page, blk_idx);
+	if (!ret) {
+		src = kmap_atomic(page);
+		memcpy(mem, src + offset, len);
+		kunmap_atomic(src);
+	}
+	__free_page(page);
+
+	return ret;
+}
+
+/*
+ * Writing "all" marks every page stored in memory idle.  A page stays
+ * idle until it is read or rewritten, writing "idle" to writeback then
+ * moves the pages still idle to the backing device.
+ */
+static ssize_t idle_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	struct zram_meta *meta;
+	unsigned long nr_pages, index;
+
+	if (!sysfs_streq(buf, "all"))
+		return -EINVAL;
+
+	down_read(&zram->init_lock);
+	if (!init_done(zram)) {
+		up_read(&zram->init_lock);
+		return -EINVAL;
+	}
+
+	meta = zram->meta;
+	nr_pages = zram->disksize >> PAGE_SHIFT;
+	for (index = 0; index < nr_pages; index++) {
+		bit_spin_lock(ZRAM_ACCESS, &meta->table[index].value);
+		if (meta->table[index].handle &&
+		    !zram_test_flag(meta, index, ZRAM_SAME) &&
+		    !zram_test_flag(meta, index, ZRAM_WB))
+			zram_set_flag(meta, index, ZRAM_IDLE);
+		bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
+		cond_resched();
+	}
+	up_read(&zram->init_lock);
+
+	return len;
+}
+
+static ssize_t bd_stat_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+	ssize_t ret;
+
+	down_read(&zram->init_lock);
+	ret = scnprintf(buf, PAGE_SIZE,
+			"%8llu %8llu %8llu\n",
+			(u64)atomic64_read(&zram->stats.bd_count) << PAGE_SHIFT,
+			(u64)atomic64_read(&zram->stats.bd_reads),
+			(u64)atomic64_read(&zram->stats.bd_writes));
+	up_read(&zram->init_lock);
+
+	return ret;
+}
+#else
+static inline void zram_reset_bdev(struct zram *zram) {}
+#endif /* CONFIG_ZRAM_WRITEBACK */
+
 static DEVICE_ATTR_RO(io_stat);
 static DEVICE_ATTR_RO(mm_stat);
 static DEVICE_ATTR_RO(debug_stat);
+#ifdef CONFIG_ZRAM_WRITEBACK
+static DEVICE_ATTR_RW(backing_dev);
+static DEVICE_ATTR_WO(idle);
+static DEVICE_ATTR_RO(bd_stat);
+#endif
 
 static void zram_meta_free(struct zram_meta *meta, u64 disksize)
 {
@@ -431,6 +730,9 @@ static void zram_meta_free(struct zram_meta *meta, u64 disksize)
 		 */
 		if (!handle || zram_test_flag(meta, index, ZRAM_SAME))
 			continue;
+		/* element is a block of the backing device, freed with it */
+		if (zram_test_flag(meta, index, ZRAM_WB))
+			continue;
 
 		zs_free(meta->mem_pool, handle);
 	}
@@ -477,7 +779,24 @@ out_error:
 static void zram_free_page(struct zram *zram, size_t index)
 {
 	struct zram_meta *meta = zram->meta;
-	unsigned long handle = meta->table[index].handle;
+	unsigned long handle;
+
+	zram_clear_flag(meta, index, ZRAM_HUGE);
+	zram_clear_flag(meta, index, ZRAM_IDLE);
+	/* tells a writeback in progress that the page changed */
+	zram_clear_flag(meta, index, ZRAM_UNDER_WB);
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+	if (zram_test_flag(meta, index, ZRAM_WB)) {
+		zram_clear_flag(meta, index, ZRAM_WB);
+		zram_free_bdev_block(zram, meta->table[index].element);
+		zram_clear_element(meta, index);
+		atomic64_dec(&zram->stats.bd_count);
+		return;
+	}
+#endif
+
+	handle = meta->table[index].handle;
 
 	/*
 	 * No memory is allocated for same element filled pages.
@@ -512,6 +831,14 @@ static int zram_decompress_page(struct zram *zram, char *mem, u32 index)
 	unsigned int size;
 
 	bit_spin_lock(ZRAM_ACCESS, &meta->table[index].value);
+#ifdef CONFIG_ZRAM_WRITEBACK
+	if (zram_test_flag(meta, index, ZRAM_WB)) {
+		unsigned long blk_idx = meta->table[index].element;
+
+		bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
+		return zram_read_from_bdev(zram, mem, blk_idx, 0, PAGE_SIZE);
+	}
+#endif
 	handle = meta->table[index].handle;
 	size = zram_get_obj_size(meta, index);
 
@@ -552,6 +879,37 @@ static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 	page = bvec->bv_page;
 
 	bit_spin_lock(ZRAM_ACCESS, &meta->table[index].value);
+	zram_clear_flag(meta, index, ZRAM_IDLE);
+#ifdef CONFIG_ZRAM_WRITEBACK
+	if (zram_test_flag(meta, index, ZRAM_WB)) {
+		unsigned long blk_idx = meta->table[index].element;
+
+		bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
+
+		if (!is_partial_io(bvec)) {
+			ret = zram_read_bdev_block(zram, page, blk_idx);
+			if (!ret)
+				flush_dcache_page(page);
+			return ret;
+		}
+
+		/* Read the block into a temporary buffer, we may sleep */
+		uncmem = kmalloc(PAGE_SIZE, GFP_NOIO);
+		if (!uncmem)
+			return -ENOMEM;
+		ret = zram_read_from_bdev(zram, uncmem, blk_idx, offset,
+					  bvec->bv_len);
+		if (!ret) {
+			user_mem = kmap_atomic(page);
+			memcpy(user_mem + bvec->bv_offset, uncmem,
+			       bvec->bv_len);
+			kunmap_atomic(user_mem);
+			flush_dcache_page(page);
+		}
+		kfree(uncmem);
+		return ret;
+	}
+#endif
 	if (unlikely(!meta->table[index].handle) ||
 			zram_test_flag(meta, index, ZRAM_SAME)) {
 		bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
@@ -736,6 +1094,8 @@ compress_again:
 
 	meta->table[index].handle = handle;
 	zram_set_obj_size(meta, index, clen);
+	if (clen == PAGE_SIZE)
+		zram_set_flag(meta, index, ZRAM_HUGE);
 	bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
 
 	/* Update stats */
@@ -749,6 +1109,188 @@ out:
 	return ret;
 }
 
+#ifdef CONFIG_ZRAM_WRITEBACK
+struct zram_wb_batch {
+	struct page *pages[ZRAM_WB_BATCH];
+	u32 index[ZRAM_WB_BATCH];
+	unsigned long blk_idx[ZRAM_WB_BATCH];	/* 0 once the write failed */
+	unsigned int nr;
+};
+
+/*
+ * Write the pages of @wb out, one bio per run of contiguous blocks.
+ */
+static void zram_wb_submit(struct zram *zram, struct zram_wb_batch *wb)
+{
+	unsigned int i, start;
+	struct bio *bio;
+	int ret;
+
+	for (start = 0; start < wb->nr; start = i) {
+		for (i = start + 1; i < wb->nr; i++)
+			if (wb->blk_idx[i] != wb->blk_idx[i - 1] + 1)
+				break;
+
+		bio = bio_alloc(GFP_KERNEL, i - start);
+		if (bio) {
+			unsigned int j;
+
+			bio->bi_iter.bi_sector =
+				wb->blk_idx[start] << SECTORS_PER_PAGE_SHIFT;
+			bio->bi_bdev = zram->bdev;
+			bio_set_op_attrs(bio, REQ_OP_WRITE, REQ_SYNC);
+			for (j = start; j < i; j++)
+				bio_add_page(bio, wb->pages[j], PAGE_SIZE, 0);
+
+			ret = submit_bio_wait(bio);
+			bio_put(bio);
+		} else {
+			ret = -ENOMEM;
+		}
+
+		if (ret) {
+			unsigned int j;
+
+			pr_err("Backing device write failed! err=%d\n", ret);
+			for (j = start; j < i; j++) {
+				zram_free_bdev_block(zram, wb->blk_idx[j]);
+				wb->blk_idx[j] = 0;
+			}
+		}
+	}
+}
+
+/*
+ * Point the slots of @wb at their blocks and free their memory, unless
+ * they were rewritten or freed while the I/O ran.
+ */
+static void zram_wb_commit(struct zram *zram, struct zram_wb_batch *wb)
+{
+	struct zram_meta *meta = zram->meta;
+	unsigned int i;
+
+	for (i = 0; i < wb->nr; i++) {
+		u32 index = wb->index[i];
+		unsigned long blk_idx = wb->blk_idx[i];
+
+		bit_spin_lock(ZRAM_ACCESS, &meta->table[index].value);
+		if (blk_idx && zram_test_flag(meta, index, ZRAM_UNDER_WB)) {
+			zram_free_page(zram, index);
+			zram_set_flag(meta, index, ZRAM_WB);
+			zram_set_element(meta, index, blk_idx);
+			atomic64_inc(&zram->stats.bd_count);
+			atomic64_inc(&zram->stats.bd_writes);
+		} else {
+			zram_clear_flag(meta, index, ZRAM_UNDER_WB);
+			if (blk_idx)
+				zram_free_bdev_block(zram, blk_idx);
+		}
+		bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
+	}
+	wb->nr = 0;
+}
+
+/*
+ * Writing "idle" moves the pages marked idle through the idle attribute,
+ * "huge" the ones that were stored uncompressed, to the backing device.
+ */
+static ssize_t writeback_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	struct zram_meta *meta;
+	struct zram_wb_batch *wb;
+	enum zram_pageflags mode;
+	unsigned long nr_pages, index, blk_idx = 0;
+	unsigned int i;
+	ssize_t ret = len;
+
+	if (sysfs_streq(buf, "idle"))
+		mode = ZRAM_IDLE;
+	else if (sysfs_streq(buf, "huge"))
+		mode = ZRAM_HUGE;
+	else
+		return -EINVAL;
+
+	wb = kzalloc(sizeof(*wb), GFP_KERNEL);
+	if (!wb)
+		return -ENOMEM;
+	for (i = 0; i < ZRAM_WB_BATCH; i++) {
+		wb->pages[i] = alloc_page(GFP_KERNEL);
+		if (!wb->pages[i]) {
+			ret = -ENOMEM;
+			goto out_free;
+		}
+	}
+
+	down_read(&zram->init_lock);
+	if (!init_done(zram)) {
+		ret = -EINVAL;
+		goto out_unlock;
+	}
+	if (!zram->backing_dev) {
+		ret = -ENODEV;
+		goto out_unlock;
+	}
+
+	meta = zram->meta;
+	nr_pages = zram->disksize >> PAGE_SHIFT;
+	for (index = 0; index < nr_pages; index++) {
+		struct page *page = wb->pages[wb->nr];
+
+		bit_spin_lock(ZRAM_ACCESS, &meta->table[index].value);
+		if (!meta->table[index].handle ||
+		    zram_test_flag(meta, index, ZRAM_SAME) ||
+		    zram_test_flag(meta, index, ZRAM_WB) ||
+		    zram_test_flag(meta, index, ZRAM_UNDER_WB) ||
+		    !zram_test_flag(meta, index, mode)) {
+			bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
+			continue;
+		}
+		zram_set_flag(meta, index, ZRAM_UNDER_WB);
+		bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
+
+		blk_idx = zram_alloc_bdev_block(zram, blk_idx + 1);
+		if (!blk_idx) {
+			bit_spin_lock(ZRAM_ACCESS, &meta->table[index].value);
+			zram_clear_flag(meta, index, ZRAM_UNDER_WB);
+			bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
+			ret = -ENOSPC;
+			break;
+		}
+
+		if (zram_decompress_page(zram, page_address(page), index)) {
+			bit_spin_lock(ZRAM_ACCESS, &meta->table[index].value);
+			zram_clear_flag(meta, index, ZRAM_UNDER_WB);
+			bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
+			zram_free_bdev_block(zram, blk_idx);
+			continue;
+		}
+
+		wb->index[wb->nr] = index;
+		wb->blk_idx[wb->nr] = blk_idx;
+		if (++wb->nr == ZRAM_WB_BATCH) {
+			zram_wb_submit(zram, wb);
+			zram_wb_commit(zram, wb);
+		}
+		cond_resched();
+	}
+
+	if (wb->nr) {
+		zram_wb_submit(zram, wb);
+		zram_wb_commit(zram, wb);
+	}
+out_unlock:
+	up_read(&zram->init_lock);
+out_free:
+	for (i = 0; i < ZRAM_WB_BATCH; i++)
+		if (wb->pages[i])
+			__free_page(wb->pages[i]);
+	kfree(wb);
+	return ret;
+}
+#endif /* CONFIG_ZRAM_WRITEBACK */
+
 /*
  * zram_bio_discard - handler on discard request
  * @index: physical block index in PAGE_SIZE units
@@ -818,6 +1360,69 @@ static int zram_bvec_rw(struct zram *zram, struct bio_vec *bvec, u32 index,
 	return ret;
 }
 
+struct zram_comp_work {
+	struct work_struct work;
+	struct zram *zram;
+	struct bio *bio;
+	struct bio_vec bvec;
+	u32 index;
+};
+
+static void zram_comp_work_fn(struct work_struct *work)
+{
+	struct zram_comp_work *zw = container_of(work, struct zram_comp_work,
+						 work);
+	struct bio *bio = zw->bio;
+
+	if (zram_bvec_rw(zw->zram, &zw->bvec, zw->index, 0, true) < 0)
+		bio->bi_error = -EIO;
+	kfree(zw);
+	bio_endio(bio);
+}
+
+/*
+ * With parallel_comp set, each whole page of a write is compressed by a
+ * worker of its own and the submitter returns right away.  A burst of
+ * swap-out from reclaim is then compressed by idle CPUs in parallel,
+ * instead of all of it on the CPU doing reclaim.  The bio completes once
+ * its last page is stored.
+ */
+static bool zram_write_parallel(struct zram *zram, struct bio *bio, u32 index)
+{
+	struct bio_vec bvec;
+	struct bvec_iter iter;
+
+	if (!READ_ONCE(zram->parallel_comp) || bio_op(bio) != REQ_OP_WRITE)
+		return false;
+
+	bio_for_each_segment(bvec, bio, iter)
+		if (is_partial_io(&bvec))
+			return false;
+
+	bio_for_each_segment(bvec, bio, iter) {
+		struct zram_comp_work *zw = kmalloc(sizeof(*zw), GFP_NOIO);
+
+		if (!zw) {
+			/* no memory, do this one ourselves */
+			if (zram_bvec_rw(zram, &bvec, index, 0, true) < 0)
+				bio->bi_error = -EIO;
+			index++;
+			continue;
+		}
+
+		INIT_WORK(&zw->work, zram_comp_work_fn);
+		zw->zram = zram;
+		zw->bio = bio;
+		zw->bvec = bvec;
+		zw->index = index++;
+		bio_inc_remaining(bio);
+		queue_work(zram_comp_wq, &zw->work);
+	}
+
+	bio_endio(bio);
+	return true;
+}
+
 static void __zram_make_request(struct zram *zram, struct bio *bio)
 {
 	int offset;
@@ -839,6 +1444,9 @@ static void __zram_make_request(struct zram *zram, struct bio *bio)
 		break;
 	}
 
+	if (!offset && zram_write_parallel(zram, bio, index))
+		return;
+
 	bio_for_each_segment(bvec, bio, iter) {
 		int max_transfer_size = PAGE_SIZE - offset;
 
@@ -925,6 +1533,10 @@ static int zram_rw_page(struct block_device *bdev, sector_t sector,
 
 	zram = bdev->bd_disk->private_data;
 
+	/* Make swap fall back to a bio, so that it is compressed async */
+	if (is_write && READ_ONCE(zram->parallel_comp))
+		return -EOPNOTSUPP;
+
 	if (!valid_io_request(zram, sector, PAGE_SIZE)) {
 		atomic64_inc(&zram->stats.invalid_io);
 		err = -EINVAL;
@@ -964,6 +1576,7 @@ static void zram_reset_device(struct zram *zram)
 	zram->limit_pages = 0;
 
 	if (!init_done(zram)) {
+		zram_reset_bdev(zram);
 		up_write(&zram->init_lock);
 		return;
 	}
@@ -983,6 +1596,10 @@ static void zram_reset_device(struct zram *zram)
 	/* I/O operation under all of CPU are done so let's free */
 	zram_meta_free(meta, disksize);
 	zcomp_destroy(comp);
+
+	down_write(&zram->init_lock);
+	zram_reset_bdev(zram);
+	up_write(&zram->init_lock);
 }
 
 static ssize_t disksize_store(struct device *dev,
@@ -1110,6 +1727,10 @@ static DEVICE_ATTR_WO(mem_limit);
 static DEVICE_ATTR_WO(mem_used_max);
 static DEVICE_ATTR_RW(max_comp_streams);
 static DEVICE_ATTR_RW(comp_algorithm);
+static DEVICE_ATTR_RW(parallel_comp);
+#ifdef CONFIG_ZRAM_WRITEBACK
+static DEVICE_ATTR_WO(writeback);
+#endif
 
 static struct attribute *zram_disk_attrs[] = {
 	&dev_attr_disksize.attr,
@@ -1120,9 +1741,16 @@ static struct attribute *zram_disk_attrs[] = {
 	&dev_attr_mem_used_max.attr,
 	&dev_attr_max_comp_streams.attr,
 	&dev_attr_comp_algorithm.attr,
+	&dev_attr_parallel_comp.attr,
 	&dev_attr_io_stat.attr,
 	&dev_attr_mm_stat.attr,
 	&dev_attr_debug_stat.attr,
+#ifdef CONFIG_ZRAM_WRITEBACK
+	&dev_attr_backing_dev.attr,
+	&dev_attr_idle.attr,
+	&dev_attr_writeback.attr,
+	&dev_attr_bd_stat.attr,
+#endif
 	NULL,
 };
 
@@ -1354,6 +1982,7 @@ static void destroy_devices(void)
 	idr_for_each(&zram_index_idr, &zram_remove_cb, NULL);
 	idr_destroy(&zram_index_idr);
 	unregister_blkdev(zram_major, "zram");
+	destroy_workqueue(zram_comp_wq);
 	cpuhp_remove_multi_state(CPUHP_ZCOMP_PREPARE);
 }
 
@@ -1366,9 +1995,18 @@ static int __init zram_init(void)
 	if (ret < 0)
 		return ret;
 
+	/* on the swap-out path, needs to make progress under reclaim */
+	zram_comp_wq = alloc_workqueue("zram_comp",
+				       WQ_UNBOUND | WQ_MEM_RECLAIM, 0);
+	if (!zram_comp_wq) {
+		cpuhp_remove_multi_state(CPUHP_ZCOMP_PREPARE);
+		return -ENOMEM;
+	}
+
 	ret = class_register(&zram_control_class);
 	if (ret) {
 		pr_err("Unable to register zram-control class\n");
+		destroy_workqueue(zram_comp_wq);
 		cpuhp_remove_multi_state(CPUHP_ZCOMP_PREPARE);
 		return ret;
 	}
@@ -1377,6 +2015,7 @@ static int __init zram_init(void)
 	if (zram_major <= 0) {
 		pr_err("Unable to get major number\n");
 		class_unregister(&zram_control_class);
+		destroy_workqueue(zram_comp_wq);
 		cpuhp_remove_multi_state(CPUHP_ZCOMP_PREPARE);
 		return -EBUSY;
 	}
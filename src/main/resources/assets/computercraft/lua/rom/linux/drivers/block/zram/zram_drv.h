@@ -63,6 +63,10 @@ enum zram_pageflags {
 	/* Page consists entirely of zeros */
 	ZRAM_SAME = ZRAM_FLAG_SHIFT,
 	ZRAM_ACCESS,	/* page is now accessed */
+	ZRAM_HUGE,	/* page is stored uncompressed */
+	ZRAM_IDLE,	/* not accessed since last marked idle */
+	ZRAM_WB,	/* page is on the backing device, element is its block */
+	ZRAM_UNDER_WB,	/* page is being written back */
 
 	__NR_ZRAM_PAGEFLAGS,
 };
@@ -90,6 +94,11 @@ struct zram_stats {
 	atomic64_t pages_stored;	/* no. of pages currently stored */
 	atomic_long_t max_used_pages;	/* no. of maximum pages stored */
 	atomic64_t writestall;		/* no. of write slow paths */
+#ifdef CONFIG_ZRAM_WRITEBACK
+	atomic64_t bd_count;		/* no. of pages on backing device */
+	atomic64_t bd_reads;		/* no. of reads from backing device */
+	atomic64_t bd_writes;		/* no. of writes to backing device */
+#endif
 };
 
 struct zram_meta {
@@ -119,5 +128,16 @@ struct zram {
 	 * zram is claimed so open request will be failed
 	 */
 	bool claim; /* Protected by bdev->bd_mutex */
+	/* Spread compression of multi-page writes over zram_comp_wq */
+	bool parallel_comp;
+#ifdef CONFIG_ZRAM_WRITEBACK
+	/* Backing device, protected by init_lock */
+	struct file *backing_dev;
+	struct block_device *bdev;
+	unsigned int old_block_size;
+	/* One bit per PAGE_SIZE block of the backing device, 0 is unused */
+	unsigned long *bitmap;
+	unsigned long nr_pages;
+#endif
 };
 #endif
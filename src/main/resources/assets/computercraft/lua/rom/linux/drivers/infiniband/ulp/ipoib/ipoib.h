@@ -79,7 +79,7 @@ enum {
 	IPOIB_MIN_QUEUE_SIZE	  = 2,
 	IPOIB_CM_MAX_CONN_QP	  = 4096,
 
-	IPOIB_NUM_WC		  = 4,
+	IPOIB_NUM_WC		  = 16,
 
 	IPOIB_MAX_PATH_REC_QUEUE  = 3,
 	IPOIB_MAX_MCAST_QUEUE	  = 64,
@@ -326,6 +326,7 @@ struct ipoib_dev_priv {
 	struct net_device *dev;
 
 	struct napi_struct napi;
+	struct napi_struct send_napi;
 
 	unsigned long flags;
 
@@ -401,7 +402,6 @@ struct ipoib_dev_priv {
 #endif
 	u64	hca_caps;
 	struct ipoib_ethtool_st ethtool;
-	struct timer_list poll_timer;
 	unsigned max_send_sge;
 	bool sm_fullmember_sendonly_support;
 };
@@ -468,6 +468,7 @@ extern struct workqueue_struct *ipoib_workqueue;
 /* functions */
 
 int ipoib_poll(struct napi_struct *napi, int budget);
+int ipoib_tx_poll(struct napi_struct *napi, int budget);
 void ipoib_ib_completion(struct ib_cq *cq, void *dev_ptr);
 void ipoib_send_comp_handler(struct ib_cq *cq, void *dev_ptr);
 
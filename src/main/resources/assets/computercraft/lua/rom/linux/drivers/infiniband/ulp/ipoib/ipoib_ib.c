@@ -490,25 +490,36 @@ void ipoib_ib_completion(struct ib_cq *cq, void *dev_ptr)
 	napi_schedule(&priv->napi);
 }
 
-static void drain_tx_cq(struct net_device *dev)
+/*
+ * The send CQ is only armed once the TX ring fills up; until then
+ * ipoib_send() reaps send completions itself.  Keep re-arming it for as
+ * long as the queue stays stopped, rather than polling on every tick.
+ */
+int ipoib_tx_poll(struct napi_struct *napi, int budget)
 {
-	struct ipoib_dev_priv *priv = netdev_priv(dev);
+	struct ipoib_dev_priv *priv = container_of(napi, struct ipoib_dev_priv,
+						   send_napi);
+	struct net_device *dev = priv->dev;
 
 	netif_tx_lock(dev);
 	while (poll_tx(priv))
 		; /* nothing */
 
-	if (netif_queue_stopped(dev))
-		mod_timer(&priv->poll_timer, jiffies + 1);
-
+	napi_complete(napi);
+	if (netif_queue_stopped(dev) &&
+	    ib_req_notify_cq(priv->send_cq, IB_CQ_NEXT_COMP |
+			     IB_CQ_REPORT_MISSED_EVENTS) > 0)
+		napi_schedule(napi);
 	netif_tx_unlock(dev);
+
+	return 0;
 }
 
 void ipoib_send_comp_handler(struct ib_cq *cq, void *dev_ptr)
 {
 	struct ipoib_dev_priv *priv = netdev_priv(dev_ptr);
 
-	mod_timer(&priv->poll_timer, jiffies);
+	napi_schedule(&priv->send_napi);
 }
 
 static inline int post_send(struct ipoib_dev_priv *priv,
@@ -692,11 +703,6 @@ static void ipoib_stop_ah(struct net_device *dev)
 	ipoib_flush_ah(dev);
 }
 
-static void ipoib_ib_tx_timer_func(unsigned long ctx)
-{
-	drain_tx_cq((struct net_device *)ctx);
-}
-
 int ipoib_ib_dev_open(struct net_device *dev)
 {
 	struct ipoib_dev_priv *priv = netdev_priv(dev);
@@ -732,13 +738,17 @@ int ipoib_ib_dev_open(struct net_device *dev)
 	queue_delayed_work(priv->wq, &priv->ah_reap_task,
 			   round_jiffies_relative(HZ));
 
-	if (!test_and_set_bit(IPOIB_FLAG_INITIALIZED, &priv->flags))
+	if (!test_and_set_bit(IPOIB_FLAG_INITIALIZED, &priv->flags)) {
 		napi_enable(&priv->napi);
+		napi_enable(&priv->send_napi);
+	}
 
 	return 0;
 dev_stop:
-	if (!test_and_set_bit(IPOIB_FLAG_INITIALIZED, &priv->flags))
+	if (!test_and_set_bit(IPOIB_FLAG_INITIALIZED, &priv->flags)) {
 		napi_enable(&priv->napi);
+		napi_enable(&priv->send_napi);
+	}
 	ipoib_ib_dev_stop(dev);
 	return -1;
 }
@@ -846,8 +856,10 @@ void ipoib_ib_dev_stop(struct net_device *dev)
 	struct ipoib_tx_buf *tx_req;
 	int i;
 
-	if (test_and_clear_bit(IPOIB_FLAG_INITIALIZED, &priv->flags))
+	if (test_and_clear_bit(IPOIB_FLAG_INITIALIZED, &priv->flags)) {
 		napi_disable(&priv->napi);
+		napi_disable(&priv->send_napi);
+	}
 
 	ipoib_cm_dev_stop(dev);
 
@@ -903,7 +915,6 @@ void ipoib_ib_dev_stop(struct net_device *dev)
 	ipoib_dbg(priv, "All sends and receives done.\n");
 
 timeout:
-	del_timer_sync(&priv->poll_timer);
 	qp_attr.qp_state = IB_QPS_RESET;
 	if (ib_modify_qp(priv->qp, &qp_attr, IB_QP_STATE))
 		ipoib_warn(priv, "Failed to modify QP to RESET state\n");
@@ -926,9 +937,6 @@ int ipoib_ib_dev_init(struct net_device *dev, struct ib_device *ca, int port)
 		return -ENODEV;
 	}
 
-	setup_timer(&priv->poll_timer, ipoib_ib_tx_timer_func,
-		    (unsigned long) dev);
-
 	if (dev->flags & IFF_UP) {
 		if (ipoib_ib_dev_open(dev)) {
 			ipoib_transport_dev_cleanup(dev);
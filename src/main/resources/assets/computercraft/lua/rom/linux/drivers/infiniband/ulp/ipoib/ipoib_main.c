@@ -1787,6 +1787,7 @@ void ipoib_setup(struct net_device *dev)
 	ipoib_set_ethtool_ops(dev);
 
 	netif_napi_add(dev, &priv->napi, ipoib_poll, NAPI_POLL_WEIGHT);
+	netif_tx_napi_add(dev, &priv->send_napi, ipoib_tx_poll, MAX_SEND_CQE);
 
 	dev->watchdog_timeo	 = HZ;
 
@@ -2883,6 +2883,45 @@ static struct device_attribute *srp_host_attrs[] = {
 	NULL
 };
 
+/*
+ * Map each CPU onto one of the channels of its own NUMA node, in the same
+ * order in which srp_create_target() created them, so that a command is
+ * submitted on and completes through the completion vector picked for that
+ * node.  CPUs of a node without a channel are spread over all channels.
+ */
+static int srp_map_queues(struct Scsi_Host *shost)
+{
+	struct srp_target_port *target = host_to_target(shost);
+	unsigned int *map = shost->tag_set.mq_map;
+	unsigned int cpu, c, i, first, nr, idx;
+	int node;
+
+	for_each_possible_cpu(cpu) {
+		node = cpu_to_node(cpu);
+		first = nr = 0;
+		for (i = 0; i < target->ch_count; i++) {
+			if (target->ch[i].node != node)
+				continue;
+			if (!nr)
+				first = i;
+			nr++;
+		}
+		if (!nr) {
+			map[cpu] = cpu % target->ch_count;
+			continue;
+		}
+
+		idx = 0;
+		for_each_cpu(c, cpumask_of_node(node)) {
+			if (c == cpu)
+				break;
+			idx++;
+		}
+		map[cpu] = first + idx % nr;
+	}
+	return 0;
+}
+
 static struct scsi_host_template srp_template = {
 	.module				= THIS_MODULE,
 	.name				= "InfiniBand SRP initiator",
@@ -2892,6 +2931,7 @@ static struct scsi_host_template srp_template = {
 	.info				= srp_target_info,
 	.queuecommand			= srp_queuecommand,
 	.change_queue_depth             = srp_change_queue_depth,
+	.map_queues			= srp_map_queues,
 	.eh_timed_out			= srp_timed_out,
 	.eh_abort_handler		= srp_abort,
 	.eh_device_reset_handler	= srp_reset_device,
@@ -3426,6 +3466,7 @@ static ssize_t srp_create_target(struct device *dev,
 				continue;
 			ch = &target->ch[ch_start + cpu_idx];
 			ch->target = target;
+			ch->node = node;
 			ch->comp_vector = cv_start == cv_end ? cv_start :
 				cv_start + cpu_idx % (cv_end - cv_start);
 			spin_lock_init(&ch->lock);
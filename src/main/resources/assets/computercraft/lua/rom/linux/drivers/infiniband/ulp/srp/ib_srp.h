@@ -162,6 +162,7 @@ struct srp_rdma_ch {
 	struct srp_request     *req_ring;
 	int			max_ti_iu_len;
 	int			comp_vector;
+	int			node;
 
 	u64			tsk_mgmt_tag;
 	struct completion	tsk_mgmt_done;
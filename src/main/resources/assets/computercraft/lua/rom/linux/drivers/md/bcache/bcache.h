@@ -334,6 +334,16 @@ struct cached_dev {
 	struct semaphore	in_flight;
 	struct task_struct	*writeback_thread;
 
+	/*
+	 * Writes to the backing device are issued in the order read_dirty()
+	 * read the keys, so that a pass of contiguous keys stays sequential.
+	 */
+	atomic_t		writeback_sequence_next;
+	struct closure_waitlist	writeback_ordering_wait;
+
+	/* jiffies of the last foreground bio, for idle detection */
+	unsigned long		last_foreground_io;
+
 	struct keybuf		writeback_keys;
 
 	/* For tracking sequential IO */
@@ -358,6 +368,7 @@ struct cached_dev {
 	unsigned		writeback_running:1;
 	unsigned char		writeback_percent;
 	unsigned		writeback_delay;
+	unsigned		writeback_idle_ms;
 
 	uint64_t		writeback_rate_target;
 	int64_t			writeback_rate_proportional;
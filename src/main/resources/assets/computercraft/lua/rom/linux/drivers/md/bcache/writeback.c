@@ -87,18 +87,40 @@ static void update_writeback_rate(struct work_struct *work)
 			      dc->writeback_rate_update_seconds * HZ);
 }
 
+static bool backing_idle(struct cached_dev *dc)
+{
+	return dc->writeback_idle_ms &&
+		time_after(jiffies, READ_ONCE(dc->last_foreground_io) +
+			   msecs_to_jiffies(dc->writeback_idle_ms));
+}
+
 static unsigned writeback_delay(struct cached_dev *dc, unsigned sectors)
 {
 	if (test_bit(BCACHE_DEV_DETACHING, &dc->disk.flags) ||
 	    !dc->writeback_percent)
 		return 0;
 
+	/*
+	 * Nothing to compete with: write back at full speed, but don't
+	 * build up credit that would let writeback keep going at full
+	 * speed once foreground I/O comes back.
+	 */
+	if (backing_idle(dc)) {
+		dc->writeback_rate.next = local_clock();
+		return 0;
+	}
+
 	return bch_next_delay(&dc->writeback_rate, sectors);
 }
 
+/* Limits on the contiguous keys read_dirty() writes back in one pass */
+#define MAX_WRITEBACKS_IN_PASS	5
+#define MAX_WRITESIZE_IN_PASS	5000	/* sectors */
+
 struct dirty_io {
 	struct closure		cl;
 	struct cached_dev	*dc;
+	unsigned		sequence;
 	struct bio		bio;
 };
 
@@ -177,15 +199,31 @@ static void write_dirty(struct closure *cl)
 {
 	struct dirty_io *io = container_of(cl, struct dirty_io, cl);
 	struct keybuf_key *w = io->bio.bi_private;
+	struct cached_dev *dc = io->dc;
+
+	/* Reads complete in any order; wait for the writes before ours */
+	if (atomic_read(&dc->writeback_sequence_next) != io->sequence) {
+		closure_wait(&dc->writeback_ordering_wait, cl);
+
+		/* Our turn may have come before we were on the wait list */
+		if (atomic_read(&dc->writeback_sequence_next) == io->sequence)
+			closure_wake_up(&dc->writeback_ordering_wait);
+
+		continue_at(cl, write_dirty, system_wq);
+		return;
+	}
 
 	dirty_init(w);
 	bio_set_op_attrs(&io->bio, REQ_OP_WRITE, 0);
 	io->bio.bi_iter.bi_sector = KEY_START(&w->key);
-	io->bio.bi_bdev		= io->dc->bdev;
+	io->bio.bi_bdev		= dc->bdev;
 	io->bio.bi_end_io	= dirty_endio;
 
 	closure_bio_submit(&io->bio, cl);
 
+	atomic_set(&dc->writeback_sequence_next, io->sequence + 1);
+	closure_wake_up(&dc->writeback_ordering_wait);
+
 	continue_at(cl, write_dirty_finish, system_wq);
 }
 
@@ -212,9 +250,12 @@ static void read_dirty_submit(struct closure *cl)
 static void read_dirty(struct cached_dev *dc)
 {
 	unsigned delay = 0;
-	struct keybuf_key *w;
+	struct keybuf_key *next, *keys[MAX_WRITEBACKS_IN_PASS], *w;
+	size_t size;
+	int nk, i;
 	struct dirty_io *io;
 	struct closure cl;
+	unsigned sequence = 0;
 
 	closure_init_stack(&cl);
 
@@ -223,55 +264,88 @@ static void read_dirty(struct cached_dev *dc)
 	 * mempools.
 	 */
 
-	while (!kthread_should_stop()) {
-
-		w = bch_keybuf_next(&dc->writeback_keys);
-		if (!w)
-			break;
-
-		BUG_ON(ptr_stale(dc->disk.c, &w->key, 0));
-
-		if (KEY_START(&w->key) != dc->last_read ||
-		    jiffies_to_msecs(delay) > 50)
-			while (!kthread_should_stop() && delay)
-				delay = schedule_timeout_interruptible(delay);
-
-		dc->last_read	= KEY_OFFSET(&w->key);
-
-		io = kzalloc(sizeof(struct dirty_io) + sizeof(struct bio_vec)
-			     * DIV_ROUND_UP(KEY_SIZE(&w->key), PAGE_SECTORS),
-			     GFP_KERNEL);
-		if (!io)
-			goto err;
-
-		w->private	= io;
-		io->dc		= dc;
-
-		dirty_init(w);
-		bio_set_op_attrs(&io->bio, REQ_OP_READ, 0);
-		io->bio.bi_iter.bi_sector = PTR_OFFSET(&w->key, 0);
-		io->bio.bi_bdev		= PTR_CACHE(dc->disk.c,
-						    &w->key, 0)->bdev;
-		io->bio.bi_end_io	= read_dirty_endio;
-
-		if (bio_alloc_pages(&io->bio, GFP_KERNEL))
-			goto err_free;
-
-		trace_bcache_writeback(&w->key);
+	next = bch_keybuf_next(&dc->writeback_keys);
+	atomic_set(&dc->writeback_sequence_next, sequence);
+
+	while (!kthread_should_stop() && next) {
+		size = 0;
+		nk = 0;
+
+		/*
+		 * The keybuf is sorted: gather the contiguous keys that
+		 * follow, so that their writes to the backing device go
+		 * out as one sequential run.
+		 */
+		do {
+			BUG_ON(ptr_stale(dc->disk.c, &next->key, 0));
+
+			if (nk &&
+			    KEY_START(&next->key) != KEY_OFFSET(&keys[nk - 1]->key))
+				break;
+			if (nk >= MAX_WRITEBACKS_IN_PASS ||
+			    size + KEY_SIZE(&next->key) > MAX_WRITESIZE_IN_PASS)
+				break;
+
+			size += KEY_SIZE(&next->key);
+			keys[nk++] = next;
+		} while ((next = bch_keybuf_next(&dc->writeback_keys)));
+
+		for (i = 0; i < nk; i++) {
+			w = keys[i];
+
+			io = kzalloc(sizeof(struct dirty_io) +
+				     sizeof(struct bio_vec) *
+				     DIV_ROUND_UP(KEY_SIZE(&w->key), PAGE_SECTORS),
+				     GFP_KERNEL);
+			if (!io)
+				goto err;
+
+			w->private	= io;
+			io->dc		= dc;
+			io->sequence	= sequence++;
+
+			dirty_init(w);
+			bio_set_op_attrs(&io->bio, REQ_OP_READ, 0);
+			io->bio.bi_iter.bi_sector = PTR_OFFSET(&w->key, 0);
+			io->bio.bi_bdev		= PTR_CACHE(dc->disk.c,
+							    &w->key, 0)->bdev;
+			io->bio.bi_end_io	= read_dirty_endio;
+
+			if (bio_alloc_pages(&io->bio, GFP_KERNEL))
+				goto err_free;
+
+			trace_bcache_writeback(&w->key);
+
+			down(&dc->in_flight);
+			closure_call(&io->cl, read_dirty_submit, NULL, &cl);
+		}
 
-		down(&dc->in_flight);
-		closure_call(&io->cl, read_dirty_submit, NULL, &cl);
+		dc->last_read = KEY_OFFSET(&keys[nk - 1]->key);
 
-		delay = writeback_delay(dc, KEY_SIZE(&w->key));
+		/* Rate limit between passes, not between the keys of a pass */
+		delay = writeback_delay(dc, size);
+		while (!kthread_should_stop() && delay) {
+			schedule_timeout_interruptible(delay);
+			delay = writeback_delay(dc, 0);
+		}
 	}
 
 	if (0) {
 err_free:
 		kfree(w->private);
 err:
-		bch_keybuf_del(&dc->writeback_keys, w);
+		/*
+		 * The writes after the failed key would wait for its
+		 * sequence forever: drop them before submitting anything
+		 * else.
+		 */
+		for (; i < nk; i++)
+			bch_keybuf_del(&dc->writeback_keys, keys[i]);
 	}
 
+	if (next)
+		bch_keybuf_del(&dc->writeback_keys, next);
+
 	/*
 	 * Wait for outstanding writeback IOs to finish (and keybuf slots to be
 	 * freed) before refilling again
@@ -505,6 +579,7 @@ void bch_cached_dev_writeback_init(struct cached_dev *dc)
 	dc->writeback_running		= true;
 	dc->writeback_percent		= 10;
 	dc->writeback_delay		= 30;
+	dc->writeback_idle_ms		= 2000;
 	dc->writeback_rate.rate		= 1024;
 
 	dc->writeback_rate_update_seconds = 5;
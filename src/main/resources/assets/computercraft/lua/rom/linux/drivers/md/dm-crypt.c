@@ -25,6 +25,7 @@
 #include <linux/scatterlist.h>
 #include <linux/rbtree.h>
 #include <linux/ctype.h>
+#include <linux/percpu_counter.h>
 #include <asm/page.h>
 #include <asm/unaligned.h>
 #include <crypto/hash.h>
@@ -116,7 +117,8 @@ struct iv_tcw_private {
  * and encrypts / decrypts at the same time.
  */
 enum flags { DM_CRYPT_SUSPENDED, DM_CRYPT_KEY_VALID,
-	     DM_CRYPT_SAME_CPU, DM_CRYPT_NO_OFFLOAD };
+	     DM_CRYPT_SAME_CPU, DM_CRYPT_NO_OFFLOAD,
+	     DM_CRYPT_NO_READ_WORKQUEUE, DM_CRYPT_NO_WRITE_WORKQUEUE };
 
 /*
  * The fields in here must be read only after initialization.
@@ -141,6 +143,11 @@ struct crypt_config {
 	wait_queue_head_t write_thread_wait;
 	struct rb_root write_tree;
 
+	/* Bios encrypted or decrypted in the submitting or completing context */
+	struct percpu_counter nr_inline;
+	/* Bios handed to kcryptd */
+	struct percpu_counter nr_offloaded;
+
 	char *cipher;
 	char *cipher_string;
 	char *key_string;
@@ -1264,7 +1271,8 @@ static void kcryptd_crypt_write_io_submit(struct dm_crypt_io *io, int async)
 
 	clone->bi_iter.bi_sector = cc->start + io->sector;
 
-	if (likely(!async) && test_bit(DM_CRYPT_NO_OFFLOAD, &cc->flags)) {
+	if (likely(!async) && (test_bit(DM_CRYPT_NO_OFFLOAD, &cc->flags) ||
+			       test_bit(DM_CRYPT_NO_WRITE_WORKQUEUE, &cc->flags))) {
 		generic_make_request(clone);
 		return;
 	}
@@ -1317,6 +1325,11 @@ static void kcryptd_crypt_write_convert(struct dm_crypt_io *io)
 	if (r)
 		io->error = -EIO;
 	crypt_finished = atomic_dec_and_test(&io->ctx.cc_pending);
+	if (!crypt_finished && test_bit(DM_CRYPT_NO_WRITE_WORKQUEUE, &cc->flags)) {
+		/* Wait for kcryptd_async_done() to finish the last request */
+		wait_for_completion(&io->ctx.restart);
+		crypt_finished = 1;
+	}
 
 	/* Encryption was already finished, submit io now */
 	if (crypt_finished) {
@@ -1384,6 +1397,9 @@ static void kcryptd_async_done(struct crypto_async_request *async_req,
 
 	if (bio_data_dir(io->base_bio) == READ)
 		kcryptd_crypt_read_done(io);
+	else if (test_bit(DM_CRYPT_NO_WRITE_WORKQUEUE, &cc->flags))
+		/* kcryptd_crypt_write_convert() submits inline writes */
+		complete(&ctx->restart);
 	else
 		kcryptd_crypt_write_io_submit(io, 1);
 }
@@ -1402,6 +1418,18 @@ static void kcryptd_queue_crypt(struct dm_crypt_io *io)
 {
 	struct crypt_config *cc = io->cc;
 
+	/*
+	 * Decryption may sleep, so it can only be done inline when the read
+	 * completes in process context, e.g. for polled I/O.
+	 */
+	if (bio_data_dir(io->base_bio) == READ &&
+	    test_bit(DM_CRYPT_NO_READ_WORKQUEUE, &cc->flags) && !in_interrupt()) {
+		percpu_counter_inc(&cc->nr_inline);
+		kcryptd_crypt_read_convert(io);
+		return;
+	}
+
+	percpu_counter_inc(&cc->nr_offloaded);
 	INIT_WORK(&io->work, kcryptd_crypt);
 	queue_work(cc->crypt_queue, &io->work);
 }
@@ -1669,6 +1697,9 @@ static void crypt_dtr(struct dm_target *ti)
 	if (cc->write_thread)
 		kthread_stop(cc->write_thread);
 
+	percpu_counter_destroy(&cc->nr_inline);
+	percpu_counter_destroy(&cc->nr_offloaded);
+
 	if (cc->io_queue)
 		destroy_workqueue(cc->io_queue);
 	if (cc->crypt_queue)
@@ -1874,7 +1905,7 @@ static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 	char dummy;
 
 	static struct dm_arg _args[] = {
-		{0, 3, "Invalid number of feature args"},
+		{0, 5, "Invalid number of feature args"},
 	};
 
 	if (argc < 5) {
@@ -1896,6 +1927,15 @@ static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 	cc->key_size = key_size;
 
 	ti->private = cc;
+
+	ret = percpu_counter_init(&cc->nr_inline, 0, GFP_KERNEL);
+	if (!ret)
+		ret = percpu_counter_init(&cc->nr_offloaded, 0, GFP_KERNEL);
+	if (ret) {
+		ti->error = "Cannot allocate statistics";
+		goto bad;
+	}
+
 	ret = crypt_ctr_cipher(ti, argv[0], argv[1]);
 	if (ret < 0)
 		goto bad;
@@ -1964,6 +2004,14 @@ static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 	}
 	cc->start = tmpll;
 
+	/*
+	 * Writes to sequential zones must reach the device in the order
+	 * they were issued: encrypt and submit them from the map context
+	 * rather than through kcryptd and the sorting write thread.
+	 */
+	if (bdev_is_zoned(cc->dev->bdev))
+		set_bit(DM_CRYPT_NO_WRITE_WORKQUEUE, &cc->flags);
+
 	argv += 5;
 	argc -= 5;
 
@@ -1993,6 +2041,12 @@ static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 			else if (!strcasecmp(opt_string, "submit_from_crypt_cpus"))
 				set_bit(DM_CRYPT_NO_OFFLOAD, &cc->flags);
 
+			else if (!strcasecmp(opt_string, "no_read_workqueue"))
+				set_bit(DM_CRYPT_NO_READ_WORKQUEUE, &cc->flags);
+
+			else if (!strcasecmp(opt_string, "no_write_workqueue"))
+				set_bit(DM_CRYPT_NO_WRITE_WORKQUEUE, &cc->flags);
+
 			else {
 				ti->error = "Invalid feature arguments";
 				goto bad;
@@ -2044,14 +2098,18 @@ static int crypt_map(struct dm_target *ti, struct bio *bio)
 	struct crypt_config *cc = ti->private;
 
 	/*
-	 * If bio is REQ_PREFLUSH or REQ_OP_DISCARD, just bypass crypt queues.
+	 * If bio is REQ_PREFLUSH, REQ_OP_DISCARD or a zone command, just
+	 * bypass crypt queues.
 	 * - for REQ_PREFLUSH device-mapper core ensures that no IO is in-flight
 	 * - for REQ_OP_DISCARD caller must use flush if IO ordering matters
+	 * - zone reports carry no encrypted data and zone resets carry no data
 	 */
 	if (unlikely(bio->bi_opf & REQ_PREFLUSH ||
-	    bio_op(bio) == REQ_OP_DISCARD)) {
+	    bio_op(bio) == REQ_OP_DISCARD ||
+	    bio_op(bio) == REQ_OP_ZONE_REPORT ||
+	    bio_op(bio) == REQ_OP_ZONE_RESET)) {
 		bio->bi_bdev = cc->dev->bdev;
-		if (bio_sectors(bio))
+		if (bio_sectors(bio) || bio_op(bio) == REQ_OP_ZONE_RESET)
 			bio->bi_iter.bi_sector = cc->start +
 				dm_target_offset(ti, bio->bi_iter.bi_sector);
 		return DM_MAPIO_REMAPPED;
@@ -2069,14 +2127,33 @@ static int crypt_map(struct dm_target *ti, struct bio *bio)
 	io->ctx.req = (struct skcipher_request *)(io + 1);
 
 	if (bio_data_dir(io->base_bio) == READ) {
-		if (kcryptd_io_read(io, GFP_NOWAIT))
+		if (test_bit(DM_CRYPT_NO_READ_WORKQUEUE, &cc->flags)) {
+			/* May sleep here rather than going through kcryptd_io */
+			crypt_inc_pending(io);
+			if (kcryptd_io_read(io, GFP_NOIO))
+				io->error = -ENOMEM;
+			crypt_dec_pending(io);
+		} else if (kcryptd_io_read(io, GFP_NOWAIT))
 			kcryptd_queue_read(io);
+	} else if (test_bit(DM_CRYPT_NO_WRITE_WORKQUEUE, &cc->flags)) {
+		percpu_counter_inc(&cc->nr_inline);
+		kcryptd_crypt_write_convert(io);
 	} else
 		kcryptd_queue_crypt(io);
 
 	return DM_MAPIO_SUBMITTED;
 }
 
+static int crypt_end_io(struct dm_target *ti, struct bio *bio, int error)
+{
+	struct crypt_config *cc = ti->private;
+
+	if (!error && bio_op(bio) == REQ_OP_ZONE_REPORT)
+		dm_remap_zone_report(ti, bio, cc->start);
+
+	return error;
+}
+
 static void crypt_status(struct dm_target *ti, status_type_t type,
 			 unsigned status_flags, char *result, unsigned maxlen)
 {
@@ -2086,7 +2163,8 @@ static void crypt_status(struct dm_target *ti, status_type_t type,
 
 	switch (type) {
 	case STATUSTYPE_INFO:
-		result[0] = '\0';
+		DMEMIT("%lld %lld", percpu_counter_sum(&cc->nr_inline),
+		       percpu_counter_sum(&cc->nr_offloaded));
 		break;
 
 	case STATUSTYPE_TABLE:
@@ -2107,6 +2185,8 @@ static void crypt_status(struct dm_target *ti, status_type_t type,
 		num_feature_args += !!ti->num_discard_bios;
 		num_feature_args += test_bit(DM_CRYPT_SAME_CPU, &cc->flags);
 		num_feature_args += test_bit(DM_CRYPT_NO_OFFLOAD, &cc->flags);
+		num_feature_args += test_bit(DM_CRYPT_NO_READ_WORKQUEUE, &cc->flags);
+		num_feature_args += test_bit(DM_CRYPT_NO_WRITE_WORKQUEUE, &cc->flags);
 		if (num_feature_args) {
 			DMEMIT(" %d", num_feature_args);
 			if (ti->num_discard_bios)
@@ -2115,6 +2195,10 @@ static void crypt_status(struct dm_target *ti, status_type_t type,
 				DMEMIT(" same_cpu_crypt");
 			if (test_bit(DM_CRYPT_NO_OFFLOAD, &cc->flags))
 				DMEMIT(" submit_from_crypt_cpus");
+			if (test_bit(DM_CRYPT_NO_READ_WORKQUEUE, &cc->flags))
+				DMEMIT(" no_read_workqueue");
+			if (test_bit(DM_CRYPT_NO_WRITE_WORKQUEUE, &cc->flags))
+				DMEMIT(" no_write_workqueue");
 		}
 
 		break;
@@ -2215,11 +2299,13 @@ static void crypt_io_hints(struct dm_target *ti, struct queue_limits *limits)
 
 static struct target_type crypt_target = {
 	.name   = "crypt",
-	.version = {1, 15, 0},
+	.version = {1, 17, 0},
+	.features = DM_TARGET_ZONED_HM,
 	.module = THIS_MODULE,
 	.ctr    = crypt_ctr,
 	.dtr    = crypt_dtr,
 	.map    = crypt_map,
+	.end_io = crypt_end_io,
 	.status = crypt_status,
 	.postsuspend = crypt_postsuspend,
 	.preresume = crypt_preresume,
@@ -194,9 +194,33 @@ static int stripe_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 		atomic_set(&(sc->stripe[i].error_count), 0);
 	}
 
+	/*
+	 * Zones of a zoned device can only be striped whole: each chunk
+	 * must be exactly one zone so that zone commands map to a single
+	 * zone of a single stripe.
+	 */
+	for (i = 0; i < stripes; i++) {
+		struct block_device *bdev = sc->stripe[i].dev->bdev;
+
+		if (!bdev_is_zoned(bdev))
+			continue;
+		if (chunk_size != bdev_zone_sectors(bdev)) {
+			ti->error = "Chunk size must match the device zone size";
+			r = -EINVAL;
+			goto bad_zoned;
+		}
+		ti->per_io_data_size = sizeof(sector_t);
+	}
+
 	ti->private = sc;
 
 	return 0;
+
+bad_zoned:
+	for (i = 0; i < stripes; i++)
+		dm_put_device(ti, sc->stripe[i].dev);
+	kfree(sc);
+	return r;
 }
 
 static void stripe_dtr(struct dm_target *ti)
@@ -301,6 +325,21 @@ static int stripe_map(struct dm_target *ti, struct bio *bio)
 		return stripe_map_range(sc, bio, target_bio_nr);
 	}
 
+	/*
+	 * Only the first zone of a report can be remapped on completion,
+	 * remember where its chunk starts in the target.
+	 */
+	if (unlikely(bio_op(bio) == REQ_OP_ZONE_REPORT)) {
+		sector_t *zone_sector = dm_per_bio_data(bio, sizeof(sector_t));
+		sector_t chunk = dm_target_offset(ti, bio->bi_iter.bi_sector);
+
+		*zone_sector = bio->bi_iter.bi_sector;
+		if (sc->chunk_size_shift < 0)
+			*zone_sector -= sector_div(chunk, sc->chunk_size);
+		else
+			*zone_sector -= chunk & (sc->chunk_size - 1);
+	}
+
 	stripe_map_sector(sc, bio->bi_iter.bi_sector,
 			  &stripe, &bio->bi_iter.bi_sector);
 
@@ -382,6 +421,13 @@ static int stripe_end_io(struct dm_target *ti, struct bio *bio, int error)
 	char major_minor[16];
 	struct stripe_c *sc = ti->private;
 
+	if (!error && bio_op(bio) == REQ_OP_ZONE_REPORT) {
+		sector_t *zone_sector = dm_per_bio_data(bio, sizeof(sector_t));
+
+		dm_remap_zone_report_one(ti, bio, *zone_sector);
+		return bio->bi_error;
+	}
+
 	if (!error)
 		return 0; /* I/O complete */
 
@@ -441,7 +487,8 @@ static void stripe_io_hints(struct dm_target *ti,
 
 static struct target_type stripe_target = {
 	.name   = "striped",
-	.version = {1, 6, 0},
+	.version = {1, 7, 0},
+	.features = DM_TARGET_ZONED_HM,
 	.module = THIS_MODULE,
 	.ctr    = stripe_ctr,
 	.dtr    = stripe_dtr,
@@ -0,0 +1,1330 @@
+/*
+ * Zoned target: exposes a host-managed or host-aware zoned block device
+ * as a regular block device without any write constraint.
+ *
+ * This file is released under the GPL.
+ */
+
+#include <linux/device-mapper.h>
+#include <linux/dm-io.h>
+
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/blkdev.h>
+#include <linux/bio.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+#include <linux/crc32.h>
+
+#define DM_MSG_PREFIX "zoned"
+
+/*
+ * The target is split in chunks of the device zone size.  A chunk is
+ * stored in a sequential zone of the device, its data zone: writes at
+ * the data zone write pointer go straight to it.  Any other write is
+ * staged in a conventional zone, the chunk buffer zone, at the same
+ * offset, and a bitmap records which blocks of the buffer zone are
+ * valid.  Reads take each block from the buffer zone if it is valid
+ * there, from the data zone if it is below the write pointer, and read
+ * zeroes otherwise.
+ *
+ * Reclaim merges the data and buffer zones of a chunk into a free
+ * sequential zone, which becomes the chunk data zone, and frees the
+ * buffer zone.  One sequential zone is kept spare for this.
+ *
+ * The first conventional zone of the device holds two copies of the
+ * metadata: a super block, the chunk mapping table and the bitmaps of
+ * the buffer zones.  Flushes write the in-memory metadata over the
+ * older copy, so a valid copy always remains on disk.  A zone is only
+ * reset and reused once the metadata no longer mapping it is on disk.
+ *
+ * All bios and reclaim are processed in order from a single ordered
+ * workqueue, which serializes every metadata update.
+ */
+#define DMZ_MAGIC		0x444d5a44	/* "DMZD" */
+#define DMZ_META_VER		1
+
+#define DMZ_BLOCK_SHIFT		12
+#define DMZ_BLOCK_SIZE		(1 << DMZ_BLOCK_SHIFT)
+#define DMZ_BLOCK_SECTORS_SHIFT	(DMZ_BLOCK_SHIFT - SECTOR_SHIFT)
+#define DMZ_BLOCK_SECTORS	(DMZ_BLOCK_SIZE >> SECTOR_SHIFT)
+
+#define DMZ_UNMAPPED		UINT_MAX
+
+/* Sequential zones not mapped to any chunk, for reclaim */
+#define DMZ_NR_SPARE_ZONES	1
+
+/* Percentage of free buffer zones starting and stopping background reclaim */
+#define DMZ_RECLAIM_LOW		25
+#define DMZ_RECLAIM_HIGH	50
+
+#define DMZ_REPORT_NR_ZONES	1024
+#define DMZ_COPY_BLOCKS		256
+#define DMZ_MIN_BIOS		64
+
+struct dmz_super {
+	__le32	magic;
+	__le32	version;
+	__le64	gen;
+	__le32	crc;
+	__le32	zone_sectors;
+	__le32	nr_zones;
+	__le32	nr_chunks;
+	__le32	nr_buffers;
+	__le32	meta_blocks;
+	u8	reserved[4056];
+} __packed;
+
+struct dmz_map {
+	__le32	dzone;
+	__le32	bzone;
+} __packed;
+
+enum {
+	DMZ_ZONE_META,
+	DMZ_ZONE_BUFFER,
+	DMZ_ZONE_DATA,
+	DMZ_ZONE_OFFLINE,
+};
+
+/* Zone flags */
+#define DMZ_WP_STALE		0	/* write failed, write pointer unknown */
+
+struct dmz_zone {
+	sector_t		start;
+	unsigned int		id;
+	unsigned int		type;
+	unsigned long		flags;
+
+	/* Data zones: write pointer, in blocks from the zone start */
+	unsigned int		wp_block;
+
+	/* Buffer zones: valid blocks, little endian in the metadata */
+	void			*bitmap;
+
+	/* Chunk mapped to the zone, or DMZ_UNMAPPED */
+	unsigned int		chunk;
+
+	/* Bios in flight to the zone */
+	atomic_t		ref;
+
+	/* Free list, or LRU list of mapped buffer zones */
+	struct list_head	link;
+};
+
+struct dmz_target {
+	struct dm_dev		*dev;
+	struct block_device	*bdev;
+
+	unsigned int		zone_sectors;
+	unsigned int		zone_sectors_shift;
+	unsigned int		zone_blocks;
+	unsigned int		nr_zones;
+	struct dmz_zone		*zones;
+
+	unsigned int		nr_chunks;
+	unsigned int		nr_data;
+	unsigned int		nr_free_data;
+	unsigned int		nr_buffers;
+	unsigned int		nr_free_buffers;
+
+	struct list_head	free_data;
+	struct list_head	free_buffers;
+	struct list_head	lru_buffers;
+
+	/* Metadata */
+	struct dmz_zone		*meta_zone;
+	unsigned int		meta_blocks;
+	unsigned int		meta_slot;
+	u64			meta_gen;
+	bool			meta_dirty;
+	void			*meta;
+	struct dmz_map		*map;
+
+	struct dm_io_client	*io_client;
+	struct bio_set		*bio_set;
+	void			*copy_buf;
+
+	spinlock_t		lock;
+	struct bio_list		bios;
+	struct workqueue_struct	*wq;
+	struct work_struct	work;
+	struct work_struct	reclaim_work;
+	wait_queue_head_t	wait;
+};
+
+struct dmz_bioctx {
+	struct dmz_target	*dmz;
+	struct dmz_zone		*dzone;
+	struct dmz_zone		*bzone;
+	atomic_t		ref;
+	int			error;
+};
+
+static inline unsigned int dmz_bio_chunk(struct dmz_target *dmz,
+					 struct bio *bio)
+{
+	return bio->bi_iter.bi_sector >> dmz->zone_sectors_shift;
+}
+
+static inline unsigned int dmz_bio_block(struct dmz_target *dmz,
+					 struct bio *bio)
+{
+	return (bio->bi_iter.bi_sector & (dmz->zone_sectors - 1)) >>
+		DMZ_BLOCK_SECTORS_SHIFT;
+}
+
+static inline unsigned int dmz_bio_blocks(struct bio *bio)
+{
+	return bio_sectors(bio) >> DMZ_BLOCK_SECTORS_SHIFT;
+}
+
+static struct dmz_zone *dmz_mapped_zone(struct dmz_target *dmz, __le32 id)
+{
+	u32 zone_id = le32_to_cpu(id);
+
+	if (zone_id == DMZ_UNMAPPED)
+		return NULL;
+
+	return &dmz->zones[zone_id];
+}
+
+static void dmz_put_zone(struct dmz_target *dmz, struct dmz_zone *zone)
+{
+	if (zone && atomic_dec_and_test(&zone->ref))
+		wake_up(&dmz->wait);
+}
+
+/*
+ * Wait for the bios in flight to a zone.  Only called from the
+ * workqueue, which is the only submitter.
+ */
+static void dmz_wait_zone(struct dmz_target *dmz, struct dmz_zone *zone)
+{
+	if (zone)
+		wait_event(dmz->wait, !atomic_read(&zone->ref));
+}
+
+/*----------------------------------------------------------------
+ * Metadata
+ *--------------------------------------------------------------*/
+static int dmz_meta_io(struct dmz_target *dmz, int op, int op_flags,
+		       unsigned int slot, void *buf)
+{
+	struct dm_io_region where = {
+		.bdev = dmz->bdev,
+		.sector = dmz->meta_zone->start +
+			((sector_t)slot * dmz->meta_blocks << DMZ_BLOCK_SECTORS_SHIFT),
+		.count = (sector_t)dmz->meta_blocks << DMZ_BLOCK_SECTORS_SHIFT,
+	};
+	struct dm_io_request io_req = {
+		.bi_op = op,
+		.bi_op_flags = op_flags,
+		.mem.type = DM_IO_VMA,
+		.mem.ptr.vma = buf,
+		.notify.fn = NULL,
+		.client = dmz->io_client,
+	};
+
+	return dm_io(&io_req, 1, &where, NULL);
+}
+
+static u32 dmz_meta_crc(struct dmz_target *dmz, struct dmz_super *sb)
+{
+	__le32 crc = sb->crc;
+	u32 ret;
+
+	sb->crc = 0;
+	ret = crc32_le(DMZ_MAGIC, (unsigned char *)sb,
+		       dmz->meta_blocks << DMZ_BLOCK_SHIFT);
+	sb->crc = crc;
+
+	return ret;
+}
+
+/*
+ * Write the metadata over the older on-disk copy.  The preflush makes
+ * all the data writes completed so far stable before the metadata
+ * referencing them.
+ */
+static int dmz_flush_metadata(struct dmz_target *dmz)
+{
+	struct dmz_super *sb = dmz->meta;
+	unsigned int slot = dmz->meta_slot ^ 1;
+	int r;
+
+	if (!dmz->meta_dirty)
+		return blkdev_issue_flush(dmz->bdev, GFP_NOIO, NULL);
+
+	sb->magic = cpu_to_le32(DMZ_MAGIC);
+	sb->version = cpu_to_le32(DMZ_META_VER);
+	sb->gen = cpu_to_le64(dmz->meta_gen + 1);
+	sb->zone_sectors = cpu_to_le32(dmz->zone_sectors);
+	sb->nr_zones = cpu_to_le32(dmz->nr_zones);
+	sb->nr_chunks = cpu_to_le32(dmz->nr_chunks);
+	sb->nr_buffers = cpu_to_le32(dmz->nr_buffers);
+	sb->meta_blocks = cpu_to_le32(dmz->meta_blocks);
+	sb->crc = cpu_to_le32(dmz_meta_crc(dmz, sb));
+
+	r = dmz_meta_io(dmz, REQ_OP_WRITE, REQ_PREFLUSH | REQ_FUA, slot,
+			dmz->meta);
+	if (r) {
+		DMERR("Metadata write failed %d", r);
+		return r;
+	}
+
+	dmz->meta_slot = slot;
+	dmz->meta_gen++;
+	dmz->meta_dirty = false;
+
+	return 0;
+}
+
+static bool dmz_check_meta(struct dmz_target *dmz, struct dmz_super *sb)
+{
+	return le32_to_cpu(sb->magic) == DMZ_MAGIC &&
+		le32_to_cpu(sb->version) == DMZ_META_VER &&
+		le32_to_cpu(sb->zone_sectors) == dmz->zone_sectors &&
+		le32_to_cpu(sb->nr_zones) == dmz->nr_zones &&
+		le32_to_cpu(sb->nr_chunks) == dmz->nr_chunks &&
+		le32_to_cpu(sb->nr_buffers) == dmz->nr_buffers &&
+		le32_to_cpu(sb->meta_blocks) == dmz->meta_blocks &&
+		le32_to_cpu(sb->crc) == dmz_meta_crc(dmz, sb);
+}
+
+/*
+ * Load the most recent valid copy of the metadata.
+ */
+static int dmz_load_meta(struct dm_target *ti, struct dmz_target *dmz)
+{
+	struct dmz_super *sb = dmz->meta, *sb1;
+	bool valid0, valid1;
+	int r;
+
+	sb1 = vmalloc(dmz->meta_blocks << DMZ_BLOCK_SHIFT);
+	if (!sb1) {
+		ti->error = "Cannot allocate metadata buffer";
+		return -ENOMEM;
+	}
+
+	r = dmz_meta_io(dmz, REQ_OP_READ, 0, 0, sb);
+	valid0 = !r && dmz_check_meta(dmz, sb);
+	r = dmz_meta_io(dmz, REQ_OP_READ, 0, 1, sb1);
+	valid1 = !r && dmz_check_meta(dmz, sb1);
+
+	if (valid1 && (!valid0 || le64_to_cpu(sb1->gen) > le64_to_cpu(sb->gen))) {
+		memcpy(sb, sb1, dmz->meta_blocks << DMZ_BLOCK_SHIFT);
+		dmz->meta_slot = 1;
+	} else if (valid0) {
+		dmz->meta_slot = 0;
+	} else {
+		ti->error = "No valid metadata found";
+		vfree(sb1);
+		return -EINVAL;
+	}
+	dmz->meta_gen = le64_to_cpu(sb->gen);
+
+	vfree(sb1);
+
+	return 0;
+}
+
+static int dmz_reset_zone(struct dmz_target *dmz, struct dmz_zone *zone)
+{
+	int r;
+
+	r = blkdev_reset_zones(dmz->bdev, zone->start, dmz->zone_sectors,
+			       GFP_NOIO);
+	if (r) {
+		DMERR("Reset of zone %u failed %d", zone->id, r);
+		return r;
+	}
+
+	zone->wp_block = 0;
+	clear_bit(DMZ_WP_STALE, &zone->flags);
+
+	return 0;
+}
+
+/*
+ * Initialize empty metadata and write both copies of it.
+ */
+static int dmz_format(struct dmz_target *dmz)
+{
+	struct dmz_zone *zone;
+	unsigned int i;
+	int r;
+
+	for (i = 0; i < dmz->nr_chunks; i++) {
+		dmz->map[i].dzone = cpu_to_le32(DMZ_UNMAPPED);
+		dmz->map[i].bzone = cpu_to_le32(DMZ_UNMAPPED);
+	}
+
+	for (i = 0; i < dmz->nr_zones; i++) {
+		zone = &dmz->zones[i];
+		if (zone->type == DMZ_ZONE_DATA && zone->wp_block) {
+			r = dmz_reset_zone(dmz, zone);
+			if (r)
+				return r;
+		}
+	}
+
+	dmz->meta_slot = 1;
+	dmz->meta_gen = 0;
+	for (i = 0; i < 2; i++) {
+		dmz->meta_dirty = true;
+		r = dmz_flush_metadata(dmz);
+		if (r)
+			return r;
+	}
+
+	return 0;
+}
+
+/*
+ * Assign zones to the chunks as recorded in the metadata, and put the
+ * other data and buffer zones on the free lists.
+ */
+static int dmz_init_mapping(struct dm_target *ti, struct dmz_target *dmz)
+{
+	struct dmz_zone *dzone, *bzone, *zone;
+	unsigned int i;
+
+	for (i = 0; i < dmz->nr_chunks; i++) {
+		dzone = NULL;
+		if (le32_to_cpu(dmz->map[i].dzone) != DMZ_UNMAPPED) {
+			if (le32_to_cpu(dmz->map[i].dzone) >= dmz->nr_zones)
+				goto bad;
+			dzone = dmz_mapped_zone(dmz, dmz->map[i].dzone);
+			if (dzone->type != DMZ_ZONE_DATA ||
+			    dzone->chunk != DMZ_UNMAPPED)
+				goto bad;
+			dzone->chunk = i;
+		}
+
+		if (le32_to_cpu(dmz->map[i].bzone) != DMZ_UNMAPPED) {
+			if (!dzone || le32_to_cpu(dmz->map[i].bzone) >= dmz->nr_zones)
+				goto bad;
+			bzone = dmz_mapped_zone(dmz, dmz->map[i].bzone);
+			if (bzone->type != DMZ_ZONE_BUFFER ||
+			    bzone->chunk != DMZ_UNMAPPED)
+				goto bad;
+			bzone->chunk = i;
+			list_add_tail(&bzone->link, &dmz->lru_buffers);
+		}
+	}
+
+	for (i = 0; i < dmz->nr_zones; i++) {
+		zone = &dmz->zones[i];
+		if (zone->chunk != DMZ_UNMAPPED)
+			continue;
+
+		if (zone->type == DMZ_ZONE_DATA) {
+			/* Written after the last metadata flush */
+			if (zone->wp_block && dmz_reset_zone(dmz, zone))
+				continue;
+			list_add_tail(&zone->link, &dmz->free_data);
+			dmz->nr_free_data++;
+		} else if (zone->type == DMZ_ZONE_BUFFER) {
+			memset(zone->bitmap, 0, dmz->zone_blocks >> 3);
+			list_add_tail(&zone->link, &dmz->free_buffers);
+			dmz->nr_free_buffers++;
+		}
+	}
+
+	if (dmz->nr_free_data < DMZ_NR_SPARE_ZONES) {
+		ti->error = "No free data zone for reclaim";
+		return -EINVAL;
+	}
+
+	return 0;
+
+bad:
+	ti->error = "Invalid chunk mapping";
+	return -EINVAL;
+}
+
+static void dmz_init_zone(struct dmz_target *dmz, struct dmz_zone *zone,
+			  unsigned int id, struct blk_zone *blkz)
+{
+	zone->start = blkz->start;
+	zone->id = id;
+	zone->chunk = DMZ_UNMAPPED;
+	atomic_set(&zone->ref, 0);
+	INIT_LIST_HEAD(&zone->link);
+
+	if (blkz->type == BLK_ZONE_TYPE_CONVENTIONAL) {
+		if (!dmz->meta_zone) {
+			zone->type = DMZ_ZONE_META;
+			dmz->meta_zone = zone;
+		} else {
+			zone->type = DMZ_ZONE_BUFFER;
+			dmz->nr_buffers++;
+		}
+		return;
+	}
+
+	if (blkz->cond == BLK_ZONE_COND_OFFLINE ||
+	    blkz->cond == BLK_ZONE_COND_READONLY) {
+		zone->type = DMZ_ZONE_OFFLINE;
+		return;
+	}
+
+	zone->type = DMZ_ZONE_DATA;
+	if (blkz->cond == BLK_ZONE_COND_FULL)
+		zone->wp_block = dmz->zone_blocks;
+	else
+		zone->wp_block = (blkz->wp - blkz->start) >> DMZ_BLOCK_SECTORS_SHIFT;
+	dmz->nr_data++;
+}
+
+/*
+ * Get the device zone configuration and lay out the metadata.
+ */
+static int dmz_init_zones(struct dm_target *ti, struct dmz_target *dmz)
+{
+	struct blk_zone *blkz;
+	unsigned int nr_blkz, i, id = 0, buf_idx = 0;
+	unsigned int map_blocks, bitmap_bytes;
+	sector_t sector = 0;
+	int r;
+
+	dmz->zone_sectors = bdev_zone_sectors(dmz->bdev);
+	if (!is_power_of_2(dmz->zone_sectors) ||
+	    dmz->zone_sectors < DMZ_BLOCK_SECTORS * BITS_PER_LONG) {
+		ti->error = "Unsupported zone size";
+		return -EINVAL;
+	}
+	dmz->zone_sectors_shift = ilog2(dmz->zone_sectors);
+	dmz->zone_blocks = dmz->zone_sectors >> DMZ_BLOCK_SECTORS_SHIFT;
+
+	/* A smaller last zone is not used */
+	dmz->nr_zones = i_size_read(dmz->bdev->bd_inode) >>
+		(SECTOR_SHIFT + dmz->zone_sectors_shift);
+
+	dmz->zones = vzalloc(dmz->nr_zones * sizeof(struct dmz_zone));
+	if (!dmz->zones) {
+		ti->error = "Cannot allocate zones";
+		return -ENOMEM;
+	}
+
+	blkz = kcalloc(DMZ_REPORT_NR_ZONES, sizeof(struct blk_zone), GFP_KERNEL);
+	if (!blkz) {
+		ti->error = "Cannot allocate zone report";
+		return -ENOMEM;
+	}
+
+	while (id < dmz->nr_zones) {
+		nr_blkz = DMZ_REPORT_NR_ZONES;
+		r = blkdev_report_zones(dmz->bdev, sector, blkz, &nr_blkz,
+					GFP_KERNEL);
+		if (!r && !nr_blkz)
+			r = -EIO;
+		if (r) {
+			ti->error = "Zone report failed";
+			kfree(blkz);
+			return r;
+		}
+
+		for (i = 0; i < nr_blkz && id < dmz->nr_zones; i++, id++) {
+			dmz_init_zone(dmz, &dmz->zones[id], id, &blkz[i]);
+			sector += dmz->zone_sectors;
+		}
+	}
+	kfree(blkz);
+
+	if (!dmz->meta_zone || !dmz->nr_buffers) {
+		ti->error = "Not enough conventional zones";
+		return -EINVAL;
+	}
+
+	if (dmz->nr_data <= DMZ_NR_SPARE_ZONES ||
+	    ti->len & (dmz->zone_sectors - 1) ||
+	    ti->len >> dmz->zone_sectors_shift >
+	    dmz->nr_data - DMZ_NR_SPARE_ZONES) {
+		ti->error = "Invalid target length";
+		return -EINVAL;
+	}
+	dmz->nr_chunks = ti->len >> dmz->zone_sectors_shift;
+
+	/* Super block, mapping table, then buffer zone bitmaps */
+	map_blocks = DIV_ROUND_UP(dmz->nr_chunks * sizeof(struct dmz_map),
+				  DMZ_BLOCK_SIZE);
+	bitmap_bytes = dmz->zone_blocks >> 3;
+	dmz->meta_blocks = 1 + map_blocks +
+		DIV_ROUND_UP(dmz->nr_buffers * bitmap_bytes, DMZ_BLOCK_SIZE);
+	if (2 * dmz->meta_blocks > dmz->zone_blocks) {
+		ti->error = "Metadata does not fit in a zone";
+		return -EINVAL;
+	}
+
+	dmz->meta = vzalloc(dmz->meta_blocks << DMZ_BLOCK_SHIFT);
+	if (!dmz->meta) {
+		ti->error = "Cannot allocate metadata";
+		return -ENOMEM;
+	}
+	dmz->map = dmz->meta + DMZ_BLOCK_SIZE;
+
+	for (i = 0; i < dmz->nr_zones; i++) {
+		if (dmz->zones[i].type != DMZ_ZONE_BUFFER)
+			continue;
+		dmz->zones[i].bitmap = dmz->meta +
+			((1 + map_blocks) << DMZ_BLOCK_SHIFT) +
+			buf_idx++ * bitmap_bytes;
+	}
+
+	return 0;
+}
+
+/*----------------------------------------------------------------
+ * Zone allocation and reclaim
+ *--------------------------------------------------------------*/
+static struct dmz_zone *dmz_alloc_data_zone(struct dmz_target *dmz)
+{
+	struct dmz_zone *zone;
+
+	if (list_empty(&dmz->free_data))
+		return NULL;
+
+	zone = list_first_entry(&dmz->free_data, struct dmz_zone, link);
+	list_del_init(&zone->link);
+	dmz->nr_free_data--;
+
+	return zone;
+}
+
+/*
+ * Only called once the metadata not mapping the zone is on disk.
+ */
+static void dmz_free_data_zone(struct dmz_target *dmz, struct dmz_zone *zone)
+{
+	zone->chunk = DMZ_UNMAPPED;
+	if (dmz_reset_zone(dmz, zone))
+		return;
+
+	list_add_tail(&zone->link, &dmz->free_data);
+	dmz->nr_free_data++;
+}
+
+static void dmz_free_buffer_zone(struct dmz_target *dmz, struct dmz_zone *zone)
+{
+	dmz->map[zone->chunk].bzone = cpu_to_le32(DMZ_UNMAPPED);
+	memset(zone->bitmap, 0, dmz->zone_blocks >> 3);
+	zone->chunk = DMZ_UNMAPPED;
+	list_move_tail(&zone->link, &dmz->free_buffers);
+	dmz->nr_free_buffers++;
+	dmz->meta_dirty = true;
+}
+
+static int dmz_copy_blocks(struct dmz_target *dmz, struct dmz_zone *src,
+			   struct dmz_zone *dst, unsigned int block,
+			   unsigned int nr_blocks)
+{
+	struct dm_io_region where = { .bdev = dmz->bdev };
+	struct dm_io_request io_req = {
+		.mem.type = DM_IO_VMA,
+		.mem.ptr.vma = dmz->copy_buf,
+		.notify.fn = NULL,
+		.client = dmz->io_client,
+	};
+	unsigned int nr;
+	int r;
+
+	/* Synchronous writes, in order, as the target zone is sequential */
+	while (nr_blocks) {
+		nr = min_t(unsigned int, nr_blocks, DMZ_COPY_BLOCKS);
+		where.count = nr << DMZ_BLOCK_SECTORS_SHIFT;
+
+		if (src) {
+			where.sector = src->start +
+				((sector_t)block << DMZ_BLOCK_SECTORS_SHIFT);
+			io_req.bi_op = REQ_OP_READ;
+			io_req.bi_op_flags = 0;
+			r = dm_io(&io_req, 1, &where, NULL);
+			if (r)
+				return r;
+		} else
+			memset(dmz->copy_buf, 0, nr << DMZ_BLOCK_SHIFT);
+
+		where.sector = dst->start +
+			((sector_t)block << DMZ_BLOCK_SECTORS_SHIFT);
+		io_req.bi_op = REQ_OP_WRITE;
+		io_req.bi_op_flags = 0;
+		r = dm_io(&io_req, 1, &where, NULL);
+		if (r)
+			return r;
+
+		block += nr;
+		nr_blocks -= nr;
+	}
+
+	return 0;
+}
+
+/*
+ * Merge the data and buffer zones of the least recently written
+ * buffered chunk into a free data zone.
+ */
+static int dmz_reclaim_chunk(struct dmz_target *dmz)
+{
+	struct dmz_zone *bzone, *dzone, *szone, *src;
+	unsigned int chunk, block = 0, next;
+	int r;
+
+	if (list_empty(&dmz->lru_buffers))
+		return -ENOSPC;
+
+	bzone = list_first_entry(&dmz->lru_buffers, struct dmz_zone, link);
+	chunk = bzone->chunk;
+	dzone = dmz_mapped_zone(dmz, dmz->map[chunk].dzone);
+
+	dmz_wait_zone(dmz, bzone);
+	dmz_wait_zone(dmz, dzone);
+
+	szone = dmz_alloc_data_zone(dmz);
+	if (!szone)
+		return -ENOSPC;
+
+	while (block < dmz->zone_blocks) {
+		if (test_bit_le(block, bzone->bitmap)) {
+			src = bzone;
+			next = find_next_zero_bit_le(bzone->bitmap,
+						     dmz->zone_blocks, block);
+		} else {
+			next = find_next_bit_le(bzone->bitmap,
+						dmz->zone_blocks, block);
+			if (dzone && block < dzone->wp_block) {
+				src = dzone;
+				next = min(next, dzone->wp_block);
+			} else if (next == dmz->zone_blocks) {
+				break;
+			} else {
+				/* Hole: fill with zeroes */
+				src = NULL;
+			}
+		}
+
+		r = dmz_copy_blocks(dmz, src, szone, block, next - block);
+		if (r) {
+			DMERR("Reclaim of chunk %u failed %d", chunk, r);
+			dmz_free_data_zone(dmz, szone);
+			return r;
+		}
+		block = next;
+	}
+
+	szone->wp_block = block;
+	szone->chunk = chunk;
+	dmz->map[chunk].dzone = cpu_to_le32(szone->id);
+	dmz_free_buffer_zone(dmz, bzone);
+
+	r = dmz_flush_metadata(dmz);
+	if (r)
+		return r;
+
+	if (dzone)
+		dmz_free_data_zone(dmz, dzone);
+
+	return 0;
+}
+
+static void dmz_reclaim_work(struct work_struct *work)
+{
+	struct dmz_target *dmz = container_of(work, struct dmz_target,
+					      reclaim_work);
+
+	while (dmz->nr_free_buffers * 100 < dmz->nr_buffers * DMZ_RECLAIM_HIGH)
+		if (dmz_reclaim_chunk(dmz))
+			break;
+}
+
+static struct dmz_zone *dmz_alloc_buffer_zone(struct dmz_target *dmz,
+					      unsigned int chunk)
+{
+	struct dmz_zone *bzone;
+
+	if (list_empty(&dmz->free_buffers))
+		dmz_reclaim_chunk(dmz);
+	if (list_empty(&dmz->free_buffers))
+		return NULL;
+
+	bzone = list_first_entry(&dmz->free_buffers, struct dmz_zone, link);
+	list_move_tail(&bzone->link, &dmz->lru_buffers);
+	dmz->nr_free_buffers--;
+
+	bzone->chunk = chunk;
+	dmz->map[chunk].bzone = cpu_to_le32(bzone->id);
+	dmz->meta_dirty = true;
+
+	if (dmz->nr_free_buffers * 100 < dmz->nr_buffers * DMZ_RECLAIM_LOW)
+		queue_work(dmz->wq, &dmz->reclaim_work);
+
+	return bzone;
+}
+
+static void dmz_set_blocks(struct dmz_target *dmz, struct dmz_zone *bzone,
+			   unsigned int block, unsigned int nr_blocks, bool valid)
+{
+	unsigned int end = block + nr_blocks;
+
+	for (; block < end; block++) {
+		if (valid)
+			__set_bit_le(block, bzone->bitmap);
+		else
+			__clear_bit_le(block, bzone->bitmap);
+	}
+	dmz->meta_dirty = true;
+}
+
+/*----------------------------------------------------------------
+ * Bio processing
+ *--------------------------------------------------------------*/
+static void dmz_bio_endio(struct bio *bio, int error)
+{
+	struct dmz_bioctx *bioctx = dm_per_bio_data(bio, sizeof(struct dmz_bioctx));
+
+	if (error)
+		bioctx->error = error;
+
+	if (!atomic_dec_and_test(&bioctx->ref))
+		return;
+
+	if (bioctx->error && bioctx->dzone && bio_op(bio) == REQ_OP_WRITE)
+		set_bit(DMZ_WP_STALE, &bioctx->dzone->flags);
+	dmz_put_zone(bioctx->dmz, bioctx->dzone);
+	dmz_put_zone(bioctx->dmz, bioctx->bzone);
+
+	bio->bi_error = bioctx->error;
+	bio_endio(bio);
+}
+
+static void dmz_clone_endio(struct bio *clone)
+{
+	struct dmz_bioctx *bioctx = clone->bi_private;
+	struct bio *bio = dm_bio_from_per_bio_data(bioctx,
+						   sizeof(struct dmz_bioctx));
+	int error = clone->bi_error;
+
+	bio_put(clone);
+	dmz_bio_endio(bio, error);
+}
+
+static void dmz_get_zones(struct dmz_bioctx *bioctx, struct dmz_zone *dzone,
+			  struct dmz_zone *bzone)
+{
+	if (dzone) {
+		atomic_inc(&dzone->ref);
+		bioctx->dzone = dzone;
+	}
+	if (bzone) {
+		atomic_inc(&bzone->ref);
+		bioctx->bzone = bzone;
+	}
+}
+
+/*
+ * Submit the next @nr_blocks of @bio to @zone at @block.
+ */
+static int dmz_submit_clone(struct dmz_target *dmz, struct bio *bio,
+			    struct dmz_zone *zone, unsigned int block,
+			    unsigned int nr_blocks)
+{
+	struct dmz_bioctx *bioctx = dm_per_bio_data(bio, sizeof(struct dmz_bioctx));
+	struct bio *clone;
+
+	clone = bio_clone_fast(bio, GFP_NOIO, dmz->bio_set);
+	if (!clone)
+		return -ENOMEM;
+
+	clone->bi_bdev = dmz->bdev;
+	clone->bi_iter.bi_sector = zone->start +
+		((sector_t)block << DMZ_BLOCK_SECTORS_SHIFT);
+	clone->bi_iter.bi_size = nr_blocks << DMZ_BLOCK_SHIFT;
+	clone->bi_end_io = dmz_clone_endio;
+	clone->bi_private = bioctx;
+
+	bio_advance(bio, clone->bi_iter.bi_size);
+
+	atomic_inc(&bioctx->ref);
+	generic_make_request(clone);
+
+	return 0;
+}
+
+static void dmz_zero_fill(struct bio *bio, unsigned int nr_blocks)
+{
+	struct bvec_iter iter = bio->bi_iter;
+
+	bio->bi_iter.bi_size = nr_blocks << DMZ_BLOCK_SHIFT;
+	zero_fill_bio(bio);
+	bio->bi_iter = iter;
+
+	bio_advance(bio, nr_blocks << DMZ_BLOCK_SHIFT);
+}
+
+static int dmz_handle_read(struct dmz_target *dmz, unsigned int chunk,
+			   struct bio *bio)
+{
+	struct dmz_zone *dzone = dmz_mapped_zone(dmz, dmz->map[chunk].dzone);
+	struct dmz_zone *bzone = dmz_mapped_zone(dmz, dmz->map[chunk].bzone);
+	unsigned int block = dmz_bio_block(dmz, bio);
+	unsigned int end = block + dmz_bio_blocks(bio);
+	unsigned int next;
+	struct dmz_zone *zone;
+	int r;
+
+	dmz_get_zones(dm_per_bio_data(bio, sizeof(struct dmz_bioctx)),
+		      dzone, bzone);
+
+	while (block < end) {
+		zone = NULL;
+		if (bzone && test_bit_le(block, bzone->bitmap)) {
+			zone = bzone;
+			next = find_next_zero_bit_le(bzone->bitmap, end, block);
+		} else {
+			next = bzone ? find_next_bit_le(bzone->bitmap, end, block) : end;
+			if (dzone && block < dzone->wp_block) {
+				zone = dzone;
+				next = min(next, dzone->wp_block);
+			}
+		}
+
+		if (zone) {
+			r = dmz_submit_clone(dmz, bio, zone, block, next - block);
+			if (r)
+				return r;
+		} else
+			dmz_zero_fill(bio, next - block);
+
+		block = next;
+	}
+
+	return 0;
+}
+
+static int dmz_refresh_wp(struct dmz_target *dmz, struct dmz_zone *zone)
+{
+	struct blk_zone blkz;
+	unsigned int nr_blkz = 1;
+	int r;
+
+	dmz_wait_zone(dmz, zone);
+
+	r = blkdev_report_zones(dmz->bdev, zone->start, &blkz, &nr_blkz,
+				GFP_NOIO);
+	if (!r && !nr_blkz)
+		r = -EIO;
+	if (r)
+		return r;
+
+	if (blkz.cond == BLK_ZONE_COND_FULL)
+		zone->wp_block = dmz->zone_blocks;
+	else
+		zone->wp_block = (blkz.wp - blkz.start) >> DMZ_BLOCK_SECTORS_SHIFT;
+	clear_bit(DMZ_WP_STALE, &zone->flags);
+
+	return 0;
+}
+
+static int dmz_handle_write(struct dmz_target *dmz, unsigned int chunk,
+			    struct bio *bio)
+{
+	struct dmz_bioctx *bioctx = dm_per_bio_data(bio, sizeof(struct dmz_bioctx));
+	struct dmz_zone *dzone = dmz_mapped_zone(dmz, dmz->map[chunk].dzone);
+	struct dmz_zone *bzone = dmz_mapped_zone(dmz, dmz->map[chunk].bzone);
+	unsigned int block = dmz_bio_block(dmz, bio);
+	unsigned int nr_blocks = dmz_bio_blocks(bio);
+	int r;
+
+	if (!dzone) {
+		dzone = dmz_alloc_data_zone(dmz);
+		if (!dzone)
+			return -ENOSPC;
+		dzone->chunk = chunk;
+		dmz->map[chunk].dzone = cpu_to_le32(dzone->id);
+		dmz->meta_dirty = true;
+	}
+
+	if (test_bit(DMZ_WP_STALE, &dzone->flags)) {
+		r = dmz_refresh_wp(dmz, dzone);
+		if (r)
+			return r;
+	}
+
+	if (block == dzone->wp_block) {
+		/*
+		 * Sequential write: one write at a time in the zone, so that
+		 * the device sees them in order.
+		 */
+		dmz_wait_zone(dmz, dzone);
+		dmz_get_zones(bioctx, dzone, NULL);
+		r = dmz_submit_clone(dmz, bio, dzone, block, nr_blocks);
+		if (r)
+			return r;
+		dzone->wp_block += nr_blocks;
+		if (bzone)
+			dmz_set_blocks(dmz, bzone, block, nr_blocks, false);
+	} else {
+		if (!bzone) {
+			bzone = dmz_alloc_buffer_zone(dmz, chunk);
+			if (!bzone)
+				return -ENOSPC;
+		}
+		dmz_get_zones(bioctx, NULL, bzone);
+		r = dmz_submit_clone(dmz, bio, bzone, block, nr_blocks);
+		if (r)
+			return r;
+		dmz_set_blocks(dmz, bzone, block, nr_blocks, true);
+		list_move_tail(&bzone->link, &dmz->lru_buffers);
+	}
+
+	/* The mapping of FUA data must be stable too */
+	if ((bio->bi_opf & REQ_FUA) && dmz->meta_dirty)
+		return dmz_flush_metadata(dmz);
+
+	return 0;
+}
+
+/*
+ * A whole chunk discard unmaps the chunk.  Otherwise, only blocks above
+ * the data zone write pointer, and so only valid in the buffer zone, are
+ * invalidated: blocks below it would read back older data.
+ */
+static int dmz_handle_discard(struct dmz_target *dmz, unsigned int chunk,
+			      struct bio *bio)
+{
+	struct dmz_zone *dzone = dmz_mapped_zone(dmz, dmz->map[chunk].dzone);
+	struct dmz_zone *bzone = dmz_mapped_zone(dmz, dmz->map[chunk].bzone);
+	unsigned int block = dmz_bio_block(dmz, bio);
+	unsigned int nr_blocks = dmz_bio_blocks(bio);
+	unsigned int start;
+	int r;
+
+	if (!dzone)
+		return 0;
+
+	if (!block && nr_blocks == dmz->zone_blocks) {
+		dmz_wait_zone(dmz, dzone);
+		if (bzone) {
+			dmz_wait_zone(dmz, bzone);
+			dmz_free_buffer_zone(dmz, bzone);
+		}
+		dmz->map[chunk].dzone = cpu_to_le32(DMZ_UNMAPPED);
+		dmz->meta_dirty = true;
+
+		r = dmz_flush_metadata(dmz);
+		if (r)
+			return r;
+
+		dmz_free_data_zone(dmz, dzone);
+		return 0;
+	}
+
+	if (bzone) {
+		start = max(block, dzone->wp_block);
+		if (start < block + nr_blocks)
+			dmz_set_blocks(dmz, bzone, start,
+				       block + nr_blocks - start, false);
+	}
+
+	return 0;
+}
+
+static void dmz_handle_bio(struct dmz_target *dmz, struct bio *bio)
+{
+	unsigned int chunk = dmz_bio_chunk(dmz, bio);
+	int r;
+
+	if (bio->bi_opf & REQ_PREFLUSH) {
+		r = dmz_flush_metadata(dmz);
+		goto out;
+	}
+
+	switch (bio_op(bio)) {
+	case REQ_OP_READ:
+		r = dmz_handle_read(dmz, chunk, bio);
+		break;
+	case REQ_OP_WRITE:
+		r = dmz_handle_write(dmz, chunk, bio);
+		break;
+	case REQ_OP_DISCARD:
+		r = dmz_handle_discard(dmz, chunk, bio);
+		break;
+	default:
+		r = -EIO;
+		break;
+	}
+
+out:
+	dmz_bio_endio(bio, r);
+}
+
+static void dmz_work(struct work_struct *work)
+{
+	struct dmz_target *dmz = container_of(work, struct dmz_target, work);
+	struct bio_list bios;
+	struct blk_plug plug;
+	struct bio *bio;
+
+	spin_lock(&dmz->lock);
+	bios = dmz->bios;
+	bio_list_init(&dmz->bios);
+	spin_unlock(&dmz->lock);
+
+	blk_start_plug(&plug);
+	while ((bio = bio_list_pop(&bios)))
+		dmz_handle_bio(dmz, bio);
+	blk_finish_plug(&plug);
+}
+
+/*----------------------------------------------------------------
+ * Target methods
+ *--------------------------------------------------------------*/
+static void dmz_dtr(struct dm_target *ti)
+{
+	struct dmz_target *dmz = ti->private;
+
+	if (dmz->wq) {
+		destroy_workqueue(dmz->wq);
+		if (dmz->meta_dirty)
+			dmz_flush_metadata(dmz);
+	}
+
+	vfree(dmz->copy_buf);
+	if (dmz->bio_set)
+		bioset_free(dmz->bio_set);
+	if (dmz->io_client)
+		dm_io_client_destroy(dmz->io_client);
+	vfree(dmz->meta);
+	vfree(dmz->zones);
+	if (dmz->dev)
+		dm_put_device(ti, dmz->dev);
+	kfree(dmz);
+}
+
+/*
+ * Construct a zoned mapping: <dev_path> [format]
+ *
+ * The target length must be a multiple of the zone size, and at most the
+ * size of all sequential zones of the device minus one zone.  "format"
+ * discards any previous content and writes new metadata.
+ */
+static int dmz_ctr(struct dm_target *ti, unsigned int argc, char **argv)
+{
+	struct dmz_target *dmz;
+	bool format = false;
+	int r;
+
+	if (argc != 1 && argc != 2) {
+		ti->error = "Invalid argument count";
+		return -EINVAL;
+	}
+
+	if (argc == 2) {
+		if (strcasecmp(argv[1], "format")) {
+			ti->error = "Invalid argument";
+			return -EINVAL;
+		}
+		format = true;
+	}
+
+	dmz = kzalloc(sizeof(*dmz), GFP_KERNEL);
+	if (!dmz) {
+		ti->error = "Cannot allocate target context";
+		return -ENOMEM;
+	}
+	ti->private = dmz;
+
+	INIT_LIST_HEAD(&dmz->free_data);
+	INIT_LIST_HEAD(&dmz->free_buffers);
+	INIT_LIST_HEAD(&dmz->lru_buffers);
+	spin_lock_init(&dmz->lock);
+	bio_list_init(&dmz->bios);
+	INIT_WORK(&dmz->work, dmz_work);
+	INIT_WORK(&dmz->reclaim_work, dmz_reclaim_work);
+	init_waitqueue_head(&dmz->wait);
+
+	r = dm_get_device(ti, argv[0], dm_table_get_mode(ti->table), &dmz->dev);
+	if (r) {
+		ti->error = "Device lookup failed";
+		goto bad;
+	}
+	dmz->bdev = dmz->dev->bdev;
+
+	if (!bdev_is_zoned(dmz->bdev)) {
+		ti->error = "Not a zoned block device";
+		r = -EINVAL;
+		goto bad;
+	}
+
+	r = dmz_init_zones(ti, dmz);
+	if (r)
+		goto bad;
+
+	r = -ENOMEM;
+	dmz->io_client = dm_io_client_create();
+	if (IS_ERR(dmz->io_client)) {
+		r = PTR_ERR(dmz->io_client);
+		dmz->io_client = NULL;
+		ti->error = "Cannot create dm-io client";
+		goto bad;
+	}
+
+	dmz->bio_set = bioset_create(DMZ_MIN_BIOS, 0);
+	if (!dmz->bio_set) {
+		ti->error = "Cannot create bio set";
+		goto bad;
+	}
+
+	dmz->copy_buf = vmalloc(DMZ_COPY_BLOCKS << DMZ_BLOCK_SHIFT);
+	if (!dmz->copy_buf) {
+		ti->error = "Cannot allocate copy buffer";
+		goto bad;
+	}
+
+	if (format) {
+		r = dmz_format(dmz);
+		if (r)
+			ti->error = "Format failed";
+	} else
+		r = dmz_load_meta(ti, dmz);
+	if (r)
+		goto bad;
+
+	r = dmz_init_mapping(ti, dmz);
+	if (r)
+		goto bad;
+
+	dmz->wq = alloc_ordered_workqueue("dm-" DM_MSG_PREFIX, WQ_MEM_RECLAIM);
+	if (!dmz->wq) {
+		ti->error = "Cannot create workqueue";
+		r = -ENOMEM;
+		goto bad;
+	}
+
+	r = dm_set_target_max_io_len(ti, dmz->zone_sectors);
+	if (r)
+		goto bad;
+
+	ti->per_io_data_size = sizeof(struct dmz_bioctx);
+	ti->num_flush_bios = 1;
+	ti->flush_supported = true;
+	ti->num_discard_bios = 1;
+	ti->discards_supported = true;
+	ti->split_discard_bios = true;
+
+	return 0;
+
+bad:
+	dmz_dtr(ti);
+	return r;
+}
+
+static int dmz_map(struct dm_target *ti, struct bio *bio)
+{
+	struct dmz_target *dmz = ti->private;
+	struct dmz_bioctx *bioctx = dm_per_bio_data(bio, sizeof(struct dmz_bioctx));
+
+	bio->bi_iter.bi_sector = dm_target_offset(ti, bio->bi_iter.bi_sector);
+	if ((bio->bi_iter.bi_sector | bio_sectors(bio)) &
+	    (DMZ_BLOCK_SECTORS - 1))
+		return -EIO;
+
+	bioctx->dmz = dmz;
+	bioctx->dzone = NULL;
+	bioctx->bzone = NULL;
+	bioctx->error = 0;
+	atomic_set(&bioctx->ref, 1);
+
+	spin_lock(&dmz->lock);
+	bio_list_add(&dmz->bios, bio);
+	spin_unlock(&dmz->lock);
+
+	queue_work(dmz->wq, &dmz->work);
+
+	return DM_MAPIO_SUBMITTED;
+}
+
+/*
+ * Status: <free data zones>/<data zones> <free buffer zones>/<buffer zones>
+ */
+static void dmz_status(struct dm_target *ti, status_type_t type,
+		       unsigned status_flags, char *result, unsigned maxlen)
+{
+	struct dmz_target *dmz = ti->private;
+	unsigned sz = 0;
+
+	switch (type) {
+	case STATUSTYPE_INFO:
+		DMEMIT("%u/%u %u/%u", dmz->nr_free_data, dmz->nr_data,
+		       dmz->nr_free_buffers, dmz->nr_buffers);
+		break;
+
+	case STATUSTYPE_TABLE:
+		DMEMIT("%s", dmz->dev->name);
+		break;
+	}
+}
+
+static int dmz_iterate_devices(struct dm_target *ti,
+			       iterate_devices_callout_fn fn, void *data)
+{
+	struct dmz_target *dmz = ti->private;
+
+	return fn(ti, dmz->dev, 0,
+		  (sector_t)dmz->nr_zones << dmz->zone_sectors_shift, data);
+}
+
+static void dmz_io_hints(struct dm_target *ti, struct queue_limits *limits)
+{
+	struct dmz_target *dmz = ti->private;
+
+	limits->logical_block_size = DMZ_BLOCK_SIZE;
+	limits->physical_block_size = DMZ_BLOCK_SIZE;
+	blk_limits_io_min(limits, DMZ_BLOCK_SIZE);
+	blk_limits_io_opt(limits, DMZ_BLOCK_SIZE);
+
+	limits->discard_alignment = DMZ_BLOCK_SIZE;
+	limits->discard_granularity = DMZ_BLOCK_SIZE;
+	limits->max_discard_sectors = dmz->zone_sectors;
+	limits->max_hw_discard_sectors = dmz->zone_sectors;
+
+	/* The target is a regular block device, split in chunks */
+	limits->zoned = BLK_ZONED_NONE;
+	limits->chunk_sectors = dmz->zone_sectors;
+}
+
+static struct target_type dmz_target = {
+	.name   = "zoned",
+	.version = {1, 0, 0},
+	.features = DM_TARGET_ZONED_HM,
+	.module = THIS_MODULE,
+	.ctr    = dmz_ctr,
+	.dtr    = dmz_dtr,
+	.map    = dmz_map,
+	.status = dmz_status,
+	.iterate_devices = dmz_iterate_devices,
+	.io_hints = dmz_io_hints,
+};
+
+static int __init dm_zoned_init(void)
+{
+	int r = dm_register_target(&dmz_target);
+
+	if (r < 0)
+		DMERR("register failed %d", r);
+
+	return r;
+}
+
+static void __exit dm_zoned_exit(void)
+{
+	dm_unregister_target(&dmz_target);
+}
+
+module_init(dm_zoned_init);
+module_exit(dm_zoned_exit);
+
+MODULE_DESCRIPTION(DM_NAME " target for zoned block devices");
+MODULE_LICENSE("GPL");
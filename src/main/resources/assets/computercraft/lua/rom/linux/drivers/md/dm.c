@@ -987,6 +987,106 @@ void dm_accept_partial_bio(struct bio *bio, unsigned n_sectors)
 }
 EXPORT_SYMBOL_GPL(dm_accept_partial_bio);
 
+/*
+ * The zone descriptors obtained with a zone report indicate zone positions
+ * within the target device, and must be remapped to their position within
+ * the dm device.  With @first_only, only the first reported zone is kept,
+ * and it is moved to start at @delta; otherwise @delta is added to the
+ * start of every zone.
+ */
+static void __dm_remap_zone_report(struct dm_target *ti, struct bio *bio,
+				   sector_t delta, bool first_only)
+{
+#ifdef CONFIG_BLK_DEV_ZONED
+	struct dm_target_io *tio = container_of(bio, struct dm_target_io, clone);
+	struct bio *report_bio = tio->io->bio;
+	struct blk_zone_report_hdr *hdr = NULL;
+	struct blk_zone *zone;
+	unsigned int nr_rep = 0;
+	unsigned int ofst;
+	struct bio_vec bvec;
+	struct bvec_iter iter;
+	void *addr;
+
+	if (bio->bi_error)
+		return;
+
+	/*
+	 * Remap the start sector of the reported zones. For sequential zones,
+	 * also remap the write pointer position.
+	 */
+	bio_for_each_segment(bvec, report_bio, iter) {
+		addr = kmap_atomic(bvec.bv_page);
+
+		/* Remember the report header in the first page */
+		if (!hdr) {
+			hdr = addr;
+			ofst = sizeof(struct blk_zone_report_hdr);
+		} else
+			ofst = 0;
+
+		while (hdr->nr_zones && ofst < bvec.bv_len) {
+			zone = addr + ofst;
+			if (first_only) {
+				delta -= zone->start;
+				hdr->nr_zones = 1;
+			}
+			if (zone->start + delta >= ti->begin + ti->len) {
+				hdr->nr_zones = 0;
+				break;
+			}
+			zone->start += delta;
+			if (zone->type != BLK_ZONE_TYPE_CONVENTIONAL) {
+				if (zone->cond == BLK_ZONE_COND_FULL)
+					zone->wp = zone->start + zone->len;
+				else if (zone->cond == BLK_ZONE_COND_EMPTY)
+					zone->wp = zone->start;
+				else
+					zone->wp += delta;
+			}
+			ofst += sizeof(struct blk_zone);
+			hdr->nr_zones--;
+			nr_rep++;
+		}
+
+		if (addr != hdr)
+			kunmap_atomic(addr);
+
+		if (!hdr->nr_zones)
+			break;
+	}
+
+	if (hdr) {
+		hdr->nr_zones = nr_rep;
+		kunmap_atomic(hdr);
+	}
+#else /* !CONFIG_BLK_DEV_ZONED */
+	bio->bi_error = -EOPNOTSUPP;
+#endif
+}
+
+/*
+ * A target whose device sector @start maps to the target's first sector calls
+ * this from its end_io method on completion of a REQ_OP_ZONE_REPORT bio.
+ */
+void dm_remap_zone_report(struct dm_target *ti, struct bio *bio, sector_t start)
+{
+	__dm_remap_zone_report(ti, bio, ti->begin - start, false);
+}
+EXPORT_SYMBOL_GPL(dm_remap_zone_report);
+
+/*
+ * For targets that don't map zones linearly: keep only the first reported
+ * zone, and remap it to start at the dm device @sector.  Callers of a zone
+ * report come back for the zones that follow.
+ */
+void dm_remap_zone_report_one(struct dm_target *ti, struct bio *bio,
+			      sector_t sector)
+{
+	__dm_remap_zone_report(ti, bio, sector, true);
+}
+EXPORT_SYMBOL_GPL(dm_remap_zone_report_one);
+
 /*
  * Flush current->bio_list when the target map method blocks.
  * This fixes deadlocks in snapshot and possibly in other targets.
@@ -1299,7 +1399,15 @@ static int __split_and_process_non_flush(struct clone_info *ci)
 	if (!dm_target_is_valid(ti))
 		return -EIO;
 
-	len = min_t(sector_t, max_io_len(ci->sector, ti), ci->sector_count);
+	/*
+	 * The size of a zone report is that of its reply buffer, it is not
+	 * a sector range: send it to the target as a whole.
+	 */
+	if (bio_op(bio) == REQ_OP_ZONE_REPORT)
+		len = ci->sector_count;
+	else
+		len = min_t(sector_t, max_io_len(ci->sector, ti),
+			    ci->sector_count);
 
 	r = __clone_and_map_data_bio(ci, ti, ci->sector, &len);
 	if (r < 0)
@@ -1342,6 +1450,11 @@ static void __split_and_process_bio(struct mapped_device *md,
 		ci.sector_count = 0;
 		error = __send_empty_flush(&ci);
 		/* dec_pending submits any data associated with flush */
+	} else if (bio_op(bio) == REQ_OP_ZONE_RESET) {
+		/* Carries no data, but still needs to reach the target */
+		ci.bio = bio;
+		ci.sector_count = 0;
+		error = __split_and_process_non_flush(&ci);
 	} else {
 		ci.bio = bio;
 		ci.sector_count = bio_sectors(bio);
@@ -5245,12 +5245,44 @@ static struct stripe_head *__get_priority_stripe(struct r5conf *conf, int group)
 	return sh;
 }
 
+/* covers a 512KiB chunk with 4KiB pages */
+#define PLUG_STRIPE_CACHE_SIZE	128
+
 struct raid5_plug_cb {
 	struct blk_plug_cb	cb;
 	struct list_head	list;
 	struct list_head	temp_inactive_list[NR_STRIPE_HASH_LOCKS];
+	/* stripes on list, by sector, see raid5_get_plugged_stripe() */
+	struct stripe_head	*stripes[PLUG_STRIPE_CACHE_SIZE];
 };
 
+static inline int plug_stripe_slot(sector_t sector)
+{
+	return (sector >> STRIPE_SHIFT) & (PLUG_STRIPE_CACHE_SIZE - 1);
+}
+
+/*
+ * A full stripe write needs no reads: once the submitter unplugs, it can
+ * compute the parity and issue the writes itself rather than wait for
+ * raid5d or a worker thread to pick the stripe up.  Stripes waiting for
+ * a bitmap update, and the members of a batch, which are handled with
+ * their batch head, still go through the handle list.
+ */
+static bool stripe_can_handle_inline(struct r5conf *conf,
+				     struct stripe_head *sh)
+{
+	if (conf->log || !test_bit(STRIPE_HANDLE, &sh->state))
+		return false;
+	if (sh->batch_head && sh->batch_head != sh)
+		return false;
+	if (test_bit(STRIPE_BIT_DELAY, &sh->state) &&
+	    sh->bm_seq - conf->seq_write > 0)
+		return false;
+	return !test_bit(STRIPE_EXPANDING, &sh->state) &&
+		!test_bit(STRIPE_SYNCING, &sh->state) &&
+		is_full_stripe_write(sh);
+}
+
 static void raid5_unplug(struct blk_plug_cb *blk_cb, bool from_schedule)
 {
 	struct raid5_plug_cb *cb = container_of(
@@ -5258,6 +5290,7 @@ static void raid5_unplug(struct blk_plug_cb *blk_cb, bool from_schedule)
 	struct stripe_head *sh;
 	struct mddev *mddev = cb->cb.data;
 	struct r5conf *conf = mddev->private;
+	LIST_HEAD(inline_list);
 	int cnt = 0;
 	int hash;
 
@@ -5273,18 +5306,30 @@ static void raid5_unplug(struct blk_plug_cb *blk_cb, bool from_schedule)
 			 */
 			smp_mb__before_atomic();
 			clear_bit(STRIPE_ON_UNPLUG_LIST, &sh->state);
+			cnt++;
+			/* only when unplugged by the submitter itself */
+			if (!from_schedule && stripe_can_handle_inline(conf, sh)) {
+				list_add_tail(&sh->lru, &inline_list);
+				continue;
+			}
 			/*
 			 * STRIPE_ON_RELEASE_LIST could be set here. In that
 			 * case, the count is always > 1 here
 			 */
 			hash = sh->hash_lock_index;
 			__release_stripe(conf, sh, &cb->temp_inactive_list[hash]);
-			cnt++;
 		}
 		spin_unlock_irq(&conf->device_lock);
 	}
 	release_inactive_stripe_list(conf, cb->temp_inactive_list,
 				     NR_STRIPE_HASH_LOCKS);
+
+	while (!list_empty(&inline_list)) {
+		sh = list_first_entry(&inline_list, struct stripe_head, lru);
+		list_del_init(&sh->lru);
+		handle_stripe(sh);
+		raid5_release_stripe(sh);
+	}
 	if (mddev->queue)
 		trace_block_unplug(mddev->queue, cnt, !from_schedule);
 	kfree(cb);
@@ -5312,12 +5357,61 @@ static void release_stripe_plug(struct mddev *mddev,
 			INIT_LIST_HEAD(cb->temp_inactive_list + i);
 	}
 
-	if (!test_and_set_bit(STRIPE_ON_UNPLUG_LIST, &sh->state))
+	if (!test_and_set_bit(STRIPE_ON_UNPLUG_LIST, &sh->state)) {
 		list_add_tail(&sh->lru, &cb->list);
-	else
+		cb->stripes[plug_stripe_slot(sh->sector)] = sh;
+	} else
 		raid5_release_stripe(sh);
 }
 
+/*
+ * A write that spans a whole stripe looks each stripe_head up once per
+ * data disk, every time taking its hash lock.  The stripes the submitter
+ * has plugged are pinned by its plug list until raid5_unplug(), which also
+ * frees the plug, so those lookups can be served from a small table in the
+ * plug instead.  The plug is private to the submitting task, which makes
+ * this a per-submitter stripe cache without any locking.
+ *
+ * The stripe still has to go through handle_stripe(), which is what
+ * orders these writes against everything else happening to the stripe:
+ * - bitmap_startwrite() for the stripe must be on disk before any member
+ *   write is issued (STRIPE_BIT_DELAY);
+ * - parity is computed only once every overlapping bio has been drained
+ *   into the stripe pages, and R5_Overlap waiters are woken after that;
+ * - a stripe being resynced, or reshaped (STRIPE_EXPANDING), must not get
+ *   new data until that has completed;
+ * - a device failing mid-write turns the stripe into a degraded
+ *   read-modify-write, which only the state machine knows how to do;
+ * - with a journal or PPL the data and parity must reach the log first.
+ * Which is why only the lookup is cached here.
+ */
+static struct stripe_head *raid5_get_plugged_stripe(struct mddev *mddev,
+						    sector_t sector,
+						    int previous)
+{
+	struct r5conf *conf = mddev->private;
+	struct blk_plug_cb *blk_cb;
+	struct raid5_plug_cb *cb;
+	struct stripe_head *sh;
+
+	/* raid5_get_active_stripe() will wait for the quiesce */
+	if (READ_ONCE(conf->quiesce))
+		return NULL;
+
+	blk_cb = blk_check_plugged(raid5_unplug, mddev,
+				   sizeof(struct raid5_plug_cb));
+	if (!blk_cb)
+		return NULL;
+	cb = container_of(blk_cb, struct raid5_plug_cb, cb);
+	sh = cb->stripes[plug_stripe_slot(sector)];
+	if (!sh || sh->sector != sector ||
+	    sh->generation != conf->generation - previous)
+		return NULL;
+	/* the plug list holds a reference until raid5_unplug() */
+	atomic_inc(&sh->count);
+	return sh;
+}
+
 static void make_discard_request(struct mddev *mddev, struct bio *bi)
 {
 	struct r5conf *conf = mddev->private;
@@ -5510,8 +5604,10 @@ static void raid5_make_request(struct mddev *mddev, struct bio * bi)
 			(unsigned long long)new_sector,
 			(unsigned long long)logical_sector);
 
-		sh = raid5_get_active_stripe(conf, new_sector, previous,
-				       (bi->bi_opf & REQ_RAHEAD), 0);
+		sh = raid5_get_plugged_stripe(mddev, new_sector, previous);
+		if (!sh)
+			sh = raid5_get_active_stripe(conf, new_sector, previous,
+					       (bi->bi_opf & REQ_RAHEAD), 0);
 		if (sh) {
 			if (unlikely(previous)) {
 				/* expansion might have moved on while waiting for a
@@ -638,6 +638,8 @@ struct bnxt_rx_ring_info {
 	struct page		*rx_page;
 	unsigned int		rx_page_offset;
 
+	struct page_pool	*page_pool;
+
 	dma_addr_t		rx_desc_mapping[MAX_RX_PAGES];
 	dma_addr_t		rx_agg_desc_mapping[MAX_RX_AGG_PAGES];
 
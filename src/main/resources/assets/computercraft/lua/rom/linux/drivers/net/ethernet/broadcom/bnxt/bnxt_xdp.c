@@ -203,7 +203,7 @@ static int bnxt_xdp_set(struct bnxt *bp, struct bpf_prog *prog)
 		bnxt_get_max_rings(bp, &rx, &tx, true);
 		if (rx > 1) {
 			bp->flags &= ~BNXT_FLAG_NO_AGG_RINGS;
-			bp->dev->hw_features |= NETIF_F_LRO;
+			bp->dev->hw_features |= NETIF_F_LRO | NETIF_F_GRO_HW;
 		}
 	}
 	bp->tx_nr_rings_xdp = tx_xdp;
@@ -32,6 +32,7 @@
 #include "i40e.h"
 #include "i40e_diag.h"
 #include <net/udp_tunnel.h>
+#include <linux/bpf.h>
 
 const char i40e_driver_name[] = "i40e";
 static const char i40e_driver_string[] =
@@ -2488,6 +2489,13 @@ static int i40e_change_mtu(struct net_device *netdev, int new_mtu)
 	struct i40e_netdev_priv *np = netdev_priv(netdev);
 	struct i40e_vsi *vsi = np->vsi;
 
+	if (i40e_enabled_xdp_vsi(vsi)) {
+		int frame_size = new_mtu + ETH_HLEN + ETH_FCS_LEN + VLAN_HLEN;
+
+		if (frame_size > I40E_RXBUFFER_XDP)
+			return -EINVAL;
+	}
+
 	netdev_info(netdev, "changing MTU from %d to %d\n",
 		    netdev->mtu, new_mtu);
 	netdev->mtu = new_mtu;
@@ -3098,6 +3106,14 @@ static int i40e_configure_rx_ring(struct i40e_ring *ring)
 
 	ring->rx_buf_len = vsi->rx_buf_len;
 
+	/* buffers are placed after XDP_PACKET_HEADROOM while XDP is on */
+	if (i40e_enabled_xdp_vsi(vsi))
+		ring->flags |= I40E_RXR_FLAGS_XDP_HEADROOM;
+	else
+		ring->flags &= ~I40E_RXR_FLAGS_XDP_HEADROOM;
+	WRITE_ONCE(ring->xdp_prog, vsi->xdp_prog);
+	xdp_rxq_info_init(&ring->xdp_rxq, ring->netdev, ring->queue_index);
+
 	rx_ctx.dbuff = ring->rx_buf_len >> I40E_RXQ_CTX_DBUFF_SHIFT;
 
 	rx_ctx.base = (ring->dma / 128);
@@ -3198,6 +3214,14 @@ static int i40e_vsi_configure_rx(struct i40e_vsi *vsi)
 	}
 
 #endif /* I40E_FCOE */
+	/* keep the headroom inside the half page and never chain buffers,
+	 * XDP programs only ever see a single buffer
+	 */
+	if (i40e_enabled_xdp_vsi(vsi)) {
+		vsi->rx_buf_len = I40E_RXBUFFER_XDP;
+		vsi->max_frame = min_t(u16, vsi->max_frame, vsi->rx_buf_len);
+	}
+
 	/* round up for the chip's needs */
 	vsi->rx_buf_len = ALIGN(vsi->rx_buf_len,
 				BIT_ULL(I40E_RXQ_CTX_DBUFF_SHIFT));
@@ -9335,6 +9359,68 @@ out_err:
 	return features & ~(NETIF_F_CSUM_MASK | NETIF_F_GSO_MASK);
 }
 
+/**
+ * i40e_xdp_setup - add/remove an XDP program
+ * @vsi: VSI to change
+ * @prog: XDP program
+ **/
+static int i40e_xdp_setup(struct i40e_vsi *vsi, struct bpf_prog *prog)
+{
+	int frame_size = vsi->netdev->mtu + ETH_HLEN + ETH_FCS_LEN + VLAN_HLEN;
+	struct bpf_prog *old_prog;
+	bool need_reset;
+	int i;
+
+	/* Don't allow frames that span over multiple buffers */
+	if (frame_size > I40E_RXBUFFER_XDP)
+		return -EINVAL;
+
+	if (!i40e_enabled_xdp_vsi(vsi) && !prog)
+		return 0;
+
+	/* When turning XDP on->off/off->on we reset and rebuild the rings. */
+	need_reset = (i40e_enabled_xdp_vsi(vsi) != !!prog);
+
+	old_prog = xchg(&vsi->xdp_prog, prog);
+
+	if (need_reset) {
+		if (netif_running(vsi->netdev))
+			i40e_vsi_reinit_locked(vsi);
+	} else {
+		for (i = 0; i < vsi->num_queue_pairs; i++)
+			WRITE_ONCE(vsi->rx_rings[i]->xdp_prog, vsi->xdp_prog);
+	}
+
+	if (old_prog)
+		bpf_prog_put(old_prog);
+
+	return 0;
+}
+
+/**
+ * i40e_xdp - implements ndo_xdp for i40e
+ * @dev: netdevice
+ * @xdp: XDP command
+ **/
+static int i40e_xdp(struct net_device *dev, struct netdev_xdp *xdp)
+{
+	struct i40e_netdev_priv *np = netdev_priv(dev);
+	struct i40e_vsi *vsi = np->vsi;
+
+	if (vsi->type != I40E_VSI_MAIN)
+		return -EINVAL;
+
+	switch (xdp->command) {
+	case XDP_SETUP_PROG:
+		return i40e_xdp_setup(vsi, xdp->prog);
+	case XDP_QUERY_PROG:
+		xdp->prog_attached = i40e_enabled_xdp_vsi(vsi);
+		return 0;
+	default:
+		return -EINVAL;
+	}
+}
+
 static const struct net_device_ops i40e_netdev_ops = {
 	.ndo_open		= i40e_open,
 	.ndo_stop		= i40e_close,
@@ -9371,6 +9457,7 @@ static const struct net_device_ops i40e_netdev_ops = {
 	.ndo_features_check	= i40e_features_check,
 	.ndo_bridge_getlink	= i40e_ndo_bridge_getlink,
 	.ndo_bridge_setlink	= i40e_ndo_bridge_setlink,
+	.ndo_xdp		= i40e_xdp,
 };
 
 /**
@@ -25,6 +25,8 @@
  ******************************************************************************/
 
 #include <linux/prefetch.h>
+#include <linux/bpf.h>
+#include <linux/bpf_trace.h>
 #include <net/busy_poll.h>
 #include "i40e.h"
 #include "i40e_prototype.h"
@@ -1131,16 +1133,63 @@ static inline void i40e_release_rx_desc(struct i40e_ring *rx_ring, u32 val)
 	writel(val, rx_ring->tail);
 }
 
+/**
+ * struct i40e_rx_page_batch - pages bulk allocated for one refill
+ * @pages: pages not handed out yet, NULL once taken
+ * @count: number of pages allocated
+ * @next: index of the next page to hand out
+ **/
+struct i40e_rx_page_batch {
+	struct page *pages[I40E_RX_BUFFER_WRITE];
+	unsigned int count;
+	unsigned int next;
+};
+
+/**
+ * i40e_rx_page_batch_get - take a page from the refill batch
+ * @pb: batch to take from
+ * @wanted: number of buffers the refill still has to place
+ *
+ * Refills the batch with a single bulk allocation once it runs dry.
+ **/
+static struct page *i40e_rx_page_batch_get(struct i40e_rx_page_batch *pb,
+					   u16 wanted)
+{
+	struct page *page;
+
+	if (pb->next == pb->count) {
+		pb->count = dev_alloc_pages_bulk_array(min_t(u16, wanted,
+							     I40E_RX_BUFFER_WRITE),
+						       pb->pages);
+		pb->next = 0;
+		if (unlikely(!pb->count))
+			return NULL;
+	}
+
+	page = pb->pages[pb->next];
+	pb->pages[pb->next++] = NULL;
+	return page;
+}
+
+static inline unsigned int i40e_rx_offset(struct i40e_ring *rx_ring)
+{
+	return (rx_ring->flags & I40E_RXR_FLAGS_XDP_HEADROOM) ?
+	       XDP_PACKET_HEADROOM : 0;
+}
+
 /**
  * i40e_alloc_mapped_page - recycle or make a new page
  * @rx_ring: ring to use
  * @bi: rx_buffer struct to modify
+ * @pb: batch of freshly allocated pages to take new pages from
+ * @wanted: number of buffers the refill still has to place
  *
  * Returns true if the page was successfully allocated or
  * reused.
  **/
 static bool i40e_alloc_mapped_page(struct i40e_ring *rx_ring,
-				   struct i40e_rx_buffer *bi)
+				   struct i40e_rx_buffer *bi,
+				   struct i40e_rx_page_batch *pb, u16 wanted)
 {
 	struct page *page = bi->page;
 	dma_addr_t dma;
@@ -1152,7 +1201,7 @@ static bool i40e_alloc_mapped_page(struct i40e_ring *rx_ring,
 	}
 
 	/* alloc new page for storage */
-	page = dev_alloc_page();
+	page = i40e_rx_page_batch_get(pb, wanted);
 	if (unlikely(!page)) {
 		rx_ring->rx_stats.alloc_page_failed++;
 		return false;
@@ -1172,7 +1221,7 @@ static bool i40e_alloc_mapped_page(struct i40e_ring *rx_ring,
 
 	bi->dma = dma;
 	bi->page = page;
-	bi->page_offset = 0;
+	bi->page_offset = i40e_rx_offset(rx_ring);
 
 	return true;
 }
@@ -1205,8 +1254,10 @@ static void i40e_receive_skb(struct i40e_ring *rx_ring,
 bool i40e_alloc_rx_buffers(struct i40e_ring *rx_ring, u16 cleaned_count)
 {
 	u16 ntu = rx_ring->next_to_use;
+	struct i40e_rx_page_batch pb = { };
 	union i40e_rx_desc *rx_desc;
 	struct i40e_rx_buffer *bi;
+	bool failed = false;
 
 	/* do nothing if no valid netdev defined */
 	if (!rx_ring->netdev || !cleaned_count)
@@ -1216,8 +1267,10 @@ bool i40e_alloc_rx_buffers(struct i40e_ring *rx_ring, u16 cleaned_count)
 	bi = &rx_ring->rx_bi[ntu];
 
 	do {
-		if (!i40e_alloc_mapped_page(rx_ring, bi))
-			goto no_buffers;
+		if (!i40e_alloc_mapped_page(rx_ring, bi, &pb, cleaned_count)) {
+			failed = true;
+			break;
+		}
 
 		/* Refresh the desc even if buffer_addrs didn't change
 		 * because each write-back erases this info.
@@ -1239,19 +1292,17 @@ bool i40e_alloc_rx_buffers(struct i40e_ring *rx_ring, u16 cleaned_count)
 		cleaned_count--;
 	} while (cleaned_count);
 
-	if (rx_ring->next_to_use != ntu)
-		i40e_release_rx_desc(rx_ring, ntu);
-
-	return false;
+	/* return pages the refill ended up recycling buffers for */
+	while (pb.next < pb.count)
+		__free_pages(pb.pages[pb.next++], 0);
 
-no_buffers:
 	if (rx_ring->next_to_use != ntu)
 		i40e_release_rx_desc(rx_ring, ntu);
 
 	/* make sure to come back via polling to try again after
 	 * allocation failure
 	 */
-	return true;
+	return failed;
 }
 
 /**
@@ -1554,7 +1605,7 @@ static bool i40e_can_reuse_rx_page(struct i40e_rx_buffer *rx_buffer,
  * i40e_add_rx_frag - Add contents of Rx buffer to sk_buff
  * @rx_ring: rx descriptor ring to transact packets on
  * @rx_buffer: buffer containing page to add
- * @size: packet length from rx_desc
+ * @xdp: packet data within the buffer, possibly moved by an XDP program
  * @skb: sk_buff to place the data into
  *
  * This function will add the data contained in rx_buffer->page to the skb.
@@ -1567,15 +1618,17 @@ static bool i40e_can_reuse_rx_page(struct i40e_rx_buffer *rx_buffer,
  **/
 static bool i40e_add_rx_frag(struct i40e_ring *rx_ring,
 			     struct i40e_rx_buffer *rx_buffer,
-			     unsigned int size,
+			     struct xdp_buff *xdp,
 			     struct sk_buff *skb)
 {
 	struct page *page = rx_buffer->page;
-	unsigned char *va = page_address(page) + rx_buffer->page_offset;
+	unsigned char *va = xdp->data;
+	unsigned int size = xdp->data_end - xdp->data;
 #if (PAGE_SIZE < 8192)
 	unsigned int truesize = I40E_RXBUFFER_2048;
 #else
-	unsigned int truesize = ALIGN(size, L1_CACHE_BYTES);
+	unsigned int truesize = ALIGN(xdp->data_end - xdp->data_hard_start,
+				      L1_CACHE_BYTES);
 #endif
 	unsigned int pull_len;
 
@@ -1619,10 +1672,38 @@ add_tail_frag:
 	return i40e_can_reuse_rx_page(rx_buffer, page, truesize);
 }
 
+/**
+ * i40e_get_rx_buffer - Fetch Rx buffer and synchronize data for use
+ * @rx_ring: rx descriptor ring to transact packets on
+ * @size: size of buffer to add to skb
+ *
+ * This function will pull an Rx buffer from the ring and synchronize it
+ * for use by the CPU.
+ */
+static struct i40e_rx_buffer *i40e_get_rx_buffer(struct i40e_ring *rx_ring,
+						 const unsigned int size)
+{
+	struct i40e_rx_buffer *rx_buffer;
+
+	rx_buffer = &rx_ring->rx_bi[rx_ring->next_to_clean];
+	prefetchw(rx_buffer->page);
+
+	/* we are reusing so sync this buffer for CPU use */
+	dma_sync_single_range_for_cpu(rx_ring->dev,
+				      rx_buffer->dma,
+				      rx_buffer->page_offset,
+				      size,
+				      DMA_FROM_DEVICE);
+
+	return rx_buffer;
+}
+
 /**
  * i40e_fetch_rx_buffer - Allocate skb and populate it
  * @rx_ring: rx descriptor ring to transact packets on
- * @rx_desc: descriptor containing info written by hardware
+ * @rx_buffer: buffer returned by i40e_get_rx_buffer()
+ * @xdp: packet data within the buffer
+ * @skb: skb being built, or NULL for the first buffer of a packet
  *
  * This function allocates an skb on the fly, and populates it with the page
  * data from the current receive descriptor, taking care to set up the skb
@@ -1631,28 +1712,15 @@ add_tail_frag:
  */
 static inline
 struct sk_buff *i40e_fetch_rx_buffer(struct i40e_ring *rx_ring,
-				     union i40e_rx_desc *rx_desc,
+				     struct i40e_rx_buffer *rx_buffer,
+				     struct xdp_buff *xdp,
 				     struct sk_buff *skb)
 {
-	u64 local_status_error_len =
-		le64_to_cpu(rx_desc->wb.qword1.status_error_len);
-	unsigned int size =
-		(local_status_error_len & I40E_RXD_QW1_LENGTH_PBUF_MASK) >>
-		I40E_RXD_QW1_LENGTH_PBUF_SHIFT;
-	struct i40e_rx_buffer *rx_buffer;
-	struct page *page;
-
-	rx_buffer = &rx_ring->rx_bi[rx_ring->next_to_clean];
-	page = rx_buffer->page;
-	prefetchw(page);
-
 	if (likely(!skb)) {
-		void *page_addr = page_address(page) + rx_buffer->page_offset;
-
 		/* prefetch first cache line of first page */
-		prefetch(page_addr);
+		prefetch(xdp->data);
 #if L1_CACHE_BYTES < 128
-		prefetch(page_addr + L1_CACHE_BYTES);
+		prefetch(xdp->data + L1_CACHE_BYTES);
 #endif
 
 		/* allocate a skb to store the frags */
@@ -1671,15 +1739,8 @@ struct sk_buff *i40e_fetch_rx_buffer(struct i40e_ring *rx_ring,
 		prefetchw(skb->data);
 	}
 
-	/* we are reusing so sync this buffer for CPU use */
-	dma_sync_single_range_for_cpu(rx_ring->dev,
-				      rx_buffer->dma,
-				      rx_buffer->page_offset,
-				      size,
-				      DMA_FROM_DEVICE);
-
 	/* pull page into skb */
-	if (i40e_add_rx_frag(rx_ring, rx_buffer, size, skb)) {
+	if (i40e_add_rx_frag(rx_ring, rx_buffer, xdp, skb)) {
 		/* hand second half of page back to the ring */
 		i40e_reuse_rx_page(rx_ring, rx_buffer);
 		rx_ring->rx_stats.page_reuse_count++;
@@ -1733,6 +1794,46 @@ static bool i40e_is_non_eop(struct i40e_ring *rx_ring,
 	return true;
 }
 
+/**
+ * i40e_run_xdp - run an XDP program
+ * @rx_ring: Rx ring being processed
+ * @xdp: XDP buffer containing the frame
+ *
+ * Returns true if the frame was consumed by the program and must not be
+ * passed up the stack.
+ **/
+static bool i40e_run_xdp(struct i40e_ring *rx_ring, struct xdp_buff *xdp)
+{
+	struct bpf_prog *xdp_prog;
+	bool consumed = false;
+	u32 act;
+
+	rcu_read_lock();
+	xdp_prog = READ_ONCE(rx_ring->xdp_prog);
+
+	if (!xdp_prog)
+		goto xdp_out;
+
+	act = bpf_prog_run_xdp(xdp_prog, xdp);
+	switch (act) {
+	case XDP_PASS:
+		break;
+	default:
+		/* XDP_TX and XDP_REDIRECT need Tx queues of our own */
+		bpf_warn_invalid_xdp_action(act);
+		/* fallthrough */
+	case XDP_ABORTED:
+		trace_xdp_exception(rx_ring->netdev, xdp_prog, act);
+		/* fallthrough -- handle aborts by dropping packet */
+	case XDP_DROP:
+		consumed = true;
+		break;
+	}
+xdp_out:
+	rcu_read_unlock();
+	return consumed;
+}
+
 /**
  * i40e_clean_rx_irq - Clean completed descriptors from Rx ring - bounce buf
  * @rx_ring: rx descriptor ring to transact packets on
@@ -1751,9 +1852,14 @@ static int i40e_clean_rx_irq(struct i40e_ring *rx_ring, int budget)
 	struct sk_buff *skb = rx_ring->skb;
 	u16 cleaned_count = I40E_DESC_UNUSED(rx_ring);
 	bool failure = false;
+	struct xdp_buff xdp;
+
+	xdp.rxq = &rx_ring->xdp_rxq;
 
 	while (likely(total_rx_packets < budget)) {
+		struct i40e_rx_buffer *rx_buffer;
 		union i40e_rx_desc *rx_desc;
+		unsigned int size;
 		u16 vlan_tag;
 		u8 rx_ptype;
 		u64 qword;
@@ -1782,7 +1888,37 @@ static int i40e_clean_rx_irq(struct i40e_ring *rx_ring, int budget)
 		 */
 		dma_rmb();
 
-		skb = i40e_fetch_rx_buffer(rx_ring, rx_desc, skb);
+		qword = le64_to_cpu(rx_desc->wb.qword1.status_error_len);
+		size = (qword & I40E_RXD_QW1_LENGTH_PBUF_MASK) >>
+		       I40E_RXD_QW1_LENGTH_PBUF_SHIFT;
+
+		rx_buffer = i40e_get_rx_buffer(rx_ring, size);
+
+		xdp.data = page_address(rx_buffer->page) +
+			   rx_buffer->page_offset;
+		xdp.data_hard_start = xdp.data - i40e_rx_offset(rx_ring);
+		xdp.data_end = xdp.data + size;
+
+		/* XDP only runs on frames that fit a single buffer, which
+		 * i40e_xdp_setup() guarantees for anything the MAC accepts
+		 */
+		if (!skb && !i40e_rx_is_programming_status(qword) &&
+		    i40e_test_staterr(rx_desc, I40E_RXD_EOF) &&
+		    i40e_run_xdp(rx_ring, &xdp)) {
+			/* the page is still ours, give the half back as is */
+			i40e_reuse_rx_page(rx_ring, rx_buffer);
+			rx_ring->rx_stats.page_reuse_count++;
+			rx_buffer->page = NULL;
+
+			cleaned_count++;
+			i40e_is_non_eop(rx_ring, rx_desc, NULL);
+
+			total_rx_bytes += size;
+			total_rx_packets++;
+			continue;
+		}
+
+		skb = i40e_fetch_rx_buffer(rx_ring, rx_buffer, &xdp, skb);
 		if (!skb)
 			break;
 
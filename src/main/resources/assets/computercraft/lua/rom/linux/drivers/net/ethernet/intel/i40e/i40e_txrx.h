@@ -123,6 +123,9 @@ enum i40e_dyn_idx_t {
 #define I40E_RXBUFFER_8192  8192
 #define I40E_MAX_RXBUFFER   9728  /* largest size for single descriptor */
 
+/* Rx buffer size when XDP_PACKET_HEADROOM is left in front of each frame */
+#define I40E_RXBUFFER_XDP   (I40E_RXBUFFER_2048 - XDP_PACKET_HEADROOM)
+
 /* NOTE: netdev_alloc_skb reserves up to 64 bytes, NET_IP_ALIGN means we
  * reserve 2 more, and skb_shared_info adds an additional 384 bytes more,
  * this adds up to 512 bytes of extra data meaning the smallest allocation
@@ -336,6 +339,7 @@ struct i40e_ring {
 
 	u16 flags;
 #define I40E_TXR_FLAGS_WB_ON_ITR	BIT(0)
+#define I40E_RXR_FLAGS_XDP_HEADROOM	BIT(1)
 
 	/* stats structs */
 	struct i40e_queue_stats	stats;
@@ -351,6 +355,7 @@ struct i40e_ring {
 	struct i40e_vsi *vsi;		/* Backreference to associated VSI */
 	struct i40e_q_vector *q_vector;	/* Backreference to associated vector */
 
+	struct bpf_prog *xdp_prog;
 	struct rcu_head rcu;		/* to avoid race on free */
 	u16 next_to_alloc;
 	struct sk_buff *skb;		/* When i40e_clean_rx_ring_irq() must
@@ -361,6 +366,7 @@ struct i40e_ring {
 					 * i40e_clean_rx_ring_irq() is called
 					 * for this ring.
 					 */
+	struct xdp_rxq_info xdp_rxq;
 } ____cacheline_internodealigned_in_smp;
 
 enum i40e_latency_range {
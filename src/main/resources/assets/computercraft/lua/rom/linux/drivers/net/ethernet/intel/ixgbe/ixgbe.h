@@ -54,6 +54,7 @@
 #endif
 
 #include <net/busy_poll.h>
+#include <net/xdp.h>
 
 /* common prefix used by pr_<> macros */
 #undef pr_fmt
@@ -92,6 +93,7 @@
 #define IXGBE_MAX_RXBUFFER  16384  /* largest size for a single descriptor */
 
 #define IXGBE_SKB_PAD		(NET_SKB_PAD + NET_IP_ALIGN)
+#define IXGBE_XDP_PAD		(XDP_PACKET_HEADROOM + NET_IP_ALIGN)
 #if (PAGE_SIZE < 8192)
 #define IXGBE_MAX_FRAME_BUILD_SKB \
 	(SKB_WITH_OVERHEAD(IXGBE_RXBUFFER_2K) - IXGBE_SKB_PAD)
@@ -99,6 +101,13 @@
 #define IXGBE_MAX_FRAME_BUILD_SKB IXGBE_RXBUFFER_2K
 #endif
 
+/* XDP needs the whole frame in a single buffer */
+#if (PAGE_SIZE < 8192)
+#define IXGBE_MAX_FRAME_XDP	IXGBE_RXBUFFER_3K
+#else
+#define IXGBE_MAX_FRAME_XDP	IXGBE_RXBUFFER_2K
+#endif
+
 /*
  * NOTE: netdev_alloc_skb reserves up to 64 bytes, NET_IP_ALIGN means we
  * reserve 64 more, and skb_shared_info adds an additional 320 bytes more,
@@ -190,7 +199,11 @@ struct vf_macvlans {
 struct ixgbe_tx_buffer {
 	union ixgbe_adv_tx_desc *next_to_watch;
 	unsigned long time_stamp;
-	struct sk_buff *skb;
+	union {
+		struct sk_buff *skb;
+		/* XDP uses address ptr on irq_clean */
+		void *data;
+	};
 	unsigned int bytecount;
 	unsigned short gso_segs;
 	__be16 protocol;
@@ -239,14 +252,18 @@ enum ixgbe_ring_state_t {
 	__IXGBE_RX_RSC_ENABLED,
 	__IXGBE_RX_CSUM_UDP_ZERO_ERR,
 	__IXGBE_RX_FCOE,
+	__IXGBE_RX_XDP_HEADROOM,
 	__IXGBE_TX_FDIR_INIT_DONE,
 	__IXGBE_TX_XPS_INIT_DONE,
 	__IXGBE_TX_DETECT_HANG,
 	__IXGBE_HANG_CHECK_ARMED,
+	__IXGBE_TX_XDP_RING,
 };
 
 #define ring_uses_build_skb(ring) \
 	test_bit(__IXGBE_RX_BUILD_SKB_ENABLED, &(ring)->state)
+#define ring_uses_xdp_headroom(ring) \
+	test_bit(__IXGBE_RX_XDP_HEADROOM, &(ring)->state)
 
 struct ixgbe_fwd_adapter {
 	unsigned long active_vlans[BITS_TO_LONGS(VLAN_N_VID)];
@@ -269,11 +286,18 @@ struct ixgbe_fwd_adapter {
 	set_bit(__IXGBE_RX_RSC_ENABLED, &(ring)->state)
 #define clear_ring_rsc_enabled(ring) \
 	clear_bit(__IXGBE_RX_RSC_ENABLED, &(ring)->state)
+#define ring_is_xdp(ring) \
+	test_bit(__IXGBE_TX_XDP_RING, &(ring)->state)
+#define set_ring_xdp(ring) \
+	set_bit(__IXGBE_TX_XDP_RING, &(ring)->state)
+#define clear_ring_xdp(ring) \
+	clear_bit(__IXGBE_TX_XDP_RING, &(ring)->state)
 struct ixgbe_ring {
 	struct ixgbe_ring *next;	/* pointer to next ring in q_vector */
 	struct ixgbe_q_vector *q_vector; /* backpointer to host q_vector */
 	struct net_device *netdev;	/* netdev ring belongs to */
 	struct device *dev;		/* device for DMA mapping */
+	struct bpf_prog *xdp_prog;
 	struct ixgbe_fwd_adapter *l2_accel_priv;
 	void *desc;			/* descriptor ring memory */
 	union {
@@ -313,6 +337,7 @@ struct ixgbe_ring {
 		struct ixgbe_tx_queue_stats tx_stats;
 		struct ixgbe_rx_queue_stats rx_stats;
 	};
+	struct xdp_rxq_info xdp_rxq;
 } ____cacheline_internodealigned_in_smp;
 
 enum ixgbe_ring_f_enum {
@@ -334,6 +359,7 @@ enum ixgbe_ring_f_enum {
 #define IXGBE_MAX_FCOE_INDICES		8
 #define MAX_RX_QUEUES			(IXGBE_MAX_FDIR_INDICES + 1)
 #define MAX_TX_QUEUES			(IXGBE_MAX_FDIR_INDICES + 1)
+#define MAX_XDP_QUEUES			(IXGBE_MAX_FDIR_INDICES + 1)
 #define IXGBE_MAX_L2A_QUEUES		4
 #define IXGBE_BAD_L2A_QUEUE		3
 #define IXGBE_MAX_MACVLANS		31
@@ -568,6 +594,10 @@ struct ixgbe_adapter {
 	u16 tx_itr_setting;
 	u16 tx_work_limit;
 
+	/* XDP */
+	int num_xdp_queues;
+	struct bpf_prog *xdp_prog;
+
 	/* Rx fast path data */
 	int num_rx_queues;
 	u16 rx_itr_setting;
@@ -579,6 +609,9 @@ struct ixgbe_adapter {
 	/* TX */
 	struct ixgbe_ring *tx_ring[MAX_TX_QUEUES] ____cacheline_aligned_in_smp;
 
+	/* XDP TX, one ring per CPU */
+	struct ixgbe_ring *xdp_ring[MAX_XDP_QUEUES];
+
 	u64 restart_queue;
 	u64 lsc_int;
 	u32 tx_timeout_count;
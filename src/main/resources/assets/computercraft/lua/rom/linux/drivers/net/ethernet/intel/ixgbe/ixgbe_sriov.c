@@ -309,6 +309,12 @@ static int ixgbe_pci_sriov_enable(struct pci_dev *dev, int num_vfs)
 	if (err)
 		return err;
 
+	/* XDP Tx rings are only set up for the RSS queue layout */
+	if (adapter->xdp_prog) {
+		e_dev_warn("SR-IOV is not supported with XDP\n");
+		return -EINVAL;
+	}
+
 	/* While the SR-IOV capability structure reports total VFs to be 64,
 	 * we have to limit the actual number allocated based on two factors.
 	 * First, we reserve some transmit/receive resources for the PF.
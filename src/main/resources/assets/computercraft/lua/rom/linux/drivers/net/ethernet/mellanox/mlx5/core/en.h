@@ -45,6 +45,7 @@
 #include <linux/mlx5/transobj.h>
 #include <linux/rhashtable.h>
 #include <net/switchdev.h>
+#include <net/xdp.h>
 #include "wq.h"
 #include "mlx5_core.h"
 #include "en_stats.h"
@@ -382,6 +383,8 @@ struct mlx5e_rq {
 
 	struct mlx5e_rx_am     am; /* Adaptive Moderation */
 	struct bpf_prog       *xdp_prog;
+	bool                   xdp_flush;
+	struct xdp_rxq_info    xdp_rxq;
 
 	/* control */
 	struct mlx5_wq_ctrl    wq_ctrl;
@@ -194,6 +194,7 @@ static void mlx5e_update_sw_counters(struct mlx5e_priv *priv)
 		s->rx_xdp_drop += rq_stats->xdp_drop;
 		s->rx_xdp_tx += rq_stats->xdp_tx;
 		s->rx_xdp_tx_full += rq_stats->xdp_tx_full;
+		s->rx_xdp_redirect += rq_stats->xdp_redirect;
 		s->rx_wqe_err   += rq_stats->wqe_err;
 		s->rx_mpwqe_filler += rq_stats->mpwqe_filler;
 		s->rx_buff_alloc_err += rq_stats->buff_alloc_err;
@@ -571,6 +572,7 @@ static int mlx5e_create_rq(struct mlx5e_channel *c,
 	rq->tstamp  = &priv->tstamp;
 	rq->channel = c;
 	rq->ix      = c->ix;
+	xdp_rxq_info_init(&rq->xdp_rxq, c->netdev, c->ix);
 	rq->priv    = c->priv;
 
 	rq->xdp_prog = priv->xdp_prog ? bpf_prog_inc(priv->xdp_prog) : NULL;
@@ -224,6 +224,21 @@ static inline bool mlx5e_rx_cache_get(struct mlx5e_rq *rq,
 	return true;
 }
 
+static inline int mlx5e_page_map(struct mlx5e_rq *rq,
+				 struct mlx5e_dma_info *dma_info,
+				 struct page *page)
+{
+	dma_info->page = page;
+	dma_info->addr = dma_map_page(rq->pdev, page, 0,
+				      RQ_PAGE_SIZE(rq), rq->buff.map_dir);
+	if (unlikely(dma_mapping_error(rq->pdev, dma_info->addr))) {
+		put_page(page);
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
 static inline int mlx5e_page_alloc_mapped(struct mlx5e_rq *rq,
 					  struct mlx5e_dma_info *dma_info)
 {
@@ -236,15 +251,7 @@ static inline int mlx5e_page_alloc_mapped(struct mlx5e_rq *rq,
 	if (unlikely(!page))
 		return -ENOMEM;
 
-	dma_info->page = page;
-	dma_info->addr = dma_map_page(rq->pdev, page, 0,
-				      RQ_PAGE_SIZE(rq), rq->buff.map_dir);
-	if (unlikely(dma_mapping_error(rq->pdev, dma_info->addr))) {
-		put_page(page);
-		return -ENOMEM;
-	}
-
-	return 0;
+	return mlx5e_page_map(rq, dma_info, page);
 }
 
 void mlx5e_page_release(struct mlx5e_rq *rq, struct mlx5e_dma_info *dma_info,
@@ -363,26 +370,51 @@ static int mlx5e_alloc_rx_umr_mpwqe(struct mlx5e_rq *rq,
 	struct mlx5e_mpw_info *wi = &rq->mpwqe.info[ix];
 	u64 dma_offset = (u64)mlx5e_get_wqe_mtt_offset(rq, ix) << PAGE_SHIFT;
 	int pg_strides = mlx5e_mpwqe_strides_per_page(rq);
+	struct page *pages[MLX5_MPWRQ_PAGES_PER_WQE];
+	int nr_pages = 0, next = 0;
 	int err;
 	int i;
 
 	for (i = 0; i < MLX5_MPWRQ_PAGES_PER_WQE; i++) {
 		struct mlx5e_dma_info *dma_info = &wi->umr.dma_info[i];
 
-		err = mlx5e_page_alloc_mapped(rq, dma_info);
-		if (unlikely(err))
-			goto err_unmap;
+		if (!mlx5e_rx_cache_get(rq, dma_info)) {
+			/*
+			 * Everything the page cache can't provide for the
+			 * rest of the WQE comes from one bulk allocation.
+			 */
+			if (next == nr_pages) {
+				memset(pages, 0, sizeof(pages));
+				nr_pages = dev_alloc_pages_bulk_array(
+					MLX5_MPWRQ_PAGES_PER_WQE - i, pages);
+				next = 0;
+				if (unlikely(!nr_pages)) {
+					err = -ENOMEM;
+					goto err_unmap;
+				}
+			}
+			err = mlx5e_page_map(rq, dma_info, pages[next++]);
+			if (unlikely(err))
+				goto err_unmap;
+		}
 		wi->umr.mtt[i] = cpu_to_be64(dma_info->addr | MLX5_EN_WR);
 		page_ref_add(dma_info->page, pg_strides);
 		wi->skbs_frags[i] = 0;
 	}
 
+	/* Pages left over when the cache refilled behind the allocation */
+	while (next < nr_pages)
+		put_page(pages[next++]);
+
 	wi->consumed_strides = 0;
 	wqe->data.addr = cpu_to_be64(dma_offset);
 
 	return 0;
 
 err_unmap:
+	while (next < nr_pages)
+		put_page(pages[next++]);
+
 	while (--i >= 0) {
 		struct mlx5e_dma_info *dma_info = &wi->umr.dma_info[i];
 
@@ -726,9 +758,10 @@ static inline int mlx5e_xdp_handle(struct mlx5e_rq *rq,
 				   struct mlx5e_dma_info *di,
 				   void *va, u16 *rx_headroom, u32 *len)
 {
-	const struct bpf_prog *prog = READ_ONCE(rq->xdp_prog);
+	struct bpf_prog *prog = READ_ONCE(rq->xdp_prog);
 	struct xdp_buff xdp;
 	u32 act;
+	int err;
 
 	if (!prog)
 		return false;
@@ -736,6 +769,7 @@ static inline int mlx5e_xdp_handle(struct mlx5e_rq *rq,
 	xdp.data = va + *rx_headroom;
 	xdp.data_end = xdp.data + *len;
 	xdp.data_hard_start = va;
+	xdp.rxq = &rq->xdp_rxq;
 
 	act = bpf_prog_run_xdp(prog, &xdp);
 	switch (act) {
@@ -747,6 +781,23 @@ static inline int mlx5e_xdp_handle(struct mlx5e_rq *rq,
 		if (unlikely(!mlx5e_xmit_xdp_frame(rq, di, &xdp)))
 			trace_xdp_exception(rq->netdev, prog, act);
 		return true;
+	case XDP_REDIRECT:
+		/* The page leaves our ring and cannot be recycled; the
+		 * target device maps it for its own TX and drops our
+		 * reference with put_page() on completion.
+		 */
+		dma_unmap_page(rq->pdev, di->addr, RQ_PAGE_SIZE(rq),
+			       rq->buff.map_dir);
+		err = xdp_do_redirect(rq->netdev, &xdp, prog);
+		if (unlikely(err)) {
+			trace_xdp_exception(rq->netdev, prog, act);
+			rq->stats.xdp_drop++;
+			put_page(di->page);
+			return true;
+		}
+		rq->xdp_flush = true;
+		rq->stats.xdp_redirect++;
+		return true;
 	default:
 		bpf_warn_invalid_xdp_action(act);
 	case XDP_ABORTED:
@@ -982,6 +1033,11 @@ int mlx5e_poll_rx_cq(struct mlx5e_cq *cq, int budget)
 		xdp_sq->db.xdp.doorbell = false;
 	}
 
+	if (rq->xdp_flush) {
+		xdp_do_flush_map();
+		rq->xdp_flush = false;
+	}
+
 	mlx5_cqwq_update_db_record(&cq->wq);
 
 	/* ensure cq space is freed before enabling more cqes */
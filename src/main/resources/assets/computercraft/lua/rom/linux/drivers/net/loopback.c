@@ -76,6 +76,9 @@ static netdev_tx_t loopback_xmit(struct sk_buff *skb,
 
 	skb_orphan(skb);
 
+	/* A departure time set by the sender is not a receive timestamp */
+	skb->tstamp = 0;
+
 	/* Before queueing this packet to netif_rx(),
 	 * make sure dst is refcounted.
 	 */
@@ -17,22 +17,50 @@
 #include <net/rtnetlink.h>
 #include <net/dst.h>
 #include <net/xfrm.h>
+#include <net/xdp.h>
 #include <linux/veth.h>
 #include <linux/module.h>
+#include <linux/bpf.h>
+#include <linux/bpf_trace.h>
+#include <linux/ptr_ring.h>
 
 #define DRV_NAME	"veth"
 #define DRV_VERSION	"1.0"
 
+#define VETH_RING_SIZE		256
+/* Ring entries with this bit set are frames from ndo_xdp_xmit(),
+ * everything else is an skb from the peer's veth_xmit().
+ */
+#define VETH_XDP_FLAG		BIT(0)
+
 struct pcpu_vstats {
 	u64			packets;
 	u64			bytes;
 	struct u64_stats_sync	syncp;
 };
 
+/* Describes a frame queued by ndo_xdp_xmit().  It is written at the start
+ * of the frame's headroom, so the ring only has to carry one pointer, and
+ * the frame memory is a page fragment that is released with
+ * page_frag_free() once the frame has been handled.
+ */
+struct veth_xdp_frame {
+	void			*data;
+	u16			len;
+	u16			headroom;
+};
+
 struct veth_priv {
 	struct net_device __rcu	*peer;
 	atomic64_t		dropped;
+	/* program set by the user, active only while the device is up */
+	struct bpf_prog		*_xdp_prog;
+	struct bpf_prog __rcu	*xdp_prog;
+	struct napi_struct	xdp_napi;
+	struct ptr_ring		xdp_ring;
+	bool			rx_notify_masked;
 	unsigned		requested_headroom;
+	struct xdp_rxq_info	xdp_rxq;
 };
 
 /*
@@ -103,11 +131,73 @@ static const struct ethtool_ops veth_ethtool_ops = {
 	.get_ethtool_stats	= veth_get_ethtool_stats,
 };
 
+static bool veth_is_xdp_frame(void *ptr)
+{
+	return (unsigned long)ptr & VETH_XDP_FLAG;
+}
+
+static struct veth_xdp_frame *veth_ptr_to_xdp(void *ptr)
+{
+	return (void *)((unsigned long)ptr & ~VETH_XDP_FLAG);
+}
+
+static void *veth_xdp_to_ptr(struct veth_xdp_frame *frame)
+{
+	return (void *)((unsigned long)frame | VETH_XDP_FLAG);
+}
+
+static void veth_ptr_free(void *ptr)
+{
+	if (veth_is_xdp_frame(ptr))
+		page_frag_free(veth_ptr_to_xdp(ptr));
+	else
+		kfree_skb(ptr);
+}
+
+static void __veth_xdp_flush(struct veth_priv *priv)
+{
+	/* Write ptr_ring before reading rx_notify_masked */
+	smp_mb();
+	if (!priv->rx_notify_masked) {
+		priv->rx_notify_masked = true;
+		napi_schedule(&priv->xdp_napi);
+	}
+}
+
+static int veth_xdp_rx(struct veth_priv *priv, struct sk_buff *skb)
+{
+	if (unlikely(ptr_ring_produce(&priv->xdp_ring, skb))) {
+		dev_kfree_skb_any(skb);
+		return NET_RX_DROP;
+	}
+
+	return NET_RX_SUCCESS;
+}
+
+static int veth_forward_skb(struct net_device *dev, struct sk_buff *skb,
+			    bool xdp)
+{
+	return __dev_forward_skb(dev, skb) ?: xdp ?
+		veth_xdp_rx(netdev_priv(dev), skb) :
+		netif_rx(skb);
+}
+
+static void veth_count_tx(struct net_device *dev, unsigned int length)
+{
+	struct pcpu_vstats *stats = this_cpu_ptr(dev->vstats);
+
+	u64_stats_update_begin(&stats->syncp);
+	stats->bytes += length;
+	stats->packets++;
+	u64_stats_update_end(&stats->syncp);
+}
+
 static netdev_tx_t veth_xmit(struct sk_buff *skb, struct net_device *dev)
 {
-	struct veth_priv *priv = netdev_priv(dev);
+	struct veth_priv *rcv_priv, *priv = netdev_priv(dev);
 	struct net_device *rcv;
 	int length = skb->len;
+	bool rcv_xdp = false;
 
 	rcu_read_lock();
 	rcv = rcu_dereference(priv->peer);
@@ -116,21 +206,272 @@ static netdev_tx_t veth_xmit(struct sk_buff *skb, struct net_device *dev)
 		goto drop;
 	}
 
-	if (likely(dev_forward_skb(rcv, skb) == NET_RX_SUCCESS)) {
-		struct pcpu_vstats *stats = this_cpu_ptr(dev->vstats);
+	/* While the peer runs an XDP program it receives from its ring */
+	rcv_priv = netdev_priv(rcv);
+	rcv_xdp = rcu_access_pointer(rcv_priv->xdp_prog);
 
-		u64_stats_update_begin(&stats->syncp);
-		stats->bytes += length;
-		stats->packets++;
-		u64_stats_update_end(&stats->syncp);
+	if (likely(veth_forward_skb(rcv, skb, rcv_xdp) == NET_RX_SUCCESS)) {
+		veth_count_tx(dev, length);
 	} else {
 drop:
 		atomic64_inc(&priv->dropped);
 	}
+
+	if (rcv_xdp)
+		__veth_xdp_flush(rcv_priv);
+
 	rcu_read_unlock();
 	return NETDEV_TX_OK;
 }
 
+/* Queue an XDP frame on the peer's ring.  This only works while the peer
+ * has an XDP program attached, it is what gives the peer a ring and a NAPI
+ * context to run the frame in.
+ */
+static int veth_xdp_xmit(struct net_device *dev, struct xdp_buff *xdp)
+{
+	struct veth_priv *rcv_priv, *priv = netdev_priv(dev);
+	unsigned int headroom = xdp->data - xdp->data_hard_start;
+	unsigned int len = xdp->data_end - xdp->data;
+	struct veth_xdp_frame *frame;
+	struct net_device *rcv;
+	int err = 0;
+
+	rcu_read_lock();
+	rcv = rcu_dereference(priv->peer);
+	if (unlikely(!rcv)) {
+		err = -ENXIO;
+		goto out;
+	}
+
+	rcv_priv = netdev_priv(rcv);
+	if (!rcu_access_pointer(rcv_priv->xdp_prog)) {
+		err = -ENXIO;
+		goto out;
+	}
+
+	if (unlikely(len > rcv->mtu + rcv->hard_header_len)) {
+		err = -EMSGSIZE;
+		goto out;
+	}
+
+	/* The descriptor lives in the headroom and its address is tagged */
+	if (unlikely(headroom < sizeof(*frame) ||
+		     !IS_ALIGNED((unsigned long)xdp->data_hard_start,
+				 sizeof(void *)))) {
+		err = -EOVERFLOW;
+		goto out;
+	}
+
+	frame = xdp->data_hard_start;
+	frame->data = xdp->data;
+	frame->len = len;
+	frame->headroom = headroom;
+
+	if (unlikely(ptr_ring_produce(&rcv_priv->xdp_ring,
+				      veth_xdp_to_ptr(frame)))) {
+		err = -ENOSPC;
+		goto out;
+	}
+
+	veth_count_tx(dev, len);
+out:
+	rcu_read_unlock();
+	return err;
+}
+
+static void veth_xdp_flush(struct net_device *dev)
+{
+	struct veth_priv *rcv_priv, *priv = netdev_priv(dev);
+	struct net_device *rcv;
+
+	rcu_read_lock();
+	rcv = rcu_dereference(priv->peer);
+	if (unlikely(!rcv))
+		goto out;
+
+	rcv_priv = netdev_priv(rcv);
+	/* the peer only has a ring while it runs XDP */
+	if (unlikely(!rcu_access_pointer(rcv_priv->xdp_prog)))
+		goto out;
+
+	__veth_xdp_flush(rcv_priv);
+out:
+	rcu_read_unlock();
+}
+
+static struct sk_buff *veth_xdp_rcv_one(struct veth_priv *priv,
+					struct veth_xdp_frame *frame,
+					bool *xdp_xmit, bool *xdp_redir)
+{
+	struct net_device *dev = priv->xdp_napi.dev;
+	void *data = frame->data;
+	unsigned int len = frame->len;
+	struct bpf_prog *xdp_prog;
+	struct sk_buff *skb;
+	u32 act;
+
+	rcu_read_lock();
+	xdp_prog = rcu_dereference(priv->xdp_prog);
+	if (likely(xdp_prog)) {
+		struct xdp_buff xdp;
+
+		/* keep the descriptor out of reach of bpf_xdp_adjust_head() */
+		xdp.data_hard_start = (void *)(frame + 1);
+		xdp.data = data;
+		xdp.data_end = data + len;
+		xdp.rxq = &priv->xdp_rxq;
+
+		act = bpf_prog_run_xdp(xdp_prog, &xdp);
+
+		switch (act) {
+		case XDP_PASS:
+			data = xdp.data;
+			len = xdp.data_end - xdp.data;
+			break;
+		case XDP_TX:
+			if (unlikely(veth_xdp_xmit(dev, &xdp))) {
+				trace_xdp_exception(dev, xdp_prog, act);
+				goto err_xdp;
+			}
+			*xdp_xmit = true;
+			rcu_read_unlock();
+			return NULL;
+		case XDP_REDIRECT:
+			if (xdp_do_redirect(dev, &xdp, xdp_prog))
+				goto err_xdp;
+			*xdp_redir = true;
+			rcu_read_unlock();
+			return NULL;
+		default:
+			bpf_warn_invalid_xdp_action(act);
+			/* fall through */
+		case XDP_ABORTED:
+			trace_xdp_exception(dev, xdp_prog, act);
+			/* fall through */
+		case XDP_DROP:
+			goto err_xdp;
+		}
+	}
+	rcu_read_unlock();
+
+	/* The frame came from another driver's buffer and there is no
+	 * telling how much tailroom it has, so the stack gets a copy.
+	 */
+	skb = napi_alloc_skb(&priv->xdp_napi, len);
+	if (unlikely(!skb))
+		goto err;
+
+	memcpy(skb_put(skb, len), data, len);
+	page_frag_free(frame);
+	skb->protocol = eth_type_trans(skb, dev);
+
+	return skb;
+
+err_xdp:
+	rcu_read_unlock();
+err:
+	page_frag_free(frame);
+	atomic_long_inc(&dev->rx_dropped);
+	return NULL;
+}
+
+static struct sk_buff *veth_xdp_rcv_skb(struct veth_priv *priv,
+					struct sk_buff *skb)
+{
+	int act;
+
+	rcu_read_lock();
+	act = do_xdp_generic(rcu_dereference(priv->xdp_prog), skb);
+	rcu_read_unlock();
+
+	return act == XDP_PASS ? skb : NULL;
+}
+
+static int veth_xdp_rcv(struct veth_priv *priv, int budget, bool *xdp_xmit,
+			bool *xdp_redir)
+{
+	int done = 0;
+
+	while (done < budget) {
+		void *ptr = __ptr_ring_consume(&priv->xdp_ring);
+		struct sk_buff *skb;
+
+		if (!ptr)
+			break;
+
+		if (veth_is_xdp_frame(ptr))
+			skb = veth_xdp_rcv_one(priv, veth_ptr_to_xdp(ptr),
+					       xdp_xmit, xdp_redir);
+		else
+			skb = veth_xdp_rcv_skb(priv, ptr);
+
+		if (skb)
+			napi_gro_receive(&priv->xdp_napi, skb);
+
+		done++;
+	}
+
+	return done;
+}
+
+static int veth_poll(struct napi_struct *napi, int budget)
+{
+	struct veth_priv *priv = container_of(napi, struct veth_priv, xdp_napi);
+	bool xdp_xmit = false, xdp_redir = false;
+	int done;
+
+	done = veth_xdp_rcv(priv, budget, &xdp_xmit, &xdp_redir);
+
+	if (done < budget && napi_complete_done(napi, done)) {
+		/* Write rx_notify_masked before reading ptr_ring */
+		smp_store_mb(priv->rx_notify_masked, false);
+		if (unlikely(!__ptr_ring_empty(&priv->xdp_ring))) {
+			priv->rx_notify_masked = true;
+			napi_schedule(&priv->xdp_napi);
+		}
+	}
+
+	if (xdp_xmit)
+		veth_xdp_flush(napi->dev);
+	if (xdp_redir)
+		xdp_do_flush_map();
+
+	return done;
+}
+
+static int veth_enable_xdp(struct net_device *dev)
+{
+	struct veth_priv *priv = netdev_priv(dev);
+	int err;
+
+	err = ptr_ring_init(&priv->xdp_ring, VETH_RING_SIZE, GFP_KERNEL);
+	if (err)
+		return err;
+
+	xdp_rxq_info_init(&priv->xdp_rxq, dev, 0);
+	netif_napi_add(dev, &priv->xdp_napi, veth_poll, NAPI_POLL_WEIGHT);
+	napi_enable(&priv->xdp_napi);
+
+	rcu_assign_pointer(priv->xdp_prog, priv->_xdp_prog);
+	return 0;
+}
+
+static void veth_disable_xdp(struct net_device *dev)
+{
+	struct veth_priv *priv = netdev_priv(dev);
+
+	RCU_INIT_POINTER(priv->xdp_prog, NULL);
+	/* no new producers once everyone saw the program go away */
+	synchronize_net();
+
+	napi_disable(&priv->xdp_napi);
+	netif_napi_del(&priv->xdp_napi);
+	priv->rx_notify_masked = false;
+
+	ptr_ring_cleanup(&priv->xdp_ring, veth_ptr_free);
+}
+
 /*
  * general routines
  */
@@ -192,6 +533,13 @@ static int veth_open(struct net_device *dev)
 	if (!peer)
 		return -ENOTCONN;
 
+	if (priv->_xdp_prog) {
+		int err = veth_enable_xdp(dev);
+
+		if (err)
+			return err;
+	}
+
 	if (peer->flags & IFF_UP) {
 		netif_carrier_on(dev);
 		netif_carrier_on(peer);
@@ -208,6 +556,9 @@ static int veth_close(struct net_device *dev)
 	if (peer)
 		netif_carrier_off(peer);
 
+	if (priv->_xdp_prog)
+		veth_disable_xdp(dev);
+
 	return 0;
 }
 
@@ -226,6 +577,10 @@ static int veth_dev_init(struct net_device *dev)
 
 static void veth_dev_free(struct net_device *dev)
 {
+	struct veth_priv *priv = netdev_priv(dev);
+
+	if (priv->_xdp_prog)
+		bpf_prog_put(priv->_xdp_prog);
 	free_percpu(dev->vstats);
 	free_netdev(dev);
 }
@@ -282,6 +637,49 @@ out:
 	rcu_read_unlock();
 }
 
+static int veth_xdp_set(struct net_device *dev, struct bpf_prog *prog)
+{
+	struct veth_priv *priv = netdev_priv(dev);
+	struct bpf_prog *old_prog = priv->_xdp_prog;
+	int err;
+
+	priv->_xdp_prog = prog;
+
+	if (dev->flags & IFF_UP) {
+		if (prog && !old_prog) {
+			err = veth_enable_xdp(dev);
+			if (err) {
+				priv->_xdp_prog = old_prog;
+				return err;
+			}
+		} else if (!prog && old_prog) {
+			veth_disable_xdp(dev);
+		} else {
+			rcu_assign_pointer(priv->xdp_prog, prog);
+		}
+	}
+
+	if (old_prog)
+		bpf_prog_put(old_prog);
+
+	return 0;
+}
+
+static int veth_xdp(struct net_device *dev, struct netdev_xdp *xdp)
+{
+	struct veth_priv *priv = netdev_priv(dev);
+
+	switch (xdp->command) {
+	case XDP_SETUP_PROG:
+		return veth_xdp_set(dev, xdp->prog);
+	case XDP_QUERY_PROG:
+		xdp->prog_attached = !!priv->_xdp_prog;
+		return 0;
+	default:
+		return -EINVAL;
+	}
+}
+
 static const struct net_device_ops veth_netdev_ops = {
 	.ndo_init            = veth_dev_init,
 	.ndo_open            = veth_open,
@@ -296,6 +694,9 @@ static const struct net_device_ops veth_netdev_ops = {
 	.ndo_get_iflink		= veth_get_iflink,
 	.ndo_features_check	= passthru_features_check,
 	.ndo_set_rx_headroom	= veth_set_rx_headroom,
+	.ndo_xdp		= veth_xdp,
+	.ndo_xdp_xmit		= veth_xdp_xmit,
+	.ndo_xdp_flush		= veth_xdp_flush,
 };
 
 #define VETH_FEATURES (NETIF_F_SG | NETIF_F_FRAGLIST | NETIF_F_HW_CSUM | \
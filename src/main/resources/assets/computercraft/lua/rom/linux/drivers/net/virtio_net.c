@@ -29,6 +29,7 @@
 #include <linux/slab.h>
 #include <linux/cpu.h>
 #include <linux/average.h>
+#include <net/xdp.h>
 
 static int napi_weight = NAPI_POLL_WEIGHT;
 module_param(napi_weight, int, 0444);
@@ -46,6 +47,10 @@ module_param(gso, bool, 0444);
 /* Amount of XDP headroom to prepend to packets for use by xdp_adjust_head */
 #define VIRTIO_XDP_HEADROOM 256
 
+/* Deferred work for the end of a NAPI poll, see virtnet_poll() */
+#define VIRTIO_XDP_TX		BIT(0)
+#define VIRTIO_XDP_REDIR	BIT(1)
+
 /* RX packet size EWMA. The average packet size is used to determine the packet
  * buffer size when refilling RX rings. As the entire RX ring may be refilled
  * at once, the weight is chosen so that the EWMA will be insensitive to short-
@@ -111,6 +116,8 @@ struct receive_queue {
 
 	/* Name of this receive queue: input.$index */
 	char name[40];
+
+	struct xdp_rxq_info xdp_rxq;
 };
 
 struct virtnet_info {
@@ -343,20 +350,27 @@ static struct sk_buff *page_to_skb(struct virtnet_info *vi,
 	return skb;
 }
 
-static bool virtnet_xdp_xmit(struct virtnet_info *vi,
-			     struct receive_queue *rq,
-			     struct xdp_buff *xdp)
+static struct send_queue *virtnet_xdp_sq(struct virtnet_info *vi)
 {
+	unsigned int qp;
+
+	qp = vi->curr_queue_pairs - vi->xdp_queue_pairs + smp_processor_id();
+	return &vi->sq[qp];
+}
+
+/* Queue a frame on this CPU's XDP TX queue without notifying the host;
+ * the caller kicks the queue once per NAPI poll (or via ndo_xdp_flush).
+ * On failure the caller still owns the page.
+ */
+static bool __virtnet_xdp_xmit(struct virtnet_info *vi,
+			       struct xdp_buff *xdp)
+{
+	struct send_queue *sq = virtnet_xdp_sq(vi);
 	struct virtio_net_hdr_mrg_rxbuf *hdr;
 	unsigned int len;
-	struct send_queue *sq;
-	unsigned int qp;
 	void *xdp_sent;
 	int err;
 
-	qp = vi->curr_queue_pairs - vi->xdp_queue_pairs + smp_processor_id();
-	sq = &vi->sq[qp];
-
 	/* Free up any pending old buffers before queueing new ones. */
 	while ((xdp_sent = virtqueue_get_buf(sq->vq, &len)) != NULL) {
 		struct page *sent_page = virt_to_head_page(xdp_sent);
@@ -373,16 +387,44 @@ static bool virtnet_xdp_xmit(struct virtnet_info *vi,
 
 	err = virtqueue_add_outbuf(sq->vq, sq->sg, 1, xdp->data, GFP_ATOMIC);
 	if (unlikely(err)) {
-		struct page *page = virt_to_head_page(xdp->data);
-
-		put_page(page);
+		xdp->data += vi->hdr_len;
 		return false;
 	}
 
-	virtqueue_kick(sq->vq);
 	return true;
 }
 
+static void virtnet_xdp_flush(struct net_device *dev)
+{
+	struct virtnet_info *vi = netdev_priv(dev);
+
+	if (unlikely(!vi->xdp_queue_pairs))
+		return;
+
+	virtqueue_kick(virtnet_xdp_sq(vi)->vq);
+}
+
+static int virtnet_xdp_xmit(struct net_device *dev, struct xdp_buff *xdp)
+{
+	struct virtnet_info *vi = netdev_priv(dev);
+	struct bpf_prog *xdp_prog;
+
+	/* The XDP TX queues only exist while a program is attached, and
+	 * the frame needs room in front of it for the vnet header.
+	 */
+	xdp_prog = rcu_dereference(vi->rq[0].xdp_prog);
+	if (!xdp_prog)
+		return -ENXIO;
+
+	if (unlikely(xdp->data - xdp->data_hard_start < vi->hdr_len))
+		return -EOVERFLOW;
+
+	if (unlikely(!__virtnet_xdp_xmit(vi, xdp)))
+		return -ENOSPC;
+
+	return 0;
+}
+
 static unsigned int virtnet_get_headroom(struct virtnet_info *vi)
 {
 	return vi->xdp_queue_pairs ? VIRTIO_XDP_HEADROOM : 0;
@@ -391,7 +433,8 @@ static unsigned int virtnet_get_headroom(struct virtnet_info *vi)
 static struct sk_buff *receive_small(struct net_device *dev,
 				     struct virtnet_info *vi,
 				     struct receive_queue *rq,
-				     void *buf, unsigned int len)
+				     void *buf, unsigned int len,
+				     unsigned int *xdp_xmit)
 {
 	struct sk_buff *skb;
 	struct bpf_prog *xdp_prog;
@@ -401,6 +444,8 @@ static struct sk_buff *receive_small(struct net_device *dev,
 	unsigned int buflen = SKB_DATA_ALIGN(GOOD_PACKET_LEN + headroom) +
 			      SKB_DATA_ALIGN(sizeof(struct skb_shared_info));
 	unsigned int delta = 0;
+	int err;
+
 	len -= vi->hdr_len;
 
 	rcu_read_lock();
@@ -417,6 +462,7 @@ static struct sk_buff *receive_small(struct net_device *dev,
 		xdp.data_hard_start = buf + VIRTNET_RX_PAD + vi->hdr_len;
 		xdp.data = xdp.data_hard_start + xdp_headroom;
 		xdp.data_end = xdp.data + len;
+		xdp.rxq = &rq->xdp_rxq;
 		orig_data = xdp.data;
 		act = bpf_prog_run_xdp(xdp_prog, &xdp);
 
@@ -426,8 +472,20 @@ static struct sk_buff *receive_small(struct net_device *dev,
 			delta = orig_data - xdp.data;
 			break;
 		case XDP_TX:
-			if (unlikely(!virtnet_xdp_xmit(vi, rq, &xdp)))
+			if (unlikely(!__virtnet_xdp_xmit(vi, &xdp))) {
+				trace_xdp_exception(vi->dev, xdp_prog, act);
+				goto err_xdp;
+			}
+			*xdp_xmit |= VIRTIO_XDP_TX;
+			rcu_read_unlock();
+			goto xdp_xmit;
+		case XDP_REDIRECT:
+			err = xdp_do_redirect(dev, &xdp, xdp_prog);
+			if (unlikely(err)) {
 				trace_xdp_exception(vi->dev, xdp_prog, act);
+				goto err_xdp;
+			}
+			*xdp_xmit |= VIRTIO_XDP_REDIR;
 			rcu_read_unlock();
 			goto xdp_xmit;
 		default:
@@ -549,7 +607,8 @@ static struct sk_buff *receive_mergeable(struct net_device *dev,
 					 struct virtnet_info *vi,
 					 struct receive_queue *rq,
 					 unsigned long ctx,
-					 unsigned int len)
+					 unsigned int len,
+					 unsigned int *xdp_xmit)
 {
 	void *buf = mergeable_ctx_to_buf_address(ctx);
 	struct virtio_net_hdr_mrg_rxbuf *hdr = buf;
@@ -569,6 +628,7 @@ static struct sk_buff *receive_mergeable(struct net_device *dev,
 		struct xdp_buff xdp;
 		void *data;
 		u32 act;
+		int err;
 
 		/* This happens when rx buffer size is underestimated */
 		if (unlikely(num_buf > 1)) {
@@ -597,6 +657,7 @@ static struct sk_buff *receive_mergeable(struct net_device *dev,
 		xdp.data_hard_start = data - VIRTIO_XDP_HEADROOM + vi->hdr_len;
 		xdp.data = data + vi->hdr_len;
 		xdp.data_end = xdp.data + (len - vi->hdr_len);
+		xdp.rxq = &rq->xdp_rxq;
 		act = bpf_prog_run_xdp(xdp_prog, &xdp);
 
 		switch (act) {
@@ -619,8 +680,23 @@ static struct sk_buff *receive_mergeable(struct net_device *dev,
 			}
 			break;
 		case XDP_TX:
-			if (unlikely(!virtnet_xdp_xmit(vi, rq, &xdp)))
+			if (unlikely(!__virtnet_xdp_xmit(vi, &xdp))) {
 				trace_xdp_exception(vi->dev, xdp_prog, act);
+				goto err_xdp_page;
+			}
+			*xdp_xmit |= VIRTIO_XDP_TX;
+			ewma_pkt_len_add(&rq->mrg_avg_pkt_len, len);
+			if (unlikely(xdp_page != page))
+				goto err_xdp;
+			rcu_read_unlock();
+			goto xdp_xmit;
+		case XDP_REDIRECT:
+			err = xdp_do_redirect(dev, &xdp, xdp_prog);
+			if (unlikely(err)) {
+				trace_xdp_exception(vi->dev, xdp_prog, act);
+				goto err_xdp_page;
+			}
+			*xdp_xmit |= VIRTIO_XDP_REDIR;
 			ewma_pkt_len_add(&rq->mrg_avg_pkt_len, len);
 			if (unlikely(xdp_page != page))
 				goto err_xdp;
@@ -631,6 +707,7 @@ static struct sk_buff *receive_mergeable(struct net_device *dev,
 		case XDP_ABORTED:
 			trace_xdp_exception(vi->dev, xdp_prog, act);
 		case XDP_DROP:
+err_xdp_page:
 			if (unlikely(xdp_page != page))
 				__free_pages(xdp_page, 0);
 			ewma_pkt_len_add(&rq->mrg_avg_pkt_len, len);
@@ -718,7 +795,7 @@ xdp_xmit:
 }
 
 static int receive_buf(struct virtnet_info *vi, struct receive_queue *rq,
-		       void *buf, unsigned int len)
+		       void *buf, unsigned int len, unsigned int *xdp_xmit)
 {
 	struct net_device *dev = vi->dev;
 	struct sk_buff *skb;
@@ -741,11 +818,12 @@ static int receive_buf(struct virtnet_info *vi, struct receive_queue *rq,
 	}
 
 	if (vi->mergeable_rx_bufs)
-		skb = receive_mergeable(dev, vi, rq, (unsigned long)buf, len);
+		skb = receive_mergeable(dev, vi, rq, (unsigned long)buf, len,
+					xdp_xmit);
 	else if (vi->big_packets)
 		skb = receive_big(dev, vi, rq, buf, len);
 	else
-		skb = receive_small(dev, vi, rq, buf, len);
+		skb = receive_small(dev, vi, rq, buf, len, xdp_xmit);
 
 	if (unlikely(!skb))
 		return 0;
@@ -981,7 +1059,8 @@ static void refill_work(struct work_struct *work)
 	}
 }
 
-static int virtnet_receive(struct receive_queue *rq, int budget)
+static int virtnet_receive(struct receive_queue *rq, int budget,
+			   unsigned int *xdp_xmit)
 {
 	struct virtnet_info *vi = rq->vq->vdev->priv;
 	unsigned int len, received = 0, bytes = 0;
@@ -990,7 +1069,7 @@ static int virtnet_receive(struct receive_queue *rq, int budget)
 
 	while (received < budget &&
 	       (buf = virtqueue_get_buf(rq->vq, &len)) != NULL) {
-		bytes += receive_buf(vi, rq, buf, len);
+		bytes += receive_buf(vi, rq, buf, len, xdp_xmit);
 		received++;
 	}
 
@@ -1011,9 +1090,16 @@ static int virtnet_poll(struct napi_struct *napi, int budget)
 {
 	struct receive_queue *rq =
 		container_of(napi, struct receive_queue, napi);
-	unsigned int r, received;
+	struct virtnet_info *vi = rq->vq->vdev->priv;
+	unsigned int r, received, xdp_xmit = 0;
+
+	received = virtnet_receive(rq, budget, &xdp_xmit);
 
-	received = virtnet_receive(rq, budget);
+	/* Ring the doorbells once for everything queued during this poll */
+	if (xdp_xmit & VIRTIO_XDP_REDIR)
+		xdp_do_flush_map();
+	if (xdp_xmit & VIRTIO_XDP_TX)
+		virtnet_xdp_flush(vi->dev);
 
 	/* Out of packets? */
 	if (received < budget) {
@@ -1894,6 +1980,8 @@ static const struct net_device_ops virtnet_netdev = {
 	.ndo_poll_controller = virtnet_netpoll,
 #endif
 	.ndo_xdp		= virtnet_xdp,
+	.ndo_xdp_xmit		= virtnet_xdp_xmit,
+	.ndo_xdp_flush		= virtnet_xdp_flush,
 };
 
 static void virtnet_config_changed_work(struct work_struct *work)
@@ -2131,6 +2219,7 @@ static int virtnet_alloc_queues(struct virtnet_info *vi)
 		sg_init_table(vi->rq[i].sg, ARRAY_SIZE(vi->rq[i].sg));
 		ewma_pkt_len_init(&vi->rq[i].mrg_avg_pkt_len);
 		sg_init_table(vi->sq[i].sg, ARRAY_SIZE(vi->sq[i].sg));
+		xdp_rxq_info_init(&vi->rq[i].xdp_rxq, vi->dev, i);
 	}
 
 	return 0;
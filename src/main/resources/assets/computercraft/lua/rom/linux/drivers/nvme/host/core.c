@@ -1186,6 +1186,26 @@ static const struct block_device_operations nvme_fops = {
 	.pr_ops		= &nvme_pr_ops,
 };
 
+/*
+ * Look up the namespace behind a block device for the target passthrough
+ * code.  Returns NULL if @bdev is not an nvme namespace, otherwise the
+ * namespace with a reference held that nvme_put_ns_from_bdev() drops.
+ */
+struct nvme_ns *nvme_get_ns_from_bdev(struct block_device *bdev)
+{
+	if (bdev->bd_disk->fops != &nvme_fops)
+		return NULL;
+	return nvme_get_ns_from_disk(bdev->bd_disk);
+}
+EXPORT_SYMBOL_GPL(nvme_get_ns_from_bdev);
+
+void nvme_put_ns_from_bdev(struct nvme_ns *ns)
+{
+	module_put(ns->ctrl->ops->module);
+	nvme_put_ns(ns);
+}
+EXPORT_SYMBOL_GPL(nvme_put_ns_from_bdev);
+
 static int nvme_wait_ready(struct nvme_ctrl *ctrl, u64 cap, bool enabled)
 {
 	unsigned long timeout =
@@ -56,6 +56,8 @@ enum {
 	NVMF_OPT_RECONNECT_DELAY = 1 << 9,
 	NVMF_OPT_HOST_TRADDR	= 1 << 10,
 	NVMF_OPT_CTRL_LOSS_TMO	= 1 << 11,
+	NVMF_OPT_HDR_DIGEST	= 1 << 12,
+	NVMF_OPT_DATA_DIGEST	= 1 << 13,
 };
 
 /**
@@ -84,6 +86,8 @@ enum {
  * @max_reconnects: maximum number of allowed reconnect attempts before removing
  *              the controller, (-1) means reconnect forever, zero means remove
  *              immediately;
+ * @hdr_digest: generate/verify header digest (TCP)
+ * @data_digest: generate/verify data digest (TCP)
  */
 struct nvmf_ctrl_options {
 	unsigned		mask;
@@ -100,6 +104,8 @@ struct nvmf_ctrl_options {
 	struct nvmf_host	*host;
 	int			nr_reconnects;
 	int			max_reconnects;
+	bool			hdr_digest;
+	bool			data_digest;
 };
 
 /*
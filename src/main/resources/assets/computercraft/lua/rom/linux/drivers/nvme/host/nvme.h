@@ -259,6 +259,23 @@ static inline void nvme_end_request(struct request *req, __le16 status,
 	blk_mq_complete_request(req);
 }
 
+/*
+ * Successful completions may be collected on @batch, the caller then ends
+ * them with blk_mq_end_request_batch().
+ */
+static inline void nvme_end_request_batch(struct request *req, __le16 status,
+		union nvme_result result, struct list_head *batch)
+{
+	struct nvme_request *rq = nvme_req(req);
+
+	rq->status = le16_to_cpu(status) >> 1;
+	rq->result = result;
+	if (rq->status)
+		blk_mq_complete_request(req);
+	else
+		blk_mq_complete_request_batch(req, batch);
+}
+
 void nvme_complete_rq(struct request *req);
 void nvme_cancel_request(struct request *req, void *data, bool reserved);
 bool nvme_change_ctrl_state(struct nvme_ctrl *ctrl,
@@ -291,6 +308,9 @@ void nvme_wait_freeze(struct nvme_ctrl *ctrl);
 void nvme_wait_freeze_timeout(struct nvme_ctrl *ctrl, long timeout);
 void nvme_start_freeze(struct nvme_ctrl *ctrl);
 
+struct nvme_ns *nvme_get_ns_from_bdev(struct block_device *bdev);
+void nvme_put_ns_from_bdev(struct nvme_ns *ns);
+
 #define NVME_QID_ANY -1
 struct request *nvme_alloc_request(struct request_queue *q,
 		struct nvme_command *cmd, unsigned int flags, int qid);
@@ -66,6 +66,10 @@ static bool use_cmb_sqes = true;
 module_param(use_cmb_sqes, bool, 0644);
 MODULE_PARM_DESC(use_cmb_sqes, "use controller's memory buffer for I/O SQes");
 
+static unsigned int poll_queues;
+module_param(poll_queues, uint, 0644);
+MODULE_PARM_DESC(poll_queues, "number of interrupt-less queues used for polled I/O");
+
 static struct workqueue_struct *nvme_workq;
 
 struct nvme_dev;
@@ -89,6 +93,7 @@ struct nvme_dev {
 	unsigned queue_count;
 	unsigned online_queues;
 	unsigned max_qid;
+	unsigned nr_poll_queues;
 	int q_depth;
 	u32 db_stride;
 	void __iomem *bar;
@@ -148,6 +153,7 @@ struct nvme_queue {
 	u16 qid;
 	u8 cq_phase;
 	u8 cqe_seen;
+	bool polled;
 	u32 *dbbuf_sq_db;
 	u32 *dbbuf_cq_db;
 	u32 *dbbuf_sq_ei;
@@ -759,6 +765,17 @@ static void nvme_pci_complete_rq(struct request *req)
 	nvme_complete_rq(req);
 }
 
+/* The batched equivalent of nvme_pci_complete_rq() for successful requests */
+static void nvme_pci_complete_batch(struct nvme_dev *dev,
+		struct list_head *batch)
+{
+	struct request *req;
+
+	list_for_each_entry(req, batch, queuelist)
+		nvme_unmap_data(dev, req);
+	blk_mq_end_request_batch(batch);
+}
+
 /* We read the CQE phase first to check if the rest of the entry is valid */
 static inline bool nvme_cqe_valid(struct nvme_queue *nvmeq, u16 head,
 		u16 phase)
@@ -768,6 +785,7 @@ static inline bool nvme_cqe_valid(struct nvme_queue *nvmeq, u16 head,
 
 static void __nvme_process_cq(struct nvme_queue *nvmeq, unsigned int *tag)
 {
+	LIST_HEAD(batch);
 	u16 head, phase;
 
 	head = nvmeq->cq_head;
@@ -806,7 +824,7 @@ static void __nvme_process_cq(struct nvme_queue *nvmeq, unsigned int *tag)
 		}
 
 		req = blk_mq_tag_to_rq(*nvmeq->tags, cqe.command_id);
-		nvme_end_request(req, cqe.status, cqe.result);
+		nvme_end_request_batch(req, cqe.status, cqe.result, &batch);
 	}
 
 	if (head == nvmeq->cq_head && phase == nvmeq->cq_phase)
@@ -819,6 +837,9 @@ static void __nvme_process_cq(struct nvme_queue *nvmeq, unsigned int *tag)
 	nvmeq->cq_head = head;
 	nvmeq->cq_phase = phase;
 
+	/* End the batch after the CQ doorbell, the entries are free already */
+	nvme_pci_complete_batch(nvmeq->dev, &batch);
+
 	nvmeq->cqe_seen = 1;
 }
 
@@ -898,7 +919,10 @@ static int adapter_alloc_cq(struct nvme_dev *dev, u16 qid,
 						struct nvme_queue *nvmeq)
 {
 	struct nvme_command c;
-	int flags = NVME_QUEUE_PHYS_CONTIG | NVME_CQ_IRQ_ENABLED;
+	int flags = NVME_QUEUE_PHYS_CONTIG;
+
+	if (!nvmeq->polled)
+		flags |= NVME_CQ_IRQ_ENABLED;
 
 	/*
 	 * Note: we (ab)use the fact the the prp fields survive if no data
@@ -1087,7 +1111,8 @@ static int nvme_suspend_queue(struct nvme_queue *nvmeq)
 	if (!nvmeq->qid && nvmeq->dev->ctrl.admin_q)
 		blk_mq_stop_hw_queues(nvmeq->dev->ctrl.admin_q);
 
-	free_irq(vector, nvmeq);
+	if (!nvmeq->polled)
+		free_irq(vector, nvmeq);
 
 	return 0;
 }
@@ -1224,7 +1249,12 @@ static int nvme_create_queue(struct nvme_queue *nvmeq, int qid)
 	struct nvme_dev *dev = nvmeq->dev;
 	int result;
 
-	nvmeq->cq_vector = qid - 1;
+	/*
+	 * Poll queues sit after the interrupt driven ones and have no vector
+	 * of their own; cq_vector only marks them live.
+	 */
+	nvmeq->polled = qid > dev->max_qid - dev->nr_poll_queues;
+	nvmeq->cq_vector = nvmeq->polled ? 0 : qid - 1;
 	result = adapter_alloc_cq(dev, qid, nvmeq);
 	if (result < 0)
 		return result;
@@ -1233,9 +1263,11 @@ static int nvme_create_queue(struct nvme_queue *nvmeq, int qid)
 	if (result < 0)
 		goto release_cq;
 
-	result = queue_request_irq(nvmeq);
-	if (result < 0)
-		goto release_sq;
+	if (!nvmeq->polled) {
+		result = queue_request_irq(nvmeq);
+		if (result < 0)
+			goto release_sq;
+	}
 
 	nvme_init_queue(nvmeq, qid);
 	return result;
@@ -1425,13 +1457,15 @@ static void nvme_watchdog_timer(unsigned long data)
 
 static int nvme_create_io_queues(struct nvme_dev *dev)
 {
-	unsigned i, max;
+	unsigned i, max, nr_irq_queues = dev->max_qid - dev->nr_poll_queues;
 	int ret = 0;
 
 	for (i = dev->queue_count; i <= dev->max_qid; i++) {
 		/* vector == qid - 1, match nvme_create_queue */
-		if (!nvme_alloc_queue(dev, i, dev->q_depth,
-		     pci_irq_get_node(to_pci_dev(dev->dev), i - 1))) {
+		int node = i > nr_irq_queues ? dev_to_node(dev->dev) :
+			pci_irq_get_node(to_pci_dev(dev->dev), i - 1);
+
+		if (!nvme_alloc_queue(dev, i, dev->q_depth, node)) {
 			ret = -ENOMEM;
 			break;
 		}
@@ -1444,6 +1478,12 @@ static int nvme_create_io_queues(struct nvme_dev *dev)
 			break;
 	}
 
+	/* Only the poll queues that actually came up are handed to blk-mq */
+	if (dev->online_queues - 1 > nr_irq_queues)
+		dev->nr_poll_queues = dev->online_queues - 1 - nr_irq_queues;
+	else
+		dev->nr_poll_queues = 0;
+
 	/*
 	 * Ignore failing Create SQ/CQ commands, we can continue with less
 	 * than the desired aount of queues, and even a controller without
@@ -1523,9 +1563,10 @@ static int nvme_setup_io_queues(struct nvme_dev *dev)
 {
 	struct nvme_queue *adminq = dev->queues[0];
 	struct pci_dev *pdev = to_pci_dev(dev->dev);
-	int result, nr_io_queues, size;
+	int result, nr_io_queues, nr_poll_queues, size;
 
-	nr_io_queues = num_online_cpus();
+	nr_poll_queues = min_t(unsigned int, poll_queues, num_online_cpus());
+	nr_io_queues = num_online_cpus() + nr_poll_queues;
 	result = nvme_set_queue_count(&dev->ctrl, &nr_io_queues);
 	if (result < 0)
 		return result;
@@ -1565,11 +1606,15 @@ static int nvme_setup_io_queues(struct nvme_dev *dev)
 	 * setting up the full range we need.
 	 */
 	pci_free_irq_vectors(pdev);
-	nr_io_queues = pci_alloc_irq_vectors(pdev, 1, nr_io_queues,
+	/* Always keep at least one interrupt driven queue */
+	nr_poll_queues = min(nr_poll_queues, nr_io_queues - 1);
+	nr_io_queues = pci_alloc_irq_vectors(pdev, 1,
+			nr_io_queues - nr_poll_queues,
 			PCI_IRQ_ALL_TYPES | PCI_IRQ_AFFINITY);
 	if (nr_io_queues <= 0)
 		return -EIO;
-	dev->max_qid = nr_io_queues;
+	dev->nr_poll_queues = nr_poll_queues;
+	dev->max_qid = nr_io_queues + nr_poll_queues;
 
 	/*
 	 * Should investigate if there's a performance win from allocating
@@ -1676,6 +1721,7 @@ static int nvme_dev_add(struct nvme_dev *dev)
 	if (!dev->ctrl.tagset) {
 		dev->tagset.ops = &nvme_mq_ops;
 		dev->tagset.nr_hw_queues = dev->online_queues - 1;
+		dev->tagset.nr_poll_queues = dev->nr_poll_queues;
 		dev->tagset.timeout = NVME_IO_TIMEOUT;
 		dev->tagset.numa_node = dev_to_node(dev->dev);
 		dev->tagset.queue_depth =
@@ -1690,6 +1736,7 @@ static int nvme_dev_add(struct nvme_dev *dev)
 
 		nvme_dbbuf_set(dev);
 	} else {
+		dev->tagset.nr_poll_queues = dev->nr_poll_queues;
 		blk_mq_update_nr_hw_queues(&dev->tagset, dev->online_queues - 1);
 
 		/* Free previously allocated queues that are no longer usable */
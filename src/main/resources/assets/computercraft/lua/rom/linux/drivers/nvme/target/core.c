@@ -283,10 +283,24 @@ int nvmet_ns_enable(struct nvmet_ns *ns)
 	ns->size = i_size_read(ns->bdev->bd_inode);
 	ns->blksize_shift = blksize_bits(bdev_logical_block_size(ns->bdev));
 
+	if (ns->poll && !test_bit(QUEUE_FLAG_POLL,
+			&bdev_get_queue(ns->bdev)->queue_flags)) {
+		pr_err("block device %s does not support polling\n",
+		       ns->device_path);
+		ret = -EINVAL;
+		goto out_blkdev_put;
+	}
+
+	if (ns->passthru) {
+		ret = nvmet_passthru_ns_enable(ns);
+		if (ret)
+			goto out_blkdev_put;
+	}
+
 	ret = percpu_ref_init(&ns->ref, nvmet_destroy_namespace,
 				0, GFP_KERNEL);
 	if (ret)
-		goto out_blkdev_put;
+		goto out_passthru_disable;
 
 	if (ns->nsid > subsys->max_nsid)
 		subsys->max_nsid = ns->nsid;
@@ -317,6 +331,9 @@ int nvmet_ns_enable(struct nvmet_ns *ns)
 out_unlock:
 	mutex_unlock(&subsys->lock);
 	return ret;
+out_passthru_disable:
+	if (ns->passthru)
+		nvmet_passthru_ns_disable(ns);
 out_blkdev_put:
 	blkdev_put(ns->bdev, FMODE_WRITE|FMODE_READ);
 	ns->bdev = NULL;
@@ -353,6 +370,8 @@ void nvmet_ns_disable(struct nvmet_ns *ns)
 	list_for_each_entry(ctrl, &subsys->ctrls, subsys_entry)
 		nvmet_add_async_event(ctrl, NVME_AER_TYPE_NOTICE, 0, 0);
 
+	if (ns->passthru)
+		nvmet_passthru_ns_disable(ns);
 	if (ns->bdev)
 		blkdev_put(ns->bdev, FMODE_WRITE|FMODE_READ);
 out_unlock:
@@ -486,6 +505,7 @@ bool nvmet_req_init(struct nvmet_req *req, struct nvmet_cq *cq,
 	req->ops = ops;
 	req->sg = NULL;
 	req->sg_cnt = 0;
+	req->poll_queue = NULL;
 	req->rsp->status = 0;
 
 	/* no support for fused commands yet */
@@ -982,10 +1002,14 @@ static int __init nvmet_init(void)
 {
 	int error;
 
-	error = nvmet_init_discovery();
+	error = nvmet_poll_init();
 	if (error)
 		goto out;
 
+	error = nvmet_init_discovery();
+	if (error)
+		goto out_exit_poll;
+
 	error = nvmet_init_configfs();
 	if (error)
 		goto out_exit_discovery;
@@ -993,6 +1017,8 @@ static int __init nvmet_init(void)
 
 out_exit_discovery:
 	nvmet_exit_discovery();
+out_exit_poll:
+	nvmet_poll_exit();
 out:
 	return error;
 }
@@ -1001,6 +1027,7 @@ static void __exit nvmet_exit(void)
 {
 	nvmet_exit_configfs();
 	nvmet_exit_discovery();
+	nvmet_poll_exit();
 	ida_destroy(&cntlid_ida);
 
 	BUILD_BUG_ON(sizeof(struct nvmf_disc_rsp_page_entry) != 1024);
@@ -16,12 +16,143 @@
 #include <linux/module.h>
 #include "nvmet.h"
 
+/*
+ * Bios for namespaces with polling enabled are submitted with REQ_HIPRI and
+ * the request is put on a per-cpu list.  A work item on that cpu spins in
+ * blk_mq_poll() until the list is empty, so completions are reaped without
+ * waiting for an interrupt, or without one at all on a poll queue.
+ *
+ * A polled request holds two references: one for the submitter, which
+ * still has to record the cookie after submit_bio() returns, and one for the
+ * bio completion.  Whoever drops the last one completes the request.
+ */
+struct nvmet_poll_queue {
+	spinlock_t		lock;
+	struct list_head	list;
+	struct work_struct	work;
+	int			cpu;
+};
+
+static DEFINE_PER_CPU(struct nvmet_poll_queue, nvmet_poll_queues);
+static struct workqueue_struct *nvmet_poll_wq;
+
+static void nvmet_poll_work(struct work_struct *work)
+{
+	struct nvmet_poll_queue *pq =
+		container_of(work, struct nvmet_poll_queue, work);
+	struct request_queue *q;
+	struct nvmet_req *req;
+	blk_qc_t cookie;
+
+	for (;;) {
+		spin_lock_irq(&pq->lock);
+		req = list_first_entry_or_null(&pq->list, struct nvmet_req,
+				poll_entry);
+		if (!req) {
+			spin_unlock_irq(&pq->lock);
+			break;
+		}
+		/* rotate so that every outstanding request gets polled */
+		list_move_tail(&req->poll_entry, &pq->list);
+		q = bdev_get_queue(req->ns->bdev);
+		cookie = req->poll_cookie;
+		if (!blk_get_queue(q))
+			q = NULL;
+		spin_unlock_irq(&pq->lock);
+
+		if (q) {
+			if (blk_qc_t_valid(cookie)) {
+				set_current_state(TASK_UNINTERRUPTIBLE);
+				blk_mq_poll(q, cookie);
+				__set_current_state(TASK_RUNNING);
+			}
+			blk_put_queue(q);
+		}
+		cond_resched();
+	}
+}
+
+static void nvmet_poll_add(struct nvmet_req *req)
+{
+	struct nvmet_poll_queue *pq;
+	unsigned long flags;
+
+	pq = per_cpu_ptr(&nvmet_poll_queues, raw_smp_processor_id());
+	req->poll_queue = pq;
+	req->poll_cookie = BLK_QC_T_NONE;
+	atomic_set(&req->poll_ref, 2);
+
+	spin_lock_irqsave(&pq->lock, flags);
+	list_add_tail(&req->poll_entry, &pq->list);
+	spin_unlock_irqrestore(&pq->lock, flags);
+}
+
+static void nvmet_poll_start(struct nvmet_req *req, blk_qc_t cookie)
+{
+	struct nvmet_poll_queue *pq = req->poll_queue;
+	unsigned long flags;
+	bool queued;
+
+	spin_lock_irqsave(&pq->lock, flags);
+	queued = !list_empty(&req->poll_entry);
+	if (queued)
+		req->poll_cookie = cookie;
+	spin_unlock_irqrestore(&pq->lock, flags);
+
+	if (queued)
+		queue_work_on(pq->cpu, nvmet_poll_wq, &pq->work);
+	if (atomic_dec_and_test(&req->poll_ref))
+		nvmet_req_complete(req, req->poll_status);
+}
+
+static void nvmet_poll_done(struct nvmet_req *req, u16 status)
+{
+	struct nvmet_poll_queue *pq = req->poll_queue;
+	unsigned long flags;
+
+	spin_lock_irqsave(&pq->lock, flags);
+	list_del_init(&req->poll_entry);
+	spin_unlock_irqrestore(&pq->lock, flags);
+
+	req->poll_status = status;
+	if (atomic_dec_and_test(&req->poll_ref))
+		nvmet_req_complete(req, status);
+}
+
+int nvmet_poll_init(void)
+{
+	int cpu;
+
+	nvmet_poll_wq = alloc_workqueue("nvmet-poll",
+			WQ_HIGHPRI | WQ_CPU_INTENSIVE | WQ_MEM_RECLAIM, 0);
+	if (!nvmet_poll_wq)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		struct nvmet_poll_queue *pq = per_cpu_ptr(&nvmet_poll_queues, cpu);
+
+		spin_lock_init(&pq->lock);
+		INIT_LIST_HEAD(&pq->list);
+		INIT_WORK(&pq->work, nvmet_poll_work);
+		pq->cpu = cpu;
+	}
+	return 0;
+}
+
+void nvmet_poll_exit(void)
+{
+	destroy_workqueue(nvmet_poll_wq);
+}
+
 static void nvmet_bio_done(struct bio *bio)
 {
 	struct nvmet_req *req = bio->bi_private;
+	u16 status = bio->bi_error ? NVME_SC_INTERNAL | NVME_SC_DNR : 0;
 
-	nvmet_req_complete(req,
-		bio->bi_error ? NVME_SC_INTERNAL | NVME_SC_DNR : 0);
+	if (req->poll_queue)
+		nvmet_poll_done(req, status);
+	else
+		nvmet_req_complete(req, status);
 
 	if (bio != &req->inline_bio)
 		bio_put(bio);
@@ -48,6 +179,7 @@ static void nvmet_execute_rw(struct nvmet_req *req)
 	sector_t sector;
 	blk_qc_t cookie;
 	int op, op_flags = 0, i;
+	bool poll = req->ns->poll;
 
 	if (!req->sg_cnt) {
 		nvmet_req_complete(req, 0);
@@ -63,6 +195,11 @@ static void nvmet_execute_rw(struct nvmet_req *req)
 		op = REQ_OP_READ;
 	}
 
+	if (poll) {
+		op_flags |= REQ_HIPRI;
+		nvmet_poll_add(req);
+	}
+
 	sector = le64_to_cpu(req->cmd->rw.slba);
 	sector <<= (req->ns->blksize_shift - 9);
 
@@ -94,7 +231,8 @@ static void nvmet_execute_rw(struct nvmet_req *req)
 
 	cookie = submit_bio(bio);
 
-	blk_mq_poll(bdev_get_queue(req->ns->bdev), cookie);
+	if (poll)
+		nvmet_poll_start(req, cookie);
 }
 
 static void nvmet_execute_flush(struct nvmet_req *req)
@@ -211,6 +349,9 @@ u16 nvmet_parse_io_cmd(struct nvmet_req *req)
 	if (unlikely(!req->ns))
 		return NVME_SC_INVALID_NS | NVME_SC_DNR;
 
+	if (req->ns->passthru)
+		return nvmet_parse_passthru_cmd(req);
+
 	switch (cmd->common.opcode) {
 	case nvme_cmd_read:
 	case nvme_cmd_write:
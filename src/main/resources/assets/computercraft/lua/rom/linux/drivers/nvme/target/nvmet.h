@@ -50,6 +50,9 @@ struct nvmet_ns {
 	bool			enabled;
 	struct nvmet_subsys	*subsys;
 	const char		*device_path;
+	bool			poll;
+	bool			passthru;
+	struct nvme_ns		*passthru_ns;
 
 	struct config_group	device_group;
 	struct config_group	group;
@@ -221,6 +224,12 @@ struct nvmet_req {
 	int			sg_cnt;
 	size_t			data_len;
 
+	struct list_head	poll_entry;
+	struct nvmet_poll_queue	*poll_queue;
+	blk_qc_t		poll_cookie;
+	atomic_t		poll_ref;
+	u16			poll_status;
+
 	struct nvmet_port	*port;
 
 	void (*execute)(struct nvmet_req *req);
@@ -255,6 +264,8 @@ struct nvmet_async_event {
 
 u16 nvmet_parse_connect_cmd(struct nvmet_req *req);
 u16 nvmet_parse_io_cmd(struct nvmet_req *req);
+int nvmet_poll_init(void);
+void nvmet_poll_exit(void);
 u16 nvmet_parse_admin_cmd(struct nvmet_req *req);
 u16 nvmet_parse_discovery_cmd(struct nvmet_req *req);
 u16 nvmet_parse_fabrics_cmd(struct nvmet_req *req);
@@ -292,6 +303,24 @@ void nvmet_ns_disable(struct nvmet_ns *ns);
 struct nvmet_ns *nvmet_ns_alloc(struct nvmet_subsys *subsys, u32 nsid);
 void nvmet_ns_free(struct nvmet_ns *ns);
 
+#ifdef CONFIG_NVME_TARGET_PASSTHRU
+int nvmet_passthru_ns_enable(struct nvmet_ns *ns);
+void nvmet_passthru_ns_disable(struct nvmet_ns *ns);
+u16 nvmet_parse_passthru_cmd(struct nvmet_req *req);
+#else
+static inline int nvmet_passthru_ns_enable(struct nvmet_ns *ns)
+{
+	return -EOPNOTSUPP;
+}
+static inline void nvmet_passthru_ns_disable(struct nvmet_ns *ns)
+{
+}
+static inline u16 nvmet_parse_passthru_cmd(struct nvmet_req *req)
+{
+	return NVME_SC_INVALID_OPCODE | NVME_SC_DNR;
+}
+#endif
+
 int nvmet_register_transport(struct nvmet_fabrics_ops *ops);
 void nvmet_unregister_transport(struct nvmet_fabrics_ops *ops);
 
@@ -0,0 +1,126 @@
+/*
+ * NVMe I/O command passthrough to a local NVMe namespace.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+#include <linux/blkdev.h>
+#include <linux/module.h>
+#include "../host/nvme.h"
+#include "nvmet.h"
+
+int nvmet_passthru_ns_enable(struct nvmet_ns *ns)
+{
+	if (ns->bdev != ns->bdev->bd_contains) {
+		pr_err("passthru needs a whole namespace, %s is a partition\n",
+		       ns->device_path);
+		return -EINVAL;
+	}
+
+	ns->passthru_ns = nvme_get_ns_from_bdev(ns->bdev);
+	if (!ns->passthru_ns) {
+		pr_err("%s is not an nvme namespace\n", ns->device_path);
+		return -EINVAL;
+	}
+	return 0;
+}
+
+void nvmet_passthru_ns_disable(struct nvmet_ns *ns)
+{
+	nvme_put_ns_from_bdev(ns->passthru_ns);
+	ns->passthru_ns = NULL;
+}
+
+static void nvmet_passthru_req_done(struct request *rq, int error)
+{
+	struct nvmet_req *req = rq->end_io_data;
+	u16 status = nvme_req(rq)->status;
+
+	if (!status && error)
+		status = NVME_SC_INTERNAL | NVME_SC_DNR;
+	req->rsp->result = nvme_req(rq)->result;
+
+	blk_mq_free_request(rq);
+	nvmet_req_complete(req, status);
+}
+
+static void nvmet_passthru_bio_done(struct bio *bio)
+{
+	bio_put(bio);
+}
+
+static int nvmet_passthru_map_sg(struct nvmet_req *req, struct request *rq)
+{
+	struct scatterlist *sg;
+	struct bio *bio;
+	int i, ret;
+
+	bio = bio_kmalloc(GFP_KERNEL, req->sg_cnt);
+	if (!bio)
+		return -ENOMEM;
+	bio->bi_opf = req_op(rq);
+	bio->bi_end_io = nvmet_passthru_bio_done;
+
+	for_each_sg(req->sg, sg, req->sg_cnt, i) {
+		if (bio_add_pc_page(rq->q, bio, sg_page(sg), sg->length,
+				sg->offset) < sg->length) {
+			ret = -EINVAL;
+			goto out_put_bio;
+		}
+	}
+
+	ret = blk_rq_append_bio(rq, bio);
+	if (ret)
+		goto out_put_bio;
+	return 0;
+
+out_put_bio:
+	bio_put(bio);
+	return ret;
+}
+
+static void nvmet_passthru_execute_cmd(struct nvmet_req *req)
+{
+	struct nvme_ns *ns = req->ns->passthru_ns;
+	struct nvme_command *cmd = req->cmd;
+	struct request *rq;
+
+	/*
+	 * The local controller knows the namespace by its own id, and the
+	 * driver fills in its own data pointer.
+	 */
+	cmd->common.nsid = cpu_to_le32(ns->ns_id);
+	cmd->common.flags &= ~NVME_CMD_SGL_ALL;
+	cmd->common.metadata = 0;
+	memset(&cmd->common.dptr, 0, sizeof(cmd->common.dptr));
+
+	rq = nvme_alloc_request(ns->queue, cmd, 0, NVME_QID_ANY);
+	if (IS_ERR(rq))
+		goto out_err;
+
+	if (req->sg_cnt && nvmet_passthru_map_sg(req, rq)) {
+		blk_mq_free_request(rq);
+		goto out_err;
+	}
+
+	rq->end_io_data = req;
+	blk_execute_rq_nowait(rq->q, ns->disk, rq, 0, nvmet_passthru_req_done);
+	return;
+
+out_err:
+	nvmet_req_complete(req, NVME_SC_INTERNAL | NVME_SC_DNR);
+}
+
+u16 nvmet_parse_passthru_cmd(struct nvmet_req *req)
+{
+	req->execute = nvmet_passthru_execute_cmd;
+	req->data_len = le32_to_cpu(req->cmd->common.dptr.sgl.length);
+	return 0;
+}
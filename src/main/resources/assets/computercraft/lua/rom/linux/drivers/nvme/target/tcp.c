@@ -0,0 +1,1714 @@
+/*
+ * NVMe over Fabrics TCP target.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/slab.h>
+#include <linux/err.h>
+#include <linux/highmem.h>
+#include <linux/crc32c.h>
+#include <linux/inet.h>
+#include <linux/llist.h>
+#include <linux/nvme-tcp.h>
+#include <net/sock.h>
+#include <net/tcp.h>
+
+#include "nvmet.h"
+
+/*
+ * We allow up to a page of inline data to go with the SQE on I/O queues,
+ * the admin queue always takes NVME_TCP_ADMIN_CCSZ.
+ */
+#define NVMET_TCP_INLINE_DATA_SIZE	PAGE_SIZE
+
+/* largest h2c data pdu we accept, a single r2t may be split up by it */
+#define NVMET_TCP_MAXH2CDATA		0x400000
+
+enum nvmet_tcp_send_state {
+	NVMET_TCP_SEND_DATA_PDU = 0,
+	NVMET_TCP_SEND_DATA,
+	NVMET_TCP_SEND_R2T,
+	NVMET_TCP_SEND_DDGST,
+	NVMET_TCP_SEND_RESPONSE
+};
+
+enum nvmet_tcp_recv_state {
+	NVMET_TCP_RECV_PDU,
+	NVMET_TCP_RECV_DATA,
+	NVMET_TCP_RECV_DDGST,
+	NVMET_TCP_RECV_ERR,
+};
+
+enum {
+	NVMET_TCP_F_INIT_FAILED = (1 << 0),
+};
+
+struct nvmet_tcp_cmd {
+	struct nvmet_tcp_queue		*queue;
+	struct nvmet_req		req;
+
+	struct nvme_tcp_cmd_pdu		*cmd_pdu;
+	struct nvme_tcp_rsp_pdu		*rsp_pdu;
+	struct nvme_tcp_data_pdu	*data_pdu;
+	struct nvme_tcp_r2t_pdu		*r2t_pdu;
+
+	u32				data_len;
+	u32				rbytes_done;
+	u32				wbytes_done;
+
+	/* current h2c data pdu, or the in-capsule data */
+	u32				pdu_len;
+	u32				pdu_recv;
+	struct bio_vec			*bvec;
+	struct msghdr			recv_msg;
+	__le32				exp_ddgst;
+	__le32				recv_ddgst;
+	u32				flags;
+
+	struct list_head		entry;
+	struct llist_node		lentry;
+
+	/* send state */
+	u32				offset;
+	struct scatterlist		*cur_sg;
+	enum nvmet_tcp_send_state	state;
+};
+
+enum nvmet_tcp_queue_state {
+	NVMET_TCP_Q_CONNECTING,
+	NVMET_TCP_Q_LIVE,
+	NVMET_TCP_Q_DISCONNECTING,
+};
+
+struct nvmet_tcp_queue {
+	struct socket		*sock;
+	struct nvmet_port	*nport;
+	struct work_struct	io_work;
+	int			cpu;
+	struct nvmet_cq		nvme_cq;
+	struct nvmet_sq		nvme_sq;
+
+	/* only touched from io_work */
+	struct nvmet_tcp_cmd	*cmds;
+	unsigned int		nr_cmds;
+	struct list_head	free_list;
+	struct list_head	resp_send_list;
+	struct nvmet_tcp_cmd	*snd_cmd;
+
+	/* responses queued from any context */
+	struct llist_head	resp_list;
+
+	/* recv state */
+	int			offset;
+	int			left;
+	enum nvmet_tcp_recv_state rcv_state;
+	struct nvmet_tcp_cmd	*cmd;
+	union nvme_tcp_pdu	pdu;
+
+	/* digest state */
+	bool			hdr_digest;
+	bool			data_digest;
+
+	struct page_frag_cache	pf_cache;
+
+	spinlock_t		state_lock;
+	enum nvmet_tcp_queue_state state;
+
+	int			idx;
+	struct list_head	queue_list;
+	struct work_struct	release_work;
+
+	/* used for the connect command until the queue size is known */
+	struct nvmet_tcp_cmd	connect;
+
+	void (*data_ready)(struct sock *);
+	void (*state_change)(struct sock *);
+	void (*write_space)(struct sock *);
+};
+
+struct nvmet_tcp_port {
+	struct socket		*sock;
+	struct work_struct	accept_work;
+	struct nvmet_port	*nport;
+	struct sockaddr_storage addr;
+	int			last_cpu;
+	void (*data_ready)(struct sock *);
+};
+
+static DEFINE_IDA(nvmet_tcp_queue_ida);
+static LIST_HEAD(nvmet_tcp_queue_list);
+static DEFINE_MUTEX(nvmet_tcp_queue_mutex);
+
+static struct workqueue_struct *nvmet_tcp_wq;
+static struct nvmet_fabrics_ops nvmet_tcp_ops;
+static void nvmet_tcp_free_cmd_buffers(struct nvmet_tcp_cmd *cmd);
+
+static inline u16 nvmet_tcp_cmd_tag(struct nvmet_tcp_queue *queue,
+		struct nvmet_tcp_cmd *cmd)
+{
+	if (cmd == &queue->connect)
+		return 0;
+	return cmd - queue->cmds;
+}
+
+static inline bool nvmet_tcp_has_data_in(struct nvmet_tcp_cmd *cmd)
+{
+	return nvme_is_write(cmd->req.cmd) &&
+		cmd->rbytes_done < cmd->data_len;
+}
+
+static inline bool nvmet_tcp_need_data_in(struct nvmet_tcp_cmd *cmd)
+{
+	return nvmet_tcp_has_data_in(cmd) &&
+		!(cmd->flags & NVMET_TCP_F_INIT_FAILED);
+}
+
+static inline bool nvmet_tcp_need_data_out(struct nvmet_tcp_cmd *cmd)
+{
+	return !nvme_is_write(cmd->req.cmd) &&
+		cmd->data_len && !cmd->req.rsp->status;
+}
+
+static inline bool nvmet_tcp_has_inline_data(struct nvmet_tcp_cmd *cmd)
+{
+	return nvme_is_write(cmd->req.cmd) && cmd->pdu_len &&
+		!cmd->rbytes_done;
+}
+
+static inline u8 nvmet_tcp_hdgst_len(struct nvmet_tcp_queue *queue)
+{
+	return queue->hdr_digest ? NVME_TCP_DIGEST_LENGTH : 0;
+}
+
+static inline u8 nvmet_tcp_ddgst_len(struct nvmet_tcp_queue *queue)
+{
+	return queue->data_digest ? NVME_TCP_DIGEST_LENGTH : 0;
+}
+
+static inline size_t nvmet_tcp_inline_data_size(struct nvmet_tcp_queue *queue)
+{
+	return queue->nvme_sq.qid ? NVMET_TCP_INLINE_DATA_SIZE :
+		NVME_TCP_ADMIN_CCSZ;
+}
+
+static inline __le32 nvmet_tcp_digest(u32 crc)
+{
+	return cpu_to_le32(~crc);
+}
+
+static inline void nvmet_tcp_hdgst(void *pdu, size_t len)
+{
+	*(__le32 *)(pdu + len) = nvmet_tcp_digest(crc32c(~0, pdu, len));
+}
+
+static struct nvmet_tcp_cmd *nvmet_tcp_get_cmd(struct nvmet_tcp_queue *queue)
+{
+	struct nvmet_tcp_cmd *cmd;
+
+	cmd = list_first_entry_or_null(&queue->free_list,
+				struct nvmet_tcp_cmd, entry);
+	if (!cmd)
+		return NULL;
+	list_del_init(&cmd->entry);
+
+	return cmd;
+}
+
+static void nvmet_tcp_put_cmd(struct nvmet_tcp_cmd *cmd)
+{
+	nvmet_tcp_free_cmd_buffers(cmd);
+	if (unlikely(cmd == &cmd->queue->connect))
+		return;
+
+	list_add_tail(&cmd->entry, &cmd->queue->free_list);
+}
+
+static void nvmet_tcp_free_sgl(struct scatterlist *sgl, unsigned int nents)
+{
+	struct scatterlist *sg;
+	int count;
+
+	if (!sgl || !nents)
+		return;
+
+	for_each_sg(sgl, sg, nents, count)
+		__free_page(sg_page(sg));
+	kfree(sgl);
+}
+
+static void nvmet_tcp_free_cmd_buffers(struct nvmet_tcp_cmd *cmd)
+{
+	nvmet_tcp_free_sgl(cmd->req.sg, cmd->req.sg_cnt);
+	cmd->req.sg = NULL;
+	cmd->req.sg_cnt = 0;
+	kfree(cmd->bvec);
+	cmd->bvec = NULL;
+	cmd->data_len = 0;
+}
+
+/*
+ * Data is kept in whole pages so that it can be handed to the socket with
+ * sendpage, and is received through a bvec iterator over those same pages.
+ */
+static int nvmet_tcp_alloc_data(struct nvmet_tcp_cmd *cmd, u32 length)
+{
+	struct scatterlist *sg;
+	struct page *page;
+	unsigned int nent;
+	int i = 0;
+
+	nent = DIV_ROUND_UP(length, PAGE_SIZE);
+	sg = kmalloc_array(nent, sizeof(struct scatterlist), GFP_KERNEL);
+	if (!sg)
+		return -ENOMEM;
+
+	cmd->bvec = kmalloc_array(nent, sizeof(*cmd->bvec), GFP_KERNEL);
+	if (!cmd->bvec)
+		goto out_free_sg;
+
+	sg_init_table(sg, nent);
+
+	while (length) {
+		u32 page_len = min_t(u32, length, PAGE_SIZE);
+
+		page = alloc_page(GFP_KERNEL);
+		if (!page)
+			goto out_free_pages;
+
+		sg_set_page(&sg[i], page, page_len, 0);
+		cmd->bvec[i].bv_page = page;
+		cmd->bvec[i].bv_len = page_len;
+		cmd->bvec[i].bv_offset = 0;
+		cmd->data_len += page_len;
+		length -= page_len;
+		i++;
+	}
+	cmd->req.sg = sg;
+	cmd->req.sg_cnt = nent;
+	return 0;
+
+out_free_pages:
+	while (i > 0) {
+		i--;
+		__free_page(sg_page(&sg[i]));
+	}
+	kfree(cmd->bvec);
+	cmd->bvec = NULL;
+	cmd->data_len = 0;
+out_free_sg:
+	kfree(sg);
+	return -ENOMEM;
+}
+
+static u16 nvmet_tcp_map_data(struct nvmet_tcp_cmd *cmd)
+{
+	struct nvme_sgl_desc *sgl = &cmd->req.cmd->common.dptr.sgl;
+	u32 len = le32_to_cpu(sgl->length);
+
+	if (!len)
+		return 0;
+
+	if (sgl->type == ((NVME_SGL_FMT_DATA_DESC << 4) |
+			  NVME_SGL_FMT_OFFSET)) {
+		if (!nvme_is_write(cmd->req.cmd))
+			return NVME_SC_INVALID_FIELD | NVME_SC_DNR;
+
+		if (len > nvmet_tcp_inline_data_size(cmd->queue) ||
+		    len != cmd->pdu_len) {
+			pr_err("invalid inline data length %u\n", len);
+			return NVME_SC_SGL_INVALID_OFFSET | NVME_SC_DNR;
+		}
+	} else if (sgl->type != ((NVME_TRANSPORT_SGL_DATA_DESC << 4) |
+				  NVME_SGL_FMT_TRANSPORT_A)) {
+		pr_err("invalid SGL type: %#x\n", sgl->type);
+		return NVME_SC_SGL_INVALID_TYPE | NVME_SC_DNR;
+	} else if (cmd->pdu_len) {
+		pr_err("in-capsule data with a transport SGL\n");
+		return NVME_SC_SGL_INVALID_DATA | NVME_SC_DNR;
+	}
+
+	if (nvmet_tcp_alloc_data(cmd, len))
+		return NVME_SC_INTERNAL;
+
+	return 0;
+}
+
+static void nvmet_tcp_build_iter(struct nvmet_tcp_cmd *cmd, u32 off, u32 len)
+{
+	struct iov_iter *iter = &cmd->recv_msg.msg_iter;
+
+	iov_iter_bvec(iter, ITER_BVEC | READ, cmd->bvec, cmd->req.sg_cnt,
+			cmd->data_len);
+	iov_iter_advance(iter, off);
+	iov_iter_truncate(iter, len);
+	cmd->recv_msg.msg_flags = MSG_DONTWAIT | MSG_NOSIGNAL;
+}
+
+static __le32 nvmet_tcp_sg_ddgst(struct nvmet_tcp_cmd *cmd, u32 off, u32 len)
+{
+	struct scatterlist *sg = cmd->req.sg;
+	u32 crc = ~0;
+
+	/* skip to the page holding @off, every but the last page is full */
+	sg += off / PAGE_SIZE;
+	off %= PAGE_SIZE;
+
+	while (len) {
+		u32 seg = min_t(u32, len, sg->length - off);
+		u8 *vaddr = kmap_atomic(sg_page(sg));
+
+		crc = crc32c(crc, vaddr + sg->offset + off, seg);
+		kunmap_atomic(vaddr);
+		len -= seg;
+		off = 0;
+		sg = sg_next(sg);
+	}
+
+	return nvmet_tcp_digest(crc);
+}
+
+static void nvmet_tcp_setup_c2h_data_pdu(struct nvmet_tcp_cmd *cmd)
+{
+	struct nvme_tcp_data_pdu *pdu = cmd->data_pdu;
+	struct nvmet_tcp_queue *queue = cmd->queue;
+	u8 hdgst = nvmet_tcp_hdgst_len(cmd->queue);
+	u8 ddgst = nvmet_tcp_ddgst_len(cmd->queue);
+
+	cmd->offset = 0;
+	cmd->wbytes_done = 0;
+	cmd->cur_sg = cmd->req.sg;
+	cmd->state = NVMET_TCP_SEND_DATA_PDU;
+
+	pdu->hdr.type = nvme_tcp_c2h_data;
+	pdu->hdr.flags = NVME_TCP_F_DATA_LAST;
+	if (queue->hdr_digest)
+		pdu->hdr.flags |= NVME_TCP_F_HDGST;
+	if (queue->data_digest)
+		pdu->hdr.flags |= NVME_TCP_F_DDGST;
+	pdu->hdr.hlen = sizeof(*pdu);
+	pdu->hdr.pdo = pdu->hdr.hlen + hdgst;
+	pdu->hdr.plen =
+		cpu_to_le32(pdu->hdr.hlen + hdgst + cmd->data_len + ddgst);
+	pdu->command_id = cmd->req.rsp->command_id;
+	pdu->ttag = 0;
+	pdu->data_length = cpu_to_le32(cmd->data_len);
+	pdu->data_offset = 0;
+	memset(pdu->rsvd, 0, sizeof(pdu->rsvd));
+
+	if (queue->hdr_digest)
+		nvmet_tcp_hdgst(pdu, sizeof(*pdu));
+}
+
+static void nvmet_tcp_setup_r2t_pdu(struct nvmet_tcp_cmd *cmd)
+{
+	struct nvme_tcp_r2t_pdu *pdu = cmd->r2t_pdu;
+	struct nvmet_tcp_queue *queue = cmd->queue;
+	u8 hdgst = nvmet_tcp_hdgst_len(cmd->queue);
+
+	cmd->offset = 0;
+	cmd->state = NVMET_TCP_SEND_R2T;
+
+	pdu->hdr.type = nvme_tcp_r2t;
+	pdu->hdr.flags = 0;
+	if (queue->hdr_digest)
+		pdu->hdr.flags |= NVME_TCP_F_HDGST;
+	pdu->hdr.hlen = sizeof(*pdu);
+	pdu->hdr.pdo = 0;
+	pdu->hdr.plen = cpu_to_le32(pdu->hdr.hlen + hdgst);
+
+	pdu->command_id = cmd->req.cmd->common.command_id;
+	pdu->ttag = nvmet_tcp_cmd_tag(cmd->queue, cmd);
+	pdu->r2t_length = cpu_to_le32(cmd->data_len - cmd->rbytes_done);
+	pdu->r2t_offset = cpu_to_le32(cmd->rbytes_done);
+	memset(pdu->rsvd, 0, sizeof(pdu->rsvd));
+
+	if (queue->hdr_digest)
+		nvmet_tcp_hdgst(pdu, sizeof(*pdu));
+}
+
+static void nvmet_tcp_setup_response_pdu(struct nvmet_tcp_cmd *cmd)
+{
+	struct nvme_tcp_rsp_pdu *pdu = cmd->rsp_pdu;
+	struct nvmet_tcp_queue *queue = cmd->queue;
+	u8 hdgst = nvmet_tcp_hdgst_len(cmd->queue);
+
+	cmd->offset = 0;
+	cmd->state = NVMET_TCP_SEND_RESPONSE;
+
+	pdu->hdr.type = nvme_tcp_rsp;
+	pdu->hdr.flags = 0;
+	if (queue->hdr_digest)
+		pdu->hdr.flags |= NVME_TCP_F_HDGST;
+	pdu->hdr.hlen = sizeof(*pdu);
+	pdu->hdr.pdo = 0;
+	pdu->hdr.plen = cpu_to_le32(pdu->hdr.hlen + hdgst);
+
+	if (queue->hdr_digest)
+		nvmet_tcp_hdgst(pdu, sizeof(*pdu));
+}
+
+static void nvmet_tcp_queue_send(struct nvmet_tcp_cmd *cmd)
+{
+	struct nvmet_tcp_queue *queue = cmd->queue;
+
+	llist_add(&cmd->lentry, &queue->resp_list);
+	queue_work_on(queue->cpu, nvmet_tcp_wq, &queue->io_work);
+}
+
+static void nvmet_tcp_process_resp_list(struct nvmet_tcp_queue *queue)
+{
+	struct llist_node *node;
+	struct nvmet_tcp_cmd *cmd;
+
+	node = llist_reverse_order(llist_del_all(&queue->resp_list));
+	while (node) {
+		cmd = llist_entry(node, struct nvmet_tcp_cmd, lentry);
+		node = node->next;
+		list_add_tail(&cmd->entry, &queue->resp_send_list);
+	}
+}
+
+static struct nvmet_tcp_cmd *nvmet_tcp_fetch_cmd(struct nvmet_tcp_queue *queue)
+{
+	queue->snd_cmd = list_first_entry_or_null(&queue->resp_send_list,
+				struct nvmet_tcp_cmd, entry);
+	if (!queue->snd_cmd) {
+		nvmet_tcp_process_resp_list(queue);
+		queue->snd_cmd =
+			list_first_entry_or_null(&queue->resp_send_list,
+					struct nvmet_tcp_cmd, entry);
+		if (unlikely(!queue->snd_cmd))
+			return NULL;
+	}
+
+	list_del_init(&queue->snd_cmd->entry);
+	return queue->snd_cmd;
+}
+
+static void nvmet_tcp_queue_response(struct nvmet_req *req)
+{
+	struct nvmet_tcp_cmd *cmd =
+		container_of(req, struct nvmet_tcp_cmd, req);
+
+	/*
+	 * A command that failed before its in-capsule data was read gets its
+	 * response once the data has been drained from the socket.
+	 */
+	if (unlikely((cmd->flags & NVMET_TCP_F_INIT_FAILED) &&
+		     cmd->pdu_recv < cmd->pdu_len))
+		return;
+
+	if (nvmet_tcp_need_data_out(cmd))
+		nvmet_tcp_setup_c2h_data_pdu(cmd);
+	else
+		nvmet_tcp_setup_response_pdu(cmd);
+
+	nvmet_tcp_queue_send(cmd);
+}
+
+static int nvmet_tcp_send_pdu(struct nvmet_tcp_cmd *cmd, void *pdu,
+		size_t len, int flags)
+{
+	int ret;
+
+	ret = kernel_sendpage(cmd->queue->sock, virt_to_page(pdu),
+			offset_in_page(pdu) + cmd->offset,
+			len - cmd->offset, flags);
+	if (ret <= 0)
+		return ret ? ret : -EAGAIN;
+
+	cmd->offset += ret;
+	if (cmd->offset < len)
+		return -EAGAIN;
+
+	cmd->offset = 0;
+	return 1;
+}
+
+static int nvmet_tcp_try_send_data_pdu(struct nvmet_tcp_cmd *cmd)
+{
+	u8 hdgst = nvmet_tcp_hdgst_len(cmd->queue);
+	int ret;
+
+	ret = nvmet_tcp_send_pdu(cmd, cmd->data_pdu,
+			sizeof(*cmd->data_pdu) + hdgst,
+			MSG_DONTWAIT | MSG_MORE);
+	if (ret <= 0)
+		return ret;
+
+	cmd->state = NVMET_TCP_SEND_DATA;
+	return 1;
+}
+
+static int nvmet_tcp_try_send_data(struct nvmet_tcp_cmd *cmd)
+{
+	struct nvmet_tcp_queue *queue = cmd->queue;
+	int ret;
+
+	while (cmd->cur_sg) {
+		struct page *page = sg_page(cmd->cur_sg);
+		u32 left = cmd->cur_sg->length - cmd->offset;
+
+		/* the response always follows */
+		ret = kernel_sendpage(queue->sock, page,
+				cmd->cur_sg->offset + cmd->offset, left,
+				MSG_DONTWAIT | MSG_MORE);
+		if (ret <= 0)
+			return ret ? ret : -EAGAIN;
+
+		cmd->offset += ret;
+		cmd->wbytes_done += ret;
+
+		/* Done with sg?*/
+		if (cmd->offset == cmd->cur_sg->length) {
+			cmd->cur_sg = sg_next(cmd->cur_sg);
+			cmd->offset = 0;
+		}
+	}
+
+	if (queue->data_digest) {
+		cmd->exp_ddgst = nvmet_tcp_sg_ddgst(cmd, 0, cmd->data_len);
+		cmd->state = NVMET_TCP_SEND_DDGST;
+		cmd->offset = 0;
+	} else {
+		nvmet_tcp_setup_response_pdu(cmd);
+	}
+
+	return 1;
+}
+
+static int nvmet_tcp_try_send_ddgst(struct nvmet_tcp_cmd *cmd)
+{
+	struct msghdr msg = { .msg_flags = MSG_DONTWAIT | MSG_MORE };
+	struct kvec iov = {
+		.iov_base = (u8 *)&cmd->exp_ddgst + cmd->offset,
+		.iov_len = NVME_TCP_DIGEST_LENGTH - cmd->offset
+	};
+	int ret;
+
+	ret = kernel_sendmsg(cmd->queue->sock, &msg, &iov, 1, iov.iov_len);
+	if (unlikely(ret <= 0))
+		return ret ? ret : -EAGAIN;
+
+	cmd->offset += ret;
+	if (cmd->offset < NVME_TCP_DIGEST_LENGTH)
+		return -EAGAIN;
+
+	nvmet_tcp_setup_response_pdu(cmd);
+	return 1;
+}
+
+static int nvmet_tcp_try_send_r2t(struct nvmet_tcp_cmd *cmd)
+{
+	u8 hdgst = nvmet_tcp_hdgst_len(cmd->queue);
+	int ret;
+
+	ret = nvmet_tcp_send_pdu(cmd, cmd->r2t_pdu,
+			sizeof(*cmd->r2t_pdu) + hdgst,
+			MSG_DONTWAIT | MSG_EOR);
+	if (ret <= 0)
+		return ret;
+
+	/* the command stays around until its data arrives */
+	cmd->queue->snd_cmd = NULL;
+	return 1;
+}
+
+static int nvmet_tcp_try_send_response(struct nvmet_tcp_cmd *cmd)
+{
+	u8 hdgst = nvmet_tcp_hdgst_len(cmd->queue);
+	int ret;
+
+	ret = nvmet_tcp_send_pdu(cmd, cmd->rsp_pdu,
+			sizeof(*cmd->rsp_pdu) + hdgst,
+			MSG_DONTWAIT | MSG_EOR);
+	if (ret <= 0)
+		return ret;
+
+	cmd->queue->snd_cmd = NULL;
+	nvmet_tcp_put_cmd(cmd);
+	return 1;
+}
+
+static int nvmet_tcp_try_send_one(struct nvmet_tcp_queue *queue)
+{
+	struct nvmet_tcp_cmd *cmd = queue->snd_cmd;
+	int ret = 0;
+
+	if (!cmd) {
+		cmd = nvmet_tcp_fetch_cmd(queue);
+		if (unlikely(!cmd))
+			return 0;
+	}
+
+	if (cmd->state == NVMET_TCP_SEND_DATA_PDU) {
+		ret = nvmet_tcp_try_send_data_pdu(cmd);
+		if (ret <= 0)
+			goto done_send;
+	}
+
+	if (cmd->state == NVMET_TCP_SEND_DATA) {
+		ret = nvmet_tcp_try_send_data(cmd);
+		if (ret <= 0)
+			goto done_send;
+	}
+
+	if (cmd->state == NVMET_TCP_SEND_DDGST) {
+		ret = nvmet_tcp_try_send_ddgst(cmd);
+		if (ret <= 0)
+			goto done_send;
+	}
+
+	if (cmd->state == NVMET_TCP_SEND_R2T) {
+		ret = nvmet_tcp_try_send_r2t(cmd);
+		if (ret <= 0)
+			goto done_send;
+	}
+
+	if (cmd->state == NVMET_TCP_SEND_RESPONSE)
+		ret = nvmet_tcp_try_send_response(cmd);
+
+done_send:
+	if (ret < 0) {
+		if (ret == -EAGAIN)
+			return 0;
+		return ret;
+	}
+
+	return 1;
+}
+
+static void nvmet_tcp_prep_recv_ctx(struct nvmet_tcp_queue *queue)
+{
+	queue->offset = 0;
+	queue->left = sizeof(struct nvme_tcp_hdr);
+	queue->cmd = NULL;
+	queue->rcv_state = NVMET_TCP_RECV_PDU;
+}
+
+static void nvmet_tcp_schedule_release_queue(struct nvmet_tcp_queue *queue)
+{
+	spin_lock_bh(&queue->state_lock);
+	if (queue->state != NVMET_TCP_Q_DISCONNECTING) {
+		queue->state = NVMET_TCP_Q_DISCONNECTING;
+		schedule_work(&queue->release_work);
+	}
+	spin_unlock_bh(&queue->state_lock);
+}
+
+static void nvmet_tcp_fatal_error(struct nvmet_tcp_queue *queue)
+{
+	queue->rcv_state = NVMET_TCP_RECV_ERR;
+	if (queue->nvme_sq.ctrl)
+		nvmet_ctrl_fatal_error(queue->nvme_sq.ctrl);
+	else
+		nvmet_tcp_schedule_release_queue(queue);
+}
+
+static void nvmet_tcp_socket_error(struct nvmet_tcp_queue *queue, int status)
+{
+	queue->rcv_state = NVMET_TCP_RECV_ERR;
+	if (status == -EPIPE || status == -ECONNRESET)
+		nvmet_tcp_schedule_release_queue(queue);
+	else
+		nvmet_tcp_fatal_error(queue);
+}
+
+static int nvmet_tcp_handle_icreq(struct nvmet_tcp_queue *queue)
+{
+	struct nvme_tcp_icreq_pdu *icreq = &queue->pdu.icreq;
+	struct nvme_tcp_icresp_pdu *icresp = &queue->pdu.icresp;
+	struct msghdr msg = {};
+	struct kvec iov;
+	int ret;
+
+	if (le32_to_cpu(icreq->hdr.plen) != sizeof(struct nvme_tcp_icreq_pdu)) {
+		pr_err("bad nvme-tcp pdu length (%d)\n",
+			le32_to_cpu(icreq->hdr.plen));
+		return -EPROTO;
+	}
+
+	if (icreq->pfv != cpu_to_le16(NVME_TCP_PFV_1_0)) {
+		pr_err("queue %d: bad pfv %d\n", queue->idx,
+			le16_to_cpu(icreq->pfv));
+		return -EPROTO;
+	}
+
+	if (icreq->hpda != 0) {
+		pr_err("queue %d: unsupported hpda %d\n", queue->idx,
+			icreq->hpda);
+		return -EPROTO;
+	}
+
+	/* a single r2t is outstanding at any time whatever maxr2t says */
+	queue->hdr_digest = !!(icreq->digest & NVME_TCP_HDR_DIGEST_ENABLE);
+	queue->data_digest = !!(icreq->digest & NVME_TCP_DATA_DIGEST_ENABLE);
+
+	/* icresp overlays icreq, nothing of the request is used past here */
+	memset(icresp, 0, sizeof(*icresp));
+	icresp->hdr.type = nvme_tcp_icresp;
+	icresp->hdr.hlen = sizeof(*icresp);
+	icresp->hdr.pdo = 0;
+	icresp->hdr.plen = cpu_to_le32(icresp->hdr.hlen);
+	icresp->pfv = cpu_to_le16(NVME_TCP_PFV_1_0);
+	icresp->maxdata = cpu_to_le32(NVMET_TCP_MAXH2CDATA);
+	icresp->cpda = 0;
+	if (queue->hdr_digest)
+		icresp->digest |= NVME_TCP_HDR_DIGEST_ENABLE;
+	if (queue->data_digest)
+		icresp->digest |= NVME_TCP_DATA_DIGEST_ENABLE;
+
+	iov.iov_base = icresp;
+	iov.iov_len = sizeof(*icresp);
+	ret = kernel_sendmsg(queue->sock, &msg, &iov, 1, iov.iov_len);
+	if (ret < 0)
+		return ret;
+
+	spin_lock_bh(&queue->state_lock);
+	if (queue->state == NVMET_TCP_Q_CONNECTING)
+		queue->state = NVMET_TCP_Q_LIVE;
+	spin_unlock_bh(&queue->state_lock);
+
+	nvmet_tcp_prep_recv_ctx(queue);
+	return 0;
+}
+
+static int nvmet_tcp_alloc_cmds(struct nvmet_tcp_queue *queue);
+
+static struct nvmet_tcp_cmd *nvmet_tcp_next_cmd(struct nvmet_tcp_queue *queue)
+{
+	/*
+	 * The queue size is only known once the connect command went
+	 * through, which is also the only command the host may send before.
+	 */
+	if (unlikely(!queue->nr_cmds)) {
+		if (!queue->nvme_sq.ctrl)
+			return &queue->connect;
+		if (nvmet_tcp_alloc_cmds(queue))
+			return NULL;
+	}
+
+	return nvmet_tcp_get_cmd(queue);
+}
+
+static int nvmet_tcp_handle_req_failure(struct nvmet_tcp_queue *queue,
+		struct nvmet_tcp_cmd *cmd)
+{
+	if (!cmd->pdu_len) {
+		nvmet_tcp_prep_recv_ctx(queue);
+		return 0;
+	}
+
+	/* the in-capsule data still has to be drained from the socket */
+	if (!cmd->req.sg && nvmet_tcp_alloc_data(cmd, cmd->pdu_len)) {
+		pr_err("queue %d: failed to allocate inline data\n",
+			queue->idx);
+		return -ENOMEM;
+	}
+
+	nvmet_tcp_build_iter(cmd, 0, cmd->pdu_len);
+	queue->rcv_state = NVMET_TCP_RECV_DATA;
+	return 0;
+}
+
+static int nvmet_tcp_handle_cmd_pdu(struct nvmet_tcp_queue *queue)
+{
+	struct nvme_tcp_hdr *hdr = &queue->pdu.cmd.hdr;
+	struct nvme_command *nvme_cmd = &queue->pdu.cmd.cmd;
+	u8 hdgst = nvmet_tcp_hdgst_len(queue);
+	struct nvmet_tcp_cmd *cmd;
+	u32 inline_len;
+	u16 status;
+
+	inline_len = le32_to_cpu(hdr->plen) - hdr->hlen - hdgst;
+	if (inline_len && (hdr->flags & NVME_TCP_F_DDGST))
+		inline_len -= NVME_TCP_DIGEST_LENGTH;
+	if (unlikely(inline_len > nvmet_tcp_inline_data_size(queue) ||
+		     (inline_len && hdr->pdo != hdr->hlen + hdgst))) {
+		pr_err("queue %d: bad in-capsule data (len %u pdo %d)\n",
+			queue->idx, inline_len, hdr->pdo);
+		return -EPROTO;
+	}
+
+	cmd = nvmet_tcp_next_cmd(queue);
+	if (unlikely(!cmd)) {
+		pr_err("queue %d: out of commands\n", queue->idx);
+		return -ENOMEM;
+	}
+
+	queue->cmd = cmd;
+	memcpy(cmd->req.cmd, nvme_cmd, sizeof(*nvme_cmd));
+	cmd->rbytes_done = 0;
+	cmd->pdu_len = inline_len;
+	cmd->pdu_recv = 0;
+	cmd->req.port = queue->nport;
+
+	/* cleared again below, see nvmet_tcp_queue_response */
+	cmd->flags = NVMET_TCP_F_INIT_FAILED;
+	if (unlikely(!nvmet_req_init(&cmd->req, &queue->nvme_cq,
+			&queue->nvme_sq, &nvmet_tcp_ops)))
+		return nvmet_tcp_handle_req_failure(queue, cmd);
+
+	status = nvmet_tcp_map_data(cmd);
+	if (unlikely(status)) {
+		nvmet_req_complete(&cmd->req, status);
+		return nvmet_tcp_handle_req_failure(queue, cmd);
+	}
+	cmd->flags = 0;
+
+	if (nvmet_tcp_need_data_in(cmd)) {
+		if (nvmet_tcp_has_inline_data(cmd)) {
+			nvmet_tcp_build_iter(cmd, 0, cmd->pdu_len);
+			queue->rcv_state = NVMET_TCP_RECV_DATA;
+			return 0;
+		}
+		/* send back R2T */
+		nvmet_tcp_setup_r2t_pdu(cmd);
+		nvmet_tcp_queue_send(cmd);
+		nvmet_tcp_prep_recv_ctx(queue);
+		return 0;
+	}
+
+	nvmet_tcp_prep_recv_ctx(queue);
+	cmd->req.execute(&cmd->req);
+	return 0;
+}
+
+static int nvmet_tcp_handle_h2c_data_pdu(struct nvmet_tcp_queue *queue)
+{
+	struct nvme_tcp_data_pdu *data = &queue->pdu.data;
+	struct nvmet_tcp_cmd *cmd;
+	u32 off, len;
+
+	if (unlikely(!queue->nr_cmds))
+		cmd = &queue->connect;
+	else if (likely(data->ttag < queue->nr_cmds))
+		cmd = &queue->cmds[data->ttag];
+	else
+		cmd = NULL;
+
+	off = le32_to_cpu(data->data_offset);
+	len = le32_to_cpu(data->data_length);
+	if (unlikely(!cmd || !nvmet_tcp_need_data_in(cmd) ||
+		     data->command_id != cmd->req.cmd->common.command_id)) {
+		pr_err("queue %d: unexpected h2c data for ttag %d\n",
+			queue->idx, data->ttag);
+		return -EPROTO;
+	}
+
+	if (unlikely(off != cmd->rbytes_done || !len ||
+		     len > NVMET_TCP_MAXH2CDATA ||
+		     off + len > cmd->data_len)) {
+		pr_err("queue %d: bad h2c data offset %u length %u (expected %u)\n",
+			queue->idx, off, len, cmd->rbytes_done);
+		return -EPROTO;
+	}
+
+	cmd->pdu_len = len;
+	cmd->pdu_recv = 0;
+	nvmet_tcp_build_iter(cmd, off, len);
+	queue->cmd = cmd;
+	queue->rcv_state = NVMET_TCP_RECV_DATA;
+
+	return 0;
+}
+
+static int nvmet_tcp_done_recv_pdu(struct nvmet_tcp_queue *queue)
+{
+	struct nvme_tcp_hdr *hdr = &queue->pdu.cmd.hdr;
+
+	if (hdr->type == nvme_tcp_icreq) {
+		if (unlikely(queue->state != NVMET_TCP_Q_CONNECTING)) {
+			pr_err("queue %d: unexpected icreq\n", queue->idx);
+			return -EPROTO;
+		}
+		return nvmet_tcp_handle_icreq(queue);
+	}
+
+	if (unlikely(queue->state != NVMET_TCP_Q_LIVE)) {
+		pr_err("queue %d: pdu type %d before icreq\n",
+			queue->idx, hdr->type);
+		return -EPROTO;
+	}
+
+	switch (hdr->type) {
+	case nvme_tcp_cmd:
+		return nvmet_tcp_handle_cmd_pdu(queue);
+	case nvme_tcp_h2c_data:
+		return nvmet_tcp_handle_h2c_data_pdu(queue);
+	case nvme_tcp_h2c_term:
+		pr_err("queue %d: host terminated the connection (fes %#x)\n",
+			queue->idx,
+			le16_to_cpu(((struct nvme_tcp_term_pdu *)hdr)->fes));
+		return -ECONNRESET;
+	default:
+		return -EPROTO;
+	}
+}
+
+static inline u8 nvmet_tcp_pdu_size(u8 type)
+{
+	switch (type) {
+	case nvme_tcp_icreq:
+		return sizeof(struct nvme_tcp_icreq_pdu);
+	case nvme_tcp_cmd:
+		return sizeof(struct nvme_tcp_cmd_pdu);
+	case nvme_tcp_h2c_data:
+		return sizeof(struct nvme_tcp_data_pdu);
+	case nvme_tcp_h2c_term:
+		return sizeof(struct nvme_tcp_term_pdu);
+	default:
+		return 0;
+	}
+}
+
+static int nvmet_tcp_verify_pdu(struct nvmet_tcp_queue *queue)
+{
+	struct nvme_tcp_hdr *hdr = &queue->pdu.cmd.hdr;
+	u32 data_len;
+
+	if (hdr->type == nvme_tcp_icreq)
+		return 0;
+
+	if (queue->hdr_digest) {
+		__le32 exp_digest;
+
+		exp_digest = nvmet_tcp_digest(crc32c(~0, hdr, hdr->hlen));
+		if (unlikely(!(hdr->flags & NVME_TCP_F_HDGST) ||
+			     *(__le32 *)((void *)hdr + hdr->hlen) !=
+			     exp_digest)) {
+			pr_err("queue %d: header digest error\n", queue->idx);
+			return -EPROTO;
+		}
+	}
+
+	data_len = le32_to_cpu(hdr->plen) - hdr->hlen -
+			nvmet_tcp_hdgst_len(queue);
+	if (unlikely(queue->data_digest && data_len &&
+		     !(hdr->flags & NVME_TCP_F_DDGST))) {
+		pr_err("queue %d: data digest flag is cleared\n", queue->idx);
+		return -EPROTO;
+	}
+
+	return 0;
+}
+
+static int nvmet_tcp_try_recv_pdu(struct nvmet_tcp_queue *queue)
+{
+	struct nvme_tcp_hdr *hdr = &queue->pdu.cmd.hdr;
+	int len, ret;
+	struct kvec iov;
+	struct msghdr msg = { .msg_flags = MSG_DONTWAIT };
+
+recv:
+	iov.iov_base = (void *)&queue->pdu + queue->offset;
+	iov.iov_len = queue->left;
+	len = kernel_recvmsg(queue->sock, &msg, &iov, 1,
+			iov.iov_len, msg.msg_flags);
+	if (unlikely(len < 0))
+		return len;
+	if (unlikely(!len))
+		return -EAGAIN;
+
+	queue->offset += len;
+	queue->left -= len;
+	if (queue->left)
+		return -EAGAIN;
+
+	if (queue->offset == sizeof(struct nvme_tcp_hdr)) {
+		u8 hdgst = nvmet_tcp_hdgst_len(queue);
+		u8 hlen = nvmet_tcp_pdu_size(hdr->type);
+
+		if (unlikely(!hlen || hdr->hlen != hlen)) {
+			pr_err("queue %d: pdu type %d bad hlen %d\n",
+				queue->idx, hdr->type, hdr->hlen);
+			return -EPROTO;
+		}
+
+		/* the header digest is never there for the icreq */
+		if (hdr->type == nvme_tcp_icreq)
+			hdgst = 0;
+
+		queue->left = hdr->hlen - queue->offset + hdgst;
+		goto recv;
+	}
+
+	ret = nvmet_tcp_verify_pdu(queue);
+	if (unlikely(ret))
+		return ret;
+
+	return nvmet_tcp_done_recv_pdu(queue);
+}
+
+static void nvmet_tcp_data_done(struct nvmet_tcp_queue *queue,
+		struct nvmet_tcp_cmd *cmd)
+{
+	nvmet_tcp_prep_recv_ctx(queue);
+
+	if (cmd->flags & NVMET_TCP_F_INIT_FAILED)
+		nvmet_tcp_queue_response(&cmd->req);
+	else if (cmd->rbytes_done == cmd->data_len)
+		cmd->req.execute(&cmd->req);
+}
+
+static int nvmet_tcp_try_recv_data(struct nvmet_tcp_queue *queue)
+{
+	struct nvmet_tcp_cmd *cmd = queue->cmd;
+	int ret;
+
+	while (msg_data_left(&cmd->recv_msg)) {
+		ret = sock_recvmsg(cmd->queue->sock, &cmd->recv_msg,
+			cmd->recv_msg.msg_flags);
+		if (ret <= 0)
+			return ret ? ret : -EAGAIN;
+
+		cmd->pdu_recv += ret;
+		cmd->rbytes_done += ret;
+	}
+
+	if (queue->data_digest) {
+		cmd->exp_ddgst = nvmet_tcp_sg_ddgst(cmd,
+				cmd->rbytes_done - cmd->pdu_len, cmd->pdu_len);
+		queue->offset = 0;
+		queue->left = NVME_TCP_DIGEST_LENGTH;
+		queue->rcv_state = NVMET_TCP_RECV_DDGST;
+		return 0;
+	}
+
+	nvmet_tcp_data_done(queue, cmd);
+	return 0;
+}
+
+static int nvmet_tcp_try_recv_ddgst(struct nvmet_tcp_queue *queue)
+{
+	struct nvmet_tcp_cmd *cmd = queue->cmd;
+	int len;
+	struct kvec iov = {
+		.iov_base = (void *)&cmd->recv_ddgst + queue->offset,
+		.iov_len = queue->left
+	};
+	struct msghdr msg = { .msg_flags = MSG_DONTWAIT };
+
+	len = kernel_recvmsg(queue->sock, &msg, &iov, 1,
+			iov.iov_len, msg.msg_flags);
+	if (unlikely(len < 0))
+		return len;
+	if (unlikely(!len))
+		return -EAGAIN;
+
+	queue->offset += len;
+	queue->left -= len;
+	if (queue->left)
+		return -EAGAIN;
+
+	if (cmd->recv_ddgst != cmd->exp_ddgst) {
+		pr_err("queue %d: cmd %d pdu (%d) data digest error: recv %#x expected %#x\n",
+			queue->idx, cmd->req.cmd->common.command_id,
+			queue->pdu.cmd.hdr.type, le32_to_cpu(cmd->recv_ddgst),
+			le32_to_cpu(cmd->exp_ddgst));
+		return -EPROTO;
+	}
+
+	nvmet_tcp_data_done(queue, cmd);
+	return 0;
+}
+
+static int nvmet_tcp_try_recv_one(struct nvmet_tcp_queue *queue)
+{
+	int result = 0;
+
+	if (unlikely(queue->rcv_state == NVMET_TCP_RECV_ERR))
+		return 0;
+
+	if (queue->rcv_state == NVMET_TCP_RECV_PDU) {
+		result = nvmet_tcp_try_recv_pdu(queue);
+		if (result != 0)
+			goto done_recv;
+	}
+
+	if (queue->rcv_state == NVMET_TCP_RECV_DATA) {
+		result = nvmet_tcp_try_recv_data(queue);
+		if (result != 0)
+			goto done_recv;
+	}
+
+	if (queue->rcv_state == NVMET_TCP_RECV_DDGST) {
+		result = nvmet_tcp_try_recv_ddgst(queue);
+		if (result != 0)
+			goto done_recv;
+	}
+
+done_recv:
+	if (result < 0) {
+		if (result == -EAGAIN)
+			return 0;
+		return result;
+	}
+	return 1;
+}
+
+/*
+ * Receiving and sending for a queue only ever happen here, on the CPU the
+ * queue was assigned when it was accepted.  The work requeues itself after
+ * a jiffy so that busy queues sharing a CPU take turns.
+ */
+static void nvmet_tcp_io_work(struct work_struct *w)
+{
+	struct nvmet_tcp_queue *queue =
+		container_of(w, struct nvmet_tcp_queue, io_work);
+	unsigned long deadline = jiffies + msecs_to_jiffies(1);
+	bool pending;
+	int ret;
+
+	if (unlikely(queue->state == NVMET_TCP_Q_DISCONNECTING))
+		return;
+
+	do {
+		pending = false;
+
+		ret = nvmet_tcp_try_recv_one(queue);
+		if (ret > 0) {
+			pending = true;
+		} else if (ret < 0) {
+			nvmet_tcp_socket_error(queue, ret);
+			return;
+		}
+
+		ret = nvmet_tcp_try_send_one(queue);
+		if (ret > 0) {
+			pending = true;
+		} else if (ret < 0) {
+			nvmet_tcp_socket_error(queue, ret);
+			return;
+		}
+
+		if (!pending)
+			return;
+
+	} while (!time_after(jiffies, deadline));
+
+	queue_work_on(queue->cpu, nvmet_tcp_wq, &queue->io_work);
+}
+
+/*
+ * The pdus always have room for a header digest, whether it is used is only
+ * known once the icreq arrived.
+ */
+static int nvmet_tcp_alloc_cmd(struct nvmet_tcp_queue *queue,
+		struct nvmet_tcp_cmd *c)
+{
+	u8 hdgst = NVME_TCP_DIGEST_LENGTH;
+
+	c->queue = queue;
+	c->req.port = queue->nport;
+
+	c->cmd_pdu = page_frag_alloc(&queue->pf_cache,
+			sizeof(*c->cmd_pdu) + hdgst, GFP_KERNEL);
+	if (!c->cmd_pdu)
+		return -ENOMEM;
+	c->req.cmd = &c->cmd_pdu->cmd;
+
+	c->rsp_pdu = page_frag_alloc(&queue->pf_cache,
+			sizeof(*c->rsp_pdu) + hdgst, GFP_KERNEL);
+	if (!c->rsp_pdu)
+		goto out_free_cmd;
+	c->req.rsp = &c->rsp_pdu->cqe;
+
+	c->data_pdu = page_frag_alloc(&queue->pf_cache,
+			sizeof(*c->data_pdu) + hdgst, GFP_KERNEL);
+	if (!c->data_pdu)
+		goto out_free_rsp;
+
+	c->r2t_pdu = page_frag_alloc(&queue->pf_cache,
+			sizeof(*c->r2t_pdu) + hdgst, GFP_KERNEL);
+	if (!c->r2t_pdu)
+		goto out_free_data;
+
+	return 0;
+out_free_data:
+	page_frag_free(c->data_pdu);
+out_free_rsp:
+	page_frag_free(c->rsp_pdu);
+out_free_cmd:
+	page_frag_free(c->cmd_pdu);
+	return -ENOMEM;
+}
+
+static void nvmet_tcp_free_cmd(struct nvmet_tcp_cmd *c)
+{
+	nvmet_tcp_free_cmd_buffers(c);
+	page_frag_free(c->r2t_pdu);
+	page_frag_free(c->data_pdu);
+	page_frag_free(c->rsp_pdu);
+	page_frag_free(c->cmd_pdu);
+}
+
+static int nvmet_tcp_alloc_cmds(struct nvmet_tcp_queue *queue)
+{
+	struct nvmet_tcp_cmd *cmds;
+	int i, ret = -EINVAL, nr_cmds = queue->nvme_sq.size + 1;
+
+	cmds = kcalloc(nr_cmds, sizeof(struct nvmet_tcp_cmd), GFP_KERNEL);
+	if (!cmds)
+		goto out;
+
+	for (i = 0; i < nr_cmds; i++) {
+		ret = nvmet_tcp_alloc_cmd(queue, cmds + i);
+		if (ret)
+			goto out_free;
+		list_add_tail(&cmds[i].entry, &queue->free_list);
+	}
+
+	queue->cmds = cmds;
+	queue->nr_cmds = nr_cmds;
+
+	return 0;
+out_free:
+	while (--i >= 0)
+		nvmet_tcp_free_cmd(cmds + i);
+	INIT_LIST_HEAD(&queue->free_list);
+	kfree(cmds);
+out:
+	return ret;
+}
+
+static void nvmet_tcp_free_cmds(struct nvmet_tcp_queue *queue)
+{
+	struct nvmet_tcp_cmd *cmds = queue->cmds;
+	int i;
+
+	for (i = 0; i < queue->nr_cmds; i++)
+		nvmet_tcp_free_cmd(cmds + i);
+
+	nvmet_tcp_free_cmd(&queue->connect);
+	kfree(cmds);
+}
+
+/* the pdus hold their own references on the cached pages */
+static void nvmet_tcp_drain_pf_cache(struct nvmet_tcp_queue *queue)
+{
+	struct page *page;
+
+	if (!queue->pf_cache.va)
+		return;
+
+	page = virt_to_head_page(queue->pf_cache.va);
+	__page_frag_cache_drain(page, queue->pf_cache.pagecnt_bias);
+	queue->pf_cache.va = NULL;
+}
+
+static void nvmet_tcp_restore_socket_callbacks(struct nvmet_tcp_queue *queue)
+{
+	struct socket *sock = queue->sock;
+
+	write_lock_bh(&sock->sk->sk_callback_lock);
+	sock->sk->sk_data_ready =  queue->data_ready;
+	sock->sk->sk_state_change = queue->state_change;
+	sock->sk->sk_write_space = queue->write_space;
+	sock->sk->sk_user_data = NULL;
+	write_unlock_bh(&sock->sk->sk_callback_lock);
+}
+
+/*
+ * Commands still waiting for data from the host hold a reference on the
+ * submission queue, fail them so that the queue can be torn down.
+ */
+static void nvmet_tcp_uninit_data_in_cmds(struct nvmet_tcp_queue *queue)
+{
+	struct nvmet_tcp_cmd *cmd = queue->cmds;
+	int i;
+
+	for (i = 0; i < queue->nr_cmds; i++, cmd++) {
+		if (nvmet_tcp_need_data_in(cmd))
+			nvmet_req_complete(&cmd->req,
+					NVME_SC_DATA_XFER_ERROR);
+	}
+
+	if (!queue->nr_cmds && nvmet_tcp_need_data_in(&queue->connect))
+		nvmet_req_complete(&queue->connect.req,
+				NVME_SC_DATA_XFER_ERROR);
+}
+
+static void nvmet_tcp_release_queue_work(struct work_struct *w)
+{
+	struct nvmet_tcp_queue *queue =
+		container_of(w, struct nvmet_tcp_queue, release_work);
+
+	mutex_lock(&nvmet_tcp_queue_mutex);
+	list_del_init(&queue->queue_list);
+	mutex_unlock(&nvmet_tcp_queue_mutex);
+
+	nvmet_tcp_restore_socket_callbacks(queue);
+	kernel_sock_shutdown(queue->sock, SHUT_RDWR);
+	cancel_work_sync(&queue->io_work);
+	/* stop accepting incoming data */
+	queue->rcv_state = NVMET_TCP_RECV_ERR;
+
+	nvmet_tcp_uninit_data_in_cmds(queue);
+	nvmet_sq_destroy(&queue->nvme_sq);
+	cancel_work_sync(&queue->io_work);
+	sock_release(queue->sock);
+	nvmet_tcp_free_cmds(queue);
+	nvmet_tcp_drain_pf_cache(queue);
+
+	ida_simple_remove(&nvmet_tcp_queue_ida, queue->idx);
+	kfree(queue);
+}
+
+static void nvmet_tcp_data_ready(struct sock *sk)
+{
+	struct nvmet_tcp_queue *queue;
+
+	read_lock_bh(&sk->sk_callback_lock);
+	queue = sk->sk_user_data;
+	if (likely(queue))
+		queue_work_on(queue->cpu, nvmet_tcp_wq, &queue->io_work);
+	read_unlock_bh(&sk->sk_callback_lock);
+}
+
+static void nvmet_tcp_write_space(struct sock *sk)
+{
+	struct nvmet_tcp_queue *queue;
+
+	read_lock_bh(&sk->sk_callback_lock);
+	queue = sk->sk_user_data;
+	if (unlikely(!queue))
+		goto out;
+
+	if (sk_stream_is_writeable(sk)) {
+		clear_bit(SOCK_NOSPACE, &sk->sk_socket->flags);
+		queue_work_on(queue->cpu, nvmet_tcp_wq, &queue->io_work);
+	}
+out:
+	read_unlock_bh(&sk->sk_callback_lock);
+}
+
+static void nvmet_tcp_state_change(struct sock *sk)
+{
+	struct nvmet_tcp_queue *queue;
+
+	read_lock_bh(&sk->sk_callback_lock);
+	queue = sk->sk_user_data;
+	if (!queue)
+		goto done;
+
+	switch (sk->sk_state) {
+	case TCP_FIN_WAIT1:
+	case TCP_CLOSE_WAIT:
+	case TCP_CLOSE:
+		nvmet_tcp_schedule_release_queue(queue);
+		break;
+	default:
+		pr_warn("queue %d unhandled state %d\n",
+			queue->idx, sk->sk_state);
+	}
+done:
+	read_unlock_bh(&sk->sk_callback_lock);
+}
+
+static int nvmet_tcp_set_queue_sock(struct nvmet_tcp_queue *queue)
+{
+	struct socket *sock = queue->sock;
+	int ret = 0;
+
+	write_lock_bh(&sock->sk->sk_callback_lock);
+	/* the peer may already have gone before the callbacks are set */
+	if (sock->sk->sk_state != TCP_ESTABLISHED) {
+		ret = -ENOTCONN;
+	} else {
+		sock->sk->sk_user_data = queue;
+		queue->data_ready = sock->sk->sk_data_ready;
+		sock->sk->sk_data_ready = nvmet_tcp_data_ready;
+		queue->state_change = sock->sk->sk_state_change;
+		sock->sk->sk_state_change = nvmet_tcp_state_change;
+		queue->write_space = sock->sk->sk_write_space;
+		sock->sk->sk_write_space = nvmet_tcp_write_space;
+	}
+	write_unlock_bh(&sock->sk->sk_callback_lock);
+
+	return ret;
+}
+
+static int nvmet_tcp_alloc_queue(struct nvmet_tcp_port *port,
+		struct socket *newsock)
+{
+	struct nvmet_tcp_queue *queue;
+	int ret;
+
+	queue = kzalloc(sizeof(*queue), GFP_KERNEL);
+	if (!queue)
+		return -ENOMEM;
+
+	INIT_WORK(&queue->release_work, nvmet_tcp_release_queue_work);
+	INIT_WORK(&queue->io_work, nvmet_tcp_io_work);
+	queue->sock = newsock;
+	queue->nport = port->nport;
+	queue->nr_cmds = 0;
+	spin_lock_init(&queue->state_lock);
+	queue->state = NVMET_TCP_Q_CONNECTING;
+	INIT_LIST_HEAD(&queue->free_list);
+	init_llist_head(&queue->resp_list);
+	INIT_LIST_HEAD(&queue->resp_send_list);
+
+	queue->idx = ida_simple_get(&nvmet_tcp_queue_ida, 0, 0, GFP_KERNEL);
+	if (queue->idx < 0) {
+		ret = queue->idx;
+		goto out_free_queue;
+	}
+
+	ret = nvmet_tcp_alloc_cmd(queue, &queue->connect);
+	if (ret)
+		goto out_ida_remove;
+
+	ret = nvmet_sq_init(&queue->nvme_sq);
+	if (ret)
+		goto out_free_connect;
+
+	port->last_cpu = cpumask_next(port->last_cpu, cpu_online_mask);
+	if (port->last_cpu >= nr_cpu_ids)
+		port->last_cpu = cpumask_first(cpu_online_mask);
+	queue->cpu = port->last_cpu;
+	nvmet_tcp_prep_recv_ctx(queue);
+
+	mutex_lock(&nvmet_tcp_queue_mutex);
+	list_add_tail(&queue->queue_list, &nvmet_tcp_queue_list);
+	mutex_unlock(&nvmet_tcp_queue_mutex);
+
+	ret = nvmet_tcp_set_queue_sock(queue);
+	if (ret)
+		goto out_destroy_sq;
+
+	/* the icreq may have arrived before the callbacks were installed */
+	queue_work_on(queue->cpu, nvmet_tcp_wq, &queue->io_work);
+
+	return 0;
+out_destroy_sq:
+	mutex_lock(&nvmet_tcp_queue_mutex);
+	list_del_init(&queue->queue_list);
+	mutex_unlock(&nvmet_tcp_queue_mutex);
+	nvmet_sq_destroy(&queue->nvme_sq);
+out_free_connect:
+	nvmet_tcp_free_cmd(&queue->connect);
+	nvmet_tcp_drain_pf_cache(queue);
+out_ida_remove:
+	ida_simple_remove(&nvmet_tcp_queue_ida, queue->idx);
+out_free_queue:
+	kfree(queue);
+	return ret;
+}
+
+static void nvmet_tcp_accept_work(struct work_struct *w)
+{
+	struct nvmet_tcp_port *port =
+		container_of(w, struct nvmet_tcp_port, accept_work);
+	struct socket *newsock;
+	int ret;
+
+	while (true) {
+		ret = kernel_accept(port->sock, &newsock, O_NONBLOCK);
+		if (ret < 0) {
+			if (ret != -EAGAIN)
+				pr_warn("failed to accept err=%d\n", ret);
+			return;
+		}
+		ret = nvmet_tcp_alloc_queue(port, newsock);
+		if (ret) {
+			pr_err("failed to allocate queue\n");
+			sock_release(newsock);
+		}
+	}
+}
+
+static void nvmet_tcp_listen_data_ready(struct sock *sk)
+{
+	struct nvmet_tcp_port *port;
+
+	read_lock_bh(&sk->sk_callback_lock);
+	port = sk->sk_user_data;
+	if (!port)
+		goto out;
+
+	if (sk->sk_state == TCP_LISTEN)
+		schedule_work(&port->accept_work);
+out:
+	read_unlock_bh(&sk->sk_callback_lock);
+}
+
+static int nvmet_tcp_add_port(struct nvmet_port *nport)
+{
+	struct nvmet_tcp_port *port;
+	__kernel_sa_family_t af;
+	int opt, ret;
+
+	port = kzalloc(sizeof(*port), GFP_KERNEL);
+	if (!port)
+		return -ENOMEM;
+
+	switch (nport->disc_addr.adrfam) {
+	case NVMF_ADDR_FAMILY_IP4:
+		af = AF_INET;
+		break;
+	case NVMF_ADDR_FAMILY_IP6:
+		af = AF_INET6;
+		break;
+	default:
+		pr_err("address family %d not supported\n",
+				nport->disc_addr.adrfam);
+		ret = -EINVAL;
+		goto err_port;
+	}
+
+	ret = inet_pton_with_scope(&init_net, af, nport->disc_addr.traddr,
+			nport->disc_addr.trsvcid, &port->addr);
+	if (ret) {
+		pr_err("malformed ip/port passed: %s:%s\n",
+			nport->disc_addr.traddr, nport->disc_addr.trsvcid);
+		goto err_port;
+	}
+
+	port->nport = nport;
+	port->last_cpu = -1;
+	INIT_WORK(&port->accept_work, nvmet_tcp_accept_work);
+
+	ret = sock_create_kern(&init_net, port->addr.ss_family,
+				SOCK_STREAM, IPPROTO_TCP, &port->sock);
+	if (ret) {
+		pr_err("failed to create a socket\n");
+		goto err_port;
+	}
+
+	port->sock->sk->sk_user_data = port;
+	port->data_ready = port->sock->sk->sk_data_ready;
+	port->sock->sk->sk_data_ready = nvmet_tcp_listen_data_ready;
+
+	opt = 1;
+	ret = kernel_setsockopt(port->sock, IPPROTO_TCP,
+			TCP_NODELAY, (char *)&opt, sizeof(opt));
+	if (ret) {
+		pr_err("failed to set TCP_NODELAY sock opt %d\n", ret);
+		goto err_sock;
+	}
+
+	ret = kernel_setsockopt(port->sock, SOL_SOCKET, SO_REUSEADDR,
+			(char *)&opt, sizeof(opt));
+	if (ret) {
+		pr_err("failed to set SO_REUSEADDR sock opt %d\n", ret);
+		goto err_sock;
+	}
+
+	ret = kernel_bind(port->sock, (struct sockaddr *)&port->addr,
+			sizeof(port->addr));
+	if (ret) {
+		pr_err("failed to bind port socket %d\n", ret);
+		goto err_sock;
+	}
+
+	ret = kernel_listen(port->sock, 128);
+	if (ret) {
+		pr_err("failed to listen %d on port sock\n", ret);
+		goto err_sock;
+	}
+
+	nport->priv = port;
+	pr_info("enabling port %d (%pISpc)\n",
+		le16_to_cpu(nport->disc_addr.portid), &port->addr);
+
+	return 0;
+
+err_sock:
+	sock_release(port->sock);
+err_port:
+	kfree(port);
+	return ret;
+}
+
+static void nvmet_tcp_remove_port(struct nvmet_port *nport)
+{
+	struct nvmet_tcp_port *port = xchg(&nport->priv, NULL);
+
+	if (!port)
+		return;
+
+	write_lock_bh(&port->sock->sk->sk_callback_lock);
+	port->sock->sk->sk_data_ready = port->data_ready;
+	port->sock->sk->sk_user_data = NULL;
+	write_unlock_bh(&port->sock->sk->sk_callback_lock);
+	cancel_work_sync(&port->accept_work);
+
+	sock_release(port->sock);
+	kfree(port);
+}
+
+static void nvmet_tcp_delete_ctrl(struct nvmet_ctrl *ctrl)
+{
+	struct nvmet_tcp_queue *queue;
+
+	mutex_lock(&nvmet_tcp_queue_mutex);
+	list_for_each_entry(queue, &nvmet_tcp_queue_list, queue_list)
+		if (queue->nvme_sq.ctrl == ctrl)
+			nvmet_tcp_schedule_release_queue(queue);
+	mutex_unlock(&nvmet_tcp_queue_mutex);
+}
+
+static struct nvmet_fabrics_ops nvmet_tcp_ops = {
+	.owner			= THIS_MODULE,
+	.type			= NVMF_TRTYPE_TCP,
+	.sqe_inline_size	= NVMET_TCP_INLINE_DATA_SIZE,
+	.msdbd			= 1,
+	.has_keyed_sgls		= 0,
+	.add_port		= nvmet_tcp_add_port,
+	.remove_port		= nvmet_tcp_remove_port,
+	.queue_response		= nvmet_tcp_queue_response,
+	.delete_ctrl		= nvmet_tcp_delete_ctrl,
+};
+
+static int __init nvmet_tcp_init(void)
+{
+	int ret;
+
+	nvmet_tcp_wq = alloc_workqueue("nvmet_tcp_wq", WQ_HIGHPRI, 0);
+	if (!nvmet_tcp_wq)
+		return -ENOMEM;
+
+	ret = nvmet_register_transport(&nvmet_tcp_ops);
+	if (ret)
+		goto err;
+
+	return 0;
+err:
+	destroy_workqueue(nvmet_tcp_wq);
+	return ret;
+}
+
+static void __exit nvmet_tcp_exit(void)
+{
+	struct nvmet_tcp_queue *queue;
+
+	nvmet_unregister_transport(&nvmet_tcp_ops);
+
+	flush_scheduled_work();
+	mutex_lock(&nvmet_tcp_queue_mutex);
+	list_for_each_entry(queue, &nvmet_tcp_queue_list, queue_list)
+		nvmet_tcp_schedule_release_queue(queue);
+	mutex_unlock(&nvmet_tcp_queue_mutex);
+	flush_scheduled_work();
+
+	destroy_workqueue(nvmet_tcp_wq);
+	ida_destroy(&nvmet_tcp_queue_ida);
+}
+
+module_init(nvmet_tcp_init);
+module_exit(nvmet_tcp_exit);
+
+MODULE_LICENSE("GPL v2");
+MODULE_ALIAS("nvmet-transport-3"); /* 3 == NVMF_TRTYPE_TCP */
@@ -1500,16 +1500,26 @@ static void
 n_tty_receive_buf_raw(struct tty_struct *tty, const unsigned char *cp,
 		      char *fp, int count)
 {
-	struct n_tty_data *ldata = tty->disc_data;
-	char flag = TTY_NORMAL;
-
-	while (count--) {
-		if (fp)
-			flag = *fp++;
-		if (likely(flag == TTY_NORMAL))
-			put_tty_queue(*cp++, ldata);
-		else
-			n_tty_receive_char_flagged(tty, *cp++, flag);
+	int n;
+
+	/* Raw mode queues TTY_NORMAL chars as they are, copy them in runs */
+	while (count) {
+		n = count;
+		if (fp) {
+			for (n = 0; n < count; n++)
+				if (fp[n] != TTY_NORMAL)
+					break;
+		}
+		if (n) {
+			n_tty_receive_buf_real_raw(tty, cp, NULL, n);
+			cp += n;
+			if (fp)
+				fp += n;
+			count -= n;
+			continue;
+		}
+		n_tty_receive_char_flagged(tty, *cp++, *fp++);
+		count--;
 	}
 }
 
@@ -120,6 +120,32 @@ static int pty_write(struct tty_struct *tty, const unsigned char *buf, int c)
 	return c;
 }
 
+/**
+ *	pty_put_char		-	write one char to a pty
+ *	@tty: the tty we write from
+ *	@ch: the char
+ *
+ *	Like pty_write() but leaves the push to pty_flush_chars(), which
+ *	callers of put_char must use when done.  Output processing writes
+ *	every newline expansion and echo through here, so this saves
+ *	scheduling the flip buffer work of the other end for each of them.
+ */
+
+static int pty_put_char(struct tty_struct *tty, unsigned char ch)
+{
+	struct tty_struct *to = tty->link;
+
+	if (tty->stopped)
+		return 0;
+
+	return tty_insert_flip_char(to->port, ch, TTY_NORMAL);
+}
+
+static void pty_flush_chars(struct tty_struct *tty)
+{
+	tty_flip_buffer_push(tty->link->port);
+}
+
 /**
  *	pty_write_room	-	write space
  *	@tty: tty we are writing from
@@ -502,6 +528,8 @@ static const struct tty_operations master_pty_ops_bsd = {
 	.open = pty_open,
 	.close = pty_close,
 	.write = pty_write,
+	.put_char = pty_put_char,
+	.flush_chars = pty_flush_chars,
 	.write_room = pty_write_room,
 	.flush_buffer = pty_flush_buffer,
 	.chars_in_buffer = pty_chars_in_buffer,
@@ -517,6 +545,8 @@ static const struct tty_operations slave_pty_ops_bsd = {
 	.open = pty_open,
 	.close = pty_close,
 	.write = pty_write,
+	.put_char = pty_put_char,
+	.flush_chars = pty_flush_chars,
 	.write_room = pty_write_room,
 	.flush_buffer = pty_flush_buffer,
 	.chars_in_buffer = pty_chars_in_buffer,
@@ -681,6 +711,8 @@ static const struct tty_operations ptm_unix98_ops = {
 	.open = pty_open,
 	.close = pty_close,
 	.write = pty_write,
+	.put_char = pty_put_char,
+	.flush_chars = pty_flush_chars,
 	.write_room = pty_write_room,
 	.flush_buffer = pty_flush_buffer,
 	.chars_in_buffer = pty_chars_in_buffer,
@@ -697,6 +729,8 @@ static const struct tty_operations pty_unix98_ops = {
 	.open = pty_open,
 	.close = pty_close,
 	.write = pty_write,
+	.put_char = pty_put_char,
+	.flush_chars = pty_flush_chars,
 	.write_room = pty_write_room,
 	.flush_buffer = pty_flush_buffer,
 	.chars_in_buffer = pty_chars_in_buffer,
@@ -58,6 +58,11 @@ module_param_named(disable_hugepages,
 MODULE_PARM_DESC(disable_hugepages,
 		 "Disable VFIO IOMMU support for IOMMU hugepages.");
 
+static unsigned int pin_workers;
+module_param_named(pin_workers, pin_workers, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(pin_workers,
+		 "Number of workers pinning and mapping large DMA mappings in parallel (0 = disabled).");
+
 struct vfio_iommu {
 	struct list_head	domain_list;
 	struct vfio_domain	*external_domain; /* domain for external user */
@@ -107,6 +112,56 @@ struct vfio_pfn {
 
 static int put_pfn(unsigned long pfn, int prot);
 
+/*
+ * Pages pinned ahead of vfio_pin_pages_remote(), up to a page worth of
+ * struct page pointers at a time.  What is left over when a contiguous run
+ * ends is kept for the next run.
+ */
+struct vfio_batch {
+	struct page		**pages;	/* for get_user_pages */
+	struct page		*fallback_page;	/* if pages alloc fails */
+	int			capacity;	/* length of pages array */
+	int			size;		/* of batch currently */
+	int			offset;		/* of next entry in pages */
+};
+
+static void vfio_batch_init(struct vfio_batch *batch)
+{
+	batch->size = 0;
+	batch->offset = 0;
+
+	if (unlikely(disable_hugepages))
+		goto fallback;
+
+	batch->pages = (struct page **) __get_free_page(GFP_KERNEL);
+	if (!batch->pages)
+		goto fallback;
+
+	batch->capacity = PAGE_SIZE / sizeof(struct page *);
+	return;
+
+fallback:
+	batch->pages = &batch->fallback_page;
+	batch->capacity = 1;
+}
+
+static void vfio_batch_unpin(struct vfio_batch *batch, struct vfio_dma *dma)
+{
+	while (batch->size) {
+		unsigned long pfn = page_to_pfn(batch->pages[batch->offset]);
+
+		put_pfn(pfn, dma->prot);
+		batch->offset++;
+		batch->size--;
+	}
+}
+
+static void vfio_batch_fini(struct vfio_batch *batch)
+{
+	if (batch->capacity > 1)
+		free_page((unsigned long)batch->pages);
+}
+
 /*
  * This code handles mapping and unmapping of user data buffers
  * into DMA'ble space using the IOMMU
@@ -398,78 +453,134 @@ static int vaddr_get_pfn(struct mm_struct *mm, unsigned long vaddr,
 }
 
 /*
- * Attempt to pin pages.  We really don't want to track all the pfns and
- * the iommu can only map chunks of consecutive pfns anyway, so get the
- * first page and all consecutive pages with the same locking.
+ * Pin up to @npages pages from @vaddr into @batch and return how many, or
+ * a negative error.  A VM_PFNMAP range has no struct pages that the batch
+ * could hold; then only the pfn of @vaddr is returned in @pfn, with the
+ * batch left empty.
  */
-static long vfio_pin_pages_remote(struct vfio_dma *dma, unsigned long vaddr,
-				  long npage, unsigned long *pfn_base)
+static long vaddr_get_pfns(struct mm_struct *mm, unsigned long vaddr,
+			   long npages, int prot, unsigned long *pfn,
+			   struct vfio_batch *batch)
 {
-	unsigned long limit = rlimit(RLIMIT_MEMLOCK) >> PAGE_SHIFT;
-	bool lock_cap = capable(CAP_IPC_LOCK);
-	long ret, pinned = 0, lock_acct = 0;
-	bool rsvd;
-	dma_addr_t iova = vaddr - dma->vaddr + dma->iova;
+	struct vm_area_struct *vma;
+	long ret;
 
-	/* This code path is only user initiated */
-	if (!current->mm)
-		return -ENODEV;
+	if (mm == current->mm) {
+		ret = get_user_pages_fast(vaddr, npages, !!(prot & IOMMU_WRITE),
+					  batch->pages);
+	} else {
+		unsigned int flags = 0;
 
-	ret = vaddr_get_pfn(current->mm, vaddr, dma->prot, pfn_base);
-	if (ret)
+		if (prot & IOMMU_WRITE)
+			flags |= FOLL_WRITE;
+
+		down_read(&mm->mmap_sem);
+		ret = get_user_pages_remote(NULL, mm, vaddr, npages, flags,
+					    batch->pages, NULL, NULL);
+		up_read(&mm->mmap_sem);
+	}
+
+	if (ret > 0) {
+		batch->size = ret;
+		batch->offset = 0;
+		*pfn = page_to_pfn(batch->pages[0]);
 		return ret;
+	}
 
-	pinned++;
-	rsvd = is_invalid_reserved_pfn(*pfn_base);
+	down_read(&mm->mmap_sem);
 
-	/*
-	 * Reserved pages aren't counted against the user, externally pinned
-	 * pages are already counted against the user.
-	 */
-	if (!rsvd && !vfio_find_vpfn(dma, iova)) {
-		if (!lock_cap && current->mm->locked_vm + 1 > limit) {
-			put_pfn(*pfn_base, dma->prot);
-			pr_warn("%s: RLIMIT_MEMLOCK (%ld) exceeded\n", __func__,
-					limit << PAGE_SHIFT);
-			return -ENOMEM;
-		}
-		lock_acct++;
+	ret = -EFAULT;
+	vma = find_vma_intersection(mm, vaddr, vaddr + 1);
+
+	if (vma && vma->vm_flags & VM_PFNMAP) {
+		*pfn = ((vaddr - vma->vm_start) >> PAGE_SHIFT) + vma->vm_pgoff;
+		if (is_invalid_reserved_pfn(*pfn))
+			ret = 1;
 	}
 
-	if (unlikely(disable_hugepages))
-		goto out;
+	up_read(&mm->mmap_sem);
+	return ret;
+}
 
-	/* Lock all the consecutive pages from pfn_base */
-	for (vaddr += PAGE_SIZE, iova += PAGE_SIZE; pinned < npage;
-	     pinned++, vaddr += PAGE_SIZE, iova += PAGE_SIZE) {
-		unsigned long pfn = 0;
+static unsigned long vfio_memlock_limit(void)
+{
+	if (capable(CAP_IPC_LOCK))
+		return ULONG_MAX;
+	return rlimit(RLIMIT_MEMLOCK) >> PAGE_SHIFT;
+}
 
-		ret = vaddr_get_pfn(current->mm, vaddr, dma->prot, &pfn);
-		if (ret)
-			break;
+/*
+ * Attempt to pin pages.  We really don't want to track all the pfns and
+ * the iommu can only map chunks of consecutive pfns anyway, so get the
+ * first page and all consecutive pages with the same locking.  Pages are
+ * pinned a batch at a time; pages to account against @limit are added to
+ * *@lock_acct, the caller does the accounting.
+ */
+static long vfio_pin_pages_remote(struct vfio_dma *dma, struct mm_struct *mm,
+				  unsigned long vaddr, long npage,
+				  unsigned long *pfn_base, unsigned long limit,
+				  long *lock_acct, struct vfio_batch *batch)
+{
+	dma_addr_t iova = vaddr - dma->vaddr + dma->iova;
+	long ret = 0, pinned = 0;
+	unsigned long pfn;
+	bool rsvd = false;
 
-		if (pfn != *pfn_base + pinned ||
-		    rsvd != is_invalid_reserved_pfn(pfn)) {
-			put_pfn(pfn, dma->prot);
+	/* This code path is only user initiated */
+	if (!mm)
+		return -ENODEV;
+
+	while (pinned < npage) {
+		if (!batch->size) {
+			/* Empty batch, so refill it. */
+			ret = vaddr_get_pfns(mm, vaddr,
+					     min_t(long, npage - pinned,
+						   batch->capacity),
+					     dma->prot, &pfn, batch);
+			if (ret < 0)
+				break;
+		} else {
+			pfn = page_to_pfn(batch->pages[batch->offset]);
+		}
+
+		if (!pinned) {
+			*pfn_base = pfn;
+			rsvd = is_invalid_reserved_pfn(pfn);
+		} else if (pfn != *pfn_base + pinned ||
+			   rsvd != is_invalid_reserved_pfn(pfn)) {
+			/* The batch keeps the page for the next run */
+			if (!batch->size)
+				put_pfn(pfn, dma->prot);
 			break;
 		}
 
+		/*
+		 * Reserved pages aren't counted against the user, externally
+		 * pinned pages are already counted against the user.
+		 */
 		if (!rsvd && !vfio_find_vpfn(dma, iova)) {
-			if (!lock_cap &&
-			    current->mm->locked_vm + lock_acct + 1 > limit) {
-				put_pfn(pfn, dma->prot);
+			if (mm->locked_vm + *lock_acct + 1 > limit) {
 				pr_warn("%s: RLIMIT_MEMLOCK (%ld) exceeded\n",
 					__func__, limit << PAGE_SHIFT);
+				ret = -ENOMEM;
 				break;
 			}
-			lock_acct++;
+			(*lock_acct)++;
 		}
-	}
 
-out:
-	vfio_lock_acct(current, lock_acct);
+		if (batch->size) {
+			batch->offset++;
+			batch->size--;
+		}
+		pinned++;
+		vaddr += PAGE_SIZE;
+		iova += PAGE_SIZE;
+
+		if (unlikely(disable_hugepages))
+			break;
+	}
 
-	return pinned;
+	return pinned ? pinned : ret;
 }
 
 static long vfio_unpin_pages_remote(struct vfio_dma *dma, dma_addr_t iova,
@@ -675,17 +786,15 @@ unpin_exit:
 	return i > npage ? npage : (i > 0 ? i : -EINVAL);
 }
 
-static long vfio_unmap_unpin(struct vfio_iommu *iommu, struct vfio_dma *dma,
-			     bool do_accounting)
+/* Unmap [iova, end) of @dma from all domains and unpin it, no accounting */
+static long vfio_unmap_unpin_range(struct vfio_iommu *iommu,
+				   struct vfio_dma *dma, dma_addr_t iova,
+				   dma_addr_t end)
 {
-	dma_addr_t iova = dma->iova, end = dma->iova + dma->size;
 	struct vfio_domain *domain, *d;
 	long unlocked = 0;
 
-	if (!dma->size)
-		return 0;
-
-	if (!IS_IOMMU_CAP_DOMAIN_IN_CONTAINER(iommu))
+	if (iova == end)
 		return 0;
 
 	/*
@@ -699,7 +808,7 @@ static long vfio_unmap_unpin(struct vfio_iommu *iommu, struct vfio_dma *dma,
 				      struct vfio_domain, next);
 
 	list_for_each_entry_continue(d, &iommu->domain_list, next) {
-		iommu_unmap(d->domain, dma->iova, dma->size);
+		iommu_unmap(d->domain, iova, end - iova);
 		cond_resched();
 	}
 
@@ -738,6 +847,23 @@ static long vfio_unmap_unpin(struct vfio_iommu *iommu, struct vfio_dma *dma,
 		cond_resched();
 	}
 
+	return unlocked;
+}
+
+static long vfio_unmap_unpin(struct vfio_iommu *iommu, struct vfio_dma *dma,
+			     bool do_accounting)
+{
+	long unlocked;
+
+	if (!dma->size)
+		return 0;
+
+	if (!IS_IOMMU_CAP_DOMAIN_IN_CONTAINER(iommu))
+		return 0;
+
+	unlocked = vfio_unmap_unpin_range(iommu, dma, dma->iova,
+					  dma->iova + dma->size);
+
 	dma->iommu_mapped = false;
 	if (do_accounting) {
 		vfio_lock_acct(dma->task, -unlocked);
@@ -944,20 +1070,31 @@ unwind:
 	return ret;
 }
 
-static int vfio_pin_map_dma(struct vfio_iommu *iommu, struct vfio_dma *dma,
-			    size_t map_size)
+/*
+ * Pin and map [iova, iova + size) of @dma a contiguous chunk at a time,
+ * counting how much got mapped in *@mapped and the pages to account in
+ * *@lock_acct.
+ */
+static int vfio_pin_map_range(struct vfio_iommu *iommu, struct vfio_dma *dma,
+			      struct mm_struct *mm, dma_addr_t iova,
+			      size_t size, unsigned long limit,
+			      size_t *mapped, long *lock_acct)
 {
-	dma_addr_t iova = dma->iova;
-	unsigned long vaddr = dma->vaddr;
-	size_t size = map_size;
-	long npage;
+	struct vfio_batch batch;
 	unsigned long pfn;
+	long npage, acct;
 	int ret = 0;
 
-	while (size) {
+	vfio_batch_init(&batch);
+
+	while (*mapped < size) {
+		unsigned long vaddr = dma->vaddr + (iova - dma->iova) + *mapped;
+
 		/* Pin a contiguous chunk of memory */
-		npage = vfio_pin_pages_remote(dma, vaddr + dma->size,
-					      size >> PAGE_SHIFT, &pfn);
+		acct = *lock_acct;
+		npage = vfio_pin_pages_remote(dma, mm, vaddr,
+					      (size - *mapped) >> PAGE_SHIFT,
+					      &pfn, limit, lock_acct, &batch);
 		if (npage <= 0) {
 			WARN_ON(!npage);
 			ret = (int)npage;
@@ -965,18 +1102,150 @@ static int vfio_pin_map_dma(struct vfio_iommu *iommu, struct vfio_dma *dma,
 		}
 
 		/* Map it! */
-		ret = vfio_iommu_map(iommu, iova + dma->size, pfn, npage,
+		ret = vfio_iommu_map(iommu, iova + *mapped, pfn, npage,
 				     dma->prot);
 		if (ret) {
-			vfio_unpin_pages_remote(dma, iova + dma->size, pfn,
-						npage, true);
+			vfio_unpin_pages_remote(dma, iova + *mapped, pfn,
+						npage, false);
+			*lock_acct = acct;
 			break;
 		}
 
-		size -= npage << PAGE_SHIFT;
-		dma->size += npage << PAGE_SHIFT;
+		*mapped += npage << PAGE_SHIFT;
+	}
+
+	vfio_batch_unpin(&batch, dma);
+	vfio_batch_fini(&batch);
+
+	return ret;
+}
+
+/*
+ * Large mappings can be split between pin_workers jobs on the unbound
+ * workqueue.  Job boundaries are 1GB aligned in IOVA space so that no job
+ * ends in the middle of what the IOMMU could map as a superpage.
+ */
+#define VFIO_PIN_JOB_SIZE	(1UL << 30)
+
+struct vfio_pin_job {
+	struct work_struct	work;
+	struct vfio_iommu	*iommu;
+	struct vfio_dma		*dma;
+	struct mm_struct	*mm;
+	dma_addr_t		iova;
+	size_t			size;
+	size_t			mapped;
+	long			lock_acct;
+	int			ret;
+};
+
+static void vfio_pin_job_fn(struct work_struct *work)
+{
+	struct vfio_pin_job *job = container_of(work, struct vfio_pin_job,
+						work);
+
+	/*
+	 * The caller made sure the whole mapping fits the locked memory
+	 * limit, so the jobs don't need to coordinate on it.
+	 */
+	job->ret = vfio_pin_map_range(job->iommu, job->dma, job->mm, job->iova,
+				      job->size, ULONG_MAX, &job->mapped,
+				      &job->lock_acct);
+}
+
+static bool vfio_pin_map_parallel(size_t map_size, unsigned long limit)
+{
+	unsigned int workers = READ_ONCE(pin_workers);
+
+	if (workers < 2 || map_size < 2 * VFIO_PIN_JOB_SIZE)
+		return false;
+
+	return limit == ULONG_MAX ||
+	       current->mm->locked_vm + (map_size >> PAGE_SHIFT) <= limit;
+}
+
+static int vfio_pin_map_dma_parallel(struct vfio_iommu *iommu,
+				     struct vfio_dma *dma, size_t map_size)
+{
+	dma_addr_t end = dma->iova + map_size, iova = dma->iova;
+	unsigned int i, nr_jobs;
+	struct vfio_pin_job *jobs;
+	long lock_acct = 0, unlocked = 0;
+	size_t chunk;
+	int ret = 0;
+
+	nr_jobs = min_t(unsigned long, READ_ONCE(pin_workers),
+			DIV_ROUND_UP(map_size, VFIO_PIN_JOB_SIZE));
+	chunk = round_up(map_size / nr_jobs, VFIO_PIN_JOB_SIZE);
+
+	jobs = kcalloc(nr_jobs, sizeof(*jobs), GFP_KERNEL);
+	if (!jobs)
+		return -ENOMEM;
+
+	for (i = 0; i < nr_jobs && iova < end; i++) {
+		struct vfio_pin_job *job = &jobs[i];
+		dma_addr_t next = ALIGN(iova + chunk, VFIO_PIN_JOB_SIZE);
+
+		if (i == nr_jobs - 1 || next > end)
+			next = end;
+
+		INIT_WORK(&job->work, vfio_pin_job_fn);
+		job->iommu = iommu;
+		job->dma = dma;
+		job->mm = current->mm;
+		job->iova = iova;
+		job->size = next - iova;
+		queue_work(system_unbound_wq, &job->work);
+
+		iova = next;
+	}
+	nr_jobs = i;
+
+	for (i = 0; i < nr_jobs; i++) {
+		flush_work(&jobs[i].work);
+		lock_acct += jobs[i].lock_acct;
+		if (!ret)
+			ret = jobs[i].ret;
 	}
 
+	vfio_lock_acct(current, lock_acct);
+
+	if (!ret) {
+		dma->size = map_size;
+	} else {
+		for (i = 0; i < nr_jobs; i++)
+			unlocked += vfio_unmap_unpin_range(iommu, dma,
+							   jobs[i].iova,
+							   jobs[i].iova +
+							   jobs[i].mapped);
+		vfio_lock_acct(current, -unlocked);
+	}
+	dma->iommu_mapped = true;
+
+	kfree(jobs);
+
+	if (ret)
+		vfio_remove_dma(iommu, dma);
+
+	return ret;
+}
+
+static int vfio_pin_map_dma(struct vfio_iommu *iommu, struct vfio_dma *dma,
+			    size_t map_size)
+{
+	unsigned long limit = vfio_memlock_limit();
+	size_t mapped = 0;
+	long lock_acct = 0;
+	int ret;
+
+	if (vfio_pin_map_parallel(map_size, limit))
+		return vfio_pin_map_dma_parallel(iommu, dma, map_size);
+
+	ret = vfio_pin_map_range(iommu, dma, current->mm, dma->iova, map_size,
+				 limit, &mapped, &lock_acct);
+
+	dma->size = mapped;
+	vfio_lock_acct(current, lock_acct);
 	dma->iommu_mapped = true;
 
 	if (ret)
@@ -1065,9 +1334,13 @@ static int vfio_bus_type(struct device *dev, void *data)
 static int vfio_iommu_replay(struct vfio_iommu *iommu,
 			     struct vfio_domain *domain)
 {
+	unsigned long limit = vfio_memlock_limit();
+	struct vfio_batch batch;
 	struct vfio_domain *d;
 	struct rb_node *n;
-	int ret;
+	int ret = 0;
+
+	vfio_batch_init(&batch);
 
 	/* Arbitrarily pick the first domain in the list for lookups */
 	d = list_first_entry(&iommu->domain_list, struct vfio_domain, next);
@@ -1109,15 +1382,19 @@ static int vfio_iommu_replay(struct vfio_iommu *iommu,
 				unsigned long vaddr = dma->vaddr +
 						     (iova - dma->iova);
 				size_t n = dma->iova + dma->size - iova;
-				long npage;
+				long npage, lock_acct = 0;
 
-				npage = vfio_pin_pages_remote(dma, vaddr,
+				npage = vfio_pin_pages_remote(dma, current->mm,
+							      vaddr,
 							      n >> PAGE_SHIFT,
-							      &pfn);
+							      &pfn, limit,
+							      &lock_acct,
+							      &batch);
+				vfio_lock_acct(current, lock_acct);
 				if (npage <= 0) {
 					WARN_ON(!npage);
 					ret = (int)npage;
-					return ret;
+					goto out;
 				}
 
 				phys = pfn << PAGE_SHIFT;
@@ -1127,13 +1404,17 @@ static int vfio_iommu_replay(struct vfio_iommu *iommu,
 			ret = iommu_map(domain->domain, iova, phys,
 					size, dma->prot | domain->prot);
 			if (ret)
-				return ret;
+				goto out;
 
 			iova += size;
 		}
+		vfio_batch_unpin(&batch, dma);
 		dma->iommu_mapped = true;
 	}
-	return 0;
+out:
+	vfio_batch_unpin(&batch, dma);
+	vfio_batch_fini(&batch);
+	return ret;
 }
 
 /*
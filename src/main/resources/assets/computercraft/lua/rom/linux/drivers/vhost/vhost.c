@@ -24,6 +24,7 @@
 #include <linux/slab.h>
 #include <linux/vmalloc.h>
 #include <linux/kthread.h>
+#include <linux/cpu.h>
 #include <linux/cgroup.h>
 #include <linux/module.h>
 #include <linux/sort.h>
@@ -41,6 +42,14 @@ static int max_iotlb_entries = 2048;
 module_param(max_iotlb_entries, int, 0444);
 MODULE_PARM_DESC(max_iotlb_entries,
 	"Maximum number of iotlb entries. (default: 2048)");
+static bool shared_workers;
+module_param(shared_workers, bool, 0444);
+MODULE_PARM_DESC(shared_workers,
+	"Run all devices on one worker thread per CPU instead of one thread per device. (default: N)");
+
+static struct vhost_shared_worker *vhost_shared_workers;
+static unsigned int vhost_nr_shared_workers;
+static atomic_t vhost_shared_next = ATOMIC_INIT(0);
 
 enum {
 	VHOST_MEMORY_F_LOG = 0x1,
@@ -266,15 +275,24 @@ void vhost_work_queue(struct vhost_dev *dev, struct vhost_work *work)
 		 * test_and_set_bit() implies a memory barrier.
 		 */
 		llist_add(&work->node, &dev->work_list);
+		if (dev->shared) {
+			/* Same ordering argument for the device itself. */
+			if (test_and_set_bit(VHOST_DEV_QUEUED, &dev->flags))
+				return;
+			llist_add(&dev->shared_node, &dev->shared->dev_list);
+		}
 		wake_up_process(dev->worker);
 	}
 }
 EXPORT_SYMBOL_GPL(vhost_work_queue);
 
-/* A lockless hint for busy polling code to exit the loop */
+/* A lockless hint for busy polling code to exit the loop.  With a shared
+ * worker, other devices waiting for it count as well.
+ */
 bool vhost_has_work(struct vhost_dev *dev)
 {
-	return !llist_empty(&dev->work_list);
+	return !llist_empty(&dev->work_list) ||
+	       (dev->shared && !llist_empty(&dev->shared->dev_list));
 }
 EXPORT_SYMBOL_GPL(vhost_has_work);
 
@@ -310,7 +328,11 @@ static void vhost_vq_reset(struct vhost_dev *dev,
 	vq->last_avail_idx = 0;
 	vq->last_used_event = 0;
 	vq->avail_idx = 0;
+	vq->avail_head_count = 0;
 	vq->last_used_idx = 0;
+	vq->avail_wrap_counter = true;
+	vq->used_wrap_counter = true;
+	vq->packed_fetched = 0;
 	vq->signalled_used = 0;
 	vq->signalled_used_valid = false;
 	vq->used_flags = 0;
@@ -372,6 +394,127 @@ static int vhost_worker(void *data)
 	return 0;
 }
 
+/* Run the work queued on one device, in the context of its owner's mm.
+ * The device may go away as soon as its last work item completes, so
+ * nothing is read from it after that.
+ */
+static void vhost_shared_run_dev(struct vhost_dev *dev)
+{
+	struct mm_struct *mm = dev->mm;
+	struct vhost_work *work, *work_next;
+	struct llist_node *node;
+
+	clear_bit(VHOST_DEV_QUEUED, &dev->flags);
+	/* pairs with test_and_set_bit() in vhost_work_queue() */
+	smp_mb__after_atomic();
+
+	node = llist_del_all(&dev->work_list);
+	if (!node)
+		return;
+
+	node = llist_reverse_order(node);
+	/* make sure flag is seen after deletion */
+	smp_wmb();
+	use_mm(mm);
+	llist_for_each_entry_safe(work, work_next, node, node) {
+		clear_bit(VHOST_WORK_QUEUED, &work->flags);
+		work->fn(work);
+	}
+	unuse_mm(mm);
+}
+
+/* Devices are served round robin: each gets one pass over the work it had
+ * queued, and anything it queues meanwhile waits for the next round.
+ */
+static int vhost_shared_worker_fn(void *data)
+{
+	struct vhost_shared_worker *worker = data;
+	struct vhost_dev *dev, *dev_next;
+	struct llist_node *node;
+	mm_segment_t oldfs = get_fs();
+
+	set_fs(USER_DS);
+
+	for (;;) {
+		/* mb paired w/ kthread_stop */
+		set_current_state(TASK_INTERRUPTIBLE);
+
+		if (kthread_should_stop()) {
+			__set_current_state(TASK_RUNNING);
+			break;
+		}
+
+		node = llist_del_all(&worker->dev_list);
+		if (!node) {
+			schedule();
+			continue;
+		}
+
+		__set_current_state(TASK_RUNNING);
+		node = llist_reverse_order(node);
+		llist_for_each_entry_safe(dev, dev_next, node, shared_node) {
+			vhost_shared_run_dev(dev);
+			cond_resched();
+		}
+	}
+	set_fs(oldfs);
+	return 0;
+}
+
+static struct vhost_shared_worker *vhost_shared_worker(void)
+{
+	unsigned int i;
+
+	i = (unsigned int)atomic_inc_return(&vhost_shared_next);
+	return &vhost_shared_workers[i % vhost_nr_shared_workers];
+}
+
+static void vhost_shared_workers_stop(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < vhost_nr_shared_workers; i++)
+		kthread_stop(vhost_shared_workers[i].task);
+	kfree(vhost_shared_workers);
+	vhost_shared_workers = NULL;
+	vhost_nr_shared_workers = 0;
+}
+
+static int __init vhost_shared_workers_start(void)
+{
+	struct vhost_shared_worker *worker;
+	struct task_struct *task;
+	int cpu;
+
+	get_online_cpus();
+	vhost_shared_workers = kcalloc(num_online_cpus(),
+				       sizeof(*vhost_shared_workers),
+				       GFP_KERNEL);
+	if (!vhost_shared_workers) {
+		put_online_cpus();
+		return -ENOMEM;
+	}
+
+	for_each_online_cpu(cpu) {
+		worker = &vhost_shared_workers[vhost_nr_shared_workers];
+		init_llist_head(&worker->dev_list);
+		task = kthread_create_on_node(vhost_shared_worker_fn, worker,
+					      cpu_to_node(cpu),
+					      "vhost-shared/%d", cpu);
+		if (IS_ERR(task)) {
+			put_online_cpus();
+			vhost_shared_workers_stop();
+			return PTR_ERR(task);
+		}
+		kthread_bind(task, cpu);
+		worker->task = task;
+		vhost_nr_shared_workers++;
+		wake_up_process(task);
+	}
+	put_online_cpus();
+	return 0;
+}
+
 static void vhost_vq_free_iovecs(struct vhost_virtqueue *vq)
 {
 	kfree(vq->indirect);
@@ -428,6 +571,8 @@ void vhost_dev_init(struct vhost_dev *dev,
 	dev->iotlb = NULL;
 	dev->mm = NULL;
 	dev->worker = NULL;
+	dev->shared = NULL;
+	dev->flags = 0;
 	init_llist_head(&dev->work_list);
 	init_waitqueue_head(&dev->wait);
 	INIT_LIST_HEAD(&dev->read_list);
@@ -440,6 +585,7 @@ void vhost_dev_init(struct vhost_dev *dev,
 		vq->log = NULL;
 		vq->indirect = NULL;
 		vq->heads = NULL;
+		vq->packed_slots = NULL;
 		vq->dev = dev;
 		mutex_init(&vq->mutex);
 		vhost_vq_reset(dev, vq);
@@ -504,6 +650,20 @@ long vhost_dev_set_owner(struct vhost_dev *dev)
 
 	/* No owner, become one */
 	dev->mm = get_task_mm(current);
+
+	/* A shared worker can't follow the cgroups of every owner, it stays
+	 * where it was started.
+	 */
+	if (vhost_nr_shared_workers) {
+		dev->shared = vhost_shared_worker();
+		dev->worker = dev->shared->task;
+
+		err = vhost_dev_alloc_iovecs(dev);
+		if (err)
+			goto err_shared;
+		return 0;
+	}
+
 	worker = kthread_create(vhost_worker, dev, "vhost-%d", current->pid);
 	if (IS_ERR(worker)) {
 		err = PTR_ERR(worker);
@@ -522,6 +682,10 @@ long vhost_dev_set_owner(struct vhost_dev *dev)
 		goto err_cgroup;
 
 	return 0;
+err_shared:
+	dev->shared = NULL;
+	dev->worker = NULL;
+	goto err_worker;
 err_cgroup:
 	kthread_stop(worker);
 	dev->worker = NULL;
@@ -637,6 +801,8 @@ void vhost_dev_cleanup(struct vhost_dev *dev, bool locked)
 			eventfd_ctx_put(dev->vqs[i]->call_ctx);
 		if (dev->vqs[i]->call)
 			fput(dev->vqs[i]->call);
+		kvfree(dev->vqs[i]->packed_slots);
+		dev->vqs[i]->packed_slots = NULL;
 		vhost_vq_reset(dev, dev->vqs[i]);
 	}
 	vhost_dev_free_iovecs(dev);
@@ -654,7 +820,14 @@ void vhost_dev_cleanup(struct vhost_dev *dev, bool locked)
 	vhost_clear_msg(dev);
 	wake_up_interruptible_poll(&dev->wait, POLLIN | POLLRDNORM);
 	WARN_ON(!llist_empty(&dev->work_list));
-	if (dev->worker) {
+	if (dev->shared) {
+		/* The device may still be on the worker's list from a
+		 * wakeup that raced with the last round; wait it out.
+		 */
+		vhost_work_flush(dev, NULL);
+		dev->shared = NULL;
+		dev->worker = NULL;
+	} else if (dev->worker) {
 		kthread_stop(dev->worker);
 		dev->worker = NULL;
 	}
@@ -1154,6 +1327,27 @@ static int vhost_iotlb_miss(struct vhost_virtqueue *vq, u64 iova, int access)
 	return 0;
 }
 
+static inline bool vhost_packed_ring(struct vhost_virtqueue *vq)
+{
+	return vhost_has_feature(vq, VIRTIO_F_RING_PACKED);
+}
+
+/* A packed ring is the descriptor ring, which we write used entries to,
+ * with the driver and device event suppression structures in place of the
+ * avail and used rings. */
+static int vq_access_ok_packed(unsigned int num,
+			       struct vring_desc __user *desc,
+			       struct vring_avail __user *avail,
+			       struct vring_used __user *used)
+{
+	return access_ok(VERIFY_WRITE, desc,
+			 num * sizeof(struct vring_packed_desc)) &&
+	       access_ok(VERIFY_READ, avail,
+			 sizeof(struct vring_packed_desc_event)) &&
+	       access_ok(VERIFY_WRITE, used,
+			 sizeof(struct vring_packed_desc_event));
+}
+
 static int vq_access_ok(struct vhost_virtqueue *vq, unsigned int num,
 			struct vring_desc __user *desc,
 			struct vring_avail __user *avail,
@@ -1162,6 +1356,9 @@ static int vq_access_ok(struct vhost_virtqueue *vq, unsigned int num,
 {
 	size_t s = vhost_has_feature(vq, VIRTIO_RING_F_EVENT_IDX) ? 2 : 0;
 
+	if (vhost_packed_ring(vq))
+		return vq_access_ok_packed(num, desc, avail, used);
+
 	return access_ok(VERIFY_READ, desc, num * sizeof *desc) &&
 	       access_ok(VERIFY_READ, avail,
 			 sizeof *avail + num * sizeof *avail->ring + s) &&
@@ -1224,6 +1421,20 @@ int vq_iotlb_prefetch(struct vhost_virtqueue *vq)
 	if (!vq->iotlb)
 		return 1;
 
+	if (vhost_packed_ring(vq))
+		return iotlb_access_ok(vq, VHOST_ACCESS_RW,
+				       (u64)(uintptr_t)vq->desc,
+				       num * sizeof(struct vring_packed_desc),
+				       VHOST_ADDR_DESC) &&
+		       iotlb_access_ok(vq, VHOST_ACCESS_RO,
+				       (u64)(uintptr_t)vq->avail,
+				       sizeof(struct vring_packed_desc_event),
+				       VHOST_ADDR_AVAIL) &&
+		       iotlb_access_ok(vq, VHOST_ACCESS_WO,
+				       (u64)(uintptr_t)vq->used,
+				       sizeof(struct vring_packed_desc_event),
+				       VHOST_ADDR_USED);
+
 	return iotlb_access_ok(vq, VHOST_ACCESS_RO, (u64)(uintptr_t)vq->desc,
 			       num * sizeof(*vq->desc), VHOST_ADDR_DESC) &&
 	       iotlb_access_ok(vq, VHOST_ACCESS_RO, (u64)(uintptr_t)vq->avail,
@@ -1251,12 +1462,16 @@ static int vq_log_access_ok(struct vhost_virtqueue *vq,
 			    void __user *log_base)
 {
 	size_t s = vhost_has_feature(vq, VIRTIO_RING_F_EVENT_IDX) ? 2 : 0;
+	size_t sz = sizeof *vq->used + vq->num * sizeof *vq->used->ring + s;
+
+	/* For a packed ring log_addr is the guest address of the descriptor
+	 * ring, that's where used entries go. */
+	if (vhost_packed_ring(vq))
+		sz = vq->num * sizeof(struct vring_packed_desc);
 
 	return vq_memory_access_ok(log_base, vq->umem,
 				   vhost_has_feature(vq, VHOST_F_LOG_ALL)) &&
-		(!vq->log_used || log_access_ok(log_base, vq->log_addr,
-					sizeof *vq->used +
-					vq->num * sizeof *vq->used->ring + s));
+		(!vq->log_used || log_access_ok(log_base, vq->log_addr, sz));
 }
 
 /* Can we start vq? */
@@ -1395,6 +1610,7 @@ long vhost_vring_ioctl(struct vhost_dev *d, int ioctl, void __user *argp)
 			break;
 		}
 		vq->num = s.num;
+		vq->avail_head_count = 0;
 		break;
 	case VHOST_SET_VRING_BASE:
 		/* Moving base with an active backend?
@@ -1407,6 +1623,20 @@ long vhost_vring_ioctl(struct vhost_dev *d, int ioctl, void __user *argp)
 			r = -EFAULT;
 			break;
 		}
+		if (vhost_packed_ring(vq)) {
+			vq->last_avail_idx = s.num & 0x7fff;
+			vq->avail_wrap_counter = !!(s.num & 0x8000);
+			vq->last_used_idx = (s.num >> 16) & 0x7fff;
+			vq->used_wrap_counter = !!(s.num & 0x80000000);
+			if (vq->last_avail_idx >= vq->num ||
+			    vq->last_used_idx >= vq->num) {
+				r = -EINVAL;
+				break;
+			}
+			vq->avail_idx = vq->last_avail_idx;
+			vq->packed_fetched = 0;
+			break;
+		}
 		if (s.num > 0xffff) {
 			r = -EINVAL;
 			break;
@@ -1414,10 +1644,15 @@ long vhost_vring_ioctl(struct vhost_dev *d, int ioctl, void __user *argp)
 		vq->last_avail_idx = vq->last_used_event = s.num;
 		/* Forget the cached index value. */
 		vq->avail_idx = vq->last_avail_idx;
+		vq->avail_head_count = 0;
 		break;
 	case VHOST_GET_VRING_BASE:
 		s.index = idx;
 		s.num = vq->last_avail_idx;
+		if (vhost_packed_ring(vq))
+			s.num |= vq->avail_wrap_counter << 15 |
+				 (u32)vq->last_used_idx << 16 |
+				 (u32)vq->used_wrap_counter << 31;
 		if (copy_to_user(argp, &s, sizeof s))
 			r = -EFAULT;
 		break;
@@ -1474,6 +1709,7 @@ long vhost_vring_ioctl(struct vhost_dev *d, int ioctl, void __user *argp)
 		vq->log_used = !!(a.flags & (0x1 << VHOST_VRING_F_LOG));
 		vq->desc = (void __user *)(unsigned long)a.desc_user_addr;
 		vq->avail = (void __user *)(unsigned long)a.avail_user_addr;
+		vq->avail_head_count = 0;
 		vq->log_addr = a.log_guest_addr;
 		vq->used = (void __user *)(unsigned long)a.used_user_addr;
 		break;
@@ -1794,6 +2030,45 @@ static int vhost_update_avail_event(struct vhost_virtqueue *vq, u16 avail_event)
 	return 0;
 }
 
+/* Tell the guest whether and where to notify us, following used_flags. */
+static int vhost_update_device_event(struct vhost_virtqueue *vq)
+{
+	struct vring_packed_desc_event __user *event = (void __user *)vq->used;
+	u16 flags = VRING_PACKED_EVENT_FLAG_DISABLE;
+	u16 off_wrap;
+
+	if (!(vq->used_flags & VRING_USED_F_NO_NOTIFY)) {
+		flags = VRING_PACKED_EVENT_FLAG_ENABLE;
+		if (vhost_has_feature(vq, VIRTIO_RING_F_EVENT_IDX)) {
+			off_wrap = vq->last_avail_idx |
+				   vq->avail_wrap_counter <<
+				   VRING_PACKED_EVENT_F_WRAP_CTR;
+			if (vhost_put_user(vq, cpu_to_le16(off_wrap),
+					   &event->off_wrap))
+				return -EFAULT;
+			/* The guest looks at off_wrap once it sees DESC. */
+			smp_wmb();
+			flags = VRING_PACKED_EVENT_FLAG_DESC;
+		}
+	}
+	if (vhost_put_user(vq, cpu_to_le16(flags), &event->flags))
+		return -EFAULT;
+	return 0;
+}
+
+static int vhost_vq_init_packed(struct vhost_virtqueue *vq)
+{
+	kvfree(vq->packed_slots);
+	vq->packed_slots = vhost_kvzalloc(2 * vq->num *
+					  sizeof(*vq->packed_slots));
+	if (!vq->packed_slots)
+		return -ENOMEM;
+	vq->packed_fetched = 0;
+	vq->signalled_used_valid = false;
+
+	return vhost_update_device_event(vq);
+}
+
 int vhost_vq_init_access(struct vhost_virtqueue *vq)
 {
 	__virtio16 last_used_idx;
@@ -1805,6 +2080,13 @@ int vhost_vq_init_access(struct vhost_virtqueue *vq)
 
 	vhost_init_is_le(vq);
 
+	if (vhost_packed_ring(vq)) {
+		r = vhost_vq_init_packed(vq);
+		if (r)
+			goto err;
+		return 0;
+	}
+
 	r = vhost_update_used_flags(vq);
 	if (r)
 		goto err;
@@ -1994,6 +2276,273 @@ static int get_indirect(struct vhost_virtqueue *vq,
 	return 0;
 }
 
+/* Read the avail ring from @idx on, as far as the guest has published it
+ * and without wrapping, so that the next heads come from vq->avail_heads.
+ */
+static int vhost_fetch_avail_heads(struct vhost_virtqueue *vq, u16 idx)
+{
+	unsigned int start = idx & (vq->num - 1);
+	unsigned int n = min_t(unsigned int, (u16)(vq->avail_idx - idx),
+			       VHOST_AVAIL_BATCH);
+	__virtio16 __user *from = &vq->avail->ring[start];
+	void __user *uaddr;
+
+	n = min(n, vq->num - start);
+
+	if (!vq->iotlb) {
+		if (__copy_from_user(vq->avail_heads, from, n * sizeof(*from)))
+			return -EFAULT;
+	} else {
+		uaddr = vhost_vq_meta_fetch(vq, (u64)(uintptr_t)from,
+					    n * sizeof(*from),
+					    VHOST_ADDR_AVAIL);
+		if (uaddr) {
+			if (__copy_from_user(vq->avail_heads, uaddr,
+					     n * sizeof(*from)))
+				return -EFAULT;
+		} else {
+			/* No contiguous mapping, go one entry at a time */
+			n = 1;
+			if (vhost_get_avail(vq, vq->avail_heads[0], from))
+				return -EFAULT;
+		}
+	}
+
+	vq->avail_head_first = idx;
+	vq->avail_head_count = n;
+	return 0;
+}
+
+static inline bool vhost_desc_avail_packed(__le16 flags, bool wrap_counter)
+{
+	bool avail = flags & cpu_to_le16(1 << VRING_PACKED_DESC_F_AVAIL);
+	bool used = flags & cpu_to_le16(1 << VRING_PACKED_DESC_F_USED);
+
+	return avail != used && avail == wrap_counter;
+}
+
+static int vhost_get_desc_flags_packed(struct vhost_virtqueue *vq, u16 idx,
+				       __le16 *flags)
+{
+	struct vring_packed_desc __user *ring = (void __user *)vq->desc;
+
+	return vhost_get_user(vq, *flags, &ring[idx].flags, VHOST_ADDR_DESC);
+}
+
+/* Entries of a packed indirect table follow each other, there's no next. */
+static int get_indirect_packed(struct vhost_virtqueue *vq,
+			       struct iovec iov[], unsigned int iov_size,
+			       unsigned int *out_num, unsigned int *in_num,
+			       struct vhost_log *log, unsigned int *log_num,
+			       struct vring_packed_desc *indirect)
+{
+	struct vring_packed_desc desc;
+	unsigned int i, count;
+	u32 len = le32_to_cpu(indirect->len);
+	struct iov_iter from;
+	int ret, access;
+
+	/* Sanity check */
+	if (unlikely(!len || len % sizeof desc)) {
+		vq_err(vq, "Invalid length in indirect descriptor: "
+		       "len 0x%llx not multiple of 0x%zx\n",
+		       (unsigned long long)len,
+		       sizeof desc);
+		return -EINVAL;
+	}
+
+	ret = translate_desc(vq, le64_to_cpu(indirect->addr), len,
+			     vq->indirect, UIO_MAXIOV, VHOST_ACCESS_RO);
+	if (unlikely(ret < 0)) {
+		if (ret != -EAGAIN)
+			vq_err(vq, "Translation failure %d in indirect.\n", ret);
+		return ret;
+	}
+	iov_iter_init(&from, READ, vq->indirect, ret, len);
+
+	/* We will use the result as an address to read from, so most
+	 * architectures only need a compiler barrier here. */
+	read_barrier_depends();
+
+	count = len / sizeof desc;
+	if (unlikely(count > USHRT_MAX + 1)) {
+		vq_err(vq, "Indirect buffer length too big: %d\n", len);
+		return -E2BIG;
+	}
+
+	for (i = 0; i < count; i++) {
+		unsigned iov_count = *in_num + *out_num;
+
+		if (unlikely(!copy_from_iter_full(&desc, sizeof(desc), &from))) {
+			vq_err(vq, "Failed indirect descriptor: idx %d, %zx\n",
+			       i, (size_t)le64_to_cpu(indirect->addr) + i * sizeof desc);
+			return -EINVAL;
+		}
+		if (unlikely(desc.flags & cpu_to_le16(VRING_DESC_F_INDIRECT))) {
+			vq_err(vq, "Nested indirect descriptor: idx %d, %zx\n",
+			       i, (size_t)le64_to_cpu(indirect->addr) + i * sizeof desc);
+			return -EINVAL;
+		}
+
+		if (desc.flags & cpu_to_le16(VRING_DESC_F_WRITE))
+			access = VHOST_ACCESS_WO;
+		else
+			access = VHOST_ACCESS_RO;
+
+		ret = translate_desc(vq, le64_to_cpu(desc.addr),
+				     le32_to_cpu(desc.len), iov + iov_count,
+				     iov_size - iov_count, access);
+		if (unlikely(ret < 0)) {
+			if (ret != -EAGAIN)
+				vq_err(vq, "Translation failure %d indirect idx %d\n",
+					ret, i);
+			return ret;
+		}
+		/* If this is an input descriptor, increment that count. */
+		if (access == VHOST_ACCESS_WO) {
+			*in_num += ret;
+			if (unlikely(log)) {
+				log[*log_num].addr = le64_to_cpu(desc.addr);
+				log[*log_num].len = le32_to_cpu(desc.len);
+				++*log_num;
+			}
+		} else {
+			/* If it's an output descriptor, they're all supposed
+			 * to come before any input descriptors. */
+			if (unlikely(*in_num)) {
+				vq_err(vq, "Indirect descriptor "
+				       "has out after in: idx %d\n", i);
+				return -EINVAL;
+			}
+			*out_num += ret;
+		}
+	}
+	return 0;
+}
+
+/* Packed ring version of vhost_get_vq_desc: the guest makes a chain
+ * available by flipping the flags of its first descriptor, and the buffer
+ * id that is returned comes from the last one. */
+static int vhost_get_vq_desc_packed(struct vhost_virtqueue *vq,
+				    struct iovec iov[], unsigned int iov_size,
+				    unsigned int *out_num, unsigned int *in_num,
+				    struct vhost_log *log, unsigned int *log_num)
+{
+	struct vring_packed_desc __user *ring = (void __user *)vq->desc;
+	struct vring_packed_desc desc;
+	bool wrap_counter = vq->avail_wrap_counter;
+	u16 i = vq->last_avail_idx, id = 0;
+	unsigned int found = 0;
+	__le16 flags;
+	int ret, access;
+
+	if (unlikely(vhost_get_desc_flags_packed(vq, i, &flags))) {
+		vq_err(vq, "Failed to access descriptor flags at %p\n",
+		       &ring[i].flags);
+		return -EFAULT;
+	}
+
+	/* If there's nothing new since last we looked, return invalid. */
+	if (!vhost_desc_avail_packed(flags, wrap_counter))
+		return vq->num;
+
+	/* Only read the descriptors after they have been exposed by guest. */
+	smp_rmb();
+
+	/* When we start there are none of either input nor output. */
+	*out_num = *in_num = 0;
+	if (unlikely(log))
+		*log_num = 0;
+
+	do {
+		unsigned iov_count = *in_num + *out_num;
+
+		if (unlikely(++found > vq->num)) {
+			vq_err(vq, "Loop detected: last one at %u "
+			       "vq size %u head %u\n",
+			       i, vq->num, vq->last_avail_idx);
+			return -EINVAL;
+		}
+		ret = vhost_copy_from_user(vq, &desc, ring + i, sizeof desc);
+		if (unlikely(ret)) {
+			vq_err(vq, "Failed to get descriptor: idx %d addr %p\n",
+			       i, ring + i);
+			return -EFAULT;
+		}
+		id = le16_to_cpu(desc.id);
+		if (++i >= vq->num) {
+			i = 0;
+			wrap_counter ^= 1;
+		}
+
+		if (desc.flags & cpu_to_le16(VRING_DESC_F_INDIRECT)) {
+			ret = get_indirect_packed(vq, iov, iov_size,
+						  out_num, in_num,
+						  log, log_num, &desc);
+			if (unlikely(ret < 0)) {
+				if (ret != -EAGAIN)
+					vq_err(vq, "Failure detected "
+						"in indirect descriptor at idx %d\n", i);
+				return ret;
+			}
+			continue;
+		}
+
+		if (desc.flags & cpu_to_le16(VRING_DESC_F_WRITE))
+			access = VHOST_ACCESS_WO;
+		else
+			access = VHOST_ACCESS_RO;
+		ret = translate_desc(vq, le64_to_cpu(desc.addr),
+				     le32_to_cpu(desc.len), iov + iov_count,
+				     iov_size - iov_count, access);
+		if (unlikely(ret < 0)) {
+			if (ret != -EAGAIN)
+				vq_err(vq, "Translation failure %d descriptor idx %d\n",
+					ret, i);
+			return ret;
+		}
+		if (access == VHOST_ACCESS_WO) {
+			/* If this is an input descriptor,
+			 * increment that count. */
+			*in_num += ret;
+			if (unlikely(log)) {
+				log[*log_num].addr = le64_to_cpu(desc.addr);
+				log[*log_num].len = le32_to_cpu(desc.len);
+				++*log_num;
+			}
+		} else {
+			/* If it's an output descriptor, they're all supposed
+			 * to come before any input descriptors. */
+			if (unlikely(*in_num)) {
+				vq_err(vq, "Descriptor has out after in: "
+				       "idx %d\n", i);
+				return -EINVAL;
+			}
+			*out_num += ret;
+		}
+	} while (desc.flags & cpu_to_le16(VRING_DESC_F_NEXT));
+
+	/* If their number is silly, that's an error. */
+	if (unlikely(id >= vq->num)) {
+		vq_err(vq, "Guest says buffer id %u > %u is available",
+		       id, vq->num);
+		return -EINVAL;
+	}
+
+	/* On success, move past the chain and remember its length: the used
+	 * entry for this id then skips as many slots. */
+	vq->packed_slots[id] = found;
+	vq->packed_slots[vq->num + (vq->packed_fetched & (vq->num - 1))] = found;
+	vq->packed_fetched++;
+	vq->last_avail_idx = i;
+	vq->avail_wrap_counter = wrap_counter;
+
+	/* Assume notifications from guest are disabled at this point,
+	 * if they aren't we would need to update the device event. */
+	BUG_ON(!(vq->used_flags & VRING_USED_F_NO_NOTIFY));
+	return id;
+}
+
 /* This looks in the virtqueue and for the first available buffer, and converts
  * it to an iovec for convenient access.  Since descriptors consist of some
  * number of output then some number of input descriptors, it's actually two
@@ -2014,6 +2563,10 @@ int vhost_get_vq_desc(struct vhost_virtqueue *vq,
 	__virtio16 ring_head;
 	int ret, access;
 
+	if (vhost_packed_ring(vq))
+		return vhost_get_vq_desc_packed(vq, iov, iov_size, out_num,
+						in_num, log, log_num);
+
 	/* Check it isn't doing very strange things with descriptor numbers. */
 	last_avail_idx = vq->last_avail_idx;
 
@@ -2044,14 +2597,18 @@ int vhost_get_vq_desc(struct vhost_virtqueue *vq,
 	}
 
 	/* Grab the next descriptor number they're advertising, and increment
-	 * the index we've seen. */
-	if (unlikely(vhost_get_avail(vq, ring_head,
-		     &vq->avail->ring[last_avail_idx & (vq->num - 1)]))) {
+	 * the index we've seen.  Heads are read ahead in batches; entries
+	 * the guest has published can't change until we use them. */
+	if ((u16)(last_avail_idx - vq->avail_head_first) >=
+	    vq->avail_head_count &&
+	    unlikely(vhost_fetch_avail_heads(vq, last_avail_idx))) {
 		vq_err(vq, "Failed to read head: idx %d address %p\n",
 		       last_avail_idx,
 		       &vq->avail->ring[last_avail_idx % vq->num]);
 		return -EFAULT;
 	}
+	ring_head = vq->avail_heads[(u16)(last_avail_idx -
+					  vq->avail_head_first)];
 
 	head = vhost16_to_cpu(vq, ring_head);
 
@@ -2148,7 +2705,23 @@ EXPORT_SYMBOL_GPL(vhost_get_vq_desc);
 /* Reverse the effect of vhost_get_vq_desc. Useful for error handling. */
 void vhost_discard_vq_desc(struct vhost_virtqueue *vq, int n)
 {
-	vq->last_avail_idx -= n;
+	u16 slots;
+
+	if (!vhost_packed_ring(vq)) {
+		vq->last_avail_idx -= n;
+		return;
+	}
+
+	while (n--) {
+		vq->packed_fetched--;
+		slots = vq->packed_slots[vq->num +
+				(vq->packed_fetched & (vq->num - 1))];
+		if (vq->last_avail_idx < slots) {
+			vq->last_avail_idx += vq->num;
+			vq->avail_wrap_counter ^= 1;
+		}
+		vq->last_avail_idx -= slots;
+	}
 }
 EXPORT_SYMBOL_GPL(vhost_discard_vq_desc);
 
@@ -2208,6 +2781,66 @@ static int __vhost_add_used_n(struct vhost_virtqueue *vq,
 	return 0;
 }
 
+/* A used entry goes to the next used slot of the descriptor ring, its flags
+ * are written last since they hand the entry over to the guest. */
+static int vhost_add_used_n_packed(struct vhost_virtqueue *vq,
+				   struct vring_used_elem *heads,
+				   unsigned count)
+{
+	struct vring_packed_desc __user *used;
+	__le16 flags;
+	unsigned int i;
+	u32 id;
+
+	for (i = 0; i < count; i++) {
+		id = vhost32_to_cpu(vq, heads[i].id);
+		if (unlikely(id >= vq->num)) {
+			vq_err(vq, "Used id %u out of range\n", id);
+			return -EINVAL;
+		}
+		used = (struct vring_packed_desc __user *)vq->desc +
+		       vq->last_used_idx;
+		if (vhost_put_user(vq, cpu_to_le16(id), &used->id)) {
+			vq_err(vq, "Failed to write used id");
+			return -EFAULT;
+		}
+		if (vhost_put_user(vq, cpu_to_le32(vhost32_to_cpu(vq,
+							heads[i].len)),
+				   &used->len)) {
+			vq_err(vq, "Failed to write used len");
+			return -EFAULT;
+		}
+		if (vq->used_wrap_counter)
+			flags = cpu_to_le16(1 << VRING_PACKED_DESC_F_AVAIL |
+					    1 << VRING_PACKED_DESC_F_USED);
+		else
+			flags = 0;
+		/* Make sure buffer is written before we update the flags. */
+		smp_wmb();
+		if (vhost_put_user(vq, flags, &used->flags)) {
+			vq_err(vq, "Failed to write used flags");
+			return -EFAULT;
+		}
+		if (unlikely(vq->log_used)) {
+			/* Make sure data is seen before log. */
+			smp_wmb();
+			/* Log used descriptor write. */
+			log_write(vq->log_base,
+				  vq->log_addr +
+				   ((void __user *)used - (void __user *)vq->desc),
+				  sizeof *used);
+		}
+		vq->last_used_idx += vq->packed_slots[id];
+		if (vq->last_used_idx >= vq->num) {
+			vq->last_used_idx -= vq->num;
+			vq->used_wrap_counter ^= 1;
+		}
+	}
+	if (unlikely(vq->log_used) && vq->log_ctx)
+		eventfd_signal(vq->log_ctx, 1);
+	return 0;
+}
+
 /* After we've used one of their buffers, we tell them about it.  We'll then
  * want to notify the guest, using eventfd. */
 int vhost_add_used_n(struct vhost_virtqueue *vq, struct vring_used_elem *heads,
@@ -2215,6 +2848,9 @@ int vhost_add_used_n(struct vhost_virtqueue *vq, struct vring_used_elem *heads,
 {
 	int start, n, r;
 
+	if (vhost_packed_ring(vq))
+		return vhost_add_used_n_packed(vq, heads, count);
+
 	start = vq->last_used_idx & (vq->num - 1);
 	n = vq->num - start;
 	if (n < count) {
@@ -2245,12 +2881,61 @@ int vhost_add_used_n(struct vhost_virtqueue *vq, struct vring_used_elem *heads,
 }
 EXPORT_SYMBOL_GPL(vhost_add_used_n);
 
+static bool vhost_notify_packed(struct vhost_virtqueue *vq)
+{
+	struct vring_packed_desc_event __user *event = (void __user *)vq->avail;
+	__le16 flags, off_wrap;
+	u16 old, new, event_idx;
+	bool v;
+
+	/* Flush out used descriptor updates. This is paired
+	 * with the barrier that the Guest executes when enabling
+	 * interrupts. */
+	smp_mb();
+
+	if (vhost_get_avail(vq, flags, &event->flags)) {
+		vq_err(vq, "Failed to get driver event flags");
+		return true;
+	}
+
+	old = vq->signalled_used;
+	v = vq->signalled_used_valid;
+	new = vq->signalled_used = vq->last_used_idx;
+	vq->signalled_used_valid = true;
+
+	if (flags == cpu_to_le16(VRING_PACKED_EVENT_FLAG_DISABLE))
+		return false;
+	if (flags != cpu_to_le16(VRING_PACKED_EVENT_FLAG_DESC) ||
+	    !vhost_has_feature(vq, VIRTIO_RING_F_EVENT_IDX) || unlikely(!v))
+		return true;
+
+	if (vhost_get_avail(vq, off_wrap, &event->off_wrap)) {
+		vq_err(vq, "Failed to get driver event off_wrap");
+		return true;
+	}
+	event_idx = le16_to_cpu(off_wrap) &
+		    ~(1 << VRING_PACKED_EVENT_F_WRAP_CTR);
+
+	/* Ring positions become comparable indices once the ones from
+	 * the previous lap are taken back by num. */
+	if ((le16_to_cpu(off_wrap) >> VRING_PACKED_EVENT_F_WRAP_CTR) !=
+	    vq->used_wrap_counter)
+		event_idx -= vq->num;
+	if (new < old)
+		old -= vq->num;
+
+	return vring_need_event(event_idx, new, old);
+}
+
 static bool vhost_notify(struct vhost_dev *dev, struct vhost_virtqueue *vq)
 {
 	__u16 old, new;
 	__virtio16 event;
 	bool v;
 
+	if (vhost_packed_ring(vq))
+		return vhost_notify_packed(vq);
+
 	if (vhost_has_feature(vq, VIRTIO_F_NOTIFY_ON_EMPTY) &&
 	    unlikely(vq->avail_idx == vq->last_avail_idx))
 		return true;
@@ -2330,8 +3015,16 @@ EXPORT_SYMBOL_GPL(vhost_add_used_and_signal_n);
 bool vhost_vq_avail_empty(struct vhost_dev *dev, struct vhost_virtqueue *vq)
 {
 	__virtio16 avail_idx;
+	__le16 flags;
 	int r;
 
+	if (vhost_packed_ring(vq)) {
+		r = vhost_get_desc_flags_packed(vq, vq->last_avail_idx, &flags);
+		if (unlikely(r))
+			return false;
+		return !vhost_desc_avail_packed(flags, vq->avail_wrap_counter);
+	}
+
 	if (vq->avail_idx != vq->last_avail_idx)
 		return false;
 
@@ -2353,6 +3046,25 @@ bool vhost_enable_notify(struct vhost_dev *dev, struct vhost_virtqueue *vq)
 	if (!(vq->used_flags & VRING_USED_F_NO_NOTIFY))
 		return false;
 	vq->used_flags &= ~VRING_USED_F_NO_NOTIFY;
+	if (vhost_packed_ring(vq)) {
+		__le16 flags;
+
+		r = vhost_update_device_event(vq);
+		if (r) {
+			vq_err(vq, "Failed to enable notification at %p: %d\n",
+			       vq->used, r);
+			return false;
+		}
+		/* They could have slipped one in as we were doing that:
+		 * make sure it's written, then check again. */
+		smp_mb();
+		r = vhost_get_desc_flags_packed(vq, vq->last_avail_idx, &flags);
+		if (r) {
+			vq_err(vq, "Failed to check descriptor flags: %d\n", r);
+			return false;
+		}
+		return vhost_desc_avail_packed(flags, vq->avail_wrap_counter);
+	}
 	if (!vhost_has_feature(vq, VIRTIO_RING_F_EVENT_IDX)) {
 		r = vhost_update_used_flags(vq);
 		if (r) {
@@ -2390,6 +3102,13 @@ void vhost_disable_notify(struct vhost_dev *dev, struct vhost_virtqueue *vq)
 	if (vq->used_flags & VRING_USED_F_NO_NOTIFY)
 		return;
 	vq->used_flags |= VRING_USED_F_NO_NOTIFY;
+	if (vhost_packed_ring(vq)) {
+		r = vhost_update_device_event(vq);
+		if (r)
+			vq_err(vq, "Failed to disable notification at %p: %d\n",
+			       vq->used, r);
+		return;
+	}
 	if (!vhost_has_feature(vq, VIRTIO_RING_F_EVENT_IDX)) {
 		r = vhost_update_used_flags(vq);
 		if (r)
@@ -2442,11 +3161,14 @@ EXPORT_SYMBOL_GPL(vhost_dequeue_msg);
 
 static int __init vhost_init(void)
 {
+	if (shared_workers)
+		return vhost_shared_workers_start();
 	return 0;
 }
 
 static void __exit vhost_exit(void)
 {
+	vhost_shared_workers_stop();
 }
 
 module_init(vhost_init);
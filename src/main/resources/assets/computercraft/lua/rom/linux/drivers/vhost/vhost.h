@@ -83,6 +83,9 @@ enum vhost_uaddr_type {
 	VHOST_NUM_ADDRS = 3,
 };
 
+/* Avail ring heads read from the guest in one go */
+#define VHOST_AVAIL_BATCH 64
+
 /* The virtqueue structure describes a queue attached to a device. */
 struct vhost_virtqueue {
 	struct vhost_dev *dev;
@@ -112,9 +115,25 @@ struct vhost_virtqueue {
 	/* Caches available index value from user. */
 	u16 avail_idx;
 
+	/* Avail ring entries from avail_head_first on, read ahead of use. */
+	u16 avail_head_first;
+	u16 avail_head_count;
+	__virtio16 avail_heads[VHOST_AVAIL_BATCH];
+
 	/* Last index we used. */
 	u16 last_used_idx;
 
+	/* Packed ring: wrap counters going with last_avail_idx and
+	 * last_used_idx, which are then ring positions. */
+	bool avail_wrap_counter;
+	bool used_wrap_counter;
+
+	/* Packed ring: ring slots taken by each buffer id, followed by a
+	 * history of the slots taken by the last num buffers fetched, for
+	 * vhost_discard_vq_desc.  2 * num entries. */
+	u16 *packed_slots;
+	u16 packed_fetched;
+
 	/* Last used evet we've seen */
 	u16 last_used_event;
 
@@ -160,6 +179,14 @@ struct vhost_msg_node {
   struct list_head node;
 };
 
+/* A worker thread shared by several devices, see vhost_shared_worker() */
+struct vhost_shared_worker {
+	struct task_struct *task;
+	/* Devices with queued work, each on the list at most once */
+	struct llist_head dev_list;
+};
+
+#define VHOST_DEV_QUEUED 1
 struct vhost_dev {
 	struct mm_struct *mm;
 	struct mutex mutex;
@@ -169,6 +196,9 @@ struct vhost_dev {
 	struct eventfd_ctx *log_ctx;
 	struct llist_head work_list;
 	struct task_struct *worker;
+	struct vhost_shared_worker *shared;
+	struct llist_node shared_node;
+	unsigned long flags;
 	struct vhost_umem *umem;
 	struct vhost_umem *iotlb;
 	spinlock_t iotlb_lock;
@@ -239,7 +269,8 @@ enum {
 			 (1ULL << VIRTIO_RING_F_EVENT_IDX) |
 			 (1ULL << VHOST_F_LOG_ALL) |
 			 (1ULL << VIRTIO_F_ANY_LAYOUT) |
-			 (1ULL << VIRTIO_F_VERSION_1)
+			 (1ULL << VIRTIO_F_VERSION_1) |
+			 (1ULL << VIRTIO_F_RING_PACKED)
 };
 
 static inline bool vhost_has_feature(struct vhost_virtqueue *vq, int bit)
@@ -1649,7 +1649,7 @@ static long do_io_submit(aio_context_t ctx_id, long nr,
 		return -EINVAL;
 	}
 
-	blk_start_plug(&plug);
+	blk_start_plug_nr_ios(&plug, min_t(long, nr, USHRT_MAX));
 
 	/*
 	 * AKPM: should this return a partial result if some of the IOs were
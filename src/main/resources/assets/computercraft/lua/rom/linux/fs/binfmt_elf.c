@@ -40,10 +40,15 @@
 #include <linux/sched/cputime.h>
 #include <linux/cred.h>
 #include <linux/dax.h>
+#include <linux/hashtable.h>
+#include <linux/refcount.h>
+#include <linux/userfaultfd_k.h>
 #include <linux/uaccess.h>
 #include <asm/param.h>
 #include <asm/page.h>
 
+#include <trace/events/exec.h>
+
 #ifndef user_long_t
 #define user_long_t long
 #endif
@@ -341,6 +346,19 @@ create_elf_tables(struct linux_binprm *bprm, struct elfhdr *exec,
 	return 0;
 }
 
+static inline int make_prot(u32 p_flags)
+{
+	int prot = 0;
+
+	if (p_flags & PF_R)
+		prot |= PROT_READ;
+	if (p_flags & PF_W)
+		prot |= PROT_WRITE;
+	if (p_flags & PF_X)
+		prot |= PROT_EXEC;
+	return prot;
+}
+
 #ifndef elf_map
 
 static unsigned long elf_map(struct file *filep, unsigned long addr,
@@ -377,8 +395,131 @@ static unsigned long elf_map(struct file *filep, unsigned long addr,
 	return(map_addr);
 }
 
+/*
+ * The PT_LOAD segments of an image are mapped under one mmap_sem hold
+ * instead of taking it for every vm_mmap(), as long as nothing in between
+ * needs to touch user memory.
+ */
+struct elf_map_batch {
+	struct mm_struct *mm;
+	struct list_head uf;
+	bool locked;
+};
+
+static int elf_map_batch_begin(struct elf_map_batch *batch,
+			       struct file *filep, struct elf_phdr *phdrs,
+			       int nr, int type)
+{
+	int i, retval;
+
+	batch->mm = current->mm;
+	INIT_LIST_HEAD(&batch->uf);
+	batch->locked = false;
+
+	for (i = 0; i < nr; i++) {
+		if (phdrs[i].p_type != PT_LOAD)
+			continue;
+		retval = security_mmap_file(filep,
+					    make_prot(phdrs[i].p_flags), type);
+		if (retval)
+			return retval;
+	}
+
+	if (down_write_killable(&batch->mm->mmap_sem))
+		return -EINTR;
+	batch->locked = true;
+	return 0;
+}
+
+static void elf_map_batch_end(struct elf_map_batch *batch)
+{
+	if (!batch->locked)
+		return;
+	up_write(&batch->mm->mmap_sem);
+	userfaultfd_unmap_complete(batch->mm, &batch->uf);
+	batch->locked = false;
+}
+
+/* elf_map() for a batch, which falls back to it when not locked */
+static unsigned long elf_map_batch(struct elf_map_batch *batch,
+		struct file *filep, unsigned long addr,
+		struct elf_phdr *eppnt, int prot, int type,
+		unsigned long total_size)
+{
+	unsigned long map_addr, populate;
+	unsigned long size = eppnt->p_filesz + ELF_PAGEOFFSET(eppnt->p_vaddr);
+	unsigned long off = eppnt->p_offset - ELF_PAGEOFFSET(eppnt->p_vaddr);
+	unsigned long len;
+
+	if (!batch->locked)
+		return elf_map(filep, addr, eppnt, prot, type, total_size);
+
+	addr = ELF_PAGESTART(addr);
+	size = ELF_PAGEALIGN(size);
+	if (!size)
+		return addr;
+
+	len = total_size ? ELF_PAGEALIGN(total_size) : size;
+	if (unlikely(off + len < off) || unlikely(offset_in_page(off)))
+		return -EINVAL;
+
+	/* A fresh mm has no VM_LOCKED default, nothing gets populated */
+	map_addr = do_mmap_pgoff(filep, addr, len, prot, type,
+				 off >> PAGE_SHIFT, &populate, &batch->uf);
+	if (total_size && !BAD_ADDR(map_addr))
+		do_munmap(batch->mm, map_addr + size, len - size, &batch->uf);
+
+	return map_addr;
+}
+
+#else /* elf_map */
+
+struct elf_map_batch {
+	bool locked;
+};
+
+static int elf_map_batch_begin(struct elf_map_batch *batch,
+			       struct file *filep, struct elf_phdr *phdrs,
+			       int nr, int type)
+{
+	batch->locked = false;
+	return 0;
+}
+
+static void elf_map_batch_end(struct elf_map_batch *batch)
+{
+}
+
+static unsigned long elf_map_batch(struct elf_map_batch *batch,
+		struct file *filep, unsigned long addr,
+		struct elf_phdr *eppnt, int prot, int type,
+		unsigned long total_size)
+{
+	return elf_map(filep, addr, eppnt, prot, type, total_size);
+}
+
 #endif /* !elf_map */
 
+/*
+ * The bss of a PT_LOAD segment that is followed by more of them has to be
+ * cleared before mapping the rest, which rules out batching.
+ */
+static bool elf_has_inner_bss(struct elf_phdr *phdrs, int nr)
+{
+	bool bss = false;
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		if (phdrs[i].p_type != PT_LOAD)
+			continue;
+		if (bss)
+			return true;
+		if (phdrs[i].p_memsz > phdrs[i].p_filesz)
+			bss = true;
+	}
+	return false;
+}
+
 static unsigned long total_mapping_size(struct elf_phdr *cmds, int nr)
 {
 	int i, first_idx = -1, last_idx = -1;
@@ -397,21 +538,199 @@ static unsigned long total_mapping_size(struct elf_phdr *cmds, int nr)
 				ELF_PAGESTART(cmds[first_idx].p_vaddr);
 }
 
+/*
+ * Program headers and the PT_INTERP path of recently executed binaries
+ * (and of their interpreters), so that spawning the same program over
+ * and over doesn't go back to the file for them every time.  An entry
+ * is only used when the inode still looks the same as when it was
+ * filled in and the ELF header read by this exec matches the cached
+ * one; the file can't be written while it is being executed.
+ */
+#define ELF_PHDR_CACHE_BITS	6
+#define ELF_PHDR_CACHE_MAX	256
+
+struct elf_phdr_cache_entry {
+	struct hlist_node	hnode;
+	struct list_head	lru;
+	refcount_t		ref;
+	struct super_block	*sb;
+	unsigned long		ino;
+	u32			generation;
+	loff_t			size;
+	u64			version;
+	struct timespec		mtime;
+	struct timespec		ctime;
+	struct elfhdr		ehdr;
+	char			*interp;	/* NULL if none */
+	unsigned int		interp_len;
+	struct elf_phdr		phdrs[];
+};
+
+static DEFINE_SPINLOCK(elf_phdr_cache_lock);
+static DEFINE_HASHTABLE(elf_phdr_cache, ELF_PHDR_CACHE_BITS);
+static LIST_HEAD(elf_phdr_cache_lru);
+static unsigned int elf_phdr_cache_nr;
+
+static inline u32 elf_phdr_cache_hash(struct inode *inode)
+{
+	return hash_ptr(inode->i_sb, 32) ^ inode->i_ino;
+}
+
+static bool elf_phdr_cache_match(struct elf_phdr_cache_entry *e,
+				 struct inode *inode, struct elfhdr *elf_ex)
+{
+	return e->sb == inode->i_sb && e->ino == inode->i_ino &&
+		e->generation == inode->i_generation &&
+		e->size == i_size_read(inode) &&
+		e->version == inode->i_version &&
+		timespec_equal(&e->mtime, &inode->i_mtime) &&
+		timespec_equal(&e->ctime, &inode->i_ctime) &&
+		!memcmp(&e->ehdr, elf_ex, sizeof(*elf_ex));
+}
+
+static void elf_phdr_cache_put(struct elf_phdr_cache_entry *e)
+{
+	if (refcount_dec_and_test(&e->ref))
+		kfree(e);
+}
+
+static struct elf_phdr_cache_entry *
+elf_phdr_cache_lookup(struct inode *inode, struct elfhdr *elf_ex)
+{
+	struct elf_phdr_cache_entry *e;
+
+	spin_lock(&elf_phdr_cache_lock);
+	hash_for_each_possible(elf_phdr_cache, e, hnode,
+			       elf_phdr_cache_hash(inode)) {
+		if (elf_phdr_cache_match(e, inode, elf_ex)) {
+			refcount_inc(&e->ref);
+			list_move(&e->lru, &elf_phdr_cache_lru);
+			spin_unlock(&elf_phdr_cache_lock);
+			return e;
+		}
+	}
+	spin_unlock(&elf_phdr_cache_lock);
+	return NULL;
+}
+
+static void elf_phdr_cache_insert(struct inode *inode, struct elfhdr *elf_ex,
+				  struct elf_phdr *phdrs, const char *interp)
+{
+	struct elf_phdr_cache_entry *e, *old = NULL, *victim = NULL;
+	unsigned int size = sizeof(struct elf_phdr) * elf_ex->e_phnum;
+	unsigned int interp_len = interp ? strlen(interp) + 1 : 0;
+	u32 hash = elf_phdr_cache_hash(inode);
+
+	e = kmalloc(sizeof(*e) + size + interp_len, GFP_KERNEL);
+	if (!e)
+		return;
+
+	refcount_set(&e->ref, 1);
+	e->sb = inode->i_sb;
+	e->ino = inode->i_ino;
+	e->generation = inode->i_generation;
+	e->size = i_size_read(inode);
+	e->version = inode->i_version;
+	e->mtime = inode->i_mtime;
+	e->ctime = inode->i_ctime;
+	e->ehdr = *elf_ex;
+	memcpy(e->phdrs, phdrs, size);
+	e->interp = NULL;
+	e->interp_len = interp_len;
+	if (interp) {
+		e->interp = (char *)e->phdrs + size;
+		memcpy(e->interp, interp, interp_len);
+	}
+
+	spin_lock(&elf_phdr_cache_lock);
+	hash_for_each_possible(elf_phdr_cache, old, hnode, hash) {
+		if (old->sb == e->sb && old->ino == e->ino)
+			break;
+	}
+	if (old) {
+		/* Stale left-over of an earlier version of the file */
+		hash_del(&old->hnode);
+		list_del(&old->lru);
+		elf_phdr_cache_nr--;
+	} else if (elf_phdr_cache_nr >= ELF_PHDR_CACHE_MAX) {
+		victim = list_last_entry(&elf_phdr_cache_lru,
+					 struct elf_phdr_cache_entry, lru);
+		hash_del(&victim->hnode);
+		list_del(&victim->lru);
+		elf_phdr_cache_nr--;
+	}
+	hash_add(elf_phdr_cache, &e->hnode, hash);
+	list_add(&e->lru, &elf_phdr_cache_lru);
+	elf_phdr_cache_nr++;
+	spin_unlock(&elf_phdr_cache_lock);
+
+	if (old)
+		elf_phdr_cache_put(old);
+	if (victim)
+		elf_phdr_cache_put(victim);
+}
+
+/*
+ * Read the path of the first PT_INTERP header into a new buffer.  Returns
+ * NULL if there is none, an ERR_PTR if the header is bogus.
+ */
+static char *read_elf_interp(struct elfhdr *elf_ex, struct elf_phdr *phdrs,
+			     struct file *elf_file)
+{
+	struct elf_phdr *elf_ppnt = phdrs;
+	char *interp;
+	int i, retval;
+
+	for (i = 0; i < elf_ex->e_phnum; i++, elf_ppnt++)
+		if (elf_ppnt->p_type == PT_INTERP)
+			break;
+	if (i == elf_ex->e_phnum)
+		return NULL;
+
+	if (elf_ppnt->p_filesz > PATH_MAX || elf_ppnt->p_filesz < 2)
+		return ERR_PTR(-ENOEXEC);
+
+	interp = kmalloc(elf_ppnt->p_filesz, GFP_KERNEL);
+	if (!interp)
+		return ERR_PTR(-ENOMEM);
+
+	retval = kernel_read(elf_file, elf_ppnt->p_offset, interp,
+			     elf_ppnt->p_filesz);
+	if (retval != elf_ppnt->p_filesz) {
+		kfree(interp);
+		return ERR_PTR(retval < 0 ? retval : -EIO);
+	}
+	/* make sure path is NULL terminated */
+	if (interp[elf_ppnt->p_filesz - 1] != '\0') {
+		kfree(interp);
+		return ERR_PTR(-ENOEXEC);
+	}
+	return interp;
+}
+
 /**
  * load_elf_phdrs() - load ELF program headers
  * @elf_ex:   ELF header of the binary whose program headers should be loaded
  * @elf_file: the opened ELF binary file
+ * @interp:   if not NULL, set to a newly allocated copy of the PT_INTERP path
+ *            when it is known, or to NULL
  *
  * Loads ELF program headers from the binary file elf_file, which has the ELF
  * header pointed to by elf_ex, into a newly allocated array. The caller is
  * responsible for freeing the allocated data. Returns an ERR_PTR upon failure.
  */
 static struct elf_phdr *load_elf_phdrs(struct elfhdr *elf_ex,
-				       struct file *elf_file)
+				       struct file *elf_file, char **interp)
 {
+	struct inode *inode = file_inode(elf_file);
+	struct elf_phdr_cache_entry *e;
 	struct elf_phdr *elf_phdata = NULL;
+	char *elf_interp;
 	int retval, size, err = -1;
 
+	if (interp)
+		*interp = NULL;
+
 	/*
 	 * If the size of this structure has changed, then punt, since
 	 * we will be doing the wrong thing.
@@ -433,6 +752,18 @@ static struct elf_phdr *load_elf_phdrs(struct elfhdr *elf_ex,
 	if (!elf_phdata)
 		goto out;
 
+	e = elf_phdr_cache_lookup(inode, elf_ex);
+	trace_elf_phdr_cache(inode, e);
+	if (e) {
+		memcpy(elf_phdata, e->phdrs, size);
+		if (interp && e->interp)
+			*interp = kmemdup(e->interp, e->interp_len,
+					  GFP_KERNEL);
+		elf_phdr_cache_put(e);
+		err = 0;
+		goto out;
+	}
+
 	/* Read in the program headers */
 	retval = kernel_read(elf_file, elf_ex->e_phoff,
 			     (char *)elf_phdata, size);
@@ -441,6 +772,19 @@ static struct elf_phdr *load_elf_phdrs(struct elfhdr *elf_ex,
 		goto out;
 	}
 
+	/*
+	 * A bogus PT_INTERP isn't cached, the caller reads it again and
+	 * fails the exec.
+	 */
+	elf_interp = read_elf_interp(elf_ex, elf_phdata, elf_file);
+	if (!IS_ERR(elf_interp)) {
+		elf_phdr_cache_insert(inode, elf_ex, elf_phdata, elf_interp);
+		if (interp)
+			*interp = elf_interp;
+		else
+			kfree(elf_interp);
+	}
+
 	/* Success! */
 	err = 0;
 out:
@@ -531,6 +875,7 @@ static unsigned long load_elf_interp(struct elfhdr *interp_elf_ex,
 		unsigned long no_base, struct elf_phdr *interp_elf_phdata)
 {
 	struct elf_phdr *eppnt;
+	struct elf_map_batch batch;
 	unsigned long load_addr = 0;
 	int load_addr_set = 0;
 	unsigned long last_bss = 0, elf_bss = 0;
@@ -555,34 +900,36 @@ static unsigned long load_elf_interp(struct elfhdr *interp_elf_ex,
 		goto out;
 	}
 
+	/* The bss is only cleared after the loop, always batch */
+	error = elf_map_batch_begin(&batch, interpreter, interp_elf_phdata,
+				    interp_elf_ex->e_phnum,
+				    MAP_PRIVATE | MAP_DENYWRITE);
+	if (error)
+		goto out;
+
 	eppnt = interp_elf_phdata;
 	for (i = 0; i < interp_elf_ex->e_phnum; i++, eppnt++) {
 		if (eppnt->p_type == PT_LOAD) {
 			int elf_type = MAP_PRIVATE | MAP_DENYWRITE;
-			int elf_prot = 0;
+			int elf_prot = make_prot(eppnt->p_flags);
 			unsigned long vaddr = 0;
 			unsigned long k, map_addr;
 
-			if (eppnt->p_flags & PF_R)
-		    		elf_prot = PROT_READ;
-			if (eppnt->p_flags & PF_W)
-				elf_prot |= PROT_WRITE;
-			if (eppnt->p_flags & PF_X)
-				elf_prot |= PROT_EXEC;
 			vaddr = eppnt->p_vaddr;
 			if (interp_elf_ex->e_type == ET_EXEC || load_addr_set)
 				elf_type |= MAP_FIXED;
 			else if (no_base && interp_elf_ex->e_type == ET_DYN)
 				load_addr = -vaddr;
 
-			map_addr = elf_map(interpreter, load_addr + vaddr,
-					eppnt, elf_prot, elf_type, total_size);
+			map_addr = elf_map_batch(&batch, interpreter,
+					load_addr + vaddr, eppnt, elf_prot,
+					elf_type, total_size);
 			total_size = 0;
 			if (!*interp_map_addr)
 				*interp_map_addr = map_addr;
 			error = map_addr;
 			if (BAD_ADDR(map_addr))
-				goto out;
+				goto out_end_batch;
 
 			if (!load_addr_set &&
 			    interp_elf_ex->e_type == ET_DYN) {
@@ -601,7 +948,7 @@ static unsigned long load_elf_interp(struct elfhdr *interp_elf_ex,
 			    eppnt->p_memsz > TASK_SIZE ||
 			    TASK_SIZE - eppnt->p_memsz < k) {
 				error = -ENOMEM;
-				goto out;
+				goto out_end_batch;
 			}
 
 			/*
@@ -623,6 +970,7 @@ static unsigned long load_elf_interp(struct elfhdr *interp_elf_ex,
 			}
 		}
 	}
+	elf_map_batch_end(&batch);
 
 	/*
 	 * Now fill out the bss section: first pad the last page from
@@ -651,6 +999,10 @@ static unsigned long load_elf_interp(struct elfhdr *interp_elf_ex,
 	error = load_addr;
 out:
 	return error;
+
+out_end_batch:
+	elf_map_batch_end(&batch);
+	return error;
 }
 
 /*
@@ -687,6 +1039,7 @@ static int load_elf_binary(struct linux_binprm *bprm)
 	char * elf_interpreter = NULL;
 	unsigned long error;
 	struct elf_phdr *elf_ppnt, *elf_phdata, *interp_elf_phdata = NULL;
+	struct elf_map_batch batch = { .locked = false };
 	unsigned long elf_bss, elf_brk;
 	int bss_prot = 0;
 	int retval, i;
@@ -723,7 +1076,7 @@ static int load_elf_binary(struct linux_binprm *bprm)
 	if (!bprm->file->f_op->mmap)
 		goto out;
 
-	elf_phdata = load_elf_phdrs(&loc->elf_ex, bprm->file);
+	elf_phdata = load_elf_phdrs(&loc->elf_ex, bprm->file, &elf_interpreter);
 	if (!elf_phdata)
 		goto out;
 
@@ -736,61 +1089,43 @@ static int load_elf_binary(struct linux_binprm *bprm)
 	start_data = 0;
 	end_data = 0;
 
-	for (i = 0; i < loc->elf_ex.e_phnum; i++) {
-		if (elf_ppnt->p_type == PT_INTERP) {
-			/* This is the program interpreter used for
-			 * shared libraries - for now assume that this
-			 * is an a.out format binary
-			 */
-			retval = -ENOEXEC;
-			if (elf_ppnt->p_filesz > PATH_MAX || 
-			    elf_ppnt->p_filesz < 2)
-				goto out_free_ph;
-
-			retval = -ENOMEM;
-			elf_interpreter = kmalloc(elf_ppnt->p_filesz,
-						  GFP_KERNEL);
-			if (!elf_interpreter)
-				goto out_free_ph;
-
-			retval = kernel_read(bprm->file, elf_ppnt->p_offset,
-					     elf_interpreter,
-					     elf_ppnt->p_filesz);
-			if (retval != elf_ppnt->p_filesz) {
-				if (retval >= 0)
-					retval = -EIO;
-				goto out_free_interp;
-			}
-			/* make sure path is NULL terminated */
-			retval = -ENOEXEC;
-			if (elf_interpreter[elf_ppnt->p_filesz - 1] != '\0')
-				goto out_free_interp;
-
-			interpreter = open_exec(elf_interpreter);
-			retval = PTR_ERR(interpreter);
-			if (IS_ERR(interpreter))
-				goto out_free_interp;
+	/*
+	 * This is the program interpreter used for shared libraries - for
+	 * now assume that this is an a.out format binary.  Normally
+	 * load_elf_phdrs() found it already.
+	 */
+	if (!elf_interpreter) {
+		elf_interpreter = read_elf_interp(&loc->elf_ex, elf_phdata,
+						  bprm->file);
+		if (IS_ERR(elf_interpreter)) {
+			retval = PTR_ERR(elf_interpreter);
+			elf_interpreter = NULL;
+			goto out_free_ph;
+		}
+	}
 
-			/*
-			 * If the binary is not readable then enforce
-			 * mm->dumpable = 0 regardless of the interpreter's
-			 * permissions.
-			 */
-			would_dump(bprm, interpreter);
-
-			/* Get the exec headers */
-			retval = kernel_read(interpreter, 0,
-					     (void *)&loc->interp_elf_ex,
-					     sizeof(loc->interp_elf_ex));
-			if (retval != sizeof(loc->interp_elf_ex)) {
-				if (retval >= 0)
-					retval = -EIO;
-				goto out_free_dentry;
-			}
+	if (elf_interpreter) {
+		interpreter = open_exec(elf_interpreter);
+		retval = PTR_ERR(interpreter);
+		if (IS_ERR(interpreter))
+			goto out_free_interp;
 
-			break;
+		/*
+		 * If the binary is not readable then enforce
+		 * mm->dumpable = 0 regardless of the interpreter's
+		 * permissions.
+		 */
+		would_dump(bprm, interpreter);
+
+		/* Get the exec headers */
+		retval = kernel_read(interpreter, 0,
+				     (void *)&loc->interp_elf_ex,
+				     sizeof(loc->interp_elf_ex));
+		if (retval != sizeof(loc->interp_elf_ex)) {
+			if (retval >= 0)
+				retval = -EIO;
+			goto out_free_dentry;
 		}
-		elf_ppnt++;
 	}
 
 	elf_ppnt = elf_phdata;
@@ -824,7 +1159,7 @@ static int load_elf_binary(struct linux_binprm *bprm)
 
 		/* Load the interpreter program headers */
 		interp_elf_phdata = load_elf_phdrs(&loc->interp_elf_ex,
-						   interpreter);
+						   interpreter, NULL);
 		if (!interp_elf_phdata)
 			goto out_free_dentry;
 
@@ -841,6 +1176,7 @@ static int load_elf_binary(struct linux_binprm *bprm)
 				break;
 			}
 	}
+	exec_phase_end(bprm, EXEC_PHASE_HEADERS);
 
 	/*
 	 * Allow arch code to reject the ELF at this point, whilst it's
@@ -857,6 +1193,7 @@ static int load_elf_binary(struct linux_binprm *bprm)
 	retval = flush_old_exec(bprm);
 	if (retval)
 		goto out_free_dentry;
+	exec_phase_end(bprm, EXEC_PHASE_FLUSH);
 
 	/* Do this immediately, since STACK_TOP as used in setup_arg_pages
 	   may depend on the personality.  */
@@ -878,12 +1215,21 @@ static int load_elf_binary(struct linux_binprm *bprm)
 		goto out_free_dentry;
 	
 	current->mm->start_stack = bprm->p;
+	exec_phase_end(bprm, EXEC_PHASE_SETUP);
 
 	/* Now we do a little grungy work by mmapping the ELF image into
 	   the correct location in memory. */
+	if (!elf_has_inner_bss(elf_phdata, loc->elf_ex.e_phnum)) {
+		retval = elf_map_batch_begin(&batch, bprm->file, elf_phdata,
+					     loc->elf_ex.e_phnum,
+					     MAP_PRIVATE | MAP_DENYWRITE |
+					     MAP_EXECUTABLE);
+		if (retval)
+			goto out_free_dentry;
+	}
 	for(i = 0, elf_ppnt = elf_phdata;
 	    i < loc->elf_ex.e_phnum; i++, elf_ppnt++) {
-		int elf_prot = 0, elf_flags;
+		int elf_prot, elf_flags;
 		unsigned long k, vaddr;
 		unsigned long total_size = 0;
 
@@ -900,7 +1246,7 @@ static int load_elf_binary(struct linux_binprm *bprm)
 					 elf_brk + load_bias,
 					 bss_prot);
 			if (retval)
-				goto out_free_dentry;
+				goto out_end_batch;
 			nbyte = ELF_PAGEOFFSET(elf_bss);
 			if (nbyte) {
 				nbyte = ELF_MIN_ALIGN - nbyte;
@@ -917,12 +1263,7 @@ static int load_elf_binary(struct linux_binprm *bprm)
 			}
 		}
 
-		if (elf_ppnt->p_flags & PF_R)
-			elf_prot |= PROT_READ;
-		if (elf_ppnt->p_flags & PF_W)
-			elf_prot |= PROT_WRITE;
-		if (elf_ppnt->p_flags & PF_X)
-			elf_prot |= PROT_EXEC;
+		elf_prot = make_prot(elf_ppnt->p_flags);
 
 		elf_flags = MAP_PRIVATE | MAP_DENYWRITE | MAP_EXECUTABLE;
 
@@ -942,16 +1283,17 @@ static int load_elf_binary(struct linux_binprm *bprm)
 							loc->elf_ex.e_phnum);
 			if (!total_size) {
 				retval = -EINVAL;
-				goto out_free_dentry;
+				goto out_end_batch;
 			}
 		}
 
-		error = elf_map(bprm->file, load_bias + vaddr, elf_ppnt,
-				elf_prot, elf_flags, total_size);
+		error = elf_map_batch(&batch, bprm->file, load_bias + vaddr,
+				      elf_ppnt, elf_prot, elf_flags,
+				      total_size);
 		if (BAD_ADDR(error)) {
 			retval = IS_ERR((void *)error) ?
 				PTR_ERR((void*)error) : -EINVAL;
-			goto out_free_dentry;
+			goto out_end_batch;
 		}
 
 		if (!load_addr_set) {
@@ -980,7 +1322,7 @@ static int load_elf_binary(struct linux_binprm *bprm)
 		    TASK_SIZE - elf_ppnt->p_memsz < k) {
 			/* set_brk can never work. Avoid overflows. */
 			retval = -EINVAL;
-			goto out_free_dentry;
+			goto out_end_batch;
 		}
 
 		k = elf_ppnt->p_vaddr + elf_ppnt->p_filesz;
@@ -997,6 +1339,7 @@ static int load_elf_binary(struct linux_binprm *bprm)
 			elf_brk = k;
 		}
 	}
+	elf_map_batch_end(&batch);
 
 	loc->elf_ex.e_entry += load_bias;
 	elf_bss += load_bias;
@@ -1018,6 +1361,7 @@ static int load_elf_binary(struct linux_binprm *bprm)
 		retval = -EFAULT; /* Nobody gets to see this, but.. */
 		goto out_free_dentry;
 	}
+	exec_phase_end(bprm, EXEC_PHASE_MAP);
 
 	if (elf_interpreter) {
 		unsigned long interp_map_addr = 0;
@@ -1040,6 +1384,7 @@ static int load_elf_binary(struct linux_binprm *bprm)
 			goto out_free_dentry;
 		}
 		reloc_func_desc = interp_load_addr;
+		exec_phase_end(bprm, EXEC_PHASE_INTERP);
 
 		allow_write_access(interpreter);
 		fput(interpreter);
@@ -1113,6 +1458,8 @@ out_ret:
 	return retval;
 
 	/* error cleanup */
+out_end_batch:
+	elf_map_batch_end(&batch);
 out_free_dentry:
 	kfree(interp_elf_phdata);
 	allow_write_access(interpreter);
@@ -703,6 +703,17 @@ struct btrfs_delayed_root;
 #define BTRFS_FS_LOG1_ERR			12
 #define BTRFS_FS_LOG2_ERR			13
 
+/*
+ * Slow path statistics of the extent buffer locks, indexed by tree level.
+ * A lock attempt counts once if it had to spin on or sleep for a holder.
+ */
+struct btrfs_tree_lock_stats {
+	atomic64_t read_contended[BTRFS_MAX_LEVEL];
+	atomic64_t read_wait_ns[BTRFS_MAX_LEVEL];
+	atomic64_t write_contended[BTRFS_MAX_LEVEL];
+	atomic64_t write_wait_ns[BTRFS_MAX_LEVEL];
+};
+
 struct btrfs_fs_info {
 	u8 fsid[BTRFS_FSID_SIZE];
 	u8 chunk_tree_uuid[BTRFS_UUID_SIZE];
@@ -1097,6 +1108,8 @@ struct btrfs_fs_info {
 	u32 nodesize;
 	u32 sectorsize;
 	u32 stripesize;
+
+	struct btrfs_tree_lock_stats tree_lock_stats;
 };
 
 static inline struct btrfs_fs_info *btrfs_sb(struct super_block *sb)
@@ -26,6 +26,7 @@
 #include "volumes.h"
 #include "print-tree.h"
 #include "compression.h"
+#include "hash.h"
 
 #define __MAX_CSUM_ITEMS(r, size) ((unsigned long)(((BTRFS_LEAF_DATA_SIZE(r) - \
 				   sizeof(struct btrfs_item) * 2) / \
@@ -443,6 +444,7 @@ int btrfs_csum_one_bio(struct inode *inode, struct bio *bio,
 	struct bio_vec *bvec;
 	int index;
 	int nr_sectors;
+	int run;
 	int i, j;
 	unsigned long total_bytes = 0;
 	unsigned long this_sum_bytes = 0;
@@ -480,7 +482,7 @@ int btrfs_csum_one_bio(struct inode *inode, struct bio *bio,
 						 bvec->bv_len + fs_info->sectorsize
 						 - 1);
 
-		for (i = 0; i < nr_sectors; i++) {
+		for (i = 0; i < nr_sectors; i += run) {
 			if (offset >= ordered->file_offset + ordered->len ||
 				offset < ordered->file_offset) {
 				unsigned long bytes_left;
@@ -507,18 +509,22 @@ int btrfs_csum_one_bio(struct inode *inode, struct bio *bio,
 				data = kmap_atomic(bvec->bv_page);
 			}
 
-			sums->sums[index] = ~(u32)0;
-			sums->sums[index]
-				= btrfs_csum_data(data + bvec->bv_offset
-						+ (i * fs_info->sectorsize),
-						sums->sums[index],
-						fs_info->sectorsize);
-			btrfs_csum_final(sums->sums[index],
-					(char *)(sums->sums + index));
-			index++;
-			offset += fs_info->sectorsize;
-			this_sum_bytes += fs_info->sectorsize;
-			total_bytes += fs_info->sectorsize;
+			/*
+			 * Checksum all sectors of this segment that belong to
+			 * the current ordered extent in one go.
+			 */
+			run = min_t(u64, nr_sectors - i,
+				    BTRFS_BYTES_TO_BLKS(fs_info,
+					ordered->file_offset + ordered->len -
+					offset));
+			btrfs_csum_sectors(data + bvec->bv_offset +
+					   (i * fs_info->sectorsize),
+					   run, fs_info->sectorsize,
+					   (u8 *)(sums->sums + index));
+			index += run;
+			offset += run * fs_info->sectorsize;
+			this_sum_bytes += run * fs_info->sectorsize;
+			total_bytes += run * fs_info->sectorsize;
 		}
 
 		kunmap_atomic(data);
@@ -49,3 +49,28 @@ u32 btrfs_crc32c(u32 crc, const void *address, unsigned int length)
 
 	return *ctx;
 }
+
+/*
+ * Compute the final, on-disk checksums of @nr_sectors consecutive sectors
+ * starting at @data and store them back to back in @csums.  This is what
+ * btrfs_csum_data() followed by btrfs_csum_final() gives for each sector,
+ * with one descriptor set up for the whole run.
+ */
+void btrfs_csum_sectors(const u8 *data, unsigned int nr_sectors,
+			unsigned int sectorsize, u8 *csums)
+{
+	SHASH_DESC_ON_STACK(shash, tfm);
+	unsigned int csum_size = crypto_shash_digestsize(tfm);
+	unsigned int i;
+	int err;
+
+	shash->tfm = tfm;
+	shash->flags = 0;
+
+	for (i = 0; i < nr_sectors; i++) {
+		err = crypto_shash_digest(shash, data, sectorsize, csums);
+		BUG_ON(err);
+		data += sectorsize;
+		csums += csum_size;
+	}
+}
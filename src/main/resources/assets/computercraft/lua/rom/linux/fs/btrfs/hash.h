@@ -25,6 +25,8 @@ void btrfs_hash_exit(void);
 const char* btrfs_crc32c_impl(void);
 
 u32 btrfs_crc32c(u32 crc, const void *address, unsigned int length);
+void btrfs_csum_sectors(const u8 *data, unsigned int nr_sectors,
+			unsigned int sectorsize, u8 *csums);
 
 static inline u64 btrfs_name_hash(const char *name, int len)
 {
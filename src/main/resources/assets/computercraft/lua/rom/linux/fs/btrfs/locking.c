@@ -17,7 +17,7 @@
  */
 #include <linux/sched.h>
 #include <linux/pagemap.h>
-#include <linux/spinlock.h>
+#include <linux/rwsem.h>
 #include <linux/page-flags.h>
 #include <asm/bug.h>
 #include "ctree.h"
@@ -27,89 +27,43 @@
 static void btrfs_assert_tree_read_locked(struct extent_buffer *eb);
 
 /*
- * if we currently have a spinning reader or writer lock
- * (indicated by the rw flag) this will bump the count
- * of blocking holders and drop the spinlock.
+ * Account a lock attempt on @eb that did not get the lock right away and
+ * started waiting at @start.
  */
-void btrfs_set_lock_blocking_rw(struct extent_buffer *eb, int rw)
+static void btrfs_tree_lock_waited(struct extent_buffer *eb, int write,
+				   u64 start)
 {
-	/*
-	 * no lock is required.  The lock owner may change if
-	 * we have a read lock, but it won't change to or away
-	 * from us.  If we have the write lock, we are the owner
-	 * and it'll never change.
-	 */
-	if (eb->lock_nested && current->pid == eb->lock_owner)
-		return;
-	if (rw == BTRFS_WRITE_LOCK) {
-		if (atomic_read(&eb->blocking_writers) == 0) {
-			WARN_ON(atomic_read(&eb->spinning_writers) != 1);
-			atomic_dec(&eb->spinning_writers);
-			btrfs_assert_tree_locked(eb);
-			atomic_inc(&eb->blocking_writers);
-			write_unlock(&eb->lock);
-		}
-	} else if (rw == BTRFS_READ_LOCK) {
-		btrfs_assert_tree_read_locked(eb);
-		atomic_inc(&eb->blocking_readers);
-		WARN_ON(atomic_read(&eb->spinning_readers) == 0);
-		atomic_dec(&eb->spinning_readers);
-		read_unlock(&eb->lock);
-	}
-}
+	struct btrfs_tree_lock_stats *stats;
+	u64 delta = ktime_get_ns() - start;
+	int level;
 
-/*
- * if we currently have a blocking lock, take the spinlock
- * and drop our blocking count
- */
-void btrfs_clear_lock_blocking_rw(struct extent_buffer *eb, int rw)
-{
-	/*
-	 * no lock is required.  The lock owner may change if
-	 * we have a read lock, but it won't change to or away
-	 * from us.  If we have the write lock, we are the owner
-	 * and it'll never change.
-	 */
-	if (eb->lock_nested && current->pid == eb->lock_owner)
+	if (!eb->fs_info)
+		return;
+	/* buffers being initialized don't carry a valid level yet */
+	level = btrfs_header_level(eb);
+	if (level >= BTRFS_MAX_LEVEL)
 		return;
 
-	if (rw == BTRFS_WRITE_LOCK_BLOCKING) {
-		BUG_ON(atomic_read(&eb->blocking_writers) != 1);
-		write_lock(&eb->lock);
-		WARN_ON(atomic_read(&eb->spinning_writers));
-		atomic_inc(&eb->spinning_writers);
-		/*
-		 * atomic_dec_and_test implies a barrier for waitqueue_active
-		 */
-		if (atomic_dec_and_test(&eb->blocking_writers) &&
-		    waitqueue_active(&eb->write_lock_wq))
-			wake_up(&eb->write_lock_wq);
-	} else if (rw == BTRFS_READ_LOCK_BLOCKING) {
-		BUG_ON(atomic_read(&eb->blocking_readers) == 0);
-		read_lock(&eb->lock);
-		atomic_inc(&eb->spinning_readers);
-		/*
-		 * atomic_dec_and_test implies a barrier for waitqueue_active
-		 */
-		if (atomic_dec_and_test(&eb->blocking_readers) &&
-		    waitqueue_active(&eb->read_lock_wq))
-			wake_up(&eb->read_lock_wq);
+	stats = &eb->fs_info->tree_lock_stats;
+	if (write) {
+		atomic64_inc(&stats->write_contended[level]);
+		atomic64_add(delta, &stats->write_wait_ns[level]);
+	} else {
+		atomic64_inc(&stats->read_contended[level]);
+		atomic64_add(delta, &stats->read_wait_ns[level]);
 	}
 }
 
 /*
- * take a spinning read lock.  This will wait for any blocking
- * writers
+ * take a read lock.  Contended readers spin while the writer holding
+ * the lock is running and sleep once it blocks, see rwsem_optimistic_spin().
  */
-void btrfs_tree_read_lock(struct extent_buffer *eb)
+void __btrfs_tree_read_lock(struct extent_buffer *eb,
+			    enum btrfs_lock_nesting nest)
 {
-again:
-	BUG_ON(!atomic_read(&eb->blocking_writers) &&
-	       current->pid == eb->lock_owner);
+	u64 start;
 
-	read_lock(&eb->lock);
-	if (atomic_read(&eb->blocking_writers) &&
-	    current->pid == eb->lock_owner) {
+	if (eb->lock_owner == current->pid) {
 		/*
 		 * This extent is already write-locked by our thread. We allow
 		 * an additional read lock to be added because it's for the same
@@ -118,84 +72,38 @@ again:
 		 */
 		BUG_ON(eb->lock_nested);
 		eb->lock_nested = 1;
-		read_unlock(&eb->lock);
 		return;
 	}
-	if (atomic_read(&eb->blocking_writers)) {
-		read_unlock(&eb->lock);
-		wait_event(eb->write_lock_wq,
-			   atomic_read(&eb->blocking_writers) == 0);
-		goto again;
-	}
-	atomic_inc(&eb->read_locks);
-	atomic_inc(&eb->spinning_readers);
-}
-
-/*
- * take a spinning read lock.
- * returns 1 if we get the read lock and 0 if we don't
- * this won't wait for blocking writers
- */
-int btrfs_tree_read_lock_atomic(struct extent_buffer *eb)
-{
-	if (atomic_read(&eb->blocking_writers))
-		return 0;
-
-	read_lock(&eb->lock);
-	if (atomic_read(&eb->blocking_writers)) {
-		read_unlock(&eb->lock);
-		return 0;
-	}
-	atomic_inc(&eb->read_locks);
-	atomic_inc(&eb->spinning_readers);
-	return 1;
+	if (down_read_trylock(&eb->lock))
+		return;
+	start = ktime_get_ns();
+	down_read_nested(&eb->lock, nest);
+	btrfs_tree_lock_waited(eb, 0, start);
 }
 
 /*
  * returns 1 if we get the read lock and 0 if we don't
- * this won't wait for blocking writers
+ * this won't wait for writers
  */
 int btrfs_try_tree_read_lock(struct extent_buffer *eb)
 {
-	if (atomic_read(&eb->blocking_writers))
-		return 0;
-
-	if (!read_trylock(&eb->lock))
-		return 0;
-
-	if (atomic_read(&eb->blocking_writers)) {
-		read_unlock(&eb->lock);
-		return 0;
-	}
-	atomic_inc(&eb->read_locks);
-	atomic_inc(&eb->spinning_readers);
-	return 1;
+	return down_read_trylock(&eb->lock);
 }
 
 /*
- * returns 1 if we get the read lock and 0 if we don't
- * this won't wait for blocking writers or readers
+ * returns 1 if we get the write lock and 0 if we don't
+ * this won't wait for readers or writers
  */
 int btrfs_try_tree_write_lock(struct extent_buffer *eb)
 {
-	if (atomic_read(&eb->blocking_writers) ||
-	    atomic_read(&eb->blocking_readers))
+	if (!down_write_trylock(&eb->lock))
 		return 0;
-
-	write_lock(&eb->lock);
-	if (atomic_read(&eb->blocking_writers) ||
-	    atomic_read(&eb->blocking_readers)) {
-		write_unlock(&eb->lock);
-		return 0;
-	}
-	atomic_inc(&eb->write_locks);
-	atomic_inc(&eb->spinning_writers);
 	eb->lock_owner = current->pid;
 	return 1;
 }
 
 /*
- * drop a spinning read lock
+ * drop a read lock
  */
 void btrfs_tree_read_unlock(struct extent_buffer *eb)
 {
@@ -210,102 +118,55 @@ void btrfs_tree_read_unlock(struct extent_buffer *eb)
 		return;
 	}
 	btrfs_assert_tree_read_locked(eb);
-	WARN_ON(atomic_read(&eb->spinning_readers) == 0);
-	atomic_dec(&eb->spinning_readers);
-	atomic_dec(&eb->read_locks);
-	read_unlock(&eb->lock);
+	up_read(&eb->lock);
 }
 
 /*
- * drop a blocking read lock
+ * take a write lock.  This waits for all readers and writers, spinning
+ * while a writer holding the lock is running.
  */
-void btrfs_tree_read_unlock_blocking(struct extent_buffer *eb)
+void __btrfs_tree_lock(struct extent_buffer *eb, enum btrfs_lock_nesting nest)
 {
-	/*
-	 * if we're nested, we have the write lock.  No new locking
-	 * is needed as long as we are the lock owner.
-	 * The write unlock will do a barrier for us, and the lock_nested
-	 * field only matters to the lock owner.
-	 */
-	if (eb->lock_nested && current->pid == eb->lock_owner) {
-		eb->lock_nested = 0;
-		return;
+	u64 start;
+
+	WARN_ON(eb->lock_owner == current->pid);
+	if (!down_write_trylock(&eb->lock)) {
+		start = ktime_get_ns();
+		down_write_nested(&eb->lock, nest);
+		btrfs_tree_lock_waited(eb, 1, start);
 	}
-	btrfs_assert_tree_read_locked(eb);
-	WARN_ON(atomic_read(&eb->blocking_readers) == 0);
-	/*
-	 * atomic_dec_and_test implies a barrier for waitqueue_active
-	 */
-	if (atomic_dec_and_test(&eb->blocking_readers) &&
-	    waitqueue_active(&eb->read_lock_wq))
-		wake_up(&eb->read_lock_wq);
-	atomic_dec(&eb->read_locks);
+	eb->lock_owner = current->pid;
 }
 
 /*
- * take a spinning write lock.  This will wait for both
- * blocking readers or writers
+ * Lock a buffer that was just allocated for @trans and that nobody else
+ * can have found yet.  The caller may already hold the buffer this one is
+ * COWed or split from, at the same level and thus in the same lockdep
+ * class, as well as other new buffers of that level.  Taking it with a
+ * trylock keeps lockdep from reporting those as recursion.
  */
-void btrfs_tree_lock(struct extent_buffer *eb)
+void btrfs_tree_lock_new(struct extent_buffer *eb)
 {
-	WARN_ON(eb->lock_owner == current->pid);
-again:
-	wait_event(eb->read_lock_wq, atomic_read(&eb->blocking_readers) == 0);
-	wait_event(eb->write_lock_wq, atomic_read(&eb->blocking_writers) == 0);
-	write_lock(&eb->lock);
-	if (atomic_read(&eb->blocking_readers)) {
-		write_unlock(&eb->lock);
-		wait_event(eb->read_lock_wq,
-			   atomic_read(&eb->blocking_readers) == 0);
-		goto again;
-	}
-	if (atomic_read(&eb->blocking_writers)) {
-		write_unlock(&eb->lock);
-		wait_event(eb->write_lock_wq,
-			   atomic_read(&eb->blocking_writers) == 0);
-		goto again;
-	}
-	WARN_ON(atomic_read(&eb->spinning_writers));
-	atomic_inc(&eb->spinning_writers);
-	atomic_inc(&eb->write_locks);
-	eb->lock_owner = current->pid;
+	if (!btrfs_try_tree_write_lock(eb))
+		btrfs_tree_lock(eb);
 }
 
 /*
- * drop a spinning or a blocking write lock.
+ * drop a write lock.
  */
 void btrfs_tree_unlock(struct extent_buffer *eb)
 {
-	int blockers = atomic_read(&eb->blocking_writers);
-
-	BUG_ON(blockers > 1);
-
 	btrfs_assert_tree_locked(eb);
 	eb->lock_owner = 0;
-	atomic_dec(&eb->write_locks);
-
-	if (blockers) {
-		WARN_ON(atomic_read(&eb->spinning_writers));
-		atomic_dec(&eb->blocking_writers);
-		/*
-		 * Make sure counter is updated before we wake up waiters.
-		 */
-		smp_mb();
-		if (waitqueue_active(&eb->write_lock_wq))
-			wake_up(&eb->write_lock_wq);
-	} else {
-		WARN_ON(atomic_read(&eb->spinning_writers) != 1);
-		atomic_dec(&eb->spinning_writers);
-		write_unlock(&eb->lock);
-	}
+	up_write(&eb->lock);
 }
 
 void btrfs_assert_tree_locked(struct extent_buffer *eb)
 {
-	BUG_ON(!atomic_read(&eb->write_locks));
+	BUG_ON(!rwsem_is_locked(&eb->lock));
 }
 
 static void btrfs_assert_tree_read_locked(struct extent_buffer *eb)
 {
-	BUG_ON(!atomic_read(&eb->read_locks));
+	BUG_ON(!rwsem_is_locked(&eb->lock));
 }
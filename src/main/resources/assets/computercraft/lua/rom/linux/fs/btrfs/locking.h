@@ -24,18 +24,61 @@
 #define BTRFS_WRITE_LOCK_BLOCKING 3
 #define BTRFS_READ_LOCK_BLOCKING 4
 
-void btrfs_tree_lock(struct extent_buffer *eb);
+/*
+ * lockdep subclasses for the places that lock a sibling of a buffer they
+ * already hold.  Buffers of the same tree and level share a lockdep class,
+ * see btrfs_set_buffer_lockdep_class().
+ */
+enum btrfs_lock_nesting {
+	BTRFS_NESTING_NORMAL,
+	BTRFS_NESTING_LEFT,
+	BTRFS_NESTING_RIGHT,
+};
+
+void __btrfs_tree_lock(struct extent_buffer *eb, enum btrfs_lock_nesting nest);
+void btrfs_tree_lock_new(struct extent_buffer *eb);
 void btrfs_tree_unlock(struct extent_buffer *eb);
 
-void btrfs_tree_read_lock(struct extent_buffer *eb);
+void __btrfs_tree_read_lock(struct extent_buffer *eb,
+			    enum btrfs_lock_nesting nest);
 void btrfs_tree_read_unlock(struct extent_buffer *eb);
-void btrfs_tree_read_unlock_blocking(struct extent_buffer *eb);
-void btrfs_set_lock_blocking_rw(struct extent_buffer *eb, int rw);
-void btrfs_clear_lock_blocking_rw(struct extent_buffer *eb, int rw);
 void btrfs_assert_tree_locked(struct extent_buffer *eb);
 int btrfs_try_tree_read_lock(struct extent_buffer *eb);
 int btrfs_try_tree_write_lock(struct extent_buffer *eb);
-int btrfs_tree_read_lock_atomic(struct extent_buffer *eb);
+
+static inline void btrfs_tree_lock(struct extent_buffer *eb)
+{
+	__btrfs_tree_lock(eb, BTRFS_NESTING_NORMAL);
+}
+
+static inline void btrfs_tree_read_lock(struct extent_buffer *eb)
+{
+	__btrfs_tree_read_lock(eb, BTRFS_NESTING_NORMAL);
+}
+
+/*
+ * The locks are rw_semaphores, which spin on a running holder by
+ * themselves, so there is no separate atomic or blocking mode any more.
+ * These stay so the callers can keep tracking which mode they'd want.
+ */
+static inline int btrfs_tree_read_lock_atomic(struct extent_buffer *eb)
+{
+	return btrfs_try_tree_read_lock(eb);
+}
+
+static inline void btrfs_tree_read_unlock_blocking(struct extent_buffer *eb)
+{
+	btrfs_tree_read_unlock(eb);
+}
+
+static inline void btrfs_set_lock_blocking_rw(struct extent_buffer *eb, int rw)
+{
+}
+
+static inline void btrfs_clear_lock_blocking_rw(struct extent_buffer *eb,
+						int rw)
+{
+}
 
 
 static inline void btrfs_tree_unlock_rw(struct extent_buffer *eb, int rw)
@@ -447,11 +447,55 @@ static ssize_t btrfs_clone_alignment_show(struct kobject *kobj,
 
 BTRFS_ATTR(clone_alignment, btrfs_clone_alignment_show);
 
+static ssize_t btrfs_tree_lock_stats_show(struct kobject *kobj,
+				struct kobj_attribute *a, char *buf)
+{
+	struct btrfs_fs_info *fs_info = to_fs_info(kobj);
+	struct btrfs_tree_lock_stats *stats = &fs_info->tree_lock_stats;
+	ssize_t ret;
+	int level;
+
+	ret = snprintf(buf, PAGE_SIZE,
+		       "level read_contended read_wait_us write_contended write_wait_us\n");
+	for (level = 0; level < BTRFS_MAX_LEVEL; level++)
+		ret += snprintf(buf + ret, PAGE_SIZE - ret,
+				"%d %lld %lld %lld %lld\n", level,
+			(long long)atomic64_read(&stats->read_contended[level]),
+			(long long)atomic64_read(&stats->read_wait_ns[level]) /
+				NSEC_PER_USEC,
+			(long long)atomic64_read(&stats->write_contended[level]),
+			(long long)atomic64_read(&stats->write_wait_ns[level]) /
+				NSEC_PER_USEC);
+	return ret;
+}
+
+/* Writing anything resets the counters */
+static ssize_t btrfs_tree_lock_stats_store(struct kobject *kobj,
+				struct kobj_attribute *a,
+				const char *buf, size_t len)
+{
+	struct btrfs_fs_info *fs_info = to_fs_info(kobj);
+	struct btrfs_tree_lock_stats *stats = &fs_info->tree_lock_stats;
+	int level;
+
+	for (level = 0; level < BTRFS_MAX_LEVEL; level++) {
+		atomic64_set(&stats->read_contended[level], 0);
+		atomic64_set(&stats->read_wait_ns[level], 0);
+		atomic64_set(&stats->write_contended[level], 0);
+		atomic64_set(&stats->write_wait_ns[level], 0);
+	}
+	return len;
+}
+
+BTRFS_ATTR_RW(tree_lock_stats, btrfs_tree_lock_stats_show,
+	      btrfs_tree_lock_stats_store);
+
 static const struct attribute *btrfs_attrs[] = {
 	BTRFS_ATTR_PTR(label),
 	BTRFS_ATTR_PTR(nodesize),
 	BTRFS_ATTR_PTR(sectorsize),
 	BTRFS_ATTR_PTR(clone_alignment),
+	BTRFS_ATTR_PTR(tree_lock_stats),
 	NULL,
 };
 
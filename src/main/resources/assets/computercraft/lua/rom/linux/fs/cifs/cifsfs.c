@@ -519,6 +519,11 @@ cifs_show_options(struct seq_file *s, struct dentry *root)
 	seq_printf(s, ",wsize=%u", cifs_sb->wsize);
 	seq_printf(s, ",echo_interval=%lu",
 			tcon->ses->server->echo_interval / HZ);
+#ifdef CONFIG_CIFS_SMB2
+	if (tcon->ses->chan_count)
+		seq_printf(s, ",multichannel,max_channels=%u",
+			   tcon->ses->chan_count + 1);
+#endif /* CONFIG_CIFS_SMB2 */
 	/* convert actimeo and display it in seconds */
 	seq_printf(s, ",actimeo=%lu", cifs_sb->actimeo / HZ);
 
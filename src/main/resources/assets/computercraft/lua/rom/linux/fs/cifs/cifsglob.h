@@ -75,6 +75,10 @@
 #define SMB_ECHO_INTERVAL_MAX 600
 #define SMB_ECHO_INTERVAL_DEFAULT 60
 
+/* SMB3 multichannel: connections per session, including the first one */
+#define CIFS_MAX_CHANNELS 16
+#define CIFS_DEFAULT_CHANNELS 2
+
 /*
  * Default number of credits to keep available for SMB3.
  * This value is chosen somewhat arbitrarily. The Windows client
@@ -273,6 +277,10 @@ struct smb_version_operations {
 			     unsigned int *, const struct nls_table *, int);
 	/* informational QFS call */
 	void (*qfs_tcon)(const unsigned int, struct cifs_tcon *);
+	/* list the addresses of the network interfaces of the server */
+	int (*query_server_interfaces)(const unsigned int, struct cifs_tcon *,
+				       struct sockaddr_storage *,
+				       unsigned int *);
 	/* check if a path is accessible or not */
 	int (*is_path_accessible)(const unsigned int, struct cifs_tcon *,
 				  struct cifs_sb_info *, const char *);
@@ -530,6 +538,8 @@ struct smb_vol {
 	bool nopersistent:1;
 	bool resilient:1; /* noresilient not required since not fored for CA */
 	bool domainauto:1;
+	bool multichannel:1;
+	unsigned int max_channels; /* connections per session, incl. first */
 	unsigned int rsize;
 	unsigned int wsize;
 	bool sockopt_tcp_nodelay:1;
@@ -610,6 +620,7 @@ struct TCP_Server_Info {
 	__u16 sec_mode;
 	bool sign; /* is signing enabled on this connection? */
 	bool session_estab; /* mark when very first sess is established */
+	bool is_channel; /* extra connection bound to a session of another */
 #ifdef CONFIG_CIFS_SMB2
 	int echo_credits;  /* echo reserved slots */
 	int oplock_credits;  /* oplock break reserved slots */
@@ -853,6 +864,18 @@ struct cifs_ses {
 	__u8 smb3encryptionkey[SMB3_SIGN_KEY_SIZE];
 	__u8 smb3decryptionkey[SMB3_SIGN_KEY_SIZE];
 	__u8 preauth_hash[512];
+	/*
+	 * SMB3 multichannel: each further connection the session is bound to
+	 * gets its own cifs_ses, on the smb_ses_list of that connection, with
+	 * the same Suid and the signing key of the channel.  Those are in
+	 * chans[] of the session they belong to, and point back to it with
+	 * chan_primary.  chans[] only grows until the session is put.
+	 */
+	bool binding:1;		/* session setup binds a new channel */
+	struct cifs_ses *chan_primary;
+	struct cifs_ses *chans[CIFS_MAX_CHANNELS - 1];
+	unsigned int chan_count;
+	atomic_t chan_seq;	/* rotates channel selection */
 #endif /* CONFIG_CIFS_SMB2 */
 };
 
@@ -1123,6 +1146,7 @@ struct cifs_readdata {
 	struct list_head		list;
 	struct completion		done;
 	struct cifsFileInfo		*cfile;
+	struct TCP_Server_Info		*server; /* NULL: use ses->server */
 	struct address_space		*mapping;
 	__u64				offset;
 	unsigned int			bytes;
@@ -1154,6 +1178,7 @@ struct cifs_writedata {
 	enum writeback_sync_modes	sync_mode;
 	struct work_struct		work;
 	struct cifsFileInfo		*cfile;
+	struct TCP_Server_Info		*server; /* NULL: use ses->server */
 	__u64				offset;
 	pid_t				pid;
 	unsigned int			bytes;
@@ -93,7 +93,7 @@ enum {
 	Opt_multiuser, Opt_sloppy, Opt_nosharesock,
 	Opt_persistent, Opt_nopersistent,
 	Opt_resilient, Opt_noresilient,
-	Opt_domainauto,
+	Opt_domainauto, Opt_multichannel,
 
 	/* Mount options which take numeric value */
 	Opt_backupuid, Opt_backupgid, Opt_uid,
@@ -101,7 +101,7 @@ enum {
 	Opt_dirmode, Opt_port,
 	Opt_rsize, Opt_wsize, Opt_actimeo,
 	Opt_echo_interval, Opt_max_credits,
-	Opt_snapshot,
+	Opt_snapshot, Opt_max_channels,
 
 	/* Mount options which take string value */
 	Opt_user, Opt_pass, Opt_ip,
@@ -184,6 +184,7 @@ static const match_table_t cifs_mount_option_tokens = {
 	{ Opt_resilient, "resilienthandles"},
 	{ Opt_noresilient, "noresilienthandles"},
 	{ Opt_domainauto, "domainauto"},
+	{ Opt_multichannel, "multichannel"},
 
 	{ Opt_backupuid, "backupuid=%s" },
 	{ Opt_backupgid, "backupgid=%s" },
@@ -200,6 +201,7 @@ static const match_table_t cifs_mount_option_tokens = {
 	{ Opt_echo_interval, "echo_interval=%s" },
 	{ Opt_max_credits, "max_credits=%s" },
 	{ Opt_snapshot, "snapshot=%s" },
+	{ Opt_max_channels, "max_channels=%s" },
 
 	{ Opt_blank_user, "user=" },
 	{ Opt_blank_user, "username=" },
@@ -1275,6 +1277,7 @@ cifs_parse_mount_options(const char *mountdata, const char *devname,
 	vol->vals = &smb1_values;
 
 	vol->echo_interval = SMB_ECHO_INTERVAL_DEFAULT;
+	vol->max_channels = CIFS_DEFAULT_CHANNELS;
 
 	if (!mountdata)
 		goto cifs_parse_mount_err;
@@ -1536,6 +1539,9 @@ cifs_parse_mount_options(const char *mountdata, const char *devname,
 		case Opt_domainauto:
 			vol->domainauto = true;
 			break;
+		case Opt_multichannel:
+			vol->multichannel = true;
+			break;
 
 		/* Numeric Values */
 		case Opt_backupuid:
@@ -1655,6 +1661,15 @@ cifs_parse_mount_options(const char *mountdata, const char *devname,
 			}
 			vol->max_credits = option;
 			break;
+		case Opt_max_channels:
+			if (get_option_ul(args, &option) || option < 1 ||
+			    option > CIFS_MAX_CHANNELS) {
+				cifs_dbg(VFS, "%s: Invalid max_channels value, needs to be 1-%d\n",
+					 __func__, CIFS_MAX_CHANNELS);
+				goto cifs_parse_mount_err;
+			}
+			vol->max_channels = option;
+			break;
 
 		/* String Arguments */
 
@@ -2134,6 +2149,9 @@ cifs_find_tcp_session(struct smb_vol *vol)
 
 	spin_lock(&cifs_tcp_ses_lock);
 	list_for_each_entry(server, &cifs_tcp_ses_list, tcp_ses_list) {
+		/* extra channels belong to their session only */
+		if (server->is_channel)
+			continue;
 		if (!match_server(server, vol))
 			continue;
 
@@ -2368,6 +2386,28 @@ cifs_find_smb_ses(struct TCP_Server_Info *server, struct smb_vol *vol)
 	return NULL;
 }
 
+#ifdef CONFIG_CIFS_SMB2
+static void
+cifs_free_channels(struct cifs_ses *ses)
+{
+	unsigned int i;
+
+	for (i = 0; i < ses->chan_count; i++) {
+		struct cifs_ses *chan = ses->chans[i];
+		struct TCP_Server_Info *server = chan->server;
+
+		spin_lock(&cifs_tcp_ses_lock);
+		list_del_init(&chan->smb_ses_list);
+		spin_unlock(&cifs_tcp_ses_lock);
+
+		sesInfoFree(chan);
+		ses->chans[i] = NULL;
+		cifs_put_tcp_session(server, 0);
+	}
+	ses->chan_count = 0;
+}
+#endif /* CONFIG_CIFS_SMB2 */
+
 static void
 cifs_put_smb_ses(struct cifs_ses *ses)
 {
@@ -2389,6 +2429,11 @@ cifs_put_smb_ses(struct cifs_ses *ses)
 		ses->status = CifsExiting;
 	spin_unlock(&cifs_tcp_ses_lock);
 
+#ifdef CONFIG_CIFS_SMB2
+	/* the logoff below ends the session on all of its channels */
+	cifs_free_channels(ses);
+#endif
+
 	if (ses->status == CifsExiting && server->ops->logoff) {
 		xid = get_xid();
 		rc = server->ops->logoff(xid, ses);
@@ -2641,6 +2686,187 @@ get_ses_fail:
 	return ERR_PTR(rc);
 }
 
+#ifdef CONFIG_CIFS_SMB2
+static bool
+cifs_ses_has_address(struct cifs_ses *ses, struct sockaddr *addr)
+{
+	unsigned int i;
+
+	if (match_address(ses->server, addr,
+			  (struct sockaddr *)&ses->server->srcaddr))
+		return true;
+	for (i = 0; i < ses->chan_count; i++)
+		if (match_address(ses->chans[i]->server, addr,
+			(struct sockaddr *)&ses->chans[i]->server->srcaddr))
+			return true;
+	return false;
+}
+
+/*
+ * Open a connection to addr and bind it to ses as an extra channel.  The
+ * channel gets a cifs_ses of its own on the new connection's session list,
+ * with the Suid of the primary, so that signing and decryption find their
+ * keys per connection as usual.  It never holds tcons.
+ */
+static int
+cifs_add_channel(const unsigned int xid, struct cifs_ses *ses,
+		 struct smb_vol *vol, struct sockaddr_storage *addr)
+{
+	struct smb_vol *chan_vol;
+	struct TCP_Server_Info *server;
+	struct cifs_ses *chan;
+	int rc = -ENOMEM;
+
+	chan_vol = kmemdup(vol, sizeof(*vol), GFP_KERNEL);
+	if (!chan_vol)
+		return -ENOMEM;
+	memcpy(&chan_vol->dstaddr, addr, sizeof(chan_vol->dstaddr));
+	chan_vol->nosharesock = true;
+
+	server = cifs_get_tcp_session(chan_vol);
+	kfree(chan_vol);
+	if (IS_ERR(server))
+		return PTR_ERR(server);
+	server->is_channel = true;
+	server->max_credits = ses->server->max_credits;
+
+	chan = sesInfoAlloc();
+	if (!chan)
+		goto out_put_server;
+
+	chan->server = server;
+	strlcpy(chan->serverName, ses->serverName, sizeof(chan->serverName));
+	if (ses->user_name) {
+		chan->user_name = kstrdup(ses->user_name, GFP_KERNEL);
+		if (!chan->user_name)
+			goto out_free_chan;
+	}
+	if (ses->password) {
+		chan->password = kstrdup(ses->password, GFP_KERNEL);
+		if (!chan->password)
+			goto out_free_chan;
+	}
+	if (ses->domainName) {
+		chan->domainName = kstrdup(ses->domainName, GFP_KERNEL);
+		if (!chan->domainName)
+			goto out_free_chan;
+	}
+	chan->domainAuto = ses->domainAuto;
+	chan->cred_uid = ses->cred_uid;
+	chan->linux_uid = ses->linux_uid;
+	chan->sectype = ses->sectype;
+	chan->sign = true;
+	chan->Suid = ses->Suid;
+	chan->chan_primary = ses;
+	chan->binding = true;
+	/* the binding request is signed with the key of the session */
+	memcpy(chan->smb3signingkey, ses->smb3signingkey,
+	       SMB3_SIGN_KEY_SIZE);
+
+	/* the signing code looks the session up on the connection */
+	spin_lock(&cifs_tcp_ses_lock);
+	list_add(&chan->smb_ses_list, &server->smb_ses_list);
+	spin_unlock(&cifs_tcp_ses_lock);
+
+	mutex_lock(&chan->session_mutex);
+	rc = cifs_negotiate_protocol(xid, chan);
+	if (!rc && server->dialect != ses->server->dialect)
+		rc = -EOPNOTSUPP;
+	if (!rc) {
+		server->sign = true;
+		mutex_lock(&server->srv_mutex);
+		server->session_estab = true;
+		mutex_unlock(&server->srv_mutex);
+		rc = cifs_setup_session(xid, chan, vol->local_nls);
+	}
+	mutex_unlock(&chan->session_mutex);
+	if (rc)
+		goto out_unlist_chan;
+
+	/* encryption keys come from the session, not from the channel */
+	memcpy(chan->smb3encryptionkey, ses->smb3encryptionkey,
+	       SMB3_SIGN_KEY_SIZE);
+	memcpy(chan->smb3decryptionkey, ses->smb3decryptionkey,
+	       SMB3_SIGN_KEY_SIZE);
+	chan->binding = false;
+
+	ses->chans[ses->chan_count] = chan;
+	/* pairs with smp_rmb() in cifs_pick_channel() */
+	smp_wmb();
+	WRITE_ONCE(ses->chan_count, ses->chan_count + 1);
+	return 0;
+
+out_unlist_chan:
+	spin_lock(&cifs_tcp_ses_lock);
+	list_del_init(&chan->smb_ses_list);
+	spin_unlock(&cifs_tcp_ses_lock);
+out_free_chan:
+	sesInfoFree(chan);
+out_put_server:
+	cifs_put_tcp_session(server, 0);
+	return rc;
+}
+
+/*
+ * Bind connections to the other interfaces the server reports to ses, up
+ * to vol->max_channels in total.  Failures are not fatal, the session
+ * works over the channels it got.
+ */
+static void
+cifs_try_adding_channels(const unsigned int xid, struct cifs_ses *ses,
+			 struct cifs_tcon *tcon, struct smb_vol *vol)
+{
+	struct TCP_Server_Info *server = ses->server;
+	struct sockaddr_storage *addrs;
+	unsigned int i, count = CIFS_MAX_CHANNELS;
+	int rc;
+
+	if (vol->max_channels < 2 || !server->ops->query_server_interfaces)
+		return;
+	if (!(server->capabilities & SMB2_GLOBAL_CAP_MULTI_CHANNEL)) {
+		cifs_dbg(VFS, "server %s does not support multichannel\n",
+			 server->hostname);
+		return;
+	}
+	/* no preauth integrity hashing for binding under 3.1.1 here yet */
+	if (server->dialect < SMB30_PROT_ID ||
+	    server->dialect == SMB311_PROT_ID) {
+		cifs_dbg(VFS, "multichannel needs SMB 3.0 or 3.0.2\n");
+		return;
+	}
+	if (ses->sectype == Kerberos) {
+		cifs_dbg(VFS, "multichannel not supported with krb5\n");
+		return;
+	}
+
+	addrs = kcalloc(count, sizeof(*addrs), GFP_KERNEL);
+	if (!addrs)
+		return;
+
+	mutex_lock(&ses->session_mutex);
+	/* an earlier mount of this session did it already */
+	if (ses->chan_count)
+		goto out;
+
+	rc = server->ops->query_server_interfaces(xid, tcon, addrs, &count);
+	if (rc)
+		goto out;
+
+	for (i = 0; i < count && ses->chan_count < vol->max_channels - 1; i++) {
+		if (cifs_ses_has_address(ses, (struct sockaddr *)&addrs[i]))
+			continue;
+		rc = cifs_add_channel(xid, ses, vol, &addrs[i]);
+		if (rc)
+			cifs_dbg(FYI, "failed to add channel %u: %d\n", i, rc);
+	}
+	cifs_dbg(FYI, "session %llx has %u extra channels\n",
+		 ses->Suid, ses->chan_count);
+out:
+	mutex_unlock(&ses->session_mutex);
+	kfree(addrs);
+}
+#endif /* CONFIG_CIFS_SMB2 */
+
 static int match_tcon(struct cifs_tcon *tcon, struct smb_vol *volume_info)
 {
 	if (tcon->tidStatus == CifsExiting)
@@ -3773,6 +3999,11 @@ try_mount_again:
 	cifs_sb->wsize = server->ops->negotiate_wsize(tcon, volume_info);
 	cifs_sb->rsize = server->ops->negotiate_rsize(tcon, volume_info);
 
+#ifdef CONFIG_CIFS_SMB2
+	if (volume_info->multichannel && !tcon->ipc)
+		cifs_try_adding_channels(xid, ses, tcon, volume_info);
+#endif /* CONFIG_CIFS_SMB2 */
+
 remote_path_check:
 #ifdef CONFIG_CIFS_DFS_UPCALL
 	/*
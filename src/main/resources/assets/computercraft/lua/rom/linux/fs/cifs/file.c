@@ -2100,6 +2100,7 @@ static int cifs_writepages(struct address_space *mapping,
 			   struct writeback_control *wbc)
 {
 	struct cifs_sb_info *cifs_sb = CIFS_SB(mapping->host->i_sb);
+	struct cifs_ses *ses;
 	struct TCP_Server_Info *server;
 	bool done = false, scanned = false, range_whole = false;
 	pgoff_t end, index;
@@ -2123,12 +2124,22 @@ static int cifs_writepages(struct address_space *mapping,
 			range_whole = true;
 		scanned = true;
 	}
-	server = cifs_sb_master_tcon(cifs_sb)->ses->server;
+	ses = cifs_sb_master_tcon(cifs_sb)->ses;
 retry:
 	while (!done && index <= end) {
 		unsigned int i, nr_pages, found_pages, wsize, credits;
 		pgoff_t next = 0, tofind, saved_index = index;
 
+		/*
+		 * The writable handle is only looked up later, and on a
+		 * multiuser mount it may belong to another session than the
+		 * one the channels are bound to.
+		 */
+		if (cifs_sb->mnt_cifs_flags & CIFS_MOUNT_MULTIUSER)
+			server = ses->server;
+		else
+			server = cifs_pick_channel(ses);
+
 		rc = server->ops->wait_mtu_credits(server, cifs_sb->wsize,
 						   &wsize, &credits);
 		if (rc)
@@ -2161,6 +2172,7 @@ retry:
 		}
 
 		wdata->credits = credits;
+		wdata->server = server;
 
 		rc = wdata_send_pages(wdata, nr_pages, mapping, wbc);
 
@@ -2536,6 +2548,7 @@ cifs_write_from_iter(loff_t offset, size_t len, struct iov_iter *from,
 	struct iov_iter saved_from = *from;
 	loff_t saved_offset = offset;
 	pid_t pid;
+	struct cifs_ses *ses;
 	struct TCP_Server_Info *server;
 
 	if (cifs_sb->mnt_cifs_flags & CIFS_MOUNT_RWPIDFORWARD)
@@ -2543,11 +2556,12 @@ cifs_write_from_iter(loff_t offset, size_t len, struct iov_iter *from,
 	else
 		pid = current->tgid;
 
-	server = tlink_tcon(open_file->tlink)->ses->server;
+	ses = tlink_tcon(open_file->tlink)->ses;
 
 	do {
 		unsigned int wsize, credits;
 
+		server = cifs_pick_channel(ses);
 		rc = server->ops->wait_mtu_credits(server, cifs_sb->wsize,
 						   &wsize, &credits);
 		if (rc)
@@ -2595,6 +2609,7 @@ cifs_write_from_iter(loff_t offset, size_t len, struct iov_iter *from,
 		wdata->pagesz = PAGE_SIZE;
 		wdata->tailsz = cur_len - ((nr_pages - 1) * PAGE_SIZE);
 		wdata->credits = credits;
+		wdata->server = server;
 
 		if (!wdata->cfile->invalidHandle ||
 		    !(rc = cifs_reopen_file(wdata->cfile, false)))
@@ -2980,9 +2995,10 @@ cifs_send_async_read(loff_t offset, size_t len, struct cifsFileInfo *open_file,
 	size_t cur_len;
 	int rc;
 	pid_t pid;
+	struct cifs_ses *ses;
 	struct TCP_Server_Info *server;
 
-	server = tlink_tcon(open_file->tlink)->ses->server;
+	ses = tlink_tcon(open_file->tlink)->ses;
 
 	if (cifs_sb->mnt_cifs_flags & CIFS_MOUNT_RWPIDFORWARD)
 		pid = open_file->pid;
@@ -2990,6 +3006,7 @@ cifs_send_async_read(loff_t offset, size_t len, struct cifsFileInfo *open_file,
 		pid = current->tgid;
 
 	do {
+		server = cifs_pick_channel(ses);
 		rc = server->ops->wait_mtu_credits(server, cifs_sb->rsize,
 						   &rsize, &credits);
 		if (rc)
@@ -3020,6 +3037,7 @@ cifs_send_async_read(loff_t offset, size_t len, struct cifsFileInfo *open_file,
 		rdata->read_into_pages = cifs_uncached_read_into_pages;
 		rdata->copy_into_pages = cifs_uncached_copy_into_pages;
 		rdata->credits = credits;
+		rdata->server = server;
 
 		if (!rdata->cfile->invalidHandle ||
 		    !(rc = cifs_reopen_file(rdata->cfile, true)))
@@ -3520,6 +3538,7 @@ static int cifs_readpages(struct file *file, struct address_space *mapping,
 	struct list_head tmplist;
 	struct cifsFileInfo *open_file = file->private_data;
 	struct cifs_sb_info *cifs_sb = CIFS_FILE_SB(file);
+	struct cifs_ses *ses;
 	struct TCP_Server_Info *server;
 	pid_t pid;
 
@@ -3541,7 +3560,7 @@ static int cifs_readpages(struct file *file, struct address_space *mapping,
 		pid = current->tgid;
 
 	rc = 0;
-	server = tlink_tcon(open_file->tlink)->ses->server;
+	ses = tlink_tcon(open_file->tlink)->ses;
 
 	cifs_dbg(FYI, "%s: file=%p mapping=%p num_pages=%u\n",
 		 __func__, file, mapping, num_pages);
@@ -3564,6 +3583,7 @@ static int cifs_readpages(struct file *file, struct address_space *mapping,
 		struct cifs_readdata *rdata;
 		unsigned credits;
 
+		server = cifs_pick_channel(ses);
 		rc = server->ops->wait_mtu_credits(server, cifs_sb->rsize,
 						   &rsize, &credits);
 		if (rc)
@@ -3610,6 +3630,7 @@ static int cifs_readpages(struct file *file, struct address_space *mapping,
 		rdata->read_into_pages = cifs_readpages_read_into_pages;
 		rdata->copy_into_pages = cifs_readpages_copy_into_pages;
 		rdata->credits = credits;
+		rdata->server = server;
 
 		list_for_each_entry_safe(page, tpage, &tmplist, lru) {
 			list_del(&page->lru);
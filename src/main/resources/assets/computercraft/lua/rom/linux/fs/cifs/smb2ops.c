@@ -273,35 +273,89 @@ smb2_negotiate_rsize(struct cifs_tcon *tcon, struct smb_vol *volume_info)
 	return rsize;
 }
 
-#ifdef CONFIG_CIFS_STATS2
+/*
+ * Ask the server for its network interfaces and return up to *count of
+ * their addresses in addrs, with the port of the current connection.
+ * *count is set to the number of addresses returned.
+ */
 static int
-SMB3_request_interfaces(const unsigned int xid, struct cifs_tcon *tcon)
+smb3_query_server_interfaces(const unsigned int xid, struct cifs_tcon *tcon,
+			     struct sockaddr_storage *addrs,
+			     unsigned int *count)
 {
 	int rc;
 	unsigned int ret_data_len = 0;
-	struct network_interface_info_ioctl_rsp *out_buf;
+	unsigned int offset = 0, next, max = *count;
+	struct network_interface_info_ioctl_rsp *out_buf = NULL, *iface;
+	struct sockaddr_storage *primary = &tcon->ses->server->dstaddr;
+	__be16 port;
+
+	if (primary->ss_family == AF_INET6)
+		port = ((struct sockaddr_in6 *)primary)->sin6_port;
+	else
+		port = ((struct sockaddr_in *)primary)->sin_port;
 
+	*count = 0;
 	rc = SMB2_ioctl(xid, tcon, NO_FILE_ID, NO_FILE_ID,
 			FSCTL_QUERY_NETWORK_INTERFACE_INFO, true /* is_fsctl */,
 			false /* use_ipc */,
 			NULL /* no data input */, 0 /* no data input */,
 			(char **)&out_buf, &ret_data_len);
-	if (rc != 0)
+	if (rc != 0) {
 		cifs_dbg(VFS, "error %d on ioctl to get interface list\n", rc);
-	else if (ret_data_len < sizeof(struct network_interface_info_ioctl_rsp)) {
+		goto out;
+	}
+	if (ret_data_len < sizeof(struct network_interface_info_ioctl_rsp)) {
 		cifs_dbg(VFS, "server returned bad net interface info buf\n");
 		rc = -EINVAL;
-	} else {
-		/* Dump info on first interface */
+		goto out;
+	}
+
+	while (offset + sizeof(*iface) <= ret_data_len) {
+		__le16 family;
+
+		iface = (struct network_interface_info_ioctl_rsp *)
+					((char *)out_buf + offset);
+		family = *(__le16 *)iface->SockAddr_Storage;
+
 		cifs_dbg(FYI, "Adapter Capability 0x%x\t",
-			le32_to_cpu(out_buf->Capability));
+			le32_to_cpu(iface->Capability));
 		cifs_dbg(FYI, "Link Speed %lld\n",
-			le64_to_cpu(out_buf->LinkSpeed));
+			le64_to_cpu(iface->LinkSpeed));
+
+		if (*count < max && family == INTERNETWORK) {
+			struct iface_info_ipv4 *p = (struct iface_info_ipv4 *)
+						(iface->SockAddr_Storage + 2);
+			struct sockaddr_in *addr4 =
+					(struct sockaddr_in *)&addrs[*count];
+
+			memset(addr4, 0, sizeof(*addrs));
+			addr4->sin_family = AF_INET;
+			addr4->sin_addr.s_addr = p->IPv4Address;
+			addr4->sin_port = port;
+			(*count)++;
+		} else if (*count < max && family == INTERNETWORKV6) {
+			struct iface_info_ipv6 *p = (struct iface_info_ipv6 *)
+						(iface->SockAddr_Storage + 2);
+			struct sockaddr_in6 *addr6 =
+					(struct sockaddr_in6 *)&addrs[*count];
+
+			memset(addr6, 0, sizeof(*addrs));
+			addr6->sin6_family = AF_INET6;
+			memcpy(&addr6->sin6_addr, p->IPv6Address, 16);
+			addr6->sin6_port = port;
+			(*count)++;
+		}
+
+		next = le32_to_cpu(iface->Next);
+		if (!next)
+			break;
+		offset += next;
 	}
+out:
 	kfree(out_buf);
 	return rc;
 }
-#endif /* STATS2 */
 
 static void
 smb3_qfs_tcon(const unsigned int xid, struct cifs_tcon *tcon)
@@ -324,7 +378,12 @@ smb3_qfs_tcon(const unsigned int xid, struct cifs_tcon *tcon)
 		return;
 
 #ifdef CONFIG_CIFS_STATS2
-	SMB3_request_interfaces(xid, tcon);
+	{
+		unsigned int count = 0;
+
+		/* just dumps the list */
+		smb3_query_server_interfaces(xid, tcon, NULL, &count);
+	}
 #endif /* STATS2 */
 
 	SMB2_QFS_attr(xid, tcon, fid.persistent_fid, fid.volatile_fid,
@@ -2508,6 +2567,7 @@ struct smb_version_operations smb30_operations = {
 	.tree_connect = SMB2_tcon,
 	.tree_disconnect = SMB2_tdis,
 	.qfs_tcon = smb3_qfs_tcon,
+	.query_server_interfaces = smb3_query_server_interfaces,
 	.is_path_accessible = smb2_is_path_accessible,
 	.can_echo = smb2_can_echo,
 	.echo = SMB2_echo,
@@ -2603,6 +2663,7 @@ struct smb_version_operations smb311_operations = {
 	.tree_connect = SMB2_tcon,
 	.tree_disconnect = SMB2_tdis,
 	.qfs_tcon = smb3_qfs_tcon,
+	.query_server_interfaces = smb3_query_server_interfaces,
 	.is_path_accessible = smb2_is_path_accessible,
 	.can_echo = smb2_can_echo,
 	.echo = SMB2_echo,
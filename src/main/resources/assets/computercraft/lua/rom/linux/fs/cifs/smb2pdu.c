@@ -712,13 +712,27 @@ SMB2_sess_alloc_buffer(struct SMB2_sess_data *sess_data)
 	if (rc)
 		return rc;
 
-	/* First session, not a reauthenticate */
-	req->hdr.sync_hdr.SessionId = 0;
+	if (ses->binding) {
+		/*
+		 * Bind this connection to the established session, signed
+		 * with the signing key of the session.
+		 */
+		req->hdr.sync_hdr.SessionId = ses->Suid;
+		req->hdr.sync_hdr.Flags |= SMB2_FLAGS_SIGNED;
+		req->PreviousSessionId = 0;
+		req->Flags = SMB2_SESSION_REQ_FLAG_BINDING;
+	} else {
+		/* First session, not a reauthenticate */
+		req->hdr.sync_hdr.SessionId = 0;
 
-	/* if reconnect, we need to send previous sess id, otherwise it is 0 */
-	req->PreviousSessionId = sess_data->previous_session;
+		/*
+		 * if reconnect, we need to send previous sess id,
+		 * otherwise it is 0
+		 */
+		req->PreviousSessionId = sess_data->previous_session;
 
-	req->Flags = 0; /* MBZ */
+		req->Flags = 0; /* MBZ */
+	}
 	/* to enable echos and oplocks */
 	req->hdr.sync_hdr.CreditRequest = cpu_to_le16(3);
 
@@ -2374,7 +2388,8 @@ smb2_readv_callback(struct mid_q_entry *mid)
 {
 	struct cifs_readdata *rdata = mid->callback_data;
 	struct cifs_tcon *tcon = tlink_tcon(rdata->cfile->tlink);
-	struct TCP_Server_Info *server = tcon->ses->server;
+	struct TCP_Server_Info *server = rdata->server ? rdata->server :
+						       tcon->ses->server;
 	struct smb2_sync_hdr *shdr =
 				(struct smb2_sync_hdr *)rdata->iov[1].iov_base;
 	unsigned int credits_received = 1;
@@ -2454,7 +2469,7 @@ smb2_async_readv(struct cifs_readdata *rdata)
 	io_parms.volatile_fid = rdata->cfile->fid.volatile_fid;
 	io_parms.pid = rdata->pid;
 
-	server = io_parms.tcon->ses->server;
+	server = rdata->server ? rdata->server : io_parms.tcon->ses->server;
 
 	rc = smb2_new_read_req((void **) &buf, &total_len, &io_parms, 0, 0);
 	if (rc) {
@@ -2481,6 +2496,11 @@ smb2_async_readv(struct cifs_readdata *rdata)
 
 	shdr = (struct smb2_sync_hdr *)buf;
 
+	/* a channel bound to the session only takes signed requests */
+	if (server != io_parms.tcon->ses->server &&
+	    !(flags & CIFS_TRANSFORM_REQ))
+		shdr->Flags |= SMB2_FLAGS_SIGNED;
+
 	if (rdata->credits) {
 		shdr->CreditCharge = cpu_to_le16(DIV_ROUND_UP(rdata->bytes,
 						SMB2_MAX_BUFFER_SIZE));
@@ -2494,7 +2514,7 @@ smb2_async_readv(struct cifs_readdata *rdata)
 	}
 
 	kref_get(&rdata->refcount);
-	rc = cifs_call_async(io_parms.tcon->ses->server, &rqst,
+	rc = cifs_call_async(server, &rqst,
 			     cifs_readv_receive, smb2_readv_callback,
 			     smb3_handle_read_data, rdata, flags);
 	if (rc) {
@@ -2585,7 +2605,8 @@ smb2_writev_callback(struct mid_q_entry *mid)
 {
 	struct cifs_writedata *wdata = mid->callback_data;
 	struct cifs_tcon *tcon = tlink_tcon(wdata->cfile->tlink);
-	struct TCP_Server_Info *server = tcon->ses->server;
+	struct TCP_Server_Info *server = wdata->server ? wdata->server :
+						       tcon->ses->server;
 	unsigned int written;
 	struct smb2_write_rsp *rsp = (struct smb2_write_rsp *)mid->resp_buf;
 	unsigned int credits_received = 1;
@@ -2593,7 +2614,7 @@ smb2_writev_callback(struct mid_q_entry *mid)
 	switch (mid->mid_state) {
 	case MID_RESPONSE_RECEIVED:
 		credits_received = le16_to_cpu(rsp->hdr.sync_hdr.CreditRequest);
-		wdata->result = smb2_check_receive(mid, tcon->ses->server, 0);
+		wdata->result = smb2_check_receive(mid, server, 0);
 		if (wdata->result != 0)
 			break;
 
@@ -2628,7 +2649,7 @@ smb2_writev_callback(struct mid_q_entry *mid)
 	mutex_lock(&server->srv_mutex);
 	DeleteMidQEntry(mid);
 	mutex_unlock(&server->srv_mutex);
-	add_credits(tcon->ses->server, credits_received, 0);
+	add_credits(server, credits_received, 0);
 }
 
 /* smb2_async_writev - send an async write, and set up mid to handle result */
@@ -2640,7 +2661,8 @@ smb2_async_writev(struct cifs_writedata *wdata,
 	struct smb2_write_req *req = NULL;
 	struct smb2_sync_hdr *shdr;
 	struct cifs_tcon *tcon = tlink_tcon(wdata->cfile->tlink);
-	struct TCP_Server_Info *server = tcon->ses->server;
+	struct TCP_Server_Info *server = wdata->server ? wdata->server :
+						       tcon->ses->server;
 	struct kvec iov[2];
 	struct smb_rqst rqst = { };
 
@@ -2663,6 +2685,10 @@ smb2_async_writev(struct cifs_writedata *wdata,
 	shdr = get_sync_hdr(req);
 	shdr->ProcessId = cpu_to_le32(wdata->cfile->pid);
 
+	/* a channel bound to the session only takes signed requests */
+	if (server != tcon->ses->server && !(flags & CIFS_TRANSFORM_REQ))
+		shdr->Flags |= SMB2_FLAGS_SIGNED;
+
 	req->PersistentFileId = wdata->cfile->fid.persistent_fid;
 	req->VolatileFileId = wdata->cfile->fid.volatile_fid;
 	req->WriteChannelInfoOffset = 0;
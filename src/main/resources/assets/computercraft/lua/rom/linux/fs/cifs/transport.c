@@ -418,6 +418,60 @@ cifs_wait_mtu_credits(struct TCP_Server_Info *server, unsigned int size,
 	return 0;
 }
 
+#ifdef CONFIG_CIFS_SMB2
+static bool
+cifs_chan_usable(struct cifs_ses *ses, struct cifs_ses *chan)
+{
+	/* channels are not re-bound after a reconnect of either side */
+	return chan->server->tcpStatus == CifsGood &&
+	       chan->status == CifsGood && !chan->need_reconnect &&
+	       chan->Suid == ses->Suid;
+}
+#endif
+
+/*
+ * Choose the connection to send the next request of @ses on: the one with
+ * the most credits among the connection of the session and the channels
+ * bound to it.  Ties go to the next one in turn, so that the load spreads
+ * across all channels while the server grants them the same credits.
+ */
+struct TCP_Server_Info *
+cifs_pick_channel(struct cifs_ses *ses)
+{
+	struct TCP_Server_Info *server = ses->server;
+#ifdef CONFIG_CIFS_SMB2
+	unsigned int count = READ_ONCE(ses->chan_count);
+	unsigned int i, start, best;
+
+	if (!count)
+		return server;
+	/* pairs with smp_wmb() in cifs_add_channel() */
+	smp_rmb();
+
+	/* index 0 stands for the connection of the session itself */
+	start = (unsigned int)atomic_inc_return(&ses->chan_seq);
+	best = 0;
+	server = NULL;
+	for (i = 0; i <= count; i++) {
+		unsigned int idx = (start + i) % (count + 1);
+		struct TCP_Server_Info *candidate = ses->server;
+		unsigned int credits;
+
+		if (idx) {
+			if (!cifs_chan_usable(ses, ses->chans[idx - 1]))
+				continue;
+			candidate = ses->chans[idx - 1]->server;
+		}
+		credits = READ_ONCE(candidate->credits);
+		if (!server || credits > best) {
+			server = candidate;
+			best = credits;
+		}
+	}
+#endif
+	return server;
+}
+
 static int allocate_mid(struct cifs_ses *ses, struct smb_hdr *in_buf,
 			struct mid_q_entry **ppmidQ)
 {
@@ -52,7 +52,7 @@
  * s_anon bl list spinlock protects:
  *   - the s_anon list (see __d_drop)
  * dentry->d_sb->s_dentry_lru_lock protects:
- *   - the dcache lru lists and counters
+ *   - the dcache lru lists (positive and negative) and counters
  * d_lock protects:
  *   - d_flags
  *   - d_name
@@ -84,6 +84,12 @@
 int sysctl_vfs_cache_pressure __read_mostly = 100;
 EXPORT_SYMBOL_GPL(sysctl_vfs_cache_pressure);
 
+/*
+ * Maximum number of unused negative dentries per superblock before they are
+ * trimmed in the background, 0 for no limit.  Defaults to 1% of memory.
+ */
+unsigned long sysctl_negative_dentry_limit __read_mostly;
+
 __cacheline_aligned_in_smp DEFINE_SEQLOCK(rename_lock);
 
 EXPORT_SYMBOL(rename_lock);
@@ -127,6 +133,7 @@ struct dentry_stat_t dentry_stat = {
 
 static DEFINE_PER_CPU(long, nr_dentry);
 static DEFINE_PER_CPU(long, nr_dentry_unused);
+static DEFINE_PER_CPU(long, nr_dentry_negative);
 
 #if defined(CONFIG_SYSCTL) && defined(CONFIG_PROC_FS)
 
@@ -160,11 +167,21 @@ static long get_nr_dentry_unused(void)
 	return sum < 0 ? 0 : sum;
 }
 
+static long get_nr_dentry_negative(void)
+{
+	int i;
+	long sum = 0;
+	for_each_possible_cpu(i)
+		sum += per_cpu(nr_dentry_negative, i);
+	return sum < 0 ? 0 : sum;
+}
+
 int proc_nr_dentry(struct ctl_table *table, int write, void __user *buffer,
 		   size_t *lenp, loff_t *ppos)
 {
 	dentry_stat.nr_dentry = get_nr_dentry();
 	dentry_stat.nr_unused = get_nr_dentry_unused();
+	dentry_stat.nr_negative = get_nr_dentry_negative();
 	return proc_doulongvec_minmax(table, write, buffer, lenp, ppos);
 }
 #endif
@@ -277,6 +294,8 @@ static inline int dname_external(const struct dentry *dentry)
 	return dentry->d_name.name != dentry->d_iname;
 }
 
+static void d_lru_retype(struct dentry *dentry);
+
 static inline void __d_set_inode_and_type(struct dentry *dentry,
 					  struct inode *inode,
 					  unsigned type_flags)
@@ -288,6 +307,7 @@ static inline void __d_set_inode_and_type(struct dentry *dentry,
 	flags &= ~(DCACHE_ENTRY_TYPE | DCACHE_FALLTHRU);
 	flags |= type_flags;
 	WRITE_ONCE(dentry->d_flags, flags);
+	d_lru_retype(dentry);
 }
 
 static inline void __d_clear_type_and_inode(struct dentry *dentry)
@@ -297,6 +317,7 @@ static inline void __d_clear_type_and_inode(struct dentry *dentry)
 	flags &= ~(DCACHE_ENTRY_TYPE | DCACHE_FALLTHRU);
 	WRITE_ONCE(dentry->d_flags, flags);
 	dentry->d_inode = NULL;
+	d_lru_retype(dentry);
 }
 
 static void dentry_free(struct dentry *dentry)
@@ -305,7 +326,7 @@ static void dentry_free(struct dentry *dentry)
 	if (unlikely(dname_external(dentry))) {
 		struct external_name *p = external_name(dentry);
 		if (likely(atomic_dec_and_test(&p->u.count))) {
-			call_rcu(&dentry->d_u.d_rcu, __d_free_external);
+			call_rcu_lazy(&dentry->d_u.d_rcu, __d_free_external);
 			return;
 		}
 	}
@@ -313,7 +334,7 @@ static void dentry_free(struct dentry *dentry)
 	if (!(dentry->d_flags & DCACHE_RCUACCESS))
 		__d_free(&dentry->d_u.d_rcu);
 	else
-		call_rcu(&dentry->d_u.d_rcu, __d_free);
+		call_rcu_lazy(&dentry->d_u.d_rcu, __d_free);
 }
 
 /*
@@ -354,16 +375,55 @@ static void dentry_unlink_inode(struct dentry * dentry)
  * The per-cpu "nr_dentry_unused" counters are updated with
  * the DCACHE_LRU_LIST bit.
  *
+ * The DCACHE_LRU_NEGATIVE bit is set whenever the dentry is on
+ * the superblock negative dentry LRU list rather than the main
+ * one.  The "nr_dentry_negative" counters and the superblock
+ * s_nr_dentry_negative counter are updated with it.
+ *
  * These helper functions make sure we always follow the
  * rules. d_lock must be held by the caller.
  */
 #define D_FLAG_VERIFY(dentry,x) WARN_ON_ONCE(((dentry)->d_flags & (DCACHE_LRU_LIST | DCACHE_SHRINK_LIST)) != (x))
+
+static inline struct list_lru *d_lru_list(struct dentry *dentry)
+{
+	if (dentry->d_flags & DCACHE_LRU_NEGATIVE)
+		return &dentry->d_sb->s_dentry_neg_lru;
+	return &dentry->d_sb->s_dentry_lru;
+}
+
+static void d_lru_negative_add(struct dentry *dentry)
+{
+	struct super_block *sb = dentry->d_sb;
+	unsigned long limit = READ_ONCE(sysctl_negative_dentry_limit);
+
+	dentry->d_flags |= DCACHE_LRU_NEGATIVE;
+	this_cpu_inc(nr_dentry_negative);
+	percpu_counter_inc(&sb->s_nr_dentry_negative);
+
+	if (limit &&
+	    percpu_counter_read(&sb->s_nr_dentry_negative) > (s64)limit &&
+	    !work_pending(&sb->s_dentry_negative_work))
+		schedule_work(&sb->s_dentry_negative_work);
+}
+
+static void d_lru_negative_del(struct dentry *dentry)
+{
+	if (dentry->d_flags & DCACHE_LRU_NEGATIVE) {
+		dentry->d_flags &= ~DCACHE_LRU_NEGATIVE;
+		this_cpu_dec(nr_dentry_negative);
+		percpu_counter_dec(&dentry->d_sb->s_nr_dentry_negative);
+	}
+}
+
 static void d_lru_add(struct dentry *dentry)
 {
 	D_FLAG_VERIFY(dentry, 0);
 	dentry->d_flags |= DCACHE_LRU_LIST;
 	this_cpu_inc(nr_dentry_unused);
-	WARN_ON_ONCE(!list_lru_add(&dentry->d_sb->s_dentry_lru, &dentry->d_lru));
+	if (d_is_negative(dentry))
+		d_lru_negative_add(dentry);
+	WARN_ON_ONCE(!list_lru_add(d_lru_list(dentry), &dentry->d_lru));
 }
 
 static void d_lru_del(struct dentry *dentry)
@@ -371,7 +431,26 @@ static void d_lru_del(struct dentry *dentry)
 	D_FLAG_VERIFY(dentry, DCACHE_LRU_LIST);
 	dentry->d_flags &= ~DCACHE_LRU_LIST;
 	this_cpu_dec(nr_dentry_unused);
-	WARN_ON_ONCE(!list_lru_del(&dentry->d_sb->s_dentry_lru, &dentry->d_lru));
+	WARN_ON_ONCE(!list_lru_del(d_lru_list(dentry), &dentry->d_lru));
+	d_lru_negative_del(dentry);
+}
+
+/*
+ * Move a dentry that is on an LRU list to the one matching its type after
+ * it was instantiated or made negative.  Dentries on a shrink list are left
+ * alone, they are about to go anyway.
+ */
+static void d_lru_retype(struct dentry *dentry)
+{
+	bool negative = d_is_negative(dentry);
+
+	if ((dentry->d_flags & (DCACHE_LRU_LIST | DCACHE_SHRINK_LIST)) !=
+	    DCACHE_LRU_LIST)
+		return;
+	if (negative == !!(dentry->d_flags & DCACHE_LRU_NEGATIVE))
+		return;
+	d_lru_del(dentry);
+	d_lru_add(dentry);
 }
 
 static void d_shrink_del(struct dentry *dentry)
@@ -402,6 +481,7 @@ static void d_lru_isolate(struct list_lru_one *lru, struct dentry *dentry)
 	dentry->d_flags &= ~DCACHE_LRU_LIST;
 	this_cpu_dec(nr_dentry_unused);
 	list_lru_isolate(lru, &dentry->d_lru);
+	d_lru_negative_del(dentry);
 }
 
 static void d_lru_shrink_move(struct list_lru_one *lru, struct dentry *dentry,
@@ -410,6 +490,7 @@ static void d_lru_shrink_move(struct list_lru_one *lru, struct dentry *dentry,
 	D_FLAG_VERIFY(dentry, DCACHE_LRU_LIST);
 	dentry->d_flags |= DCACHE_SHRINK_LIST;
 	list_lru_isolate_move(lru, &dentry->d_lru, list);
+	d_lru_negative_del(dentry);
 }
 
 /*
@@ -456,6 +537,7 @@ void __d_drop(struct dentry *dentry)
 		hlist_bl_unlock(b);
 		/* After this call, in-progress rcu-walk path lookup will fail. */
 		write_seqcount_invalidate(&dentry->d_seq);
+		path_cache_invalidate(dentry);
 	}
 }
 EXPORT_SYMBOL(__d_drop);
@@ -1081,7 +1163,8 @@ static enum lru_status dentry_lru_isolate(struct list_head *item,
  *
  * Attempt to shrink the superblock dcache LRU by @sc->nr_to_scan entries. This
  * is done when we need more memory and called from the superblock shrinker
- * function.
+ * function.  Negative dentries are the cheapest to rebuild, so their LRU gets
+ * scanned first and the main LRU only gets what is left of the budget.
  *
  * This function may fail to free any resources if all the dentries are in
  * use.
@@ -1091,12 +1174,56 @@ long prune_dcache_sb(struct super_block *sb, struct shrink_control *sc)
 	LIST_HEAD(dispose);
 	long freed;
 
-	freed = list_lru_shrink_walk(&sb->s_dentry_lru, sc,
+	freed = list_lru_shrink_walk(&sb->s_dentry_neg_lru, sc,
 				     dentry_lru_isolate, &dispose);
+	if (sc->nr_to_scan)
+		freed += list_lru_shrink_walk(&sb->s_dentry_lru, sc,
+					      dentry_lru_isolate, &dispose);
 	shrink_dentry_list(&dispose);
 	return freed;
 }
 
+#define NEG_DENTRY_TRIM_BATCH	1024UL
+
+/**
+ * prune_dcache_sb_negative - trim unused negative dentries of a superblock
+ * @sb: superblock, with s_umount held for reading
+ *
+ * Bring the number of unused negative dentries back below the limit, with
+ * some slack so that this doesn't run again right away.  The negative LRU is
+ * walked in batches so that neither the LRU lock nor the CPU is hogged.
+ */
+void prune_dcache_sb_negative(struct super_block *sb)
+{
+	unsigned long limit = READ_ONCE(sysctl_negative_dentry_limit);
+	long target = limit - limit / 8;
+	long excess;
+	unsigned long nr_to_walk;
+
+	if (!limit)
+		return;
+
+	excess = percpu_counter_sum_positive(&sb->s_nr_dentry_negative) - target;
+	if (excess <= 0)
+		return;
+
+	/* Referenced entries get rotated once, allow for a second pass */
+	nr_to_walk = 2 * excess;
+	while (nr_to_walk) {
+		unsigned long batch = min(nr_to_walk, NEG_DENTRY_TRIM_BATCH);
+		LIST_HEAD(dispose);
+
+		list_lru_walk(&sb->s_dentry_neg_lru, dentry_lru_isolate,
+			      &dispose, batch);
+		nr_to_walk -= batch;
+		shrink_dentry_list(&dispose);
+
+		if (percpu_counter_read(&sb->s_nr_dentry_negative) <= target)
+			break;
+		cond_resched();
+	}
+}
+
 static enum lru_status dentry_lru_isolate_shrink(struct list_head *item,
 		struct list_lru_one *lru, spinlock_t *lru_lock, void *arg)
 {
@@ -1132,7 +1259,9 @@ void shrink_dcache_sb(struct super_block *sb)
 	do {
 		LIST_HEAD(dispose);
 
-		freed = list_lru_walk(&sb->s_dentry_lru,
+		freed = list_lru_walk(&sb->s_dentry_neg_lru,
+			dentry_lru_isolate_shrink, &dispose, UINT_MAX);
+		freed += list_lru_walk(&sb->s_dentry_lru,
 			dentry_lru_isolate_shrink, &dispose, UINT_MAX);
 
 		this_cpu_sub(nr_dentry_unused, freed);
@@ -3583,6 +3712,9 @@ static void __init dcache_init(void)
 	dentry_cache = KMEM_CACHE(dentry,
 		SLAB_RECLAIM_ACCOUNT|SLAB_PANIC|SLAB_MEM_SPREAD|SLAB_ACCOUNT);
 
+	sysctl_negative_dentry_limit = totalram_pages / 100 * PAGE_SIZE /
+				       sizeof(struct dentry);
+
 	/* Hash may have been set up in dcache_init_early */
 	if (!hashdist)
 		return;
@@ -42,6 +42,9 @@
 #include <linux/seq_file.h>
 #include <linux/compat.h>
 #include <linux/rculist.h>
+#include <linux/llist.h>
+#include <linux/vmalloc.h>
+#include <net/busy_poll.h>
 
 /*
  * LOCKING:
@@ -49,14 +52,16 @@
  *
  * 1) epmutex (mutex)
  * 2) ep->mtx (mutex)
- * 3) ep->lock (spinlock)
+ * 3) ep->wq.lock (spinlock)
  *
  * The acquire order is the one listed above, from 1 to 3.
- * We need a spinlock (ep->lock) because we manipulate objects
- * from inside the poll callback, that might be triggered from
- * a wake_up() that in turn might be called from IRQ context.
- * So we can't sleep inside the poll callback and hence we need
- * a spinlock. During the event transfer loop (from kernel to
+ * The poll callback, that might be triggered from a wake_up() that in
+ * turn might be called from IRQ context, takes no epoll lock at all: it
+ * pushes the item on the lock-less ep->ovflist (or, for EPOLL_USERPOLL
+ * instances, on the user mapped ring) and wakes up ep->wq, whose own
+ * lock serializes the waiters. The ready list (ep->rdllist) is only
+ * touched with ep->mtx held, items are moved there from ep->ovflist by
+ * ep_flush_ovflist(). During the event transfer loop (from kernel to
  * user space) we could end up sleeping due a copy_to_user(), so
  * we need a lock that will allow us to sleep. This lock is a
  * mutex (ep->mtx). It is acquired during the event transfer loop,
@@ -84,7 +89,7 @@
  * of epoll file descriptors, we use the current recursion depth as
  * the lockdep subkey.
  * It is possible to drop the "ep->mtx" and to use the global
- * mutex "epmutex" (together with "ep->lock") to have it working,
+ * mutex "epmutex" to have it working,
  * but having "ep->mtx" will make the interface more scalable.
  * Events that require holding "epmutex" are very rare, while for
  * normal operations the epoll private "ep->mtx" will guarantee
@@ -108,6 +113,9 @@
 
 #define EP_ITEM_COST (sizeof(struct epitem) + sizeof(struct eppoll_entry))
 
+/* Largest user mapped ring of an EPOLL_USERPOLL instance */
+#define EP_UHEADER_MAX_SIZE (16UL << 20)
+
 struct epoll_filefd {
 	struct file *file;
 	int fd;
@@ -149,11 +157,15 @@ struct epitem {
 	/* List header used to link this structure to the eventpoll ready list */
 	struct list_head rdllink;
 
-	/*
-	 * Works together "struct eventpoll"->ovflist in keeping the
-	 * single linked chain of items.
-	 */
-	struct epitem *next;
+	union {
+		/*
+		 * Links the item to "struct eventpoll"->ovflist, where the poll
+		 * callback queues it; EP_UNACTIVE_PTR while it is not queued.
+		 */
+		struct llist_node ovfnode;
+		/* Slot of the item in the user mapped ring (EPOLL_USERPOLL) */
+		unsigned int uindex;
+	};
 
 	/* The file descriptor information this item refers to */
 	struct epoll_filefd ffd;
@@ -183,9 +195,6 @@ struct epitem {
  * interface.
  */
 struct eventpoll {
-	/* Protect the access to this structure */
-	spinlock_t lock;
-
 	/*
 	 * This mutex is used to ensure that files are not removed
 	 * while epoll is using them. This is held during the event
@@ -194,24 +203,23 @@ struct eventpoll {
 	 */
 	struct mutex mtx;
 
-	/* Wait queue used by sys_epoll_wait() */
+	/* Wait queue used by sys_epoll_wait(), its lock serializes the waiters */
 	wait_queue_head_t wq;
 
 	/* Wait queue used by file->poll() */
 	wait_queue_head_t poll_wait;
 
-	/* List of ready file descriptors */
+	/* List of ready file descriptors, protected by "mtx" */
 	struct list_head rdllist;
 
 	/* RB tree root used to store monitored fd structs */
 	struct rb_root rbr;
 
 	/*
-	 * This is a single linked list that chains all the "struct epitem" that
-	 * happened while transferring ready events to userspace w/out
-	 * holding ->lock.
+	 * Lock-less list of the "struct epitem" that the poll callback found
+	 * ready, waiting to be moved to rdllist by ep_flush_ovflist().
 	 */
-	struct epitem *ovflist;
+	struct llist_head ovflist;
 
 	/* wakeup_source used when ep_scan_ready_list is running */
 	struct wakeup_source *ws;
@@ -224,6 +232,32 @@ struct eventpoll {
 	/* used to optimize loop detection check */
 	int visited;
 	struct list_head visited_list_link;
+
+	/* Created with EPOLL_USERPOLL: events go to a user mapped ring */
+	bool userpoll;
+
+	/*
+	 * The user mapped ring, set up by the first mmap() and never changed
+	 * afterwards; uitems and uring point inside it. The ring mask and the
+	 * slot bitmap (protected by "mtx" once the ring is set up) are kept
+	 * here, out of reach of user space.
+	 */
+	struct epoll_uheader *uheader;
+	struct epoll_uitem *uitems;
+	u32 *uring;
+	unsigned int uring_mask;
+	unsigned long *uitems_map;
+
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	/* used to track busy poll napi_id */
+	unsigned int napi_id;
+
+	/* busy poll time budget, net.core.busy_poll when zero */
+	unsigned int busy_poll_usecs;
+
+	atomic_long_t busy_poll_loops;
+	atomic_long_t busy_poll_hits;
+#endif
 };
 
 /* Wait structure used by the poll hooks */
@@ -267,6 +301,9 @@ static long max_user_watches __read_mostly;
  */
 static DEFINE_MUTEX(epmutex);
 
+/* Serializes the setup of EPOLL_USERPOLL rings by ep_eventpoll_mmap() */
+static DEFINE_MUTEX(ep_uring_mutex);
+
 /* Used to check for epoll file descriptor inclusion loops */
 static struct nested_calls poll_loop_ncalls;
 
@@ -371,6 +408,76 @@ static void ep_nested_calls_init(struct nested_calls *ncalls)
 	spin_lock_init(&ncalls->lock);
 }
 
+/* Tells if events of this eventpoll are delivered through a user mapped ring */
+static inline bool ep_has_uring(struct eventpoll *ep)
+{
+	return smp_load_acquire(&ep->uheader) != NULL;
+}
+
+/* Number of ring entries user space has not consumed yet */
+static inline unsigned int ep_uring_count(struct eventpoll *ep)
+{
+	return READ_ONCE(ep->uheader->tail) - READ_ONCE(ep->uheader->head);
+}
+
+/*
+ * Report @pollflags for @epi through the user mapped ring. Lock-less, can be
+ * called from the poll callback.
+ *
+ * An item is put on the ring only when its ready_events go from zero to
+ * non-zero, further events are just or-ed in until user space consumes the
+ * entry and clears ready_events. Each item thus appears at most once in the
+ * ring, which has a slot per item and cannot overflow.
+ */
+static void ep_uring_post(struct eventpoll *ep, struct epitem *epi,
+			  unsigned int pollflags)
+{
+	struct epoll_uitem *uitem = &ep->uitems[epi->uindex];
+	unsigned int tail;
+
+	if (!pollflags)
+		return;
+
+	if (atomic_fetch_or(pollflags, (atomic_t *)&uitem->ready_events))
+		return;
+
+	tail = atomic_fetch_inc((atomic_t *)&ep->uheader->tail);
+	smp_store_release(&ep->uring[tail & ep->uring_mask], epi->uindex);
+}
+
+/*
+ * Get a free ring slot for a new item. A slot whose previous owner still has
+ * an entry pending in the ring is not reused until user space consumed it.
+ * Must be called with "mtx" held.
+ */
+static int ep_uitem_alloc(struct eventpoll *ep, struct epitem *epi)
+{
+	unsigned int i, nr = ep->uring_mask + 1;
+	struct epoll_uitem *uitem;
+
+	for_each_clear_bit(i, ep->uitems_map, nr) {
+		uitem = &ep->uitems[i];
+		if (READ_ONCE(uitem->ready_events))
+			continue;
+
+		__set_bit(i, ep->uitems_map);
+		WRITE_ONCE(uitem->data, epi->event.data);
+		WRITE_ONCE(uitem->events, epi->event.events);
+		epi->uindex = i;
+		return 0;
+	}
+
+	return -ENOSPC;
+}
+
+/* Must be called with "mtx" held, after the poll hooks are gone */
+static void ep_uitem_free(struct eventpoll *ep, struct epitem *epi)
+{
+	/* Tells user space to skip an entry still pending for this slot */
+	WRITE_ONCE(ep->uitems[epi->uindex].events, 0);
+	__clear_bit(epi->uindex, ep->uitems_map);
+}
+
 /**
  * ep_events_available - Checks if ready events might be available.
  *
@@ -381,9 +488,137 @@ static void ep_nested_calls_init(struct nested_calls *ncalls)
  */
 static inline int ep_events_available(struct eventpoll *ep)
 {
-	return !list_empty(&ep->rdllist) || ep->ovflist != EP_UNACTIVE_PTR;
+	if (ep_has_uring(ep))
+		return ep_uring_count(ep) != 0;
+
+	return !list_empty(&ep->rdllist) || !llist_empty(&ep->ovflist);
 }
 
+#ifdef CONFIG_NET_RX_BUSY_POLL
+static inline bool ep_busy_loop_on(struct eventpoll *ep)
+{
+	return READ_ONCE(ep->busy_poll_usecs) || net_busy_loop_on();
+}
+
+static bool ep_busy_loop_end(void *p)
+{
+	struct eventpoll *ep = p;
+
+	return ep_events_available(ep) || signal_pending(current);
+}
+
+/*
+ * Busy poll if globally on and supporting sockets found && no events,
+ * busy loop will return if need_resched or ep_events_available.
+ *
+ * we must do our busy polling with irqs enabled
+ */
+static void ep_busy_loop(struct eventpoll *ep, int nonblock)
+{
+	unsigned int napi_id = READ_ONCE(ep->napi_id);
+	unsigned long end_time = 0;
+	unsigned int usecs;
+
+	if (napi_id < MIN_NAPI_ID || !ep_busy_loop_on(ep))
+		return;
+
+	if (!nonblock) {
+		usecs = READ_ONCE(ep->busy_poll_usecs) ?:
+			READ_ONCE(sysctl_net_busy_poll);
+		end_time = busy_loop_us_clock() + usecs;
+	}
+
+	atomic_long_inc(&ep->busy_poll_loops);
+	if (napi_busy_loop(napi_id, end_time, ep_busy_loop_end, ep) &&
+	    ep_events_available(ep))
+		atomic_long_inc(&ep->busy_poll_hits);
+}
+
+static inline void ep_reset_busy_poll_napi_id(struct eventpoll *ep)
+{
+	if (ep->napi_id)
+		ep->napi_id = 0;
+}
+
+/*
+ * Set epoll busy poll NAPI ID from sk.
+ */
+static inline void ep_set_busy_poll_napi_id(struct epitem *epi)
+{
+	struct eventpoll *ep = epi->ep;
+	unsigned int napi_id;
+	struct socket *sock;
+	struct sock *sk;
+	int err;
+
+	if (!ep_busy_loop_on(ep))
+		return;
+
+	sock = sock_from_file(epi->ffd.file, &err);
+	if (!sock)
+		return;
+
+	sk = sock->sk;
+	if (!sk)
+		return;
+
+	napi_id = READ_ONCE(sk->sk_napi_id);
+
+	/* Non-NAPI IDs can be rejected
+	 *	or
+	 * Nothing to do if we already have this ID
+	 */
+	if (napi_id < MIN_NAPI_ID || napi_id == ep->napi_id)
+		return;
+
+	/* record NAPI ID for use in next busy poll */
+	ep->napi_id = napi_id;
+}
+
+static long ep_busy_poll_ioctl(struct eventpoll *ep, unsigned int cmd,
+			       struct epoll_params __user *uparams)
+{
+	struct epoll_params params;
+
+	switch (cmd) {
+	case EPIOCSPARAMS:
+		if (copy_from_user(&params, uparams, sizeof(params)))
+			return -EFAULT;
+		if (params.__pad || params.busy_poll_usecs > S32_MAX)
+			return -EINVAL;
+		WRITE_ONCE(ep->busy_poll_usecs, params.busy_poll_usecs);
+		return 0;
+	case EPIOCGPARAMS:
+		memset(&params, 0, sizeof(params));
+		params.busy_poll_usecs = READ_ONCE(ep->busy_poll_usecs);
+		params.busy_poll_loops = atomic_long_read(&ep->busy_poll_loops);
+		params.busy_poll_hits = atomic_long_read(&ep->busy_poll_hits);
+		if (copy_to_user(uparams, &params, sizeof(params)))
+			return -EFAULT;
+		return 0;
+	}
+	return -ENOIOCTLCMD;
+}
+#else
+static inline void ep_busy_loop(struct eventpoll *ep, int nonblock)
+{
+}
+
+static inline void ep_reset_busy_poll_napi_id(struct eventpoll *ep)
+{
+}
+
+static inline void ep_set_busy_poll_napi_id(struct epitem *epi)
+{
+}
+
+static long ep_busy_poll_ioctl(struct eventpoll *ep, unsigned int cmd,
+			       struct epoll_params __user *uparams)
+{
+	return -EOPNOTSUPP;
+}
+#endif /* CONFIG_NET_RX_BUSY_POLL */
+
 /**
  * ep_call_nested - Perform a bound (possibly) nested call, by checking
  *                  that the recursion limit is not exceeded, and that
@@ -569,16 +804,42 @@ static inline bool ep_has_wakeup_source(struct epitem *epi)
 	return rcu_access_pointer(epi->ws) ? true : false;
 }
 
-/* call when ep->mtx cannot be held (ep_poll_callback) */
-static inline void ep_pm_stay_awake_rcu(struct epitem *epi)
+/*
+ * Move the items queued by the poll callback on ep->ovflist to the ready list,
+ * in the order they were queued. Items already linked, e.g. on the txlist of
+ * ep_scan_ready_list(), are left alone. Must be called with "mtx" held.
+ */
+static void ep_flush_ovflist(struct eventpoll *ep)
 {
-	struct wakeup_source *ws;
+	struct llist_node *head;
+	struct epitem *epi, *tmp;
 
-	rcu_read_lock();
-	ws = rcu_dereference(epi->ws);
-	if (ws)
-		__pm_stay_awake(ws);
-	rcu_read_unlock();
+	head = llist_reverse_order(llist_del_all(&ep->ovflist));
+	llist_for_each_entry_safe(epi, tmp, head, ovfnode) {
+		/*
+		 * From here on ep_poll_callback() may queue the item again,
+		 * the next flush will then find it already linked.
+		 */
+		smp_store_release(&epi->ovfnode.next, EP_UNACTIVE_PTR);
+
+		if (!ep_is_linked(&epi->rdllink)) {
+			list_add_tail(&epi->rdllink, &ep->rdllist);
+			ep_pm_stay_awake(epi);
+		}
+	}
+}
+
+/*
+ * Take @epi off the ready list, including an event still pending for it on
+ * ep->ovflist. Must be called with "mtx" held, after the poll hooks are gone.
+ */
+static void ep_unlink_ready(struct eventpoll *ep, struct epitem *epi)
+{
+	if (READ_ONCE(epi->ovfnode.next) != EP_UNACTIVE_PTR)
+		ep_flush_ovflist(ep);
+
+	if (ep_is_linked(&epi->rdllink))
+		list_del_init(&epi->rdllink);
 }
 
 /**
@@ -600,8 +861,6 @@ static int ep_scan_ready_list(struct eventpoll *ep,
 			      void *priv, int depth, bool ep_locked)
 {
 	int error, pwake = 0;
-	unsigned long flags;
-	struct epitem *epi, *nepi;
 	LIST_HEAD(txlist);
 
 	/*
@@ -613,66 +872,47 @@ static int ep_scan_ready_list(struct eventpoll *ep,
 		mutex_lock_nested(&ep->mtx, depth);
 
 	/*
-	 * Steal the ready list, and re-init the original one to the
-	 * empty list. Also, set ep->ovflist to NULL so that events
-	 * happening while looping w/out locks, are not lost. We cannot
-	 * have the poll callback to queue directly on ep->rdllist,
-	 * because we want the "sproc" callback to be able to do it
-	 * in a lockless way.
+	 * Collect what the poll callback queued so far, then steal the
+	 * ready list, and re-init the original one to the empty list.
+	 * Events happening while looping are queued on ep->ovflist by
+	 * the poll callback, which never touches ep->rdllist, so the
+	 * "sproc" callback can re-insert items there without locks.
 	 */
-	spin_lock_irqsave(&ep->lock, flags);
+	ep_flush_ovflist(ep);
 	list_splice_init(&ep->rdllist, &txlist);
-	ep->ovflist = NULL;
-	spin_unlock_irqrestore(&ep->lock, flags);
 
 	/*
 	 * Now call the callback function.
 	 */
 	error = (*sproc)(ep, &txlist, priv);
 
-	spin_lock_irqsave(&ep->lock, flags);
-	/*
-	 * During the time we spent inside the "sproc" callback, some
-	 * other events might have been queued by the poll callback.
-	 * We re-insert them inside the main ready-list here.
-	 */
-	for (nepi = ep->ovflist; (epi = nepi) != NULL;
-	     nepi = epi->next, epi->next = EP_UNACTIVE_PTR) {
-		/*
-		 * We need to check if the item is already in the list.
-		 * During the "sproc" callback execution time, items are
-		 * queued into ->ovflist but the "txlist" might already
-		 * contain them, and the list_splice() below takes care of them.
-		 */
-		if (!ep_is_linked(&epi->rdllink)) {
-			list_add_tail(&epi->rdllink, &ep->rdllist);
-			ep_pm_stay_awake(epi);
-		}
-	}
 	/*
-	 * We need to set back ep->ovflist to EP_UNACTIVE_PTR, so that after
-	 * releasing the lock, events will be queued in the normal way inside
-	 * ep->rdllist.
+	 * Drop ep->ws before collecting the events queued during the "sproc"
+	 * callback: the flush below keeps each of them awake through epi->ws,
+	 * and a callback racing with us activates ep->ws again.
 	 */
-	ep->ovflist = EP_UNACTIVE_PTR;
+	__pm_relax(ep->ws);
 
 	/*
-	 * Quickly re-inject items left on "txlist".
+	 * During the time we spent inside the "sproc" callback, some
+	 * other events might have been queued by the poll callback.
+	 * We insert them inside the main ready-list here. Items still
+	 * on "txlist" are skipped, and re-injected by the list_splice()
+	 * below.
 	 */
+	ep_flush_ovflist(ep);
 	list_splice(&txlist, &ep->rdllist);
-	__pm_relax(ep->ws);
 
 	if (!list_empty(&ep->rdllist)) {
 		/*
 		 * Wake up (if active) both the eventpoll wait list and
 		 * the ->poll() wait list (delayed after we release the lock).
 		 */
-		if (waitqueue_active(&ep->wq))
-			wake_up_locked(&ep->wq);
+		if (wq_has_sleeper(&ep->wq))
+			wake_up(&ep->wq);
 		if (waitqueue_active(&ep->poll_wait))
 			pwake++;
 	}
-	spin_unlock_irqrestore(&ep->lock, flags);
 
 	if (!ep_locked)
 		mutex_unlock(&ep->mtx);
@@ -696,16 +936,13 @@ static void epi_rcu_free(struct rcu_head *head)
  */
 static int ep_remove(struct eventpoll *ep, struct epitem *epi)
 {
-	unsigned long flags;
 	struct file *file = epi->ffd.file;
 
 	/*
-	 * Removes poll wait queue hooks. We _have_ to do this without holding
-	 * the "ep->lock" otherwise a deadlock might occur. This because of the
-	 * sequence of the lock acquisition. Here we do "ep->lock" then the wait
-	 * queue head lock when unregistering the wait queue. The wakeup callback
-	 * will run by holding the wait queue head lock and will call our callback
-	 * that will try to get "ep->lock".
+	 * Removes poll wait queue hooks. Once this is done no poll callback can
+	 * be running for this item anymore: it runs holding the wait queue head
+	 * lock, which remove_wait_queue() takes. The callback might have queued
+	 * the item on ep->ovflist before, which we clean up below.
 	 */
 	ep_unregister_pollwait(ep, epi);
 
@@ -716,10 +953,10 @@ static int ep_remove(struct eventpoll *ep, struct epitem *epi)
 
 	rb_erase(&epi->rbn, &ep->rbr);
 
-	spin_lock_irqsave(&ep->lock, flags);
-	if (ep_is_linked(&epi->rdllink))
-		list_del_init(&epi->rdllink);
-	spin_unlock_irqrestore(&ep->lock, flags);
+	if (ep_has_uring(ep))
+		ep_uitem_free(ep, epi);
+	else
+		ep_unlink_ready(ep, epi);
 
 	wakeup_source_unregister(ep_wakeup_source(epi));
 	/*
@@ -769,7 +1006,7 @@ static void ep_free(struct eventpoll *ep)
 	 * Walks through the whole tree by freeing each "struct epitem". At this
 	 * point we are sure no poll callbacks will be lingering around, and also by
 	 * holding "epmutex" we can be sure that no file cleanup code will hit
-	 * us during this operation. So we can avoid the lock on "ep->lock".
+	 * us during this operation.
 	 * We do not need to lock ep->mtx, either, we only do it to prevent
 	 * a lockdep warning.
 	 */
@@ -785,6 +1022,8 @@ static void ep_free(struct eventpoll *ep)
 	mutex_destroy(&ep->mtx);
 	free_uid(ep->user);
 	wakeup_source_unregister(ep->ws);
+	vfree(ep->uheader);
+	kfree(ep->uitems_map);
 	kfree(ep);
 }
 
@@ -862,6 +1101,10 @@ static unsigned int ep_eventpoll_poll(struct file *file, poll_table *wait)
 	/* Insert inside our poll wait queue */
 	poll_wait(file, &ep->poll_wait, wait);
 
+	/* Items of a user mapped ring are never on the ready list */
+	if (ep_has_uring(ep))
+		return ep_uring_count(ep) ? POLLIN | POLLRDNORM : 0;
+
 	/*
 	 * Proceed to find out if wanted events are really available inside
 	 * the ready list. This need to be done under ep_call_nested()
@@ -891,6 +1134,109 @@ static void ep_show_fdinfo(struct seq_file *m, struct file *f)
 			break;
 	}
 	mutex_unlock(&ep->mtx);
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	seq_printf(m, "busy_poll: napi_id: %u usecs: %u loops: %ld hits: %ld\n",
+		   READ_ONCE(ep->napi_id), READ_ONCE(ep->busy_poll_usecs),
+		   atomic_long_read(&ep->busy_poll_loops),
+		   atomic_long_read(&ep->busy_poll_hits));
+#endif
+}
+#endif
+
+/*
+ * Set up the user mapped ring of an EPOLL_USERPOLL instance. The first mmap()
+ * sizes it: the header is followed by as many items, and ring entries, as fit
+ * in the mapping, rounded down to a power of two. Later mappings share it.
+ */
+static int ep_eventpoll_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct eventpoll *ep = file->private_data;
+	unsigned long size = vma->vm_end - vma->vm_start;
+	struct epoll_uheader *uheader;
+	unsigned long nr, i;
+	int error;
+
+	if (!ep->userpoll || vma->vm_pgoff)
+		return -EINVAL;
+
+	/*
+	 * Not ep->mtx: we are called with mmap_sem held, which ep_send_events()
+	 * takes with ep->mtx held when copying to user space faults.
+	 */
+	mutex_lock(&ep_uring_mutex);
+	if (ep->uheader) {
+		error = remap_vmalloc_range(vma, ep->uheader, 0);
+		goto out_unlock;
+	}
+
+	error = -EINVAL;
+	if (size < sizeof(*uheader) || size > EP_UHEADER_MAX_SIZE)
+		goto out_unlock;
+
+	nr = (size - sizeof(*uheader)) /
+		(sizeof(struct epoll_uitem) + sizeof(u32));
+	if (!nr)
+		goto out_unlock;
+	nr = rounddown_pow_of_two(nr);
+
+	error = -ENOMEM;
+	ep->uitems_map = kcalloc(BITS_TO_LONGS(nr), sizeof(long), GFP_KERNEL);
+	if (!ep->uitems_map)
+		goto out_unlock;
+
+	uheader = vmalloc_user(size);
+	if (!uheader)
+		goto out_free_map;
+
+	uheader->max_items = nr;
+	uheader->items_offset = sizeof(*uheader);
+	uheader->ring_offset = sizeof(*uheader) +
+		nr * sizeof(struct epoll_uitem);
+	ep->uitems = (void *)uheader + uheader->items_offset;
+	ep->uring = (void *)uheader + uheader->ring_offset;
+	for (i = 0; i < nr; i++)
+		ep->uring[i] = EPOLL_UINDEX_EMPTY;
+
+	error = remap_vmalloc_range(vma, uheader, 0);
+	if (error) {
+		vfree(uheader);
+		goto out_free_map;
+	}
+
+	ep->uring_mask = nr - 1;
+	/* Publish last, pairs with ep_has_uring() */
+	smp_store_release(&ep->uheader, uheader);
+	mutex_unlock(&ep_uring_mutex);
+
+	return 0;
+
+out_free_map:
+	kfree(ep->uitems_map);
+	ep->uitems_map = NULL;
+out_unlock:
+	mutex_unlock(&ep_uring_mutex);
+	return error;
+}
+
+static long ep_eventpoll_ioctl(struct file *file, unsigned int cmd,
+			       unsigned long arg)
+{
+	struct eventpoll *ep = file->private_data;
+
+	switch (cmd) {
+	case EPIOCSPARAMS:
+	case EPIOCGPARAMS:
+		return ep_busy_poll_ioctl(ep, cmd, (void __user *)arg);
+	}
+	return -ENOIOCTLCMD;
+}
+
+#ifdef CONFIG_COMPAT
+/* struct epoll_params has the same layout, only the pointer needs converting */
+static long ep_eventpoll_compat_ioctl(struct file *file, unsigned int cmd,
+				      unsigned long arg)
+{
+	return ep_eventpoll_ioctl(file, cmd, (unsigned long)compat_ptr(arg));
 }
 #endif
 
@@ -901,6 +1247,11 @@ static const struct file_operations eventpoll_fops = {
 #endif
 	.release	= ep_eventpoll_release,
 	.poll		= ep_eventpoll_poll,
+	.mmap		= ep_eventpoll_mmap,
+	.unlocked_ioctl	= ep_eventpoll_ioctl,
+#ifdef CONFIG_COMPAT
+	.compat_ioctl	= ep_eventpoll_compat_ioctl,
+#endif
 	.llseek		= noop_llseek,
 };
 
@@ -949,13 +1300,12 @@ static int ep_alloc(struct eventpoll **pep)
 	if (unlikely(!ep))
 		goto free_uid;
 
-	spin_lock_init(&ep->lock);
 	mutex_init(&ep->mtx);
 	init_waitqueue_head(&ep->wq);
 	init_waitqueue_head(&ep->poll_wait);
 	INIT_LIST_HEAD(&ep->rdllist);
 	ep->rbr = RB_ROOT;
-	ep->ovflist = EP_UNACTIVE_PTR;
+	init_llist_head(&ep->ovflist);
 	ep->user = user;
 
 	*pep = ep;
@@ -1004,9 +1354,9 @@ static struct epitem *ep_find(struct eventpoll *ep, struct file *file, int fd)
 static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *key)
 {
 	int pwake = 0;
-	unsigned long flags;
 	struct epitem *epi = ep_item_from_wait(wait);
 	struct eventpoll *ep = epi->ep;
+	unsigned int events = READ_ONCE(epi->event.events);
 	int ewake = 0;
 
 	if ((unsigned long)key & POLLFREE) {
@@ -1020,16 +1370,14 @@ static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *k
 		list_del_init(&wait->task_list);
 	}
 
-	spin_lock_irqsave(&ep->lock, flags);
-
 	/*
 	 * If the event mask does not contain any poll(2) event, we consider the
 	 * descriptor to be disabled. This condition is likely the effect of the
 	 * EPOLLONESHOT bit that disables the descriptor when an event is received,
 	 * until the next EPOLL_CTL_MOD will be issued.
 	 */
-	if (!(epi->event.events & ~EP_PRIVATE_BITS))
-		goto out_unlock;
+	if (!(events & ~EP_PRIVATE_BITS))
+		goto out;
 
 	/*
 	 * Check the events coming with the callback. At this stage, not
@@ -1037,51 +1385,43 @@ static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *k
 	 * callback. We need to be able to handle both cases here, hence the
 	 * test for "key" != NULL before the event match test.
 	 */
-	if (key && !((unsigned long) key & epi->event.events))
-		goto out_unlock;
-
-	/*
-	 * If we are transferring events to userspace, we can hold no locks
-	 * (because we're accessing user memory, and because of linux f_op->poll()
-	 * semantics). All the events that happen during that period of time are
-	 * chained in ep->ovflist and requeued later on.
-	 */
-	if (unlikely(ep->ovflist != EP_UNACTIVE_PTR)) {
-		if (epi->next == EP_UNACTIVE_PTR) {
-			epi->next = ep->ovflist;
-			ep->ovflist = epi;
-			if (epi->ws) {
-				/*
-				 * Activate ep->ws since epi->ws may get
-				 * deactivated at any time.
-				 */
-				__pm_stay_awake(ep->ws);
-			}
+	if (key && !((unsigned long) key & events))
+		goto out;
 
-		}
-		goto out_unlock;
-	}
-
-	/* If this file is already in the ready list we exit soon */
-	if (!ep_is_linked(&epi->rdllink)) {
-		list_add_tail(&epi->rdllink, &ep->rdllist);
-		ep_pm_stay_awake_rcu(epi);
+	if (ep_has_uring(ep)) {
+		/*
+		 * Without a key we don't know what happened, report all the
+		 * requested events and let user space find out.
+		 */
+		ep_uring_post(ep, epi, key ? (unsigned long)key & events :
+					     events & ~EP_PRIVATE_BITS);
+	} else if (cmpxchg(&epi->ovfnode.next, EP_UNACTIVE_PTR, NULL) ==
+		   EP_UNACTIVE_PTR) {
+		/*
+		 * The item was not queued yet. Activate ep->ws since epi->ws
+		 * may get deactivated at any time; ep_flush_ovflist() hands
+		 * over to epi->ws when moving the item to the ready list.
+		 */
+		if (ep_has_wakeup_source(epi))
+			__pm_stay_awake(ep->ws);
+		llist_add(&epi->ovfnode, &ep->ovflist);
 	}
 
 	/*
 	 * Wake up ( if active ) both the eventpoll wait list and the ->poll()
-	 * wait list.
+	 * wait list. The barrier in wq_has_sleeper() orders the queueing above
+	 * against the set_current_state() of a waiter in ep_poll().
 	 */
-	if (waitqueue_active(&ep->wq)) {
-		if ((epi->event.events & EPOLLEXCLUSIVE) &&
+	if (wq_has_sleeper(&ep->wq)) {
+		if ((events & EPOLLEXCLUSIVE) &&
 					!((unsigned long)key & POLLFREE)) {
 			switch ((unsigned long)key & EPOLLINOUT_BITS) {
 			case POLLIN:
-				if (epi->event.events & POLLIN)
+				if (events & POLLIN)
 					ewake = 1;
 				break;
 			case POLLOUT:
-				if (epi->event.events & POLLOUT)
+				if (events & POLLOUT)
 					ewake = 1;
 				break;
 			case 0:
@@ -1089,19 +1429,16 @@ static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *k
 				break;
 			}
 		}
-		wake_up_locked(&ep->wq);
+		wake_up(&ep->wq);
 	}
 	if (waitqueue_active(&ep->poll_wait))
 		pwake++;
 
-out_unlock:
-	spin_unlock_irqrestore(&ep->lock, flags);
-
-	/* We have to call this outside the lock */
+out:
 	if (pwake)
 		ep_poll_safewake(&ep->poll_wait);
 
-	if (epi->event.events & EPOLLEXCLUSIVE)
+	if (events & EPOLLEXCLUSIVE)
 		return ewake;
 
 	return 1;
@@ -1294,11 +1631,14 @@ static int ep_insert(struct eventpoll *ep, struct epoll_event *event,
 		     struct file *tfile, int fd, int full_check)
 {
 	int error, revents, pwake = 0;
-	unsigned long flags;
 	long user_watches;
 	struct epitem *epi;
 	struct ep_pqueue epq;
 
+	/* Items of an EPOLL_USERPOLL instance need the ring to be mapped */
+	if (ep->userpoll && !ep_has_uring(ep))
+		return -EINVAL;
+
 	user_watches = atomic_long_read(&ep->user->epoll_watches);
 	if (unlikely(user_watches >= max_user_watches))
 		return -ENOSPC;
@@ -1313,7 +1653,13 @@ static int ep_insert(struct eventpoll *ep, struct epoll_event *event,
 	ep_set_ffd(&epi->ffd, tfile, fd);
 	epi->event = *event;
 	epi->nwait = 0;
-	epi->next = EP_UNACTIVE_PTR;
+	if (ep_has_uring(ep)) {
+		error = ep_uitem_alloc(ep, epi);
+		if (error)
+			goto error_create_wakeup_source;
+	} else {
+		epi->ovfnode.next = EP_UNACTIVE_PTR;
+	}
 	if (epi->event.events & EPOLLWAKEUP) {
 		error = ep_create_wakeup_source(epi);
 		if (error)
@@ -1360,23 +1706,25 @@ static int ep_insert(struct eventpoll *ep, struct epoll_event *event,
 	if (full_check && reverse_path_check())
 		goto error_remove_epi;
 
-	/* We have to drop the new item inside our item list to keep track of it */
-	spin_lock_irqsave(&ep->lock, flags);
+	/* Sockets may already know which NAPI context feeds them */
+	ep_set_busy_poll_napi_id(epi);
 
 	/* If the file is already "ready" we drop it inside the ready list */
-	if ((revents & event->events) && !ep_is_linked(&epi->rdllink)) {
-		list_add_tail(&epi->rdllink, &ep->rdllist);
-		ep_pm_stay_awake(epi);
+	if (revents & event->events) {
+		if (ep_has_uring(ep)) {
+			ep_uring_post(ep, epi, revents & event->events);
+		} else if (!ep_is_linked(&epi->rdllink)) {
+			list_add_tail(&epi->rdllink, &ep->rdllist);
+			ep_pm_stay_awake(epi);
+		}
 
 		/* Notify waiting tasks that events are available */
-		if (waitqueue_active(&ep->wq))
-			wake_up_locked(&ep->wq);
+		if (wq_has_sleeper(&ep->wq))
+			wake_up(&ep->wq);
 		if (waitqueue_active(&ep->poll_wait))
 			pwake++;
 	}
 
-	spin_unlock_irqrestore(&ep->lock, flags);
-
 	atomic_long_inc(&ep->user->epoll_watches);
 
 	/* We have to call this outside the lock */
@@ -1397,14 +1745,13 @@ error_unregister:
 
 	/*
 	 * We need to do this because an event could have been arrived on some
-	 * allocated wait queue. Note that we don't care about the ep->ovflist
-	 * list, since that is used/cleaned only inside a section bound by "mtx".
-	 * And ep_insert() is called with "mtx" held.
+	 * allocated wait queue, and queued the item on ep->ovflist or on the
+	 * user mapped ring.
 	 */
-	spin_lock_irqsave(&ep->lock, flags);
-	if (ep_is_linked(&epi->rdllink))
-		list_del_init(&epi->rdllink);
-	spin_unlock_irqrestore(&ep->lock, flags);
+	if (ep_has_uring(ep))
+		ep_uitem_free(ep, epi);
+	else
+		ep_unlink_ready(ep, epi);
 
 	wakeup_source_unregister(ep_wakeup_source(epi));
 
@@ -1433,6 +1780,10 @@ static int ep_modify(struct eventpoll *ep, struct epitem *epi, struct epoll_even
 	 */
 	epi->event.events = event->events; /* need barrier below */
 	epi->event.data = event->data; /* protected by mtx */
+	if (ep_has_uring(ep)) {
+		WRITE_ONCE(ep->uitems[epi->uindex].data, event->data);
+		WRITE_ONCE(ep->uitems[epi->uindex].events, event->events);
+	}
 	if (epi->event.events & EPOLLWAKEUP) {
 		if (!ep_has_wakeup_source(epi))
 			ep_create_wakeup_source(epi);
@@ -1446,9 +1797,8 @@ static int ep_modify(struct eventpoll *ep, struct epitem *epi, struct epoll_even
 	 * 1) Flush epi changes above to other CPUs.  This ensures
 	 *    we do not miss events from ep_poll_callback if an
 	 *    event occurs immediately after we call f_op->poll().
-	 *    We need this because we did not take ep->lock while
-	 *    changing epi above (but ep_poll_callback does take
-	 *    ep->lock).
+	 *    We need this because ep_poll_callback reads epi
+	 *    without any lock.
 	 *
 	 * 2) We also need to ensure we do not miss _past_ events
 	 *    when calling f_op->poll().  This barrier also
@@ -1471,18 +1821,18 @@ static int ep_modify(struct eventpoll *ep, struct epitem *epi, struct epoll_even
 	 * list, push it inside.
 	 */
 	if (revents & event->events) {
-		spin_lock_irq(&ep->lock);
-		if (!ep_is_linked(&epi->rdllink)) {
+		if (ep_has_uring(ep)) {
+			ep_uring_post(ep, epi, revents & event->events);
+		} else if (!ep_is_linked(&epi->rdllink)) {
 			list_add_tail(&epi->rdllink, &ep->rdllist);
 			ep_pm_stay_awake(epi);
-
-			/* Notify waiting tasks that events are available */
-			if (waitqueue_active(&ep->wq))
-				wake_up_locked(&ep->wq);
-			if (waitqueue_active(&ep->poll_wait))
-				pwake++;
 		}
-		spin_unlock_irq(&ep->lock);
+
+		/* Notify waiting tasks that events are available */
+		if (wq_has_sleeper(&ep->wq))
+			wake_up(&ep->wq);
+		if (waitqueue_active(&ep->poll_wait))
+			pwake++;
 	}
 
 	/* We have to call this outside the lock */
@@ -1541,6 +1891,8 @@ static int ep_send_events_proc(struct eventpoll *ep, struct list_head *head,
 		 * can change the item.
 		 */
 		if (revents) {
+			ep_set_busy_poll_napi_id(epi);
+
 			if (__put_user(revents, &uevent->events) ||
 			    __put_user(epi->event.data, &uevent->data)) {
 				list_add(&epi->rdllink, head);
@@ -1577,6 +1929,13 @@ static int ep_send_events(struct eventpoll *ep,
 {
 	struct ep_send_events_data esed;
 
+	/*
+	 * The events of a user mapped ring have been delivered already, just
+	 * tell how many entries are waiting there.
+	 */
+	if (ep_has_uring(ep))
+		return min_t(unsigned int, ep_uring_count(ep), maxevents);
+
 	esed.maxevents = maxevents;
 	esed.events = events;
 
@@ -1615,7 +1974,6 @@ static int ep_poll(struct eventpoll *ep, struct epoll_event __user *events,
 		   int maxevents, long timeout)
 {
 	int res = 0, eavail, timed_out = 0;
-	unsigned long flags;
 	u64 slack = 0;
 	wait_queue_t wait;
 	ktime_t expires, *to = NULL;
@@ -1632,27 +1990,35 @@ static int ep_poll(struct eventpoll *ep, struct epoll_event __user *events,
 		 * caller specified a non blocking operation.
 		 */
 		timed_out = 1;
-		spin_lock_irqsave(&ep->lock, flags);
 		goto check_events;
 	}
 
 fetch_events:
-	spin_lock_irqsave(&ep->lock, flags);
+	if (!ep_events_available(ep))
+		ep_busy_loop(ep, timed_out);
 
 	if (!ep_events_available(ep)) {
+		/*
+		 * Busy poll timed out.  Drop NAPI ID for now, we can add
+		 * it back in when we have moved a socket with a valid NAPI
+		 * ID onto the ready list.
+		 */
+		ep_reset_busy_poll_napi_id(ep);
+
 		/*
 		 * We don't have any available event to return to the caller.
 		 * We need to sleep here, and we will be wake up by
 		 * ep_poll_callback() when events will become available.
 		 */
 		init_waitqueue_entry(&wait, current);
-		__add_wait_queue_exclusive(&ep->wq, &wait);
+		add_wait_queue_exclusive(&ep->wq, &wait);
 
 		for (;;) {
 			/*
 			 * We don't want to sleep if the ep_poll_callback() sends us
 			 * a wakeup in between. That's why we set the task state
-			 * to TASK_INTERRUPTIBLE before doing the checks.
+			 * to TASK_INTERRUPTIBLE before doing the checks; this
+			 * pairs with wq_has_sleeper() in the wakers.
 			 */
 			set_current_state(TASK_INTERRUPTIBLE);
 			if (ep_events_available(ep) || timed_out)
@@ -1662,22 +2028,17 @@ fetch_events:
 				break;
 			}
 
-			spin_unlock_irqrestore(&ep->lock, flags);
 			if (!schedule_hrtimeout_range(to, slack, HRTIMER_MODE_ABS))
 				timed_out = 1;
-
-			spin_lock_irqsave(&ep->lock, flags);
 		}
 
-		__remove_wait_queue(&ep->wq, &wait);
 		__set_current_state(TASK_RUNNING);
+		remove_wait_queue(&ep->wq, &wait);
 	}
 check_events:
 	/* Is it worth to try to dig for events ? */
 	eavail = ep_events_available(ep);
 
-	spin_unlock_irqrestore(&ep->lock, flags);
-
 	/*
 	 * Try to transfer events to user space. In case we get 0 events and
 	 * there's still timeout left over, we go trying again in search of
@@ -1798,8 +2159,9 @@ SYSCALL_DEFINE1(epoll_create1, int, flags)
 
 	/* Check the EPOLL_* constant for consistency.  */
 	BUILD_BUG_ON(EPOLL_CLOEXEC != O_CLOEXEC);
+	BUILD_BUG_ON(EPOLL_USERPOLL & O_CLOEXEC);
 
-	if (flags & ~EPOLL_CLOEXEC)
+	if (flags & ~(EPOLL_CLOEXEC | EPOLL_USERPOLL))
 		return -EINVAL;
 	/*
 	 * Create the internal data structure ("struct eventpoll").
@@ -1807,6 +2169,7 @@ SYSCALL_DEFINE1(epoll_create1, int, flags)
 	error = ep_alloc(&ep);
 	if (error < 0)
 		return error;
+	ep->userpoll = flags & EPOLL_USERPOLL;
 	/*
 	 * Creates all the items needed to setup an eventpoll file. That is,
 	 * a file structure and a free file descriptor.
@@ -1909,6 +2272,15 @@ SYSCALL_DEFINE4(epoll_ctl, int, epfd, int, op, int, fd,
 	 */
 	ep = f.file->private_data;
 
+	/*
+	 * Events of an EPOLL_USERPOLL instance are reported through the user
+	 * mapped ring, which only does edge triggered, plain event reporting.
+	 */
+	if (ep->userpoll && ep_op_has_event(op) &&
+	    (!(epds.events & EPOLLET) ||
+	     (epds.events & (EPOLLONESHOT | EPOLLWAKEUP | EPOLLEXCLUSIVE))))
+		goto error_tgt_fput;
+
 	/*
 	 * When we insert an epoll file descriptor, inside another epoll file
 	 * descriptor, there is the change of creating closed loops, which are
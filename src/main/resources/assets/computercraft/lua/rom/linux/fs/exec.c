@@ -25,6 +25,7 @@
 #include <linux/slab.h>
 #include <linux/file.h>
 #include <linux/fdtable.h>
+#include <linux/poll.h>
 #include <linux/mm.h>
 #include <linux/vmacache.h>
 #include <linux/stat.h>
@@ -62,6 +63,7 @@
 #include <linux/oom.h>
 #include <linux/compat.h>
 #include <linux/vmalloc.h>
+#include <linux/sched/clock.h>
 
 #include <linux/uaccess.h>
 #include <asm/mmu_context.h>
@@ -72,6 +74,9 @@
 
 #include <trace/events/sched.h>
 
+#define CREATE_TRACE_POINTS
+#include <trace/events/exec.h>
+
 int suid_dumpable = 0;
 
 static LIST_HEAD(formats);
@@ -1279,6 +1284,8 @@ int flush_old_exec(struct linux_binprm * bprm)
 	 * trying to access the should-be-closed file descriptors of a process
 	 * undergoing exec(2).
 	 */
+	exit_poll_cache(current);
+	exit_fd_cache(current);
 	do_close_on_exec(current->files);
 	return 0;
 
@@ -1308,6 +1315,25 @@ void would_dump(struct linux_binprm *bprm, struct file *file)
 }
 EXPORT_SYMBOL(would_dump);
 
+/*
+ * Report the time since the previous mark as spent in @phase.  Only the
+ * tracepoint's static key is tested while nobody listens.
+ */
+void exec_phase_end(struct linux_binprm *bprm, enum exec_phase phase)
+{
+	u64 now;
+
+	if (!trace_exec_phase_enabled()) {
+		bprm->phase_start = 0;
+		return;
+	}
+
+	now = local_clock();
+	if (bprm->phase_start)
+		trace_exec_phase(bprm, phase, now - bprm->phase_start);
+	bprm->phase_start = now;
+}
+
 void setup_new_exec(struct linux_binprm * bprm)
 {
 	arch_pick_mmap_layout(current->mm);
@@ -1697,6 +1723,9 @@ static int do_execveat_common(int fd, struct filename *filename,
 	if (!bprm)
 		goto out_files;
 
+	if (trace_exec_phase_enabled())
+		bprm->phase_start = local_clock();
+
 	retval = prepare_bprm_creds(bprm);
 	if (retval)
 		goto out_free;
@@ -1708,6 +1737,7 @@ static int do_execveat_common(int fd, struct filename *filename,
 	retval = PTR_ERR(file);
 	if (IS_ERR(file))
 		goto out_unmark;
+	exec_phase_end(bprm, EXEC_PHASE_OPEN);
 
 	sched_exec();
 
@@ -1765,10 +1795,12 @@ static int do_execveat_common(int fd, struct filename *filename,
 		goto out;
 
 	would_dump(bprm, bprm->file);
+	exec_phase_end(bprm, EXEC_PHASE_ARGS);
 
 	retval = exec_binprm(bprm);
 	if (retval < 0)
 		goto out;
+	exec_phase_end(bprm, EXEC_PHASE_LOAD);
 
 	/* execve succeeded */
 	current->fs->in_exec = 0;
@@ -112,7 +112,12 @@
  *	next extent, adding a extent(a range of blocks) and removing a extent.
  *
  *   --	race on a extent status tree
- *	Extent status tree is protected by inode->i_es_lock.
+ *	Extent status tree is protected by inode->i_es_lock.  Writers also
+ *	bump inode->i_es_seq while they hold the lock, which lets
+ *	ext4_es_lookup_extent() walk the tree under RCU alone and retry
+ *	with the lock only when the tree changed under it.  Extent status
+ *	objects are allocated from a SLAB_DESTROY_BY_RCU cache so a lockless
+ *	reader never touches memory that is not an extent_status.
  *
  *   --	memory consumption
  *      Fragmented extent tree will make extent status tree cost too much
@@ -153,7 +158,8 @@ int __init ext4_init_es(void)
 {
 	ext4_es_cachep = kmem_cache_create("ext4_extent_status",
 					   sizeof(struct extent_status),
-					   0, (SLAB_RECLAIM_ACCOUNT), NULL);
+					   0, (SLAB_RECLAIM_ACCOUNT|
+					       SLAB_DESTROY_BY_RCU), NULL);
 	if (ext4_es_cachep == NULL)
 		return -ENOMEM;
 	return 0;
@@ -355,6 +361,12 @@ ext4_es_alloc_extent(struct inode *inode, ext4_lblk_t lblk, ext4_lblk_t len,
 
 static void ext4_es_free_extent(struct inode *inode, struct extent_status *es)
 {
+	struct ext4_es_tree *tree = &EXT4_I(inode)->i_es_tree;
+
+	/* Lockless readers trust cache_es once i_es_seq is stable */
+	if (tree->cache_es == es)
+		tree->cache_es = NULL;
+
 	EXT4_I(inode)->i_es_all_nr--;
 	percpu_counter_dec(&EXT4_SB(inode->i_sb)->s_es_stats.es_stats_all_cnt);
 
@@ -673,7 +685,7 @@ static int __es_insert_extent(struct inode *inode, struct extent_status *newes)
 				  newes->es_pblk);
 	if (!es)
 		return -ENOMEM;
-	rb_link_node(&es->rb_node, parent, p);
+	rb_link_node_rcu(&es->rb_node, parent, p);
 	rb_insert_color(&es->rb_node, &tree->root);
 
 out:
@@ -719,6 +731,7 @@ int ext4_es_insert_extent(struct inode *inode, ext4_lblk_t lblk,
 	ext4_es_insert_extent_check(inode, &newes);
 
 	write_lock(&EXT4_I(inode)->i_es_lock);
+	write_seqcount_begin(&EXT4_I(inode)->i_es_seq);
 	err = __es_remove_extent(inode, lblk, end);
 	if (err != 0)
 		goto error;
@@ -731,6 +744,7 @@ retry:
 		err = 0;
 
 error:
+	write_seqcount_end(&EXT4_I(inode)->i_es_seq);
 	write_unlock(&EXT4_I(inode)->i_es_lock);
 
 	ext4_es_print_tree(inode);
@@ -762,13 +776,87 @@ void ext4_es_cache_extent(struct inode *inode, ext4_lblk_t lblk,
 	BUG_ON(end < lblk);
 
 	write_lock(&EXT4_I(inode)->i_es_lock);
+	write_seqcount_begin(&EXT4_I(inode)->i_es_seq);
 
 	es = __es_tree_search(&EXT4_I(inode)->i_es_tree.root, lblk);
 	if (!es || es->es_lblk > end)
 		__es_insert_extent(inode, &newes);
+	write_seqcount_end(&EXT4_I(inode)->i_es_seq);
 	write_unlock(&EXT4_I(inode)->i_es_lock);
 }
 
+/*
+ * A red-black tree holding fewer than 2^32 extents is less than 64 levels
+ * deep.  A lockless walk that goes further has been led astray by a
+ * concurrent rotation.
+ */
+#define ES_LOCKLESS_MAX_DEPTH	64
+
+/*
+ * Look up @lblk without taking i_es_lock.  The tree is walked under RCU
+ * and whatever was found is validated against i_es_seq afterwards.
+ *
+ * Return 1 on found, 0 on not, and -EAGAIN if the caller has to take
+ * i_es_lock: the tree changed under us, or the extent found still needs
+ * its referenced bit set, which only the locked path may do.
+ */
+static int __es_lookup_extent_rcu(struct inode *inode, ext4_lblk_t lblk,
+				  struct extent_status *es)
+{
+	struct ext4_inode_info *ei = EXT4_I(inode);
+	struct ext4_es_tree *tree = &ei->i_es_tree;
+	struct extent_status *es1;
+	struct rb_node *node;
+	ext4_lblk_t es_lblk;
+	unsigned int seq;
+	int depth = 0;
+	int found = 0;
+
+	seq = raw_read_seqcount(&ei->i_es_seq);
+	if (seq & 1)
+		return -EAGAIN;
+
+	rcu_read_lock();
+	es1 = READ_ONCE(tree->cache_es);
+	if (es1 && in_range(lblk, READ_ONCE(es1->es_lblk),
+			    READ_ONCE(es1->es_len))) {
+		found = 1;
+		goto out;
+	}
+
+	node = READ_ONCE(tree->root.rb_node);
+	while (node) {
+		if (++depth > ES_LOCKLESS_MAX_DEPTH) {
+			rcu_read_unlock();
+			return -EAGAIN;
+		}
+		es1 = rb_entry(node, struct extent_status, rb_node);
+		es_lblk = READ_ONCE(es1->es_lblk);
+		if (lblk < es_lblk)
+			node = READ_ONCE(node->rb_left);
+		else if (lblk > es_lblk + READ_ONCE(es1->es_len) - 1)
+			node = READ_ONCE(node->rb_right);
+		else {
+			found = 1;
+			break;
+		}
+	}
+
+out:
+	if (found) {
+		es->es_lblk = READ_ONCE(es1->es_lblk);
+		es->es_len = READ_ONCE(es1->es_len);
+		es->es_pblk = READ_ONCE(es1->es_pblk);
+	}
+	rcu_read_unlock();
+
+	if (read_seqcount_retry(&ei->i_es_seq, seq))
+		return -EAGAIN;
+	if (found && !ext4_es_is_referenced(es))
+		return -EAGAIN;
+	return found;
+}
+
 /*
  * ext4_es_lookup_extent() looks up an extent in extent status tree.
  *
@@ -788,6 +876,17 @@ int ext4_es_lookup_extent(struct inode *inode, ext4_lblk_t lblk,
 	trace_ext4_es_lookup_extent_enter(inode, lblk);
 	es_debug("lookup extent in block %u\n", lblk);
 
+	stats = &EXT4_SB(inode->i_sb)->s_es_stats;
+	found = __es_lookup_extent_rcu(inode, lblk, es);
+	if (found >= 0) {
+		if (found)
+			percpu_counter_inc(&stats->es_stats_cache_hits);
+		else
+			percpu_counter_inc(&stats->es_stats_cache_misses);
+		goto out_trace;
+	}
+	found = 0;
+
 	tree = &EXT4_I(inode)->i_es_tree;
 	read_lock(&EXT4_I(inode)->i_es_lock);
 
@@ -817,7 +916,6 @@ int ext4_es_lookup_extent(struct inode *inode, ext4_lblk_t lblk,
 	}
 
 out:
-	stats = &EXT4_SB(inode->i_sb)->s_es_stats;
 	if (found) {
 		BUG_ON(!es1);
 		es->es_lblk = es1->es_lblk;
@@ -825,13 +923,14 @@ out:
 		es->es_pblk = es1->es_pblk;
 		if (!ext4_es_is_referenced(es1))
 			ext4_es_set_referenced(es1);
-		stats->es_stats_cache_hits++;
+		percpu_counter_inc(&stats->es_stats_cache_hits);
 	} else {
-		stats->es_stats_cache_misses++;
+		percpu_counter_inc(&stats->es_stats_cache_misses);
 	}
 
 	read_unlock(&EXT4_I(inode)->i_es_lock);
 
+out_trace:
 	trace_ext4_es_lookup_extent_exit(inode, es, found);
 	return found;
 }
@@ -963,7 +1062,9 @@ int ext4_es_remove_extent(struct inode *inode, ext4_lblk_t lblk,
 	 * is reclaimed.
 	 */
 	write_lock(&EXT4_I(inode)->i_es_lock);
+	write_seqcount_begin(&EXT4_I(inode)->i_es_seq);
 	err = __es_remove_extent(inode, lblk, end);
+	write_seqcount_end(&EXT4_I(inode)->i_es_seq);
 	write_unlock(&EXT4_I(inode)->i_es_lock);
 	ext4_es_print_tree(inode);
 	return err;
@@ -1016,7 +1117,9 @@ retry:
 		 */
 		spin_unlock(&sbi->s_es_lock);
 
+		write_seqcount_begin(&ei->i_es_seq);
 		nr_shrunk += es_reclaim_extents(ei, &nr_to_scan);
+		write_seqcount_end(&ei->i_es_seq);
 		write_unlock(&ei->i_es_lock);
 
 		if (nr_to_scan <= 0)
@@ -1113,9 +1216,9 @@ int ext4_seq_es_shrinker_info_show(struct seq_file *seq, void *v)
 	seq_printf(seq, "stats:\n  %lld objects\n  %lld reclaimable objects\n",
 		   percpu_counter_sum_positive(&es_stats->es_stats_all_cnt),
 		   percpu_counter_sum_positive(&es_stats->es_stats_shk_cnt));
-	seq_printf(seq, "  %lu/%lu cache hits/misses\n",
-		   es_stats->es_stats_cache_hits,
-		   es_stats->es_stats_cache_misses);
+	seq_printf(seq, "  %lld/%lld cache hits/misses\n",
+		   percpu_counter_sum_positive(&es_stats->es_stats_cache_hits),
+		   percpu_counter_sum_positive(&es_stats->es_stats_cache_misses));
 	if (inode_cnt)
 		seq_printf(seq, "  %d inodes on list\n", inode_cnt);
 
@@ -1142,13 +1245,17 @@ int ext4_es_register_shrinker(struct ext4_sb_info *sbi)
 	sbi->s_es_nr_inode = 0;
 	spin_lock_init(&sbi->s_es_lock);
 	sbi->s_es_stats.es_stats_shrunk = 0;
-	sbi->s_es_stats.es_stats_cache_hits = 0;
-	sbi->s_es_stats.es_stats_cache_misses = 0;
 	sbi->s_es_stats.es_stats_scan_time = 0;
 	sbi->s_es_stats.es_stats_max_scan_time = 0;
-	err = percpu_counter_init(&sbi->s_es_stats.es_stats_all_cnt, 0, GFP_KERNEL);
+	err = percpu_counter_init(&sbi->s_es_stats.es_stats_cache_hits, 0, GFP_KERNEL);
 	if (err)
 		return err;
+	err = percpu_counter_init(&sbi->s_es_stats.es_stats_cache_misses, 0, GFP_KERNEL);
+	if (err)
+		goto err0;
+	err = percpu_counter_init(&sbi->s_es_stats.es_stats_all_cnt, 0, GFP_KERNEL);
+	if (err)
+		goto err_misses;
 	err = percpu_counter_init(&sbi->s_es_stats.es_stats_shk_cnt, 0, GFP_KERNEL);
 	if (err)
 		goto err1;
@@ -1166,11 +1273,17 @@ err2:
 	percpu_counter_destroy(&sbi->s_es_stats.es_stats_shk_cnt);
 err1:
 	percpu_counter_destroy(&sbi->s_es_stats.es_stats_all_cnt);
+err_misses:
+	percpu_counter_destroy(&sbi->s_es_stats.es_stats_cache_misses);
+err0:
+	percpu_counter_destroy(&sbi->s_es_stats.es_stats_cache_hits);
 	return err;
 }
 
 void ext4_es_unregister_shrinker(struct ext4_sb_info *sbi)
 {
+	percpu_counter_destroy(&sbi->s_es_stats.es_stats_cache_hits);
+	percpu_counter_destroy(&sbi->s_es_stats.es_stats_cache_misses);
 	percpu_counter_destroy(&sbi->s_es_stats.es_stats_all_cnt);
 	percpu_counter_destroy(&sbi->s_es_stats.es_stats_shk_cnt);
 	unregister_shrinker(&sbi->s_es_shrinker);
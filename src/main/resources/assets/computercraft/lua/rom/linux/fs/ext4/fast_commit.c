@@ -0,0 +1,376 @@
+/*
+ *  linux/fs/ext4/fast_commit.c
+ *
+ * Fast commits: making fsync of a file durable without committing the
+ * whole running transaction.
+ *
+ * fsync of a regular file normally has to commit the running jbd2
+ * transaction.  When the only changes made to the file in that
+ * transaction are to its inode and to blocks newly allocated to it, the
+ * inode alone describes them, as long as its extent tree fits in the
+ * inode: i_size, i_blocks, the times and the extents.  ext4_fc_commit()
+ * then writes a copy of the on-disk inode to a block of the jbd2 fast
+ * commit area, and at recovery ext4_fc_replay() writes the copy back to
+ * the inode table and marks the blocks it maps in use in the block
+ * bitmaps, on top of the transactions replayed from the log.
+ *
+ * Anything that changes metadata such a copy does not cover marks the
+ * inode, or for some operations the whole file system, ineligible for
+ * the running transaction: creating, linking, unlinking or renaming the
+ * inode, freeing blocks from it, changing its xattrs, moving extents,
+ * resizing.  fsync then falls back to a full commit, as it does once the
+ * fast commit area is full.  Blocks freed in a transaction are not reused
+ * before it commits, so marking blocks in use on replay never takes them
+ * away from another inode.
+ */
+
+#include <linux/fs.h>
+#include <linux/quotaops.h>
+#include <linux/buffer_head.h>
+#include <linux/blkdev.h>
+#include <linux/slab.h>
+#include "ext4.h"
+#include "ext4_jbd2.h"
+#include "ext4_extents.h"
+#include "fast_commit.h"
+
+void ext4_fc_mark_ineligible(handle_t *handle, struct inode *inode)
+{
+	if (!inode || !ext4_handle_valid(handle) ||
+	    !test_opt2(inode->i_sb, JOURNAL_FAST_COMMIT))
+		return;
+	WRITE_ONCE(EXT4_I(inode)->i_fc_ineligible_tid,
+		   handle->h_transaction->t_tid);
+}
+
+void ext4_fc_mark_sb_ineligible(handle_t *handle, struct super_block *sb)
+{
+	if (!ext4_handle_valid(handle) || !test_opt2(sb, JOURNAL_FAST_COMMIT))
+		return;
+	WRITE_ONCE(EXT4_SB(sb)->s_fc_ineligible_tid,
+		   handle->h_transaction->t_tid);
+}
+
+static u32 ext4_fc_csum(struct ext4_sb_info *sbi, const void *buf, int len)
+{
+	return ext4_chksum(sbi, ~0, buf, len);
+}
+
+/* Can fsync of @inode use a fast commit for transaction @tid? */
+static bool ext4_fc_eligible(struct inode *inode, tid_t tid)
+{
+	struct super_block *sb = inode->i_sb;
+
+	if (!test_opt2(sb, JOURNAL_FAST_COMMIT) || !S_ISREG(inode->i_mode))
+		return false;
+	if (READ_ONCE(EXT4_I(inode)->i_fc_ineligible_tid) == tid ||
+	    READ_ONCE(EXT4_SB(sb)->s_fc_ineligible_tid) == tid)
+		return false;
+	/* The orphan list is chained through inodes and the superblock */
+	if (!list_empty(&EXT4_I(inode)->i_orphan))
+		return false;
+	/* Quota usage changes are not part of the inode copy */
+	if (sb_any_quota_loaded(sb))
+		return false;
+	return true;
+}
+
+/* Does a copy of this on-disk inode map all of its blocks by itself? */
+static bool ext4_fc_raw_inode_ok(struct ext4_inode *raw)
+{
+	struct ext4_extent_header *eh;
+	__u32 flags = le32_to_cpu(raw->i_flags);
+
+	if (!(flags & EXT4_EXTENTS_FL) || (flags & EXT4_INLINE_DATA_FL))
+		return false;
+	eh = (struct ext4_extent_header *)raw->i_block;
+	if (eh->eh_magic != EXT4_EXT_MAGIC || eh->eh_depth ||
+	    le16_to_cpu(eh->eh_entries) >
+	    (sizeof(raw->i_block) - sizeof(*eh)) / sizeof(struct ext4_extent))
+		return false;
+	return !raw->i_dtime && raw->i_links_count;
+}
+
+/*
+ * Write a fast commit of @inode for transaction @commit_tid.  Returns 0
+ * once it is stable, or an error if the caller has to fall back to a full
+ * commit.
+ */
+int ext4_fc_commit(struct inode *inode, tid_t commit_tid)
+{
+	struct super_block *sb = inode->i_sb;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	journal_t *journal = sbi->s_journal;
+	int inode_len = EXT4_INODE_SIZE(sb);
+	struct ext4_fc_inode *fc_inode;
+	struct ext4_fc_tail *tail;
+	struct ext4_fc_tl *tl;
+	struct ext4_iloc iloc;
+	struct buffer_head *bh;
+	void *raw;
+	int ret;
+
+	if (!ext4_fc_eligible(inode, commit_tid))
+		return -EINVAL;
+	if (2 * sizeof(*tl) + sizeof(*fc_inode) + inode_len + sizeof(*tail) >
+	    journal->j_blocksize)
+		return -EINVAL;
+
+	raw = kmalloc(inode_len, GFP_NOFS);
+	if (!raw)
+		return -ENOMEM;
+
+	/* Copy the inode as last stored into its buffer under a handle */
+	ret = ext4_get_inode_loc(inode, &iloc);
+	if (ret)
+		goto out_free;
+	spin_lock(&EXT4_I(inode)->i_raw_lock);
+	memcpy(raw, ext4_raw_inode(&iloc), inode_len);
+	spin_unlock(&EXT4_I(inode)->i_raw_lock);
+	brelse(iloc.bh);
+
+	ret = -EINVAL;
+	if (!ext4_fc_raw_inode_ok(raw))
+		goto out_free;
+
+	/*
+	 * Writeback racing with the copy may have allocated blocks it maps
+	 * whose data is not on disk yet.
+	 */
+	ret = filemap_write_and_wait(inode->i_mapping);
+	if (ret)
+		goto out_free;
+
+	ret = jbd2_fc_begin_commit(journal, commit_tid);
+	if (ret)
+		goto out_free;
+
+	ret = jbd2_fc_get_buf(journal, &bh);
+	if (ret)
+		goto out_end;
+
+	/*
+	 * The data lives on the file system device, make it stable before
+	 * the record which makes it reachable.
+	 */
+	if (journal->j_flags & JBD2_BARRIER && journal->j_fs_dev != journal->j_dev)
+		blkdev_issue_flush(journal->j_fs_dev, GFP_NOFS, NULL);
+
+	lock_buffer(bh);
+	memset(bh->b_data, 0, journal->j_blocksize);
+	tl = (struct ext4_fc_tl *)bh->b_data;
+	tl->fc_tag = cpu_to_le16(EXT4_FC_TAG_INODE);
+	tl->fc_len = cpu_to_le16(sizeof(*fc_inode) + inode_len);
+	fc_inode = (struct ext4_fc_inode *)(tl + 1);
+	fc_inode->fc_ino = cpu_to_le32(inode->i_ino);
+	memcpy(fc_inode->fc_raw_inode, raw, inode_len);
+
+	tl = (struct ext4_fc_tl *)(fc_inode->fc_raw_inode + inode_len);
+	tl->fc_tag = cpu_to_le16(EXT4_FC_TAG_TAIL);
+	tl->fc_len = cpu_to_le16(sizeof(*tail));
+	tail = (struct ext4_fc_tail *)(tl + 1);
+	tail->fc_tid = cpu_to_le32(commit_tid);
+	tail->fc_crc = cpu_to_le32(ext4_fc_csum(sbi, bh->b_data,
+				(char *)&tail->fc_crc - bh->b_data));
+
+	set_buffer_uptodate(bh);
+	clear_buffer_dirty(bh);
+	bh->b_end_io = end_buffer_write_sync;
+	get_bh(bh);
+	submit_bh(REQ_OP_WRITE, REQ_SYNC | (journal->j_flags & JBD2_BARRIER ?
+					    REQ_PREFLUSH | REQ_FUA : 0), bh);
+	wait_on_buffer(bh);
+	if (!buffer_uptodate(bh))
+		ret = -EIO;
+	brelse(bh);
+out_end:
+	jbd2_fc_end_commit(journal);
+out_free:
+	kfree(raw);
+	return ret;
+}
+
+/* Mark the blocks [block, block + len) in use in the block bitmaps */
+static int ext4_fc_replay_mark_used(struct super_block *sb,
+				    ext4_fsblk_t block, unsigned int len)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_super_block *es = sbi->s_es;
+	struct buffer_head *gd_bh, *bh;
+	struct ext4_group_desc *gdp;
+	ext4_grpblk_t cluster, last;
+	ext4_group_t group;
+	ext4_fsblk_t first, n;
+	unsigned int free, used;
+	int err;
+
+	if (block < le32_to_cpu(es->s_first_data_block) ||
+	    block + len < block || block + len > ext4_blocks_count(es))
+		return -EFSCORRUPTED;
+
+	while (len) {
+		ext4_get_group_no_and_offset(sb, block, &group, &cluster);
+		first = ext4_group_first_block_no(sb, group);
+		n = min_t(ext4_fsblk_t, len,
+			  first + EXT4_BLOCKS_PER_GROUP(sb) - block);
+		last = EXT4_B2C(sbi, block + n - 1 - first);
+
+		gdp = ext4_get_group_desc(sb, group, &gd_bh);
+		if (!gdp)
+			return -EFSCORRUPTED;
+
+		err = 0;
+		if (gdp->bg_flags & cpu_to_le16(EXT4_BG_BLOCK_UNINIT)) {
+			bh = sb_getblk(sb, ext4_block_bitmap(sb, gdp));
+			if (!bh)
+				return -ENOMEM;
+			lock_buffer(bh);
+			if (!ext4_group_desc_csum_verify(sb, group, gdp))
+				err = -EFSBADCRC;
+			else
+				err = ext4_init_block_bitmap(sb, bh, group, gdp);
+			if (!err) {
+				gdp->bg_flags &= cpu_to_le16(~EXT4_BG_BLOCK_UNINIT);
+				set_buffer_uptodate(bh);
+			}
+		} else {
+			bh = sb_bread(sb, ext4_block_bitmap(sb, gdp));
+			if (!bh)
+				return -EIO;
+			lock_buffer(bh);
+		}
+
+		if (!err) {
+			used = 0;
+			for (; cluster <= last; cluster++)
+				if (!ext4_test_and_set_bit(cluster, bh->b_data))
+					used++;
+			free = ext4_free_group_clusters(sb, gdp);
+			ext4_free_group_clusters_set(sb, gdp,
+					free > used ? free - used : 0);
+			ext4_block_bitmap_csum_set(sb, group, gdp, bh);
+			ext4_group_desc_csum_set(sb, group, gdp);
+		}
+		unlock_buffer(bh);
+		if (!err) {
+			mark_buffer_dirty(bh);
+			mark_buffer_dirty(gd_bh);
+		}
+		brelse(bh);
+		if (err)
+			return err;
+
+		block += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int ext4_fc_replay_inode(struct super_block *sb,
+				struct ext4_fc_inode *fc_inode, int len)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_inode *raw = (struct ext4_inode *)fc_inode->fc_raw_inode;
+	unsigned long ino = le32_to_cpu(fc_inode->fc_ino);
+	int inode_len = EXT4_INODE_SIZE(sb);
+	struct ext4_extent_header *eh;
+	struct ext4_group_desc *gdp;
+	struct ext4_extent *ex;
+	struct buffer_head *bh;
+	unsigned long offset;
+	ext4_group_t group;
+	int i, err;
+
+	if (len != sizeof(*fc_inode) + inode_len ||
+	    ino < EXT4_FIRST_INO(sb) ||
+	    ino > le32_to_cpu(sbi->s_es->s_inodes_count) ||
+	    !ext4_fc_raw_inode_ok(raw))
+		return -EFSCORRUPTED;
+
+	group = (ino - 1) / EXT4_INODES_PER_GROUP(sb);
+	offset = ((ino - 1) % EXT4_INODES_PER_GROUP(sb)) * inode_len;
+	gdp = ext4_get_group_desc(sb, group, NULL);
+	if (!gdp)
+		return -EFSCORRUPTED;
+
+	bh = sb_bread(sb, ext4_inode_table(sb, gdp) +
+		      (offset >> EXT4_BLOCK_SIZE_BITS(sb)));
+	if (!bh)
+		return -EIO;
+	lock_buffer(bh);
+	memcpy(bh->b_data + (offset & (EXT4_BLOCK_SIZE(sb) - 1)), raw,
+	       inode_len);
+	unlock_buffer(bh);
+	mark_buffer_dirty(bh);
+	brelse(bh);
+
+	eh = (struct ext4_extent_header *)raw->i_block;
+	ex = EXT_FIRST_EXTENT(eh);
+	for (i = 0; i < le16_to_cpu(eh->eh_entries); i++, ex++) {
+		err = ext4_fc_replay_mark_used(sb, ext4_ext_pblock(ex),
+					       ext4_ext_get_actual_len(ex));
+		if (err)
+			return err;
+	}
+	return 0;
+}
+
+/*
+ * jbd2 recovery callback, called for each block of the fast commit area
+ * once the log has been replayed.
+ */
+int ext4_fc_replay(journal_t *journal, struct buffer_head *bh, int off,
+		   tid_t expected_tid)
+{
+	struct super_block *sb = journal->j_private;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	char *start = bh->b_data, *end = start + journal->j_blocksize;
+	struct ext4_fc_tail *tail = NULL;
+	struct ext4_fc_tl *tl;
+	char *cur;
+	int len, err;
+
+	if (!sbi->s_chksum_driver)
+		return JBD2_FC_REPLAY_STOP;
+
+	/* Find the tail, which tells whether this is a valid fast commit */
+	for (cur = start; cur + sizeof(*tl) <= end; cur += sizeof(*tl) + len) {
+		tl = (struct ext4_fc_tl *)cur;
+		len = le16_to_cpu(tl->fc_len);
+		if (cur + sizeof(*tl) + len > end)
+			break;
+		if (le16_to_cpu(tl->fc_tag) == EXT4_FC_TAG_TAIL) {
+			if (len == sizeof(*tail))
+				tail = (struct ext4_fc_tail *)(tl + 1);
+			break;
+		}
+	}
+	if (!tail || le32_to_cpu(tail->fc_tid) != expected_tid ||
+	    le32_to_cpu(tail->fc_crc) !=
+	    ext4_fc_csum(sbi, start, (char *)&tail->fc_crc - start))
+		return JBD2_FC_REPLAY_STOP;
+
+	end = (char *)tail - sizeof(*tl);
+	for (cur = start; cur < end; cur += sizeof(*tl) + len) {
+		tl = (struct ext4_fc_tl *)cur;
+		len = le16_to_cpu(tl->fc_len);
+		switch (le16_to_cpu(tl->fc_tag)) {
+		case EXT4_FC_TAG_INODE:
+			err = ext4_fc_replay_inode(sb,
+					(struct ext4_fc_inode *)(tl + 1), len);
+			break;
+		case EXT4_FC_TAG_PAD:
+			err = 0;
+			break;
+		default:
+			err = -EFSCORRUPTED;
+			break;
+		}
+		if (err) {
+			ext4_msg(sb, KERN_ERR, "fast commit replay failed "
+				 "at block %d: %d", off, err);
+			return err;
+		}
+	}
+	return 0;
+}
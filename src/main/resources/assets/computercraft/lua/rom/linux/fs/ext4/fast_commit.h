@@ -0,0 +1,36 @@
+#ifndef __FAST_COMMIT_H__
+#define __FAST_COMMIT_H__
+
+/*
+ * On disk format of ext4 fast commits.
+ *
+ * Each fast commit fills one block of the jbd2 fast commit area with a
+ * sequence of tag-length-value records, terminated by a tail record.  The
+ * tail carries the tid of the running transaction the records apply on
+ * top of, and a checksum of the block up to and including that tid.
+ */
+
+/* Fast commit tags */
+#define EXT4_FC_TAG_INODE		0x0001	/* raw copy of an inode */
+#define EXT4_FC_TAG_PAD			0x0002
+#define EXT4_FC_TAG_TAIL		0x0003
+
+/* Header of every record; fc_len is the length of what follows */
+struct ext4_fc_tl {
+	__le16 fc_tag;
+	__le16 fc_len;
+};
+
+/* Value of EXT4_FC_TAG_INODE: the on-disk inode, EXT4_INODE_SIZE bytes */
+struct ext4_fc_inode {
+	__le32 fc_ino;
+	__u8 fc_raw_inode[0];
+};
+
+/* Value of EXT4_FC_TAG_TAIL */
+struct ext4_fc_tail {
+	__le32 fc_tid;
+	__le32 fc_crc;
+};
+
+#endif /* __FAST_COMMIT_H__ */
@@ -1061,6 +1061,8 @@ got:
 	ext4_set_inode_flags(inode);
 	if (IS_DIRSYNC(inode))
 		ext4_handle_sync(handle);
+	/* The inode bitmap and the directory entry are not in a fast commit */
+	ext4_fc_mark_ineligible(handle, inode);
 	if (insert_inode_locked(inode) < 0) {
 		/*
 		 * Likely a bitmap corruption causing inode to be allocated
@@ -3301,7 +3301,6 @@ static int ext4_releasepage(struct page *page, gfp_t wait)
 		return try_to_free_buffers(page);
 }
 
-#ifdef CONFIG_FS_DAX
 static int ext4_iomap_begin(struct inode *inode, loff_t offset, loff_t length,
 			    unsigned flags, struct iomap *iomap)
 {
@@ -3455,8 +3454,6 @@ const struct iomap_ops ext4_iomap_ops = {
 	.iomap_end		= ext4_iomap_end,
 };
 
-#endif
-
 static int ext4_end_io_dio(struct kiocb *iocb, loff_t offset,
 			    ssize_t size, void *private)
 {
@@ -3809,6 +3806,9 @@ void ext4_set_aops(struct inode *inode)
 		inode->i_mapping->a_ops = &ext4_da_aops;
 	else
 		inode->i_mapping->a_ops = &ext4_aops;
+	/* read-only huge pages, see CONFIG_READ_ONLY_THP_FOR_FS */
+	if (S_ISREG(inode->i_mode) && !IS_DAX(inode))
+		mapping_set_thp_support(inode->i_mapping);
 }
 
 static int __ext4_block_zero_page_range(handle_t *handle,
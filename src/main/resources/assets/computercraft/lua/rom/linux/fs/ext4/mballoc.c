@@ -697,13 +697,67 @@ static void ext4_mb_mark_free_simple(struct super_block *sb,
 	}
 }
 
+/*
+ * Keep the group on the allocator's list for its largest free order and
+ * for its average fragment size order.  Called with the group locked,
+ * whenever bb_counters, bb_free or bb_fragments have changed.
+ */
+static void
+mb_update_group_lists(struct super_block *sb, struct ext4_group_info *grp,
+		      int old_largest)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	int avg = -1;
+
+	if (grp->bb_free && grp->bb_largest_free_order != old_largest) {
+		if (old_largest >= 0) {
+			write_lock(&sbi->s_mb_largest_free_orders_locks[old_largest]);
+			list_del_init(&grp->bb_largest_free_order_node);
+			write_unlock(&sbi->s_mb_largest_free_orders_locks[old_largest]);
+		}
+		old_largest = grp->bb_largest_free_order;
+		if (old_largest >= 0) {
+			write_lock(&sbi->s_mb_largest_free_orders_locks[old_largest]);
+			list_add_tail(&grp->bb_largest_free_order_node,
+				&sbi->s_mb_largest_free_orders[old_largest]);
+			write_unlock(&sbi->s_mb_largest_free_orders_locks[old_largest]);
+		}
+	} else if (!grp->bb_free && !list_empty(&grp->bb_largest_free_order_node)) {
+		write_lock(&sbi->s_mb_largest_free_orders_locks[old_largest]);
+		list_del_init(&grp->bb_largest_free_order_node);
+		write_unlock(&sbi->s_mb_largest_free_orders_locks[old_largest]);
+	}
+
+	if (grp->bb_free && grp->bb_fragments)
+		avg = min_t(int, fls(grp->bb_free / grp->bb_fragments) - 1,
+			    MB_NUM_ORDERS(sb) - 1);
+	if (avg == grp->bb_avg_fragment_size_order)
+		return;
+
+	if (grp->bb_avg_fragment_size_order >= 0) {
+		write_lock(&sbi->s_mb_avg_fragment_size_locks[
+					grp->bb_avg_fragment_size_order]);
+		list_del_init(&grp->bb_avg_fragment_size_node);
+		write_unlock(&sbi->s_mb_avg_fragment_size_locks[
+					grp->bb_avg_fragment_size_order]);
+	}
+	grp->bb_avg_fragment_size_order = avg;
+	if (avg >= 0) {
+		write_lock(&sbi->s_mb_avg_fragment_size_locks[avg]);
+		list_add_tail(&grp->bb_avg_fragment_size_node,
+			      &sbi->s_mb_avg_fragment_size[avg]);
+		write_unlock(&sbi->s_mb_avg_fragment_size_locks[avg]);
+	}
+}
+
 /*
  * Cache the order of the largest free extent we have available in this block
- * group.
+ * group, and requeue the group on the allocator's lists.
  */
 static void
 mb_set_largest_free_order(struct super_block *sb, struct ext4_group_info *grp)
 {
+	int old = grp->bb_largest_free_order;
 	int i;
 	int bits;
 
@@ -716,6 +770,7 @@ mb_set_largest_free_order(struct super_block *sb, struct ext4_group_info *grp)
 			break;
 		}
 	}
+	mb_update_group_lists(sb, grp, old);
 }
 
 static noinline_for_stack
@@ -1645,6 +1700,20 @@ static int mb_mark_used(struct ext4_buddy *e4b, struct ext4_free_extent *ex)
 	return ret;
 }
 
+/*
+ * Stream allocations of an inode always pick up from the same slot, so a
+ * file keeps growing where it left off while writers of other files, on
+ * this or other cpus, mostly use goals of their own.
+ */
+static inline struct ext4_mb_last_alloc *
+ext4_mb_last_alloc(struct ext4_allocation_context *ac)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(ac->ac_sb);
+
+	return &sbi->s_mb_last_allocs[ac->ac_inode->i_ino %
+				      sbi->s_mb_nr_last_allocs];
+}
+
 /*
  * Must be called under group lock!
  */
@@ -1682,10 +1751,10 @@ static void ext4_mb_use_best_found(struct ext4_allocation_context *ac,
 	get_page(ac->ac_buddy_page);
 	/* store last allocated for subsequent stream allocation */
 	if (ac->ac_flags & EXT4_MB_STREAM_ALLOC) {
-		spin_lock(&sbi->s_md_lock);
-		sbi->s_mb_last_group = ac->ac_f_ex.fe_group;
-		sbi->s_mb_last_start = ac->ac_f_ex.fe_start;
-		spin_unlock(&sbi->s_md_lock);
+		struct ext4_mb_last_alloc *last = ext4_mb_last_alloc(ac);
+
+		WRITE_ONCE(last->group, ac->ac_f_ex.fe_group);
+		WRITE_ONCE(last->start, ac->ac_f_ex.fe_start);
 	}
 }
 
@@ -2108,6 +2177,150 @@ static int ext4_mb_good_group(struct ext4_allocation_context *ac,
 	return 0;
 }
 
+/*
+ * Check, load and scan a single group for the allocation at criteria cr.
+ * Returns an error only if the buddy could not be loaded; a group which
+ * turns out unsuitable is recorded in *first_err and skipped.
+ */
+static int ext4_mb_try_group(struct ext4_allocation_context *ac,
+			     ext4_group_t group, int cr,
+			     struct ext4_buddy *e4b, int *first_err)
+{
+	struct super_block *sb = ac->ac_sb;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	int ret, err;
+
+	/* This now checks without needing the buddy page */
+	ret = ext4_mb_good_group(ac, group, cr);
+	if (ret <= 0) {
+		if (!*first_err)
+			*first_err = ret;
+		return 0;
+	}
+
+	err = ext4_mb_load_buddy(sb, group, e4b);
+	if (err)
+		return err;
+
+	ext4_lock_group(sb, group);
+
+	/*
+	 * We need to check again after locking the
+	 * block group
+	 */
+	ret = ext4_mb_good_group(ac, group, cr);
+	if (ret <= 0) {
+		ext4_unlock_group(sb, group);
+		ext4_mb_unload_buddy(e4b);
+		if (!*first_err)
+			*first_err = ret;
+		return 0;
+	}
+
+	ac->ac_groups_scanned++;
+	if (cr == 0)
+		ext4_mb_simple_scan_group(ac, e4b);
+	else if (cr == 1 && sbi->s_stripe &&
+			!(ac->ac_g_ex.fe_len % sbi->s_stripe))
+		ext4_mb_scan_aligned(ac, e4b);
+	else
+		ext4_mb_complex_scan_group(ac, e4b);
+
+	ext4_unlock_group(sb, group);
+	ext4_mb_unload_buddy(e4b);
+
+	return 0;
+}
+
+/*
+ * Take the first group on an order list that looks worth trying at
+ * criteria cr, and rotate it to the tail so that the next caller, and
+ * concurrent allocators, move on to the following one.  Returns ngroups
+ * if there is none.
+ */
+static ext4_group_t ext4_mb_pick_group(struct ext4_allocation_context *ac,
+				       struct list_head *head, rwlock_t *lock,
+				       int cr, ext4_group_t ngroups)
+{
+	struct ext4_group_info *grp;
+	ext4_group_t group = ngroups;
+
+	write_lock(lock);
+	list_for_each_entry(grp, head, cr == 0 ?
+			    bb_largest_free_order_node :
+			    bb_avg_fragment_size_node) {
+		if (grp->bb_group >= ngroups ||
+		    grp->bb_free < ac->ac_g_ex.fe_len ||
+		    EXT4_MB_GRP_BBITMAP_CORRUPT(grp))
+			continue;
+		if (cr == 1 &&
+		    (!grp->bb_fragments ||
+		     grp->bb_free / grp->bb_fragments < ac->ac_g_ex.fe_len))
+			continue;
+		group = grp->bb_group;
+		if (cr == 0)
+			list_move_tail(&grp->bb_largest_free_order_node, head);
+		else
+			list_move_tail(&grp->bb_avg_fragment_size_node, head);
+		break;
+	}
+	write_unlock(lock);
+
+	return group;
+}
+
+/*
+ * Find a group for criteria 0 or 1 without walking all of them: after the
+ * goal group, try groups from the lists of groups by order of their
+ * largest free extent (cr 0) or of their average free extent (cr 1),
+ * starting at the order the request needs.
+ */
+static int ext4_mb_scan_group_lists(struct ext4_allocation_context *ac,
+				    int cr, ext4_group_t ngroups,
+				    struct ext4_buddy *e4b, int *first_err)
+{
+	struct super_block *sb = ac->ac_sb;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	ext4_group_t group, first, tries = 0;
+	struct list_head *lists;
+	rwlock_t *locks;
+	int order, err;
+
+	err = ext4_mb_try_group(ac, ac->ac_g_ex.fe_group, cr, e4b, first_err);
+	if (err || ac->ac_status != AC_STATUS_CONTINUE)
+		return err;
+
+	if (cr == 0) {
+		order = ac->ac_2order;
+		lists = sbi->s_mb_largest_free_orders;
+		locks = sbi->s_mb_largest_free_orders_locks;
+	} else {
+		order = fls(ac->ac_g_ex.fe_len) - 1;
+		lists = sbi->s_mb_avg_fragment_size;
+		locks = sbi->s_mb_avg_fragment_size_locks;
+	}
+
+	for (; order < MB_NUM_ORDERS(sb); order++) {
+		first = ngroups;
+		while (tries < ngroups) {
+			cond_resched();
+			group = ext4_mb_pick_group(ac, &lists[order],
+						   &locks[order], cr, ngroups);
+			if (group >= ngroups || group == first)
+				break;
+			if (first >= ngroups)
+				first = group;
+			tries++;
+
+			err = ext4_mb_try_group(ac, group, cr, e4b, first_err);
+			if (err || ac->ac_status != AC_STATUS_CONTINUE)
+				return err;
+		}
+	}
+
+	return 0;
+}
+
 static noinline_for_stack int
 ext4_mb_regular_allocator(struct ext4_allocation_context *ac)
 {
@@ -2157,13 +2370,14 @@ ext4_mb_regular_allocator(struct ext4_allocation_context *ac)
 			ac->ac_2order = i - 1;
 	}
 
-	/* if stream allocation is enabled, use global goal */
+	/* if stream allocation is enabled, use the stream goal */
 	if (ac->ac_flags & EXT4_MB_STREAM_ALLOC) {
-		/* TBD: may be hot point */
-		spin_lock(&sbi->s_md_lock);
-		ac->ac_g_ex.fe_group = sbi->s_mb_last_group;
-		ac->ac_g_ex.fe_start = sbi->s_mb_last_start;
-		spin_unlock(&sbi->s_md_lock);
+		struct ext4_mb_last_alloc *last = ext4_mb_last_alloc(ac);
+
+		ac->ac_g_ex.fe_group = READ_ONCE(last->group);
+		ac->ac_g_ex.fe_start = READ_ONCE(last->start);
+		if (ac->ac_g_ex.fe_group >= ngroups)
+			ac->ac_g_ex.fe_group = 0;
 	}
 
 	/* Let's just scan groups to find more-less suitable blocks */
@@ -2181,8 +2395,23 @@ repeat:
 		 */
 		group = ac->ac_g_ex.fe_group;
 
+		if (cr <= 1 && sbi->s_mb_optimize_scan) {
+			err = ext4_mb_scan_group_lists(ac, cr, ngroups,
+						       &e4b, &first_err);
+			if (err)
+				goto out;
+			if (ac->ac_status != AC_STATUS_CONTINUE)
+				continue;
+			/*
+			 * Groups whose buddy was never loaded are on none
+			 * of the lists yet; the cr 1 linear pass below
+			 * initializes them on its way.
+			 */
+			if (cr == 0)
+				continue;
+		}
+
 		for (i = 0; i < ngroups; group++, i++) {
-			int ret = 0;
 			cond_resched();
 			/*
 			 * Artificially restricted ngroups for non-extent
@@ -2191,45 +2420,10 @@ repeat:
 			if (group >= ngroups)
 				group = 0;
 
-			/* This now checks without needing the buddy page */
-			ret = ext4_mb_good_group(ac, group, cr);
-			if (ret <= 0) {
-				if (!first_err)
-					first_err = ret;
-				continue;
-			}
-
-			err = ext4_mb_load_buddy(sb, group, &e4b);
+			err = ext4_mb_try_group(ac, group, cr, &e4b, &first_err);
 			if (err)
 				goto out;
 
-			ext4_lock_group(sb, group);
-
-			/*
-			 * We need to check again after locking the
-			 * block group
-			 */
-			ret = ext4_mb_good_group(ac, group, cr);
-			if (ret <= 0) {
-				ext4_unlock_group(sb, group);
-				ext4_mb_unload_buddy(&e4b);
-				if (!first_err)
-					first_err = ret;
-				continue;
-			}
-
-			ac->ac_groups_scanned++;
-			if (cr == 0)
-				ext4_mb_simple_scan_group(ac, &e4b);
-			else if (cr == 1 && sbi->s_stripe &&
-					!(ac->ac_g_ex.fe_len % sbi->s_stripe))
-				ext4_mb_scan_aligned(ac, &e4b);
-			else
-				ext4_mb_complex_scan_group(ac, &e4b);
-
-			ext4_unlock_group(sb, group);
-			ext4_mb_unload_buddy(&e4b);
-
 			if (ac->ac_status != AC_STATUS_CONTINUE)
 				break;
 		}
@@ -2466,6 +2660,10 @@ int ext4_mb_add_groupinfo(struct super_block *sb, ext4_group_t group,
 	init_rwsem(&meta_group_info[i]->alloc_sem);
 	meta_group_info[i]->bb_free_root = RB_ROOT;
 	meta_group_info[i]->bb_largest_free_order = -1;  /* uninit */
+	meta_group_info[i]->bb_avg_fragment_size_order = -1;  /* uninit */
+	meta_group_info[i]->bb_group = group;
+	INIT_LIST_HEAD(&meta_group_info[i]->bb_largest_free_order_node);
+	INIT_LIST_HEAD(&meta_group_info[i]->bb_avg_fragment_size_node);
 
 #ifdef DOUBLE_CHECK
 	{
@@ -2636,6 +2834,39 @@ int ext4_mb_init(struct super_block *sb)
 		i++;
 	} while (i <= sb->s_blocksize_bits + 1);
 
+	sbi->s_mb_largest_free_orders =
+		kmalloc_array(MB_NUM_ORDERS(sb), sizeof(struct list_head),
+			      GFP_KERNEL);
+	sbi->s_mb_largest_free_orders_locks =
+		kmalloc_array(MB_NUM_ORDERS(sb), sizeof(rwlock_t), GFP_KERNEL);
+	sbi->s_mb_avg_fragment_size =
+		kmalloc_array(MB_NUM_ORDERS(sb), sizeof(struct list_head),
+			      GFP_KERNEL);
+	sbi->s_mb_avg_fragment_size_locks =
+		kmalloc_array(MB_NUM_ORDERS(sb), sizeof(rwlock_t), GFP_KERNEL);
+	if (!sbi->s_mb_largest_free_orders ||
+	    !sbi->s_mb_largest_free_orders_locks ||
+	    !sbi->s_mb_avg_fragment_size ||
+	    !sbi->s_mb_avg_fragment_size_locks) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	for (i = 0; i < MB_NUM_ORDERS(sb); i++) {
+		INIT_LIST_HEAD(&sbi->s_mb_largest_free_orders[i]);
+		rwlock_init(&sbi->s_mb_largest_free_orders_locks[i]);
+		INIT_LIST_HEAD(&sbi->s_mb_avg_fragment_size[i]);
+		rwlock_init(&sbi->s_mb_avg_fragment_size_locks[i]);
+	}
+
+	sbi->s_mb_nr_last_allocs = num_possible_cpus();
+	sbi->s_mb_last_allocs = kcalloc(sbi->s_mb_nr_last_allocs,
+					sizeof(*sbi->s_mb_last_allocs),
+					GFP_KERNEL);
+	if (sbi->s_mb_last_allocs == NULL) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
 	spin_lock_init(&sbi->s_md_lock);
 	spin_lock_init(&sbi->s_bal_lock);
 	sbi->s_mb_free_pending = 0;
@@ -2645,6 +2876,7 @@ int ext4_mb_init(struct super_block *sb)
 	sbi->s_mb_stats = MB_DEFAULT_STATS;
 	sbi->s_mb_stream_request = MB_DEFAULT_STREAM_THRESHOLD;
 	sbi->s_mb_order2_reqs = MB_DEFAULT_ORDER2_REQS;
+	sbi->s_mb_optimize_scan = MB_DEFAULT_OPTIMIZE_SCAN;
 	/*
 	 * The default group preallocation is 512, which for 4k block
 	 * sizes translates to 2 megabytes.  However for bigalloc file
@@ -2697,6 +2929,16 @@ out_free_locality_groups:
 	free_percpu(sbi->s_locality_groups);
 	sbi->s_locality_groups = NULL;
 out:
+	kfree(sbi->s_mb_last_allocs);
+	sbi->s_mb_last_allocs = NULL;
+	kfree(sbi->s_mb_avg_fragment_size_locks);
+	sbi->s_mb_avg_fragment_size_locks = NULL;
+	kfree(sbi->s_mb_avg_fragment_size);
+	sbi->s_mb_avg_fragment_size = NULL;
+	kfree(sbi->s_mb_largest_free_orders_locks);
+	sbi->s_mb_largest_free_orders_locks = NULL;
+	kfree(sbi->s_mb_largest_free_orders);
+	sbi->s_mb_largest_free_orders = NULL;
 	kfree(sbi->s_mb_offsets);
 	sbi->s_mb_offsets = NULL;
 	kfree(sbi->s_mb_maxs);
@@ -2749,6 +2991,11 @@ int ext4_mb_release(struct super_block *sb)
 			kfree(sbi->s_group_info[i]);
 		kvfree(sbi->s_group_info);
 	}
+	kfree(sbi->s_mb_last_allocs);
+	kfree(sbi->s_mb_avg_fragment_size_locks);
+	kfree(sbi->s_mb_avg_fragment_size);
+	kfree(sbi->s_mb_largest_free_orders_locks);
+	kfree(sbi->s_mb_largest_free_orders);
 	kfree(sbi->s_mb_offsets);
 	kfree(sbi->s_mb_maxs);
 	iput(sbi->s_buddy_cache);
@@ -4711,6 +4958,8 @@ void ext4_free_blocks(handle_t *handle, struct inode *inode,
 	}
 
 	ext4_debug("freeing block %llu\n", block);
+	/* A fast commit could not free them on replay */
+	ext4_fc_mark_ineligible(handle, inode);
 	trace_ext4_free_blocks(inode, block, count, flags);
 
 	if (bh && (flags & EXT4_FREE_BLOCKS_FORGET)) {
@@ -76,6 +76,25 @@ do {									\
  */
 #define MB_DEFAULT_GROUP_PREALLOC	512
 
+/*
+ * Number of orders the buddy tracks, and the number of per-order group
+ * lists used by the allocator when mb_optimize_scan is set
+ */
+#define MB_NUM_ORDERS(sb)		((sb)->s_blocksize_bits + 2)
+
+/* default for mb_optimize_scan */
+#define MB_DEFAULT_OPTIMIZE_SCAN	1
+
+/*
+ * Where the last stream allocation of the inodes hashed to a slot was
+ * done.  There is a slot per possible cpu, so that concurrent writers
+ * neither share a goal nor a lock.
+ */
+struct ext4_mb_last_alloc {
+	ext4_group_t	group;
+	ext4_grpblk_t	start;
+};
+
 
 struct ext4_free_data {
 	/* MUST be the first member */
@@ -22,6 +22,7 @@
 #include <linux/spinlock.h>
 #include <linux/rcupdate.h>
 #include <linux/workqueue.h>
+#include <linux/task_work.h>
 
 unsigned int sysctl_nr_open __read_mostly = 1024*1024;
 unsigned int sysctl_nr_open_min = BITS_PER_LONG;
@@ -305,6 +306,7 @@ struct files_struct *dup_fd(struct files_struct *oldf, int *errorp)
 	newf->resize_in_progress = false;
 	init_waitqueue_head(&newf->resize_wait);
 	newf->next_fd = 0;
+	newf->close_seq = 0;
 	new_fdt = &newf->fdtab;
 	new_fdt->max_fds = NR_OPEN_DEFAULT;
 	new_fdt->close_on_exec = newf->close_on_exec_init;
@@ -647,6 +649,7 @@ int __close_fd(struct files_struct *files, unsigned fd)
 	rcu_assign_pointer(fdt->fd[fd], NULL);
 	__clear_close_on_exec(fd, fdt);
 	__put_unused_fd(files, fd);
+	files->close_seq++;
 	spin_unlock(&files->file_lock);
 	return filp_close(file, files);
 
@@ -681,6 +684,7 @@ void do_close_on_exec(struct files_struct *files)
 				continue;
 			rcu_assign_pointer(fdt->fd[fd], NULL);
 			__put_unused_fd(files, fd);
+			files->close_seq++;
 			spin_unlock(&files->file_lock);
 			filp_close(file, files);
 			cond_resched();
@@ -726,6 +730,101 @@ struct file *fget_raw(unsigned int fd)
 }
 EXPORT_SYMBOL(fget_raw);
 
+static void fd_cache_flush(struct fd_cache *fc)
+{
+	int i;
+
+	for (i = 0; i < FD_CACHE_SIZE; i++) {
+		if (fc->file[i]) {
+			fput(fc->file[i]);
+			fc->file[i] = NULL;
+		}
+	}
+}
+
+/* Runs on the return to user space of the syscall that filled a slot */
+static void fd_cache_work(struct callback_head *work)
+{
+	struct fd_cache *fc = container_of(work, struct fd_cache, work);
+
+	fd_cache_flush(fc);
+	fc->queued = false;
+}
+
+/* Only called on current, with no file of the cache in use */
+void exit_fd_cache(struct task_struct *tsk)
+{
+	struct fd_cache *fc = tsk->fd_cache;
+
+	if (fc) {
+		if (fc->queued)
+			task_work_cancel(tsk, fd_cache_work);
+		tsk->fd_cache = NULL;
+		fd_cache_flush(fc);
+		kfree(fc);
+	}
+}
+
+/*
+ * The reference of the cache slot covers the caller until fdput(), so a
+ * hit only reads the fd table and the file.  A miss takes a reference
+ * for a free slot.  Slots are only dropped by fd_cache_work() once the
+ * syscall is done with them, never here: a nested fdget() in the same
+ * syscall (epoll_ctl, splice, sendfile...) may not put the file an outer
+ * caller still uses.  It takes its own reference instead when the slot is
+ * taken.
+ */
+static unsigned long fd_cache_fget(struct files_struct *files,
+				   unsigned int fd, fmode_t mask)
+{
+	struct fd_cache *fc = current->fd_cache;
+	unsigned int slot = fd % FD_CACHE_SIZE;
+	struct file *file;
+
+	if (unlikely(!fc)) {
+		if (current->flags & PF_EXITING)
+			goto nocache;
+		/* fdget() callers may not sleep */
+		fc = kzalloc(sizeof(*fc), GFP_NOWAIT | __GFP_NOWARN);
+		if (!fc)
+			goto nocache;
+		init_task_work(&fc->work, fd_cache_work);
+		current->fd_cache = fc;
+	}
+	if (fc->files != files) {
+		/* The slots are of the table before an unshare() */
+		if (fc->queued)
+			goto nocache;
+		fc->files = files;
+	}
+
+	rcu_read_lock();
+	file = fcheck_files(files, fd);
+	rcu_read_unlock();
+	if (file && file == fc->file[slot] && fc->fd[slot] == fd)
+		return unlikely(file->f_mode & mask) ? 0 : (unsigned long)file;
+	if (fc->file[slot])
+		goto nocache;
+
+	if (!fc->queued) {
+		if (task_work_add(current, &fc->work, true))
+			goto nocache;
+		fc->queued = true;
+	}
+	file = __fget(fd, mask);
+	if (!file)
+		return 0;
+	fc->file[slot] = file;
+	fc->fd[slot] = fd;
+	return (unsigned long)file;
+
+nocache:
+	file = __fget(fd, mask);
+	if (!file)
+		return 0;
+	return FDPUT_FPUT | (unsigned long)file;
+}
+
 /*
  * Lightweight file lookup - no refcnt increment if fd table isn't shared.
  *
@@ -741,6 +840,10 @@ EXPORT_SYMBOL(fget_raw);
  *
  * The fput_needed flag returned by fget_light should be passed to the
  * corresponding fput_light.
+ *
+ * A shared fd table skips the refcnt increment too for a thread with
+ * PR_SET_FD_CACHE, whose cache holds a reference on the returned file
+ * until the syscall returns.
  */
 static unsigned long __fget_light(unsigned int fd, fmode_t mask)
 {
@@ -752,6 +855,8 @@ static unsigned long __fget_light(unsigned int fd, fmode_t mask)
 		if (!file || unlikely(file->f_mode & mask))
 			return 0;
 		return (unsigned long)file;
+	} else if (task_fd_cache(current)) {
+		return fd_cache_fget(files, fd, mask);
 	} else {
 		file = __fget(fd, mask);
 		if (!file)
@@ -848,6 +953,8 @@ __releases(&files->file_lock)
 	get_file(file);
 	rcu_assign_pointer(fdt->fd[fd], file);
 	__set_open_fd(fd, fdt);
+	if (tofree)
+		files->close_seq++;
 	if (flags & O_CLOEXEC)
 		__set_close_on_exec(fd, fdt);
 	else
@@ -15,6 +15,7 @@
 #include <linux/security.h>
 #include <linux/cred.h>
 #include <linux/eventpoll.h>
+#include <linux/poll.h>
 #include <linux/rcupdate.h>
 #include <linux/mount.h>
 #include <linux/capability.h>
@@ -53,7 +54,7 @@ static void file_free_rcu(struct rcu_head *head)
 static inline void file_free(struct file *f)
 {
 	percpu_counter_dec(&nr_files);
-	call_rcu(&f->f_u.fu_rcuhead, file_free_rcu);
+	call_rcu_lazy(&f->f_u.fu_rcuhead, file_free_rcu);
 }
 
 /*
@@ -137,6 +138,7 @@ struct file *get_empty_filp(void)
 	spin_lock_init(&f->f_lock);
 	mutex_init(&f->f_pos_lock);
 	eventpoll_init_file(f);
+	INIT_LIST_HEAD(&f->f_poll_cache_links);
 	/* f->f_version: 0 */
 	return f;
 
@@ -198,6 +200,7 @@ static void __fput(struct file *file)
 	 * in the file cleanup chain.
 	 */
 	eventpoll_release(file);
+	poll_cache_release(file);
 	locks_remove_file(file);
 
 	if (unlikely(file->f_flags & FASYNC)) {
@@ -20,6 +20,8 @@
 #include <linux/pipe_fs_i.h>
 #include <linux/swap.h>
 #include <linux/splice.h>
+#include <linux/vmalloc.h>
+#include <linux/bvec.h>
 
 MODULE_ALIAS_MISCDEV(FUSE_MINOR);
 MODULE_ALIAS("devname:fuse");
@@ -305,12 +307,70 @@ static u64 fuse_get_unique(struct fuse_iqueue *fiq)
 	return ++fiq->reqctr;
 }
 
+/* How many sleeping readers to look at for one on the current CPU */
+#define FUSE_WAKE_SCAN_MAX 32
+
+/*
+ * Wake up one reader of the device for new input.  Called with
+ * fiq->waitq.lock held.
+ *
+ * A reader sleeping in fuse_dev_do_read() that last ran on this CPU is
+ * preferred over the longest waiting one: the request is then picked up
+ * where it was queued, and the reply written from there finds the
+ * requester on the same CPU as well.  If anyone polls the device, all
+ * waiters are woken as before.
+ */
+static void fuse_wake_reader_locked(struct fuse_iqueue *fiq)
+{
+	int cpu = raw_smp_processor_id();
+	wait_queue_t *curr;
+	int scanned = 0;
+
+	/* poll() adds non-exclusive entries at the head of the queue */
+	list_for_each_entry(curr, &fiq->waitq.task_list, task_list) {
+		if (!(curr->flags & WQ_FLAG_EXCLUSIVE) ||
+		    curr->func != autoremove_wake_function ||
+		    ++scanned > FUSE_WAKE_SCAN_MAX)
+			break;
+		if (task_cpu(curr->private) == cpu) {
+			curr->func(curr, TASK_NORMAL, 0, NULL);
+			return;
+		}
+	}
+	wake_up_locked(&fiq->waitq);
+}
+
+/*
+ * Queue a request on the ring queue of this cpu if a daemon thread
+ * serves it, so that it is processed where it was submitted.  Called
+ * with fiq->waitq.lock held.
+ */
+static bool fuse_ring_queue_request(struct fuse_iqueue *fiq,
+				    struct fuse_req *req)
+{
+	struct fuse_ring *ring = fiq->ring;
+	struct fuse_ring_queue *q;
+
+	if (!ring)
+		return false;
+
+	q = &ring->queues[smp_processor_id()];
+	if (!q->active)
+		return false;
+
+	list_add_tail(&req->list, &q->pending);
+	wake_up(&q->waitq);
+	return true;
+}
+
 static void queue_request(struct fuse_iqueue *fiq, struct fuse_req *req)
 {
 	req->in.h.len = sizeof(struct fuse_in_header) +
 		len_args(req->in.numargs, (struct fuse_arg *) req->in.args);
+	if (fuse_ring_queue_request(fiq, req))
+		return;
 	list_add_tail(&req->list, &fiq->pending);
-	wake_up_locked(&fiq->waitq);
+	fuse_wake_reader_locked(fiq);
 	kill_fasync(&fiq->fasync, SIGIO, POLL_IN);
 }
 
@@ -326,7 +386,7 @@ void fuse_queue_forget(struct fuse_conn *fc, struct fuse_forget_link *forget,
 	if (fiq->connected) {
 		fiq->forget_list_tail->next = forget;
 		fiq->forget_list_tail = forget;
-		wake_up_locked(&fiq->waitq);
+		fuse_wake_reader_locked(fiq);
 		kill_fasync(&fiq->fasync, SIGIO, POLL_IN);
 	} else {
 		kfree(forget);
@@ -1202,14 +1262,82 @@ __releases(fiq->waitq.lock)
 		return fuse_read_batch_forget(fiq, cs, nbytes);
 }
 
+/*
+ * Copy a request just taken off a pending list to the userspace
+ * filesystem's buffer, which the caller checked is large enough.  If no
+ * reply is needed (FORGET) or request has been aborted or there was an
+ * error during the copying then it's finished by calling request_end().
+ * Otherwise add it to the processing list, and set the 'sent' flag.
+ */
+static ssize_t fuse_dev_send_req(struct fuse_dev *fud,
+				 struct fuse_copy_state *cs,
+				 struct fuse_req *req)
+{
+	ssize_t err;
+	struct fuse_conn *fc = fud->fc;
+	struct fuse_iqueue *fiq = &fc->iq;
+	struct fuse_pqueue *fpq = &fud->pq;
+	struct fuse_in *in = &req->in;
+	unsigned reqsize = in->h.len;
+
+	spin_lock(&fpq->lock);
+	list_add(&req->list, &fpq->io);
+	spin_unlock(&fpq->lock);
+	cs->req = req;
+	err = fuse_copy_one(cs, &in->h, sizeof(in->h));
+	if (!err)
+		err = fuse_copy_args(cs, in->numargs, in->argpages,
+				     (struct fuse_arg *) in->args, 0);
+	fuse_copy_finish(cs);
+	spin_lock(&fpq->lock);
+	clear_bit(FR_LOCKED, &req->flags);
+	if (!fpq->connected) {
+		err = -ENODEV;
+		goto out_end;
+	}
+	if (err) {
+		req->out.h.error = -EIO;
+		goto out_end;
+	}
+	if (!test_bit(FR_ISREPLY, &req->flags)) {
+		err = reqsize;
+		goto out_end;
+	}
+	list_move_tail(&req->list, &fpq->processing);
+	spin_unlock(&fpq->lock);
+	set_bit(FR_SENT, &req->flags);
+	/* matches barrier in request_wait_answer() */
+	smp_mb__after_atomic();
+	if (test_bit(FR_INTERRUPTED, &req->flags))
+		queue_interrupt(fiq, req);
+
+	return reqsize;
+
+out_end:
+	if (!test_bit(FR_PRIVATE, &req->flags))
+		list_del_init(&req->list);
+	spin_unlock(&fpq->lock);
+	request_end(fc, req);
+	return err;
+}
+
+/*
+ * Finish a request too large for the buffer it was to be read into,
+ * the reader then goes for the next one.
+ */
+static void fuse_dev_req_too_large(struct fuse_conn *fc, struct fuse_req *req)
+{
+	req->out.h.error = -EIO;
+	/* SETXATTR is special, since it may contain too large data */
+	if (req->in.h.opcode == FUSE_SETXATTR)
+		req->out.h.error = -E2BIG;
+	request_end(fc, req);
+}
+
 /*
  * Read a single request into the userspace filesystem's buffer.  This
  * function waits until a request is available, then removes it from
- * the pending list and copies request data to userspace buffer.  If
- * no reply is needed (FORGET) or request has been aborted or there
- * was an error during the copying then it's finished by calling
- * request_end().  Otherwise add it to the processing list, and set
- * the 'sent' flag.
+ * the pending list and hands it to fuse_dev_send_req().
  */
 static ssize_t fuse_dev_do_read(struct fuse_dev *fud, struct file *file,
 				struct fuse_copy_state *cs, size_t nbytes)
@@ -1217,10 +1345,7 @@ static ssize_t fuse_dev_do_read(struct fuse_dev *fud, struct file *file,
 	ssize_t err;
 	struct fuse_conn *fc = fud->fc;
 	struct fuse_iqueue *fiq = &fc->iq;
-	struct fuse_pqueue *fpq = &fud->pq;
 	struct fuse_req *req;
-	struct fuse_in *in;
-	unsigned reqsize;
 
  restart:
 	spin_lock(&fiq->waitq.lock);
@@ -1257,56 +1382,12 @@ static ssize_t fuse_dev_do_read(struct fuse_dev *fud, struct file *file,
 	list_del_init(&req->list);
 	spin_unlock(&fiq->waitq.lock);
 
-	in = &req->in;
-	reqsize = in->h.len;
 	/* If request is too large, reply with an error and restart the read */
-	if (nbytes < reqsize) {
-		req->out.h.error = -EIO;
-		/* SETXATTR is special, since it may contain too large data */
-		if (in->h.opcode == FUSE_SETXATTR)
-			req->out.h.error = -E2BIG;
-		request_end(fc, req);
+	if (nbytes < req->in.h.len) {
+		fuse_dev_req_too_large(fc, req);
 		goto restart;
 	}
-	spin_lock(&fpq->lock);
-	list_add(&req->list, &fpq->io);
-	spin_unlock(&fpq->lock);
-	cs->req = req;
-	err = fuse_copy_one(cs, &in->h, sizeof(in->h));
-	if (!err)
-		err = fuse_copy_args(cs, in->numargs, in->argpages,
-				     (struct fuse_arg *) in->args, 0);
-	fuse_copy_finish(cs);
-	spin_lock(&fpq->lock);
-	clear_bit(FR_LOCKED, &req->flags);
-	if (!fpq->connected) {
-		err = -ENODEV;
-		goto out_end;
-	}
-	if (err) {
-		req->out.h.error = -EIO;
-		goto out_end;
-	}
-	if (!test_bit(FR_ISREPLY, &req->flags)) {
-		err = reqsize;
-		goto out_end;
-	}
-	list_move_tail(&req->list, &fpq->processing);
-	spin_unlock(&fpq->lock);
-	set_bit(FR_SENT, &req->flags);
-	/* matches barrier in request_wait_answer() */
-	smp_mb__after_atomic();
-	if (test_bit(FR_INTERRUPTED, &req->flags))
-		queue_interrupt(fiq, req);
-
-	return reqsize;
-
-out_end:
-	if (!test_bit(FR_PRIVATE, &req->flags))
-		list_del_init(&req->list);
-	spin_unlock(&fpq->lock);
-	request_end(fc, req);
-	return err;
+	return fuse_dev_send_req(fud, cs, req);
 
  err_unlock:
 	spin_unlock(&fiq->waitq.lock);
@@ -1997,6 +2078,280 @@ out:
 	return ret;
 }
 
+/*
+ * Shared memory request ring
+ *
+ * Each request and reply through read() and write() costs a syscall, and
+ * the request is picked up by whichever reader wakes.  With the ring, a
+ * daemon thread makes one FUSE_DEV_IOC_RING_CMD per request: it passes
+ * the reply to the last request in its entry and waits for the next one
+ * of its cpu.  The data still goes through the fuse_copy_state helpers,
+ * over the pages of the entry instead of a user buffer.
+ */
+#define FUSE_RING_MAX_DEPTH		256
+#define FUSE_RING_MAX_ENTRY_SIZE	(1U << 20)
+#define FUSE_RING_MAX_SIZE		(256UL << 20)
+
+static void fuse_ring_free(struct fuse_ring *ring)
+{
+	kvfree(ring->bvec);
+	kfree(ring->busy);
+	vfree(ring->buf);
+	kfree(ring);
+}
+
+/* The ring set up on @fud, if any */
+static struct fuse_ring *fuse_ring_get(struct fuse_dev *fud)
+{
+	struct fuse_iqueue *fiq = &fud->fc->iq;
+	struct fuse_ring *ring;
+
+	/* Only the release of @fud frees its ring, and it's in use here */
+	spin_lock(&fiq->waitq.lock);
+	ring = fiq->ring;
+	if (ring && ring->fud != fud)
+		ring = NULL;
+	spin_unlock(&fiq->waitq.lock);
+	return ring;
+}
+
+static long fuse_ring_setup(struct fuse_dev *fud,
+			    struct fuse_ring_setup __user *usetup)
+{
+	struct fuse_iqueue *fiq = &fud->fc->iq;
+	struct fuse_ring_setup setup;
+	struct fuse_ring *ring;
+	unsigned int nr_ents, nr_pages, i;
+	size_t size;
+	int err;
+
+	if (copy_from_user(&setup, usetup, sizeof(setup)))
+		return -EFAULT;
+
+	if (setup.flags || !setup.queue_depth ||
+	    setup.queue_depth > FUSE_RING_MAX_DEPTH ||
+	    setup.entry_size < FUSE_MIN_READ_BUFFER ||
+	    setup.entry_size > FUSE_RING_MAX_ENTRY_SIZE ||
+	    !PAGE_ALIGNED(setup.entry_size))
+		return -EINVAL;
+
+	nr_ents = nr_cpu_ids * setup.queue_depth;
+	size = (size_t)nr_ents * setup.entry_size;
+	if (size > FUSE_RING_MAX_SIZE)
+		return -EINVAL;
+	nr_pages = size >> PAGE_SHIFT;
+
+	ring = kzalloc(sizeof(*ring) +
+		       nr_cpu_ids * sizeof(struct fuse_ring_queue), GFP_KERNEL);
+	if (!ring)
+		return -ENOMEM;
+
+	ring->fud = fud;
+	ring->nr_queues = nr_cpu_ids;
+	ring->queue_depth = setup.queue_depth;
+	ring->entry_size = setup.entry_size;
+	ring->size = size;
+	for (i = 0; i < ring->nr_queues; i++) {
+		INIT_LIST_HEAD(&ring->queues[i].pending);
+		init_waitqueue_head(&ring->queues[i].waitq);
+	}
+
+	err = -ENOMEM;
+	ring->busy = kcalloc(BITS_TO_LONGS(nr_ents), sizeof(long), GFP_KERNEL);
+	ring->buf = vmalloc_user(size);
+	ring->bvec = kmalloc_array(nr_pages, sizeof(struct bio_vec),
+				   GFP_KERNEL | __GFP_NOWARN);
+	if (!ring->bvec)
+		ring->bvec = vmalloc(nr_pages * sizeof(struct bio_vec));
+	if (!ring->busy || !ring->buf || !ring->bvec)
+		goto out_free;
+
+	for (i = 0; i < nr_pages; i++) {
+		ring->bvec[i].bv_page = vmalloc_to_page(ring->buf +
+							((size_t)i << PAGE_SHIFT));
+		ring->bvec[i].bv_len = PAGE_SIZE;
+		ring->bvec[i].bv_offset = 0;
+	}
+
+	err = -EFAULT;
+	setup.nr_queues = ring->nr_queues;
+	setup.mmap_size = size;
+	if (copy_to_user(usetup, &setup, sizeof(setup)))
+		goto out_free;
+
+	spin_lock(&fiq->waitq.lock);
+	if (!fiq->connected)
+		err = -ENODEV;
+	else if (fiq->ring)
+		err = -EBUSY;
+	else
+		err = 0;
+	if (!err)
+		fiq->ring = ring;
+	spin_unlock(&fiq->waitq.lock);
+	if (!err)
+		return 0;
+
+out_free:
+	fuse_ring_free(ring);
+	return err;
+}
+
+/* Iterate over the first @len bytes of entry @idx */
+static void fuse_ring_iter(struct fuse_ring *ring, unsigned int idx,
+			   struct iov_iter *iter, int dir, size_t len)
+{
+	unsigned int pages = ring->entry_size >> PAGE_SHIFT;
+
+	iov_iter_bvec(iter, ITER_BVEC | dir, ring->bvec + idx * pages, pages,
+		      len);
+}
+
+/* Wait for a request on @q and copy it to entry @idx */
+static ssize_t fuse_ring_fetch(struct fuse_dev *fud, struct fuse_ring *ring,
+			       struct fuse_ring_queue *q, unsigned int idx)
+{
+	struct fuse_conn *fc = fud->fc;
+	struct fuse_iqueue *fiq = &fc->iq;
+	struct fuse_copy_state cs;
+	struct iov_iter iter;
+	struct fuse_req *req;
+	int err;
+
+ restart:
+	spin_lock(&fiq->waitq.lock);
+	q->active = true;
+	while (fiq->connected && list_empty(&q->pending)) {
+		spin_unlock(&fiq->waitq.lock);
+		err = wait_event_interruptible_exclusive(q->waitq,
+				!READ_ONCE(fiq->connected) ||
+				!list_empty_careful(&q->pending));
+		if (err)
+			return err;
+		spin_lock(&fiq->waitq.lock);
+	}
+	if (!fiq->connected) {
+		spin_unlock(&fiq->waitq.lock);
+		return -ENODEV;
+	}
+
+	req = list_entry(q->pending.next, struct fuse_req, list);
+	clear_bit(FR_PENDING, &req->flags);
+	list_del_init(&req->list);
+	spin_unlock(&fiq->waitq.lock);
+
+	if (req->in.h.len > ring->entry_size) {
+		fuse_dev_req_too_large(fc, req);
+		goto restart;
+	}
+
+	fuse_ring_iter(ring, idx, &iter, READ, ring->entry_size);
+	fuse_copy_init(&cs, 1, &iter);
+	return fuse_dev_send_req(fud, &cs, req);
+}
+
+static long fuse_ring_cmd(struct fuse_dev *fud,
+			  struct fuse_ring_cmd __user *ucmd)
+{
+	struct fuse_ring *ring = fuse_ring_get(fud);
+	struct fuse_copy_state cs;
+	struct fuse_ring_cmd cmd;
+	struct iov_iter iter;
+	unsigned int idx;
+	long err;
+
+	if (!ring)
+		return -EINVAL;
+	if (copy_from_user(&cmd, ucmd, sizeof(cmd)))
+		return -EFAULT;
+	if (cmd.qid >= ring->nr_queues || cmd.entry >= ring->queue_depth ||
+	    (cmd.flags & ~FUSE_RING_COMMIT))
+		return -EINVAL;
+
+	idx = cmd.qid * ring->queue_depth + cmd.entry;
+	if (test_and_set_bit_lock(idx, ring->busy))
+		return -EBUSY;
+
+	if (cmd.flags & FUSE_RING_COMMIT) {
+		err = -EINVAL;
+		if (cmd.reply_len > ring->entry_size)
+			goto out;
+
+		fuse_ring_iter(ring, idx, &iter, WRITE, cmd.reply_len);
+		fuse_copy_init(&cs, 0, &iter);
+		err = fuse_dev_do_write(fud, &cs, cmd.reply_len);
+		if (err < 0)
+			goto out;
+	}
+
+	err = fuse_ring_fetch(fud, ring, &ring->queues[cmd.qid], idx);
+out:
+	clear_bit_unlock(idx, ring->busy);
+	return err;
+}
+
+/* Called with fiq->waitq.lock held, when the connection is aborted */
+static void fuse_ring_abort_locked(struct fuse_iqueue *fiq,
+				   struct list_head *to_end)
+{
+	struct fuse_ring *ring = fiq->ring;
+	unsigned int i;
+
+	if (!ring)
+		return;
+
+	for (i = 0; i < ring->nr_queues; i++) {
+		list_splice_tail_init(&ring->queues[i].pending, to_end);
+		wake_up_all(&ring->queues[i].waitq);
+	}
+}
+
+/*
+ * @fud is going away: hand the requests still queued on its ring back to
+ * the readers of the device, and free the ring.  Nobody maps it any more,
+ * a mapping holds a reference on the file.
+ */
+static void fuse_ring_release(struct fuse_dev *fud)
+{
+	struct fuse_iqueue *fiq = &fud->fc->iq;
+	struct fuse_ring *ring;
+	unsigned int i;
+
+	spin_lock(&fiq->waitq.lock);
+	ring = fiq->ring;
+	if (!ring || ring->fud != fud) {
+		spin_unlock(&fiq->waitq.lock);
+		return;
+	}
+	fiq->ring = NULL;
+	for (i = 0; i < ring->nr_queues; i++)
+		list_splice_tail_init(&ring->queues[i].pending, &fiq->pending);
+	if (request_pending(fiq))
+		wake_up_all_locked(&fiq->waitq);
+	spin_unlock(&fiq->waitq.lock);
+
+	fuse_ring_free(ring);
+}
+
+static int fuse_dev_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct fuse_dev *fud = fuse_get_dev(file);
+	struct fuse_ring *ring;
+
+	if (!fud)
+		return -EPERM;
+
+	ring = fuse_ring_get(fud);
+	if (!ring)
+		return -ENODEV;
+
+	/* Replies are written to the entries, a private copy won't do */
+	if (!(vma->vm_flags & VM_SHARED))
+		return -EINVAL;
+
+	return remap_vmalloc_range(vma, ring->buf, vma->vm_pgoff);
+}
+
 static unsigned fuse_dev_poll(struct file *file, poll_table *wait)
 {
 	unsigned mask = POLLOUT | POLLWRNORM;
@@ -2107,6 +2462,7 @@ void fuse_abort_conn(struct fuse_conn *fc)
 		spin_lock(&fiq->waitq.lock);
 		fiq->connected = 0;
 		list_splice_init(&fiq->pending, &to_end2);
+		fuse_ring_abort_locked(fiq, &to_end2);
 		list_for_each_entry(req, &to_end2, list)
 			clear_bit(FR_PENDING, &req->flags);
 		while (forget_pending(fiq))
@@ -2139,6 +2495,7 @@ int fuse_dev_release(struct inode *inode, struct file *file)
 		struct fuse_conn *fc = fud->fc;
 		struct fuse_pqueue *fpq = &fud->pq;
 
+		fuse_ring_release(fud);
 		WARN_ON(!list_empty(&fpq->io));
 		end_requests(fc, &fpq->processing);
 		/* Are we the last open device? */
@@ -2185,6 +2542,38 @@ static long fuse_dev_ioctl(struct file *file, unsigned int cmd,
 {
 	int err = -ENOTTY;
 
+	if (cmd == FUSE_DEV_IOC_PASSTHROUGH_OPEN) {
+		struct fuse_passthrough_out pto;
+		struct fuse_dev *fud = fuse_get_dev(file);
+
+		/* CUSE shares this handler but has no files to pass through */
+		err = -EINVAL;
+		if (!fud || file->f_op != &fuse_dev_operations)
+			return err;
+
+		err = -EFAULT;
+		if (copy_from_user(&pto, (void __user *) arg, sizeof(pto)))
+			return err;
+
+		err = -EINVAL;
+		if (pto.flags)
+			return err;
+
+		return fuse_passthrough_open(fud, pto.fd);
+	}
+
+	if (cmd == FUSE_DEV_IOC_RING_SETUP || cmd == FUSE_DEV_IOC_RING_CMD) {
+		struct fuse_dev *fud = fuse_get_dev(file);
+
+		/* Not for CUSE either */
+		if (!fud || file->f_op != &fuse_dev_operations)
+			return -EINVAL;
+
+		if (cmd == FUSE_DEV_IOC_RING_SETUP)
+			return fuse_ring_setup(fud, (void __user *) arg);
+		return fuse_ring_cmd(fud, (void __user *) arg);
+	}
+
 	if (cmd == FUSE_DEV_IOC_CLONE) {
 		int oldfd;
 
@@ -2225,6 +2614,7 @@ const struct file_operations fuse_dev_operations = {
 	.write_iter	= fuse_dev_write,
 	.splice_write	= fuse_dev_splice_write,
 	.poll		= fuse_dev_poll,
+	.mmap		= fuse_dev_mmap,
 	.release	= fuse_dev_release,
 	.fasync		= fuse_dev_fasync,
 	.unlocked_ioctl = fuse_dev_ioctl,
@@ -456,6 +456,9 @@ static int fuse_create_open(struct inode *dir, struct dentry *entry,
 	ff->fh = outopen.fh;
 	ff->nodeid = outentry.nodeid;
 	ff->open_flags = outopen.open_flags;
+	if ((ff->open_flags & FOPEN_PASSTHROUGH) &&
+	    fuse_passthrough_setup(fc, ff, &outopen))
+		ff->open_flags &= ~FOPEN_PASSTHROUGH;
 	inode = fuse_iget(dir->i_sb, outentry.nodeid, outentry.generation,
 			  &outentry.attr, entry_attr_timeout(&outentry), 0);
 	if (!inode) {
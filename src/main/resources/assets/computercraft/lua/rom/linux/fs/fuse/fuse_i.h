@@ -24,6 +24,7 @@
 #include <linux/workqueue.h>
 #include <linux/kref.h>
 #include <linux/xattr.h>
+#include <linux/idr.h>
 
 /** Max number of pages that can be used in a single read request */
 #define FUSE_MAX_PAGES_PER_REQ 32
@@ -119,6 +120,12 @@ enum {
 
 struct fuse_conn;
 
+/** Backing file of a passthrough open, see passthrough.c */
+struct fuse_passthrough {
+	struct file *filp;
+	const struct cred *cred;
+};
+
 /** FUSE specific file data */
 struct fuse_file {
 	/** Fuse connection for this file */
@@ -151,6 +158,9 @@ struct fuse_file {
 	/** Wait queue head for poll */
 	wait_queue_head_t poll_wait;
 
+	/** Backing file for FOPEN_PASSTHROUGH, filp is NULL otherwise */
+	struct fuse_passthrough passthrough;
+
 	/** Has flock been performed on this file? */
 	bool flock:1;
 };
@@ -406,6 +416,9 @@ struct fuse_iqueue {
 
 	/** O_ASYNC requests */
 	struct fasync_struct *fasync;
+
+	/** Request ring of the connection, if set up */
+	struct fuse_ring *ring;
 };
 
 struct fuse_pqueue {
@@ -436,6 +449,54 @@ struct fuse_dev {
 	struct list_head entry;
 };
 
+/**
+ * Queue of the request ring, one per cpu
+ *
+ * Requests queued on a cpu wait on @pending, under fc->iq.waitq.lock,
+ * for a daemon thread serving that cpu to fetch them into an entry.
+ */
+struct fuse_ring_queue {
+	/** Requests waiting for an entry */
+	struct list_head pending;
+
+	/** Daemon threads wait here for requests */
+	wait_queue_head_t waitq;
+
+	/** A thread has served the queue, requests of this cpu go here */
+	bool active;
+};
+
+/**
+ * Shared memory request ring, see FUSE_DEV_IOC_RING_SETUP
+ *
+ * The daemon maps @buf, which holds @queue_depth entries of @entry_size
+ * bytes for each cpu.  A thread owning an entry passes the reply to the
+ * request in it and gets the next request of its cpu in the same entry,
+ * with one ioctl.  Requests in the hands of the daemon are on the
+ * processing list of @fud, as if they were read from it.  The ring lives
+ * as long as @fud.
+ */
+struct fuse_ring {
+	/** Device the ring was set up on */
+	struct fuse_dev *fud;
+
+	unsigned int nr_queues;
+	unsigned int queue_depth;
+	unsigned int entry_size;
+
+	/** Entries, indexed by queue * queue_depth + entry */
+	void *buf;
+	size_t size;
+
+	/** Pages of @buf, to copy requests through like a user buffer */
+	struct bio_vec *bvec;
+
+	/** Set while a thread is in FUSE_DEV_IOC_RING_CMD on the entry */
+	unsigned long *busy;
+
+	struct fuse_ring_queue queues[];
+};
+
 /**
  * A Fuse connection.
  *
@@ -616,6 +677,9 @@ struct fuse_conn {
 	/** Does the filesystem support posix acls? */
 	unsigned posix_acl:1;
 
+	/** May opens be passed through to a backing file? */
+	unsigned passthrough:1;
+
 	/** Check permissions based on the file mode or not? */
 	unsigned default_permissions:1;
 
@@ -660,6 +724,12 @@ struct fuse_conn {
 
 	/** List of device instances belonging to this connection */
 	struct list_head devices;
+
+	/** Backing files registered for passthrough but not opened yet */
+	struct idr passthrough_req;
+
+	/** Protects passthrough_req */
+	spinlock_t passthrough_req_lock;
 };
 
 static inline struct fuse_conn *get_fuse_conn_super(struct super_block *sb)
@@ -976,4 +1046,14 @@ struct posix_acl;
 struct posix_acl *fuse_get_acl(struct inode *inode, int type);
 int fuse_set_acl(struct inode *inode, struct posix_acl *acl, int type);
 
+/* passthrough.c */
+int fuse_passthrough_open(struct fuse_dev *fud, u32 fd);
+int fuse_passthrough_setup(struct fuse_conn *fc, struct fuse_file *ff,
+			   struct fuse_open_out *openarg);
+void fuse_passthrough_release(struct fuse_passthrough *passthrough);
+void fuse_passthrough_cleanup(struct fuse_conn *fc);
+ssize_t fuse_passthrough_read_iter(struct kiocb *iocb, struct iov_iter *to);
+ssize_t fuse_passthrough_write_iter(struct kiocb *iocb, struct iov_iter *from);
+int fuse_passthrough_mmap(struct file *file, struct vm_area_struct *vma);
+
 #endif /* _FS_FUSE_I_H */
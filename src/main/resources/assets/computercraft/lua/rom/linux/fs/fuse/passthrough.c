@@ -0,0 +1,214 @@
+/*
+  FUSE: Filesystem in Userspace
+
+  Passthrough of file I/O to a backing file.
+
+  This program can be distributed under the terms of the GNU GPL.
+  See the file COPYING.
+*/
+
+#include "fuse_i.h"
+
+#include <linux/cred.h>
+#include <linux/file.h>
+#include <linux/uio.h>
+
+/*
+ * A filesystem that only forwards reads and writes of a file to some
+ * other file can let the kernel do that by itself.  The daemon registers
+ * the backing file with FUSE_DEV_IOC_PASSTHROUGH_OPEN on the device, which
+ * returns an id, and replies to FUSE_OPEN or FUSE_CREATE with
+ * FOPEN_PASSTHROUGH and that id in passthrough_fh.  read_iter, write_iter
+ * and mmap of the fuse file then go straight to the backing file, with the
+ * credentials of the daemon at registration time.  Everything else is
+ * still sent to the daemon.
+ */
+
+int fuse_passthrough_open(struct fuse_dev *fud, u32 fd)
+{
+	struct fuse_conn *fc = fud->fc;
+	struct fuse_passthrough *passthrough;
+	struct super_block *backing_sb;
+	struct file *backing;
+	int id;
+
+	if (!fc->passthrough)
+		return -EPERM;
+
+	backing = fget(fd);
+	if (!backing)
+		return -EBADF;
+
+	id = -EINVAL;
+	if (!backing->f_op->read_iter || !backing->f_op->write_iter)
+		goto out_fput;
+
+	/* Passthrough fuse mounts can't be stacked on each other, see INIT */
+	id = -ELOOP;
+	backing_sb = file_inode(backing)->i_sb;
+	if (backing_sb->s_stack_depth >= FILESYSTEM_MAX_STACK_DEPTH)
+		goto out_fput;
+
+	id = -ENOMEM;
+	passthrough = kmalloc(sizeof(*passthrough), GFP_KERNEL);
+	if (!passthrough)
+		goto out_fput;
+
+	passthrough->filp = backing;
+	passthrough->cred = get_current_cred();
+
+	idr_preload(GFP_KERNEL);
+	spin_lock(&fc->passthrough_req_lock);
+	id = idr_alloc(&fc->passthrough_req, passthrough, 1, 0, GFP_ATOMIC);
+	spin_unlock(&fc->passthrough_req_lock);
+	idr_preload_end();
+
+	if (id < 0) {
+		fuse_passthrough_release(passthrough);
+		kfree(passthrough);
+	}
+	return id;
+
+out_fput:
+	fput(backing);
+	return id;
+}
+
+/*
+ * Attach the backing file registered as openarg->passthrough_fh to a newly
+ * opened fuse file.  Each registration is used up by one open.
+ */
+int fuse_passthrough_setup(struct fuse_conn *fc, struct fuse_file *ff,
+			   struct fuse_open_out *openarg)
+{
+	struct fuse_passthrough *passthrough;
+	int id = openarg->passthrough_fh;
+
+	if (!fc->passthrough || id <= 0)
+		return -EINVAL;
+
+	spin_lock(&fc->passthrough_req_lock);
+	passthrough = idr_find(&fc->passthrough_req, id);
+	if (passthrough)
+		idr_remove(&fc->passthrough_req, id);
+	spin_unlock(&fc->passthrough_req_lock);
+
+	if (!passthrough)
+		return -EINVAL;
+
+	ff->passthrough = *passthrough;
+	kfree(passthrough);
+	return 0;
+}
+
+void fuse_passthrough_release(struct fuse_passthrough *passthrough)
+{
+	if (passthrough->filp) {
+		fput(passthrough->filp);
+		passthrough->filp = NULL;
+	}
+	if (passthrough->cred) {
+		put_cred(passthrough->cred);
+		passthrough->cred = NULL;
+	}
+}
+
+static int fuse_passthrough_free_req(int id, void *p, void *data)
+{
+	struct fuse_passthrough *passthrough = p;
+
+	fuse_passthrough_release(passthrough);
+	kfree(passthrough);
+	return 0;
+}
+
+/* Drop the registrations the daemon never used, on final connection put */
+void fuse_passthrough_cleanup(struct fuse_conn *fc)
+{
+	idr_for_each(&fc->passthrough_req, fuse_passthrough_free_req, NULL);
+	idr_destroy(&fc->passthrough_req);
+}
+
+ssize_t fuse_passthrough_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct fuse_file *ff = iocb->ki_filp->private_data;
+	struct file *backing = ff->passthrough.filp;
+	const struct cred *old_cred;
+	ssize_t ret;
+
+	if (!iov_iter_count(to))
+		return 0;
+
+	old_cred = override_creds(ff->passthrough.cred);
+	ret = vfs_iter_read(backing, to, &iocb->ki_pos);
+	revert_creds(old_cred);
+
+	return ret;
+}
+
+ssize_t fuse_passthrough_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct file *file = iocb->ki_filp;
+	struct inode *inode = file_inode(file);
+	struct fuse_file *ff = file->private_data;
+	struct file *backing = ff->passthrough.filp;
+	const struct cred *old_cred;
+	loff_t pos;
+	ssize_t ret;
+
+	if (!iov_iter_count(from))
+		return 0;
+
+	inode_lock(inode);
+	if (iocb->ki_flags & IOCB_APPEND)
+		iocb->ki_pos = i_size_read(file_inode(backing));
+	pos = iocb->ki_pos;
+
+	old_cred = override_creds(ff->passthrough.cred);
+	file_start_write(backing);
+	ret = vfs_iter_write(backing, from, &iocb->ki_pos);
+	file_end_write(backing);
+	revert_creds(old_cred);
+
+	if (ret > 0) {
+		/* Keep cached pages of other, non-passthrough opens coherent */
+		if (inode->i_mapping->nrpages)
+			invalidate_inode_pages2_range(inode->i_mapping,
+					pos >> PAGE_SHIFT,
+					(iocb->ki_pos - 1) >> PAGE_SHIFT);
+		fuse_write_update_size(inode, iocb->ki_pos);
+	}
+	fuse_invalidate_attr(inode);
+	inode_unlock(inode);
+
+	return ret;
+}
+
+int fuse_passthrough_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct fuse_file *ff = file->private_data;
+	struct file *backing = ff->passthrough.filp;
+	const struct cred *old_cred;
+	int ret;
+
+	if (!backing->f_op->mmap)
+		return -ENODEV;
+
+	if (WARN_ON(file != vma->vm_file))
+		return -EIO;
+
+	vma->vm_file = get_file(backing);
+
+	old_cred = override_creds(ff->passthrough.cred);
+	ret = call_mmap(backing, vma);
+	revert_creds(old_cred);
+
+	if (ret)
+		/* Drop the reference taken for the new vm_file */
+		fput(backing);
+	else
+		/* And the one of the fuse file on success */
+		fput(file);
+
+	return ret;
+}
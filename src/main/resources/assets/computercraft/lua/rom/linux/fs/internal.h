@@ -55,6 +55,13 @@ extern void __init chrdev_init(void);
 extern int user_path_mountpoint_at(int, const char __user *, unsigned int, struct path *);
 extern int vfs_path_lookup(struct dentry *, struct vfsmount *,
 			   const char *, unsigned int, struct path *);
+#ifdef CONFIG_FS_PATH_CACHE
+extern void path_cache_destroy(struct super_block *);
+#else
+static inline void path_cache_destroy(struct super_block *sb)
+{
+}
+#endif
 
 /*
  * namespace.c
@@ -143,6 +150,7 @@ extern int invalidate_inodes(struct super_block *, bool);
 extern struct dentry *__d_alloc(struct super_block *, const struct qstr *);
 extern int d_set_mounted(struct dentry *dentry);
 extern long prune_dcache_sb(struct super_block *sb, struct shrink_control *sc);
+extern void prune_dcache_sb_negative(struct super_block *sb);
 extern struct dentry *d_alloc_cursor(struct dentry *);
 
 /*
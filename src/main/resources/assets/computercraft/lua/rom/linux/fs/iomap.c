@@ -594,9 +594,16 @@ EXPORT_SYMBOL_GPL(iomap_fiemap);
  * Private flags for iomap_dio, must not overlap with the public ones in
  * iomap.h:
  */
+#define IOMAP_DIO_ONSTACK	(1 << 29)
 #define IOMAP_DIO_WRITE		(1 << 30)
 #define IOMAP_DIO_DIRTY		(1 << 31)
 
+/*
+ * Direct I/O bios come from their own bio_set so that small I/O can recycle
+ * them through its per cpu cache instead of the fs_bio_set mempool.
+ */
+static struct bio_set *iomap_dio_bioset __read_mostly;
+
 struct iomap_dio {
 	struct kiocb		*iocb;
 	iomap_dio_end_io_t	*end_io;
@@ -645,7 +652,8 @@ static ssize_t iomap_dio_complete(struct iomap_dio *dio)
 	}
 
 	inode_dio_end(file_inode(iocb->ki_filp));
-	kfree(dio);
+	if (!(dio->flags & IOMAP_DIO_ONSTACK))
+		kfree(dio);
 
 	return ret;
 }
@@ -716,7 +724,7 @@ iomap_dio_zero(struct iomap_dio *dio, struct iomap *iomap, loff_t pos,
 	struct page *page = ZERO_PAGE(0);
 	struct bio *bio;
 
-	bio = bio_alloc(GFP_KERNEL, 1);
+	bio = bio_alloc_bioset(GFP_KERNEL, 1, iomap_dio_bioset);
 	bio->bi_bdev = iomap->bdev;
 	bio->bi_iter.bi_sector =
 		iomap->blkno + ((pos - iomap->offset) >> 9);
@@ -795,7 +803,7 @@ iomap_dio_actor(struct inode *inode, loff_t pos, loff_t length,
 		if (dio->error)
 			return 0;
 
-		bio = bio_alloc(GFP_KERNEL, nr_pages);
+		bio = bio_alloc_bioset(GFP_KERNEL, nr_pages, iomap_dio_bioset);
 		bio->bi_bdev = iomap->bdev;
 		bio->bi_iter.bi_sector =
 			iomap->blkno + ((pos - iomap->offset) >> 9);
@@ -850,16 +858,26 @@ iomap_dio_rw(struct kiocb *iocb, struct iov_iter *iter,
 	loff_t end = iocb->ki_pos + count - 1, ret = 0;
 	unsigned int flags = IOMAP_DIRECT;
 	struct blk_plug plug;
-	struct iomap_dio *dio;
+	struct iomap_dio *dio, onstack_dio;
 
 	lockdep_assert_held(&inode->i_rwsem);
 
 	if (!count)
 		return 0;
 
-	dio = kmalloc(sizeof(*dio), GFP_KERNEL);
-	if (!dio)
-		return -ENOMEM;
+	/*
+	 * Synchronous callers wait for all bios before returning, so the
+	 * dio can live on their stack.  Only aio needs it to outlive us.
+	 */
+	if (is_sync_kiocb(iocb)) {
+		dio = &onstack_dio;
+		dio->flags = IOMAP_DIO_ONSTACK;
+	} else {
+		dio = kmalloc(sizeof(*dio), GFP_KERNEL);
+		if (!dio)
+			return -ENOMEM;
+		dio->flags = 0;
+	}
 
 	dio->iocb = iocb;
 	atomic_set(&dio->ref, 1);
@@ -867,7 +885,6 @@ iomap_dio_rw(struct kiocb *iocb, struct iov_iter *iter,
 	dio->i_size = i_size_read(inode);
 	dio->end_io = end_io;
 	dio->error = 0;
-	dio->flags = 0;
 
 	dio->submit.iter = iter;
 	if (is_sync_kiocb(iocb)) {
@@ -960,7 +977,18 @@ iomap_dio_rw(struct kiocb *iocb, struct iov_iter *iter,
 	return ret;
 
 out_free_dio:
-	kfree(dio);
+	if (!(dio->flags & IOMAP_DIO_ONSTACK))
+		kfree(dio);
 	return ret;
 }
 EXPORT_SYMBOL_GPL(iomap_dio_rw);
+
+static int __init iomap_init(void)
+{
+	iomap_dio_bioset = bioset_create(BIO_POOL_SIZE, 0);
+	if (!iomap_dio_bioset)
+		panic("iomap: can't allocate bioset\n");
+	bioset_enable_percpu_cache(iomap_dio_bioset);
+	return 0;
+}
+fs_initcall(iomap_init);
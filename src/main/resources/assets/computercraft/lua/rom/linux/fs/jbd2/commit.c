@@ -119,7 +119,7 @@ static void jbd2_commit_block_csum_set(journal_t *j, struct buffer_head *bh)
 static int journal_submit_commit_record(journal_t *journal,
 					transaction_t *commit_transaction,
 					struct buffer_head **cbh,
-					__u32 crc32_sum)
+					__u32 crc32_sum, bool fua_log)
 {
 	struct commit_header *tmp;
 	struct buffer_head *bh;
@@ -153,7 +153,13 @@ static int journal_submit_commit_record(journal_t *journal,
 	set_buffer_uptodate(bh);
 	bh->b_end_io = journal_end_buffer_io_sync;
 
-	if (journal->j_flags & JBD2_BARRIER &&
+	/*
+	 * The log blocks of a FUA commit are on stable storage once they
+	 * have completed, only the commit record itself needs FUA.
+	 */
+	if (fua_log)
+		ret = submit_bh(REQ_OP_WRITE, REQ_SYNC | REQ_FUA, bh);
+	else if (journal->j_flags & JBD2_BARRIER &&
 	    !jbd2_has_feature_async_commit(journal))
 		ret = submit_bh(REQ_OP_WRITE,
 			REQ_SYNC | REQ_PREFLUSH | REQ_FUA, bh);
@@ -164,6 +170,25 @@ static int journal_submit_commit_record(journal_t *journal,
 	return ret;
 }
 
+/*
+ * An external journal device that honours FUA can take the log blocks with
+ * FUA: the commit record then goes out without flushing the cache in front
+ * of it.  The filesystem device gets its own flush when the transaction
+ * needs one, so nothing else depends on that flush.  A journal on the
+ * filesystem device still needs the flush for the data blocks, and an
+ * async commit doesn't wait for the log blocks before writing the commit
+ * record.
+ */
+static bool journal_fua_log_writes(journal_t *journal)
+{
+	struct request_queue *q = bdev_get_queue(journal->j_dev);
+
+	return (journal->j_flags & JBD2_BARRIER) &&
+		journal->j_fs_dev != journal->j_dev &&
+		!jbd2_has_feature_async_commit(journal) &&
+		test_bit(QUEUE_FLAG_FUA, &q->queue_flags);
+}
+
 /*
  * This function along with journal_submit_commit_record
  * allows to write the commit record asynchronously.
@@ -379,12 +404,18 @@ void jbd2_journal_commit_transaction(journal_t *journal)
 	tid_t first_tid;
 	int update_tail;
 	int csum_size = 0;
+	bool fua_log;
+	int write_flags = REQ_SYNC;
 	LIST_HEAD(io_bufs);
 	LIST_HEAD(log_bufs);
 
 	if (jbd2_journal_has_csum_v2or3(journal))
 		csum_size = sizeof(struct jbd2_journal_block_tail);
 
+	fua_log = journal_fua_log_writes(journal);
+	if (fua_log)
+		write_flags |= REQ_FUA;
+
 	/*
 	 * First job: lock down the current transaction and wait for
 	 * all outstanding updates to complete.
@@ -419,6 +450,22 @@ void jbd2_journal_commit_transaction(journal_t *journal)
 			commit_transaction->t_tid);
 
 	write_lock(&journal->j_state_lock);
+	/*
+	 * A fast commit being written records changes of this transaction on
+	 * top of the previous one; let it finish, and keep new ones out until
+	 * this commit is done.
+	 */
+	while (journal->j_flags & JBD2_FAST_COMMIT_ONGOING) {
+		DEFINE_WAIT(wait);
+
+		prepare_to_wait(&journal->j_fc_wait, &wait,
+				TASK_UNINTERRUPTIBLE);
+		write_unlock(&journal->j_state_lock);
+		schedule();
+		write_lock(&journal->j_state_lock);
+		finish_wait(&journal->j_fc_wait, &wait);
+	}
+	journal->j_flags |= JBD2_FULL_COMMIT_ONGOING;
 	J_ASSERT(commit_transaction->t_state == T_RUNNING);
 	commit_transaction->t_state = T_LOCKED;
 
@@ -539,7 +586,8 @@ void jbd2_journal_commit_transaction(journal_t *journal)
 		jbd2_journal_abort(journal, err);
 
 	blk_start_plug(&plug);
-	jbd2_journal_write_revoke_records(commit_transaction, &log_bufs);
+	jbd2_journal_write_revoke_records(commit_transaction, &log_bufs,
+					  write_flags);
 
 	jbd_debug(3, "JBD2: commit phase 2b\n");
 
@@ -718,8 +766,16 @@ start_journal_io:
 				clear_buffer_dirty(bh);
 				set_buffer_uptodate(bh);
 				bh->b_end_io = journal_end_buffer_io_sync;
-				submit_bh(REQ_OP_WRITE, REQ_SYNC, bh);
+				submit_bh(REQ_OP_WRITE, write_flags, bh);
 			}
+			/*
+			 * Start the IO for this descriptor's blocks now, so
+			 * that it overlaps with checksumming and tagging the
+			 * next batch instead of waiting for the end of the
+			 * commit.
+			 */
+			blk_finish_plug(&plug);
+			blk_start_plug(&plug);
 			cond_resched();
 			stats.run.rs_blocks_logged += bufs;
 
@@ -777,7 +833,7 @@ start_journal_io:
 	/* Done it all: now write the commit record asynchronously. */
 	if (jbd2_has_feature_async_commit(journal)) {
 		err = journal_submit_commit_record(journal, commit_transaction,
-						 &cbh, crc32_sum);
+						 &cbh, crc32_sum, false);
 		if (err)
 			__jbd2_journal_abort_hard(journal);
 	}
@@ -868,7 +924,7 @@ start_journal_io:
 
 	if (!jbd2_has_feature_async_commit(journal)) {
 		err = journal_submit_commit_record(journal, commit_transaction,
-						&cbh, crc32_sum);
+						&cbh, crc32_sum, fua_log);
 		if (err)
 			__jbd2_journal_abort_hard(journal);
 	}
@@ -1086,6 +1142,9 @@ restart_loop:
 	J_ASSERT(commit_transaction == journal->j_committing_transaction);
 	journal->j_commit_sequence = commit_transaction->t_tid;
 	journal->j_committing_transaction = NULL;
+	/* Fast commits of the next transaction start over in their area */
+	journal->j_flags &= ~JBD2_FULL_COMMIT_ONGOING;
+	journal->j_fc_off = 0;
 	commit_time = ktime_to_ns(ktime_sub(ktime_get(), start_time));
 
 	/*
@@ -1099,6 +1158,7 @@ restart_loop:
 		journal->j_average_commit_time = commit_time;
 
 	write_unlock(&journal->j_state_lock);
+	wake_up(&journal->j_fc_wait);
 
 	if (journal->j_commit_callback)
 		journal->j_commit_callback(journal, commit_transaction);
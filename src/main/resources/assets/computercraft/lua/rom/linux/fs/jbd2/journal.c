@@ -100,6 +100,9 @@ EXPORT_SYMBOL(jbd2_journal_init_jbd_inode);
 EXPORT_SYMBOL(jbd2_journal_release_jbd_inode);
 EXPORT_SYMBOL(jbd2_journal_begin_ordered_truncate);
 EXPORT_SYMBOL(jbd2_inode_cache);
+EXPORT_SYMBOL(jbd2_fc_begin_commit);
+EXPORT_SYMBOL(jbd2_fc_end_commit);
+EXPORT_SYMBOL(jbd2_fc_get_buf);
 
 static void __journal_abort_soft (journal_t *journal, int errno);
 static int jbd2_journal_create_slab(size_t slab_size);
@@ -767,6 +770,124 @@ int jbd2_journal_next_log_block(journal_t *journal, unsigned long long *retp)
 	return jbd2_journal_bmap(journal, blocknr, retp);
 }
 
+/*
+ * Fast commits write compact records of the running transaction to a
+ * separate area past the end of the log, without committing it.  They are
+ * only valid on top of the last full commit, so a fast commit and a full
+ * commit never run at the same time: jbd2_fc_begin_commit() waits for a
+ * full commit in progress, and a full commit waits for a fast commit in
+ * progress before locking down the running transaction.
+ *
+ * Returns 0 if the caller may write a fast commit for transaction @tid,
+ * -EALREADY if @tid has been committed already, or -EINVAL if @tid is not
+ * the running transaction and a full commit has to be used instead.
+ */
+int jbd2_fc_begin_commit(journal_t *journal, tid_t tid)
+{
+	DEFINE_WAIT(wait);
+
+	if (!journal->j_fc_last)
+		return -EINVAL;
+
+	write_lock(&journal->j_state_lock);
+	while (journal->j_flags & (JBD2_FAST_COMMIT_ONGOING |
+				   JBD2_FULL_COMMIT_ONGOING)) {
+		prepare_to_wait(&journal->j_fc_wait, &wait,
+				TASK_UNINTERRUPTIBLE);
+		write_unlock(&journal->j_state_lock);
+		schedule();
+		write_lock(&journal->j_state_lock);
+		finish_wait(&journal->j_fc_wait, &wait);
+	}
+	if (tid_geq(journal->j_commit_sequence, tid)) {
+		write_unlock(&journal->j_state_lock);
+		return -EALREADY;
+	}
+	if (is_journal_aborted(journal) ||
+	    !journal->j_running_transaction ||
+	    journal->j_running_transaction->t_tid != tid ||
+	    journal->j_committing_transaction) {
+		write_unlock(&journal->j_state_lock);
+		return -EINVAL;
+	}
+	journal->j_flags |= JBD2_FAST_COMMIT_ONGOING;
+	write_unlock(&journal->j_state_lock);
+
+	return 0;
+}
+
+void jbd2_fc_end_commit(journal_t *journal)
+{
+	write_lock(&journal->j_state_lock);
+	journal->j_flags &= ~JBD2_FAST_COMMIT_ONGOING;
+	write_unlock(&journal->j_state_lock);
+	wake_up(&journal->j_fc_wait);
+}
+
+/*
+ * Get the buffer for the next block of the fast commit area, which the
+ * caller fills in and writes out.  Returns -ENOSPC once the area is full
+ * for this transaction.  Must be called between jbd2_fc_begin_commit()
+ * and jbd2_fc_end_commit().
+ */
+int jbd2_fc_get_buf(journal_t *journal, struct buffer_head **bh_out)
+{
+	unsigned long long pblock;
+	unsigned long blocknr;
+	struct buffer_head *bh;
+	int err;
+
+	J_ASSERT(journal->j_flags & JBD2_FAST_COMMIT_ONGOING);
+
+	write_lock(&journal->j_state_lock);
+	if (journal->j_fc_first + journal->j_fc_off >= journal->j_fc_last) {
+		write_unlock(&journal->j_state_lock);
+		return -ENOSPC;
+	}
+	blocknr = journal->j_fc_first + journal->j_fc_off++;
+	write_unlock(&journal->j_state_lock);
+
+	err = jbd2_journal_bmap(journal, blocknr, &pblock);
+	if (err)
+		return err;
+
+	bh = __getblk(journal->j_dev, pblock, journal->j_blocksize);
+	if (!bh)
+		return -ENOMEM;
+
+	*bh_out = bh;
+	return 0;
+}
+
+/*
+ * Carve the fast commit area out of the end of the journal, if the
+ * journal has the feature and is large enough to spare it.
+ */
+static void jbd2_journal_init_fc_area(journal_t *journal)
+{
+	journal_superblock_t *sb = journal->j_superblock;
+	unsigned long num;
+
+	journal->j_fc_first = journal->j_fc_last = journal->j_fc_off = 0;
+	if (!jbd2_has_feature_fast_commit(journal))
+		return;
+
+	num = be32_to_cpu(sb->s_num_fc_blks);
+	if (!num)
+		num = JBD2_DEFAULT_FAST_COMMIT_BLOCKS;
+	if (journal->j_first + JBD2_MIN_JOURNAL_BLOCKS + num >
+	    journal->j_last + 1) {
+		printk(KERN_WARNING "JBD2: Journal %s too short for %lu fast "
+		       "commit blocks, fast commits disabled\n",
+		       journal->j_devname, num);
+		return;
+	}
+
+	journal->j_fc_last = journal->j_last;
+	journal->j_last -= num;
+	journal->j_fc_first = journal->j_last;
+}
+
 /*
  * Conversion of logical to physical block numbers for the journal
  *
@@ -1109,6 +1230,7 @@ static journal_t *journal_init_common(struct block_device *bdev,
 	init_waitqueue_head(&journal->j_wait_commit);
 	init_waitqueue_head(&journal->j_wait_updates);
 	init_waitqueue_head(&journal->j_wait_reserved);
+	init_waitqueue_head(&journal->j_fc_wait);
 	mutex_init(&journal->j_barrier);
 	mutex_init(&journal->j_checkpoint_mutex);
 	spin_lock_init(&journal->j_revoke_lock);
@@ -1279,10 +1401,11 @@ static int journal_reset(journal_t *journal)
 
 	journal->j_first = first;
 	journal->j_last = last;
+	jbd2_journal_init_fc_area(journal);
 
 	journal->j_head = first;
 	journal->j_tail = first;
-	journal->j_free = last - first;
+	journal->j_free = journal->j_last - first;
 
 	journal->j_tail_sequence = journal->j_transaction_sequence;
 	journal->j_commit_sequence = journal->j_transaction_sequence - 1;
@@ -1595,6 +1718,7 @@ static int load_superblock(journal_t *journal)
 	journal->j_first = be32_to_cpu(sb->s_first);
 	journal->j_last = be32_to_cpu(sb->s_maxlen);
 	journal->j_errno = be32_to_cpu(sb->s_errno);
+	jbd2_journal_init_fc_area(journal);
 
 	return 0;
 }
@@ -1886,6 +2010,27 @@ int jbd2_journal_set_features (journal_t *journal, unsigned long compat,
 	sb->s_feature_ro_compat |= cpu_to_be32(ro);
 	sb->s_feature_incompat  |= cpu_to_be32(incompat);
 
+	/*
+	 * Turning on fast commits takes their area from the end of the
+	 * log.  This is only done right after jbd2_journal_load(), when
+	 * the log is empty.
+	 */
+	if (incompat & JBD2_FEATURE_INCOMPAT_FAST_COMMIT &&
+	    !journal->j_fc_last) {
+		if (!sb->s_num_fc_blks)
+			sb->s_num_fc_blks =
+				cpu_to_be32(JBD2_DEFAULT_FAST_COMMIT_BLOCKS);
+		write_lock(&journal->j_state_lock);
+		if (journal->j_head == journal->j_first &&
+		    journal->j_tail == journal->j_first) {
+			unsigned long last = journal->j_last;
+
+			jbd2_journal_init_fc_area(journal);
+			journal->j_free -= last - journal->j_last;
+		}
+		write_unlock(&journal->j_state_lock);
+	}
+
 	return 1;
 #undef COMPAT_FEATURE_ON
 #undef INCOMPAT_FEATURE_ON
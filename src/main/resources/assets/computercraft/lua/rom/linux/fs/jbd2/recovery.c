@@ -43,6 +43,7 @@ static int do_one_pass(journal_t *journal,
 				struct recovery_info *info, enum passtype pass);
 static int scan_revoke_records(journal_t *, struct buffer_head *,
 				tid_t, struct recovery_info *);
+static int fc_do_one_pass(journal_t *journal, struct recovery_info *info);
 
 #ifdef __KERNEL__
 
@@ -272,6 +273,8 @@ int jbd2_journal_recover(journal_t *journal)
 		err = do_one_pass(journal, &info, PASS_REVOKE);
 	if (!err)
 		err = do_one_pass(journal, &info, PASS_REPLAY);
+	if (!err)
+		err = fc_do_one_pass(journal, &info);
 
 	jbd_debug(1, "JBD2: recovery, exit status %d, "
 		  "recovered transactions %u to %u\n",
@@ -337,6 +340,42 @@ int jbd2_journal_skip_recovery(journal_t *journal)
 	return err;
 }
 
+/*
+ * Hand the fast commit area to the filesystem for replay, once the log has
+ * been replayed.  Only fast commits of the transaction following the last
+ * complete one in the log, which was running when the journal was last
+ * used, are valid; the callback checks their tid against the one we pass.
+ */
+static int fc_do_one_pass(journal_t *journal, struct recovery_info *info)
+{
+	unsigned long next_fc_block;
+	struct buffer_head *bh;
+	int err = 0;
+
+	if (!journal->j_fc_replay_callback || !journal->j_fc_last)
+		return 0;
+
+	for (next_fc_block = journal->j_fc_first;
+	     next_fc_block < journal->j_fc_last; next_fc_block++) {
+		err = jread(&bh, journal, next_fc_block);
+		if (err)
+			break;
+
+		err = journal->j_fc_replay_callback(journal, bh,
+					next_fc_block - journal->j_fc_first,
+					info->end_transaction);
+		brelse(bh);
+		if (err)
+			break;
+	}
+
+	jbd_debug(1, "JBD2: fast commit replay stopped at block %lu (%d)\n",
+		  next_fc_block - journal->j_fc_first, err);
+	if (err == JBD2_FC_REPLAY_STOP)
+		err = 0;
+	return err;
+}
+
 static inline unsigned long long read_tag_block(journal_t *journal,
 						journal_block_tag_t *tag)
 {
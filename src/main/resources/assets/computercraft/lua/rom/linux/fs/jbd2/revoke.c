@@ -125,8 +125,8 @@ struct jbd2_revoke_table_s
 static void write_one_revoke_record(transaction_t *,
 				    struct list_head *,
 				    struct buffer_head **, int *,
-				    struct jbd2_revoke_record_s *);
-static void flush_descriptor(journal_t *, struct buffer_head *, int);
+				    struct jbd2_revoke_record_s *, int);
+static void flush_descriptor(journal_t *, struct buffer_head *, int, int);
 #endif
 
 /* Utility functions to maintain the revoke table */
@@ -521,7 +521,8 @@ void jbd2_journal_switch_revoke_table(journal_t *journal)
  * revoke hash, deleting the entries as we go.
  */
 void jbd2_journal_write_revoke_records(transaction_t *transaction,
-				       struct list_head *log_bufs)
+				       struct list_head *log_bufs,
+				       int write_flags)
 {
 	journal_t *journal = transaction->t_journal;
 	struct buffer_head *descriptor;
@@ -545,14 +546,15 @@ void jbd2_journal_write_revoke_records(transaction_t *transaction,
 			record = (struct jbd2_revoke_record_s *)
 				hash_list->next;
 			write_one_revoke_record(transaction, log_bufs,
-						&descriptor, &offset, record);
+						&descriptor, &offset, record,
+						write_flags);
 			count++;
 			list_del(&record->hash);
 			kmem_cache_free(jbd2_revoke_record_cache, record);
 		}
 	}
 	if (descriptor)
-		flush_descriptor(journal, descriptor, offset);
+		flush_descriptor(journal, descriptor, offset, write_flags);
 	jbd_debug(1, "Wrote %d revoke records\n", count);
 }
 
@@ -565,7 +567,8 @@ static void write_one_revoke_record(transaction_t *transaction,
 				    struct list_head *log_bufs,
 				    struct buffer_head **descriptorp,
 				    int *offsetp,
-				    struct jbd2_revoke_record_s *record)
+				    struct jbd2_revoke_record_s *record,
+				    int write_flags)
 {
 	journal_t *journal = transaction->t_journal;
 	int csum_size = 0;
@@ -594,7 +597,8 @@ static void write_one_revoke_record(transaction_t *transaction,
 	/* Make sure we have a descriptor with space left for the record */
 	if (descriptor) {
 		if (offset + sz > journal->j_blocksize - csum_size) {
-			flush_descriptor(journal, descriptor, offset);
+			flush_descriptor(journal, descriptor, offset,
+					 write_flags);
 			descriptor = NULL;
 		}
 	}
@@ -633,7 +637,7 @@ static void write_one_revoke_record(transaction_t *transaction,
 
 static void flush_descriptor(journal_t *journal,
 			     struct buffer_head *descriptor,
-			     int offset)
+			     int offset, int write_flags)
 {
 	jbd2_journal_revoke_header_t *header;
 
@@ -649,7 +653,7 @@ static void flush_descriptor(journal_t *journal,
 	set_buffer_jwrite(descriptor);
 	BUFFER_TRACE(descriptor, "write");
 	set_buffer_dirty(descriptor);
-	write_dirty_buffer(descriptor, REQ_SYNC);
+	write_dirty_buffer(descriptor, write_flags);
 }
 #endif
 
@@ -38,6 +38,10 @@
 #include <linux/bitops.h>
 #include <linux/init_task.h>
 #include <linux/uaccess.h>
+#include <linux/cred.h>
+#include <linux/percpu.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
 
 #include "internal.h"
 #include "mount.h"
@@ -2031,6 +2035,352 @@ static inline u64 hash_name(const void *salt, const char *name)
 
 #endif
 
+#ifdef CONFIG_FS_PATH_CACHE
+/*
+ * Path prefix cache.
+ *
+ * Deep paths tend to be looked up over and over again from the same
+ * starting point, and an RCU walk of such a path spends most of its time
+ * redoing lookups of directories it has been through many times before.
+ * Each superblock therefore keeps a small direct mapped cache from
+ * (starting dentry, vfsmount, all but the last component) to the dentry
+ * that prefix resolved to, letting link_path_walk() jump straight to the
+ * last component on a hit.
+ *
+ * Entries hold no references on the dentries they name.  Instead every
+ * unhash, rename, attribute or xattr change of a directory bumps the
+ * ->s_path_cache_gen of its superblock, and an entry is only used while
+ * the generation it was created under is current.  Hashed dentries are
+ * not freed, so that keeps both ends of the prefix alive and in place;
+ * the target's ->d_seq catches it going negative, and nd->m_seq any
+ * change to the mount tree.  The credentials the prefix was walked with
+ * are pinned in the entry, so may_lookup() on the skipped directories is
+ * only elided for the credentials that already passed it.
+ *
+ * Only pure RCU walks without symlinks, "." or "..", mount crossings or
+ * filesystem specific hashing and revalidation are cached.
+ */
+#define PATH_CACHE_BITS		8
+#define PATH_CACHE_SIZE		(1U << PATH_CACHE_BITS)
+#define PATH_CACHE_MIN_DEPTH	3
+#define PATH_CACHE_NAME_MAX	224
+
+#define DCACHE_PATH_NOCACHE	(DCACHE_OP_HASH | DCACHE_OP_COMPARE | \
+				 DCACHE_OP_REVALIDATE | \
+				 DCACHE_OP_WEAK_REVALIDATE)
+
+struct path_cache_entry {
+	struct rcu_head		rcu;
+	struct dentry		*start;
+	struct vfsmount		*mnt;
+	struct dentry		*target;
+	const struct cred	*cred;
+	unsigned		seq;		/* target->d_seq */
+	unsigned		m_seq;		/* mount_lock */
+	int			gen;		/* ->s_path_cache_gen */
+	u64			hash_len;
+	char			name[];
+};
+
+struct path_cache {
+	spinlock_t			lock;
+	struct path_cache_entry __rcu	*slot[PATH_CACHE_SIZE];
+};
+
+struct path_cache_walk {
+	const char		*name;	/* start of the prefix */
+	const char		*last;	/* end of it, NULL if not caching */
+	u64			hash_len;
+	struct dentry		*start;
+	struct vfsmount		*mnt;
+	int			gen;
+};
+
+enum {
+	PATH_CACHE_HIT,
+	PATH_CACHE_MISS,
+	PATH_CACHE_STALE,
+	PATH_CACHE_INSERT,
+	NR_PATH_CACHE_STATS,
+};
+
+struct path_cache_stats {
+	unsigned long count[NR_PATH_CACHE_STATS];
+};
+
+static DEFINE_PER_CPU(struct path_cache_stats, path_cache_stats);
+
+static inline void path_cache_count(int item)
+{
+	this_cpu_inc(path_cache_stats.count[item]);
+}
+
+static void path_cache_entry_free(struct path_cache_entry *pce)
+{
+	put_cred(pce->cred);
+	kfree(pce);
+}
+
+static void path_cache_entry_free_rcu(struct rcu_head *head)
+{
+	path_cache_entry_free(container_of(head, struct path_cache_entry, rcu));
+}
+
+void path_cache_destroy(struct super_block *sb)
+{
+	struct path_cache *pc = sb->s_path_cache;
+	unsigned int i;
+
+	if (!pc)
+		return;
+
+	for (i = 0; i < PATH_CACHE_SIZE; i++) {
+		struct path_cache_entry *pce;
+
+		pce = rcu_dereference_protected(pc->slot[i], 1);
+		if (pce)
+			path_cache_entry_free(pce);
+	}
+	kfree(pc);
+}
+
+/*
+ * Try to resolve everything but the last component of @name from the
+ * cache.  On a hit nd is moved to the directory holding the last
+ * component and the rest of @name is returned.  Otherwise @name is
+ * returned as is and @pw is set up for path_cache_insert() once the
+ * walk has made it to the last component.
+ */
+static const char *path_cache_lookup(struct nameidata *nd, const char *name,
+				     struct path_cache_walk *pw)
+{
+	struct dentry *start = nd->path.dentry;
+	struct super_block *sb = start->d_sb;
+	struct path_cache_entry *pce;
+	struct path_cache *pc;
+	const char *p, *last = NULL;
+	unsigned int depth = 0, len;
+	struct dentry *target;
+	struct inode *inode;
+	unsigned seq;
+	u64 hash_len;
+
+	pw->last = NULL;
+	if (!(nd->flags & LOOKUP_RCU) || nd->depth ||
+	    (start->d_flags & DCACHE_PATH_NOCACHE))
+		return name;
+
+	for (p = name; *p; depth++) {
+		const char *c = p;
+
+		while (*p && *p != '/')
+			p++;
+		last = c;
+		while (*p == '/')
+			p++;
+		/* "." and ".." may only be the last component */
+		if (*p && c[0] == '.' &&
+		    (c[1] == '/' || (c[1] == '.' && c[2] == '/')))
+			return name;
+	}
+
+	len = last - name;
+	if (depth <= PATH_CACHE_MIN_DEPTH || len > PATH_CACHE_NAME_MAX)
+		return name;
+
+	hash_len = hashlen_create(full_name_hash(start, name, len), len);
+	pw->name = name;
+	pw->last = last;
+	pw->hash_len = hash_len;
+	pw->start = start;
+	pw->mnt = nd->path.mnt;
+	pw->gen = atomic_read(&sb->s_path_cache_gen);
+	smp_rmb();
+
+	pc = READ_ONCE(sb->s_path_cache);
+	if (!pc)
+		goto miss;
+
+	pce = rcu_dereference(pc->slot[hash_32(hashlen_hash(hash_len),
+					       PATH_CACHE_BITS)]);
+	if (!pce || pce->hash_len != hash_len || pce->start != start ||
+	    pce->mnt != nd->path.mnt || memcmp(pce->name, name, len))
+		goto miss;
+
+	if (pce->gen != pw->gen || pce->m_seq != nd->m_seq ||
+	    pce->cred != current_cred())
+		goto stale;
+
+	target = pce->target;
+	seq = raw_seqcount_begin(&target->d_seq);
+	if (seq != pce->seq)
+		goto stale;
+	inode = d_backing_inode(target);
+	if (unlikely(read_seqcount_retry(&target->d_seq, seq)) ||
+	    unlikely(__read_seqcount_retry(&start->d_seq, nd->seq)))
+		goto stale;
+
+	path_cache_count(PATH_CACHE_HIT);
+	pw->last = NULL;
+	nd->path.dentry = target;
+	nd->inode = inode;
+	nd->seq = seq;
+	nd->flags &= ~LOOKUP_JUMPED;
+	return last;
+
+stale:
+	path_cache_count(PATH_CACHE_STALE);
+	return name;
+miss:
+	path_cache_count(PATH_CACHE_MISS);
+	return name;
+}
+
+/*
+ * Called after each component the walk went through.  Anything other
+ * than a plain RCU step inside the starting mount makes the prefix
+ * uncacheable.
+ */
+static inline void path_cache_walked(struct nameidata *nd,
+				     struct path_cache_walk *pw, int err)
+{
+	if (pw->last &&
+	    (err || !(nd->flags & LOOKUP_RCU) || nd->path.mnt != pw->mnt ||
+	     (nd->path.dentry->d_flags &
+	      (DCACHE_PATH_NOCACHE | DCACHE_MANAGED_DENTRY))))
+		pw->last = NULL;
+}
+
+static void path_cache_insert(struct nameidata *nd, struct path_cache_walk *pw)
+{
+	struct dentry *start = pw->start;
+	struct super_block *sb = start->d_sb;
+	unsigned int len = hashlen_len(pw->hash_len);
+	struct path_cache_entry *pce, *old;
+	struct path_cache *pc, *old_pc;
+	unsigned int i;
+
+	/*
+	 * An unhashed starting point could be freed and its memory reused
+	 * without bumping the generation; mount roots are pinned by the
+	 * mount itself.
+	 */
+	if (d_unhashed(start) && start != pw->mnt->mnt_root)
+		return;
+
+	pc = READ_ONCE(sb->s_path_cache);
+	if (!pc) {
+		pc = kzalloc(sizeof(*pc), GFP_NOWAIT | __GFP_NOWARN);
+		if (!pc)
+			return;
+		spin_lock_init(&pc->lock);
+		old_pc = cmpxchg(&sb->s_path_cache, NULL, pc);
+		if (old_pc) {
+			kfree(pc);
+			pc = old_pc;
+		}
+	}
+
+	pce = kmalloc(sizeof(*pce) + len, GFP_NOWAIT | __GFP_NOWARN);
+	if (!pce)
+		return;
+	pce->start = start;
+	pce->mnt = pw->mnt;
+	pce->target = nd->path.dentry;
+	pce->cred = get_cred(current_cred());
+	pce->seq = nd->seq;
+	pce->m_seq = nd->m_seq;
+	pce->gen = pw->gen;
+	pce->hash_len = pw->hash_len;
+	memcpy(pce->name, pw->name, len);
+
+	/*
+	 * Only publish what the walk can still vouch for: no directory has
+	 * changed since it started, the target is still what it found and
+	 * the mount tree is unchanged.
+	 */
+	smp_rmb();
+	if (atomic_read(&sb->s_path_cache_gen) != pw->gen ||
+	    read_seqcount_retry(&pce->target->d_seq, pce->seq) ||
+	    read_seqretry(&mount_lock, nd->m_seq)) {
+		path_cache_entry_free(pce);
+		return;
+	}
+
+	i = hash_32(hashlen_hash(pw->hash_len), PATH_CACHE_BITS);
+	spin_lock(&pc->lock);
+	old = rcu_dereference_protected(pc->slot[i],
+					lockdep_is_held(&pc->lock));
+	rcu_assign_pointer(pc->slot[i], pce);
+	spin_unlock(&pc->lock);
+	if (old)
+		call_rcu(&old->rcu, path_cache_entry_free_rcu);
+	path_cache_count(PATH_CACHE_INSERT);
+}
+
+static inline void path_cache_done(struct nameidata *nd,
+				   struct path_cache_walk *pw)
+{
+	if (pw->last && pw->last == nd->last.name &&
+	    (nd->flags & LOOKUP_RCU))
+		path_cache_insert(nd, pw);
+}
+
+static int path_cache_show(struct seq_file *m, void *v)
+{
+	unsigned long stats[NR_PATH_CACHE_STATS] = { 0 };
+	int cpu, i;
+
+	for_each_possible_cpu(cpu)
+		for (i = 0; i < NR_PATH_CACHE_STATS; i++)
+			stats[i] += per_cpu(path_cache_stats, cpu).count[i];
+
+	seq_printf(m, "hits %lu\nmisses %lu\nstale %lu\ninserts %lu\n",
+		   stats[PATH_CACHE_HIT], stats[PATH_CACHE_MISS],
+		   stats[PATH_CACHE_STALE], stats[PATH_CACHE_INSERT]);
+	return 0;
+}
+
+static int path_cache_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, path_cache_show, NULL);
+}
+
+static const struct file_operations path_cache_fops = {
+	.open		= path_cache_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int __init path_cache_proc_init(void)
+{
+	proc_create("fs/path_cache", 0444, NULL, &path_cache_fops);
+	return 0;
+}
+fs_initcall(path_cache_proc_init);
+#else
+struct path_cache_walk {
+};
+
+static inline const char *path_cache_lookup(struct nameidata *nd,
+					    const char *name,
+					    struct path_cache_walk *pw)
+{
+	return name;
+}
+
+static inline void path_cache_walked(struct nameidata *nd,
+				     struct path_cache_walk *pw, int err)
+{
+}
+
+static inline void path_cache_done(struct nameidata *nd,
+				   struct path_cache_walk *pw)
+{
+}
+#endif /* CONFIG_FS_PATH_CACHE */
+
 /*
  * Name resolution.
  * This is the basic name resolution function, turning a pathname into
@@ -2041,6 +2391,7 @@ static inline u64 hash_name(const void *salt, const char *name)
  */
 static int link_path_walk(const char *name, struct nameidata *nd)
 {
+	struct path_cache_walk pw;
 	int err;
 
 	while (*name=='/')
@@ -2048,6 +2399,8 @@ static int link_path_walk(const char *name, struct nameidata *nd)
 	if (!*name)
 		return 0;
 
+	name = path_cache_lookup(nd, name, &pw);
+
 	/* At this point we know we have a real path component. */
 	for(;;) {
 		u64 hash_len;
@@ -2100,8 +2453,10 @@ static int link_path_walk(const char *name, struct nameidata *nd)
 		if (unlikely(!*name)) {
 OK:
 			/* pathname body, done */
-			if (!nd->depth)
+			if (!nd->depth) {
+				path_cache_done(nd, &pw);
 				return 0;
+			}
 			name = nd->stack[nd->depth - 1].name;
 			/* trailing symlink, done */
 			if (!name)
@@ -2115,6 +2470,7 @@ OK:
 		if (err < 0)
 			return err;
 
+		path_cache_walked(nd, &pw, err);
 		if (err) {
 			const char *s = get_link(nd);
 
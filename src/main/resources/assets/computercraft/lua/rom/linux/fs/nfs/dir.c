@@ -77,6 +77,7 @@ static struct nfs_open_dir_context *alloc_nfs_open_dir_context(struct inode *dir
 		ctx->attr_gencount = nfsi->attr_gencount;
 		ctx->dir_cookie = 0;
 		ctx->dup_cookie = 0;
+		ctx->flags = 0;
 		ctx->cred = get_rpccred(cred);
 		spin_lock(&dir->i_lock);
 		list_add(&ctx->list, &nfsi->open_files);
@@ -468,6 +469,18 @@ void nfs_advise_use_readdirplus(struct inode *dir)
 		set_bit(NFS_INO_ADVISE_RDPLUS, &nfsi->flags);
 }
 
+/*
+ * Called by lookup revalidation and getattr with whether they could use
+ * the cached attributes of the inode.  Counts the first use of attributes
+ * that were cached from a READDIRPLUS reply.
+ */
+void nfs_readdirplus_hit(struct inode *inode, bool hit)
+{
+	if (test_and_clear_bit(NFS_INO_RDPLUS_ATTRS, &NFS_I(inode)->flags) &&
+	    hit)
+		nfs_inc_stats(inode, NFSIOS_READDIRPLUS_HIT);
+}
+
 /*
  * This function is mainly for use by nfs_getattr().
  *
@@ -535,8 +548,11 @@ again:
 				goto out;
 			nfs_set_verifier(dentry, nfs_save_change_attribute(dir));
 			status = nfs_refresh_inode(d_inode(dentry), entry->fattr);
-			if (!status)
+			if (!status) {
 				nfs_setsecurity(d_inode(dentry), entry->fattr, entry->label);
+				set_bit(NFS_INO_RDPLUS_ATTRS,
+					&NFS_I(d_inode(dentry))->flags);
+			}
 			goto out;
 		} else {
 			d_invalidate(dentry);
@@ -560,6 +576,8 @@ again:
 		dentry = alias;
 	}
 	nfs_set_verifier(dentry, nfs_save_change_attribute(dir));
+	if (d_really_is_positive(dentry))
+		set_bit(NFS_INO_RDPLUS_ATTRS, &NFS_I(d_inode(dentry))->flags);
 out:
 	dput(dentry);
 }
@@ -740,6 +758,83 @@ int nfs_readdir_filler(nfs_readdir_descriptor_t *desc, struct page* page)
 	return ret;
 }
 
+struct nfs_readdir_prefetch {
+	struct work_struct work;
+	nfs_readdir_descriptor_t desc;
+};
+
+static void nfs_readdir_prefetch_work(struct work_struct *work)
+{
+	struct nfs_readdir_prefetch *prefetch =
+		container_of(work, struct nfs_readdir_prefetch, work);
+	nfs_readdir_descriptor_t *desc = &prefetch->desc;
+	struct file *file = desc->file;
+	struct nfs_open_dir_context *ctx = file->private_data;
+	struct page *page;
+
+	page = read_cache_page(file->f_mapping, desc->page_index,
+			       (filler_t *)nfs_readdir_filler, desc);
+	if (!IS_ERR(page))
+		put_page(page);
+
+	clear_bit(NFS_ODC_PREFETCH, &ctx->flags);
+	fput(file);
+	kfree(prefetch);
+}
+
+/*
+ * The READDIR or READDIRPLUS calls that fill the cache of a directory can
+ * only be issued one after the other, since each one starts at the cookie
+ * the previous one ended at.  Keep one of them in flight ahead of the
+ * reader instead: while the caller works through desc->page and stats its
+ * entries, fill the next page of the cache from nfsiod.
+ */
+static void nfs_readdir_prefetch(nfs_readdir_descriptor_t *desc)
+{
+	struct file *file = desc->file;
+	struct nfs_open_dir_context *ctx = file->private_data;
+	struct nfs_readdir_prefetch *prefetch;
+	struct nfs_cache_array *array;
+	struct page *page;
+	u64 last_cookie;
+	int eof_index;
+
+	array = nfs_readdir_get_array(desc->page);
+	if (IS_ERR(array))
+		return;
+	eof_index = array->eof_index;
+	last_cookie = array->last_cookie;
+	nfs_readdir_release_array(desc->page);
+	if (eof_index >= 0)
+		return;
+
+	page = find_get_page(file->f_mapping, desc->page_index + 1);
+	if (page) {
+		put_page(page);
+		return;
+	}
+
+	if (test_and_set_bit(NFS_ODC_PREFETCH, &ctx->flags))
+		return;
+
+	prefetch = kmalloc(sizeof(*prefetch), GFP_KERNEL);
+	if (!prefetch) {
+		clear_bit(NFS_ODC_PREFETCH, &ctx->flags);
+		return;
+	}
+	prefetch->desc = *desc;
+	prefetch->desc.page = NULL;
+	prefetch->desc.ctx = NULL;
+	prefetch->desc.dir_cookie = NULL;
+	prefetch->desc.page_index = desc->page_index + 1;
+	prefetch->desc.last_cookie = last_cookie;
+	INIT_WORK(&prefetch->work, nfs_readdir_prefetch_work);
+
+	nfs_inc_stats(file_inode(file), NFSIOS_READDIR_PREFETCH);
+	get_file(file);
+	queue_work(nfsiod_workqueue, &prefetch->work);
+}
+
 static
 void cache_page_release(nfs_readdir_descriptor_t *desc)
 {
@@ -953,6 +1048,7 @@ static int nfs_readdir(struct file *file, struct dir_context *ctx)
 		if (res < 0)
 			break;
 
+		nfs_readdir_prefetch(desc);
 		res = nfs_do_filldir(desc);
 		if (res < 0)
 			break;
@@ -1178,6 +1274,7 @@ static int nfs_lookup_revalidate(struct dentry *dentry, unsigned int flags)
 			goto out_zap_parent;
 		}
 		nfs_advise_use_readdirplus(dir);
+		nfs_readdirplus_hit(inode, true);
 		goto out_valid;
 	}
 
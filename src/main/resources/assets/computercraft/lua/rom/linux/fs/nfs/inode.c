@@ -735,9 +735,12 @@ int nfs_getattr(const struct path *path, struct kstat *stat,
 		struct nfs_server *server = NFS_SERVER(inode);
 
 		nfs_readdirplus_parent_cache_miss(path->dentry);
+		nfs_readdirplus_hit(inode, false);
 		err = __nfs_revalidate_inode(server, inode);
-	} else
+	} else {
 		nfs_readdirplus_parent_cache_hit(path->dentry);
+		nfs_readdirplus_hit(inode, true);
+	}
 	if (!err) {
 		generic_fillattr(inode, stat);
 		stat->ino = nfs_compat_user_ino64(NFS_FILEID(inode));
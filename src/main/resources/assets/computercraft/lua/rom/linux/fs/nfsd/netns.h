@@ -115,6 +115,12 @@ struct nfsd_net {
 	 */
 	unsigned int max_connections;
 
+	/*
+	 * Limit for starting threads beyond the configured number when all
+	 * of them are busy.  '0', the default, keeps that number fixed.
+	 */
+	unsigned int max_threads;
+
 	u32 clientid_counter;
 	u32 clverifier_counter;
 
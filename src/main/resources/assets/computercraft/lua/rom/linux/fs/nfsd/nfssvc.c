@@ -475,11 +475,30 @@ static int nfsd_get_default_max_blksize(void)
 	return ret;
 }
 
+/*
+ * Start another thread in a pool that ran out of idle ones.  This runs
+ * from a work item that svc_destroy() waits for with nfsd_mutex held, so
+ * it must not block on the mutex; the next busy enqueue will retry.
+ */
+static void nfsd_grow_pool(struct svc_serv *serv, struct svc_pool *pool)
+{
+	if (!mutex_trylock(&nfsd_mutex))
+		return;
+	/* Only add to a pool that wasn't shut down */
+	if (pool->sp_nrthreads) {
+		svc_get(serv);
+		svc_pool_add_thread(serv, pool);
+		svc_destroy(serv);
+	}
+	mutex_unlock(&nfsd_mutex);
+}
+
 static struct svc_serv_ops nfsd_thread_sv_ops = {
 	.svo_shutdown		= nfsd_last_thread,
 	.svo_function		= nfsd,
 	.svo_enqueue_xprt	= svc_xprt_do_enqueue,
 	.svo_setup		= svc_set_num_threads,
+	.svo_grow		= nfsd_grow_pool,
 	.svo_module		= THIS_MODULE,
 };
 
@@ -502,6 +521,7 @@ int nfsd_create_serv(struct net *net)
 		return -ENOMEM;
 
 	nn->nfsd_serv->sv_maxconn = nn->max_connections;
+	nn->nfsd_serv->sv_maxthreads = nn->max_threads;
 	error = svc_bind(nn->nfsd_serv, net);
 	if (error < 0) {
 		svc_destroy(nn->nfsd_serv);
@@ -702,8 +722,9 @@ nfsd(void *vrqstp)
 	 * The main request loop
 	 */
 	for (;;) {
-		/* Update sv_maxconn if it has changed */
+		/* Update sv_maxconn and sv_maxthreads if they have changed */
 		rqstp->rq_server->sv_maxconn = nn->max_connections;
+		rqstp->rq_server->sv_maxthreads = nn->max_threads;
 
 		/*
 		 * Find a socket with data available and call its
@@ -765,6 +765,20 @@ static int do_dentry_open(struct file *f,
 
 	file_ra_state_init(&f->f_ra, f->f_mapping->host->i_mapping);
 
+	/*
+	 * Huge pages in the page cache of a regular file are read-only:
+	 * drop them before the first write.  The barrier pairs with the one
+	 * in collapse_file(): either khugepaged sees our i_writecount or we
+	 * see its huge page.
+	 */
+	if (f->f_mode & FMODE_WRITE) {
+		smp_mb();
+		if (filemap_nr_thps(inode->i_mapping)) {
+			filemap_write_and_wait(inode->i_mapping);
+			truncate_pagecache(inode, 0);
+		}
+	}
+
 	return 0;
 
 cleanup_all:
@@ -195,6 +195,16 @@ out_fput:
 	return error;
 }
 
+static int ovl_set_size(struct dentry *upperdentry, loff_t size)
+{
+	struct iattr attr = {
+		.ia_valid = ATTR_SIZE,
+		.ia_size = size,
+	};
+
+	return notify_change(upperdentry, &attr, NULL);
+}
+
 static int ovl_set_timestamps(struct dentry *upperdentry, struct kstat *stat)
 {
 	struct iattr attr = {
@@ -235,7 +245,8 @@ int ovl_set_attr(struct dentry *upperdentry, struct kstat *stat)
 static int ovl_copy_up_locked(struct dentry *workdir, struct dentry *upperdir,
 			      struct dentry *dentry, struct path *lowerpath,
 			      struct kstat *stat, const char *link,
-			      struct kstat *pstat, bool tmpfile)
+			      struct kstat *pstat, bool tmpfile,
+			      bool metacopy)
 {
 	struct inode *wdir = workdir->d_inode;
 	struct inode *udir = upperdir->d_inode;
@@ -285,7 +296,23 @@ static int ovl_copy_up_locked(struct dentry *workdir, struct dentry *upperdir,
 	if (err)
 		goto out2;
 
-	if (S_ISREG(stat->mode)) {
+	/*
+	 * A metadata only copy-up leaves the data in the lower layer and marks
+	 * the upper file, which then only gets its size, with an xattr.
+	 */
+	if (metacopy) {
+		err = ovl_do_setxattr(temp, OVL_XATTR_METACOPY, "", 0, 0);
+		if (err == -EOPNOTSUPP) {
+			pr_warn_once("overlayfs: upper fs does not support xattrs, falling back to data copy-up.\n");
+			ovl_clear_metacopy(dentry->d_sb);
+			metacopy = false;
+			err = 0;
+		}
+		if (err)
+			goto out_cleanup;
+	}
+
+	if (S_ISREG(stat->mode) && !metacopy) {
 		struct path upperpath;
 
 		ovl_path_upper(dentry, &upperpath);
@@ -311,7 +338,10 @@ static int ovl_copy_up_locked(struct dentry *workdir, struct dentry *upperdir,
 		goto out_cleanup;
 
 	inode_lock(temp->d_inode);
-	err = ovl_set_attr(temp, stat);
+	if (metacopy)
+		err = ovl_set_size(temp, stat->size);
+	if (!err)
+		err = ovl_set_attr(temp, stat);
 	inode_unlock(temp->d_inode);
 	if (err)
 		goto out_cleanup;
@@ -324,6 +354,7 @@ static int ovl_copy_up_locked(struct dentry *workdir, struct dentry *upperdir,
 		goto out_cleanup;
 
 	newdentry = dget(tmpfile ? upper : temp);
+	ovl_dentry_set_metacopy(dentry, metacopy);
 	ovl_dentry_update(dentry, newdentry);
 	ovl_inode_update(d_inode(dentry), d_inode(newdentry));
 
@@ -352,7 +383,8 @@ out_cleanup:
  * the file will have already been copied up anyway.
  */
 static int ovl_copy_up_one(struct dentry *parent, struct dentry *dentry,
-			   struct path *lowerpath, struct kstat *stat)
+			   struct path *lowerpath, struct kstat *stat,
+			   bool metacopy)
 {
 	DEFINE_DELAYED_CALL(done);
 	struct dentry *workdir = ovl_workdir(dentry);
@@ -396,7 +428,7 @@ static int ovl_copy_up_one(struct dentry *parent, struct dentry *dentry,
 
 		inode_lock_nested(upperdir->d_inode, I_MUTEX_PARENT);
 		err = ovl_copy_up_locked(workdir, upperdir, dentry, lowerpath,
-					 stat, link, &pstat, true);
+					 stat, link, &pstat, true, metacopy);
 		inode_unlock(upperdir->d_inode);
 		ovl_copy_up_end(dentry);
 		goto out_done;
@@ -414,7 +446,7 @@ static int ovl_copy_up_one(struct dentry *parent, struct dentry *dentry,
 	}
 
 	err = ovl_copy_up_locked(workdir, upperdir, dentry, lowerpath,
-				 stat, link, &pstat, false);
+				 stat, link, &pstat, false, metacopy);
 out_unlock:
 	unlock_rename(workdir, upperdir);
 out_done:
@@ -423,6 +455,70 @@ out_done:
 	return err;
 }
 
+/*
+ * Copy up the data of a file that was copied up metadata only, in place,
+ * and only then drop the metacopy xattr.  Until that point the data is
+ * still read from the lower file, also after a crash.
+ */
+static int ovl_copy_up_meta_inode_data(struct dentry *dentry, int flags)
+{
+	struct path lowerpath, upperpath;
+	struct inode *upperinode;
+	struct kstat stat;
+	int err;
+
+	err = ovl_copy_up_data_start(dentry);
+	/* err < 0: interrupted, err > 0: raced with another copy-up */
+	if (unlikely(err)) {
+		pr_debug("ovl_copy_up_data_start(%pd2) = %i\n", dentry, err);
+		return err > 0 ? 0 : err;
+	}
+
+	ovl_path_lower(dentry, &lowerpath);
+	ovl_path_upper(dentry, &upperpath);
+	upperinode = d_inode(upperpath.dentry);
+
+	ovl_do_check_copy_up(lowerpath.dentry);
+
+	if (flags & O_TRUNC) {
+		inode_lock(upperinode);
+		err = ovl_set_size(upperpath.dentry, 0);
+		inode_unlock(upperinode);
+	} else {
+		err = vfs_getattr(&lowerpath, &stat,
+				  STATX_SIZE, AT_STATX_SYNC_AS_STAT);
+		if (!err)
+			err = ovl_copy_up_data(&lowerpath, &upperpath,
+					       stat.size);
+	}
+	if (err)
+		goto out;
+
+	err = ovl_do_removexattr(upperpath.dentry, OVL_XATTR_METACOPY);
+	if (err)
+		goto out;
+
+	ovl_dentry_set_metacopy(dentry, false);
+out:
+	ovl_copy_up_end(dentry);
+	return err;
+}
+
+static bool ovl_need_data_copy_up(int flags)
+{
+	return (OPEN_FMODE(flags) & FMODE_WRITE) || (flags & O_TRUNC);
+}
+
+/* Can the copy-up of a regular file for these open flags skip the data? */
+static bool ovl_need_meta_copy_up(struct dentry *dentry, umode_t mode,
+				  int flags)
+{
+	if (!ovl_metacopy(dentry->d_sb) || !S_ISREG(mode))
+		return false;
+
+	return !ovl_need_data_copy_up(flags);
+}
+
 int ovl_copy_up_flags(struct dentry *dentry, int flags)
 {
 	int err = 0;
@@ -433,10 +529,15 @@ int ovl_copy_up_flags(struct dentry *dentry, int flags)
 		struct dentry *parent;
 		struct path lowerpath;
 		struct kstat stat;
+		bool metacopy;
 		enum ovl_path_type type = ovl_path_type(dentry);
 
-		if (OVL_TYPE_UPPER(type))
+		if (OVL_TYPE_UPPER(type)) {
+			if (ovl_need_data_copy_up(flags) &&
+			    ovl_dentry_is_metacopy(dentry))
+				err = ovl_copy_up_meta_inode_data(dentry, flags);
 			break;
+		}
 
 		next = dget(dentry);
 		/* find the topmost dentry not yet copied up */
@@ -457,8 +558,12 @@ int ovl_copy_up_flags(struct dentry *dentry, int flags)
 		/* maybe truncate regular file. this has no effect on dirs */
 		if (flags & O_TRUNC)
 			stat.size = 0;
+		/* parents are directories, only the target can be metacopy */
+		metacopy = next == dentry &&
+			   ovl_need_meta_copy_up(next, stat.mode, flags);
 		if (!err)
-			err = ovl_copy_up_one(parent, next, &lowerpath, &stat);
+			err = ovl_copy_up_one(parent, next, &lowerpath, &stat,
+					      metacopy);
 
 		dput(parent);
 		dput(next);
@@ -468,7 +573,14 @@ int ovl_copy_up_flags(struct dentry *dentry, int flags)
 	return err;
 }
 
+/* Copy up, metadata only if the metacopy feature allows it */
 int ovl_copy_up(struct dentry *dentry)
 {
 	return ovl_copy_up_flags(dentry, 0);
 }
+
+/* Copy up, including the data of regular files */
+int ovl_copy_up_with_data(struct dentry *dentry)
+{
+	return ovl_copy_up_flags(dentry, O_WRONLY);
+}
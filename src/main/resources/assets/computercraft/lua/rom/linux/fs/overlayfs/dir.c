@@ -605,7 +605,8 @@ static int ovl_link(struct dentry *old, struct inode *newdir,
 	if (err)
 		goto out;
 
-	err = ovl_copy_up(old);
+	/* The new name would not find the lower data of a metacopy file */
+	err = ovl_copy_up_with_data(old);
 	if (err)
 		goto out_drop_write;
 
@@ -928,7 +929,7 @@ static int ovl_rename(struct inode *olddir, struct dentry *old,
 	if (err)
 		goto out;
 
-	err = ovl_copy_up(old);
+	err = ovl_copy_up_with_data(old);
 	if (err)
 		goto out_drop_write;
 
@@ -936,7 +937,7 @@ static int ovl_rename(struct inode *olddir, struct dentry *old,
 	if (err)
 		goto out_drop_write;
 	if (!overwrite) {
-		err = ovl_copy_up(new);
+		err = ovl_copy_up_with_data(new);
 		if (err)
 			goto out_drop_write;
 	}
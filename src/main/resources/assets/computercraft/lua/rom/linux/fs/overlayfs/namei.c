@@ -81,6 +81,26 @@ invalid:
 	goto err_free;
 }
 
+/* Was this upper file copied up metadata only? */
+static int ovl_check_metacopy(struct dentry *dentry)
+{
+	int res;
+
+	if (!d_is_reg(dentry))
+		return 0;
+
+	res = vfs_getxattr(dentry, OVL_XATTR_METACOPY, NULL, 0);
+	if (res < 0) {
+		if (res == -ENODATA || res == -EOPNOTSUPP)
+			return 0;
+		pr_warn_ratelimited("overlayfs: failed to get metacopy (%i)\n",
+				    res);
+		return res;
+	}
+
+	return 1;
+}
+
 static bool ovl_is_opaquedir(struct dentry *dentry)
 {
 	int res;
@@ -225,6 +245,7 @@ struct dentry *ovl_lookup(struct inode *dir, struct dentry *dentry,
 	unsigned int ctr = 0;
 	struct inode *inode = NULL;
 	bool upperopaque = false;
+	bool metacopy = false;
 	char *upperredirect = NULL;
 	struct dentry *this;
 	unsigned int i;
@@ -242,8 +263,12 @@ struct dentry *ovl_lookup(struct inode *dir, struct dentry *dentry,
 		return ERR_PTR(-ENAMETOOLONG);
 
 	old_cred = ovl_override_creds(dentry->d_sb);
+	/* Names that are not in a current merged dir cache are in no layer */
+	if (ovl_dir_cache_negative(dentry->d_parent, &dentry->d_name))
+		d.stop = true;
+
 	upperdir = ovl_upperdentry_dereference(poe);
-	if (upperdir) {
+	if (upperdir && !d.stop) {
 		err = ovl_lookup_layer(upperdir, &d, &upperdentry);
 		if (err)
 			goto out;
@@ -254,6 +279,16 @@ struct dentry *ovl_lookup(struct inode *dir, struct dentry *dentry,
 			goto out;
 		}
 
+		if (upperdentry) {
+			err = ovl_check_metacopy(upperdentry);
+			if (err < 0)
+				goto out_put_upper;
+			/* Continue in the lower layers to find the data */
+			metacopy = err;
+			if (metacopy)
+				d.stop = false;
+		}
+
 		if (d.redirect) {
 			upperredirect = kstrdup(d.redirect, GFP_KERNEL);
 			if (!upperredirect)
@@ -287,7 +322,7 @@ struct dentry *ovl_lookup(struct inode *dir, struct dentry *dentry,
 		stack[ctr].mnt = lowerpath.mnt;
 		ctr++;
 
-		if (d.stop)
+		if (d.stop || metacopy)
 			break;
 
 		if (d.redirect &&
@@ -304,6 +339,13 @@ struct dentry *ovl_lookup(struct inode *dir, struct dentry *dentry,
 		}
 	}
 
+	if (metacopy && (!ctr || !d_is_reg(stack[0].dentry))) {
+		pr_warn_ratelimited("overlayfs: no lower data for metacopy file (%pd2)\n",
+				    upperdentry);
+		err = -EIO;
+		goto out_put;
+	}
+
 	oe = ovl_alloc_entry(ctr);
 	err = -ENOMEM;
 	if (!oe)
@@ -332,6 +374,7 @@ struct dentry *ovl_lookup(struct inode *dir, struct dentry *dentry,
 
 	revert_creds(old_cred);
 	oe->opaque = upperopaque;
+	oe->metacopy = metacopy;
 	oe->redirect = upperredirect;
 	oe->__upperdentry = upperdentry;
 	memcpy(oe->lowerstack, stack, sizeof(struct path) * ctr);
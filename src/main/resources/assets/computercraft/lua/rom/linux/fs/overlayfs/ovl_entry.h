@@ -14,6 +14,7 @@ struct ovl_config {
 	char *workdir;
 	bool default_permissions;
 	bool redirect_dir;
+	bool metacopy;
 };
 
 /* private information held for overlayfs's superblock */
@@ -41,6 +42,8 @@ struct ovl_entry {
 			const char *redirect;
 			bool opaque;
 			bool copying;
+			/* upper has metadata only, data is in lowerstack[0] */
+			bool metacopy;
 		};
 		struct rcu_head rcu;
 	};
@@ -15,6 +15,7 @@
 #include <linux/rbtree.h>
 #include <linux/security.h>
 #include <linux/cred.h>
+#include <linux/workqueue.h>
 #include "overlayfs.h"
 
 struct ovl_cache_entry {
@@ -28,25 +29,40 @@ struct ovl_cache_entry {
 	char name[];
 };
 
+/*
+ * The merged dir cache of a directory stays attached to its dentry, which
+ * holds a reference on it, until a change of the directory through the
+ * overlay bumps the dentry version or the dentry goes away.  All accesses
+ * are under the directory inode lock.
+ */
 struct ovl_dir_cache {
 	long refcount;
 	u64 version;
 	struct list_head entries;
+	struct rb_root root;
 };
 
 struct ovl_readdir_data {
 	struct dir_context ctx;
 	struct dentry *dentry;
-	bool is_lowest;
 	struct rb_root root;
 	struct list_head *list;
-	struct list_head middle;
 	struct ovl_cache_entry *first_maybe_whiteout;
 	int count;
 	int err;
 	bool d_type_supported;
 };
 
+/* Reading of one layer of a merged directory */
+struct ovl_dir_read_work {
+	struct work_struct work;
+	const struct cred *cred;
+	struct path realpath;
+	struct ovl_readdir_data rdd;
+	struct list_head list;
+	int err;
+};
+
 struct ovl_dir_file {
 	bool is_real;
 	bool is_upper;
@@ -107,6 +123,34 @@ static struct ovl_cache_entry *ovl_cache_entry_new(struct ovl_readdir_data *rdd,
 	return p;
 }
 
+/* Insert @p into @root, unless there is an entry of that name already */
+static struct ovl_cache_entry *ovl_cache_entry_insert(struct rb_root *root,
+						     struct ovl_cache_entry *p)
+{
+	struct rb_node **newp = &root->rb_node;
+	struct rb_node *parent = NULL;
+
+	while (*newp) {
+		int cmp;
+		struct ovl_cache_entry *tmp;
+
+		parent = *newp;
+		tmp = ovl_cache_entry_from_node(*newp);
+		cmp = strncmp(p->name, tmp->name, p->len);
+		if (cmp > 0)
+			newp = &tmp->node.rb_right;
+		else if (cmp < 0 || p->len < tmp->len)
+			newp = &tmp->node.rb_left;
+		else
+			return tmp;
+	}
+
+	rb_link_node(&p->node, parent, newp);
+	rb_insert_color(&p->node, root);
+
+	return NULL;
+}
+
 static int ovl_cache_entry_add_rb(struct ovl_readdir_data *rdd,
 				  const char *name, int len, u64 ino,
 				  unsigned int d_type)
@@ -141,26 +185,6 @@ static int ovl_cache_entry_add_rb(struct ovl_readdir_data *rdd,
 	return 0;
 }
 
-static int ovl_fill_lowest(struct ovl_readdir_data *rdd,
-			   const char *name, int namelen,
-			   loff_t offset, u64 ino, unsigned int d_type)
-{
-	struct ovl_cache_entry *p;
-
-	p = ovl_cache_entry_find(&rdd->root, name, namelen);
-	if (p) {
-		list_move_tail(&p->l_node, &rdd->middle);
-	} else {
-		p = ovl_cache_entry_new(rdd, name, namelen, ino, d_type);
-		if (p == NULL)
-			rdd->err = -ENOMEM;
-		else
-			list_add_tail(&p->l_node, &rdd->middle);
-	}
-
-	return rdd->err;
-}
-
 void ovl_cache_free(struct list_head *list)
 {
 	struct ovl_cache_entry *p;
@@ -172,21 +196,43 @@ void ovl_cache_free(struct list_head *list)
 	INIT_LIST_HEAD(list);
 }
 
-static void ovl_cache_put(struct ovl_dir_file *od, struct dentry *dentry)
+void ovl_cache_put(struct ovl_dir_cache *cache)
 {
-	struct ovl_dir_cache *cache = od->cache;
-
 	WARN_ON(cache->refcount <= 0);
 	cache->refcount--;
 	if (!cache->refcount) {
-		if (ovl_dir_cache(dentry) == cache)
-			ovl_set_dir_cache(dentry, NULL);
-
 		ovl_cache_free(&cache->entries);
 		kfree(cache);
 	}
 }
 
+/* Drop the reference of the dentry on a cache that is no longer current */
+static void ovl_cache_put_stale(struct dentry *dentry)
+{
+	struct ovl_dir_cache *cache = ovl_dir_cache(dentry);
+
+	if (cache && ovl_dentry_version_get(dentry) != cache->version) {
+		ovl_set_dir_cache(dentry, NULL);
+		ovl_cache_put(cache);
+	}
+}
+
+/*
+ * A merged dir cache that is still current has every name of every layer of
+ * the directory, whiteouts included.  A name that is not in it needs no
+ * lookup in the layers.  Called with the directory locked, at least shared.
+ */
+bool ovl_dir_cache_negative(struct dentry *dir, const struct qstr *name)
+{
+	struct ovl_dir_cache *cache = ovl_dir_cache(dir);
+
+	if (!cache || ovl_dentry_version_get(dir) != cache->version)
+		return false;
+
+	return !ovl_cache_entry_find(&cache->root, (const char *) name->name,
+				     name->len);
+}
+
 static int ovl_fill_merge(struct dir_context *ctx, const char *name,
 			  int namelen, loff_t offset, u64 ino,
 			  unsigned int d_type)
@@ -195,10 +241,7 @@ static int ovl_fill_merge(struct dir_context *ctx, const char *name,
 		container_of(ctx, struct ovl_readdir_data, ctx);
 
 	rdd->count++;
-	if (!rdd->is_lowest)
-		return ovl_cache_entry_add_rb(rdd, name, namelen, ino, d_type);
-	else
-		return ovl_fill_lowest(rdd, name, namelen, offset, ino, d_type);
+	return ovl_cache_entry_add_rb(rdd, name, namelen, ino, d_type);
 }
 
 static int ovl_check_whiteouts(struct dentry *dir, struct ovl_readdir_data *rdd)
@@ -264,46 +307,109 @@ static void ovl_dir_reset(struct file *file)
 	enum ovl_path_type type = ovl_path_type(dentry);
 
 	if (cache && ovl_dentry_version_get(dentry) != cache->version) {
-		ovl_cache_put(od, dentry);
+		ovl_cache_put(cache);
 		od->cache = NULL;
 		od->cursor = NULL;
 	}
+	ovl_cache_put_stale(dentry);
 	WARN_ON(!od->is_real && !OVL_TYPE_MERGE(type));
 	if (od->is_real && OVL_TYPE_MERGE(type))
 		od->is_real = false;
 }
 
-static int ovl_dir_read_merged(struct dentry *dentry, struct list_head *list)
+static void ovl_dir_read_worker(struct work_struct *work)
 {
-	int err;
+	struct ovl_dir_read_work *w =
+		container_of(work, struct ovl_dir_read_work, work);
+	const struct cred *old_cred;
+
+	old_cred = override_creds(w->cred);
+	w->err = ovl_dir_read(&w->realpath, &w->rdd);
+	revert_creds(old_cred);
+}
+
+/* Merge the entries of one layer, read on its own, into @list and @root */
+static void ovl_dir_merge_layer(struct list_head *list, struct rb_root *root,
+				struct list_head *layer, bool is_lowest)
+{
+	struct ovl_cache_entry *p, *n, *old;
+	struct list_head *pos = list;
+	LIST_HEAD(middle);
+
+	/*
+	 * Insert lowest layer entries before upper ones, this allows offsets
+	 * to be reasonably constant
+	 */
+	if (is_lowest) {
+		list_add(&middle, list);
+		pos = &middle;
+	}
+
+	list_for_each_entry_safe(p, n, layer, l_node) {
+		old = ovl_cache_entry_insert(root, p);
+		if (!old) {
+			list_move_tail(&p->l_node, pos);
+			continue;
+		}
+		if (is_lowest)
+			list_move_tail(&old->l_node, pos);
+		list_del(&p->l_node);
+		kfree(p);
+	}
+
+	if (is_lowest)
+		list_del(&middle);
+}
+
+/*
+ * Read all layers of a merged directory.  The layers are independent until
+ * the merge, so all but the upper one are read by workers, in parallel, and
+ * then merged from the top down.  The workers use the credentials of the
+ * caller, who waits for them.
+ */
+static int ovl_dir_read_merged(struct dentry *dentry, struct list_head *list,
+			       struct rb_root *root)
+{
+	int err = 0;
 	struct path realpath;
-	struct ovl_readdir_data rdd = {
-		.ctx.actor = ovl_fill_merge,
-		.dentry = dentry,
-		.list = list,
-		.root = RB_ROOT,
-		.is_lowest = false,
-	};
-	int idx, next;
+	struct ovl_dir_read_work *works, *w;
+	int idx, next, nr, i;
 
-	for (idx = 0; idx != -1; idx = next) {
+	for (idx = 0, nr = 0; idx != -1; idx = next, nr++)
 		next = ovl_path_next(idx, dentry, &realpath);
 
-		if (next != -1) {
-			err = ovl_dir_read(&realpath, &rdd);
-			if (err)
-				break;
-		} else {
-			/*
-			 * Insert lowest layer entries before upper ones, this
-			 * allows offsets to be reasonably constant
-			 */
-			list_add(&rdd.middle, rdd.list);
-			rdd.is_lowest = true;
-			err = ovl_dir_read(&realpath, &rdd);
-			list_del(&rdd.middle);
-		}
+	works = kcalloc(nr, sizeof(*works), GFP_KERNEL);
+	if (!works)
+		return -ENOMEM;
+
+	for (idx = 0, i = 0; idx != -1; idx = next, i++) {
+		w = &works[i];
+		next = ovl_path_next(idx, dentry, &w->realpath);
+		INIT_LIST_HEAD(&w->list);
+		INIT_WORK(&w->work, ovl_dir_read_worker);
+		w->cred = current_cred();
+		w->rdd.ctx.actor = ovl_fill_merge;
+		w->rdd.dentry = dentry;
+		w->rdd.list = &w->list;
+		w->rdd.root = RB_ROOT;
+		if (i)
+			queue_work(system_unbound_wq, &w->work);
 	}
+
+	ovl_dir_read_worker(&works[0].work);
+	for (i = 1; i < nr; i++)
+		flush_work(&works[i].work);
+
+	for (i = 0; i < nr; i++) {
+		w = &works[i];
+		if (!err)
+			err = w->err;
+		if (!err)
+			ovl_dir_merge_layer(list, root, &w->list, i == nr - 1);
+		ovl_cache_free(&w->list);
+	}
+	kfree(works);
+
 	return err;
 }
 
@@ -331,16 +437,18 @@ static struct ovl_dir_cache *ovl_cache_get(struct dentry *dentry)
 		cache->refcount++;
 		return cache;
 	}
-	ovl_set_dir_cache(dentry, NULL);
+	ovl_cache_put_stale(dentry);
 
 	cache = kzalloc(sizeof(struct ovl_dir_cache), GFP_KERNEL);
 	if (!cache)
 		return ERR_PTR(-ENOMEM);
 
-	cache->refcount = 1;
+	/* One reference for the file, one for the dentry */
+	cache->refcount = 2;
 	INIT_LIST_HEAD(&cache->entries);
+	cache->root = RB_ROOT;
 
-	res = ovl_dir_read_merged(dentry, &cache->entries);
+	res = ovl_dir_read_merged(dentry, &cache->entries, &cache->root);
 	if (res) {
 		ovl_cache_free(&cache->entries);
 		kfree(cache);
@@ -473,7 +581,7 @@ static int ovl_dir_release(struct inode *inode, struct file *file)
 
 	if (od->cache) {
 		inode_lock(inode);
-		ovl_cache_put(od, file->f_path.dentry);
+		ovl_cache_put(od->cache);
 		inode_unlock(inode);
 	}
 	fput(od->realfile);
@@ -522,8 +630,9 @@ int ovl_check_empty_dir(struct dentry *dentry, struct list_head *list)
 {
 	int err;
 	struct ovl_cache_entry *p;
+	struct rb_root root = RB_ROOT;
 
-	err = ovl_dir_read_merged(dentry, list);
+	err = ovl_dir_read_merged(dentry, list, &root);
 	if (err)
 		return err;
 
@@ -618,7 +727,6 @@ static void ovl_workdir_cleanup_recurse(struct path *path, int level)
 		.dentry = NULL,
 		.list = &list,
 		.root = RB_ROOT,
-		.is_lowest = false,
 	};
 
 	err = ovl_dir_read(path, &rdd);
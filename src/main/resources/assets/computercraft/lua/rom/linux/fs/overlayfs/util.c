@@ -192,6 +192,40 @@ void ovl_clear_redirect_dir(struct super_block *sb)
 	ofs->config.redirect_dir = false;
 }
 
+bool ovl_metacopy(struct super_block *sb)
+{
+	struct ovl_fs *ofs = sb->s_fs_info;
+
+	return ofs->config.metacopy;
+}
+
+void ovl_clear_metacopy(struct super_block *sb)
+{
+	struct ovl_fs *ofs = sb->s_fs_info;
+
+	ofs->config.metacopy = false;
+}
+
+/*
+ * Is the data of this dentry still in the lower layer?  Only meaningful
+ * after the upper dentry was found to be set.
+ */
+bool ovl_dentry_is_metacopy(struct dentry *dentry)
+{
+	struct ovl_entry *oe = dentry->d_fsdata;
+
+	/* Pairs with smp_wmb() in ovl_dentry_update() */
+	smp_rmb();
+	return READ_ONCE(oe->metacopy);
+}
+
+void ovl_dentry_set_metacopy(struct dentry *dentry, bool metacopy)
+{
+	struct ovl_entry *oe = dentry->d_fsdata;
+
+	WRITE_ONCE(oe->metacopy, metacopy);
+}
+
 const char *ovl_dentry_get_redirect(struct dentry *dentry)
 {
 	struct ovl_entry *oe = dentry->d_fsdata;
@@ -284,6 +318,29 @@ int ovl_copy_up_start(struct dentry *dentry)
 	return err;
 }
 
+/*
+ * Like ovl_copy_up_start(), but for copying up the data of an upper dentry
+ * that was copied up metadata only.
+ */
+int ovl_copy_up_data_start(struct dentry *dentry)
+{
+	struct ovl_fs *ofs = dentry->d_sb->s_fs_info;
+	struct ovl_entry *oe = dentry->d_fsdata;
+	int err;
+
+	spin_lock(&ofs->copyup_wq.lock);
+	err = wait_event_interruptible_locked(ofs->copyup_wq, !oe->copying);
+	if (!err) {
+		if (!oe->metacopy)
+			err = 1; /* Data already copied up */
+		else
+			oe->copying = true;
+	}
+	spin_unlock(&ofs->copyup_wq.lock);
+
+	return err;
+}
+
 void ovl_copy_up_end(struct dentry *dentry)
 {
 	struct ovl_fs *ofs = dentry->d_sb->s_fs_info;
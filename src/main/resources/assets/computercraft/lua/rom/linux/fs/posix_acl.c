@@ -856,6 +856,8 @@ posix_acl_xattr_get(const struct xattr_handler *handler,
 int
 set_posix_acl(struct inode *inode, int type, struct posix_acl *acl)
 {
+	int ret;
+
 	if (!IS_POSIXACL(inode))
 		return -EOPNOTSUPP;
 	if (!inode->i_op->set_acl)
@@ -867,11 +869,14 @@ set_posix_acl(struct inode *inode, int type, struct posix_acl *acl)
 		return -EPERM;
 
 	if (acl) {
-		int ret = posix_acl_valid(inode->i_sb->s_user_ns, acl);
+		ret = posix_acl_valid(inode->i_sb->s_user_ns, acl);
 		if (ret)
 			return ret;
 	}
-	return inode->i_op->set_acl(inode, acl, type);
+	ret = inode->i_op->set_acl(inode, acl, type);
+	if (!ret && S_ISDIR(inode->i_mode))
+		path_cache_invalidate_sb(inode->i_sb);
+	return ret;
 }
 EXPORT_SYMBOL(set_posix_acl);
 
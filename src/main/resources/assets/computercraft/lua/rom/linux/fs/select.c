@@ -87,8 +87,8 @@ u64 select_estimate_accuracy(struct timespec64 *tv)
 	now = timespec64_sub(*tv, now);
 	ret = __estimate_accuracy(&now);
 	if (ret < current->timer_slack_ns)
-		return current->timer_slack_ns;
-	return ret;
+		ret = current->timer_slack_ns;
+	return max(ret, hrtimer_coalesce_slack());
 }
 
 
@@ -180,9 +180,9 @@ static struct poll_table_entry *poll_get_entry(struct poll_wqueues *p)
 	return table->entry++;
 }
 
-static int __pollwake(wait_queue_t *wait, unsigned mode, int sync, void *key)
+static int pollwake_task(struct poll_wqueues *pwq, unsigned mode, int sync,
+			 void *key)
 {
-	struct poll_wqueues *pwq = wait->private;
 	DECLARE_WAITQUEUE(dummy_wait, pwq->polling_task);
 
 	/*
@@ -206,6 +206,11 @@ static int __pollwake(wait_queue_t *wait, unsigned mode, int sync, void *key)
 	return default_wake_function(&dummy_wait, mode, sync, key);
 }
 
+static int __pollwake(wait_queue_t *wait, unsigned mode, int sync, void *key)
+{
+	return pollwake_task(wait->private, mode, sync, key);
+}
+
 static int pollwake(wait_queue_t *wait, unsigned mode, int sync, void *key)
 {
 	struct poll_table_entry *entry;
@@ -839,8 +844,351 @@ static inline unsigned int do_pollfd(struct pollfd *pollfd, poll_table *pwait,
 	return mask;
 }
 
+/*
+ * Persistent interest sets, see PR_SET_POLL_CACHE.
+ *
+ * A task that keeps calling poll() with the same fds leaves its wait
+ * queue entries registered between calls, the way epoll does. A wakeup
+ * marks its entry, and a call only goes into ->poll() for the entries
+ * that were marked or had events last time: nothing else can have become
+ * ready. The cache is dropped when the fd set changes, when an fd of the
+ * task gets closed or replaced (files->close_seq), at execve and at exit.
+ *
+ * Like epoll, the cache holds no reference on the files it waits on, so
+ * that it never keeps a closed file open between calls. Each entry is
+ * linked on file->f_poll_cache_links and unhooked by __fput(), see
+ * poll_cache_release_file(). pc->mtx is held across each pass of
+ * do_poll() over the entries, which keeps entry->file alive while it is
+ * polled. poll_cache_mutex serialises __fput() with the owner freeing
+ * the cache, and nests outside pc->mtx.
+ */
+#define POLL_CACHE_WAITS	2	/* wait queues kept per fd */
+#define POLL_CACHE_MIN_FDS	16	/* smaller sets aren't worth it */
+
+enum {
+	PCE_NEW,	/* not polled since the cache was built */
+	PCE_CACHED,	/* wait queue entries stay registered */
+	PCE_CLASSIC,	/* polled through the poll_wqueues of each call */
+};
+
+struct poll_cache_wait {
+	wait_queue_t wait;
+	wait_queue_head_t *whead;
+};
+
+struct poll_cache_entry {
+	struct poll_cache *pc;
+	struct file *file;		/* under pc->mtx */
+	struct list_head flink;		/* on file->f_poll_cache_links */
+	int fd;
+	short events;
+	u8 state;
+	u8 nwait;
+	int woken;
+	unsigned int mask;
+	struct poll_cache_wait waits[POLL_CACHE_WAITS];
+};
+
+struct poll_cache {
+	struct mutex mtx;
+	spinlock_t lock;
+	struct poll_wqueues *pwq;	/* call in progress, under @lock */
+	struct files_struct *files;
+	unsigned int close_seq;
+	unsigned int nfds;
+	struct poll_cache_entry entries[0];
+};
+
+struct poll_cache_table {
+	poll_table pt;
+	struct poll_cache_entry *entry;
+	poll_table *fallback;
+};
+
+static int poll_cache_wake(wait_queue_t *wait, unsigned mode, int sync,
+			   void *key)
+{
+	struct poll_cache_entry *entry = wait->private;
+	struct poll_cache *pc = entry->pc;
+	unsigned long flags;
+	int ret = 0;
+
+	if (key && !((unsigned long)key & (entry->events | POLLERR | POLLHUP)))
+		return 0;
+
+	WRITE_ONCE(entry->woken, 1);
+	spin_lock_irqsave(&pc->lock, flags);
+	if (pc->pwq)
+		ret = pollwake_task(pc->pwq, mode, sync, key);
+	spin_unlock_irqrestore(&pc->lock, flags);
+
+	/* The wait queue is going away, see ep_poll_callback() */
+	if ((unsigned long)key & POLLFREE) {
+		list_del_init(&wait->task_list);
+		smp_store_release(&container_of(wait, struct poll_cache_wait,
+						wait)->whead, NULL);
+	}
+	return ret;
+}
+
+static void poll_cache_queue_proc(struct file *filp,
+				  wait_queue_head_t *wait_address,
+				  poll_table *p)
+{
+	struct poll_cache_table *t = container_of(p, struct poll_cache_table,
+						  pt);
+	struct poll_cache_entry *entry = t->entry;
+	struct poll_cache_wait *pw;
+
+	if (entry->nwait == POLL_CACHE_WAITS) {
+		/* too many queues to keep, poll this fd the classic way */
+		entry->state = PCE_CLASSIC;
+		if (t->fallback->_qproc)
+			t->fallback->_qproc(filp, wait_address, t->fallback);
+		return;
+	}
+
+	pw = &entry->waits[entry->nwait++];
+	init_waitqueue_func_entry(&pw->wait, poll_cache_wake);
+	pw->wait.private = entry;
+	pw->whead = wait_address;
+	add_wait_queue(wait_address, &pw->wait);
+}
+
+/* Poll a fresh entry once, registering its wait queues for good */
+static unsigned int poll_cache_first(struct poll_cache_entry *entry,
+				     struct pollfd *pollfd, poll_table *pwait)
+{
+	struct poll_cache_table t;
+	bool can_busy_poll;
+	unsigned int mask;
+	struct fd f;
+
+	entry->state = PCE_CLASSIC;
+	if (pollfd->fd < 0)
+		goto classic;
+	f = fdget(pollfd->fd);
+	if (!f.file)
+		goto classic;
+	if (!f.file->f_op->poll) {
+		fdput(f);
+		goto classic;
+	}
+
+	entry->state = PCE_CACHED;
+	init_poll_funcptr(&t.pt, poll_cache_queue_proc);
+	t.pt._key = pollfd->events | POLLERR | POLLHUP;
+	t.entry = entry;
+	t.fallback = pwait;
+	pwait->_key = t.pt._key;
+	mask = f.file->f_op->poll(f.file, &t.pt);
+	mask &= pollfd->events | POLLERR | POLLHUP;
+
+	/* registered wait entries must not outlive the file */
+	if (entry->nwait) {
+		entry->file = f.file;
+		spin_lock(&f.file->f_lock);
+		list_add(&entry->flink, &f.file->f_poll_cache_links);
+		spin_unlock(&f.file->f_lock);
+	} else {
+		entry->state = PCE_CLASSIC;
+	}
+	fdput(f);
+
+	entry->mask = mask;
+	pollfd->revents = mask;
+	return mask;
+
+classic:
+	return do_pollfd(pollfd, pwait, &can_busy_poll, 0);
+}
+
+static unsigned int poll_cache_pollfd(struct poll_cache_entry *entry,
+				      struct pollfd *pollfd, poll_table *pwait)
+{
+	bool can_busy_poll;
+	unsigned int mask;
+	int i;
+
+	if (entry->state == PCE_NEW)
+		return poll_cache_first(entry, pollfd, pwait);
+
+	/*
+	 * Without a wakeup the fd can't have become ready. Clear the mark
+	 * before calling ->poll(), so a wakeup racing with it is seen on
+	 * the next pass.
+	 */
+	if (!xchg(&entry->woken, 0) && !entry->mask) {
+		pollfd->revents = 0;
+		return 0;
+	}
+
+	/*
+	 * A wait queue freed under us (POLLFREE) can't wake us any more.
+	 * Those only belong to the task itself (signalfd), which is on
+	 * its way to exec or exit.
+	 */
+	for (i = 0; i < entry->nwait; i++) {
+		if (!smp_load_acquire(&entry->waits[i].whead)) {
+			entry->state = PCE_CLASSIC;
+			return do_pollfd(pollfd, pwait, &can_busy_poll, 0);
+		}
+	}
+
+	mask = entry->file->f_op->poll(entry->file, NULL);
+	mask &= pollfd->events | POLLERR | POLLHUP;
+	entry->mask = mask;
+	pollfd->revents = mask;
+	return mask;
+}
+
+static DEFINE_MUTEX(poll_cache_mutex);
+
+/* Unregister the wait queues of @entry and unlink it from its file */
+static void poll_cache_detach(struct poll_cache_entry *entry)
+{
+	struct file *file = entry->file;
+	int j;
+
+	for (j = 0; j < entry->nwait; j++) {
+		struct poll_cache_wait *pw = &entry->waits[j];
+		wait_queue_head_t *whead;
+
+		rcu_read_lock();
+		whead = smp_load_acquire(&pw->whead);
+		if (whead)
+			remove_wait_queue(whead, &pw->wait);
+		rcu_read_unlock();
+	}
+	entry->nwait = 0;
+
+	spin_lock(&file->f_lock);
+	list_del(&entry->flink);
+	spin_unlock(&file->f_lock);
+	entry->file = NULL;
+}
+
+/*
+ * @file is on its way out of __fput(): drop its entries from the caches
+ * waiting on it.  A cache in the middle of a pass is waited for, and the
+ * next pass polls the fd the classic way.
+ */
+void poll_cache_release_file(struct file *file)
+{
+	struct poll_cache_entry *entry, *next;
+
+	mutex_lock(&poll_cache_mutex);
+	list_for_each_entry_safe(entry, next, &file->f_poll_cache_links,
+				 flink) {
+		struct poll_cache *pc = entry->pc;
+
+		mutex_lock(&pc->mtx);
+		poll_cache_detach(entry);
+		entry->state = PCE_CLASSIC;
+		mutex_unlock(&pc->mtx);
+	}
+	mutex_unlock(&poll_cache_mutex);
+}
+
+static void poll_cache_free(struct poll_cache *pc)
+{
+	unsigned int i;
+
+	mutex_lock(&poll_cache_mutex);
+	for (i = 0; i < pc->nfds; i++) {
+		struct poll_cache_entry *entry = &pc->entries[i];
+
+		if (entry->file)
+			poll_cache_detach(entry);
+	}
+	mutex_unlock(&poll_cache_mutex);
+	kvfree(pc);
+}
+
+void exit_poll_cache(struct task_struct *tsk)
+{
+	struct poll_cache *pc = tsk->poll_cache;
+
+	if (pc) {
+		tsk->poll_cache = NULL;
+		poll_cache_free(pc);
+	}
+}
+
+static bool poll_cache_match(struct poll_cache *pc, struct poll_list *list,
+			     unsigned int nfds)
+{
+	struct files_struct *files = current->files;
+	struct poll_cache_entry *entry = pc->entries;
+	struct poll_list *walk;
+	int j;
+
+	if (pc->nfds != nfds || pc->files != files ||
+	    pc->close_seq != READ_ONCE(files->close_seq))
+		return false;
+
+	for (walk = list; walk != NULL; walk = walk->next) {
+		for (j = 0; j < walk->len; j++, entry++) {
+			if (entry->fd != walk->entries[j].fd ||
+			    entry->events != walk->entries[j].events)
+				return false;
+		}
+	}
+	return true;
+}
+
+/* Find the cache for this fd set, starting a new one if it changed */
+static struct poll_cache *poll_cache_get(struct poll_list *list,
+					 unsigned int nfds)
+{
+	struct poll_cache *pc = current->poll_cache;
+	struct poll_cache_entry *entry;
+	struct poll_list *walk;
+	size_t size;
+	int j;
+
+	if (pc && poll_cache_match(pc, list, nfds))
+		return pc;
+
+	exit_poll_cache(current);
+	if (nfds < POLL_CACHE_MIN_FDS)
+		return NULL;
+
+	size = sizeof(*pc) + nfds * sizeof(struct poll_cache_entry);
+	pc = kzalloc(size, GFP_KERNEL | __GFP_NOWARN);
+	if (!pc)
+		pc = vzalloc(size);
+	if (!pc)
+		return NULL;
+
+	mutex_init(&pc->mtx);
+	spin_lock_init(&pc->lock);
+	pc->files = current->files;
+	pc->close_seq = READ_ONCE(pc->files->close_seq);
+	pc->nfds = nfds;
+	entry = pc->entries;
+	for (walk = list; walk != NULL; walk = walk->next) {
+		for (j = 0; j < walk->len; j++, entry++) {
+			entry->pc = pc;
+			entry->fd = walk->entries[j].fd;
+			entry->events = walk->entries[j].events;
+		}
+	}
+	current->poll_cache = pc;
+	return pc;
+}
+
+static void poll_cache_attach(struct poll_cache *pc, struct poll_wqueues *pwq)
+{
+	if (pc) {
+		spin_lock_irq(&pc->lock);
+		pc->pwq = pwq;
+		spin_unlock_irq(&pc->lock);
+	}
+}
+
 static int do_poll(struct poll_list *list, struct poll_wqueues *wait,
-		   struct timespec64 *end_time)
+		   struct timespec64 *end_time, struct poll_cache *pc)
 {
 	poll_table* pt = &wait->pt;
 	ktime_t expire, *to = NULL;
@@ -859,15 +1207,29 @@ static int do_poll(struct poll_list *list, struct poll_wqueues *wait,
 		slack = select_estimate_accuracy(end_time);
 
 	for (;;) {
+		struct poll_cache_entry *entry = pc ? pc->entries : NULL;
 		struct poll_list *walk;
 		bool can_busy_loop = false;
 
+		if (pc)
+			mutex_lock(&pc->mtx);
 		for (walk = list; walk != NULL; walk = walk->next) {
 			struct pollfd * pfd, * pfd_end;
 
 			pfd = walk->entries;
 			pfd_end = pfd + walk->len;
 			for (; pfd != pfd_end; pfd++) {
+				unsigned int mask;
+
+				if (entry && entry->state != PCE_CLASSIC)
+					mask = poll_cache_pollfd(entry, pfd,
+								 pt);
+				else
+					mask = do_pollfd(pfd, pt,
+							 &can_busy_loop,
+							 busy_flag);
+				if (entry)
+					entry++;
 				/*
 				 * Fish for events. If we found one, record it
 				 * and kill poll_table->_qproc, so we don't
@@ -875,8 +1237,7 @@ static int do_poll(struct poll_list *list, struct poll_wqueues *wait,
 				 * this. They'll get immediately deregistered
 				 * when we break out and return.
 				 */
-				if (do_pollfd(pfd, pt, &can_busy_loop,
-					      busy_flag)) {
+				if (mask) {
 					count++;
 					pt->_qproc = NULL;
 					/* found something, stop busy polling */
@@ -885,6 +1246,8 @@ static int do_poll(struct poll_list *list, struct poll_wqueues *wait,
 				}
 			}
 		}
+		if (pc)
+			mutex_unlock(&pc->mtx);
 		/*
 		 * All waiters have already been registered, so don't provide
 		 * a poll_table->_qproc to them on the next loop iteration.
@@ -932,6 +1295,7 @@ static int do_sys_poll(struct pollfd __user *ufds, unsigned int nfds,
 		struct timespec64 *end_time)
 {
 	struct poll_wqueues table;
+	struct poll_cache *pc = NULL;
  	int err = -EFAULT, fdcount, len, size;
 	/* Allocate small arguments on the stack to save memory and be
 	   faster - use long to make sure the buffer is aligned properly
@@ -968,8 +1332,13 @@ static int do_sys_poll(struct pollfd __user *ufds, unsigned int nfds,
 		}
 	}
 
+	if (task_poll_cache(current))
+		pc = poll_cache_get(head, nfds);
+
 	poll_initwait(&table);
-	fdcount = do_poll(head, &table, end_time);
+	poll_cache_attach(pc, &table);
+	fdcount = do_poll(head, &table, end_time, pc);
+	poll_cache_attach(pc, NULL);
 	poll_freewait(&table);
 
 	for (walk = head; walk; walk = walk->next) {
@@ -201,7 +201,8 @@ static int timerfd_setup(struct timerfd_ctx *ctx, int flags,
 			else
 				alarm_start_relative(&ctx->t.alarm, texp);
 		} else {
-			hrtimer_start(&ctx->t.tmr, texp, htmode);
+			hrtimer_start_range_ns(&ctx->t.tmr, texp,
+					       hrtimer_coalesce_slack(), htmode);
 		}
 
 		if (timerfd_canceled(ctx))
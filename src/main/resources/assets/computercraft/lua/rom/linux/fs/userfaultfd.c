@@ -310,6 +310,8 @@ static inline bool userfaultfd_must_wait(struct userfaultfd_ctx *ctx,
 	 */
 	if (pte_none(*pte))
 		ret = true;
+	if (pte_uffd_wp(*pte) && (reason & VM_UFFD_WP))
+		ret = true;
 	pte_unmap(pte);
 
 out:
@@ -822,8 +824,10 @@ static int userfaultfd_release(struct inode *inode, struct file *file)
 			vma = prev;
 		else
 			prev = vma;
+		vm_write_begin(vma);
 		vma->vm_flags = new_flags;
 		vma->vm_userfaultfd_ctx = NULL_VM_UFFD_CTX;
+		vm_write_end(vma);
 	}
 	up_write(&mm->mmap_sem);
 	mmput(mm);
@@ -1167,8 +1171,12 @@ static __always_inline int validate_range(struct mm_struct *mm,
 	return 0;
 }
 
-static inline bool vma_can_userfault(struct vm_area_struct *vma)
+static inline bool vma_can_userfault(struct vm_area_struct *vma,
+				     unsigned long vm_flags)
 {
+	/* Write protect tracking is only implemented for anonymous memory */
+	if (vm_flags & VM_UFFD_WP)
+		return vma_is_anonymous(vma);
 	return vma_is_anonymous(vma) || is_vm_hugetlb_page(vma) ||
 		vma_is_shmem(vma);
 }
@@ -1203,13 +1211,9 @@ static int userfaultfd_register(struct userfaultfd_ctx *ctx,
 	if (uffdio_register.mode & UFFDIO_REGISTER_MODE_MISSING)
 		vm_flags |= VM_UFFD_MISSING;
 	if (uffdio_register.mode & UFFDIO_REGISTER_MODE_WP) {
+		if (!IS_ENABLED(CONFIG_HAVE_ARCH_USERFAULTFD_WP))
+			goto out;
 		vm_flags |= VM_UFFD_WP;
-		/*
-		 * FIXME: remove the below error constraint by
-		 * implementing the wprotect tracking mode.
-		 */
-		ret = -EINVAL;
-		goto out;
 	}
 
 	ret = validate_range(mm, uffdio_register.range.start,
@@ -1258,7 +1262,7 @@ static int userfaultfd_register(struct userfaultfd_ctx *ctx,
 
 		/* check not compatible vmas */
 		ret = -EINVAL;
-		if (!vma_can_userfault(cur))
+		if (!vma_can_userfault(cur, vm_flags))
 			goto out_unlock;
 		/*
 		 * If this vma contains ending address, and huge pages
@@ -1302,7 +1306,7 @@ static int userfaultfd_register(struct userfaultfd_ctx *ctx,
 	do {
 		cond_resched();
 
-		BUG_ON(!vma_can_userfault(vma));
+		BUG_ON(!vma_can_userfault(vma, vm_flags));
 		BUG_ON(vma->vm_userfaultfd_ctx.ctx &&
 		       vma->vm_userfaultfd_ctx.ctx != ctx);
 
@@ -1343,8 +1347,10 @@ static int userfaultfd_register(struct userfaultfd_ctx *ctx,
 		 * the next vma was merged into the current one and
 		 * the current one has not been updated yet.
 		 */
+		vm_write_begin(vma);
 		vma->vm_flags = new_flags;
 		vma->vm_userfaultfd_ctx.ctx = ctx;
+		vm_write_end(vma);
 
 	skip:
 		prev = vma;
@@ -1360,9 +1366,14 @@ out_unlock:
 		 * userland which ioctls methods are guaranteed to
 		 * succeed on this range.
 		 */
-		if (put_user(non_anon_pages ? UFFD_API_RANGE_IOCTLS_BASIC :
-			     UFFD_API_RANGE_IOCTLS,
-			     &user_uffdio_register->ioctls))
+		__u64 ioctls_out;
+
+		ioctls_out = non_anon_pages ? UFFD_API_RANGE_IOCTLS_BASIC :
+			UFFD_API_RANGE_IOCTLS;
+		/* UFFDIO_WRITEPROTECT needs the range registered in WP mode */
+		if (!(uffdio_register.mode & UFFDIO_REGISTER_MODE_WP))
+			ioctls_out &= ~((__u64)1 << _UFFDIO_WRITEPROTECT);
+		if (put_user(ioctls_out, &user_uffdio_register->ioctls))
 			ret = -EFAULT;
 	}
 out:
@@ -1436,7 +1447,7 @@ static int userfaultfd_unregister(struct userfaultfd_ctx *ctx,
 		 * provides for more strict behavior to notice
 		 * unregistration errors.
 		 */
-		if (!vma_can_userfault(cur))
+		if (!vma_can_userfault(cur, cur->vm_flags))
 			goto out_unlock;
 
 		found = true;
@@ -1450,7 +1461,7 @@ static int userfaultfd_unregister(struct userfaultfd_ctx *ctx,
 	do {
 		cond_resched();
 
-		BUG_ON(!vma_can_userfault(vma));
+		BUG_ON(!vma_can_userfault(vma, vma->vm_flags));
 
 		/*
 		 * Nothing to do: this vma is already registered into this
@@ -1463,7 +1474,12 @@ static int userfaultfd_unregister(struct userfaultfd_ctx *ctx,
 			start = vma->vm_start;
 		vma_end = min(end, vma->vm_end);
 
-		if (userfaultfd_missing(vma)) {
+		/* Drop the uffd-wp markers, nobody is left to resolve them */
+		if (userfaultfd_wp(vma))
+			change_protection(vma, start, vma_end, vma->vm_page_prot,
+					  MM_CP_UFFD_WP_RESOLVE);
+
+		if (userfaultfd_missing(vma) || userfaultfd_wp(vma)) {
 			/*
 			 * Wake any concurrent pending userfault while
 			 * we unregister, so they will not hang
@@ -1501,8 +1517,10 @@ static int userfaultfd_unregister(struct userfaultfd_ctx *ctx,
 		 * the next vma was merged into the current one and
 		 * the current one has not been updated yet.
 		 */
+		vm_write_begin(vma);
 		vma->vm_flags = new_flags;
 		vma->vm_userfaultfd_ctx = NULL_VM_UFFD_CTX;
+		vm_write_end(vma);
 
 	skip:
 		prev = vma;
@@ -1579,11 +1597,12 @@ static int userfaultfd_copy(struct userfaultfd_ctx *ctx,
 	ret = -EINVAL;
 	if (uffdio_copy.src + uffdio_copy.len <= uffdio_copy.src)
 		goto out;
-	if (uffdio_copy.mode & ~UFFDIO_COPY_MODE_DONTWAKE)
+	if (uffdio_copy.mode & ~(UFFDIO_COPY_MODE_DONTWAKE|UFFDIO_COPY_MODE_WP))
 		goto out;
 	if (mmget_not_zero(ctx->mm)) {
 		ret = mcopy_atomic(ctx->mm, uffdio_copy.dst, uffdio_copy.src,
-				   uffdio_copy.len);
+				   uffdio_copy.len,
+				   uffdio_copy.mode & UFFDIO_COPY_MODE_WP);
 		mmput(ctx->mm);
 	} else {
 		return -ENOSPC;
@@ -1649,6 +1668,145 @@ out:
 	return ret;
 }
 
+/*
+ * Resolve a vector of ranges with a single ioctl.  Wakeups are
+ * deferred and merged while the destination ranges are contiguous,
+ * so a batch covering one region wakes the waiters only once.
+ */
+static int userfaultfd_copy_vec(struct userfaultfd_ctx *ctx,
+				unsigned long arg)
+{
+	__s64 ret;
+	struct uffdio_copy_vec uffdio_copy_vec;
+	struct uffdio_copy_vec __user *user_uffdio_copy_vec;
+	struct uffdio_copy_range __user *user_vec;
+	struct uffdio_copy_range cr;
+	struct userfaultfd_wake_range range;
+	__s64 copied;
+	__u64 i;
+	bool wake;
+
+	user_uffdio_copy_vec = (struct uffdio_copy_vec __user *) arg;
+
+	ret = -EFAULT;
+	if (copy_from_user(&uffdio_copy_vec, user_uffdio_copy_vec,
+			   /* don't copy "copied" last field */
+			   sizeof(uffdio_copy_vec)-sizeof(__s64)))
+		goto out;
+
+	ret = -EINVAL;
+	if (uffdio_copy_vec.mode & ~(UFFDIO_COPY_MODE_DONTWAKE|
+				     UFFDIO_COPY_MODE_WP))
+		goto out;
+	if (!uffdio_copy_vec.nr)
+		goto out;
+
+	if (!mmget_not_zero(ctx->mm))
+		return -ENOSPC;
+
+	user_vec = u64_to_user_ptr(uffdio_copy_vec.vec);
+	wake = !(uffdio_copy_vec.mode & UFFDIO_COPY_MODE_DONTWAKE);
+	range.start = range.len = 0;
+	copied = 0;
+	for (i = 0; i < uffdio_copy_vec.nr; i++) {
+		ret = -EFAULT;
+		if (copy_from_user(&cr, &user_vec[i], sizeof(cr)))
+			break;
+		ret = validate_range(ctx->mm, cr.dst, cr.len);
+		if (ret)
+			break;
+		ret = -EINVAL;
+		if (cr.src + cr.len <= cr.src)
+			break;
+
+		ret = mcopy_atomic(ctx->mm, cr.dst, cr.src, cr.len,
+				   uffdio_copy_vec.mode & UFFDIO_COPY_MODE_WP);
+		if (ret < 0)
+			break;
+		BUG_ON(!ret);
+		copied += ret;
+
+		if (wake) {
+			if (range.len && range.start + range.len != cr.dst) {
+				wake_userfault(ctx, &range);
+				range.len = 0;
+			}
+			if (!range.len)
+				range.start = cr.dst;
+			range.len += ret;
+		}
+
+		if (ret != cr.len) {
+			ret = -EAGAIN;
+			break;
+		}
+		ret = 0;
+
+		if (fatal_signal_pending(current)) {
+			ret = -EINTR;
+			break;
+		}
+		cond_resched();
+	}
+	mmput(ctx->mm);
+
+	/* len == 0 would wake all */
+	if (range.len)
+		wake_userfault(ctx, &range);
+
+	if (unlikely(put_user(copied ? copied : ret,
+			      &user_uffdio_copy_vec->copied)))
+		return -EFAULT;
+out:
+	return ret;
+}
+
+static int userfaultfd_writeprotect(struct userfaultfd_ctx *ctx,
+				    unsigned long arg)
+{
+	int ret;
+	struct uffdio_writeprotect uffdio_wp;
+	struct uffdio_writeprotect __user *user_uffdio_wp;
+	struct userfaultfd_wake_range range;
+	bool mode_wp, mode_dontwake;
+
+	user_uffdio_wp = (struct uffdio_writeprotect __user *) arg;
+
+	if (copy_from_user(&uffdio_wp, user_uffdio_wp,
+			   sizeof(struct uffdio_writeprotect)))
+		return -EFAULT;
+
+	ret = validate_range(ctx->mm, uffdio_wp.range.start,
+			     uffdio_wp.range.len);
+	if (ret)
+		return ret;
+
+	if (uffdio_wp.mode & ~(UFFDIO_WRITEPROTECT_MODE_DONTWAKE |
+			       UFFDIO_WRITEPROTECT_MODE_WP))
+		return -EINVAL;
+
+	mode_wp = uffdio_wp.mode & UFFDIO_WRITEPROTECT_MODE_WP;
+	mode_dontwake = uffdio_wp.mode & UFFDIO_WRITEPROTECT_MODE_DONTWAKE;
+
+	if (mode_wp && mode_dontwake)
+		return -EINVAL;
+
+	if (!mmget_not_zero(ctx->mm))
+		return -ENOSPC;
+	ret = mwriteprotect_range(ctx->mm, uffdio_wp.range.start,
+				  uffdio_wp.range.len, mode_wp);
+	mmput(ctx->mm);
+	if (ret)
+		return ret;
+
+	if (!mode_wp && !mode_dontwake) {
+		range.start = uffdio_wp.range.start;
+		range.len = uffdio_wp.range.len;
+		wake_userfault(ctx, &range);
+	}
+	return ret;
+}
+
 static inline unsigned int uffd_ctx_features(__u64 user_features)
 {
 	/*
@@ -1657,6 +1815,15 @@ static inline unsigned int uffd_ctx_features(__u64 user_features)
 	return (unsigned int)user_features;
 }
 
+static inline __u64 uffd_api_features(void)
+{
+	__u64 features = UFFD_API_FEATURES;
+
+	if (!IS_ENABLED(CONFIG_HAVE_ARCH_USERFAULTFD_WP))
+		features &= ~(__u64)UFFD_FEATURE_PAGEFAULT_FLAG_WP;
+	return features;
+}
+
 /*
  * userland asks for a certain API version and we return which bits
  * and ioctl commands are implemented in this kernel for such API
@@ -1677,7 +1844,8 @@ static int userfaultfd_api(struct userfaultfd_ctx *ctx,
 	if (copy_from_user(&uffdio_api, buf, sizeof(uffdio_api)))
 		goto out;
 	features = uffdio_api.features;
-	if (uffdio_api.api != UFFD_API || (features & ~UFFD_API_FEATURES)) {
+	if (uffdio_api.api != UFFD_API ||
+	    (features & ~uffd_api_features())) {
 		memset(&uffdio_api, 0, sizeof(uffdio_api));
 		if (copy_to_user(buf, &uffdio_api, sizeof(uffdio_api)))
 			goto out;
@@ -1685,7 +1853,7 @@ static int userfaultfd_api(struct userfaultfd_ctx *ctx,
 		goto out;
 	}
 	/* report all available features and ioctls to userland */
-	uffdio_api.features = UFFD_API_FEATURES;
+	uffdio_api.features = uffd_api_features();
 	uffdio_api.ioctls = UFFD_API_IOCTLS;
 	ret = -EFAULT;
 	if (copy_to_user(buf, &uffdio_api, sizeof(uffdio_api)))
@@ -1726,6 +1894,12 @@ static long userfaultfd_ioctl(struct file *file, unsigned cmd,
 	case UFFDIO_ZEROPAGE:
 		ret = userfaultfd_zeropage(ctx, arg);
 		break;
+	case UFFDIO_WRITEPROTECT:
+		ret = userfaultfd_writeprotect(ctx, arg);
+		break;
+	case UFFDIO_COPY_VEC:
+		ret = userfaultfd_copy_vec(ctx, arg);
+		break;
 	}
 	return ret;
 }
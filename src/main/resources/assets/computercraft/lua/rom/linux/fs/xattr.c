@@ -179,6 +179,7 @@ int __vfs_setxattr_noperm(struct dentry *dentry, const char *name,
 	if (inode->i_opflags & IOP_XATTR) {
 		error = __vfs_setxattr(dentry, inode, name, value, size, flags);
 		if (!error) {
+			path_cache_invalidate(dentry);
 			fsnotify_xattr(dentry);
 			security_inode_post_setxattr(dentry, name, value,
 						     size, flags);
@@ -195,8 +196,10 @@ int __vfs_setxattr_noperm(struct dentry *dentry, const char *name,
 
 			error = security_inode_setsecurity(inode, suffix, value,
 							   size, flags);
-			if (!error)
+			if (!error) {
+				path_cache_invalidate(dentry);
 				fsnotify_xattr(dentry);
+			}
 		}
 	}
 
@@ -397,6 +400,7 @@ vfs_removexattr(struct dentry *dentry, const char *name)
 	error = __vfs_removexattr(dentry, name);
 
 	if (!error) {
+		path_cache_invalidate(dentry);
 		fsnotify_xattr(dentry);
 		evm_inode_post_removexattr(dentry, name);
 	}
@@ -245,6 +245,7 @@ xfs_inode_set_reclaim_tag(
 			   XFS_ICI_RECLAIM_TAG);
 	xfs_perag_set_reclaim_tag(pag);
 	__xfs_iflags_set(ip, XFS_IRECLAIMABLE);
+	ip->i_flags &= ~XFS_INACTIVATING;
 
 	spin_unlock(&ip->i_flags_lock);
 	spin_unlock(&pag->pag_ici_lock);
@@ -262,6 +263,121 @@ xfs_inode_clear_reclaim_tag(
 	xfs_perag_clear_reclaim_tag(pag);
 }
 
+/*
+ * Background inactivation of unlinked inodes.
+ *
+ * Freeing an unlinked inode truncates its data fork and removes it from the
+ * inode btrees, which can take several transactions.  Instead of making the
+ * task that dropped the last reference wait for all of that, the inode is
+ * put on a list in its AG and inactivated by a work item for that AG.  Each
+ * worker takes whatever has accumulated on its list, so unlink bursts are
+ * batched, and different AGs are processed in parallel.
+ *
+ * The inode stays on the AGI unlinked list until the worker frees it, so a
+ * crash in between is recovered just like an open unlinked file.  While an
+ * inode is queued it carries XFS_NEED_INACTIVE, which lookups treat as the
+ * inode already being gone; XFS_INACTIVATING replaces it while the worker
+ * runs and is cleared when the inode becomes reclaimable.
+ */
+
+/* Past this many queued inodes in an AG, make the queueing task wait. */
+#define XFS_INODEGC_MAX_BACKLOG	256
+
+void
+xfs_inodegc_worker(
+	struct work_struct	*work)
+{
+	struct xfs_perag	*pag = container_of(work, struct xfs_perag,
+						    pag_inodegc_work);
+	struct llist_node	*node;
+	struct xfs_inode	*ip, *n;
+
+	node = llist_reverse_order(llist_del_all(&pag->pag_inodegc_list));
+	llist_for_each_entry_safe(ip, n, node, i_gclist) {
+		spin_lock(&ip->i_flags_lock);
+		ip->i_flags &= ~XFS_NEED_INACTIVE;
+		ip->i_flags |= XFS_INACTIVATING;
+		spin_unlock(&ip->i_flags_lock);
+		atomic_dec(&pag->pag_inodegc_count);
+
+		xfs_inactive(ip);
+		ASSERT(XFS_FORCED_SHUTDOWN(ip->i_mount) ||
+		       ip->i_delayed_blks == 0);
+		xfs_inode_set_reclaim_tag(ip);
+	}
+}
+
+/*
+ * Hand an evicted inode over to background inactivation if it is unlinked.
+ * Returns false if the caller has to inactivate the inode itself.
+ */
+bool
+xfs_inodegc_queue(
+	struct xfs_inode	*ip)
+{
+	struct xfs_mount	*mp = ip->i_mount;
+	struct xfs_perag	*pag;
+	bool			throttle;
+
+	if (!READ_ONCE(mp->m_inodegc_enabled))
+		return false;
+	if (VFS_I(ip)->i_mode == 0 || VFS_I(ip)->i_nlink != 0)
+		return false;
+
+	spin_lock(&ip->i_flags_lock);
+	ip->i_flags |= XFS_NEED_INACTIVE;
+	spin_unlock(&ip->i_flags_lock);
+
+	pag = xfs_perag_get(mp, XFS_INO_TO_AGNO(mp, ip->i_ino));
+	llist_add(&ip->i_gclist, &pag->pag_inodegc_list);
+	throttle = atomic_inc_return(&pag->pag_inodegc_count) >
+			XFS_INODEGC_MAX_BACKLOG;
+	queue_work(mp->m_inodegc_workqueue, &pag->pag_inodegc_work);
+
+	/*
+	 * Don't let unlinkers run arbitrarily far ahead of the worker, the
+	 * space and inodes they free would only show up much later.
+	 */
+	if (throttle)
+		flush_work(&pag->pag_inodegc_work);
+	xfs_perag_put(pag);
+	return true;
+}
+
+/* Wait for all inodes queued for inactivation so far. */
+void
+xfs_inodegc_flush(
+	struct xfs_mount	*mp)
+{
+	struct xfs_perag	*pag;
+	xfs_agnumber_t		agno;
+
+	for (agno = 0; agno < mp->m_sb.sb_agcount; agno++) {
+		pag = xfs_perag_get(mp, agno);
+		flush_work(&pag->pag_inodegc_work);
+		xfs_perag_put(pag);
+	}
+}
+
+void
+xfs_inodegc_start(
+	struct xfs_mount	*mp)
+{
+	WRITE_ONCE(mp->m_inodegc_enabled, true);
+}
+
+/*
+ * Make eviction inactivate inodes synchronously again and drain the queues.
+ * Used before the filesystem stops accepting transactions.
+ */
+void
+xfs_inodegc_stop(
+	struct xfs_mount	*mp)
+{
+	WRITE_ONCE(mp->m_inodegc_enabled, false);
+	xfs_inodegc_flush(mp);
+}
+
 /*
  * When we recycle a reclaimable inode, we need to re-initialise the VFS inode
  * part of the structure. This is made more complex by the fact we store
@@ -331,13 +447,23 @@ xfs_iget_cache_hit(
 	 *	     wait_on_inode to wait for these flags to be cleared
 	 *	     instead of polling for it.
 	 */
-	if (ip->i_flags & (XFS_INEW|XFS_IRECLAIM)) {
+	if (ip->i_flags & (XFS_INEW|XFS_IRECLAIM|XFS_INACTIVATING)) {
 		trace_xfs_iget_skip(ip);
 		XFS_STATS_INC(mp, xs_ig_frecycle);
 		error = -EAGAIN;
 		goto out_error;
 	}
 
+	/*
+	 * An unlinked inode waiting for background inactivation is still
+	 * allocated on disk but can never be looked up again.
+	 */
+	if (ip->i_flags & XFS_NEED_INACTIVE) {
+		ASSERT(!(flags & XFS_IGET_CREATE));
+		error = -ENOENT;
+		goto out_error;
+	}
+
 	/*
 	 * If lookup is racing with unlink return an error immediately.
 	 */
@@ -68,6 +68,9 @@ typedef struct xfs_inode {
 	xfs_extnum_t		i_cnextents;	/* # of extents in cow fork */
 	unsigned int		i_cformat;	/* format of cow fork */
 
+	/* pending background inactivation, see xfs_inodegc_queue() */
+	struct llist_node	i_gclist;
+
 	/* VFS inode */
 	struct inode		i_vnode;	/* embedded VFS inode */
 } xfs_inode_t;
@@ -231,6 +234,8 @@ static inline bool xfs_is_reflink_inode(struct xfs_inode *ip)
  * log recovery to replay a bmap operation on the inode.
  */
 #define XFS_IRECOVERY		(1 << 11)
+#define XFS_NEED_INACTIVE	(1 << 12) /* queued for background inactivation */
+#define XFS_INACTIVATING	(1 << 13) /* background inactivation running */
 
 /*
  * Per-lifetime flags need to be reset when re-using a reclaimable inode during
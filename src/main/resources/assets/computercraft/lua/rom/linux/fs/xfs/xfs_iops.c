@@ -1226,7 +1226,7 @@ xfs_setup_inode(
 
 	inode_sb_list_add(inode);
 	/* make the inode look hashed for the writeback code */
-	hlist_add_fake(&inode->i_hash);
+	inode_fake_hash(inode);
 
 	inode->i_uid    = xfs_uid_to_kuid(ip->i_d.di_uid);
 	inode->i_gid    = xfs_gid_to_kgid(ip->i_d.di_gid);
@@ -1283,6 +1283,9 @@ xfs_setup_iops(
 		inode->i_op = &xfs_inode_operations;
 		inode->i_fop = &xfs_file_operations;
 		inode->i_mapping->a_ops = &xfs_address_space_operations;
+		/* read-only huge pages, see CONFIG_READ_ONLY_THP_FOR_FS */
+		if (!IS_DAX(inode))
+			mapping_set_thp_support(inode->i_mapping);
 		break;
 	case S_IFDIR:
 		if (xfs_sb_version_hasasciici(&XFS_M(inode->i_sb)->m_sb))
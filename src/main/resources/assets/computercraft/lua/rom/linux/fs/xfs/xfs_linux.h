@@ -79,6 +79,7 @@ typedef __u32			xfs_nlink_t;
 #include <linux/list_sort.h>
 #include <linux/ratelimit.h>
 #include <linux/rhashtable.h>
+#include <linux/llist.h>
 
 #include <asm/page.h>
 #include <asm/div64.h>
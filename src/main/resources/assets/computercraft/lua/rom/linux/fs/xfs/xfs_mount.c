@@ -212,6 +212,9 @@ xfs_initialize_perag(
 		spin_lock_init(&pag->pag_ici_lock);
 		mutex_init(&pag->pag_ici_reclaim_lock);
 		INIT_RADIX_TREE(&pag->pag_ici_root, GFP_ATOMIC);
+		init_llist_head(&pag->pag_inodegc_list);
+		atomic_set(&pag->pag_inodegc_count, 0);
+		INIT_WORK(&pag->pag_inodegc_work, xfs_inodegc_worker);
 		if (xfs_buf_hash_init(pag))
 			goto out_free_pag;
 		init_waitqueue_head(&pag->pagb_wait);
@@ -955,6 +958,13 @@ xfs_mountfs(
 		goto out_rtunmount;
 	}
 
+	/*
+	 * Unlinked inodes released by log recovery have been inactivated
+	 * synchronously; from now on this can be left to the per-AG workers.
+	 */
+	if (!(mp->m_flags & XFS_MOUNT_RDONLY))
+		xfs_inodegc_start(mp);
+
 	/*
 	 * Now the log is fully replayed, we can transition to full read-only
 	 * mode for read-only mounts. This will sync all the metadata and clean
@@ -1019,6 +1029,7 @@ xfs_mountfs(
  out_quota:
 	xfs_qm_unmount_quotas(mp);
  out_rtunmount:
+	xfs_inodegc_stop(mp);
 	mp->m_super->s_flags &= ~MS_ACTIVE;
 	xfs_rtunmount_inodes(mp);
  out_rele_rip:
@@ -1059,6 +1070,7 @@ xfs_unmountfs(
 	__uint64_t		resblks;
 	int			error;
 
+	xfs_inodegc_stop(mp);
 	cancel_delayed_work_sync(&mp->m_eofblocks_work);
 	cancel_delayed_work_sync(&mp->m_cowblocks_work);
 
@@ -877,8 +877,15 @@ xfs_init_mount_workqueues(
 	if (!mp->m_eofblocks_workqueue)
 		goto out_destroy_log;
 
+	mp->m_inodegc_workqueue = alloc_workqueue("xfs-inodegc/%s",
+			WQ_MEM_RECLAIM|WQ_FREEZABLE, 0, mp->m_fsname);
+	if (!mp->m_inodegc_workqueue)
+		goto out_destroy_eofb;
+
 	return 0;
 
+out_destroy_eofb:
+	destroy_workqueue(mp->m_eofblocks_workqueue);
 out_destroy_log:
 	destroy_workqueue(mp->m_log_workqueue);
 out_destroy_reclaim:
@@ -899,6 +906,7 @@ STATIC void
 xfs_destroy_mount_workqueues(
 	struct xfs_mount	*mp)
 {
+	destroy_workqueue(mp->m_inodegc_workqueue);
 	destroy_workqueue(mp->m_eofblocks_workqueue);
 	destroy_workqueue(mp->m_log_workqueue);
 	destroy_workqueue(mp->m_reclaim_workqueue);
@@ -924,6 +932,9 @@ xfs_flush_inodes(
 		sync_inodes_sb(sb);
 		up_read(&sb->s_umount);
 	}
+
+	/* Unlinked inodes still waiting to be freed hold on to their space. */
+	xfs_inodegc_flush(mp);
 }
 
 /* Catch misguided souls that try to use this interface on XFS */
@@ -960,9 +971,6 @@ xfs_fs_destroy_inode(
 					error, ip->i_ino);
 	}
 
-	xfs_inactive(ip);
-
-	ASSERT(XFS_FORCED_SHUTDOWN(ip->i_mount) || ip->i_delayed_blks == 0);
 	XFS_STATS_INC(ip->i_mount, vn_reclaim);
 
 	/*
@@ -971,6 +979,16 @@ xfs_fs_destroy_inode(
 	ASSERT_ALWAYS(!xfs_iflags_test(ip, XFS_IRECLAIMABLE));
 	ASSERT_ALWAYS(!xfs_iflags_test(ip, XFS_IRECLAIM));
 
+	/*
+	 * Freeing an unlinked inode is left to the per-AG inodegc worker,
+	 * which also sets the reclaim tag once it is done.
+	 */
+	if (xfs_inodegc_queue(ip))
+		return;
+
+	xfs_inactive(ip);
+	ASSERT(XFS_FORCED_SHUTDOWN(ip->i_mount) || ip->i_delayed_blks == 0);
+
 	/*
 	 * We always use background reclaim here because even if the
 	 * inode is clean, it still may be under IO and hence we have
@@ -1058,6 +1076,17 @@ xfs_fs_sync_fs(
 	if (!wait)
 		return 0;
 
+	/*
+	 * Finish freeing queued unlinked inodes so that their space is free
+	 * once sync returns.  When freeze calls us with page faults already
+	 * blocked, also stop deferring inactivation: once freeze_fs has run
+	 * the workers could not start transactions until the thaw.
+	 */
+	if (sb->s_writers.frozen == SB_FREEZE_PAGEFAULT)
+		xfs_inodegc_stop(mp);
+	else
+		xfs_inodegc_flush(mp);
+
 	xfs_log_force(mp, XFS_LOG_SYNC);
 	if (laptop_mode) {
 		/*
@@ -1304,6 +1333,7 @@ xfs_fs_remount(
 		}
 
 		mp->m_flags &= ~XFS_MOUNT_RDONLY;
+		xfs_inodegc_start(mp);
 
 		/*
 		 * If this is the first remount to writeable state we
@@ -1343,6 +1373,9 @@ xfs_fs_remount(
 
 	/* rw -> ro */
 	if (!(mp->m_flags & XFS_MOUNT_RDONLY) && (*flags & MS_RDONLY)) {
+		/* Free any unlinked inodes still queued for inactivation. */
+		xfs_inodegc_stop(mp);
+
 		/* Free the per-AG metadata reservation pool. */
 		error = xfs_fs_unreserve_ag_blocks(mp);
 		if (error) {
@@ -1397,6 +1430,7 @@ xfs_fs_unfreeze(
 
 	xfs_restore_resvblks(mp);
 	xfs_log_work_queue(mp);
+	xfs_inodegc_start(mp);
 	return 0;
 }
 
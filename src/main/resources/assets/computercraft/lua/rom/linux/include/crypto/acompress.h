@@ -44,6 +44,8 @@ struct acomp_req {
  *
  * @compress:		Function performs a compress operation
  * @decompress:		Function performs a de-compress operation
+ * @compress_batch:	Function compresses many requests at once, or NULL
+ * @decompress_batch:	Function de-compresses many requests at once, or NULL
  * @dst_free:		Frees destination buffer if allocated inside the
  *			algorithm
  * @reqsize:		Context size for (de)compression requests
@@ -52,6 +54,10 @@ struct acomp_req {
 struct crypto_acomp {
 	int (*compress)(struct acomp_req *req);
 	int (*decompress)(struct acomp_req *req);
+	int (*compress_batch)(struct acomp_req **reqs, unsigned int nr,
+			      struct crypto_batch *batch);
+	int (*decompress_batch)(struct acomp_req **reqs, unsigned int nr,
+				struct crypto_batch *batch);
 	void (*dst_free)(struct scatterlist *dst);
 	unsigned int reqsize;
 	struct crypto_tfm base;
@@ -62,6 +68,11 @@ struct crypto_acomp {
  *
  * @compress:	Function performs a compress operation
  * @decompress:	Function performs a de-compress operation
+ * @compress_batch: Optional. Compress an array of requests on the same tfm,
+ *		e.g. by queueing all of them to the engine before ringing the
+ *		doorbell once. See crypto_acomp_compress_batch().
+ * @decompress_batch: Optional. Counterpart of @compress_batch for
+ *		de-compression.
  * @dst_free:	Frees destination buffer if allocated inside the algorithm
  * @init:	Initialize the cryptographic transformation object.
  *		This function is used to initialize the cryptographic
@@ -81,6 +92,10 @@ struct crypto_acomp {
 struct acomp_alg {
 	int (*compress)(struct acomp_req *req);
 	int (*decompress)(struct acomp_req *req);
+	int (*compress_batch)(struct acomp_req **reqs, unsigned int nr,
+			      struct crypto_batch *batch);
+	int (*decompress_batch)(struct acomp_req **reqs, unsigned int nr,
+				struct crypto_batch *batch);
 	void (*dst_free)(struct scatterlist *dst);
 	int (*init)(struct crypto_acomp *tfm);
 	void (*exit)(struct crypto_acomp *tfm);
@@ -266,4 +281,39 @@ static inline int crypto_acomp_decompress(struct acomp_req *req)
 	return tfm->decompress(req);
 }
 
+/**
+ * crypto_acomp_compress_batch() -- Invoke compress operations on many requests
+ *
+ * All requests have to be on the same tfm. Their completion callbacks are
+ * replaced; @batch reports back once all of them finished, with the first
+ * error of any request. Algorithms without a batch operation of their own
+ * get synchronous implementations spread over several CPUs when the
+ * requests may sleep.
+ *
+ * @reqs:	requests to compress
+ * @nr:		number of requests
+ * @batch:	completion for the whole batch, @batch->complete must be set
+ *
+ * Return:	-EINPROGRESS if @batch->complete will be called later,
+ *		otherwise the result of the batch
+ */
+int crypto_acomp_compress_batch(struct acomp_req **reqs, unsigned int nr,
+				struct crypto_batch *batch);
+
+/**
+ * crypto_acomp_decompress_batch() -- Invoke de-compress operations on many
+ *				      requests
+ *
+ * See crypto_acomp_compress_batch().
+ *
+ * @reqs:	requests to de-compress
+ * @nr:		number of requests
+ * @batch:	completion for the whole batch, @batch->complete must be set
+ *
+ * Return:	-EINPROGRESS if @batch->complete will be called later,
+ *		otherwise the result of the batch
+ */
+int crypto_acomp_decompress_batch(struct acomp_req **reqs, unsigned int nr,
+				  struct crypto_batch *batch);
+
 #endif
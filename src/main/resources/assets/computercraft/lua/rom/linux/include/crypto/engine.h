@@ -93,6 +93,12 @@ int crypto_transfer_hash_request(struct crypto_engine *engine,
 				 struct ahash_request *req, bool need_pump);
 int crypto_transfer_hash_request_to_engine(struct crypto_engine *engine,
 					   struct ahash_request *req);
+int crypto_transfer_cipher_request_batch(struct crypto_engine *engine,
+					 struct ablkcipher_request **reqs,
+					 int *rets, unsigned int nr);
+int crypto_transfer_hash_request_batch(struct crypto_engine *engine,
+				       struct ahash_request **reqs,
+				       int *rets, unsigned int nr);
 void crypto_finalize_cipher_request(struct crypto_engine *engine,
 				    struct ablkcipher_request *req, int err);
 void crypto_finalize_hash_request(struct crypto_engine *engine,
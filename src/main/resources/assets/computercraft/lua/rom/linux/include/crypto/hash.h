@@ -452,6 +452,21 @@ int crypto_ahash_final(struct ahash_request *req);
  */
 int crypto_ahash_digest(struct ahash_request *req);
 
+/**
+ * crypto_ahash_digest_batch() - calculate message digests for many buffers
+ * @reqs: requests to digest, all on the same transformation object
+ * @nr: number of requests in @reqs
+ * @batch: completion for the whole batch, @batch->complete must be set
+ *
+ * The completion callback and data of each request are replaced, only
+ * @batch reports back. Its error is the first one of any request.
+ *
+ * Return: -EINPROGRESS if @batch->complete will be called later, otherwise
+ *	   0 if all digests were created or the first error
+ */
+int crypto_ahash_digest_batch(struct ahash_request **reqs, unsigned int nr,
+			      struct crypto_batch *batch);
+
 /**
  * crypto_ahash_export() - extract current message digest state
  * @req: reference to the ahash_request handle whose state is exported
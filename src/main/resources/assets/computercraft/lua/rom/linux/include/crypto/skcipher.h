@@ -57,6 +57,10 @@ struct crypto_skcipher {
 	              unsigned int keylen);
 	int (*encrypt)(struct skcipher_request *req);
 	int (*decrypt)(struct skcipher_request *req);
+	int (*encrypt_batch)(struct skcipher_request **reqs, unsigned int nr,
+			     struct crypto_batch *batch);
+	int (*decrypt_batch)(struct skcipher_request **reqs, unsigned int nr,
+			     struct crypto_batch *batch);
 
 	unsigned int ivsize;
 	unsigned int reqsize;
@@ -100,6 +104,10 @@ struct crypto_skcipher {
  *	     be called in parallel with the same transformation object.
  * @decrypt: Decrypt a single block. This is a reverse counterpart to @encrypt
  *	     and the conditions are exactly the same.
+ * @encrypt_batch: Optional. Encrypt an array of requests on the same
+ *		   transformation object in one go, e.g. without dropping the
+ *		   FPU between them. See crypto_skcipher_encrypt_batch().
+ * @decrypt_batch: Optional. Counterpart of @encrypt_batch for decryption.
  * @init: Initialize the cryptographic transformation object. This function
  *	  is used to initialize the cryptographic transformation object.
  *	  This function is called only once at the instantiation time, right
@@ -120,13 +128,18 @@ struct crypto_skcipher {
  * 	      in parallel. Should be a multiple of chunksize.
  * @base: Definition of a generic crypto algorithm.
  *
- * All fields except @ivsize are mandatory and must be filled.
+ * All fields except @ivsize and the batch operations are mandatory and must be
+ * filled.
  */
 struct skcipher_alg {
 	int (*setkey)(struct crypto_skcipher *tfm, const u8 *key,
 	              unsigned int keylen);
 	int (*encrypt)(struct skcipher_request *req);
 	int (*decrypt)(struct skcipher_request *req);
+	int (*encrypt_batch)(struct skcipher_request **reqs, unsigned int nr,
+			     struct crypto_batch *batch);
+	int (*decrypt_batch)(struct skcipher_request **reqs, unsigned int nr,
+			     struct crypto_batch *batch);
 	int (*init)(struct crypto_skcipher *tfm);
 	void (*exit)(struct crypto_skcipher *tfm);
 
@@ -463,6 +476,40 @@ static inline int crypto_skcipher_decrypt(struct skcipher_request *req)
 	return tfm->decrypt(req);
 }
 
+/**
+ * crypto_skcipher_encrypt_batch() - encrypt an array of requests
+ * @reqs: requests to encrypt, all on the same transformation object
+ * @nr: number of requests in @reqs
+ * @batch: completion for the whole batch, @batch->complete must be set
+ *
+ * The completion callback and data of each request are replaced, only
+ * @batch reports back. Its error is the first one of any request.
+ *
+ * Return: -EINPROGRESS if @batch->complete will be called later, otherwise
+ *	   0 if all requests succeeded or the first error
+ */
+int crypto_skcipher_encrypt_batch(struct skcipher_request **reqs,
+				  unsigned int nr, struct crypto_batch *batch);
+
+/**
+ * crypto_skcipher_decrypt_batch() - decrypt an array of requests
+ * @reqs: requests to decrypt, all on the same transformation object
+ * @nr: number of requests in @reqs
+ * @batch: completion for the whole batch, @batch->complete must be set
+ *
+ * Same as crypto_skcipher_encrypt_batch() for decryption.
+ */
+int crypto_skcipher_decrypt_batch(struct skcipher_request **reqs,
+				  unsigned int nr, struct crypto_batch *batch);
+
+/*
+ * Submit a batch one request at a time, for implementations of the batch
+ * operations that can't handle the batch natively.
+ */
+int crypto_skcipher_submit_batch(struct skcipher_request **reqs,
+				 unsigned int nr, struct crypto_batch *batch,
+				 bool encrypt);
+
 /**
  * DOC: Symmetric Key Cipher Request Handle
  *
@@ -46,6 +46,19 @@ struct linux_binprm {
 	unsigned interp_flags;
 	unsigned interp_data;
 	unsigned long loader, exec;
+	u64 phase_start;	/* for the exec_phase tracepoint */
+};
+
+/* Stages of an exec reported by the exec_phase tracepoint */
+enum exec_phase {
+	EXEC_PHASE_OPEN,	/* looking up and opening the binary */
+	EXEC_PHASE_ARGS,	/* new mm, argument and environment copy */
+	EXEC_PHASE_HEADERS,	/* program headers, interpreter lookup */
+	EXEC_PHASE_FLUSH,	/* tearing down the old mm */
+	EXEC_PHASE_SETUP,	/* new credentials, personality, stack */
+	EXEC_PHASE_MAP,		/* mapping the segments and the bss */
+	EXEC_PHASE_INTERP,	/* mapping the interpreter */
+	EXEC_PHASE_LOAD,	/* rest of the binary handler */
 };
 
 #define BINPRM_FLAGS_ENFORCE_NONDUMP_BIT 0
@@ -104,6 +117,7 @@ extern int search_binary_handler(struct linux_binprm *);
 extern int flush_old_exec(struct linux_binprm * bprm);
 extern void setup_new_exec(struct linux_binprm * bprm);
 extern void would_dump(struct linux_binprm *, struct file *);
+extern void exec_phase_end(struct linux_binprm *bprm, enum exec_phase phase);
 
 extern int suid_dumpable;
 
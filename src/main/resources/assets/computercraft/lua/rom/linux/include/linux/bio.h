@@ -380,6 +380,7 @@ static inline struct bio *bio_next_split(struct bio *bio, int sectors,
 
 extern struct bio_set *bioset_create(unsigned int, unsigned int);
 extern struct bio_set *bioset_create_nobvec(unsigned int, unsigned int);
+extern int bioset_enable_percpu_cache(struct bio_set *);
 extern void bioset_free(struct bio_set *);
 extern mempool_t *biovec_create_pool(int pool_entries);
 
@@ -682,6 +683,18 @@ static inline void bio_inc_remaining(struct bio *bio)
  */
 #define BIO_POOL_SIZE 2
 
+/*
+ * Freed bios of a bio_set with bioset_enable_percpu_cache().  Bios freed
+ * from interrupt context go to their own list, which only ever gets
+ * touched with interrupts disabled.
+ */
+struct bio_alloc_cache {
+	struct bio_list		free_list;
+	struct bio_list		free_list_irq;
+	unsigned int		nr;
+	unsigned int		nr_irq;
+};
+
 struct bio_set {
 	struct kmem_cache *bio_slab;
 	unsigned int front_pad;
@@ -692,6 +705,7 @@ struct bio_set {
 	mempool_t *bio_integrity_pool;
 	mempool_t *bvec_integrity_pool;
 #endif
+	struct bio_alloc_cache __percpu *cache;
 
 	/*
 	 * Deadlock avoidance for stacking block drivers: see comments in
@@ -681,12 +681,24 @@ static inline bool blk_throtl_bio(struct request_queue *q, struct blkcg_gq *blkg
 				  struct bio *bio) { return false; }
 #endif
 
+#ifdef CONFIG_BLK_CGROUP_IOCOST
+extern u64 blk_iocost_charge(struct request_queue *q, struct blkcg_gq *blkg,
+			     struct bio *bio);
+extern void blk_iocost_delay(u64 delay);
+#else
+static inline u64 blk_iocost_charge(struct request_queue *q,
+				    struct blkcg_gq *blkg,
+				    struct bio *bio) { return 0; }
+static inline void blk_iocost_delay(u64 delay) { }
+#endif
+
 static inline bool blkcg_bio_issue_check(struct request_queue *q,
 					 struct bio *bio)
 {
 	struct blkcg *blkcg;
 	struct blkcg_gq *blkg;
 	bool throtl = false;
+	u64 delay = 0;
 
 	rcu_read_lock();
 	blkcg = bio_blkcg(bio);
@@ -704,12 +716,17 @@ static inline bool blkcg_bio_issue_check(struct request_queue *q,
 
 	if (!throtl) {
 		blkg = blkg ?: q->root_blkg;
+		delay = blk_iocost_charge(q, blkg, bio);
 		blkg_rwstat_add(&blkg->stat_bytes, bio->bi_opf,
 				bio->bi_iter.bi_size);
 		blkg_rwstat_add(&blkg->stat_ios, bio->bi_opf, 1);
 	}
 
 	rcu_read_unlock();
+
+	/* the cgroup is over its share of the device, pay the cost back */
+	if (delay)
+		blk_iocost_delay(delay);
 	return !throtl;
 }
 
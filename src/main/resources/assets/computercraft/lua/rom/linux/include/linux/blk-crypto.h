@@ -0,0 +1,141 @@
+/*
+ * Inline encryption support for the block layer
+ *
+ * A bio can carry a crypt context naming the key its data is to be
+ * encrypted or decrypted with, and the data unit number (DUN) of its first
+ * data unit. Devices that can do the crypto themselves get a keyslot
+ * programmed with the key; for all others blk-crypto falls back to the
+ * kernel crypto API, when enabled.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef __LINUX_BLK_CRYPTO_H
+#define __LINUX_BLK_CRYPTO_H
+
+#include <linux/types.h>
+#include <linux/gfp.h>
+#include <linux/blk_types.h>
+
+enum blk_crypto_mode_num {
+	BLK_ENCRYPTION_MODE_INVALID,
+	BLK_ENCRYPTION_MODE_AES_256_XTS,
+	BLK_ENCRYPTION_MODE_MAX,
+};
+
+#define BLK_CRYPTO_MAX_KEY_SIZE		64
+
+/**
+ * struct blk_crypto_key - an inline encryption key
+ * @crypto_mode: encryption algorithm this key is for
+ * @data_unit_size: the data unit size for all encryption/decryptions with
+ *	this key, a power of 2 between 512 and PAGE_SIZE
+ * @data_unit_size_bits: log2 of @data_unit_size
+ * @size: size of @raw
+ * @hash: hash of @raw, to speed up keyslot lookups
+ * @raw: the raw bytes of the key
+ *
+ * The key has to be evicted with blk_crypto_evict_key() from every queue it
+ * was used on before it is freed.
+ */
+struct blk_crypto_key {
+	enum blk_crypto_mode_num crypto_mode;
+	unsigned int data_unit_size;
+	unsigned int data_unit_size_bits;
+	unsigned int size;
+	unsigned int hash;
+	u8 raw[BLK_CRYPTO_MAX_KEY_SIZE];
+};
+
+struct keyslot_manager;
+
+/**
+ * struct bio_crypt_ctx - an inline encryption context
+ * @bc_key: the key, must outlive the bio
+ * @bc_dun: the data unit number of the first data unit of the bio
+ * @bc_keyslot: keyslot of @bc_ksm programmed with @bc_key, or -1
+ * @bc_ksm: keyslot manager @bc_keyslot belongs to
+ */
+struct bio_crypt_ctx {
+	const struct blk_crypto_key	*bc_key;
+	u64				bc_dun;
+	int				bc_keyslot;
+	struct keyslot_manager		*bc_ksm;
+};
+
+struct request_queue;
+
+#ifdef CONFIG_BLK_INLINE_ENCRYPTION
+
+int blk_crypto_init_key(struct blk_crypto_key *blk_key, const u8 *raw_key,
+			enum blk_crypto_mode_num crypto_mode,
+			unsigned int data_unit_size);
+
+int blk_crypto_evict_key(struct request_queue *q,
+			 const struct blk_crypto_key *key);
+
+bool blk_crypto_submit_bio(struct bio **bio_ptr);
+
+int bio_crypt_set_ctx(struct bio *bio, const struct blk_crypto_key *key,
+		      u64 dun, gfp_t gfp_mask);
+
+static inline bool bio_has_crypt_ctx(struct bio *bio)
+{
+	return bio->bi_crypt_context;
+}
+
+void bio_crypt_free_ctx(struct bio *bio);
+int bio_crypt_clone(struct bio *dst, struct bio *src, gfp_t gfp_mask);
+void bio_crypt_advance(struct bio *bio, unsigned int bytes);
+void bio_crypt_endio(struct bio *bio);
+
+bool bio_crypt_ctx_compatible(struct bio *b_1, struct bio *b_2);
+bool bio_crypt_ctx_mergeable(struct bio *b_1, unsigned int b1_bytes,
+			     struct bio *b_2);
+
+#else /* CONFIG_BLK_INLINE_ENCRYPTION */
+
+static inline bool blk_crypto_submit_bio(struct bio **bio_ptr)
+{
+	return true;
+}
+
+static inline bool bio_has_crypt_ctx(struct bio *bio)
+{
+	return false;
+}
+
+static inline void bio_crypt_free_ctx(struct bio *bio)
+{
+}
+
+static inline int bio_crypt_clone(struct bio *dst, struct bio *src,
+				  gfp_t gfp_mask)
+{
+	return 0;
+}
+
+static inline void bio_crypt_advance(struct bio *bio, unsigned int bytes)
+{
+}
+
+static inline void bio_crypt_endio(struct bio *bio)
+{
+}
+
+static inline bool bio_crypt_ctx_compatible(struct bio *b_1, struct bio *b_2)
+{
+	return true;
+}
+
+static inline bool bio_crypt_ctx_mergeable(struct bio *b_1,
+					   unsigned int b1_bytes,
+					   struct bio *b_2)
+{
+	return true;
+}
+
+#endif /* CONFIG_BLK_INLINE_ENCRYPTION */
+
+#endif /* __LINUX_BLK_CRYPTO_H */
@@ -8,6 +8,12 @@
 struct blk_mq_tags;
 struct blk_flush_queue;
 
+/*
+ * Completion times of polled requests are kept in log-linear buckets of
+ * 256ns units: four buckets per power of two, from 0 to ~2ms.
+ */
+#define BLK_MQ_POLL_HIST_BKTS	48
+
 struct blk_mq_hw_ctx {
 	struct {
 		spinlock_t		lock;
@@ -57,12 +63,27 @@ struct blk_mq_hw_ctx {
 	unsigned long		poll_considered;
 	unsigned long		poll_invoked;
 	unsigned long		poll_success;
+
+	/*
+	 * Per request size completion time histograms of polled requests
+	 * for the current stats window, and the hybrid poll sleep they
+	 * gave for each size at the end of the last one.
+	 */
+	atomic_t		poll_hist[BLK_MQ_POLL_STATS_BKTS][BLK_MQ_POLL_HIST_BKTS];
+	unsigned int		poll_sleep_nsec[BLK_MQ_POLL_STATS_BKTS];
 };
 
 struct blk_mq_tag_set {
 	unsigned int		*mq_map;
+	unsigned int		*mq_poll_map;
 	const struct blk_mq_ops	*ops;
 	unsigned int		nr_hw_queues;
+	/*
+	 * The last nr_poll_queues of the nr_hw_queues are dedicated to
+	 * polled (REQ_HIPRI) I/O and may have no completion interrupt.
+	 * ->map_queues only maps the others in ->mq_map.
+	 */
+	unsigned int		nr_poll_queues;
 	unsigned int		queue_depth;	/* max hw supported */
 	unsigned int		reserved_tags;
 	unsigned int		cmd_size;	/* per-request extra data */
@@ -189,6 +210,7 @@ int blk_mq_alloc_tag_set(struct blk_mq_tag_set *set);
 void blk_mq_free_tag_set(struct blk_mq_tag_set *set);
 
 void blk_mq_flush_plug_list(struct blk_plug *plug, bool from_schedule);
+void blk_mq_plug_put_tags(struct blk_plug *plug);
 
 void blk_mq_free_request(struct request *rq);
 bool blk_mq_can_queue(struct blk_mq_hw_ctx *);
@@ -197,6 +219,7 @@ enum {
 	BLK_MQ_REQ_NOWAIT	= (1 << 0), /* return when out of requests */
 	BLK_MQ_REQ_RESERVED	= (1 << 1), /* allocate from reserved pool */
 	BLK_MQ_REQ_INTERNAL	= (1 << 2), /* allocate internal/sched tag */
+	BLK_MQ_REQ_POLL		= (1 << 3), /* allocate from a poll queue */
 };
 
 struct request *blk_mq_alloc_request(struct request_queue *q, int rw,
@@ -235,6 +258,8 @@ void blk_mq_kick_requeue_list(struct request_queue *q);
 void blk_mq_delay_kick_requeue_list(struct request_queue *q, unsigned long msecs);
 void blk_mq_abort_requeue_list(struct request_queue *q);
 void blk_mq_complete_request(struct request *rq);
+void blk_mq_complete_request_batch(struct request *rq, struct list_head *list);
+void blk_mq_end_request_batch(struct list_head *list);
 
 bool blk_mq_queue_stopped(struct request_queue *q);
 void blk_mq_stop_hw_queue(struct blk_mq_hw_ctx *hctx);
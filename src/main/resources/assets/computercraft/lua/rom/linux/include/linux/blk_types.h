@@ -11,6 +11,7 @@
 struct bio_set;
 struct bio;
 struct bio_integrity_payload;
+struct bio_crypt_ctx;
 struct page;
 struct block_device;
 struct io_context;
@@ -72,6 +73,9 @@ struct bio {
 		struct bio_integrity_payload *bi_integrity; /* data integrity */
 #endif
 	};
+#ifdef CONFIG_BLK_INLINE_ENCRYPTION
+	struct bio_crypt_ctx	*bi_crypt_context;
+#endif
 
 	unsigned short		bi_vcnt;	/* how many bio_vec's */
 
@@ -112,6 +116,7 @@ struct bio {
 				 * throttling rules. Don't do it again. */
 #define BIO_TRACE_COMPLETION 10	/* bio_endio() should trace the final completion
 				 * of this bio. */
+#define BIO_PERCPU_CACHE 11	/* free to the bio_set's per cpu cache */
 /* See BVEC_POOL_OFFSET below before adding new flags */
 
 /*
@@ -201,6 +206,7 @@ enum req_flag_bits {
 	__REQ_PREFLUSH,		/* request for cache flush */
 	__REQ_RAHEAD,		/* read ahead, can fail anytime */
 	__REQ_BACKGROUND,	/* background IO */
+	__REQ_HIPRI,		/* submitter polls for the completion */
 
 	/* command specific flags for REQ_OP_WRITE_ZEROES: */
 	__REQ_NOUNMAP,		/* do not free blocks when zeroing */
@@ -221,6 +227,7 @@ enum req_flag_bits {
 #define REQ_PREFLUSH		(1ULL << __REQ_PREFLUSH)
 #define REQ_RAHEAD		(1ULL << __REQ_RAHEAD)
 #define REQ_BACKGROUND		(1ULL << __REQ_BACKGROUND)
+#define REQ_HIPRI		(1ULL << __REQ_HIPRI)
 
 #define REQ_NOUNMAP		(1ULL << __REQ_NOUNMAP)
 
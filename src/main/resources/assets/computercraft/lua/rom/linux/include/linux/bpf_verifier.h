@@ -16,6 +16,21 @@
 #define BPF_REGISTER_MAX_RANGE (1024 * 1024 * 1024)
 #define BPF_REGISTER_MIN_RANGE -1
 
+/* Liveness marks, used for registers and spilled registers (in stack slots).
+ * Read marks propagate upwards until they find a write mark; they record that
+ * "one of this state's descendants read this reg" (and therefore the reg is
+ * relevant for states_equal() checks).
+ * Write marks collect downwards and do not propagate; they record that "the
+ * straight-line code that reached this state (from its parent) wrote this reg"
+ * (and therefore that reads propagated from this state or its descendants
+ * should not propagate to its parent).
+ */
+enum bpf_reg_liveness {
+	REG_LIVE_NONE = 0, /* reg hasn't been read or written this branch */
+	REG_LIVE_READ, /* reg was read, so we're sensitive to initial value */
+	REG_LIVE_WRITTEN, /* reg was written first, screening off later reads */
+};
+
 struct bpf_reg_state {
 	enum bpf_reg_type type;
 	union {
@@ -35,11 +50,13 @@ struct bpf_reg_state {
 	};
 	u32 id;
 	/* Used to determine if any memory access using this register will
-	 * result in a bad access. These two fields must be last.
+	 * result in a bad access. These two fields must be last, apart from
+	 * the liveness marks, which are not part of the state proper.
 	 * See states_equal()
 	 */
 	s64 min_value;
 	u64 max_value;
+	enum bpf_reg_liveness live;
 };
 
 enum bpf_stack_slot_type {
@@ -57,6 +74,7 @@ struct bpf_verifier_state {
 	struct bpf_reg_state regs[MAX_BPF_REG];
 	u8 stack_slot_type[MAX_BPF_STACK];
 	struct bpf_reg_state spilled_regs[MAX_BPF_STACK / BPF_REG_SIZE];
+	struct bpf_verifier_state *parent; /* explored state we came from */
 };
 
 /* linked list of verifier states used to prune search */
@@ -71,6 +89,18 @@ struct bpf_insn_aux_data {
 
 #define MAX_USED_MAPS 64 /* max number of maps accessed by one eBPF program */
 
+#define BPF_MAX_SUBPROGS 256
+/* Every frame has a whole MAX_BPF_STACK of its own, keep the kernel stack
+ * of a program that nests calls reasonable.
+ */
+#define MAX_CALL_FRAMES 4
+
+/* functions of the program, the main one being subprog 0 */
+struct bpf_subprog_info {
+	u32 start;		/* insn idx of the function entry point */
+	bool changes_pkt_data;	/* may move skb->data, maybe through callees */
+};
+
 struct bpf_verifier_env;
 struct bpf_ext_analyzer_ops {
 	int (*insn_hook)(struct bpf_verifier_env *env,
@@ -95,6 +125,15 @@ struct bpf_verifier_env {
 	bool seen_direct_write;
 	bool varlen_map_value_access;
 	struct bpf_insn_aux_data *insn_aux_data; /* array of per-insn state */
+	struct bpf_subprog_info subprog_info[BPF_MAX_SUBPROGS];
+	u32 subprog_cnt;		/* number of functions, sorted by start */
+	u32 call_depth;			/* frames above the main program */
+	u32 insn_processed;		/* across all frames */
+	/* search statistics, reported in the verifier log */
+	u32 total_states;		/* states remembered for pruning */
+	u32 pruned_states;		/* paths cut short by an equivalent state */
+	u32 peak_states;		/* max states waiting to be processed */
+	u32 max_states_per_insn;	/* longest explored_states[] list */
 };
 
 int bpf_analyzer(struct bpf_prog *prog, const struct bpf_ext_analyzer_ops *ops,
@@ -7,10 +7,40 @@
 
 #include <linux/types.h>
 #include <linux/bitrev.h>
+#include <linux/list.h>
 
 u32 __pure crc32_le(u32 crc, unsigned char const *p, size_t len);
 u32 __pure crc32_be(u32 crc, unsigned char const *p, size_t len);
 
+/*
+ * The generic table driven code, for accelerated implementations to fall
+ * back to on short or misaligned buffers.
+ */
+u32 __pure crc32_le_base(u32 crc, unsigned char const *p, size_t len);
+u32 __pure __crc32c_le_base(u32 crc, unsigned char const *p, size_t len);
+
+typedef u32 (*crc32_fn_t)(u32 crc, unsigned char const *p, size_t len);
+
+/**
+ * struct crc32_arch - accelerated implementations of crc32_le()/__crc32c_le()
+ * @name: shown in the boot log when selected
+ * @priority: the highest priority registered implementation is used
+ * @crc32_le: replacement for crc32_le(), or NULL
+ * @crc32c_le: replacement for __crc32c_le(), or NULL
+ *
+ * Both are called with preemption disabled.
+ */
+struct crc32_arch {
+	const char *name;
+	int priority;
+	crc32_fn_t crc32_le;
+	crc32_fn_t crc32c_le;
+	struct list_head list;
+};
+
+void crc32_register_arch(struct crc32_arch *arch);
+void crc32_unregister_arch(struct crc32_arch *arch);
+
 /**
  * crc32_le_combine - Combine two crc32 check values into one. For two
  * 		      sequences of bytes, seq1 and seq2 with lengths len1
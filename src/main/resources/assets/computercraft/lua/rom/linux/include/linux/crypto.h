@@ -163,6 +163,20 @@ struct crypto_async_request {
 	u32 flags;
 };
 
+/**
+ * struct crypto_batch - single completion for a batch of requests
+ * @pending: requests not finished yet, plus one held by the submitter
+ * @err: first error reported by any request of the batch
+ * @complete: called once when the last request of an asynchronous batch
+ *	      finishes, not called if the submit function returns anything
+ *	      but -EINPROGRESS
+ */
+struct crypto_batch {
+	atomic_t pending;
+	int err;
+	void (*complete)(struct crypto_batch *batch, int err);
+};
+
 struct ablkcipher_request {
 	struct crypto_async_request base;
 
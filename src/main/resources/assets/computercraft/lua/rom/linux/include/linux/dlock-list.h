@@ -0,0 +1,135 @@
+/*
+ * Distributed and locked list
+ *
+ * A dlock list is a set of per cpu lists, each protected by its own
+ * spinlock.  Insertion goes to the list of the local cpu and deletion to
+ * whichever list the node was added to, so neither needs a global lock.
+ * Walking all the entries visits the per cpu lists one after another,
+ * holding only the lock of the list being walked.
+ *
+ * There is no ordering between entries of different lists, so this is
+ * only useful for sets that are mostly added to and deleted from, and
+ * only occasionally walked as a whole.
+ */
+#ifndef __LINUX_DLOCK_LIST_H
+#define __LINUX_DLOCK_LIST_H
+
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/percpu.h>
+
+struct dlock_list_head {
+	struct list_head	list;
+	spinlock_t		lock;
+};
+
+struct dlock_list_heads {
+	struct dlock_list_head __percpu *heads;
+};
+
+/*
+ * @head remembers which per cpu list the node is on, so that it can be
+ * deleted from any cpu.
+ */
+struct dlock_list_node {
+	struct list_head	list;
+	struct dlock_list_head	*head;
+};
+
+/*
+ * Iterator over all the entries of a dlock list.  @entry is the per cpu
+ * list currently being walked, its lock is held while the walk is on it.
+ */
+struct dlock_list_iter {
+	int			cpu;
+	struct dlock_list_heads	*heads;
+	struct dlock_list_head	*entry;
+};
+
+#define DEFINE_DLOCK_LIST_ITER(s, dlist)			\
+	struct dlock_list_iter s = {				\
+		.cpu	 = -1,					\
+		.heads	 = dlist,				\
+		.entry	 = NULL,				\
+	}
+
+static inline void init_dlock_list_iter(struct dlock_list_iter *iter,
+					struct dlock_list_heads *dlist)
+{
+	iter->cpu = -1;
+	iter->heads = dlist;
+	iter->entry = NULL;
+}
+
+static inline void init_dlock_list_node(struct dlock_list_node *node)
+{
+	INIT_LIST_HEAD(&node->list);
+	node->head = NULL;
+}
+
+static inline bool dlock_list_node_empty(const struct dlock_list_node *node)
+{
+	return list_empty(&node->list);
+}
+
+/*
+ * Drop and retake the lock of the list the iterator is on, e.g. to sleep
+ * in the middle of a walk.  The caller must make sure the current entry
+ * stays on the list in between, usually by holding a reference to it.
+ */
+static inline void dlock_list_unlock(struct dlock_list_iter *iter)
+{
+	spin_unlock(&iter->entry->lock);
+}
+
+static inline void dlock_list_relock(struct dlock_list_iter *iter)
+{
+	spin_lock(&iter->entry->lock);
+}
+
+extern int alloc_dlock_list_heads(struct dlock_list_heads *dlist);
+extern void free_dlock_list_heads(struct dlock_list_heads *dlist);
+extern bool dlock_lists_empty(struct dlock_list_heads *dlist);
+extern void dlock_lists_add(struct dlock_list_node *node,
+			    struct dlock_list_heads *dlist);
+extern void dlock_lists_del(struct dlock_list_node *node);
+extern struct dlock_list_node *__dlock_list_next_list(struct dlock_list_iter *iter);
+
+static inline struct dlock_list_node *
+__dlock_list_next_entry(struct dlock_list_node *curr,
+			struct dlock_list_iter *iter)
+{
+	if (curr) {
+		curr = list_next_entry(curr, list);
+		if (&curr->list != &iter->entry->list)
+			return curr;
+	}
+	/* The current list is done (or not started), go to the next one */
+	return __dlock_list_next_list(iter);
+}
+
+#define __dlock_list_entry(node, type, member)				\
+({									\
+	struct dlock_list_node *__node = (node);			\
+	__node ? container_of(__node, type, member) : NULL;		\
+})
+
+/**
+ * dlist_for_each_entry - iterate over all the entries of a dlock list
+ * @pos:	the type * to use as a loop cursor
+ * @iter:	the dlock list iterator, set up with init_dlock_list_iter()
+ * @member:	the name of the dlock_list_node within the struct
+ *
+ * The lock of the per cpu list holding @pos is held in the loop body.  The
+ * body must not delete @pos from the list.  Breaking out of the loop leaves
+ * that lock held, and it has to be dropped with dlock_list_unlock().
+ */
+#define dlist_for_each_entry(pos, iter, member)				\
+	for (pos = __dlock_list_entry(__dlock_list_next_entry(NULL, iter), \
+				      typeof(*pos), member);		\
+	     pos;							\
+	     pos = __dlock_list_entry(__dlock_list_next_entry(&(pos)->member, \
+							      iter),	\
+				      typeof(*pos), member))
+
+#endif /* __LINUX_DLOCK_LIST_H */
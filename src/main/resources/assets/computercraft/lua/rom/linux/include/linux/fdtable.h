@@ -58,6 +58,7 @@ struct files_struct {
    */
 	spinlock_t file_lock ____cacheline_aligned_in_smp;
 	unsigned int next_fd;
+	unsigned int close_seq;		/* bumped when an fd loses its file */
 	unsigned long close_on_exec_init[1];
 	unsigned long open_fds_init[1];
 	unsigned long full_fds_bits_init[1];
@@ -101,6 +102,24 @@ static inline struct file *fcheck_files(struct files_struct *files, unsigned int
 
 struct task_struct;
 
+/*
+ * Files pinned for fdget() by a thread whose fd table is shared, see
+ * PR_SET_FD_CACHE.  Slot @i holds a reference on @file[i], which was at
+ * @fd[i] of @files when it was looked up.  @work, queued while a slot is
+ * in use, drops all of them when the syscall returns to user space.
+ */
+#define FD_CACHE_SIZE	4
+
+struct fd_cache {
+	struct files_struct *files;
+	bool queued;
+	struct callback_head work;
+	unsigned int fd[FD_CACHE_SIZE];
+	struct file *file[FD_CACHE_SIZE];
+};
+
+extern void exit_fd_cache(struct task_struct *tsk);
+
 struct files_struct *get_files_struct(struct task_struct *);
 void put_files_struct(struct files_struct *fs);
 void reset_files_struct(struct files_struct *);
@@ -15,6 +15,9 @@
 #include <linux/sched.h>
 #include <linux/capability.h>
 #include <linux/cryptohash.h>
+#include <linux/jump_label.h>
+#include <linux/u64_stats_sync.h>
+#include <linux/sched/clock.h>
 
 #include <net/sch_generic.h>
 
@@ -27,6 +30,7 @@ struct sk_buff;
 struct sock;
 struct seccomp_data;
 struct bpf_prog_aux;
+struct xdp_rxq_info;
 
 /* ArgX, context and stack frame pointer register positions. Note,
  * Arg1, Arg2, Arg3, etc are used as argument mappings of function
@@ -54,6 +58,11 @@ struct bpf_prog_aux;
 #define BPF_REG_AX		MAX_BPF_REG
 #define MAX_BPF_JIT_REG		(MAX_BPF_REG + 1)
 
+/* unused opcode to mark call to a function of the same program, into which
+ * the verifier rewrites BPF_PSEUDO_CALL instructions; imm stays the offset
+ */
+#define BPF_CALL_ARGS	0xe0
+
 /* As per nm, we expose JITed images as text (code) section for
  * kallsyms. That way, tools like perf can find it to match
  * addresses.
@@ -63,8 +72,6 @@ struct bpf_prog_aux;
 /* BPF program can access up to 512 bytes of stack space. */
 #define MAX_BPF_STACK	512
 
-#define BPF_TAG_SIZE	8
-
 /* Helper macros for filter block array initializers. */
 
 /* ALU ops on registers, bpf_add|sub|...: dst_reg += src_reg */
@@ -405,6 +412,12 @@ struct bpf_binary_header {
 	u8 image[];
 };
 
+struct bpf_prog_stats {
+	u64 cnt;
+	u64 nsecs;
+	struct u64_stats_sync syncp;
+};
+
 struct bpf_prog {
 	u16			pages;		/* Number of allocated pages */
 	kmemcheck_bitfield_begin(meta);
@@ -419,6 +432,7 @@ struct bpf_prog {
 	u32			len;		/* Number of filter blocks */
 	u8			tag[BPF_TAG_SIZE];
 	struct bpf_prog_aux	*aux;		/* Auxiliary fields */
+	struct bpf_prog_stats __percpu *stats;
 	struct sock_fprog_kern	*orig_prog;	/* Original BPF program */
 	unsigned int		(*bpf_func)(const void *ctx,
 					    const struct bpf_insn *insn);
@@ -435,7 +449,26 @@ struct sk_filter {
 	struct bpf_prog	*prog;
 };
 
-#define BPF_PROG_RUN(filter, ctx)  (*filter->bpf_func)(ctx, filter->insnsi)
+DECLARE_STATIC_KEY_FALSE(bpf_stats_enabled_key);
+
+/* With kernel.bpf_stats_enabled, count runs and run time of each program;
+ * the callers have preemption disabled.
+ */
+#define BPF_PROG_RUN(filter, ctx)	({				\
+	u32 __ret;							\
+	if (static_branch_unlikely(&bpf_stats_enabled_key)) {		\
+		struct bpf_prog_stats *__stats;				\
+		u64 __start = sched_clock();				\
+		__ret = (*(filter)->bpf_func)(ctx, (filter)->insnsi);	\
+		__stats = this_cpu_ptr((filter)->stats);		\
+		u64_stats_update_begin(&__stats->syncp);		\
+		__stats->cnt++;						\
+		__stats->nsecs += sched_clock() - __start;		\
+		u64_stats_update_end(&__stats->syncp);			\
+	} else {							\
+		__ret = (*(filter)->bpf_func)(ctx, (filter)->insnsi);	\
+	}								\
+	__ret; })
 
 #define BPF_SKB_CB_LEN QDISC_CB_PRIV_LEN
 
@@ -448,6 +481,8 @@ struct xdp_buff {
 	void *data;
 	void *data_end;
 	void *data_hard_start;
+	/* only valid on the XDP_REDIRECT path, see xdp_do_redirect() */
+	struct xdp_rxq_info *rxq;
 };
 
 /* compute the linear packet data range [data, data_end) which
@@ -653,6 +688,26 @@ bool bpf_helper_changes_pkt_data(void *func);
 
 struct bpf_prog *bpf_patch_insn_single(struct bpf_prog *prog, u32 off,
 				       const struct bpf_insn *patch, u32 len);
+
+/* The pair of xdp_do_redirect and xdp_do_flush_map MUST be called in the
+ * same cpu context. Further for best results no more than a single map
+ * for the do_redirect/do_flush pair should be used. This limitation is
+ * because we only track one map and force a flush when the map changes.
+ * This does not appear to be a real limitation for existing software.
+ *
+ * Drivers calling xdp_do_redirect must point xdp->rxq at the RX ring's
+ * struct xdp_rxq_info.
+ */
+int xdp_do_redirect(struct net_device *dev,
+		    struct xdp_buff *xdp,
+		    struct bpf_prog *prog);
+int xdp_do_generic_redirect(struct net_device *dev, struct sk_buff *skb,
+			    struct bpf_prog *prog);
+void xdp_do_flush_map(void);
+
+/* Used by the sockmap to pick up the target of bpf_sk_redirect_map() */
+struct sock *do_sk_redirect_map(void);
+
 void bpf_warn_invalid_xdp_action(u32 act);
 
 #ifdef CONFIG_BPF_JIT
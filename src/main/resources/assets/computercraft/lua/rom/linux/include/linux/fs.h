@@ -22,6 +22,7 @@
 #include <linux/semaphore.h>
 #include <linux/fiemap.h>
 #include <linux/rculist_bl.h>
+#include <linux/dlock-list.h>
 #include <linux/atomic.h>
 #include <linux/shrinker.h>
 #include <linux/migrate_mode.h>
@@ -29,6 +30,7 @@
 #include <linux/lockdep.h>
 #include <linux/percpu-rwsem.h>
 #include <linux/workqueue.h>
+#include <linux/percpu_counter.h>
 #include <linux/percpu-rwsem.h>
 #include <linux/delayed_call.h>
 
@@ -55,6 +57,7 @@ struct workqueue_struct;
 struct iov_iter;
 struct fscrypt_info;
 struct fscrypt_operations;
+struct path_cache;
 
 extern void __init inode_init(void);
 extern void __init inode_init_early(void);
@@ -381,6 +384,10 @@ struct address_space {
 	struct radix_tree_root	page_tree;	/* radix tree of all pages */
 	spinlock_t		tree_lock;	/* and lock protecting it */
 	atomic_t		i_mmap_writable;/* count VM_SHARED mappings */
+#ifdef CONFIG_READ_ONLY_THP_FOR_FS
+	/* number of huge pages, only for non-shmem files */
+	atomic_t		nr_thps;
+#endif
 	struct rb_root		i_mmap;		/* tree of private and shared mappings */
 	struct rw_semaphore	i_mmap_rwsem;	/* protect tree, count, list */
 	/* Protected by tree_lock together with the radix tree */
@@ -605,7 +612,8 @@ struct inode {
 	unsigned long		dirtied_when;	/* jiffies of first dirtying */
 	unsigned long		dirtied_time_when;
 
-	struct hlist_node	i_hash;
+	struct hlist_bl_node	i_hash;
+	struct hlist_bl_head	*i_hash_head;	/* bucket i_hash is on */
 	struct list_head	i_io_list;	/* backing dev IO list */
 #ifdef CONFIG_CGROUP_WRITEBACK
 	struct bdi_writeback	*i_wb;		/* the associated cgroup wb */
@@ -616,7 +624,7 @@ struct inode {
 	u16			i_wb_frn_history;
 #endif
 	struct list_head	i_lru;		/* inode LRU list */
-	struct list_head	i_sb_list;
+	struct dlock_list_node	i_sb_list;
 	struct list_head	i_wb_list;	/* backing dev writeback list */
 	union {
 		struct hlist_head	i_dentry;
@@ -662,7 +670,17 @@ static inline unsigned int i_blocksize(const struct inode *node)
 
 static inline int inode_unhashed(struct inode *inode)
 {
-	return hlist_unhashed(&inode->i_hash);
+	return hlist_bl_unhashed(&inode->i_hash);
+}
+
+/*
+ * For filesystems that don't use the inode hash but still want the inode to
+ * look hashed to generic code, e.g. so that it isn't dropped on last iput.
+ * remove_inode_hash() leaves such inodes alone.
+ */
+static inline void inode_fake_hash(struct inode *inode)
+{
+	hlist_bl_add_fake(&inode->i_hash);
 }
 
 /*
@@ -842,7 +860,7 @@ struct file {
 	const struct file_operations	*f_op;
 
 	/*
-	 * Protects f_ep_links, f_flags.
+	 * Protects f_ep_links, f_poll_cache_links, f_flags.
 	 * Must not be taken from IRQ context.
 	 */
 	spinlock_t		f_lock;
@@ -867,6 +885,8 @@ struct file {
 	struct list_head	f_ep_links;
 	struct list_head	f_tfile_llink;
 #endif /* #ifdef CONFIG_EPOLL */
+	/* Used by fs/select.c to link the poll() caches waiting on this file */
+	struct list_head	f_poll_cache_links;
 	struct address_space	*f_mapping;
 } __attribute__((aligned(4)));	/* lest something weird decides that 2 is OK */
 
@@ -1380,11 +1400,17 @@ struct super_block {
 	 */
 	struct user_namespace *s_user_ns;
 
+	/* unused negative dentries, trimmed past sysctl_negative_dentry_limit */
+	struct percpu_counter	s_nr_dentry_negative;
+	struct work_struct	s_dentry_negative_work;
+
 	/*
 	 * Keep the lru lists last in the structure so they always sit on their
-	 * own individual cachelines.
+	 * own individual cachelines.  Negative dentries have their own list so
+	 * that they can be trimmed without scanning the positive ones.
 	 */
 	struct list_lru		s_dentry_lru ____cacheline_aligned_in_smp;
+	struct list_lru		s_dentry_neg_lru ____cacheline_aligned_in_smp;
 	struct list_lru		s_inode_lru ____cacheline_aligned_in_smp;
 	struct rcu_head		rcu;
 	struct work_struct	destroy_work;
@@ -1396,14 +1422,36 @@ struct super_block {
 	 */
 	int s_stack_depth;
 
-	/* s_inode_list_lock protects s_inodes */
-	spinlock_t		s_inode_list_lock ____cacheline_aligned_in_smp;
-	struct list_head	s_inodes;	/* all inodes */
+	struct dlock_list_heads	s_inodes;	/* all inodes */
 
 	spinlock_t		s_inode_wblist_lock;
 	struct list_head	s_inodes_wb;	/* writeback inodes */
+
+#ifdef CONFIG_FS_PATH_CACHE
+	/* Path prefix cache, see fs/namei.c */
+	struct path_cache	*s_path_cache;
+	atomic_t		s_path_cache_gen ____cacheline_aligned_in_smp;
+#endif
 };
 
+/*
+ * A change to a directory that could make a cached path prefix resolve
+ * differently (unhash, rename, permission or label change) has to throw
+ * away the cached prefixes of its filesystem.
+ */
+static inline void path_cache_invalidate_sb(struct super_block *sb)
+{
+#ifdef CONFIG_FS_PATH_CACHE
+	atomic_inc(&sb->s_path_cache_gen);
+#endif
+}
+
+static inline void path_cache_invalidate(struct dentry *dentry)
+{
+	if (d_is_dir(dentry))
+		path_cache_invalidate_sb(dentry->d_sb);
+}
+
 /* Helper functions so that in most cases filesystems will
  * not need to deal directly with kuid_t and kgid_t and can
  * instead deal with the raw numeric values that are stored
@@ -2766,7 +2814,7 @@ static inline void insert_inode_hash(struct inode *inode)
 extern void __remove_inode_hash(struct inode *);
 static inline void remove_inode_hash(struct inode *inode)
 {
-	if (!inode_unhashed(inode) && !hlist_fake(&inode->i_hash))
+	if (!inode_unhashed(inode) && !hlist_bl_fake(&inode->i_hash))
 		__remove_inode_hash(inode);
 }
 
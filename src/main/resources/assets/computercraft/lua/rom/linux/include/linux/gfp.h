@@ -426,6 +426,50 @@ __alloc_pages(gfp_t gfp_mask, unsigned int order,
 	return __alloc_pages_nodemask(gfp_mask, order, zonelist, NULL);
 }
 
+unsigned long __alloc_pages_bulk(gfp_t gfp_mask, struct zonelist *zonelist,
+				 nodemask_t *nodemask, unsigned long nr_pages,
+				 struct list_head *page_list,
+				 struct page **page_array);
+
+/* Bulk allocate order-0 pages, preferring the node given as nid */
+static inline unsigned long
+alloc_pages_bulk_list_node(gfp_t gfp_mask, int nid, unsigned long nr_pages,
+			   struct list_head *list)
+{
+	if (nid == NUMA_NO_NODE)
+		nid = numa_mem_id();
+
+	return __alloc_pages_bulk(gfp_mask, node_zonelist(nid, gfp_mask), NULL,
+				  nr_pages, list, NULL);
+}
+
+static inline unsigned long
+alloc_pages_bulk_array_node(gfp_t gfp_mask, int nid, unsigned long nr_pages,
+			    struct page **page_array)
+{
+	if (nid == NUMA_NO_NODE)
+		nid = numa_mem_id();
+
+	return __alloc_pages_bulk(gfp_mask, node_zonelist(nid, gfp_mask), NULL,
+				  nr_pages, NULL, page_array);
+}
+
+static inline unsigned long
+alloc_pages_bulk_list(gfp_t gfp_mask, unsigned long nr_pages,
+		      struct list_head *list)
+{
+	return alloc_pages_bulk_list_node(gfp_mask, NUMA_NO_NODE, nr_pages,
+					  list);
+}
+
+static inline unsigned long
+alloc_pages_bulk_array(gfp_t gfp_mask, unsigned long nr_pages,
+		       struct page **page_array)
+{
+	return alloc_pages_bulk_array_node(gfp_mask, NUMA_NO_NODE, nr_pages,
+					   page_array);
+}
+
 /*
  * Allocate pages, preferring the node given as nid. The node must be valid and
  * online. For more general interface, see alloc_pages_node().
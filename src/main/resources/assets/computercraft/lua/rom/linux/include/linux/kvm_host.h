@@ -35,6 +35,7 @@
 #include <linux/kvm_types.h>
 
 #include <asm/kvm_host.h>
+#include <linux/kvm_dirty_ring.h>
 
 #ifndef KVM_MAX_VCPU_ID
 #define KVM_MAX_VCPU_ID KVM_MAX_VCPUS
@@ -204,6 +205,9 @@ struct kvm_mmio_fragment {
 	unsigned len;
 };
 
+/* Power-of-two buckets of halt block times, the first one is under 1us */
+#define KVM_HALT_HIST_BUCKETS 16
+
 struct kvm_vcpu {
 	struct kvm *kvm;
 #ifdef CONFIG_PREEMPT_NOTIFIERS
@@ -229,7 +233,10 @@ struct kvm_vcpu {
 	sigset_t sigset;
 	struct kvm_vcpu_stat stat;
 	unsigned int halt_poll_ns;
+	u16 halt_hist[KVM_HALT_HIST_BUCKETS];
+	u16 halt_hist_samples;
 	bool valid_wakeup;
+	struct kvm_dirty_ring dirty_ring;
 
 #ifdef CONFIG_HAS_IOMEM
 	int mmio_needed;
@@ -285,6 +292,7 @@ struct kvm_memory_slot {
 	unsigned long userspace_addr;
 	u32 flags;
 	short id;
+	u16 as_id;
 };
 
 static inline unsigned long kvm_dirty_bitmap_bytes(struct kvm_memory_slot *memslot)
@@ -371,7 +379,11 @@ struct kvm_memslots {
 };
 
 struct kvm {
+#ifdef KVM_HAVE_MMU_RWLOCK
+	rwlock_t mmu_lock;
+#else
 	spinlock_t mmu_lock;
+#endif
 	struct mutex slots_lock;
 	struct mm_struct *mm; /* userspace tied to this vm */
 	struct kvm_memslots *memslots[KVM_ADDRESS_SPACE_NUM];
@@ -408,6 +420,8 @@ struct kvm {
 	spinlock_t ring_lock;
 	struct list_head coalesced_zones;
 #endif
+	/* bytes of the per-vcpu dirty rings, 0 if they are not used */
+	u32 dirty_ring_size;
 
 	struct mutex irq_lock;
 #ifdef CONFIG_HAVE_KVM_IRQCHIP
@@ -500,6 +514,7 @@ void kvm_vcpu_uninit(struct kvm_vcpu *vcpu);
 
 int __must_check vcpu_load(struct kvm_vcpu *vcpu);
 void vcpu_put(struct kvm_vcpu *vcpu);
+struct kvm_vcpu *kvm_get_running_vcpu(void);
 
 #ifdef __KVM_HAVE_IOAPIC
 void kvm_vcpu_request_scan_ioapic(struct kvm *kvm);
@@ -1116,6 +1131,7 @@ extern bool kvm_rebooting;
 extern unsigned int halt_poll_ns;
 extern unsigned int halt_poll_ns_grow;
 extern unsigned int halt_poll_ns_shrink;
+extern unsigned int halt_poll_hit_pct;
 
 struct kvm_device {
 	struct kvm_device_ops *ops;
@@ -0,0 +1,61 @@
+/*
+ * Per cpu log2 latency histograms of hot paths
+ *
+ * Syscalls, softirq vectors and hardirq handlers are timed with
+ * local_clock() and counted in the bucket of the log2 of their duration
+ * in ns, without tracing every event.  It is off by default, and turned
+ * on and read through <debugfs>/lathist/.  The hooks are patched out by
+ * a static key while it is off.
+ *
+ *	u64 start = lathist_start();
+ *	...
+ *	lathist_softirq(vec_nr, start);
+ */
+#ifndef _LINUX_LATHIST_H
+#define _LINUX_LATHIST_H
+
+#include <linux/types.h>
+#include <linux/jump_label.h>
+#include <linux/sched/clock.h>
+
+#ifdef CONFIG_LATHIST
+DECLARE_STATIC_KEY_FALSE(lathist_enabled);
+
+extern void __lathist_syscall(unsigned int nr, u64 start);
+extern void __lathist_softirq(unsigned int vec_nr, u64 start);
+extern void __lathist_hardirq(u64 start);
+
+/* The start time to pass to the lathist_*() hooks, 0 while it is off */
+static __always_inline u64 lathist_start(void)
+{
+	if (static_branch_unlikely(&lathist_enabled))
+		return local_clock();
+	return 0;
+}
+
+/* Called by the arch syscall dispatch after the syscall returned */
+static __always_inline void lathist_syscall(unsigned int nr, u64 start)
+{
+	if (static_branch_unlikely(&lathist_enabled) && start)
+		__lathist_syscall(nr, start);
+}
+
+static __always_inline void lathist_softirq(unsigned int vec_nr, u64 start)
+{
+	if (static_branch_unlikely(&lathist_enabled) && start)
+		__lathist_softirq(vec_nr, start);
+}
+
+static __always_inline void lathist_hardirq(u64 start)
+{
+	if (static_branch_unlikely(&lathist_enabled) && start)
+		__lathist_hardirq(start);
+}
+#else
+static inline u64 lathist_start(void) { return 0; }
+static inline void lathist_syscall(unsigned int nr, u64 start) { }
+static inline void lathist_softirq(unsigned int vec_nr, u64 start) { }
+static inline void lathist_hardirq(u64 start) { }
+#endif
+
+#endif /* _LINUX_LATHIST_H */
@@ -0,0 +1,99 @@
+#ifndef _LINUX_MAPLE_TREE_H
+#define _LINUX_MAPLE_TREE_H
+/*
+ * Maple tree - a B-tree of non-overlapping ranges
+ *
+ * Each entry covers an inclusive range [first, last] of unsigned long
+ * indices, and no two entries overlap.  Lookups walk the tree under
+ * rcu_read_lock() only.  Writers are serialised by ma_lock and never modify
+ * a node readers can see: the nodes on the path to the change are copied,
+ * the new path is published with a single pointer store, and the old nodes
+ * are freed after a grace period.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/gfp.h>
+#include <linux/kernel.h>
+#include <linux/rcupdate.h>
+#include <linux/spinlock.h>
+
+/*
+ * A node is a sorted array of ranges.  In a leaf, slot[i] is the entry for
+ * [min[i], max[i]]; in an internal node it is the child holding every entry
+ * in that range.  Gaps between ranges are simply not covered by any slot.
+ */
+#define MAPLE_NODE_SLOTS	16
+
+struct maple_node {
+	union {
+		struct rcu_head		rcu;
+		struct maple_node	*next_free;
+	};
+	unsigned char		nr;
+	bool			leaf;
+	unsigned long		min[MAPLE_NODE_SLOTS];
+	unsigned long		max[MAPLE_NODE_SLOTS];
+	void __rcu		*slot[MAPLE_NODE_SLOTS];
+};
+
+struct maple_tree {
+	spinlock_t		ma_lock;
+	unsigned int		ma_height;
+	struct maple_node __rcu	*ma_root;
+};
+
+#define MTREE_INIT(name) {					\
+	.ma_lock = __SPIN_LOCK_UNLOCKED(name.ma_lock),		\
+	.ma_height = 0,						\
+	.ma_root = NULL,					\
+}
+
+#define DEFINE_MTREE(name) struct maple_tree name = MTREE_INIT(name)
+
+static inline void mtree_init(struct maple_tree *mt)
+{
+	spin_lock_init(&mt->ma_lock);
+	mt->ma_height = 0;
+	RCU_INIT_POINTER(mt->ma_root, NULL);
+}
+
+static inline bool mtree_empty(const struct maple_tree *mt)
+{
+	return rcu_access_pointer(mt->ma_root) == NULL;
+}
+
+void *mtree_load(struct maple_tree *mt, unsigned long index);
+void *mt_find(struct maple_tree *mt, unsigned long *index, unsigned long max);
+void *mt_find_after(struct maple_tree *mt, unsigned long *index,
+		    unsigned long max);
+int mtree_insert_range(struct maple_tree *mt, unsigned long first,
+		       unsigned long last, void *entry, gfp_t gfp);
+void *mtree_erase(struct maple_tree *mt, unsigned long index);
+void mtree_destroy(struct maple_tree *mt);
+void maple_tree_init(void);
+
+static inline int mtree_insert(struct maple_tree *mt, unsigned long index,
+			       void *entry, gfp_t gfp)
+{
+	return mtree_insert_range(mt, index, index, entry, gfp);
+}
+
+/**
+ * mt_for_each - iterate over the entries of a maple tree
+ * @mt: maple tree
+ * @entry: current entry
+ * @index: unsigned long, index to start at, then first index of @entry
+ * @max: last index to look at
+ *
+ * Each step is a lookup from the root under RCU, so other entries may be
+ * inserted or erased while the loop runs.
+ */
+#define mt_for_each(mt, entry, index, max)				\
+	for (entry = mt_find(mt, &(index), max);			\
+	     entry;							\
+	     entry = mt_find_after(mt, &(index), max))
+
+#endif /* _LINUX_MAPLE_TREE_H */
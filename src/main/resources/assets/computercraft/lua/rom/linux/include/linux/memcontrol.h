@@ -107,6 +107,9 @@ struct mem_cgroup_stat_cpu {
 	unsigned long events[MEMCG_NR_EVENTS];
 	unsigned long nr_page_events;
 	unsigned long targets[MEM_CGROUP_NTARGETS];
+	/* values of count[] and events[] at the last stats flush */
+	long count_flushed[MEMCG_NR_STAT];
+	unsigned long events_flushed[MEMCG_NR_EVENTS];
 };
 
 struct mem_cgroup_reclaim_iter {
@@ -194,6 +197,11 @@ struct mem_cgroup {
 
 	unsigned long soft_limit;
 
+	/* Proactive reclaim through "memory.reclaim", in pages */
+	unsigned long reclaim_last_requested;
+	unsigned long reclaim_last_reclaimed;
+	atomic_long_t reclaim_total;
+
 	/* vmpressure notifications */
 	struct vmpressure vmpressure;
 
@@ -243,6 +251,15 @@ struct mem_cgroup {
 	 */
 	struct mem_cgroup_stat_cpu __percpu *stat;
 
+	/*
+	 * Totals of the percpu counters as of the last flush, for this
+	 * memcg alone and for its whole subtree.
+	 */
+	long			stat_local[MEMCG_NR_STAT];
+	long			stat_tree[MEMCG_NR_STAT];
+	unsigned long		events_local[MEMCG_NR_EVENTS];
+	unsigned long		events_tree[MEMCG_NR_EVENTS];
+
 	unsigned long		socket_pressure;
 
 	/* Legacy tcp memory accounting */
@@ -8,6 +8,7 @@
 #include <linux/spinlock.h>
 #include <linux/rbtree.h>
 #include <linux/rwsem.h>
+#include <linux/seqlock.h>
 #include <linux/completion.h>
 #include <linux/cpumask.h>
 #include <linux/uprobes.h>
@@ -23,6 +24,7 @@
 
 struct address_space;
 struct mem_cgroup;
+struct futex_hash_bucket;
 
 /*
  * Each physical page in the system has a struct page associated with
@@ -335,6 +337,11 @@ struct vm_area_struct {
 	struct file * vm_file;		/* File we map to (can be NULL). */
 	void * vm_private_data;		/* was vm_pte (shared mem) */
 
+#ifdef CONFIG_SWAP
+	/* Last swap fault address, window and hits, see swap_state.c */
+	atomic_long_t swap_readahead_info;
+#endif
+
 #ifndef CONFIG_MMU
 	struct vm_region *vm_region;	/* NOMMU mapping region */
 #endif
@@ -342,6 +349,15 @@ struct vm_area_struct {
 	struct mempolicy *vm_policy;	/* NUMA policy for the VMA */
 #endif
 	struct vm_userfaultfd_ctx vm_userfaultfd_ctx;
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	/*
+	 * Bumped around changes a speculative page fault must not race
+	 * with; see vm_write_begin() and handle_speculative_fault().
+	 */
+	seqcount_t vm_sequence;
+	/* References held by speculative faults, on top of the mm's own */
+	atomic_t vm_ref_count;
+#endif
 };
 
 struct core_thread {
@@ -359,6 +375,9 @@ struct kioctx_table;
 struct mm_struct {
 	struct vm_area_struct *mmap;		/* list of VMAs */
 	struct rb_root mm_rb;
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	rwlock_t mm_rb_lock;			/* Protects mm_rb against get_vma() */
+#endif
 	u32 vmacache_seqnum;                   /* per-thread vmacache */
 #ifdef CONFIG_MMU
 	unsigned long (*get_unmapped_area) (struct file *filp,
@@ -396,6 +415,9 @@ struct mm_struct {
 	 */
 	atomic_t mm_count;
 
+#ifdef CONFIG_MEMBARRIER
+	atomic_t membarrier_state;		/* MEMBARRIER_STATE_* flags */
+#endif
 	atomic_long_t nr_ptes;			/* PTE page table pages */
 #if CONFIG_PGTABLE_LEVELS > 2
 	atomic_long_t nr_pmds;			/* PMD page table pages */
@@ -409,6 +431,9 @@ struct mm_struct {
 						 * together off init_mm.mmlist, and are protected
 						 * by mmlist_lock
 						 */
+#ifdef CONFIG_LRU_GEN
+	struct list_head lru_gen_list;	/* Walked by multi-gen LRU aging */
+#endif
 
 
 	unsigned long hiwater_rss;	/* High-watermark of RSS usage */
@@ -498,12 +523,30 @@ struct mm_struct {
 	struct uprobes_state uprobes_state;
 #ifdef CONFIG_HUGETLB_PAGE
 	atomic_long_t hugetlb_usage;
+#endif
+#ifdef CONFIG_FUTEX
+	/* Hash table for private futexes set up by PR_FUTEX_HASH, or NULL */
+	struct futex_hash_bucket *futex_queues;
+	unsigned long futex_hashsize;
 #endif
 	struct work_struct async_put_work;
 };
 
 extern struct mm_struct init_mm;
 
+#ifdef CONFIG_LRU_GEN
+void lru_gen_add_mm(struct mm_struct *mm);
+void lru_gen_del_mm(struct mm_struct *mm);
+#else
+static inline void lru_gen_add_mm(struct mm_struct *mm)
+{
+}
+
+static inline void lru_gen_del_mm(struct mm_struct *mm)
+{
+}
+#endif
+
 static inline void mm_init_cpumask(struct mm_struct *mm)
 {
 #ifdef CONFIG_CPUMASK_OFFSTACK
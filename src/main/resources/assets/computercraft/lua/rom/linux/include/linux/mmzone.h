@@ -163,6 +163,8 @@ enum node_stat_item {
 	NR_SHMEM,		/* shmem pages (included tmpfs/GEM pages) */
 	NR_SHMEM_THPS,
 	NR_SHMEM_PMDMAPPED,
+	NR_FILE_THPS,
+	NR_FILE_PMDMAPPED,
 	NR_ANON_THPS,
 	NR_UNSTABLE_NFS,	/* NFS unstable pages */
 	NR_VMSCAN_WRITE,
@@ -208,6 +210,8 @@ static inline int is_active_lru(enum lru_list lru)
 	return (lru == LRU_ACTIVE_ANON || lru == LRU_ACTIVE_FILE);
 }
 
+#define ANON_AND_FILE 2
+
 struct zone_reclaim_stat {
 	/*
 	 * The pageout code in vmscan.c keeps track of how many of the
@@ -221,11 +225,54 @@ struct zone_reclaim_stat {
 	unsigned long		recent_scanned[2];
 };
 
+#ifdef CONFIG_LRU_GEN
+/*
+ * The multi-gen LRU sorts evictable pages into generations instead of an
+ * active and an inactive list. A page's generation is the sequence number
+ * of the aging pass that last saw it accessed, modulo MAX_NR_GENS, and is
+ * kept (plus one) in the LRU_GEN field of page->flags. The aging creates
+ * a new youngest generation by incrementing max_seq after scanning page
+ * tables for accessed bits; the eviction reclaims from the oldest
+ * generation of each type and increments min_seq once it is empty.
+ *
+ * The two youngest generations are accounted as the active list and the
+ * rest as the inactive list, so NR_ACTIVE_* and NR_INACTIVE_* and the
+ * workingset refault distance keep their meaning.
+ *
+ * Pages promoted by the aging only have their generation updated in
+ * page->flags; they stay on the list they were on until the eviction
+ * reaches them and moves them. nr_pages is kept by generation in
+ * page->flags, not by list.
+ */
+#define MIN_NR_GENS		2
+#define MAX_NR_GENS		4
+
+#if MAX_NR_GENS + 1 > (1 << LRU_GEN_WIDTH)
+#error LRU_GEN_WIDTH is too small for MAX_NR_GENS
+#endif
+
+struct lru_gen_struct {
+	/* the youngest generation, incremented by the aging */
+	unsigned long max_seq;
+	/* the oldest generation of each type, incremented by the eviction */
+	unsigned long min_seq[ANON_AND_FILE];
+	/* the lists of each generation, type and zone */
+	struct list_head lists[MAX_NR_GENS][ANON_AND_FILE][MAX_NR_ZONES];
+	/* the number of pages per generation, type and zone */
+	long nr_pages[MAX_NR_GENS][ANON_AND_FILE][MAX_NR_ZONES];
+	/* a reclaimer is walking page tables on behalf of this lruvec */
+	bool aging;
+};
+#endif /* CONFIG_LRU_GEN */
+
 struct lruvec {
 	struct list_head		lists[NR_LRU_LISTS];
 	struct zone_reclaim_stat	reclaim_stat;
 	/* Evictions & activations on the inactive file list */
 	atomic_long_t			inactive_age;
+#ifdef CONFIG_LRU_GEN
+	struct lru_gen_struct		lrugen;
+#endif
 #ifdef CONFIG_MEMCG
 	struct pglist_data *pgdat;
 #endif
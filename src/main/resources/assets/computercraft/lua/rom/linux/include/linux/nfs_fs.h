@@ -89,8 +89,14 @@ struct nfs_open_dir_context {
 	__u64 dir_cookie;
 	__u64 dup_cookie;
 	signed char duped;
+	unsigned long flags;
 };
 
+/*
+ * Bit offsets in nfs_open_dir_context->flags
+ */
+#define NFS_ODC_PREFETCH	(0)		/* next readdir page being fetched */
+
 /*
  * NFSv4 delegation
  */
@@ -207,6 +213,7 @@ struct nfs_inode {
 #define NFS_INO_LAYOUTCOMMITTING (10)		/* layoutcommit inflight */
 #define NFS_INO_LAYOUTSTATS	(11)		/* layoutstats inflight */
 #define NFS_INO_ODIRECT		(12)		/* I/O setting is O_DIRECT */
+#define NFS_INO_RDPLUS_ATTRS	(13)		/* attrs are from readdirplus */
 
 static inline struct nfs_inode *NFS_I(const struct inode *inode)
 {
@@ -543,6 +543,7 @@ struct swevent_hlist {
 #define PERF_ATTACH_TASK_DATA	0x08
 
 struct perf_cgroup;
+struct perf_cgroup_node;
 struct ring_buffer;
 
 struct pmu_event_list {
@@ -715,6 +716,12 @@ struct perf_event {
 #ifdef CONFIG_CGROUP_PERF
 	struct perf_cgroup		*cgrp; /* cgroup event is attach to */
 	int				cgrp_defer_enabled;
+
+	/* cgroups sharing this cpu-wide event, sorted by css */
+	struct perf_cgroup_node		*cgrp_nodes;
+	int				nr_cgrp_nodes;
+	struct list_head		cgrp_node_entry;
+	u64				cgrp_node_count;
 #endif
 
 	struct list_head		sb_list;
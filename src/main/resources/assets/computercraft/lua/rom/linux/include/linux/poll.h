@@ -97,6 +97,20 @@ extern void poll_freewait(struct poll_wqueues *pwq);
 extern int poll_schedule_timeout(struct poll_wqueues *pwq, int state,
 				 ktime_t *expires, unsigned long slack);
 extern u64 select_estimate_accuracy(struct timespec64 *tv);
+extern void exit_poll_cache(struct task_struct *tsk);
+extern void poll_cache_release_file(struct file *file);
+
+/* Called from __fput(), to unhook the poll() caches waiting on @file */
+static inline void poll_cache_release(struct file *file)
+{
+	/*
+	 * Nothing links the file to a cache any more once its last
+	 * reference is gone, so an empty list can be trusted unlocked.
+	 */
+	if (likely(list_empty(&file->f_poll_cache_links)))
+		return;
+	poll_cache_release_file(file);
+}
 
 #define MAX_INT64_SECONDS (((s64)(~((u64)0)>>1)/HZ)-1)
 
@@ -84,6 +84,17 @@ static inline struct proc_dir_entry *proc_net_mkdir(
 	return proc_mkdir_data(name, 0, parent, net);
 }
 
+struct mm_struct;
+
+#ifdef CONFIG_PROC_PAGE_MONITOR
+extern void task_mem_pss(struct mm_struct *mm, u64 *pss, u64 *swap_pss);
+#else
+static inline void task_mem_pss(struct mm_struct *mm, u64 *pss, u64 *swap_pss)
+{
+	*pss = *swap_pss = 0;
+}
+#endif
+
 struct ns_common;
 int open_related_ns(struct ns_common *ns,
 		   struct ns_common *(*get_ns)(struct ns_common *ns));
@@ -117,6 +117,8 @@ struct rhashtable;
  * @insecure_elasticity: Set to true to disable chain length checks
  * @automatic_shrinking: Enable automatic shrinking of tables
  * @locks_mul: Number of bucket locks to allocate per cpu (default: 128)
+ * @rehash_assist: Buckets an insert migrates while a rehash is pending
+ *	(default: 0, leave it all to the deferred worker)
  * @hashfn: Hash function (default: jhash2 if !(key_len % 4), or jhash)
  * @obj_hashfn: Function to hash object
  * @obj_cmpfn: Function to compare key with object
@@ -133,6 +135,7 @@ struct rhashtable_params {
 	bool			insecure_elasticity;
 	bool			automatic_shrinking;
 	size_t			locks_mul;
+	unsigned int		rehash_assist;
 	rht_hashfn_t		hashfn;
 	rht_obj_hashfn_t	obj_hashfn;
 	rht_obj_cmpfn_t		obj_cmpfn;
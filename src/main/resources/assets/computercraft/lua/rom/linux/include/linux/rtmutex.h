@@ -15,6 +15,7 @@
 #include <linux/linkage.h>
 #include <linux/rbtree.h>
 #include <linux/spinlock_types.h>
+#include <linux/osq_lock.h>
 
 extern int max_lock_depth; /* for sysctl */
 
@@ -25,12 +26,16 @@ extern int max_lock_depth; /* for sysctl */
  * @waiters:	rbtree root to enqueue waiters in priority order
  * @waiters_leftmost: top waiter
  * @owner:	the mutex owner
+ * @osq:	queue of tasks spinning on a running owner before they block
  */
 struct rt_mutex {
 	raw_spinlock_t		wait_lock;
 	struct rb_root          waiters;
 	struct rb_node          *waiters_leftmost;
 	struct task_struct	*owner;
+#ifdef CONFIG_RT_MUTEX_SPIN_ON_OWNER
+	struct optimistic_spin_queue osq;
+#endif
 #ifdef CONFIG_DEBUG_RT_MUTEXES
 	int			save_state;
 	const char 		*name, *file;
@@ -66,10 +71,17 @@ struct hrtimer_sleeper;
 # define rt_mutex_debug_task_free(t)			do { } while (0)
 #endif
 
+#ifdef CONFIG_RT_MUTEX_SPIN_ON_OWNER
+# define __RT_MUTEX_OSQ_INITIALIZER	, .osq = OSQ_LOCK_UNLOCKED
+#else
+# define __RT_MUTEX_OSQ_INITIALIZER
+#endif
+
 #define __RT_MUTEX_INITIALIZER(mutexname) \
 	{ .wait_lock = __RAW_SPIN_LOCK_UNLOCKED(mutexname.wait_lock) \
 	, .waiters = RB_ROOT \
 	, .owner = NULL \
+	__RT_MUTEX_OSQ_INITIALIZER \
 	__DEBUG_RT_MUTEX_INITIALIZER(mutexname)}
 
 #define DEFINE_RT_MUTEX(mutexname) \
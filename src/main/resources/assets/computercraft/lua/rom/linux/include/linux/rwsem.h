@@ -30,6 +30,11 @@ struct rw_semaphore {
 	atomic_long_t count;
 	struct list_head wait_list;
 	raw_spinlock_t wait_lock;
+	/*
+	 * Set when the waiter at the head of wait_list has waited too long:
+	 * nobody else may take the lock before it then.
+	 */
+	bool handoff;
 #ifdef CONFIG_RWSEM_SPIN_ON_OWNER
 	struct optimistic_spin_queue osq; /* spinner MCS lock */
 	/*
@@ -36,6 +36,14 @@ struct sbitmap_word {
 	 * @depth: Number of bits being used in @word.
 	 */
 	unsigned long depth;
+
+	/**
+	 * @cleared: Bits freed with sbitmap_deferred_clear_bit() that are
+	 * still set in @word.  They are folded back into @word only once the
+	 * allocator finds it full, so freeing doesn't write the cacheline
+	 * allocators are working on.
+	 */
+	unsigned long cleared ____cacheline_aligned_in_smp;
 } ____cacheline_aligned_in_smp;
 
 /**
@@ -229,15 +237,17 @@ static inline void sbitmap_for_each_set(struct sbitmap *sb, sb_for_each_fn fn,
 
 	for (i = 0; i < sb->map_nr; i++) {
 		struct sbitmap_word *word = &sb->map[i];
+		unsigned long val;
 		unsigned int off, nr;
 
-		if (!word->word)
+		val = READ_ONCE(word->word) & ~READ_ONCE(word->cleared);
+		if (!val)
 			continue;
 
 		nr = 0;
 		off = i << sb->shift;
 		while (1) {
-			nr = find_next_bit(&word->word, word->depth, nr);
+			nr = find_next_bit(&val, word->depth, nr);
 			if (nr >= word->depth)
 				break;
 
@@ -270,6 +280,23 @@ static inline void sbitmap_clear_bit(struct sbitmap *sb, unsigned int bitnr)
 	clear_bit(SB_NR_TO_BIT(sb, bitnr), __sbitmap_word(sb, bitnr));
 }
 
+/**
+ * sbitmap_deferred_clear_bit() - Free a bit without touching the bitmap word.
+ * @sb: Bitmap the bit belongs to.
+ * @bitnr: Bit to free.
+ *
+ * The bit is only marked in the word's cleared mask; it is reclaimed the next
+ * time an allocation finds the word full.  Until then sbitmap_test_bit() still
+ * reports it as set, while the iteration and weight helpers treat it as free.
+ */
+static inline void sbitmap_deferred_clear_bit(struct sbitmap *sb,
+					      unsigned int bitnr)
+{
+	unsigned long *addr = &sb->map[SB_NR_TO_INDEX(sb, bitnr)].cleared;
+
+	set_bit(SB_NR_TO_BIT(sb, bitnr), addr);
+}
+
 static inline int sbitmap_test_bit(struct sbitmap *sb, unsigned int bitnr)
 {
 	return test_bit(SB_NR_TO_BIT(sb, bitnr), __sbitmap_word(sb, bitnr));
@@ -357,6 +384,18 @@ int __sbitmap_queue_get(struct sbitmap_queue *sbq);
 int __sbitmap_queue_get_shallow(struct sbitmap_queue *sbq,
 				unsigned int shallow_depth);
 
+/**
+ * __sbitmap_queue_get_batch() - Try to allocate a run of free bits from a
+ * single word of a &struct sbitmap_queue, with preemption already disabled.
+ * @sbq: Bitmap queue to allocate from.
+ * @nr_tags: The maximum number of bits to allocate, at most %BITS_PER_LONG.
+ * @offset: Output parameter; bit number of the lowest bit of the mask.
+ *
+ * Return: Mask of the bits allocated relative to @offset, 0 if none could be.
+ */
+unsigned long __sbitmap_queue_get_batch(struct sbitmap_queue *sbq, int nr_tags,
+					unsigned int *offset);
+
 /**
  * sbitmap_queue_get() - Try to allocate a free bit from a &struct
  * sbitmap_queue.
@@ -406,10 +445,26 @@ static inline int sbitmap_queue_get_shallow(struct sbitmap_queue *sbq,
  * @sbq: Bitmap to free from.
  * @nr: Bit number to free.
  * @cpu: CPU the bit was allocated on.
+ *
+ * The bit is freed with sbitmap_deferred_clear_bit().
  */
 void sbitmap_queue_clear(struct sbitmap_queue *sbq, unsigned int nr,
 			 unsigned int cpu);
 
+/**
+ * sbitmap_queue_clear_batch() - Free a batch of allocated bits and wake up
+ * waiters on a &struct sbitmap_queue.
+ * @sbq: Bitmap to free from.
+ * @offset: Offset to subtract from each entry of @tags to get the bit number.
+ * @tags: Array of bits to free. Bits of the same word that are adjacent in
+ *        @tags are freed together.
+ * @nr_tags: Number of entries in @tags.
+ *
+ * Unlike sbitmap_queue_clear(), this doesn't update the allocation hints.
+ */
+void sbitmap_queue_clear_batch(struct sbitmap_queue *sbq, int offset,
+			       int *tags, int nr_tags);
+
 static inline int sbq_index_inc(int index)
 {
 	return (index + 1) & (SBQ_WAIT_QUEUES - 1);
@@ -457,6 +457,31 @@ struct sched_dl_entity {
 	struct hrtimer			dl_timer;
 };
 
+enum uclamp_id {
+	UCLAMP_MIN = 0,	/* Minimum utilization */
+	UCLAMP_MAX,	/* Maximum utilization */
+	UCLAMP_CNT
+};
+
+#ifdef CONFIG_UCLAMP_TASK
+/* Number of utilization clamp buckets per rq and clamp index */
+#define UCLAMP_BUCKETS CONFIG_UCLAMP_BUCKETS_COUNT
+
+/*
+ * Utilization clamp of a task, in SCHED_CAPACITY_SCALE units.
+ *
+ * @bucket_id caches the rq bucket @value is counted in, @active tells that
+ * the task is currently counted there and @user_defined that @value was
+ * requested by user space rather than being the default.
+ */
+struct uclamp_se {
+	unsigned int value		: SCHED_FIXEDPOINT_SHIFT + 1;
+	unsigned int bucket_id		: 5;
+	unsigned int active		: 1;
+	unsigned int user_defined	: 1;
+};
+#endif /* CONFIG_UCLAMP_TASK */
+
 union rcu_special {
 	struct {
 		u8			blocked;
@@ -524,6 +549,18 @@ struct task_struct {
 #endif
 	struct sched_dl_entity		dl;
 
+#ifdef CONFIG_SCHED_CORE
+	/* Tasks may only share a core with tasks of the same cookie: */
+	unsigned long			core_cookie;
+#endif
+
+#ifdef CONFIG_UCLAMP_TASK
+	/* Clamp values requested for the task: */
+	struct uclamp_se		uclamp_req[UCLAMP_CNT];
+	/* Effective clamp values, restricted by the task group: */
+	struct uclamp_se		uclamp[UCLAMP_CNT];
+#endif
+
 #ifdef CONFIG_PREEMPT_NOTIFIERS
 	/* List of struct preempt_notifier: */
 	struct hlist_head		preempt_notifiers;
@@ -584,6 +621,9 @@ struct task_struct {
 	unsigned			sched_contributes_to_load:1;
 	unsigned			sched_migrated:1;
 	unsigned			sched_remote_wakeup:1;
+#ifdef CONFIG_PSI
+	unsigned			sched_psi_wake_requeue:1;
+#endif
 	/* Force alignment to the next boundary: */
 	unsigned			:0;
 
@@ -592,6 +632,10 @@ struct task_struct {
 	/* Bit to tell LSMs we're in execve(): */
 	unsigned			in_execve:1;
 	unsigned			in_iowait:1;
+#ifdef CONFIG_PSI
+	/* Stalled due to lack of memory: */
+	unsigned			in_memstall:1;
+#endif
 #ifndef TIF_RESTORE_SIGMASK
 	unsigned			restore_sigmask:1;
 #endif
@@ -739,6 +783,12 @@ struct task_struct {
 	/* Open file information: */
 	struct files_struct		*files;
 
+	/* Persistent poll() interest set, see PR_SET_POLL_CACHE: */
+	struct poll_cache		*poll_cache;
+
+	/* Pinned files of a shared fd table, see PR_SET_FD_CACHE: */
+	struct fd_cache			*fd_cache;
+
 	/* Namespaces: */
 	struct nsproxy			*nsproxy;
 
@@ -837,6 +887,11 @@ struct task_struct {
 
 	struct io_context		*io_context;
 
+#ifdef CONFIG_PSI
+	/* Pressure stall state, TSK_* flags, protected by the rq lock: */
+	unsigned int			psi_flags;
+#endif
+
 	/* Ptrace state: */
 	unsigned long			ptrace_message;
 	siginfo_t			*last_siginfo;
@@ -1263,6 +1318,8 @@ extern struct pid *cad_pid;
 #define PFA_SPREAD_PAGE			1	/* Spread page cache over cpuset */
 #define PFA_SPREAD_SLAB			2	/* Spread some slab caches over cpuset */
 #define PFA_LMK_WAITING			3	/* Lowmemorykiller is waiting */
+#define PFA_POLL_CACHE			4	/* Keep poll() interest sets */
+#define PFA_FD_CACHE			5	/* Pin files looked up by fdget() */
 
 
 #define TASK_PFA_TEST(name, func)					\
@@ -1291,6 +1348,14 @@ TASK_PFA_CLEAR(SPREAD_SLAB, spread_slab)
 TASK_PFA_TEST(LMK_WAITING, lmk_waiting)
 TASK_PFA_SET(LMK_WAITING, lmk_waiting)
 
+TASK_PFA_TEST(POLL_CACHE, poll_cache)
+TASK_PFA_SET(POLL_CACHE, poll_cache)
+TASK_PFA_CLEAR(POLL_CACHE, poll_cache)
+
+TASK_PFA_TEST(FD_CACHE, fd_cache)
+TASK_PFA_SET(FD_CACHE, fd_cache)
+TASK_PFA_CLEAR(FD_CACHE, fd_cache)
+
 static inline void
 current_restore_flags(unsigned long orig_flags, unsigned long flags)
 {
@@ -1566,6 +1631,28 @@ static inline void set_task_cpu(struct task_struct *p, unsigned int cpu)
 extern long sched_setaffinity(pid_t pid, const struct cpumask *new_mask);
 extern long sched_getaffinity(pid_t pid, struct cpumask *mask);
 
+#ifdef CONFIG_UCLAMP_TASK
+extern int sched_uclamp_prctl(unsigned long op, pid_t pid,
+			      unsigned long min, unsigned long max);
+#else
+static inline int sched_uclamp_prctl(unsigned long op, pid_t pid,
+				     unsigned long min, unsigned long max)
+{
+	return -EINVAL;
+}
+#endif
+
+#ifdef CONFIG_SCHED_CORE
+extern int sched_core_share_pid(unsigned long cmd, pid_t pid,
+				unsigned long scope, unsigned long uaddr);
+#else
+static inline int sched_core_share_pid(unsigned long cmd, pid_t pid,
+				       unsigned long scope, unsigned long uaddr)
+{
+	return -EINVAL;
+}
+#endif
+
 #ifndef TASK_SIZE_OF
 #define TASK_SIZE_OF(tsk)	TASK_SIZE
 #endif
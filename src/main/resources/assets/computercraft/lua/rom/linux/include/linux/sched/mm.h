@@ -171,4 +171,27 @@ static inline void memalloc_noio_restore(unsigned int flags)
 	current->flags = (current->flags & ~PF_MEMALLOC_NOIO) | flags;
 }
 
+#ifdef CONFIG_MEMBARRIER
+enum {
+	MEMBARRIER_STATE_PRIVATE_EXPEDITED	= (1U << 0),
+};
+
+/*
+ * MEMBARRIER_CMD_PRIVATE_EXPEDITED only IPIs the CPUs whose rq->curr uses
+ * the caller's mm, so switching into or out of a registered mm needs a
+ * full barrier between the rq->curr update and the user-space accesses
+ * on the other side of it.  Unregistered mms don't pay for it.
+ */
+static inline void membarrier_mm_sync(struct mm_struct *mm)
+{
+	if (mm && unlikely(atomic_read(&mm->membarrier_state) &
+			   MEMBARRIER_STATE_PRIVATE_EXPEDITED))
+		smp_mb();
+}
+#else
+static inline void membarrier_mm_sync(struct mm_struct *mm)
+{
+}
+#endif
+
 #endif /* _LINUX_SCHED_MM_H */
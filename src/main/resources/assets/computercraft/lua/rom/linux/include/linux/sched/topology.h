@@ -70,9 +70,20 @@ struct sched_group;
 struct sched_domain_shared {
 	atomic_t	ref;
 	atomic_t	nr_busy_cpus;
-	int		has_idle_cores;
+	/*
+	 * CPUs of the cores whose SMT siblings are all idle, set on idle
+	 * entry and cleared on idle exit; may be stale, so users recheck.
+	 *
+	 * NOTE: this field is variable length, like sched_domain::span.
+	 */
+	unsigned long	idle_cores_span[0];
 };
 
+static inline struct cpumask *sds_idle_cores(struct sched_domain_shared *sds)
+{
+	return to_cpumask(sds->idle_cores_span);
+}
+
 struct sched_domain {
 	/* These fields must be setup */
 	struct sched_domain *parent;	/* top domain must be null terminated */
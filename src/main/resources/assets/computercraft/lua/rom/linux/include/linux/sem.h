@@ -22,6 +22,13 @@ struct sem_array {
 	int			sem_nsems;	/* no. of semaphores in array */
 	int			complex_count;	/* pending complex operations */
 	unsigned int		use_global_lock;/* >0: global lock required */
+	unsigned int		update_gen;	/* see do_smart_update() */
+
+	/* contention statistics, shown in /proc/sysvipc/sem */
+	atomic_long_t		global_contended; /* waited for sem_perm.lock */
+	atomic_long_t		sem_contended;	/* waited for a sem->lock */
+	atomic_long_t		sleeps;		/* semops that had to sleep */
+	atomic_long_t		retries_skipped; /* queued ops not retried */
 };
 
 #ifdef CONFIG_SYSVIPC
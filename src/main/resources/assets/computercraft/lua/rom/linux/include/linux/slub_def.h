@@ -35,6 +35,9 @@ enum stat_item {
 	CPU_PARTIAL_FREE,	/* Refill cpu partial on free */
 	CPU_PARTIAL_NODE,	/* Refill cpu partial from node partial */
 	CPU_PARTIAL_DRAIN,	/* Drain cpu partial to node partial */
+	ALLOC_MAGAZINE,		/* Allocation from cpu magazine */
+	FREE_MAGAZINE,		/* Remote free to cpu magazine */
+	MAGAZINE_FLUSH,		/* Cpu magazine returned to its slabs */
 	NR_SLUB_STAT_ITEMS };
 
 struct kmem_cache_cpu {
@@ -47,6 +50,19 @@ struct kmem_cache_cpu {
 #endif
 };
 
+#ifdef CONFIG_SLUB_MAGAZINE
+#define SLUB_MAGAZINE_SIZE	32
+
+/*
+ * Objects freed on this cpu that did not belong to its cpu slab.  Only
+ * accessed with interrupts disabled.
+ */
+struct kmem_cache_magazine {
+	unsigned int count;
+	void *objects[SLUB_MAGAZINE_SIZE];
+};
+#endif
+
 /*
  * Word size structure that can be atomically updated or read and that
  * contains both the order and the number of objects that a slab of the
@@ -61,6 +77,9 @@ struct kmem_cache_order_objects {
  */
 struct kmem_cache {
 	struct kmem_cache_cpu __percpu *cpu_slab;
+#ifdef CONFIG_SLUB_MAGAZINE
+	struct kmem_cache_magazine __percpu *cpu_mag;
+#endif
 	/* Used for retriving partial slabs etc */
 	unsigned long flags;
 	unsigned long min_partial;
@@ -18,15 +18,26 @@
 #include <linux/sunrpc/svcauth.h>
 #include <linux/wait.h>
 #include <linux/mm.h>
+#include <linux/workqueue.h>
 
 /* statistics for svc_pool structures */
 struct svc_pool_stats {
 	atomic_long_t	packets;
-	unsigned long	sockets_queued;
+	atomic_long_t	sockets_queued;
 	atomic_long_t	threads_woken;
 	atomic_long_t	threads_timedout;
 };
 
+/*
+ * Transports ready for service.  Each pool has one of these per CPU: a
+ * transport is queued on the CPU that enqueued it, and threads look at
+ * the queue of the CPU they run on before taking work from the others.
+ */
+struct svc_xprt_queue {
+	spinlock_t		xq_lock;	/* protects xq_sockets */
+	struct list_head	xq_sockets;	/* pending sockets */
+};
+
 /*
  *
  * RPC service thread pool.
@@ -39,13 +50,15 @@ struct svc_pool_stats {
  */
 struct svc_pool {
 	unsigned int		sp_id;	    	/* pool id; also node id on NUMA */
-	spinlock_t		sp_lock;	/* protects all fields */
-	struct list_head	sp_sockets;	/* pending sockets */
+	spinlock_t		sp_lock;	/* protects the thread fields */
+	struct svc_xprt_queue __percpu *sp_queues; /* pending sockets */
+	atomic_t		sp_nqueued;	/* # of pending sockets */
 	unsigned int		sp_nrthreads;	/* # of threads in pool */
 	struct list_head	sp_all_threads;	/* all server threads */
 	struct svc_pool_stats	sp_stats;	/* statistics on pool operation */
 #define	SP_TASK_PENDING		(0)		/* still work to do even if no
 						 * xprt is queued. */
+#define	SP_GROW			(1)		/* ran out of idle threads */
 	unsigned long		sp_flags;
 } ____cacheline_aligned_in_smp;
 
@@ -64,6 +77,9 @@ struct svc_serv_ops {
 	/* set up thread (or whatever) execution context */
 	int		(*svo_setup)(struct svc_serv *, struct svc_pool *, int);
 
+	/* optional: start another thread in a pool short of idle ones */
+	void		(*svo_grow)(struct svc_serv *, struct svc_pool *);
+
 	/* optional module to count when adding threads (pooled svcs only) */
 	struct module	*svo_module;
 };
@@ -86,6 +102,10 @@ struct svc_serv {
 	unsigned int		sv_maxconn;	/* max connections allowed or
 						 * '0' causing max to be based
 						 * on number of threads. */
+	unsigned int		sv_maxthreads;	/* limit for svo_grow, '0'
+						 * keeps the thread count
+						 * fixed. */
+	struct work_struct	sv_grow_work;	/* calls svo_grow */
 
 	unsigned int		sv_max_payload;	/* datagram payload size */
 	unsigned int		sv_max_mesg;	/* max_payload + 1 page for overheads */
@@ -269,6 +289,8 @@ struct svc_rqst {
 #define	RQ_VICTIM	(5)			/* about to be shut down */
 #define	RQ_BUSY		(6)			/* request is busy */
 #define	RQ_DATA		(7)			/* request has data */
+#define	RQ_DYNAMIC	(8)			/* started by svo_grow, exits
+						 * when idle */
 	unsigned long		rq_flags;	/* flags field */
 
 	void *			rq_argp;	/* decoded arguments */
@@ -474,6 +496,7 @@ void		   svc_pool_map_put(void);
 struct svc_serv *  svc_create_pooled(struct svc_program *, unsigned int,
 			struct svc_serv_ops *);
 int		   svc_set_num_threads(struct svc_serv *, struct svc_pool *, int);
+int		   svc_pool_add_thread(struct svc_serv *, struct svc_pool *);
 int		   svc_pool_stats_open(struct svc_serv *serv, struct file *file);
 void		   svc_destroy(struct svc_serv *);
 void		   svc_shutdown_net(struct svc_serv *, struct net *);
@@ -2,6 +2,7 @@
 #define __LINUX_SWIOTLB_H
 
 #include <linux/dma-direction.h>
+#include <linux/errno.h>
 #include <linux/init.h>
 #include <linux/types.h>
 
@@ -115,9 +116,16 @@ swiotlb_dma_supported(struct device *hwdev, u64 mask);
 #ifdef CONFIG_SWIOTLB
 extern void __init swiotlb_free(void);
 unsigned int swiotlb_max_segment(void);
+int swiotlb_dev_pool_create(struct device *dev, size_t size);
+void swiotlb_dev_pool_destroy(struct device *dev);
 #else
 static inline void swiotlb_free(void) { }
 static inline unsigned int swiotlb_max_segment(void) { return 0; }
+static inline int swiotlb_dev_pool_create(struct device *dev, size_t size)
+{
+	return -ENODEV;
+}
+static inline void swiotlb_dev_pool_destroy(struct device *dev) { }
 #endif
 
 extern void swiotlb_print_info(void);
@@ -189,8 +189,12 @@ struct tcp_sock {
 	u32	last_oow_ack_time;  /* timestamp of last out-of-window ACK */
 
 	u32	tsoffset;	/* timestamp offset */
+	u64	tcp_wstamp_ns;	/* departure time of next sent data packet,
+				 * for congestion controls with TCP_CONG_EDT
+				 */
 
 	struct list_head tsq_node; /* anchor in tsq_tasklet.head list */
+	struct hrtimer	pacing_timer;	/* internal pacing, see tcp_pace_kick() */
 
 	/* Data for direct copy to user */
 	struct {
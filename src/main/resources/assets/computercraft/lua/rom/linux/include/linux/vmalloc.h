@@ -46,9 +46,15 @@ struct vmap_area {
 	unsigned long flags;
 	struct rb_node rb_node;         /* address sorted rbtree */
 	struct list_head list;          /* address sorted list */
+
+	/*
+	 * Largest available free size in subtree, only valid for areas
+	 * in the free space tree.
+	 */
+	unsigned long subtree_max_size;
+
 	struct llist_node purge_list;    /* "lazy purge" list */
 	struct vm_struct *vm;
-	struct rcu_head rcu_head;
 };
 
 /*
@@ -0,0 +1,181 @@
+/*
+ * eXtensible Arrays
+ *
+ * An XArray is a radix tree bundled with the spinlock that serialises
+ * modifications to it.  Readers only need rcu_read_lock(); writers either
+ * call the plain functions, which take the lock and deal with memory
+ * allocation themselves, or the __xa_ variants with xa_lock() held.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2, or (at
+ * your option) any later version.
+ */
+#ifndef _LINUX_XARRAY_H
+#define _LINUX_XARRAY_H
+
+#include <linux/err.h>
+#include <linux/gfp.h>
+#include <linux/radix-tree.h>
+#include <linux/spinlock.h>
+
+struct xarray {
+	spinlock_t		xa_lock;
+	struct radix_tree_root	xa_tree;
+};
+
+/*
+ * Nodes are taken from the radix tree preload pool when the lock-held
+ * GFP_NOWAIT allocation fails, so the root mask only has to be atomic.
+ */
+#define XA_GFP_MASK	(GFP_NOWAIT | __GFP_NOWARN)
+
+#define XARRAY_INIT(name) {					\
+	.xa_lock = __SPIN_LOCK_UNLOCKED(name.xa_lock),		\
+	.xa_tree = RADIX_TREE_INIT(XA_GFP_MASK),		\
+}
+
+#define DEFINE_XARRAY(name) struct xarray name = XARRAY_INIT(name)
+
+static inline void xa_init(struct xarray *xa)
+{
+	spin_lock_init(&xa->xa_lock);
+	INIT_RADIX_TREE(&xa->xa_tree, XA_GFP_MASK);
+}
+
+/*
+ * Marks are the radix tree tags: each entry has RADIX_TREE_MAX_TAGS bits
+ * that are propagated up the tree, so finding marked entries skips every
+ * subtree without one.  XA_PRESENT is only valid as a search filter and
+ * matches any entry.
+ */
+typedef unsigned int xa_mark_t;
+#define XA_MARK_0		0U
+#define XA_MARK_1		1U
+#define XA_MARK_2		2U
+#define XA_MARK_MAX		XA_MARK_2
+#define XA_PRESENT		RADIX_TREE_MAX_TAGS
+
+#define xa_lock(xa)		spin_lock(&(xa)->xa_lock)
+#define xa_unlock(xa)		spin_unlock(&(xa)->xa_lock)
+#define xa_lock_bh(xa)		spin_lock_bh(&(xa)->xa_lock)
+#define xa_unlock_bh(xa)	spin_unlock_bh(&(xa)->xa_lock)
+#define xa_lock_irq(xa)		spin_lock_irq(&(xa)->xa_lock)
+#define xa_unlock_irq(xa)	spin_unlock_irq(&(xa)->xa_lock)
+#define xa_lock_irqsave(xa, flags) \
+				spin_lock_irqsave(&(xa)->xa_lock, flags)
+#define xa_unlock_irqrestore(xa, flags) \
+				spin_unlock_irqrestore(&(xa)->xa_lock, flags)
+
+/*
+ * Value entries are integers stored in place of a pointer, e.g. the swap
+ * and shadow entries of the page cache.  They use the radix tree's
+ * exceptional entry encoding and are limited to LONG_MAX >> 2 so that they
+ * can never be mistaken for an error pointer.
+ */
+static inline void *xa_mk_value(unsigned long v)
+{
+	WARN_ON(v > (LONG_MAX >> RADIX_TREE_EXCEPTIONAL_SHIFT));
+	return (void *)((v << RADIX_TREE_EXCEPTIONAL_SHIFT) |
+			RADIX_TREE_EXCEPTIONAL_ENTRY);
+}
+
+static inline unsigned long xa_to_value(const void *entry)
+{
+	return (unsigned long)entry >> RADIX_TREE_EXCEPTIONAL_SHIFT;
+}
+
+static inline bool xa_is_value(const void *entry)
+{
+	return (unsigned long)entry & RADIX_TREE_EXCEPTIONAL_ENTRY;
+}
+
+/**
+ * xa_err() - turn an XArray result into an errno
+ * @entry: result of xa_store(), xa_cmpxchg() or their __xa_ variants
+ *
+ * Return: the negative errno encoded in @entry, or 0 if it is an entry.
+ */
+static inline int xa_err(void *entry)
+{
+	return IS_ERR(entry) ? PTR_ERR(entry) : 0;
+}
+
+static inline bool xa_empty(const struct xarray *xa)
+{
+	return radix_tree_empty(&xa->xa_tree);
+}
+
+static inline bool xa_marked(const struct xarray *xa, xa_mark_t mark)
+{
+	return radix_tree_tagged(&xa->xa_tree, mark);
+}
+
+void *xa_load(struct xarray *xa, unsigned long index);
+void *xa_store(struct xarray *xa, unsigned long index, void *entry, gfp_t);
+void *xa_erase(struct xarray *xa, unsigned long index);
+void *xa_cmpxchg(struct xarray *xa, unsigned long index,
+		 void *old, void *entry, gfp_t);
+int xa_insert_order(struct xarray *xa, unsigned long index,
+		    unsigned int order, void *entry, gfp_t);
+bool xa_get_mark(struct xarray *xa, unsigned long index, xa_mark_t mark);
+void xa_set_mark(struct xarray *xa, unsigned long index, xa_mark_t mark);
+void xa_clear_mark(struct xarray *xa, unsigned long index, xa_mark_t mark);
+void *xa_find(struct xarray *xa, unsigned long *index,
+	      unsigned long max, xa_mark_t filter);
+void *xa_find_after(struct xarray *xa, unsigned long *index,
+		    unsigned long max, xa_mark_t filter);
+unsigned int xa_extract(struct xarray *xa, void **dst, unsigned long start,
+			unsigned long max, unsigned int n, xa_mark_t filter);
+void xa_destroy(struct xarray *xa);
+
+/* Variants for callers holding xa_lock; node allocations must not sleep */
+void *__xa_store(struct xarray *xa, unsigned long index, void *entry);
+void *__xa_erase(struct xarray *xa, unsigned long index);
+void *__xa_cmpxchg(struct xarray *xa, unsigned long index,
+		   void *old, void *entry);
+void __xa_set_mark(struct xarray *xa, unsigned long index, xa_mark_t mark);
+void __xa_clear_mark(struct xarray *xa, unsigned long index, xa_mark_t mark);
+
+/**
+ * xa_insert() - store an entry at an unused index
+ * @xa: XArray
+ * @index: index to store @entry at
+ * @entry: new entry, must not be NULL
+ * @gfp: allocation flags
+ *
+ * Return: 0 on success, -EEXIST if @index is in use, -ENOMEM.
+ */
+static inline int xa_insert(struct xarray *xa, unsigned long index,
+			    void *entry, gfp_t gfp)
+{
+	return xa_insert_order(xa, index, 0, entry, gfp);
+}
+
+/**
+ * xa_for_each() - iterate over the present entries of an XArray
+ * @xa: XArray
+ * @index: unsigned long index of the current entry
+ * @entry: current entry
+ *
+ * Each step is an RCU-protected walk from the root, so the loop may run
+ * without locks and the body may sleep.  Entries spanning several indices
+ * are returned once, at their first index.
+ */
+#define xa_for_each(xa, index, entry)					\
+	xa_for_each_marked(xa, index, entry, XA_PRESENT)
+
+/**
+ * xa_for_each_marked() - iterate over the marked entries of an XArray
+ * @xa: XArray
+ * @index: unsigned long index of the current entry
+ * @entry: current entry
+ * @filter: XA_MARK_* to select, or XA_PRESENT for every entry
+ */
+#define xa_for_each_marked(xa, index, entry, filter)			\
+	for (index = 0,							\
+	     entry = xa_find(xa, &index, ULONG_MAX, filter);		\
+	     entry;							\
+	     entry = xa_find_after(xa, &index, ULONG_MAX, filter))
+
+#endif /* _LINUX_XARRAY_H */
@@ -0,0 +1,60 @@
+/*
+ * xxHash - Extremely Fast Hash algorithm
+ *
+ * xxHash is a non-cryptographic hash running close to RAM speed limits.
+ * It is meant for checksumming and hash tables, not for anything that
+ * needs to resist a malicious input.  Only the one-shot variants are
+ * provided; callers with streaming input should use something else.
+ *
+ * xxh32() is best on 32-bit machines, xxh64() on 64-bit ones, and
+ * xxhash() picks whichever is faster for the machine's word size.
+ */
+
+#ifndef _LINUX_XXHASH_H
+#define _LINUX_XXHASH_H
+
+#include <linux/types.h>
+
+/**
+ * xxh32() - calculate the 32-bit hash of the input with a given seed.
+ * @input:  The data to hash.
+ * @length: The length of the data to hash.
+ * @seed:   The seed can be used to alter the result predictably.
+ *
+ * Return:  The 32-bit hash of the data.
+ */
+uint32_t xxh32(const void *input, size_t length, uint32_t seed);
+
+/**
+ * xxh64() - calculate the 64-bit hash of the input with a given seed.
+ * @input:  The data to hash.
+ * @length: The length of the data to hash.
+ * @seed:   The seed can be used to alter the result predictably.
+ *
+ * Return:  The 64-bit hash of the data.
+ */
+uint64_t xxh64(const void *input, size_t length, uint64_t seed);
+
+/**
+ * xxhash() - calculate wordsize hash of the input with a given seed
+ * @input:  The data to hash.
+ * @length: The length of the data to hash.
+ * @seed:   The seed can be used to alter the result predictably.
+ *
+ * If the hash does not need to be comparable between machines with
+ * different word sizes, this function will call whichever of xxh32()
+ * or xxh64() is faster.
+ *
+ * Return:  wordsize hash of the data.
+ */
+static inline unsigned long xxhash(const void *input, size_t length,
+				   uint64_t seed)
+{
+#if BITS_PER_LONG == 64
+	return xxh64(input, length, seed);
+#else
+	return xxh32(input, length, seed);
+#endif
+}
+
+#endif /* _LINUX_XXHASH_H */
@@ -19,6 +19,7 @@
 #include <linux/ip.h>
 #include <linux/ipv6.h>
 #include <linux/list.h>
+#include <linux/seqlock.h>
 #include <linux/slab.h>
 #include <linux/socket.h>
 #include <linux/spinlock.h>
@@ -43,6 +44,19 @@ struct inet_ehash_bucket {
 	struct hlist_nulls_head chain;
 };
 
+/* The ehash locks are indexed by the hash, not by the bucket, so a lock
+ * covers the same sockets whatever the size of the table.  That is what
+ * lets the table grow while in use: the buckets of one lock are moved to
+ * the new table in one go, under the lock and inside @seq, and @pending
+ * tells which table they live in until then.  Lockless lookups that miss
+ * while @seq moved retry, see __inet_lookup_established().
+ */
+struct inet_ehash_lock {
+	spinlock_t	lock;
+	seqcount_t	seq;
+	bool		pending;	/* buckets still in ehash_old */
+};
+
 /* There are a few simple rules, which allow for local port reuse by
  * an application.  In essence:
  *
@@ -125,10 +139,16 @@ struct inet_hashinfo {
 	 *
 	 */
 	struct inet_ehash_bucket	*ehash;
-	spinlock_t			*ehash_locks;
+	struct inet_ehash_lock		*ehash_locks;
 	unsigned int			ehash_mask;
 	unsigned int			ehash_locks_mask;
 
+	/* Only set while inet_ehash_resize() runs */
+	struct inet_ehash_bucket	*ehash_old;
+	unsigned int			ehash_old_mask;
+	/* ehash was allocated by inet_ehash_resize(), free it with vfree() */
+	bool				ehash_vmalloc;
+
 	/* Ok, let's try this, I give up, we do need a local binding
 	 * TCP hash as well as the others for fast bind/connect.
 	 */
@@ -153,21 +173,74 @@ struct inet_hashinfo {
 					____cacheline_aligned_in_smp;
 };
 
-static inline struct inet_ehash_bucket *inet_ehash_bucket(
+static inline struct inet_ehash_lock *inet_ehash_lockent(
 	struct inet_hashinfo *hashinfo,
 	unsigned int hash)
 {
-	return &hashinfo->ehash[hash & hashinfo->ehash_mask];
+	return &hashinfo->ehash_locks[hash & hashinfo->ehash_locks_mask];
 }
 
 static inline spinlock_t *inet_ehash_lockp(
 	struct inet_hashinfo *hashinfo,
 	unsigned int hash)
 {
-	return &hashinfo->ehash_locks[hash & hashinfo->ehash_locks_mask];
+	return &inet_ehash_lockent(hashinfo, hash)->lock;
+}
+
+/* To be called with the bucket lock held, or under rcu_read_lock() and
+ * inside the seqcount of the lock, @slot is the nulls value of the chain.
+ */
+static inline struct inet_ehash_bucket *__inet_ehash_bucket(
+	struct inet_hashinfo *hashinfo,
+	unsigned int hash, unsigned int *slot)
+{
+	if (unlikely(smp_load_acquire(&inet_ehash_lockent(hashinfo,
+							  hash)->pending))) {
+		*slot = hash & hashinfo->ehash_old_mask;
+		return &hashinfo->ehash_old[*slot];
+	}
+	*slot = hash & hashinfo->ehash_mask;
+	return &hashinfo->ehash[*slot];
+}
+
+static inline struct inet_ehash_bucket *inet_ehash_bucket(
+	struct inet_hashinfo *hashinfo,
+	unsigned int hash)
+{
+	unsigned int slot;
+
+	return __inet_ehash_bucket(hashinfo, hash, &slot);
+}
+
+/* For walkers going over the table slot by slot with the lock of @slot
+ * held, or under rcu_read_lock().  While a resize runs, the slots of the
+ * new table that have no counterpart in the old one return NULL, their
+ * sockets are found through the old slot.  A walk that races with a
+ * resize may see a socket twice or not at all, as it may when sockets
+ * come and go underneath it.
+ */
+static inline struct inet_ehash_bucket *inet_ehash_slot(
+	struct inet_hashinfo *hashinfo,
+	unsigned int slot)
+{
+	if (unlikely(smp_load_acquire(&inet_ehash_lockent(hashinfo,
+							  slot)->pending))) {
+		if (slot > hashinfo->ehash_old_mask)
+			return NULL;
+		return &hashinfo->ehash_old[slot];
+	}
+	return &hashinfo->ehash[slot];
 }
 
 int inet_ehash_locks_alloc(struct inet_hashinfo *hashinfo);
+int inet_ehash_resize(struct inet_hashinfo *hashinfo, unsigned int size);
+extern struct mutex inet_ehash_resize_mutex;
+
+/* Chain length histogram: empty, 1, 2-3, 4-7, 8-15, 16 and more */
+#define INET_EHASH_HIST_SIZE	6
+void inet_ehash_chain_hist(struct inet_hashinfo *hashinfo,
+			   unsigned int hist[INET_EHASH_HIST_SIZE],
+			   unsigned int *max);
 
 static inline void inet_ehash_locks_free(struct inet_hashinfo *hashinfo)
 {
@@ -15,6 +15,7 @@
 #include <linux/compiler.h>
 #include <linux/timer.h>
 #include <linux/bug.h>
+#include <linux/percpu_counter.h>
 
 #include <net/checksum.h>
 #include <linux/netfilter.h>		/* for union nf_inet_addr */
@@ -672,9 +673,9 @@ struct ip_vs_dest {
 	unsigned long		idle_start;	/* start time, jiffies */
 
 	/* connection counters and thresholds */
-	atomic_t		activeconns;	/* active connections */
-	atomic_t		inactconns;	/* inactive connections */
-	atomic_t		persistconns;	/* persistent connections */
+	struct percpu_counter	activeconns;	/* active connections */
+	struct percpu_counter	inactconns;	/* inactive connections */
+	struct percpu_counter	persistconns;	/* persistent connections */
 	__u32			u_threshold;	/* upper threshold */
 	__u32			l_threshold;	/* lower threshold */
 
@@ -1425,6 +1426,27 @@ static inline void ip_vs_dest_put_and_free(struct ip_vs_dest *dest)
 		kfree(dest);
 }
 
+/* The connection counters of a destination are per-cpu.  Schedulers use
+ * the lazily folded total, which is off by less than
+ * IP_VS_DEST_CONNS_BATCH per cpu, only reporting sums them up exactly.
+ */
+#define IP_VS_DEST_CONNS_BATCH	16
+
+static inline void ip_vs_dest_conns_add(struct percpu_counter *conns, int v)
+{
+	__percpu_counter_add(conns, v, IP_VS_DEST_CONNS_BATCH);
+}
+
+static inline int ip_vs_dest_conns_read(struct percpu_counter *conns)
+{
+	return percpu_counter_read_positive(conns);
+}
+
+static inline int ip_vs_dest_conns_sum(struct percpu_counter *conns)
+{
+	return percpu_counter_sum_positive(conns);
+}
+
 /* IPVS sync daemon data and function prototypes
  * (from ip_vs_sync.c)
  */
@@ -1633,8 +1655,8 @@ ip_vs_dest_conn_overhead(struct ip_vs_dest *dest)
 	 * use the following formula to estimate the overhead now:
 	 *		  dest->activeconns*256 + dest->inactconns
 	 */
-	return (atomic_read(&dest->activeconns) << 8) +
-		atomic_read(&dest->inactconns);
+	return (ip_vs_dest_conns_read(&dest->activeconns) << 8) +
+		ip_vs_dest_conns_read(&dest->inactconns);
 }
 
 #endif	/* _NET_IP_VS_H */
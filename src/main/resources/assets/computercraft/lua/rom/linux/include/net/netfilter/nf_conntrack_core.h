@@ -79,11 +79,30 @@ print_tuple(struct seq_file *s, const struct nf_conntrack_tuple *tuple,
             const struct nf_conntrack_l3proto *l3proto,
             const struct nf_conntrack_l4proto *proto);
 
-#define CONNTRACK_LOCKS 1024
+/* Bucket lock shards, sized from the hash table when conntrack starts */
+#define CONNTRACK_LOCKS_MIN	1024
+#define CONNTRACK_LOCKS_MAX	16384
+#define CONNTRACK_LOCKS_BUCKETS	256
 
-extern spinlock_t nf_conntrack_locks[CONNTRACK_LOCKS];
+extern spinlock_t *nf_conntrack_locks;
+extern unsigned int nf_conntrack_locks_count;
 void nf_conntrack_lock(spinlock_t *lock);
 
+static inline spinlock_t *nf_conntrack_bucket_lock(unsigned int bucket)
+{
+	return &nf_conntrack_locks[bucket % nf_conntrack_locks_count];
+}
+
+struct nf_conntrack_gc_stat {
+	unsigned long	runs;
+	unsigned long	scanned;
+	unsigned long	expired;
+	unsigned long	early_drop;
+	unsigned long	interval;
+};
+
+void nf_conntrack_gc_stat_get(struct nf_conntrack_gc_stat *st);
+
 extern spinlock_t nf_conntrack_expect_lock;
 
 #endif /* _NF_CONNTRACK_CORE_H */
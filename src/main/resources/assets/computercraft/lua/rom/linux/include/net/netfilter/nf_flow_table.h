@@ -0,0 +1,93 @@
+#ifndef _NF_FLOW_TABLE_H
+#define _NF_FLOW_TABLE_H
+
+#include <linux/in.h>
+#include <linux/netdevice.h>
+#include <linux/rhashtable.h>
+#include <linux/rcupdate.h>
+#include <linux/workqueue.h>
+#include <net/dst.h>
+
+struct nf_conn;
+
+/*
+ * Flow table of established, offloaded conntrack entries, consulted from
+ * the netdev ingress hook.  Packets that hit an entry are mangled with the
+ * NAT of the connection and transmitted to the cached route, bypassing the
+ * inet hooks and the conntrack lookup.  There is one table per netns.
+ */
+struct nf_flowtable {
+	struct rhashtable		rhashtable;
+	struct delayed_work		gc_work;
+};
+
+enum flow_offload_tuple_dir {
+	FLOW_OFFLOAD_DIR_ORIGINAL,
+	FLOW_OFFLOAD_DIR_REPLY,
+	__FLOW_OFFLOAD_DIR_MAX		= FLOW_OFFLOAD_DIR_REPLY,
+};
+#define FLOW_OFFLOAD_DIR_MAX		(__FLOW_OFFLOAD_DIR_MAX + 1)
+
+struct flow_offload_tuple {
+	/* Hash key, up to and not including dir */
+	struct in_addr			src_v4;
+	struct in_addr			dst_v4;
+	__be16				src_port;
+	__be16				dst_port;
+	int				iifidx;
+	u8				l3proto;
+	u8				l4proto;
+
+	u8				dir;
+	int				oifidx;
+	struct dst_entry		*dst_cache;
+};
+
+struct flow_offload_tuple_rhash {
+	struct rhash_head		node;
+	struct flow_offload_tuple	tuple;
+};
+
+#define FLOW_OFFLOAD_SNAT	0x1
+#define FLOW_OFFLOAD_DNAT	0x2
+#define FLOW_OFFLOAD_DYING	0x4
+#define FLOW_OFFLOAD_TEARDOWN	0x8
+
+struct flow_offload {
+	struct flow_offload_tuple_rhash		tuplehash[FLOW_OFFLOAD_DIR_MAX];
+	struct nf_conn				*ct;
+	u32					flags;
+	u32					timeout;
+	struct rcu_head				rcu_head;
+};
+
+#define NF_FLOW_TIMEOUT (30 * HZ)
+#define nf_flowtable_time_stamp	((u32)jiffies)
+
+static inline bool nf_flow_has_expired(const struct flow_offload *flow)
+{
+	return (__s32)(flow->timeout - nf_flowtable_time_stamp) <= 0;
+}
+
+struct nf_flow_route {
+	struct {
+		struct dst_entry	*dst;
+		int			ifindex;
+	} tuple[FLOW_OFFLOAD_DIR_MAX];
+};
+
+struct flow_offload *flow_offload_alloc(struct nf_conn *ct,
+					struct nf_flow_route *route);
+void flow_offload_free(struct flow_offload *flow);
+
+int flow_offload_add(struct nf_flowtable *flow_table, struct flow_offload *flow);
+struct flow_offload_tuple_rhash *flow_offload_lookup(struct nf_flowtable *flow_table,
+						     struct flow_offload_tuple *tuple);
+void flow_offload_teardown(struct flow_offload *flow);
+
+struct nf_flowtable *nf_flow_table_get(struct net *net);
+
+unsigned int nf_flow_offload_ip_hook(struct nf_flowtable *flow_table,
+				     struct sk_buff *skb);
+
+#endif /* _NF_FLOW_TABLE_H */
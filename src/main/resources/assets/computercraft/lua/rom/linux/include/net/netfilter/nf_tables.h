@@ -241,17 +241,23 @@ struct nft_set_iter {
 			      struct nft_set_elem *elem);
 };
 
+#define NFT_REG32_COUNT		(NFT_REG32_15 - NFT_REG32_00 + 1)
+
 /**
  *	struct nft_set_desc - description of set elements
  *
  *	@klen: key length
  *	@dlen: data length
  *	@size: number of set elements
+ *	@field_len: length of each field of a concatenated key
+ *	@field_count: number of fields of a concatenated key, 0 if not given
  */
 struct nft_set_desc {
 	unsigned int		klen;
 	unsigned int		dlen;
 	unsigned int		size;
+	u8			field_len[NFT_REG32_COUNT];
+	u8			field_count;
 };
 
 /**
@@ -371,6 +377,8 @@ void nft_unregister_set(struct nft_set_ops *ops);
  *	@policy: set parameterization (see enum nft_set_policies)
  *	@udlen: user data length
  *	@udata: user data
+ *	@field_len: length of each field of a concatenated key
+ *	@field_count: number of fields of a concatenated key
  * 	@ops: set ops
  * 	@flags: set flags
  *	@genmask: generation mask
@@ -393,6 +401,8 @@ struct nft_set {
 	u16				policy;
 	u16				udlen;
 	unsigned char			*udata;
+	u8				field_len[NFT_REG32_COUNT];
+	u8				field_count;
 	/* runtime data below here */
 	const struct nft_set_ops	*ops ____cacheline_aligned;
 	u16				flags:14,
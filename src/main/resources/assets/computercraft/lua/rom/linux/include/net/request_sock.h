@@ -151,16 +151,38 @@ struct fastopen_queue {
 	int		max_qlen;	/* != 0 iff TFO is currently enabled */
 };
 
+/*
+ * Per cpu accept queues, requested with TCP_ACCEPT_PERCPU.
+ *
+ * A child is queued on the cpu that completed its handshake, and accept()
+ * looks at the queue of its own cpu first, so a listener served by one
+ * accepting thread per cpu never bounces a lock between cpus.
+ */
+struct reqsk_cpu_queue {
+	spinlock_t		lock;
+	struct request_sock	*head;
+	struct request_sock	*tail;
+};
+
+struct reqsk_cpu_queues {
+	struct reqsk_cpu_queue __percpu *cpu;
+	atomic_t		backlog;	/* children queued on all cpus */
+	struct rcu_head		rcu;
+};
+
 /** struct request_sock_queue - queue of request_socks
  *
  * @rskq_accept_head - FIFO head of established children
  * @rskq_accept_tail - FIFO tail of established children
  * @rskq_defer_accept - User waits for some data after accept()
+ * @rskq_percpu - Queue children per cpu once listening
+ * @rskq_cpu_queues - The per cpu queues of a listener with @rskq_percpu
  *
  */
 struct request_sock_queue {
 	spinlock_t		rskq_lock;
 	u8			rskq_defer_accept;
+	u8			rskq_percpu;
 
 	u32			synflood_warned;
 	atomic_t		qlen;
@@ -171,15 +193,26 @@ struct request_sock_queue {
 	struct fastopen_queue	fastopenq;  /* Check max_qlen != 0 to determine
 					     * if TFO is enabled.
 					     */
+	struct reqsk_cpu_queues __rcu *rskq_cpu_queues;
 };
 
 void reqsk_queue_alloc(struct request_sock_queue *queue);
 
+int reqsk_cpu_queues_alloc(struct request_sock_queue *queue);
+void reqsk_cpu_queues_free(struct request_sock_queue *queue);
+bool reqsk_cpu_queues_empty(const struct request_sock_queue *queue);
+struct request_sock *reqsk_cpu_queue_remove(struct request_sock_queue *queue,
+					    struct sock *parent);
+struct request_sock *reqsk_cpu_queues_splice(struct request_sock_queue *queue,
+					     struct sock *parent);
+
 void reqsk_fastopen_remove(struct sock *sk, struct request_sock *req,
 			   bool reset);
 
 static inline bool reqsk_queue_empty(const struct request_sock_queue *queue)
 {
+	if (unlikely(queue->rskq_percpu) && !reqsk_cpu_queues_empty(queue))
+		return false;
 	return queue->rskq_accept_head == NULL;
 }
 
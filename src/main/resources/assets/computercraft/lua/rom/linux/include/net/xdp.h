@@ -0,0 +1,40 @@
+/* include/net/xdp.h
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ */
+#ifndef __LINUX_NET_XDP_H__
+#define __LINUX_NET_XDP_H__
+
+/**
+ * DOC: XDP RX-queue information
+ *
+ * The XDP RX-queue info (xdp_rxq_info) is associated with the driver
+ * level RX-ring queues. It is information that is specific to how
+ * the driver has configured a given RX-ring queue.
+ *
+ * Each xdp_buff frame received in the driver carries a (pointer)
+ * reference to this xdp_rxq_info structure. This provides the XDP
+ * redirect targets, such as AF_XDP sockets, with a way to tell which
+ * device and queue a frame arrived on.
+ *
+ * The structure lives in the driver's RX-ring and is set up when the
+ * ring is allocated; it is only read in the fast path.
+ */
+
+struct net_device;
+
+struct xdp_rxq_info {
+	struct net_device *dev;
+	u32 queue_index;
+} ____cacheline_aligned; /* perf critical, avoid false-sharing */
+
+static inline void xdp_rxq_info_init(struct xdp_rxq_info *xdp_rxq,
+				     struct net_device *dev, u32 queue_index)
+{
+	xdp_rxq->dev = dev;
+	xdp_rxq->queue_index = queue_index;
+}
+
+#endif /* __LINUX_NET_XDP_H__ */
@@ -0,0 +1,87 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM exec
+
+#if !defined(_TRACE_EXEC_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_EXEC_H
+
+#include <linux/binfmts.h>
+#include <linux/fs.h>
+#include <linux/tracepoint.h>
+
+#define EXEC_PHASES				\
+	EM(EXEC_PHASE_OPEN,	"open")		\
+	EM(EXEC_PHASE_ARGS,	"args")		\
+	EM(EXEC_PHASE_HEADERS,	"headers")	\
+	EM(EXEC_PHASE_FLUSH,	"flush")	\
+	EM(EXEC_PHASE_SETUP,	"setup")	\
+	EM(EXEC_PHASE_MAP,	"map")		\
+	EM(EXEC_PHASE_INTERP,	"interp")	\
+	EMe(EXEC_PHASE_LOAD,	"load")
+
+#undef EM
+#undef EMe
+#define EM(a, b)	TRACE_DEFINE_ENUM(a);
+#define EMe(a, b)	TRACE_DEFINE_ENUM(a);
+
+EXEC_PHASES
+
+#undef EM
+#undef EMe
+#define EM(a, b)	{ a, b },
+#define EMe(a, b)	{ a, b }
+
+/*
+ * Emitted at the end of each stage of an exec with the time spent in it,
+ * so that the cost of an exec can be broken down per binary.
+ */
+TRACE_EVENT(exec_phase,
+
+	TP_PROTO(struct linux_binprm *bprm, enum exec_phase phase, u64 delta),
+
+	TP_ARGS(bprm, phase, delta),
+
+	TP_STRUCT__entry(
+		__string(	filename,	bprm->filename	)
+		__field(	int,		phase		)
+		__field(	u64,		delta		)
+	),
+
+	TP_fast_assign(
+		__assign_str(filename, bprm->filename);
+		__entry->phase	= phase;
+		__entry->delta	= delta;
+	),
+
+	TP_printk("filename=%s phase=%s delta=%llu ns",
+		  __get_str(filename),
+		  __print_symbolic(__entry->phase, EXEC_PHASES),
+		  __entry->delta)
+);
+
+TRACE_EVENT(elf_phdr_cache,
+
+	TP_PROTO(struct inode *inode, bool hit),
+
+	TP_ARGS(inode, hit),
+
+	TP_STRUCT__entry(
+		__field(	dev_t,		dev		)
+		__field(	unsigned long,	ino		)
+		__field(	bool,		hit		)
+	),
+
+	TP_fast_assign(
+		__entry->dev	= inode->i_sb->s_dev;
+		__entry->ino	= inode->i_ino;
+		__entry->hit	= hit;
+	),
+
+	TP_printk("dev=%d:%d ino=%lu %s",
+		  MAJOR(__entry->dev), MINOR(__entry->dev),
+		  __entry->ino, __entry->hit ? "hit" : "miss")
+);
+
+#endif /* _TRACE_EXEC_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
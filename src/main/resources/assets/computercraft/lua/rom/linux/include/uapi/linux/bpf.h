@@ -81,6 +81,10 @@ enum bpf_cmd {
 	BPF_OBJ_GET,
 	BPF_PROG_ATTACH,
 	BPF_PROG_DETACH,
+	BPF_MAP_LOOKUP_BATCH,
+	BPF_MAP_UPDATE_BATCH,
+	BPF_MAP_DELETE_BATCH,
+	BPF_OBJ_GET_INFO_BY_FD,
 };
 
 enum bpf_map_type {
@@ -96,6 +100,10 @@ enum bpf_map_type {
 	BPF_MAP_TYPE_LRU_HASH,
 	BPF_MAP_TYPE_LRU_PERCPU_HASH,
 	BPF_MAP_TYPE_LPM_TRIE,
+	BPF_MAP_TYPE_DEVMAP,
+	BPF_MAP_TYPE_XSKMAP,
+	BPF_MAP_TYPE_SOCKMAP,
+	BPF_MAP_TYPE_RINGBUF,
 };
 
 enum bpf_prog_type {
@@ -112,12 +120,15 @@ enum bpf_prog_type {
 	BPF_PROG_TYPE_LWT_IN,
 	BPF_PROG_TYPE_LWT_OUT,
 	BPF_PROG_TYPE_LWT_XMIT,
+	BPF_PROG_TYPE_SK_SKB,
 };
 
 enum bpf_attach_type {
 	BPF_CGROUP_INET_INGRESS,
 	BPF_CGROUP_INET_EGRESS,
 	BPF_CGROUP_INET_SOCK_CREATE,
+	BPF_SK_SKB_STREAM_PARSER,
+	BPF_SK_SKB_STREAM_VERDICT,
 	__MAX_BPF_ATTACH_TYPE
 };
 
@@ -131,6 +142,11 @@ enum bpf_attach_type {
 
 #define BPF_PSEUDO_MAP_FD	1
 
+/* when bpf_call->src_reg == BPF_PSEUDO_CALL, bpf_call->imm == pc-relative
+ * offset to another bpf function of the same program
+ */
+#define BPF_PSEUDO_CALL		1
+
 /* flags for BPF_MAP_UPDATE_ELEM command */
 #define BPF_ANY		0 /* create new element or update existing */
 #define BPF_NOEXIST	1 /* create new element if it didn't exist */
@@ -144,6 +160,40 @@ enum bpf_attach_type {
  * across different LRU lists.
  */
 #define BPF_F_NO_COMMON_LRU	(1U << 1)
+/* Values of a BPF_MAP_TYPE_ARRAY can be mmap()ed by user space, at
+ * round_up(value_size, 8) bytes apart, starting at offset 0.
+ */
+#define BPF_F_MMAPABLE		(1U << 2)
+/* Split the LRU of a BPF_MAP_TYPE_LRU_[PERCPU_]HASH into shards chosen
+ * by key hash, each with its own lock and a CLOCK approximation of LRU
+ * order.  Scales better than the common LRU list under heavy updates
+ * from many CPUs, at the cost of less accurate eviction.  Counters are
+ * reported in the map's fdinfo.
+ */
+#define BPF_F_LRU_SHARDED	(1U << 3)
+/* Store build_id+offset of each frame of a BPF_MAP_TYPE_STACK_TRACE
+ * instead of its ip, so that stacks are symbolized offline.
+ */
+#define BPF_F_STACK_BUILD_ID	(1U << 4)
+
+#define BPF_BUILD_ID_SIZE 20
+enum bpf_stack_build_id_status {
+	/* user space need an empty entry to identify end of a trace */
+	BPF_STACK_BUILD_ID_EMPTY = 0,
+	/* with valid build_id and offset */
+	BPF_STACK_BUILD_ID_VALID = 1,
+	/* couldn't get build_id, fallback to ip */
+	BPF_STACK_BUILD_ID_IP = 2,
+};
+
+struct bpf_stack_build_id {
+	__s32		status;
+	unsigned char	build_id[BPF_BUILD_ID_SIZE];
+	union {
+		__u64	offset;
+		__u64	ip;
+	};
+};
 
 union bpf_attr {
 	struct { /* anonymous struct used by BPF_MAP_CREATE command */
@@ -186,6 +236,29 @@ union bpf_attr {
 		__u32		attach_type;
 		__u32		attach_flags;
 	};
+
+	struct { /* struct used by BPF_MAP_*_BATCH commands */
+		__aligned_u64	in_batch;	/* start batch,
+						 * NULL to start from beginning
+						 */
+		__aligned_u64	out_batch;	/* output: next start batch */
+		__aligned_u64	keys;
+		__aligned_u64	values;
+		__u32		count;		/* input/output:
+						 * input: # of key/value
+						 * elements
+						 * output: # of filled elements
+						 */
+		__u32		map_fd;
+		__u64		elem_flags;	/* BPF_MAP_UPDATE_ELEM flags */
+		__u64		flags;
+	} batch;
+
+	struct { /* anonymous struct used by BPF_OBJ_GET_INFO_BY_FD */
+		__u32		bpf_fd;
+		__u32		info_len;	/* input/output: size of info */
+		__aligned_u64	info;
+	} info;
 } __attribute__((aligned(8)));
 
 /* BPF helper function descriptions:
@@ -298,7 +371,7 @@ union bpf_attr {
  *     @ifindex: ifindex of the net device
  *     @flags: bit 0 - if set, redirect to ingress instead of egress
  *             other bits - reserved
- *     Return: TC_ACT_REDIRECT
+ *     Return: TC_ACT_REDIRECT for tc programs, XDP_REDIRECT for XDP
  *
  * u32 bpf_get_route_realm(skb)
  *     retrieve a dst's tclassid
@@ -456,6 +529,40 @@ union bpf_attr {
  *     Return:
  *       > 0 length of the string including the trailing NUL on success
  *       < 0 error
+ *
+ * int bpf_redirect_map(map, key, flags)
+ *     redirect to the net device stored in a BPF_MAP_TYPE_DEVMAP slot,
+ *     or to the AF_XDP socket stored in a BPF_MAP_TYPE_XSKMAP slot
+ *     @map: pointer to dev map or xsk map
+ *     @key: index inside the map of the device or socket
+ *     @flags: reserved, must be 0
+ *     Return: XDP_REDIRECT on success or XDP_ABORTED on error
+ *
+ * int bpf_sk_redirect_map(skb, map, key, flags)
+ *     redirect the message to the TCP socket stored in a
+ *     BPF_MAP_TYPE_SOCKMAP slot, to be sent on that socket
+ *     @skb: pointer to skb
+ *     @map: pointer to sockmap
+ *     @key: index inside the map of the socket to send on
+ *     @flags: reserved, must be 0
+ *     Return: SK_PASS on success or SK_DROP on error
+ *
+ * int bpf_ringbuf_output(map, data, size, flags)
+ *     copy size bytes from data into a BPF_MAP_TYPE_RINGBUF as one record
+ *     @map: pointer to ringbuf map
+ *     @data: pointer to the record
+ *     @size: size of the record
+ *     @flags: BPF_RB_NO_WAKEUP to not wake up the consumer for this record,
+ *             BPF_RB_FORCE_WAKEUP to wake it up even if it is not waiting
+ *             on this very record
+ *     Return: 0 on success, -EAGAIN if the ring is full, negative otherwise
+ *
+ * u64 bpf_ringbuf_query(map, flags)
+ *     query one of the BPF_RB_* positions or sizes of a ring buffer
+ *     @map: pointer to ringbuf map
+ *     @flags: what to return, BPF_RB_AVAIL_DATA, BPF_RB_RING_SIZE,
+ *             BPF_RB_CONS_POS or BPF_RB_PROD_POS
+ *     Return: the requested value, 0 for unknown flags
  */
 #define __BPF_FUNC_MAPPER(FN)		\
 	FN(unspec),			\
@@ -503,7 +610,11 @@ union bpf_attr {
 	FN(get_numa_node_id),		\
 	FN(skb_change_head),		\
 	FN(xdp_adjust_head),		\
-	FN(probe_read_str),
+	FN(probe_read_str),		\
+	FN(redirect_map),		\
+	FN(sk_redirect_map),		\
+	FN(ringbuf_output),		\
+	FN(ringbuf_query),
 
 /* integer value in 'imm' field of BPF_CALL instruction selects which helper
  * function eBPF program intends to call
@@ -553,6 +664,38 @@ enum bpf_func_id {
 /* BPF_FUNC_perf_event_output for sk_buff input context. */
 #define BPF_F_CTXLEN_MASK		(0xfffffULL << 32)
 
+#define BPF_TAG_SIZE	8
+
+/* Returned by BPF_OBJ_GET_INFO_BY_FD for a program.  run_time_ns and
+ * run_cnt only count while the kernel.bpf_stats_enabled sysctl is set.
+ */
+struct bpf_prog_info {
+	__u32 type;
+	__u32 jited;
+	__u8  tag[BPF_TAG_SIZE];
+	__u64 run_time_ns;
+	__u64 run_cnt;
+} __attribute__((aligned(8)));
+
+/* BPF_FUNC_ringbuf_output flags. */
+#define BPF_RB_NO_WAKEUP		(1ULL << 0)
+#define BPF_RB_FORCE_WAKEUP		(1ULL << 1)
+
+/* BPF_FUNC_ringbuf_query flags */
+enum {
+	BPF_RB_AVAIL_DATA = 0,
+	BPF_RB_RING_SIZE = 1,
+	BPF_RB_CONS_POS = 2,
+	BPF_RB_PROD_POS = 3,
+};
+
+/* BPF ring buffer constants */
+enum {
+	BPF_RINGBUF_BUSY_BIT		= (1U << 31),
+	BPF_RINGBUF_DISCARD_BIT		= (1U << 30),
+	BPF_RINGBUF_HDR_SZ		= 8,
+};
+
 /* user accessible mirror of in-kernel sk_buff.
  * new fields can only be added to the end of this structure
  */
@@ -574,6 +717,18 @@ struct __sk_buff {
 	__u32 tc_classid;
 	__u32 data;
 	__u32 data_end;
+
+	/* Accessed by BPF_PROG_TYPE_SK_SKB programs only, from the socket
+	 * the message was received on. remote_port is in network byte
+	 * order, local_port in host byte order.
+	 */
+	__u32 family;
+	__u32 remote_ip4;	/* Stored in network byte order */
+	__u32 local_ip4;	/* Stored in network byte order */
+	__u32 remote_ip6[4];	/* Stored in network byte order */
+	__u32 local_ip6[4];	/* Stored in network byte order */
+	__u32 remote_port;	/* Stored in network byte order */
+	__u32 local_port;	/* stored in host byte order */
 };
 
 struct bpf_tunnel_key {
@@ -623,6 +778,7 @@ enum xdp_action {
 	XDP_DROP,
 	XDP_PASS,
 	XDP_TX,
+	XDP_REDIRECT,
 };
 
 /* user accessible metadata for XDP packet hook
@@ -633,4 +789,13 @@ struct xdp_md {
 	__u32 data_end;
 };
 
+/* Verdicts for BPF_PROG_TYPE_SK_SKB programs. A verdict program returns
+ * SK_PASS after a successful bpf_sk_redirect_map() to forward the
+ * message, anything else drops it.
+ */
+enum sk_action {
+	SK_DROP = 0,
+	SK_PASS,
+};
+
 #endif /* _UAPI__LINUX_BPF_H__ */
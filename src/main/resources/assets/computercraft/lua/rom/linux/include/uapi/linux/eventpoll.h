@@ -17,9 +17,11 @@
 /* For O_CLOEXEC */
 #include <linux/fcntl.h>
 #include <linux/types.h>
+#include <linux/ioctl.h>
 
 /* Flags for epoll_create1.  */
 #define EPOLL_CLOEXEC O_CLOEXEC
+#define EPOLL_USERPOLL 1
 
 /* Valid opcodes to issue to sys_epoll_ctl() */
 #define EPOLL_CTL_ADD 1
@@ -64,6 +66,70 @@ struct epoll_event {
 	__u64 data;
 } EPOLL_PACKED;
 
+/*
+ * User polling (EPOLL_USERPOLL)
+ *
+ * The events of an epoll instance created with EPOLL_USERPOLL are reported
+ * through a ring shared with user space instead of being copied out by
+ * epoll_wait(). The ring is set up by mmap()ing the epoll file descriptor at
+ * offset 0 before adding any file: the mapping holds a struct epoll_uheader,
+ * followed at items_offset by max_items struct epoll_uitem slots, one per
+ * monitored file, and at ring_offset by max_items __u32 ring entries, each
+ * holding a slot index. Only EPOLLET is supported, without EPOLLONESHOT,
+ * EPOLLWAKEUP or EPOLLEXCLUSIVE.
+ *
+ * The kernel or-s new events into a slot's ready_events, and appends the
+ * slot index at tail when ready_events was zero. A single consumer takes
+ * entries from head:
+ *
+ *	idx = ring[head & (max_items - 1)];
+ *	if (idx == EPOLL_UINDEX_EMPTY)
+ *		retry, the entry is still being written;
+ *	ring[head & (max_items - 1)] = EPOLL_UINDEX_EMPTY;
+ *	store-release head + 1 to head;
+ *	read items[idx].data and items[idx].events;
+ *	ready = atomic exchange of items[idx].ready_events with 0;
+ *
+ * and skips the entry if events is zero (the file was removed). epoll_wait()
+ * only waits for the ring to be non-empty and returns the number of entries
+ * in it, the events buffer is not written.
+ */
+#define EPOLL_UINDEX_EMPTY (~0U)
+
+struct epoll_uitem {
+	__u32 ready_events;
+	__u32 events;
+	__u64 data;
+};
+
+struct epoll_uheader {
+	__u32 max_items;
+	__u32 head;
+	__u32 tail;
+	__u32 items_offset;
+	__u32 ring_offset;
+	__u32 reserved[11];
+};
+
+/*
+ * Busy polling of an epoll instance
+ *
+ * epoll_wait() busy polls the NAPI context of the sockets it watches before
+ * going to sleep, for net.core.busy_poll microseconds or, when set with
+ * EPIOCSPARAMS, for busy_poll_usecs. The counters are only reported by
+ * EPIOCGPARAMS and ignored by EPIOCSPARAMS.
+ */
+struct epoll_params {
+	__u32 busy_poll_usecs;
+	__u32 __pad;
+	__u64 busy_poll_loops;	/* busy poll rounds run by epoll_wait() */
+	__u64 busy_poll_hits;	/* rounds that found events */
+};
+
+#define EPOLL_IOC_TYPE 0x8A
+#define EPIOCSPARAMS _IOW(EPOLL_IOC_TYPE, 0x01, struct epoll_params)
+#define EPIOCGPARAMS _IOR(EPOLL_IOC_TYPE, 0x02, struct epoll_params)
+
 #ifdef CONFIG_PM_SLEEP
 static inline void ep_take_care_of_epollwakeup(struct epoll_event *epev)
 {
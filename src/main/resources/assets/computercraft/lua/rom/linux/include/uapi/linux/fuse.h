@@ -112,6 +112,13 @@
  *  7.26
  *  - add FUSE_HANDLE_KILLPRIV
  *  - add FUSE_POSIX_ACL
+ *
+ *  7.27
+ *  - add FUSE_PASSTHROUGH, FOPEN_PASSTHROUGH and FUSE_DEV_IOC_PASSTHROUGH_OPEN
+ *  - add passthrough_fh to fuse_open_out
+ *
+ *  7.28
+ *  - add FUSE_DEV_IOC_RING_SETUP and FUSE_DEV_IOC_RING_CMD
  */
 
 #ifndef _LINUX_FUSE_H
@@ -147,7 +154,7 @@
 #define FUSE_KERNEL_VERSION 7
 
 /** Minor version number of this interface */
-#define FUSE_KERNEL_MINOR_VERSION 26
+#define FUSE_KERNEL_MINOR_VERSION 28
 
 /** The node ID of the root inode */
 #define FUSE_ROOT_ID 1
@@ -215,10 +222,12 @@ struct fuse_file_lock {
  * FOPEN_DIRECT_IO: bypass page cache for this open file
  * FOPEN_KEEP_CACHE: don't invalidate the data cache on open
  * FOPEN_NONSEEKABLE: the file is not seekable
+ * FOPEN_PASSTHROUGH: read/write/mmap go to the backing file in passthrough_fh
  */
 #define FOPEN_DIRECT_IO		(1 << 0)
 #define FOPEN_KEEP_CACHE	(1 << 1)
 #define FOPEN_NONSEEKABLE	(1 << 2)
+#define FOPEN_PASSTHROUGH	(1 << 3)
 
 /**
  * INIT request/reply flags
@@ -244,6 +253,7 @@ struct fuse_file_lock {
  * FUSE_PARALLEL_DIROPS: allow parallel lookups and readdir
  * FUSE_HANDLE_KILLPRIV: fs handles killing suid/sgid/cap on write/chown/trunc
  * FUSE_POSIX_ACL: filesystem supports posix acls
+ * FUSE_PASSTHROUGH: I/O on open files may be passed through to a backing file
  */
 #define FUSE_ASYNC_READ		(1 << 0)
 #define FUSE_POSIX_LOCKS	(1 << 1)
@@ -266,6 +276,7 @@ struct fuse_file_lock {
 #define FUSE_PARALLEL_DIROPS    (1 << 18)
 #define FUSE_HANDLE_KILLPRIV	(1 << 19)
 #define FUSE_POSIX_ACL		(1 << 20)
+#define FUSE_PASSTHROUGH	(1 << 21)
 
 /**
  * CUSE INIT request/reply flags
@@ -497,7 +508,7 @@ struct fuse_create_in {
 struct fuse_open_out {
 	uint64_t	fh;
 	uint32_t	open_flags;
-	uint32_t	padding;
+	uint32_t	passthrough_fh;
 };
 
 struct fuse_release_in {
@@ -772,8 +783,56 @@ struct fuse_notify_retrieve_in {
 	uint64_t	dummy4;
 };
 
+/* Argument of FUSE_DEV_IOC_PASSTHROUGH_OPEN */
+struct fuse_passthrough_out {
+	uint32_t	fd;
+	uint32_t	flags;	/* must be zero */
+};
+
+/*
+ * Argument of FUSE_DEV_IOC_RING_SETUP
+ *
+ * Sets up a shared memory request ring on the device, with one queue of
+ * queue_depth entries per cpu.  The entries are mapped with mmap() of
+ * mmap_size bytes at offset 0 of the device; entry e of queue q starts
+ * at (q * queue_depth + e) * entry_size.  Requests submitted on a cpu go
+ * to its queue once a thread has called FUSE_DEV_IOC_RING_CMD on it, and
+ * through read() before that.  Interrupts and forgets always go through
+ * read().
+ */
+struct fuse_ring_setup {
+	uint32_t	queue_depth;	/* entries per queue, at most 256 */
+	uint32_t	entry_size;	/* multiple of the page size, at least
+					   FUSE_MIN_READ_BUFFER */
+	uint32_t	flags;		/* must be zero */
+	uint32_t	nr_queues;	/* out: number of queues */
+	uint64_t	mmap_size;	/* out: length of the mapping */
+};
+
+/*
+ * Argument of FUSE_DEV_IOC_RING_CMD
+ *
+ * A thread owns an entry of the queue of the cpu it runs on.  With
+ * FUSE_RING_COMMIT the entry holds the reply to the request last fetched
+ * into it, laid out as it would be written to the device.  The ioctl
+ * then waits for the next request of the queue and returns its length,
+ * with the request in the entry as read() would return it.
+ */
+struct fuse_ring_cmd {
+	uint32_t	qid;
+	uint32_t	entry;
+	uint32_t	flags;
+	uint32_t	reply_len;	/* with FUSE_RING_COMMIT */
+};
+
+#define FUSE_RING_COMMIT	(1 << 0)
+
 /* Device ioctls: */
 #define FUSE_DEV_IOC_CLONE	_IOR(229, 0, uint32_t)
+#define FUSE_DEV_IOC_PASSTHROUGH_OPEN	\
+	_IOW(229, 1, struct fuse_passthrough_out)
+#define FUSE_DEV_IOC_RING_SETUP	_IOWR(229, 2, struct fuse_ring_setup)
+#define FUSE_DEV_IOC_RING_CMD	_IOW(229, 3, struct fuse_ring_cmd)
 
 struct fuse_lseek_in {
 	uint64_t	fh;
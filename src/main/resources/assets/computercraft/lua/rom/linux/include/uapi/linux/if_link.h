@@ -157,6 +157,7 @@ enum {
 	IFLA_GSO_MAX_SIZE,
 	IFLA_PAD,
 	IFLA_XDP,
+	IFLA_RPS_BPF,
 	__IFLA_MAX
 };
 
@@ -880,7 +881,9 @@ enum {
 /* XDP section */
 
 #define XDP_FLAGS_UPDATE_IF_NOEXIST	(1U << 0)
-#define XDP_FLAGS_MASK			(XDP_FLAGS_UPDATE_IF_NOEXIST)
+#define XDP_FLAGS_SKB_MODE		(1U << 1)
+#define XDP_FLAGS_MASK			(XDP_FLAGS_UPDATE_IF_NOEXIST | \
+					 XDP_FLAGS_SKB_MODE)
 
 enum {
 	IFLA_XDP_UNSPEC,
@@ -892,4 +895,20 @@ enum {
 
 #define IFLA_XDP_MAX (__IFLA_XDP_MAX - 1)
 
+/* RPS steering program section
+ *
+ * A BPF_PROG_TYPE_SOCKET_FILTER program run by RPS on every received
+ * packet, with the data starting at the network header.  It returns the
+ * CPU to steer the packet to; values of nr_cpu_ids or more leave the
+ * choice to the RFS and RPS tables.
+ */
+enum {
+	IFLA_RPS_BPF_UNSPEC,
+	IFLA_RPS_BPF_FD,
+	IFLA_RPS_BPF_ATTACHED,
+	__IFLA_RPS_BPF_MAX,
+};
+
+#define IFLA_RPS_BPF_MAX (__IFLA_RPS_BPF_MAX - 1)
+
 #endif /* _UAPI_LINUX_IF_LINK_H */
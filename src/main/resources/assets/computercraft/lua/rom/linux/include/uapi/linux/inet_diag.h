@@ -63,9 +63,21 @@ struct inet_diag_req_raw {
 enum {
 	INET_DIAG_REQ_NONE,
 	INET_DIAG_REQ_BYTECODE,
+	INET_DIAG_REQ_CURSOR,
 };
 
-#define INET_DIAG_REQ_MAX INET_DIAG_REQ_BYTECODE
+#define INET_DIAG_REQ_MAX INET_DIAG_REQ_CURSOR
+
+/* INET_DIAG_REQ_CURSOR: dump only @count buckets of the established hash,
+ * starting at @bucket. Bucket numbers wrap around the table, so a monitor
+ * that keeps adding @count to @bucket sweeps all sockets incrementally.
+ * Listening sockets are reported by the slice covering bucket 0. A @count
+ * of 0 means the whole table.
+ */
+struct inet_diag_cursor {
+	__u32	bucket;
+	__u32	count;
+};
 
 /* Bytecode is sequence of 4 byte commands followed by variable arguments.
  * All the commands identified by "code" are conditional jumps forward:
@@ -91,6 +103,7 @@ enum {
 	INET_DIAG_BC_D_COND,
 	INET_DIAG_BC_DEV_COND,   /* u32 ifindex */
 	INET_DIAG_BC_MARK_COND,
+	INET_DIAG_BC_FIELD_COND,	/* struct inet_diag_fieldcond */
 };
 
 struct inet_diag_hostcond {
@@ -105,6 +118,34 @@ struct inet_diag_markcond {
 	__u32 mask;
 };
 
+/* Compare a socket field against @value */
+struct inet_diag_fieldcond {
+	__u16	field;		/* INET_DIAG_FIELD_* */
+	__u8	cmp;		/* INET_DIAG_CMP_* */
+	__u8	pad;
+	__u64	value;
+};
+
+enum {
+	INET_DIAG_FIELD_STATE,		/* TCP state, substate for timewait */
+	INET_DIAG_FIELD_UID,		/* 0 for timewait and request socks */
+	INET_DIAG_FIELD_INODE,		/* 0 for timewait and request socks */
+	INET_DIAG_FIELD_COOKIE,
+	INET_DIAG_FIELD_RMEM,		/* receive queue memory, in bytes */
+	INET_DIAG_FIELD_WMEM,		/* send queue memory, in bytes */
+	__INET_DIAG_FIELD_MAX,
+};
+
+enum {
+	INET_DIAG_CMP_EQ,
+	INET_DIAG_CMP_NE,
+	INET_DIAG_CMP_LT,
+	INET_DIAG_CMP_LE,
+	INET_DIAG_CMP_GT,
+	INET_DIAG_CMP_GE,
+	__INET_DIAG_CMP_MAX,
+};
+
 /* Base info structure. It contains socket identity (addrs/ports/cookie)
  * and, alas, the information shown by netstat. */
 struct inet_diag_msg {
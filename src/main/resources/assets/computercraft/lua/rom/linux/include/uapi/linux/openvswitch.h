@@ -101,7 +101,7 @@ struct ovs_dp_megaflow_stats {
 	__u64 n_mask_hit;	 /* Number of masks used for flow lookups. */
 	__u32 n_masks;		 /* Number of masks for the datapath. */
 	__u32 pad0;		 /* Pad for future expension. */
-	__u64 pad1;		 /* Pad for future expension. */
+	__u64 n_cache_hit;       /* Num of cache hits for flow lookups. */
 	__u64 pad2;		 /* Pad for future expension. */
 };
 
@@ -122,6 +122,11 @@ struct ovs_vport_stats {
 /* Allow datapath to associate multiple Netlink PIDs to each vport */
 #define OVS_DP_F_VPORT_PIDS	(1 << 1)
 
+/* Allow datapath to pack several upcalls, each with its own nlmsghdr, into
+ * one Netlink datagram.
+ */
+#define OVS_DP_F_UPCALL_BATCH	(1 << 2)
+
 /* Fixed logical ports. */
 #define OVSP_LOCAL      ((__u32)0)
 
@@ -197,4 +197,55 @@ struct prctl_mm_map {
 # define PR_CAP_AMBIENT_LOWER		3
 # define PR_CAP_AMBIENT_CLEAR_ALL	4
 
+/*
+ * Give the process its own hash table for private futexes, allocated on
+ * one NUMA node, instead of sharing the global one.  Only allowed while
+ * the process is single threaded.
+ */
+#define PR_FUTEX_HASH			48
+# define PR_FUTEX_HASH_SET_SLOTS	1
+# define PR_FUTEX_HASH_GET_SLOTS	2
+
+/*
+ * Core scheduling: only tasks with the same cookie may run on the SMT
+ * siblings of a core at the same time.  arg3 is the pid (0 for the
+ * caller), arg4 the scope and for GET arg5 points to a __u64.
+ */
+#define PR_SCHED_CORE			49
+# define PR_SCHED_CORE_GET		0
+# define PR_SCHED_CORE_CREATE		1	/* new cookie for pid */
+# define PR_SCHED_CORE_SHARE_TO		2	/* caller's cookie to pid */
+# define PR_SCHED_CORE_SHARE_FROM	3	/* pid's cookie to caller */
+# define PR_SCHED_CORE_SCOPE_THREAD		0
+# define PR_SCHED_CORE_SCOPE_THREAD_GROUP	1
+# define PR_SCHED_CORE_SCOPE_PROCESS_GROUP	2
+
+/*
+ * Utilization clamping: arg3 is the pid (0 for the caller).  SET takes
+ * the minimum and maximum utilization in arg4 and arg5, from 0 to 1024,
+ * or -1 to go back to the default for that clamp.  GET_MIN and GET_MAX
+ * return the requested values.
+ */
+#define PR_SCHED_UCLAMP			50
+# define PR_SCHED_UCLAMP_SET		1
+# define PR_SCHED_UCLAMP_GET_MIN	2
+# define PR_SCHED_UCLAMP_GET_MAX	3
+
+/*
+ * Let poll() keep the wait queue entries of an fd set between calls, so
+ * repeating the same set only re-polls the fds that saw a wakeup or were
+ * ready last time.  Inherited across fork and kept across execve.
+ */
+#define PR_SET_POLL_CACHE		51
+#define PR_GET_POLL_CACHE		52
+
+/*
+ * Let fdget() keep a reference on the files a thread looked up when its
+ * fd table is shared, so that looking them up again in the same syscall
+ * does not touch f_count.  The references are dropped when the syscall
+ * returns.  Inherited across fork and kept across execve.
+ */
+#define PR_SET_FD_CACHE			53
+#define PR_GET_FD_CACHE			54
+
 #endif /* _LINUX_PRCTL_H */
@@ -282,6 +282,8 @@ enum
 	LINUX_MIB_TCPKEEPALIVE,			/* TCPKeepAlive */
 	LINUX_MIB_TCPMTUPFAIL,			/* TCPMTUPFail */
 	LINUX_MIB_TCPMTUPSUCCESS,		/* TCPMTUPSuccess */
+	LINUX_MIB_TCPZEROCOPYRXMAPPED,		/* TCPZeroCopyRxMapped */
+	LINUX_MIB_TCPZEROCOPYRXSKIP,		/* TCPZeroCopyRxSkip */
 	__LINUX_MIB_MAX
 };
 
@@ -33,7 +33,7 @@
  */
 
 
-#define TASKSTATS_VERSION	8
+#define TASKSTATS_VERSION	9
 #define TS_COMM_LEN		32	/* should be >= TASK_COMM_LEN
 					 * in linux/sched.h */
 
@@ -163,6 +163,17 @@ struct taskstats {
 	/* Delay waiting for memory reclaim */
 	__u64	freepages_count;
 	__u64	freepages_delay_total;
+	/* version 8 ends here */
+
+	/* Current memory usage in KB, filled in with extended accounting */
+	__u64	rss_anon;		/* resident anonymous pages */
+	__u64	rss_file;		/* resident file mappings */
+	__u64	rss_shmem;		/* resident shmem pages */
+	__u64	swap;			/* swapped out anonymous pages */
+
+	/* Proportional set size in KB, only with TASKSTATS_CMD_ATTR_MEM_PSS */
+	__u64	pss;
+	__u64	swap_pss;
 };
 
 
@@ -200,6 +211,8 @@ enum {
 	TASKSTATS_CMD_ATTR_TGID,
 	TASKSTATS_CMD_ATTR_REGISTER_CPUMASK,
 	TASKSTATS_CMD_ATTR_DEREGISTER_CPUMASK,
+	TASKSTATS_CMD_ATTR_PID_LIST,	/* array of u32 pids, dump only */
+	TASKSTATS_CMD_ATTR_MEM_PSS,	/* flag: also walk page tables for PSS */
 	__TASKSTATS_CMD_ATTR_MAX,
 };
 
@@ -19,6 +19,12 @@
 #include <linux/syscalls.h>
 #include <linux/utime.h>
 #include <linux/file.h>
+#include <linux/async.h>
+#include <linux/cpumask.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+#include <linux/completion.h>
+#include <asm/unaligned.h>
 
 static ssize_t __init xwrite(int fd, const char *p, size_t count)
 {
@@ -447,6 +453,150 @@ static unsigned long my_inptr; /* index of next byte to be processed in inbuf */
 
 #include <linux/decompress/generic.h>
 
+/*
+ * Block-parallel archive: a header, a table with the compressed and
+ * uncompressed size of each chunk, then the chunks themselves.  Every
+ * chunk is a complete xz or lz4 stream and the concatenation of the
+ * uncompressed chunks is a cpio archive, so chunk boundaries need not
+ * line up with cpio entries.  Chunks are decoded on all CPUs and fed to
+ * the cpio parser in order; at most two per CPU are in flight.
+ */
+#define PAR_MAGIC	"INITPAR1"
+
+struct par_header {
+	char magic[8];
+	__le32 nr_chunks;
+	__le32 reserved;
+};
+
+struct par_chunk {
+	__le32 csize;
+	__le32 usize;
+};
+
+struct par_work {
+	struct work_struct work;
+	struct completion done;
+	decompress_fn decompress;
+	unsigned char *in;
+	unsigned long in_len;
+	unsigned char *out;
+	unsigned long out_len;
+	int res;
+};
+
+static void __init par_error(char *x)
+{
+	pr_err("initramfs: %s\n", x);
+}
+
+static void __init par_work_fn(struct work_struct *work)
+{
+	struct par_work *pw = container_of(work, struct par_work, work);
+	long pos;
+
+	pw->res = pw->decompress(pw->in, pw->in_len, NULL, NULL, pw->out,
+				 &pos, par_error);
+	complete(&pw->done);
+}
+
+static void __init par_start(struct par_work *pw, char *in,
+			     unsigned long csize, unsigned long usize)
+{
+	const char *name;
+
+	INIT_WORK(&pw->work, par_work_fn);
+	init_completion(&pw->done);
+	pw->in = in;
+	pw->in_len = csize;
+	pw->out_len = usize;
+	pw->res = -EINVAL;
+
+	pw->decompress = decompress_method(in, csize, &name);
+	if (!pw->decompress || !name ||
+	    (strcmp(name, "xz") && strcmp(name, "lz4"))) {
+		pw->out = NULL;
+		complete(&pw->done);
+		return;
+	}
+	pw->out = vmalloc(usize);
+	if (!pw->out) {
+		pw->res = -ENOMEM;
+		complete(&pw->done);
+		return;
+	}
+	queue_work(system_unbound_wq, &pw->work);
+}
+
+static bool __init is_par_archive(const char *buf, unsigned long len)
+{
+	return len >= sizeof(struct par_header) &&
+	       !memcmp(buf, PAR_MAGIC, sizeof(((struct par_header *)0)->magic));
+}
+
+/* Returns the number of bytes of @buf taken by the archive */
+static unsigned long __init unpack_par(char *buf, unsigned long len)
+{
+	const struct par_header *hdr = (const struct par_header *)buf;
+	const struct par_chunk *table;
+	struct par_work *works;
+	unsigned long total, pos;
+	unsigned int nr, window, started, i;
+
+	nr = get_unaligned_le32(&hdr->nr_chunks);
+	total = sizeof(*hdr) + (unsigned long)nr * sizeof(*table);
+	if (!nr || total > len) {
+		error("bad parallel archive header");
+		return len;
+	}
+	table = (const struct par_chunk *)(buf + sizeof(*hdr));
+	for (i = 0; i < nr; i++) {
+		total += get_unaligned_le32(&table[i].csize);
+		if (total > len) {
+			error("truncated parallel archive");
+			return len;
+		}
+	}
+
+	window = min(nr, 2 * num_online_cpus());
+	works = kcalloc(window, sizeof(*works), GFP_KERNEL);
+	if (!works) {
+		error("can't allocate parallel archive buffers");
+		return len;
+	}
+
+	pos = sizeof(*hdr) + (unsigned long)nr * sizeof(*table);
+	for (started = 0; started < window; started++) {
+		par_start(&works[started], buf + pos,
+			  get_unaligned_le32(&table[started].csize),
+			  get_unaligned_le32(&table[started].usize));
+		pos += get_unaligned_le32(&table[started].csize);
+	}
+
+	for (i = 0; i < started; i++) {
+		struct par_work *pw = &works[i % window];
+
+		wait_for_completion(&pw->done);
+		if (pw->res)
+			error("decompressor failed");
+		else
+			flush_buffer(pw->out, pw->out_len);
+		vfree(pw->out);
+
+		/* Reuse the slot for the next chunk unless we've failed */
+		if (started < nr && !message) {
+			par_start(pw, buf + pos,
+				  get_unaligned_le32(&table[started].csize),
+				  get_unaligned_le32(&table[started].usize));
+			pos += get_unaligned_le32(&table[started].csize);
+			started++;
+		}
+	}
+	kfree(works);
+
+	return total;
+}
+
 static char * __init unpack_to_rootfs(char *buf, unsigned long len)
 {
 	long written;
@@ -480,6 +630,11 @@ static char * __init unpack_to_rootfs(char *buf, unsigned long len)
 			continue;
 		}
 		this_header = 0;
+		if (is_par_archive(buf, len)) {
+			pr_debug("Detected parallel compressed data\n");
+			my_inptr = unpack_par(buf, len);
+			goto next;
+		}
 		decompress = decompress_method(buf, len, &compress_name);
 		pr_debug("Detected %s compressed data\n", compress_name);
 		if (decompress) {
@@ -496,6 +651,7 @@ static char * __init unpack_to_rootfs(char *buf, unsigned long len)
 			}
 		} else
 			error("junk in compressed archive");
+next:
 		if (state != Reset)
 			error("junk in compressed archive");
 		this_header = saved_offset + my_inptr;
@@ -606,7 +762,35 @@ static void __init clean_rootfs(void)
 }
 #endif
 
-static int __init populate_rootfs(void)
+/*
+ * The archives are unpacked asynchronously so that the rest of the
+ * initcalls do not have to wait for it; anything that needs files from
+ * the initramfs has to call wait_for_initramfs() first.
+ */
+static bool __initdata initramfs_async = true;
+static int __init initramfs_async_setup(char *str)
+{
+	strtobool(str, &initramfs_async);
+	return 1;
+}
+__setup("initramfs_async=", initramfs_async_setup);
+
+static async_cookie_t initramfs_cookie;
+static ASYNC_DOMAIN_EXCLUSIVE(initramfs_domain);
+
+/**
+ * wait_for_initramfs - wait until the initramfs has been unpacked
+ */
+void wait_for_initramfs(void)
+{
+	if (!initramfs_cookie)
+		return;
+	async_synchronize_cookie_domain(initramfs_cookie + 1,
+					&initramfs_domain);
+}
+EXPORT_SYMBOL_GPL(wait_for_initramfs);
+
+static void __init do_populate_rootfs(void *unused, async_cookie_t cookie)
 {
 	char *err = unpack_to_rootfs(__initramfs_start, __initramfs_size);
 	if (err)
@@ -651,10 +835,23 @@ static int __init populate_rootfs(void)
 		flush_delayed_fput();
 		/*
 		 * Try loading default modules from initramfs.  This gives
-		 * us a chance to load before device_initcalls.
+		 * us a chance to load before device_initcalls.  Loading a
+		 * module from here would wait for ourselves when we run
+		 * asynchronously, kernel_init_freeable() does it then.
 		 */
-		load_default_modules();
+		if (!initramfs_async)
+			load_default_modules();
 	}
+}
+
+static int __init populate_rootfs(void)
+{
+	if (initramfs_async)
+		initramfs_cookie = async_schedule_domain(do_populate_rootfs,
+							 NULL,
+							 &initramfs_domain);
+	else
+		do_populate_rootfs(NULL, 0);
 	return 0;
 }
 rootfs_initcall(populate_rootfs);
@@ -100,6 +100,7 @@ static int kernel_init(void *);
 extern void init_IRQ(void);
 extern void fork_init(void);
 extern void radix_tree_init(void);
+extern void maple_tree_init(void);
 
 /*
  * Debug helper: via this flag we know that we are in 'early bootup code'
@@ -479,7 +480,6 @@ static void __init mm_init(void)
 	page_ext_init_flatmem();
 	mem_init();
 	kmem_cache_init();
-	percpu_init_late();
 	pgtable_init();
 	vmalloc_init();
 	ioremap_huge_init();
@@ -560,6 +560,7 @@ asmlinkage __visible void __init start_kernel(void)
 		 "Interrupts were enabled *very* early, fixing it\n"))
 		local_irq_disable();
 	radix_tree_init();
+	maple_tree_init();
 
 	/*
 	 * Allow workqueue creation and work item queueing/cancelling
@@ -759,6 +760,55 @@ static bool __init_or_module initcall_blacklisted(initcall_t fn)
 #endif
 __setup("initcall_blacklist=", initcall_blacklist);
 
+/*
+ * Boot critical path as seen by initcall_debug: the time spent running
+ * initcalls serially, the slowest of them, and how long init then waited
+ * for the asynchronous work (probes included) they left behind.
+ */
+#define INITCALL_SLOWEST	8
+
+struct initcall_timing {
+	initcall_t fn;
+	unsigned long long usecs;
+};
+
+static struct initcall_timing initcall_slowest[INITCALL_SLOWEST];
+static unsigned long long initcall_total_usecs;
+static unsigned long long initcall_async_wait_usecs;
+
+static void __init_or_module initcall_timing_record(initcall_t fn,
+						    unsigned long long usecs)
+{
+	int i;
+
+	if (system_state != SYSTEM_BOOTING)
+		return;
+
+	initcall_total_usecs += usecs;
+	for (i = 0; i < INITCALL_SLOWEST; i++)
+		if (usecs > initcall_slowest[i].usecs)
+			break;
+	if (i == INITCALL_SLOWEST)
+		return;
+
+	memmove(&initcall_slowest[i + 1], &initcall_slowest[i],
+		(INITCALL_SLOWEST - i - 1) * sizeof(initcall_slowest[0]));
+	initcall_slowest[i].fn = fn;
+	initcall_slowest[i].usecs = usecs;
+}
+
+static void __init initcall_timing_report(void)
+{
+	int i;
+
+	pr_info("initcall: %llu usecs in initcalls, %llu usecs waiting for async work\n",
+		initcall_total_usecs, initcall_async_wait_usecs);
+	for (i = 0; i < INITCALL_SLOWEST && initcall_slowest[i].fn; i++)
+		pr_info("initcall: %8llu usecs %pF\n",
+			initcall_slowest[i].usecs, initcall_slowest[i].fn);
+	driver_probe_timing_report();
+}
+
 static int __init_or_module do_one_initcall_debug(initcall_t fn)
 {
 	ktime_t calltime, delta, rettime;
@@ -773,6 +823,7 @@ static int __init_or_module do_one_initcall_debug(initcall_t fn)
 	duration = (unsigned long long) ktime_to_ns(delta) >> 10;
 	printk(KERN_DEBUG "initcall %pF returned %d after %lld usecs\n",
 		 fn, ret, duration);
+	initcall_timing_record(fn, duration);
 
 	return ret;
 }
@@ -958,7 +1009,16 @@ static int __ref kernel_init(void *unused)
 
 	kernel_init_freeable();
 	/* need to finish all async __init code before freeing the memory */
-	async_synchronize_full();
+	if (initcall_debug) {
+		ktime_t calltime = ktime_get();
+
+		async_synchronize_full();
+		initcall_async_wait_usecs =
+			ktime_to_us(ktime_sub(ktime_get(), calltime));
+		initcall_timing_report();
+	} else {
+		async_synchronize_full();
+	}
 	free_initmem();
 	mark_readonly();
 	system_state = SYSTEM_RUNNING;
@@ -1029,11 +1089,14 @@ static noinline void __init kernel_init_freeable(void)
 
 	smp_init();
 	sched_init_smp();
+	workqueue_init_topology();
 
 	page_alloc_init_late();
 
 	do_basic_setup();
 
+	wait_for_initramfs();
+
 	/* Open the /dev/console on the rootfs, this should never fail */
 	if (sys_open((const char __user *) "/dev/console", O_RDWR, 0) < 0)
 		pr_err("Warning: unable to open an initial console.\n");
@@ -104,6 +104,7 @@ struct sem {
 	struct list_head pending_const; /* pending single-sop operations */
 					/* that do not alter the semaphore*/
 	time_t	sem_otime;	/* candidate for sem_otime */
+	unsigned int update_gen; /* sma->update_gen when last changed */
 } ____cacheline_aligned_in_smp;
 
 /* One queue for each sleeping process in the system. */
@@ -172,7 +173,8 @@ static int sysvipc_sem_proc_show(struct seq_file *s, void *it);
  *	sem_undo.id_next,
  *	sem_array.complex_count,
  *	sem_array.pending{_alter,_const},
- *	sem_array.sem_undo
+ *	sem_array.sem_undo,
+ *	sem_array.update_gen, sem_array.sem_base[i].update_gen
  *
  * b) global or semaphore sem_lock() for read/write:
  *	sem_array.sem_base[i].pending_{const,alter}:
@@ -225,7 +227,7 @@ void __init sem_init(void)
 {
 	sem_init_ns(&init_ipc_ns);
 	ipc_init_proc_interface("sysvipc/sem",
-				"       key      semid perms      nsems   uid   gid  cuid  cgid      otime      ctime\n",
+				"       key      semid perms      nsems   uid   gid  cuid  cgid      otime      ctime   gcontended   scontended       sleeps      skipped\n",
 				IPC_SEM_IDS, sysvipc_sem_proc_show);
 }
 
@@ -337,6 +339,23 @@ static void complexmode_tryleave(struct sem_array *sma)
 	}
 }
 
+/* Lock helpers that account contention in the array's statistics */
+static inline void sem_lock_global(struct sem_array *sma)
+{
+	if (unlikely(!spin_trylock(&sma->sem_perm.lock))) {
+		atomic_long_inc(&sma->global_contended);
+		ipc_lock_object(&sma->sem_perm);
+	}
+}
+
+static inline void sem_lock_one(struct sem_array *sma, struct sem *sem)
+{
+	if (unlikely(!spin_trylock(&sem->lock))) {
+		atomic_long_inc(&sma->sem_contended);
+		spin_lock(&sem->lock);
+	}
+}
+
 #define SEM_GLOBAL_LOCK	(-1)
 /*
  * If the request contains only one semaphore operation, and there are
@@ -352,7 +371,7 @@ static inline int sem_lock(struct sem_array *sma, struct sembuf *sops,
 
 	if (nsops != 1) {
 		/* Complex operation - acquire a full lock */
-		ipc_lock_object(&sma->sem_perm);
+		sem_lock_global(sma);
 
 		/* Prevent parallel simple ops */
 		complexmode_enter(sma);
@@ -377,7 +396,7 @@ static inline int sem_lock(struct sem_array *sma, struct sembuf *sops,
 		 * It appears that no complex operation is around.
 		 * Acquire the per-semaphore lock.
 		 */
-		spin_lock(&sem->lock);
+		sem_lock_one(sma, sem);
 
 		/* pairs with smp_store_release() */
 		if (!smp_load_acquire(&sma->use_global_lock)) {
@@ -388,7 +407,7 @@ static inline int sem_lock(struct sem_array *sma, struct sembuf *sops,
 	}
 
 	/* slow path: acquire the full lock */
-	ipc_lock_object(&sma->sem_perm);
+	sem_lock_global(sma);
 
 	if (sma->use_global_lock == 0) {
 		/*
@@ -884,10 +903,37 @@ static int do_smart_wakeup_zero(struct sem_array *sma, struct sembuf *sops,
 }
 
 
+/*
+ * A sleeping operation can only proceed once the semaphore it blocked on
+ * has changed: that one still fails otherwise.  While the global queue
+ * is scanned after a known set of changes, the semaphores touched are
+ * tagged with the current sma->update_gen and operations blocked
+ * elsewhere are not retried.
+ */
+static void sem_mark_changed(struct sem_array *sma, struct sembuf *sops,
+			     int nsops)
+{
+	int i;
+
+	for (i = 0; i < nsops; i++)
+		if (sops[i].sem_op)
+			sma->sem_base[sops[i].sem_num].update_gen =
+							sma->update_gen;
+}
+
+static inline bool sem_queue_may_proceed(struct sem_array *sma,
+					 struct sem_queue *q)
+{
+	return sma->sem_base[q->blocking->sem_num].update_gen ==
+							sma->update_gen;
+}
+
 /**
  * update_queue - look for tasks that can be completed.
  * @sma: semaphore array.
  * @semnum: semaphore that was modified.
+ * @filter: only retry operations blocked on semaphores tagged by
+ *	    sem_mark_changed(), for semnum = -1.
  * @wake_q: lockless wake-queue head.
  *
  * update_queue must be called after a semaphore in a semaphore array
@@ -900,7 +946,8 @@ static int do_smart_wakeup_zero(struct sem_array *sma, struct sembuf *sops,
  *
  * The function return 1 if at least one semop was completed successfully.
  */
-static int update_queue(struct sem_array *sma, int semnum, struct wake_q_head *wake_q)
+static int update_queue(struct sem_array *sma, int semnum, bool filter,
+			struct wake_q_head *wake_q)
 {
 	struct sem_queue *q, *tmp;
 	struct list_head *pending_list;
@@ -925,6 +972,11 @@ again:
 		if (semnum != -1 && sma->sem_base[semnum].semval == 0)
 			break;
 
+		if (filter && !sem_queue_may_proceed(sma, q)) {
+			atomic_long_inc(&sma->retries_skipped);
+			continue;
+		}
+
 		error = perform_atomic_semop(sma, q);
 
 		/* Does q->sleeper still need to sleep? */
@@ -937,6 +989,8 @@ again:
 			restart = 0;
 		} else {
 			semop_completed = 1;
+			if (filter)
+				sem_mark_changed(sma, q->sops, q->nsops);
 			do_smart_wakeup_zero(sma, q->sops, q->nsops, wake_q);
 			restart = check_restart(sma, q);
 		}
@@ -988,8 +1042,15 @@ static void do_smart_update(struct sem_array *sma, struct sembuf *sops, int nsop
 	otime |= do_smart_wakeup_zero(sma, sops, nsops, wake_q);
 
 	if (!list_empty(&sma->pending_alter)) {
-		/* semaphore array uses the global queue - just process it. */
-		otime |= update_queue(sma, -1, wake_q);
+		/*
+		 * semaphore array uses the global queue - process it,
+		 * skipping operations that can't have been unblocked.
+		 */
+		if (sops) {
+			sma->update_gen++;
+			sem_mark_changed(sma, sops, nsops);
+		}
+		otime |= update_queue(sma, -1, sops != NULL, wake_q);
 	} else {
 		if (!sops) {
 			/*
@@ -997,7 +1058,7 @@ static void do_smart_update(struct sem_array *sma, struct sembuf *sops, int nsop
 			 * known. Check all.
 			 */
 			for (i = 0; i < sma->sem_nsems; i++)
-				otime |= update_queue(sma, i, wake_q);
+				otime |= update_queue(sma, i, false, wake_q);
 		} else {
 			/*
 			 * Check the semaphores that were increased:
@@ -1011,7 +1072,8 @@ static void do_smart_update(struct sem_array *sma, struct sembuf *sops, int nsop
 			for (i = 0; i < nsops; i++) {
 				if (sops[i].sem_op > 0) {
 					otime |= update_queue(sma,
-							      sops[i].sem_num, wake_q);
+							      sops[i].sem_num,
+							      false, wake_q);
 				}
 			}
 		}
@@ -1930,6 +1992,7 @@ SYSCALL_DEFINE4(semtimedop, int, semid, struct sembuf __user *, tsops,
 	 * We need to sleep on this operation, so we put the current
 	 * task into the pending queue and go to sleep.
 	 */
+	atomic_long_inc(&sma->sleeps);
 	if (nsops == 1) {
 		struct sem *curr;
 		curr = &sma->sem_base[sops->sem_num];
@@ -2198,7 +2261,7 @@ static int sysvipc_sem_proc_show(struct seq_file *s, void *it)
 	sem_otime = get_semotime(sma);
 
 	seq_printf(s,
-		   "%10d %10d  %4o %10u %5u %5u %5u %5u %10lu %10lu\n",
+		   "%10d %10d  %4o %10u %5u %5u %5u %5u %10lu %10lu %12lu %12lu %12lu %12lu\n",
 		   sma->sem_perm.key,
 		   sma->sem_perm.id,
 		   sma->sem_perm.mode,
@@ -2208,7 +2271,11 @@ static int sysvipc_sem_proc_show(struct seq_file *s, void *it)
 		   from_kuid_munged(user_ns, sma->sem_perm.cuid),
 		   from_kgid_munged(user_ns, sma->sem_perm.cgid),
 		   sem_otime,
-		   sma->sem_ctime);
+		   sma->sem_ctime,
+		   atomic_long_read(&sma->global_contended),
+		   atomic_long_read(&sma->sem_contended),
+		   atomic_long_read(&sma->sleeps),
+		   atomic_long_read(&sma->retries_skipped));
 
 	complexmode_tryleave(sma);
 
@@ -13,6 +13,7 @@
 #include <linux/err.h>
 #include <linux/slab.h>
 #include <linux/mm.h>
+#include <linux/vmalloc.h>
 #include <linux/filter.h>
 #include <linux/perf_event.h>
 
@@ -42,17 +43,36 @@ static int bpf_array_alloc_percpu(struct bpf_array *array)
 	return 0;
 }
 
+/* An mmapable array lives in vmalloc_user() memory laid out so that
+ * array->value starts on the second page; user space maps from there on
+ * and never sees struct bpf_array itself.
+ */
+static void *array_map_vmalloc_addr(struct bpf_array *array)
+{
+	return (void *)round_down((unsigned long)array, PAGE_SIZE);
+}
+
+static bool array_map_mmapable(const struct bpf_array *array)
+{
+	return array->map.map_flags & BPF_F_MMAPABLE;
+}
+
 /* Called from syscall */
 static struct bpf_map *array_map_alloc(union bpf_attr *attr)
 {
 	bool percpu = attr->map_type == BPF_MAP_TYPE_PERCPU_ARRAY;
+	bool mmapable = attr->map_flags & BPF_F_MMAPABLE;
 	struct bpf_array *array;
 	u64 array_size;
 	u32 elem_size;
+	void *data;
 
 	/* check sanity of attributes */
 	if (attr->max_entries == 0 || attr->key_size != 4 ||
-	    attr->value_size == 0 || attr->map_flags)
+	    attr->value_size == 0 || attr->map_flags & ~BPF_F_MMAPABLE)
+		return ERR_PTR(-EINVAL);
+
+	if (mmapable && attr->map_type != BPF_MAP_TYPE_ARRAY)
 		return ERR_PTR(-EINVAL);
 
 	if (attr->value_size > KMALLOC_MAX_SIZE)
@@ -66,6 +86,9 @@ static struct bpf_map *array_map_alloc(union bpf_attr *attr)
 	array_size = sizeof(*array);
 	if (percpu)
 		array_size += (u64) attr->max_entries * sizeof(void *);
+	else if (mmapable)
+		array_size = PAGE_ALIGN(array_size) +
+			     PAGE_ALIGN((u64) attr->max_entries * elem_size);
 	else
 		array_size += (u64) attr->max_entries * elem_size;
 
@@ -74,15 +97,24 @@ static struct bpf_map *array_map_alloc(union bpf_attr *attr)
 		return ERR_PTR(-ENOMEM);
 
 	/* allocate all map elements and zero-initialize them */
-	array = bpf_map_area_alloc(array_size);
-	if (!array)
-		return ERR_PTR(-ENOMEM);
+	if (mmapable) {
+		data = vmalloc_user(array_size);
+		if (!data)
+			return ERR_PTR(-ENOMEM);
+		array = data + PAGE_ALIGN(sizeof(*array)) -
+			offsetof(struct bpf_array, value);
+	} else {
+		array = bpf_map_area_alloc(array_size);
+		if (!array)
+			return ERR_PTR(-ENOMEM);
+	}
 
 	/* copy mandatory map attributes */
 	array->map.map_type = attr->map_type;
 	array->map.key_size = attr->key_size;
 	array->map.value_size = attr->value_size;
 	array->map.max_entries = attr->max_entries;
+	array->map.map_flags = attr->map_flags;
 	array->elem_size = elem_size;
 
 	if (!percpu)
@@ -257,7 +289,28 @@ static void array_map_free(struct bpf_map *map)
 	if (array->map.map_type == BPF_MAP_TYPE_PERCPU_ARRAY)
 		bpf_array_free_percpu(array);
 
-	bpf_map_area_free(array);
+	if (array_map_mmapable(array))
+		vfree(array_map_vmalloc_addr(array));
+	else
+		bpf_map_area_free(array);
+}
+
+/* Called from syscall */
+static int array_map_mmap(struct bpf_map *map, struct vm_area_struct *vma)
+{
+	struct bpf_array *array = container_of(map, struct bpf_array, map);
+	pgoff_t pgoff = PAGE_ALIGN(sizeof(*array)) >> PAGE_SHIFT;
+
+	if (!array_map_mmapable(array))
+		return -EINVAL;
+
+	/* the area size remap_vmalloc_range() checks against has a guard page */
+	if (vma->vm_pgoff + vma_pages(vma) >
+	    PAGE_ALIGN((u64) map->max_entries * array->elem_size) >> PAGE_SHIFT)
+		return -EINVAL;
+
+	return remap_vmalloc_range(vma, array_map_vmalloc_addr(array),
+				   vma->vm_pgoff + pgoff);
 }
 
 static const struct bpf_map_ops array_ops = {
@@ -267,6 +320,7 @@ static const struct bpf_map_ops array_ops = {
 	.map_lookup_elem = array_map_lookup_elem,
 	.map_update_elem = array_map_update_elem,
 	.map_delete_elem = array_map_delete_elem,
+	.map_mmap = array_map_mmap,
 };
 
 static struct bpf_map_type_list array_type __ro_after_init = {
@@ -7,6 +7,8 @@
 #include <linux/cpumask.h>
 #include <linux/spinlock.h>
 #include <linux/percpu.h>
+#include <linux/slab.h>
+#include <linux/sched/clock.h>
 
 #include "bpf_lru_list.h"
 
@@ -16,6 +18,8 @@
 #define PERCPU_FREE_TARGET		(16)
 #define PERCPU_NR_SCANS			PERCPU_FREE_TARGET
 
+#define SHARD_NR_SCANS			(32)
+
 /* Helpers to get the local list index */
 #define LOCAL_LIST_IDX(t)	((t) - BPF_LOCAL_LIST_T_OFFSET)
 #define LOCAL_FREE_LIST_IDX	LOCAL_LIST_IDX(BPF_LRU_LOCAL_LIST_T_FREE)
@@ -494,9 +498,160 @@ static struct bpf_lru_node *bpf_common_lru_pop_free(struct bpf_lru *lru,
 	return node;
 }
 
+/* Sharded LRU
+ *
+ * The common LRU funnels every CPU that runs out of local free nodes
+ * through one list lock.  The sharded LRU instead splits the nodes over
+ * nr_shards independently locked shards and picks the shard by the hash
+ * of the key, so inserts spread evenly and the least recently used
+ * elements of all shards together are about those of the whole map.
+ *
+ * Within a shard strict LRU order is given up for a CLOCK approximation:
+ * the nodes in use sit in a ring and the hand sweeps it, clearing ref bits
+ * and evicting the first node that was not referenced since the last
+ * sweep.  Nothing moves on access, lookups only set the ref bit.
+ */
+static void bpf_lru_shard_lock(struct bpf_lru_shard *s, unsigned long *flags)
+{
+	u64 start;
+
+	local_irq_save(*flags);
+	if (likely(raw_spin_trylock(&s->lock)))
+		return;
+
+	start = local_clock();
+	raw_spin_lock(&s->lock);
+	s->stats.lock_contended++;
+	s->stats.lock_wait_ns += local_clock() - start;
+}
+
+static void bpf_lru_shard_unlock(struct bpf_lru_shard *s, unsigned long flags)
+{
+	raw_spin_unlock_irqrestore(&s->lock, flags);
+}
+
+static void __bpf_lru_shard_del(struct bpf_lru_shard *s,
+				struct bpf_lru_node *node)
+{
+	if (&node->list == s->hand)
+		s->hand = node->list.next;
+	list_del(&node->list);
+}
+
+static struct bpf_lru_node *__bpf_lru_shard_evict(struct bpf_lru *lru,
+						  struct bpf_lru_shard *s)
+{
+	struct list_head *cur = s->hand;
+	struct bpf_lru_node *node;
+	unsigned int i;
+
+	if (list_empty(&s->clock))
+		return NULL;
+
+	for (i = 0; i < lru->nr_scans; i++) {
+		if (cur == &s->clock)
+			cur = cur->next;
+		node = list_entry(cur, struct bpf_lru_node, list);
+		cur = cur->next;
+
+		if (bpf_lru_node_is_ref(node)) {
+			node->ref = 0;
+			s->stats.second_chances++;
+		} else if (lru->del_from_htab(lru->del_arg, node)) {
+			s->hand = cur;
+			goto evicted;
+		}
+	}
+	s->hand = cur;
+
+	/* Everything in reach was referenced, give up on the ref bit */
+	list_for_each_entry(node, &s->clock, list) {
+		if (lru->del_from_htab(lru->del_arg, node)) {
+			s->stats.evictions_forced++;
+			goto evicted;
+		}
+	}
+
+	return NULL;
+
+evicted:
+	__bpf_lru_shard_del(s, node);
+	s->stats.evictions++;
+	return node;
+}
+
+static struct bpf_lru_node *__bpf_lru_shard_pop(struct bpf_lru *lru,
+						struct bpf_lru_shard *s)
+{
+	struct bpf_lru_node *node;
+
+	node = list_first_entry_or_null(&s->free, struct bpf_lru_node, list);
+	if (node) {
+		list_del(&node->list);
+		return node;
+	}
+
+	return __bpf_lru_shard_evict(lru, s);
+}
+
+/* New nodes go right behind the hand, so they are the last it reaches */
+static void __bpf_lru_shard_add(struct bpf_lru *lru, struct bpf_lru_shard *s,
+				int idx, struct bpf_lru_node *node, u32 hash)
+{
+	*(u32 *)((void *)node + lru->hash_offset) = hash;
+	node->cpu = idx;
+	node->type = BPF_LRU_LIST_T_ACTIVE;
+	node->ref = 0;
+	list_add_tail(&node->list, s->hand);
+}
+
+static struct bpf_lru_node *bpf_sharded_lru_pop_free(struct bpf_lru *lru,
+						     u32 hash)
+{
+	int idx = reciprocal_scale(hash, lru->nr_shards);
+	struct bpf_lru_shard *s = &lru->shards[idx];
+	struct bpf_lru_node *node;
+	unsigned long flags;
+	int i, steal;
+
+	bpf_lru_shard_lock(s, &flags);
+	node = __bpf_lru_shard_pop(lru, s);
+	if (node)
+		__bpf_lru_shard_add(lru, s, idx, node, hash);
+	bpf_lru_shard_unlock(s, flags);
+
+	if (node)
+		return node;
+
+	/* Only when a shard has no node the htab lets go of, e.g. because
+	 * the map has fewer elements than shards.
+	 */
+	for (i = 1; i < lru->nr_shards && !node; i++) {
+		struct bpf_lru_shard *steal_s;
+
+		steal = (idx + i) % lru->nr_shards;
+		steal_s = &lru->shards[steal];
+
+		bpf_lru_shard_lock(steal_s, &flags);
+		node = __bpf_lru_shard_pop(lru, steal_s);
+		bpf_lru_shard_unlock(steal_s, flags);
+	}
+
+	if (node) {
+		bpf_lru_shard_lock(s, &flags);
+		s->stats.steals++;
+		__bpf_lru_shard_add(lru, s, idx, node, hash);
+		bpf_lru_shard_unlock(s, flags);
+	}
+
+	return node;
+}
+
 struct bpf_lru_node *bpf_lru_pop_free(struct bpf_lru *lru, u32 hash)
 {
-	if (lru->percpu)
+	if (lru->sharded)
+		return bpf_sharded_lru_pop_free(lru, hash);
+	else if (lru->percpu)
 		return bpf_percpu_lru_pop_free(lru, hash);
 	else
 		return bpf_common_lru_pop_free(lru, hash);
@@ -550,14 +705,54 @@ static void bpf_percpu_lru_push_free(struct bpf_lru *lru,
 	raw_spin_unlock_irqrestore(&l->lock, flags);
 }
 
+static void bpf_sharded_lru_push_free(struct bpf_lru *lru,
+				      struct bpf_lru_node *node)
+{
+	struct bpf_lru_shard *s = &lru->shards[node->cpu];
+	unsigned long flags;
+
+	if (WARN_ON_ONCE(node->type == BPF_LRU_LIST_T_FREE))
+		return;
+
+	bpf_lru_shard_lock(s, &flags);
+	__bpf_lru_shard_del(s, node);
+	node->type = BPF_LRU_LIST_T_FREE;
+	node->ref = 0;
+	list_add(&node->list, &s->free);
+	bpf_lru_shard_unlock(s, flags);
+}
+
 void bpf_lru_push_free(struct bpf_lru *lru, struct bpf_lru_node *node)
 {
-	if (lru->percpu)
+	if (lru->sharded)
+		bpf_sharded_lru_push_free(lru, node);
+	else if (lru->percpu)
 		bpf_percpu_lru_push_free(lru, node);
 	else
 		bpf_common_lru_push_free(lru, node);
 }
 
+/* The counters of all shards added up, without taking the shard locks */
+void bpf_lru_shard_stats(struct bpf_lru *lru, struct bpf_lru_shard_stats *sum)
+{
+	const struct bpf_lru_shard_stats *st;
+	unsigned int i;
+
+	memset(sum, 0, sizeof(*sum));
+	if (!lru->sharded)
+		return;
+
+	for (i = 0; i < lru->nr_shards; i++) {
+		st = &lru->shards[i].stats;
+		sum->evictions += READ_ONCE(st->evictions);
+		sum->evictions_forced += READ_ONCE(st->evictions_forced);
+		sum->second_chances += READ_ONCE(st->second_chances);
+		sum->steals += READ_ONCE(st->steals);
+		sum->lock_contended += READ_ONCE(st->lock_contended);
+		sum->lock_wait_ns += READ_ONCE(st->lock_wait_ns);
+	}
+}
+
 static void bpf_common_lru_populate(struct bpf_lru *lru, void *buf,
 				    u32 node_offset, u32 elem_size,
 				    u32 nr_elems)
@@ -607,10 +802,32 @@ again:
 	}
 }
 
+static void bpf_sharded_lru_populate(struct bpf_lru *lru, void *buf,
+				     u32 node_offset, u32 elem_size,
+				     u32 nr_elems)
+{
+	u32 i;
+
+	for (i = 0; i < nr_elems; i++) {
+		struct bpf_lru_node *node;
+		int idx = i % lru->nr_shards;
+
+		node = (struct bpf_lru_node *)(buf + node_offset);
+		node->cpu = idx;
+		node->type = BPF_LRU_LIST_T_FREE;
+		node->ref = 0;
+		list_add(&node->list, &lru->shards[idx].free);
+		buf += elem_size;
+	}
+}
+
 void bpf_lru_populate(struct bpf_lru *lru, void *buf, u32 node_offset,
 		      u32 elem_size, u32 nr_elems)
 {
-	if (lru->percpu)
+	if (lru->sharded)
+		bpf_sharded_lru_populate(lru, buf, node_offset, elem_size,
+					 nr_elems);
+	else if (lru->percpu)
 		bpf_percpu_lru_populate(lru, buf, node_offset, elem_size,
 					nr_elems);
 	else
@@ -645,12 +862,33 @@ static void bpf_lru_list_init(struct bpf_lru_list *l)
 	raw_spin_lock_init(&l->lock);
 }
 
-int bpf_lru_init(struct bpf_lru *lru, bool percpu, u32 hash_offset,
-		 del_from_htab_func del_from_htab, void *del_arg)
+static void bpf_lru_shard_init(struct bpf_lru_shard *s)
+{
+	INIT_LIST_HEAD(&s->free);
+	INIT_LIST_HEAD(&s->clock);
+	s->hand = &s->clock;
+	raw_spin_lock_init(&s->lock);
+}
+
+int bpf_lru_init(struct bpf_lru *lru, bool percpu, bool sharded,
+		 u32 hash_offset, del_from_htab_func del_from_htab,
+		 void *del_arg)
 {
 	int cpu;
 
-	if (percpu) {
+	if (sharded) {
+		unsigned int i;
+
+		lru->nr_shards = num_possible_cpus();
+		lru->shards = kcalloc(lru->nr_shards, sizeof(*lru->shards),
+				      GFP_USER | __GFP_NOWARN);
+		if (!lru->shards)
+			return -ENOMEM;
+
+		for (i = 0; i < lru->nr_shards; i++)
+			bpf_lru_shard_init(&lru->shards[i]);
+		lru->nr_scans = SHARD_NR_SCANS;
+	} else if (percpu) {
 		lru->percpu_lru = alloc_percpu(struct bpf_lru_list);
 		if (!lru->percpu_lru)
 			return -ENOMEM;
@@ -681,6 +919,7 @@ int bpf_lru_init(struct bpf_lru *lru, bool percpu, u32 hash_offset,
 	}
 
 	lru->percpu = percpu;
+	lru->sharded = sharded;
 	lru->del_from_htab = del_from_htab;
 	lru->del_arg = del_arg;
 	lru->hash_offset = hash_offset;
@@ -690,7 +929,9 @@ int bpf_lru_init(struct bpf_lru *lru, bool percpu, u32 hash_offset,
 
 void bpf_lru_destroy(struct bpf_lru *lru)
 {
-	if (lru->percpu)
+	if (lru->sharded)
+		kfree(lru->shards);
+	else if (lru->percpu)
 		free_percpu(lru->percpu_lru);
 	else
 		free_percpu(lru->common_lru.local_list);
@@ -50,18 +50,45 @@ struct bpf_common_lru {
 	struct bpf_lru_locallist __percpu *local_list;
 };
 
+struct bpf_lru_shard_stats {
+	u64 evictions;
+	/* evicted although referenced, nothing else in reach could go */
+	u64 evictions_forced;
+	/* ref bits cleared by the clock hand */
+	u64 second_chances;
+	/* nodes taken from another shard */
+	u64 steals;
+	u64 lock_contended;
+	u64 lock_wait_ns;
+};
+
+/* One shard of a sharded LRU: the nodes in use form a ring swept by a
+ * CLOCK hand instead of active/inactive lists.
+ */
+struct bpf_lru_shard {
+	raw_spinlock_t lock;
+	struct list_head free;
+	struct list_head clock;
+	/* The next node the hand looks at, or &clock to wrap around */
+	struct list_head *hand;
+	struct bpf_lru_shard_stats stats;
+} ____cacheline_aligned_in_smp;
+
 typedef bool (*del_from_htab_func)(void *arg, struct bpf_lru_node *node);
 
 struct bpf_lru {
 	union {
 		struct bpf_common_lru common_lru;
 		struct bpf_lru_list __percpu *percpu_lru;
+		struct bpf_lru_shard *shards;
 	};
 	del_from_htab_func del_from_htab;
 	void *del_arg;
 	unsigned int hash_offset;
 	unsigned int nr_scans;
+	unsigned int nr_shards;
 	bool percpu;
+	bool sharded;
 };
 
 static inline void bpf_lru_node_set_ref(struct bpf_lru_node *node)
@@ -72,13 +99,15 @@ static inline void bpf_lru_node_set_ref(struct bpf_lru_node *node)
 	node->ref = 1;
 }
 
-int bpf_lru_init(struct bpf_lru *lru, bool percpu, u32 hash_offset,
-		 del_from_htab_func del_from_htab, void *delete_arg);
+int bpf_lru_init(struct bpf_lru *lru, bool percpu, bool sharded,
+		 u32 hash_offset, del_from_htab_func del_from_htab,
+		 void *delete_arg);
 void bpf_lru_populate(struct bpf_lru *lru, void *buf, u32 node_offset,
 		      u32 elem_size, u32 nr_elems);
 void bpf_lru_destroy(struct bpf_lru *lru);
 struct bpf_lru_node *bpf_lru_pop_free(struct bpf_lru *lru, u32 hash);
 void bpf_lru_push_free(struct bpf_lru *lru, struct bpf_lru_node *node);
 void bpf_lru_promote(struct bpf_lru *lru, struct bpf_lru_node *node);
+void bpf_lru_shard_stats(struct bpf_lru *lru, struct bpf_lru_shard_stats *sum);
 
 #endif
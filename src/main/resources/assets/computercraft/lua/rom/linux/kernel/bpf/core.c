@@ -80,6 +80,7 @@ struct bpf_prog *bpf_prog_alloc(unsigned int size, gfp_t gfp_extra_flags)
 			  gfp_extra_flags;
 	struct bpf_prog_aux *aux;
 	struct bpf_prog *fp;
+	int cpu;
 
 	size = round_up(size, PAGE_SIZE);
 	fp = __vmalloc(size, gfp_flags, PAGE_KERNEL);
@@ -94,6 +95,17 @@ struct bpf_prog *bpf_prog_alloc(unsigned int size, gfp_t gfp_extra_flags)
 		return NULL;
 	}
 
+	fp->stats = alloc_percpu_gfp(struct bpf_prog_stats,
+				     GFP_KERNEL | gfp_extra_flags);
+	if (!fp->stats) {
+		kfree(aux);
+		vfree(fp);
+		return NULL;
+	}
+
+	for_each_possible_cpu(cpu)
+		u64_stats_init(&per_cpu_ptr(fp->stats, cpu)->syncp);
+
 	fp->pages = size / PAGE_SIZE;
 	fp->aux = aux;
 	fp->aux->prog = fp;
@@ -135,10 +147,11 @@ struct bpf_prog *bpf_prog_realloc(struct bpf_prog *fp_old, unsigned int size,
 		fp->pages = pages;
 		fp->aux->prog = fp;
 
-		/* We keep fp->aux from fp_old around in the new
-		 * reallocated structure.
+		/* We keep fp->aux and fp->stats from fp_old around in
+		 * the new reallocated structure.
 		 */
 		fp_old->aux = NULL;
+		fp_old->stats = NULL;
 		__bpf_prog_free(fp_old);
 	}
 
@@ -148,6 +161,7 @@ struct bpf_prog *bpf_prog_realloc(struct bpf_prog *fp_old, unsigned int size,
 void __bpf_prog_free(struct bpf_prog *fp)
 {
 	kfree(fp->aux);
+	free_percpu(fp->stats);
 	vfree(fp);
 }
 
@@ -223,6 +237,13 @@ int bpf_prog_calc_tag(struct bpf_prog *fp)
 	return 0;
 }
 
+static bool bpf_is_call_with_target(const struct bpf_insn *insn)
+{
+	return (insn->code == (BPF_JMP | BPF_CALL) &&
+		insn->src_reg == BPF_PSEUDO_CALL) ||
+	       insn->code == (BPF_JMP | BPF_CALL_ARGS);
+}
+
 static bool bpf_is_jmp_and_has_target(const struct bpf_insn *insn)
 {
 	return BPF_CLASS(insn->code) == BPF_JMP  &&
@@ -239,6 +260,17 @@ static void bpf_adj_branches(struct bpf_prog *prog, u32 pos, u32 delta)
 	u32 i, insn_cnt = prog->len;
 
 	for (i = 0; i < insn_cnt; i++, insn++) {
+		/* Calls of functions of the program keep their offset in
+		 * imm, the same adjustment applies.
+		 */
+		if (bpf_is_call_with_target(insn)) {
+			if (i < pos && i + insn->imm + 1 > pos)
+				insn->imm += delta;
+			else if (i > pos + delta &&
+				 i + insn->imm + 1 <= pos + delta)
+				insn->imm -= delta;
+			continue;
+		}
 		if (!bpf_is_jmp_and_has_target(insn))
 			continue;
 
@@ -763,17 +795,19 @@ noinline u64 __bpf_call_base(u64 r1, u64 r2, u64 r3, u64 r4, u64 r5)
 }
 EXPORT_SYMBOL_GPL(__bpf_call_base);
 
+static u64 __bpf_prog_run_args(u64 r1, u64 r2, u64 r3, u64 r4, u64 r5,
+			       const struct bpf_insn *insn);
+
 /**
- *	__bpf_prog_run - run eBPF program on a given context
- *	@ctx: is the data we are operating on
+ *	___bpf_prog_run - run eBPF function with a prepared frame
+ *	@regs: registers of the frame, FP already points to its stack
  *	@insn: is the array of eBPF instructions
  *
  * Decode and execute eBPF instructions.
  */
-static unsigned int __bpf_prog_run(void *ctx, const struct bpf_insn *insn)
+static u64 ___bpf_prog_run(u64 *regs, const struct bpf_insn *insn)
 {
-	u64 stack[MAX_BPF_STACK / sizeof(u64)];
-	u64 regs[MAX_BPF_REG], tmp;
+	u64 tmp;
 	static const void *jumptable[256] = {
 		[0 ... 255] = &&default_label,
 		/* Now overwrite non-defaults ... */
@@ -831,6 +865,7 @@ static unsigned int __bpf_prog_run(void *ctx, const struct bpf_insn *insn)
 		[BPF_ALU64 | BPF_NEG] = &&ALU64_NEG,
 		/* Call instruction */
 		[BPF_JMP | BPF_CALL] = &&JMP_CALL,
+		[BPF_JMP | BPF_CALL_ARGS] = &&JMP_CALL_ARGS,
 		[BPF_JMP | BPF_CALL | BPF_X] = &&JMP_TAIL_CALL,
 		/* Jumps */
 		[BPF_JMP | BPF_JA] = &&JMP_JA,
@@ -881,9 +916,6 @@ static unsigned int __bpf_prog_run(void *ctx, const struct bpf_insn *insn)
 #define CONT	 ({ insn++; goto select_insn; })
 #define CONT_JMP ({ insn++; goto select_insn; })
 
-	FP = (u64) (unsigned long) &stack[ARRAY_SIZE(stack)];
-	ARG1 = (u64) (unsigned long) ctx;
-
 select_insn:
 	goto *jumptable[insn->code];
 
@@ -1016,6 +1048,15 @@ select_insn:
 						       BPF_R4, BPF_R5);
 		CONT;
 
+	JMP_CALL_ARGS:
+		/* Same convention for a function of this program, which
+		 * starts imm + 1 instructions further and gets a frame
+		 * of its own.
+		 */
+		BPF_R0 = __bpf_prog_run_args(BPF_R1, BPF_R2, BPF_R3, BPF_R4,
+					     BPF_R5, insn + insn->imm + 1);
+		CONT;
+
 	JMP_TAIL_CALL: {
 		struct bpf_map *map = (struct bpf_map *) (unsigned long) BPF_R2;
 		struct bpf_array *array = container_of(map, struct bpf_array, map);
@@ -1226,7 +1267,37 @@ load_byte:
 		WARN_RATELIMIT(1, "unknown opcode %02x\n", insn->code);
 		return 0;
 }
-STACK_FRAME_NON_STANDARD(__bpf_prog_run); /* jump table */
+STACK_FRAME_NON_STANDARD(___bpf_prog_run); /* jump table */
+
+/**
+ *	__bpf_prog_run - run eBPF program on a given context
+ *	@ctx: is the data we are operating on
+ *	@insn: is the array of eBPF instructions
+ */
+static unsigned int __bpf_prog_run(void *ctx, const struct bpf_insn *insn)
+{
+	u64 stack[MAX_BPF_STACK / sizeof(u64)];
+	u64 regs[MAX_BPF_REG];
+
+	FP = (u64) (unsigned long) &stack[ARRAY_SIZE(stack)];
+	ARG1 = (u64) (unsigned long) ctx;
+	return ___bpf_prog_run(regs, insn);
+}
+
+static u64 __bpf_prog_run_args(u64 r1, u64 r2, u64 r3, u64 r4, u64 r5,
+			       const struct bpf_insn *insn)
+{
+	u64 stack[MAX_BPF_STACK / sizeof(u64)];
+	u64 regs[MAX_BPF_REG];
+
+	FP = (u64) (unsigned long) &stack[ARRAY_SIZE(stack)];
+	BPF_R1 = r1;
+	BPF_R2 = r2;
+	BPF_R3 = r3;
+	BPF_R4 = r4;
+	BPF_R5 = r5;
+	return ___bpf_prog_run(regs, insn);
+}
 
 bool bpf_prog_array_compatible(struct bpf_array *array,
 			       const struct bpf_prog *fp)
@@ -1315,6 +1386,10 @@ void bpf_prog_free(struct bpf_prog *fp)
 }
 EXPORT_SYMBOL_GPL(bpf_prog_free);
 
+/* Enabled through the kernel.bpf_stats_enabled sysctl, see BPF_PROG_RUN() */
+DEFINE_STATIC_KEY_FALSE(bpf_stats_enabled_key);
+EXPORT_SYMBOL(bpf_stats_enabled_key);
+
 /* RNG for unpriviledged user space with separated state from prandom_u32(). */
 static DEFINE_PER_CPU(struct rnd_state, bpf_user_rnd_state);
 
@@ -1355,6 +1430,9 @@ const struct bpf_func_proto bpf_get_current_pid_tgid_proto __weak;
 const struct bpf_func_proto bpf_get_current_uid_gid_proto __weak;
 const struct bpf_func_proto bpf_get_current_comm_proto __weak;
 
+const struct bpf_func_proto bpf_ringbuf_output_proto __weak;
+const struct bpf_func_proto bpf_ringbuf_query_proto __weak;
+
 const struct bpf_func_proto * __weak bpf_get_trace_printk_proto(void)
 {
 	return NULL;
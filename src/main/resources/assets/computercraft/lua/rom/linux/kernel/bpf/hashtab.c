@@ -14,6 +14,8 @@
 #include <linux/jhash.h>
 #include <linux/filter.h>
 #include <linux/rculist_nulls.h>
+#include <linux/uaccess.h>
+#include <linux/seq_file.h>
 #include "percpu_freelist.h"
 #include "bpf_lru_list.h"
 
@@ -154,6 +156,7 @@ skip_percpu_elems:
 	if (htab_is_lru(htab))
 		err = bpf_lru_init(&htab->lru,
 				   htab->map.map_flags & BPF_F_NO_COMMON_LRU,
+				   htab->map.map_flags & BPF_F_LRU_SHARDED,
 				   offsetof(struct htab_elem, hash) -
 				   offsetof(struct htab_elem, lru_node),
 				   htab_lru_map_delete_node,
@@ -226,6 +229,7 @@ static struct bpf_map *htab_map_alloc(union bpf_attr *attr)
 	 * nothing to do with the map's value.
 	 */
 	bool percpu_lru = (attr->map_flags & BPF_F_NO_COMMON_LRU);
+	bool sharded_lru = (attr->map_flags & BPF_F_LRU_SHARDED);
 	bool prealloc = !(attr->map_flags & BPF_F_NO_PREALLOC);
 	struct bpf_htab *htab;
 	int err, i;
@@ -242,11 +246,16 @@ static struct bpf_map *htab_map_alloc(union bpf_attr *attr)
 		 */
 		return ERR_PTR(-EPERM);
 
-	if (attr->map_flags & ~(BPF_F_NO_PREALLOC | BPF_F_NO_COMMON_LRU))
+	if (attr->map_flags & ~(BPF_F_NO_PREALLOC | BPF_F_NO_COMMON_LRU |
+				BPF_F_LRU_SHARDED))
 		/* reserved bits should not be used */
 		return ERR_PTR(-EINVAL);
 
-	if (!lru && percpu_lru)
+	if (!lru && (percpu_lru || sharded_lru))
+		return ERR_PTR(-EINVAL);
+
+	/* both replace the common LRU list, in different ways */
+	if (percpu_lru && sharded_lru)
 		return ERR_PTR(-EINVAL);
 
 	if (lru && !prealloc)
@@ -470,6 +479,33 @@ static void *htab_lru_map_lookup_elem(struct bpf_map *map, void *key)
 	return NULL;
 }
 
+/* Called from syscall */
+static void htab_lru_map_show_fdinfo(struct bpf_map *map, struct seq_file *m)
+{
+	struct bpf_htab *htab = container_of(map, struct bpf_htab, map);
+	struct bpf_lru_shard_stats st;
+
+	if (!htab->lru.sharded)
+		return;
+
+	bpf_lru_shard_stats(&htab->lru, &st);
+	seq_printf(m,
+		   "lru_shards:\t%u\n"
+		   "lru_evictions:\t%llu\n"
+		   "lru_evictions_forced:\t%llu\n"
+		   "lru_second_chances:\t%llu\n"
+		   "lru_steals:\t%llu\n"
+		   "lru_lock_contended:\t%llu\n"
+		   "lru_lock_wait_ns:\t%llu\n",
+		   htab->lru.nr_shards,
+		   st.evictions,
+		   st.evictions_forced,
+		   st.second_chances,
+		   st.steals,
+		   st.lock_contended,
+		   st.lock_wait_ns);
+}
+
 /* It is called from the bpf_lru_list when the LRU needs to delete
  * older elements from the htab.
  */
@@ -557,6 +593,136 @@ find_first_elem:
 	return -ENOENT;
 }
 
+/* Called from syscall: walk the buckets from the one in batch.in_batch on
+ * and return whole buckets, as many as fit in batch.count elements, then
+ * report in batch.out_batch the bucket to go on from.  The number of buckets
+ * never changes and an element always hashes to the same one, so a walk
+ * returns each element that stays in the map meanwhile exactly once.
+ */
+static int htab_map_lookup_batch(struct bpf_map *map,
+				 const union bpf_attr *attr,
+				 union bpf_attr __user *uattr)
+{
+	struct bpf_htab *htab = container_of(map, struct bpf_htab, map);
+	void __user *uvalues = u64_to_user_ptr(attr->batch.values);
+	void __user *ukeys = u64_to_user_ptr(attr->batch.keys);
+	void __user *in_batch = u64_to_user_ptr(attr->batch.in_batch);
+	void __user *out_batch = u64_to_user_ptr(attr->batch.out_batch);
+	u32 key_size = map->key_size, value_size, size;
+	u32 batch, max_count, bucket_cnt, bucket_size, total = 0;
+	void *keys = NULL, *values = NULL, *dst_key, *dst_val;
+	bool percpu = htab_is_percpu(htab);
+	struct hlist_nulls_node *n;
+	unsigned long flags;
+	struct htab_elem *l;
+	struct bucket *b;
+	int cpu, off, ret = 0;
+
+	if (!out_batch || attr->batch.elem_flags || attr->batch.flags)
+		return -EINVAL;
+
+	if (put_user(0, &uattr->batch.count))
+		return -EFAULT;
+
+	max_count = attr->batch.count;
+	if (!max_count)
+		return 0;
+
+	batch = 0;
+	if (in_batch && copy_from_user(&batch, in_batch, sizeof(batch)))
+		return -EFAULT;
+	if (batch >= htab->n_buckets)
+		return -ENOENT;
+
+	size = round_up(map->value_size, 8);
+	value_size = bpf_map_value_size(map);
+
+	/* a bucket is copied out under its lock, into room for all of it */
+	bucket_size = 4;
+alloc:
+	keys = kmalloc_array(bucket_size, key_size, GFP_USER | __GFP_NOWARN);
+	values = kmalloc_array(bucket_size, value_size, GFP_USER | __GFP_NOWARN);
+	if (!keys || !values) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	for (; batch < htab->n_buckets && total < max_count; batch++) {
+		b = &htab->buckets[batch];
+
+		/* the common case of a sparse map, no need to lock */
+		if (hlist_nulls_empty(&b->head))
+			continue;
+
+		bucket_cnt = 0;
+		raw_spin_lock_irqsave(&b->lock, flags);
+		hlist_nulls_for_each_entry(l, n, &b->head, hash_node)
+			bucket_cnt++;
+
+		if (bucket_cnt > bucket_size) {
+			raw_spin_unlock_irqrestore(&b->lock, flags);
+			bucket_size = bucket_cnt;
+			kfree(keys);
+			kfree(values);
+			goto alloc;
+		}
+
+		if (bucket_cnt > max_count - total) {
+			raw_spin_unlock_irqrestore(&b->lock, flags);
+			/* not even the first bucket fits, ask for more room */
+			if (!total)
+				ret = -ENOSPC;
+			break;
+		}
+
+		dst_key = keys;
+		dst_val = values;
+		hlist_nulls_for_each_entry(l, n, &b->head, hash_node) {
+			memcpy(dst_key, l->key, key_size);
+			if (percpu) {
+				void __percpu *pptr;
+
+				pptr = htab_elem_get_ptr(l, key_size);
+				off = 0;
+				for_each_possible_cpu(cpu) {
+					bpf_long_memcpy(dst_val + off,
+							per_cpu_ptr(pptr, cpu),
+							size);
+					off += size;
+				}
+			} else {
+				memcpy(dst_val, l->key + round_up(key_size, 8),
+				       value_size);
+			}
+			dst_key += key_size;
+			dst_val += value_size;
+		}
+		raw_spin_unlock_irqrestore(&b->lock, flags);
+
+		if (copy_to_user(ukeys + total * key_size, keys,
+				 bucket_cnt * key_size) ||
+		    copy_to_user(uvalues + total * value_size, values,
+				 bucket_cnt * value_size)) {
+			ret = -EFAULT;
+			goto out;
+		}
+		total += bucket_cnt;
+		cond_resched();
+	}
+
+	/* all done, what was returned along with it is still valid */
+	if (batch >= htab->n_buckets)
+		ret = -ENOENT;
+
+	if (put_user(total, &uattr->batch.count) ||
+	    copy_to_user(out_batch, &batch, sizeof(batch)))
+		ret = -EFAULT;
+out:
+	kfree(keys);
+	kfree(values);
+	return ret;
+}
+
 static void htab_elem_free(struct bpf_htab *htab, struct htab_elem *l)
 {
 	if (htab->map.map_type == BPF_MAP_TYPE_PERCPU_HASH)
@@ -1057,6 +1223,9 @@ static const struct bpf_map_ops htab_ops = {
 	.map_alloc = htab_map_alloc,
 	.map_free = htab_map_free,
 	.map_get_next_key = htab_map_get_next_key,
+	.map_lookup_batch = htab_map_lookup_batch,
+	.map_update_batch = generic_map_update_batch,
+	.map_delete_batch = generic_map_delete_batch,
 	.map_lookup_elem = htab_map_lookup_elem,
 	.map_update_elem = htab_map_update_elem,
 	.map_delete_elem = htab_map_delete_elem,
@@ -1071,9 +1240,13 @@ static const struct bpf_map_ops htab_lru_ops = {
 	.map_alloc = htab_map_alloc,
 	.map_free = htab_map_free,
 	.map_get_next_key = htab_map_get_next_key,
+	.map_lookup_batch = htab_map_lookup_batch,
+	.map_update_batch = generic_map_update_batch,
+	.map_delete_batch = generic_map_delete_batch,
 	.map_lookup_elem = htab_lru_map_lookup_elem,
 	.map_update_elem = htab_lru_map_update_elem,
 	.map_delete_elem = htab_lru_map_delete_elem,
+	.map_show_fdinfo = htab_lru_map_show_fdinfo,
 };
 
 static struct bpf_map_type_list htab_lru_type __ro_after_init = {
@@ -1158,6 +1331,9 @@ static const struct bpf_map_ops htab_percpu_ops = {
 	.map_alloc = htab_map_alloc,
 	.map_free = htab_map_free,
 	.map_get_next_key = htab_map_get_next_key,
+	.map_lookup_batch = htab_map_lookup_batch,
+	.map_update_batch = generic_map_update_batch,
+	.map_delete_batch = generic_map_delete_batch,
 	.map_lookup_elem = htab_percpu_map_lookup_elem,
 	.map_update_elem = htab_percpu_map_update_elem,
 	.map_delete_elem = htab_map_delete_elem,
@@ -1172,9 +1348,13 @@ static const struct bpf_map_ops htab_lru_percpu_ops = {
 	.map_alloc = htab_map_alloc,
 	.map_free = htab_map_free,
 	.map_get_next_key = htab_map_get_next_key,
+	.map_lookup_batch = htab_map_lookup_batch,
+	.map_update_batch = generic_map_update_batch,
+	.map_delete_batch = generic_map_delete_batch,
 	.map_lookup_elem = htab_lru_percpu_map_lookup_elem,
 	.map_update_elem = htab_lru_percpu_map_update_elem,
 	.map_delete_elem = htab_lru_map_delete_elem,
+	.map_show_fdinfo = htab_lru_map_show_fdinfo,
 };
 
 static struct bpf_map_type_list htab_lru_percpu_type __ro_after_init = {
@@ -14,12 +14,21 @@
 #include <linux/slab.h>
 #include <linux/spinlock.h>
 #include <linux/vmalloc.h>
+#include <linux/workqueue.h>
 #include <net/ipv6.h>
 
 /* Intermediate node */
 #define LPM_TREE_NODE_FLAG_IM BIT(0)
 
+/* Widest stride and deepest level of the lookup index */
+#define LPM_INDEX_MAX_BITS	8
+#define LPM_INDEX_MAX_DEPTH	16
+
+/* How long the trie has to be left alone before it is indexed again */
+#define LPM_INDEX_DELAY		(HZ / 10)
+
 struct lpm_trie_node;
+struct lpm_index;
 
 struct lpm_trie_node {
 	struct rcu_head rcu;
@@ -29,12 +38,34 @@ struct lpm_trie_node {
 	u8				data[0];
 };
 
+struct lpm_index_slot {
+	/* Longest real prefix that ends within the stride and matches */
+	struct lpm_trie_node		*best;
+	/* First node below that matches, where the walk goes on */
+	struct lpm_trie_node		*node;
+	/* If set, index for the subtrie of @node */
+	struct lpm_index		*child;
+};
+
+struct lpm_index {
+	struct rcu_head			rcu;
+	/* The subtrie indexed, its prefix precedes the stride */
+	struct lpm_trie_node		*node;
+	u32				pos;
+	u32				bits;
+	struct lpm_index_slot		slots[0];
+};
+
 struct lpm_trie {
 	struct bpf_map			map;
 	struct lpm_trie_node __rcu	*root;
+	struct lpm_index __rcu		*index;
 	size_t				n_entries;
 	size_t				max_prefixlen;
 	size_t				data_size;
+	/* Bumped by every change, an index built meanwhile is stale */
+	u32				gen;
+	struct delayed_work		index_work;
 	raw_spinlock_t			lock;
 };
 
@@ -147,6 +178,21 @@ struct lpm_trie {
  * is a child that can be used to become more specific, the trie is traversed
  * downwards. The last node in the traversal that is a non-intermediate one is
  * returned.
+ *
+ * With many prefixes that is a long chain of dependent loads, one per
+ * branching bit.  So once the trie has not changed for LPM_INDEX_DELAY, a
+ * work item builds a multibit index on top of it, similar to the level
+ * compression of fib_trie.c: an index node covers the subtrie of one trie
+ * node and is an array of 2^bits slots for the next bits of the key, with
+ * bits chosen as wide as possible while at least half of the slots lead
+ * to a subtrie.  Each slot knows the best real prefix that ends within the
+ * stride, so there is no backtracking, and where the walk goes on, either
+ * a further index node or a trie node to walk the binary trie from.
+ *
+ * The index is read under RCU like the trie.  Any update drops it and
+ * schedules a rebuild; an index built while the trie changed is thrown
+ * away.  Lookups without index, and those with a key shorter than the
+ * maximum prefix length, walk the binary trie alone.
  */
 
 static inline int extract_bit(const u8 *data, size_t index)
@@ -154,6 +200,36 @@ static inline int extract_bit(const u8 *data, size_t index)
 	return !!(data[index / 8] & (1 << (7 - (index % 8))));
 }
 
+/* Bits [pos, pos + n) of data as a number, n <= 8 */
+static u32 extract_bits(const u8 *data, u32 pos, u32 n)
+{
+	u32 v = data[pos / 8] << 8;
+
+	if (pos % 8 + n > 8)
+		v |= data[pos / 8 + 1];
+
+	return (v >> (16 - pos % 8 - n)) & ((1U << n) - 1);
+}
+
+/* Do bits [from, to) of a and b match? */
+static bool bits_equal(const u8 *a, const u8 *b, u32 from, u32 to)
+{
+	u32 i;
+	u8 mask;
+
+	for (i = from / 8; i * 8 < to; i++) {
+		mask = 0xff;
+		if (i == from / 8)
+			mask >>= from % 8;
+		if ((i + 1) * 8 > to)
+			mask &= 0xff << ((i + 1) * 8 - to);
+		if ((a[i] ^ b[i]) & mask)
+			return false;
+	}
+
+	return true;
+}
+
 /**
  * longest_prefix_match() - determine the longest prefix
  * @trie:	The trie to get internal sizes from
@@ -185,16 +261,51 @@ static size_t longest_prefix_match(const struct lpm_trie *trie,
 	return prefixlen;
 }
 
+/* Walk the index as far as it goes.  Returns the trie node to walk on
+ * from, with *found set to the best match so far.
+ */
+static struct lpm_trie_node *lpm_index_walk(const struct lpm_index *idx,
+					    const struct bpf_lpm_trie_key *key,
+					    struct lpm_trie_node **found)
+{
+	const struct lpm_index_slot *slot;
+	u32 from = 0;
+
+	for (;;) {
+		/* the prefix of idx->node, as far as the parent didn't check */
+		if (!bits_equal(key->data, idx->node->data, from, idx->pos))
+			return NULL;
+
+		slot = &idx->slots[extract_bits(key->data, idx->pos,
+						idx->bits)];
+		if (slot->best)
+			*found = slot->best;
+		if (!slot->child)
+			return slot->node;
+
+		from = idx->pos + idx->bits;
+		idx = slot->child;
+	}
+}
+
 /* Called from syscall or from eBPF program */
 static void *trie_lookup_elem(struct bpf_map *map, void *_key)
 {
 	struct lpm_trie *trie = container_of(map, struct lpm_trie, map);
 	struct lpm_trie_node *node, *found = NULL;
 	struct bpf_lpm_trie_key *key = _key;
+	struct lpm_index *idx;
 
-	/* Start walking the trie from the root node ... */
+	/* Start walking the trie from the root node, or from where the
+	 * index leaves off ...
+	 */
+	idx = rcu_dereference(trie->index);
+	if (idx && key->prefixlen == trie->max_prefixlen)
+		node = lpm_index_walk(idx, key, &found);
+	else
+		node = rcu_dereference(trie->root);
 
-	for (node = rcu_dereference(trie->root); node;) {
+	for (; node;) {
 		unsigned int next_bit;
 		size_t matchlen;
 
@@ -235,6 +346,163 @@ static void *trie_lookup_elem(struct bpf_map *map, void *_key)
 	return found->data + trie->data_size;
 }
 
+static void lpm_index_free(struct lpm_index *idx)
+{
+	u32 i;
+
+	for (i = 0; i < 1U << idx->bits; i++)
+		if (idx->slots[i].child)
+			lpm_index_free(idx->slots[i].child);
+	kfree(idx);
+}
+
+static void lpm_index_free_rcu(struct rcu_head *head)
+{
+	lpm_index_free(container_of(head, struct lpm_index, rcu));
+}
+
+/* Number of subtries of @node at bit @len, all of them anchored below */
+static u32 lpm_index_count(struct lpm_trie_node *node, u32 len)
+{
+	if (!node)
+		return 0;
+	if (node->prefixlen >= len)
+		return 1;
+
+	return lpm_index_count(rcu_dereference(node->child[0]), len) +
+	       lpm_index_count(rcu_dereference(node->child[1]), len);
+}
+
+/* Fill the slots of @idx from the trie nodes above the end of its stride,
+ * parents before children so longer prefixes win.
+ */
+static void lpm_index_fill(struct lpm_index *idx, struct lpm_trie_node *node)
+{
+	u32 len = idx->pos + idx->bits;
+	u32 first, i, n;
+
+	if (!node)
+		return;
+
+	if (node->prefixlen >= len) {
+		idx->slots[extract_bits(node->data, idx->pos,
+					idx->bits)].node = node;
+		return;
+	}
+
+	if (!(node->flags & LPM_TREE_NODE_FLAG_IM)) {
+		/* the bits past the prefix are free, the node covers a range */
+		n = len - node->prefixlen;
+		first = extract_bits(node->data, idx->pos, idx->bits);
+		first &= ~((1U << n) - 1);
+		for (i = 0; i < 1U << n; i++)
+			idx->slots[first + i].best = node;
+	}
+
+	lpm_index_fill(idx, rcu_dereference(node->child[0]));
+	lpm_index_fill(idx, rcu_dereference(node->child[1]));
+}
+
+static struct lpm_index *lpm_index_build(const struct lpm_trie *trie,
+					 struct lpm_trie_node *node,
+					 int depth)
+{
+	u32 pos = node->prefixlen, max_bits, bits = 0, k, i;
+	struct lpm_index *idx, *child;
+
+	if (depth == LPM_INDEX_MAX_DEPTH)
+		return NULL;
+
+	max_bits = min_t(u32, LPM_INDEX_MAX_BITS, trie->max_prefixlen - pos);
+	for (k = 1; k <= max_bits; k++) {
+		if (lpm_index_count(node, pos + k) * 2 < 1U << k)
+			break;
+		bits = k;
+	}
+
+	/* a single bit is no better than the binary trie itself */
+	if (bits < 2)
+		return NULL;
+
+	idx = kzalloc(sizeof(*idx) + (sizeof(idx->slots[0]) << bits),
+		      GFP_NOWAIT | __GFP_NOWARN);
+	if (!idx)
+		return ERR_PTR(-ENOMEM);
+
+	idx->node = node;
+	idx->pos = pos;
+	idx->bits = bits;
+	lpm_index_fill(idx, node);
+
+	for (i = 0; i < 1U << bits; i++) {
+		if (!idx->slots[i].node)
+			continue;
+
+		child = lpm_index_build(trie, idx->slots[i].node, depth + 1);
+		if (IS_ERR(child)) {
+			lpm_index_free(idx);
+			return child;
+		}
+		idx->slots[i].child = child;
+	}
+
+	return idx;
+}
+
+static void lpm_index_work(struct work_struct *work)
+{
+	struct lpm_trie *trie = container_of(to_delayed_work(work),
+					     struct lpm_trie, index_work);
+	struct lpm_index *idx = NULL;
+	struct lpm_trie_node *root;
+	unsigned long irq_flags;
+	u32 gen;
+
+	raw_spin_lock_irqsave(&trie->lock, irq_flags);
+	gen = trie->gen;
+	raw_spin_unlock_irqrestore(&trie->lock, irq_flags);
+
+	/* Updates come from programs too and can't wait for this, so build
+	 * it without the lock and only publish it if nothing changed.
+	 */
+	rcu_read_lock();
+	root = rcu_dereference(trie->root);
+	if (root)
+		idx = lpm_index_build(trie, root, 0);
+	rcu_read_unlock();
+
+	/* out of memory, the next update tries again */
+	if (IS_ERR_OR_NULL(idx))
+		return;
+
+	raw_spin_lock_irqsave(&trie->lock, irq_flags);
+	if (trie->gen == gen) {
+		rcu_assign_pointer(trie->index, idx);
+		idx = NULL;
+	}
+	raw_spin_unlock_irqrestore(&trie->lock, irq_flags);
+
+	/* stale, the update that made it so has scheduled a new build */
+	if (idx)
+		lpm_index_free(idx);
+}
+
+/* Called with trie->lock held after an update */
+static void lpm_index_invalidate(struct lpm_trie *trie)
+{
+	struct lpm_index *idx;
+
+	idx = rcu_dereference_protected(trie->index,
+					lockdep_is_held(&trie->lock));
+	if (idx) {
+		RCU_INIT_POINTER(trie->index, NULL);
+		call_rcu(&idx->rcu, lpm_index_free_rcu);
+	}
+
+	trie->gen++;
+	schedule_delayed_work(&trie->index_work, LPM_INDEX_DELAY);
+}
+
 static struct lpm_trie_node *lpm_trie_node_alloc(const struct lpm_trie *trie,
 						 const void *value)
 {
@@ -381,6 +649,8 @@ out:
 
 		kfree(new_node);
 		kfree(im_node);
+	} else {
+		lpm_index_invalidate(trie);
 	}
 
 	raw_spin_unlock_irqrestore(&trie->lock, irq_flags);
@@ -436,8 +706,12 @@ static struct bpf_map *trie_alloc(union bpf_attr *attr)
 			  offsetof(struct bpf_lpm_trie_key, data);
 	trie->max_prefixlen = trie->data_size * 8;
 
+	/* Index slots are at most half empty and there is at most one used
+	 * slot per trie node, of which there are at most two per entry.
+	 */
 	cost_per_node = sizeof(struct lpm_trie_node) +
-			attr->value_size + trie->data_size;
+			attr->value_size + trie->data_size +
+			4 * sizeof(struct lpm_index_slot);
 	cost += (u64) attr->max_entries * cost_per_node;
 	if (cost >= U32_MAX - PAGE_SIZE) {
 		ret = -E2BIG;
@@ -451,6 +725,7 @@ static struct bpf_map *trie_alloc(union bpf_attr *attr)
 		goto out_err;
 
 	raw_spin_lock_init(&trie->lock);
+	INIT_DELAYED_WORK(&trie->index_work, lpm_index_work);
 
 	return &trie->map;
 out_err:
@@ -463,6 +738,14 @@ static void trie_free(struct bpf_map *map)
 	struct lpm_trie *trie = container_of(map, struct lpm_trie, map);
 	struct lpm_trie_node __rcu **slot;
 	struct lpm_trie_node *node;
+	struct lpm_index *idx;
+
+	cancel_delayed_work_sync(&trie->index_work);
+
+	/* No more readers, see bpf_map_put() */
+	idx = rcu_dereference_protected(trie->index, 1);
+	if (idx)
+		lpm_index_free(idx);
 
 	raw_spin_lock(&trie->lock);
 
@@ -20,6 +20,8 @@
 #include <linux/file.h>
 #include <linux/vmalloc.h>
 #include <linux/stringify.h>
+#include <linux/bsearch.h>
+#include <linux/sort.h>
 
 /* bpf_check() is a static code analyzer that walks eBPF program
  * instruction by instruction and updates register/stack state.
@@ -428,6 +430,8 @@ static struct bpf_verifier_state *push_stack(struct bpf_verifier_env *env,
 	elem->next = env->head;
 	env->head = elem;
 	env->stack_size++;
+	if (env->stack_size > env->peak_states)
+		env->peak_states = env->stack_size;
 	if (env->stack_size > BPF_COMPLEXITY_LIMIT_STACK) {
 		verbose("BPF program is too complex\n");
 		goto err;
@@ -453,6 +457,7 @@ static void init_reg_state(struct bpf_reg_state *regs)
 		regs[i].imm = 0;
 		regs[i].min_value = BPF_REGISTER_MIN_RANGE;
 		regs[i].max_value = BPF_REGISTER_MAX_RANGE;
+		regs[i].live = REG_LIVE_NONE;
 	}
 
 	/* frame pointer */
@@ -494,9 +499,34 @@ enum reg_arg_type {
 	DST_OP_NO_MARK	/* same as above, check only, don't mark */
 };
 
-static int check_reg_arg(struct bpf_reg_state *regs, u32 regno,
+/* Parentage chain of this register (or stack slot) should take care of all
+ * issues like callee-saved registers, stack slot allocation time, etc.
+ */
+static void mark_reg_read(const struct bpf_verifier_state *state, u32 regno)
+{
+	struct bpf_verifier_state *parent = state->parent;
+
+	while (parent) {
+		/* if read wasn't screened by an earlier write ... */
+		if (state->regs[regno].live & REG_LIVE_WRITTEN)
+			break;
+		/* ... and the parent doesn't already know, all its own
+		 * parents were told when it was marked
+		 */
+		if (parent->regs[regno].live & REG_LIVE_READ)
+			break;
+		/* ... then we depend on parent's value */
+		parent->regs[regno].live |= REG_LIVE_READ;
+		state = parent;
+		parent = state->parent;
+	}
+}
+
+static int check_reg_arg(struct bpf_verifier_env *env, u32 regno,
 			 enum reg_arg_type t)
 {
+	struct bpf_reg_state *regs = env->cur_state.regs;
+
 	if (regno >= MAX_BPF_REG) {
 		verbose("R%d is invalid\n", regno);
 		return -EINVAL;
@@ -508,12 +538,14 @@ static int check_reg_arg(struct bpf_reg_state *regs, u32 regno,
 			verbose("R%d !read_ok\n", regno);
 			return -EACCES;
 		}
+		mark_reg_read(&env->cur_state, regno);
 	} else {
 		/* check whether register used as dest operand can be written to */
 		if (regno == BPF_REG_FP) {
 			verbose("frame pointer is read only\n");
 			return -EACCES;
 		}
+		regs[regno].live |= REG_LIVE_WRITTEN;
 		if (t == DST_OP)
 			mark_reg_unknown_value(regs, regno);
 	}
@@ -555,10 +587,28 @@ static bool is_spillable_regtype(enum bpf_reg_type type)
 /* check_stack_read/write functions track spill/fill of registers,
  * stack boundary and alignment are checked in check_mem_access()
  */
+static void mark_stack_slot_read(const struct bpf_verifier_state *state,
+				 int slot)
+{
+	struct bpf_verifier_state *parent = state->parent;
+
+	while (parent) {
+		/* if read wasn't screened by an earlier write ... */
+		if (state->spilled_regs[slot].live & REG_LIVE_WRITTEN)
+			break;
+		if (parent->spilled_regs[slot].live & REG_LIVE_READ)
+			break;
+		/* ... then we depend on parent's value */
+		parent->spilled_regs[slot].live |= REG_LIVE_READ;
+		state = parent;
+		parent = state->parent;
+	}
+}
+
 static int check_stack_write(struct bpf_verifier_state *state, int off,
 			     int size, int value_regno)
 {
-	int i;
+	int i, spi = (MAX_BPF_STACK + off) / BPF_REG_SIZE;
 	/* caller checked that off % size == 0 and -MAX_BPF_STACK <= off < 0,
 	 * so it's aligned access and [off, off + size) are within stack limits
 	 */
@@ -573,15 +623,15 @@ static int check_stack_write(struct bpf_verifier_state *state, int off,
 		}
 
 		/* save register state */
-		state->spilled_regs[(MAX_BPF_STACK + off) / BPF_REG_SIZE] =
-			state->regs[value_regno];
+		state->spilled_regs[spi] = state->regs[value_regno];
+		state->spilled_regs[spi].live |= REG_LIVE_WRITTEN;
 
 		for (i = 0; i < BPF_REG_SIZE; i++)
 			state->stack_slot_type[MAX_BPF_STACK + off + i] = STACK_SPILL;
 	} else {
 		/* regular write of data into stack */
-		state->spilled_regs[(MAX_BPF_STACK + off) / BPF_REG_SIZE] =
-			(struct bpf_reg_state) {};
+		state->spilled_regs[spi] = (struct bpf_reg_state) {};
+		state->spilled_regs[spi].live |= REG_LIVE_WRITTEN;
 
 		for (i = 0; i < size; i++)
 			state->stack_slot_type[MAX_BPF_STACK + off + i] = STACK_MISC;
@@ -592,8 +642,8 @@ static int check_stack_write(struct bpf_verifier_state *state, int off,
 static int check_stack_read(struct bpf_verifier_state *state, int off, int size,
 			    int value_regno)
 {
+	int i, spi = (MAX_BPF_STACK + off) / BPF_REG_SIZE;
 	u8 *slot_type;
-	int i;
 
 	slot_type = &state->stack_slot_type[MAX_BPF_STACK + off];
 
@@ -609,10 +659,15 @@ static int check_stack_read(struct bpf_verifier_state *state, int off, int size,
 			}
 		}
 
-		if (value_regno >= 0)
+		if (value_regno >= 0) {
 			/* restore register state from stack */
-			state->regs[value_regno] =
-				state->spilled_regs[(MAX_BPF_STACK + off) / BPF_REG_SIZE];
+			state->regs[value_regno] = state->spilled_regs[spi];
+			/* the fill is a write of the destination, whatever
+			 * marks the spilled copy carried
+			 */
+			state->regs[value_regno].live |= REG_LIVE_WRITTEN;
+		}
+		mark_stack_slot_read(state, spi);
 		return 0;
 	} else {
 		for (i = 0; i < size; i++) {
@@ -706,6 +761,7 @@ static bool may_access_direct_pkt_data(struct bpf_verifier_env *env,
 	case BPF_PROG_TYPE_SCHED_ACT:
 	case BPF_PROG_TYPE_XDP:
 	case BPF_PROG_TYPE_LWT_XMIT:
+	case BPF_PROG_TYPE_SK_SKB:
 		if (meta)
 			return meta->pkt_access;
 
@@ -921,7 +977,6 @@ static int check_mem_access(struct bpf_verifier_env *env, u32 regno, int off,
 
 static int check_xadd(struct bpf_verifier_env *env, struct bpf_insn *insn)
 {
-	struct bpf_reg_state *regs = env->cur_state.regs;
 	int err;
 
 	if ((BPF_SIZE(insn->code) != BPF_W && BPF_SIZE(insn->code) != BPF_DW) ||
@@ -931,12 +986,12 @@ static int check_xadd(struct bpf_verifier_env *env, struct bpf_insn *insn)
 	}
 
 	/* check src1 operand */
-	err = check_reg_arg(regs, insn->src_reg, SRC_OP);
+	err = check_reg_arg(env, insn->src_reg, SRC_OP);
 	if (err)
 		return err;
 
 	/* check src2 operand */
-	err = check_reg_arg(regs, insn->dst_reg, SRC_OP);
+	err = check_reg_arg(env, insn->dst_reg, SRC_OP);
 	if (err)
 		return err;
 
@@ -1215,6 +1270,20 @@ static int check_map_func_compatibility(struct bpf_map *map, int func_id)
 		    func_id != BPF_FUNC_current_task_under_cgroup)
 			goto error;
 		break;
+	case BPF_MAP_TYPE_DEVMAP:
+	case BPF_MAP_TYPE_XSKMAP:
+		if (func_id != BPF_FUNC_redirect_map)
+			goto error;
+		break;
+	case BPF_MAP_TYPE_SOCKMAP:
+		if (func_id != BPF_FUNC_sk_redirect_map)
+			goto error;
+		break;
+	case BPF_MAP_TYPE_RINGBUF:
+		if (func_id != BPF_FUNC_ringbuf_output &&
+		    func_id != BPF_FUNC_ringbuf_query)
+			goto error;
+		break;
 	default:
 		break;
 	}
@@ -1239,6 +1308,20 @@ static int check_map_func_compatibility(struct bpf_map *map, int func_id)
 		if (map->map_type != BPF_MAP_TYPE_CGROUP_ARRAY)
 			goto error;
 		break;
+	case BPF_FUNC_redirect_map:
+		if (map->map_type != BPF_MAP_TYPE_DEVMAP &&
+		    map->map_type != BPF_MAP_TYPE_XSKMAP)
+			goto error;
+		break;
+	case BPF_FUNC_sk_redirect_map:
+		if (map->map_type != BPF_MAP_TYPE_SOCKMAP)
+			goto error;
+		break;
+	case BPF_FUNC_ringbuf_output:
+	case BPF_FUNC_ringbuf_query:
+		if (map->map_type != BPF_MAP_TYPE_RINGBUF)
+			goto error;
+		break;
 	default:
 		break;
 	}
@@ -1321,6 +1404,12 @@ static int check_call(struct bpf_verifier_env *env, int func_id)
 		return -EINVAL;
 	}
 
+	/* a tail call replaces the current frame, whichever it is */
+	if (func_id == BPF_FUNC_tail_call && env->subprog_cnt > 1) {
+		verbose("tail_calls are not allowed in programs with bpf-to-bpf calls\n");
+		return -EINVAL;
+	}
+
 	changes_data = bpf_helper_changes_pkt_data(fn->func);
 
 	memset(&meta, 0, sizeof(meta));
@@ -1367,6 +1456,7 @@ static int check_call(struct bpf_verifier_env *env, int func_id)
 		reg = regs + caller_saved[i];
 		reg->type = NOT_INIT;
 		reg->imm = 0;
+		reg->live |= REG_LIVE_WRITTEN;
 	}
 
 	/* update return register */
@@ -1782,7 +1872,7 @@ static int check_alu_op(struct bpf_verifier_env *env, struct bpf_insn *insn)
 		}
 
 		/* check src operand */
-		err = check_reg_arg(regs, insn->dst_reg, SRC_OP);
+		err = check_reg_arg(env, insn->dst_reg, SRC_OP);
 		if (err)
 			return err;
 
@@ -1793,7 +1883,7 @@ static int check_alu_op(struct bpf_verifier_env *env, struct bpf_insn *insn)
 		}
 
 		/* check dest operand */
-		err = check_reg_arg(regs, insn->dst_reg, DST_OP);
+		err = check_reg_arg(env, insn->dst_reg, DST_OP);
 		if (err)
 			return err;
 
@@ -1806,7 +1896,7 @@ static int check_alu_op(struct bpf_verifier_env *env, struct bpf_insn *insn)
 			}
 
 			/* check src operand */
-			err = check_reg_arg(regs, insn->src_reg, SRC_OP);
+			err = check_reg_arg(env, insn->src_reg, SRC_OP);
 			if (err)
 				return err;
 		} else {
@@ -1817,7 +1907,7 @@ static int check_alu_op(struct bpf_verifier_env *env, struct bpf_insn *insn)
 		}
 
 		/* check dest operand */
-		err = check_reg_arg(regs, insn->dst_reg, DST_OP);
+		err = check_reg_arg(env, insn->dst_reg, DST_OP);
 		if (err)
 			return err;
 
@@ -1862,7 +1952,7 @@ static int check_alu_op(struct bpf_verifier_env *env, struct bpf_insn *insn)
 				return -EINVAL;
 			}
 			/* check src1 operand */
-			err = check_reg_arg(regs, insn->src_reg, SRC_OP);
+			err = check_reg_arg(env, insn->src_reg, SRC_OP);
 			if (err)
 				return err;
 		} else {
@@ -1873,7 +1963,7 @@ static int check_alu_op(struct bpf_verifier_env *env, struct bpf_insn *insn)
 		}
 
 		/* check src2 operand */
-		err = check_reg_arg(regs, insn->dst_reg, SRC_OP);
+		err = check_reg_arg(env, insn->dst_reg, SRC_OP);
 		if (err)
 			return err;
 
@@ -1894,7 +1984,7 @@ static int check_alu_op(struct bpf_verifier_env *env, struct bpf_insn *insn)
 		}
 
 		/* check dest operand */
-		err = check_reg_arg(regs, insn->dst_reg, DST_OP_NO_MARK);
+		err = check_reg_arg(env, insn->dst_reg, DST_OP_NO_MARK);
 		if (err)
 			return err;
 
@@ -2163,7 +2253,7 @@ static int check_cond_jmp_op(struct bpf_verifier_env *env,
 		}
 
 		/* check src1 operand */
-		err = check_reg_arg(regs, insn->src_reg, SRC_OP);
+		err = check_reg_arg(env, insn->src_reg, SRC_OP);
 		if (err)
 			return err;
 
@@ -2180,7 +2270,7 @@ static int check_cond_jmp_op(struct bpf_verifier_env *env,
 	}
 
 	/* check src2 operand */
-	err = check_reg_arg(regs, insn->dst_reg, SRC_OP);
+	err = check_reg_arg(env, insn->dst_reg, SRC_OP);
 	if (err)
 		return err;
 
@@ -2277,7 +2367,7 @@ static int check_ld_imm(struct bpf_verifier_env *env, struct bpf_insn *insn)
 		return -EINVAL;
 	}
 
-	err = check_reg_arg(regs, insn->dst_reg, DST_OP);
+	err = check_reg_arg(env, insn->dst_reg, DST_OP);
 	if (err)
 		return err;
 
@@ -2336,6 +2426,12 @@ static int check_ld_abs(struct bpf_verifier_env *env, struct bpf_insn *insn)
 		return -EINVAL;
 	}
 
+	/* they end the program when the load fails, not the function */
+	if (env->call_depth) {
+		verbose("BPF_LD_[ABS|IND] instructions cannot be used in subprogs\n");
+		return -EINVAL;
+	}
+
 	if (insn->dst_reg != BPF_REG_0 || insn->off != 0 ||
 	    BPF_SIZE(insn->code) == BPF_DW ||
 	    (mode == BPF_ABS && insn->src_reg != BPF_REG_0)) {
@@ -2344,7 +2440,7 @@ static int check_ld_abs(struct bpf_verifier_env *env, struct bpf_insn *insn)
 	}
 
 	/* check whether implicit source operand (register R6) is readable */
-	err = check_reg_arg(regs, BPF_REG_6, SRC_OP);
+	err = check_reg_arg(env, BPF_REG_6, SRC_OP);
 	if (err)
 		return err;
 
@@ -2355,7 +2451,7 @@ static int check_ld_abs(struct bpf_verifier_env *env, struct bpf_insn *insn)
 
 	if (mode == BPF_IND) {
 		/* check explicit source operand */
-		err = check_reg_arg(regs, insn->src_reg, SRC_OP);
+		err = check_reg_arg(env, insn->src_reg, SRC_OP);
 		if (err)
 			return err;
 	}
@@ -2365,6 +2461,7 @@ static int check_ld_abs(struct bpf_verifier_env *env, struct bpf_insn *insn)
 		reg = regs + caller_saved[i];
 		reg->type = NOT_INIT;
 		reg->imm = 0;
+		reg->live |= REG_LIVE_WRITTEN;
 	}
 
 	/* mark destination R0 register as readable, since it contains
@@ -2374,6 +2471,163 @@ static int check_ld_abs(struct bpf_verifier_env *env, struct bpf_insn *insn)
 	return 0;
 }
 
+static int cmp_subprogs(const void *a, const void *b)
+{
+	return ((struct bpf_subprog_info *)a)->start -
+	       ((struct bpf_subprog_info *)b)->start;
+}
+
+static int find_subprog(struct bpf_verifier_env *env, int off)
+{
+	struct bpf_subprog_info *p;
+
+	p = bsearch(&off, env->subprog_info, env->subprog_cnt,
+		    sizeof(env->subprog_info[0]), cmp_subprogs);
+	if (!p)
+		return -ENOENT;
+	return p - env->subprog_info;
+}
+
+static int subprog_end(struct bpf_verifier_env *env, int subprog)
+{
+	if (subprog + 1 < env->subprog_cnt)
+		return env->subprog_info[subprog + 1].start;
+	return env->prog->len;
+}
+
+static int add_subprog(struct bpf_verifier_env *env, int off)
+{
+	if (off < 0 || off >= env->prog->len) {
+		verbose("call to invalid destination\n");
+		return -EINVAL;
+	}
+	if (find_subprog(env, off) >= 0)
+		return 0;
+	if (env->subprog_cnt >= BPF_MAX_SUBPROGS) {
+		verbose("too many subprograms\n");
+		return -E2BIG;
+	}
+	env->subprog_info[env->subprog_cnt++].start = off;
+	sort(env->subprog_info, env->subprog_cnt, sizeof(env->subprog_info[0]),
+	     cmp_subprogs, NULL);
+	return 0;
+}
+
+static bool helper_changes_pkt_data(struct bpf_verifier_env *env,
+				    int func_id)
+{
+	const struct bpf_func_proto *fn = NULL;
+
+	/* invalid ids are rejected by check_call() */
+	if (func_id < 0 || func_id >= __BPF_FUNC_MAX_ID)
+		return false;
+	if (env->prog->aux->ops->get_func_proto)
+		fn = env->prog->aux->ops->get_func_proto(func_id);
+	return fn && bpf_helper_changes_pkt_data(fn->func);
+}
+
+/* A function that moves skb->data, by itself or through its callees,
+ * invalidates the packet pointers of its callers as well.
+ */
+static void mark_subprogs_pkt_data(struct bpf_verifier_env *env)
+{
+	struct bpf_insn *insn = env->prog->insnsi;
+	struct bpf_subprog_info *info;
+	bool changed, changes;
+	int i, subprog;
+
+	do {
+		changed = false;
+		for (subprog = 0; subprog < env->subprog_cnt; subprog++) {
+			info = &env->subprog_info[subprog];
+			if (info->changes_pkt_data)
+				continue;
+			for (i = info->start; i < subprog_end(env, subprog); i++) {
+				if (insn[i].code != (BPF_JMP | BPF_CALL))
+					continue;
+				if (insn[i].src_reg == BPF_PSEUDO_CALL)
+					changes = env->subprog_info[find_subprog(env,
+						i + insn[i].imm + 1)].changes_pkt_data;
+				else
+					changes = helper_changes_pkt_data(env,
+								insn[i].imm);
+				if (changes) {
+					info->changes_pkt_data = true;
+					changed = true;
+					break;
+				}
+			}
+		}
+	} while (changed);
+}
+
+/* Split the program into functions at the targets of BPF_PSEUDO_CALL and
+ * make sure each of them is self-contained: no jump leaves it and it
+ * doesn't fall through into the next one.
+ */
+static int check_subprogs(struct bpf_verifier_env *env)
+{
+	struct bpf_insn *insn = env->prog->insnsi;
+	int i, off, ret, subprog, start, end;
+
+	/* the main program, starting at insn 0 */
+	env->subprog_cnt = 1;
+
+	for (i = 0; i < env->prog->len; i++) {
+		if (insn[i].code != (BPF_JMP | BPF_CALL) ||
+		    insn[i].src_reg != BPF_PSEUDO_CALL)
+			continue;
+		if (!env->allow_ptr_leaks) {
+			verbose("function calls to other bpf functions are allowed for root only\n");
+			return -EPERM;
+		}
+		if (insn[i].off != 0 || insn[i].dst_reg != BPF_REG_0) {
+			verbose("BPF_CALL uses reserved fields\n");
+			return -EINVAL;
+		}
+		ret = add_subprog(env, i + insn[i].imm + 1);
+		if (ret < 0)
+			return ret;
+	}
+
+	if (env->subprog_cnt == 1)
+		return 0;
+
+	for (subprog = 0; subprog < env->subprog_cnt; subprog++) {
+		start = env->subprog_info[subprog].start;
+		end = subprog_end(env, subprog);
+		if (log_level > 1)
+			verbose("func#%d @%d\n", subprog, start);
+
+		for (i = start; i < end; i++) {
+			u8 code = insn[i].code;
+
+			if (BPF_CLASS(code) != BPF_JMP ||
+			    BPF_OP(code) == BPF_CALL || BPF_OP(code) == BPF_EXIT)
+				continue;
+			off = i + insn[i].off + 1;
+			if (off < start || off >= end) {
+				verbose("jump out of range from insn %d to %d\n",
+					i, off);
+				return -EINVAL;
+			}
+		}
+
+		/* the last function running off the end is check_cfg()'s */
+		if (end == env->prog->len)
+			continue;
+		if (insn[end - 1].code != (BPF_JMP | BPF_EXIT) &&
+		    insn[end - 1].code != (BPF_JMP | BPF_JA)) {
+			verbose("last insn of func#%d is not exit or jmp\n",
+				subprog);
+			return -EINVAL;
+		}
+	}
+
+	mark_subprogs_pkt_data(env);
+	return 0;
+}
+
 /* non-recursive DFS pseudo code
  * 1  procedure DFS-iterative(G,v):
  * 2      label v as discovered
@@ -2505,6 +2759,19 @@ peek_stack:
 				goto err_free;
 			if (t + 1 < insn_cnt)
 				env->explored_states[t + 1] = STATE_LIST_MARK;
+			if (insns[t].src_reg == BPF_PSEUDO_CALL) {
+				/* the callee is a part of the caller's walk,
+				 * so recursion shows up as a back-edge.  Its
+				 * entry becomes a pruning point, see
+				 * check_func_call()
+				 */
+				ret = push_insn(t, t + insns[t].imm + 1,
+						BRANCH, env);
+				if (ret == 1)
+					goto peek_stack;
+				else if (ret < 0)
+					goto err_free;
+			}
 		} else if (opcode == BPF_JA) {
 			if (BPF_SRC(insns[t].code) != BPF_K) {
 				ret = -EINVAL;
@@ -2535,6 +2802,11 @@ peek_stack:
 				goto peek_stack;
 			else if (ret < 0)
 				goto err_free;
+			/* both edges are pruning points: with liveness the
+			 * fall-through state often matches one explored from
+			 * the other side of an earlier branch
+			 */
+			env->explored_states[t + 1] = STATE_LIST_MARK;
 		}
 	} else {
 		/* all other non-branch instructions with single
@@ -2663,7 +2935,11 @@ static bool states_equal(struct bpf_verifier_env *env,
 		rold = &old->regs[i];
 		rcur = &cur->regs[i];
 
-		if (memcmp(rold, rcur, sizeof(*rold)) == 0)
+		if (!(rold->live & REG_LIVE_READ))
+			/* explored state didn't use this */
+			continue;
+
+		if (memcmp(rold, rcur, offsetof(struct bpf_reg_state, live)) == 0)
 			continue;
 
 		/* If the ranges were not the same, but everything else was and
@@ -2701,9 +2977,13 @@ static bool states_equal(struct bpf_verifier_env *env,
 			return false;
 		if (i % BPF_REG_SIZE)
 			continue;
+		if (old->stack_slot_type[i] == STACK_SPILL &&
+		    !(old->spilled_regs[i / BPF_REG_SIZE].live & REG_LIVE_READ))
+			/* explored state never filled from this slot */
+			continue;
 		if (memcmp(&old->spilled_regs[i / BPF_REG_SIZE],
 			   &cur->spilled_regs[i / BPF_REG_SIZE],
-			   sizeof(old->spilled_regs[0])))
+			   offsetof(struct bpf_reg_state, live)))
 			/* when explored and current stack slot types are
 			 * the same, check that stored pointers types
 			 * are the same as well.
@@ -2721,10 +3001,35 @@ static bool states_equal(struct bpf_verifier_env *env,
 	return true;
 }
 
+/* A state equivalent to 'state' will reach bpf_exit the same way, reading
+ * everything 'state' read.  Those reads now depend on the values in 'cur',
+ * so pass them on to its parents like reads done on the current path.
+ * Write marks of 'state' don't screen anything here: they describe the path
+ * that reached it, not the one that reached 'cur'.
+ */
+static void propagate_liveness(const struct bpf_verifier_state *state,
+			       const struct bpf_verifier_state *cur)
+{
+	int i;
+
+	for (i = 0; i < MAX_BPF_REG; i++)
+		if (state->regs[i].live & REG_LIVE_READ)
+			mark_reg_read(cur, i);
+
+	for (i = 0; i < MAX_BPF_STACK / BPF_REG_SIZE; i++) {
+		if (state->stack_slot_type[i * BPF_REG_SIZE] != STACK_SPILL)
+			continue;
+		if (state->spilled_regs[i].live & REG_LIVE_READ)
+			mark_stack_slot_read(cur, i);
+	}
+}
+
 static int is_state_visited(struct bpf_verifier_env *env, int insn_idx)
 {
 	struct bpf_verifier_state_list *new_sl;
 	struct bpf_verifier_state_list *sl;
+	u32 nr_states = 0;
+	int i;
 
 	sl = env->explored_states[insn_idx];
 	if (!sl)
@@ -2734,12 +3039,19 @@ static int is_state_visited(struct bpf_verifier_env *env, int insn_idx)
 		return 0;
 
 	while (sl != STATE_LIST_MARK) {
-		if (states_equal(env, &sl->state, &env->cur_state))
+		if (states_equal(env, &sl->state, &env->cur_state)) {
 			/* reached equivalent register/stack state,
-			 * prune the search
+			 * prune the search.
+			 * Registers read by the continuation are read by us,
+			 * our own marks are forgotten as soon as the next
+			 * state is popped.
 			 */
+			propagate_liveness(&sl->state, &env->cur_state);
+			env->pruned_states++;
 			return 1;
+		}
 		sl = sl->next;
+		nr_states++;
 	}
 
 	/* there were no equivalent states, remember current one.
@@ -2756,6 +3068,19 @@ static int is_state_visited(struct bpf_verifier_env *env, int insn_idx)
 	memcpy(&new_sl->state, &env->cur_state, sizeof(env->cur_state));
 	new_sl->next = env->explored_states[insn_idx];
 	env->explored_states[insn_idx] = new_sl;
+
+	env->total_states++;
+	if (++nr_states > env->max_states_per_insn)
+		env->max_states_per_insn = nr_states;
+
+	/* connect new state to parentage chain and start collecting
+	 * the marks of the path below it afresh
+	 */
+	env->cur_state.parent = &new_sl->state;
+	for (i = 0; i < MAX_BPF_REG; i++)
+		env->cur_state.regs[i].live = REG_LIVE_NONE;
+	for (i = 0; i < MAX_BPF_STACK / BPF_REG_SIZE; i++)
+		env->cur_state.spilled_regs[i].live = REG_LIVE_NONE;
 	return 0;
 }
 
@@ -2768,19 +3093,107 @@ static int ext_analyzer_insn_hook(struct bpf_verifier_env *env,
 	return env->analyzer_ops->insn_hook(env, insn_idx, prev_insn_idx);
 }
 
-static int do_check(struct bpf_verifier_env *env)
+static int do_check_paths(struct bpf_verifier_env *env, int insn_idx);
+
+/* Verify the function called at 'insn_idx' in the calling context of the
+ * current state: R1-R5 as they are, R6-R9 unreadable and a stack of its own.
+ * Its entry is a pruning point, so the function is walked once per calling
+ * context; a context equivalent to one it was already verified in is cut
+ * short there like any other path.
+ */
+static int check_func_call(struct bpf_verifier_env *env, int insn_idx)
+{
+	struct bpf_insn *insn = &env->prog->insnsi[insn_idx];
+	struct bpf_reg_state *regs = env->cur_state.regs;
+	struct bpf_verifier_stack_elem *head;
+	struct bpf_verifier_state *caller;
+	int i, subprog, target, err;
+
+	target = insn_idx + insn->imm + 1;
+	subprog = find_subprog(env, target);
+	if (subprog < 0) {
+		verbose("verifier bug. No program starts at insn %d\n", target);
+		return -EFAULT;
+	}
+
+	if (env->call_depth + 1 >= MAX_CALL_FRAMES) {
+		verbose("the call stack of %d frames is too deep\n",
+			env->call_depth + 2);
+		return -E2BIG;
+	}
+
+	for (i = BPF_REG_1; i <= BPF_REG_5; i++) {
+		if (regs[i].type == NOT_INIT)
+			continue;
+		/* the callee's stack is not the caller's */
+		if (regs[i].type == PTR_TO_STACK || regs[i].type == FRAME_PTR) {
+			verbose("R%d pointer to stack can't be passed to func#%d\n",
+				i, subprog);
+			return -EACCES;
+		}
+		/* whatever the callee reads of them */
+		mark_reg_read(&env->cur_state, i);
+	}
+
+	caller = kmalloc(sizeof(*caller), GFP_KERNEL);
+	if (!caller)
+		return -ENOMEM;
+	memcpy(caller, &env->cur_state, sizeof(*caller));
+
+	memset(&env->cur_state, 0, sizeof(env->cur_state));
+	init_reg_state(regs);
+	for (i = BPF_REG_1; i <= BPF_REG_5; i++) {
+		regs[i] = caller->regs[i];
+		regs[i].live = REG_LIVE_NONE;
+	}
+
+	if (log_level)
+		verbose("call func#%d from %d\n", subprog, insn_idx);
+
+	/* the callee's paths are walked to the end before the caller's
+	 * pending branches, keep them apart
+	 */
+	head = env->head;
+	env->head = NULL;
+	env->call_depth++;
+	err = do_check_paths(env, target);
+	env->call_depth--;
+	while (pop_stack(env, NULL) >= 0);
+	env->head = head;
+
+	memcpy(&env->cur_state, caller, sizeof(*caller));
+	kfree(caller);
+	if (err)
+		return err;
+
+	if (log_level)
+		verbose("return from func#%d to %d\n", subprog, insn_idx + 1);
+
+	if (env->subprog_info[subprog].changes_pkt_data)
+		clear_all_pkt_pointers(env);
+
+	/* same convention as for helpers */
+	for (i = 0; i < CALLER_SAVED_REGS; i++) {
+		regs[caller_saved[i]].type = NOT_INIT;
+		regs[caller_saved[i]].imm = 0;
+		regs[caller_saved[i]].live |= REG_LIVE_WRITTEN;
+	}
+	mark_reg_unknown_value_and_range(regs, BPF_REG_0);
+	return 0;
+}
+
+/* Walk every path from 'insn_idx' in the current state to the bpf_exit of
+ * the function it starts in.
+ */
+static int do_check_paths(struct bpf_verifier_env *env, int insn_idx)
 {
 	struct bpf_verifier_state *state = &env->cur_state;
 	struct bpf_insn *insns = env->prog->insnsi;
 	struct bpf_reg_state *regs = state->regs;
 	int insn_cnt = env->prog->len;
-	int insn_idx, prev_insn_idx = 0;
-	int insn_processed = 0;
+	int prev_insn_idx = insn_idx;
 	bool do_print_state = false;
 
-	init_reg_state(regs);
-	insn_idx = 0;
-	env->varlen_map_value_access = false;
 	for (;;) {
 		struct bpf_insn *insn;
 		u8 class;
@@ -2795,9 +3208,9 @@ static int do_check(struct bpf_verifier_env *env)
 		insn = &insns[insn_idx];
 		class = BPF_CLASS(insn->code);
 
-		if (++insn_processed > BPF_COMPLEXITY_LIMIT_INSNS) {
-			verbose("BPF program is too large. Processed %d insn\n",
-				insn_processed);
+		if (++env->insn_processed > BPF_COMPLEXITY_LIMIT_INSNS) {
+			verbose("BPF program is too large. Processed %u insn\n",
+				env->insn_processed);
 			return -E2BIG;
 		}
 
@@ -2842,11 +3255,11 @@ static int do_check(struct bpf_verifier_env *env)
 			/* check for reserved fields is already done */
 
 			/* check src operand */
-			err = check_reg_arg(regs, insn->src_reg, SRC_OP);
+			err = check_reg_arg(env, insn->src_reg, SRC_OP);
 			if (err)
 				return err;
 
-			err = check_reg_arg(regs, insn->dst_reg, DST_OP_NO_MARK);
+			err = check_reg_arg(env, insn->dst_reg, DST_OP_NO_MARK);
 			if (err)
 				return err;
 
@@ -2902,11 +3315,11 @@ static int do_check(struct bpf_verifier_env *env)
 			}
 
 			/* check src1 operand */
-			err = check_reg_arg(regs, insn->src_reg, SRC_OP);
+			err = check_reg_arg(env, insn->src_reg, SRC_OP);
 			if (err)
 				return err;
 			/* check src2 operand */
-			err = check_reg_arg(regs, insn->dst_reg, SRC_OP);
+			err = check_reg_arg(env, insn->dst_reg, SRC_OP);
 			if (err)
 				return err;
 
@@ -2937,7 +3350,7 @@ static int do_check(struct bpf_verifier_env *env)
 				return -EINVAL;
 			}
 			/* check src operand */
-			err = check_reg_arg(regs, insn->dst_reg, SRC_OP);
+			err = check_reg_arg(env, insn->dst_reg, SRC_OP);
 			if (err)
 				return err;
 
@@ -2954,13 +3367,17 @@ static int do_check(struct bpf_verifier_env *env)
 			if (opcode == BPF_CALL) {
 				if (BPF_SRC(insn->code) != BPF_K ||
 				    insn->off != 0 ||
-				    insn->src_reg != BPF_REG_0 ||
+				    (insn->src_reg != BPF_REG_0 &&
+				     insn->src_reg != BPF_PSEUDO_CALL) ||
 				    insn->dst_reg != BPF_REG_0) {
 					verbose("BPF_CALL uses reserved fields\n");
 					return -EINVAL;
 				}
 
-				err = check_call(env, insn->imm);
+				if (insn->src_reg == BPF_PSEUDO_CALL)
+					err = check_func_call(env, insn_idx);
+				else
+					err = check_call(env, insn->imm);
 				if (err)
 					return err;
 
@@ -2991,7 +3408,7 @@ static int do_check(struct bpf_verifier_env *env)
 				 * of bpf_exit, which means that program wrote
 				 * something into it earlier
 				 */
-				err = check_reg_arg(regs, BPF_REG_0, SRC_OP);
+				err = check_reg_arg(env, BPF_REG_0, SRC_OP);
 				if (err)
 					return err;
 
@@ -3000,6 +3417,15 @@ static int do_check(struct bpf_verifier_env *env)
 					return -EACCES;
 				}
 
+				/* the caller takes it as an unknown scalar */
+				if (env->call_depth &&
+				    regs[BPF_REG_0].type != UNKNOWN_VALUE &&
+				    regs[BPF_REG_0].type != CONST_IMM) {
+					verbose("func can't return %s in R0\n",
+						reg_type_str[regs[BPF_REG_0].type]);
+					return -EACCES;
+				}
+
 process_bpf_exit:
 				insn_idx = pop_stack(env, &prev_insn_idx);
 				if (insn_idx < 0) {
@@ -3040,7 +3466,23 @@ process_bpf_exit:
 		insn_idx++;
 	}
 
-	verbose("processed %d insns\n", insn_processed);
+	return 0;
+}
+
+static int do_check(struct bpf_verifier_env *env)
+{
+	int err;
+
+	init_reg_state(env->cur_state.regs);
+	env->varlen_map_value_access = false;
+
+	err = do_check_paths(env, 0);
+	if (err)
+		return err;
+
+	verbose("processed %u insns, total_states %u pruned_states %u peak_states %u max_states_per_insn %u\n",
+		env->insn_processed, env->total_states, env->pruned_states,
+		env->peak_states, env->max_states_per_insn);
 	return 0;
 }
 
@@ -3332,11 +3774,15 @@ int bpf_check(struct bpf_prog **prog, union bpf_attr *attr)
 	if (!env->explored_states)
 		goto skip_full_check;
 
-	ret = check_cfg(env);
+	env->allow_ptr_leaks = capable(CAP_SYS_ADMIN);
+
+	ret = check_subprogs(env);
 	if (ret < 0)
 		goto skip_full_check;
 
-	env->allow_ptr_leaks = capable(CAP_SYS_ADMIN);
+	ret = check_cfg(env);
+	if (ret < 0)
+		goto skip_full_check;
 
 	ret = do_check(env);
 
@@ -3430,11 +3876,15 @@ int bpf_analyzer(struct bpf_prog *prog, const struct bpf_ext_analyzer_ops *ops,
 	if (!env->explored_states)
 		goto skip_full_check;
 
-	ret = check_cfg(env);
+	env->allow_ptr_leaks = capable(CAP_SYS_ADMIN);
+
+	ret = check_subprogs(env);
 	if (ret < 0)
 		goto skip_full_check;
 
-	env->allow_ptr_leaks = capable(CAP_SYS_ADMIN);
+	ret = check_cfg(env);
+	if (ret < 0)
+		goto skip_full_check;
 
 	ret = do_check(env);
 
@@ -50,6 +50,8 @@
 #include <linux/sched/mm.h>
 #include <linux/proc_ns.h>
 #include <linux/mount.h>
+#include <linux/sort.h>
+#include <linux/bsearch.h>
 
 #include "internal.h"
 
@@ -375,6 +377,35 @@ static DECLARE_DELAYED_WORK(perf_sched_work, perf_sched_delayed);
 static DEFINE_MUTEX(perf_sched_mutex);
 static atomic_t perf_sched_count;
 
+static void perf_sched_events_inc(void)
+{
+	if (atomic_inc_not_zero(&perf_sched_count))
+		return;
+
+	mutex_lock(&perf_sched_mutex);
+	if (!atomic_read(&perf_sched_count)) {
+		static_branch_enable(&perf_sched_events);
+		/*
+		 * Guarantee that all CPUs observe they key change and
+		 * call the perf scheduling hooks before proceeding to
+		 * install events that need them.
+		 */
+		synchronize_sched();
+	}
+	/*
+	 * Now that we have waited for the sync_sched(), allow further
+	 * increments to by-pass the mutex.
+	 */
+	atomic_inc(&perf_sched_count);
+	mutex_unlock(&perf_sched_mutex);
+}
+
+static void perf_sched_events_dec(void)
+{
+	if (!atomic_add_unless(&perf_sched_count, -1, 1))
+		schedule_delayed_work(&perf_sched_work, HZ);
+}
+
 static DEFINE_PER_CPU(atomic_t, perf_cgroup_events);
 static DEFINE_PER_CPU(int, perf_sched_cb_usages);
 static DEFINE_PER_CPU(struct pmu_event_list, pmu_sb_events);
@@ -909,6 +940,256 @@ list_update_cgroup_event(struct perf_event *event,
 	}
 }
 
+/*
+ * Instead of opening one cgroup event per cgroup, which all have to be
+ * multiplexed on the PMU, a cpu-wide event can be shared by a set of
+ * cgroups. On every cgroup switch the delta of the event since the last
+ * switch is added to the outgoing cgroup and to each of its ancestors
+ * that is attached, so a single counter serves a whole hierarchy.
+ */
+struct perf_cgroup_node {
+	struct cgroup_subsys_state	*css;
+	u64				count;
+};
+
+#define PERF_MAX_CGROUP_NODES	256
+
+static DEFINE_PER_CPU(struct list_head, cgrp_node_events);
+
+static int perf_cgroup_node_cmp(const void *a, const void *b)
+{
+	const struct perf_cgroup_node *x = a, *y = b;
+
+	if (x->css < y->css)
+		return -1;
+	return x->css > y->css;
+}
+
+static struct perf_cgroup_node *
+perf_cgroup_node_find(struct perf_event *event, struct cgroup_subsys_state *css)
+{
+	struct perf_cgroup_node key = { .css = css };
+
+	return bsearch(&key, event->cgrp_nodes, event->nr_cgrp_nodes,
+		       sizeof(key), perf_cgroup_node_cmp);
+}
+
+/*
+ * Must be called on event->cpu with interrupts disabled.
+ */
+static void
+perf_cgroup_node_account(struct perf_event *event, struct perf_cgroup *cgrp)
+{
+	struct cgroup_subsys_state *css;
+	struct perf_cgroup_node *node;
+	u64 count, delta;
+
+	if (event->state == PERF_EVENT_STATE_ACTIVE)
+		event->pmu->read(event);
+
+	count = local64_read(&event->count);
+	delta = count - event->cgrp_node_count;
+	event->cgrp_node_count = count;
+
+	for (css = &cgrp->css; css; css = css->parent) {
+		node = perf_cgroup_node_find(event, css);
+		if (node)
+			node->count += delta;
+	}
+}
+
+static void perf_cgroup_node_switch(struct task_struct *task,
+				    struct task_struct *next)
+{
+	struct perf_cgroup *cgrp;
+	struct perf_event *event;
+
+	rcu_read_lock();
+	cgrp = perf_cgroup_from_task(task, NULL);
+	if (cgrp != perf_cgroup_from_task(next, NULL)) {
+		list_for_each_entry(event, this_cpu_ptr(&cgrp_node_events),
+				    cgrp_node_entry)
+			perf_cgroup_node_account(event, cgrp);
+	}
+	rcu_read_unlock();
+}
+
+static inline void perf_cgroup_node_sched_out(struct task_struct *task,
+					      struct task_struct *next)
+{
+	if (!list_empty(this_cpu_ptr(&cgrp_node_events)))
+		perf_cgroup_node_switch(task, next);
+}
+
+static int __perf_cgroup_node_attach(void *info)
+{
+	struct perf_event *event = info;
+
+	if (event->state == PERF_EVENT_STATE_ACTIVE)
+		event->pmu->read(event);
+	event->cgrp_node_count = local64_read(&event->count);
+	list_add(&event->cgrp_node_entry, this_cpu_ptr(&cgrp_node_events));
+	return 0;
+}
+
+static int __perf_cgroup_node_detach(void *info)
+{
+	struct perf_event *event = info;
+
+	list_del(&event->cgrp_node_entry);
+	return 0;
+}
+
+static int __perf_cgroup_node_read(void *info)
+{
+	struct perf_event *event = info;
+
+	/* flush what accrued to current since the last switch */
+	rcu_read_lock();
+	perf_cgroup_node_account(event, perf_cgroup_from_task(current, NULL));
+	rcu_read_unlock();
+	return 0;
+}
+
+static void perf_cgroup_node_put(struct perf_cgroup_node *nodes, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		if (nodes[i].css)
+			css_put(nodes[i].css);
+	}
+	kfree(nodes);
+}
+
+/*
+ * @arg points to { nr, cgroup fd[nr] }.
+ */
+static int perf_cgroup_node_attach(struct perf_event *event, u64 __user *arg)
+{
+	struct cgroup_subsys_state *css;
+	struct perf_cgroup_node *nodes;
+	u64 nr, fd;
+	struct fd f;
+	int i, ret;
+
+	if (event->cpu < 0 || (event->attach_state & PERF_ATTACH_TASK) ||
+	    is_cgroup_event(event))
+		return -EINVAL;
+
+	if (event->cgrp_nodes)
+		return -EBUSY;
+
+	if (copy_from_user(&nr, arg, sizeof(nr)))
+		return -EFAULT;
+
+	if (!nr || nr > PERF_MAX_CGROUP_NODES)
+		return -EINVAL;
+
+	nodes = kcalloc(nr, sizeof(*nodes), GFP_KERNEL);
+	if (!nodes)
+		return -ENOMEM;
+
+	for (i = 0; i < nr; i++) {
+		ret = -EFAULT;
+		if (copy_from_user(&fd, arg + 1 + i, sizeof(fd)))
+			goto err;
+
+		ret = -EBADF;
+		f = fdget(fd);
+		if (!f.file)
+			goto err;
+
+		css = css_tryget_online_from_dir(f.file->f_path.dentry,
+						 &perf_event_cgrp_subsys);
+		fdput(f);
+		if (IS_ERR(css)) {
+			ret = PTR_ERR(css);
+			goto err;
+		}
+		nodes[i].css = css;
+	}
+
+	sort(nodes, nr, sizeof(*nodes), perf_cgroup_node_cmp, NULL);
+	for (i = 1; i < nr; i++) {
+		ret = -EINVAL;
+		if (nodes[i].css == nodes[i - 1].css)
+			goto err;
+	}
+
+	event->cgrp_nodes = nodes;
+	event->nr_cgrp_nodes = nr;
+
+	perf_sched_events_inc();
+	ret = cpu_function_call(event->cpu, __perf_cgroup_node_attach, event);
+	if (ret) {
+		perf_sched_events_dec();
+		event->cgrp_nodes = NULL;
+		event->nr_cgrp_nodes = 0;
+		goto err;
+	}
+	return 0;
+
+err:
+	perf_cgroup_node_put(nodes, nr);
+	return ret;
+}
+
+static void perf_cgroup_node_detach(struct perf_event *event)
+{
+	if (!event->cgrp_nodes)
+		return;
+
+	/* an offline cpu doesn't walk its list */
+	if (cpu_function_call(event->cpu, __perf_cgroup_node_detach, event))
+		list_del(&event->cgrp_node_entry);
+
+	perf_sched_events_dec();
+	perf_cgroup_node_put(event->cgrp_nodes, event->nr_cgrp_nodes);
+	event->cgrp_nodes = NULL;
+	event->nr_cgrp_nodes = 0;
+}
+
+/*
+ * @arg points to { cgroup fd, count }, the count is written back.
+ */
+static int perf_cgroup_node_read(struct perf_event *event, u64 __user *arg)
+{
+	struct cgroup_subsys_state *css;
+	struct perf_cgroup_node *node;
+	u64 fd, count;
+	struct fd f;
+
+	if (!event->cgrp_nodes)
+		return -EINVAL;
+
+	if (copy_from_user(&fd, arg, sizeof(fd)))
+		return -EFAULT;
+
+	f = fdget(fd);
+	if (!f.file)
+		return -EBADF;
+
+	css = css_tryget_online_from_dir(f.file->f_path.dentry,
+					 &perf_event_cgrp_subsys);
+	fdput(f);
+	if (IS_ERR(css))
+		return PTR_ERR(css);
+
+	node = perf_cgroup_node_find(event, css);
+	css_put(css);
+	if (!node)
+		return -ENOENT;
+
+	/* an offline cpu has nothing left to flush */
+	cpu_function_call(event->cpu, __perf_cgroup_node_read, event);
+	count = READ_ONCE(node->count);
+
+	if (copy_to_user(arg + 1, &count, sizeof(count)))
+		return -EFAULT;
+	return 0;
+}
+
 #else /* !CONFIG_CGROUP_PERF */
 
 static inline bool
@@ -993,6 +1274,27 @@ list_update_cgroup_event(struct perf_event *event,
 {
 }
 
+static inline void perf_cgroup_node_sched_out(struct task_struct *task,
+					      struct task_struct *next)
+{
+}
+
+static inline int perf_cgroup_node_attach(struct perf_event *event,
+					  u64 __user *arg)
+{
+	return -EINVAL;
+}
+
+static inline void perf_cgroup_node_detach(struct perf_event *event)
+{
+}
+
+static inline int perf_cgroup_node_read(struct perf_event *event,
+					u64 __user *arg)
+{
+	return -EINVAL;
+}
+
 #endif
 
 /*
@@ -3045,6 +3347,8 @@ void __perf_event_task_sched_out(struct task_struct *task,
 	 */
 	if (atomic_read(this_cpu_ptr(&perf_cgroup_events)))
 		perf_cgroup_sched_out(task, next);
+
+	perf_cgroup_node_sched_out(task, next);
 }
 
 /*
@@ -4009,10 +4313,8 @@ static void unaccount_event(struct perf_event *event)
 	if (has_branch_stack(event))
 		dec = true;
 
-	if (dec) {
-		if (!atomic_add_unless(&perf_sched_count, -1, 1))
-			schedule_delayed_work(&perf_sched_work, HZ);
-	}
+	if (dec)
+		perf_sched_events_dec();
 
 	unaccount_event_cpu(event, event->cpu);
 
@@ -4136,6 +4438,8 @@ static void _free_event(struct perf_event *event)
 	if (is_cgroup_event(event))
 		perf_detach_cgroup(event);
 
+	perf_cgroup_node_detach(event);
+
 	if (!event->parent) {
 		if (event->attr.sample_type & PERF_SAMPLE_CALLCHAIN)
 			put_callchain_buffers();
@@ -4751,6 +5055,13 @@ static long _perf_ioctl(struct perf_event *event, unsigned int cmd, unsigned lon
 		rcu_read_unlock();
 		return 0;
 	}
+
+	case PERF_EVENT_IOC_ATTACH_CGROUP:
+		return perf_cgroup_node_attach(event, (u64 __user *)arg);
+
+	case PERF_EVENT_IOC_READ_CGROUP:
+		return perf_cgroup_node_read(event, (u64 __user *)arg);
+
 	default:
 		return -ENOTTY;
 	}
@@ -4783,6 +5094,8 @@ static long perf_compat_ioctl(struct file *file, unsigned int cmd,
 	switch (_IOC_NR(cmd)) {
 	case _IOC_NR(PERF_EVENT_IOC_SET_FILTER):
 	case _IOC_NR(PERF_EVENT_IOC_ID):
+	case _IOC_NR(PERF_EVENT_IOC_ATTACH_CGROUP):
+	case _IOC_NR(PERF_EVENT_IOC_READ_CGROUP):
 		/* Fix up pointer size (usually 4 -> 8 in 32-on-64-bit case */
 		if (_IOC_SIZE(cmd) == sizeof(compat_uptr_t)) {
 			cmd &= ~IOCSIZE_MASK;
@@ -9293,28 +9606,8 @@ static void account_event(struct perf_event *event)
 	if (is_cgroup_event(event))
 		inc = true;
 
-	if (inc) {
-		if (atomic_inc_not_zero(&perf_sched_count))
-			goto enabled;
-
-		mutex_lock(&perf_sched_mutex);
-		if (!atomic_read(&perf_sched_count)) {
-			static_branch_enable(&perf_sched_events);
-			/*
-			 * Guarantee that all CPUs observe they key change and
-			 * call the perf scheduling hooks before proceeding to
-			 * install events that need them.
-			 */
-			synchronize_sched();
-		}
-		/*
-		 * Now that we have waited for the sync_sched(), allow further
-		 * increments to by-pass the mutex.
-		 */
-		atomic_inc(&perf_sched_count);
-		mutex_unlock(&perf_sched_mutex);
-	}
-enabled:
+	if (inc)
+		perf_sched_events_inc();
 
 	account_event_cpu(event, event->cpu);
 
@@ -10930,6 +11223,7 @@ static void __init perf_event_init_all_cpus(void)
 
 #ifdef CONFIG_CGROUP_PERF
 		INIT_LIST_HEAD(&per_cpu(cgrp_cpuctx_list, cpu));
+		INIT_LIST_HEAD(&per_cpu(cgrp_node_events, cpu));
 #endif
 		INIT_LIST_HEAD(&per_cpu(sched_cb_list, cpu));
 	}
@@ -25,6 +25,7 @@
 #include <linux/tsacct_kern.h>
 #include <linux/file.h>
 #include <linux/fdtable.h>
+#include <linux/poll.h>
 #include <linux/freezer.h>
 #include <linux/binfmts.h>
 #include <linux/nsproxy.h>
@@ -870,6 +871,8 @@ void __noreturn do_exit(long code)
 
 	exit_sem(tsk);
 	exit_shm(tsk);
+	exit_poll_cache(tsk);
+	exit_fd_cache(tsk);
 	exit_files(tsk);
 	exit_fs(tsk);
 	if (group_dead)
@@ -67,6 +67,9 @@
 #include <linux/freezer.h>
 #include <linux/bootmem.h>
 #include <linux/fault-inject.h>
+#include <linux/vmalloc.h>
+#include <linux/prctl.h>
+#include <linux/sched/signal.h>
 
 #include <asm/futex.h>
 
@@ -384,20 +387,106 @@ static inline int hb_waiters_pending(struct futex_hash_bucket *hb)
 }
 
 /**
- * hash_futex - Return the hash bucket in the global hash
+ * hash_futex - Return the hash bucket in the global or private hash
  * @key:	Pointer to the futex key for which the hash is calculated
  *
  * We hash on the keys returned from get_futex_key (see below) and return the
- * corresponding hash bucket in the global hash.
+ * corresponding hash bucket in the global hash, or in the hash of the mm for
+ * a private futex of a process that set one up with PR_FUTEX_HASH.
  */
 static struct futex_hash_bucket *hash_futex(union futex_key *key)
 {
 	u32 hash = jhash2((u32*)&key->both.word,
 			  (sizeof(key->both.word)+sizeof(key->both.ptr))/4,
 			  key->both.offset);
+	struct mm_struct *mm = key->private.mm;
+
+	if (!(key->both.offset & (FUT_OFF_INODE|FUT_OFF_MMSHARED)) &&
+	    mm->futex_queues)
+		return &mm->futex_queues[hash & (mm->futex_hashsize - 1)];
+
 	return &futex_queues[hash & (futex_hashsize - 1)];
 }
 
+static void futex_hash_bucket_init(struct futex_hash_bucket *hb)
+{
+	atomic_set(&hb->waiters, 0);
+	plist_head_init(&hb->chain);
+	spin_lock_init(&hb->lock);
+}
+
+#define FUTEX_PRIVATE_HASH_MIN	16
+#define FUTEX_PRIVATE_HASH_MAX	(1U << 16)
+
+/*
+ * PR_FUTEX_HASH_SET_SLOTS: allocate a private futex hash of @slots buckets
+ * (rounded up to a power of two) on @node, NUMA_NO_NODE meaning the local
+ * one.  It keeps private futexes of a busy process from contending with
+ * everybody else in the global hash, and keeps the buckets on the node the
+ * process runs on.  The hash is only installed while the process is single
+ * threaded, so that no waiter can be queued in the global hash for a key
+ * that now hashes elsewhere, and it stays until the mm goes away.
+ */
+static int futex_hash_set_slots(unsigned long slots, int node)
+{
+	struct mm_struct *mm = current->mm;
+	struct futex_hash_bucket *queues;
+	unsigned long i;
+	size_t size;
+
+	if (slots < FUTEX_PRIVATE_HASH_MIN || slots > FUTEX_PRIVATE_HASH_MAX)
+		return -EINVAL;
+	if (node == NUMA_NO_NODE)
+		node = numa_node_id();
+	else if (node < 0 || node >= nr_node_ids || !node_online(node))
+		return -EINVAL;
+
+	if (mm->futex_queues)
+		return -EBUSY;
+	if (!current_is_single_threaded())
+		return -EBUSY;
+
+	slots = roundup_pow_of_two(slots);
+	size = slots * sizeof(*queues);
+	queues = kmalloc_node(size, GFP_KERNEL | __GFP_NOWARN, node);
+	if (!queues)
+		queues = vmalloc_node(size, node);
+	if (!queues)
+		return -ENOMEM;
+
+	for (i = 0; i < slots; i++)
+		futex_hash_bucket_init(&queues[i]);
+
+	mm->futex_hashsize = slots;
+	mm->futex_queues = queues;
+	return 0;
+}
+
+int futex_hash_prctl(unsigned long arg2, unsigned long arg3,
+		     unsigned long arg4)
+{
+	switch (arg2) {
+	case PR_FUTEX_HASH_SET_SLOTS:
+		return futex_hash_set_slots(arg3, (int)arg4);
+	case PR_FUTEX_HASH_GET_SLOTS:
+		if (arg3 || arg4)
+			return -EINVAL;
+		return current->mm->futex_hashsize;
+	}
+	return -EINVAL;
+}
+
+void futex_mm_init(struct mm_struct *mm)
+{
+	mm->futex_queues = NULL;
+	mm->futex_hashsize = 0;
+}
+
+void futex_mm_free(struct mm_struct *mm)
+{
+	kvfree(mm->futex_queues);
+}
+
 
 /**
  * match_futex - Check whether two futex keys are equal
@@ -2574,6 +2663,186 @@ static long futex_wait_restart(struct restart_block *restart)
 				restart->futex.val, tp, restart->futex.bitset);
 }
 
+/**
+ * futex_wait_multiple_setup() - Prepare to wait on several futexes
+ * @wb:		the futexes to wait on, with their expected values
+ * @qs:		one futex_q per futex
+ * @count:	number of entries in @wb and @qs
+ * @flags:	futex flags (FLAGS_SHARED, etc.)
+ * @woken:	index of a futex that was woken while undoing the setup
+ *
+ * Queue @qs on all the futexes, each after checking its value under the hash
+ * bucket lock as futex_wait_setup() does.  The task state is set before the
+ * first futex is queued, so a wake up on any of them before we get to sleep
+ * is not lost.  If one of the values does not match, the futexes queued so
+ * far are dequeued again; one of those may have been woken in the meantime,
+ * which is reported in @woken.
+ *
+ * Return:
+ *  0 - all futexes queued (*@woken < 0) or one woken (*@woken >= 0);
+ * <0 - -EFAULT or -EWOULDBLOCK (a value did not match), nothing queued
+ */
+static int futex_wait_multiple_setup(struct futex_wait_block *wb,
+				     struct futex_q *qs, int count,
+				     unsigned int flags, int *woken)
+{
+	struct futex_hash_bucket *hb;
+	u32 __user *uaddr;
+	int i, j, ret;
+	u32 uval;
+
+retry:
+	*woken = -1;
+	for (i = 0; i < count; i++) {
+		uaddr = u64_to_user_ptr(wb[i].uaddr);
+		ret = get_futex_key(uaddr, flags & FLAGS_SHARED, &qs[i].key,
+				    VERIFY_READ);
+		if (unlikely(ret)) {
+			while (--i >= 0)
+				put_futex_key(&qs[i].key);
+			return ret;
+		}
+	}
+
+	set_current_state(TASK_INTERRUPTIBLE);
+
+	for (i = 0; i < count; i++) {
+		uaddr = u64_to_user_ptr(wb[i].uaddr);
+		hb = queue_lock(&qs[i]);
+
+		ret = get_futex_value_locked(&uval, uaddr);
+		if (!ret && uval == wb[i].val) {
+			/* queue_me() drops the hb lock */
+			queue_me(&qs[i], hb);
+			continue;
+		}
+		queue_unlock(hb);
+		__set_current_state(TASK_RUNNING);
+
+		/* unqueue_me() drops the key refs of the queued ones */
+		for (j = 0; j < i; j++) {
+			if (!unqueue_me(&qs[j]) && *woken < 0)
+				*woken = j;
+		}
+		for (j = i; j < count; j++)
+			put_futex_key(&qs[j].key);
+
+		if (*woken >= 0)
+			return 0;
+		if (!ret)
+			return -EWOULDBLOCK;
+
+		ret = get_user(uval, uaddr);
+		if (ret)
+			return ret;
+		goto retry;
+	}
+
+	return 0;
+}
+
+/*
+ * Wait until any of the @count futexes described by the futex_wait_block
+ * array at @uaddr is woken, and return its index.
+ */
+static int futex_wait_multiple(u32 __user *uaddr, unsigned int flags,
+			       u32 count, ktime_t *abs_time)
+{
+	struct hrtimer_sleeper timeout, *to = NULL;
+	struct futex_wait_block *wb;
+	struct futex_q *qs;
+	int i, ret, woken;
+
+	if (!count || count > FUTEX_MULTIPLE_MAX_COUNT)
+		return -EINVAL;
+
+	wb = kmalloc_array(count, sizeof(*wb), GFP_KERNEL);
+	if (!wb)
+		return -ENOMEM;
+	ret = -EFAULT;
+	if (copy_from_user(wb, uaddr, count * sizeof(*wb)))
+		goto out_free_wb;
+
+	ret = -ENOMEM;
+	qs = kmalloc_array(count, sizeof(*qs), GFP_KERNEL);
+	if (!qs)
+		goto out_free_wb;
+
+	ret = -EINVAL;
+	for (i = 0; i < count; i++) {
+		if (!wb[i].bitset)
+			goto out_free_qs;
+		qs[i] = futex_q_init;
+		qs[i].bitset = wb[i].bitset;
+	}
+
+	if (abs_time) {
+		to = &timeout;
+
+		hrtimer_init_on_stack(&to->timer, (flags & FLAGS_CLOCKRT) ?
+				      CLOCK_REALTIME : CLOCK_MONOTONIC,
+				      HRTIMER_MODE_ABS);
+		hrtimer_init_sleeper(to, current);
+		hrtimer_set_expires_range_ns(&to->timer, *abs_time,
+					     current->timer_slack_ns);
+	}
+
+retry:
+	ret = futex_wait_multiple_setup(wb, qs, count, flags, &woken);
+	if (ret)
+		goto out;
+	if (woken >= 0) {
+		ret = woken;
+		goto out;
+	}
+
+	/* Arm the timer */
+	if (to)
+		hrtimer_start_expires(&to->timer, HRTIMER_MODE_ABS);
+
+	/*
+	 * A wake up on any of the futexes since the setup has put us back
+	 * into TASK_RUNNING, and schedule() returns right away.
+	 */
+	if (!to || to->task)
+		freezable_schedule();
+	__set_current_state(TASK_RUNNING);
+
+	ret = -1;
+	for (i = 0; i < count; i++) {
+		/* unqueue_me() drops q.key ref */
+		if (!unqueue_me(&qs[i]) && ret < 0)
+			ret = i;
+	}
+	if (ret >= 0)
+		goto out;
+
+	ret = -ETIMEDOUT;
+	if (to && !to->task)
+		goto out;
+
+	/*
+	 * We expect signal_pending(current), but we might be the
+	 * victim of a spurious wakeup as well.
+	 */
+	if (!signal_pending(current))
+		goto retry;
+
+	/* The timeout is absolute, so the syscall can simply be restarted */
+	ret = -ERESTARTSYS;
+
+out:
+	if (to) {
+		hrtimer_cancel(&to->timer);
+		destroy_hrtimer_on_stack(&to->timer);
+	}
+out_free_qs:
+	kfree(qs);
+out_free_wb:
+	kfree(wb);
+	return ret;
+}
+
 
 /*
  * Userspace tried a 0 -> TID atomic transition of the futex value
@@ -3372,7 +3641,7 @@ long do_futex(u32 __user *uaddr, int op, u32 val, ktime_t *timeout,
 	if (op & FUTEX_CLOCK_REALTIME) {
 		flags |= FLAGS_CLOCKRT;
 		if (cmd != FUTEX_WAIT && cmd != FUTEX_WAIT_BITSET && \
-		    cmd != FUTEX_WAIT_REQUEUE_PI)
+		    cmd != FUTEX_WAIT_REQUEUE_PI && cmd != FUTEX_WAIT_MULTIPLE)
 			return -ENOSYS;
 	}
 
@@ -3413,6 +3682,8 @@ long do_futex(u32 __user *uaddr, int op, u32 val, ktime_t *timeout,
 					     uaddr2);
 	case FUTEX_CMP_REQUEUE_PI:
 		return futex_requeue(uaddr, flags, uaddr2, val, val2, &val3, 1);
+	case FUTEX_WAIT_MULTIPLE:
+		return futex_wait_multiple(uaddr, flags, val, timeout);
 	}
 	return -ENOSYS;
 }
@@ -3429,7 +3700,8 @@ SYSCALL_DEFINE6(futex, u32 __user *, uaddr, int, op, u32, val,
 
 	if (utime && (cmd == FUTEX_WAIT || cmd == FUTEX_LOCK_PI ||
 		      cmd == FUTEX_WAIT_BITSET ||
-		      cmd == FUTEX_WAIT_REQUEUE_PI)) {
+		      cmd == FUTEX_WAIT_REQUEUE_PI ||
+		      cmd == FUTEX_WAIT_MULTIPLE)) {
 		if (unlikely(should_fail_futex(!(op & FUTEX_PRIVATE_FLAG))))
 			return -EFAULT;
 		if (copy_from_user(&ts, utime, sizeof(ts)) != 0)
@@ -3493,11 +3765,8 @@ static int __init futex_init(void)
 
 	futex_detect_cmpxchg();
 
-	for (i = 0; i < futex_hashsize; i++) {
-		atomic_set(&futex_queues[i].waiters, 0);
-		plist_head_init(&futex_queues[i].chain);
-		spin_lock_init(&futex_queues[i].lock);
-	}
+	for (i = 0; i < futex_hashsize; i++)
+		futex_hash_bucket_init(&futex_queues[i]);
 
 	return 0;
 }
@@ -15,6 +15,7 @@
 #include <linux/sched.h>
 #include <linux/interrupt.h>
 #include <linux/kernel_stat.h>
+#include <linux/lathist.h>
 
 #include <trace/events/irq.h>
 
@@ -181,8 +182,10 @@ irqreturn_t handle_irq_event_percpu(struct irq_desc *desc)
 {
 	irqreturn_t retval;
 	unsigned int flags = 0;
+	u64 start = lathist_start();
 
 	retval = __handle_irq_event_percpu(desc, &flags);
+	lathist_hardirq(start);
 
 	add_interrupt_randomness(desc->irq_data.irq, flags);
 
@@ -0,0 +1,556 @@
+/*
+ * Microbenchmarks of locking, RCU, ring buffers and memory allocators
+ *
+ * Each selected benchmark is run @reps times for @duration_ms, with
+ * @nr_threads threads bound to CPUs in topology order (see @placement),
+ * and summarized in one line of key=value pairs, tagged "kbench:", that
+ * tools/testing/selftests/kbench/kbench.sh collects and compares with a
+ * baseline:
+ *
+ *	kbench: test=spinlock threads=8 reps=5 metric=ops_per_sec
+ *		better=higher min=... max=... mean=... stddev=...
+ *
+ * (on one line).  The benchmarks run at module load, which returns once
+ * they are all done.
+ */
+
+#define pr_fmt(fmt) "kbench: " fmt
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/kthread.h>
+#include <linux/delay.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include <linux/cpu.h>
+#include <linux/topology.h>
+#include <linux/spinlock.h>
+#include <linux/rwsem.h>
+#include <linux/mutex.h>
+#include <linux/rcupdate.h>
+#include <linux/ring_buffer.h>
+#include <linux/utsname.h>
+#include <linux/wait.h>
+#include <linux/gfp.h>
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Microbenchmarks of locking, RCU, ring buffers and allocators");
+
+static char *tests = "all";
+module_param(tests, charp, 0444);
+MODULE_PARM_DESC(tests, "Comma separated benchmarks to run, or \"all\"");
+
+static unsigned int nr_threads;
+module_param(nr_threads, uint, 0444);
+MODULE_PARM_DESC(nr_threads, "Threads per benchmark (default: online CPUs)");
+
+static unsigned int reps = 5;
+module_param(reps, uint, 0444);
+MODULE_PARM_DESC(reps, "Repetitions of each benchmark, 1 to 100");
+
+static unsigned int duration_ms = 1000;
+module_param(duration_ms, uint, 0444);
+MODULE_PARM_DESC(duration_ms, "Duration of each repetition");
+
+static char *placement = "spread";
+module_param(placement, charp, 0444);
+MODULE_PARM_DESC(placement,
+		 "\"spread\" threads over packages, or \"pack\" them in one");
+
+#define KBENCH_MAX_REPS	100
+#define KBENCH_BATCH	64
+
+enum kbench_metric {
+	KBENCH_OPS_PER_SEC,	/* total over all threads */
+	KBENCH_NS_PER_OP,	/* average of one thread */
+};
+
+struct kbench_test {
+	const char *name;
+	enum kbench_metric metric;
+	unsigned int max_threads;	/* 0 for no limit */
+	unsigned int batch_ops;		/* operations done by one ->batch() */
+	int (*setup)(void);
+	void (*cleanup)(void);
+	void (*batch)(void);
+};
+
+static DEFINE_SPINLOCK(kbench_spinlock);
+static DECLARE_RWSEM(kbench_rwsem);
+static DEFINE_MUTEX(kbench_mutex);
+static unsigned long kbench_counter;
+
+static void kbench_spinlock_batch(void)
+{
+	int i;
+
+	for (i = 0; i < KBENCH_BATCH; i++) {
+		spin_lock(&kbench_spinlock);
+		kbench_counter++;
+		spin_unlock(&kbench_spinlock);
+	}
+}
+
+static void kbench_rwsem_read_batch(void)
+{
+	int i;
+
+	for (i = 0; i < KBENCH_BATCH; i++) {
+		down_read(&kbench_rwsem);
+		up_read(&kbench_rwsem);
+	}
+}
+
+static void kbench_rwsem_write_batch(void)
+{
+	int i;
+
+	for (i = 0; i < KBENCH_BATCH; i++) {
+		down_write(&kbench_rwsem);
+		kbench_counter++;
+		up_write(&kbench_rwsem);
+	}
+}
+
+static void kbench_mutex_batch(void)
+{
+	int i;
+
+	for (i = 0; i < KBENCH_BATCH; i++) {
+		mutex_lock(&kbench_mutex);
+		kbench_counter++;
+		mutex_unlock(&kbench_mutex);
+	}
+}
+
+static void kbench_rcu_read_batch(void)
+{
+	int i;
+
+	for (i = 0; i < KBENCH_BATCH; i++) {
+		rcu_read_lock();
+		barrier();
+		rcu_read_unlock();
+	}
+}
+
+static void kbench_rcu_gp_batch(void)
+{
+	synchronize_rcu();
+}
+
+/*
+ * The allocator benchmarks free a whole batch after allocating it, so
+ * that they go beyond what the per cpu caches can recycle in place.
+ */
+static void kbench_kmalloc_batch(void)
+{
+	void *objs[KBENCH_BATCH];
+	int i;
+
+	for (i = 0; i < KBENCH_BATCH; i++)
+		objs[i] = kmalloc(64, GFP_KERNEL);
+	for (i = 0; i < KBENCH_BATCH; i++)
+		kfree(objs[i]);
+}
+
+static struct kmem_cache *kbench_cache;
+
+static int kbench_kmem_cache_setup(void)
+{
+	kbench_cache = kmem_cache_create("kbench", 256, 0, 0, NULL);
+	return kbench_cache ? 0 : -ENOMEM;
+}
+
+static void kbench_kmem_cache_cleanup(void)
+{
+	kmem_cache_destroy(kbench_cache);
+	kbench_cache = NULL;
+}
+
+static void kbench_kmem_cache_batch(void)
+{
+	void *objs[KBENCH_BATCH];
+	int i;
+
+	for (i = 0; i < KBENCH_BATCH; i++)
+		objs[i] = kmem_cache_alloc(kbench_cache, GFP_KERNEL);
+	for (i = 0; i < KBENCH_BATCH; i++)
+		if (objs[i])
+			kmem_cache_free(kbench_cache, objs[i]);
+}
+
+static void kbench_page_alloc_batch(void)
+{
+	struct page *pages[KBENCH_BATCH];
+	int i;
+
+	for (i = 0; i < KBENCH_BATCH; i++)
+		pages[i] = alloc_page(GFP_KERNEL);
+	for (i = 0; i < KBENCH_BATCH; i++)
+		if (pages[i])
+			__free_page(pages[i]);
+}
+
+#ifdef CONFIG_RING_BUFFER
+static struct ring_buffer *kbench_rb;
+
+static int kbench_ring_buffer_setup(void)
+{
+	kbench_rb = ring_buffer_alloc(1 << 20, RB_FL_OVERWRITE);
+	return kbench_rb ? 0 : -ENOMEM;
+}
+
+static void kbench_ring_buffer_cleanup(void)
+{
+	ring_buffer_free(kbench_rb);
+	kbench_rb = NULL;
+}
+
+static void kbench_ring_buffer_batch(void)
+{
+	u64 event = 0;
+	int i;
+
+	for (i = 0; i < KBENCH_BATCH; i++)
+		ring_buffer_write(kbench_rb, sizeof(event), &event);
+}
+#endif
+
+static const struct kbench_test kbench_tests[] = {
+	{
+		.name		= "spinlock",
+		.metric		= KBENCH_OPS_PER_SEC,
+		.batch_ops	= KBENCH_BATCH,
+		.batch		= kbench_spinlock_batch,
+	}, {
+		.name		= "rwsem_read",
+		.metric		= KBENCH_OPS_PER_SEC,
+		.batch_ops	= KBENCH_BATCH,
+		.batch		= kbench_rwsem_read_batch,
+	}, {
+		.name		= "rwsem_write",
+		.metric		= KBENCH_OPS_PER_SEC,
+		.batch_ops	= KBENCH_BATCH,
+		.batch		= kbench_rwsem_write_batch,
+	}, {
+		.name		= "mutex",
+		.metric		= KBENCH_OPS_PER_SEC,
+		.batch_ops	= KBENCH_BATCH,
+		.batch		= kbench_mutex_batch,
+	}, {
+		.name		= "rcu_read",
+		.metric		= KBENCH_OPS_PER_SEC,
+		.batch_ops	= KBENCH_BATCH,
+		.batch		= kbench_rcu_read_batch,
+	}, {
+		.name		= "rcu_gp",
+		.metric		= KBENCH_NS_PER_OP,
+		.max_threads	= 1,
+		.batch_ops	= 1,
+		.batch		= kbench_rcu_gp_batch,
+	}, {
+		.name		= "kmalloc",
+		.metric		= KBENCH_OPS_PER_SEC,
+		.batch_ops	= KBENCH_BATCH,
+		.batch		= kbench_kmalloc_batch,
+	}, {
+		.name		= "kmem_cache",
+		.metric		= KBENCH_OPS_PER_SEC,
+		.batch_ops	= KBENCH_BATCH,
+		.setup		= kbench_kmem_cache_setup,
+		.cleanup	= kbench_kmem_cache_cleanup,
+		.batch		= kbench_kmem_cache_batch,
+	}, {
+		.name		= "page_alloc",
+		.metric		= KBENCH_OPS_PER_SEC,
+		.batch_ops	= KBENCH_BATCH,
+		.batch		= kbench_page_alloc_batch,
+#ifdef CONFIG_RING_BUFFER
+	}, {
+		.name		= "ring_buffer",
+		.metric		= KBENCH_OPS_PER_SEC,
+		.batch_ops	= KBENCH_BATCH,
+		.setup		= kbench_ring_buffer_setup,
+		.cleanup	= kbench_ring_buffer_cleanup,
+		.batch		= kbench_ring_buffer_batch,
+#endif
+	},
+};
+
+/*
+ * CPUs in the order threads are placed on them: first one hardware
+ * thread of each core, then the SMT siblings.  Within that, "pack" fills
+ * one package after the other, "spread" goes round robin over packages.
+ */
+struct kbench_cpu {
+	int cpu;
+	int tier;	/* 0 for the first thread of a core */
+	int pkg;
+	int rank;	/* among the CPUs of the same tier and package */
+};
+
+static int *kbench_cpus;
+static unsigned int kbench_nr_cpus;
+static bool kbench_pack;
+
+static int kbench_cpu_cmp(const void *a, const void *b)
+{
+	const struct kbench_cpu *x = a, *y = b;
+
+	if (x->tier != y->tier)
+		return x->tier - y->tier;
+	if (kbench_pack) {
+		if (x->pkg != y->pkg)
+			return x->pkg - y->pkg;
+	} else {
+		if (x->rank != y->rank)
+			return x->rank - y->rank;
+		if (x->pkg != y->pkg)
+			return x->pkg - y->pkg;
+	}
+	return x->cpu - y->cpu;
+}
+
+/* Called with the CPU hotplug lock held */
+static int kbench_init_cpus(void)
+{
+	struct kbench_cpu *order;
+	unsigned int i, j, n = 0;
+	int cpu;
+
+	order = kcalloc(num_online_cpus(), sizeof(*order), GFP_KERNEL);
+	kbench_cpus = kcalloc(num_online_cpus(), sizeof(*kbench_cpus),
+			      GFP_KERNEL);
+	if (!order || !kbench_cpus) {
+		kfree(order);
+		kfree(kbench_cpus);
+		kbench_cpus = NULL;
+		return -ENOMEM;
+	}
+
+	for_each_online_cpu(cpu) {
+		const struct cpumask *siblings = topology_sibling_cpumask(cpu);
+
+		order[n].cpu = cpu;
+		order[n].tier = cpumask_first_and(siblings, cpu_online_mask)
+				!= cpu;
+		order[n].pkg = topology_physical_package_id(cpu);
+		order[n].rank = 0;
+		for (j = 0; j < n; j++)
+			if (order[j].tier == order[n].tier &&
+			    order[j].pkg == order[n].pkg)
+				order[n].rank++;
+		n++;
+	}
+
+	sort(order, n, sizeof(*order), kbench_cpu_cmp, NULL);
+	for (i = 0; i < n; i++)
+		kbench_cpus[i] = order[i].cpu;
+	kbench_nr_cpus = n;
+	kfree(order);
+	return 0;
+}
+
+struct kbench_thread {
+	struct task_struct *task;
+	const struct kbench_test *test;
+	u64 ops;
+};
+
+static DECLARE_WAIT_QUEUE_HEAD(kbench_wq);
+static bool kbench_running;
+
+static int kbench_thread_fn(void *arg)
+{
+	struct kbench_thread *t = arg;
+	u64 ops = 0;
+
+	wait_event(kbench_wq, READ_ONCE(kbench_running) ||
+			      kthread_should_stop());
+
+	while (READ_ONCE(kbench_running)) {
+		t->test->batch();
+		ops += t->test->batch_ops;
+		cond_resched();
+	}
+	t->ops = ops;
+
+	/* Stay around for kthread_stop(), which collects the result */
+	while (!kthread_should_stop())
+		schedule_timeout_uninterruptible(1);
+	return 0;
+}
+
+static int kbench_run_rep(const struct kbench_test *test,
+			  unsigned int threads, u64 *sample)
+{
+	struct kbench_thread *t;
+	ktime_t start;
+	u64 ops = 0;
+	u64 ns = 0;
+	unsigned int i;
+	int ret = 0;
+
+	t = kcalloc(threads, sizeof(*t), GFP_KERNEL);
+	if (!t)
+		return -ENOMEM;
+
+	for (i = 0; i < threads; i++) {
+		struct task_struct *task;
+
+		t[i].test = test;
+		task = kthread_create(kbench_thread_fn, &t[i], "kbench/%u", i);
+		if (IS_ERR(task)) {
+			ret = PTR_ERR(task);
+			goto stop;
+		}
+		kthread_bind(task, kbench_cpus[i % kbench_nr_cpus]);
+		t[i].task = task;
+		wake_up_process(task);
+	}
+
+	start = ktime_get();
+	WRITE_ONCE(kbench_running, true);
+	wake_up_all(&kbench_wq);
+	msleep(duration_ms);
+	WRITE_ONCE(kbench_running, false);
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+stop:
+	for (i = 0; i < threads && t[i].task; i++) {
+		kthread_stop(t[i].task);
+		ops += t[i].ops;
+	}
+	kfree(t);
+	if (ret)
+		return ret;
+
+	if (test->metric == KBENCH_OPS_PER_SEC)
+		*sample = div64_u64(ops * USEC_PER_SEC,
+				    max_t(u64, div_u64(ns, NSEC_PER_USEC), 1));
+	else
+		*sample = ops ? div64_u64(ns * threads, ops) : 0;
+	return 0;
+}
+
+static void kbench_report(const struct kbench_test *test,
+			  unsigned int threads, const u64 *samples,
+			  unsigned int n)
+{
+	u64 lo = U64_MAX, hi = 0, sum = 0, var = 0, mean;
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		lo = min(lo, samples[i]);
+		hi = max(hi, samples[i]);
+		sum += samples[i];
+	}
+	mean = div_u64(sum, n);
+	for (i = 0; i < n; i++) {
+		u64 d = samples[i] > mean ? samples[i] - mean : mean - samples[i];
+
+		var += div_u64(d * d, n);
+	}
+
+	pr_info("test=%s threads=%u reps=%u metric=%s better=%s min=%llu max=%llu mean=%llu stddev=%lu\n",
+		test->name, threads, n,
+		test->metric == KBENCH_OPS_PER_SEC ? "ops_per_sec" : "ns_per_op",
+		test->metric == KBENCH_OPS_PER_SEC ? "higher" : "lower",
+		lo, hi, mean, int_sqrt(min_t(u64, var, ULONG_MAX)));
+}
+
+static int kbench_run_test(const struct kbench_test *test)
+{
+	unsigned int threads = nr_threads ?: kbench_nr_cpus;
+	u64 *samples;
+	unsigned int i;
+	int ret;
+
+	if (test->max_threads)
+		threads = min(threads, test->max_threads);
+
+	samples = kcalloc(reps, sizeof(*samples), GFP_KERNEL);
+	if (!samples)
+		return -ENOMEM;
+
+	ret = test->setup ? test->setup() : 0;
+	if (ret)
+		goto out;
+
+	for (i = 0; i < reps; i++) {
+		ret = kbench_run_rep(test, threads, &samples[i]);
+		if (ret)
+			break;
+	}
+
+	if (test->cleanup)
+		test->cleanup();
+	if (!ret)
+		kbench_report(test, threads, samples, reps);
+out:
+	kfree(samples);
+	if (ret)
+		pr_err("test=%s failed: %d\n", test->name, ret);
+	return ret;
+}
+
+static bool kbench_selected(const char *name)
+{
+	const char *p = tests;
+	size_t len = strlen(name);
+
+	if (!strcmp(tests, "all"))
+		return true;
+
+	while ((p = strstr(p, name)) != NULL) {
+		if ((p == tests || p[-1] == ',') &&
+		    (p[len] == '\0' || p[len] == ','))
+			return true;
+		p += len;
+	}
+	return false;
+}
+
+static int __init kbench_init(void)
+{
+	unsigned int i;
+	int ret;
+
+	if (!reps || reps > KBENCH_MAX_REPS || !duration_ms)
+		return -EINVAL;
+	if (!strcmp(placement, "pack"))
+		kbench_pack = true;
+	else if (strcmp(placement, "spread"))
+		return -EINVAL;
+
+	get_online_cpus();
+	ret = kbench_init_cpus();
+	if (ret)
+		goto out;
+
+	pr_info("version=1 release=%s cpus=%u placement=%s duration_ms=%u\n",
+		init_utsname()->release, kbench_nr_cpus, placement,
+		duration_ms);
+
+	for (i = 0; i < ARRAY_SIZE(kbench_tests); i++) {
+		if (!kbench_selected(kbench_tests[i].name))
+			continue;
+		ret = kbench_run_test(&kbench_tests[i]);
+		if (ret)
+			break;
+	}
+
+	kfree(kbench_cpus);
+out:
+	put_online_cpus();
+	return ret;
+}
+
+static void __exit kbench_exit(void)
+{
+}
+
+module_init(kbench_init);
+module_exit(kbench_exit);
@@ -41,6 +41,7 @@
 #include <linux/rwsem.h>
 #include <linux/ptrace.h>
 #include <linux/async.h>
+#include <linux/initrd.h>
 #include <linux/uaccess.h>
 
 #include <trace/events/module.h>
@@ -325,6 +326,9 @@ static void call_usermodehelper_exec_work(struct work_struct *work)
 	struct subprocess_info *sub_info =
 		container_of(work, struct subprocess_info, work);
 
+	/* The helper may well live in the initramfs */
+	wait_for_initramfs();
+
 	if (sub_info->wait & UMH_WAIT_PROC) {
 		call_usermodehelper_exec_sync(sub_info);
 	} else {
@@ -0,0 +1,272 @@
+/*
+ * Per cpu log2 latency histograms of hot paths
+ *
+ * See include/linux/lathist.h.  <debugfs>/lathist/ has:
+ *
+ *	enable		write 1 or 0 to start or stop counting
+ *	reset		write anything to clear all the counts
+ *	syscalls	one line per syscall number
+ *	softirqs	one line per softirq vector
+ *	hardirqs	one line for all the hardirq handlers
+ *
+ * Each line of the last three has the name, the total count and the
+ * non-zero buckets, summed over all cpus, as "<ns>:<count>".  Bucket <ns>
+ * counts durations from <ns> to twice that, and the last one everything
+ * longer.  Lines with no counts are left out.
+ *
+ * The histograms are allocated the first time counting is enabled and
+ * then kept, so that the hooks never see them go away.
+ */
+#include <linux/lathist.h>
+#include <linux/kernel.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/interrupt.h>
+#include <linux/percpu.h>
+#include <linux/mutex.h>
+#include <linux/string.h>
+#include <linux/uaccess.h>
+#include <linux/init.h>
+#include <asm/unistd.h>
+
+#define LATHIST_BUCKETS		32
+
+struct lathist {
+	u32 count[LATHIST_BUCKETS];
+};
+
+enum {
+	LATHIST_SYSCALLS,
+	LATHIST_SOFTIRQS,
+	LATHIST_HARDIRQS,
+	LATHIST_NR,
+};
+
+static const unsigned int lathist_rows[LATHIST_NR] = {
+	[LATHIST_SYSCALLS]	= NR_syscalls,
+	[LATHIST_SOFTIRQS]	= NR_SOFTIRQS,
+	[LATHIST_HARDIRQS]	= 1,
+};
+
+DEFINE_STATIC_KEY_FALSE(lathist_enabled);
+static struct lathist __percpu *lathist_hists[LATHIST_NR];
+static DEFINE_MUTEX(lathist_mutex);
+
+static __always_inline unsigned int lathist_bucket(u64 start)
+{
+	s64 delta = local_clock() - start;
+
+	/* A task may migrate during a syscall, and the clocks of cpus drift */
+	if (delta <= 0)
+		return 0;
+	return min_t(unsigned int, fls64(delta), LATHIST_BUCKETS - 1);
+}
+
+static __always_inline void lathist_count(int id, unsigned int row, u64 start)
+{
+	struct lathist __percpu *h = READ_ONCE(lathist_hists[id]);
+
+	if (likely(h))
+		this_cpu_inc(h[row].count[lathist_bucket(start)]);
+}
+
+void __lathist_syscall(unsigned int nr, u64 start)
+{
+	if (nr < NR_syscalls)
+		lathist_count(LATHIST_SYSCALLS, nr, start);
+}
+
+void __lathist_softirq(unsigned int vec_nr, u64 start)
+{
+	lathist_count(LATHIST_SOFTIRQS, vec_nr, start);
+}
+
+void __lathist_hardirq(u64 start)
+{
+	lathist_count(LATHIST_HARDIRQS, 0, start);
+}
+
+static int lathist_alloc(void)
+{
+	struct lathist __percpu *h;
+	int id;
+
+	for (id = 0; id < LATHIST_NR; id++) {
+		if (lathist_hists[id])
+			continue;
+		h = __alloc_percpu(lathist_rows[id] * sizeof(*h),
+				   __alignof__(*h));
+		if (!h)
+			return -ENOMEM;
+		/* Pairs with the READ_ONCE() in lathist_count() */
+		smp_store_release(&lathist_hists[id], h);
+	}
+	return 0;
+}
+
+/* Racy against the hooks, a count may survive a concurrent reset */
+static void lathist_reset(void)
+{
+	int id, cpu;
+
+	for (id = 0; id < LATHIST_NR; id++) {
+		if (!lathist_hists[id])
+			continue;
+		for_each_possible_cpu(cpu)
+			memset(per_cpu_ptr(lathist_hists[id], cpu), 0,
+			       lathist_rows[id] * sizeof(struct lathist));
+	}
+}
+
+static void lathist_show_row(struct seq_file *m, const char *name,
+			     struct lathist __percpu *h)
+{
+	u64 sum[LATHIST_BUCKETS] = { }, total = 0;
+	int cpu, i;
+
+	for_each_possible_cpu(cpu) {
+		struct lathist *p = per_cpu_ptr(h, cpu);
+
+		for (i = 0; i < LATHIST_BUCKETS; i++)
+			sum[i] += READ_ONCE(p->count[i]);
+	}
+	for (i = 0; i < LATHIST_BUCKETS; i++)
+		total += sum[i];
+	if (!total)
+		return;
+
+	seq_printf(m, "%s total=%llu", name, total);
+	for (i = 0; i < LATHIST_BUCKETS; i++)
+		if (sum[i])
+			seq_printf(m, " %llu:%llu", i ? 1ULL << (i - 1) : 0ULL,
+				   sum[i]);
+	seq_putc(m, '\n');
+}
+
+static int lathist_show(struct seq_file *m, void *v)
+{
+	long id = (long)m->private;
+	struct lathist __percpu *h = READ_ONCE(lathist_hists[id]);
+	char name[16];
+	unsigned int row;
+
+	if (!h)
+		return 0;
+
+	for (row = 0; row < lathist_rows[id]; row++) {
+		switch (id) {
+		case LATHIST_SYSCALLS:
+			snprintf(name, sizeof(name), "%u", row);
+			lathist_show_row(m, name, h + row);
+			break;
+		case LATHIST_SOFTIRQS:
+			lathist_show_row(m, softirq_to_name[row], h + row);
+			break;
+		default:
+			lathist_show_row(m, "all", h + row);
+			break;
+		}
+	}
+	return 0;
+}
+
+static int lathist_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, lathist_show, inode->i_private);
+}
+
+static const struct file_operations lathist_fops = {
+	.open		= lathist_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static ssize_t lathist_enable_read(struct file *file, char __user *user_buf,
+				   size_t count, loff_t *ppos)
+{
+	char buf[2] = { static_key_enabled(&lathist_enabled) ? '1' : '0',
+			'\n' };
+
+	return simple_read_from_buffer(user_buf, count, ppos, buf, sizeof(buf));
+}
+
+static ssize_t lathist_enable_write(struct file *file,
+				    const char __user *user_buf,
+				    size_t count, loff_t *ppos)
+{
+	bool enable;
+	int ret;
+
+	ret = kstrtobool_from_user(user_buf, count, &enable);
+	if (ret)
+		return ret;
+
+	mutex_lock(&lathist_mutex);
+	if (enable) {
+		ret = lathist_alloc();
+		if (!ret)
+			static_branch_enable(&lathist_enabled);
+	} else {
+		static_branch_disable(&lathist_enabled);
+	}
+	mutex_unlock(&lathist_mutex);
+
+	return ret ? ret : count;
+}
+
+static const struct file_operations lathist_enable_fops = {
+	.read		= lathist_enable_read,
+	.write		= lathist_enable_write,
+	.llseek		= default_llseek,
+};
+
+static ssize_t lathist_reset_write(struct file *file,
+				   const char __user *user_buf,
+				   size_t count, loff_t *ppos)
+{
+	mutex_lock(&lathist_mutex);
+	lathist_reset();
+	mutex_unlock(&lathist_mutex);
+	return count;
+}
+
+static const struct file_operations lathist_reset_fops = {
+	.write		= lathist_reset_write,
+	.llseek		= default_llseek,
+};
+
+static const char * const lathist_names[LATHIST_NR] = {
+	[LATHIST_SYSCALLS]	= "syscalls",
+	[LATHIST_SOFTIRQS]	= "softirqs",
+	[LATHIST_HARDIRQS]	= "hardirqs",
+};
+
+static int __init lathist_init(void)
+{
+	struct dentry *dir;
+	long id;
+
+	dir = debugfs_create_dir("lathist", NULL);
+	if (!dir)
+		goto out;
+
+	if (!debugfs_create_file("enable", 0600, dir, NULL,
+				 &lathist_enable_fops) ||
+	    !debugfs_create_file("reset", 0200, dir, NULL,
+				 &lathist_reset_fops))
+		goto fail;
+
+	for (id = 0; id < LATHIST_NR; id++)
+		if (!debugfs_create_file(lathist_names[id], 0400, dir,
+					 (void *)id, &lathist_fops))
+			goto fail;
+
+	return 0;
+fail:
+	debugfs_remove_recursive(dir);
+out:
+	pr_warn("Could not create 'lathist' debugfs entries\n");
+	return -ENOMEM;
+}
+fs_initcall(lathist_init);
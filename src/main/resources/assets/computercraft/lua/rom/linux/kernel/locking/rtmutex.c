@@ -20,6 +20,7 @@
 #include <linux/timer.h>
 
 #include "rtmutex_common.h"
+#include "lock_events.h"
 
 /*
  * lock->owner state tracking:
@@ -1167,6 +1168,144 @@ void rt_mutex_init_waiter(struct rt_mutex_waiter *waiter)
 	waiter->task = NULL;
 }
 
+#ifdef CONFIG_RT_MUTEX_SPIN_ON_OWNER
+/*
+ * Spin while @owner owns @lock and is running: it is likely to release the
+ * lock before we would be through a sleep and wakeup.  @waiter is our
+ * enqueued waiter, which only keeps spinning while it is the top waiter, or
+ * NULL if we are not queued yet, in which case we stop as soon as somebody
+ * else is.  Returns true if the owner changed, false if we should block.
+ */
+static bool rt_mutex_spin_on_owner(struct rt_mutex *lock,
+				   struct task_struct *owner,
+				   struct rt_mutex_waiter *waiter)
+{
+	bool ret = true;
+
+	rcu_read_lock();
+	while (rt_mutex_owner(lock) == owner) {
+		/*
+		 * Ensure we emit the owner->on_cpu dereference _after_
+		 * checking lock->owner still matches owner. If that fails,
+		 * owner might point to freed memory. If it still matches,
+		 * the rcu_read_lock() ensures the memory stays valid.
+		 */
+		barrier();
+
+		if (!owner->on_cpu || need_resched() ||
+		    vcpu_is_preempted(task_cpu(owner))) {
+			ret = false;
+			break;
+		}
+
+		/*
+		 * Only compare the pointer: the top waiter may be dequeued
+		 * and gone under us, as we don't hold wait_lock.
+		 */
+		if (waiter ? READ_ONCE(lock->waiters_leftmost) !=
+			     &waiter->tree_entry :
+			     rt_mutex_has_waiters(lock)) {
+			ret = false;
+			break;
+		}
+
+		cpu_relax();
+	}
+	rcu_read_unlock();
+
+	return ret;
+}
+
+/*
+ * Initial check for entering the spinning loop: there is no point when the
+ * owner is not running, and spinning before queueing must not get ahead of
+ * tasks that are already waiting, as they are ordered by priority.
+ */
+static inline bool rt_mutex_can_spin_on_owner(struct rt_mutex *lock)
+{
+	struct task_struct *owner;
+	bool ret = true;
+
+	if (need_resched() || rt_mutex_has_waiters(lock))
+		return false;
+
+	rcu_read_lock();
+	owner = rt_mutex_owner(lock);
+	if (owner)
+		ret = owner->on_cpu && !vcpu_is_preempted(task_cpu(owner));
+	rcu_read_unlock();
+
+	return ret;
+}
+
+/*
+ * Try to take the lock by spinning on its owner before blocking on it.  The
+ * spinners are serialized on the osq, so only one of them polls the lock at
+ * a time.  The lock itself is still taken with try_to_take_rt_mutex() under
+ * wait_lock, which works without the cmpxchg fast path too.
+ */
+static bool rt_mutex_optimistic_spin(struct rt_mutex *lock)
+{
+	struct task_struct *owner;
+	unsigned long flags;
+	bool taken = false;
+
+	preempt_disable();
+	if (!rt_mutex_can_spin_on_owner(lock))
+		goto out;
+
+	if (!osq_lock(&lock->osq))
+		goto out;
+
+	for (;;) {
+		owner = rt_mutex_owner(lock);
+		if (owner) {
+			if (!rt_mutex_spin_on_owner(lock, owner, NULL))
+				break;
+			continue;
+		}
+
+		if (rt_mutex_has_waiters(lock))
+			break;
+
+		raw_spin_lock_irqsave(&lock->wait_lock, flags);
+		taken = try_to_take_rt_mutex(lock, current, NULL);
+		/*
+		 * try_to_take_rt_mutex() sets the waiter bit
+		 * unconditionally. Clean this up.
+		 */
+		fixup_rt_mutex_waiters(lock);
+		raw_spin_unlock_irqrestore(&lock->wait_lock, flags);
+		if (taken)
+			break;
+
+		if (need_resched())
+			break;
+
+		cpu_relax();
+	}
+
+	osq_unlock(&lock->osq);
+	lockevent_cond_inc(rtmutex_spin_acquired, taken);
+	lockevent_cond_inc(rtmutex_spin_failed, !taken);
+out:
+	preempt_enable();
+	return taken;
+}
+#else
+static inline bool rt_mutex_spin_on_owner(struct rt_mutex *lock,
+					  struct task_struct *owner,
+					  struct rt_mutex_waiter *waiter)
+{
+	return false;
+}
+
+static inline bool rt_mutex_optimistic_spin(struct rt_mutex *lock)
+{
+	return false;
+}
+#endif
+
 /**
  * __rt_mutex_slowlock() - Perform the wait-wake-try-to-take loop
  * @lock:		 the rt_mutex to take
@@ -1182,6 +1321,7 @@ __rt_mutex_slowlock(struct rt_mutex *lock, int state,
 		    struct hrtimer_sleeper *timeout,
 		    struct rt_mutex_waiter *waiter)
 {
+	struct task_struct *owner;
 	int ret = 0;
 
 	for (;;) {
@@ -1203,11 +1343,22 @@ __rt_mutex_slowlock(struct rt_mutex *lock, int state,
 				break;
 		}
 
+		owner = rt_mutex_owner(lock);
 		raw_spin_unlock_irq(&lock->wait_lock);
 
 		debug_rt_mutex_print_deadlock(waiter);
 
-		schedule();
+		/*
+		 * The top waiter keeps spinning while the owner runs, as it
+		 * is next in line anyway.  This is also the wait loop of PI
+		 * futexes, see rt_mutex_wait_proxy_lock().
+		 */
+		if (!owner || !rt_mutex_spin_on_owner(lock, owner, waiter)) {
+			lockevent_cond_inc(rtmutex_waiter_spin_failed, owner);
+			schedule();
+		} else {
+			lockevent_inc(rtmutex_waiter_spin_woken);
+		}
 
 		raw_spin_lock_irq(&lock->wait_lock);
 		set_current_state(state);
@@ -1259,6 +1410,9 @@ rt_mutex_slowlock(struct rt_mutex *lock, int state,
 	 * enable interrupts in that early boot case. So we need to use the
 	 * irqsave/restore variants.
 	 */
+	if (rt_mutex_optimistic_spin(lock))
+		return 0;
+
 	raw_spin_lock_irqsave(&lock->wait_lock, flags);
 
 	/* Try to acquire the lock again: */
@@ -1638,6 +1792,9 @@ void __rt_mutex_init(struct rt_mutex *lock, const char *name)
 	raw_spin_lock_init(&lock->wait_lock);
 	lock->waiters = RB_ROOT;
 	lock->waiters_leftmost = NULL;
+#ifdef CONFIG_RT_MUTEX_SPIN_ON_OWNER
+	osq_lock_init(&lock->osq);
+#endif
 
 	debug_rt_mutex_init(lock, name);
 }
@@ -19,6 +19,7 @@
 #include <linux/osq_lock.h>
 
 #include "rwsem.h"
+#include "lock_events.h"
 
 /*
  * Guide to the rw_semaphore's count field for common values.
@@ -85,6 +86,7 @@ void __init_rwsem(struct rw_semaphore *sem, const char *name,
 	atomic_long_set(&sem->count, RWSEM_UNLOCKED_VALUE);
 	raw_spin_lock_init(&sem->wait_lock);
 	INIT_LIST_HEAD(&sem->wait_list);
+	sem->handoff = false;
 #ifdef CONFIG_RWSEM_SPIN_ON_OWNER
 	sem->owner = NULL;
 	osq_lock_init(&sem->osq);
@@ -102,8 +104,25 @@ struct rwsem_waiter {
 	struct list_head list;
 	struct task_struct *task;
 	enum rwsem_waiter_type type;
+	unsigned long timeout;
 };
 
+/*
+ * Lock handoff: once the waiter at the head of the queue has waited for
+ * more than RWSEM_WAIT_TIMEOUT, it sets sem->handoff.  From then on, new
+ * writers neither spin for the lock nor steal it from the queue, and the
+ * lock goes to that waiter the next time it is free.  sem->handoff is only
+ * changed under wait_lock, and is cleared when the head waiter leaves the
+ * queue.  Spinners read it locklessly, which is fine as the head waiter
+ * rechecks everything under wait_lock.
+ */
+#define RWSEM_WAIT_TIMEOUT	DIV_ROUND_UP(HZ, 250)
+
+static inline struct rwsem_waiter *rwsem_first_waiter(struct rw_semaphore *sem)
+{
+	return list_first_entry(&sem->wait_list, struct rwsem_waiter, list);
+}
+
 enum rwsem_wake_type {
 	RWSEM_WAKE_ANY,		/* Wake whatever's at head of wait list */
 	RWSEM_WAKE_READERS,	/* Wake readers only */
@@ -146,6 +165,7 @@ static void __rwsem_mark_wake(struct rw_semaphore *sem,
 			 * will notice the queued writer.
 			 */
 			wake_q_add(wake_q, waiter->task);
+			lockevent_inc(rwsem_wake_writer);
 		}
 
 		return;
@@ -168,8 +188,18 @@ static void __rwsem_mark_wake(struct rw_semaphore *sem,
 			 * reader grant.
 			 */
 			if (atomic_long_add_return(-adjustment, &sem->count) <
-			    RWSEM_WAITING_BIAS)
+			    RWSEM_WAITING_BIAS) {
+				/*
+				 * Don't let writers keep stealing the lock
+				 * from the readers at the head of the queue.
+				 */
+				if (!sem->handoff &&
+				    time_after(jiffies, waiter->timeout)) {
+					WRITE_ONCE(sem->handoff, true);
+					lockevent_inc(rwsem_rlock_handoff);
+				}
 				return;
+			}
 
 			/* Last active locker left. Retry waking readers. */
 			goto try_reader_grant;
@@ -182,6 +212,10 @@ static void __rwsem_mark_wake(struct rw_semaphore *sem,
 		rwsem_set_reader_owned(sem);
 	}
 
+	/* The head waiter is served */
+	if (sem->handoff)
+		WRITE_ONCE(sem->handoff, false);
+
 	/*
 	 * Grant an infinite number of read locks to the readers at the front
 	 * of the queue. We know that woken will be at least 1 as we accounted
@@ -208,6 +242,8 @@ static void __rwsem_mark_wake(struct rw_semaphore *sem,
 		smp_store_release(&waiter->task, NULL);
 	}
 
+	lockevent_cond_inc(rwsem_wake_reader, woken);
+
 	adjustment = woken * RWSEM_ACTIVE_READ_BIAS - adjustment;
 	if (list_empty(&sem->wait_list)) {
 		/* hit end of list above */
@@ -218,60 +254,13 @@ static void __rwsem_mark_wake(struct rw_semaphore *sem,
 		atomic_long_add(adjustment, &sem->count);
 }
 
-/*
- * Wait for the read lock to be granted
- */
-__visible
-struct rw_semaphore __sched *rwsem_down_read_failed(struct rw_semaphore *sem)
-{
-	long count, adjustment = -RWSEM_ACTIVE_READ_BIAS;
-	struct rwsem_waiter waiter;
-	DEFINE_WAKE_Q(wake_q);
-
-	waiter.task = current;
-	waiter.type = RWSEM_WAITING_FOR_READ;
-
-	raw_spin_lock_irq(&sem->wait_lock);
-	if (list_empty(&sem->wait_list))
-		adjustment += RWSEM_WAITING_BIAS;
-	list_add_tail(&waiter.list, &sem->wait_list);
-
-	/* we're now waiting on the lock, but no longer actively locking */
-	count = atomic_long_add_return(adjustment, &sem->count);
-
-	/*
-	 * If there are no active locks, wake the front queued process(es).
-	 *
-	 * If there are no writers and we are first in the queue,
-	 * wake our own waiter to join the existing active readers !
-	 */
-	if (count == RWSEM_WAITING_BIAS ||
-	    (count > RWSEM_WAITING_BIAS &&
-	     adjustment != -RWSEM_ACTIVE_READ_BIAS))
-		__rwsem_mark_wake(sem, RWSEM_WAKE_ANY, &wake_q);
-
-	raw_spin_unlock_irq(&sem->wait_lock);
-	wake_up_q(&wake_q);
-
-	/* wait to be given the lock */
-	while (true) {
-		set_current_state(TASK_UNINTERRUPTIBLE);
-		if (!waiter.task)
-			break;
-		schedule();
-	}
-
-	__set_current_state(TASK_RUNNING);
-	return sem;
-}
-EXPORT_SYMBOL(rwsem_down_read_failed);
-
 /*
  * This function must be called with the sem->wait_lock held to prevent
  * race conditions between checking the rwsem wait list and setting the
  * sem->count accordingly.
  */
-static inline bool rwsem_try_write_lock(long count, struct rw_semaphore *sem)
+static inline bool rwsem_try_write_lock(long count, struct rw_semaphore *sem,
+					struct rwsem_waiter *waiter)
 {
 	/*
 	 * Avoid trying to acquire write lock if count isn't RWSEM_WAITING_BIAS.
@@ -279,6 +268,10 @@ static inline bool rwsem_try_write_lock(long count, struct rw_semaphore *sem)
 	if (count != RWSEM_WAITING_BIAS)
 		return false;
 
+	/* The lock is handed off to the head waiter */
+	if (sem->handoff && rwsem_first_waiter(sem) != waiter)
+		return false;
+
 	/*
 	 * Acquire the lock by trying to set it to ACTIVE_WRITE_BIAS. If there
 	 * are other tasks on the wait list, we need to add on WAITING_BIAS.
@@ -290,6 +283,8 @@ static inline bool rwsem_try_write_lock(long count, struct rw_semaphore *sem)
 	if (atomic_long_cmpxchg_acquire(&sem->count, RWSEM_WAITING_BIAS, count)
 							== RWSEM_WAITING_BIAS) {
 		rwsem_set_owner(sem);
+		if (sem->handoff)
+			WRITE_ONCE(sem->handoff, false);
 		return true;
 	}
 
@@ -308,6 +303,10 @@ static inline bool rwsem_try_write_lock_unqueued(struct rw_semaphore *sem)
 		if (!(count == 0 || count == RWSEM_WAITING_BIAS))
 			return false;
 
+		/* Don't steal the lock from the queue once it is handed off */
+		if (count == RWSEM_WAITING_BIAS && READ_ONCE(sem->handoff))
+			return false;
+
 		old = atomic_long_cmpxchg_acquire(&sem->count, count,
 				      count + RWSEM_ACTIVE_WRITE_BIAS);
 		if (old == count) {
@@ -324,7 +323,7 @@ static inline bool rwsem_can_spin_on_owner(struct rw_semaphore *sem)
 	struct task_struct *owner;
 	bool ret = true;
 
-	if (need_resched())
+	if (need_resched() || READ_ONCE(sem->handoff))
 		return false;
 
 	rcu_read_lock();
@@ -417,6 +416,10 @@ static bool rwsem_optimistic_spin(struct rw_semaphore *sem)
 			break;
 		}
 
+		/* The head waiter is next, no point in spinning */
+		if (READ_ONCE(sem->handoff))
+			break;
+
 		/*
 		 * When there's no owner, we might have preempted between the
 		 * owner acquiring the lock and setting the owner field. If
@@ -437,6 +440,53 @@ static bool rwsem_optimistic_spin(struct rw_semaphore *sem)
 	osq_unlock(&sem->osq);
 done:
 	preempt_enable();
+	lockevent_cond_inc(rwsem_opt_wlock, taken);
+	lockevent_cond_inc(rwsem_opt_fail, !taken);
+	return taken;
+}
+
+/*
+ * Readers can spin on a writer that owns the lock, too.  The read bias
+ * added by __down_read() stays in the count while we spin, so the lock is
+ * ours as soon as the count turns positive: the writer is gone and nobody
+ * is queued.  Once somebody is queued we must queue behind it instead.
+ */
+static bool rwsem_reader_optimistic_spin(struct rw_semaphore *sem)
+{
+	bool taken = false;
+
+	preempt_disable();
+
+	/* sem->wait_lock should not be held when doing optimistic spinning */
+	if (!rwsem_can_spin_on_owner(sem))
+		goto done;
+
+	if (!osq_lock(&sem->osq))
+		goto done;
+
+	for (;;) {
+		if (atomic_long_read(&sem->count) > 0) {
+			rwsem_set_reader_owned(sem);
+			taken = true;
+			break;
+		}
+
+		if (!list_empty(&sem->wait_list) || READ_ONCE(sem->handoff))
+			break;
+
+		if (!rwsem_spin_on_owner(sem))
+			break;
+
+		/* See rwsem_optimistic_spin() */
+		if (!sem->owner && (need_resched() || rt_task(current)))
+			break;
+
+		cpu_relax();
+	}
+	osq_unlock(&sem->osq);
+done:
+	preempt_enable();
+	lockevent_cond_inc(rwsem_opt_rlock, taken);
 	return taken;
 }
 
@@ -454,12 +504,71 @@ static bool rwsem_optimistic_spin(struct rw_semaphore *sem)
 	return false;
 }
 
+static bool rwsem_reader_optimistic_spin(struct rw_semaphore *sem)
+{
+	return false;
+}
+
 static inline bool rwsem_has_spinner(struct rw_semaphore *sem)
 {
 	return false;
 }
 #endif
 
+/*
+ * Wait for the read lock to be granted
+ */
+__visible
+struct rw_semaphore __sched *rwsem_down_read_failed(struct rw_semaphore *sem)
+{
+	long count, adjustment = -RWSEM_ACTIVE_READ_BIAS;
+	struct rwsem_waiter waiter;
+	DEFINE_WAKE_Q(wake_q);
+
+	/* do optimistic spinning while a writer holds the lock */
+	if (rwsem_reader_optimistic_spin(sem))
+		return sem;
+
+	waiter.task = current;
+	waiter.type = RWSEM_WAITING_FOR_READ;
+	waiter.timeout = jiffies + RWSEM_WAIT_TIMEOUT;
+
+	raw_spin_lock_irq(&sem->wait_lock);
+	if (list_empty(&sem->wait_list))
+		adjustment += RWSEM_WAITING_BIAS;
+	list_add_tail(&waiter.list, &sem->wait_list);
+
+	/* we're now waiting on the lock, but no longer actively locking */
+	count = atomic_long_add_return(adjustment, &sem->count);
+
+	/*
+	 * If there are no active locks, wake the front queued process(es).
+	 *
+	 * If there are no writers and we are first in the queue,
+	 * wake our own waiter to join the existing active readers !
+	 */
+	if (count == RWSEM_WAITING_BIAS ||
+	    (count > RWSEM_WAITING_BIAS &&
+	     adjustment != -RWSEM_ACTIVE_READ_BIAS))
+		__rwsem_mark_wake(sem, RWSEM_WAKE_ANY, &wake_q);
+
+	raw_spin_unlock_irq(&sem->wait_lock);
+	wake_up_q(&wake_q);
+
+	/* wait to be given the lock */
+	while (true) {
+		set_current_state(TASK_UNINTERRUPTIBLE);
+		if (!waiter.task)
+			break;
+		schedule();
+		lockevent_inc(rwsem_sleep_reader);
+	}
+
+	__set_current_state(TASK_RUNNING);
+	return sem;
+}
+EXPORT_SYMBOL(rwsem_down_read_failed);
+
 /*
  * Wait until we successfully acquire the write lock
  */
@@ -485,6 +594,7 @@ __rwsem_down_write_failed_common(struct rw_semaphore *sem, int state)
 	 */
 	waiter.task = current;
 	waiter.type = RWSEM_WAITING_FOR_WRITE;
+	waiter.timeout = jiffies + RWSEM_WAIT_TIMEOUT;
 
 	raw_spin_lock_irq(&sem->wait_lock);
 
@@ -526,9 +636,25 @@ __rwsem_down_write_failed_common(struct rw_semaphore *sem, int state)
 	/* wait until we successfully acquire the lock */
 	set_current_state(state);
 	while (true) {
-		if (rwsem_try_write_lock(count, sem))
+		if (rwsem_try_write_lock(count, sem, &waiter))
 			break;
+
+		if (rwsem_first_waiter(sem) == &waiter) {
+			/* Waited long enough, make the lock come to us */
+			if (!sem->handoff && time_after(jiffies, waiter.timeout)) {
+				WRITE_ONCE(sem->handoff, true);
+				lockevent_inc(rwsem_wlock_handoff);
+			}
+		} else if (sem->handoff && count == RWSEM_WAITING_BIAS) {
+			/*
+			 * The lock is free, but handed off to the head
+			 * waiter: make sure it knows.
+			 */
+			__rwsem_mark_wake(sem, RWSEM_WAKE_ANY, &wake_q);
+		}
 		raw_spin_unlock_irq(&sem->wait_lock);
+		wake_up_q(&wake_q);
+		wake_q_init(&wake_q);
 
 		/* Block until there are no active lockers. */
 		do {
@@ -536,6 +662,7 @@ __rwsem_down_write_failed_common(struct rw_semaphore *sem, int state)
 				goto out_nolock;
 
 			schedule();
+			lockevent_inc(rwsem_sleep_writer);
 			set_current_state(state);
 		} while ((count = atomic_long_read(&sem->count)) & RWSEM_ACTIVE_MASK);
 
@@ -550,6 +677,8 @@ __rwsem_down_write_failed_common(struct rw_semaphore *sem, int state)
 out_nolock:
 	__set_current_state(TASK_RUNNING);
 	raw_spin_lock_irq(&sem->wait_lock);
+	if (rwsem_first_waiter(sem) == &waiter && sem->handoff)
+		WRITE_ONCE(sem->handoff, false);
 	list_del(&waiter.list);
 	if (list_empty(&sem->wait_list))
 		atomic_long_add(-RWSEM_WAITING_BIAS, &sem->count);
@@ -605,10 +734,12 @@ struct rw_semaphore *rwsem_wake(struct rw_semaphore *sem)
 	 * rwsem_has_spinner() is true, it will guarantee at least one
 	 * trylock attempt on the rwsem later on.
 	 */
-	if (rwsem_has_spinner(sem)) {
+	if (rwsem_has_spinner(sem) && !READ_ONCE(sem->handoff)) {
 		/*
 		 * The smp_rmb() here is to make sure that the spinner
 		 * state is consulted before reading the wait_lock.
+		 * With a handoff pending the spinner won't take the lock
+		 * but the head waiter might be the one to wake up.
 		 */
 		smp_rmb();
 		if (!raw_spin_trylock_irqsave(&sem->wait_lock, flags))
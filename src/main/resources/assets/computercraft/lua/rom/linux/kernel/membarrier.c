@@ -17,12 +17,105 @@
 #include <linux/syscalls.h>
 #include <linux/membarrier.h>
 #include <linux/tick.h>
+#include <linux/cpumask.h>
+#include <linux/sched/mm.h>
+#include <linux/sched/signal.h>
+#include <linux/sched/task.h>
+
+#include "sched/sched.h"
 
 /*
  * Bitmask made from a "or" of all commands within enum membarrier_cmd,
  * except MEMBARRIER_CMD_QUERY.
  */
-#define MEMBARRIER_CMD_BITMASK	(MEMBARRIER_CMD_SHARED)
+#define MEMBARRIER_CMD_BITMASK	\
+	(MEMBARRIER_CMD_SHARED | MEMBARRIER_CMD_PRIVATE_EXPEDITED |	\
+	 MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED)
+
+static void ipi_mb(void *info)
+{
+	smp_mb();	/* IPIs should be serializing but paranoid. */
+}
+
+static int membarrier_private_expedited(void)
+{
+	struct mm_struct *mm = current->mm;
+	bool fallback = false;
+	cpumask_var_t tmpmask;
+	int cpu;
+
+	if (!(atomic_read(&mm->membarrier_state) &
+	      MEMBARRIER_STATE_PRIVATE_EXPEDITED))
+		return -EPERM;
+
+	if (num_online_cpus() == 1 || atomic_read(&mm->mm_users) == 1)
+		return 0;
+
+	/*
+	 * Matches the barriers around the rq->curr update in the scheduler,
+	 * system call entry is not a full barrier.
+	 */
+	smp_mb();
+
+	/*
+	 * Expedited commands must not block, hence GFP_NOWAIT and the
+	 * fallback of IPIing the CPUs one at a time.
+	 */
+	if (!zalloc_cpumask_var(&tmpmask, GFP_NOWAIT))
+		fallback = true;
+
+	get_online_cpus();
+	for_each_online_cpu(cpu) {
+		struct task_struct *p;
+
+		/*
+		 * The CPU we run on is in program order with the caller
+		 * even if we migrate afterwards, so it can be skipped.
+		 */
+		if (cpu == raw_smp_processor_id())
+			continue;
+		rcu_read_lock();
+		p = task_rcu_dereference(&cpu_rq(cpu)->curr);
+		if (p && p->mm == mm) {
+			if (!fallback)
+				__cpumask_set_cpu(cpu, tmpmask);
+			else
+				smp_call_function_single(cpu, ipi_mb, NULL, 1);
+		}
+		rcu_read_unlock();
+	}
+	if (!fallback) {
+		preempt_disable();
+		smp_call_function_many(tmpmask, ipi_mb, NULL, 1);
+		preempt_enable();
+		free_cpumask_var(tmpmask);
+	}
+	put_online_cpus();
+
+	/* Exit from system call is not a full barrier either */
+	smp_mb();
+	return 0;
+}
+
+static int membarrier_register_private_expedited(void)
+{
+	struct task_struct *p = current;
+	struct mm_struct *mm = p->mm;
+
+	if (atomic_read(&mm->membarrier_state) &
+	    MEMBARRIER_STATE_PRIVATE_EXPEDITED)
+		return 0;
+	atomic_or(MEMBARRIER_STATE_PRIVATE_EXPEDITED, &mm->membarrier_state);
+	if (atomic_read(&mm->mm_users) != 1 || get_nr_threads(p) != 1) {
+		/*
+		 * Other threads of the mm may be in the middle of a context
+		 * switch that did not see the flag, so did not issue the
+		 * barriers.  Wait for all those to be done.
+		 */
+		synchronize_sched();
+	}
+	return 0;
+}
 
 /**
  * sys_membarrier - issue memory barriers on a set of threads
@@ -33,7 +126,8 @@
  * command specified does not exist, or if the command argument is invalid,
  * this system call returns -EINVAL. For a given command, with flags argument
  * set to 0, this system call is guaranteed to always return the same value
- * until reboot.
+ * until reboot. MEMBARRIER_CMD_SHARED is not available, and is left out of
+ * the MEMBARRIER_CMD_QUERY result, when nohz_full is enabled.
  *
  * All memory accesses performed in program order from each targeted thread
  * is guaranteed to be ordered with respect to sys_membarrier(). If we use
@@ -52,18 +146,28 @@
  */
 SYSCALL_DEFINE2(membarrier, int, cmd, int, flags)
 {
-	/* MEMBARRIER_CMD_SHARED is not compatible with nohz_full. */
-	if (tick_nohz_full_enabled())
-		return -ENOSYS;
 	if (unlikely(flags))
 		return -EINVAL;
 	switch (cmd) {
 	case MEMBARRIER_CMD_QUERY:
-		return MEMBARRIER_CMD_BITMASK;
+	{
+		int cmd_mask = MEMBARRIER_CMD_BITMASK;
+
+		if (tick_nohz_full_enabled())
+			cmd_mask &= ~MEMBARRIER_CMD_SHARED;
+		return cmd_mask;
+	}
 	case MEMBARRIER_CMD_SHARED:
+		/* MEMBARRIER_CMD_SHARED is not compatible with nohz_full. */
+		if (tick_nohz_full_enabled())
+			return -EINVAL;
 		if (num_online_cpus() > 1)
 			synchronize_sched();
 		return 0;
+	case MEMBARRIER_CMD_PRIVATE_EXPEDITED:
+		return membarrier_private_expedited();
+	case MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED:
+		return membarrier_register_private_expedited();
 	default:
 		return -EINVAL;
 	}
@@ -313,6 +313,9 @@ struct load_info {
 	struct {
 		unsigned int sym, str, mod, vers, info, pcpu;
 	} index;
+	/* Recent owners this module refs, their symbols resolve unlocked */
+	struct module *used[4];
+	unsigned int used_next;
 };
 
 /*
@@ -1376,9 +1379,54 @@ static inline int same_magic(const char *amagic, const char *bmagic,
 }
 #endif /* CONFIG_MODVERSIONS */
 
+static bool load_info_uses(const struct load_info *info,
+			   struct module *owner)
+{
+	unsigned int i;
+
+	/* The kernel itself is always there */
+	if (!owner)
+		return true;
+	for (i = 0; i < ARRAY_SIZE(info->used); i++)
+		if (info->used[i] == owner)
+			return true;
+	return false;
+}
+
+/*
+ * Lookup without module_mutex, for the symbols of the kernel and of the
+ * modules this one already took a reference on: those can't go away.
+ * Returns NULL if not found there, and the caller takes the slow path.
+ */
+static const struct kernel_symbol *resolve_symbol_fast(struct module *mod,
+						       struct load_info *info,
+						       const char *name,
+						       char ownername[])
+{
+	struct module *owner;
+	const struct kernel_symbol *sym;
+	const s32 *crc;
+
+	preempt_disable();
+	sym = find_symbol(name, &owner, &crc,
+			  !(mod->taints & (1 << TAINT_PROPRIETARY_MODULE)), true);
+	if (!sym || !load_info_uses(info, owner)) {
+		sym = NULL;
+		goto out;
+	}
+
+	if (!check_version(info->sechdrs, info->index.vers, name, mod, crc)) {
+		sym = ERR_PTR(-EINVAL);
+		strncpy(ownername, module_name(owner), MODULE_NAME_LEN);
+	}
+out:
+	preempt_enable();
+	return sym;
+}
+
 /* Resolve a symbol for this module.  I.e. if we find one, record usage. */
 static const struct kernel_symbol *resolve_symbol(struct module *mod,
-						  const struct load_info *info,
+						  struct load_info *info,
 						  const char *name,
 						  char ownername[])
 {
@@ -1387,6 +1435,10 @@ static const struct kernel_symbol *resolve_symbol(struct module *mod,
 	const s32 *crc;
 	int err;
 
+	sym = resolve_symbol_fast(mod, info, name, ownername);
+	if (sym)
+		return sym;
+
 	/*
 	 * The module_mutex should not be a heavily contended lock;
 	 * if we get the occasional sleep here, we'll go an extra iteration
@@ -1410,6 +1462,11 @@ static const struct kernel_symbol *resolve_symbol(struct module *mod,
 		goto getname;
 	}
 
+	if (!load_info_uses(info, owner)) {
+		info->used[info->used_next] = owner;
+		info->used_next = (info->used_next + 1) % ARRAY_SIZE(info->used);
+	}
+
 getname:
 	/* We must make copy under the lock if we failed to get ref. */
 	strncpy(ownername, module_name(owner), MODULE_NAME_LEN);
@@ -1420,7 +1477,7 @@ unlock:
 
 static const struct kernel_symbol *
 resolve_symbol_wait(struct module *mod,
-		    const struct load_info *info,
+		    struct load_info *info,
 		    const char *name)
 {
 	const struct kernel_symbol *ksym;
@@ -2223,7 +2280,7 @@ static int verify_export_symbols(struct module *mod)
 }
 
 /* Change all symbols so that st_value encodes the pointer directly. */
-static int simplify_symbols(struct module *mod, const struct load_info *info)
+static int simplify_symbols(struct module *mod, struct load_info *info)
 {
 	Elf_Shdr *symsec = &info->sechdrs[info->index.sym];
 	Elf_Sym *sym = (void *)symsec->sh_addr;
@@ -3547,6 +3604,14 @@ static int complete_formation(struct module *mod, struct load_info *info)
 {
 	int err;
 
+	/*
+	 * Nothing looks at an unformed module's memory, not even the ftrace
+	 * text permission walks that do take module_mutex, so the page
+	 * attribute changes don't need to hold up other loads.
+	 */
+	module_enable_ro(mod, false);
+	module_enable_nx(mod);
+
 	mutex_lock(&module_mutex);
 
 	/* Find duplicate symbols (must be called under lock). */
@@ -3557,9 +3622,6 @@ static int complete_formation(struct module *mod, struct load_info *info)
 	/* This relies on module_mutex for list integrity. */
 	module_bug_finalize(info->hdr, info->sechdrs, mod);
 
-	module_enable_ro(mod, false);
-	module_enable_nx(mod);
-
 	/* Mark state as coming so strong_try_module_get() ignores us,
 	 * but kallsyms etc. can see us. */
 	mod->state = MODULE_STATE_COMING;
@@ -3569,6 +3631,8 @@ static int complete_formation(struct module *mod, struct load_info *info)
 
 out:
 	mutex_unlock(&module_mutex);
+	module_disable_ro(mod);
+	module_disable_nx(mod);
 	return err;
 }
 
@@ -57,6 +57,7 @@
 #include <linux/random.h>
 #include <linux/trace_events.h>
 #include <linux/suspend.h>
+#include <linux/shrinker.h>
 
 #include "tree.h"
 #include "rcu.h"
@@ -3298,17 +3299,144 @@ void call_rcu_bh(struct rcu_head *head, rcu_callback_t func)
 }
 EXPORT_SYMBOL_GPL(call_rcu_bh);
 
+/*
+ * Lazy callbacks do nothing but free memory, so nobody is waiting for
+ * them and they can be held back on a per-CPU list and handed to RCU
+ * in batches.  This spares idle CPUs the wakeups and busy systems the
+ * grace-period churn of a stream of tiny callback batches.  A CPU's
+ * batch goes to RCU once it holds rcu_lazy_batch callbacks, once the
+ * oldest of them is rcu_lazy_jiffies old, under memory pressure, and
+ * on rcu_barrier().
+ */
+static long rcu_lazy_batch = 1000;
+module_param(rcu_lazy_batch, long, 0644);
+static int rcu_lazy_jiffies = HZ;
+module_param(rcu_lazy_jiffies, int, 0644);
+
+/*
+ * Hand the specified CPU's lazy callbacks to RCU, queueing them on the
+ * current CPU.  Returns the number of callbacks handed over.
+ */
+static long rcu_lazy_flush(struct rcu_data *rdp)
+{
+	unsigned long flags;
+	struct rcu_head *list;
+	struct rcu_head *next;
+	long len;
+
+	if (!READ_ONCE(rdp->lazy_len))
+		return 0;
+	raw_spin_lock_irqsave(&rdp->lazy_lock, flags);
+	list = rdp->lazy_head;
+	len = rdp->lazy_len;
+	rdp->lazy_head = NULL;
+	rdp->lazy_tail = &rdp->lazy_head;
+	WRITE_ONCE(rdp->lazy_len, 0);
+	raw_spin_unlock_irqrestore(&rdp->lazy_lock, flags);
+
+	for (; list; list = next) {
+		next = list->next;
+		__call_rcu(list, list->func, rdp->rsp, -1, 1);
+	}
+	return len;
+}
+
+/* Flush the lazy callbacks of all CPUs, returning how many there were. */
+static long rcu_lazy_flush_all(void)
+{
+	int cpu;
+	long len = 0;
+
+	for_each_possible_cpu(cpu)
+		len += rcu_lazy_flush(per_cpu_ptr(rcu_state_p->rda, cpu));
+	return len;
+}
+
+/* A CPU's oldest lazy callback has waited long enough. */
+static void rcu_lazy_timer(unsigned long data)
+{
+	rcu_lazy_flush((struct rcu_data *)data);
+}
+
+static unsigned long rcu_lazy_shrink_count(struct shrinker *shrink,
+					   struct shrink_control *sc)
+{
+	int cpu;
+	unsigned long count = 0;
+
+	for_each_possible_cpu(cpu)
+		count += READ_ONCE(per_cpu_ptr(rcu_state_p->rda,
+					       cpu)->lazy_len);
+	return count;
+}
+
+static unsigned long rcu_lazy_shrink_scan(struct shrinker *shrink,
+					  struct shrink_control *sc)
+{
+	return rcu_lazy_flush_all();
+}
+
+static struct shrinker rcu_lazy_shrinker = {
+	.count_objects = rcu_lazy_shrink_count,
+	.scan_objects = rcu_lazy_shrink_scan,
+	.seeks = DEFAULT_SEEKS,
+};
+
+/**
+ * call_rcu_lazy() - Queue a memory-freeing RCU callback, lazily
+ * @head: structure to be used for queueing the RCU updates.
+ * @func: actual callback function to be invoked after the grace period
+ *
+ * Like call_rcu(), but for callbacks that only free memory and thus
+ * may be delayed well past the end of a grace period: the callback is
+ * batched with other lazy callbacks of this CPU before RCU sees it.
+ * Use call_rcu() for anything that wakes up a task, drops a reference
+ * somebody may be waiting on, or is otherwise time-sensitive.
+ * rcu_barrier() still waits for lazy callbacks.
+ */
+void call_rcu_lazy(struct rcu_head *head, rcu_callback_t func)
+{
+	unsigned long flags;
+	struct rcu_data *rdp;
+	bool first;
+	bool flush;
+
+	local_irq_save(flags);
+	rdp = this_cpu_ptr(rcu_state_p->rda);
+	if (unlikely(!rdp->lazy_tail)) {
+		/* Very early boot, before rcu_init(). */
+		local_irq_restore(flags);
+		__call_rcu(head, func, rcu_state_p, -1, 1);
+		return;
+	}
+	head->func = func;
+	head->next = NULL;
+	raw_spin_lock(&rdp->lazy_lock);
+	*rdp->lazy_tail = head;
+	rdp->lazy_tail = &head->next;
+	first = !rdp->lazy_len;
+	WRITE_ONCE(rdp->lazy_len, rdp->lazy_len + 1);
+	flush = rdp->lazy_len >= READ_ONCE(rcu_lazy_batch);
+	raw_spin_unlock(&rdp->lazy_lock);
+	if (first && !flush)
+		mod_timer(&rdp->lazy_timer,
+			  jiffies + READ_ONCE(rcu_lazy_jiffies));
+	local_irq_restore(flags);
+	if (flush)
+		rcu_lazy_flush(rdp);
+}
+EXPORT_SYMBOL_GPL(call_rcu_lazy);
+
 /*
  * Queue an RCU callback for lazy invocation after a grace period.
- * This will likely be later named something like "call_rcu_lazy()",
- * but this change will require some way of tagging the lazy RCU
- * callbacks in the list of pending callbacks. Until then, this
- * function may only be called from __kfree_rcu().
+ * This may only be called from __kfree_rcu(), whose callbacks are
+ * the offset of the rcu_head rather than a function; everybody else
+ * should use call_rcu_lazy().
  */
 void kfree_call_rcu(struct rcu_head *head,
 		    rcu_callback_t func)
 {
-	__call_rcu(head, func, rcu_state_p, -1, 1);
+	call_rcu_lazy(head, func);
 }
 EXPORT_SYMBOL_GPL(kfree_call_rcu);
 
@@ -3730,6 +3858,10 @@ static void _rcu_barrier(struct rcu_state *rsp)
 	rcu_seq_start(&rsp->barrier_sequence);
 	_rcu_barrier_trace(rsp, "Inc1", -1, rsp->barrier_sequence);
 
+	/* Lazy callbacks are waited for too, so get them queued. */
+	if (rsp == rcu_state_p)
+		rcu_lazy_flush_all();
+
 	/*
 	 * Initialize the count to one rather than to zero in order to
 	 * avoid a too-soon return to zero in case of a short grace period
@@ -3849,6 +3981,10 @@ rcu_boot_init_percpu_data(int cpu, struct rcu_state *rsp)
 	rdp->cpu = cpu;
 	rdp->rsp = rsp;
 	rcu_boot_init_nocb_percpu_data(rdp);
+	raw_spin_lock_init(&rdp->lazy_lock);
+	rdp->lazy_tail = &rdp->lazy_head;
+	setup_pinned_deferrable_timer(&rdp->lazy_timer, rcu_lazy_timer,
+				      (unsigned long)rdp);
 	raw_spin_unlock_irqrestore_rcu_node(rnp, flags);
 }
 
@@ -4333,6 +4469,8 @@ void __init rcu_init(void)
 		rcutree_prepare_cpu(cpu);
 		rcu_cpu_starting(cpu);
 	}
+	if (register_shrinker(&rcu_lazy_shrinker))
+		pr_err("Failed to register RCU lazy shrinker\n");
 }
 
 #include "tree_exp.h"
@@ -30,6 +30,7 @@
 #include <linux/seqlock.h>
 #include <linux/swait.h>
 #include <linux/stop_machine.h>
+#include <linux/timer.h>
 
 /*
  * Define shape of hierarchy based on NR_CPUS, CONFIG_RCU_FANOUT, and
@@ -426,6 +427,7 @@ struct rcu_data {
 	bool nocb_leader_sleep;		/* Is the nocb leader thread asleep? */
 	struct rcu_data *nocb_next_follower;
 					/* Next follower in wakeup chain. */
+	unsigned long n_nocb_accel;	/* # GP pushes for CB backlog. */
 
 	/* The following fields are used by the follower, hence new cachline. */
 	struct rcu_data *nocb_leader ____cacheline_internodealigned_in_smp;
@@ -435,6 +437,13 @@ struct rcu_data {
 	/* 8) RCU CPU stall data. */
 	unsigned int softirq_snap;	/* Snapshot of softirq activity. */
 
+	/* 9) Lazy callbacks not yet handed to RCU, see call_rcu_lazy(). */
+	raw_spinlock_t lazy_lock;	/* Protects ->lazy_head and friends. */
+	struct rcu_head *lazy_head;
+	struct rcu_head **lazy_tail;
+	long lazy_len;			/* # on ->lazy_head. */
+	struct timer_list lazy_timer;	/* Flushes an aged batch. */
+
 	int cpu;
 	struct rcu_state *rsp;
 };
@@ -1819,6 +1819,32 @@ static bool rcu_nocb_cpu_needs_barrier(struct rcu_state *rsp, int cpu)
 	return !!ret;
 }
 
+/*
+ * Callback backlog beyond which the no-CBs machinery stops waiting
+ * patiently for grace periods and instead forces quiescent states.
+ */
+static long rcu_nocb_accel_thresh = 10000;
+module_param(rcu_nocb_accel_thresh, long, 0644);
+
+/*
+ * Push the current grace period along on behalf of a no-CBs CPU whose
+ * callbacks are piling up.  Unlike __call_rcu_core(), the no-CBs
+ * enqueue path never forces quiescent states on its own, so without
+ * this a callback flood simply accumulates behind a leisurely grace
+ * period.
+ */
+static void rcu_nocb_push_gp(struct rcu_data *rdp)
+{
+	unsigned long flags;
+
+	if (!rcu_gp_in_progress(rdp->rsp))
+		return;
+	local_irq_save(flags);
+	force_quiescent_state(rdp->rsp);
+	local_irq_restore(flags);
+	rdp->n_nocb_accel++;
+}
+
 /*
  * Enqueue the specified string of rcu_head structures onto the specified
  * CPU's no-CBs lists.  The CPU is specified by rdp, the head of the
@@ -1877,6 +1903,8 @@ static void __call_rcu_nocb_enqueue(struct rcu_data *rdp,
 					    TPS("WakeOvfIsDeferred"));
 		}
 		rdp->qlen_last_fqs_check = LONG_MAX / 2;
+		if (len > rcu_nocb_accel_thresh)
+			rcu_nocb_push_gp(rdp);
 	} else {
 		trace_rcu_nocb_wake(rdp->rsp->name, rdp->cpu, TPS("WakeNot"));
 	}
@@ -1957,9 +1985,25 @@ static bool __maybe_unused rcu_nocb_adopt_orphan_cbs(struct rcu_state *rsp,
 	return true;
 }
 
+/*
+ * Return the number of callbacks held by the specified leader and all
+ * of its followers, whether waiting for a grace period or for invocation.
+ */
+static long rcu_nocb_leader_backlog(struct rcu_data *my_rdp)
+{
+	long backlog = 0;
+	struct rcu_data *rdp;
+
+	for (rdp = my_rdp; rdp; rdp = rdp->nocb_next_follower)
+		backlog += atomic_long_read(&rdp->nocb_q_count);
+	return backlog;
+}
+
 /*
  * If necessary, kick off a new grace period, and either way wait
- * for a subsequent grace period to complete.
+ * for a subsequent grace period to complete.  If the leader's group
+ * has more than rcu_nocb_accel_thresh callbacks outstanding, force
+ * quiescent states once per jiffy until the grace period ends.
  */
 static void rcu_nocb_wait_gp(struct rcu_data *rdp)
 {
@@ -1981,6 +2025,16 @@ static void rcu_nocb_wait_gp(struct rcu_data *rdp)
 	 */
 	trace_rcu_future_gp(rnp, rdp, c, TPS("StartWait"));
 	for (;;) {
+		if (rcu_nocb_leader_backlog(rdp) > rcu_nocb_accel_thresh) {
+			swait_event_interruptible_timeout(
+				rnp->nocb_gp_wq[c & 0x1],
+				(d = ULONG_CMP_GE(READ_ONCE(rnp->completed), c)),
+				1);
+			if (likely(d))
+				break;
+			rcu_nocb_push_gp(rdp);
+			continue;
+		}
 		swait_event_interruptible(
 			rnp->nocb_gp_wq[c & 0x1],
 			(d = ULONG_CMP_GE(READ_ONCE(rnp->completed), c)));
@@ -2269,6 +2323,14 @@ static void __init rcu_boot_init_nocb_percpu_data(struct rcu_data *rdp)
 	rdp->nocb_follower_tail = &rdp->nocb_follower_head;
 }
 
+/* How many follower CPU IDs per leader?  Default of -1 for sqrt(nr_cpu_ids). */
+static int rcu_nocb_leader_stride = -1;
+module_param(rcu_nocb_leader_stride, int, 0444);
+
+/* Keep each leader's followers, and the rcuo kthreads, within one node? */
+static bool rcu_nocb_leader_per_node;
+module_param(rcu_nocb_leader_per_node, bool, 0444);
+
 /*
  * If the specified CPU is a no-CBs CPU that does not already have its
  * rcuo kthread for the specified RCU flavor, spawn it.  If the CPUs are
@@ -2310,10 +2372,17 @@ static void rcu_spawn_one_nocb_kthread(struct rcu_state *rsp, int cpu)
 		rdp_spawn->nocb_next_follower = rdp_old_leader;
 	}
 
-	/* Spawn the kthread for this CPU and RCU flavor. */
-	t = kthread_run(rcu_nocb_kthread, rdp_spawn,
-			"rcuo%c/%d", rsp->abbr, cpu);
+	/*
+	 * Spawn the kthread for this CPU and RCU flavor.  With per-node
+	 * leaders, keep it on its CPU's node so that the memory freed by
+	 * the callbacks goes back to that node's caches.
+	 */
+	t = kthread_create(rcu_nocb_kthread, rdp_spawn,
+			   "rcuo%c/%d", rsp->abbr, cpu);
 	BUG_ON(IS_ERR(t));
+	if (rcu_nocb_leader_per_node)
+		set_cpus_allowed_ptr(t, cpumask_of_node(cpu_to_node(cpu)));
+	wake_up_process(t);
 	WRITE_ONCE(rdp_spawn->nocb_kthread, t);
 }
 
@@ -2344,9 +2413,34 @@ static void __init rcu_spawn_nocb_kthreads(void)
 		rcu_spawn_all_nocb_kthreads(cpu);
 }
 
-/* How many follower CPU IDs per leader?  Default of -1 for sqrt(nr_cpu_ids). */
-static int rcu_nocb_leader_stride = -1;
-module_param(rcu_nocb_leader_stride, int, 0444);
+/*
+ * Initialize leader-follower relationships for the no-CBs CPUs of one
+ * node, starting a new leader every ls CPUs.  CPU numbering need not
+ * follow the node layout, so this counts CPUs rather than CPU IDs.
+ */
+static void __init rcu_organize_nocb_node(struct rcu_state *rsp, int node,
+					  int ls)
+{
+	int cpu;
+	int n = 0;
+	struct rcu_data *rdp;
+	struct rcu_data *rdp_leader = NULL;
+	struct rcu_data *rdp_prev = NULL;
+
+	for_each_cpu(cpu, rcu_nocb_mask) {
+		if (cpu_to_node(cpu) != node)
+			continue;
+		rdp = per_cpu_ptr(rsp->rda, cpu);
+		if (n++ % ls == 0) {
+			rdp->nocb_leader = rdp;
+			rdp_leader = rdp;
+		} else {
+			rdp->nocb_leader = rdp_leader;
+			rdp_prev->nocb_next_follower = rdp;
+		}
+		rdp_prev = rdp;
+	}
+}
 
 /*
  * Initialize leader-follower relationships for all no-CBs CPU.
@@ -2354,6 +2448,7 @@ module_param(rcu_nocb_leader_stride, int, 0444);
 static void __init rcu_organize_nocb_kthreads(struct rcu_state *rsp)
 {
 	int cpu;
+	int node;
 	int ls = rcu_nocb_leader_stride;
 	int nl = 0;  /* Next leader. */
 	struct rcu_data *rdp;
@@ -2366,6 +2461,11 @@ static void __init rcu_organize_nocb_kthreads(struct rcu_state *rsp)
 		ls = int_sqrt(nr_cpu_ids);
 		rcu_nocb_leader_stride = ls;
 	}
+	if (rcu_nocb_leader_per_node) {
+		for_each_node(node)
+			rcu_organize_nocb_node(rsp, node, ls);
+		return;
+	}
 
 	/*
 	 * Each pass through this loop sets up one rcu_data structure.
@@ -180,6 +180,52 @@ static const struct file_operations rcudata_fops = {
 	.release = seq_release,
 };
 
+#ifdef CONFIG_RCU_NOCB_CPU
+
+/*
+ * Per-CPU callback backlog of the no-CBs CPUs: the leader CPU, the
+ * lazy/total callbacks not yet invoked, and how often the backlog
+ * caused the grace period to be pushed along.
+ */
+static int show_rcunocb(struct seq_file *m, void *v)
+{
+	struct rcu_data *rdp = (struct rcu_data *)v;
+
+	if (!rcu_is_nocb_cpu(rdp->cpu) || !rdp->nocb_leader)
+		return 0;
+	seq_printf(m, "%3d%cl=%d ql=%ld/%ld acc=%lu nci=%lu\n",
+		   rdp->cpu,
+		   cpu_is_offline(rdp->cpu) ? '!' : ' ',
+		   rdp->nocb_leader->cpu,
+		   atomic_long_read(&rdp->nocb_q_count_lazy),
+		   atomic_long_read(&rdp->nocb_q_count),
+		   rdp->n_nocb_accel,
+		   rdp->n_nocbs_invoked);
+	return 0;
+}
+
+static const struct seq_operations rcunocb_op = {
+	.start = r_start,
+	.next  = r_next,
+	.stop  = r_stop,
+	.show  = show_rcunocb,
+};
+
+static int rcunocb_open(struct inode *inode, struct file *file)
+{
+	return r_open(inode, file, &rcunocb_op);
+}
+
+static const struct file_operations rcunocb_fops = {
+	.owner = THIS_MODULE,
+	.open = rcunocb_open,
+	.read = seq_read,
+	.llseek = no_llseek,
+	.release = seq_release,
+};
+
+#endif /* #ifdef CONFIG_RCU_NOCB_CPU */
+
 static int show_rcuexp(struct seq_file *m, void *v)
 {
 	int cpu;
@@ -447,6 +493,13 @@ static int __init rcutree_trace_init(void)
 		if (!retval)
 			goto free_out;
 
+#ifdef CONFIG_RCU_NOCB_CPU
+		retval = debugfs_create_file("rcunocb", 0444,
+				rspdir, rsp, &rcunocb_fops);
+		if (!retval)
+			goto free_out;
+#endif
+
 		retval = debugfs_create_file("rcuexp", 0444,
 				rspdir, rsp, &rcuexp_fops);
 		if (!retval)
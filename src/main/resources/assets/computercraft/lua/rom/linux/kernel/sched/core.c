@@ -21,6 +21,7 @@
 #include <linux/mmu_context.h>
 #include <linux/module.h>
 #include <linux/nmi.h>
+#include <linux/prctl.h>
 #include <linux/prefetch.h>
 #include <linux/profile.h>
 #include <linux/security.h>
@@ -750,14 +751,275 @@ static void set_load_weight(struct task_struct *p)
 	load->inv_weight = sched_prio_to_wmult[prio];
 }
 
+#ifdef CONFIG_UCLAMP_TASK
+/*
+ * Utilization clamping.
+ *
+ * Every RUNNABLE task is refcounted, per clamp index, in the bucket of its
+ * rq covering its clamp value, and rq->uclamp[].value tracks the value of
+ * the highest non empty bucket.  Enqueue and dequeue are O(1), except when
+ * the top bucket empties which costs a scan of UCLAMP_BUCKETS entries.
+ */
+#define UCLAMP_BUCKET_DELTA DIV_ROUND_CLOSEST(SCHED_CAPACITY_SCALE, UCLAMP_BUCKETS)
+
+static inline unsigned int uclamp_bucket_id(unsigned int clamp_value)
+{
+	return min_t(unsigned int, clamp_value / UCLAMP_BUCKET_DELTA,
+		     UCLAMP_BUCKETS - 1);
+}
+
+static inline unsigned int uclamp_none(enum uclamp_id clamp_id)
+{
+	if (clamp_id == UCLAMP_MIN)
+		return 0;
+	return SCHED_CAPACITY_SCALE;
+}
+
+static inline void uclamp_se_set(struct uclamp_se *uc_se,
+				 unsigned int value, bool user_defined)
+{
+	uc_se->value = value;
+	uc_se->bucket_id = uclamp_bucket_id(value);
+	uc_se->user_defined = user_defined;
+}
+
+/*
+ * With no RUNNABLE task left keep the last max clamp, so the blocked
+ * utilization of a capped task does not raise the frequency while the CPU
+ * is idle.  The next enqueue overwrites it, see uclamp_idle_reset().
+ */
+static inline unsigned int
+uclamp_idle_value(struct rq *rq, enum uclamp_id clamp_id,
+		  unsigned int clamp_value)
+{
+	if (clamp_id == UCLAMP_MAX) {
+		rq->uclamp_flags |= UCLAMP_FLAG_IDLE;
+		return clamp_value;
+	}
+
+	return uclamp_none(UCLAMP_MIN);
+}
+
+static inline void uclamp_idle_reset(struct rq *rq, enum uclamp_id clamp_id,
+				     unsigned int clamp_value)
+{
+	/* Reset max-clamp retention only on idle exit */
+	if (!(rq->uclamp_flags & UCLAMP_FLAG_IDLE))
+		return;
+
+	WRITE_ONCE(rq->uclamp[clamp_id].value, clamp_value);
+}
+
+static inline unsigned int
+uclamp_rq_max_value(struct rq *rq, enum uclamp_id clamp_id,
+		    unsigned int clamp_value)
+{
+	struct uclamp_bucket *bucket = rq->uclamp[clamp_id].bucket;
+	int bucket_id = UCLAMP_BUCKETS - 1;
+
+	/* Since both min and max clamps are max aggregated, find the top one */
+	for ( ; bucket_id >= 0; bucket_id--) {
+		if (!bucket[bucket_id].tasks)
+			continue;
+		return bucket[bucket_id].value;
+	}
+
+	/* No tasks -- default clamp values */
+	return uclamp_idle_value(rq, clamp_id, clamp_value);
+}
+
+/* The task's request, restricted by its task group */
+static inline struct uclamp_se
+uclamp_eff_get(struct task_struct *p, enum uclamp_id clamp_id)
+{
+	struct uclamp_se uc_req = p->uclamp_req[clamp_id];
+#ifdef CONFIG_UCLAMP_TASK_GROUP
+	struct task_group *tg = task_group(p);
+	unsigned int value;
+
+	/* Tasks in autogroups or the root group are not restricted */
+	if (task_group_is_autogroup(tg) || tg == &root_task_group)
+		return uc_req;
+
+	value = clamp_t(unsigned int, uc_req.value,
+			tg->uclamp[UCLAMP_MIN].value,
+			tg->uclamp[UCLAMP_MAX].value);
+	uclamp_se_set(&uc_req, value, false);
+#endif
+
+	return uc_req;
+}
+
+unsigned int uclamp_eff_value(struct task_struct *p, enum uclamp_id clamp_id)
+{
+	struct uclamp_se uc_eff;
+
+	/* Task currently refcounted: use back-annotated (effective) value */
+	if (p->uclamp[clamp_id].active)
+		return p->uclamp[clamp_id].value;
+
+	uc_eff = uclamp_eff_get(p, clamp_id);
+
+	return uc_eff.value;
+}
+
+static inline void uclamp_rq_inc_id(struct rq *rq, struct task_struct *p,
+				    enum uclamp_id clamp_id)
+{
+	struct uclamp_rq *uc_rq = &rq->uclamp[clamp_id];
+	struct uclamp_se *uc_se = &p->uclamp[clamp_id];
+	struct uclamp_bucket *bucket;
+
+	lockdep_assert_held(&rq->lock);
+
+	/* Update task effective clamp */
+	*uc_se = uclamp_eff_get(p, clamp_id);
+
+	bucket = &uc_rq->bucket[uc_se->bucket_id];
+	bucket->tasks++;
+	uc_se->active = true;
+
+	uclamp_idle_reset(rq, clamp_id, uc_se->value);
+
+	/*
+	 * Local max aggregation: rq buckets always track the max
+	 * "requested" clamp value of its RUNNABLE tasks.
+	 */
+	if (bucket->tasks == 1 || uc_se->value > bucket->value)
+		bucket->value = uc_se->value;
+
+	if (uc_se->value > READ_ONCE(uc_rq->value))
+		WRITE_ONCE(uc_rq->value, uc_se->value);
+}
+
+static inline void uclamp_rq_dec_id(struct rq *rq, struct task_struct *p,
+				    enum uclamp_id clamp_id)
+{
+	struct uclamp_rq *uc_rq = &rq->uclamp[clamp_id];
+	struct uclamp_se *uc_se = &p->uclamp[clamp_id];
+	struct uclamp_bucket *bucket;
+	unsigned int bkt_clamp;
+	unsigned int rq_clamp;
+
+	lockdep_assert_held(&rq->lock);
+
+	bucket = &uc_rq->bucket[uc_se->bucket_id];
+	SCHED_WARN_ON(!bucket->tasks);
+	if (likely(bucket->tasks))
+		bucket->tasks--;
+	uc_se->active = false;
+
+	/*
+	 * Keep "local max aggregation" simple and accept to (possibly)
+	 * overboost some RUNNABLE tasks in the same bucket: the bucket
+	 * value is only reset once it empties.
+	 */
+	if (likely(bucket->tasks))
+		return;
+
+	rq_clamp = READ_ONCE(uc_rq->value);
+	/*
+	 * Defensive programming: this should never happen. If it happens,
+	 * e.g. due to future modification, warn and fixup the expected value.
+	 */
+	SCHED_WARN_ON(bucket->value > rq_clamp);
+	if (bucket->value >= rq_clamp) {
+		bkt_clamp = uclamp_rq_max_value(rq, clamp_id, uc_se->value);
+		WRITE_ONCE(uc_rq->value, bkt_clamp);
+	}
+}
+
+static inline void uclamp_rq_inc(struct rq *rq, struct task_struct *p)
+{
+	enum uclamp_id clamp_id;
+
+	for_each_clamp_id(clamp_id)
+		uclamp_rq_inc_id(rq, p, clamp_id);
+
+	/* Reset clamp idle holding when there is one RUNNABLE task */
+	if (rq->uclamp_flags & UCLAMP_FLAG_IDLE)
+		rq->uclamp_flags &= ~UCLAMP_FLAG_IDLE;
+}
+
+static inline void uclamp_rq_dec(struct rq *rq, struct task_struct *p)
+{
+	enum uclamp_id clamp_id;
+
+	for_each_clamp_id(clamp_id)
+		uclamp_rq_dec_id(rq, p, clamp_id);
+}
+
+/* Re-account a RUNNABLE task whose requested or group clamps changed */
+static void uclamp_update_active(struct rq *rq, struct task_struct *p)
+{
+	if (!p->uclamp[UCLAMP_MIN].active)
+		return;
+
+	uclamp_rq_dec(rq, p);
+	uclamp_rq_inc(rq, p);
+}
+
+static void uclamp_fork(struct task_struct *p)
+{
+	enum uclamp_id clamp_id;
+
+	for_each_clamp_id(clamp_id)
+		p->uclamp[clamp_id].active = false;
+
+	if (likely(!p->sched_reset_on_fork))
+		return;
+
+	for_each_clamp_id(clamp_id)
+		uclamp_se_set(&p->uclamp_req[clamp_id],
+			      uclamp_none(clamp_id), false);
+}
+
+static void __init init_uclamp(void)
+{
+	enum uclamp_id clamp_id;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct rq *rq = cpu_rq(cpu);
+
+		for_each_clamp_id(clamp_id)
+			rq->uclamp[clamp_id].value = uclamp_none(clamp_id);
+		rq->uclamp_flags = UCLAMP_FLAG_IDLE;
+	}
+
+	for_each_clamp_id(clamp_id) {
+		uclamp_se_set(&init_task.uclamp_req[clamp_id],
+			      uclamp_none(clamp_id), false);
+#ifdef CONFIG_UCLAMP_TASK_GROUP
+		uclamp_se_set(&root_task_group.uclamp_req[clamp_id],
+			      uclamp_none(clamp_id), false);
+		root_task_group.uclamp[clamp_id] =
+			root_task_group.uclamp_req[clamp_id];
+		root_task_group.uclamp_pct[clamp_id] =
+			clamp_id == UCLAMP_MIN ? 0 : 100;
+#endif
+	}
+}
+
+#else /* CONFIG_UCLAMP_TASK */
+static inline void uclamp_rq_inc(struct rq *rq, struct task_struct *p) { }
+static inline void uclamp_rq_dec(struct rq *rq, struct task_struct *p) { }
+static inline void uclamp_fork(struct task_struct *p) { }
+static inline void init_uclamp(void) { }
+#endif /* CONFIG_UCLAMP_TASK */
+
 static inline void enqueue_task(struct rq *rq, struct task_struct *p, int flags)
 {
 	if (!(flags & ENQUEUE_NOCLOCK))
 		update_rq_clock(rq);
 
-	if (!(flags & ENQUEUE_RESTORE))
+	if (!(flags & ENQUEUE_RESTORE)) {
 		sched_info_queued(rq, p);
+		psi_enqueue(p, flags & ENQUEUE_WAKEUP);
+	}
 
+	/* Before the class, so the cpufreq update it triggers sees the clamp */
+	uclamp_rq_inc(rq, p);
 	p->sched_class->enqueue_task(rq, p, flags);
 }
 
@@ -766,9 +1028,12 @@ static inline void dequeue_task(struct rq *rq, struct task_struct *p, int flags)
 	if (!(flags & DEQUEUE_NOCLOCK))
 		update_rq_clock(rq);
 
-	if (!(flags & DEQUEUE_SAVE))
+	if (!(flags & DEQUEUE_SAVE)) {
 		sched_info_dequeued(rq, p);
+		psi_dequeue(p, flags & DEQUEUE_SLEEP);
+	}
 
+	uclamp_rq_dec(rq, p);
 	p->sched_class->dequeue_task(rq, p, flags);
 }
 
@@ -2053,6 +2318,7 @@ try_to_wake_up(struct task_struct *p, unsigned int state, int wake_flags)
 	cpu = select_task_rq(p, p->wake_cpu, SD_BALANCE_WAKE, wake_flags);
 	if (task_cpu(p) != cpu) {
 		wake_flags |= WF_MIGRATED;
+		psi_ttwu_dequeue(p);
 		set_task_cpu(p, cpu);
 	}
 
@@ -2205,6 +2471,12 @@ static void __sched_fork(unsigned long clone_flags, struct task_struct *p)
 	INIT_HLIST_HEAD(&p->preempt_notifiers);
 #endif
 
+#ifdef CONFIG_PSI
+	p->psi_flags			= 0;
+	p->in_memstall			= 0;
+	p->sched_psi_wake_requeue	= 0;
+#endif
+
 #ifdef CONFIG_NUMA_BALANCING
 	if (p->mm && atomic_read(&p->mm->mm_users) == 1) {
 		p->mm->numa_next_scan = jiffies + msecs_to_jiffies(sysctl_numa_balancing_scan_delay);
@@ -2349,6 +2621,7 @@ int sched_fork(unsigned long clone_flags, struct task_struct *p)
 	int cpu = get_cpu();
 
 	__sched_fork(clone_flags, p);
+	uclamp_fork(p);
 	/*
 	 * We mark the process as NEW here. This guarantees that
 	 * nobody will actually run it, and a signal or other external
@@ -2745,6 +3018,8 @@ static struct rq *finish_task_switch(struct task_struct *prev)
 	perf_event_task_sched_in(prev, current);
 	finish_lock_switch(rq, prev);
 	finish_arch_post_lock_switch();
+	/* Pairs with the barriers of membarrier_private_expedited() */
+	membarrier_mm_sync(current->mm);
 
 	fire_sched_in_preempt_notifiers(current);
 	if (mm)
@@ -3104,6 +3379,7 @@ void scheduler_tick(void)
 	curr->sched_class->task_tick(rq, curr, 0);
 	cpu_load_update_active(rq);
 	calc_global_load_tick(rq);
+	sched_core_tick(rq);
 
 	rq_unlock(rq, &rf);
 
@@ -3113,36 +3389,84 @@ void scheduler_tick(void)
 	rq->idle_balance = idle_cpu(cpu);
 	trigger_load_balance(rq);
 #endif
-	rq_last_tick_reset(rq);
 }
 
 #ifdef CONFIG_NO_HZ_FULL
-/**
- * scheduler_tick_max_deferment
- *
- * Keep at least one tick per second when a single
- * active task is running because the scheduler doesn't
- * yet completely support full dynticks environment.
- *
- * This makes sure that uptime, CFS vruntime, load
- * balancing, etc... continue to move forward, even
- * with a very low granularity.
- *
- * Return: Maximum deferment in nanoseconds.
+
+/*
+ * A nohz_full CPU running a single task stops its tick for good.  The
+ * scheduler still wants the current task's runtime, vruntime and the
+ * global load average to move forward, so a housekeeping CPU does that
+ * remotely once per second on the isolated CPU's rq.
  */
-u64 scheduler_tick_max_deferment(void)
+struct tick_work {
+	int			cpu;
+	struct delayed_work	work;
+};
+
+static struct tick_work __percpu *tick_work_cpu;
+
+static void sched_tick_remote(struct work_struct *work)
 {
-	struct rq *rq = this_rq();
-	unsigned long next, now = READ_ONCE(jiffies);
+	struct delayed_work *dwork = to_delayed_work(work);
+	struct tick_work *twork = container_of(dwork, struct tick_work, work);
+	int cpu = twork->cpu;
+	struct rq *rq = cpu_rq(cpu);
+	struct rq_flags rf;
 
-	next = rq->last_sched_tick + HZ;
+	/*
+	 * Handle the tick only if it appears the remote CPU is running in
+	 * full dynticks mode.  The check is racy by nature, but missing a
+	 * tick or having one too much is no big deal: the scheduler tick
+	 * updates statistics and checks timeslices in a time-independent
+	 * way, regardless of when exactly it is running.
+	 */
+	if (!idle_cpu(cpu) && tick_nohz_tick_stopped_cpu(cpu)) {
+		struct task_struct *curr;
 
-	if (time_before_eq(next, now))
-		return 0;
+		rq_lock_irq(rq, &rf);
+		update_rq_clock(rq);
+		curr = rq->curr;
+		curr->sched_class->task_tick(rq, curr, 0);
+		calc_global_load_tick(rq);
+		rq_unlock_irq(rq, &rf);
+	}
 
-	return jiffies_to_nsecs(next - now);
+	queue_delayed_work_on(housekeeping_any_cpu(), system_wq, dwork, HZ);
+}
+
+static void sched_tick_start(int cpu)
+{
+	struct tick_work *twork;
+
+	if (!tick_nohz_full_cpu(cpu))
+		return;
+
+	twork = per_cpu_ptr(tick_work_cpu, cpu);
+	twork->cpu = cpu;
+	INIT_DELAYED_WORK(&twork->work, sched_tick_remote);
+	queue_delayed_work_on(housekeeping_any_cpu(), system_wq,
+			      &twork->work, HZ);
+}
+
+static void sched_tick_stop(int cpu)
+{
+	if (!tick_nohz_full_cpu(cpu))
+		return;
+
+	cancel_delayed_work_sync(&per_cpu_ptr(tick_work_cpu, cpu)->work);
 }
-#endif
+
+static void __init sched_tick_offload_init(void)
+{
+	tick_work_cpu = alloc_percpu(struct tick_work);
+	BUG_ON(!tick_work_cpu);
+}
+#else /* !CONFIG_NO_HZ_FULL */
+static inline void sched_tick_start(int cpu) { }
+static inline void sched_tick_stop(int cpu) { }
+static inline void sched_tick_offload_init(void) { }
+#endif /* CONFIG_NO_HZ_FULL */
 
 #if defined(CONFIG_PREEMPT) && (defined(CONFIG_DEBUG_PREEMPT) || \
 				defined(CONFIG_PREEMPT_TRACER))
@@ -3325,6 +3649,155 @@ again:
 	BUG();
 }
 
+#ifdef CONFIG_SCHED_CORE
+
+DEFINE_STATIC_KEY_FALSE(__sched_core_enabled);
+
+/*
+ * Core scheduling.  Every CPU publishes the cookie of the task it is about
+ * to run in rq->core_running; a task may only be picked when all SMT
+ * siblings run either the same cookie or nothing.  Otherwise the CPU goes
+ * idle instead ("forced idle") with the task left queued, and is kicked to
+ * pick again as soon as a sibling switches to something else.
+ *
+ * The decisions of all siblings of a core are serialized by one lock, the
+ * core_lock of the first sibling.  It nests inside rq->lock and nothing
+ * else is ever taken under it.
+ */
+static inline raw_spinlock_t *sched_core_lock(int cpu)
+{
+	return &cpu_rq(cpumask_first(cpu_smt_mask(cpu)))->core_lock;
+}
+
+/*
+ * A forced idle sibling that waited for at least a tick wins the core: we
+ * yield it, so two incompatible tasks end up alternating tick by tick
+ * rather than one starving the other.  Only a CPU that is running
+ * something yields; two waiting siblings must not defer to each other.
+ */
+static inline bool sched_core_starved(struct rq *srq, unsigned long cookie)
+{
+	return srq->core_forceidle && srq->core_wait_cookie != cookie &&
+	       time_after(jiffies, srq->core_forceidle_since);
+}
+
+/*
+ * Called with rq->lock held on the task pick_next_task() chose.  Returns
+ * it, or the idle task after putting it back when it must not run now.
+ */
+static struct task_struct *
+sched_core_filter(struct rq *rq, struct task_struct *p, struct rq_flags *rf)
+{
+	int this_cpu = cpu_of(rq);
+	unsigned long cookie, running;
+	raw_spinlock_t *lock;
+	bool neutral, ok = true;
+	int cpu;
+
+	neutral = is_idle_task(p) || p->sched_class == &stop_sched_class;
+	cookie = neutral ? SCHED_CORE_IDLE : p->core_cookie;
+
+	lock = sched_core_lock(this_cpu);
+	raw_spin_lock(lock);
+
+	if (!neutral) {
+		for_each_cpu(cpu, cpu_smt_mask(this_cpu)) {
+			struct rq *srq = cpu_rq(cpu);
+
+			if (cpu == this_cpu)
+				continue;
+
+			if ((srq->core_running != SCHED_CORE_IDLE &&
+			     srq->core_running != cookie) ||
+			    (!rq->core_forceidle &&
+			     sched_core_starved(srq, cookie))) {
+				ok = false;
+				break;
+			}
+		}
+	}
+
+	running = ok ? cookie : SCHED_CORE_IDLE;
+	if (rq->core_running != running) {
+		rq->core_running = running;
+		rq->core_kick = true;
+	}
+
+	if (ok) {
+		rq->core_forceidle = false;
+	} else {
+		if (!rq->core_forceidle) {
+			rq->core_forceidle = true;
+			rq->core_forceidle_since = jiffies;
+		}
+		rq->core_wait_cookie = cookie;
+		rq->core_forceidle_count++;
+	}
+
+	raw_spin_unlock(lock);
+
+	if (ok)
+		return p;
+
+	return idle_sched_class.pick_next_task(rq, p, rf);
+}
+
+/*
+ * After a switch that changed our cookie, with rq->lock dropped: let the
+ * forced idle siblings re-evaluate.
+ */
+static void sched_core_kick(struct rq *rq)
+{
+	int this_cpu = cpu_of(rq);
+	int cpu;
+
+	if (!sched_core_enabled() || !rq->core_kick)
+		return;
+
+	rq->core_kick = false;
+
+	for_each_cpu(cpu, cpu_smt_mask(this_cpu)) {
+		struct rq *srq = cpu_rq(cpu);
+		struct rq_flags rf;
+
+		if (cpu == this_cpu || !READ_ONCE(srq->core_forceidle))
+			continue;
+
+		rq_lock_irqsave(srq, &rf);
+		if (is_idle_task(srq->curr))
+			resched_curr(srq);
+		rq_unlock_irqrestore(srq, &rf);
+	}
+}
+
+/*
+ * Tick on a CPU running a task: pick again when a sibling has been forced
+ * idle long enough, so that sched_core_starved() can hand the core over.
+ */
+static void sched_core_tick(struct rq *rq)
+{
+	int this_cpu = cpu_of(rq);
+	int cpu;
+
+	if (!sched_core_enabled() || is_idle_task(rq->curr))
+		return;
+
+	for_each_cpu(cpu, cpu_smt_mask(this_cpu)) {
+		struct rq *srq = cpu_rq(cpu);
+
+		if (cpu != this_cpu && READ_ONCE(srq->core_forceidle) &&
+		    time_after(jiffies, READ_ONCE(srq->core_forceidle_since))) {
+			resched_curr(rq);
+			break;
+		}
+	}
+}
+
+#else
+static inline void sched_core_kick(struct rq *rq) { }
+static inline void sched_core_tick(struct rq *rq) { }
+#endif /* CONFIG_SCHED_CORE */
+
 /*
  * __schedule() is the main scheduler function.
  *
@@ -3426,11 +3899,21 @@ static void __sched notrace __schedule(bool preempt)
 	}
 
 	next = pick_next_task(rq, prev, &rf);
+#ifdef CONFIG_SCHED_CORE
+	if (sched_core_enabled())
+		next = sched_core_filter(rq, next, &rf);
+#endif
 	clear_tsk_need_resched(prev);
 	clear_preempt_need_resched();
 
 	if (likely(prev != next)) {
 		rq->nr_switches++;
+		/*
+		 * Order prev's user-space accesses before the rq->curr
+		 * update for registered membarrier users, the other side
+		 * is in finish_task_switch().
+		 */
+		membarrier_mm_sync(prev->mm);
 		rq->curr = next;
 		++*switch_count;
 
@@ -3444,6 +3927,7 @@ static void __sched notrace __schedule(bool preempt)
 	}
 
 	balance_callback(rq);
+	sched_core_kick(rq);
 }
 
 void __noreturn do_task_dead(void)
@@ -4768,6 +5252,73 @@ out_unlock:
 	return retval;
 }
 
+#ifdef CONFIG_UCLAMP_TASK
+/*
+ * prctl(PR_SCHED_UCLAMP): the clamps take the same permission checks as a
+ * change of scheduling parameters.
+ */
+int sched_uclamp_prctl(unsigned long op, pid_t pid,
+		       unsigned long min, unsigned long max)
+{
+	unsigned int new_min, new_max;
+	struct task_struct *p;
+	struct rq_flags rf;
+	struct rq *rq;
+	int retval;
+
+	rcu_read_lock();
+	p = find_process_by_pid(pid);
+	if (!p) {
+		rcu_read_unlock();
+		return -ESRCH;
+	}
+	get_task_struct(p);
+	rcu_read_unlock();
+
+	switch (op) {
+	case PR_SCHED_UCLAMP_GET_MIN:
+		retval = p->uclamp_req[UCLAMP_MIN].value;
+		goto out_put_task;
+	case PR_SCHED_UCLAMP_GET_MAX:
+		retval = p->uclamp_req[UCLAMP_MAX].value;
+		goto out_put_task;
+	case PR_SCHED_UCLAMP_SET:
+		break;
+	default:
+		retval = -EINVAL;
+		goto out_put_task;
+	}
+
+	retval = -EINVAL;
+	if ((min != -1UL && min > SCHED_CAPACITY_SCALE) ||
+	    (max != -1UL && max > SCHED_CAPACITY_SCALE))
+		goto out_put_task;
+
+	new_min = min == -1UL ? uclamp_none(UCLAMP_MIN) : min;
+	new_max = max == -1UL ? uclamp_none(UCLAMP_MAX) : max;
+	if (new_min > new_max)
+		goto out_put_task;
+
+	retval = -EPERM;
+	if (!check_same_owner(p) && !capable(CAP_SYS_NICE))
+		goto out_put_task;
+
+	retval = security_task_setscheduler(p);
+	if (retval)
+		goto out_put_task;
+
+	rq = task_rq_lock(p, &rf);
+	uclamp_se_set(&p->uclamp_req[UCLAMP_MIN], new_min, min != -1UL);
+	uclamp_se_set(&p->uclamp_req[UCLAMP_MAX], new_max, max != -1UL);
+	uclamp_update_active(rq, p);
+	task_rq_unlock(rq, p, &rf);
+
+out_put_task:
+	put_task_struct(p);
+	return retval;
+}
+#endif /* CONFIG_UCLAMP_TASK */
+
 long sched_setaffinity(pid_t pid, const struct cpumask *in_mask)
 {
 	cpumask_var_t cpus_allowed, new_mask;
@@ -5835,6 +6386,7 @@ int sched_cpu_activate(unsigned int cpu)
 	rq_unlock_irqrestore(rq, &rf);
 
 	update_max_interval();
+	sched_tick_start(cpu);
 
 	return 0;
 }
@@ -5843,6 +6395,7 @@ int sched_cpu_deactivate(unsigned int cpu)
 {
 	int ret;
 
+	sched_tick_stop(cpu);
 	set_cpu_active(cpu, false);
 	/*
 	 * We've cleared cpu_active_mask, wait for all preempt-disabled and RCU
@@ -5865,6 +6418,7 @@ int sched_cpu_deactivate(unsigned int cpu)
 	ret = cpuset_cpu_inactive(cpu);
 	if (ret) {
 		set_cpu_active(cpu, true);
+		sched_tick_start(cpu);
 		return ret;
 	}
 	sched_domains_numa_masks_clear(cpu);
@@ -6085,6 +6639,10 @@ void __init sched_init(void)
 
 		rq = cpu_rq(i);
 		raw_spin_lock_init(&rq->lock);
+#ifdef CONFIG_SCHED_CORE
+		raw_spin_lock_init(&rq->core_lock);
+		rq->core_running = SCHED_CORE_IDLE;
+#endif
 		rq->nr_running = 0;
 		rq->calc_load_active = 0;
 		rq->calc_load_update = jiffies + LOAD_FREQ;
@@ -6147,9 +6705,6 @@ void __init sched_init(void)
 		rq->last_load_update_tick = jiffies;
 		rq->nohz_flags = 0;
 #endif
-#ifdef CONFIG_NO_HZ_FULL
-		rq->last_sched_tick = 0;
-#endif
 #endif /* CONFIG_SMP */
 		init_rq_hrtick(rq);
 		atomic_set(&rq->nr_iowait, 0);
@@ -6182,9 +6737,13 @@ void __init sched_init(void)
 	set_cpu_rq_start_time(smp_processor_id());
 #endif
 	init_sched_fair_class();
+	sched_tick_offload_init();
+	init_uclamp();
 
 	init_schedstats();
 
+	psi_init();
+
 	scheduler_running = 1;
 }
 
@@ -6361,6 +6920,21 @@ static void sched_free_group(struct task_group *tg)
 }
 
 /* allocate runqueue etc for a new task group */
+static inline void alloc_uclamp_sched_group(struct task_group *tg,
+					    struct task_group *parent)
+{
+#ifdef CONFIG_UCLAMP_TASK_GROUP
+	enum uclamp_id clamp_id;
+
+	for_each_clamp_id(clamp_id) {
+		uclamp_se_set(&tg->uclamp_req[clamp_id],
+			      uclamp_none(clamp_id), false);
+		tg->uclamp[clamp_id] = parent->uclamp[clamp_id];
+		tg->uclamp_pct[clamp_id] = clamp_id == UCLAMP_MIN ? 0 : 100;
+	}
+#endif
+}
+
 struct task_group *sched_create_group(struct task_group *parent)
 {
 	struct task_group *tg;
@@ -6375,6 +6949,8 @@ struct task_group *sched_create_group(struct task_group *parent)
 	if (!alloc_rt_sched_group(tg, parent))
 		goto err;
 
+	alloc_uclamp_sched_group(tg, parent);
+
 	return tg;
 
 err:
@@ -6885,6 +7461,103 @@ cpu_cgroup_css_alloc(struct cgroup_subsys_state *parent_css)
 	return &tg->css;
 }
 
+#ifdef CONFIG_UCLAMP_TASK_GROUP
+/* Serializes updates of the group clamps and their propagation */
+static DEFINE_MUTEX(uclamp_mutex);
+
+static void uclamp_update_active_tasks(struct cgroup_subsys_state *css)
+{
+	struct css_task_iter it;
+	struct task_struct *p;
+	struct rq_flags rf;
+	struct rq *rq;
+
+	css_task_iter_start(css, &it);
+	while ((p = css_task_iter_next(&it))) {
+		rq = task_rq_lock(p, &rf);
+		uclamp_update_active(rq, p);
+		task_rq_unlock(rq, p, &rf);
+	}
+	css_task_iter_end(&it);
+}
+
+/*
+ * Recompute the effective clamps of @css and its descendants: a group
+ * can't go above the effective clamps of its parent, and its minimum is
+ * capped by its maximum.  Called under uclamp_mutex and rcu_read_lock().
+ */
+static void cpu_util_update_eff(struct cgroup_subsys_state *css)
+{
+	struct cgroup_subsys_state *top_css = css;
+	unsigned int eff[UCLAMP_CNT];
+	enum uclamp_id clamp_id;
+
+	css_for_each_descendant_pre(css, top_css) {
+		struct task_group *tg = css_tg(css);
+		struct task_group *parent = tg->parent;
+
+		for_each_clamp_id(clamp_id) {
+			eff[clamp_id] = tg->uclamp_req[clamp_id].value;
+			if (parent && eff[clamp_id] > parent->uclamp[clamp_id].value)
+				eff[clamp_id] = parent->uclamp[clamp_id].value;
+		}
+		eff[UCLAMP_MIN] = min(eff[UCLAMP_MIN], eff[UCLAMP_MAX]);
+
+		for_each_clamp_id(clamp_id)
+			uclamp_se_set(&tg->uclamp[clamp_id], eff[clamp_id], true);
+
+		uclamp_update_active_tasks(css);
+	}
+}
+
+static int cpu_uclamp_write(struct cgroup_subsys_state *css, u64 pct,
+			    enum uclamp_id clamp_id)
+{
+	struct task_group *tg = css_tg(css);
+
+	if (pct > 100)
+		return -ERANGE;
+
+	mutex_lock(&uclamp_mutex);
+	rcu_read_lock();
+
+	tg->uclamp_pct[clamp_id] = pct;
+	uclamp_se_set(&tg->uclamp_req[clamp_id],
+		      DIV_ROUND_CLOSEST_ULL(pct * SCHED_CAPACITY_SCALE, 100),
+		      false);
+	cpu_util_update_eff(css);
+
+	rcu_read_unlock();
+	mutex_unlock(&uclamp_mutex);
+
+	return 0;
+}
+
+static int cpu_uclamp_min_write_u64(struct cgroup_subsys_state *css,
+				    struct cftype *cftype, u64 pct)
+{
+	return cpu_uclamp_write(css, pct, UCLAMP_MIN);
+}
+
+static u64 cpu_uclamp_min_read_u64(struct cgroup_subsys_state *css,
+				   struct cftype *cft)
+{
+	return css_tg(css)->uclamp_pct[UCLAMP_MIN];
+}
+
+static int cpu_uclamp_max_write_u64(struct cgroup_subsys_state *css,
+				    struct cftype *cftype, u64 pct)
+{
+	return cpu_uclamp_write(css, pct, UCLAMP_MAX);
+}
+
+static u64 cpu_uclamp_max_read_u64(struct cgroup_subsys_state *css,
+				   struct cftype *cft)
+{
+	return css_tg(css)->uclamp_pct[UCLAMP_MAX];
+}
+#endif /* CONFIG_UCLAMP_TASK_GROUP */
+
 /* Expose task group only after completing cgroup initialization */
 static int cpu_cgroup_css_online(struct cgroup_subsys_state *css)
 {
@@ -6893,6 +7566,16 @@ static int cpu_cgroup_css_online(struct cgroup_subsys_state *css)
 
 	if (parent)
 		sched_online_group(tg, parent);
+
+#ifdef CONFIG_UCLAMP_TASK_GROUP
+	/* Inherit the effective clamps of the parent */
+	mutex_lock(&uclamp_mutex);
+	rcu_read_lock();
+	cpu_util_update_eff(css);
+	rcu_read_unlock();
+	mutex_unlock(&uclamp_mutex);
+#endif
+
 	return 0;
 }
 
@@ -6997,7 +7680,8 @@ const u64 min_cfs_quota_period = 1 * NSEC_PER_MSEC; /* 1ms */
 
 static int __cfs_schedulable(struct task_group *tg, u64 period, u64 runtime);
 
-static int tg_set_cfs_bandwidth(struct task_group *tg, u64 period, u64 quota)
+static int tg_set_cfs_bandwidth(struct task_group *tg, u64 period, u64 quota,
+				u64 burst)
 {
 	int i, ret = 0, runtime_enabled, runtime_was_enabled;
 	struct cfs_bandwidth *cfs_b = &tg->cfs_bandwidth;
@@ -7021,6 +7705,13 @@ static int tg_set_cfs_bandwidth(struct task_group *tg, u64 period, u64 quota)
 	if (period > max_cfs_quota_period)
 		return -EINVAL;
 
+	/*
+	 * A group can at most bank one extra period worth of its quota, which
+	 * keeps the worst case overrun of a period bounded.
+	 */
+	if (quota != RUNTIME_INF && burst > quota)
+		return -EINVAL;
+
 	/*
 	 * Prevent race between setting of cfs_rq->runtime_enabled and
 	 * unthrottle_offline_cfs_rqs().
@@ -7042,6 +7733,7 @@ static int tg_set_cfs_bandwidth(struct task_group *tg, u64 period, u64 quota)
 	raw_spin_lock_irq(&cfs_b->lock);
 	cfs_b->period = ns_to_ktime(period);
 	cfs_b->quota = quota;
+	cfs_b->burst = burst;
 
 	__refill_cfs_bandwidth_runtime(cfs_b);
 
@@ -7075,15 +7767,16 @@ out_unlock:
 
 int tg_set_cfs_quota(struct task_group *tg, long cfs_quota_us)
 {
-	u64 quota, period;
+	u64 quota, period, burst;
 
 	period = ktime_to_ns(tg->cfs_bandwidth.period);
+	burst = tg->cfs_bandwidth.burst;
 	if (cfs_quota_us < 0)
 		quota = RUNTIME_INF;
 	else
 		quota = (u64)cfs_quota_us * NSEC_PER_USEC;
 
-	return tg_set_cfs_bandwidth(tg, period, quota);
+	return tg_set_cfs_bandwidth(tg, period, quota, burst);
 }
 
 long tg_get_cfs_quota(struct task_group *tg)
@@ -7101,12 +7794,13 @@ long tg_get_cfs_quota(struct task_group *tg)
 
 int tg_set_cfs_period(struct task_group *tg, long cfs_period_us)
 {
-	u64 quota, period;
+	u64 quota, period, burst;
 
 	period = (u64)cfs_period_us * NSEC_PER_USEC;
 	quota = tg->cfs_bandwidth.quota;
+	burst = tg->cfs_bandwidth.burst;
 
-	return tg_set_cfs_bandwidth(tg, period, quota);
+	return tg_set_cfs_bandwidth(tg, period, quota, burst);
 }
 
 long tg_get_cfs_period(struct task_group *tg)
@@ -7119,6 +7813,30 @@ long tg_get_cfs_period(struct task_group *tg)
 	return cfs_period_us;
 }
 
+static int tg_set_cfs_burst(struct task_group *tg, u64 cfs_burst_us)
+{
+	u64 quota, period, burst;
+
+	if (cfs_burst_us > U64_MAX / NSEC_PER_USEC)
+		return -EINVAL;
+
+	period = ktime_to_ns(tg->cfs_bandwidth.period);
+	quota = tg->cfs_bandwidth.quota;
+	burst = cfs_burst_us * NSEC_PER_USEC;
+
+	return tg_set_cfs_bandwidth(tg, period, quota, burst);
+}
+
+static u64 tg_get_cfs_burst(struct task_group *tg)
+{
+	u64 burst_us;
+
+	burst_us = tg->cfs_bandwidth.burst;
+	do_div(burst_us, NSEC_PER_USEC);
+
+	return burst_us;
+}
+
 static s64 cpu_cfs_quota_read_s64(struct cgroup_subsys_state *css,
 				  struct cftype *cft)
 {
@@ -7143,6 +7861,18 @@ static int cpu_cfs_period_write_u64(struct cgroup_subsys_state *css,
 	return tg_set_cfs_period(css_tg(css), cfs_period_us);
 }
 
+static u64 cpu_cfs_burst_read_u64(struct cgroup_subsys_state *css,
+				  struct cftype *cft)
+{
+	return tg_get_cfs_burst(css_tg(css));
+}
+
+static int cpu_cfs_burst_write_u64(struct cgroup_subsys_state *css,
+				   struct cftype *cftype, u64 cfs_burst_us)
+{
+	return tg_set_cfs_burst(css_tg(css), cfs_burst_us);
+}
+
 struct cfs_schedulable_data {
 	struct task_group *tg;
 	u64 period, quota;
@@ -7229,6 +7959,18 @@ static int cpu_stats_show(struct seq_file *sf, void *v)
 	seq_printf(sf, "nr_periods %d\n", cfs_b->nr_periods);
 	seq_printf(sf, "nr_throttled %d\n", cfs_b->nr_throttled);
 	seq_printf(sf, "throttled_time %llu\n", cfs_b->throttled_time);
+	seq_printf(sf, "nr_bursts %d\n", cfs_b->nr_burst);
+	seq_printf(sf, "burst_time %llu\n", cfs_b->burst_time);
+
+	/* per cfs_rq throttling events and time by cause */
+	seq_printf(sf, "nr_throttled_running %d\n",
+		   cfs_b->nr_throttled_cause[CFS_THROTTLE_RUNNING]);
+	seq_printf(sf, "throttled_time_running %llu\n",
+		   cfs_b->throttled_time_cause[CFS_THROTTLE_RUNNING]);
+	seq_printf(sf, "nr_throttled_wakeup %d\n",
+		   cfs_b->nr_throttled_cause[CFS_THROTTLE_WAKEUP]);
+	seq_printf(sf, "throttled_time_wakeup %llu\n",
+		   cfs_b->throttled_time_cause[CFS_THROTTLE_WAKEUP]);
 
 	return 0;
 }
@@ -7280,6 +8022,11 @@ static struct cftype cpu_files[] = {
 		.read_u64 = cpu_cfs_period_read_u64,
 		.write_u64 = cpu_cfs_period_write_u64,
 	},
+	{
+		.name = "cfs_burst_us",
+		.read_u64 = cpu_cfs_burst_read_u64,
+		.write_u64 = cpu_cfs_burst_write_u64,
+	},
 	{
 		.name = "stat",
 		.seq_show = cpu_stats_show,
@@ -7296,6 +8043,20 @@ static struct cftype cpu_files[] = {
 		.read_u64 = cpu_rt_period_read_uint,
 		.write_u64 = cpu_rt_period_write_uint,
 	},
+#endif
+#ifdef CONFIG_UCLAMP_TASK_GROUP
+	{
+		.name = "uclamp.min",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.read_u64 = cpu_uclamp_min_read_u64,
+		.write_u64 = cpu_uclamp_min_write_u64,
+	},
+	{
+		.name = "uclamp.max",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.read_u64 = cpu_uclamp_max_read_u64,
+		.write_u64 = cpu_uclamp_max_write_u64,
+	},
 #endif
 	{ }	/* Terminate */
 };
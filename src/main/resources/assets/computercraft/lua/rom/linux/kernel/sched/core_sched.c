@@ -0,0 +1,127 @@
+#include <linux/prctl.h>
+#include <linux/ptrace.h>
+#include <linux/uaccess.h>
+
+#include "sched.h"
+
+/*
+ * prctl(PR_SCHED_CORE) interface of core scheduling, see sched_core_filter()
+ * for the scheduler side.
+ *
+ * A cookie is just a number; zero is the cookie of every untagged task and
+ * new cookies come from a counter, so they are never reused and need no
+ * reference counting.  Children inherit the cookie across fork().
+ */
+
+static atomic_long_t sched_core_cookie_seq;
+
+static void sched_core_set_cookie(struct task_struct *p, unsigned long cookie)
+{
+	struct rq_flags rf;
+	struct rq *rq;
+
+	rq = task_rq_lock(p, &rf);
+	p->core_cookie = cookie;
+	/* It may not match its siblings anymore, make it go through a pick */
+	if (task_running(rq, p))
+		resched_curr(rq);
+	task_rq_unlock(rq, p, &rf);
+}
+
+int sched_core_share_pid(unsigned long cmd, pid_t pid,
+			 unsigned long scope, unsigned long uaddr)
+{
+	struct task_struct *task, *p;
+	unsigned long cookie;
+	struct pid *grp;
+	int err = 0;
+
+	if (scope > PR_SCHED_CORE_SCOPE_PROCESS_GROUP)
+		return -EINVAL;
+
+	rcu_read_lock();
+	task = pid ? find_task_by_vpid(pid) : current;
+	if (!task) {
+		rcu_read_unlock();
+		return -ESRCH;
+	}
+	get_task_struct(task);
+	rcu_read_unlock();
+
+	if (!ptrace_may_access(task, PTRACE_MODE_READ_REALCREDS)) {
+		err = -EPERM;
+		goto out;
+	}
+
+	switch (cmd) {
+	case PR_SCHED_CORE_GET:
+		if (scope != PR_SCHED_CORE_SCOPE_THREAD || !uaddr) {
+			err = -EINVAL;
+			goto out;
+		}
+		err = put_user((u64)task->core_cookie, (u64 __user *)uaddr);
+		goto out;
+
+	case PR_SCHED_CORE_CREATE:
+		cookie = atomic_long_inc_return(&sched_core_cookie_seq);
+		break;
+
+	case PR_SCHED_CORE_SHARE_TO:
+		cookie = current->core_cookie;
+		break;
+
+	case PR_SCHED_CORE_SHARE_FROM:
+		if (scope != PR_SCHED_CORE_SCOPE_THREAD) {
+			err = -EINVAL;
+			goto out;
+		}
+		cookie = task->core_cookie;
+		if (cookie)
+			static_branch_enable(&__sched_core_enabled);
+		sched_core_set_cookie(current, cookie);
+		goto out;
+
+	default:
+		err = -EINVAL;
+		goto out;
+	}
+
+	/* Never turned off again, the filter is cheap once nothing is tagged */
+	if (cookie)
+		static_branch_enable(&__sched_core_enabled);
+
+	switch (scope) {
+	case PR_SCHED_CORE_SCOPE_THREAD:
+		sched_core_set_cookie(task, cookie);
+		break;
+
+	case PR_SCHED_CORE_SCOPE_THREAD_GROUP:
+		read_lock(&tasklist_lock);
+		for_each_thread(task, p)
+			sched_core_set_cookie(p, cookie);
+		read_unlock(&tasklist_lock);
+		break;
+
+	case PR_SCHED_CORE_SCOPE_PROCESS_GROUP:
+		read_lock(&tasklist_lock);
+		grp = task_pgrp(task);
+		/* All or nothing: check every member before changing any */
+		do_each_pid_thread(grp, PIDTYPE_PGID, p) {
+			if (!ptrace_may_access(p, PTRACE_MODE_READ_REALCREDS)) {
+				err = -EPERM;
+				goto out_tasklist;
+			}
+		} while_each_pid_thread(grp, PIDTYPE_PGID, p);
+
+		do_each_pid_thread(grp, PIDTYPE_PGID, p) {
+			sched_core_set_cookie(p, cookie);
+		} while_each_pid_thread(grp, PIDTYPE_PGID, p);
+out_tasklist:
+		read_unlock(&tasklist_lock);
+		break;
+	}
+
+out:
+	put_task_struct(task);
+	return err;
+}
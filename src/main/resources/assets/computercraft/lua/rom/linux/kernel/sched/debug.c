@@ -643,6 +643,11 @@ do {									\
 	}
 #undef P
 
+#ifdef CONFIG_SCHED_CORE
+	SEQ_printf(m, "  .%-30s: %u\n", "core_forceidle_count",
+		   rq->core_forceidle_count);
+#endif
+
 	spin_lock_irqsave(&sched_debug_lock, flags);
 	print_cfs_stats(m, cpu);
 	print_rt_stats(m, cpu);
@@ -831,6 +836,14 @@ void print_numa_stats(struct seq_file *m, int node, unsigned long tsf,
 	SEQ_printf(m, "task_private=%lu task_shared=%lu ", tsf, tpf);
 	SEQ_printf(m, "group_private=%lu group_shared=%lu\n", gsf, gpf);
 }
+
+void print_numa_locality(struct seq_file *m, const char *name,
+		unsigned long local, unsigned long remote)
+{
+	SEQ_printf(m, "numa_locality %s local=%lu remote=%lu ratio=%lu%%\n",
+		   name, local, remote,
+		   local + remote ? local * 100 / (local + remote) : 0);
+}
 #endif
 
 
@@ -849,6 +862,7 @@ static void sched_show_numa(struct task_struct *p, struct seq_file *m)
 	mpol_get(pol);
 	task_unlock(p);
 
+	P(numa_scan_period);
 	P(numa_pages_migrated);
 	P(numa_preferred_nid);
 	P(total_numa_faults);
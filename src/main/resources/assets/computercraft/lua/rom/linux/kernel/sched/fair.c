@@ -1139,6 +1139,12 @@ struct numa_group {
 	struct rcu_head rcu;
 	unsigned long total_faults;
 	unsigned long max_faults_cpu;
+	/*
+	 * Remote and local faults of all tasks of the group, halved every
+	 * minimum scan period.  Members adapt their scan rate to these.
+	 */
+	unsigned long faults_locality[2];
+	unsigned long locality_decay;
 	/*
 	 * Faults_cpu is used to decide whether memory should move
 	 * towards the CPU. As a consequence, these stats are weighted
@@ -1888,9 +1894,31 @@ static void numa_group_count_active_nodes(struct numa_group *numa_group)
  * the page accesses are shared with other processes.
  * Otherwise, decrease the scan period.
  */
+/*
+ * Updated without the group lock by all members, the counts are only
+ * used as a ratio so the occasional lost update does not matter.
+ */
+static void numa_group_locality(struct numa_group *ng, unsigned long *local,
+				unsigned long *remote)
+{
+	unsigned long decay = READ_ONCE(ng->locality_decay);
+	unsigned long next;
+
+	next = jiffies + msecs_to_jiffies(sysctl_numa_balancing_scan_period_min);
+	if (time_after(jiffies, decay) &&
+	    cmpxchg(&ng->locality_decay, decay, next) == decay) {
+		ng->faults_locality[0] >>= 1;
+		ng->faults_locality[1] >>= 1;
+	}
+
+	*remote = READ_ONCE(ng->faults_locality[0]);
+	*local = READ_ONCE(ng->faults_locality[1]);
+}
+
 static void update_task_scan_period(struct task_struct *p,
 			unsigned long shared, unsigned long private)
 {
+	struct numa_group *ng = p->numa_group;
 	unsigned int period_slot;
 	int ratio;
 	int diff;
@@ -1915,6 +1943,22 @@ static void update_task_scan_period(struct task_struct *p,
 		return;
 	}
 
+	/*
+	 * The tasks of a group share their memory, so they go by the
+	 * locality of the whole group: once it has converged they all back
+	 * off together, and while it has not a member that happens to fault
+	 * locally keeps scanning for the others.
+	 */
+	if (ng && ng->nr_tasks > 1) {
+		unsigned long glocal, gremote;
+
+		numa_group_locality(ng, &glocal, &gremote);
+		if (glocal + gremote) {
+			local = glocal;
+			remote = gremote;
+		}
+	}
+
 	/*
 	 * Prepare to scale scan period relative to the current period.
 	 *	 == NUMA_PERIOD_THRESHOLD scan period stays the same
@@ -2389,6 +2433,8 @@ void task_numa_fault(int last_cpupid, int mem_node, int pages, int flags)
 	p->numa_faults[task_faults_idx(NUMA_MEMBUF, mem_node, priv)] += pages;
 	p->numa_faults[task_faults_idx(NUMA_CPUBUF, cpu_node, priv)] += pages;
 	p->numa_faults_locality[local] += pages;
+	if (ng)
+		ng->faults_locality[local] += pages;
 }
 
 static void reset_ptenuma_scan(struct task_struct *p)
@@ -3999,17 +4045,30 @@ static inline u64 sched_cfs_bandwidth_slice(void)
  * We use sched_clock_cpu directly instead of rq->clock to avoid adding
  * additional synchronization around rq->lock.
  *
+ * Quota left unused in the pool is carried over up to cfs_b->burst, so a
+ * group whose average is within its quota can absorb bursts above it.
+ * Whatever the last period took beyond its own quota is accounted as burst.
+ *
  * requires cfs_b->lock
  */
 void __refill_cfs_bandwidth_runtime(struct cfs_bandwidth *cfs_b)
 {
+	s64 runtime;
 	u64 now;
 
 	if (cfs_b->quota == RUNTIME_INF)
 		return;
 
 	now = sched_clock_cpu(smp_processor_id());
-	cfs_b->runtime = cfs_b->quota;
+	cfs_b->runtime += cfs_b->quota;
+	runtime = cfs_b->runtime_snap - cfs_b->runtime;
+	if (runtime > 0) {
+		cfs_b->burst_time += runtime;
+		cfs_b->nr_burst++;
+	}
+
+	cfs_b->runtime = min(cfs_b->runtime, cfs_b->quota + cfs_b->burst);
+	cfs_b->runtime_snap = cfs_b->runtime;
 	cfs_b->runtime_expires = now + ktime_to_ns(cfs_b->period);
 }
 
@@ -4182,7 +4241,8 @@ static int tg_throttle_down(struct task_group *tg, void *data)
 	return 0;
 }
 
-static void throttle_cfs_rq(struct cfs_rq *cfs_rq)
+static void throttle_cfs_rq(struct cfs_rq *cfs_rq,
+			    enum cfs_throttle_cause cause)
 {
 	struct rq *rq = rq_of(cfs_rq);
 	struct cfs_bandwidth *cfs_b = tg_cfs_bandwidth(cfs_rq->tg);
@@ -4217,7 +4277,9 @@ static void throttle_cfs_rq(struct cfs_rq *cfs_rq)
 
 	cfs_rq->throttled = 1;
 	cfs_rq->throttled_clock = rq_clock(rq);
+	cfs_rq->throttle_cause = cause;
 	raw_spin_lock(&cfs_b->lock);
+	cfs_b->nr_throttled_cause[cause]++;
 	empty = list_empty(&cfs_b->throttled_cfs_rq);
 
 	/*
@@ -4243,6 +4305,7 @@ void unthrottle_cfs_rq(struct cfs_rq *cfs_rq)
 	struct sched_entity *se;
 	int enqueue = 1;
 	long task_delta;
+	u64 delta;
 
 	se = cfs_rq->tg->se[cpu_of(rq)];
 
@@ -4251,7 +4314,9 @@ void unthrottle_cfs_rq(struct cfs_rq *cfs_rq)
 	update_rq_clock(rq);
 
 	raw_spin_lock(&cfs_b->lock);
-	cfs_b->throttled_time += rq_clock(rq) - cfs_rq->throttled_clock;
+	delta = rq_clock(rq) - cfs_rq->throttled_clock;
+	cfs_b->throttled_time += delta;
+	cfs_b->throttled_time_cause[cfs_rq->throttle_cause] += delta;
 	list_del_rcu(&cfs_rq->throttled_list);
 	raw_spin_unlock(&cfs_b->lock);
 
@@ -4434,6 +4499,15 @@ static void start_cfs_slack_bandwidth(struct cfs_bandwidth *cfs_b)
 	if (runtime_refresh_within(cfs_b, min_left))
 		return;
 
+	/*
+	 * Don't push an armed timer forward: with CPUs returning slack more
+	 * often than the slack period it would never fire, and the returned
+	 * runtime would sit in the pool while others stay throttled.
+	 */
+	if (cfs_b->slack_started)
+		return;
+	cfs_b->slack_started = true;
+
 	hrtimer_start(&cfs_b->slack_timer,
 			ns_to_ktime(cfs_bandwidth_slack_period),
 			HRTIMER_MODE_REL);
@@ -4486,6 +4560,7 @@ static void do_sched_cfs_slack_timer(struct cfs_bandwidth *cfs_b)
 
 	/* confirm we're still not at a refresh boundary */
 	raw_spin_lock(&cfs_b->lock);
+	cfs_b->slack_started = false;
 	if (runtime_refresh_within(cfs_b, min_bandwidth_expiration)) {
 		raw_spin_unlock(&cfs_b->lock);
 		return;
@@ -4529,7 +4604,7 @@ static void check_enqueue_throttle(struct cfs_rq *cfs_rq)
 	/* update runtime allocation */
 	account_cfs_rq_runtime(cfs_rq, 0);
 	if (cfs_rq->runtime_remaining <= 0)
-		throttle_cfs_rq(cfs_rq);
+		throttle_cfs_rq(cfs_rq, CFS_THROTTLE_WAKEUP);
 }
 
 static void sync_throttle(struct task_group *tg, int cpu)
@@ -4565,7 +4640,7 @@ static bool check_cfs_rq_runtime(struct cfs_rq *cfs_rq)
 	if (cfs_rq_throttled(cfs_rq))
 		return true;
 
-	throttle_cfs_rq(cfs_rq);
+	throttle_cfs_rq(cfs_rq, CFS_THROTTLE_RUNNING);
 	return true;
 }
 
@@ -5449,6 +5524,7 @@ static int wake_affine(struct sched_domain *sd, struct task_struct *p,
 }
 
 static inline int task_util(struct task_struct *p);
+static inline int uclamp_task_util(struct task_struct *p);
 static int cpu_util_wake(int cpu, struct task_struct *p);
 
 static unsigned long capacity_spare_wake(int cpu, struct task_struct *p)
@@ -5566,11 +5642,11 @@ find_idlest_group(struct sched_domain *sd, struct task_struct *p,
 	if (sd_flag & SD_BALANCE_FORK)
 		goto skip_spare;
 
-	if (this_spare > task_util(p) / 2 &&
+	if (this_spare > uclamp_task_util(p) / 2 &&
 	    imbalance_scale*this_spare > 100*most_spare)
 		return NULL;
 
-	if (most_spare > task_util(p) / 2)
+	if (most_spare > uclamp_task_util(p) / 2)
 		return most_spare_sg;
 
 skip_spare:
@@ -5679,29 +5755,20 @@ again:
 
 #ifdef CONFIG_SCHED_SMT
 
-static inline void set_idle_cores(int cpu, int val)
+static inline struct cpumask *llc_idle_cores(int cpu)
 {
 	struct sched_domain_shared *sds;
 
 	sds = rcu_dereference(per_cpu(sd_llc_shared, cpu));
 	if (sds)
-		WRITE_ONCE(sds->has_idle_cores, val);
-}
+		return sds_idle_cores(sds);
 
-static inline bool test_idle_cores(int cpu, bool def)
-{
-	struct sched_domain_shared *sds;
-
-	sds = rcu_dereference(per_cpu(sd_llc_shared, cpu));
-	if (sds)
-		return READ_ONCE(sds->has_idle_cores);
-
-	return def;
+	return NULL;
 }
 
 /*
  * Scans the local SMT mask to see if the entire core is idle, and records this
- * information in sd_llc_shared->has_idle_cores.
+ * information in sd_llc_shared's idle core mask.
  *
  * Since SMT siblings share all cache levels, inspecting this limited remote
  * state should be fairly cheap.
@@ -5709,10 +5776,12 @@ static inline bool test_idle_cores(int cpu, bool def)
 void __update_idle_core(struct rq *rq)
 {
 	int core = cpu_of(rq);
+	struct cpumask *idle_cores;
 	int cpu;
 
 	rcu_read_lock();
-	if (test_idle_cores(core, true))
+	idle_cores = llc_idle_cores(core);
+	if (!idle_cores || cpumask_test_cpu(core, idle_cores))
 		goto unlock;
 
 	for_each_cpu(cpu, cpu_smt_mask(core)) {
@@ -5723,46 +5792,118 @@ void __update_idle_core(struct rq *rq)
 			goto unlock;
 	}
 
-	set_idle_cores(core, 1);
+	for_each_cpu(cpu, cpu_smt_mask(core))
+		cpumask_set_cpu(cpu, idle_cores);
 unlock:
 	rcu_read_unlock();
 }
 
 /*
- * Scan the entire LLC domain for idle cores; this dynamically switches off if
- * there are no idle cores left in the system; tracked through
- * sd_llc->shared->has_idle_cores and enabled through update_idle_core() above.
+ * Called when the idle task is switched out: the core is no longer entirely
+ * idle. Only touch the shared mask when the core is actually in it.
  */
-static int select_idle_core(struct task_struct *p, struct sched_domain *sd, int target)
+void __update_busy_core(struct rq *rq)
 {
-	struct cpumask *cpus = this_cpu_cpumask_var_ptr(select_idle_mask);
-	int core, cpu, wrap;
-
-	if (!static_branch_likely(&sched_smt_present))
-		return -1;
+	int core = cpu_of(rq);
+	struct cpumask *idle_cores;
+	int cpu;
 
-	if (!test_idle_cores(target, false))
-		return -1;
+	rcu_read_lock();
+	idle_cores = llc_idle_cores(core);
+	if (idle_cores && cpumask_test_cpu(core, idle_cores)) {
+		for_each_cpu(cpu, cpu_smt_mask(core))
+			cpumask_clear_cpu(cpu, idle_cores);
+	}
+	rcu_read_unlock();
+}
 
-	cpumask_and(cpus, sched_domain_span(sd), &p->cpus_allowed);
+/*
+ * Find an idle core in @idle_cores that @p may run on. The mask is kept up to
+ * date from idle entry/exit, so the first candidate normally is idle; cores
+ * found busy after all are dropped from the mask as we go.
+ */
+static int find_idle_core(struct task_struct *p, struct cpumask *idle_cores,
+			  int target)
+{
+	int core, cpu, wrap;
 
-	for_each_cpu_wrap(core, cpus, target, wrap) {
+	for_each_cpu_wrap(core, idle_cores, target, wrap) {
 		bool idle = true;
 
+		if (!cpumask_test_cpu(core, &p->cpus_allowed))
+			continue;
+
 		for_each_cpu(cpu, cpu_smt_mask(core)) {
-			cpumask_clear_cpu(cpu, cpus);
 			if (!idle_cpu(cpu))
 				idle = false;
 		}
 
 		if (idle)
 			return core;
+
+		for_each_cpu(cpu, cpu_smt_mask(core))
+			cpumask_clear_cpu(cpu, idle_cores);
 	}
 
-	/*
-	 * Failed to find an idle core; stop looking for one.
-	 */
-	set_idle_cores(target, 0);
+	return -1;
+}
+
+/*
+ * Look up an idle core in the LLC domain through sd_llc_shared's idle core
+ * mask, maintained by update_idle_core() above.
+ */
+static int select_idle_core(struct task_struct *p, struct sched_domain *sd, int target)
+{
+	struct cpumask *idle_cores;
+
+	if (!static_branch_likely(&sched_smt_present))
+		return -1;
+
+	idle_cores = llc_idle_cores(target);
+	if (!idle_cores)
+		return -1;
+
+	return find_idle_core(p, idle_cores, target);
+}
+
+/*
+ * With several LLCs per node, look for an idle core in the other LLCs of the
+ * parent domain before settling for a busy core in our own. This trades cache
+ * affinity for a whole core, so it is left to the SIS_NODE feature.
+ */
+static int select_idle_core_node(struct task_struct *p, struct sched_domain *sd,
+				 int target)
+{
+	struct cpumask *cpus = this_cpu_cpumask_var_ptr(select_idle_mask);
+	struct sched_domain *parent = sd->parent;
+	struct sched_domain *llc;
+	struct cpumask *idle_cores;
+	int cpu, core, wrap;
+
+	if (!sched_feat(SIS_NODE))
+		return -1;
+
+	if (!static_branch_likely(&sched_smt_present))
+		return -1;
+
+	if (!parent || (parent->flags & SD_NUMA))
+		return -1;
+
+	cpumask_andnot(cpus, sched_domain_span(parent), sched_domain_span(sd));
+	cpumask_and(cpus, cpus, &p->cpus_allowed);
+
+	for_each_cpu_wrap(cpu, cpus, target, wrap) {
+		llc = rcu_dereference(per_cpu(sd_llc, cpu));
+		idle_cores = llc_idle_cores(cpu);
+		if (!llc || !idle_cores)
+			continue;
+
+		core = find_idle_core(p, idle_cores, cpu);
+		if (core >= 0)
+			return core;
+
+		cpumask_andnot(cpus, cpus, sched_domain_span(llc));
+	}
 
 	return -1;
 }
@@ -5794,6 +5935,12 @@ static inline int select_idle_core(struct task_struct *p, struct sched_domain *s
 	return -1;
 }
 
+static inline int select_idle_core_node(struct task_struct *p, struct sched_domain *sd,
+					int target)
+{
+	return -1;
+}
+
 static inline int select_idle_smt(struct task_struct *p, struct sched_domain *sd, int target)
 {
 	return -1;
@@ -5865,18 +6012,33 @@ static int select_idle_sibling(struct task_struct *p, int prev, int target)
 	if (!sd)
 		return target;
 
+	schedstat_inc(this_rq()->sis_search);
+
 	i = select_idle_core(p, sd, target);
-	if ((unsigned)i < nr_cpumask_bits)
+	if ((unsigned)i < nr_cpumask_bits) {
+		schedstat_inc(this_rq()->sis_idle_core);
 		return i;
+	}
+
+	i = select_idle_core_node(p, sd, target);
+	if ((unsigned)i < nr_cpumask_bits) {
+		schedstat_inc(this_rq()->sis_idle_core_node);
+		return i;
+	}
 
 	i = select_idle_cpu(p, sd, target);
-	if ((unsigned)i < nr_cpumask_bits)
+	if ((unsigned)i < nr_cpumask_bits) {
+		schedstat_inc(this_rq()->sis_idle_cpu);
 		return i;
+	}
 
 	i = select_idle_smt(p, sd, target);
-	if ((unsigned)i < nr_cpumask_bits)
+	if ((unsigned)i < nr_cpumask_bits) {
+		schedstat_inc(this_rq()->sis_idle_smt);
 		return i;
+	}
 
+	schedstat_inc(this_rq()->sis_failed);
 	return target;
 }
 
@@ -5919,6 +6081,17 @@ static inline int task_util(struct task_struct *p)
 	return p->se.avg.util_avg;
 }
 
+/* What the task's placement should plan for, see uclamp_eff_value() */
+static inline int uclamp_task_util(struct task_struct *p)
+{
+#ifdef CONFIG_UCLAMP_TASK
+	return clamp_t(int, task_util(p), uclamp_eff_value(p, UCLAMP_MIN),
+		       uclamp_eff_value(p, UCLAMP_MAX));
+#else
+	return task_util(p);
+#endif
+}
+
 /*
  * cpu_util_wake: Compute cpu utilization with any contributions from
  * the waking task p removed.
@@ -5958,7 +6131,7 @@ static int wake_cap(struct task_struct *p, int cpu, int prev_cpu)
 	/* Bring task utilization in sync with prev_cpu */
 	sync_entity_load_avg(&p->se);
 
-	return min_cap * 1024 < task_util(p) * capacity_margin;
+	return min_cap * 1024 < uclamp_task_util(p) * capacity_margin;
 }
 
 /*
@@ -9537,6 +9710,14 @@ void show_numa_stats(struct task_struct *p, struct seq_file *m)
 	int node;
 	unsigned long tsf = 0, tpf = 0, gsf = 0, gpf = 0;
 
+	/* What update_task_scan_period() adapts the scan rate to */
+	print_numa_locality(m, "task", p->numa_faults_locality[1],
+			    p->numa_faults_locality[0]);
+	if (p->numa_group)
+		print_numa_locality(m, "group",
+				    p->numa_group->faults_locality[1],
+				    p->numa_group->faults_locality[0]);
+
 	for_each_online_node(node) {
 		if (p->numa_faults) {
 			tsf = p->numa_faults[task_faults_idx(NUMA_MEM, node, 0)];
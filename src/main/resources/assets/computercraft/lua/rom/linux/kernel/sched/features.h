@@ -56,6 +56,12 @@ SCHED_FEAT(TTWU_QUEUE, true)
  */
 SCHED_FEAT(SIS_AVG_CPU, false)
 
+/*
+ * When the LLC has no idle core, look for one in the other LLCs of the
+ * same node before scanning the LLC for an idle CPU.
+ */
+SCHED_FEAT(SIS_NODE, false)
+
 /*
  * Issue a WARN when we do multiple update_rq_clock() calls
  * in a single rq->lock section. Default disabled because the
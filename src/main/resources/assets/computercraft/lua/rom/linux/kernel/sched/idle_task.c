@@ -47,7 +47,7 @@ dequeue_task_idle(struct rq *rq, struct task_struct *p, int flags)
 
 static void put_prev_task_idle(struct rq *rq, struct task_struct *prev)
 {
-	rq_last_tick_reset(rq);
+	update_busy_core(rq);
 }
 
 static void task_tick_idle(struct rq *rq, struct task_struct *curr, int queued)
@@ -29,6 +29,7 @@
 #include <linux/irq_work.h>
 #include <linux/tick.h>
 #include <linux/slab.h>
+#include <linux/psi.h>
 
 #ifdef CONFIG_PARAVIRT
 #include <asm/paravirt.h>
@@ -255,21 +256,35 @@ struct rt_rq;
 
 extern struct list_head task_groups;
 
+#ifdef CONFIG_CFS_BANDWIDTH
+/* Why a cfs_rq got throttled, broken down in cpu.stat */
+enum cfs_throttle_cause {
+	CFS_THROTTLE_RUNNING,	/* ran out of runtime while running */
+	CFS_THROTTLE_WAKEUP,	/* woke up in a group out of runtime */
+	CFS_THROTTLE_NR
+};
+#endif
+
 struct cfs_bandwidth {
 #ifdef CONFIG_CFS_BANDWIDTH
 	raw_spinlock_t lock;
 	ktime_t period;
 	u64 quota, runtime;
+	/* unused quota carried over, runtime never exceeds quota + burst */
+	u64 burst, runtime_snap;
 	s64 hierarchical_quota;
 	u64 runtime_expires;
 
 	int idle, period_active;
+	bool slack_started;
 	struct hrtimer period_timer, slack_timer;
 	struct list_head throttled_cfs_rq;
 
 	/* statistics */
-	int nr_periods, nr_throttled;
-	u64 throttled_time;
+	int nr_periods, nr_throttled, nr_burst;
+	u64 throttled_time, burst_time;
+	int nr_throttled_cause[CFS_THROTTLE_NR];
+	u64 throttled_time_cause[CFS_THROTTLE_NR];
 #endif
 };
 
@@ -313,6 +328,15 @@ struct task_group {
 #endif
 
 	struct cfs_bandwidth cfs_bandwidth;
+
+#ifdef CONFIG_UCLAMP_TASK_GROUP
+	/* As written to cpu.uclamp.{min,max}, in percent */
+	unsigned int uclamp_pct[UCLAMP_CNT];
+	/* Clamp values requested for the group */
+	struct uclamp_se uclamp_req[UCLAMP_CNT];
+	/* Effective clamp values, restricted by the parents */
+	struct uclamp_se uclamp[UCLAMP_CNT];
+#endif
 };
 
 #ifdef CONFIG_FAIR_GROUP_SCHED
@@ -469,6 +493,7 @@ struct cfs_rq {
 	u64 throttled_clock, throttled_clock_task;
 	u64 throttled_clock_task_time;
 	int throttled, throttle_count;
+	enum cfs_throttle_cause throttle_cause;
 	struct list_head throttled_list;
 #endif /* CONFIG_CFS_BANDWIDTH */
 #endif /* CONFIG_FAIR_GROUP_SCHED */
@@ -615,6 +640,32 @@ extern void rq_attach_root(struct rq *rq, struct root_domain *rd);
 
 #endif /* CONFIG_SMP */
 
+#ifdef CONFIG_UCLAMP_TASK
+/*
+ * Utilization clamp bucket: RUNNABLE tasks with a clamp value in the
+ * bucket's range are counted in @tasks and @value is the biggest of their
+ * clamp values.
+ */
+struct uclamp_bucket {
+	unsigned long value : SCHED_CAPACITY_SHIFT + 1;
+	unsigned long tasks : BITS_PER_LONG - SCHED_CAPACITY_SHIFT - 1;
+};
+
+/*
+ * Per rq and clamp index aggregation of the clamp values of the RUNNABLE
+ * tasks: @value is the max of all of them, i.e. the value of the highest
+ * non empty bucket.  Max aggregation makes sure a boosted task gets its
+ * boost and a capped task does not cap a task that is not.
+ */
+struct uclamp_rq {
+	unsigned int value;
+	struct uclamp_bucket bucket[UCLAMP_BUCKETS];
+};
+
+#define for_each_clamp_id(clamp_id) \
+	for ((clamp_id) = 0; (clamp_id) < UCLAMP_CNT; (clamp_id)++)
+#endif /* CONFIG_UCLAMP_TASK */
+
 /*
  * This is the main, per-CPU runqueue data structure.
  *
@@ -643,9 +694,6 @@ struct rq {
 #endif /* CONFIG_SMP */
 	unsigned long nohz_flags;
 #endif /* CONFIG_NO_HZ_COMMON */
-#ifdef CONFIG_NO_HZ_FULL
-	unsigned long last_sched_tick;
-#endif
 	/* capture load from *all* tasks on this cpu: */
 	struct load_weight load;
 	unsigned long nr_load_updates;
@@ -655,6 +703,13 @@ struct rq {
 	struct rt_rq rt;
 	struct dl_rq dl;
 
+#ifdef CONFIG_UCLAMP_TASK
+	/* Utilization clamp values based on CPU's RUNNABLE tasks */
+	struct uclamp_rq uclamp[UCLAMP_CNT] ____cacheline_aligned;
+	unsigned int uclamp_flags;
+#define UCLAMP_FLAG_IDLE 0x01
+#endif
+
 #ifdef CONFIG_FAIR_GROUP_SCHED
 	/* list of leaf cfs_rq on this cpu: */
 	struct list_head leaf_cfs_rq_list;
@@ -746,6 +801,14 @@ struct rq {
 	/* try_to_wake_up() stats */
 	unsigned int ttwu_count;
 	unsigned int ttwu_local;
+
+	/* select_idle_sibling() stats, by the level the search ended at */
+	unsigned int sis_search;
+	unsigned int sis_idle_core;
+	unsigned int sis_idle_core_node;
+	unsigned int sis_idle_cpu;
+	unsigned int sis_idle_smt;
+	unsigned int sis_failed;
 #endif
 
 #ifdef CONFIG_SMP
@@ -756,6 +819,19 @@ struct rq {
 	/* Must be inspected within a rcu lock section */
 	struct cpuidle_state *idle_state;
 #endif
+
+#ifdef CONFIG_SCHED_CORE
+	/* Only used on the first SMT sibling of a core, see sched_core_lock() */
+	raw_spinlock_t		core_lock;
+	/* Protected by sched_core_lock(): */
+	unsigned long		core_running;	/* cookie siblings must match */
+	unsigned long		core_wait_cookie; /* cookie we are idle for */
+	unsigned long		core_forceidle_since;
+	bool			core_forceidle;
+	/* Local to the CPU, kick forced idle siblings after the switch */
+	bool			core_kick;
+	unsigned int		core_forceidle_count;
+#endif
 };
 
 static inline int cpu_of(struct rq *rq)
@@ -773,6 +849,7 @@ static inline int cpu_of(struct rq *rq)
 extern struct static_key_false sched_smt_present;
 
 extern void __update_idle_core(struct rq *rq);
+extern void __update_busy_core(struct rq *rq);
 
 static inline void update_idle_core(struct rq *rq)
 {
@@ -780,10 +857,54 @@ static inline void update_idle_core(struct rq *rq)
 		__update_idle_core(rq);
 }
 
+static inline void update_busy_core(struct rq *rq)
+{
+	if (static_branch_unlikely(&sched_smt_present))
+		__update_busy_core(rq);
+}
+
 #else
 static inline void update_idle_core(struct rq *rq) { }
+static inline void update_busy_core(struct rq *rq) { }
 #endif
 
+#ifdef CONFIG_SCHED_CORE
+
+/* core_running of a sibling running idle or the stop task: matches anything */
+#define SCHED_CORE_IDLE		(~0UL)
+
+extern struct static_key_false __sched_core_enabled;
+
+static inline bool sched_core_enabled(void)
+{
+	return static_branch_unlikely(&__sched_core_enabled);
+}
+
+#endif /* CONFIG_SCHED_CORE */
+
+#ifdef CONFIG_UCLAMP_TASK
+extern unsigned int uclamp_eff_value(struct task_struct *p,
+				     enum uclamp_id clamp_id);
+
+/* Clamp @util by what the RUNNABLE tasks of @rq ask for */
+static inline unsigned long uclamp_rq_util(struct rq *rq, unsigned long util)
+{
+	unsigned long min_util = READ_ONCE(rq->uclamp[UCLAMP_MIN].value);
+	unsigned long max_util = READ_ONCE(rq->uclamp[UCLAMP_MAX].value);
+
+	/* A boost wins over the cap of another task */
+	if (unlikely(min_util >= max_util))
+		return min_util;
+
+	return clamp(util, min_util, max_util);
+}
+#else
+static inline unsigned long uclamp_rq_util(struct rq *rq, unsigned long util)
+{
+	return util;
+}
+#endif /* CONFIG_UCLAMP_TASK */
+
 DECLARE_PER_CPU_SHARED_ALIGNED(struct rq, runqueues);
 
 #define cpu_rq(cpu)		(&per_cpu(runqueues, (cpu)))
@@ -903,6 +1024,30 @@ static inline void rq_repin_lock(struct rq *rq, struct rq_flags *rf)
 #endif
 }
 
+struct rq *__task_rq_lock(struct task_struct *p, struct rq_flags *rf)
+	__acquires(rq->lock);
+
+struct rq *task_rq_lock(struct task_struct *p, struct rq_flags *rf)
+	__acquires(p->pi_lock)
+	__acquires(rq->lock);
+
+static inline void __task_rq_unlock(struct rq *rq, struct rq_flags *rf)
+	__releases(rq->lock)
+{
+	rq_unpin_lock(rq, rf);
+	raw_spin_unlock(&rq->lock);
+}
+
+static inline void
+task_rq_unlock(struct rq *rq, struct task_struct *p, struct rq_flags *rf)
+	__releases(rq->lock)
+	__releases(p->pi_lock)
+{
+	rq_unpin_lock(rq, rf);
+	raw_spin_unlock(&rq->lock);
+	raw_spin_unlock_irqrestore(&p->pi_lock, rf->flags);
+}
+
 #ifdef CONFIG_NUMA
 enum numa_topology_type {
 	NUMA_DIRECT,
@@ -1542,13 +1687,6 @@ static inline void sub_nr_running(struct rq *rq, unsigned count)
 	sched_update_tick_dependency(rq);
 }
 
-static inline void rq_last_tick_reset(struct rq *rq)
-{
-#ifdef CONFIG_NO_HZ_FULL
-	rq->last_sched_tick = jiffies;
-#endif
-}
-
 extern void update_rq_clock(struct rq *rq);
 
 extern void activate_task(struct rq *rq, struct task_struct *p, int flags);
@@ -1624,30 +1762,6 @@ static inline void sched_rt_avg_update(struct rq *rq, u64 rt_delta) { }
 static inline void sched_avg_update(struct rq *rq) { }
 #endif
 
-struct rq *__task_rq_lock(struct task_struct *p, struct rq_flags *rf)
-	__acquires(rq->lock);
-
-struct rq *task_rq_lock(struct task_struct *p, struct rq_flags *rf)
-	__acquires(p->pi_lock)
-	__acquires(rq->lock);
-
-static inline void __task_rq_unlock(struct rq *rq, struct rq_flags *rf)
-	__releases(rq->lock)
-{
-	rq_unpin_lock(rq, rf);
-	raw_spin_unlock(&rq->lock);
-}
-
-static inline void
-task_rq_unlock(struct rq *rq, struct task_struct *p, struct rq_flags *rf)
-	__releases(rq->lock)
-	__releases(p->pi_lock)
-{
-	rq_unpin_lock(rq, rf);
-	raw_spin_unlock(&rq->lock);
-	raw_spin_unlock_irqrestore(&p->pi_lock, rf->flags);
-}
-
 static inline void
 rq_lock_irqsave(struct rq *rq, struct rq_flags *rf)
 	__acquires(rq->lock)
@@ -1903,6 +2017,9 @@ show_numa_stats(struct task_struct *p, struct seq_file *m);
 extern void
 print_numa_stats(struct seq_file *m, int node, unsigned long tsf,
 	unsigned long tpf, unsigned long gsf, unsigned long gpf);
+extern void
+print_numa_locality(struct seq_file *m, const char *name,
+	unsigned long local, unsigned long remote);
 #endif /* CONFIG_NUMA_BALANCING */
 #endif /* CONFIG_SCHED_DEBUG */
 
@@ -26,6 +26,7 @@
 #include <linux/smpboot.h>
 #include <linux/tick.h>
 #include <linux/irq.h>
+#include <linux/lathist.h>
 
 #define CREATE_TRACE_POINTS
 #include <trace/events/irq.h>
@@ -272,6 +273,7 @@ restart:
 	while ((softirq_bit = ffs(pending))) {
 		unsigned int vec_nr;
 		int prev_count;
+		u64 start;
 
 		h += softirq_bit - 1;
 
@@ -281,7 +283,9 @@ restart:
 		kstat_incr_softirqs_this_cpu(vec_nr);
 
 		trace_softirq_entry(vec_nr);
+		start = lathist_start();
 		h->action(h);
+		lathist_softirq(vec_nr, start);
 		trace_softirq_exit(vec_nr);
 		if (unlikely(prev_count != preempt_count())) {
 			pr_err("huh, entered softirq %u %s %p with preempt_count %08x, exited with %08x?\n",
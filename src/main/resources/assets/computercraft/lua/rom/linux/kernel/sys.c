@@ -36,6 +36,8 @@
 #include <linux/ptrace.h>
 #include <linux/fs_struct.h>
 #include <linux/file.h>
+#include <linux/fdtable.h>
+#include <linux/poll.h>
 #include <linux/mount.h>
 #include <linux/gfp.h>
 #include <linux/syscore_ops.h>
@@ -59,6 +61,7 @@
 #include <linux/rcupdate.h>
 #include <linux/uidgid.h>
 #include <linux/cred.h>
+#include <linux/futex.h>
 
 #include <linux/kmsg_dump.h>
 /* Move somewhere else to avoid recompiling? */
@@ -2290,6 +2293,45 @@ SYSCALL_DEFINE5(prctl, int, option, unsigned long, arg2, unsigned long, arg3,
 	case PR_GET_FP_MODE:
 		error = GET_FP_MODE(me);
 		break;
+	case PR_FUTEX_HASH:
+		if (arg5)
+			return -EINVAL;
+		error = futex_hash_prctl(arg2, arg3, arg4);
+		break;
+	case PR_SCHED_CORE:
+		error = sched_core_share_pid(arg2, arg3, arg4, arg5);
+		break;
+	case PR_SCHED_UCLAMP:
+		error = sched_uclamp_prctl(arg2, arg3, arg4, arg5);
+		break;
+	case PR_SET_POLL_CACHE:
+		if (arg2 > 1 || arg3 || arg4 || arg5)
+			return -EINVAL;
+		if (arg2) {
+			task_set_poll_cache(me);
+		} else {
+			task_clear_poll_cache(me);
+			exit_poll_cache(me);
+		}
+		break;
+	case PR_GET_POLL_CACHE:
+		if (arg2 || arg3 || arg4 || arg5)
+			return -EINVAL;
+		return task_poll_cache(me) ? 1 : 0;
+	case PR_SET_FD_CACHE:
+		if (arg2 > 1 || arg3 || arg4 || arg5)
+			return -EINVAL;
+		if (arg2) {
+			task_set_fd_cache(me);
+		} else {
+			task_clear_fd_cache(me);
+			exit_fd_cache(me);
+		}
+		break;
+	case PR_GET_FD_CACHE:
+		if (arg2 || arg3 || arg4 || arg5)
+			return -EINVAL;
+		return task_fd_cache(me) ? 1 : 0;
 	default:
 		error = -EINVAL;
 		break;
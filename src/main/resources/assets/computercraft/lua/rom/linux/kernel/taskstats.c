@@ -28,6 +28,8 @@
 #include <linux/fs.h>
 #include <linux/file.h>
 #include <linux/pid_namespace.h>
+#include <linux/proc_fs.h>
+#include <linux/sched/mm.h>
 #include <net/genetlink.h>
 #include <linux/atomic.h>
 
@@ -47,7 +49,9 @@ static const struct nla_policy taskstats_cmd_get_policy[TASKSTATS_CMD_ATTR_MAX+1
 	[TASKSTATS_CMD_ATTR_PID]  = { .type = NLA_U32 },
 	[TASKSTATS_CMD_ATTR_TGID] = { .type = NLA_U32 },
 	[TASKSTATS_CMD_ATTR_REGISTER_CPUMASK] = { .type = NLA_STRING },
-	[TASKSTATS_CMD_ATTR_DEREGISTER_CPUMASK] = { .type = NLA_STRING },};
+	[TASKSTATS_CMD_ATTR_DEREGISTER_CPUMASK] = { .type = NLA_STRING },
+	[TASKSTATS_CMD_ATTR_PID_LIST] = { .type = NLA_BINARY },
+	[TASKSTATS_CMD_ATTR_MEM_PSS] = { .type = NLA_FLAG },};
 
 /*
  * We have to use TASKSTATS_CMD_ATTR_MAX here, it is the maxattr in the family.
@@ -189,7 +193,26 @@ static void fill_stats(struct user_namespace *user_ns,
 	xacct_add_tsk(stats, tsk);
 }
 
-static int fill_stats_for_pid(pid_t pid, struct taskstats *stats)
+/*
+ * PSS needs a full page table walk under mmap_sem, so unlike the RSS
+ * counters it is only gathered when the caller asks for it.
+ */
+static void fill_stats_pss(struct task_struct *tsk, struct taskstats *stats)
+{
+	struct mm_struct *mm;
+	u64 pss, swap_pss;
+
+	mm = get_task_mm(tsk);
+	if (!mm)
+		return;
+	task_mem_pss(mm, &pss, &swap_pss);
+	mmput(mm);
+
+	stats->pss = pss >> 10;
+	stats->swap_pss = swap_pss >> 10;
+}
+
+static int fill_stats_for_pid(pid_t pid, struct taskstats *stats, bool pss)
 {
 	struct task_struct *tsk;
 
@@ -201,6 +224,8 @@ static int fill_stats_for_pid(pid_t pid, struct taskstats *stats)
 	if (!tsk)
 		return -ESRCH;
 	fill_stats(current_user_ns(), task_active_pid_ns(current), tsk, stats);
+	if (pss)
+		fill_stats_pss(tsk, stats);
 	put_task_struct(tsk);
 	return 0;
 }
@@ -499,7 +524,8 @@ static int cmd_attr_pid(struct genl_info *info)
 	if (!stats)
 		goto err;
 
-	rc = fill_stats_for_pid(pid, stats);
+	rc = fill_stats_for_pid(pid, stats,
+				!!info->attrs[TASKSTATS_CMD_ATTR_MEM_PSS]);
 	if (rc < 0)
 		goto err;
 	return send_reply(rep_skb, info);
@@ -551,6 +577,57 @@ static int taskstats_user_cmd(struct sk_buff *skb, struct genl_info *info)
 		return -EINVAL;
 }
 
+/*
+ * Dump the stats of every pid in TASKSTATS_CMD_ATTR_PID_LIST, one
+ * TASKSTATS_CMD_NEW message per pid, so that a monitor can collect a few
+ * thousand processes with a single request. Pids that have gone away are
+ * skipped; cb->args[0] is the index of the next pid to send.
+ */
+static int taskstats_user_dump(struct sk_buff *skb, struct netlink_callback *cb)
+{
+	struct nlattr *attrs[TASKSTATS_CMD_ATTR_MAX + 1];
+	struct taskstats *stats;
+	u32 *pids;
+	int i, n, rc;
+	bool pss;
+	void *hdr;
+
+	rc = nlmsg_parse(cb->nlh, GENL_HDRLEN, attrs, TASKSTATS_CMD_ATTR_MAX,
+			 taskstats_cmd_get_policy);
+	if (rc < 0)
+		return rc;
+	if (!attrs[TASKSTATS_CMD_ATTR_PID_LIST])
+		return -EINVAL;
+
+	pids = nla_data(attrs[TASKSTATS_CMD_ATTR_PID_LIST]);
+	n = nla_len(attrs[TASKSTATS_CMD_ATTR_PID_LIST]) / sizeof(u32);
+	pss = !!attrs[TASKSTATS_CMD_ATTR_MEM_PSS];
+
+	for (i = cb->args[0]; i < n; i++) {
+		hdr = genlmsg_put(skb, NETLINK_CB(cb->skb).portid,
+				  cb->nlh->nlmsg_seq, &family, NLM_F_MULTI,
+				  TASKSTATS_CMD_NEW);
+		if (!hdr)
+			break;
+
+		stats = mk_reply(skb, TASKSTATS_TYPE_PID, pids[i]);
+		if (!stats) {
+			genlmsg_cancel(skb, hdr);
+			break;
+		}
+
+		if (fill_stats_for_pid(pids[i], stats, pss) < 0) {
+			genlmsg_cancel(skb, hdr);
+			continue;
+		}
+		genlmsg_end(skb, hdr);
+		cond_resched();
+	}
+
+	cb->args[0] = i;
+	return skb->len;
+}
+
 static struct taskstats *taskstats_tgid_alloc(struct task_struct *tsk)
 {
 	struct signal_struct *sig = tsk->signal;
@@ -640,6 +717,7 @@ static const struct genl_ops taskstats_ops[] = {
 	{
 		.cmd		= TASKSTATS_CMD_GET,
 		.doit		= taskstats_user_cmd,
+		.dumpit		= taskstats_user_dump,
 		.policy		= taskstats_cmd_get_policy,
 		.flags		= GENL_ADMIN_PERM,
 	},
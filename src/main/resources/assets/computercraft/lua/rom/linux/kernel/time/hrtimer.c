@@ -1273,6 +1273,10 @@ static void __hrtimer_run_queues(struct hrtimer_cpu_base *cpu_base, ktime_t now)
 			if (basenow < hrtimer_get_softexpires_tv64(timer))
 				break;
 
+			/* Riding along on an earlier expiry, one less event */
+			if (basenow < hrtimer_get_expires_tv64(timer))
+				cpu_base->nr_coalesced++;
+
 			__run_hrtimer(cpu_base, base, timer, &basenow);
 		}
 	}
@@ -1503,6 +1507,32 @@ out:
 	return ret;
 }
 
+/*
+ * Minimum slack of timers armed on behalf of user space which don't ask
+ * for a particular precision, 0 to leave them alone.  Overlapping
+ * [soft, hard] expiry ranges of such timers are served by one event.
+ */
+unsigned int sysctl_hrtimer_coalesce_ns __read_mostly;
+
+/**
+ * hrtimer_coalesce_slack - slack for a user timer of the current task
+ *
+ * Returns the slack a timer armed on behalf of the current task, such as
+ * a timerfd or a poll timeout, may be given so that its expiry coalesces
+ * with that of neighbouring timers: the larger of the task's timer slack
+ * and sysctl_hrtimer_coalesce_ns if the latter is set, 0 otherwise and
+ * for realtime tasks.
+ */
+u64 hrtimer_coalesce_slack(void)
+{
+	unsigned int ns = READ_ONCE(sysctl_hrtimer_coalesce_ns);
+
+	if (!ns || dl_task(current) || rt_task(current))
+		return 0;
+	return max_t(u64, ns, current->timer_slack_ns);
+}
+EXPORT_SYMBOL_GPL(hrtimer_coalesce_slack);
+
 long hrtimer_nanosleep(struct timespec64 *rqtp, struct timespec __user *rmtp,
 		       const enum hrtimer_mode mode, const clockid_t clockid)
 {
@@ -1109,6 +1109,7 @@ struct ftrace_func_probe {
 struct ftrace_func_entry {
 	struct hlist_node hlist;
 	unsigned long ip;
+	unsigned long direct; /* for direct lookup only */
 };
 
 /*
@@ -1641,6 +1642,79 @@ static bool test_rec_ops_needs_regs(struct dyn_ftrace *rec)
 	return  keep_regs;
 }
 
+#ifdef CONFIG_DYNAMIC_FTRACE_WITH_DIRECT_CALLS
+/*
+ * The functions that have a direct caller attached, with the address
+ * to call. Written under direct_mutex, read locklessly from the
+ * direct_ops callback and under ftrace_lock by the record updates.
+ */
+static struct ftrace_hash *direct_functions = EMPTY_HASH;
+static DEFINE_MUTEX(direct_mutex);
+
+static void call_direct_funcs(unsigned long ip, unsigned long pip,
+			      struct ftrace_ops *ops, struct pt_regs *regs);
+
+/*
+ * A single ftrace_ops covers all the direct calls. As long as it is the
+ * only callback for a function, that function's mcount site calls the
+ * direct caller itself; once other callbacks share the function it is
+ * called through the regs caller, and call_direct_funcs() tells the
+ * arch code where to go when the list walk is done.
+ */
+static struct ftrace_ops direct_ops = {
+	.func		= call_direct_funcs,
+	.flags		= FTRACE_OPS_FL_RECURSION_SAFE |
+			  FTRACE_OPS_FL_SAVE_REGS |
+			  FTRACE_OPS_FL_DIRECT,
+	INIT_OPS_HASH(direct_ops)
+};
+
+/**
+ * ftrace_find_rec_direct - Find the direct caller attached to a function
+ * @ip: The address of the mcount call site
+ *
+ * Returns the address registered with register_ftrace_direct() for
+ * @ip, or zero if there is none.
+ */
+unsigned long ftrace_find_rec_direct(unsigned long ip)
+{
+	struct ftrace_func_entry *entry;
+
+	entry = ftrace_lookup_ip(direct_functions, ip);
+	if (!entry)
+		return 0;
+
+	return entry->direct;
+}
+
+static void call_direct_funcs(unsigned long ip, unsigned long pip,
+			      struct ftrace_ops *ops, struct pt_regs *regs)
+{
+	unsigned long addr;
+
+	addr = ftrace_find_rec_direct(ip);
+	if (!addr)
+		return;
+
+	arch_ftrace_set_direct_caller(regs, addr);
+}
+
+/* Is direct_ops going to be the one callback left on @rec? */
+static bool rec_direct_only(struct dyn_ftrace *rec, struct ftrace_ops *ops)
+{
+	return ftrace_rec_count(rec) == 1 && ops != &direct_ops &&
+		(direct_ops.flags & FTRACE_OPS_FL_ENABLED) &&
+		!ftrace_hash_empty(direct_ops.func_hash->filter_hash) &&
+		hash_contains_ip(rec->ip, direct_ops.func_hash);
+}
+#else
+static inline bool rec_direct_only(struct dyn_ftrace *rec,
+				   struct ftrace_ops *ops)
+{
+	return false;
+}
+#endif /* CONFIG_DYNAMIC_FTRACE_WITH_DIRECT_CALLS */
+
 static bool __ftrace_hash_rec_update(struct ftrace_ops *ops,
 				     int filter_hash,
 				     bool inc)
@@ -1744,6 +1818,16 @@ static bool __ftrace_hash_rec_update(struct ftrace_ops *ops,
 				 */
 				rec->flags &= ~FTRACE_FL_TRAMP;
 
+			/*
+			 * Likewise a direct caller is only called straight
+			 * from the mcount site while it is the only one.
+			 */
+			if (ftrace_rec_count(rec) == 1 &&
+			    ops->flags & FTRACE_OPS_FL_DIRECT)
+				rec->flags |= FTRACE_FL_DIRECT;
+			else
+				rec->flags &= ~FTRACE_FL_DIRECT;
+
 			/*
 			 * If any ops wants regs saved for this function
 			 * then all ops will get saved regs.
@@ -1779,6 +1863,15 @@ static bool __ftrace_hash_rec_update(struct ftrace_ops *ops,
 			 */
 			rec->flags &= ~FTRACE_FL_TRAMP;
 
+			/*
+			 * Unlike trampolines, a direct caller left on its
+			 * own can go back to being called directly.
+			 */
+			if (rec_direct_only(rec, ops))
+				rec->flags |= FTRACE_FL_DIRECT;
+			else
+				rec->flags &= ~FTRACE_FL_DIRECT;
+
 			/*
 			 * flags will be cleared in ftrace_check_record()
 			 * if rec count is zero.
@@ -2102,6 +2195,10 @@ static int ftrace_check_record(struct dyn_ftrace *rec, int enable, int update)
 		if (!(rec->flags & FTRACE_FL_TRAMP) != 
 		    !(rec->flags & FTRACE_FL_TRAMP_EN))
 			flag |= FTRACE_FL_TRAMP;
+
+		if (!(rec->flags & FTRACE_FL_DIRECT) !=
+		    !(rec->flags & FTRACE_FL_DIRECT_EN))
+			flag |= FTRACE_FL_DIRECT;
 	}
 
 	/* If the state of this record hasn't changed, then do nothing */
@@ -2126,6 +2223,12 @@ static int ftrace_check_record(struct dyn_ftrace *rec, int enable, int update)
 				else
 					rec->flags &= ~FTRACE_FL_TRAMP_EN;
 			}
+			if (flag & FTRACE_FL_DIRECT) {
+				if (rec->flags & FTRACE_FL_DIRECT)
+					rec->flags |= FTRACE_FL_DIRECT_EN;
+				else
+					rec->flags &= ~FTRACE_FL_DIRECT_EN;
+			}
 		}
 
 		/*
@@ -2155,7 +2258,7 @@ static int ftrace_check_record(struct dyn_ftrace *rec, int enable, int update)
 			 * and REGS states. The _EN flags must be disabled though.
 			 */
 			rec->flags &= ~(FTRACE_FL_ENABLED | FTRACE_FL_TRAMP_EN |
-					FTRACE_FL_REGS_EN);
+					FTRACE_FL_REGS_EN | FTRACE_FL_DIRECT_EN);
 	}
 
 	ftrace_bug_type = FTRACE_BUG_NOP;
@@ -2323,6 +2426,15 @@ ftrace_find_tramp_ops_new(struct dyn_ftrace *rec)
 unsigned long ftrace_get_addr_new(struct dyn_ftrace *rec)
 {
 	struct ftrace_ops *ops;
+	unsigned long addr;
+
+	/* A lone direct caller is called straight from the site */
+	if ((rec->flags & FTRACE_FL_DIRECT) && ftrace_rec_count(rec) == 1) {
+		addr = ftrace_find_rec_direct(rec->ip);
+		if (addr)
+			return addr;
+		WARN_ON_ONCE(1);
+	}
 
 	/* Trampolines take precedence over regs */
 	if (rec->flags & FTRACE_FL_TRAMP) {
@@ -2355,6 +2467,15 @@ unsigned long ftrace_get_addr_new(struct dyn_ftrace *rec)
 unsigned long ftrace_get_addr_curr(struct dyn_ftrace *rec)
 {
 	struct ftrace_ops *ops;
+	unsigned long addr;
+
+	/* Direct calls take precedence over trampolines */
+	if (rec->flags & FTRACE_FL_DIRECT_EN) {
+		addr = ftrace_find_rec_direct(rec->ip);
+		if (addr)
+			return addr;
+		WARN_ON_ONCE(1);
+	}
 
 	/* Trampolines take precedence over regs */
 	if (rec->flags & FTRACE_FL_TRAMP_EN) {
@@ -5309,6 +5430,144 @@ void __init ftrace_init(void)
 	ftrace_disabled = 1;
 }
 
+#ifdef CONFIG_DYNAMIC_FTRACE_WITH_DIRECT_CALLS
+static void remove_direct_entry(struct ftrace_func_entry *entry)
+{
+	hlist_del_rcu(&entry->hlist);
+	direct_functions->count--;
+
+	/* call_direct_funcs() may still be looking at it */
+	synchronize_sched();
+	kfree(entry);
+}
+
+/**
+ * register_ftrace_direct - Call a custom trampoline directly
+ * @ip: The address of the mcount call site of the function to attach to
+ * @addr: The address of the trampoline to call at @ip
+ *
+ * This is used to connect a direct call from the mcount/fentry location
+ * of a function to a caller-supplied trampoline, such as one generated
+ * for a BPF program. While no other ftrace_ops traces the function, the
+ * call site is patched to call @addr itself, which skips both the
+ * callback list walk and building pt_regs. If other callbacks are
+ * attached too, they are called first and the trampoline is entered
+ * afterwards, as if it had been called from the call site.
+ *
+ * @addr is entered with the traced function's arguments in place and
+ * the address to resume the function at on top of the stack, and must
+ * preserve everything a normal mcount callback preserves.
+ *
+ * Returns:
+ *  0 on success
+ *  -EBUSY - Another direct function is already attached at @ip
+ *  -ENODEV - @ip does not point to a ftrace location
+ *  -ENOMEM - There was a problem allocating the tracking entry
+ */
+int register_ftrace_direct(unsigned long ip, unsigned long addr)
+{
+	struct ftrace_func_entry *entry;
+	struct ftrace_hash *hash;
+	unsigned long key;
+	int ret = -EBUSY;
+
+	mutex_lock(&direct_mutex);
+
+	if (ftrace_find_rec_direct(ip))
+		goto out_unlock;
+
+	ret = -ENODEV;
+	if (ftrace_location(ip) != ip)
+		goto out_unlock;
+
+	ret = -ENOMEM;
+	if (direct_functions == EMPTY_HASH) {
+		hash = alloc_ftrace_hash(FTRACE_HASH_DEFAULT_BITS);
+		if (!hash)
+			goto out_unlock;
+		rcu_assign_pointer(direct_functions, hash);
+	}
+
+	entry = kmalloc(sizeof(*entry), GFP_KERNEL);
+	if (!entry)
+		goto out_unlock;
+
+	entry->ip = ip;
+	entry->direct = addr;
+	key = ftrace_hash_key(direct_functions, ip);
+	hlist_add_head_rcu(&entry->hlist, &direct_functions->buckets[key]);
+	direct_functions->count++;
+
+	ret = ftrace_set_filter_ip(&direct_ops, ip, 0, 0);
+	if (ret)
+		goto out_remove;
+
+	if (!(direct_ops.flags & FTRACE_OPS_FL_ENABLED)) {
+		ret = register_ftrace_function(&direct_ops);
+		if (ret) {
+			ftrace_set_filter_ip(&direct_ops, ip, 1, 0);
+			goto out_remove;
+		}
+	}
+
+	mutex_unlock(&direct_mutex);
+
+	return 0;
+
+ out_remove:
+	remove_direct_entry(entry);
+ out_unlock:
+	mutex_unlock(&direct_mutex);
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(register_ftrace_direct);
+
+/**
+ * unregister_ftrace_direct - Detach a direct caller from a function
+ * @ip: The address the direct caller was attached to
+ * @addr: The trampoline that was passed to register_ftrace_direct()
+ *
+ * On return the call site no longer calls @addr, and no CPU is still
+ * about to be sent there by the ftrace callbacks. The caller is
+ * responsible for making sure no task is still running inside @addr
+ * before freeing it.
+ *
+ * Returns 0 on success, or -ENODEV if @addr is not attached at @ip.
+ */
+int unregister_ftrace_direct(unsigned long ip, unsigned long addr)
+{
+	struct ftrace_func_entry *entry;
+	int ret = -ENODEV;
+
+	mutex_lock(&direct_mutex);
+
+	entry = ftrace_lookup_ip(direct_functions, ip);
+	if (!entry || entry->direct != addr)
+		goto out_unlock;
+
+	/*
+	 * An empty filter would make direct_ops trace every function,
+	 * so the last direct caller takes the ops down before its
+	 * location is dropped from the filter.
+	 */
+	if (direct_functions->count == 1)
+		unregister_ftrace_function(&direct_ops);
+
+	ret = ftrace_set_filter_ip(&direct_ops, ip, 1, 0);
+	WARN_ON(ret);
+
+	remove_direct_entry(entry);
+	ret = 0;
+
+ out_unlock:
+	mutex_unlock(&direct_mutex);
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(unregister_ftrace_direct);
+#endif /* CONFIG_DYNAMIC_FTRACE_WITH_DIRECT_CALLS */
+
 /* Do nothing if arch does not support this */
 void __weak arch_ftrace_update_trampoline(struct ftrace_ops *ops)
 {
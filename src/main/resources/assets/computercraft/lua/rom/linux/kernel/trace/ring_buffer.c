@@ -16,6 +16,7 @@
 #include <linux/kmemcheck.h>
 #include <linux/module.h>
 #include <linux/percpu.h>
+#include <linux/mm.h>
 #include <linux/mutex.h>
 #include <linux/delay.h>
 #include <linux/slab.h>
@@ -26,6 +27,8 @@
 
 #include <asm/local.h>
 
+#include <uapi/linux/trace_mmap.h>
+
 static void update_pages_handler(struct work_struct *work);
 
 /*
@@ -301,6 +304,7 @@ struct buffer_page {
 	unsigned	 read;		/* index for next read */
 	local_t		 entries;	/* entries on this page */
 	unsigned long	 real_end;	/* real end of data */
+	unsigned	 id;		/* subbuf id when mapped */
 	struct buffer_data_page *page;	/* Actual data page */
 };
 
@@ -465,6 +469,11 @@ struct ring_buffer_per_cpu {
 	struct completion		update_done;
 
 	struct rb_irq_work		irq_work;
+
+	/* user space mapping, see ring_buffer_map() */
+	int				mapped;
+	struct trace_buffer_meta	*meta_page;
+	struct buffer_page		**subbuf_ids;
 };
 
 struct ring_buffer {
@@ -4148,6 +4157,18 @@ unsigned long ring_buffer_size(struct ring_buffer *buffer, int cpu)
 }
 EXPORT_SYMBOL_GPL(ring_buffer_size);
 
+static void rb_update_meta_page(struct ring_buffer_per_cpu *cpu_buffer)
+{
+	struct trace_buffer_meta *meta = cpu_buffer->meta_page;
+
+	meta->entries = local_read(&cpu_buffer->entries);
+	meta->overrun = local_read(&cpu_buffer->overrun);
+	meta->read = cpu_buffer->read;
+
+	meta->reader.id = cpu_buffer->reader_page->id;
+	meta->reader.read = cpu_buffer->reader_page->read;
+}
+
 static void
 rb_reset_cpu(struct ring_buffer_per_cpu *cpu_buffer)
 {
@@ -4187,6 +4208,9 @@ rb_reset_cpu(struct ring_buffer_per_cpu *cpu_buffer)
 	cpu_buffer->lost_events = 0;
 	cpu_buffer->last_overrun = 0;
 
+	if (cpu_buffer->mapped)
+		rb_update_meta_page(cpu_buffer);
+
 	rb_head_page_activate(cpu_buffer);
 }
 
@@ -4325,6 +4349,11 @@ int ring_buffer_swap_cpu(struct ring_buffer *buffer_a,
 	if (cpu_buffer_a->nr_pages != cpu_buffer_b->nr_pages)
 		goto out;
 
+	/* A mapped buffer must keep its pages where user space sees them */
+	ret = -EBUSY;
+	if (cpu_buffer_a->mapped || cpu_buffer_b->mapped)
+		goto out;
+
 	ret = -EAGAIN;
 
 	if (atomic_read(&buffer_a->record_disabled))
@@ -4486,6 +4515,12 @@ int ring_buffer_read_page(struct ring_buffer *buffer,
 
 	raw_spin_lock_irqsave(&cpu_buffer->reader_lock, flags);
 
+	/* The pages of a mapped buffer are read through the mapping */
+	if (cpu_buffer->mapped) {
+		ret = -EBUSY;
+		goto out_unlock;
+	}
+
 	reader = rb_get_reader_page(cpu_buffer);
 	if (!reader)
 		goto out_unlock;
@@ -4615,6 +4650,219 @@ int ring_buffer_read_page(struct ring_buffer *buffer,
 }
 EXPORT_SYMBOL_GPL(ring_buffer_read_page);
 
+/*
+ * Give every buffer page an id, the reader page being 0, so user space
+ * can find the reader in the mapping whatever its position in the ring.
+ * Swapping the reader in and out only reorders the pages, the ids stay.
+ */
+static void rb_setup_ids(struct ring_buffer_per_cpu *cpu_buffer,
+			 struct buffer_page **subbuf_ids)
+{
+	struct buffer_page *first, *bpage;
+	unsigned id = 0;
+
+	subbuf_ids[id] = cpu_buffer->reader_page;
+	cpu_buffer->reader_page->id = id++;
+
+	first = bpage = list_entry(rb_list_head(cpu_buffer->pages),
+				   struct buffer_page, list);
+	do {
+		if (WARN_ON(id > cpu_buffer->nr_pages))
+			break;
+
+		subbuf_ids[id] = bpage;
+		bpage->id = id++;
+
+		bpage = list_entry(rb_list_head(bpage->list.next),
+				   struct buffer_page, list);
+	} while (bpage != first);
+
+	cpu_buffer->subbuf_ids = subbuf_ids;
+}
+
+static void rb_teardown_map(struct ring_buffer_per_cpu *cpu_buffer)
+{
+	unsigned long flags;
+
+	raw_spin_lock_irqsave(&cpu_buffer->reader_lock, flags);
+	cpu_buffer->mapped = 0;
+	raw_spin_unlock_irqrestore(&cpu_buffer->reader_lock, flags);
+
+	atomic_dec(&cpu_buffer->buffer->resize_disabled);
+
+	free_page((unsigned long)cpu_buffer->meta_page);
+	cpu_buffer->meta_page = NULL;
+	kfree(cpu_buffer->subbuf_ids);
+	cpu_buffer->subbuf_ids = NULL;
+}
+
+/**
+ * ring_buffer_map - map a per-CPU buffer into user space
+ * @buffer: the buffer the CPU buffer belongs to
+ * @cpu: the CPU buffer to map
+ * @vma: the read-only vma to fill, starting at offset 0
+ *
+ * The vma gets the meta-page followed by the sub-buffers in id order,
+ * see struct trace_buffer_meta. While mapped, the buffer can not be
+ * resized, swapped or read with ring_buffer_read_page(), which would all
+ * move pages behind the back of the mapping.
+ *
+ * Returns 0 on success, -EBUSY if the CPU buffer is already mapped.
+ */
+int ring_buffer_map(struct ring_buffer *buffer, int cpu,
+		    struct vm_area_struct *vma)
+{
+	struct ring_buffer_per_cpu *cpu_buffer;
+	struct buffer_page **subbuf_ids;
+	struct trace_buffer_meta *meta;
+	unsigned long nr_subbufs, nr_pages, i;
+	unsigned long addr, flags;
+	int err;
+
+	if (!cpumask_test_cpu(cpu, buffer->cpumask))
+		return -EINVAL;
+
+	if (vma->vm_pgoff || (vma->vm_flags & VM_WRITE))
+		return -EPERM;
+
+	cpu_buffer = buffer->buffers[cpu];
+
+	mutex_lock(&buffer->mutex);
+
+	err = -EBUSY;
+	if (cpu_buffer->mapped)
+		goto unlock;
+
+	nr_subbufs = cpu_buffer->nr_pages + 1;
+	nr_pages = vma_pages(vma);
+	err = -EINVAL;
+	if (nr_pages < 1 || nr_pages > nr_subbufs + 1)
+		goto unlock;
+
+	err = -ENOMEM;
+	subbuf_ids = kcalloc(nr_subbufs, sizeof(*subbuf_ids), GFP_KERNEL);
+	if (!subbuf_ids)
+		goto unlock;
+
+	meta = (struct trace_buffer_meta *)get_zeroed_page(GFP_KERNEL);
+	if (!meta) {
+		kfree(subbuf_ids);
+		goto unlock;
+	}
+	meta->meta_page_size = PAGE_SIZE;
+	meta->meta_struct_len = sizeof(*meta);
+	meta->subbuf_size = PAGE_SIZE;
+	meta->nr_subbufs = nr_subbufs;
+
+	/* Nothing may resize the buffer until the last unmap */
+	atomic_inc(&buffer->resize_disabled);
+
+	raw_spin_lock_irqsave(&cpu_buffer->reader_lock, flags);
+	rb_setup_ids(cpu_buffer, subbuf_ids);
+	cpu_buffer->meta_page = meta;
+	cpu_buffer->mapped = 1;
+	rb_update_meta_page(cpu_buffer);
+	raw_spin_unlock_irqrestore(&cpu_buffer->reader_lock, flags);
+
+	vma->vm_flags |= VM_DONTCOPY | VM_DONTEXPAND | VM_DONTDUMP;
+	vma->vm_flags &= ~VM_MAYWRITE;
+
+	addr = vma->vm_start;
+	err = vm_insert_page(vma, addr, virt_to_page(meta));
+	for (i = 0; !err && i < nr_pages - 1; i++) {
+		addr += PAGE_SIZE;
+		err = vm_insert_page(vma, addr,
+				     virt_to_page(subbuf_ids[i]->page));
+	}
+
+	/* On error mmap_region() zaps whatever was inserted */
+	if (err)
+		rb_teardown_map(cpu_buffer);
+
+ unlock:
+	mutex_unlock(&buffer->mutex);
+
+	return err;
+}
+EXPORT_SYMBOL_GPL(ring_buffer_map);
+
+/**
+ * ring_buffer_unmap - tear down the mapping of a per-CPU buffer
+ * @buffer: the buffer the CPU buffer belongs to
+ * @cpu: the CPU buffer to unmap
+ *
+ * Called once the user space mapping is gone.
+ */
+int ring_buffer_unmap(struct ring_buffer *buffer, int cpu)
+{
+	struct ring_buffer_per_cpu *cpu_buffer;
+	int err = 0;
+
+	if (!cpumask_test_cpu(cpu, buffer->cpumask))
+		return -EINVAL;
+
+	cpu_buffer = buffer->buffers[cpu];
+
+	mutex_lock(&buffer->mutex);
+	if (cpu_buffer->mapped)
+		rb_teardown_map(cpu_buffer);
+	else
+		err = -ENODEV;
+	mutex_unlock(&buffer->mutex);
+
+	return err;
+}
+EXPORT_SYMBOL_GPL(ring_buffer_unmap);
+
+/**
+ * ring_buffer_map_get_reader - swap in the next reader sub-buffer
+ * @buffer: the buffer the CPU buffer belongs to
+ * @cpu: the mapped CPU buffer
+ *
+ * Whatever is left of the current reader page is consumed, as user space
+ * is done with it, then the next page is swapped in if the writer moved
+ * on. The meta-page tells which sub-buffer is the reader afterwards.
+ */
+int ring_buffer_map_get_reader(struct ring_buffer *buffer, int cpu)
+{
+	struct ring_buffer_per_cpu *cpu_buffer;
+	struct buffer_page *reader;
+	unsigned long flags;
+	unsigned int size;
+	int err = 0;
+
+	if (!cpumask_test_cpu(cpu, buffer->cpumask))
+		return -EINVAL;
+
+	cpu_buffer = buffer->buffers[cpu];
+
+	raw_spin_lock_irqsave(&cpu_buffer->reader_lock, flags);
+
+	if (!cpu_buffer->mapped) {
+		err = -ENODEV;
+		goto out;
+	}
+
+	reader = cpu_buffer->reader_page;
+	size = rb_page_size(reader);
+	while (reader->read < size && !rb_per_cpu_empty(cpu_buffer))
+		rb_advance_reader(cpu_buffer);
+
+	reader = rb_get_reader_page(cpu_buffer);
+	if (reader && reader->read == 0) {
+		cpu_buffer->meta_page->reader.lost_events =
+			cpu_buffer->lost_events;
+		cpu_buffer->lost_events = 0;
+	}
+
+	rb_update_meta_page(cpu_buffer);
+ out:
+	raw_spin_unlock_irqrestore(&cpu_buffer->reader_lock, flags);
+
+	return err;
+}
+EXPORT_SYMBOL_GPL(ring_buffer_map_get_reader);
+
 /*
  * We only allocate new buffers, never free them if the CPU goes down.
  * If we were to free the buffer, then the user would lose any trace that was in
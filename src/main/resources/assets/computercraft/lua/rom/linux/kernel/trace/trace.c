@@ -43,6 +43,8 @@
 #include <linux/trace.h>
 #include <linux/sched/rt.h>
 
+#include <uapi/linux/trace_mmap.h>
+
 #include "trace.h"
 #include "trace_output.h"
 
@@ -950,6 +952,10 @@ static int alloc_snapshot(struct trace_array *tr)
 
 	if (!tr->allocated_snapshot) {
 
+		/* swapping would pull the buffer from under the mapping */
+		if (tr->mapped)
+			return -EBUSY;
+
 		/* allocate spare buffer */
 		ret = resize_buffer_duplicate_size(&tr->max_buffer,
 				   &tr->trace_buffer, RING_BUFFER_ALL_CPUS);
@@ -4260,7 +4266,8 @@ static const char readme_msg[] =
 	"  current_tracer\t- function and latency tracers\n"
 	"  available_tracers\t- list of configured tracers for current_tracer\n"
 	"  buffer_size_kb\t- view and modify size of per cpu buffer\n"
-	"  buffer_total_size_kb  - view total size of all cpu buffers\n\n"
+	"  buffer_total_size_kb  - view total size of all cpu buffers\n"
+	"  buffer_size_max_kb\t- grow per cpu buffers that lose events up to this size\n\n"
 	"  trace_clock\t\t-change the clock used to order events\n"
 	"       local:   Per cpu clock but may not be synced across CPUs\n"
 	"      global:   Synced across CPUs but slows tracing down.\n"
@@ -4415,7 +4422,7 @@ static const char readme_msg[] =
 	"\t            [:values=<field1[,field2,...]>]\n"
 	"\t            [:sort=<field1[,field2,...]>]\n"
 	"\t            [:size=#entries]\n"
-	"\t            [:pause][:continue][:clear]\n"
+	"\t            [:pause][:continue][:clear][:percpu]\n"
 	"\t            [:name=histname1]\n"
 	"\t            [if <filter>]\n\n"
 	"\t    When a matching event is hit, an entry is added to a hash\n"
@@ -4446,11 +4453,15 @@ static const char readme_msg[] =
 	"\t            .sym-offset display an address as a symbol and offset\n"
 	"\t            .execname   display a common_pid as a program name\n"
 	"\t            .syscall    display a syscall id as a syscall name\n\n"
-	"\t            .log2       display log2 value rather than raw number\n\n"
+	"\t            .log2       display log2 value rather than raw number\n"
+	"\t            .buckets=N  group keys into ranges of N values\n\n"
 	"\t    The 'pause' parameter can be used to pause an existing hist\n"
 	"\t    trigger or to start a hist trigger but not log any events\n"
 	"\t    until told to do so.  'continue' can be used to start or\n"
 	"\t    restart a paused hist trigger.\n\n"
+	"\t    The 'percpu' parameter gives each CPU its own hash table,\n"
+	"\t    merged when the histogram is read, so that events on\n"
+	"\t    different CPUs never update the same entry.\n\n"
 	"\t    The 'clear' parameter will clear the contents of a running\n"
 	"\t    hist trigger and leave its current paused/active state\n"
 	"\t    unchanged.\n\n"
@@ -5702,6 +5713,91 @@ tracing_total_entries_read(struct file *filp, char __user *ubuf,
 	return simple_read_from_buffer(ubuf, cnt, ppos, buf, r);
 }
 
+/*
+ * With buffer_size_max_kb set, the per-CPU buffers that lost events since
+ * the last check are doubled, up to that size. Resizing fails quietly
+ * while the buffer is being read by an iterator or mapped.
+ */
+static void tracing_buffer_grow_work(struct work_struct *work)
+{
+	struct trace_array *tr = container_of(to_delayed_work(work),
+					      struct trace_array,
+					      buffer_grow_work);
+	struct ring_buffer *buffer = tr->trace_buffer.buffer;
+	unsigned long max = READ_ONCE(tr->buffer_size_max);
+	unsigned long lost, size;
+	int cpu;
+
+	if (!max || !buffer)
+		return;
+
+	/* instance_rmdir() cancels this work with the lock held */
+	if (!mutex_trylock(&trace_types_lock))
+		goto out;
+
+	for_each_tracing_cpu(cpu) {
+		struct trace_array_cpu *data;
+
+		data = per_cpu_ptr(tr->trace_buffer.data, cpu);
+		lost = ring_buffer_overrun_cpu(buffer, cpu) +
+			ring_buffer_dropped_events_cpu(buffer, cpu);
+		if (lost <= data->lost_seen) {
+			/* counters go back to zero on reset */
+			data->lost_seen = lost;
+			continue;
+		}
+		data->lost_seen = lost;
+
+		size = ring_buffer_size(buffer, cpu);
+		if (size >= max)
+			continue;
+		__tracing_resize_ring_buffer(tr, min(size * 2, max), cpu);
+	}
+	mutex_unlock(&trace_types_lock);
+
+ out:
+	schedule_delayed_work(&tr->buffer_grow_work, HZ);
+}
+
+static ssize_t
+tracing_buffer_size_max_read(struct file *filp, char __user *ubuf,
+			     size_t cnt, loff_t *ppos)
+{
+	struct trace_array *tr = filp->private_data;
+	char buf[64];
+	int r;
+
+	r = sprintf(buf, "%lu\n", READ_ONCE(tr->buffer_size_max) >> 10);
+
+	return simple_read_from_buffer(ubuf, cnt, ppos, buf, r);
+}
+
+static ssize_t
+tracing_buffer_size_max_write(struct file *filp, const char __user *ubuf,
+			      size_t cnt, loff_t *ppos)
+{
+	struct trace_array *tr = filp->private_data;
+	unsigned long val;
+	int ret;
+
+	ret = kstrtoul_from_user(ubuf, cnt, 10, &val);
+	if (ret)
+		return ret;
+
+	mutex_lock(&trace_types_lock);
+	WRITE_ONCE(tr->buffer_size_max, val << 10);
+	mutex_unlock(&trace_types_lock);
+
+	if (val)
+		schedule_delayed_work(&tr->buffer_grow_work, HZ);
+	else
+		cancel_delayed_work_sync(&tr->buffer_grow_work);
+
+	*ppos += cnt;
+
+	return cnt;
+}
+
 static ssize_t
 tracing_free_buffer_write(struct file *filp, const char __user *ubuf,
 			  size_t cnt, loff_t *ppos)
@@ -5963,6 +6059,7 @@ struct ftrace_buffer_info {
 	struct trace_iterator	iter;
 	void			*spare;
 	unsigned int		read;
+	unsigned int		nr_vmas;	/* of the mapping, see mmap */
 };
 
 #ifdef CONFIG_TRACER_SNAPSHOT
@@ -6177,6 +6274,14 @@ static const struct file_operations tracing_total_entries_fops = {
 	.release	= tracing_release_generic_tr,
 };
 
+static const struct file_operations tracing_buffer_size_max_fops = {
+	.open		= tracing_open_generic_tr,
+	.read		= tracing_buffer_size_max_read,
+	.write		= tracing_buffer_size_max_write,
+	.llseek		= generic_file_llseek,
+	.release	= tracing_release_generic_tr,
+};
+
 static const struct file_operations tracing_free_buffer_fops = {
 	.open		= tracing_open_generic_tr,
 	.write		= tracing_free_buffer_write,
@@ -6310,6 +6415,8 @@ tracing_buffers_read(struct file *filp, char __user *ubuf,
 	trace_access_unlock(iter->cpu_file);
 
 	if (ret < 0) {
+		if (ret == -EBUSY)
+			return ret;
 		if (trace_empty(iter)) {
 			if ((filp->f_flags & O_NONBLOCK))
 				return -EAGAIN;
@@ -6479,6 +6586,8 @@ tracing_buffers_splice_read(struct file *file, loff_t *ppos,
 		if (r < 0) {
 			ring_buffer_free_read_page(ref->buffer, ref->page);
 			kfree(ref);
+			if (r == -EBUSY)
+				ret = r;
 			break;
 		}
 
@@ -6528,12 +6637,96 @@ out:
 	return ret;
 }
 
+static long tracing_buffers_ioctl(struct file *file, unsigned int cmd,
+				  unsigned long arg)
+{
+	struct ftrace_buffer_info *info = file->private_data;
+	struct trace_iterator *iter = &info->iter;
+	int ret;
+
+	if (cmd != TRACE_MMAP_IOCTL_GET_READER)
+		return -ENOTTY;
+
+	trace_access_lock(iter->cpu_file);
+	ret = ring_buffer_map_get_reader(iter->trace_buffer->buffer,
+					 iter->cpu_file);
+	trace_access_unlock(iter->cpu_file);
+
+	return ret;
+}
+
+/*
+ * A split of the mapping gives more vmas for the same buffer, the buffer
+ * is unmapped when the last one goes away. VM_DONTCOPY keeps them all in
+ * one mm.
+ */
+static void tracing_buffers_mmap_open(struct vm_area_struct *vma)
+{
+	struct ftrace_buffer_info *info = vma->vm_private_data;
+
+	mutex_lock(&trace_types_lock);
+	info->nr_vmas++;
+	mutex_unlock(&trace_types_lock);
+}
+
+static void tracing_buffers_mmap_close(struct vm_area_struct *vma)
+{
+	struct ftrace_buffer_info *info = vma->vm_private_data;
+	struct trace_iterator *iter = &info->iter;
+
+	mutex_lock(&trace_types_lock);
+	if (!--info->nr_vmas) {
+		WARN_ON(ring_buffer_unmap(iter->trace_buffer->buffer,
+					  iter->cpu_file));
+		iter->tr->mapped--;
+	}
+	mutex_unlock(&trace_types_lock);
+}
+
+static const struct vm_operations_struct tracing_buffers_vmops = {
+	.open		= tracing_buffers_mmap_open,
+	.close		= tracing_buffers_mmap_close,
+};
+
+static int tracing_buffers_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	struct ftrace_buffer_info *info = filp->private_data;
+	struct trace_iterator *iter = &info->iter;
+	struct trace_array *tr = iter->tr;
+	int ret;
+
+	mutex_lock(&trace_types_lock);
+
+#ifdef CONFIG_TRACER_MAX_TRACE
+	/* A snapshot swap would replace the buffer behind the mapping */
+	if (tr->allocated_snapshot || tr->current_trace->use_max_tr) {
+		ret = -EBUSY;
+		goto out;
+	}
+#endif
+
+	ret = ring_buffer_map(iter->trace_buffer->buffer, iter->cpu_file, vma);
+	if (ret)
+		goto out;
+
+	tr->mapped++;
+	info->nr_vmas = 1;
+	vma->vm_ops = &tracing_buffers_vmops;
+	vma->vm_private_data = info;
+ out:
+	mutex_unlock(&trace_types_lock);
+
+	return ret;
+}
+
 static const struct file_operations tracing_buffers_fops = {
 	.open		= tracing_buffers_open,
 	.read		= tracing_buffers_read,
 	.poll		= tracing_buffers_poll,
 	.release	= tracing_buffers_release,
 	.splice_read	= tracing_buffers_splice_read,
+	.unlocked_ioctl	= tracing_buffers_ioctl,
+	.mmap		= tracing_buffers_mmap,
 	.llseek		= no_llseek,
 };
 
@@ -7333,6 +7526,7 @@ static int instance_mkdir(const char *name)
 
 	INIT_LIST_HEAD(&tr->systems);
 	INIT_LIST_HEAD(&tr->events);
+	INIT_DELAYED_WORK(&tr->buffer_grow_work, tracing_buffer_grow_work);
 
 	if (allocate_trace_buffers(tr, trace_buf_size) < 0)
 		goto out_free_tr;
@@ -7406,6 +7600,8 @@ static int instance_rmdir(const char *name)
 	ftrace_clear_pids(tr);
 	ftrace_destroy_function_files(tr);
 	tracefs_remove_recursive(tr->dir);
+	tr->buffer_size_max = 0;
+	cancel_delayed_work_sync(&tr->buffer_grow_work);
 	free_trace_buffers(tr);
 
 	for (i = 0; i < tr->nr_topts; i++) {
@@ -7462,6 +7658,9 @@ init_tracer_tracefs(struct trace_array *tr, struct dentry *d_tracer)
 	trace_create_file("buffer_total_size_kb", 0444, d_tracer,
 			  tr, &tracing_total_entries_fops);
 
+	trace_create_file("buffer_size_max_kb", 0644, d_tracer,
+			  tr, &tracing_buffer_size_max_fops);
+
 	trace_create_file("free_buffer", 0200, d_tracer,
 			  tr, &tracing_free_buffer_fops);
 
@@ -7979,6 +8178,8 @@ __init static int tracer_alloc_buffers(void)
 
 	INIT_LIST_HEAD(&global_trace.systems);
 	INIT_LIST_HEAD(&global_trace.events);
+	INIT_DELAYED_WORK(&global_trace.buffer_grow_work,
+			  tracing_buffer_grow_work);
 	list_add(&global_trace.list, &ftrace_trace_arrays);
 
 	apply_trace_boot_options();
@@ -159,6 +159,7 @@ struct trace_array_cpu {
 	unsigned long		policy;
 	unsigned long		rt_priority;
 	unsigned long		skipped_entries;
+	unsigned long		lost_seen;	/* for buffer_size_max_kb */
 	u64			preempt_timestamp;
 	pid_t			pid;
 	kuid_t			uid;
@@ -259,6 +260,9 @@ struct trace_array {
 	struct list_head	events;
 	cpumask_var_t		tracing_cpumask; /* only trace on set CPUs */
 	int			ref;
+	int			mapped;		/* mmapped trace_pipe_raw */
+	unsigned long		buffer_size_max;
+	struct delayed_work	buffer_grow_work;
 #ifdef CONFIG_FUNCTION_TRACER
 	struct ftrace_ops	*ops;
 	struct trace_pid_list	__rcu *function_pids;
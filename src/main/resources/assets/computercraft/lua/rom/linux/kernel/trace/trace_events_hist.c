@@ -34,6 +34,7 @@ struct hist_field {
 	hist_field_fn_t			fn;
 	unsigned int			size;
 	unsigned int			offset;
+	unsigned long			buckets;
 };
 
 static u64 hist_field_none(struct hist_field *field, void *event)
@@ -120,6 +121,7 @@ enum hist_field_flags {
 	HIST_FIELD_FL_SYSCALL		= 128,
 	HIST_FIELD_FL_STACKTRACE	= 256,
 	HIST_FIELD_FL_LOG2		= 512,
+	HIST_FIELD_FL_BUCKET		= 1024,
 };
 
 struct hist_trigger_attrs {
@@ -130,6 +132,7 @@ struct hist_trigger_attrs {
 	bool		pause;
 	bool		cont;
 	bool		clear;
+	bool		percpu;
 	unsigned int	map_bits;
 };
 
@@ -180,6 +183,15 @@ static hist_field_fn_t select_value_fn(int field_size, int field_is_signed)
 	return fn;
 }
 
+static u64 hist_field_bucket(struct hist_field *hist_field, void *event)
+{
+	struct ftrace_event_field *field = hist_field->field;
+	hist_field_fn_t fn = select_value_fn(field->size, field->is_signed);
+	u64 val = fn(hist_field, event);
+
+	return div64_u64(val, hist_field->buckets) * hist_field->buckets;
+}
+
 static int parse_map_size(char *str)
 {
 	unsigned long size, map_bits;
@@ -247,6 +259,8 @@ static struct hist_trigger_attrs *parse_hist_trigger_attrs(char *trigger_str)
 			attrs->cont = true;
 		else if (strcmp(str, "clear") == 0)
 			attrs->clear = true;
+		else if (strcmp(str, "percpu") == 0)
+			attrs->percpu = true;
 		else if (strncmp(str, "size=", strlen("size=")) == 0) {
 			int map_bits = parse_map_size(str);
 
@@ -372,6 +386,16 @@ static struct hist_field *create_hist_field(struct ftrace_event_field *field,
 		goto out;
 	}
 
+	if (flags & HIST_FIELD_FL_BUCKET) {
+		if (WARN_ON_ONCE(!field) || is_string_field(field) ||
+		    !select_value_fn(field->size, field->is_signed)) {
+			destroy_hist_field(hist_field);
+			return NULL;
+		}
+		hist_field->fn = hist_field_bucket;
+		goto out;
+	}
+
 	if (WARN_ON_ONCE(!field))
 		goto out;
 
@@ -512,7 +536,7 @@ static int create_key_field(struct hist_trigger_data *hist_data,
 			    char *field_str)
 {
 	struct ftrace_event_field *field = NULL;
-	unsigned long flags = 0;
+	unsigned long flags = 0, buckets = 0;
 	unsigned int key_size;
 	int ret = 0;
 
@@ -541,7 +565,16 @@ static int create_key_field(struct hist_trigger_data *hist_data,
 				flags |= HIST_FIELD_FL_SYSCALL;
 			else if (strcmp(field_str, "log2") == 0)
 				flags |= HIST_FIELD_FL_LOG2;
-			else {
+			else if (strncmp(field_str, "buckets=",
+					 strlen("buckets=")) == 0) {
+				ret = kstrtoul(field_str + strlen("buckets="),
+					       0, &buckets);
+				if (ret || !buckets) {
+					ret = -EINVAL;
+					goto out;
+				}
+				flags |= HIST_FIELD_FL_BUCKET;
+			} else {
 				ret = -EINVAL;
 				goto out;
 			}
@@ -553,6 +586,11 @@ static int create_key_field(struct hist_trigger_data *hist_data,
 			goto out;
 		}
 
+		if ((flags & HIST_FIELD_FL_BUCKET) && is_string_field(field)) {
+			ret = -EINVAL;
+			goto out;
+		}
+
 		if (is_string_field(field))
 			key_size = MAX_FILTER_STR_VAL;
 		else
@@ -565,6 +603,8 @@ static int create_key_field(struct hist_trigger_data *hist_data,
 		goto out;
 	}
 
+	hist_data->fields[key_idx]->buckets = buckets;
+
 	key_size = ALIGN(key_size, sizeof(u64));
 	hist_data->fields[key_idx]->size = key_size;
 	hist_data->fields[key_idx]->offset = key_offset;
@@ -821,7 +861,10 @@ create_hist_data(unsigned int map_bits,
 	if (ret)
 		goto free;
 
-	ret = tracing_map_init(hist_data->map);
+	if (attrs->percpu)
+		ret = tracing_map_init_percpu(hist_data->map);
+	else
+		ret = tracing_map_init(hist_data->map);
 	if (ret)
 		goto free;
 
@@ -1002,6 +1045,10 @@ hist_trigger_entry_print(struct seq_file *m,
 		} else if (key_field->flags & HIST_FIELD_FL_LOG2) {
 			seq_printf(m, "%s: ~ 2^%-2llu", key_field->field->name,
 				   *(u64 *)(key + key_field->offset));
+		} else if (key_field->flags & HIST_FIELD_FL_BUCKET) {
+			uval = *(u64 *)(key + key_field->offset);
+			seq_printf(m, "%s: ~ %llu-%llu", key_field->field->name,
+				   uval, uval + key_field->buckets - 1);
 		} else if (key_field->flags & HIST_FIELD_FL_STRING) {
 			seq_printf(m, "%s: %-50s", key_field->field->name,
 				   (char *)(key + key_field->offset));
@@ -1143,7 +1190,9 @@ static const char *get_hist_field_flags(struct hist_field *hist_field)
 static void hist_field_print(struct seq_file *m, struct hist_field *hist_field)
 {
 	seq_printf(m, "%s", hist_field->field->name);
-	if (hist_field->flags) {
+	if (hist_field->flags & HIST_FIELD_FL_BUCKET) {
+		seq_printf(m, ".buckets=%lu", hist_field->buckets);
+	} else if (hist_field->flags) {
 		const char *flags_str = get_hist_field_flags(hist_field);
 
 		if (flags_str)
@@ -1216,6 +1265,9 @@ static int event_hist_trigger_print(struct seq_file *m,
 
 	seq_printf(m, ":size=%u", (1 << hist_data->map->map_bits));
 
+	if (hist_data->attrs->percpu)
+		seq_puts(m, ":percpu");
+
 	if (data->filter_str)
 		seq_printf(m, " if %s", data->filter_str);
 
@@ -1381,6 +1433,8 @@ static bool hist_trigger_match(struct event_trigger_data *data,
 			return false;
 		if (key_field->offset != key_field_test->offset)
 			return false;
+		if (key_field->buckets != key_field_test->buckets)
+			return false;
 	}
 
 	for (i = 0; i < hist_data->n_sort_keys; i++) {
@@ -784,19 +784,83 @@ error:
 	return ret;
 }
 
+/*
+ * Unregister every probe on probe_list whose event could be removed, with
+ * one call each to unregister_kprobes() and unregister_kretprobes() so
+ * that the whole list waits for a single grace period instead of one per
+ * probe. Call with locking probe_lock.
+ */
+static int unregister_all_trace_kprobes(int nr)
+{
+	struct kretprobe **rps;
+	struct kprobe **kps;
+	struct trace_kprobe *tk, *n;
+	int nr_kps = 0, nr_rps = 0;
+	LIST_HEAD(release_list);
+	int ret = 0;
+
+	kps = kcalloc(nr, sizeof(*kps), GFP_KERNEL);
+	rps = kcalloc(nr, sizeof(*rps), GFP_KERNEL);
+	if (!kps || !rps) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	list_for_each_entry_safe(tk, n, &probe_list, list) {
+		/* Will fail if probe is being used by ftrace or perf */
+		if (unregister_kprobe_event(tk)) {
+			ret = -EBUSY;
+			break;
+		}
+
+		if (trace_probe_is_registered(&tk->tp)) {
+			if (trace_kprobe_is_return(tk))
+				rps[nr_rps++] = &tk->rp;
+			else
+				kps[nr_kps++] = &tk->rp.kp;
+		}
+		list_move_tail(&tk->list, &release_list);
+	}
+
+	if (nr_kps)
+		unregister_kprobes(kps, nr_kps);
+	if (nr_rps)
+		unregister_kretprobes(rps, nr_rps);
+
+	list_for_each_entry_safe(tk, n, &release_list, list) {
+		list_del(&tk->list);
+		free_trace_kprobe(tk);
+	}
+ out:
+	kfree(rps);
+	kfree(kps);
+
+	return ret;
+}
+
 static int release_all_trace_kprobes(void)
 {
 	struct trace_kprobe *tk;
-	int ret = 0;
+	int nr = 0, ret = 0;
 
 	mutex_lock(&probe_lock);
 	/* Ensure no probe is in use. */
-	list_for_each_entry(tk, &probe_list, list)
+	list_for_each_entry(tk, &probe_list, list) {
 		if (trace_probe_is_enabled(&tk->tp)) {
 			ret = -EBUSY;
 			goto end;
 		}
-	/* TODO: Use batch unregistration */
+		nr++;
+	}
+
+	if (nr > 1) {
+		ret = unregister_all_trace_kprobes(nr);
+		if (ret != -ENOMEM)
+			goto end;
+		/* fall back to releasing them one by one */
+		ret = 0;
+	}
+
 	while (!list_empty(&probe_list)) {
 		tk = list_entry(probe_list.next, struct trace_kprobe, list);
 		ret = unregister_trace_kprobe(tk);
@@ -496,6 +496,13 @@ __tracing_map_insert(struct tracing_map *map, void *key, bool lookup_only)
  */
 struct tracing_map_elt *tracing_map_insert(struct tracing_map *map, void *key)
 {
+	/*
+	 * Being migrated after picking the map only means the event is
+	 * counted in another CPU's map, which is just as lock-free.
+	 */
+	if (map->cpu_maps)
+		map = map->cpu_maps[raw_smp_processor_id()];
+
 	return __tracing_map_insert(map, key, false);
 }
 
@@ -533,15 +540,37 @@ struct tracing_map_elt *tracing_map_lookup(struct tracing_map *map, void *key)
  */
 void tracing_map_destroy(struct tracing_map *map)
 {
+	int cpu;
+
 	if (!map)
 		return;
 
+	if (map->cpu_maps) {
+		for_each_possible_cpu(cpu)
+			tracing_map_destroy(map->cpu_maps[cpu]);
+		kfree(map->cpu_maps);
+	}
+
 	tracing_map_free_elts(map);
 
 	tracing_map_array_free(map->map);
 	kfree(map);
 }
 
+static void __tracing_map_clear(struct tracing_map *map)
+{
+	unsigned int i;
+
+	atomic_set(&map->next_elt, -1);
+	atomic64_set(&map->hits, 0);
+	atomic64_set(&map->drops, 0);
+
+	tracing_map_array_clear(map->map);
+
+	for (i = 0; i < map->max_elts; i++)
+		tracing_map_elt_clear(*(TRACING_MAP_ELT(map->elts, i)));
+}
+
 /**
  * tracing_map_clear - Clear a tracing_map
  * @map: The tracing_map to clear
@@ -555,16 +584,14 @@ void tracing_map_destroy(struct tracing_map *map)
  */
 void tracing_map_clear(struct tracing_map *map)
 {
-	unsigned int i;
-
-	atomic_set(&map->next_elt, -1);
-	atomic64_set(&map->hits, 0);
-	atomic64_set(&map->drops, 0);
+	int cpu;
 
-	tracing_map_array_clear(map->map);
+	if (map->cpu_maps) {
+		for_each_possible_cpu(cpu)
+			__tracing_map_clear(map->cpu_maps[cpu]);
+	}
 
-	for (i = 0; i < map->max_elts; i++)
-		tracing_map_elt_clear(*(TRACING_MAP_ELT(map->elts, i)));
+	__tracing_map_clear(map);
 }
 
 static void set_sort_key(struct tracing_map *map,
@@ -700,6 +727,112 @@ int tracing_map_init(struct tracing_map *map)
 	return err;
 }
 
+/**
+ * tracing_map_init_percpu - Initialize a map with one instance per CPU
+ * @map: The tracing_map to initialize
+ *
+ * Like tracing_map_init(), but additionally creates a private copy of
+ * the map for each possible CPU.  tracing_map_insert() then only ever
+ * touches the copy belonging to the current CPU, so concurrent
+ * insertions on different CPUs never contend on the same table slots
+ * or element counters.  The copies are folded into @map itself by
+ * tracing_map_sort_entries(), which is the only way to read them.
+ *
+ * This costs one pool of 2 ** map_bits tracing_map_elts per CPU in
+ * addition to the one belonging to @map, which is used as the merge
+ * target.
+ *
+ * Return: 0 if successful, negative errno if not.
+ */
+int tracing_map_init_percpu(struct tracing_map *map)
+{
+	struct tracing_map *cpu_map;
+	int cpu, err;
+
+	err = tracing_map_init(map);
+	if (err)
+		return err;
+
+	map->cpu_maps = kcalloc(nr_cpu_ids, sizeof(*map->cpu_maps),
+				GFP_KERNEL);
+	if (!map->cpu_maps)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		cpu_map = tracing_map_create(map->map_bits, map->key_size,
+					     map->ops, map->private_data);
+		if (IS_ERR(cpu_map))
+			return PTR_ERR(cpu_map);
+
+		map->cpu_maps[cpu] = cpu_map;
+
+		memcpy(cpu_map->fields, map->fields, sizeof(map->fields));
+		cpu_map->n_fields = map->n_fields;
+		memcpy(cpu_map->key_idx, map->key_idx, sizeof(map->key_idx));
+		cpu_map->n_keys = map->n_keys;
+
+		err = tracing_map_init(cpu_map);
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+/*
+ * Rebuild a per-cpu map's merge target from the current contents of
+ * the per-cpu instances: matching keys have their sums added and the
+ * hits and drops of all instances are accumulated.  Writers may still
+ * be inserting; entries that aren't fully published yet are skipped.
+ */
+static void tracing_map_merge_percpu(struct tracing_map *map)
+{
+	struct tracing_map_elt *elt, *melt;
+	struct tracing_map_entry *entry;
+	struct tracing_map *cpu_map;
+	u64 hits = 0, drops = 0;
+	unsigned int i, j;
+	int cpu;
+
+	__tracing_map_clear(map);
+
+	for_each_possible_cpu(cpu) {
+		cpu_map = map->cpu_maps[cpu];
+
+		for (i = 0; i < cpu_map->map_size; i++) {
+			entry = TRACING_MAP_ENTRY(cpu_map->map, i);
+			elt = READ_ONCE(entry->val);
+			if (!entry->key || !elt)
+				continue;
+
+			melt = __tracing_map_insert(map, elt->key, true);
+			if (!melt) {
+				melt = __tracing_map_insert(map, elt->key,
+							    false);
+				if (!melt)
+					continue;
+				if (map->ops && map->ops->elt_copy)
+					map->ops->elt_copy(melt, elt);
+			}
+
+			for (j = 0; j < map->n_fields; j++) {
+				if (map->fields[j].cmp_fn !=
+				    tracing_map_cmp_atomic64)
+					continue;
+				tracing_map_update_sum(melt, j,
+						tracing_map_read_sum(elt, j));
+			}
+		}
+
+		hits += atomic64_read(&cpu_map->hits);
+		drops += atomic64_read(&cpu_map->drops);
+	}
+
+	/* the merge's own insertions above only count against drops */
+	atomic64_set(&map->hits, hits);
+	atomic64_add(drops, &map->drops);
+}
+
 static int cmp_entries_dup(const struct tracing_map_sort_entry **a,
 			   const struct tracing_map_sort_entry **b)
 {
@@ -1000,6 +1133,9 @@ int tracing_map_sort_entries(struct tracing_map *map,
 	struct tracing_map_sort_entry *sort_entry, **entries;
 	int i, n_entries, ret;
 
+	if (map->cpu_maps)
+		tracing_map_merge_percpu(map);
+
 	entries = vmalloc(map->max_elts * sizeof(sort_entry));
 	if (!entries)
 		return -ENOMEM;
@@ -193,6 +193,7 @@ struct tracing_map {
 	struct tracing_map_sort_key	sort_key;
 	atomic64_t			hits;
 	atomic64_t			drops;
+	struct tracing_map		**cpu_maps;
 };
 
 /**
@@ -245,6 +246,7 @@ tracing_map_create(unsigned int map_bits,
 		   const struct tracing_map_ops *ops,
 		   void *private_data);
 extern int tracing_map_init(struct tracing_map *map);
+extern int tracing_map_init_percpu(struct tracing_map *map);
 
 extern int tracing_map_add_sum_field(struct tracing_map *map);
 extern int tracing_map_add_key_field(struct tracing_map *map,
@@ -105,6 +105,10 @@ void xacct_add_tsk(struct taskstats *stats, struct task_struct *p)
 		/* adjust to KB unit */
 		stats->hiwater_rss   = get_mm_hiwater_rss(mm) * PAGE_SIZE / KB;
 		stats->hiwater_vm    = get_mm_hiwater_vm(mm)  * PAGE_SIZE / KB;
+		stats->rss_anon  = get_mm_counter(mm, MM_ANONPAGES) * PAGE_SIZE / KB;
+		stats->rss_file  = get_mm_counter(mm, MM_FILEPAGES) * PAGE_SIZE / KB;
+		stats->rss_shmem = get_mm_counter(mm, MM_SHMEMPAGES) * PAGE_SIZE / KB;
+		stats->swap      = get_mm_counter(mm, MM_SWAPENTS) * PAGE_SIZE / KB;
 		mmput(mm);
 	}
 	stats->read_char	= p->ioac.rchar & KB_MASK;
@@ -27,7 +27,11 @@
 /* see: Documentation/crc32.txt for a description of algorithms */
 
 #include <linux/crc32.h>
+#include <linux/jump_label.h>
+#include <linux/list.h>
 #include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/rcupdate.h>
 #include <linux/types.h>
 #include <linux/sched.h>
 #include "crc32defs.h"
@@ -182,26 +186,136 @@ static inline u32 __pure crc32_le_generic(u32 crc, unsigned char const *p,
 }
 
 #if CRC_LE_BITS == 1
-u32 __pure crc32_le(u32 crc, unsigned char const *p, size_t len)
+u32 __pure crc32_le_base(u32 crc, unsigned char const *p, size_t len)
 {
 	return crc32_le_generic(crc, p, len, NULL, CRCPOLY_LE);
 }
-u32 __pure __crc32c_le(u32 crc, unsigned char const *p, size_t len)
+u32 __pure __crc32c_le_base(u32 crc, unsigned char const *p, size_t len)
 {
 	return crc32_le_generic(crc, p, len, NULL, CRC32C_POLY_LE);
 }
 #else
-u32 __pure crc32_le(u32 crc, unsigned char const *p, size_t len)
+u32 __pure crc32_le_base(u32 crc, unsigned char const *p, size_t len)
 {
 	return crc32_le_generic(crc, p, len,
 			(const u32 (*)[256])crc32table_le, CRCPOLY_LE);
 }
-u32 __pure __crc32c_le(u32 crc, unsigned char const *p, size_t len)
+u32 __pure __crc32c_le_base(u32 crc, unsigned char const *p, size_t len)
 {
 	return crc32_le_generic(crc, p, len,
 			(const u32 (*)[256])crc32ctable_le, CRC32C_POLY_LE);
 }
 #endif
+EXPORT_SYMBOL(crc32_le_base);
+EXPORT_SYMBOL(__crc32c_le_base);
+
+/*
+ * Accelerated implementations registered by architecture code. The best
+ * one for each function is picked whenever the set changes, and callers
+ * only pay a static branch while none is registered.
+ */
+static DEFINE_MUTEX(crc32_arch_mutex);
+static LIST_HEAD(crc32_arch_list);
+
+static DEFINE_STATIC_KEY_FALSE(crc32_le_use_arch);
+static DEFINE_STATIC_KEY_FALSE(crc32c_le_use_arch);
+static crc32_fn_t crc32_le_arch __read_mostly;
+static crc32_fn_t crc32c_le_arch __read_mostly;
+
+static void crc32_arch_select(struct static_key_false *key, crc32_fn_t *fnp,
+			      const struct crc32_arch *best, crc32_fn_t fn,
+			      const char *what)
+{
+	if (READ_ONCE(*fnp) == fn)
+		return;
+
+	WRITE_ONCE(*fnp, fn);
+	if (fn) {
+		static_branch_enable(key);
+		pr_info("crc32: %s using %s\n", what, best->name);
+	} else {
+		static_branch_disable(key);
+		pr_info("crc32: %s using generic code\n", what);
+	}
+}
+
+static void crc32_arch_update(void)
+{
+	const struct crc32_arch *best_le = NULL, *best_c = NULL, *arch;
+
+	lockdep_assert_held(&crc32_arch_mutex);
+
+	list_for_each_entry(arch, &crc32_arch_list, list) {
+		if (arch->crc32_le &&
+		    (!best_le || arch->priority > best_le->priority))
+			best_le = arch;
+		if (arch->crc32c_le &&
+		    (!best_c || arch->priority > best_c->priority))
+			best_c = arch;
+	}
+
+	crc32_arch_select(&crc32_le_use_arch, &crc32_le_arch, best_le,
+			  best_le ? best_le->crc32_le : NULL, "crc32_le");
+	crc32_arch_select(&crc32c_le_use_arch, &crc32c_le_arch, best_c,
+			  best_c ? best_c->crc32c_le : NULL, "crc32c_le");
+}
+
+/**
+ * crc32_register_arch - offer accelerated crc32_le()/__crc32c_le()
+ * @arch: the implementations, must stay around until unregistered
+ *
+ * The implementations may only fall back to crc32_le_base() and
+ * __crc32c_le_base(), never to the dispatching functions.
+ */
+void crc32_register_arch(struct crc32_arch *arch)
+{
+	mutex_lock(&crc32_arch_mutex);
+	list_add_tail(&arch->list, &crc32_arch_list);
+	crc32_arch_update();
+	mutex_unlock(&crc32_arch_mutex);
+}
+EXPORT_SYMBOL(crc32_register_arch);
+
+void crc32_unregister_arch(struct crc32_arch *arch)
+{
+	mutex_lock(&crc32_arch_mutex);
+	list_del(&arch->list);
+	crc32_arch_update();
+	mutex_unlock(&crc32_arch_mutex);
+
+	/* Callers run with preemption disabled, wait for them to finish */
+	synchronize_sched();
+}
+EXPORT_SYMBOL(crc32_unregister_arch);
+
+static __always_inline u32 crc32_le_dispatch(struct static_key_false *key,
+					     crc32_fn_t *fnp, crc32_fn_t base,
+					     u32 crc, unsigned char const *p,
+					     size_t len)
+{
+	crc32_fn_t fn;
+
+	if (!static_branch_unlikely(key))
+		return base(crc, p, len);
+
+	preempt_disable();
+	fn = READ_ONCE(*fnp);
+	crc = fn ? fn(crc, p, len) : base(crc, p, len);
+	preempt_enable();
+
+	return crc;
+}
+
+u32 __pure crc32_le(u32 crc, unsigned char const *p, size_t len)
+{
+	return crc32_le_dispatch(&crc32_le_use_arch, &crc32_le_arch,
+				 crc32_le_base, crc, p, len);
+}
+u32 __pure __crc32c_le(u32 crc, unsigned char const *p, size_t len)
+{
+	return crc32_le_dispatch(&crc32c_le_use_arch, &crc32c_le_arch,
+				 __crc32c_le_base, crc, p, len);
+}
 EXPORT_SYMBOL(crc32_le);
 EXPORT_SYMBOL(__crc32c_le);
 
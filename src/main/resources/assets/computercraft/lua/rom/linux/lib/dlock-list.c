@@ -0,0 +1,140 @@
+/*
+ * Distributed and locked list
+ *
+ * See include/linux/dlock-list.h.
+ */
+#include <linux/dlock-list.h>
+#include <linux/cpumask.h>
+#include <linux/export.h>
+#include <linux/bug.h>
+
+/**
+ * alloc_dlock_list_heads - allocate and initialize the per cpu lists
+ * @dlist: dlock list to set up
+ *
+ * Return: 0 on success, -ENOMEM if the per cpu memory can't be allocated.
+ */
+int alloc_dlock_list_heads(struct dlock_list_heads *dlist)
+{
+	int cpu;
+
+	dlist->heads = alloc_percpu(struct dlock_list_head);
+	if (!dlist->heads)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		struct dlock_list_head *head = per_cpu_ptr(dlist->heads, cpu);
+
+		INIT_LIST_HEAD(&head->list);
+		spin_lock_init(&head->lock);
+	}
+	return 0;
+}
+EXPORT_SYMBOL(alloc_dlock_list_heads);
+
+/**
+ * free_dlock_list_heads - free the per cpu lists
+ * @dlist: dlock list to free, all its lists must be empty
+ */
+void free_dlock_list_heads(struct dlock_list_heads *dlist)
+{
+	free_percpu(dlist->heads);
+	dlist->heads = NULL;
+}
+EXPORT_SYMBOL(free_dlock_list_heads);
+
+/**
+ * dlock_lists_empty - check if all the per cpu lists are empty
+ * @dlist: dlock list to check
+ *
+ * This is done without taking the locks, so the answer is only stable if
+ * the caller otherwise prevents additions.
+ */
+bool dlock_lists_empty(struct dlock_list_heads *dlist)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		if (!list_empty(&per_cpu_ptr(dlist->heads, cpu)->list))
+			return false;
+	return true;
+}
+EXPORT_SYMBOL(dlock_lists_empty);
+
+/**
+ * dlock_lists_add - add a node to the list of the local cpu
+ * @node: node to add
+ * @dlist: dlock list to add it to
+ */
+void dlock_lists_add(struct dlock_list_node *node,
+		     struct dlock_list_heads *dlist)
+{
+	/* Migrating after picking the list is harmless, it is only locality */
+	struct dlock_list_head *head = raw_cpu_ptr(dlist->heads);
+
+	spin_lock(&head->lock);
+	node->head = head;
+	list_add(&node->list, &head->list);
+	spin_unlock(&head->lock);
+}
+EXPORT_SYMBOL(dlock_lists_add);
+
+/**
+ * dlock_lists_del - delete a node from the list it is on
+ * @node: node to delete
+ *
+ * The node may be on the list of any cpu.  Concurrent deletions of the
+ * same node are not allowed.
+ */
+void dlock_lists_del(struct dlock_list_node *node)
+{
+	struct dlock_list_head *head = node->head;
+
+	if (WARN_ON_ONCE(!head))
+		return;
+
+	spin_lock(&head->lock);
+	list_del_init(&node->list);
+	node->head = NULL;
+	spin_unlock(&head->lock);
+}
+EXPORT_SYMBOL(dlock_lists_del);
+
+/**
+ * __dlock_list_next_list - move an iterator to the next non-empty list
+ * @iter: the dlock list iterator
+ *
+ * Drops the lock of the list the iterator was on, if any, and takes the
+ * lock of the next non-empty one.
+ *
+ * Return: the first node of that list, or NULL when all lists are done.
+ */
+struct dlock_list_node *__dlock_list_next_list(struct dlock_list_iter *iter)
+{
+	struct dlock_list_head *head;
+
+	if (iter->entry) {
+		spin_unlock(&iter->entry->lock);
+		iter->entry = NULL;
+	}
+
+	for (;;) {
+		iter->cpu = cpumask_next(iter->cpu, cpu_possible_mask);
+		if (iter->cpu >= nr_cpu_ids)
+			return NULL;
+
+		head = per_cpu_ptr(iter->heads->heads, iter->cpu);
+		/* Don't bother taking the lock of an empty list */
+		if (list_empty(&head->list))
+			continue;
+
+		spin_lock(&head->lock);
+		if (!list_empty(&head->list))
+			break;
+		spin_unlock(&head->lock);
+	}
+
+	iter->entry = head;
+	return list_first_entry(&head->list, struct dlock_list_node, list);
+}
+EXPORT_SYMBOL(__dlock_list_next_list);
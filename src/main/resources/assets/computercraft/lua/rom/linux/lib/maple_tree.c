@@ -0,0 +1,602 @@
+/*
+ * Maple tree - a B-tree of non-overlapping ranges
+ *
+ * The tree is modified copy-on-write: a change builds new copies of the
+ * nodes from the affected leaf up to the root, publishes the new root and
+ * frees the replaced nodes after an RCU grace period.  Readers therefore
+ * always see a consistent tree without taking any lock, and writers only
+ * serialise against each other.
+ *
+ * Nodes are allocated before ma_lock is taken, for the worst case of the
+ * current height: two nodes per level plus a new root on insertion (every
+ * level splits), and a copy plus a merge per level on erase.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/bug.h>
+#include <linux/export.h>
+#include <linux/init.h>
+#include <linux/maple_tree.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+/* 16^16 ranges; each level is at least a quarter full in practice */
+#define MT_MAX_HEIGHT		16
+/* An erase merges a node this sparse with a neighbour if they fit in one */
+#define MT_MERGE_THRESHOLD	(MAPLE_NODE_SLOTS / 4)
+
+#define mt_dereference(mt, p) \
+	rcu_dereference_protected(p, lockdep_is_held(&(mt)->ma_lock))
+
+static struct kmem_cache *maple_node_cache __read_mostly;
+
+struct mt_alloc {
+	struct maple_node	*head;
+	unsigned int		count;
+};
+
+struct mt_entry {
+	unsigned long		min;
+	unsigned long		max;
+	void			*slot;
+};
+
+static int mt_alloc_fill(struct mt_alloc *alloc, unsigned int nr, gfp_t gfp)
+{
+	struct maple_node *node;
+
+	while (alloc->count < nr) {
+		node = kmem_cache_alloc(maple_node_cache, gfp);
+		if (!node)
+			return -ENOMEM;
+		node->next_free = alloc->head;
+		alloc->head = node;
+		alloc->count++;
+	}
+	return 0;
+}
+
+static void mt_alloc_drain(struct mt_alloc *alloc)
+{
+	struct maple_node *node;
+
+	while ((node = alloc->head)) {
+		alloc->head = node->next_free;
+		kmem_cache_free(maple_node_cache, node);
+	}
+	alloc->count = 0;
+}
+
+static struct maple_node *mt_node_get(struct mt_alloc *alloc)
+{
+	struct maple_node *node = alloc->head;
+
+	BUG_ON(!node);
+	alloc->head = node->next_free;
+	alloc->count--;
+	return node;
+}
+
+/* Give back a node that was never published */
+static void mt_node_put(struct mt_alloc *alloc, struct maple_node *node)
+{
+	node->next_free = alloc->head;
+	alloc->head = node;
+	alloc->count++;
+}
+
+static void mt_free_rcu(struct rcu_head *head)
+{
+	kmem_cache_free(maple_node_cache,
+			container_of(head, struct maple_node, rcu));
+}
+
+/*
+ * Readers never look at ->next_free, so replaced nodes can be chained
+ * through it until the new root is published.
+ */
+static void mt_node_retire(struct maple_node **dead, struct maple_node *node)
+{
+	node->next_free = *dead;
+	*dead = node;
+}
+
+static void mt_free_retired(struct maple_node *dead)
+{
+	struct maple_node *next;
+
+	for (; dead; dead = next) {
+		next = dead->next_free;
+		call_rcu(&dead->rcu, mt_free_rcu);
+	}
+}
+
+static void mt_publish(struct maple_tree *mt, struct maple_node *root,
+		       unsigned int height, struct maple_node *dead)
+{
+	mt->ma_height = height;
+	rcu_assign_pointer(mt->ma_root, root);
+	mt_free_retired(dead);
+}
+
+static inline struct mt_entry mt_node_entry(const struct maple_node *node,
+					    unsigned int i)
+{
+	struct mt_entry e = {
+		.min = node->min[i],
+		.max = node->max[i],
+		.slot = rcu_dereference_raw(node->slot[i]),
+	};
+
+	return e;
+}
+
+/* The entry an internal node keeps for @child */
+static inline struct mt_entry mt_child_entry(struct maple_node *child)
+{
+	struct mt_entry e = {
+		.min = child->min[0],
+		.max = child->max[child->nr - 1],
+		.slot = child,
+	};
+
+	return e;
+}
+
+static struct maple_node *mt_node_fill(struct mt_alloc *alloc, bool leaf,
+				       const struct mt_entry *e,
+				       unsigned int nr)
+{
+	struct maple_node *node = mt_node_get(alloc);
+	unsigned int i;
+
+	node->leaf = leaf;
+	node->nr = nr;
+	for (i = 0; i < nr; i++) {
+		node->min[i] = e[i].min;
+		node->max[i] = e[i].max;
+		RCU_INIT_POINTER(node->slot[i], e[i].slot);
+	}
+	return node;
+}
+
+/*
+ * Build the replacement of @old: its slots with [@pos, @pos + @skip)
+ * replaced by the @n entries of @ins.  Returns the number of nodes written
+ * to @out, which is 0 if nothing is left and 2 if the result had to be
+ * split.  @ins adds at most one slot more than it removes.
+ */
+static unsigned int mt_rebuild(const struct maple_node *old, unsigned int pos,
+			       unsigned int skip, const struct mt_entry *ins,
+			       unsigned int n, struct mt_alloc *alloc,
+			       struct maple_node **out)
+{
+	struct mt_entry e[MAPLE_NODE_SLOTS + 1];
+	unsigned int i, nr = 0, split;
+
+	for (i = 0; i < pos; i++)
+		e[nr++] = mt_node_entry(old, i);
+	for (i = 0; i < n; i++)
+		e[nr++] = ins[i];
+	for (i = pos + skip; i < old->nr; i++)
+		e[nr++] = mt_node_entry(old, i);
+
+	if (!nr)
+		return 0;
+
+	split = nr > MAPLE_NODE_SLOTS ? nr / 2 : nr;
+	out[0] = mt_node_fill(alloc, old->leaf, e, split);
+	if (split == nr)
+		return 1;
+
+	out[1] = mt_node_fill(alloc, old->leaf, e + split, nr - split);
+	return 2;
+}
+
+/* Index of the first slot of @node ending at or after @index */
+static inline unsigned int mt_node_find(const struct maple_node *node,
+					unsigned long index)
+{
+	unsigned int i;
+
+	for (i = 0; i < node->nr; i++)
+		if (node->max[i] >= index)
+			break;
+	return i;
+}
+
+/*
+ * Find the first entry ending at or after @index.  Every entry of the
+ * children before the one chosen at each level ends before @index, so
+ * that entry is in the chosen child.
+ */
+static void *mt_walk(struct maple_tree *mt, unsigned long index,
+		     unsigned long *first, unsigned long *last)
+{
+	struct maple_node *node;
+	unsigned int i;
+
+	node = rcu_dereference_check(mt->ma_root,
+				     lockdep_is_held(&mt->ma_lock));
+	while (node) {
+		i = mt_node_find(node, index);
+		if (i == node->nr)
+			return NULL;
+		if (node->leaf) {
+			*first = node->min[i];
+			*last = node->max[i];
+			return rcu_dereference_check(node->slot[i],
+					lockdep_is_held(&mt->ma_lock));
+		}
+		node = rcu_dereference_check(node->slot[i],
+					     lockdep_is_held(&mt->ma_lock));
+	}
+	return NULL;
+}
+
+/**
+ * mtree_load() - look up the entry covering an index
+ * @mt: maple tree
+ * @index: index to look up
+ *
+ * Context: Any context.  Takes and releases the RCU lock.
+ * Return: The entry whose range contains @index, or %NULL.
+ */
+void *mtree_load(struct maple_tree *mt, unsigned long index)
+{
+	unsigned long first, last;
+	void *entry;
+
+	rcu_read_lock();
+	entry = mt_walk(mt, index, &first, &last);
+	if (entry && first > index)
+		entry = NULL;
+	rcu_read_unlock();
+
+	return entry;
+}
+EXPORT_SYMBOL(mtree_load);
+
+/**
+ * mt_find() - find the first entry overlapping a range
+ * @mt: maple tree
+ * @index: pointer to the first index of the range; updated
+ * @max: last index of the range
+ *
+ * This is the lookup find_vma() needs: the entry containing *@index or,
+ * failing that, the next one.  On success *@index is set to the first
+ * index of the entry, which may be below the index passed in.
+ *
+ * Context: Any context.  Takes and releases the RCU lock.
+ * Return: The entry, or %NULL if none overlaps [*@index, @max].
+ */
+void *mt_find(struct maple_tree *mt, unsigned long *index, unsigned long max)
+{
+	unsigned long first, last;
+	void *entry;
+
+	rcu_read_lock();
+	entry = mt_walk(mt, *index, &first, &last);
+	rcu_read_unlock();
+
+	if (!entry || first > max)
+		return NULL;
+
+	*index = first;
+	return entry;
+}
+EXPORT_SYMBOL(mt_find);
+
+/**
+ * mt_find_after() - find the next entry
+ * @mt: maple tree
+ * @index: pointer to the first index of the previous entry; updated
+ * @max: last index to look at
+ *
+ * Context: Any context.  Takes and releases the RCU lock.
+ * Return: The first entry starting after *@index and no later than @max,
+ * or %NULL.
+ */
+void *mt_find_after(struct maple_tree *mt, unsigned long *index,
+		    unsigned long max)
+{
+	unsigned long start = *index, first = 0, last = 0;
+	void *entry = NULL;
+
+	rcu_read_lock();
+	while (start < max) {
+		entry = mt_walk(mt, start + 1, &first, &last);
+		/* Skip the previous entry if it extends past *index */
+		if (!entry || first > *index)
+			break;
+		start = last;
+		entry = NULL;
+	}
+	rcu_read_unlock();
+
+	if (!entry || first > max)
+		return NULL;
+
+	*index = first;
+	return entry;
+}
+EXPORT_SYMBOL(mt_find_after);
+
+static int __mt_insert(struct maple_tree *mt, unsigned long first,
+		       unsigned long last, void *entry,
+		       struct mt_alloc *alloc)
+{
+	struct maple_node *path[MT_MAX_HEIGHT], *out[2], *node, *dead = NULL;
+	unsigned int offset[MT_MAX_HEIGHT];
+	struct mt_entry ins[2];
+	unsigned int height = mt->ma_height, level, i, n;
+
+	ins[0].min = first;
+	ins[0].max = last;
+	ins[0].slot = entry;
+
+	node = mt_dereference(mt, mt->ma_root);
+	if (!node) {
+		node = mt_node_fill(alloc, true, ins, 1);
+		mt_publish(mt, node, 1, NULL);
+		return 0;
+	}
+
+	for (level = 0; ; level++) {
+		i = mt_node_find(node, first);
+		path[level] = node;
+		offset[level] = i;
+		if (node->leaf)
+			break;
+		/* Past the last range: append to the last child */
+		if (i == node->nr)
+			offset[level] = --i;
+		node = mt_dereference(mt, node->slot[i]);
+	}
+
+	/* The first entry ending at or after @first must start after @last */
+	if (i < node->nr && node->min[i] <= last)
+		return -EEXIST;
+
+	/* A full root might have to split; refuse before touching anything */
+	if (WARN_ON_ONCE(height == MT_MAX_HEIGHT &&
+			 path[0]->nr == MAPLE_NODE_SLOTS))
+		return -ENOSPC;
+
+	n = mt_rebuild(node, i, 0, ins, 1, alloc, out);
+	mt_node_retire(&dead, node);
+
+	while (level--) {
+		node = path[level];
+		for (i = 0; i < n; i++)
+			ins[i] = mt_child_entry(out[i]);
+		n = mt_rebuild(node, offset[level], 1, ins, n, alloc, out);
+		mt_node_retire(&dead, node);
+	}
+
+	if (n == 2) {
+		ins[0] = mt_child_entry(out[0]);
+		ins[1] = mt_child_entry(out[1]);
+		out[0] = mt_node_fill(alloc, false, ins, 2);
+		height++;
+	}
+
+	mt_publish(mt, out[0], height, dead);
+	return 0;
+}
+
+/**
+ * mtree_insert_range() - insert an entry covering a range
+ * @mt: maple tree
+ * @first: first index covered by @entry
+ * @last: last index covered by @entry
+ * @entry: entry to insert, must not be %NULL
+ * @gfp: allocation flags
+ *
+ * Context: Process context if @gfp allows blocking.  Takes and releases
+ * ma_lock, which is not irq-safe.
+ * Return: 0 on success, -EEXIST if any index of the range is in use,
+ * -ENOMEM or -EINVAL.
+ */
+int mtree_insert_range(struct maple_tree *mt, unsigned long first,
+		       unsigned long last, void *entry, gfp_t gfp)
+{
+	struct mt_alloc alloc = { };
+	unsigned int need;
+	int ret;
+
+	if (WARN_ON_ONCE(first > last || !entry))
+		return -EINVAL;
+
+	spin_lock(&mt->ma_lock);
+	while (alloc.count < (need = 2 * mt->ma_height + 1)) {
+		spin_unlock(&mt->ma_lock);
+		ret = mt_alloc_fill(&alloc, need, gfp);
+		spin_lock(&mt->ma_lock);
+		if (ret)
+			goto out;
+	}
+	ret = __mt_insert(mt, first, last, entry, &alloc);
+out:
+	spin_unlock(&mt->ma_lock);
+	mt_alloc_drain(&alloc);
+
+	return ret;
+}
+EXPORT_SYMBOL(mtree_insert_range);
+
+/*
+ * Merge the freshly built, sparse child at @pos of @parent with a neighbour
+ * if both fit in one node.  On success *@pos and *@skip describe the two
+ * parent slots the merged node replaces.
+ */
+static struct maple_node *mt_merge(struct maple_node *parent,
+				   struct maple_node *child,
+				   unsigned int *pos, unsigned int *skip,
+				   struct mt_alloc *alloc,
+				   struct maple_node **dead)
+{
+	struct maple_node *sibling, *left, *right, *merged;
+	struct mt_entry e[MAPLE_NODE_SLOTS];
+	unsigned int i, nr = 0, sib;
+
+	if (child->nr >= MT_MERGE_THRESHOLD || parent->nr < 2)
+		return child;
+
+	sib = *pos + 1 < parent->nr ? *pos + 1 : *pos - 1;
+	sibling = rcu_dereference_raw(parent->slot[sib]);
+	if (child->nr + sibling->nr > MAPLE_NODE_SLOTS)
+		return child;
+
+	left = sib < *pos ? sibling : child;
+	right = sib < *pos ? child : sibling;
+	for (i = 0; i < left->nr; i++)
+		e[nr++] = mt_node_entry(left, i);
+	for (i = 0; i < right->nr; i++)
+		e[nr++] = mt_node_entry(right, i);
+
+	mt_node_put(alloc, child);
+	merged = mt_node_fill(alloc, sibling->leaf, e, nr);
+	mt_node_retire(dead, sibling);
+
+	*pos = min(*pos, sib);
+	*skip = 2;
+	return merged;
+}
+
+static void *__mt_erase(struct maple_tree *mt, unsigned long index,
+			struct mt_alloc *alloc)
+{
+	struct maple_node *path[MT_MAX_HEIGHT], *out[2], *node, *dead = NULL;
+	unsigned int offset[MT_MAX_HEIGHT];
+	unsigned int height = mt->ma_height, level, i, n, pos, skip;
+	struct mt_entry ins;
+	void *entry;
+
+	node = mt_dereference(mt, mt->ma_root);
+	if (!node)
+		return NULL;
+
+	for (level = 0; ; level++) {
+		i = mt_node_find(node, index);
+		if (i == node->nr)
+			return NULL;
+		path[level] = node;
+		offset[level] = i;
+		if (node->leaf)
+			break;
+		node = mt_dereference(mt, node->slot[i]);
+	}
+
+	if (node->min[i] > index)
+		return NULL;
+	entry = mt_dereference(mt, node->slot[i]);
+
+	n = mt_rebuild(node, i, 1, NULL, 0, alloc, out);
+	mt_node_retire(&dead, node);
+
+	while (level--) {
+		node = path[level];
+		pos = offset[level];
+		skip = 1;
+		if (n) {
+			out[0] = mt_merge(node, out[0], &pos, &skip, alloc,
+					  &dead);
+			ins = mt_child_entry(out[0]);
+		}
+		n = mt_rebuild(node, pos, skip, &ins, n, alloc, out);
+		mt_node_retire(&dead, node);
+	}
+
+	if (!n) {
+		mt_publish(mt, NULL, 0, dead);
+		return entry;
+	}
+
+	/* Drop internal roots with a single child */
+	node = out[0];
+	while (!node->leaf && node->nr == 1) {
+		struct maple_node *child = rcu_dereference_raw(node->slot[0]);
+
+		mt_node_put(alloc, node);
+		node = child;
+		height--;
+	}
+
+	mt_publish(mt, node, height, dead);
+	return entry;
+}
+
+/**
+ * mtree_erase() - erase the entry covering an index
+ * @mt: maple tree
+ * @index: any index of the entry to erase
+ *
+ * The whole range of the entry is erased.
+ *
+ * Context: Process context; may sleep to allocate the new nodes.  Takes
+ * and releases ma_lock.
+ * Return: The erased entry, or %NULL if @index was not covered.
+ */
+void *mtree_erase(struct maple_tree *mt, unsigned long index)
+{
+	struct mt_alloc alloc = { };
+	unsigned int need;
+	void *entry;
+
+	spin_lock(&mt->ma_lock);
+	while (alloc.count < (need = 2 * mt->ma_height)) {
+		spin_unlock(&mt->ma_lock);
+		mt_alloc_fill(&alloc, need, GFP_KERNEL | __GFP_NOFAIL);
+		spin_lock(&mt->ma_lock);
+	}
+	entry = __mt_erase(mt, index, &alloc);
+	spin_unlock(&mt->ma_lock);
+	mt_alloc_drain(&alloc);
+
+	return entry;
+}
+EXPORT_SYMBOL(mtree_erase);
+
+static void mt_free_subtree(struct maple_node *node)
+{
+	unsigned int i;
+
+	if (!node->leaf)
+		for (i = 0; i < node->nr; i++)
+			mt_free_subtree(rcu_dereference_raw(node->slot[i]));
+	call_rcu(&node->rcu, mt_free_rcu);
+}
+
+/**
+ * mtree_destroy() - erase every entry of a maple tree
+ * @mt: maple tree
+ *
+ * The entries themselves are not freed.  Readers that are still walking
+ * the tree are safe; the nodes are freed after a grace period.
+ *
+ * Context: Takes and releases ma_lock.
+ */
+void mtree_destroy(struct maple_tree *mt)
+{
+	struct maple_node *root;
+
+	spin_lock(&mt->ma_lock);
+	root = mt_dereference(mt, mt->ma_root);
+	mt->ma_height = 0;
+	RCU_INIT_POINTER(mt->ma_root, NULL);
+	if (root)
+		mt_free_subtree(root);
+	spin_unlock(&mt->ma_lock);
+}
+EXPORT_SYMBOL(mtree_destroy);
+
+void __init maple_tree_init(void)
+{
+	maple_node_cache = kmem_cache_create("maple_node",
+					     sizeof(struct maple_node), 0,
+					     SLAB_PANIC, NULL);
+}
@@ -32,6 +32,7 @@
 #define HASH_DEFAULT_SIZE	64UL
 #define HASH_MIN_SIZE		4U
 #define BUCKET_LOCKS_PER_CPU	32UL
+#define RHT_REHASH_BATCH	1024U
 
 union nested_table {
 	union nested_table __rcu *table;
@@ -263,9 +264,10 @@ static struct bucket_table *rhashtable_last_table(struct rhashtable *ht,
 	return new_tbl;
 }
 
-static int rhashtable_rehash_one(struct rhashtable *ht, unsigned int old_hash)
+static int rhashtable_rehash_one(struct rhashtable *ht,
+				 struct bucket_table *old_tbl,
+				 unsigned int old_hash)
 {
-	struct bucket_table *old_tbl = rht_dereference(ht->tbl, ht);
 	struct bucket_table *new_tbl = rhashtable_last_table(ht,
 		rht_dereference_rcu(old_tbl->future_tbl, ht));
 	struct rhash_head __rcu **pprev = rht_bucket_var(old_tbl, old_hash);
@@ -311,28 +313,60 @@ out:
 	return err;
 }
 
+/*
+ * Buckets are rehashed in order, by the deferred worker and by inserters
+ * lending a hand. ->rehash only ever moves past a bucket under that bucket's
+ * lock, so whoever finds it still pointing at @old_hash once holding the
+ * lock owns the bucket.
+ */
 static int rhashtable_rehash_chain(struct rhashtable *ht,
-				    unsigned int old_hash)
+				   struct bucket_table *old_tbl,
+				   unsigned int old_hash)
 {
-	struct bucket_table *old_tbl = rht_dereference(ht->tbl, ht);
 	spinlock_t *old_bucket_lock;
-	int err;
+	int err = 0;
 
 	old_bucket_lock = rht_bucket_lock(old_tbl, old_hash);
 
 	spin_lock_bh(old_bucket_lock);
-	while (!(err = rhashtable_rehash_one(ht, old_hash)))
+	if (old_tbl->rehash != old_hash)
+		goto out;
+
+	while (!(err = rhashtable_rehash_one(ht, old_tbl, old_hash)))
 		;
 
 	if (err == -ENOENT) {
-		old_tbl->rehash++;
+		WRITE_ONCE(old_tbl->rehash, old_hash + 1);
 		err = 0;
 	}
+out:
 	spin_unlock_bh(old_bucket_lock);
 
 	return err;
 }
 
+/*
+ * Move up to ht->p.rehash_assist buckets of a pending rehash from the insert
+ * slow path, so that growth is spread over the inserts causing it rather than
+ * left entirely to the worker. Must be called under rcu_read_lock().
+ */
+static void rhashtable_rehash_assist(struct rhashtable *ht)
+{
+	struct bucket_table *tbl = rht_dereference_rcu(ht->tbl, ht);
+	unsigned int n = ht->p.rehash_assist;
+	unsigned int old_hash;
+
+	if (!rcu_access_pointer(tbl->future_tbl))
+		return;
+
+	while (n--) {
+		old_hash = READ_ONCE(tbl->rehash);
+		if (old_hash >= tbl->size ||
+		    rhashtable_rehash_chain(ht, tbl, old_hash))
+			break;
+	}
+}
+
 static int rhashtable_rehash_attach(struct rhashtable *ht,
 				    struct bucket_table *old_tbl,
 				    struct bucket_table *new_tbl)
@@ -368,10 +402,14 @@ static int rhashtable_rehash_table(struct rhashtable *ht)
 	if (!new_tbl)
 		return 0;
 
-	for (old_hash = 0; old_hash < old_tbl->size; old_hash++) {
-		err = rhashtable_rehash_chain(ht, old_hash);
+	while ((old_hash = READ_ONCE(old_tbl->rehash)) < old_tbl->size) {
+		err = rhashtable_rehash_chain(ht, old_tbl, old_hash);
 		if (err)
 			return err;
+
+		/* Keep huge tables from hogging the CPU */
+		if (!(old_hash % RHT_REHASH_BATCH))
+			cond_resched();
 	}
 
 	/* Publish the new table pointer. */
@@ -681,6 +719,8 @@ void *rhashtable_insert_slow(struct rhashtable *ht, const void *key,
 
 	do {
 		rcu_read_lock();
+		if (ht->p.rehash_assist)
+			rhashtable_rehash_assist(ht);
 		data = rhashtable_try_insert(ht, key, obj);
 		rcu_read_unlock();
 	} while (PTR_ERR(data) == -EAGAIN);
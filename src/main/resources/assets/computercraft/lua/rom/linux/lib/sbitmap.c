@@ -64,11 +64,30 @@ int sbitmap_init_node(struct sbitmap *sb, unsigned int depth, int shift,
 }
 EXPORT_SYMBOL_GPL(sbitmap_init_node);
 
+/*
+ * Fold the bits freed with sbitmap_deferred_clear_bit() back into the word.
+ * Returns true if there were any, i.e. if it's worth searching the word again.
+ */
+static bool sbitmap_deferred_clear(struct sbitmap_word *map)
+{
+	unsigned long mask;
+
+	if (!READ_ONCE(map->cleared))
+		return false;
+
+	mask = xchg(&map->cleared, 0);
+	atomic_long_andnot(mask, (atomic_long_t *)&map->word);
+	return true;
+}
+
 void sbitmap_resize(struct sbitmap *sb, unsigned int depth)
 {
 	unsigned int bits_per_word = 1U << sb->shift;
 	unsigned int i;
 
+	for (i = 0; i < sb->map_nr; i++)
+		sbitmap_deferred_clear(&sb->map[i]);
+
 	sb->depth = depth;
 	sb->map_nr = DIV_ROUND_UP(sb->depth, bits_per_word);
 
@@ -111,6 +130,20 @@ static int __sbitmap_get_word(unsigned long *word, unsigned long depth,
 	return nr;
 }
 
+static int sbitmap_get_word(struct sbitmap_word *map, unsigned long depth,
+			    unsigned int hint, bool wrap)
+{
+	int nr;
+
+	do {
+		nr = __sbitmap_get_word(&map->word, depth, hint, wrap);
+		if (nr != -1)
+			break;
+	} while (sbitmap_deferred_clear(map));
+
+	return nr;
+}
+
 int sbitmap_get(struct sbitmap *sb, unsigned int alloc_hint, bool round_robin)
 {
 	unsigned int i, index;
@@ -119,10 +152,9 @@ int sbitmap_get(struct sbitmap *sb, unsigned int alloc_hint, bool round_robin)
 	index = SB_NR_TO_INDEX(sb, alloc_hint);
 
 	for (i = 0; i < sb->map_nr; i++) {
-		nr = __sbitmap_get_word(&sb->map[index].word,
-					sb->map[index].depth,
-					SB_NR_TO_BIT(sb, alloc_hint),
-					!round_robin);
+		nr = sbitmap_get_word(&sb->map[index], sb->map[index].depth,
+				      SB_NR_TO_BIT(sb, alloc_hint),
+				      !round_robin);
 		if (nr != -1) {
 			nr += index << sb->shift;
 			break;
@@ -151,9 +183,9 @@ int sbitmap_get_shallow(struct sbitmap *sb, unsigned int alloc_hint,
 	index = SB_NR_TO_INDEX(sb, alloc_hint);
 
 	for (i = 0; i < sb->map_nr; i++) {
-		nr = __sbitmap_get_word(&sb->map[index].word,
-					min(sb->map[index].depth, shallow_depth),
-					SB_NR_TO_BIT(sb, alloc_hint), true);
+		nr = sbitmap_get_word(&sb->map[index],
+				      min(sb->map[index].depth, shallow_depth),
+				      SB_NR_TO_BIT(sb, alloc_hint), true);
 		if (nr != -1) {
 			nr += index << sb->shift;
 			break;
@@ -178,7 +210,7 @@ bool sbitmap_any_bit_set(const struct sbitmap *sb)
 	unsigned int i;
 
 	for (i = 0; i < sb->map_nr; i++) {
-		if (sb->map[i].word)
+		if (sb->map[i].word & ~sb->map[i].cleared)
 			return true;
 	}
 	return false;
@@ -191,9 +223,10 @@ bool sbitmap_any_bit_clear(const struct sbitmap *sb)
 
 	for (i = 0; i < sb->map_nr; i++) {
 		const struct sbitmap_word *word = &sb->map[i];
+		unsigned long val = word->word & ~word->cleared;
 		unsigned long ret;
 
-		ret = find_first_zero_bit(&word->word, word->depth);
+		ret = find_first_zero_bit(&val, word->depth);
 		if (ret < word->depth)
 			return true;
 	}
@@ -207,8 +240,9 @@ unsigned int sbitmap_weight(const struct sbitmap *sb)
 
 	for (i = 0; i < sb->map_nr; i++) {
 		const struct sbitmap_word *word = &sb->map[i];
+		unsigned long val = word->word & ~word->cleared;
 
-		weight += bitmap_weight(&word->word, word->depth);
+		weight += bitmap_weight(&val, word->depth);
 	}
 	return weight;
 }
@@ -243,7 +277,8 @@ void sbitmap_bitmap_show(struct sbitmap *sb, struct seq_file *m)
 	int i;
 
 	for (i = 0; i < sb->map_nr; i++) {
-		unsigned long word = READ_ONCE(sb->map[i].word);
+		unsigned long word = READ_ONCE(sb->map[i].word) &
+				     ~READ_ONCE(sb->map[i].cleared);
 		unsigned int word_bits = READ_ONCE(sb->map[i].depth);
 
 		while (word_bits > 0) {
@@ -403,6 +438,56 @@ int __sbitmap_queue_get_shallow(struct sbitmap_queue *sbq,
 }
 EXPORT_SYMBOL_GPL(__sbitmap_queue_get_shallow);
 
+unsigned long __sbitmap_queue_get_batch(struct sbitmap_queue *sbq, int nr_tags,
+					unsigned int *offset)
+{
+	struct sbitmap *sb = &sbq->sb;
+	unsigned int hint, depth, index, i;
+
+	if (unlikely(sbq->round_robin))
+		return 0;
+
+	hint = this_cpu_read(*sbq->alloc_hint);
+	depth = READ_ONCE(sb->depth);
+	if (unlikely(hint >= depth))
+		hint = 0;
+	index = SB_NR_TO_INDEX(sb, hint);
+
+	for (i = 0; i < sb->map_nr; i++) {
+		struct sbitmap_word *map = &sb->map[index];
+		unsigned long val, get_mask;
+		unsigned int nr, n;
+
+		nr = find_first_zero_bit(&map->word, map->depth);
+		if (nr >= map->depth && sbitmap_deferred_clear(map))
+			nr = find_first_zero_bit(&map->word, map->depth);
+		if (nr < map->depth) {
+			n = min_t(unsigned int, nr_tags, map->depth - nr);
+			get_mask = (~0UL >> (BITS_PER_LONG - n)) << nr;
+			do {
+				val = READ_ONCE(map->word);
+			} while (atomic_long_cmpxchg((atomic_long_t *)&map->word,
+						     val, val | get_mask) != val);
+
+			/* Someone else may have grabbed some of them meanwhile */
+			get_mask = (get_mask & ~val) >> nr;
+			if (get_mask) {
+				*offset = nr + (index << sb->shift);
+				hint = *offset + n;
+				this_cpu_write(*sbq->alloc_hint,
+					       hint >= depth - 1 ? 0 : hint);
+				return get_mask;
+			}
+		}
+
+		if (++index >= sb->map_nr)
+			index = 0;
+	}
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(__sbitmap_queue_get_batch);
+
 static struct sbq_wait_state *sbq_wake_ptr(struct sbitmap_queue *sbq)
 {
 	int i, wake_index;
@@ -425,24 +510,16 @@ static struct sbq_wait_state *sbq_wake_ptr(struct sbitmap_queue *sbq)
 	return NULL;
 }
 
-static void sbq_wake_up(struct sbitmap_queue *sbq)
+/* Account one freed bit, returns false if nobody is waiting */
+static bool __sbq_wake_up(struct sbitmap_queue *sbq)
 {
 	struct sbq_wait_state *ws;
 	unsigned int wake_batch;
 	int wait_cnt;
 
-	/*
-	 * Pairs with the memory barrier in set_current_state() to ensure the
-	 * proper ordering of clear_bit()/waitqueue_active() in the waker and
-	 * test_and_set_bit()/prepare_to_wait()/finish_wait() in the waiter. See
-	 * the comment on waitqueue_active(). This is __after_atomic because we
-	 * just did clear_bit() in the caller.
-	 */
-	smp_mb__after_atomic();
-
 	ws = sbq_wake_ptr(sbq);
 	if (!ws)
-		return;
+		return false;
 
 	wait_cnt = atomic_dec_return(&ws->wait_cnt);
 	if (wait_cnt <= 0) {
@@ -464,18 +541,81 @@ static void sbq_wake_up(struct sbitmap_queue *sbq)
 		sbq_index_atomic_inc(&sbq->wake_index);
 		wake_up(&ws->wait);
 	}
+
+	return true;
+}
+
+static void sbq_wake_up(struct sbitmap_queue *sbq)
+{
+	/*
+	 * Pairs with the memory barrier in set_current_state() to ensure the
+	 * proper ordering of clear_bit()/waitqueue_active() in the waker and
+	 * test_and_set_bit()/prepare_to_wait()/finish_wait() in the waiter. See
+	 * the comment on waitqueue_active(). This is __after_atomic because we
+	 * just did clear_bit() in the caller.
+	 */
+	smp_mb__after_atomic();
+
+	__sbq_wake_up(sbq);
 }
 
 void sbitmap_queue_clear(struct sbitmap_queue *sbq, unsigned int nr,
 			 unsigned int cpu)
 {
-	sbitmap_clear_bit(&sbq->sb, nr);
+	/*
+	 * Once the cleared bit is set the bit may be handed out again, so
+	 * order the caller's accesses to whatever the bit protects before it.
+	 * Pairs with the barrier implied by test_and_set_bit() in
+	 * __sbitmap_get_word().
+	 */
+	smp_mb__before_atomic();
+	sbitmap_deferred_clear_bit(&sbq->sb, nr);
 	sbq_wake_up(sbq);
 	if (likely(!sbq->round_robin && nr < sbq->sb.depth))
 		*per_cpu_ptr(sbq->alloc_hint, cpu) = nr;
 }
 EXPORT_SYMBOL_GPL(sbitmap_queue_clear);
 
+void sbitmap_queue_clear_batch(struct sbitmap_queue *sbq, int offset,
+			       int *tags, int nr_tags)
+{
+	struct sbitmap *sb = &sbq->sb;
+	unsigned long *addr = NULL;
+	unsigned long mask = 0;
+	int i;
+
+	/* See sbitmap_queue_clear() */
+	smp_mb__before_atomic();
+
+	/*
+	 * Free runs of bits that share a word with a single atomic op on the
+	 * word's cleared mask.
+	 */
+	for (i = 0; i < nr_tags; i++) {
+		const int nr = tags[i] - offset;
+		unsigned long *this_addr;
+
+		this_addr = &sb->map[SB_NR_TO_INDEX(sb, nr)].cleared;
+
+		if (this_addr != addr) {
+			if (mask)
+				atomic_long_or(mask, (atomic_long_t *)addr);
+			addr = this_addr;
+			mask = 0;
+		}
+		mask |= 1UL << SB_NR_TO_BIT(sb, nr);
+	}
+	if (mask)
+		atomic_long_or(mask, (atomic_long_t *)addr);
+
+	/* See sbq_wake_up(), one barrier covers the whole batch */
+	smp_mb__after_atomic();
+
+	while (nr_tags-- && __sbq_wake_up(sbq))
+		;
+}
+EXPORT_SYMBOL_GPL(sbitmap_queue_clear_batch);
+
 void sbitmap_queue_wake_all(struct sbitmap_queue *sbq)
 {
 	int i, wake_index;
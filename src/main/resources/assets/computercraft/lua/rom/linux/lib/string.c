@@ -469,6 +469,33 @@ char *strim(char *s)
 }
 EXPORT_SYMBOL(strim);
 
+/*
+ * The word-at-a-time scanners below only ever load aligned words, so they
+ * never touch a page the string doesn't reach into.  They may still read
+ * bytes just past the end of an object, which KASAN would report, hence
+ * the unchecked load.
+ */
+#define read_aligned_word(p)	READ_ONCE_NOCHECK(*(unsigned long *)(p))
+
+/* Set bits in the first 'n' bytes when loaded from memory */
+#ifdef __LITTLE_ENDIAN
+#  define aligned_byte_mask(n) ((1ul << 8*(n))-1)
+#else
+#  define aligned_byte_mask(n) (~0xfful << (BITS_PER_LONG - 8 - 8*(n)))
+#endif
+
+/*
+ * Return the byte offset of the first zero byte in a word that has_zero()
+ * reported on.
+ */
+static inline unsigned long first_zero_byte(unsigned long c, unsigned long data,
+					    const struct word_at_a_time *constants)
+{
+	data = prep_zero_mask(c, data, constants);
+	data = create_zero_mask(data);
+	return find_zero(data);
+}
+
 #ifndef __HAVE_ARCH_STRLEN
 /**
  * strlen - Find the length of a string
@@ -476,11 +503,18 @@ EXPORT_SYMBOL(strim);
  */
 size_t strlen(const char *s)
 {
-	const char *sc;
-
-	for (sc = s; *sc != '\0'; ++sc)
-		/* nothing */;
-	return sc - s;
+	const struct word_at_a_time constants = WORD_AT_A_TIME_CONSTANTS;
+	unsigned long align = (unsigned long)s & (sizeof(unsigned long) - 1);
+	const char *p = s - align;
+	unsigned long c, data;
+
+	/* Bytes before the start of the string must not look like a NUL */
+	c = read_aligned_word(p) | aligned_byte_mask(align);
+	while (!has_zero(c, &data, &constants)) {
+		p += sizeof(unsigned long);
+		c = read_aligned_word(p);
+	}
+	return p - s + first_zero_byte(c, data, &constants);
 }
 EXPORT_SYMBOL(strlen);
 #endif
@@ -493,11 +527,27 @@ EXPORT_SYMBOL(strlen);
  */
 size_t strnlen(const char *s, size_t count)
 {
-	const char *sc;
+	const struct word_at_a_time constants = WORD_AT_A_TIME_CONSTANTS;
+	unsigned long align = (unsigned long)s & (sizeof(unsigned long) - 1);
+	const char *p = s - align;
+	unsigned long c, data;
+	size_t len;
 
-	for (sc = s; count-- && *sc != '\0'; ++sc)
-		/* nothing */;
-	return sc - s;
+	if (!count)
+		return 0;
+
+	c = read_aligned_word(p) | aligned_byte_mask(align);
+	for (;;) {
+		if (has_zero(c, &data, &constants)) {
+			len = p - s + first_zero_byte(c, data, &constants);
+			return min(len, count);
+		}
+		p += sizeof(unsigned long);
+		/* Only load the next word if part of it is within @count */
+		if ((size_t)(p - s) >= count)
+			return count;
+		c = read_aligned_word(p);
+	}
 }
 EXPORT_SYMBOL(strnlen);
 #endif
@@ -764,6 +814,20 @@ __visible int memcmp(const void *cs, const void *ct, size_t count)
 	const unsigned char *su1, *su2;
 	int res = 0;
 
+	/*
+	 * Skip over equal words; the first word that differs is left to the
+	 * byte loop, which finds the byte that decides the sign.
+	 */
+	if (IS_ENABLED(CONFIG_HAVE_EFFICIENT_UNALIGNED_ACCESS) ||
+	    !(((unsigned long)cs | (unsigned long)ct) & (sizeof(long) - 1))) {
+		while (count >= sizeof(unsigned long) &&
+		       *(unsigned long *)cs == *(unsigned long *)ct) {
+			cs += sizeof(unsigned long);
+			ct += sizeof(unsigned long);
+			count -= sizeof(unsigned long);
+		}
+	}
+
 	for (su1 = cs, su2 = ct; 0 < count; ++su1, ++su2, count--)
 		if ((res = *su1 - *su2) != 0)
 			break;
@@ -859,13 +923,32 @@ EXPORT_SYMBOL(strnstr);
  */
 void *memchr(const void *s, int c, size_t n)
 {
-	const unsigned char *p = s;
-	while (n-- != 0) {
-        	if ((unsigned char)c == *p++) {
-			return (void *)(p - 1);
+	const struct word_at_a_time constants = WORD_AT_A_TIME_CONSTANTS;
+	unsigned long pattern = REPEAT_BYTE((unsigned char)c);
+	unsigned long align = (unsigned long)s & (sizeof(unsigned long) - 1);
+	const char *p = (const char *)s - align;
+	unsigned long val, data;
+	long off;
+
+	if (!n)
+		return NULL;
+
+	/*
+	 * XOR with the repeated byte turns every match into a zero byte;
+	 * the bytes in front of @s are forced non-zero.
+	 */
+	val = (read_aligned_word(p) ^ pattern) | aligned_byte_mask(align);
+	for (;;) {
+		if (has_zero(val, &data, &constants)) {
+			off = p - (const char *)s +
+			      first_zero_byte(val, data, &constants);
+			return (size_t)off < n ? (void *)s + off : NULL;
 		}
+		p += sizeof(unsigned long);
+		if ((size_t)(p - (const char *)s) >= n)
+			return NULL;
+		val = read_aligned_word(p) ^ pattern;
 	}
-	return NULL;
 }
 EXPORT_SYMBOL(memchr);
 #endif
@@ -30,6 +30,10 @@
 #include <linux/highmem.h>
 #include <linux/gfp.h>
 #include <linux/scatterlist.h>
+#include <linux/debugfs.h>
+#include <linux/rculist.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
 
 #include <asm/io.h>
 #include <asm/dma.h>
@@ -56,17 +60,71 @@
 enum swiotlb_force swiotlb_force;
 
 /*
- * Used to do a quick range check in swiotlb_tbl_unmap_single and
- * swiotlb_tbl_sync_single_*, to see if the memory was in fact allocated by this
- * API.
+ * A pool of bounce buffers.  The default pool is set up at boot from low
+ * memory; pools on each NUMA node (swiotlb_node=) and pools private to a
+ * device (swiotlb_dev_pool_create()) can be added, each with its own lock
+ * and free list.
  */
-static phys_addr_t io_tlb_start, io_tlb_end;
+struct io_tlb_mem {
+	/*
+	 * Used to do a quick range check in swiotlb_tbl_unmap_single and
+	 * swiotlb_tbl_sync_single_*, to see if the memory was in fact
+	 * allocated by this API.
+	 */
+	phys_addr_t start, end;
 
-/*
- * The number of IO TLB blocks (in groups of 64) between io_tlb_start and
- * io_tlb_end.  This is command line adjustable via setup_io_tlb_npages.
- */
-static unsigned long io_tlb_nslabs;
+	/*
+	 * The number of IO TLB blocks (in groups of 64) between start and
+	 * end.  For the default pool this is command line adjustable via
+	 * setup_io_tlb_npages.
+	 */
+	unsigned long nslabs;
+
+	/*
+	 * This is a free list describing the number of free entries
+	 * available from each index
+	 */
+	unsigned int *list;
+	unsigned int index;
+
+	/*
+	 * We need to save away the original address corresponding to a
+	 * mapped entry for the sync operations.
+	 */
+	phys_addr_t *orig_addr;
+
+	/*
+	 * Protect the above data structures in the map and unmap calls
+	 */
+	spinlock_t lock;
+
+	int nid;			/* node of a per-node pool */
+	struct device *dev;		/* owner of a per-device pool */
+	struct list_head node;		/* on io_tlb_pools */
+	struct rcu_head rcu;
+
+	/* Statistics, protected by lock */
+	unsigned long used;		/* slots in use */
+	unsigned long peak;		/* highest used */
+	unsigned long maps;		/* successful mappings */
+	unsigned long failed;		/* mappings that found no room */
+
+	struct dentry *debugfs;
+};
+
+static struct io_tlb_mem io_tlb_default_mem = {
+	.lock = __SPIN_LOCK_UNLOCKED(io_tlb_default_mem.lock),
+	.nid = NUMA_NO_NODE,
+};
+
+/* Pools other than the default one, walked by is_swiotlb_buffer() */
+static LIST_HEAD(io_tlb_pools);
+static DEFINE_SPINLOCK(io_tlb_pools_lock);
+
+static struct io_tlb_mem *io_tlb_node_mem[MAX_NUMNODES];
+
+/* Size of the per-node pools in slabs, 0 for none */
+static unsigned long io_tlb_node_nslabs;
 
 /*
  * When the IOMMU overflows we return a fallback buffer. This sets the size.
@@ -75,40 +133,25 @@ static unsigned long io_tlb_overflow = 32*1024;
 
 static phys_addr_t io_tlb_overflow_buffer;
 
-/*
- * This is a free list describing the number of free entries available from
- * each index
- */
-static unsigned int *io_tlb_list;
-static unsigned int io_tlb_index;
-
 /*
  * Max segment that we can provide which (if pages are contingous) will
  * not be bounced (unless SWIOTLB_FORCE is set).
  */
 unsigned int max_segment;
 
-/*
- * We need to save away the original address corresponding to a mapped entry
- * for the sync operations.
- */
 #define INVALID_PHYS_ADDR (~(phys_addr_t)0)
-static phys_addr_t *io_tlb_orig_addr;
-
-/*
- * Protect the above data structures in the map and unmap calls
- */
-static DEFINE_SPINLOCK(io_tlb_lock);
 
 static int late_alloc;
 
 static int __init
 setup_io_tlb_npages(char *str)
 {
+	struct io_tlb_mem *mem = &io_tlb_default_mem;
+
 	if (isdigit(*str)) {
-		io_tlb_nslabs = simple_strtoul(str, &str, 0);
+		mem->nslabs = simple_strtoul(str, &str, 0);
 		/* avoid tail segment of size < IO_TLB_SEGSIZE */
-		io_tlb_nslabs = ALIGN(io_tlb_nslabs, IO_TLB_SEGSIZE);
+		mem->nslabs = ALIGN(mem->nslabs, IO_TLB_SEGSIZE);
 	}
 	if (*str == ',')
 		++str;
@@ -116,7 +159,7 @@ setup_io_tlb_npages(char *str)
 		swiotlb_force = SWIOTLB_FORCE;
 	} else if (!strcmp(str, "noforce")) {
 		swiotlb_force = SWIOTLB_NO_FORCE;
-		io_tlb_nslabs = 1;
+		mem->nslabs = 1;
 	}
 
 	return 0;
@@ -124,9 +167,21 @@ setup_io_tlb_npages(char *str)
 early_param("swiotlb", setup_io_tlb_npages);
 /* make io_tlb_overflow tunable too? */
 
+static int __init
+setup_io_tlb_node_npages(char *str)
+{
+	if (isdigit(*str)) {
+		io_tlb_node_nslabs = simple_strtoul(str, &str, 0);
+		io_tlb_node_nslabs = ALIGN(io_tlb_node_nslabs, IO_TLB_SEGSIZE);
+	}
+
+	return 0;
+}
+early_param("swiotlb_node", setup_io_tlb_node_npages);
+
 unsigned long swiotlb_nr_tbl(void)
 {
-	return io_tlb_nslabs;
+	return io_tlb_default_mem.nslabs;
 }
 EXPORT_SYMBOL_GPL(swiotlb_nr_tbl);
 
@@ -150,7 +205,7 @@ unsigned long swiotlb_size_or_default(void)
 {
 	unsigned long size;
 
-	size = io_tlb_nslabs << IO_TLB_SHIFT;
+	size = io_tlb_default_mem.nslabs << IO_TLB_SHIFT;
 
 	return size ? size : (IO_TLB_DEFAULT_SIZE);
 }
@@ -166,7 +221,8 @@ static bool no_iotlb_memory;
 
 void swiotlb_print_info(void)
 {
-	unsigned long bytes = io_tlb_nslabs << IO_TLB_SHIFT;
+	struct io_tlb_mem *mem = &io_tlb_default_mem;
+	unsigned long bytes = mem->nslabs << IO_TLB_SHIFT;
 	unsigned char *vstart, *vend;
 
 	if (no_iotlb_memory) {
@@ -174,25 +230,37 @@ void swiotlb_print_info(void)
 		return;
 	}
 
-	vstart = phys_to_virt(io_tlb_start);
-	vend = phys_to_virt(io_tlb_end);
+	vstart = phys_to_virt(mem->start);
+	vend = phys_to_virt(mem->end);
 
 	printk(KERN_INFO "software IO TLB [mem %#010llx-%#010llx] (%luMB) mapped at [%p-%p]\n",
-	       (unsigned long long)io_tlb_start,
-	       (unsigned long long)io_tlb_end,
+	       (unsigned long long)mem->start,
+	       (unsigned long long)mem->end,
 	       bytes >> 20, vstart, vend - 1);
 }
 
+static void swiotlb_init_free_list(struct io_tlb_mem *mem)
+{
+	unsigned long i;
+
+	for (i = 0; i < mem->nslabs; i++) {
+		mem->list[i] = IO_TLB_SEGSIZE - OFFSET(i, IO_TLB_SEGSIZE);
+		mem->orig_addr[i] = INVALID_PHYS_ADDR;
+	}
+	mem->index = 0;
+}
+
 int __init swiotlb_init_with_tbl(char *tlb, unsigned long nslabs, int verbose)
 {
+	struct io_tlb_mem *mem = &io_tlb_default_mem;
 	void *v_overflow_buffer;
-	unsigned long i, bytes;
+	unsigned long bytes;
 
 	bytes = nslabs << IO_TLB_SHIFT;
 
-	io_tlb_nslabs = nslabs;
-	io_tlb_start = __pa(tlb);
-	io_tlb_end = io_tlb_start + bytes;
+	mem->nslabs = nslabs;
+	mem->start = __pa(tlb);
+	mem->end = mem->start + bytes;
 
 	/*
 	 * Get the overflow emergency buffer
@@ -208,27 +276,95 @@ int __init swiotlb_init_with_tbl(char *tlb, unsigned long nslabs, int verbose)
 	/*
 	 * Allocate and initialize the free list array.  This array is used
 	 * to find contiguous free memory regions of size up to IO_TLB_SEGSIZE
-	 * between io_tlb_start and io_tlb_end.
+	 * between mem->start and mem->end.
 	 */
-	io_tlb_list = memblock_virt_alloc(
-				PAGE_ALIGN(io_tlb_nslabs * sizeof(int)),
+	mem->list = memblock_virt_alloc(
+				PAGE_ALIGN(mem->nslabs * sizeof(int)),
 				PAGE_SIZE);
-	io_tlb_orig_addr = memblock_virt_alloc(
-				PAGE_ALIGN(io_tlb_nslabs * sizeof(phys_addr_t)),
+	mem->orig_addr = memblock_virt_alloc(
+				PAGE_ALIGN(mem->nslabs * sizeof(phys_addr_t)),
 				PAGE_SIZE);
-	for (i = 0; i < io_tlb_nslabs; i++) {
-		io_tlb_list[i] = IO_TLB_SEGSIZE - OFFSET(i, IO_TLB_SEGSIZE);
-		io_tlb_orig_addr[i] = INVALID_PHYS_ADDR;
-	}
-	io_tlb_index = 0;
+	swiotlb_init_free_list(mem);
 
 	if (verbose)
 		swiotlb_print_info();
 
-	swiotlb_set_max_segment(io_tlb_nslabs << IO_TLB_SHIFT);
+	swiotlb_set_max_segment(mem->nslabs << IO_TLB_SHIFT);
 	return 0;
 }
 
+static void __init swiotlb_init_node_pool(int nid, int verbose)
+{
+	unsigned long bytes = io_tlb_node_nslabs << IO_TLB_SHIFT;
+	struct io_tlb_mem *mem;
+	void *tlb;
+
+	mem = memblock_virt_alloc_try_nid_nopanic(sizeof(*mem), SMP_CACHE_BYTES,
+						  0, BOOTMEM_ALLOC_ACCESSIBLE,
+						  nid);
+	if (!mem)
+		return;
+
+	tlb = memblock_virt_alloc_try_nid_nopanic(PAGE_ALIGN(bytes), PAGE_SIZE,
+						  0, BOOTMEM_ALLOC_ACCESSIBLE,
+						  nid);
+	if (!tlb)
+		goto free_mem;
+
+	mem->list = memblock_virt_alloc_try_nid_nopanic(
+				PAGE_ALIGN(io_tlb_node_nslabs * sizeof(int)),
+				PAGE_SIZE, 0, BOOTMEM_ALLOC_ACCESSIBLE, nid);
+	mem->orig_addr = memblock_virt_alloc_try_nid_nopanic(
+				PAGE_ALIGN(io_tlb_node_nslabs * sizeof(phys_addr_t)),
+				PAGE_SIZE, 0, BOOTMEM_ALLOC_ACCESSIBLE, nid);
+	if (!mem->list || !mem->orig_addr)
+		goto free_tables;
+
+	mem->nslabs = io_tlb_node_nslabs;
+	mem->start = __pa(tlb);
+	mem->end = mem->start + bytes;
+	mem->nid = nid;
+	spin_lock_init(&mem->lock);
+	swiotlb_init_free_list(mem);
+
+	list_add_tail(&mem->node, &io_tlb_pools);
+	io_tlb_node_mem[nid] = mem;
+
+	if (verbose)
+		pr_info("software IO TLB: node %d [mem %#010llx-%#010llx] (%luMB)\n",
+			nid, (unsigned long long)mem->start,
+			(unsigned long long)mem->end, bytes >> 20);
+	return;
+
+free_tables:
+	if (mem->orig_addr)
+		memblock_free_early(__pa(mem->orig_addr),
+			PAGE_ALIGN(io_tlb_node_nslabs * sizeof(phys_addr_t)));
+	if (mem->list)
+		memblock_free_early(__pa(mem->list),
+			PAGE_ALIGN(io_tlb_node_nslabs * sizeof(int)));
+	memblock_free_early(__pa(tlb), PAGE_ALIGN(bytes));
+free_mem:
+	memblock_free_early(__pa(mem), sizeof(*mem));
+	pr_warn("Cannot allocate SWIOTLB buffer on node %d\n", nid);
+}
+
+/*
+ * With swiotlb_node=<nslabs>, every node gets a bounce pool from its own
+ * memory.  Devices use the pool of their node when it is within their DMA
+ * mask and the default pool otherwise.
+ */
+static void __init swiotlb_init_node_pools(int verbose)
+{
+	int nid;
+
+	if (!io_tlb_node_nslabs || swiotlb_force == SWIOTLB_NO_FORCE)
+		return;
+
+	for_each_online_node(nid)
+		swiotlb_init_node_pool(nid, verbose);
+}
+
 /*
  * Statically reserve bounce buffer space and initialize bounce buffer data
  * structures for the software IO TLB used to implement the DMA API.
@@ -236,25 +372,28 @@ int __init swiotlb_init_with_tbl(char *tlb, unsigned long nslabs, int verbose)
 void  __init
 swiotlb_init(int verbose)
 {
+	struct io_tlb_mem *mem = &io_tlb_default_mem;
 	size_t default_size = IO_TLB_DEFAULT_SIZE;
 	unsigned char *vstart;
 	unsigned long bytes;
 
-	if (!io_tlb_nslabs) {
-		io_tlb_nslabs = (default_size >> IO_TLB_SHIFT);
-		io_tlb_nslabs = ALIGN(io_tlb_nslabs, IO_TLB_SEGSIZE);
+	if (!mem->nslabs) {
+		mem->nslabs = (default_size >> IO_TLB_SHIFT);
+		mem->nslabs = ALIGN(mem->nslabs, IO_TLB_SEGSIZE);
 	}
 
-	bytes = io_tlb_nslabs << IO_TLB_SHIFT;
+	bytes = mem->nslabs << IO_TLB_SHIFT;
 
 	/* Get IO TLB memory from the low pages */
 	vstart = memblock_virt_alloc_low_nopanic(PAGE_ALIGN(bytes), PAGE_SIZE);
-	if (vstart && !swiotlb_init_with_tbl(vstart, io_tlb_nslabs, verbose))
+	if (vstart && !swiotlb_init_with_tbl(vstart, mem->nslabs, verbose)) {
+		swiotlb_init_node_pools(verbose);
 		return;
+	}
 
-	if (io_tlb_start)
-		memblock_free_early(io_tlb_start,
-				    PAGE_ALIGN(io_tlb_nslabs << IO_TLB_SHIFT));
+	if (mem->start)
+		memblock_free_early(mem->start,
+				    PAGE_ALIGN(mem->nslabs << IO_TLB_SHIFT));
 	pr_warn("Cannot allocate SWIOTLB buffer");
 	no_iotlb_memory = true;
 }
@@ -267,22 +406,23 @@ swiotlb_init(int verbose)
 int
 swiotlb_late_init_with_default_size(size_t default_size)
 {
-	unsigned long bytes, req_nslabs = io_tlb_nslabs;
+	struct io_tlb_mem *mem = &io_tlb_default_mem;
+	unsigned long bytes, req_nslabs = mem->nslabs;
 	unsigned char *vstart = NULL;
 	unsigned int order;
 	int rc = 0;
 
-	if (!io_tlb_nslabs) {
-		io_tlb_nslabs = (default_size >> IO_TLB_SHIFT);
-		io_tlb_nslabs = ALIGN(io_tlb_nslabs, IO_TLB_SEGSIZE);
+	if (!mem->nslabs) {
+		mem->nslabs = (default_size >> IO_TLB_SHIFT);
+		mem->nslabs = ALIGN(mem->nslabs, IO_TLB_SEGSIZE);
 	}
 
 	/*
 	 * Get IO TLB memory from the low pages
 	 */
-	order = get_order(io_tlb_nslabs << IO_TLB_SHIFT);
-	io_tlb_nslabs = SLABS_PER_PAGE << order;
-	bytes = io_tlb_nslabs << IO_TLB_SHIFT;
+	order = get_order(mem->nslabs << IO_TLB_SHIFT);
+	mem->nslabs = SLABS_PER_PAGE << order;
+	bytes = mem->nslabs << IO_TLB_SHIFT;
 
 	while ((SLABS_PER_PAGE << order) > IO_TLB_MIN_SLABS) {
 		vstart = (void *)__get_free_pages(GFP_DMA | __GFP_NOWARN,
@@ -293,15 +433,15 @@ swiotlb_late_init_with_default_size(size_t default_size)
 	}
 
 	if (!vstart) {
-		io_tlb_nslabs = req_nslabs;
+		mem->nslabs = req_nslabs;
 		return -ENOMEM;
 	}
 	if (order != get_order(bytes)) {
 		printk(KERN_WARNING "Warning: only able to allocate %ld MB "
 		       "for software IO TLB\n", (PAGE_SIZE << order) >> 20);
-		io_tlb_nslabs = SLABS_PER_PAGE << order;
+		mem->nslabs = SLABS_PER_PAGE << order;
 	}
-	rc = swiotlb_late_init_with_tbl(vstart, io_tlb_nslabs);
+	rc = swiotlb_late_init_with_tbl(vstart, mem->nslabs);
 	if (rc)
 		free_pages((unsigned long)vstart, order);
 
@@ -311,14 +451,15 @@ swiotlb_late_init_with_default_size(size_t default_size)
 int
 swiotlb_late_init_with_tbl(char *tlb, unsigned long nslabs)
 {
-	unsigned long i, bytes;
+	struct io_tlb_mem *mem = &io_tlb_default_mem;
+	unsigned long bytes;
 	unsigned char *v_overflow_buffer;
 
 	bytes = nslabs << IO_TLB_SHIFT;
 
-	io_tlb_nslabs = nslabs;
-	io_tlb_start = virt_to_phys(tlb);
-	io_tlb_end = io_tlb_start + bytes;
+	mem->nslabs = nslabs;
+	mem->start = virt_to_phys(tlb);
+	mem->end = mem->start + bytes;
 
 	memset(tlb, 0, bytes);
 
@@ -335,81 +476,179 @@ swiotlb_late_init_with_tbl(char *tlb, unsigned long nslabs)
 	/*
 	 * Allocate and initialize the free list array.  This array is used
 	 * to find contiguous free memory regions of size up to IO_TLB_SEGSIZE
-	 * between io_tlb_start and io_tlb_end.
+	 * between mem->start and mem->end.
 	 */
-	io_tlb_list = (unsigned int *)__get_free_pages(GFP_KERNEL,
-	                              get_order(io_tlb_nslabs * sizeof(int)));
-	if (!io_tlb_list)
+	mem->list = (unsigned int *)__get_free_pages(GFP_KERNEL,
+	                              get_order(mem->nslabs * sizeof(int)));
+	if (!mem->list)
 		goto cleanup3;
 
-	io_tlb_orig_addr = (phys_addr_t *)
+	mem->orig_addr = (phys_addr_t *)
 		__get_free_pages(GFP_KERNEL,
-				 get_order(io_tlb_nslabs *
+				 get_order(mem->nslabs *
 					   sizeof(phys_addr_t)));
-	if (!io_tlb_orig_addr)
+	if (!mem->orig_addr)
 		goto cleanup4;
 
-	for (i = 0; i < io_tlb_nslabs; i++) {
-		io_tlb_list[i] = IO_TLB_SEGSIZE - OFFSET(i, IO_TLB_SEGSIZE);
-		io_tlb_orig_addr[i] = INVALID_PHYS_ADDR;
-	}
-	io_tlb_index = 0;
+	swiotlb_init_free_list(mem);
 
 	swiotlb_print_info();
 
 	late_alloc = 1;
 
-	swiotlb_set_max_segment(io_tlb_nslabs << IO_TLB_SHIFT);
+	swiotlb_set_max_segment(mem->nslabs << IO_TLB_SHIFT);
 
 	return 0;
 
 cleanup4:
-	free_pages((unsigned long)io_tlb_list, get_order(io_tlb_nslabs *
+	free_pages((unsigned long)mem->list, get_order(mem->nslabs *
 	                                                 sizeof(int)));
-	io_tlb_list = NULL;
+	mem->list = NULL;
 cleanup3:
 	free_pages((unsigned long)v_overflow_buffer,
 		   get_order(io_tlb_overflow));
 	io_tlb_overflow_buffer = 0;
 cleanup2:
-	io_tlb_end = 0;
-	io_tlb_start = 0;
-	io_tlb_nslabs = 0;
+	mem->end = 0;
+	mem->start = 0;
+	mem->nslabs = 0;
 	max_segment = 0;
 	return -ENOMEM;
 }
 
+static void __init swiotlb_free_node_pools(void)
+{
+	struct io_tlb_mem *mem;
+	int nid;
+
+	for_each_node(nid) {
+		mem = io_tlb_node_mem[nid];
+		if (!mem)
+			continue;
+
+		io_tlb_node_mem[nid] = NULL;
+		list_del(&mem->node);
+
+		memblock_free_late(__pa(mem->orig_addr),
+				   PAGE_ALIGN(mem->nslabs * sizeof(phys_addr_t)));
+		memblock_free_late(__pa(mem->list),
+				   PAGE_ALIGN(mem->nslabs * sizeof(int)));
+		memblock_free_late(mem->start,
+				   PAGE_ALIGN(mem->nslabs << IO_TLB_SHIFT));
+		memblock_free_late(__pa(mem), sizeof(*mem));
+	}
+}
+
 void __init swiotlb_free(void)
 {
-	if (!io_tlb_orig_addr)
+	struct io_tlb_mem *mem = &io_tlb_default_mem;
+
+	swiotlb_free_node_pools();
+
+	if (!mem->orig_addr)
 		return;
 
 	if (late_alloc) {
 		free_pages((unsigned long)phys_to_virt(io_tlb_overflow_buffer),
 			   get_order(io_tlb_overflow));
-		free_pages((unsigned long)io_tlb_orig_addr,
-			   get_order(io_tlb_nslabs * sizeof(phys_addr_t)));
-		free_pages((unsigned long)io_tlb_list, get_order(io_tlb_nslabs *
+		free_pages((unsigned long)mem->orig_addr,
+			   get_order(mem->nslabs * sizeof(phys_addr_t)));
+		free_pages((unsigned long)mem->list, get_order(mem->nslabs *
 								 sizeof(int)));
-		free_pages((unsigned long)phys_to_virt(io_tlb_start),
-			   get_order(io_tlb_nslabs << IO_TLB_SHIFT));
+		free_pages((unsigned long)phys_to_virt(mem->start),
+			   get_order(mem->nslabs << IO_TLB_SHIFT));
 	} else {
 		memblock_free_late(io_tlb_overflow_buffer,
 				   PAGE_ALIGN(io_tlb_overflow));
-		memblock_free_late(__pa(io_tlb_orig_addr),
-				   PAGE_ALIGN(io_tlb_nslabs * sizeof(phys_addr_t)));
-		memblock_free_late(__pa(io_tlb_list),
-				   PAGE_ALIGN(io_tlb_nslabs * sizeof(int)));
-		memblock_free_late(io_tlb_start,
-				   PAGE_ALIGN(io_tlb_nslabs << IO_TLB_SHIFT));
+		memblock_free_late(__pa(mem->orig_addr),
+				   PAGE_ALIGN(mem->nslabs * sizeof(phys_addr_t)));
+		memblock_free_late(__pa(mem->list),
+				   PAGE_ALIGN(mem->nslabs * sizeof(int)));
+		memblock_free_late(mem->start,
+				   PAGE_ALIGN(mem->nslabs << IO_TLB_SHIFT));
 	}
-	io_tlb_nslabs = 0;
+	mem->nslabs = 0;
 	max_segment = 0;
 }
 
+static inline bool swiotlb_mem_contains(struct io_tlb_mem *mem,
+					phys_addr_t paddr)
+{
+	return mem && paddr >= mem->start && paddr < mem->end;
+}
+
 int is_swiotlb_buffer(phys_addr_t paddr)
 {
-	return paddr >= io_tlb_start && paddr < io_tlb_end;
+	struct io_tlb_mem *mem;
+	bool found = false;
+
+	if (swiotlb_mem_contains(&io_tlb_default_mem, paddr))
+		return 1;
+
+	if (list_empty(&io_tlb_pools))
+		return 0;
+
+	rcu_read_lock();
+	list_for_each_entry_rcu(mem, &io_tlb_pools, node) {
+		if (swiotlb_mem_contains(mem, paddr)) {
+			found = true;
+			break;
+		}
+	}
+	rcu_read_unlock();
+
+	return found;
+}
+
+/* The pool new bounce buffers for @dev come from */
+static struct io_tlb_mem *swiotlb_dev_mem(struct device *dev)
+{
+	struct io_tlb_mem *mem;
+	int nid;
+
+	if (!dev)
+		return &io_tlb_default_mem;
+
+	if (dev->dma_io_tlb_mem)
+		return dev->dma_io_tlb_mem;
+
+	nid = dev_to_node(dev);
+	if (nid == NUMA_NO_NODE)
+		return &io_tlb_default_mem;
+
+	mem = io_tlb_node_mem[nid];
+	if (mem && dev->dma_mask &&
+	    phys_to_dma(dev, mem->end - 1) <= *dev->dma_mask)
+		return mem;
+
+	return &io_tlb_default_mem;
+}
+
+/*
+ * The pool @paddr was bounced through for @dev, or NULL if it isn't a
+ * bounce buffer.  Only the pools swiotlb_dev_mem() can pick for the device
+ * need looking at.
+ */
+static struct io_tlb_mem *swiotlb_find_mem(struct device *dev,
+					   phys_addr_t paddr)
+{
+	int nid;
+
+	if (swiotlb_mem_contains(&io_tlb_default_mem, paddr))
+		return &io_tlb_default_mem;
+
+	if (!dev)
+		return NULL;
+
+	if (swiotlb_mem_contains(dev->dma_io_tlb_mem, paddr))
+		return dev->dma_io_tlb_mem;
+
+	nid = dev_to_node(dev);
+	if (nid != NUMA_NO_NODE &&
+	    swiotlb_mem_contains(io_tlb_node_mem[nid], paddr))
+		return io_tlb_node_mem[nid];
+
+	return NULL;
 }
 
 /*
@@ -452,11 +691,12 @@ static void swiotlb_bounce(phys_addr_t orig_addr, phys_addr_t tlb_addr,
 	}
 }
 
-phys_addr_t swiotlb_tbl_map_single(struct device *hwdev,
-				   dma_addr_t tbl_dma_addr,
-				   phys_addr_t orig_addr, size_t size,
-				   enum dma_data_direction dir,
-				   unsigned long attrs)
+static phys_addr_t swiotlb_mem_map_single(struct device *hwdev,
+					  struct io_tlb_mem *mem,
+					  dma_addr_t tbl_dma_addr,
+					  phys_addr_t orig_addr, size_t size,
+					  enum dma_data_direction dir,
+					  unsigned long attrs)
 {
 	unsigned long flags;
 	phys_addr_t tlb_addr;
@@ -466,7 +706,7 @@ phys_addr_t swiotlb_tbl_map_single(struct device *hwdev,
 	unsigned long offset_slots;
 	unsigned long max_slots;
 
-	if (no_iotlb_memory)
+	if (no_iotlb_memory && mem == &io_tlb_default_mem)
 		panic("Can not allocate SWIOTLB buffer earlier and can't now provide you with the DMA bounce buffer");
 
 	mask = dma_get_seg_boundary(hwdev);
@@ -498,9 +738,9 @@ phys_addr_t swiotlb_tbl_map_single(struct device *hwdev,
 	 * Find suitable number of IO TLB entries size that will fit this
 	 * request and allocate a buffer from that IO TLB pool.
 	 */
-	spin_lock_irqsave(&io_tlb_lock, flags);
-	index = ALIGN(io_tlb_index, stride);
-	if (index >= io_tlb_nslabs)
+	spin_lock_irqsave(&mem->lock, flags);
+	index = ALIGN(mem->index, stride);
+	if (index >= mem->nslabs)
 		index = 0;
 	wrap = index;
 
@@ -508,7 +748,7 @@ phys_addr_t swiotlb_tbl_map_single(struct device *hwdev,
 		while (iommu_is_span_boundary(index, nslots, offset_slots,
 					      max_slots)) {
 			index += stride;
-			if (index >= io_tlb_nslabs)
+			if (index >= mem->nslabs)
 				index = 0;
 			if (index == wrap)
 				goto not_found;
@@ -519,36 +759,40 @@ phys_addr_t swiotlb_tbl_map_single(struct device *hwdev,
 		 * contiguous buffers, we allocate the buffers from that slot
 		 * and mark the entries as '0' indicating unavailable.
 		 */
-		if (io_tlb_list[index] >= nslots) {
+		if (mem->list[index] >= nslots) {
 			int count = 0;
 
 			for (i = index; i < (int) (index + nslots); i++)
-				io_tlb_list[i] = 0;
-			for (i = index - 1; (OFFSET(i, IO_TLB_SEGSIZE) != IO_TLB_SEGSIZE - 1) && io_tlb_list[i]; i--)
-				io_tlb_list[i] = ++count;
-			tlb_addr = io_tlb_start + (index << IO_TLB_SHIFT);
+				mem->list[i] = 0;
+			for (i = index - 1; (OFFSET(i, IO_TLB_SEGSIZE) != IO_TLB_SEGSIZE - 1) && mem->list[i]; i--)
+				mem->list[i] = ++count;
+			tlb_addr = mem->start + (index << IO_TLB_SHIFT);
 
 			/*
 			 * Update the indices to avoid searching in the next
 			 * round.
 			 */
-			io_tlb_index = ((index + nslots) < io_tlb_nslabs
+			mem->index = ((index + nslots) < mem->nslabs
 					? (index + nslots) : 0);
 
+			mem->used += nslots;
+			mem->peak = max(mem->peak, mem->used);
+			mem->maps++;
 			goto found;
 		}
 		index += stride;
-		if (index >= io_tlb_nslabs)
+		if (index >= mem->nslabs)
 			index = 0;
 	} while (index != wrap);
 
 not_found:
-	spin_unlock_irqrestore(&io_tlb_lock, flags);
+	mem->failed++;
+	spin_unlock_irqrestore(&mem->lock, flags);
 	if (printk_ratelimit())
 		dev_warn(hwdev, "swiotlb buffer is full (sz: %zd bytes)\n", size);
 	return SWIOTLB_MAP_ERROR;
 found:
-	spin_unlock_irqrestore(&io_tlb_lock, flags);
+	spin_unlock_irqrestore(&mem->lock, flags);
 
 	/*
 	 * Save away the mapping from the original address to the DMA address.
@@ -556,13 +800,23 @@ found:
 	 * needed.
 	 */
 	for (i = 0; i < nslots; i++)
-		io_tlb_orig_addr[index+i] = orig_addr + (i << IO_TLB_SHIFT);
+		mem->orig_addr[index+i] = orig_addr + (i << IO_TLB_SHIFT);
 	if (!(attrs & DMA_ATTR_SKIP_CPU_SYNC) &&
 	    (dir == DMA_TO_DEVICE || dir == DMA_BIDIRECTIONAL))
 		swiotlb_bounce(orig_addr, tlb_addr, size, DMA_TO_DEVICE);
 
 	return tlb_addr;
 }
+
+phys_addr_t swiotlb_tbl_map_single(struct device *hwdev,
+				   dma_addr_t tbl_dma_addr,
+				   phys_addr_t orig_addr, size_t size,
+				   enum dma_data_direction dir,
+				   unsigned long attrs)
+{
+	return swiotlb_mem_map_single(hwdev, &io_tlb_default_mem, tbl_dma_addr,
+				      orig_addr, size, dir, attrs);
+}
 EXPORT_SYMBOL_GPL(swiotlb_tbl_map_single);
 
 /*
@@ -573,6 +827,7 @@ static phys_addr_t
 map_single(struct device *hwdev, phys_addr_t phys, size_t size,
 	   enum dma_data_direction dir, unsigned long attrs)
 {
+	struct io_tlb_mem *mem = swiotlb_dev_mem(hwdev);
 	dma_addr_t start_dma_addr;
 
 	if (swiotlb_force == SWIOTLB_NO_FORCE) {
@@ -581,8 +836,8 @@ map_single(struct device *hwdev, phys_addr_t phys, size_t size,
 		return SWIOTLB_MAP_ERROR;
 	}
 
-	start_dma_addr = phys_to_dma(hwdev, io_tlb_start);
-	return swiotlb_tbl_map_single(hwdev, start_dma_addr, phys, size,
+	start_dma_addr = phys_to_dma(hwdev, mem->start);
+	return swiotlb_mem_map_single(hwdev, mem, start_dma_addr, phys, size,
 				      dir, attrs);
 }
 
@@ -593,10 +848,17 @@ void swiotlb_tbl_unmap_single(struct device *hwdev, phys_addr_t tlb_addr,
 			      size_t size, enum dma_data_direction dir,
 			      unsigned long attrs)
 {
+	struct io_tlb_mem *mem = swiotlb_find_mem(hwdev, tlb_addr);
 	unsigned long flags;
 	int i, count, nslots = ALIGN(size, 1 << IO_TLB_SHIFT) >> IO_TLB_SHIFT;
-	int index = (tlb_addr - io_tlb_start) >> IO_TLB_SHIFT;
-	phys_addr_t orig_addr = io_tlb_orig_addr[index];
+	int index;
+	phys_addr_t orig_addr;
+
+	if (WARN_ON_ONCE(!mem))
+		return;
+
+	index = (tlb_addr - mem->start) >> IO_TLB_SHIFT;
+	orig_addr = mem->orig_addr[index];
 
 	/*
 	 * First, sync the memory before unmapping the entry
@@ -612,26 +874,27 @@ void swiotlb_tbl_unmap_single(struct device *hwdev, phys_addr_t tlb_addr,
 	 * While returning the entries to the free list, we merge the entries
 	 * with slots below and above the pool being returned.
 	 */
-	spin_lock_irqsave(&io_tlb_lock, flags);
+	spin_lock_irqsave(&mem->lock, flags);
 	{
 		count = ((index + nslots) < ALIGN(index + 1, IO_TLB_SEGSIZE) ?
-			 io_tlb_list[index + nslots] : 0);
+			 mem->list[index + nslots] : 0);
 		/*
 		 * Step 1: return the slots to the free list, merging the
 		 * slots with superceeding slots
 		 */
 		for (i = index + nslots - 1; i >= index; i--) {
-			io_tlb_list[i] = ++count;
-			io_tlb_orig_addr[i] = INVALID_PHYS_ADDR;
+			mem->list[i] = ++count;
+			mem->orig_addr[i] = INVALID_PHYS_ADDR;
 		}
 		/*
 		 * Step 2: merge the returned slots with the preceding slots,
 		 * if available (non zero)
 		 */
-		for (i = index - 1; (OFFSET(i, IO_TLB_SEGSIZE) != IO_TLB_SEGSIZE -1) && io_tlb_list[i]; i--)
-			io_tlb_list[i] = ++count;
+		for (i = index - 1; (OFFSET(i, IO_TLB_SEGSIZE) != IO_TLB_SEGSIZE -1) && mem->list[i]; i--)
+			mem->list[i] = ++count;
+		mem->used -= nslots;
 	}
-	spin_unlock_irqrestore(&io_tlb_lock, flags);
+	spin_unlock_irqrestore(&mem->lock, flags);
 }
 EXPORT_SYMBOL_GPL(swiotlb_tbl_unmap_single);
 
@@ -639,9 +902,15 @@ void swiotlb_tbl_sync_single(struct device *hwdev, phys_addr_t tlb_addr,
 			     size_t size, enum dma_data_direction dir,
 			     enum dma_sync_target target)
 {
-	int index = (tlb_addr - io_tlb_start) >> IO_TLB_SHIFT;
-	phys_addr_t orig_addr = io_tlb_orig_addr[index];
+	struct io_tlb_mem *mem = swiotlb_find_mem(hwdev, tlb_addr);
+	int index;
+	phys_addr_t orig_addr;
 
+	if (WARN_ON_ONCE(!mem))
+		return;
+
+	index = (tlb_addr - mem->start) >> IO_TLB_SHIFT;
+	orig_addr = mem->orig_addr[index];
 	if (orig_addr == INVALID_PHYS_ADDR)
 		return;
 	orig_addr += (unsigned long)tlb_addr & ((1 << IO_TLB_SHIFT) - 1);
@@ -742,7 +1011,7 @@ swiotlb_free_coherent(struct device *hwdev, size_t size, void *vaddr,
 	phys_addr_t paddr = dma_to_phys(hwdev, dev_addr);
 
 	WARN_ON(irqs_disabled());
-	if (!is_swiotlb_buffer(paddr))
+	if (!swiotlb_find_mem(hwdev, paddr))
 		free_pages((unsigned long)vaddr, get_order(size));
 	else
 		/*
@@ -844,7 +1113,7 @@ static void unmap_single(struct device *hwdev, dma_addr_t dev_addr,
 
 	BUG_ON(dir == DMA_NONE);
 
-	if (is_swiotlb_buffer(paddr)) {
+	if (swiotlb_find_mem(hwdev, paddr)) {
 		swiotlb_tbl_unmap_single(hwdev, paddr, size, dir, attrs);
 		return;
 	}
@@ -888,7 +1157,7 @@ swiotlb_sync_single(struct device *hwdev, dma_addr_t dev_addr,
 
 	BUG_ON(dir == DMA_NONE);
 
-	if (is_swiotlb_buffer(paddr)) {
+	if (swiotlb_find_mem(hwdev, paddr)) {
 		swiotlb_tbl_sync_single(hwdev, paddr, size, dir, target);
 		return;
 	}
@@ -1039,6 +1308,192 @@ EXPORT_SYMBOL(swiotlb_dma_mapping_error);
 int
 swiotlb_dma_supported(struct device *hwdev, u64 mask)
 {
-	return phys_to_dma(hwdev, io_tlb_end - 1) <= mask;
+	return phys_to_dma(hwdev, swiotlb_dev_mem(hwdev)->end - 1) <= mask;
 }
 EXPORT_SYMBOL(swiotlb_dma_supported);
+
+#ifdef CONFIG_DEBUG_FS
+static struct dentry *swiotlb_debugfs_dir;
+
+static int swiotlb_pool_show(struct seq_file *m, void *v)
+{
+	struct io_tlb_mem *mem = m->private;
+	unsigned long used, peak, maps, failed;
+	unsigned long flags;
+
+	spin_lock_irqsave(&mem->lock, flags);
+	used = mem->used;
+	peak = mem->peak;
+	maps = mem->maps;
+	failed = mem->failed;
+	spin_unlock_irqrestore(&mem->lock, flags);
+
+	seq_printf(m, "node: %d\n", mem->nid);
+	seq_printf(m, "nslabs: %lu\n", mem->nslabs);
+	seq_printf(m, "used: %lu\n", used);
+	seq_printf(m, "peak: %lu\n", peak);
+	seq_printf(m, "maps: %lu\n", maps);
+	seq_printf(m, "failed: %lu\n", failed);
+	return 0;
+}
+
+static int swiotlb_pool_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, swiotlb_pool_show, inode->i_private);
+}
+
+static const struct file_operations swiotlb_pool_fops = {
+	.open		= swiotlb_pool_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static void swiotlb_debugfs_add(struct io_tlb_mem *mem, const char *name)
+{
+	if (swiotlb_debugfs_dir)
+		mem->debugfs = debugfs_create_file(name, 0400,
+						   swiotlb_debugfs_dir, mem,
+						   &swiotlb_pool_fops);
+}
+
+static int __init swiotlb_debugfs_init(void)
+{
+	char name[16];
+	int nid;
+
+	swiotlb_debugfs_dir = debugfs_create_dir("swiotlb", NULL);
+	if (IS_ERR_OR_NULL(swiotlb_debugfs_dir)) {
+		swiotlb_debugfs_dir = NULL;
+		return 0;
+	}
+
+	if (io_tlb_default_mem.nslabs)
+		swiotlb_debugfs_add(&io_tlb_default_mem, "default");
+
+	for_each_node(nid) {
+		if (!io_tlb_node_mem[nid])
+			continue;
+		snprintf(name, sizeof(name), "node%d", nid);
+		swiotlb_debugfs_add(io_tlb_node_mem[nid], name);
+	}
+
+	return 0;
+}
+fs_initcall(swiotlb_debugfs_init);
+#else
+static inline void swiotlb_debugfs_add(struct io_tlb_mem *mem,
+				       const char *name) { }
+#endif
+
+/**
+ * swiotlb_dev_pool_create - give a device bounce buffers of its own
+ * @dev: device, with its DMA mask set
+ * @size: size of the pool in bytes
+ *
+ * Bounce buffers of @dev then come from a pool on the device's node that
+ * no other device takes the lock of.  The pool is physically contiguous,
+ * so @size is rounded up to a power of two pages and capped at
+ * MAX_ORDER - 1 pages.
+ */
+int swiotlb_dev_pool_create(struct device *dev, size_t size)
+{
+	unsigned int order = min_t(unsigned int, get_order(size),
+				   MAX_ORDER - 1);
+	gfp_t gfp = GFP_KERNEL | __GFP_NOWARN;
+	int nid = dev_to_node(dev);
+	struct io_tlb_mem *mem;
+	unsigned long nslabs;
+	struct page *page;
+
+	if (!dev->dma_mask)
+		return -EINVAL;
+	if (dev->dma_io_tlb_mem)
+		return -EBUSY;
+
+	/* At least one full segment */
+	order = max_t(unsigned int, order,
+		      get_order(IO_TLB_SEGSIZE << IO_TLB_SHIFT));
+	nslabs = SLABS_PER_PAGE << order;
+
+#ifdef CONFIG_ZONE_DMA32
+	if (*dev->dma_mask <= DMA_BIT_MASK(32))
+		gfp |= GFP_DMA32;
+#endif
+
+	mem = kzalloc_node(sizeof(*mem), GFP_KERNEL, nid);
+	if (!mem)
+		return -ENOMEM;
+
+	mem->list = kmalloc_node(nslabs * sizeof(int), GFP_KERNEL, nid);
+	mem->orig_addr = kmalloc_node(nslabs * sizeof(phys_addr_t),
+				      GFP_KERNEL, nid);
+	if (!mem->list || !mem->orig_addr)
+		goto free_tables;
+
+	page = alloc_pages_node(nid, gfp, order);
+	if (!page)
+		goto free_tables;
+
+	mem->nslabs = nslabs;
+	mem->start = page_to_phys(page);
+	mem->end = mem->start + (nslabs << IO_TLB_SHIFT);
+	if (phys_to_dma(dev, mem->end - 1) > *dev->dma_mask) {
+		dev_warn(dev, "no memory for swiotlb pool within DMA mask\n");
+		goto free_pages;
+	}
+
+	mem->nid = nid;
+	mem->dev = dev;
+	spin_lock_init(&mem->lock);
+	swiotlb_init_free_list(mem);
+
+	spin_lock(&io_tlb_pools_lock);
+	list_add_tail_rcu(&mem->node, &io_tlb_pools);
+	spin_unlock(&io_tlb_pools_lock);
+
+	dev->dma_io_tlb_mem = mem;
+	swiotlb_debugfs_add(mem, dev_name(dev));
+
+	return 0;
+
+free_pages:
+	__free_pages(page, order);
+free_tables:
+	kfree(mem->orig_addr);
+	kfree(mem->list);
+	kfree(mem);
+	return -ENOMEM;
+}
+EXPORT_SYMBOL_GPL(swiotlb_dev_pool_create);
+
+/**
+ * swiotlb_dev_pool_destroy - free the bounce pool of a device
+ * @dev: device passed to swiotlb_dev_pool_create()
+ *
+ * All of the device's streaming mappings must have been unmapped.
+ */
+void swiotlb_dev_pool_destroy(struct device *dev)
+{
+	struct io_tlb_mem *mem = dev->dma_io_tlb_mem;
+
+	if (!mem)
+		return;
+
+	WARN_ON(mem->used);
+
+	debugfs_remove(mem->debugfs);
+	dev->dma_io_tlb_mem = NULL;
+
+	spin_lock(&io_tlb_pools_lock);
+	list_del_rcu(&mem->node);
+	spin_unlock(&io_tlb_pools_lock);
+	synchronize_rcu();
+
+	free_pages((unsigned long)phys_to_virt(mem->start),
+		   get_order(mem->nslabs << IO_TLB_SHIFT));
+	kfree(mem->orig_addr);
+	kfree(mem->list);
+	kfree(mem);
+}
+EXPORT_SYMBOL_GPL(swiotlb_dev_pool_destroy);
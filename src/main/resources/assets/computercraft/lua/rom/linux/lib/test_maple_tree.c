@@ -0,0 +1,166 @@
+/*
+ * Maple tree self test
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/maple_tree.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+
+static int entries = 100000;
+module_param(entries, int, 0);
+MODULE_PARM_DESC(entries, "Number of ranges to insert (default: 100000)");
+
+static DEFINE_MTREE(tree);
+
+/*
+ * Range i covers [16 * i, 16 * i + 7]; the entry is the encoded index so
+ * that nothing has to be allocated for it.
+ */
+#define RANGE_FIRST(i)	(16UL * (i))
+#define RANGE_LAST(i)	(16UL * (i) + 7)
+#define RANGE_ENTRY(i)	((void *)(((unsigned long)(i) << 2) | 2))
+
+static int __init check_ranges(int stride, int present)
+{
+	unsigned long index;
+	int i, err = 0;
+	void *entry;
+
+	for (i = 0; i < entries; i++) {
+		bool want = (i % stride == 0) == present;
+
+		entry = mtree_load(&tree, RANGE_FIRST(i) + 3);
+		if (want ? entry != RANGE_ENTRY(i) : entry != NULL) {
+			pr_err("  range %d: wrong lookup result %p\n", i, entry);
+			err++;
+		}
+		if (mtree_load(&tree, RANGE_LAST(i) + 1)) {
+			pr_err("  gap after range %d is not empty\n", i);
+			err++;
+		}
+	}
+
+	/* The gap before a range finds the range itself */
+	for (i = 1; i < entries; i++)
+		if ((i % stride == 0) == present)
+			break;
+	index = RANGE_LAST(0) + 1;
+	entry = mt_find(&tree, &index, ULONG_MAX);
+	if (i < entries && (entry != RANGE_ENTRY(i) ||
+			    index != RANGE_FIRST(i))) {
+		pr_err("  mt_find returned %p at %lu\n", entry, index);
+		err++;
+	}
+	return err;
+}
+
+static int __init check_iteration(int expected)
+{
+	unsigned long index = 0, prev = 0;
+	int count = 0, err = 0;
+	void *entry;
+
+	mt_for_each(&tree, entry, index, ULONG_MAX) {
+		if (count && index <= prev) {
+			pr_err("  iteration went backwards at %lu\n", index);
+			err++;
+			break;
+		}
+		prev = index;
+		count++;
+	}
+	if (count != expected) {
+		pr_err("  iteration found %d entries, expected %d\n",
+		       count, expected);
+		err++;
+	}
+	return err;
+}
+
+static int __init test_mt_init(void)
+{
+	int i, err = 0, ret, removed = 0;
+	u64 start, insert_ns, lookup_ns;
+
+	pr_info("Running maple tree test with %d ranges\n", entries);
+
+	start = ktime_get_ns();
+	/* Insert out of order so that both the front and the back split */
+	for (i = 0; i < entries; i++) {
+		int n = (i & 1) ? i / 2 : entries - 1 - i / 2;
+
+		ret = mtree_insert_range(&tree, RANGE_FIRST(n), RANGE_LAST(n),
+					 RANGE_ENTRY(n), GFP_KERNEL);
+		if (ret) {
+			pr_err("  inserting range %d failed: %d\n", n, ret);
+			err++;
+			goto out;
+		}
+	}
+	insert_ns = ktime_get_ns() - start;
+
+	if (mtree_insert_range(&tree, RANGE_FIRST(1) + 4, RANGE_FIRST(1) + 12,
+			       RANGE_ENTRY(1), GFP_KERNEL) != -EEXIST) {
+		pr_err("  overlapping insert succeeded\n");
+		err++;
+	}
+	if (mtree_insert(&tree, RANGE_LAST(1) + 1, RANGE_ENTRY(0),
+			 GFP_KERNEL) || !mtree_erase(&tree, RANGE_LAST(1) + 1)) {
+		pr_err("  inserting into a gap failed\n");
+		err++;
+	}
+
+	start = ktime_get_ns();
+	err += check_ranges(1, true);
+	lookup_ns = ktime_get_ns() - start;
+	err += check_iteration(entries);
+
+	/* Erase every third range, then everything else */
+	for (i = 0; i < entries; i += 3) {
+		if (mtree_erase(&tree, RANGE_LAST(i)) != RANGE_ENTRY(i)) {
+			pr_err("  erasing range %d failed\n", i);
+			err++;
+		}
+		removed++;
+	}
+	err += check_ranges(3, false);
+	err += check_iteration(entries - removed);
+
+	for (i = 0; i < entries; i++)
+		if (i % 3)
+			mtree_erase(&tree, RANGE_FIRST(i));
+	if (!mtree_empty(&tree)) {
+		pr_err("  tree not empty after erasing everything\n");
+		err++;
+	}
+
+	pr_info("  insert: %llu ns, lookup: %llu ns per range\n",
+		div_u64(insert_ns, max(entries, 1)),
+		div_u64(lookup_ns, max(entries, 1)));
+out:
+	mtree_destroy(&tree);
+	rcu_barrier();
+
+	if (err) {
+		pr_warn("Test failed: %d errors\n", err);
+		return -EINVAL;
+	}
+	pr_info("Test passed\n");
+	return 0;
+}
+
+static void __exit test_mt_exit(void)
+{
+}
+
+module_init(test_mt_init);
+module_exit(test_mt_exit);
+
+MODULE_LICENSE("GPL v2");
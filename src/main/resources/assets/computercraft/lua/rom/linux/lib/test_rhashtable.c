@@ -56,6 +56,10 @@ static bool enomem_retry = false;
 module_param(enomem_retry, bool, 0);
 MODULE_PARM_DESC(enomem_retry, "Retry insert even if -ENOMEM was returned (default: off)");
 
+static int rehash_assist = 0;
+module_param(rehash_assist, int, 0);
+MODULE_PARM_DESC(rehash_assist, "Buckets each insert migrates during a rehash (default: 0)");
+
 struct test_obj {
 	int			value;
 	struct rhash_head	node;
@@ -266,6 +270,7 @@ static int threadfunc(void *data)
 {
 	int i, step, err = 0, insert_retries = 0;
 	struct thread_data *tdata = data;
+	u64 start, delta, max_delta = 0;
 
 	up(&prestart_sem);
 	if (down_interruptible(&startup_sem))
@@ -273,7 +278,11 @@ static int threadfunc(void *data)
 
 	for (i = 0; i < entries; i++) {
 		tdata->objs[i].value = (tdata->id << 16) | i;
+		start = ktime_get_ns();
 		err = insert_retry(&ht, &tdata->objs[i].node, test_rht_params);
+		delta = ktime_get_ns() - start;
+		if (delta > max_delta)
+			max_delta = delta;
 		if (err > 0) {
 			insert_retries += err;
 		} else if (err) {
@@ -285,6 +294,8 @@ static int threadfunc(void *data)
 	if (insert_retries)
 		pr_info("  thread[%d]: %u insertions retried due to memory pressure\n",
 			tdata->id, insert_retries);
+	pr_info("  thread[%d]: worst insert latency %llu ns\n",
+		tdata->id, max_delta);
 
 	err = thread_lookup_test(tdata);
 	if (err) {
@@ -335,9 +346,10 @@ static int __init test_rht_init(void)
 	test_rht_params.automatic_shrinking = shrinking;
 	test_rht_params.max_size = max_size ? : roundup_pow_of_two(entries);
 	test_rht_params.nelem_hint = size;
+	test_rht_params.rehash_assist = rehash_assist;
 
-	pr_info("Running rhashtable test nelem=%d, max_size=%d, shrinking=%d\n",
-		size, max_size, shrinking);
+	pr_info("Running rhashtable test nelem=%d, max_size=%d, shrinking=%d, rehash_assist=%d\n",
+		size, max_size, shrinking, rehash_assist);
 
 	for (i = 0; i < runs; i++) {
 		s64 time;
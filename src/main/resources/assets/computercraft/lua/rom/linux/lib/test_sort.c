@@ -35,6 +35,20 @@ static int __init test_sort_init(void)
 			pr_err("test has failed\n");
 			goto exit;
 		}
+
+	/* Again with 8-byte elements keyed on their first int */
+	for (i = 0; i < TEST_LEN; i++) {
+		r = (r * 725861) % 6599;
+		a[i] = r;
+	}
+
+	sort(a, TEST_LEN / 2, 2 * sizeof(*a), cmpint, NULL);
+
+	for (i = 0; i < TEST_LEN - 2; i += 2)
+		if (a[i] > a[i+2]) {
+			pr_err("test has failed\n");
+			goto exit;
+		}
 	err = 0;
 	pr_info("test passed\n");
 exit:
@@ -0,0 +1,192 @@
+/*
+ * Kernel module for checking and timing the generic string routines.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#define MAX_ALIGN	16
+#define MAX_LEN		128
+#define BENCH_LEN	4096
+
+static int iterations = 10000;
+module_param(iterations, int, 0);
+MODULE_PARM_DESC(iterations, "Number of benchmark passes (default: 10000)");
+
+/*
+ * Check every start alignment and every length up to MAX_LEN against a
+ * plain byte loop.  The strings sit at the end of the allocation so that
+ * the word loads are exercised up to the last word of the buffer.
+ */
+static int __init check_strlen(char *buf, size_t size)
+{
+	size_t align, len, limit;
+	int err = 0;
+
+	for (align = 0; align < MAX_ALIGN; align++) {
+		for (len = 0; len < MAX_LEN; len++) {
+			char *s = buf + size - len - 1 - align;
+
+			memset(s, 'a', len);
+			s[len] = '\0';
+			if (strlen(s) != len) {
+				pr_err("strlen: align %zu len %zu got %zu\n",
+				       align, len, strlen(s));
+				err++;
+			}
+			for (limit = 0; limit <= len + 1; limit++) {
+				if (strnlen(s, limit) == min(len, limit))
+					continue;
+				pr_err("strnlen: align %zu len %zu limit %zu\n",
+				       align, len, limit);
+				err++;
+			}
+		}
+	}
+	return err;
+}
+
+static int __init check_memchr(char *buf, size_t size)
+{
+	size_t align, len, pos;
+	int err = 0;
+
+	for (align = 0; align < MAX_ALIGN; align++) {
+		for (len = 0; len < MAX_LEN; len++) {
+			char *s = buf + size - len - align;
+
+			memset(s, 0x7f, len);
+			if (memchr(s, 0xff, len)) {
+				pr_err("memchr: align %zu len %zu false match\n",
+				       align, len);
+				err++;
+			}
+			for (pos = 0; pos < len; pos++) {
+				s[pos] = 0xff;
+				if (memchr(s, 0xff, len) != s + pos ||
+				    memchr(s, 0xff, pos)) {
+					pr_err("memchr: align %zu len %zu pos %zu\n",
+					       align, len, pos);
+					err++;
+				}
+				s[pos] = 0x7f;
+			}
+		}
+	}
+	return err;
+}
+
+static int __init check_memcmp(char *a, char *b)
+{
+	size_t align, len, pos;
+	int err = 0;
+
+	for (align = 0; align < MAX_ALIGN; align++) {
+		for (len = 0; len < MAX_LEN; len++) {
+			char *s = b + align;
+
+			memset(a, 0x40, len);
+			memset(s, 0x40, len);
+			if (memcmp(a, s, len)) {
+				pr_err("memcmp: align %zu len %zu not equal\n",
+				       align, len);
+				err++;
+			}
+			for (pos = 0; pos < len; pos++) {
+				s[pos] = 0x80;
+				if (memcmp(a, s, len) >= 0 ||
+				    memcmp(s, a, len) <= 0 ||
+				    memcmp(a, s, pos)) {
+					pr_err("memcmp: align %zu len %zu pos %zu\n",
+					       align, len, pos);
+					err++;
+				}
+				s[pos] = 0x40;
+			}
+		}
+	}
+	return err;
+}
+
+static u64 __init per_kb(u64 ns)
+{
+	return div_u64(ns * 1024, max(iterations, 1) * BENCH_LEN);
+}
+
+static void __init bench(char *a, char *b)
+{
+	u64 start, strlen_ns, memchr_ns, memcmp_ns;
+	size_t sum = 0;
+	int i;
+
+	memset(a, 'a', BENCH_LEN);
+	a[BENCH_LEN - 1] = '\0';
+	memcpy(b, a, BENCH_LEN);
+
+	start = ktime_get_ns();
+	for (i = 0; i < iterations; i++)
+		sum += strlen(a);
+	strlen_ns = ktime_get_ns() - start;
+
+	start = ktime_get_ns();
+	for (i = 0; i < iterations; i++)
+		sum += memchr(a, 0, BENCH_LEN) != NULL;
+	memchr_ns = ktime_get_ns() - start;
+
+	start = ktime_get_ns();
+	for (i = 0; i < iterations; i++)
+		sum += memcmp(a, b, BENCH_LEN);
+	memcmp_ns = ktime_get_ns() - start;
+
+	pr_info("strlen: %llu ns/KiB, memchr: %llu ns/KiB, memcmp: %llu ns/KiB (%zu)\n",
+		per_kb(strlen_ns), per_kb(memchr_ns), per_kb(memcmp_ns), sum);
+}
+
+static int __init test_string_init(void)
+{
+	char *a, *b;
+	int err = 0;
+
+	a = kmalloc(BENCH_LEN, GFP_KERNEL);
+	b = kmalloc(BENCH_LEN + MAX_ALIGN, GFP_KERNEL);
+	if (!a || !b) {
+		kfree(a);
+		kfree(b);
+		return -ENOMEM;
+	}
+
+	err += check_strlen(a, BENCH_LEN);
+	err += check_memchr(a, BENCH_LEN);
+	err += check_memcmp(a, b);
+	if (!err)
+		bench(a, b);
+
+	kfree(a);
+	kfree(b);
+
+	if (err) {
+		pr_warn("failed: %d errors\n", err);
+		return -EINVAL;
+	}
+	pr_info("all tests passed\n");
+	return 0;
+}
+
+static void __exit test_string_exit(void)
+{
+}
+
+module_init(test_string_init);
+module_exit(test_string_exit);
+
+MODULE_LICENSE("GPL v2");
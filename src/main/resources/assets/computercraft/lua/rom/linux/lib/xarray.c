@@ -0,0 +1,476 @@
+/*
+ * eXtensible Arrays
+ *
+ * The XArray keeps the radix tree as its storage and adds the lock, the
+ * allocation retry and the iteration helpers that every radix tree user
+ * used to open-code.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2, or (at
+ * your option) any later version.
+ */
+
+#include <linux/export.h>
+#include <linux/rcupdate.h>
+#include <linux/xarray.h>
+
+/**
+ * xa_load() - load an entry from an XArray
+ * @xa: XArray
+ * @index: index into array
+ *
+ * Context: Any context.  Takes and releases the RCU lock.
+ * Return: The entry at @index, or %NULL.
+ */
+void *xa_load(struct xarray *xa, unsigned long index)
+{
+	void *entry;
+
+	rcu_read_lock();
+	entry = radix_tree_lookup(&xa->xa_tree, index);
+	rcu_read_unlock();
+
+	return entry;
+}
+EXPORT_SYMBOL(xa_load);
+
+/**
+ * __xa_erase() - erase an entry while holding the xa_lock
+ * @xa: XArray
+ * @index: index into array
+ *
+ * An entry covering several indices is erased as a whole, whichever of
+ * its indices @index is.  The marks of the entry are cleared.
+ *
+ * Context: Any context.  Expects xa_lock to be held on entry.
+ * Return: The entry which used to be at @index.
+ */
+void *__xa_erase(struct xarray *xa, unsigned long index)
+{
+	return radix_tree_delete(&xa->xa_tree, index);
+}
+EXPORT_SYMBOL(__xa_erase);
+
+/**
+ * __xa_store() - store an entry while holding the xa_lock
+ * @xa: XArray
+ * @index: index into array
+ * @entry: new entry
+ *
+ * Storing %NULL is the same as erasing the entry.  Any nodes needed are
+ * allocated without sleeping, from the radix tree preloads if the atomic
+ * allocation fails, so the caller has to preload when it cannot afford
+ * -ENOMEM.
+ *
+ * Context: Any context.  Expects xa_lock to be held on entry.
+ * Return: The old entry at @index, or an error pointer (see xa_err()).
+ */
+void *__xa_store(struct xarray *xa, unsigned long index, void *entry)
+{
+	struct radix_tree_node *node;
+	void __rcu **slot;
+	void *curr;
+	int err;
+
+	if (WARN_ON_ONCE(radix_tree_is_internal_node(entry)))
+		return ERR_PTR(-EINVAL);
+	if (!entry)
+		return __xa_erase(xa, index);
+
+	err = __radix_tree_create(&xa->xa_tree, index, 0, &node, &slot);
+	if (err)
+		return ERR_PTR(err);
+
+	curr = rcu_dereference_protected(*slot,
+					 lockdep_is_held(&xa->xa_lock));
+	__radix_tree_replace(&xa->xa_tree, node, slot, entry, NULL, NULL);
+
+	return curr;
+}
+EXPORT_SYMBOL(__xa_store);
+
+/**
+ * xa_store() - store an entry in an XArray
+ * @xa: XArray
+ * @index: index into array
+ * @entry: new entry
+ * @gfp: memory allocation flags
+ *
+ * Nodes are preallocated with @gfp before the xa_lock is taken, so @gfp
+ * may sleep even though the store itself is done under a spinlock.
+ *
+ * Context: Process context if @gfp allows blocking.  Takes and releases
+ * the xa_lock, which must not be taken from interrupts by other users.
+ * Return: The old entry at @index, or an error pointer (see xa_err()).
+ */
+void *xa_store(struct xarray *xa, unsigned long index, void *entry, gfp_t gfp)
+{
+	void *curr;
+
+	if (entry && radix_tree_maybe_preload(gfp))
+		return ERR_PTR(-ENOMEM);
+
+	xa_lock(xa);
+	curr = __xa_store(xa, index, entry);
+	xa_unlock(xa);
+
+	if (entry)
+		radix_tree_preload_end();
+
+	return curr;
+}
+EXPORT_SYMBOL(xa_store);
+
+/**
+ * xa_erase() - erase an entry from an XArray
+ * @xa: XArray
+ * @index: index into array
+ *
+ * Context: Takes and releases the xa_lock.
+ * Return: The entry which used to be at @index.
+ */
+void *xa_erase(struct xarray *xa, unsigned long index)
+{
+	void *entry;
+
+	xa_lock(xa);
+	entry = __xa_erase(xa, index);
+	xa_unlock(xa);
+
+	return entry;
+}
+EXPORT_SYMBOL(xa_erase);
+
+/**
+ * __xa_cmpxchg() - conditionally replace an entry while holding the xa_lock
+ * @xa: XArray
+ * @index: index into array
+ * @old: entry expected at @index, may be %NULL
+ * @entry: new entry, may be %NULL
+ *
+ * Context: Any context.  Expects xa_lock to be held on entry.
+ * Return: The entry found at @index; @entry was stored if that is @old.
+ */
+void *__xa_cmpxchg(struct xarray *xa, unsigned long index,
+		   void *old, void *entry)
+{
+	void *curr;
+
+	curr = radix_tree_lookup(&xa->xa_tree, index);
+	if (curr != old)
+		return curr;
+
+	curr = __xa_store(xa, index, entry);
+	return xa_err(curr) ? curr : old;
+}
+EXPORT_SYMBOL(__xa_cmpxchg);
+
+/**
+ * xa_cmpxchg() - conditionally replace an entry in an XArray
+ * @xa: XArray
+ * @index: index into array
+ * @old: entry expected at @index, may be %NULL
+ * @entry: new entry, may be %NULL
+ * @gfp: memory allocation flags
+ *
+ * Context: Process context if @gfp allows blocking.  Takes and releases
+ * the xa_lock.
+ * Return: The entry found at @index, or an error pointer (see xa_err()).
+ */
+void *xa_cmpxchg(struct xarray *xa, unsigned long index,
+		 void *old, void *entry, gfp_t gfp)
+{
+	void *curr;
+
+	if (entry && radix_tree_maybe_preload(gfp))
+		return ERR_PTR(-ENOMEM);
+
+	xa_lock(xa);
+	curr = __xa_cmpxchg(xa, index, old, entry);
+	xa_unlock(xa);
+
+	if (entry)
+		radix_tree_preload_end();
+
+	return curr;
+}
+EXPORT_SYMBOL(xa_cmpxchg);
+
+/**
+ * xa_insert_order() - store an entry covering 2^@order indices
+ * @xa: XArray
+ * @index: first index covered by @entry, aligned to 2^@order
+ * @order: log2 of the number of indices covered
+ * @entry: new entry, must not be %NULL
+ * @gfp: memory allocation flags
+ *
+ * A multi-index entry is found by a lookup of any of its indices, carries a
+ * single set of marks and is erased as a whole.  This is what lets the page
+ * cache store a huge page as one entry instead of one per subpage.  Orders
+ * other than 0 need CONFIG_RADIX_TREE_MULTIORDER.
+ *
+ * Context: Process context if @gfp allows blocking.  Takes and releases
+ * the xa_lock.
+ * Return: 0 on success, -EEXIST if any of the indices is in use, -EINVAL
+ * or -ENOMEM.
+ */
+int xa_insert_order(struct xarray *xa, unsigned long index,
+		    unsigned int order, void *entry, gfp_t gfp)
+{
+	int err;
+
+	if (WARN_ON_ONCE(!entry || radix_tree_is_internal_node(entry)))
+		return -EINVAL;
+	if (order && (!IS_ENABLED(CONFIG_RADIX_TREE_MULTIORDER) ||
+		      WARN_ON_ONCE(index & ((1UL << order) - 1))))
+		return -EINVAL;
+
+	if (radix_tree_maybe_preload_order(gfp, order))
+		return -ENOMEM;
+
+	xa_lock(xa);
+	err = __radix_tree_insert(&xa->xa_tree, index, order, entry);
+	xa_unlock(xa);
+
+	radix_tree_preload_end();
+
+	return err;
+}
+EXPORT_SYMBOL(xa_insert_order);
+
+/**
+ * xa_get_mark() - inquire whether an entry is marked
+ * @xa: XArray
+ * @index: index into array
+ * @mark: XA_MARK_* to test
+ *
+ * Context: Any context.  Takes and releases the RCU lock.
+ */
+bool xa_get_mark(struct xarray *xa, unsigned long index, xa_mark_t mark)
+{
+	bool marked;
+
+	rcu_read_lock();
+	marked = radix_tree_tag_get(&xa->xa_tree, index, mark);
+	rcu_read_unlock();
+
+	return marked;
+}
+EXPORT_SYMBOL(xa_get_mark);
+
+/**
+ * __xa_set_mark() - mark an entry while holding the xa_lock
+ * @xa: XArray
+ * @index: index into array
+ * @mark: XA_MARK_* to set
+ *
+ * Marking an index without an entry does nothing.
+ *
+ * Context: Any context.  Expects xa_lock to be held on entry.
+ */
+void __xa_set_mark(struct xarray *xa, unsigned long index, xa_mark_t mark)
+{
+	if (radix_tree_lookup(&xa->xa_tree, index))
+		radix_tree_tag_set(&xa->xa_tree, index, mark);
+}
+EXPORT_SYMBOL(__xa_set_mark);
+
+/**
+ * __xa_clear_mark() - unmark an entry while holding the xa_lock
+ * @xa: XArray
+ * @index: index into array
+ * @mark: XA_MARK_* to clear
+ *
+ * Context: Any context.  Expects xa_lock to be held on entry.
+ */
+void __xa_clear_mark(struct xarray *xa, unsigned long index, xa_mark_t mark)
+{
+	radix_tree_tag_clear(&xa->xa_tree, index, mark);
+}
+EXPORT_SYMBOL(__xa_clear_mark);
+
+void xa_set_mark(struct xarray *xa, unsigned long index, xa_mark_t mark)
+{
+	xa_lock(xa);
+	__xa_set_mark(xa, index, mark);
+	xa_unlock(xa);
+}
+EXPORT_SYMBOL(xa_set_mark);
+
+void xa_clear_mark(struct xarray *xa, unsigned long index, xa_mark_t mark)
+{
+	xa_lock(xa);
+	__xa_clear_mark(xa, index, mark);
+	xa_unlock(xa);
+}
+EXPORT_SYMBOL(xa_clear_mark);
+
+static inline unsigned int xa_iter_flags(xa_mark_t filter)
+{
+	if (filter == XA_PRESENT)
+		return 0;
+	return RADIX_TREE_ITER_TAGGED | filter;
+}
+
+/*
+ * Find the first entry at or after @start, skipping entries that begin at
+ * or before @skip when @after is set.  The latter is how a multi-index
+ * entry, which a walk starting inside it reports at its first index, is
+ * only returned once.  Called under rcu_read_lock().
+ */
+static void *xa_find_entry(struct xarray *xa, unsigned long start,
+			   unsigned long max, xa_mark_t filter,
+			   bool after, unsigned long skip,
+			   unsigned long *indexp)
+{
+	unsigned int flags = xa_iter_flags(filter);
+	struct radix_tree_iter iter;
+	void __rcu **slot;
+	void *entry;
+
+	for (slot = radix_tree_iter_init(&iter, start);
+	     slot || (slot = radix_tree_next_chunk(&xa->xa_tree, &iter, flags));
+	     slot = radix_tree_next_slot(slot, &iter, flags)) {
+		if (iter.index > max)
+			break;
+		entry = radix_tree_deref_slot(slot);
+		if (radix_tree_deref_retry(entry)) {
+			slot = radix_tree_iter_retry(&iter);
+			continue;
+		}
+		if (!entry || (after && iter.index <= skip))
+			continue;
+
+		*indexp = iter.index;
+		return entry;
+	}
+
+	return NULL;
+}
+
+/**
+ * xa_find() - find the first present or marked entry
+ * @xa: XArray
+ * @indexp: pointer to the index to start at; updated to that of the entry
+ * @max: last index to search
+ * @filter: XA_MARK_* the entry must have, or XA_PRESENT
+ *
+ * Marked searches only descend into subtrees whose mark is set, so they
+ * cost one walk from the root however sparse the marks are.
+ *
+ * Context: Any context.  Takes and releases the RCU lock.
+ * Return: The entry, or %NULL if there is none between *@indexp and @max.
+ */
+void *xa_find(struct xarray *xa, unsigned long *indexp,
+	      unsigned long max, xa_mark_t filter)
+{
+	void *entry;
+
+	rcu_read_lock();
+	entry = xa_find_entry(xa, *indexp, max, filter, false, 0, indexp);
+	rcu_read_unlock();
+
+	return entry;
+}
+EXPORT_SYMBOL(xa_find);
+
+/**
+ * xa_find_after() - find the next present or marked entry
+ * @xa: XArray
+ * @indexp: pointer to the index of the previous entry; updated
+ * @max: last index to search
+ * @filter: XA_MARK_* the entry must have, or XA_PRESENT
+ *
+ * Context: Any context.  Takes and releases the RCU lock.
+ * Return: The first entry beginning after *@indexp, or %NULL.
+ */
+void *xa_find_after(struct xarray *xa, unsigned long *indexp,
+		    unsigned long max, xa_mark_t filter)
+{
+	unsigned long prev = *indexp;
+	void *entry;
+
+	if (prev >= max)
+		return NULL;
+
+	rcu_read_lock();
+	entry = xa_find_entry(xa, prev + 1, max, filter, true, prev, indexp);
+	rcu_read_unlock();
+
+	return entry;
+}
+EXPORT_SYMBOL(xa_find_after);
+
+/**
+ * xa_extract() - copy a range of entries out of an XArray
+ * @xa: XArray
+ * @dst: array of @n pointers to fill
+ * @start: first index to look at
+ * @max: last index to look at
+ * @n: maximum number of entries to copy
+ * @filter: XA_MARK_* the entries must have, or XA_PRESENT
+ *
+ * Unlike a loop of xa_find_after(), this collects all entries in a single
+ * walk of the tree.  It is not an atomic snapshot: entries may be added
+ * or removed concurrently.
+ *
+ * Context: Any context.  Takes and releases the RCU lock.
+ * Return: The number of entries copied.
+ */
+unsigned int xa_extract(struct xarray *xa, void **dst, unsigned long start,
+			unsigned long max, unsigned int n, xa_mark_t filter)
+{
+	unsigned int flags = xa_iter_flags(filter);
+	struct radix_tree_iter iter;
+	void __rcu **slot;
+	unsigned int i = 0;
+	void *entry;
+
+	if (!n)
+		return 0;
+
+	rcu_read_lock();
+	for (slot = radix_tree_iter_init(&iter, start);
+	     slot || (slot = radix_tree_next_chunk(&xa->xa_tree, &iter, flags));
+	     slot = radix_tree_next_slot(slot, &iter, flags)) {
+		if (iter.index > max)
+			break;
+		entry = radix_tree_deref_slot(slot);
+		if (radix_tree_deref_retry(entry)) {
+			slot = radix_tree_iter_retry(&iter);
+			continue;
+		}
+		if (!entry)
+			continue;
+
+		dst[i++] = entry;
+		if (i == n)
+			break;
+	}
+	rcu_read_unlock();
+
+	return i;
+}
+EXPORT_SYMBOL(xa_extract);
+
+/**
+ * xa_destroy() - free all internal data structures
+ * @xa: XArray
+ *
+ * After calling this function the XArray is empty.  The entries themselves
+ * are not freed; use xa_for_each() first if they need to be.
+ *
+ * Context: Takes and releases the xa_lock.
+ */
+void xa_destroy(struct xarray *xa)
+{
+	struct radix_tree_iter iter;
+	void __rcu **slot;
+
+	xa_lock(xa);
+	radix_tree_for_each_slot(slot, &xa->xa_tree, &iter, 0)
+		radix_tree_iter_delete(&xa->xa_tree, &iter, slot);
+	xa_unlock(xa);
+}
+EXPORT_SYMBOL(xa_destroy);
@@ -245,8 +245,9 @@ void __delete_from_page_cache(struct page *page, void *shadow)
 		__mod_node_page_state(page_pgdat(page), NR_SHMEM, -nr);
 		if (PageTransHuge(page))
 			__dec_node_page_state(page, NR_SHMEM_THPS);
-	} else {
-		VM_BUG_ON_PAGE(PageTransHuge(page) && !PageHuge(page), page);
+	} else if (PageTransHuge(page) && !PageHuge(page)) {
+		__dec_node_page_state(page, NR_FILE_THPS);
+		filemap_nr_thps_dec(mapping);
 	}
 
 	/*
@@ -1759,6 +1760,61 @@ static void shrink_readahead_size_eio(struct file *filp,
 	ra->ra_pages /= 4;
 }
 
+/*
+ * do_generic_file_read() takes the pages it is about to copy from in runs,
+ * so that a multi-page read costs one radix tree walk per run instead of
+ * one per page.  The pages of a run are consecutive: pages[i] sits at
+ * index start + i, and the read holds a reference on each of them until
+ * it is consumed or the run is dropped.
+ */
+#define READ_BATCH_SIZE	16
+
+struct read_batch {
+	pgoff_t start;
+	unsigned int nr;
+	unsigned int next;
+	struct page *pages[READ_BATCH_SIZE];
+};
+
+static void read_batch_release(struct read_batch *batch)
+{
+	while (batch->next < batch->nr)
+		put_page(batch->pages[batch->next++]);
+	batch->nr = batch->next = 0;
+}
+
+/*
+ * Return the page at @index with a reference held, taking it from the
+ * current run when possible and otherwise looking up a new run of up to
+ * READ_BATCH_SIZE pages, bounded by @last_index.  Returns NULL if @index
+ * is not in the page cache.
+ */
+static struct page *read_batch_get(struct address_space *mapping,
+				   struct read_batch *batch,
+				   pgoff_t index, pgoff_t last_index)
+{
+	unsigned int nr_pages;
+
+	if (batch->next < batch->nr && batch->start + batch->next == index)
+		return batch->pages[batch->next++];
+
+	read_batch_release(batch);
+	nr_pages = READ_BATCH_SIZE;
+	if (last_index > index && last_index - index < nr_pages)
+		nr_pages = last_index - index;
+
+	batch->start = index;
+	batch->nr = find_get_pages_contig(mapping, index, nr_pages,
+					  batch->pages);
+	count_vm_event(PGCACHE_BATCH);
+	count_vm_events(PGCACHE_BATCH_PAGES, batch->nr);
+	if (!batch->nr)
+		return NULL;
+
+	batch->next = 1;
+	return batch->pages[0];
+}
+
 /**
  * do_generic_file_read - generic file read routine
  * @filp:	the file to read
@@ -1778,6 +1834,7 @@ static ssize_t do_generic_file_read(struct file *filp, loff_t *ppos,
 	struct address_space *mapping = filp->f_mapping;
 	struct inode *inode = mapping->host;
 	struct file_ra_state *ra = &filp->f_ra;
+	struct read_batch batch;
 	pgoff_t index;
 	pgoff_t last_index;
 	pgoff_t prev_index;
@@ -1785,6 +1842,7 @@ static ssize_t do_generic_file_read(struct file *filp, loff_t *ppos,
 	unsigned int prev_offset;
 	int error = 0;
 
+	batch.nr = batch.next = 0;
 	if (unlikely(*ppos >= inode->i_sb->s_maxbytes))
 		return 0;
 	iov_iter_truncate(iter, inode->i_sb->s_maxbytes);
@@ -1808,12 +1866,12 @@ find_page:
 			goto out;
 		}
 
-		page = find_get_page(mapping, index);
+		page = read_batch_get(mapping, &batch, index, last_index);
 		if (!page) {
 			page_cache_sync_readahead(mapping,
 					ra, filp,
 					index, last_index - index);
-			page = find_get_page(mapping, index);
+			page = read_batch_get(mapping, &batch, index, last_index);
 			if (unlikely(page == NULL))
 				goto no_cached_page;
 		}
@@ -2005,6 +2063,7 @@ no_cached_page:
 	}
 
 out:
+	read_batch_release(&batch);
 	ra->prev_pos = prev_index;
 	ra->prev_pos <<= PAGE_SHIFT;
 	ra->prev_pos |= prev_offset;
@@ -256,6 +256,10 @@ int __frontswap_store(struct page *page)
 	VM_BUG_ON(!PageLocked(page));
 	VM_BUG_ON(sis == NULL);
 
+	/* The backends store single pages only */
+	if (PageTransHuge(page))
+		return -1;
+
 	/*
 	 * If a dup, we must remove the old page first; we can't leave the
 	 * old page no matter if the store of the new page succeeds or fails,
@@ -82,6 +82,9 @@ static struct page *follow_page_pte(struct vm_area_struct *vma,
 retry:
 	if (unlikely(pmd_bad(*pmd)))
 		return no_page_table(vma, flags);
+	/* Let the write fault give us a private table first */
+	if ((flags & FOLL_WRITE) && pmd_table_shared(*pmd))
+		return no_page_table(vma, flags);
 
 	ptep = pte_offset_map_lock(mm, pmd, address, &ptl);
 	pte = *ptep;
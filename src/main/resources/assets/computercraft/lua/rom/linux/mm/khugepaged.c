@@ -47,6 +47,8 @@ enum scan_result {
 	SCAN_CGROUP_CHARGE_FAIL,
 	SCAN_EXCEED_SWAP_PTE,
 	SCAN_TRUNCATED,
+	SCAN_PAGE_HAS_PRIVATE,
+	SCAN_PTE_UFFD_WP,
 };
 
 #define CREATE_TRACE_POINTS
@@ -429,10 +431,36 @@ int __khugepaged_enter(struct mm_struct *mm)
 	return 0;
 }
 
+/*
+ * Regular files only get huge pages in their page cache while they are
+ * read-only: the mapping must not be writable and nobody may have the file
+ * open for write.
+ */
+static bool file_thp_suitable(struct vm_area_struct *vma,
+			      unsigned long vm_flags)
+{
+	struct file *file = vma->vm_file;
+
+	if (!IS_ENABLED(CONFIG_READ_ONLY_THP_FOR_FS) || !file ||
+	    shmem_file(file))
+		return false;
+	if (!mapping_thp_support(file->f_mapping))
+		return false;
+	if (vm_flags & (VM_WRITE | VM_NO_KHUGEPAGED))
+		return false;
+	if (atomic_read(&file_inode(file)->i_writecount) > 0)
+		return false;
+	return IS_ALIGNED((vma->vm_start >> PAGE_SHIFT) - vma->vm_pgoff,
+			  HPAGE_PMD_NR);
+}
+
 int khugepaged_enter_vma_merge(struct vm_area_struct *vma,
 			       unsigned long vm_flags)
 {
 	unsigned long hstart, hend;
+
+	if (file_thp_suitable(vma, vm_flags))
+		goto check_range;
 	if (!vma->anon_vma)
 		/*
 		 * Not yet faulted in so we will register later in the
@@ -442,6 +470,7 @@ int khugepaged_enter_vma_merge(struct vm_area_struct *vma,
 	if (vma->vm_ops || (vm_flags & VM_NO_KHUGEPAGED))
 		/* khugepaged not yet working on file or special mappings */
 		return 0;
+check_range:
 	hstart = (vma->vm_start + ~HPAGE_PMD_MASK) & HPAGE_PMD_MASK;
 	hend = vma->vm_end & HPAGE_PMD_MASK;
 	if (hstart < hend)
@@ -828,6 +857,8 @@ static bool hugepage_vma_check(struct vm_area_struct *vma)
 		return IS_ALIGNED((vma->vm_start >> PAGE_SHIFT) - vma->vm_pgoff,
 				HPAGE_PMD_NR);
 	}
+	if (file_thp_suitable(vma, vma->vm_flags))
+		return true;
 	if (!vma->anon_vma || vma->vm_ops)
 		return false;
 	if (is_vma_temporary_stack(vma))
@@ -1014,6 +1045,8 @@ static void collapse_huge_page(struct mm_struct *mm,
 	mmun_start = address;
 	mmun_end   = address + HPAGE_PMD_SIZE;
 	mmu_notifier_invalidate_range_start(mm, mmun_start, mmun_end);
+	/* Turn away speculative faults while the pmd is in flux */
+	vm_write_begin(vma);
 	pmd_ptl = pmd_lock(mm, pmd); /* probably unnecessary */
 	/*
 	 * After this gup_fast can't run anymore. This also removes
@@ -1040,6 +1073,7 @@ static void collapse_huge_page(struct mm_struct *mm,
 		 */
 		pmd_populate(mm, pmd, pmd_pgtable(_pmd));
 		spin_unlock(pmd_ptl);
+		vm_write_end(vma);
 		anon_vma_unlock_write(vma->anon_vma);
 		result = SCAN_FAIL;
 		goto out;
@@ -1075,6 +1109,7 @@ static void collapse_huge_page(struct mm_struct *mm,
 	set_pmd_at(mm, address, pmd, _pmd);
 	update_mmu_cache_pmd(vma, address, pmd);
 	spin_unlock(pmd_ptl);
+	vm_write_end(vma);
 
 	*hpage = NULL;
 
@@ -1118,6 +1153,14 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 	     _pte++, _address += PAGE_SIZE) {
 		pte_t pteval = *_pte;
 		if (is_swap_pte(pteval)) {
+			/*
+			 * The uffd-wp marker is per-pte and cannot survive
+			 * a collapse into a huge pmd.
+			 */
+			if (pte_swp_uffd_wp(pteval)) {
+				result = SCAN_PTE_UFFD_WP;
+				goto out_unmap;
+			}
 			if (++unmapped <= khugepaged_max_ptes_swap) {
 				continue;
 			} else {
@@ -1138,6 +1181,10 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 			result = SCAN_PTE_NON_PRESENT;
 			goto out_unmap;
 		}
+		if (pte_uffd_wp(pteval)) {
+			result = SCAN_PTE_UFFD_WP;
+			goto out_unmap;
+		}
 		if (pte_write(pteval))
 			writable = true;
 
@@ -1278,7 +1325,7 @@ static void retract_page_tables(struct address_space *mapping, pgoff_t pgoff)
 }
 
 /**
- * collapse_shmem - collapse small tmpfs/shmem pages into huge one.
+ * collapse_file - collapse small tmpfs/shmem or file pages into huge one.
  *
  * Basic scheme is simple, details are more complex:
  *  - allocate and freeze a new huge page;
@@ -1294,11 +1341,15 @@ static void retract_page_tables(struct address_space *mapping, pgoff_t pgoff)
  *    + put all pages back and unfreeze them;
  *    + restore gaps in the radix-tree;
  *    + free huge page;
+ *
+ * Pages of a regular file can't be instantiated here: all of them have to
+ * be in the page cache, uptodate and clean already.
  */
-static void collapse_shmem(struct mm_struct *mm,
-		struct address_space *mapping, pgoff_t start,
-		struct page **hpage, int node)
+static void collapse_file(struct mm_struct *mm, struct file *file,
+		pgoff_t start, struct page **hpage, int node)
 {
+	struct address_space *mapping = file->f_mapping;
+	bool is_shmem = shmem_file(file);
 	gfp_t gfp;
 	struct page *page, *new_page, *tmp;
 	struct mem_cgroup *memcg;
@@ -1308,6 +1359,7 @@ static void collapse_shmem(struct mm_struct *mm,
 	void **slot;
 	int nr_none = 0, result = SCAN_SUCCEED;
 
+	VM_BUG_ON(!IS_ENABLED(CONFIG_READ_ONLY_THP_FOR_FS) && !is_shmem);
 	VM_BUG_ON(start & (HPAGE_PMD_NR - 1));
 
 	/* Only allocate from the target node */
@@ -1326,10 +1378,24 @@ static void collapse_shmem(struct mm_struct *mm,
 
 	new_page->index = start;
 	new_page->mapping = mapping;
-	__SetPageSwapBacked(new_page);
+	if (is_shmem)
+		__SetPageSwapBacked(new_page);
 	__SetPageLocked(new_page);
 	BUG_ON(!page_ref_freeze(new_page, 1));
 
+	if (!is_shmem) {
+		/*
+		 * Count the huge page before checking for writers: pairs
+		 * with the barrier in do_dentry_open(), which drops the huge
+		 * pages of a file opened for write.
+		 */
+		filemap_nr_thps_inc(mapping);
+		smp_mb();
+		if (atomic_read(&mapping->host->i_writecount) > 0) {
+			result = SCAN_FAIL;
+			goto tree_unlocked;
+		}
+	}
 
 	/*
 	 * At this point the new_page is 'frozen' (page_count() is zero), locked
@@ -1346,8 +1412,9 @@ static void collapse_shmem(struct mm_struct *mm,
 		/*
 		 * Handle holes in the radix tree: charge it from shmem and
 		 * insert relevant subpage of new_page into the radix-tree.
+		 * A regular file would have to read the data in first.
 		 */
-		if (n && !shmem_charge(mapping->host, n)) {
+		if (n && (!is_shmem || !shmem_charge(mapping->host, n))) {
 			result = SCAN_FAIL;
 			break;
 		}
@@ -1363,7 +1430,13 @@ static void collapse_shmem(struct mm_struct *mm,
 
 		page = radix_tree_deref_slot_protected(slot,
 				&mapping->tree_lock);
-		if (radix_tree_exceptional_entry(page) || !PageUptodate(page)) {
+		if (!is_shmem && (radix_tree_exceptional_entry(page) ||
+				  !PageUptodate(page))) {
+			/* shadow entry, or the page is still being read */
+			result = SCAN_FAIL;
+			break;
+		} else if (radix_tree_exceptional_entry(page) ||
+			   !PageUptodate(page)) {
 			spin_unlock_irq(&mapping->tree_lock);
 			/* swap in or instantiate fallocated page */
 			if (shmem_getpage(mapping->host, index, &page,
@@ -1393,6 +1466,18 @@ static void collapse_shmem(struct mm_struct *mm,
 		}
 		spin_unlock_irq(&mapping->tree_lock);
 
+		if (!is_shmem && (PageDirty(page) || PageWriteback(page))) {
+			/* written to before, and not written back yet */
+			result = SCAN_FAIL;
+			goto out_isolate_failed;
+		}
+
+		if (page_has_private(page) &&
+		    !try_to_release_page(page, GFP_KERNEL)) {
+			result = SCAN_PAGE_HAS_PRIVATE;
+			goto out_isolate_failed;
+		}
+
 		if (isolate_lru_page(page)) {
 			result = SCAN_DEL_PAGE_LRU;
 			goto out_isolate_failed;
@@ -1454,7 +1539,7 @@ out_unlock:
 	if (result == SCAN_SUCCEED && index < end) {
 		int n = end - index;
 
-		if (!shmem_charge(mapping->host, n)) {
+		if (!is_shmem || !shmem_charge(mapping->host, n)) {
 			result = SCAN_FAIL;
 			goto tree_locked;
 		}
@@ -1491,7 +1576,10 @@ tree_unlocked:
 		}
 
 		local_irq_save(flags);
-		__inc_node_page_state(new_page, NR_SHMEM_THPS);
+		if (is_shmem)
+			__inc_node_page_state(new_page, NR_SHMEM_THPS);
+		else
+			__inc_node_page_state(new_page, NR_FILE_THPS);
 		if (nr_none) {
 			__mod_node_page_state(zone->zone_pgdat, NR_FILE_PAGES, nr_none);
 			__mod_node_page_state(zone->zone_pgdat, NR_SHMEM, nr_none);
@@ -1505,17 +1593,24 @@ tree_unlocked:
 		retract_page_tables(mapping, start);
 
 		/* Everything is ready, let's unfreeze the new_page */
-		set_page_dirty(new_page);
+		if (is_shmem)
+			set_page_dirty(new_page);
 		SetPageUptodate(new_page);
 		page_ref_unfreeze(new_page, HPAGE_PMD_NR);
 		mem_cgroup_commit_charge(new_page, memcg, false, true);
-		lru_cache_add_anon(new_page);
+		if (is_shmem)
+			lru_cache_add_anon(new_page);
+		else
+			lru_cache_add_file(new_page);
 		unlock_page(new_page);
 
 		*hpage = NULL;
 	} else {
 		/* Something went wrong: rollback changes to the radix-tree */
-		shmem_uncharge(mapping->host, nr_none);
+		if (is_shmem)
+			shmem_uncharge(mapping->host, nr_none);
+		else
+			filemap_nr_thps_dec(mapping);
 		spin_lock_irq(&mapping->tree_lock);
 		radix_tree_for_each_slot(slot, &mapping->page_tree, &iter,
 				start) {
@@ -1560,10 +1655,11 @@ out:
 	/* TODO: tracepoints */
 }
 
-static void khugepaged_scan_shmem(struct mm_struct *mm,
-		struct address_space *mapping,
+static void khugepaged_scan_file(struct mm_struct *mm, struct file *file,
 		pgoff_t start, struct page **hpage)
 {
+	struct address_space *mapping = file->f_mapping;
+	bool is_shmem = shmem_file(file);
 	struct page *page = NULL;
 	struct radix_tree_iter iter;
 	void **slot;
@@ -1571,6 +1667,11 @@ static void khugepaged_scan_shmem(struct mm_struct *mm,
 	int node = NUMA_NO_NODE;
 	int result = SCAN_SUCCEED;
 
+	/* The huge page must not reach beyond the end of a regular file */
+	if (!is_shmem && start + HPAGE_PMD_NR >
+	    DIV_ROUND_UP(i_size_read(mapping->host), PAGE_SIZE))
+		return;
+
 	present = 0;
 	swap = 0;
 	memset(khugepaged_node_load, 0, sizeof(khugepaged_node_load));
@@ -1586,6 +1687,9 @@ static void khugepaged_scan_shmem(struct mm_struct *mm,
 		}
 
 		if (radix_tree_exception(page)) {
+			/* A shadow entry is just a hole in a regular file */
+			if (!is_shmem)
+				continue;
 			if (++swap > khugepaged_max_ptes_swap) {
 				result = SCAN_EXCEED_SWAP_PTE;
 				break;
@@ -1610,7 +1714,8 @@ static void khugepaged_scan_shmem(struct mm_struct *mm,
 			break;
 		}
 
-		if (page_count(page) != 1 + page_mapcount(page)) {
+		if (page_count(page) !=
+		    1 + page_mapcount(page) + page_has_private(page)) {
 			result = SCAN_PAGE_COUNT;
 			break;
 		}
@@ -1633,17 +1738,25 @@ static void khugepaged_scan_shmem(struct mm_struct *mm,
 	if (result == SCAN_SUCCEED) {
 		if (present < HPAGE_PMD_NR - khugepaged_max_ptes_none) {
 			result = SCAN_EXCEED_NONE_PTE;
+		} else if (!is_shmem && present < HPAGE_PMD_NR) {
+			/*
+			 * Only shmem can fill holes with zeroes.  Read the
+			 * rest of the range in, it is collapsed on the next
+			 * pass over this mm.
+			 */
+			__do_page_cache_readahead(mapping, file, start,
+						  HPAGE_PMD_NR, 0);
+			result = SCAN_EXCEED_NONE_PTE;
 		} else {
 			node = khugepaged_find_target_node();
-			collapse_shmem(mm, mapping, start, hpage, node);
+			collapse_file(mm, file, start, hpage, node);
 		}
 	}
 
 	/* TODO: tracepoints */
 }
 #else
-static void khugepaged_scan_shmem(struct mm_struct *mm,
-		struct address_space *mapping,
+static void khugepaged_scan_file(struct mm_struct *mm, struct file *file,
 		pgoff_t start, struct page **hpage)
 {
 	BUILD_BUG();
@@ -1713,17 +1826,17 @@ skip:
 			VM_BUG_ON(khugepaged_scan.address < hstart ||
 				  khugepaged_scan.address + HPAGE_PMD_SIZE >
 				  hend);
-			if (shmem_file(vma->vm_file)) {
+			if (IS_ENABLED(CONFIG_SHMEM) && vma->vm_file) {
 				struct file *file;
 				pgoff_t pgoff = linear_page_index(vma,
 						khugepaged_scan.address);
-				if (!shmem_huge_enabled(vma))
+				if (shmem_file(vma->vm_file) &&
+				    !shmem_huge_enabled(vma))
 					goto skip;
 				file = get_file(vma->vm_file);
 				up_read(&mm->mmap_sem);
 				ret = 1;
-				khugepaged_scan_shmem(mm, file->f_mapping,
-						pgoff, hpage);
+				khugepaged_scan_file(mm, file, pgoff, hpage);
 				fput(file);
 			} else {
 				ret = khugepaged_scan_pmd(mm, vma,
@@ -25,7 +25,7 @@
 #include <linux/pagemap.h>
 #include <linux/rmap.h>
 #include <linux/spinlock.h>
-#include <linux/jhash.h>
+#include <linux/xxhash.h>
 #include <linux/delay.h>
 #include <linux/kthread.h>
 #include <linux/wait.h>
@@ -131,6 +131,7 @@ struct ksm_scan {
  * @list: linked into migrate_nodes, pending placement in the proper node tree
  * @hlist: hlist head of rmap_items using this ksm page
  * @kpfn: page frame number of this ksm page (perhaps temporarily on wrong nid)
+ * @checksum: checksum of the ksm page, the first key of the stable tree
  * @nid: NUMA node id of stable tree in which linked (may not match kpfn)
  */
 struct stable_node {
@@ -143,6 +144,7 @@ struct stable_node {
 	};
 	struct hlist_head hlist;
 	unsigned long kpfn;
+	u32 checksum;
 #ifdef CONFIG_NUMA
 	int nid;
 #endif
@@ -155,7 +157,8 @@ struct stable_node {
  * @nid: NUMA node id of unstable tree in which linked (may not match page)
  * @mm: the memory structure this rmap_item is pointing into
  * @address: the virtual address this rmap_item tracks (+ flags in low bits)
- * @oldchecksum: previous checksum of the page at that virtual address
+ * @oldchecksum: previous checksum of the page at that virtual address,
+ *		 the first key of the unstable tree while linked there
  * @node: rb node of this rmap_item in the unstable tree
  * @head: pointer to stable_node heading this list in the stable tree
  * @hlist: link into hlist of rmap_items hanging off that stable_node
@@ -203,6 +206,38 @@ static struct ksm_scan ksm_scan = {
 	.mm_slot = &ksm_mm_head,
 };
 
+/*
+ * ksmd gathers the pages it scans in batches, so that their checksums
+ * can be calculated in parallel by the scanner thread of each page's
+ * node before the batch is compared and merged in order.
+ */
+#define KSM_SCAN_BATCH	64
+
+struct ksm_scan_item {
+	struct rmap_item *rmap_item;
+	struct page *page;
+	u32 checksum;
+	int nid;		/* scanner to checksum it, or NUMA_NO_NODE */
+};
+
+static struct ksm_scan_item ksm_scan_batch[KSM_SCAN_BATCH];
+static unsigned int ksm_scan_batch_nr;
+
+/**
+ * struct ksm_node_scanner - per-node checksum thread
+ * @worker: kthread worker bound to the node's cpus
+ * @work: checksums the pages of the batch that are on @nid
+ * @nid: NUMA node id served by this scanner
+ */
+struct ksm_node_scanner {
+	struct kthread_worker *worker;
+	struct kthread_work work;
+	int nid;
+};
+
+/* Indexed by nid, NULL unless there is more than one node with memory */
+static struct ksm_node_scanner *ksm_node_scanners;
+
 static struct kmem_cache *rmap_item_cache;
 static struct kmem_cache *stable_node_cache;
 static struct kmem_cache *mm_slot_cache;
@@ -831,7 +866,7 @@ static u32 calc_checksum(struct page *page)
 {
 	u32 checksum;
 	void *addr = kmap_atomic(page);
-	checksum = jhash2(addr, PAGE_SIZE / 4, 17);
+	checksum = xxhash(addr, PAGE_SIZE, 0);
 	kunmap_atomic(addr);
 	return checksum;
 }
@@ -854,6 +889,21 @@ static inline int pages_identical(struct page *page1, struct page *page2)
 	return !memcmp_pages(page1, page2);
 }
 
+/*
+ * Both trees are ordered by checksum first and by content only among
+ * pages with the same checksum: a search then compares the contents of
+ * a page once, on the final match, instead of once per tree level.
+ */
+static int cmp_pages(struct page *page, u32 checksum,
+		     struct page *tree_page, u32 tree_checksum)
+{
+	if (checksum < tree_checksum)
+		return -1;
+	if (checksum > tree_checksum)
+		return 1;
+	return memcmp_pages(page, tree_page);
+}
+
 static int write_protect_page(struct vm_area_struct *vma, struct page *page,
 			      pte_t *orig_pte)
 {
@@ -881,6 +931,9 @@ static int write_protect_page(struct vm_area_struct *vma, struct page *page,
 		goto out_mn;
 	if (WARN_ONCE(!pvmw.pte, "Unexpected PMD mapping?"))
 		goto out_unlock;
+	/* replace_page() could not install the kpage anyway */
+	if (pmd_table_shared(*pvmw.pmd))
+		goto out_unlock;
 
 	if (pte_write(*pvmw.pte) || pte_dirty(*pvmw.pte) ||
 	    (pte_protnone(*pvmw.pte) && pte_savedwrite(*pvmw.pte))) {
@@ -1028,6 +1081,12 @@ static int try_to_merge_one_page(struct vm_area_struct *vma,
 		goto out;
 
 	if (PageTransCompound(page)) {
+		/*
+		 * Splitting cannot be undone: don't split the huge page
+		 * only to find that this part of it no longer matches.
+		 */
+		if (kpage && !pages_identical(page, kpage))
+			goto out_unlock;
 		err = split_huge_page(page);
 		if (err)
 			goto out_unlock;
@@ -1148,7 +1207,7 @@ static struct page *try_to_merge_two_pages(struct rmap_item *rmap_item,
  * This function returns the stable tree node of identical content if found,
  * NULL otherwise.
  */
-static struct page *stable_tree_search(struct page *page)
+static struct page *stable_tree_search(struct page *page, u32 checksum)
 {
 	int nid;
 	struct rb_root *root;
@@ -1163,6 +1222,8 @@ static struct page *stable_tree_search(struct page *page)
 		get_page(page);
 		return page;
 	}
+	if (page_node)
+		checksum = page_node->checksum;
 
 	nid = get_kpfn_nid(page_to_pfn(page));
 	root = root_stable_tree + nid;
@@ -1190,7 +1251,8 @@ again:
 			goto again;
 		}
 
-		ret = memcmp_pages(page, tree_page);
+		ret = cmp_pages(page, checksum,
+				tree_page, stable_node->checksum);
 		put_page(tree_page);
 
 		parent = *new;
@@ -1266,10 +1328,17 @@ static struct stable_node *stable_tree_insert(struct page *kpage)
 	struct rb_node **new;
 	struct rb_node *parent;
 	struct stable_node *stable_node;
+	u32 checksum;
 
 	kpfn = page_to_pfn(kpage);
 	nid = get_kpfn_nid(kpfn);
 	root = root_stable_tree + nid;
+
+	/*
+	 * kpage is write-protected by now, unlike when it was checksummed
+	 * during the scan: take the key it keeps for its life in the tree.
+	 */
+	checksum = calc_checksum(kpage);
 again:
 	parent = NULL;
 	new = &root->rb_node;
@@ -1294,7 +1363,8 @@ again:
 			goto again;
 		}
 
-		ret = memcmp_pages(kpage, tree_page);
+		ret = cmp_pages(kpage, checksum,
+				tree_page, stable_node->checksum);
 		put_page(tree_page);
 
 		parent = *new;
@@ -1318,6 +1388,7 @@ again:
 
 	INIT_HLIST_HEAD(&stable_node->hlist);
 	stable_node->kpfn = kpfn;
+	stable_node->checksum = checksum;
 	set_page_stable_node(kpage, stable_node);
 	DO_NUMA(stable_node->nid = nid);
 	rb_link_node(&stable_node->node, parent, new);
@@ -1342,7 +1413,7 @@ again:
  */
 static
 struct rmap_item *unstable_tree_search_insert(struct rmap_item *rmap_item,
-					      struct page *page,
+					      struct page *page, u32 checksum,
 					      struct page **tree_pagep)
 {
 	struct rb_node **new;
@@ -1373,7 +1444,8 @@ struct rmap_item *unstable_tree_search_insert(struct rmap_item *rmap_item,
 			return NULL;
 		}
 
-		ret = memcmp_pages(page, tree_page);
+		ret = cmp_pages(page, checksum,
+				tree_page, tree_rmap_item->oldchecksum);
 
 		parent = *new;
 		if (ret < 0) {
@@ -1433,14 +1505,15 @@ static void stable_tree_append(struct rmap_item *rmap_item,
  *
  * @page: the page that we are searching identical page to.
  * @rmap_item: the reverse mapping into the virtual address of this page
+ * @checksum: checksum of the page's contents taken by the scanner
  */
-static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
+static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item,
+			       u32 checksum)
 {
 	struct rmap_item *tree_rmap_item;
 	struct page *tree_page = NULL;
 	struct stable_node *stable_node;
 	struct page *kpage;
-	unsigned int checksum;
 	int err;
 
 	stable_node = page_stable_node(page);
@@ -1458,7 +1531,7 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 	}
 
 	/* We first start with searching the page inside the stable tree */
-	kpage = stable_tree_search(page);
+	kpage = stable_tree_search(page, checksum);
 	if (kpage == page && rmap_item->head == stable_node) {
 		put_page(kpage);
 		return;
@@ -1487,7 +1560,6 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 	 * don't want to insert it in the unstable tree, and we don't want
 	 * to waste our time searching for something identical to it there.
 	 */
-	checksum = calc_checksum(page);
 	if (rmap_item->oldchecksum != checksum) {
 		rmap_item->oldchecksum = checksum;
 		return;
@@ -1511,7 +1583,8 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 			return;
 	}
 	tree_rmap_item =
-		unstable_tree_search_insert(rmap_item, page, &tree_page);
+		unstable_tree_search_insert(rmap_item, page, checksum,
+					    &tree_page);
 	if (tree_rmap_item) {
 		kpage = try_to_merge_two_pages(rmap_item, page,
 						tree_rmap_item, tree_page);
@@ -1571,7 +1644,13 @@ static struct rmap_item *get_next_rmap_item(struct mm_slot *mm_slot,
 	return rmap_item;
 }
 
-static struct rmap_item *scan_get_next_rmap_item(struct page **page)
+/*
+ * Returns ERR_PTR(-EAGAIN) instead of leaving the current mm_slot while
+ * @batch_pending: its rmap_items may be freed past that point, so the
+ * batch holding some of them has to be processed first.
+ */
+static struct rmap_item *scan_get_next_rmap_item(struct page **page,
+						 bool batch_pending)
 {
 	struct mm_struct *mm;
 	struct mm_slot *slot;
@@ -1677,6 +1756,11 @@ next_mm:
 		}
 	}
 
+	if (batch_pending) {
+		up_read(&mm->mmap_sem);
+		return ERR_PTR(-EAGAIN);
+	}
+
 	if (ksm_test_exit(mm)) {
 		ksm_scan.address = 0;
 		ksm_scan.rmap_list = &slot->rmap_list;
@@ -1729,6 +1813,76 @@ next_mm:
 	return NULL;
 }
 
+static void ksm_node_scan_fn(struct kthread_work *work)
+{
+	struct ksm_node_scanner *scanner;
+	unsigned int i;
+
+	scanner = container_of(work, struct ksm_node_scanner, work);
+	for (i = 0; i < ksm_scan_batch_nr; i++) {
+		struct ksm_scan_item *item = &ksm_scan_batch[i];
+
+		if (item->nid == scanner->nid)
+			item->checksum = calc_checksum(item->page);
+	}
+}
+
+static void ksm_scan_add(struct page *page, struct rmap_item *rmap_item)
+{
+	struct ksm_scan_item *item = &ksm_scan_batch[ksm_scan_batch_nr++];
+	int nid = page_to_nid(page);
+
+	item->rmap_item = rmap_item;
+	item->page = page;
+	item->checksum = 0;
+	/* A ksm page is write-protected: its stable_node has the checksum */
+	if (PageKsm(page) || !ksm_node_scanners ||
+	    !ksm_node_scanners[nid].worker)
+		item->nid = NUMA_NO_NODE;
+	else
+		item->nid = nid;
+}
+
+/*
+ * Checksum the batch, fanned out to the scanner threads of the nodes
+ * the pages are on, then compare and merge its pages in scan order.
+ */
+static void ksm_scan_flush(void)
+{
+	nodemask_t queued = NODE_MASK_NONE;
+	unsigned int i;
+	int nid;
+
+	for (i = 0; i < ksm_scan_batch_nr; i++) {
+		nid = ksm_scan_batch[i].nid;
+		if (nid == NUMA_NO_NODE || node_isset(nid, queued))
+			continue;
+		node_set(nid, queued);
+		kthread_queue_work(ksm_node_scanners[nid].worker,
+				   &ksm_node_scanners[nid].work);
+	}
+
+	for (i = 0; i < ksm_scan_batch_nr; i++) {
+		struct ksm_scan_item *item = &ksm_scan_batch[i];
+
+		if (item->nid == NUMA_NO_NODE && !PageKsm(item->page))
+			item->checksum = calc_checksum(item->page);
+	}
+
+	for_each_node_mask(nid, queued)
+		kthread_flush_work(&ksm_node_scanners[nid].work);
+
+	for (i = 0; i < ksm_scan_batch_nr; i++) {
+		struct ksm_scan_item *item = &ksm_scan_batch[i];
+
+		cond_resched();
+		cmp_and_merge_page(item->page, item->rmap_item,
+				   item->checksum);
+		put_page(item->page);
+	}
+	ksm_scan_batch_nr = 0;
+}
+
 /**
  * ksm_do_scan  - the ksm scanner main worker function.
  * @scan_npages - number of pages we want to scan before we return.
@@ -1738,14 +1892,22 @@ static void ksm_do_scan(unsigned int scan_npages)
 	struct rmap_item *rmap_item;
 	struct page *uninitialized_var(page);
 
-	while (scan_npages-- && likely(!freezing(current))) {
+	while (scan_npages && likely(!freezing(current))) {
 		cond_resched();
-		rmap_item = scan_get_next_rmap_item(&page);
+		rmap_item = scan_get_next_rmap_item(&page,
+						    ksm_scan_batch_nr != 0);
+		if (IS_ERR(rmap_item)) {
+			ksm_scan_flush();
+			continue;
+		}
 		if (!rmap_item)
-			return;
-		cmp_and_merge_page(page, rmap_item);
-		put_page(page);
+			break;
+		scan_npages--;
+		ksm_scan_add(page, rmap_item);
+		if (ksm_scan_batch_nr == KSM_SCAN_BATCH)
+			ksm_scan_flush();
 	}
+	ksm_scan_flush();
 }
 
 static int ksmd_should_run(void)
@@ -2365,6 +2527,44 @@ static struct attribute_group ksm_attr_group = {
 };
 #endif /* CONFIG_SYSFS */
 
+/*
+ * With memory on more than one node, give each such node a thread of
+ * its own to read and checksum the pages found there.  Pages on a node
+ * without one, say because it was hot-added later, are done by ksmd.
+ */
+static void __init ksm_node_scanners_init(void)
+{
+	int nid;
+
+	if (num_node_state(N_MEMORY) < 2)
+		return;
+
+	ksm_node_scanners = kcalloc(nr_node_ids, sizeof(*ksm_node_scanners),
+				    GFP_KERNEL);
+	if (!ksm_node_scanners)
+		return;
+
+	for_each_node_state(nid, N_MEMORY) {
+		struct ksm_node_scanner *scanner = &ksm_node_scanners[nid];
+		const struct cpumask *cpumask = cpumask_of_node(nid);
+		struct kthread_worker *worker;
+
+		worker = kthread_create_worker(0, "ksmd/%d", nid);
+		if (IS_ERR(worker)) {
+			pr_warn("ksm: creating scanner for node %d failed\n",
+				nid);
+			continue;
+		}
+		if (!cpumask_empty(cpumask))
+			set_cpus_allowed_ptr(worker->task, cpumask);
+		set_user_nice(worker->task, 5);
+
+		scanner->nid = nid;
+		kthread_init_work(&scanner->work, ksm_node_scan_fn);
+		scanner->worker = worker;
+	}
+}
+
 static int __init ksm_init(void)
 {
 	struct task_struct *ksm_thread;
@@ -2379,6 +2579,8 @@ static int __init ksm_init(void)
 	if (err)
 		goto out;
 
+	ksm_node_scanners_init();
+
 	ksm_thread = kthread_run(ksm_scan_thread, NULL, "ksmd");
 	if (IS_ERR(ksm_thread)) {
 		pr_err("ksm: creating kthread failed\n");
@@ -597,6 +597,143 @@ static unsigned long mem_cgroup_read_events(struct mem_cgroup *memcg,
 	return val;
 }
 
+/*
+ * size of first charge trial. "32" comes from vmscan.c's magic value.
+ * TODO: maybe necessary to use big numbers in big irons.
+ */
+#define CHARGE_BATCH	32U
+
+/*
+ * Readers of memory.stat and the root usage do not sum the percpu
+ * counters of every memcg in the subtree themselves, they use totals
+ * that are brought up to date by a flush.  The flush folds the percpu
+ * deltas since the previous flush into each memcg and its ancestors.
+ * It is only done once enough pages were charged or uncharged for the
+ * cached totals to be noticeably off, and every couple of seconds to
+ * bound the staleness of the counters that do not count towards it.
+ */
+#define MEMCG_FLUSH_PERIOD	(2UL * HZ)
+
+static DEFINE_PER_CPU(unsigned int, memcg_stats_updates);
+static atomic_t memcg_stats_flush_threshold = ATOMIC_INIT(0);
+static DEFINE_MUTEX(memcg_stats_flush_mutex);
+static void memcg_stats_flush_work(struct work_struct *w);
+static DECLARE_DEFERRABLE_WORK(memcg_stats_flush_dwork,
+			       memcg_stats_flush_work);
+
+/* Called with interrupts disabled */
+static void memcg_stats_updated(int nr_pages)
+{
+	unsigned int x;
+
+	x = __this_cpu_add_return(memcg_stats_updates, abs(nr_pages));
+	if (x > CHARGE_BATCH) {
+		atomic_add(x / CHARGE_BATCH, &memcg_stats_flush_threshold);
+		__this_cpu_write(memcg_stats_updates, 0);
+	}
+}
+
+static void mem_cgroup_flush_one(struct mem_cgroup *memcg)
+{
+	long stat[MEMCG_NR_STAT] = { };
+	unsigned long events[MEMCG_NR_EVENTS] = { };
+	struct mem_cgroup *mi;
+	int cpu, i;
+
+	for_each_possible_cpu(cpu) {
+		struct mem_cgroup_stat_cpu *pcp = per_cpu_ptr(memcg->stat, cpu);
+		long v;
+
+		for (i = 0; i < MEMCG_NR_STAT; i++) {
+			v = READ_ONCE(pcp->count[i]);
+			stat[i] += v - pcp->count_flushed[i];
+			pcp->count_flushed[i] = v;
+		}
+		for (i = 0; i < MEMCG_NR_EVENTS; i++) {
+			v = READ_ONCE(pcp->events[i]);
+			events[i] += v - pcp->events_flushed[i];
+			pcp->events_flushed[i] = v;
+		}
+	}
+
+	for (i = 0; i < MEMCG_NR_STAT; i++)
+		memcg->stat_local[i] += stat[i];
+	for (i = 0; i < MEMCG_NR_EVENTS; i++)
+		memcg->events_local[i] += events[i];
+
+	for (mi = memcg; mi; mi = parent_mem_cgroup(mi)) {
+		for (i = 0; i < MEMCG_NR_STAT; i++)
+			mi->stat_tree[i] += stat[i];
+		for (i = 0; i < MEMCG_NR_EVENTS; i++)
+			mi->events_tree[i] += events[i];
+	}
+}
+
+static void __mem_cgroup_flush_stats(void)
+{
+	struct cgroup_subsys_state *css;
+
+	/* Somebody else is flushing, their result is as good as ours */
+	if (!mutex_trylock(&memcg_stats_flush_mutex))
+		return;
+
+	atomic_set(&memcg_stats_flush_threshold, 0);
+	rcu_read_lock();
+	css_for_each_descendant_pre(css, &root_mem_cgroup->css)
+		mem_cgroup_flush_one(mem_cgroup_from_css(css));
+	rcu_read_unlock();
+
+	mutex_unlock(&memcg_stats_flush_mutex);
+}
+
+/* Bring the cached totals up to date if they drifted too far */
+static void mem_cgroup_flush_stats(void)
+{
+	if (atomic_read(&memcg_stats_flush_threshold) > num_online_cpus())
+		__mem_cgroup_flush_stats();
+}
+
+static void memcg_stats_flush_work(struct work_struct *w)
+{
+	__mem_cgroup_flush_stats();
+	queue_delayed_work(system_unbound_wq, &memcg_stats_flush_dwork,
+			   MEMCG_FLUSH_PERIOD);
+}
+
+/*
+ * A memcg that goes away takes its counters out of the subtree totals
+ * of its ancestors, like summing over the live memcgs would.
+ */
+static void mem_cgroup_flush_free(struct mem_cgroup *memcg)
+{
+	struct mem_cgroup *mi;
+	int i;
+
+	mutex_lock(&memcg_stats_flush_mutex);
+	mem_cgroup_flush_one(memcg);
+	for (mi = parent_mem_cgroup(memcg); mi; mi = parent_mem_cgroup(mi)) {
+		for (i = 0; i < MEMCG_NR_STAT; i++)
+			mi->stat_tree[i] -= memcg->stat_local[i];
+		for (i = 0; i < MEMCG_NR_EVENTS; i++)
+			mi->events_tree[i] -= memcg->events_local[i];
+	}
+	mutex_unlock(&memcg_stats_flush_mutex);
+}
+
+static unsigned long memcg_stat_local(struct mem_cgroup *memcg, int idx)
+{
+	long val = READ_ONCE(memcg->stat_local[idx]);
+
+	return val < 0 ? 0 : val;
+}
+
+static unsigned long memcg_stat_tree(struct mem_cgroup *memcg, int idx)
+{
+	long val = READ_ONCE(memcg->stat_tree[idx]);
+
+	return val < 0 ? 0 : val;
+}
+
 static void mem_cgroup_charge_statistics(struct mem_cgroup *memcg,
 					 struct page *page,
 					 bool compound, int nr_pages)
@@ -627,6 +764,7 @@ static void mem_cgroup_charge_statistics(struct mem_cgroup *memcg,
 	}
 
 	__this_cpu_add(memcg->stat->nr_page_events, nr_pages);
+	memcg_stats_updated(nr_pages);
 }
 
 unsigned long mem_cgroup_node_nr_lru_pages(struct mem_cgroup *memcg,
@@ -1687,13 +1825,16 @@ void unlock_page_memcg(struct page *page)
 EXPORT_SYMBOL(unlock_page_memcg);
 
 /*
- * size of first charge trial. "32" comes from vmscan.c's magic value.
- * TODO: maybe necessary to use big numbers in big irons.
+ * Each cpu caches charges for a few memcgs, so that tasks of different
+ * memcgs sharing a cpu do not keep draining each other's stock.
  */
-#define CHARGE_BATCH	32U
+#define MEMCG_STOCK_SLOTS	4
+
 struct memcg_stock_pcp {
-	struct mem_cgroup *cached; /* this never be root cgroup */
-	unsigned int nr_pages;
+	/* these never be root cgroup */
+	struct mem_cgroup *cached[MEMCG_STOCK_SLOTS];
+	unsigned int nr_pages[MEMCG_STOCK_SLOTS];
+	unsigned int next_evict;
 	struct work_struct work;
 	unsigned long flags;
 #define FLUSHING_CACHED_CHARGE	0
@@ -1706,9 +1847,9 @@ static DEFINE_MUTEX(percpu_charge_mutex);
  * @memcg: memcg to consume from.
  * @nr_pages: how many pages to charge.
  *
- * The charges will only happen if @memcg matches the current cpu's memcg
- * stock, and at least @nr_pages are available in that stock.  Failure to
- * service an allocation will refill the stock.
+ * The charges will only happen if @memcg is in one of the current cpu's
+ * memcg stock slots, and at least @nr_pages are available in that slot.
+ * Failure to service an allocation will refill the stock.
  *
  * returns true if successful, false otherwise.
  */
@@ -1717,6 +1858,7 @@ static bool consume_stock(struct mem_cgroup *memcg, unsigned int nr_pages)
 	struct memcg_stock_pcp *stock;
 	unsigned long flags;
 	bool ret = false;
+	int i;
 
 	if (nr_pages > CHARGE_BATCH)
 		return ret;
@@ -1724,9 +1866,14 @@ static bool consume_stock(struct mem_cgroup *memcg, unsigned int nr_pages)
 	local_irq_save(flags);
 
 	stock = this_cpu_ptr(&memcg_stock);
-	if (memcg == stock->cached && stock->nr_pages >= nr_pages) {
-		stock->nr_pages -= nr_pages;
-		ret = true;
+	for (i = 0; i < MEMCG_STOCK_SLOTS; i++) {
+		if (memcg == stock->cached[i]) {
+			if (stock->nr_pages[i] >= nr_pages) {
+				stock->nr_pages[i] -= nr_pages;
+				ret = true;
+			}
+			break;
+		}
 	}
 
 	local_irq_restore(flags);
@@ -1735,20 +1882,31 @@ static bool consume_stock(struct mem_cgroup *memcg, unsigned int nr_pages)
 }
 
 /*
- * Returns stocks cached in percpu and reset cached information.
+ * Returns the charges cached in one slot and resets it.
  */
-static void drain_stock(struct memcg_stock_pcp *stock)
+static void drain_stock_slot(struct memcg_stock_pcp *stock, int i)
 {
-	struct mem_cgroup *old = stock->cached;
+	struct mem_cgroup *old = stock->cached[i];
 
-	if (stock->nr_pages) {
-		page_counter_uncharge(&old->memory, stock->nr_pages);
+	if (stock->nr_pages[i]) {
+		page_counter_uncharge(&old->memory, stock->nr_pages[i]);
 		if (do_memsw_account())
-			page_counter_uncharge(&old->memsw, stock->nr_pages);
-		css_put_many(&old->css, stock->nr_pages);
-		stock->nr_pages = 0;
+			page_counter_uncharge(&old->memsw, stock->nr_pages[i]);
+		css_put_many(&old->css, stock->nr_pages[i]);
+		stock->nr_pages[i] = 0;
 	}
-	stock->cached = NULL;
+	stock->cached[i] = NULL;
+}
+
+/*
+ * Returns stocks cached in percpu and reset cached information.
+ */
+static void drain_stock(struct memcg_stock_pcp *stock)
+{
+	int i;
+
+	for (i = 0; i < MEMCG_STOCK_SLOTS; i++)
+		drain_stock_slot(stock, i);
 }
 
 static void drain_local_stock(struct work_struct *dummy)
@@ -1773,19 +1931,48 @@ static void refill_stock(struct mem_cgroup *memcg, unsigned int nr_pages)
 {
 	struct memcg_stock_pcp *stock;
 	unsigned long flags;
+	int i, slot = -1;
 
 	local_irq_save(flags);
 
 	stock = this_cpu_ptr(&memcg_stock);
-	if (stock->cached != memcg) { /* reset if necessary */
-		drain_stock(stock);
-		stock->cached = memcg;
+	for (i = 0; i < MEMCG_STOCK_SLOTS; i++) {
+		if (stock->cached[i] == memcg) {
+			slot = i;
+			break;
+		}
+		if (slot < 0 && !stock->nr_pages[i])
+			slot = i;
+	}
+	if (slot < 0) {
+		/* all slots busy, evict them in turn */
+		slot = stock->next_evict;
+		stock->next_evict = (slot + 1) % MEMCG_STOCK_SLOTS;
 	}
-	stock->nr_pages += nr_pages;
+	if (stock->cached[slot] != memcg) { /* reset if necessary */
+		drain_stock_slot(stock, slot);
+		stock->cached[slot] = memcg;
+	}
+	stock->nr_pages[slot] += nr_pages;
 
 	local_irq_restore(flags);
 }
 
+static bool stock_has_descendant(struct memcg_stock_pcp *stock,
+				 struct mem_cgroup *root_memcg)
+{
+	struct mem_cgroup *memcg;
+	int i;
+
+	for (i = 0; i < MEMCG_STOCK_SLOTS; i++) {
+		memcg = stock->cached[i];
+		if (memcg && stock->nr_pages[i] &&
+		    mem_cgroup_is_descendant(memcg, root_memcg))
+			return true;
+	}
+	return false;
+}
+
 /*
  * Drains all per-CPU charge caches for given root_memcg resp. subtree
  * of the hierarchy under it.
@@ -1802,12 +1989,8 @@ static void drain_all_stock(struct mem_cgroup *root_memcg)
 	curcpu = get_cpu();
 	for_each_online_cpu(cpu) {
 		struct memcg_stock_pcp *stock = &per_cpu(memcg_stock, cpu);
-		struct mem_cgroup *memcg;
 
-		memcg = stock->cached;
-		if (!memcg || !stock->nr_pages)
-			continue;
-		if (!mem_cgroup_is_descendant(memcg, root_memcg))
+		if (!stock_has_descendant(stock, root_memcg))
 			continue;
 		if (!test_and_set_bit(FLUSHING_CACHED_CHARGE, &stock->flags)) {
 			if (cpu == curcpu)
@@ -2388,10 +2571,9 @@ void mem_cgroup_split_huge_fixup(struct page *head)
 
 #ifdef CONFIG_MEMCG_SWAP
 static void mem_cgroup_swap_statistics(struct mem_cgroup *memcg,
-					 bool charge)
+				       int nr_entries)
 {
-	int val = (charge) ? 1 : -1;
-	this_cpu_add(memcg->stat->count[MEM_CGROUP_STAT_SWAP], val);
+	this_cpu_add(memcg->stat->count[MEM_CGROUP_STAT_SWAP], nr_entries);
 }
 
 /**
@@ -2417,8 +2599,8 @@ static int mem_cgroup_move_swap_account(swp_entry_t entry,
 	new_id = mem_cgroup_id(to);
 
 	if (swap_cgroup_cmpxchg(entry, old_id, new_id) == old_id) {
-		mem_cgroup_swap_statistics(from, false);
-		mem_cgroup_swap_statistics(to, true);
+		mem_cgroup_swap_statistics(from, -1);
+		mem_cgroup_swap_statistics(to, 1);
 		return 0;
 	}
 	return -EINVAL;
@@ -2680,6 +2862,86 @@ static ssize_t mem_cgroup_force_empty_write(struct kernfs_open_file *of,
 	return mem_cgroup_force_empty(memcg) ?: nbytes;
 }
 
+/*
+ * Reclaim the given amount of memory from the memcg without touching its
+ * limits.  "noswap" after the size restricts reclaim to the page cache.
+ * The reclaim runs in the writer's context, so any stall is charged to
+ * the controller writing the file rather than to the workload.
+ */
+static ssize_t memory_reclaim(struct kernfs_open_file *of, char *buf,
+			      size_t nbytes, loff_t off)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_css(of_css(of));
+	unsigned int nr_retries = MEM_CGROUP_RECLAIM_RETRIES;
+	unsigned long nr_to_reclaim, nr_reclaimed = 0;
+	bool may_swap = true;
+	char *opt;
+	int err = 0;
+
+	buf = strstrip(buf);
+	opt = strpbrk(buf, " \t");
+	if (opt) {
+		*opt++ = '\0';
+		opt = skip_spaces(opt);
+		if (strcmp(opt, "noswap"))
+			return -EINVAL;
+		may_swap = false;
+	}
+
+	if (!*buf)
+		return -EINVAL;
+	err = page_counter_memparse(buf, "", &nr_to_reclaim);
+	if (err)
+		return err;
+
+	while (nr_reclaimed < nr_to_reclaim) {
+		unsigned long reclaimed;
+
+		if (signal_pending(current)) {
+			err = -EINTR;
+			break;
+		}
+
+		/*
+		 * This is the final attempt, drain percpu lru caches in the
+		 * hope of introducing more evictable pages for
+		 * try_to_free_mem_cgroup_pages().
+		 */
+		if (!nr_retries)
+			lru_add_drain_all();
+
+		reclaimed = try_to_free_mem_cgroup_pages(memcg,
+					min(nr_to_reclaim - nr_reclaimed,
+					    (unsigned long)SWAP_CLUSTER_MAX),
+					GFP_KERNEL, may_swap);
+
+		if (!reclaimed && !nr_retries--) {
+			err = -EAGAIN;
+			break;
+		}
+		nr_reclaimed += reclaimed;
+	}
+
+	WRITE_ONCE(memcg->reclaim_last_requested, nr_to_reclaim);
+	WRITE_ONCE(memcg->reclaim_last_reclaimed, nr_reclaimed);
+	atomic_long_add(nr_reclaimed, &memcg->reclaim_total);
+
+	return err ? err : nbytes;
+}
+
+static int memory_reclaim_show(struct seq_file *m, void *v)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_css(seq_css(m));
+
+	seq_printf(m, "last_requested %llu\n",
+		   (u64)READ_ONCE(memcg->reclaim_last_requested) * PAGE_SIZE);
+	seq_printf(m, "last_reclaimed %llu\n",
+		   (u64)READ_ONCE(memcg->reclaim_last_reclaimed) * PAGE_SIZE);
+	seq_printf(m, "total_reclaimed %llu\n",
+		   (u64)atomic_long_read(&memcg->reclaim_total) * PAGE_SIZE);
+	return 0;
+}
+
 static u64 mem_cgroup_hierarchy_read(struct cgroup_subsys_state *css,
 				     struct cftype *cft)
 {
@@ -2718,28 +2980,18 @@ static int mem_cgroup_hierarchy_write(struct cgroup_subsys_state *css,
 
 static void tree_stat(struct mem_cgroup *memcg, unsigned long *stat)
 {
-	struct mem_cgroup *iter;
 	int i;
 
-	memset(stat, 0, sizeof(*stat) * MEMCG_NR_STAT);
-
-	for_each_mem_cgroup_tree(iter, memcg) {
-		for (i = 0; i < MEMCG_NR_STAT; i++)
-			stat[i] += mem_cgroup_read_stat(iter, i);
-	}
+	for (i = 0; i < MEMCG_NR_STAT; i++)
+		stat[i] = memcg_stat_tree(memcg, i);
 }
 
 static void tree_events(struct mem_cgroup *memcg, unsigned long *events)
 {
-	struct mem_cgroup *iter;
 	int i;
 
-	memset(events, 0, sizeof(*events) * MEMCG_NR_EVENTS);
-
-	for_each_mem_cgroup_tree(iter, memcg) {
-		for (i = 0; i < MEMCG_NR_EVENTS; i++)
-			events[i] += mem_cgroup_read_events(iter, i);
-	}
+	for (i = 0; i < MEMCG_NR_EVENTS; i++)
+		events[i] = READ_ONCE(memcg->events_tree[i]);
 }
 
 static unsigned long mem_cgroup_usage(struct mem_cgroup *memcg, bool swap)
@@ -2747,17 +2999,10 @@ static unsigned long mem_cgroup_usage(struct mem_cgroup *memcg, bool swap)
 	unsigned long val = 0;
 
 	if (mem_cgroup_is_root(memcg)) {
-		struct mem_cgroup *iter;
-
-		for_each_mem_cgroup_tree(iter, memcg) {
-			val += mem_cgroup_read_stat(iter,
-					MEM_CGROUP_STAT_CACHE);
-			val += mem_cgroup_read_stat(iter,
-					MEM_CGROUP_STAT_RSS);
-			if (swap)
-				val += mem_cgroup_read_stat(iter,
-						MEM_CGROUP_STAT_SWAP);
-		}
+		val += memcg_stat_tree(memcg, MEM_CGROUP_STAT_CACHE);
+		val += memcg_stat_tree(memcg, MEM_CGROUP_STAT_RSS);
+		if (swap)
+			val += memcg_stat_tree(memcg, MEM_CGROUP_STAT_SWAP);
 	} else {
 		if (!swap)
 			val = page_counter_read(&memcg->memory);
@@ -3144,16 +3389,18 @@ static int memcg_stat_show(struct seq_file *m, void *v)
 		     MEM_CGROUP_EVENTS_NSTATS);
 	BUILD_BUG_ON(ARRAY_SIZE(mem_cgroup_lru_names) != NR_LRU_LISTS);
 
+	mem_cgroup_flush_stats();
+
 	for (i = 0; i < MEM_CGROUP_STAT_NSTATS; i++) {
 		if (i == MEM_CGROUP_STAT_SWAP && !do_memsw_account())
 			continue;
 		seq_printf(m, "%s %lu\n", mem_cgroup_stat_names[i],
-			   mem_cgroup_read_stat(memcg, i) * PAGE_SIZE);
+			   memcg_stat_local(memcg, i) * PAGE_SIZE);
 	}
 
 	for (i = 0; i < MEM_CGROUP_EVENTS_NSTATS; i++)
 		seq_printf(m, "%s %lu\n", mem_cgroup_events_names[i],
-			   mem_cgroup_read_events(memcg, i));
+			   READ_ONCE(memcg->events_local[i]));
 
 	for (i = 0; i < NR_LRU_LISTS; i++)
 		seq_printf(m, "%s %lu\n", mem_cgroup_lru_names[i],
@@ -3172,23 +3419,15 @@ static int memcg_stat_show(struct seq_file *m, void *v)
 			   (u64)memsw * PAGE_SIZE);
 
 	for (i = 0; i < MEM_CGROUP_STAT_NSTATS; i++) {
-		unsigned long long val = 0;
-
 		if (i == MEM_CGROUP_STAT_SWAP && !do_memsw_account())
 			continue;
-		for_each_mem_cgroup_tree(mi, memcg)
-			val += mem_cgroup_read_stat(mi, i) * PAGE_SIZE;
-		seq_printf(m, "total_%s %llu\n", mem_cgroup_stat_names[i], val);
+		seq_printf(m, "total_%s %llu\n", mem_cgroup_stat_names[i],
+			   (u64)memcg_stat_tree(memcg, i) * PAGE_SIZE);
 	}
 
-	for (i = 0; i < MEM_CGROUP_EVENTS_NSTATS; i++) {
-		unsigned long long val = 0;
-
-		for_each_mem_cgroup_tree(mi, memcg)
-			val += mem_cgroup_read_events(mi, i);
-		seq_printf(m, "total_%s %llu\n",
-			   mem_cgroup_events_names[i], val);
-	}
+	for (i = 0; i < MEM_CGROUP_EVENTS_NSTATS; i++)
+		seq_printf(m, "total_%s %llu\n", mem_cgroup_events_names[i],
+			   (u64)READ_ONCE(memcg->events_tree[i]));
 
 	for (i = 0; i < NR_LRU_LISTS; i++) {
 		unsigned long long val = 0;
@@ -3947,6 +4186,11 @@ static struct cftype mem_cgroup_legacy_files[] = {
 		.name = "force_empty",
 		.write = mem_cgroup_force_empty_write,
 	},
+	{
+		.name = "reclaim",
+		.write = memory_reclaim,
+		.seq_show = memory_reclaim_show,
+	},
 	{
 		.name = "use_hierarchy",
 		.write_u64 = mem_cgroup_hierarchy_write,
@@ -4320,6 +4564,7 @@ static void mem_cgroup_css_free(struct cgroup_subsys_state *css)
 	cancel_work_sync(&memcg->high_work);
 	mem_cgroup_remove_from_trees(memcg);
 	memcg_free_kmem(memcg);
+	mem_cgroup_flush_free(memcg);
 	mem_cgroup_free(memcg);
 }
 
@@ -4674,6 +4919,9 @@ static int mem_cgroup_count_precharge_pte_range(pmd_t *pmd,
 
 	if (pmd_trans_unstable(pmd))
 		return 0;
+	/* Pages behind a table shared by fork stay with their memcg */
+	if (pmd_table_shared(*pmd))
+		return 0;
 	pte = pte_offset_map_lock(vma->vm_mm, pmd, addr, &ptl);
 	for (; addr != end; pte++, addr += PAGE_SIZE)
 		if (get_mctgt_type(vma, addr, *pte, NULL))
@@ -4888,6 +5136,8 @@ static int mem_cgroup_move_charge_pte_range(pmd_t *pmd,
 
 	if (pmd_trans_unstable(pmd))
 		return 0;
+	if (pmd_table_shared(*pmd))
+		return 0;
 retry:
 	pte = pte_offset_map_lock(vma->vm_mm, pmd, addr, &ptl);
 	for (; addr != end; addr += PAGE_SIZE) {
@@ -5193,6 +5443,7 @@ static int memory_stat_show(struct seq_file *m, void *v)
 	 * Current memory state:
 	 */
 
+	mem_cgroup_flush_stats();
 	tree_stat(memcg, stat);
 	tree_events(memcg, events);
 
@@ -5275,6 +5526,11 @@ static struct cftype memory_files[] = {
 		.flags = CFTYPE_NOT_ON_ROOT,
 		.seq_show = memory_stat_show,
 	},
+	{
+		.name = "reclaim",
+		.write = memory_reclaim,
+		.seq_show = memory_reclaim_show,
+	},
 	{ }	/* terminate */
 };
 
@@ -5369,7 +5625,7 @@ int mem_cgroup_try_charge(struct page *page, struct mm_struct *mm,
 		 * in turn serializes uncharging.
 		 */
 		VM_BUG_ON_PAGE(!PageLocked(page), page);
-		if (page->mem_cgroup)
+		if (compound_head(page)->mem_cgroup)
 			goto out;
 
 		if (do_swap_account) {
@@ -5444,7 +5700,7 @@ void mem_cgroup_commit_charge(struct page *page, struct mem_cgroup *memcg,
 		 * let's not wait for it.  The page already received a
 		 * memory+swap charge, drop the swap entry duplicate.
 		 */
-		mem_cgroup_uncharge_swap(entry);
+		mem_cgroup_uncharge_swap(entry, 1);
 	}
 }
 
@@ -5497,6 +5753,7 @@ static void uncharge_batch(struct mem_cgroup *memcg, unsigned long pgpgout,
 	__this_cpu_sub(memcg->stat->count[MEM_CGROUP_STAT_RSS_HUGE], nr_huge);
 	__this_cpu_add(memcg->stat->events[MEM_CGROUP_EVENTS_PGPGOUT], pgpgout);
 	__this_cpu_add(memcg->stat->nr_page_events, nr_pages);
+	memcg_stats_updated(nr_pages);
 	memcg_check_events(memcg, dummy_page);
 	local_irq_restore(flags);
 
@@ -5803,6 +6060,10 @@ static int __init mem_cgroup_init(void)
 		INIT_WORK(&per_cpu_ptr(&memcg_stock, cpu)->work,
 			  drain_local_stock);
 
+	if (!mem_cgroup_disabled())
+		queue_delayed_work(system_unbound_wq, &memcg_stats_flush_dwork,
+				   MEMCG_FLUSH_PERIOD);
+
 	for_each_node(node) {
 		struct mem_cgroup_tree_per_node *rtpn;
 
@@ -5847,6 +6108,7 @@ static struct mem_cgroup *mem_cgroup_id_get_online(struct mem_cgroup *memcg)
 void mem_cgroup_swapout(struct page *page, swp_entry_t entry)
 {
 	struct mem_cgroup *memcg, *swap_memcg;
+	unsigned int nr_entries;
 	unsigned short oldid;
 
 	VM_BUG_ON_PAGE(PageLRU(page), page);
@@ -5867,19 +6129,24 @@ void mem_cgroup_swapout(struct page *page, swp_entry_t entry)
 	 * ancestor for the swap instead and transfer the memory+swap charge.
 	 */
 	swap_memcg = mem_cgroup_id_get_online(memcg);
-	oldid = swap_cgroup_record(entry, mem_cgroup_id(swap_memcg));
+	nr_entries = hpage_nr_pages(page);
+	/* Get references for the tail pages, too */
+	if (nr_entries > 1)
+		mem_cgroup_id_get_many(swap_memcg, nr_entries - 1);
+	oldid = swap_cgroup_record(entry, mem_cgroup_id(swap_memcg),
+				   nr_entries);
 	VM_BUG_ON_PAGE(oldid, page);
-	mem_cgroup_swap_statistics(swap_memcg, true);
+	mem_cgroup_swap_statistics(swap_memcg, nr_entries);
 
 	page->mem_cgroup = NULL;
 
 	if (!mem_cgroup_is_root(memcg))
-		page_counter_uncharge(&memcg->memory, 1);
+		page_counter_uncharge(&memcg->memory, nr_entries);
 
 	if (memcg != swap_memcg) {
 		if (!mem_cgroup_is_root(swap_memcg))
-			page_counter_charge(&swap_memcg->memsw, 1);
-		page_counter_uncharge(&memcg->memsw, 1);
+			page_counter_charge(&swap_memcg->memsw, nr_entries);
+		page_counter_uncharge(&memcg->memsw, nr_entries);
 	}
 
 	/*
@@ -5889,11 +6156,12 @@ void mem_cgroup_swapout(struct page *page, swp_entry_t entry)
 	 * only synchronisation we have for udpating the per-CPU variables.
 	 */
 	VM_BUG_ON(!irqs_disabled());
-	mem_cgroup_charge_statistics(memcg, page, false, -1);
+	mem_cgroup_charge_statistics(memcg, page, PageTransHuge(page),
+				     -nr_entries);
 	memcg_check_events(memcg, page);
 
 	if (!mem_cgroup_is_root(memcg))
-		css_put(&memcg->css);
+		css_put_many(&memcg->css, nr_entries);
 }
 
 /*
@@ -5901,12 +6169,14 @@ void mem_cgroup_swapout(struct page *page, swp_entry_t entry)
  * @page: page being added to swap
  * @entry: swap entry to charge
  *
- * Try to charge @entry to the memcg that @page belongs to.
+ * Try to charge @entry to the memcg that @page belongs to.  A huge page
+ * charges the whole range of swap entries it is added to swap with.
  *
  * Returns 0 on success, -ENOMEM on failure.
  */
 int mem_cgroup_try_charge_swap(struct page *page, swp_entry_t entry)
 {
+	unsigned int nr_pages = hpage_nr_pages(page);
 	struct mem_cgroup *memcg;
 	struct page_counter *counter;
 	unsigned short oldid;
@@ -5923,25 +6193,29 @@ int mem_cgroup_try_charge_swap(struct page *page, swp_entry_t entry)
 	memcg = mem_cgroup_id_get_online(memcg);
 
 	if (!mem_cgroup_is_root(memcg) &&
-	    !page_counter_try_charge(&memcg->swap, 1, &counter)) {
+	    !page_counter_try_charge(&memcg->swap, nr_pages, &counter)) {
 		mem_cgroup_id_put(memcg);
 		return -ENOMEM;
 	}
 
-	oldid = swap_cgroup_record(entry, mem_cgroup_id(memcg));
+	/* Get references for the tail pages, too */
+	if (nr_pages > 1)
+		mem_cgroup_id_get_many(memcg, nr_pages - 1);
+	oldid = swap_cgroup_record(entry, mem_cgroup_id(memcg), nr_pages);
 	VM_BUG_ON_PAGE(oldid, page);
-	mem_cgroup_swap_statistics(memcg, true);
+	mem_cgroup_swap_statistics(memcg, nr_pages);
 
 	return 0;
 }
 
 /**
- * mem_cgroup_uncharge_swap - uncharge a swap entry
+ * mem_cgroup_uncharge_swap - uncharge swap space
  * @entry: swap entry to uncharge
+ * @nr_pages: the amount of swap space to uncharge
  *
- * Drop the swap charge associated with @entry.
+ * Drop the swap charge associated with @nr_pages entries from @entry on.
  */
-void mem_cgroup_uncharge_swap(swp_entry_t entry)
+void mem_cgroup_uncharge_swap(swp_entry_t entry, unsigned int nr_pages)
 {
 	struct mem_cgroup *memcg;
 	unsigned short id;
@@ -5949,18 +6223,18 @@ void mem_cgroup_uncharge_swap(swp_entry_t entry)
 	if (!do_swap_account)
 		return;
 
-	id = swap_cgroup_record(entry, 0);
+	id = swap_cgroup_record(entry, 0, nr_pages);
 	rcu_read_lock();
 	memcg = mem_cgroup_from_id(id);
 	if (memcg) {
 		if (!mem_cgroup_is_root(memcg)) {
 			if (cgroup_subsys_on_dfl(memory_cgrp_subsys))
-				page_counter_uncharge(&memcg->swap, 1);
+				page_counter_uncharge(&memcg->swap, nr_pages);
 			else
-				page_counter_uncharge(&memcg->memsw, 1);
+				page_counter_uncharge(&memcg->memsw, nr_pages);
 		}
-		mem_cgroup_swap_statistics(memcg, false);
-		mem_cgroup_id_put(memcg);
+		mem_cgroup_swap_statistics(memcg, -nr_pages);
+		mem_cgroup_id_put_many(memcg, nr_pages);
 	}
 	rcu_read_unlock();
 }
@@ -925,6 +925,8 @@ copy_one_pte(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 				pte = swp_entry_to_pte(entry);
 				if (pte_swp_soft_dirty(*src_pte))
 					pte = pte_swp_mksoft_dirty(pte);
+				if (pte_swp_uffd_wp(*src_pte))
+					pte = pte_swp_mkuffd_wp(pte);
 				set_pte_at(src_mm, addr, src_pte, pte);
 			}
 		}
@@ -948,6 +950,13 @@ copy_one_pte(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 		pte = pte_mkclean(pte);
 	pte = pte_mkold(pte);
 
+	/*
+	 * The uffd-wp marker only means something under a VM_UFFD_WP
+	 * vma, don't leak it into a child that can't resolve it.
+	 */
+	if (!(vm_flags & VM_UFFD_WP))
+		pte = pte_clear_uffd_wp(pte);
+
 	page = vm_normal_page(vma, addr, pte);
 	if (page) {
 		get_page(page);
@@ -1023,6 +1032,304 @@ again:
 	return 0;
 }
 
+#ifdef CONFIG_FORK_SHARE_PTE
+int sysctl_fork_share_pte __read_mostly;
+
+/*
+ * A pte table shared by fork keeps its entries counted in the rss of one
+ * mm only, recorded in page->index of the table page.  That mm drops the
+ * counts when it lets go of the table, and whoever takes the table over
+ * last picks them up again.
+ */
+static inline struct mm_struct *pte_table_owner(struct page *table)
+{
+	return (struct mm_struct *)table->index;
+}
+
+static inline void pte_table_set_owner(struct page *table,
+				       struct mm_struct *mm)
+{
+	table->index = (unsigned long)mm;
+}
+
+/* Add (sign > 0) or remove the table's entries from the rss of vma->vm_mm */
+static void pte_table_account(struct vm_area_struct *vma, pmd_t *pmd,
+			      unsigned long addr, int sign)
+{
+	int rss[NR_MM_COUNTERS];
+	pte_t *start_pte, *pte;
+	unsigned long end = addr + PMD_SIZE;
+	int i;
+
+	init_rss_vec(rss);
+	start_pte = pte = pte_offset_map(pmd, addr);
+	do {
+		pte_t ptent = *pte;
+		struct page *page;
+		swp_entry_t entry;
+
+		if (pte_none(ptent))
+			continue;
+		if (pte_present(ptent)) {
+			page = vm_normal_page(vma, addr, ptent);
+			if (page)
+				rss[mm_counter(page)]++;
+			continue;
+		}
+		entry = pte_to_swp_entry(ptent);
+		if (!non_swap_entry(entry))
+			rss[MM_SWAPENTS]++;
+		else if (is_migration_entry(entry))
+			rss[mm_counter(migration_entry_to_page(entry))]++;
+	} while (pte++, addr += PAGE_SIZE, addr != end);
+	pte_unmap(start_pte);
+
+	for (i = 0; i < NR_MM_COUNTERS; i++)
+		rss[i] *= sign;
+	add_mm_rss_vec(vma->vm_mm, rss);
+}
+
+/* Undo a partial copy_one_pte() run over [addr, end) of a private table */
+static void pte_table_release_copy(struct vm_area_struct *vma, pte_t *pte,
+				   unsigned long addr, unsigned long end)
+{
+	for (; addr != end; pte++, addr += PAGE_SIZE) {
+		pte_t ptent = *pte;
+
+		if (pte_none(ptent))
+			continue;
+		if (pte_present(ptent)) {
+			struct page *page = vm_normal_page(vma, addr, ptent);
+
+			if (page) {
+				page_remove_rmap(page, false);
+				put_page(page);
+			}
+		} else {
+			swp_entry_t entry = pte_to_swp_entry(ptent);
+
+			if (!non_swap_entry(entry))
+				swap_free(entry);
+		}
+		pte_clear(vma->vm_mm, addr, pte);
+	}
+}
+
+/*
+ * Give vma->vm_mm a private pte table for the range covered by @pmd.
+ * The last sharer simply takes the shared table over, everybody else
+ * gets a copy with the usual COW treatment of the entries.
+ */
+int pte_table_unshare(struct vm_area_struct *vma, pmd_t *pmd,
+		      unsigned long addr)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	unsigned long start = addr & PMD_MASK;
+	unsigned long end = start + PMD_SIZE;
+	int rss[NR_MM_COUNTERS];
+	pte_t *src_pte, *dst_pte, *orig_src_pte, *orig_dst_pte;
+	spinlock_t *pml, *ptl;
+	struct page *table;
+	pgtable_t new = NULL;
+	swp_entry_t entry;
+	int ret = 0;
+
+again:
+	pml = pmd_lock(mm, pmd);
+	if (!pmd_table_shared(*pmd))
+		goto out_unlock_pmd;
+	table = pmd_page(*pmd);
+	ptl = pte_lockptr(mm, pmd);
+	spin_lock(ptl);
+
+	if (page_count(table) == 1) {
+		if (pte_table_owner(table) != mm)
+			pte_table_account(vma, pmd, start, 1);
+		pte_table_set_owner(table, NULL);
+		set_pmd(pmd, pmd_mkwrite(*pmd));
+		goto out_unlock;
+	}
+
+	if (!new) {
+		spin_unlock(ptl);
+		spin_unlock(pml);
+		new = pte_alloc_one(mm, start);
+		if (!new)
+			return -ENOMEM;
+		goto again;
+	}
+
+	init_rss_vec(rss);
+	entry.val = 0;
+	orig_src_pte = src_pte = pte_offset_map(pmd, start);
+	orig_dst_pte = dst_pte = kmap_atomic(new);
+	for (addr = start; addr != end;
+	     src_pte++, dst_pte++, addr += PAGE_SIZE) {
+		if (pte_none(*src_pte))
+			continue;
+		entry.val = copy_one_pte(mm, mm, dst_pte, src_pte,
+					 vma, addr, rss);
+		if (entry.val)
+			break;
+	}
+	pte_unmap(orig_src_pte);
+
+	if (entry.val) {
+		pte_table_release_copy(vma, orig_dst_pte, start, addr);
+		kunmap_atomic(orig_dst_pte);
+		spin_unlock(ptl);
+		spin_unlock(pml);
+		if (add_swap_count_continuation(entry, GFP_KERNEL) < 0) {
+			ret = -ENOMEM;
+			goto out_free;
+		}
+		goto again;
+	}
+	kunmap_atomic(orig_dst_pte);
+
+	if (pte_table_owner(table) == mm)
+		pte_table_set_owner(table, NULL);
+	else
+		add_mm_rss_vec(mm, rss);
+
+	smp_wmb(); /* See comment in __pte_alloc() */
+	pmd_populate(mm, pmd, new);
+	new = NULL;
+	flush_tlb_range(vma, start, end);
+	page_ref_dec(table);
+out_unlock:
+	spin_unlock(ptl);
+out_unlock_pmd:
+	spin_unlock(pml);
+out_free:
+	if (new)
+		pte_free(mm, new);
+	return ret;
+}
+
+/* For callers that have no way to back out of a page table operation */
+void pte_table_unshare_nofail(struct vm_area_struct *vma, pmd_t *pmd,
+			      unsigned long addr)
+{
+	while (pte_table_unshare(vma, pmd, addr))
+		schedule_timeout_uninterruptible(1);
+}
+
+/*
+ * Static properties of a vma whose pte tables may be shared by fork:
+ * plain private anonymous memory, whose ptes can only ever point to
+ * normal pages, swap or migration entries.
+ */
+static inline bool vma_may_share_pte_tables(struct vm_area_struct *vma)
+{
+	return USE_SPLIT_PTE_PTLOCKS && vma_is_anonymous(vma) &&
+		is_cow_mapping(vma->vm_flags) && !userfaultfd_armed(vma);
+}
+
+static inline bool pte_table_shareable(struct vm_area_struct *vma,
+				       unsigned long addr, unsigned long end)
+{
+	return READ_ONCE(sysctl_fork_share_pte) &&
+		vma_may_share_pte_tables(vma) &&
+		!(addr & ~PMD_MASK) && end - addr == PMD_SIZE;
+}
+
+/*
+ * Map the parent's pte table into the child instead of copying it.  The
+ * pmd is write protected on both sides, so the first write fault (or
+ * anything else that modifies the table) in either mm gets a private
+ * table from pte_table_unshare().
+ */
+static void share_pte_table(struct mm_struct *dst_mm,
+			    struct mm_struct *src_mm,
+			    pmd_t *dst_pmd, pmd_t *src_pmd)
+{
+	struct page *table = pmd_page(*src_pmd);
+	spinlock_t *pml, *ptl;
+
+	pml = pmd_lock(src_mm, src_pmd);
+	ptl = pte_lockptr(src_mm, src_pmd);
+	spin_lock(ptl);
+	if (pmd_write(*src_pmd)) {
+		pte_table_set_owner(table, src_mm);
+		set_pmd(src_pmd, pmd_wrprotect(*src_pmd));
+	}
+	page_ref_inc(table);
+	set_pmd(dst_pmd, *src_pmd);
+	atomic_long_inc(&dst_mm->nr_ptes);
+	spin_unlock(ptl);
+	spin_unlock(pml);
+}
+
+/*
+ * Unmapping a whole shared table just drops this mm's reference on it.
+ * Returns false when the caller still has to zap the entries, which
+ * pte_table_unshare() made private by then.
+ */
+static bool zap_shared_pte_table(struct vm_area_struct *vma, pmd_t *pmd,
+				 unsigned long addr, unsigned long end)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	spinlock_t *pml, *ptl;
+	struct page *table;
+	bool dropped = false;
+
+	if ((addr & ~PMD_MASK) || end - addr != PMD_SIZE)
+		goto unshare;
+
+	pml = pmd_lock(mm, pmd);
+	if (!pmd_table_shared(*pmd)) {
+		spin_unlock(pml);
+		return false;
+	}
+	table = pmd_page(*pmd);
+	ptl = pte_lockptr(mm, pmd);
+	spin_lock(ptl);
+	if (page_count(table) > 1) {
+		if (pte_table_owner(table) == mm) {
+			pte_table_account(vma, pmd, addr, -1);
+			pte_table_set_owner(table, NULL);
+		}
+		pmd_clear(pmd);
+		flush_tlb_range(vma, addr, end);
+		page_ref_dec(table);
+		atomic_long_dec(&mm->nr_ptes);
+		dropped = true;
+	}
+	spin_unlock(ptl);
+	spin_unlock(pml);
+	if (dropped)
+		return true;
+unshare:
+	pte_table_unshare_nofail(vma, pmd, addr);
+	return false;
+}
+#else
+static inline bool vma_may_share_pte_tables(struct vm_area_struct *vma)
+{
+	return false;
+}
+
+static inline bool pte_table_shareable(struct vm_area_struct *vma,
+				       unsigned long addr, unsigned long end)
+{
+	return false;
+}
+
+static inline void share_pte_table(struct mm_struct *dst_mm,
+				   struct mm_struct *src_mm,
+				   pmd_t *dst_pmd, pmd_t *src_pmd)
+{
+}
+
+static inline bool zap_shared_pte_table(struct vm_area_struct *vma,
+					pmd_t *pmd, unsigned long addr,
+					unsigned long end)
+{
+	return false;
+}
+#endif /* CONFIG_FORK_SHARE_PTE */
+
 static inline int copy_pmd_range(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 		pud_t *dst_pud, pud_t *src_pud, struct vm_area_struct *vma,
 		unsigned long addr, unsigned long end)
@@ -1049,6 +1356,10 @@ static inline int copy_pmd_range(struct mm_struct *dst_mm, struct mm_struct *src
 		}
 		if (pmd_none_or_clear_bad(src_pmd))
 			continue;
+		if (pte_table_shareable(vma, addr, next)) {
+			share_pte_table(dst_mm, src_mm, dst_pmd, src_pmd);
+			continue;
+		}
 		if (copy_pte_range(dst_mm, src_mm, dst_pmd, src_pmd,
 						vma, addr, next))
 			return -ENOMEM;
@@ -1121,7 +1432,7 @@ int copy_page_range(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 	unsigned long end = vma->vm_end;
 	unsigned long mmun_start;	/* For mmu_notifiers */
 	unsigned long mmun_end;		/* For mmu_notifiers */
-	bool is_cow;
+	bool is_cow, may_share;
 	int ret;
 
 	/*
@@ -1160,6 +1471,14 @@ int copy_page_range(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 		mmu_notifier_invalidate_range_start(src_mm, mmun_start,
 						    mmun_end);
 
+	/*
+	 * Sharing write protects the parent's pmds behind the back of a
+	 * speculative fault that may be walking them without mmap_sem.
+	 */
+	may_share = vma_may_share_pte_tables(vma);
+	if (may_share)
+		vm_write_begin(vma);
+
 	ret = 0;
 	dst_pgd = pgd_offset(dst_mm, addr);
 	src_pgd = pgd_offset(src_mm, addr);
@@ -1174,6 +1493,9 @@ int copy_page_range(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 		}
 	} while (dst_pgd++, src_pgd++, addr = next, addr != end);
 
+	if (may_share)
+		vm_write_end(vma);
+
 	if (is_cow)
 		mmu_notifier_invalidate_range_end(src_mm, mmun_start, mmun_end);
 	return ret;
@@ -1314,6 +1636,9 @@ static inline unsigned long zap_pmd_range(struct mmu_gather *tlb,
 		 */
 		if (pmd_none_or_trans_huge_or_clear_bad(pmd))
 			goto next;
+		if (pmd_table_shared(*pmd) &&
+		    zap_shared_pte_table(vma, pmd, addr, next))
+			goto next;
 		next = zap_pte_range(tlb, vma, pmd, addr, next, details);
 next:
 		cond_resched();
@@ -2168,6 +2493,109 @@ static gfp_t __get_fault_gfp_mask(struct vm_area_struct *vma)
 	return GFP_KERNEL;
 }
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+static inline bool vma_has_changed(struct vm_fault *vmf)
+{
+	return read_seqcount_retry(&vmf->vma->vm_sequence, vmf->sequence);
+}
+
+/*
+ * A speculative fault holds neither mmap_sem nor a reference on the page
+ * tables, so the pmd may be freed under us.  Check the vma and the pmd with
+ * interrupts disabled, which holds off the TLB shootdown IPI that precedes
+ * freeing the page table (as gup_fast relies on), and only trylock the PTL:
+ * its holder may itself be waiting for that IPI to be acknowledged.
+ */
+static bool pte_spinlock(struct vm_fault *vmf)
+{
+	bool ret = false;
+	pmd_t pmdval;
+
+	if (!(vmf->flags & FAULT_FLAG_SPECULATIVE)) {
+		vmf->ptl = pte_lockptr(vmf->vma->vm_mm, vmf->pmd);
+		spin_lock(vmf->ptl);
+		return true;
+	}
+
+	local_irq_disable();
+	if (vma_has_changed(vmf))
+		goto out;
+
+	pmdval = READ_ONCE(*vmf->pmd);
+	if (!pmd_same(pmdval, vmf->orig_pmd))
+		goto out;
+
+	vmf->ptl = pte_lockptr(vmf->vma->vm_mm, &pmdval);
+	if (unlikely(!spin_trylock(vmf->ptl)))
+		goto out;
+
+	if (vma_has_changed(vmf)) {
+		spin_unlock(vmf->ptl);
+		goto out;
+	}
+
+	ret = true;
+out:
+	local_irq_enable();
+	return ret;
+}
+
+static bool pte_map_lock(struct vm_fault *vmf)
+{
+	bool ret = false;
+	pte_t *pte;
+	spinlock_t *ptl;
+	pmd_t pmdval;
+
+	if (!(vmf->flags & FAULT_FLAG_SPECULATIVE)) {
+		vmf->pte = pte_offset_map_lock(vmf->vma->vm_mm, vmf->pmd,
+					       vmf->address, &vmf->ptl);
+		return true;
+	}
+
+	local_irq_disable();
+	if (vma_has_changed(vmf))
+		goto out;
+
+	pmdval = READ_ONCE(*vmf->pmd);
+	if (!pmd_same(pmdval, vmf->orig_pmd))
+		goto out;
+
+	ptl = pte_lockptr(vmf->vma->vm_mm, &pmdval);
+	pte = pte_offset_map(&pmdval, vmf->address);
+	if (unlikely(!spin_trylock(ptl))) {
+		pte_unmap(pte);
+		goto out;
+	}
+
+	if (vma_has_changed(vmf)) {
+		pte_unmap_unlock(pte, ptl);
+		goto out;
+	}
+
+	vmf->pte = pte;
+	vmf->ptl = ptl;
+	ret = true;
+out:
+	local_irq_enable();
+	return ret;
+}
+#else
+static inline bool pte_spinlock(struct vm_fault *vmf)
+{
+	vmf->ptl = pte_lockptr(vmf->vma->vm_mm, vmf->pmd);
+	spin_lock(vmf->ptl);
+	return true;
+}
+
+static inline bool pte_map_lock(struct vm_fault *vmf)
+{
+	vmf->pte = pte_offset_map_lock(vmf->vma->vm_mm, vmf->pmd,
+				       vmf->address, &vmf->ptl);
+	return true;
+}
+#endif /* CONFIG_SPECULATIVE_PAGE_FAULT */
+
 /*
  * Notify the address space that the page is about to become writable so that
  * it can prohibit this or wait for the page to get into an appropriate state.
@@ -2318,7 +2746,14 @@ static int wp_page_copy(struct vm_fault *vmf)
 	/*
 	 * Re-check the pte - we dropped the lock
 	 */
-	vmf->pte = pte_offset_map_lock(mm, vmf->pmd, vmf->address, &vmf->ptl);
+	if (!pte_map_lock(vmf)) {
+		mmu_notifier_invalidate_range_end(mm, mmun_start, mmun_end);
+		mem_cgroup_cancel_charge(new_page, memcg, false);
+		put_page(new_page);
+		if (old_page)
+			put_page(old_page);
+		return VM_FAULT_RETRY;
+	}
 	if (likely(pte_same(*vmf->pte, vmf->orig_pte))) {
 		if (old_page) {
 			if (!PageAnon(old_page)) {
@@ -2519,6 +2954,11 @@ static int do_wp_page(struct vm_fault *vmf)
 {
 	struct vm_area_struct *vma = vmf->vma;
 
+	if (userfaultfd_pte_wp(vma, *vmf->pte)) {
+		pte_unmap_unlock(vmf->pte, vmf->ptl);
+		return handle_userfault(vmf, VM_UFFD_WP);
+	}
+
 	vmf->page = vm_normal_page(vma, vmf->address, vmf->orig_pte);
 	if (!vmf->page) {
 		/*
@@ -2541,13 +2981,16 @@ static int do_wp_page(struct vm_fault *vmf)
 	 * not dirty accountable.
 	 */
 	if (PageAnon(vmf->page) && !PageKsm(vmf->page)) {
-		int total_mapcount;
+		int total_map_swapcount;
 		if (!trylock_page(vmf->page)) {
 			get_page(vmf->page);
 			pte_unmap_unlock(vmf->pte, vmf->ptl);
 			lock_page(vmf->page);
-			vmf->pte = pte_offset_map_lock(vma->vm_mm, vmf->pmd,
-					vmf->address, &vmf->ptl);
+			if (!pte_map_lock(vmf)) {
+				unlock_page(vmf->page);
+				put_page(vmf->page);
+				return VM_FAULT_RETRY;
+			}
 			if (!pte_same(*vmf->pte, vmf->orig_pte)) {
 				unlock_page(vmf->page);
 				pte_unmap_unlock(vmf->pte, vmf->ptl);
@@ -2556,8 +2999,8 @@ static int do_wp_page(struct vm_fault *vmf)
 			}
 			put_page(vmf->page);
 		}
-		if (reuse_swap_page(vmf->page, &total_mapcount)) {
-			if (total_mapcount == 1) {
+		if (reuse_swap_page(vmf->page, &total_map_swapcount)) {
+			if (total_map_swapcount == 1) {
 				/*
 				 * The page is all ours. Move it to
 				 * our anon_vma so the rmap code will
@@ -2699,10 +3142,14 @@ int do_swap_page(struct vm_fault *vmf)
 		goto out;
 	}
 	delayacct_set_flag(DELAYACCT_PF_SWAPIN);
-	page = lookup_swap_cache(entry);
+	page = lookup_swap_cache(entry, vma, vmf->address);
 	if (!page) {
-		page = swapin_readahead(entry, GFP_HIGHUSER_MOVABLE, vma,
-					vmf->address);
+		if (swap_use_vma_readahead())
+			page = swap_vma_readahead(entry, GFP_HIGHUSER_MOVABLE,
+						  vmf);
+		else
+			page = swapin_readahead(entry, GFP_HIGHUSER_MOVABLE,
+						vma, vmf->address);
 		if (!page) {
 			/*
 			 * Back out if somebody else faulted in this pte
@@ -2788,7 +3235,12 @@ int do_swap_page(struct vm_fault *vmf)
 	inc_mm_counter_fast(vma->vm_mm, MM_ANONPAGES);
 	dec_mm_counter_fast(vma->vm_mm, MM_SWAPENTS);
 	pte = mk_pte(page, vma->vm_page_prot);
-	if ((vmf->flags & FAULT_FLAG_WRITE) && reuse_swap_page(page, NULL)) {
+	/*
+	 * A write to a uffd-wp swap pte is left to do_wp_page() below,
+	 * which reports it to userland instead of making it writable.
+	 */
+	if ((vmf->flags & FAULT_FLAG_WRITE) &&
+	    !pte_swp_uffd_wp(vmf->orig_pte) && reuse_swap_page(page, NULL)) {
 		pte = maybe_mkwrite(pte_mkdirty(pte), vma);
 		vmf->flags &= ~FAULT_FLAG_WRITE;
 		ret |= VM_FAULT_WRITE;
@@ -2797,6 +3249,8 @@ int do_swap_page(struct vm_fault *vmf)
 	flush_icache_page(vma, page);
 	if (pte_swp_soft_dirty(vmf->orig_pte))
 		pte = pte_mksoft_dirty(pte);
+	if (pte_swp_uffd_wp(vmf->orig_pte))
+		pte = pte_mkuffd_wp(pte_wrprotect(pte));
 	set_pte_at(vma->vm_mm, vmf->address, vmf->pte, pte);
 	vmf->orig_pte = pte;
 	if (page == swapcache) {
@@ -2916,27 +3370,33 @@ static int do_anonymous_page(struct vm_fault *vmf)
 	 * pte_alloc_map() is safe to use under down_write(mmap_sem) or when
 	 * parallel threads are excluded by other means.
 	 *
-	 * Here we only have down_read(mmap_sem).
+	 * Here we only have down_read(mmap_sem), or nothing at all for a
+	 * speculative fault, which only runs on an already populated pmd
+	 * and revalidates it under the PTL.
 	 */
-	if (pte_alloc(vma->vm_mm, vmf->pmd, vmf->address))
-		return VM_FAULT_OOM;
+	if (!(vmf->flags & FAULT_FLAG_SPECULATIVE)) {
+		if (pte_alloc(vma->vm_mm, vmf->pmd, vmf->address))
+			return VM_FAULT_OOM;
 
-	/* See the comment in pte_alloc_one_map() */
-	if (unlikely(pmd_trans_unstable(vmf->pmd)))
-		return 0;
+		/* See the comment in pte_alloc_one_map() */
+		if (unlikely(pmd_trans_unstable(vmf->pmd)))
+			return 0;
+	}
 
 	/* Use the zero-page for reads */
 	if (!(vmf->flags & FAULT_FLAG_WRITE) &&
 			!mm_forbids_zeropage(vma->vm_mm)) {
 		entry = pte_mkspecial(pfn_pte(my_zero_pfn(vmf->address),
 						vma->vm_page_prot));
-		vmf->pte = pte_offset_map_lock(vma->vm_mm, vmf->pmd,
-				vmf->address, &vmf->ptl);
+		if (!pte_map_lock(vmf))
+			return VM_FAULT_RETRY;
 		if (!pte_none(*vmf->pte))
 			goto unlock;
 		/* Deliver the page fault to userland, check inside PT lock */
 		if (userfaultfd_missing(vma)) {
 			pte_unmap_unlock(vmf->pte, vmf->ptl);
+			if (vmf->flags & FAULT_FLAG_SPECULATIVE)
+				return VM_FAULT_RETRY;
 			return handle_userfault(vmf, VM_UFFD_MISSING);
 		}
 		goto setpte;
@@ -2963,8 +3423,11 @@ static int do_anonymous_page(struct vm_fault *vmf)
 	if (vma->vm_flags & VM_WRITE)
 		entry = pte_mkwrite(pte_mkdirty(entry));
 
-	vmf->pte = pte_offset_map_lock(vma->vm_mm, vmf->pmd, vmf->address,
-			&vmf->ptl);
+	if (!pte_map_lock(vmf)) {
+		mem_cgroup_cancel_charge(page, memcg, false);
+		put_page(page);
+		return VM_FAULT_RETRY;
+	}
 	if (!pte_none(*vmf->pte))
 		goto release;
 
@@ -2973,6 +3436,8 @@ static int do_anonymous_page(struct vm_fault *vmf)
 		pte_unmap_unlock(vmf->pte, vmf->ptl);
 		mem_cgroup_cancel_charge(page, memcg, false);
 		put_page(page);
+		if (vmf->flags & FAULT_FLAG_SPECULATIVE)
+			return VM_FAULT_RETRY;
 		return handle_userfault(vmf, VM_UFFD_MISSING);
 	}
 
@@ -3033,6 +3498,10 @@ static int pte_alloc_one_map(struct vm_fault *vmf)
 {
 	struct vm_area_struct *vma = vmf->vma;
 
+	/* The speculative path only runs on a populated, stable pmd */
+	if (vmf->flags & FAULT_FLAG_SPECULATIVE)
+		goto map_pte_lock;
+
 	if (!pmd_none(*vmf->pmd))
 		goto map_pte;
 	if (vmf->prealloc_pte) {
@@ -3064,8 +3533,9 @@ map_pte:
 	if (pmd_trans_unstable(vmf->pmd) || pmd_devmap(*vmf->pmd))
 		return VM_FAULT_NOPAGE;
 
-	vmf->pte = pte_offset_map_lock(vma->vm_mm, vmf->pmd, vmf->address,
-			&vmf->ptl);
+map_pte_lock:
+	if (!pte_map_lock(vmf))
+		return VM_FAULT_RETRY;
 	return 0;
 }
 
@@ -3181,7 +3651,8 @@ int alloc_set_pte(struct vm_fault *vmf, struct mem_cgroup *memcg,
 	pte_t entry;
 	int ret;
 
-	if (pmd_none(*vmf->pmd) && PageTransCompound(page) &&
+	if (!(vmf->flags & FAULT_FLAG_SPECULATIVE) &&
+			pmd_none(*vmf->pmd) && PageTransCompound(page) &&
 			IS_ENABLED(CONFIG_TRANSPARENT_HUGE_PAGECACHE)) {
 		/* THP on COW? */
 		VM_BUG_ON_PAGE(memcg, page);
@@ -3343,7 +3814,7 @@ static int do_fault_around(struct vm_fault *vmf)
 	end_pgoff = min3(end_pgoff, vma_pages(vmf->vma) + vmf->vma->vm_pgoff - 1,
 			start_pgoff + nr_pages - 1);
 
-	if (pmd_none(*vmf->pmd)) {
+	if (!(vmf->flags & FAULT_FLAG_SPECULATIVE) && pmd_none(*vmf->pmd)) {
 		vmf->prealloc_pte = pte_alloc_one(vmf->vma->vm_mm,
 						  vmf->address);
 		if (!vmf->prealloc_pte)
@@ -3354,7 +3825,7 @@ static int do_fault_around(struct vm_fault *vmf)
 	vmf->vma->vm_ops->map_pages(vmf, start_pgoff, end_pgoff);
 
 	/* Huge page is mapped? Page fault is solved */
-	if (pmd_trans_huge(*vmf->pmd)) {
+	if (!(vmf->flags & FAULT_FLAG_SPECULATIVE) && pmd_trans_huge(*vmf->pmd)) {
 		ret = VM_FAULT_NOPAGE;
 		goto out;
 	}
@@ -3680,7 +4151,12 @@ static int handle_pte_fault(struct vm_fault *vmf)
 {
 	pte_t entry;
 
-	if (unlikely(pmd_none(*vmf->pmd))) {
+	if (vmf->flags & FAULT_FLAG_SPECULATIVE) {
+		/*
+		 * The pmd and pte were sampled by handle_speculative_fault(),
+		 * they are revalidated once the PTL is held.
+		 */
+	} else if (unlikely(pmd_none(*vmf->pmd))) {
 		/*
 		 * Leave __pte_alloc() until later: because vm_ops->fault may
 		 * want to allocate huge page, and if we expose page table
@@ -3723,14 +4199,26 @@ static int handle_pte_fault(struct vm_fault *vmf)
 			return do_fault(vmf);
 	}
 
-	if (!pte_present(vmf->orig_pte))
+	if (!pte_present(vmf->orig_pte)) {
+		if (vmf->flags & FAULT_FLAG_SPECULATIVE) {
+			pte_unmap(vmf->pte);
+			return VM_FAULT_RETRY;
+		}
 		return do_swap_page(vmf);
+	}
 
-	if (pte_protnone(vmf->orig_pte) && vma_is_accessible(vmf->vma))
+	if (pte_protnone(vmf->orig_pte) && vma_is_accessible(vmf->vma)) {
+		if (vmf->flags & FAULT_FLAG_SPECULATIVE) {
+			pte_unmap(vmf->pte);
+			return VM_FAULT_RETRY;
+		}
 		return do_numa_page(vmf);
+	}
 
-	vmf->ptl = pte_lockptr(vmf->vma->vm_mm, vmf->pmd);
-	spin_lock(vmf->ptl);
+	if (!pte_spinlock(vmf)) {
+		pte_unmap(vmf->pte);
+		return VM_FAULT_RETRY;
+	}
 	entry = vmf->orig_pte;
 	if (unlikely(!pte_same(*vmf->pte, entry)))
 		goto unlock;
@@ -3836,6 +4324,11 @@ static int __handle_mm_fault(struct vm_area_struct *vma, unsigned long address,
 				return 0;
 			}
 		}
+
+		/* Every fault into a table shared by fork modifies it */
+		if (pmd_table_shared(orig_pmd) &&
+		    pte_table_unshare(vma, vmf.pmd, address))
+			return VM_FAULT_OOM;
 	}
 
 	return handle_pte_fault(&vmf);
@@ -3906,6 +4399,162 @@ int handle_mm_fault(struct vm_area_struct *vma, unsigned long address,
 }
 EXPORT_SYMBOL_GPL(handle_mm_fault);
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+/*
+ * Try to handle a user page fault without taking mmap_sem.
+ *
+ * The vma is looked up under mm_rb_lock and pinned by a reference, which
+ * keeps it and its vm_file alive but not stable: any change that matters to
+ * the fault bumps vma->vm_sequence, which is checked again under the PTL
+ * before the pte is touched.  The page tables are walked with interrupts
+ * disabled, as in gup_fast, and only an already populated pmd is used.
+ *
+ * Anything out of the ordinary (swap-in, NUMA hinting, huge pages, shared
+ * writes, userfaultfd, vma policies, stack expansion) is left to the
+ * regular path.  VM_FAULT_RETRY means the caller must retry the fault under
+ * mmap_sem; any other value is the result of the handled fault.
+ *
+ * Only the vma flags are checked against @flags, so the arch must not send
+ * here faults that it rejects from its own fault information alone, such
+ * as protection faults on reads.
+ */
+int handle_speculative_fault(struct mm_struct *mm, unsigned long address,
+			     unsigned int flags)
+{
+	struct vm_fault vmf = {
+		.address = address & PAGE_MASK,
+	};
+	struct vm_area_struct *vma;
+	pgd_t *pgd;
+	p4d_t *p4d;
+	pud_t *pud;
+	pmd_t *pmd;
+	int ret, write;
+
+	/* The speculative path must never sleep holding mmap_sem */
+	flags &= ~(FAULT_FLAG_ALLOW_RETRY | FAULT_FLAG_KILLABLE);
+	flags |= FAULT_FLAG_SPECULATIVE;
+	write = flags & FAULT_FLAG_WRITE;
+
+	vma = get_vma(mm, address);
+	if (!vma)
+		return VM_FAULT_RETRY;
+
+	vmf.sequence = raw_read_seqcount(&vma->vm_sequence);
+	/* A writer is busy with this vma */
+	if (vmf.sequence & 1)
+		goto out_put;
+
+	if (address < vma->vm_start || vma->vm_end <= address)
+		goto out_put;
+
+	if (vma->vm_flags & (VM_HUGETLB | VM_GROWSDOWN | VM_GROWSUP |
+			     VM_PFNMAP | VM_MIXEDMAP | VM_IO))
+		goto out_put;
+
+	if (userfaultfd_armed(vma) || vma_policy(vma))
+		goto out_put;
+
+	if (!vma_is_anonymous(vma)) {
+		/*
+		 * Only filemap_fault() is known to cope with being called
+		 * without mmap_sem, and shared writes involve ->page_mkwrite.
+		 */
+		if (vma->vm_ops->fault != filemap_fault)
+			goto out_put;
+		if (write && (vma->vm_flags & VM_SHARED))
+			goto out_put;
+	}
+
+	/* anon_vma_prepare() needs mmap_sem */
+	if (write && !vma->anon_vma)
+		goto out_put;
+
+	if (write) {
+		if (!(vma->vm_flags & VM_WRITE))
+			goto out_put;
+	} else if (!(vma->vm_flags & (VM_READ | VM_EXEC | VM_WRITE))) {
+		goto out_put;
+	}
+
+	if (!arch_vma_access_permitted(vma, write,
+				       flags & FAULT_FLAG_INSTRUCTION,
+				       flags & FAULT_FLAG_REMOTE))
+		goto out_put;
+
+	vmf.vma = vma;
+	vmf.flags = flags;
+	vmf.pgoff = linear_page_index(vma, address);
+	vmf.gfp_mask = __get_fault_gfp_mask(vma);
+
+	local_irq_disable();
+	pgd = pgd_offset(mm, address);
+	if (pgd_none(*pgd) || unlikely(pgd_bad(*pgd)))
+		goto out_walk;
+
+	p4d = p4d_offset(pgd, address);
+	if (p4d_none(*p4d) || unlikely(p4d_bad(*p4d)))
+		goto out_walk;
+
+	pud = pud_offset(p4d, address);
+	if (pud_none(*pud) || unlikely(pud_bad(*pud)) ||
+	    pud_trans_huge(*pud) || pud_devmap(*pud))
+		goto out_walk;
+
+	pmd = pmd_offset(pud, address);
+	vmf.orig_pmd = READ_ONCE(*pmd);
+	if (pmd_none(vmf.orig_pmd) || pmd_trans_huge(vmf.orig_pmd) ||
+	    pmd_devmap(vmf.orig_pmd) || pmd_table_shared(vmf.orig_pmd) ||
+	    unlikely(pmd_bad(vmf.orig_pmd)))
+		goto out_walk;
+	vmf.pmd = pmd;
+
+	vmf.pte = pte_offset_map(&vmf.orig_pmd, address);
+	vmf.orig_pte = READ_ONCE(*vmf.pte);
+	barrier(); /* See comment in handle_pte_fault() */
+	if (pte_none(vmf.orig_pte)) {
+		pte_unmap(vmf.pte);
+		vmf.pte = NULL;
+	}
+	local_irq_enable();
+
+	if (flags & FAULT_FLAG_USER)
+		mem_cgroup_oom_enable();
+
+	ret = handle_pte_fault(&vmf);
+
+	if (flags & FAULT_FLAG_USER) {
+		mem_cgroup_oom_disable();
+		if (task_in_memcg_oom(current) && !(ret & VM_FAULT_OOM))
+			mem_cgroup_oom_synchronize(false);
+	}
+
+	put_vma(vma);
+
+	/*
+	 * Errors are not trusted either: the vma may have changed under us,
+	 * so let the regular path decide what to report.
+	 */
+	if (ret & (VM_FAULT_RETRY | VM_FAULT_ERROR)) {
+		count_vm_event(SPECULATIVE_PGFAULT_FAIL);
+		return VM_FAULT_RETRY;
+	}
+
+	count_vm_event(PGFAULT);
+	count_vm_event(SPECULATIVE_PGFAULT);
+	mem_cgroup_count_vm_event(mm, PGFAULT);
+	check_sync_rss_stat(current);
+	return ret;
+
+out_walk:
+	local_irq_enable();
+out_put:
+	put_vma(vma);
+	count_vm_event(SPECULATIVE_PGFAULT_FAIL);
+	return VM_FAULT_RETRY;
+}
+#endif /* CONFIG_SPECULATIVE_PAGE_FAULT */
+
 #ifndef __PAGETABLE_P4D_FOLDED
 /*
  * Allocate p4d page table.
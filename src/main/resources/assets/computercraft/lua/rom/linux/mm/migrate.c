@@ -41,6 +41,7 @@
 #include <linux/page_idle.h>
 #include <linux/page_owner.h>
 #include <linux/sched/mm.h>
+#include <linux/sched/sysctl.h>
 
 #include <asm/tlbflush.h>
 
@@ -226,6 +227,8 @@ static int remove_migration_pte(struct page *page, struct vm_area_struct *vma,
 		entry = pte_to_swp_entry(*pvmw.pte);
 		if (is_write_migration_entry(entry))
 			pte = maybe_mkwrite(pte, vma);
+		else if (pte_swp_uffd_wp(*pvmw.pte))
+			pte = pte_mkuffd_wp(pte);
 
 #ifdef CONFIG_HUGETLB_PAGE
 		if (PageHuge(new)) {
@@ -1760,16 +1763,26 @@ static struct page *alloc_misplaced_dst_page(struct page *page,
 
 /*
  * page migration rate limiting control.
- * Do not migrate more than @pages_to_migrate in a @migrate_interval_millisecs
- * window of time. Default here says do not migrate more than 1280M per second.
+ * Do not migrate more than sysctl_numa_balancing_migrate_rate_limit MB per
+ * second to a node, accounted in windows of @migrate_interval_millisecs.
+ * Default here says do not migrate more than 1280M per second, 0 means no
+ * limit.
  */
 static unsigned int migrate_interval_millisecs __read_mostly = 100;
-static unsigned int ratelimit_pages __read_mostly = 128 << (20 - PAGE_SHIFT);
+unsigned int sysctl_numa_balancing_migrate_rate_limit __read_mostly = 1280;
 
 /* Returns true if the node is migrate rate-limited after the update */
 static bool numamigrate_update_ratelimit(pg_data_t *pgdat,
 					unsigned long nr_pages)
 {
+	unsigned long ratelimit_pages;
+
+	ratelimit_pages = READ_ONCE(sysctl_numa_balancing_migrate_rate_limit);
+	if (!ratelimit_pages)
+		return false;
+	ratelimit_pages = (ratelimit_pages << (20 - PAGE_SHIFT)) *
+			  migrate_interval_millisecs / MSEC_PER_SEC;
+
 	/*
 	 * Rate-limit the amount of data that is being migrated to a node.
 	 * Optimal placement is no good if the memory bus is saturated and
@@ -1785,6 +1798,7 @@ static bool numamigrate_update_ratelimit(pg_data_t *pgdat,
 	if (pgdat->numabalancing_migrate_nr_pages > ratelimit_pages) {
 		trace_mm_numa_migrate_ratelimit(current, pgdat->node_id,
 								nr_pages);
+		count_vm_numa_events(NUMA_PAGE_MIGRATE_RATELIMITED, nr_pages);
 		return true;
 	}
 
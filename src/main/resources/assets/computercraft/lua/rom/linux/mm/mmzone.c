@@ -93,6 +93,20 @@ void lruvec_init(struct lruvec *lruvec)
 
 	for_each_lru(lru)
 		INIT_LIST_HEAD(&lruvec->lists[lru]);
+
+#ifdef CONFIG_LRU_GEN
+	{
+		struct lru_gen_struct *lrugen = &lruvec->lrugen;
+		int gen, type, zone;
+
+		/* start out with the minimum number of generations plus one */
+		lrugen->max_seq = MIN_NR_GENS;
+		for (gen = 0; gen < MAX_NR_GENS; gen++)
+			for (type = 0; type < ANON_AND_FILE; type++)
+				for (zone = 0; zone < MAX_NR_ZONES; zone++)
+					INIT_LIST_HEAD(&lrugen->lists[gen][type][zone]);
+	}
+#endif
 }
 
 #if defined(CONFIG_NUMA_BALANCING) && !defined(LAST_CPUPID_NOT_IN_PAGE_FLAGS)
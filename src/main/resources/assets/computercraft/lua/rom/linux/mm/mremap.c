@@ -242,6 +242,8 @@ unsigned long move_page_tables(struct vm_area_struct *vma,
 		}
 		if (pte_alloc(new_vma->vm_mm, new_pmd, new_addr))
 			break;
+		if (pmd_table_shared(*old_pmd))
+			pte_table_unshare_nofail(vma, old_pmd, old_addr);
 		next = (new_addr + PMD_SIZE) & PMD_MASK;
 		if (extent > next - new_addr)
 			extent = next - new_addr;
@@ -300,6 +302,11 @@ static unsigned long move_vma(struct vm_area_struct *vma,
 	if (!new_vma)
 		return -ENOMEM;
 
+	/* Keep speculative faults out of both ranges while the ptes move */
+	vm_write_begin(vma);
+	if (new_vma != vma)
+		vm_write_begin(new_vma);
+
 	moved_len = move_page_tables(vma, old_addr, new_vma, new_addr, old_len,
 				     need_rmap_locks);
 	if (moved_len < old_len) {
@@ -316,11 +323,17 @@ static unsigned long move_vma(struct vm_area_struct *vma,
 		 */
 		move_page_tables(new_vma, new_addr, vma, old_addr, moved_len,
 				 true);
+		if (new_vma != vma)
+			vm_write_end(new_vma);
+		vm_write_end(vma);
 		vma = new_vma;
 		old_len = new_len;
 		old_addr = new_addr;
 		new_addr = err;
 	} else {
+		if (new_vma != vma)
+			vm_write_end(new_vma);
+		vm_write_end(vma);
 		mremap_userfaultfd_prep(new_vma, uf);
 		arch_remap(mm, old_addr, old_addr + old_len,
 			   new_addr, new_addr + new_len);
@@ -2263,6 +2263,37 @@ static void put_cpu_partial(struct kmem_cache *s, struct page *page, int drain)
 #endif
 }
 
+#ifdef CONFIG_SLUB_MAGAZINE
+static void *magazine_alloc(struct kmem_cache *s, gfp_t gfpflags, int node);
+static bool magazine_free(struct kmem_cache *s, void *head, void *tail,
+			  int cnt);
+static void flush_cpu_magazine(struct kmem_cache *s, int cpu);
+
+static inline bool cpu_has_magazine(struct kmem_cache *s, int cpu)
+{
+	return s->cpu_mag && per_cpu_ptr(s->cpu_mag, cpu)->count;
+}
+#else
+static inline void *magazine_alloc(struct kmem_cache *s, gfp_t gfpflags,
+				   int node)
+{
+	return NULL;
+}
+
+static inline bool magazine_free(struct kmem_cache *s, void *head, void *tail,
+				 int cnt)
+{
+	return false;
+}
+
+static inline void flush_cpu_magazine(struct kmem_cache *s, int cpu) { }
+
+static inline bool cpu_has_magazine(struct kmem_cache *s, int cpu)
+{
+	return false;
+}
+#endif
+
 static inline void flush_slab(struct kmem_cache *s, struct kmem_cache_cpu *c)
 {
 	stat(s, CPUSLAB_FLUSH);
@@ -2288,6 +2319,7 @@ static inline void __flush_cpu_slab(struct kmem_cache *s, int cpu)
 
 		unfreeze_partials(s, c);
 	}
+	flush_cpu_magazine(s, cpu);
 }
 
 static void flush_cpu_slab(void *d)
@@ -2302,7 +2334,7 @@ static bool has_cpu_slab(int cpu, void *info)
 	struct kmem_cache *s = info;
 	struct kmem_cache_cpu *c = per_cpu_ptr(s->cpu_slab, cpu);
 
-	return c->page || c->partial;
+	return c->page || c->partial || cpu_has_magazine(s, cpu);
 }
 
 static void flush_all(struct kmem_cache *s)
@@ -2618,7 +2650,9 @@ static void *__slab_alloc(struct kmem_cache *s, gfp_t gfpflags, int node,
 	c = this_cpu_ptr(s->cpu_slab);
 #endif
 
-	p = ___slab_alloc(s, gfpflags, node, addr, c);
+	p = magazine_alloc(s, gfpflags, node);
+	if (!p)
+		p = ___slab_alloc(s, gfpflags, node, addr, c);
 	local_irq_restore(flags);
 	return p;
 }
@@ -2949,7 +2983,7 @@ redo:
 			goto redo;
 		}
 		stat(s, FREE_FASTPATH);
-	} else
+	} else if (!magazine_free(s, head, tail_obj, cnt))
 		__slab_free(s, page, head, tail_obj, cnt, addr);
 
 }
@@ -3076,6 +3110,132 @@ int build_detached_freelist(struct kmem_cache *s, size_t size,
 	return first_skipped_index;
 }
 
+#ifdef CONFIG_SLUB_MAGAZINE
+/*
+ * Per cpu magazines.
+ *
+ * A free that misses the cpu slab would normally go to __slab_free(),
+ * which has to cmpxchg the freelist of a slab that some other cpu is
+ * usually allocating from and often has to take the node list_lock as
+ * well.  Such objects are instead stashed in a per cpu magazine.
+ * Allocations that find the cpu freelist empty are served from the
+ * magazine first.  A full magazine is handed back to the slabs through
+ * a detached freelist per slab, as kmem_cache_free_bulk() does, so a
+ * batch of objects from the same slab costs a single freelist update.
+ */
+static bool slub_magazines_ready __read_mostly;
+
+/*
+ * Magazines are an optimization only, a cache that could not get them
+ * simply frees to its slabs directly.  Debug caches never get them so
+ * that every free still goes through free_debug_processing().
+ */
+static void alloc_kmem_cache_magazines(struct kmem_cache *s)
+{
+	if (!slub_magazines_ready || s->cpu_mag || kmem_cache_debug(s) ||
+	    (s->flags & SLAB_KASAN))
+		return;
+
+	s->cpu_mag = alloc_percpu(struct kmem_cache_magazine);
+}
+
+static void free_kmem_cache_magazines(struct kmem_cache *s)
+{
+	free_percpu(s->cpu_mag);
+	s->cpu_mag = NULL;
+}
+
+/*
+ * Return all objects in the magazine to their slabs.  Called with
+ * interrupts disabled or on behalf of an offline cpu.
+ */
+static void drain_magazine(struct kmem_cache *s, struct kmem_cache_magazine *m)
+{
+	size_t size = m->count;
+
+	if (!size)
+		return;
+
+	m->count = 0;
+	do {
+		struct detached_freelist df;
+
+		size = build_detached_freelist(s, size, m->objects, &df);
+		if (!df.page)
+			continue;
+
+		__slab_free(df.s, df.page, df.freelist, df.tail, df.cnt,
+			    _RET_IP_);
+	} while (likely(size));
+	stat(s, MAGAZINE_FLUSH);
+}
+
+static void flush_cpu_magazine(struct kmem_cache *s, int cpu)
+{
+	if (s->cpu_mag)
+		drain_magazine(s, per_cpu_ptr(s->cpu_mag, cpu));
+}
+
+/* Interrupts must be disabled */
+static void *magazine_alloc(struct kmem_cache *s, gfp_t gfpflags, int node)
+{
+	struct kmem_cache_magazine *m;
+	struct page *page;
+	void *object;
+
+	if (!s->cpu_mag)
+		return NULL;
+
+	m = this_cpu_ptr(s->cpu_mag);
+	if (!m->count)
+		return NULL;
+
+	object = m->objects[m->count - 1];
+	page = virt_to_head_page(object);
+	if (!node_match(page, node) || !pfmemalloc_match(page, gfpflags))
+		return NULL;
+
+	m->count--;
+	stat(s, ALLOC_MAGAZINE);
+	return object;
+}
+
+/*
+ * Take a freelist of @cnt objects from head to tail that did not belong
+ * to the cpu slab.  Returns false if the caller has to free it to the
+ * slab itself.
+ */
+static bool magazine_free(struct kmem_cache *s, void *head, void *tail,
+			  int cnt)
+{
+	struct kmem_cache_magazine *m;
+	unsigned long flags;
+	void *object = head;
+
+	if (!s->cpu_mag || cnt > SLUB_MAGAZINE_SIZE)
+		return false;
+
+	local_irq_save(flags);
+	m = this_cpu_ptr(s->cpu_mag);
+	if (m->count + cnt > SLUB_MAGAZINE_SIZE)
+		drain_magazine(s, m);
+
+	for (;;) {
+		m->objects[m->count++] = object;
+		if (object == tail)
+			break;
+		object = get_freepointer(s, object);
+	}
+	local_irq_restore(flags);
+	stat(s, FREE_MAGAZINE);
+	return true;
+}
+#else
+static inline void alloc_kmem_cache_magazines(struct kmem_cache *s) { }
+
+static inline void free_kmem_cache_magazines(struct kmem_cache *s) { }
+#endif /* CONFIG_SLUB_MAGAZINE */
+
 /* Note that interrupts must be enabled when calling this function. */
 void kmem_cache_free_bulk(struct kmem_cache *s, size_t size, void **p)
 {
@@ -3117,6 +3277,12 @@ int kmem_cache_alloc_bulk(struct kmem_cache *s, gfp_t flags, size_t size,
 		void *object = c->freelist;
 
 		if (unlikely(!object)) {
+			/* Empty the cpu magazine before touching any slab */
+			object = magazine_alloc(s, flags, NUMA_NO_NODE);
+			if (object) {
+				p[i] = object;
+				continue;
+			}
 			/*
 			 * Invoking slow path likely have side-effect
 			 * of re-populating per CPU c->freelist
@@ -3372,6 +3538,7 @@ static void free_kmem_cache_nodes(struct kmem_cache *s)
 void __kmem_cache_release(struct kmem_cache *s)
 {
 	cache_random_seq_destroy(s);
+	free_kmem_cache_magazines(s);
 	free_percpu(s->cpu_slab);
 	free_kmem_cache_nodes(s);
 }
@@ -3609,8 +3776,10 @@ static int kmem_cache_open(struct kmem_cache *s, unsigned long flags)
 	if (!init_kmem_cache_nodes(s))
 		goto error;
 
-	if (alloc_kmem_cache_cpus(s))
+	if (alloc_kmem_cache_cpus(s)) {
+		alloc_kmem_cache_magazines(s);
 		return 0;
+	}
 
 	free_kmem_cache_nodes(s);
 error:
@@ -4203,6 +4372,19 @@ void __init kmem_cache_init(void)
 
 void __init kmem_cache_init_late(void)
 {
+#ifdef CONFIG_SLUB_MAGAZINE
+	struct kmem_cache *s;
+
+	/*
+	 * The early percpu area is too small for the magazines of the boot
+	 * caches, so they get theirs here.
+	 */
+	mutex_lock(&slab_mutex);
+	slub_magazines_ready = true;
+	list_for_each_entry(s, &slab_caches, list)
+		alloc_kmem_cache_magazines(s);
+	mutex_unlock(&slab_mutex);
+#endif
 }
 
 struct kmem_cache *
@@ -5343,6 +5525,11 @@ STAT_ATTR(CPU_PARTIAL_ALLOC, cpu_partial_alloc);
 STAT_ATTR(CPU_PARTIAL_FREE, cpu_partial_free);
 STAT_ATTR(CPU_PARTIAL_NODE, cpu_partial_node);
 STAT_ATTR(CPU_PARTIAL_DRAIN, cpu_partial_drain);
+#ifdef CONFIG_SLUB_MAGAZINE
+STAT_ATTR(ALLOC_MAGAZINE, alloc_magazine);
+STAT_ATTR(FREE_MAGAZINE, free_magazine);
+STAT_ATTR(MAGAZINE_FLUSH, magazine_flush);
+#endif
 #endif
 
 static struct attribute *slab_attrs[] = {
@@ -5410,6 +5597,11 @@ static struct attribute *slab_attrs[] = {
 	&cpu_partial_free_attr.attr,
 	&cpu_partial_node_attr.attr,
 	&cpu_partial_drain_attr.attr,
+#ifdef CONFIG_SLUB_MAGAZINE
+	&alloc_magazine_attr.attr,
+	&free_magazine_attr.attr,
+	&magazine_flush_attr.attr,
+#endif
 #endif
 #ifdef CONFIG_FAILSLAB
 	&failslab_attr.attr,
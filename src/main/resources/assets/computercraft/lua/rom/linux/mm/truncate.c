@@ -184,7 +184,14 @@ invalidate_complete_page(struct address_space *mapping, struct page *page)
 int truncate_inode_page(struct address_space *mapping, struct page *page)
 {
 	loff_t holelen;
-	VM_BUG_ON_PAGE(PageTail(page), page);
+
+	/*
+	 * Huge pages of a regular file are clean and read-only (see
+	 * collapse_file()): they go as a whole, nothing is lost by dropping
+	 * the part outside the truncated range.
+	 */
+	VM_BUG_ON_PAGE(PageTail(page) && PageSwapBacked(page), page);
+	page = compound_head(page);
 
 	holelen = PageTransHuge(page) ? HPAGE_PMD_SIZE : PAGE_SIZE;
 	if (page_mapped(page)) {
@@ -26,7 +26,8 @@ static int mcopy_atomic_pte(struct mm_struct *dst_mm,
 			    struct vm_area_struct *dst_vma,
 			    unsigned long dst_addr,
 			    unsigned long src_addr,
-			    struct page **pagep)
+			    struct page **pagep,
+			    bool wp_copy)
 {
 	struct mem_cgroup *memcg;
 	pte_t _dst_pte, *dst_pte;
@@ -71,8 +72,13 @@ static int mcopy_atomic_pte(struct mm_struct *dst_mm,
 		goto out_release;
 
 	_dst_pte = mk_pte(page, dst_vma->vm_page_prot);
-	if (dst_vma->vm_flags & VM_WRITE)
-		_dst_pte = pte_mkwrite(pte_mkdirty(_dst_pte));
+	if (dst_vma->vm_flags & VM_WRITE) {
+		_dst_pte = pte_mkdirty(_dst_pte);
+		if (wp_copy)
+			_dst_pte = pte_mkuffd_wp(_dst_pte);
+		else
+			_dst_pte = pte_mkwrite(_dst_pte);
+	}
 
 	ret = -EEXIST;
 	dst_pte = pte_offset_map_lock(dst_mm, dst_pmd, dst_addr, &ptl);
@@ -375,7 +381,8 @@ static __always_inline ssize_t __mcopy_atomic(struct mm_struct *dst_mm,
 					      unsigned long dst_start,
 					      unsigned long src_start,
 					      unsigned long len,
-					      bool zeropage)
+					      bool zeropage,
+					      bool wp_copy)
 {
 	struct vm_area_struct *dst_vma;
 	ssize_t err;
@@ -426,6 +433,12 @@ retry:
 		goto out_unlock;
 
 	err = -EINVAL;
+	/*
+	 * Only a range registered in write protect mode can be resolved
+	 * into write protected pages.
+	 */
+	if (wp_copy && !userfaultfd_wp(dst_vma))
+		goto out_unlock;
 	/*
 	 * shmem_zero_setup is invoked in mmap for MAP_ANONYMOUS|MAP_SHARED but
 	 * it will overwrite vm_ops, so vma_is_anonymous must return false.
@@ -487,11 +500,17 @@ retry:
 		BUG_ON(pmd_none(*dst_pmd));
 		BUG_ON(pmd_trans_huge(*dst_pmd));
 
+		if (pmd_table_shared(*dst_pmd)) {
+			err = pte_table_unshare(dst_vma, dst_pmd, dst_addr);
+			if (err)
+				break;
+		}
+
 		if (vma_is_anonymous(dst_vma)) {
 			if (!zeropage)
 				err = mcopy_atomic_pte(dst_mm, dst_pmd, dst_vma,
 						       dst_addr, src_addr,
-						       &page);
+						       &page, wp_copy);
 			else
 				err = mfill_zeropage_pte(dst_mm, dst_pmd,
 							 dst_vma, dst_addr);
@@ -548,13 +567,65 @@ out:
 }
 
 ssize_t mcopy_atomic(struct mm_struct *dst_mm, unsigned long dst_start,
-		     unsigned long src_start, unsigned long len)
+		     unsigned long src_start, unsigned long len, bool wp_copy)
 {
-	return __mcopy_atomic(dst_mm, dst_start, src_start, len, false);
+	return __mcopy_atomic(dst_mm, dst_start, src_start, len, false,
+			      wp_copy);
 }
 
 ssize_t mfill_zeropage(struct mm_struct *dst_mm, unsigned long start,
 		       unsigned long len)
 {
-	return __mcopy_atomic(dst_mm, start, 0, len, true);
+	return __mcopy_atomic(dst_mm, start, 0, len, true, false);
+}
+
+int mwriteprotect_range(struct mm_struct *dst_mm, unsigned long start,
+			unsigned long len, bool enable_wp)
+{
+	struct vm_area_struct *dst_vma;
+	unsigned long cp_flags;
+	pgprot_t newprot;
+	int err;
+
+	/*
+	 * Sanitize the command parameters:
+	 */
+	BUG_ON(start & ~PAGE_MASK);
+	BUG_ON(len & ~PAGE_MASK);
+
+	/* Does the address range wrap, or is the span zero-sized? */
+	BUG_ON(start + len <= start);
+
+	down_read(&dst_mm->mmap_sem);
+
+	/*
+	 * Like __mcopy_atomic the range must be fully within a single
+	 * userfaultfd registered vma, here in write protect mode.
+	 */
+	err = -ENOENT;
+	dst_vma = find_vma(dst_mm, start);
+	if (!dst_vma || (dst_vma->vm_flags & VM_SHARED))
+		goto out_unlock;
+	if (start < dst_vma->vm_start ||
+	    start + len > dst_vma->vm_end)
+		goto out_unlock;
+	if (!userfaultfd_wp(dst_vma))
+		goto out_unlock;
+	if (!vma_is_anonymous(dst_vma))
+		goto out_unlock;
+
+	if (enable_wp) {
+		newprot = vm_get_page_prot(dst_vma->vm_flags & ~(VM_WRITE));
+		cp_flags = MM_CP_UFFD_WP;
+	} else {
+		newprot = vm_get_page_prot(dst_vma->vm_flags);
+		cp_flags = MM_CP_UFFD_WP_RESOLVE;
+	}
+
+	change_protection(dst_vma, start, start + len, newprot, cp_flags);
+
+	err = 0;
+out_unlock:
+	up_read(&dst_mm->mmap_sem);
+	return err;
 }
@@ -48,6 +48,7 @@
 #include <linux/prefetch.h>
 #include <linux/printk.h>
 #include <linux/dax.h>
+#include <linux/psi.h>
 
 #include <asm/tlbflush.h>
 #include <asm/div64.h>
@@ -666,6 +667,7 @@ static int __remove_mapping(struct address_space *mapping, struct page *page,
 			    bool reclaimed)
 {
 	unsigned long flags;
+	int refcount;
 
 	BUG_ON(!PageLocked(page));
 	BUG_ON(mapping != page_mapping(page));
@@ -695,12 +697,19 @@ static int __remove_mapping(struct address_space *mapping, struct page *page,
 	 *
 	 * Note that if SetPageDirty is always performed via set_page_dirty,
 	 * and thus under tree_lock, then this ordering is not required.
+	 *
+	 * A huge page in the swap cache has one reference per subpage
+	 * from the radix tree.
 	 */
-	if (!page_ref_freeze(page, 2))
+	if (unlikely(PageTransHuge(page)) && PageSwapCache(page))
+		refcount = 1 + HPAGE_PMD_NR;
+	else
+		refcount = 2;
+	if (!page_ref_freeze(page, refcount))
 		goto cannot_free;
 	/* note: atomic_cmpxchg in page_freeze_refs provides the smp_rmb */
 	if (unlikely(PageDirty(page))) {
-		page_ref_unfreeze(page, 2);
+		page_ref_unfreeze(page, refcount);
 		goto cannot_free;
 	}
 
@@ -709,7 +718,7 @@ static int __remove_mapping(struct address_space *mapping, struct page *page,
 		mem_cgroup_swapout(page, swap);
 		__delete_from_swap_cache(page);
 		spin_unlock_irqrestore(&mapping->tree_lock, flags);
-		swapcache_free(swap);
+		put_swap_page(page, swap);
 	} else {
 		void (*freepage)(struct page *);
 		void *shadow = NULL;
@@ -1103,7 +1112,15 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 			}
 		}
 
-		if (!force_reclaim)
+		/*
+		 * The multi-gen LRU has already found the pages accessed
+		 * through page tables while aging, and try_to_unmap() still
+		 * backs off from young PTEs, so skip the rmap walk here.
+		 */
+		if (!force_reclaim && lru_gen_enabled())
+			references = TestClearPageReferenced(page) ?
+				     PAGEREF_ACTIVATE : PAGEREF_RECLAIM;
+		else if (!force_reclaim)
 			references = page_check_references(page, sc);
 
 		switch (references) {
@@ -1124,8 +1141,31 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 		if (PageAnon(page) && !PageSwapCache(page)) {
 			if (!(sc->gfp_mask & __GFP_IO))
 				goto keep_locked;
-			if (!add_to_swap(page, page_list))
-				goto activate_locked;
+			if (PageTransHuge(page)) {
+				/* cannot split THP, skip it */
+				if (!can_split_huge_page(page, NULL))
+					goto activate_locked;
+				/*
+				 * Split pages without a PMD map right
+				 * away. Chances are some or all of the
+				 * tail pages can be freed without IO.
+				 */
+				if (!compound_mapcount(page) &&
+				    split_huge_page_to_list(page, page_list))
+					goto activate_locked;
+			}
+			if (!add_to_swap(page)) {
+				if (!PageTransHuge(page))
+					goto activate_locked;
+				/* Fallback to swap normal pages */
+				if (split_huge_page_to_list(page, page_list))
+					goto activate_locked;
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+				count_vm_event(THP_SWPOUT_FALLBACK);
+#endif
+				if (!add_to_swap(page))
+					goto activate_locked;
+			}
 			lazyfree = true;
 			may_enter_fs = 1;
 
@@ -1137,16 +1177,21 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 				goto keep_locked;
 		}
 
-		VM_BUG_ON_PAGE(PageTransHuge(page), page);
-
 		/*
 		 * The page is mapped into the page tables of one or more
-		 * processes. Try to unmap it here.
+		 * processes. Try to unmap it here.  A huge page that made it
+		 * here is in the swap cache: its PMD mappings are split so
+		 * that each subpage gets its own swap entry, but the page
+		 * itself stays whole for the write out.
 		 */
 		if (page_mapped(page) && mapping) {
-			switch (ret = try_to_unmap(page, lazyfree ?
-				(ttu_flags | TTU_BATCH_FLUSH | TTU_LZFREE) :
-				(ttu_flags | TTU_BATCH_FLUSH))) {
+			enum ttu_flags flags = ttu_flags | TTU_BATCH_FLUSH;
+
+			if (lazyfree)
+				flags |= TTU_LZFREE;
+			if (unlikely(PageTransHuge(page)))
+				flags |= TTU_SPLIT_HUGE_PMD;
+			switch (ret = try_to_unmap(page, flags)) {
 			case SWAP_FAIL:
 				nr_unmap_fail++;
 				goto activate_locked;
@@ -1283,13 +1328,17 @@ free_it:
 		if (ret == SWAP_LZFREE)
 			count_vm_event(PGLAZYFREED);
 
-		nr_reclaimed++;
+		nr_reclaimed += hpage_nr_pages(page);
 
 		/*
 		 * Is there need to periodically free_page_list? It would
 		 * appear not as the counts should be low
 		 */
-		list_add(&page->lru, &free_pages);
+		if (unlikely(PageTransHuge(page))) {
+			mem_cgroup_uncharge(page);
+			(*get_compound_page_dtor(page))(page);
+		} else
+			list_add(&page->lru, &free_pages);
 		continue;
 
 cull_mlocked:
@@ -2329,6 +2378,557 @@ out:
 	}
 }
 
+#ifdef CONFIG_LRU_GEN
+/*
+ * Multi-gen LRU
+ *
+ * Instead of an active and an inactive list, each lruvec keeps up to
+ * MAX_NR_GENS generations of pages per type, numbered by min_seq..max_seq.
+ * Aging walks the page tables of the mm_structs on lru_gen_mm_list and
+ * moves pages with young PTEs into the youngest generation, then opens a
+ * new one. Eviction takes pages from the oldest generation, so it does
+ * not need to walk the rmap of every page it looks at. The two youngest
+ * generations are accounted as active, the rest as inactive, so that
+ * the rest of the VM (and the workingset code) sees the LRU sizes it
+ * expects.
+ */
+
+bool lru_gen_on __read_mostly = IS_ENABLED(CONFIG_LRU_GEN_ENABLED);
+
+static int __init setup_lru_gen(char *str)
+{
+	bool enable;
+
+	if (kstrtobool(str, &enable))
+		return 0;
+
+	lru_gen_on = enable;
+	return 1;
+}
+__setup("lru_gen=", setup_lru_gen);
+
+static LIST_HEAD(lru_gen_mm_list);
+static DEFINE_SPINLOCK(lru_gen_mm_lock);
+
+void lru_gen_add_mm(struct mm_struct *mm)
+{
+	spin_lock(&lru_gen_mm_lock);
+	list_add_tail(&mm->lru_gen_list, &lru_gen_mm_list);
+	spin_unlock(&lru_gen_mm_lock);
+}
+
+void lru_gen_del_mm(struct mm_struct *mm)
+{
+	spin_lock(&lru_gen_mm_lock);
+	list_del(&mm->lru_gen_list);
+	spin_unlock(&lru_gen_mm_lock);
+}
+
+#define MAX_LRU_BATCH	(SWAP_CLUSTER_MAX * 4)
+
+/*
+ * Retire the oldest generation of @type if it has no pages left, as long
+ * as MIN_NR_GENS generations would remain. Called with the lru_lock held.
+ */
+static bool try_to_inc_min_seq(struct lruvec *lruvec, int type)
+{
+	struct lru_gen_struct *lrugen = &lruvec->lrugen;
+	bool success = false;
+
+	while (lrugen->min_seq[type] + MIN_NR_GENS <= lrugen->max_seq) {
+		int gen = lru_gen_from_seq(lrugen->min_seq[type]);
+		int zone;
+
+		for (zone = 0; zone < MAX_NR_ZONES; zone++) {
+			if (!list_empty(&lrugen->lists[gen][type][zone]))
+				return success;
+		}
+
+		lrugen->min_seq[type]++;
+		success = true;
+	}
+
+	return success;
+}
+
+/*
+ * Forcibly retire the oldest generation of @type, moving whatever is left
+ * in it into the next one. Called with the lru_lock held.
+ */
+static void inc_min_seq(struct lruvec *lruvec, int type)
+{
+	struct lru_gen_struct *lrugen = &lruvec->lrugen;
+	int old_gen = lru_gen_from_seq(lrugen->min_seq[type]);
+	int new_gen = lru_gen_from_seq(lrugen->min_seq[type] + 1);
+	int zone;
+
+	for (zone = 0; zone < MAX_NR_ZONES; zone++) {
+		struct list_head *head = &lrugen->lists[old_gen][type][zone];
+
+		while (!list_empty(head)) {
+			struct page *page = lru_to_page(head);
+			int gen = page_lru_gen(page);
+
+			/* the page may have been promoted by aging already */
+			if (gen == old_gen) {
+				set_mask_bits(&page->flags, LRU_GEN_MASK,
+					      (new_gen + 1UL) << LRU_GEN_PGOFF);
+				lru_gen_update_size(lruvec, page, old_gen, new_gen);
+				gen = new_gen;
+			}
+			list_move(&page->lru, &lrugen->lists[gen][type][zone]);
+		}
+	}
+
+	lrugen->min_seq[type]++;
+}
+
+/*
+ * Open a new youngest generation. The previous second youngest one
+ * becomes inactive. Called with the lru_lock held.
+ */
+static void inc_max_seq(struct lruvec *lruvec)
+{
+	struct lru_gen_struct *lrugen = &lruvec->lrugen;
+	int prev = lru_gen_from_seq(lrugen->max_seq - 1);
+	int type, zone;
+
+	for (type = 0; type < ANON_AND_FILE; type++) {
+		if (lrugen->max_seq - lrugen->min_seq[type] + 1 < MAX_NR_GENS)
+			continue;
+		if (!try_to_inc_min_seq(lruvec, type))
+			inc_min_seq(lruvec, type);
+	}
+
+	for (type = 0; type < ANON_AND_FILE; type++) {
+		enum lru_list lru = type * LRU_FILE;
+
+		for (zone = 0; zone < MAX_NR_ZONES; zone++) {
+			long delta = lrugen->nr_pages[prev][type][zone];
+
+			if (!delta)
+				continue;
+
+			update_lru_size(lruvec, lru + LRU_ACTIVE, zone, -delta);
+			update_lru_size(lruvec, lru, zone, delta);
+		}
+	}
+
+	WRITE_ONCE(lrugen->max_seq, lrugen->max_seq + 1);
+}
+
+struct lru_gen_walk {
+	struct lruvec *lruvec;
+	struct pglist_data *pgdat;
+	/* taken lazily, only once a page to promote is found */
+	bool locked;
+	unsigned long nr_promoted;
+};
+
+static void lru_gen_walk_lock(struct lru_gen_walk *args)
+{
+	if (!args->locked) {
+		spin_lock_irq(&args->pgdat->lru_lock);
+		args->locked = true;
+	}
+}
+
+static void lru_gen_walk_unlock(struct lru_gen_walk *args)
+{
+	if (args->locked) {
+		spin_unlock_irq(&args->pgdat->lru_lock);
+		args->locked = false;
+	}
+}
+
+/*
+ * Move @page into the youngest generation. Its list position is fixed up
+ * lazily, by eviction or by inc_min_seq(). Called with the lru_lock held.
+ */
+static void lru_gen_promote(struct lru_gen_walk *args, struct page *page)
+{
+	struct lruvec *lruvec = args->lruvec;
+	int new_gen = lru_gen_from_seq(lruvec->lrugen.max_seq);
+	unsigned long old_flags, new_flags;
+	int old_gen;
+
+	/* not on a multi-gen list: leave a hint for whoever has it */
+	if (!PageLRU(page) || mem_cgroup_page_lruvec(page, args->pgdat) != lruvec) {
+		SetPageReferenced(page);
+		return;
+	}
+
+	do {
+		old_flags = READ_ONCE(page->flags);
+		old_gen = ((old_flags & LRU_GEN_MASK) >> LRU_GEN_PGOFF) - 1;
+		if (old_gen < 0 || old_gen == new_gen)
+			break;
+
+		new_flags = (old_flags & ~LRU_GEN_MASK) |
+			    ((new_gen + 1UL) << LRU_GEN_PGOFF);
+	} while (cmpxchg(&page->flags, old_flags, new_flags) != old_flags);
+
+	if (old_gen < 0) {
+		SetPageReferenced(page);
+		return;
+	}
+
+	if (old_gen != new_gen) {
+		lru_gen_update_size(lruvec, page, old_gen, new_gen);
+		args->nr_promoted += hpage_nr_pages(page);
+	}
+}
+
+static int lru_gen_test_walk(unsigned long start, unsigned long end,
+			     struct mm_walk *walk)
+{
+	struct vm_area_struct *vma = walk->vma;
+
+	if (vma->vm_flags & (VM_SPECIAL | VM_HUGETLB | VM_SEQ_READ |
+			     VM_RAND_READ))
+		return 1;
+
+	return 0;
+}
+
+static int lru_gen_pmd_entry(pmd_t *pmd, unsigned long addr,
+			     unsigned long end, struct mm_walk *walk)
+{
+	struct lru_gen_walk *args = walk->private;
+	struct vm_area_struct *vma = walk->vma;
+	int nid = args->pgdat->node_id;
+	struct page *page;
+	spinlock_t *ptl;
+	pte_t *pte, *orig_pte;
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	ptl = pmd_trans_huge_lock(pmd, vma);
+	if (ptl) {
+		if (pmd_present(*pmd) && pmd_young(*pmd) &&
+		    !is_huge_zero_pmd(*pmd)) {
+			page = pmd_page(*pmd);
+			if (page_to_nid(page) == nid &&
+			    pmdp_test_and_clear_young(vma, addr, pmd)) {
+				lru_gen_walk_lock(args);
+				lru_gen_promote(args, page);
+			}
+		}
+		spin_unlock(ptl);
+		goto out;
+	}
+#endif
+
+	if (pmd_trans_unstable(pmd))
+		goto out;
+
+	orig_pte = pte = pte_offset_map_lock(walk->mm, pmd, addr, &ptl);
+	for (; addr != end; pte++, addr += PAGE_SIZE) {
+		if (!pte_present(*pte) || !pte_young(*pte))
+			continue;
+
+		page = vm_normal_page(vma, addr, *pte);
+		if (!page)
+			continue;
+
+		page = compound_head(page);
+		if (page_to_nid(page) != nid)
+			continue;
+
+		if (!ptep_test_and_clear_young(vma, addr, pte))
+			continue;
+
+		lru_gen_walk_lock(args);
+		lru_gen_promote(args, page);
+	}
+	pte_unmap_unlock(orig_pte, ptl);
+out:
+	lru_gen_walk_unlock(args);
+	cond_resched();
+	return 0;
+}
+
+static void lru_gen_walk_mm(struct mm_struct *mm, struct lru_gen_walk *args)
+{
+	struct mm_walk walk = {
+		.pmd_entry = lru_gen_pmd_entry,
+		.test_walk = lru_gen_test_walk,
+		.mm = mm,
+		.private = args,
+	};
+
+	if (!down_read_trylock(&mm->mmap_sem))
+		return;
+
+	walk_page_range(0, mm->highest_vm_end, &walk);
+	up_read(&mm->mmap_sem);
+}
+
+/*
+ * Find the pages accessed since the last aging through the page tables
+ * of every mm_struct charged to @memcg, promote them, then open a new
+ * generation. Only one aging walk runs per lruvec at a time; returns
+ * false if another one was already in progress.
+ */
+static bool lru_gen_age(struct lruvec *lruvec, struct mem_cgroup *memcg)
+{
+	struct pglist_data *pgdat = lruvec_pgdat(lruvec);
+	struct lru_gen_struct *lrugen = &lruvec->lrugen;
+	struct lru_gen_walk args = {
+		.lruvec = lruvec,
+		.pgdat = pgdat,
+	};
+	struct mm_struct *mm, *prev = NULL;
+
+	spin_lock_irq(&pgdat->lru_lock);
+	if (lrugen->aging) {
+		spin_unlock_irq(&pgdat->lru_lock);
+		return false;
+	}
+	lrugen->aging = true;
+	spin_unlock_irq(&pgdat->lru_lock);
+
+	spin_lock(&lru_gen_mm_lock);
+	list_for_each_entry(mm, &lru_gen_mm_list, lru_gen_list) {
+		if (memcg && !mem_cgroup_disabled() && !mm_match_cgroup(mm, memcg))
+			continue;
+		/* the reference keeps our position in the list */
+		if (!mmget_not_zero(mm))
+			continue;
+		spin_unlock(&lru_gen_mm_lock);
+
+		if (prev)
+			mmput_async(prev);
+		prev = mm;
+
+		lru_gen_walk_mm(mm, &args);
+
+		spin_lock(&lru_gen_mm_lock);
+	}
+	spin_unlock(&lru_gen_mm_lock);
+
+	if (prev)
+		mmput_async(prev);
+
+	spin_lock_irq(&pgdat->lru_lock);
+	inc_max_seq(lruvec);
+	lrugen->aging = false;
+	spin_unlock_irq(&pgdat->lru_lock);
+
+	count_vm_events(PGLRU_GEN_PROMOTE, args.nr_promoted);
+	count_vm_event(PGLRU_GEN_AGE);
+
+	return true;
+}
+
+/*
+ * Isolate up to SWAP_CLUSTER_MAX pages of @type from the oldest generation
+ * and try to reclaim them. Returns the number of pages scanned, or 0 if
+ * the oldest generation had nothing left to scan.
+ */
+static unsigned long lru_gen_evict(struct lruvec *lruvec, int type,
+				   struct scan_control *sc,
+				   unsigned long *nr_reclaimed)
+{
+	struct pglist_data *pgdat = lruvec_pgdat(lruvec);
+	struct lru_gen_struct *lrugen = &lruvec->lrugen;
+	isolate_mode_t isolate_mode = 0;
+	struct reclaim_stat stat = {};
+	unsigned long nr_scanned = 0;
+	unsigned long nr_taken = 0;
+	unsigned long reclaimed;
+	LIST_HEAD(page_list);
+	int gen, zone;
+
+	while (unlikely(too_many_isolated(pgdat, type, sc))) {
+		congestion_wait(BLK_RW_ASYNC, HZ/10);
+
+		/* We are about to die and free our memory. Return now. */
+		if (fatal_signal_pending(current))
+			return SWAP_CLUSTER_MAX;
+	}
+
+	lru_add_drain();
+
+	if (!sc->may_unmap)
+		isolate_mode |= ISOLATE_UNMAPPED;
+
+	spin_lock_irq(&pgdat->lru_lock);
+
+	gen = lru_gen_from_seq(lrugen->min_seq[type]);
+	for (zone = MAX_NR_ZONES - 1; zone >= 0; zone--) {
+		struct list_head *head = &lrugen->lists[gen][type][zone];
+
+		while (!list_empty(head) && nr_scanned < MAX_LRU_BATCH &&
+		       nr_taken < SWAP_CLUSTER_MAX) {
+			struct page *page = lru_to_page(head);
+			int nr_pages = hpage_nr_pages(page);
+			int new_gen = page_lru_gen(page);
+
+			VM_BUG_ON_PAGE(PageTail(page), page);
+			VM_BUG_ON_PAGE(new_gen < 0, page);
+
+			nr_scanned += nr_pages;
+
+			/* promoted by aging since it was put on this list */
+			if (new_gen != gen) {
+				list_move(&page->lru,
+					  &lrugen->lists[new_gen][type][zone]);
+				continue;
+			}
+
+			/*
+			 * Pages from zones we may not reclaim from, and pages
+			 * accessed through a file descriptor since they were
+			 * put here, get another round in the next generation.
+			 */
+			if (zone > sc->reclaim_idx || TestClearPageReferenced(page)) {
+				new_gen = lru_gen_from_seq(lrugen->min_seq[type] + 1);
+				set_mask_bits(&page->flags, LRU_GEN_MASK,
+					      (new_gen + 1UL) << LRU_GEN_PGOFF);
+				lru_gen_update_size(lruvec, page, gen, new_gen);
+				list_move(&page->lru,
+					  &lrugen->lists[new_gen][type][zone]);
+				continue;
+			}
+
+			switch (__isolate_lru_page(page, isolate_mode)) {
+			case 0:
+				lru_gen_del_page(lruvec, page);
+				list_add(&page->lru, &page_list);
+				nr_taken += nr_pages;
+				break;
+
+			case -EBUSY:
+				/* else it is being freed elsewhere */
+				list_move(&page->lru, head);
+				break;
+
+			default:
+				BUG();
+			}
+		}
+	}
+
+	__mod_node_page_state(pgdat, NR_ISOLATED_ANON + type, nr_taken);
+	if (global_reclaim(sc)) {
+		__mod_node_page_state(pgdat, NR_PAGES_SCANNED, nr_scanned);
+		if (current_is_kswapd())
+			__count_vm_events(PGSCAN_KSWAPD, nr_scanned);
+		else
+			__count_vm_events(PGSCAN_DIRECT, nr_scanned);
+	}
+
+	if (!nr_scanned)
+		try_to_inc_min_seq(lruvec, type);
+
+	spin_unlock_irq(&pgdat->lru_lock);
+
+	if (!nr_taken)
+		return nr_scanned;
+
+	reclaimed = shrink_page_list(&page_list, pgdat, sc, TTU_UNMAP,
+				     &stat, false);
+
+	spin_lock_irq(&pgdat->lru_lock);
+
+	if (global_reclaim(sc)) {
+		if (current_is_kswapd())
+			__count_vm_events(PGSTEAL_KSWAPD, reclaimed);
+		else
+			__count_vm_events(PGSTEAL_DIRECT, reclaimed);
+	}
+
+	putback_inactive_pages(lruvec, &page_list);
+
+	__mod_node_page_state(pgdat, NR_ISOLATED_ANON + type, -nr_taken);
+
+	spin_unlock_irq(&pgdat->lru_lock);
+
+	mem_cgroup_uncharge_list(&page_list);
+	free_hot_cold_page_list(&page_list, true);
+
+	*nr_reclaimed += reclaimed;
+
+	return nr_scanned;
+}
+
+static void lru_gen_shrink_lruvec(struct lruvec *lruvec, struct mem_cgroup *memcg,
+				  struct scan_control *sc, unsigned long *lru_pages)
+{
+	struct lru_gen_struct *lrugen = &lruvec->lrugen;
+	unsigned long nr_to_reclaim = sc->nr_to_reclaim;
+	unsigned long nr_reclaimed = 0;
+	unsigned long nr_to_scan = 0;
+	unsigned long nr_file = 0;
+	struct blk_plug plug;
+	bool can_swap, aged = false;
+	enum lru_list lru;
+
+	*lru_pages = 0;
+	for_each_evictable_lru(lru) {
+		unsigned long size = lruvec_lru_size(lruvec, lru, sc->reclaim_idx);
+
+		if (is_file_lru(lru))
+			nr_file += size;
+		*lru_pages += size;
+		nr_to_scan += size >> sc->priority;
+	}
+	nr_to_scan = max(nr_to_scan, SWAP_CLUSTER_MAX);
+
+	can_swap = sc->may_swap && mem_cgroup_get_nr_swap_pages(memcg) > 0 &&
+		   mem_cgroup_swappiness(memcg);
+
+	blk_start_plug(&plug);
+	while (nr_to_scan) {
+		unsigned long scanned;
+		int type = 1;
+
+		/* evict anon only if it is older than file, or file is gone */
+		if (can_swap && (!nr_file || READ_ONCE(lrugen->min_seq[0]) <
+					     READ_ONCE(lrugen->min_seq[1])))
+			type = 0;
+
+		if (READ_ONCE(lrugen->max_seq) - READ_ONCE(lrugen->min_seq[type]) + 1 <=
+		    MIN_NR_GENS) {
+			/* age at most once per call, eviction has to catch up */
+			if (aged || !lru_gen_age(lruvec, memcg))
+				break;
+			aged = true;
+			continue;
+		}
+
+		/*
+		 * An empty oldest generation has been retired by now, or else
+		 * there are only MIN_NR_GENS left and the next round ages.
+		 */
+		scanned = lru_gen_evict(lruvec, type, sc, &nr_reclaimed);
+		if (!scanned)
+			continue;
+
+		nr_to_scan -= min(nr_to_scan, scanned);
+
+		cond_resched();
+
+		/* see the comment on scan_adjusted in shrink_node_memcg() */
+		if (nr_reclaimed >= nr_to_reclaim &&
+		    !(global_reclaim(sc) && !current_is_kswapd() &&
+		      sc->priority == DEF_PRIORITY))
+			break;
+	}
+	blk_finish_plug(&plug);
+
+	sc->nr_reclaimed += nr_reclaimed;
+}
+
+#else /* !CONFIG_LRU_GEN */
+
+static void lru_gen_shrink_lruvec(struct lruvec *lruvec, struct mem_cgroup *memcg,
+				  struct scan_control *sc, unsigned long *lru_pages)
+{
+}
+
+#endif /* CONFIG_LRU_GEN */
+
 /*
  * This is a basic per-node page freer.  Used by both kswapd and direct reclaim.
  */
@@ -2345,6 +2945,11 @@ static void shrink_node_memcg(struct pglist_data *pgdat, struct mem_cgroup *memc
 	struct blk_plug plug;
 	bool scan_adjusted;
 
+	if (lru_gen_enabled()) {
+		lru_gen_shrink_lruvec(lruvec, memcg, sc, lru_pages);
+		return;
+	}
+
 	get_scan_count(lruvec, memcg, sc, nr, lru_pages);
 
 	/* Record the original scan target for proportional adjustments later */
@@ -3027,6 +3632,7 @@ unsigned long try_to_free_mem_cgroup_pages(struct mem_cgroup *memcg,
 {
 	struct zonelist *zonelist;
 	unsigned long nr_reclaimed;
+	unsigned long pflags;
 	int nid;
 	struct scan_control sc = {
 		.nr_to_reclaim = max(nr_pages, SWAP_CLUSTER_MAX),
@@ -3054,9 +3660,11 @@ unsigned long try_to_free_mem_cgroup_pages(struct mem_cgroup *memcg,
 					    sc.gfp_mask,
 					    sc.reclaim_idx);
 
+	psi_memstall_enter(&pflags);
 	current->flags |= PF_MEMALLOC;
 	nr_reclaimed = do_try_to_free_pages(zonelist, &sc);
 	current->flags &= ~PF_MEMALLOC;
+	psi_memstall_leave(&pflags);
 
 	trace_mm_vmscan_memcg_reclaim_end(nr_reclaimed);
 
@@ -3069,7 +3677,8 @@ static void age_active_anon(struct pglist_data *pgdat,
 {
 	struct mem_cgroup *memcg;
 
-	if (!total_swap_pages)
+	/* the multi-gen LRU has no active list to balance */
+	if (!total_swap_pages || lru_gen_enabled())
 		return;
 
 	memcg = mem_cgroup_iter(NULL, NULL, NULL);
@@ -3202,6 +3811,7 @@ static int balance_pgdat(pg_data_t *pgdat, int order, int classzone_idx)
 	int i;
 	unsigned long nr_soft_reclaimed;
 	unsigned long nr_soft_scanned;
+	unsigned long pflags;
 	struct zone *zone;
 	struct scan_control sc = {
 		.gfp_mask = GFP_KERNEL,
@@ -3211,6 +3821,8 @@ static int balance_pgdat(pg_data_t *pgdat, int order, int classzone_idx)
 		.may_unmap = 1,
 		.may_swap = 1,
 	};
+
+	psi_memstall_enter(&pflags);
 	count_vm_event(PAGEOUTRUN);
 
 	do {
@@ -3311,6 +3923,7 @@ static int balance_pgdat(pg_data_t *pgdat, int order, int classzone_idx)
 	} while (sc.priority >= 1);
 
 out:
+	psi_memstall_leave(&pflags);
 	/*
 	 * Return the order kswapd stopped reclaiming at as
 	 * prepare_kswapd_sleep() takes it into account. If another caller
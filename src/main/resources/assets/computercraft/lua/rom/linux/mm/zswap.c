@@ -27,6 +27,7 @@
 #include <linux/highmem.h>
 #include <linux/slab.h>
 #include <linux/spinlock.h>
+#include <linux/mutex.h>
 #include <linux/types.h>
 #include <linux/atomic.h>
 #include <linux/frontswap.h>
@@ -49,6 +50,8 @@
 static u64 zswap_pool_total_size;
 /* The number of compressed pages currently stored in zswap */
 static atomic_t zswap_stored_pages = ATOMIC_INIT(0);
+/* The number of same-value filled pages currently stored in zswap */
+static atomic_t zswap_same_filled_pages = ATOMIC_INIT(0);
 
 /*
  * The statistics below are not protected from concurrent access for
@@ -116,6 +119,11 @@ module_param_cb(zpool, &zswap_zpool_param_ops, &zswap_zpool_type, 0644);
 static unsigned int zswap_max_pool_percent = 20;
 module_param_named(max_pool_percent, zswap_max_pool_percent, uint, 0644);
 
+/* Store pages filled with one repeated word as just that word */
+static bool zswap_same_filled_pages_enabled = true;
+module_param_named(same_filled_pages_enabled, zswap_same_filled_pages_enabled,
+		   bool, 0644);
+
 /*********************************
 * data structures
 **********************************/
@@ -145,9 +153,11 @@ struct zswap_pool {
  *            be held while changing the refcount.  Since the lock must
  *            be held, there is no reason to also make refcount atomic.
  * length - the length in bytes of the compressed page data.  Needed during
- *          decompression
- * pool - the zswap_pool the entry's data is in
+ *          decompression.  0 for a same-value filled page.
+ * pool - the zswap_pool the entry's data is in, NULL for a same-value
+ *        filled page
  * handle - zpool allocation handle that stores the compressed page data
+ * value - the word a same-value filled page is filled with
  */
 struct zswap_entry {
 	struct rb_node rbnode;
@@ -155,7 +165,10 @@ struct zswap_entry {
 	int refcount;
 	unsigned int length;
 	struct zswap_pool *pool;
-	unsigned long handle;
+	union {
+		unsigned long handle;
+		unsigned long value;
+	};
 };
 
 struct zswap_header {
@@ -166,13 +179,35 @@ struct zswap_header {
  * The tree lock in the zswap_tree struct protects a few things:
  * - the rbtree
  * - the refcount field of each entry in the tree
+ * - nr_entries
  */
 struct zswap_tree {
 	struct rb_root rbroot;
 	spinlock_t lock;
-};
+	unsigned long nr_entries;
+} ____cacheline_aligned_in_smp;
+
+/*
+ * Each swap type has ZSWAP_TREE_SHARDS trees, each covering every
+ * ZSWAP_TREE_SHARDS'th run of 1 << ZSWAP_SHARD_SHIFT offsets.  CPUs
+ * swapping out allocate from swap clusters of their own, so they mostly
+ * work on different runs and hence on different tree locks.
+ */
+#define ZSWAP_TREE_SHARDS	16
+#define ZSWAP_SHARD_SHIFT	8
 
 static struct zswap_tree *zswap_trees[MAX_SWAPFILES];
+/* serializes setting up and freeing zswap_trees against debugfs */
+static DEFINE_MUTEX(zswap_trees_mutex);
+
+static struct zswap_tree *zswap_tree_shard(unsigned type, pgoff_t offset)
+{
+	struct zswap_tree *trees = zswap_trees[type];
+
+	if (!trees)
+		return NULL;
+	return &trees[(offset >> ZSWAP_SHARD_SHIFT) % ZSWAP_TREE_SHARDS];
+}
 
 /* RCU-protected iteration */
 static LIST_HEAD(zswap_pools);
@@ -283,9 +318,10 @@ static struct zswap_entry *zswap_rb_search(struct rb_root *root, pgoff_t offset)
  * In the case that a entry with the same offset is found, a pointer to
  * the existing entry is stored in dupentry and the function returns -EEXIST
  */
-static int zswap_rb_insert(struct rb_root *root, struct zswap_entry *entry,
+static int zswap_rb_insert(struct zswap_tree *tree, struct zswap_entry *entry,
 			struct zswap_entry **dupentry)
 {
+	struct rb_root *root = &tree->rbroot;
 	struct rb_node **link = &root->rb_node, *parent = NULL;
 	struct zswap_entry *myentry;
 
@@ -303,14 +339,16 @@ static int zswap_rb_insert(struct rb_root *root, struct zswap_entry *entry,
 	}
 	rb_link_node(&entry->rbnode, parent, link);
 	rb_insert_color(&entry->rbnode, root);
+	tree->nr_entries++;
 	return 0;
 }
 
-static void zswap_rb_erase(struct rb_root *root, struct zswap_entry *entry)
+static void zswap_rb_erase(struct zswap_tree *tree, struct zswap_entry *entry)
 {
 	if (!RB_EMPTY_NODE(&entry->rbnode)) {
-		rb_erase(&entry->rbnode, root);
+		rb_erase(&entry->rbnode, &tree->rbroot);
 		RB_CLEAR_NODE(&entry->rbnode);
+		tree->nr_entries--;
 	}
 }
 
@@ -320,8 +358,12 @@ static void zswap_rb_erase(struct rb_root *root, struct zswap_entry *entry)
  */
 static void zswap_free_entry(struct zswap_entry *entry)
 {
-	zpool_free(entry->pool->zpool, entry->handle);
-	zswap_pool_put(entry->pool);
+	if (!entry->length) {
+		atomic_dec(&zswap_same_filled_pages);
+	} else {
+		zpool_free(entry->pool->zpool, entry->handle);
+		zswap_pool_put(entry->pool);
+	}
 	zswap_entry_cache_free(entry);
 	atomic_dec(&zswap_stored_pages);
 	zswap_update_total_size();
@@ -343,7 +385,7 @@ static void zswap_entry_put(struct zswap_tree *tree,
 
 	BUG_ON(refcount < 0);
 	if (refcount == 0) {
-		zswap_rb_erase(&tree->rbroot, entry);
+		zswap_rb_erase(tree, entry);
 		zswap_free_entry(entry);
 	}
 }
@@ -854,8 +896,8 @@ static int zswap_writeback_entry(struct zpool *pool, unsigned long handle)
 	zhdr = zpool_map_handle(pool, handle, ZPOOL_MM_RO);
 	swpentry = zhdr->swpentry; /* here */
 	zpool_unmap_handle(pool, handle);
-	tree = zswap_trees[swp_type(swpentry)];
 	offset = swp_offset(swpentry);
+	tree = zswap_tree_shard(swp_type(swpentry), offset);
 
 	/* find and ref zswap entry */
 	spin_lock(&tree->lock);
@@ -956,6 +998,32 @@ static int zswap_shrink(void)
 	return ret;
 }
 
+static bool zswap_is_page_same_filled(void *ptr, unsigned long *value)
+{
+	unsigned long *page = ptr;
+	unsigned int pos;
+
+	for (pos = 1; pos < PAGE_SIZE / sizeof(*page); pos++) {
+		if (page[pos] != page[0])
+			return false;
+	}
+	*value = page[0];
+	return true;
+}
+
+static void zswap_fill_page(void *ptr, unsigned long value)
+{
+	unsigned long *page = ptr;
+	unsigned int pos;
+
+	if (value == 0) {
+		memset(page, 0, PAGE_SIZE);
+		return;
+	}
+	for (pos = 0; pos < PAGE_SIZE / sizeof(*page); pos++)
+		page[pos] = value;
+}
+
 /*********************************
 * frontswap hooks
 **********************************/
@@ -963,12 +1031,12 @@ static int zswap_shrink(void)
 static int zswap_frontswap_store(unsigned type, pgoff_t offset,
 				struct page *page)
 {
-	struct zswap_tree *tree = zswap_trees[type];
+	struct zswap_tree *tree = zswap_tree_shard(type, offset);
 	struct zswap_entry *entry, *dupentry;
 	struct crypto_comp *tfm;
 	int ret;
 	unsigned int dlen = PAGE_SIZE, len;
-	unsigned long handle;
+	unsigned long handle, value;
 	char *buf;
 	u8 *src, *dst;
 	struct zswap_header *zhdr;
@@ -996,6 +1064,20 @@ static int zswap_frontswap_store(unsigned type, pgoff_t offset,
 		goto reject;
 	}
 
+	if (zswap_same_filled_pages_enabled) {
+		src = kmap_atomic(page);
+		if (zswap_is_page_same_filled(src, &value)) {
+			kunmap_atomic(src);
+			entry->offset = offset;
+			entry->length = 0;
+			entry->pool = NULL;
+			entry->value = value;
+			atomic_inc(&zswap_same_filled_pages);
+			goto insert_entry;
+		}
+		kunmap_atomic(src);
+	}
+
 	/* if entry is successfully added, it keeps the reference */
 	entry->pool = zswap_pool_current_get();
 	if (!entry->pool) {
@@ -1040,14 +1122,15 @@ static int zswap_frontswap_store(unsigned type, pgoff_t offset,
 	entry->handle = handle;
 	entry->length = dlen;
 
+insert_entry:
 	/* map */
 	spin_lock(&tree->lock);
 	do {
-		ret = zswap_rb_insert(&tree->rbroot, entry, &dupentry);
+		ret = zswap_rb_insert(tree, entry, &dupentry);
 		if (ret == -EEXIST) {
 			zswap_duplicate_entry++;
 			/* remove from rbtree */
-			zswap_rb_erase(&tree->rbroot, dupentry);
+			zswap_rb_erase(tree, dupentry);
 			zswap_entry_put(tree, dupentry);
 		}
 	} while (ret == -EEXIST);
@@ -1075,7 +1158,7 @@ reject:
 static int zswap_frontswap_load(unsigned type, pgoff_t offset,
 				struct page *page)
 {
-	struct zswap_tree *tree = zswap_trees[type];
+	struct zswap_tree *tree = zswap_tree_shard(type, offset);
 	struct zswap_entry *entry;
 	struct crypto_comp *tfm;
 	u8 *src, *dst;
@@ -1092,6 +1175,13 @@ static int zswap_frontswap_load(unsigned type, pgoff_t offset,
 	}
 	spin_unlock(&tree->lock);
 
+	if (!entry->length) {
+		dst = kmap_atomic(page);
+		zswap_fill_page(dst, entry->value);
+		kunmap_atomic(dst);
+		goto put_entry;
+	}
+
 	/* decompress */
 	dlen = PAGE_SIZE;
 	src = (u8 *)zpool_map_handle(entry->pool->zpool, entry->handle,
@@ -1104,6 +1194,7 @@ static int zswap_frontswap_load(unsigned type, pgoff_t offset,
 	zpool_unmap_handle(entry->pool->zpool, entry->handle);
 	BUG_ON(ret);
 
+put_entry:
 	spin_lock(&tree->lock);
 	zswap_entry_put(tree, entry);
 	spin_unlock(&tree->lock);
@@ -1114,7 +1205,7 @@ static int zswap_frontswap_load(unsigned type, pgoff_t offset,
 /* frees an entry in zswap */
 static void zswap_frontswap_invalidate_page(unsigned type, pgoff_t offset)
 {
-	struct zswap_tree *tree = zswap_trees[type];
+	struct zswap_tree *tree = zswap_tree_shard(type, offset);
 	struct zswap_entry *entry;
 
 	/* find */
@@ -1127,7 +1218,7 @@ static void zswap_frontswap_invalidate_page(unsigned type, pgoff_t offset)
 	}
 
 	/* remove from rbtree */
-	zswap_rb_erase(&tree->rbroot, entry);
+	zswap_rb_erase(tree, entry);
 
 	/* drop the initial reference from entry creation */
 	zswap_entry_put(tree, entry);
@@ -1138,35 +1229,49 @@ static void zswap_frontswap_invalidate_page(unsigned type, pgoff_t offset)
 /* frees all zswap entries for the given swap type */
 static void zswap_frontswap_invalidate_area(unsigned type)
 {
-	struct zswap_tree *tree = zswap_trees[type];
+	struct zswap_tree *trees = zswap_trees[type];
 	struct zswap_entry *entry, *n;
+	int i;
 
-	if (!tree)
+	if (!trees)
 		return;
 
-	/* walk the tree and free everything */
-	spin_lock(&tree->lock);
-	rbtree_postorder_for_each_entry_safe(entry, n, &tree->rbroot, rbnode)
-		zswap_free_entry(entry);
-	tree->rbroot = RB_ROOT;
-	spin_unlock(&tree->lock);
-	kfree(tree);
+	/* walk the trees and free everything */
+	for (i = 0; i < ZSWAP_TREE_SHARDS; i++) {
+		struct zswap_tree *tree = &trees[i];
+
+		spin_lock(&tree->lock);
+		rbtree_postorder_for_each_entry_safe(entry, n, &tree->rbroot,
+						     rbnode)
+			zswap_free_entry(entry);
+		tree->rbroot = RB_ROOT;
+		tree->nr_entries = 0;
+		spin_unlock(&tree->lock);
+	}
+	mutex_lock(&zswap_trees_mutex);
 	zswap_trees[type] = NULL;
+	mutex_unlock(&zswap_trees_mutex);
+	kfree(trees);
 }
 
 static void zswap_frontswap_init(unsigned type)
 {
-	struct zswap_tree *tree;
+	struct zswap_tree *trees;
+	int i;
 
-	tree = kzalloc(sizeof(struct zswap_tree), GFP_KERNEL);
-	if (!tree) {
+	trees = kcalloc(ZSWAP_TREE_SHARDS, sizeof(*trees), GFP_KERNEL);
+	if (!trees) {
 		pr_err("alloc failed, zswap disabled for swap type %d\n", type);
 		return;
 	}
 
-	tree->rbroot = RB_ROOT;
-	spin_lock_init(&tree->lock);
-	zswap_trees[type] = tree;
+	for (i = 0; i < ZSWAP_TREE_SHARDS; i++) {
+		trees[i].rbroot = RB_ROOT;
+		spin_lock_init(&trees[i].lock);
+	}
+	mutex_lock(&zswap_trees_mutex);
+	zswap_trees[type] = trees;
+	mutex_unlock(&zswap_trees_mutex);
 }
 
 static struct frontswap_ops zswap_frontswap_ops = {
@@ -1182,9 +1287,42 @@ static struct frontswap_ops zswap_frontswap_ops = {
 **********************************/
 #ifdef CONFIG_DEBUG_FS
 #include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 static struct dentry *zswap_debugfs_root;
 
+/* one line per swap type: the number of entries in each of its shards */
+static int zswap_tree_shards_show(struct seq_file *m, void *v)
+{
+	int type, i;
+
+	mutex_lock(&zswap_trees_mutex);
+	for (type = 0; type < MAX_SWAPFILES; type++) {
+		struct zswap_tree *trees = zswap_trees[type];
+
+		if (!trees)
+			continue;
+		seq_printf(m, "%d:", type);
+		for (i = 0; i < ZSWAP_TREE_SHARDS; i++)
+			seq_printf(m, " %lu", READ_ONCE(trees[i].nr_entries));
+		seq_putc(m, '\n');
+	}
+	mutex_unlock(&zswap_trees_mutex);
+	return 0;
+}
+
+static int zswap_tree_shards_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, zswap_tree_shards_show, NULL);
+}
+
+static const struct file_operations zswap_tree_shards_fops = {
+	.open		= zswap_tree_shards_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
 static int __init zswap_debugfs_init(void)
 {
 	if (!debugfs_initialized())
@@ -1212,6 +1350,10 @@ static int __init zswap_debugfs_init(void)
 			zswap_debugfs_root, &zswap_pool_total_size);
 	debugfs_create_atomic_t("stored_pages", S_IRUGO,
 			zswap_debugfs_root, &zswap_stored_pages);
+	debugfs_create_atomic_t("same_filled_pages", S_IRUGO,
+			zswap_debugfs_root, &zswap_same_filled_pages);
+	debugfs_create_file("tree_shards", S_IRUGO,
+			zswap_debugfs_root, NULL, &zswap_tree_shards_fops);
 
 	return 0;
 }
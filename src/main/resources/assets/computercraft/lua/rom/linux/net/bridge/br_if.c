@@ -288,6 +288,8 @@ static void del_nbp(struct net_bridge_port *p)
 	dev->priv_flags &= ~IFF_BRIDGE_PORT;
 
 	netdev_rx_handler_unregister(dev);
+	/* frames in flight may have queued addresses on the port */
+	br_fdb_learn_purge(br, p, 0);
 
 	br_multicast_del_port(p);
 
@@ -21,12 +21,16 @@
 #include <net/ip6_fib.h>
 #include <linux/if_vlan.h>
 #include <linux/rhashtable.h>
+#include <linux/interrupt.h>
 
 #define BR_HASH_BITS 8
 #define BR_HASH_SIZE (1 << BR_HASH_BITS)
 
 #define BR_HOLD_TIME (1*HZ)
 
+/* Number of new addresses a cpu collects before learning them in one go */
+#define BR_FDB_LEARN_BATCH	32
+
 #define BR_PORT_BITS	10
 #define BR_MAX_PORTS	(1<<BR_PORT_BITS)
 
@@ -160,12 +164,17 @@ struct net_bridge_vlan_group {
 	u16				pvid;
 };
 
+struct net_bridge_fdb_key {
+	mac_addr addr;
+	u16 vlan_id;
+};
+
 struct net_bridge_fdb_entry {
-	struct hlist_node		hlist;
+	struct rhash_head		rhnode;
 	struct net_bridge_port		*dst;
 
-	mac_addr			addr;
-	__u16				vlan_id;
+	struct net_bridge_fdb_key	key;
+	struct hlist_node		fdb_node;
 	unsigned char			is_local:1,
 					is_static:1,
 					added_by_user:1,
@@ -178,6 +187,23 @@ struct net_bridge_fdb_entry {
 	struct rcu_head			rcu;
 };
 
+/* Addresses seen on a cpu that are not in the fdb yet.  They are added by
+ * br_fdb_learn_flush() under a single hash_lock round trip, either when
+ * the queue fills up or from the tasklet once the softirq run is over.
+ */
+struct br_fdb_learn {
+	struct net_bridge_port		*source;
+	struct net_bridge_fdb_key	key;
+};
+
+struct br_fdb_learn_queue {
+	spinlock_t			lock;
+	unsigned int			count;
+	struct net_bridge		*br;
+	struct tasklet_struct		tasklet;
+	struct br_fdb_learn		entries[BR_FDB_LEARN_BATCH];
+};
+
 #define MDB_PG_FLAGS_PERMANENT	BIT(0)
 #define MDB_PG_FLAGS_OFFLOAD	BIT(1)
 
@@ -299,7 +325,8 @@ struct net_bridge {
 	struct net_bridge_vlan_group	__rcu *vlgrp;
 #endif
 
-	struct hlist_head		hash[BR_HASH_SIZE];
+	struct rhashtable		fdb_hash_tbl;
+	struct br_fdb_learn_queue	__percpu *fdb_learn;
 #if IS_ENABLED(CONFIG_BRIDGE_NETFILTER)
 	union {
 		struct rtable		fake_rtable;
@@ -382,6 +409,7 @@ struct net_bridge {
 	struct timer_list		tcn_timer;
 	struct timer_list		topology_change_timer;
 	struct delayed_work		gc_work;
+	struct hlist_head		fdb_list;
 	struct kobject			*ifobj;
 	u32				auto_cnt;
 
@@ -498,6 +526,10 @@ static inline void br_netpoll_disable(struct net_bridge_port *p)
 /* br_fdb.c */
 int br_fdb_init(void);
 void br_fdb_fini(void);
+int br_fdb_hash_init(struct net_bridge *br);
+void br_fdb_hash_fini(struct net_bridge *br);
+void br_fdb_learn_purge(struct net_bridge *br, struct net_bridge_port *p,
+			u16 vid);
 void br_fdb_flush(struct net_bridge *br);
 void br_fdb_find_delete_local(struct net_bridge *br,
 			      const struct net_bridge_port *p,
@@ -140,6 +140,7 @@
 #include <linux/hrtimer.h>
 #include <linux/netfilter_ingress.h>
 #include <linux/crash_dump.h>
+#include <linux/bpf_trace.h>
 
 #include "net-sysfs.h"
 
@@ -1829,7 +1830,7 @@ static inline int deliver_skb(struct sk_buff *skb,
 			      struct packet_type *pt_prev,
 			      struct net_device *orig_dev)
 {
-	if (unlikely(skb_orphan_frags(skb, GFP_ATOMIC)))
+	if (unlikely(skb_orphan_frags_rx(skb, GFP_ATOMIC)))
 		return -ENOMEM;
 	atomic_inc(&skb->users);
 	return pt_prev->func(skb, skb->dev, pt_prev, orig_dev);
@@ -3069,6 +3070,21 @@ static inline int __dev_xmit_skb(struct sk_buff *skb, struct Qdisc *q,
 	int rc;
 
 	qdisc_calculate_pkt_len(skb, q);
+
+	if (q->flags & TCQ_F_NOLOCK) {
+		if (unlikely(test_bit(__QDISC_STATE_DEACTIVATED, &q->state))) {
+			__qdisc_drop(skb, &to_free);
+			rc = NET_XMIT_DROP;
+		} else {
+			rc = q->enqueue(skb, q, &to_free) & NET_XMIT_MASK;
+			qdisc_run(q);
+		}
+
+		if (unlikely(to_free))
+			kfree_skb_list(to_free);
+		return rc;
+	}
+
 	/*
 	 * Heuristic to force contended enqueues to serialize on a
 	 * separate lock before trying to get qdisc main lock.
@@ -3434,6 +3450,52 @@ int dev_queue_xmit_accel(struct sk_buff *skb, void *accel_priv)
 }
 EXPORT_SYMBOL(dev_queue_xmit_accel);
 
+/**
+ *	dev_direct_xmit - transmit a buffer on a given queue, bypassing qdiscs
+ *	@skb: buffer to transmit
+ *	@queue_id: TX queue of skb->dev to use
+ *
+ *	Hands the buffer straight to the driver. The buffer is consumed in
+ *	all cases; NETDEV_TX_BUSY is returned if the queue was stopped.
+ */
+int dev_direct_xmit(struct sk_buff *skb, u16 queue_id)
+{
+	struct net_device *dev = skb->dev;
+	struct sk_buff *orig_skb = skb;
+	struct netdev_queue *txq;
+	int ret = NETDEV_TX_BUSY;
+
+	if (unlikely(!netif_running(dev) ||
+		     !netif_carrier_ok(dev)))
+		goto drop;
+
+	skb = validate_xmit_skb_list(skb, dev);
+	if (skb != orig_skb)
+		goto drop;
+
+	skb_set_queue_mapping(skb, queue_id);
+	txq = skb_get_tx_queue(dev, skb);
+
+	local_bh_disable();
+
+	HARD_TX_LOCK(dev, txq, smp_processor_id());
+	if (!netif_xmit_frozen_or_drv_stopped(txq))
+		ret = netdev_start_xmit(skb, dev, txq, false);
+	HARD_TX_UNLOCK(dev, txq);
+
+	local_bh_enable();
+
+	if (!dev_xmit_complete(ret))
+		kfree_skb(skb);
+
+	return ret;
+drop:
+	atomic_long_inc(&dev->tx_dropped);
+	kfree_skb_list(skb);
+	return NET_XMIT_DROP;
+}
+EXPORT_SYMBOL(dev_direct_xmit);
+
 
 /*************************************************************************
  *			Receiver routines
@@ -3527,8 +3589,10 @@ static int get_rps_cpu(struct net_device *dev, struct sk_buff *skb,
 	const struct rps_sock_flow_table *sock_flow_table;
 	struct netdev_rx_queue *rxqueue = dev->_rx;
 	struct rps_dev_flow_table *flow_table;
+	struct bpf_prog *prog;
 	struct rps_map *map;
 	int cpu = -1;
+	u32 next_cpu;
 	u32 tcpu;
 	u32 hash;
 
@@ -3549,7 +3613,8 @@ static int get_rps_cpu(struct net_device *dev, struct sk_buff *skb,
 
 	flow_table = rcu_dereference(rxqueue->rps_flow_table);
 	map = rcu_dereference(rxqueue->rps_map);
-	if (!flow_table && !map)
+	prog = rcu_dereference(dev->rps_prog);
+	if (!flow_table && !map && !prog)
 		goto done;
 
 	skb_reset_network_header(skb);
@@ -3557,18 +3622,33 @@ static int get_rps_cpu(struct net_device *dev, struct sk_buff *skb,
 	if (!hash)
 		goto done;
 
+	/* A steering program takes precedence over the global flow table */
+	next_cpu = RPS_NO_CPU;
+	if (prog) {
+		tcpu = bpf_prog_run_save_cb(prog, skb);
+		if (tcpu < nr_cpu_ids && cpu_online(tcpu)) {
+			if (!flow_table) {
+				cpu = tcpu;
+				goto done;
+			}
+			next_cpu = tcpu;
+		}
+	}
+
 	sock_flow_table = rcu_dereference(rps_sock_flow_table);
-	if (flow_table && sock_flow_table) {
+	if (flow_table && (sock_flow_table || next_cpu != RPS_NO_CPU)) {
 		struct rps_dev_flow *rflow;
-		u32 next_cpu;
-		u32 ident;
 
-		/* First check into global flow table if there is a match */
-		ident = sock_flow_table->ents[hash & sock_flow_table->mask];
-		if ((ident ^ hash) & ~rps_cpu_mask)
-			goto try_rps;
+		if (next_cpu == RPS_NO_CPU) {
+			u32 ident;
+
+			/* First check into global flow table if there is a match */
+			ident = sock_flow_table->ents[hash & sock_flow_table->mask];
+			if ((ident ^ hash) & ~rps_cpu_mask)
+				goto try_rps;
 
-		next_cpu = ident & rps_cpu_mask;
+			next_cpu = ident & rps_cpu_mask;
+		}
 
 		/* OK, now we know there is a match,
 		 * we can look at the local (per receive queue) flow table
@@ -3577,8 +3657,8 @@ static int get_rps_cpu(struct net_device *dev, struct sk_buff *skb,
 		tcpu = rflow->cpu;
 
 		/*
-		 * If the desired CPU (where last recvmsg was done) is
-		 * different from current CPU (one in the rx-queue flow
+		 * If the desired CPU (where last recvmsg was done, or the
+		 * one the steering program chose) is different from current CPU (one in the rx-queue flow
 		 * table entry), switch if one of the following holds:
 		 *   - Current CPU is unset (>= nr_cpu_ids).
 		 *   - Current CPU is offline.
@@ -3778,6 +3858,140 @@ drop:
 	return NET_RX_DROP;
 }
 
+static struct static_key generic_xdp_needed __read_mostly;
+
+static u32 netif_receive_generic_xdp(struct sk_buff *skb,
+				     struct bpf_prog *xdp_prog)
+{
+	struct xdp_buff xdp;
+	u32 act = XDP_DROP;
+	void *orig_data;
+	int hlen, off;
+	u32 mac_len;
+
+	/* Reinjected packets coming from act_mirred or similar should
+	 * not get XDP generic processing.
+	 */
+	if (skb_cloned(skb))
+		return XDP_PASS;
+
+	if (skb_linearize(skb))
+		goto do_drop;
+
+	/* The XDP program wants to see the packet starting at the MAC
+	 * header.
+	 */
+	mac_len = skb->data - skb_mac_header(skb);
+	hlen = skb_headlen(skb) + mac_len;
+	xdp.data = skb->data - mac_len;
+	xdp.data_end = xdp.data + hlen;
+	xdp.data_hard_start = skb->data - skb_headroom(skb);
+	xdp.rxq = NULL;
+	orig_data = xdp.data;
+
+	act = bpf_prog_run_xdp(xdp_prog, &xdp);
+
+	off = xdp.data - orig_data;
+	if (off > 0)
+		__skb_pull(skb, off);
+	else if (off < 0)
+		__skb_push(skb, -off);
+	skb->mac_header += off;
+
+	switch (act) {
+	case XDP_REDIRECT:
+	case XDP_TX:
+		__skb_push(skb, mac_len);
+		/* fall through */
+	case XDP_PASS:
+		break;
+
+	default:
+		bpf_warn_invalid_xdp_action(act);
+		/* fall through */
+	case XDP_ABORTED:
+		trace_xdp_exception(skb->dev, xdp_prog, act);
+		/* fall through */
+	case XDP_DROP:
+	do_drop:
+		kfree_skb(skb);
+		break;
+	}
+
+	return act;
+}
+
+/**
+ *	generic_xdp_tx - transmit an skb on behalf of an XDP program
+ *	@skb: buffer to transmit, skb->dev is the device to send it on
+ *	@xdp_prog: program that returned XDP_TX or XDP_REDIRECT
+ *
+ *	Generic XDP bypasses the qdisc layer and the network taps in order
+ *	to match in-driver XDP behaviour.  The skb is consumed.
+ */
+void generic_xdp_tx(struct sk_buff *skb, struct bpf_prog *xdp_prog)
+{
+	struct net_device *dev = skb->dev;
+	struct netdev_queue *txq;
+	bool free_skb = true;
+	int cpu, rc;
+
+	txq = netdev_pick_tx(dev, skb, NULL);
+	cpu = smp_processor_id();
+	HARD_TX_LOCK(dev, txq, cpu);
+	if (!netif_xmit_stopped(txq)) {
+		rc = netdev_start_xmit(skb, dev, txq, 0);
+		if (dev_xmit_complete(rc))
+			free_skb = false;
+	}
+	HARD_TX_UNLOCK(dev, txq);
+	if (free_skb) {
+		trace_xdp_exception(dev, xdp_prog, XDP_TX);
+		kfree_skb(skb);
+	}
+}
+EXPORT_SYMBOL_GPL(generic_xdp_tx);
+
+/**
+ *	do_xdp_generic - run an XDP program on an skb
+ *	@xdp_prog: program to run, may be NULL
+ *	@skb: received buffer, skb->data at the network header
+ *
+ *	Returns XDP_PASS if the skb should continue up the stack.  Anything
+ *	else means the skb was consumed: dropped, sent back out or
+ *	redirected.  Must be called with preemption and bottom halves
+ *	disabled and under rcu_read_lock().
+ */
+int do_xdp_generic(struct bpf_prog *xdp_prog, struct sk_buff *skb)
+{
+	int err;
+
+	if (xdp_prog) {
+		u32 act = netif_receive_generic_xdp(skb, xdp_prog);
+
+		if (act != XDP_PASS) {
+			switch (act) {
+			case XDP_REDIRECT:
+				err = xdp_do_generic_redirect(skb->dev, skb,
+							      xdp_prog);
+				if (err)
+					goto out_redir;
+				/* fall through */
+			case XDP_TX:
+				generic_xdp_tx(skb, xdp_prog);
+				break;
+			}
+			return XDP_DROP;
+		}
+	}
+	return XDP_PASS;
+out_redir:
+	trace_xdp_exception(skb->dev, xdp_prog, XDP_REDIRECT);
+	kfree_skb(skb);
+	return XDP_DROP;
+}
+EXPORT_SYMBOL_GPL(do_xdp_generic);
+
 static int netif_rx_internal(struct sk_buff *skb)
 {
 	int ret;
@@ -3785,6 +3999,24 @@ static int netif_rx_internal(struct sk_buff *skb)
 	net_timestamp_check(netdev_tstamp_prequeue, skb);
 
 	trace_netif_rx(skb);
+
+	if (static_key_false(&generic_xdp_needed)) {
+		int act;
+
+		preempt_disable();
+		rcu_read_lock();
+		act = do_xdp_generic(rcu_dereference(skb->dev->xdp_prog), skb);
+		rcu_read_unlock();
+		preempt_enable();
+
+		/* Consider XDP consuming the packet a success from
+		 * the netdev point of view we do not want to count
+		 * this as an error.
+		 */
+		if (act != XDP_PASS)
+			return NET_RX_SUCCESS;
+	}
+
 #ifdef CONFIG_RPS
 	if (static_key_false(&rps_needed)) {
 		struct rps_dev_flow voidflow, *rflow = &voidflow;
@@ -3894,19 +4126,22 @@ static __latent_entropy void net_tx_action(struct softirq_action *h)
 
 		while (head) {
 			struct Qdisc *q = head;
-			spinlock_t *root_lock;
+			spinlock_t *root_lock = NULL;
 
 			head = head->next_sched;
 
-			root_lock = qdisc_lock(q);
-			spin_lock(root_lock);
+			if (!(q->flags & TCQ_F_NOLOCK)) {
+				root_lock = qdisc_lock(q);
+				spin_lock(root_lock);
+			}
 			/* We need to make sure head->next_sched is read
 			 * before clearing __QDISC_STATE_SCHED
 			 */
 			smp_mb__before_atomic();
 			clear_bit(__QDISC_STATE_SCHED, &q->state);
 			qdisc_run(q);
-			spin_unlock(root_lock);
+			if (root_lock)
+				spin_unlock(root_lock);
 		}
 	}
 }
@@ -4204,7 +4439,7 @@ skip_classify:
 	}
 
 	if (pt_prev) {
-		if (unlikely(skb_orphan_frags(skb, GFP_ATOMIC)))
+		if (unlikely(skb_orphan_frags_rx(skb, GFP_ATOMIC)))
 			goto drop;
 		else
 			ret = pt_prev->func(skb, skb->dev, pt_prev, orig_dev);
@@ -4261,6 +4496,19 @@ static int netif_receive_skb_internal(struct sk_buff *skb)
 
 	rcu_read_lock();
 
+	if (static_key_false(&generic_xdp_needed)) {
+		int act;
+
+		preempt_disable();
+		act = do_xdp_generic(rcu_dereference(skb->dev->xdp_prog), skb);
+		preempt_enable();
+
+		if (act != XDP_PASS) {
+			rcu_read_unlock();
+			return NET_RX_DROP;
+		}
+	}
+
 #ifdef CONFIG_RPS
 	if (static_key_false(&rps_needed)) {
 		struct rps_dev_flow voidflow, *rflow = &voidflow;
@@ -4443,6 +4691,93 @@ static void gro_list_prepare(struct napi_struct *napi, struct sk_buff *skb)
 	}
 }
 
+/*
+ * gro_list_prepare() only compares the L2 header, dev and vlan: check
+ * that a held @p also has the addresses, protocol and ports of @skb,
+ * whose network header is at its gro offset.  When that can't be told,
+ * say they are the same flow, flushing too much is only slower.
+ */
+static bool gro_same_l4_flow(const struct sk_buff *p, const struct sk_buff *skb)
+{
+	int poff = skb_network_offset(p), off = skb_gro_offset(skb);
+	union {
+		struct iphdr	v4;
+		struct ipv6hdr	v6;
+	} h, ph;
+	__be32 port_buf, pport_buf;
+	const __be32 *ports, *pports;
+	u8 proto;
+
+	if (NAPI_GRO_CB(p)->encap_mark)
+		return true;
+	if (p->protocol != skb->protocol)
+		return false;
+
+	switch (skb->protocol) {
+	case htons(ETH_P_IP): {
+		const struct iphdr *iph, *piph;
+
+		iph = skb_header_pointer(skb, off, sizeof(h.v4), &h.v4);
+		piph = skb_header_pointer(p, poff, sizeof(ph.v4), &ph.v4);
+		if (!iph || !piph)
+			return true;
+		if (iph->saddr != piph->saddr || iph->daddr != piph->daddr ||
+		    iph->protocol != piph->protocol)
+			return false;
+		proto = iph->protocol;
+		off += iph->ihl * 4;
+		poff += piph->ihl * 4;
+		break;
+	}
+	case htons(ETH_P_IPV6): {
+		const struct ipv6hdr *ip6h, *pip6h;
+
+		ip6h = skb_header_pointer(skb, off, sizeof(h.v6), &h.v6);
+		pip6h = skb_header_pointer(p, poff, sizeof(ph.v6), &ph.v6);
+		if (!ip6h || !pip6h)
+			return true;
+		/* saddr and daddr are adjacent */
+		if (memcmp(&ip6h->saddr, &pip6h->saddr,
+			   2 * sizeof(ip6h->saddr)) ||
+		    ip6h->nexthdr != pip6h->nexthdr)
+			return false;
+		proto = ip6h->nexthdr;
+		off += sizeof(*ip6h);
+		poff += sizeof(*pip6h);
+		break;
+	}
+	default:
+		return true;
+	}
+
+	if (proto != IPPROTO_TCP && proto != IPPROTO_UDP)
+		return true;
+
+	ports = skb_header_pointer(skb, off, sizeof(port_buf), &port_buf);
+	pports = skb_header_pointer(p, poff, sizeof(pport_buf), &pport_buf);
+	if (!ports || !pports)
+		return true;
+	return *ports == *pports;
+}
+
+/* Complete the held packets of the same flow as @skb, before it goes up */
+static void gro_flush_same_flow(struct napi_struct *napi, struct sk_buff *skb)
+{
+	struct sk_buff **pp = &napi->gro_list;
+	struct sk_buff *p;
+
+	while ((p = *pp) != NULL) {
+		if (!NAPI_GRO_CB(p)->same_flow || !gro_same_l4_flow(p, skb)) {
+			pp = &p->next;
+			continue;
+		}
+		*pp = p->next;
+		p->next = NULL;
+		napi_gro_complete(p);
+		napi->gro_count--;
+	}
+}
+
 static void skb_gro_reset_offset(struct sk_buff *skb)
 {
 	const struct skb_shared_info *pinfo = skb_shinfo(skb);
@@ -4501,6 +4836,16 @@ static enum gro_result dev_gro_receive(struct napi_struct *napi, struct sk_buff
 
 	gro_list_prepare(napi, skb);
 
+	/* Segments already coalesced by the device (NETIF_F_GRO_HW) are not
+	 * run through the protocol handlers again.  Held packets of the same
+	 * flow, down to the L4 ports, go up first so the stream stays in
+	 * order; other flows from the same link stay held.
+	 */
+	if (skb_is_gso(skb) && (skb->dev->features & NETIF_F_GRO_HW)) {
+		gro_flush_same_flow(napi, skb);
+		goto normal;
+	}
+
 	rcu_read_lock();
 	list_for_each_entry_rcu(ptype, head, list) {
 		if (ptype->type != type || !ptype->callbacks.gro_receive)
@@ -5063,9 +5408,19 @@ static void busy_poll_stop(struct napi_struct *napi, void *have_poll_lock)
 		do_softirq();
 }
 
-bool sk_busy_loop(struct sock *sk, int nonblock)
+/**
+ * napi_busy_loop - busy poll a NAPI context
+ * @napi_id: the NAPI context to poll
+ * @end_time: busy_loop_us_clock() value to give up at, 0 for a single pass
+ * @loop_end: returns true once the caller has found what it was waiting for
+ * @loop_end_arg: argument passed to @loop_end
+ *
+ * Returns false if @napi_id does not name a NAPI context, otherwise the last
+ * value returned by @loop_end.
+ */
+bool napi_busy_loop(unsigned int napi_id, unsigned long end_time,
+		    bool (*loop_end)(void *), void *loop_end_arg)
 {
-	unsigned long end_time = !nonblock ? sk_busy_loop_end_time(sk) : 0;
 	int (*napi_poll)(struct napi_struct *napi, int budget);
 	void *have_poll_lock = NULL;
 	struct napi_struct *napi;
@@ -5077,7 +5432,7 @@ restart:
 
 	rcu_read_lock();
 
-	napi = napi_by_id(sk->sk_napi_id);
+	napi = napi_by_id(napi_id);
 	if (!napi)
 		goto out;
 
@@ -5105,12 +5460,11 @@ restart:
 		trace_napi_poll(napi, rc, BUSY_POLL_BUDGET);
 count:
 		if (rc > 0)
-			__NET_ADD_STATS(sock_net(sk),
+			__NET_ADD_STATS(dev_net(napi->dev),
 					LINUX_MIB_BUSYPOLLRXPACKETS, rc);
 		local_bh_enable();
 
-		if (nonblock || !skb_queue_empty(&sk->sk_receive_queue) ||
-		    busy_loop_timeout(end_time))
+		if (loop_end(loop_end_arg) || busy_loop_timeout(end_time))
 			break;
 
 		if (unlikely(need_resched())) {
@@ -5119,7 +5473,7 @@ count:
 			preempt_enable();
 			rcu_read_unlock();
 			cond_resched();
-			rc = !skb_queue_empty(&sk->sk_receive_queue);
+			rc = loop_end(loop_end_arg);
 			if (rc || busy_loop_timeout(end_time))
 				return rc;
 			goto restart;
@@ -5129,11 +5483,26 @@ count:
 	if (napi_poll)
 		busy_poll_stop(napi, have_poll_lock);
 	preempt_enable();
-	rc = !skb_queue_empty(&sk->sk_receive_queue);
+	rc = loop_end(loop_end_arg);
 out:
 	rcu_read_unlock();
 	return rc;
 }
+EXPORT_SYMBOL(napi_busy_loop);
+
+static bool sk_busy_loop_end(void *p)
+{
+	struct sock *sk = p;
+
+	return !skb_queue_empty(&sk->sk_receive_queue);
+}
+
+bool sk_busy_loop(struct sock *sk, int nonblock)
+{
+	unsigned long end_time = !nonblock ? sk_busy_loop_end_time(sk) : 0;
+
+	return napi_busy_loop(sk->sk_napi_id, end_time, sk_busy_loop_end, sk);
+}
 EXPORT_SYMBOL(sk_busy_loop);
 
 #endif /* CONFIG_NET_RX_BUSY_POLL */
@@ -5148,8 +5517,8 @@ static void napi_hash_add(struct napi_struct *napi)
 
 	/* 0..NR_CPUS+1 range is reserved for sender_cpu use */
 	do {
-		if (unlikely(++napi_gen_id < NR_CPUS + 1))
-			napi_gen_id = NR_CPUS + 1;
+		if (unlikely(++napi_gen_id < MIN_NAPI_ID))
+			napi_gen_id = MIN_NAPI_ID;
 	} while (napi_by_id(napi_gen_id));
 	napi->napi_id = napi_gen_id;
 
@@ -6714,16 +7083,49 @@ int dev_change_proto_down(struct net_device *dev, bool proto_down)
 }
 EXPORT_SYMBOL(dev_change_proto_down);
 
+static int generic_xdp_install(struct net_device *dev, struct netdev_xdp *xdp)
+{
+	struct bpf_prog *old = rtnl_dereference(dev->xdp_prog);
+	struct bpf_prog *new = xdp->prog;
+	int ret = 0;
+
+	switch (xdp->command) {
+	case XDP_SETUP_PROG:
+		rcu_assign_pointer(dev->xdp_prog, new);
+		if (old)
+			bpf_prog_put(old);
+
+		if (old && !new)
+			static_key_slow_dec(&generic_xdp_needed);
+		else if (new && !old)
+			static_key_slow_inc(&generic_xdp_needed);
+		break;
+
+	case XDP_QUERY_PROG:
+		xdp->prog_attached = !!old;
+		break;
+
+	default:
+		ret = -EINVAL;
+		break;
+	}
+
+	return ret;
+}
+
 /**
  *	dev_change_xdp_fd - set or clear a bpf program for a device rx path
  *	@dev: device
  *	@fd: new program fd or negative value to clear
  *	@flags: xdp-related flags
  *
- *	Set or clear a bpf program for a device
+ *	Set or clear a bpf program for a device.  Devices without native
+ *	XDP support, or any device when XDP_FLAGS_SKB_MODE is given, run
+ *	the program on skbs in the generic receive path instead.
  */
 int dev_change_xdp_fd(struct net_device *dev, int fd, u32 flags)
 {
+	int (*xdp_op)(struct net_device *dev, struct netdev_xdp *xdp);
 	const struct net_device_ops *ops = dev->netdev_ops;
 	struct bpf_prog *prog = NULL;
 	struct netdev_xdp xdp;
@@ -6731,14 +7133,16 @@ int dev_change_xdp_fd(struct net_device *dev, int fd, u32 flags)
 
 	ASSERT_RTNL();
 
-	if (!ops->ndo_xdp)
-		return -EOPNOTSUPP;
+	xdp_op = ops->ndo_xdp;
+	if (!xdp_op || (flags & XDP_FLAGS_SKB_MODE))
+		xdp_op = generic_xdp_install;
+
 	if (fd >= 0) {
 		if (flags & XDP_FLAGS_UPDATE_IF_NOEXIST) {
 			memset(&xdp, 0, sizeof(xdp));
 			xdp.command = XDP_QUERY_PROG;
 
-			err = ops->ndo_xdp(dev, &xdp);
+			err = xdp_op(dev, &xdp);
 			if (err < 0)
 				return err;
 			if (xdp.prog_attached)
@@ -6754,13 +7158,53 @@ int dev_change_xdp_fd(struct net_device *dev, int fd, u32 flags)
 	xdp.command = XDP_SETUP_PROG;
 	xdp.prog = prog;
 
-	err = ops->ndo_xdp(dev, &xdp);
+	err = xdp_op(dev, &xdp);
 	if (err < 0 && prog)
 		bpf_prog_put(prog);
 
 	return err;
 }
 
+/**
+ *	dev_change_rps_fd - set or clear the RPS steering program of a device
+ *	@dev: device
+ *	@fd: new program fd or negative value to clear
+ *
+ *	The program picks the CPU that RPS queues each received packet to.
+ *	With a flow table on the receive queue the choice goes through RFS,
+ *	so flows are moved in order and, with accelerated RFS, the hardware
+ *	filters follow the CPU the program chose.
+ */
+int dev_change_rps_fd(struct net_device *dev, int fd)
+{
+#ifdef CONFIG_RPS
+	struct bpf_prog *prog = NULL, *old;
+
+	ASSERT_RTNL();
+
+	if (fd >= 0) {
+		prog = bpf_prog_get_type(fd, BPF_PROG_TYPE_SOCKET_FILTER);
+		if (IS_ERR(prog))
+			return PTR_ERR(prog);
+	}
+
+	old = rtnl_dereference(dev->rps_prog);
+	rcu_assign_pointer(dev->rps_prog, prog);
+
+	if (prog && !old)
+		static_key_slow_inc(&rps_needed);
+	else if (!prog && old)
+		static_key_slow_dec(&rps_needed);
+
+	if (old)
+		bpf_prog_put(old);
+
+	return 0;
+#else
+	return -EOPNOTSUPP;
+#endif
+}
+
 /**
  *	dev_new_index	-	allocate an ifindex
  *	@net: the applicable net namespace
@@ -6854,6 +7298,15 @@ static void rollback_registered_many(struct list_head *head)
 		dev_uc_flush(dev);
 		dev_mc_flush(dev);
 
+		dev_change_rps_fd(dev, -1);
+		if (rtnl_dereference(dev->xdp_prog)) {
+			struct netdev_xdp xdp = {
+				.command = XDP_SETUP_PROG,
+			};
+
+			generic_xdp_install(dev, &xdp);
+		}
+
 		if (dev->netdev_ops->ndo_uninit)
 			dev->netdev_ops->ndo_uninit(dev);
 
@@ -6990,6 +7443,30 @@ static netdev_features_t netdev_fix_features(struct net_device *dev,
 		}
 	}
 
+	/* GRO_HW requires RXCSUM, and the stack only trusts it along with GRO */
+	if ((features & NETIF_F_GRO_HW) && !(features & NETIF_F_RXCSUM)) {
+		netdev_dbg(dev, "Dropping NETIF_F_GRO_HW since no RXCSUM feature.\n");
+		features &= ~NETIF_F_GRO_HW;
+	}
+
+	if ((features & NETIF_F_GRO_HW) && !(features & NETIF_F_GRO)) {
+		netdev_dbg(dev, "Dropping NETIF_F_GRO_HW since no GRO feature.\n");
+		features &= ~NETIF_F_GRO_HW;
+	}
+
+	/* LRO/HW-GRO features cannot be combined with RX-FCS */
+	if (features & NETIF_F_RXFCS) {
+		if (features & NETIF_F_LRO) {
+			netdev_dbg(dev, "Dropping LRO feature since RX-FCS is requested.\n");
+			features &= ~NETIF_F_LRO;
+		}
+
+		if (features & NETIF_F_GRO_HW) {
+			netdev_dbg(dev, "Dropping HW-GRO feature since RX-FCS is requested.\n");
+			features &= ~NETIF_F_GRO_HW;
+		}
+	}
+
 	/* GSO partial features require GSO partial be set */
 	if ((features & dev->gso_partial_features) &&
 	    !(features & NETIF_F_GSO_PARTIAL)) {
@@ -0,0 +1,512 @@
+/* net/core/page_pool.c
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ */
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/device.h>
+#include <linux/dma-mapping.h>
+#include <linux/mm.h> /* for __put_page() */
+#include <linux/poison.h>
+#include <linux/interrupt.h>
+#include <linux/jiffies.h>
+
+#include <net/page_pool.h>
+
+/* Pages owned by a pool carry this in page->lru.next and the pool in
+ * page->lru.prev.  Bit zero must stay clear so the page is never taken
+ * for a compound tail page.
+ */
+#define PP_SIGNATURE		((void *)(0x40 + POISON_POINTER_DELTA))
+
+#define DEFER_TIME		(msecs_to_jiffies(1000))
+#define DEFER_WARN_INTERVAL	(60 * HZ)
+
+static int page_pool_init(struct page_pool *pool,
+			  const struct page_pool_params *params)
+{
+	unsigned int ring_qsize = 1024; /* Default */
+
+	memcpy(&pool->p, params, sizeof(pool->p));
+
+	/* Validate only known flags were used */
+	if (pool->p.flags & ~(PP_FLAG_ALL))
+		return -EINVAL;
+
+	if (pool->p.pool_size)
+		ring_qsize = pool->p.pool_size;
+
+	/* Sanity limit mem that can be pinned down */
+	if (ring_qsize > 32768)
+		return -E2BIG;
+
+	/* DMA direction is either DMA_FROM_DEVICE or
+	 * DMA_BIDIRECTIONAL.  DMA_BIDIRECTIONAL is for allowing
+	 * page_pool to be used for XDP_TX, which needs the device to
+	 * read the page back.
+	 */
+	if (pool->p.flags & PP_FLAG_DMA_MAP) {
+		if ((pool->p.dma_dir != DMA_FROM_DEVICE) &&
+		    (pool->p.dma_dir != DMA_BIDIRECTIONAL))
+			return -EINVAL;
+
+		/* The DMA address is kept in page->private */
+		if (sizeof(dma_addr_t) > sizeof(unsigned long))
+			return -EOPNOTSUPP;
+	}
+
+	if (ptr_ring_init(&pool->ring, ring_qsize, GFP_KERNEL) < 0)
+		return -ENOMEM;
+
+	atomic_set(&pool->pages_state_release_cnt, 0);
+
+	return 0;
+}
+
+struct page_pool *page_pool_create(const struct page_pool_params *params)
+{
+	struct page_pool *pool;
+	int err;
+
+	pool = kzalloc_node(sizeof(*pool), GFP_KERNEL, params->nid);
+	if (!pool)
+		return ERR_PTR(-ENOMEM);
+
+	err = page_pool_init(pool, params);
+	if (err < 0) {
+		pr_warn("%s() gave up with errno %d\n", __func__, err);
+		kfree(pool);
+		return ERR_PTR(err);
+	}
+
+	return pool;
+}
+EXPORT_SYMBOL(page_pool_create);
+
+/* Refill the alloc cache from the ptr_ring, returns one page directly */
+static struct page *page_pool_refill_alloc_cache(struct page_pool *pool)
+{
+	struct ptr_ring *r = &pool->ring;
+	struct page *page;
+	int pref_nid; /* preferred NUMA node */
+
+	/* Quicker fallback, avoid locks when ring is empty */
+	if (__ptr_ring_empty(r))
+		return NULL;
+
+#ifdef CONFIG_NUMA
+	pref_nid = (pool->p.nid == NUMA_NO_NODE) ? numa_mem_id() : pool->p.nid;
+#else
+	/* Ignore pool->p.nid setting if !CONFIG_NUMA */
+	pref_nid = NUMA_NO_NODE;
+#endif
+
+	/* Softirq guarantee CPU and thus NUMA node is stable. This,
+	 * assumes CPU refilling driver RX-ring will also run RX-NAPI.
+	 */
+	spin_lock(&r->consumer_lock);
+	while ((page = __ptr_ring_consume(r))) {
+		if (likely(pref_nid == NUMA_NO_NODE ||
+			   page_to_nid(page) == pref_nid)) {
+			pool->alloc.cache[pool->alloc.count++] = page;
+			if (pool->alloc.count >= PP_ALLOC_CACHE_REFILL)
+				break;
+			continue;
+		}
+
+		/* NUMA mismatch: release the page and let the slow
+		 * path allocate on the right node instead.
+		 */
+		page_pool_release_page(pool, page);
+		put_page(page);
+	}
+	spin_unlock(&r->consumer_lock);
+
+	/* Return last page */
+	if (likely(pool->alloc.count > 0))
+		page = pool->alloc.cache[--pool->alloc.count];
+
+	return page;
+}
+
+/* fast-path */
+static struct page *__page_pool_get_cached(struct page_pool *pool)
+{
+	/* Caller MUST guarantee safe non-concurrent access, e.g. softirq */
+	if (likely(pool->alloc.count))
+		return pool->alloc.cache[--pool->alloc.count];
+
+	return page_pool_refill_alloc_cache(pool);
+}
+
+static bool page_pool_dma_map(struct page_pool *pool, struct page *page)
+{
+	dma_addr_t dma;
+
+	/* Setup DMA mapping: use 'struct page' area for storing DMA-addr
+	 * since dma_addr_t can be either 32 or 64 bits and does not always
+	 * fit into page private data (i.e 32bit cpu with 64bit DMA caps)
+	 * This mapping is kept for lifetime of page, until leaving pool.
+	 */
+	dma = dma_map_page_attrs(pool->p.dev, page, 0,
+				 (PAGE_SIZE << pool->p.order),
+				 pool->p.dma_dir, DMA_ATTR_SKIP_CPU_SYNC);
+	if (dma_mapping_error(pool->p.dev, dma))
+		return false;
+
+	set_page_private(page, (unsigned long)dma);
+
+	return true;
+}
+
+static void page_pool_set_pp_info(struct page_pool *pool, struct page *page)
+{
+	page->lru.next = PP_SIGNATURE;
+	page->lru.prev = (void *)pool;
+}
+
+static void page_pool_clear_pp_info(struct page *page)
+{
+	page->lru.next = NULL;
+	page->lru.prev = NULL;
+}
+
+/* slow path */
+static noinline
+struct page *__page_pool_alloc_pages_slow(struct page_pool *pool,
+					  gfp_t _gfp)
+{
+	unsigned int pp_order = pool->p.order;
+	struct page *page;
+	gfp_t gfp = _gfp | __GFP_COLD;
+	int nr_pages, i;
+
+	/* Don't support bulk alloc for high-order pages */
+	if (unlikely(pp_order)) {
+		page = alloc_pages_node(pool->p.nid, gfp | __GFP_COMP,
+					pp_order);
+		if (!page)
+			return NULL;
+
+		if ((pool->p.flags & PP_FLAG_DMA_MAP) &&
+		    unlikely(!page_pool_dma_map(pool, page))) {
+			put_page(page);
+			return NULL;
+		}
+
+		page_pool_set_pp_info(pool, page);
+		pool->pages_state_hold_cnt++;
+		return page;
+	}
+
+	/* Unnecessary as alloc cache is empty, but guarantees zero count */
+	if (unlikely(pool->alloc.count > 0))
+		return pool->alloc.cache[--pool->alloc.count];
+
+	/* Mark empty alloc.cache slots "empty" for alloc_pages_bulk */
+	memset(&pool->alloc.cache, 0, sizeof(void *) * PP_ALLOC_CACHE_REFILL);
+
+	nr_pages = alloc_pages_bulk_array_node(gfp, pool->p.nid,
+					       PP_ALLOC_CACHE_REFILL,
+					       (struct page **)pool->alloc.cache);
+	if (unlikely(!nr_pages))
+		return NULL;
+
+	/* Pages have been filled into alloc.cache array, but count is zero
+	 * and page elements have not been (possibly) DMA mapped.
+	 */
+	for (i = 0; i < nr_pages; i++) {
+		page = pool->alloc.cache[i];
+		if ((pool->p.flags & PP_FLAG_DMA_MAP) &&
+		    unlikely(!page_pool_dma_map(pool, page))) {
+			put_page(page);
+			continue;
+		}
+
+		page_pool_set_pp_info(pool, page);
+		pool->alloc.cache[pool->alloc.count++] = page;
+		pool->pages_state_hold_cnt++;
+	}
+
+	/* Return last page */
+	if (likely(pool->alloc.count > 0))
+		page = pool->alloc.cache[--pool->alloc.count];
+	else
+		page = NULL;
+
+	/* A page just alloc'ed should/must have refcnt 1. */
+	return page;
+}
+
+/* For using page_pool replace: alloc_pages() API calls, but provide
+ * synchronization guarantee for allocation side.
+ */
+struct page *page_pool_alloc_pages(struct page_pool *pool, gfp_t gfp)
+{
+	struct page *page;
+
+	/* Fast-path: Get a page from cache */
+	page = __page_pool_get_cached(pool);
+	if (page)
+		return page;
+
+	/* Slow-path: cache empty, do real allocation */
+	page = __page_pool_alloc_pages_slow(pool, gfp);
+	return page;
+}
+EXPORT_SYMBOL(page_pool_alloc_pages);
+
+static s32 page_pool_inflight(struct page_pool *pool)
+{
+	u32 release_cnt = atomic_read(&pool->pages_state_release_cnt);
+	u32 hold_cnt = READ_ONCE(pool->pages_state_hold_cnt);
+	s32 inflight;
+
+	inflight = (s32)(hold_cnt - release_cnt);
+
+	WARN(inflight < 0, "Negative(%d) inflight packet-pages", inflight);
+
+	return inflight;
+}
+
+/* Disconnects a page (from a page_pool).  API users can have a need
+ * to disconnect a page (from a page_pool), to allow it to be used as
+ * a regular page (that will eventually be returned to the normal
+ * page-allocator via put_page).
+ */
+void page_pool_release_page(struct page_pool *pool, struct page *page)
+{
+	dma_addr_t dma;
+
+	if (!(pool->p.flags & PP_FLAG_DMA_MAP))
+		/* Always account for inflight pages, even if we didn't
+		 * map them
+		 */
+		goto skip_dma_unmap;
+
+	dma = page_pool_get_dma_addr(page);
+
+	/* When page is unmapped, it cannot be returned to our pool */
+	dma_unmap_page_attrs(pool->p.dev, dma,
+			     PAGE_SIZE << pool->p.order, pool->p.dma_dir,
+			     DMA_ATTR_SKIP_CPU_SYNC);
+	set_page_private(page, 0);
+skip_dma_unmap:
+	page_pool_clear_pp_info(page);
+
+	/* This may be the last page returned, releasing the pool, so
+	 * it is not safe to reference pool afterwards.
+	 */
+	atomic_inc(&pool->pages_state_release_cnt);
+}
+EXPORT_SYMBOL(page_pool_release_page);
+
+/* Return a page to the page allocator, cleaning up our state */
+static void __page_pool_return_page(struct page_pool *pool, struct page *page)
+{
+	page_pool_release_page(pool, page);
+	put_page(page);
+	/* An optimization would be to call __free_pages(page, pool->p.order)
+	 * knowing page is not part of page-cache (thus avoiding a
+	 * __page_cache_release() call).
+	 */
+}
+
+static bool __page_pool_recycle_into_ring(struct page_pool *pool,
+					  struct page *page)
+{
+	int ret;
+
+	/* BH protection not needed if current is serving softirq */
+	if (in_serving_softirq())
+		ret = ptr_ring_produce(&pool->ring, page);
+	else
+		ret = ptr_ring_produce_bh(&pool->ring, page);
+
+	return (ret == 0) ? true : false;
+}
+
+/* Only allow direct recycling in special circumstances, into the
+ * alloc side cache.  E.g. during RX-NAPI processing for XDP_DROP use-case.
+ *
+ * Caller must provide appropriate safe context.
+ */
+static bool __page_pool_recycle_direct(struct page *page,
+				       struct page_pool *pool)
+{
+	if (unlikely(pool->alloc.count == PP_ALLOC_CACHE_SIZE))
+		return false;
+
+	/* Caller MUST have verified/know (page_ref_count(page) == 1) */
+	pool->alloc.cache[pool->alloc.count++] = page;
+	return true;
+}
+
+void __page_pool_put_page(struct page_pool *pool,
+			  struct page *page, bool allow_direct)
+{
+	/* This allocator is optimized for the XDP mode that uses
+	 * one-frame-per-page, but have fallbacks that act like the
+	 * regular page allocator APIs.
+	 *
+	 * refcnt == 1 means page_pool owns page, and can recycle it.
+	 * Pages from the emergency reserves are handed back to the
+	 * page allocator so they are not pinned down by the pool.
+	 */
+	if (likely(page_ref_count(page) == 1 && !page_is_pfmemalloc(page))) {
+		/* Read barrier done in page_ref_count / READ_ONCE */
+
+		if (allow_direct && in_serving_softirq())
+			if (__page_pool_recycle_direct(page, pool))
+				return;
+
+		if (!__page_pool_recycle_into_ring(pool, page)) {
+			/* Cache full, fallback to free pages */
+			__page_pool_return_page(pool, page);
+		}
+		return;
+	}
+	/* Fallback/non-XDP mode: API user have elevated refcnt.
+	 *
+	 * Many drivers split up the page into fragments, and some
+	 * want to keep doing this to save memory and do refcnt based
+	 * recycling. Support this use case too, to ease drivers
+	 * switching between XDP/non-XDP.
+	 *
+	 * In-case page_pool maintains the DMA mapping, API user must
+	 * call page_pool_put_page once.  In this elevated refcnt
+	 * case, the DMA is unmapped/released, as driver is likely
+	 * doing refcnt based recycle tricks, meaning another process
+	 * will be invoking put_page.
+	 */
+	__page_pool_return_page(pool, page);
+}
+EXPORT_SYMBOL(__page_pool_put_page);
+
+/* Return a page that was attached to an skb marked for recycling.
+ * Returns false if the page does not belong to a pool, in which case
+ * the caller must free it the usual way.
+ */
+bool page_pool_return_skb_page(struct page *page)
+{
+	struct page_pool *pool;
+
+	page = compound_head(page);
+	if (unlikely(READ_ONCE(page->lru.next) != PP_SIGNATURE))
+		return false;
+
+	pool = page->lru.prev;
+
+	/* The skb may be freed on any CPU and in any context, so never
+	 * touch the lockless alloc side cache from here.
+	 */
+	if (likely(page_ref_count(page) == 1)) {
+		page_pool_put_page(pool, page, false);
+		return true;
+	}
+
+	/* The page is shared with another skb, e.g. after a frag was
+	 * copied by pskb_expand_head().  Whoever clears the signature
+	 * first takes the page out of the pool; everyone else drops a
+	 * plain page reference.
+	 */
+	if (cmpxchg(&page->lru.next, PP_SIGNATURE, NULL) != PP_SIGNATURE)
+		return false;
+
+	__page_pool_return_page(pool, page);
+	return true;
+}
+EXPORT_SYMBOL(page_pool_return_skb_page);
+
+static void __page_pool_empty_ring(struct page_pool *pool)
+{
+	struct page *page;
+
+	/* Empty recycle ring */
+	while ((page = ptr_ring_consume_bh(&pool->ring))) {
+		/* Verify the refcnt invariant of cached pages */
+		if (!(page_ref_count(page) == 1))
+			pr_crit("%s() page_pool refcnt %d violation\n",
+				__func__, page_ref_count(page));
+
+		__page_pool_return_page(pool, page);
+	}
+}
+
+static void page_pool_empty_alloc_cache_once(struct page_pool *pool)
+{
+	struct page *page;
+
+	/* Empty alloc cache, assume caller made sure this is
+	 * no-longer in use, and page_pool_alloc_pages() cannot be
+	 * called concurrently.
+	 */
+	while (pool->alloc.count) {
+		page = pool->alloc.cache[--pool->alloc.count];
+		__page_pool_return_page(pool, page);
+	}
+}
+
+static void page_pool_free(struct page_pool *pool)
+{
+	ptr_ring_cleanup(&pool->ring, NULL);
+	kfree(pool);
+}
+
+static int page_pool_release(struct page_pool *pool)
+{
+	int inflight;
+
+	__page_pool_empty_ring(pool);
+	inflight = page_pool_inflight(pool);
+	if (!inflight)
+		page_pool_free(pool);
+
+	return inflight;
+}
+
+static void page_pool_release_retry(struct work_struct *wq)
+{
+	struct delayed_work *dwq = to_delayed_work(wq);
+	struct page_pool *pool = container_of(dwq, typeof(*pool), release_dw);
+	int inflight;
+
+	inflight = page_pool_release(pool);
+	if (!inflight)
+		return;
+
+	/* Periodic warning */
+	if (time_after_eq(jiffies, pool->defer_start + DEFER_WARN_INTERVAL)) {
+		pr_warn("%s() stalled pool shutdown %d inflight %d sec\n",
+			__func__, inflight,
+			(int)((jiffies - pool->defer_start) / HZ));
+		pool->defer_start = jiffies;
+	}
+
+	/* Still not ready to be disconnected, retry later */
+	schedule_delayed_work(&pool->release_dw, DEFER_TIME);
+}
+
+/* Pages still referenced by skbs in the stack keep a pointer to their
+ * pool, so the pool is only freed once all of them have come back.
+ * Until then the ring is drained periodically from a workqueue.
+ */
+void page_pool_destroy(struct page_pool *pool)
+{
+	if (!pool)
+		return;
+
+	page_pool_empty_alloc_cache_once(pool);
+
+	if (!page_pool_release(pool))
+		return;
+
+	pool->defer_start = jiffies;
+
+	INIT_DELAYED_WORK(&pool->release_dw, page_pool_release_retry);
+	schedule_delayed_work(&pool->release_dw, DEFER_TIME);
+}
+EXPORT_SYMBOL(page_pool_destroy);
@@ -47,6 +47,162 @@ void reqsk_queue_alloc(struct request_sock_queue *queue)
 	queue->rskq_accept_head = NULL;
 }
 
+int reqsk_cpu_queues_alloc(struct request_sock_queue *queue)
+{
+	struct reqsk_cpu_queues *cq;
+	int cpu;
+
+	cq = kzalloc(sizeof(*cq), GFP_KERNEL);
+	if (!cq)
+		return -ENOMEM;
+
+	cq->cpu = alloc_percpu(struct reqsk_cpu_queue);
+	if (!cq->cpu) {
+		kfree(cq);
+		return -ENOMEM;
+	}
+
+	for_each_possible_cpu(cpu)
+		spin_lock_init(&per_cpu_ptr(cq->cpu, cpu)->lock);
+	atomic_set(&cq->backlog, 0);
+
+	rcu_assign_pointer(queue->rskq_cpu_queues, cq);
+	return 0;
+}
+
+static void reqsk_cpu_queues_free_rcu(struct rcu_head *head)
+{
+	struct reqsk_cpu_queues *cq = container_of(head, struct reqsk_cpu_queues,
+						   rcu);
+
+	free_percpu(cq->cpu);
+	kfree(cq);
+}
+
+/* Called once the queues are drained; children are only ever added and
+ * accept() only looks under rcu_read_lock(), so the memory goes after a
+ * grace period.
+ */
+void reqsk_cpu_queues_free(struct request_sock_queue *queue)
+{
+	struct reqsk_cpu_queues *cq;
+
+	cq = rcu_dereference_protected(queue->rskq_cpu_queues, 1);
+	if (!cq)
+		return;
+
+	RCU_INIT_POINTER(queue->rskq_cpu_queues, NULL);
+	call_rcu(&cq->rcu, reqsk_cpu_queues_free_rcu);
+}
+
+bool reqsk_cpu_queues_empty(const struct request_sock_queue *queue)
+{
+	struct reqsk_cpu_queues *cq;
+	bool empty = true;
+
+	rcu_read_lock();
+	cq = rcu_dereference(queue->rskq_cpu_queues);
+	if (cq)
+		empty = !atomic_read(&cq->backlog);
+	rcu_read_unlock();
+
+	return empty;
+}
+EXPORT_SYMBOL(reqsk_cpu_queues_empty);
+
+/*
+ * Take the oldest child queued on the current cpu, or failing that on the
+ * next cpu that has one.  Only the lock of a non-empty queue is taken, so
+ * this can miss a child being added concurrently: fine for accept(), but
+ * a closing listener has to use reqsk_cpu_queues_splice().
+ */
+struct request_sock *reqsk_cpu_queue_remove(struct request_sock_queue *queue,
+					    struct sock *parent)
+{
+	struct request_sock *req = NULL;
+	struct reqsk_cpu_queues *cq;
+	int start, cpu;
+
+	rcu_read_lock();
+	cq = rcu_dereference(queue->rskq_cpu_queues);
+	if (!cq || !atomic_read(&cq->backlog))
+		goto out;
+
+	cpu = start = raw_smp_processor_id();
+	do {
+		struct reqsk_cpu_queue *q = per_cpu_ptr(cq->cpu, cpu);
+
+		if (READ_ONCE(q->head)) {
+			spin_lock_bh(&q->lock);
+			req = q->head;
+			if (req) {
+				q->head = req->dl_next;
+				if (!q->head)
+					q->tail = NULL;
+				WRITE_ONCE(parent->sk_ack_backlog,
+					   atomic_dec_return(&cq->backlog));
+			}
+			spin_unlock_bh(&q->lock);
+			if (req)
+				break;
+		}
+
+		cpu = cpumask_next(cpu, cpu_possible_mask);
+		if (cpu >= nr_cpu_ids)
+			cpu = cpumask_first(cpu_possible_mask);
+	} while (cpu != start);
+out:
+	rcu_read_unlock();
+	return req;
+}
+EXPORT_SYMBOL(reqsk_cpu_queue_remove);
+
+/*
+ * Take all the children queued on all cpus, for a listener that is closing.
+ * The caller must have moved @parent out of TCP_LISTEN first: every queue
+ * is then locked regardless of how it looks, so once a queue was seen
+ * here no child can be added to it any more, the adder checks the state
+ * under the same lock.
+ */
+struct request_sock *reqsk_cpu_queues_splice(struct request_sock_queue *queue,
+					     struct sock *parent)
+{
+	struct request_sock *head = NULL, *tail = NULL;
+	struct reqsk_cpu_queues *cq;
+	int cpu, n = 0;
+
+	rcu_read_lock();
+	cq = rcu_dereference(queue->rskq_cpu_queues);
+	if (!cq)
+		goto out;
+
+	for_each_possible_cpu(cpu) {
+		struct reqsk_cpu_queue *q = per_cpu_ptr(cq->cpu, cpu);
+		struct request_sock *req;
+
+		spin_lock_bh(&q->lock);
+		if (q->head) {
+			for (req = q->head; req; req = req->dl_next)
+				n++;
+			if (!head)
+				head = q->head;
+			else
+				tail->dl_next = q->head;
+			tail = q->tail;
+			q->head = NULL;
+			q->tail = NULL;
+		}
+		spin_unlock_bh(&q->lock);
+	}
+	if (n)
+		WRITE_ONCE(parent->sk_ack_backlog,
+			   atomic_sub_return(n, &cq->backlog));
+out:
+	rcu_read_unlock();
+	return head;
+}
+EXPORT_SYMBOL(reqsk_cpu_queues_splice);
+
 /*
  * This function is called to set a Fast Open socket's "fastopen_rsk" field
  * to NULL when a TFO socket no longer needs to access the request_sock.
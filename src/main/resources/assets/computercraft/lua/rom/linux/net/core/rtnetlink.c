@@ -901,10 +901,17 @@ static size_t rtnl_xdp_size(const struct net_device *dev)
 	size_t xdp_size = nla_total_size(0) +	/* nest IFLA_XDP */
 			  nla_total_size(1);	/* XDP_ATTACHED */
 
-	if (!dev->netdev_ops->ndo_xdp)
-		return 0;
-	else
-		return xdp_size;
+	return xdp_size;
+}
+
+static size_t rtnl_rps_bpf_size(const struct net_device *dev)
+{
+#ifdef CONFIG_RPS
+	return nla_total_size(0) +	/* nest IFLA_RPS_BPF */
+	       nla_total_size(1);	/* RPS_BPF_ATTACHED */
+#else
+	return 0;
+#endif
 }
 
 static noinline size_t if_nlmsg_size(const struct net_device *dev,
@@ -944,6 +951,7 @@ static noinline size_t if_nlmsg_size(const struct net_device *dev,
 	       + nla_total_size(MAX_PHYS_ITEM_ID_LEN) /* IFLA_PHYS_SWITCH_ID */
 	       + nla_total_size(IFNAMSIZ) /* IFLA_PHYS_PORT_NAME */
 	       + rtnl_xdp_size(dev) /* IFLA_XDP */
+	       + rtnl_rps_bpf_size(dev) /* IFLA_RPS_BPF */
 	       + nla_total_size(1); /* IFLA_PROTO_DOWN */
 
 }
@@ -1253,18 +1261,22 @@ static int rtnl_xdp_fill(struct sk_buff *skb, struct net_device *dev)
 {
 	struct netdev_xdp xdp_op = {};
 	struct nlattr *xdp;
+	u8 attached = 0;
 	int err;
 
-	if (!dev->netdev_ops->ndo_xdp)
-		return 0;
 	xdp = nla_nest_start(skb, IFLA_XDP);
 	if (!xdp)
 		return -EMSGSIZE;
-	xdp_op.command = XDP_QUERY_PROG;
-	err = dev->netdev_ops->ndo_xdp(dev, &xdp_op);
-	if (err)
-		goto err_cancel;
-	err = nla_put_u8(skb, IFLA_XDP_ATTACHED, xdp_op.prog_attached);
+	if (rcu_access_pointer(dev->xdp_prog)) {
+		attached = 1;
+	} else if (dev->netdev_ops->ndo_xdp) {
+		xdp_op.command = XDP_QUERY_PROG;
+		err = dev->netdev_ops->ndo_xdp(dev, &xdp_op);
+		if (err)
+			goto err_cancel;
+		attached = xdp_op.prog_attached;
+	}
+	err = nla_put_u8(skb, IFLA_XDP_ATTACHED, attached);
 	if (err)
 		goto err_cancel;
 
@@ -1276,6 +1288,24 @@ err_cancel:
 	return err;
 }
 
+static int rtnl_rps_bpf_fill(struct sk_buff *skb, struct net_device *dev)
+{
+#ifdef CONFIG_RPS
+	struct nlattr *rps;
+
+	rps = nla_nest_start(skb, IFLA_RPS_BPF);
+	if (!rps)
+		return -EMSGSIZE;
+	if (nla_put_u8(skb, IFLA_RPS_BPF_ATTACHED,
+		       !!rcu_access_pointer(dev->rps_prog))) {
+		nla_nest_cancel(skb, rps);
+		return -EMSGSIZE;
+	}
+	nla_nest_end(skb, rps);
+#endif
+	return 0;
+}
+
 static int rtnl_fill_ifinfo(struct sk_buff *skb, struct net_device *dev,
 			    int type, u32 pid, u32 seq, u32 change,
 			    unsigned int flags, u32 ext_filter_mask)
@@ -1375,6 +1405,9 @@ static int rtnl_fill_ifinfo(struct sk_buff *skb, struct net_device *dev,
 	if (rtnl_xdp_fill(skb, dev))
 		goto nla_put_failure;
 
+	if (rtnl_rps_bpf_fill(skb, dev))
+		goto nla_put_failure;
+
 	if (dev->rtnl_link_ops || rtnl_have_link_slave_info(dev)) {
 		if (rtnl_link_fill(skb, dev) < 0)
 			goto nla_put_failure;
@@ -1461,6 +1494,7 @@ static const struct nla_policy ifla_policy[IFLA_MAX+1] = {
 	[IFLA_LINK_NETNSID]	= { .type = NLA_S32 },
 	[IFLA_PROTO_DOWN]	= { .type = NLA_U8 },
 	[IFLA_XDP]		= { .type = NLA_NESTED },
+	[IFLA_RPS_BPF]		= { .type = NLA_NESTED },
 };
 
 static const struct nla_policy ifla_info_policy[IFLA_INFO_MAX+1] = {
@@ -1504,6 +1538,11 @@ static const struct nla_policy ifla_port_policy[IFLA_PORT_MAX+1] = {
 				    .len = sizeof(struct ifla_port_vsi) },
 };
 
+static const struct nla_policy ifla_rps_bpf_policy[IFLA_RPS_BPF_MAX + 1] = {
+	[IFLA_RPS_BPF_FD]	= { .type = NLA_S32 },
+	[IFLA_RPS_BPF_ATTACHED]	= { .type = NLA_U8 },
+};
+
 static const struct nla_policy ifla_xdp_policy[IFLA_XDP_MAX + 1] = {
 	[IFLA_XDP_FD]		= { .type = NLA_S32 },
 	[IFLA_XDP_ATTACHED]	= { .type = NLA_U8 },
@@ -2197,6 +2236,28 @@ static int do_setlink(const struct sk_buff *skb,
 		}
 	}
 
+	if (tb[IFLA_RPS_BPF]) {
+		struct nlattr *rps[IFLA_RPS_BPF_MAX + 1];
+
+		err = nla_parse_nested(rps, IFLA_RPS_BPF_MAX, tb[IFLA_RPS_BPF],
+				       ifla_rps_bpf_policy);
+		if (err < 0)
+			goto errout;
+
+		if (rps[IFLA_RPS_BPF_ATTACHED]) {
+			err = -EINVAL;
+			goto errout;
+		}
+
+		if (rps[IFLA_RPS_BPF_FD]) {
+			err = dev_change_rps_fd(dev,
+						nla_get_s32(rps[IFLA_RPS_BPF_FD]));
+			if (err)
+				goto errout;
+			status |= DO_SETLINK_NOTIFY;
+		}
+	}
+
 errout:
 	if (status & DO_SETLINK_MODIFIED) {
 		if (status & DO_SETLINK_NOTIFY)
@@ -769,6 +769,11 @@ static int inet_dump_fib(struct sk_buff *skb, struct netlink_callback *cb)
 	s_h = cb->args[0];
 	s_e = cb->args[1];
 
+	/* Every route change bumps fib_seq under RTNL, which dumps also
+	 * hold; messages sent after a change are flagged NLM_F_DUMP_INTR.
+	 */
+	cb->seq = net->ipv4.fib_seq + 1;
+
 	rcu_read_lock();
 
 	for (h = s_h; h < FIB_TABLE_HASHSZ; h++, s_e = 0) {
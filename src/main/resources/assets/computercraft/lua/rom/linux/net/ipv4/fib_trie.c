@@ -2067,26 +2067,55 @@ void fib_free_table(struct fib_table *tb)
 	call_rcu(&tb->rcu, __trie_free_rcu);
 }
 
+/* A dump that stops in the middle of a leaf remembers the last alias it
+ * sent by its place in the sort order of the leaf (suffix length, tos and
+ * priority, plus how many aliases with that same place were sent) rather
+ * than by its index, which moves whenever an alias is inserted or removed
+ * before it between two dump calls.
+ *
+ * cb->args[4] packs slen, tos and the duplicate count, cb->args[5] holds
+ * the priority.
+ */
+#define FIB_DUMP_POS(slen, tos, dups)	(1UL << 30 | (unsigned long)(slen) << 24 | \
+					 (unsigned long)(tos) << 16 | (dups))
+#define FIB_DUMP_POS_SLEN(pos)		(((pos) >> 24) & 0x3f)
+#define FIB_DUMP_POS_TOS(pos)		(((pos) >> 16) & 0xff)
+#define FIB_DUMP_POS_DUPS(pos)		((pos) & 0xffff)
+
+/* <0 if fa sorts before the dump position, 0 if at it, >0 if after it */
+static int fib_dump_pos_cmp(const struct fib_alias *fa, unsigned long pos,
+			    u32 prio)
+{
+	if (fa->fa_slen != FIB_DUMP_POS_SLEN(pos))
+		return fa->fa_slen < FIB_DUMP_POS_SLEN(pos) ? -1 : 1;
+	if (fa->fa_tos != FIB_DUMP_POS_TOS(pos))
+		return fa->fa_tos > FIB_DUMP_POS_TOS(pos) ? -1 : 1;
+	if (fa->fa_info->fib_priority != prio)
+		return fa->fa_info->fib_priority < prio ? -1 : 1;
+	return 0;
+}
+
 static int fn_trie_dump_leaf(struct key_vector *l, struct fib_table *tb,
 			     struct sk_buff *skb, struct netlink_callback *cb)
 {
 	__be32 xkey = htonl(l->key);
+	unsigned long s_pos = cb->args[4], pos = s_pos;
+	u32 s_prio = cb->args[5], prio = s_prio;
+	unsigned int dups = 0;
 	struct fib_alias *fa;
-	int i, s_i;
-
-	s_i = cb->args[4];
-	i = 0;
 
 	/* rcu_read_lock is hold by caller */
 	hlist_for_each_entry_rcu(fa, &l->leaf, fa_list) {
-		if (i < s_i) {
-			i++;
+		if (tb->tb_id != fa->tb_id)
 			continue;
-		}
 
-		if (tb->tb_id != fa->tb_id) {
-			i++;
-			continue;
+		if (s_pos) {
+			int cmp = fib_dump_pos_cmp(fa, s_pos, s_prio);
+
+			if (cmp < 0 ||
+			    (cmp == 0 && ++dups <= FIB_DUMP_POS_DUPS(s_pos)))
+				continue;
+			s_pos = 0;
 		}
 
 		if (fib_dump_info(skb, NETLINK_CB(cb->skb).portid,
@@ -2098,13 +2127,23 @@ static int fn_trie_dump_leaf(struct key_vector *l, struct fib_table *tb,
 				  KEYLENGTH - fa->fa_slen,
 				  fa->fa_tos,
 				  fa->fa_info, NLM_F_MULTI) < 0) {
-			cb->args[4] = i;
+			cb->args[4] = pos;
+			cb->args[5] = prio;
 			return -1;
 		}
-		i++;
+		nl_dump_check_consistent(cb, nlmsg_hdr(skb));
+
+		if (pos && !fib_dump_pos_cmp(fa, pos, prio) &&
+		    FIB_DUMP_POS_DUPS(pos) < 0xffff) {
+			pos++;
+		} else {
+			pos = FIB_DUMP_POS(fa->fa_slen, fa->fa_tos, 1);
+			prio = fa->fa_info->fib_priority;
+		}
 	}
 
-	cb->args[4] = i;
+	cb->args[4] = pos;
+	cb->args[5] = prio;
 	return skb->len;
 }
 
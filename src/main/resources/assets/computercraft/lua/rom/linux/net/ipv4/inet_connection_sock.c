@@ -421,6 +421,74 @@ static int inet_csk_wait_for_connect(struct sock *sk, long timeo)
 	return err;
 }
 
+/*
+ * accept() for a listener with per cpu accept queues.  Neither the socket
+ * lock nor rskq_lock is taken, only the lock of the cpu queue a child is
+ * taken from, so a thread pinned to the cpu that receives its connections
+ * contends with nobody.
+ */
+static struct request_sock *inet_csk_accept_percpu(struct sock *sk, int flags,
+						   int *err)
+{
+	struct request_sock_queue *queue = &inet_csk(sk)->icsk_accept_queue;
+	long timeo = sock_rcvtimeo(sk, flags & O_NONBLOCK);
+	struct request_sock *req;
+	DEFINE_WAIT(wait);
+	int error;
+
+	for (;;) {
+		error = -EINVAL;
+		if (READ_ONCE(sk->sk_state) != TCP_LISTEN)
+			break;
+		req = reqsk_cpu_queue_remove(queue, sk);
+		if (req)
+			return req;
+		error = -EAGAIN;
+		if (!timeo)
+			break;
+		error = sock_intr_errno(timeo);
+		if (signal_pending(current))
+			break;
+
+		/* Same wake-one scheme as inet_csk_wait_for_connect() */
+		prepare_to_wait_exclusive(sk_sleep(sk), &wait,
+					  TASK_INTERRUPTIBLE);
+		if (reqsk_queue_empty(queue) &&
+		    READ_ONCE(sk->sk_state) == TCP_LISTEN)
+			timeo = schedule_timeout(timeo);
+		finish_wait(sk_sleep(sk), &wait);
+	}
+	*err = error;
+	return NULL;
+}
+
+/*
+ * Detach an accepted child from its request.  Returns the request if the
+ * caller should drop it, NULL if reqsk_fastopen_remove() will.
+ */
+static struct request_sock *inet_csk_take_child(struct sock *sk,
+						struct request_sock *req)
+{
+	struct request_sock_queue *queue = &inet_csk(sk)->icsk_accept_queue;
+
+	if (sk->sk_protocol == IPPROTO_TCP &&
+	    tcp_rsk(req)->tfo_listener) {
+		spin_lock_bh(&queue->fastopenq.lock);
+		if (tcp_rsk(req)->tfo_listener) {
+			/* We are still waiting for the final ACK from 3WHS
+			 * so can't free req now. Instead, we set req->sk to
+			 * NULL to signify that the child socket is taken
+			 * so reqsk_fastopen_remove() will free the req
+			 * when 3WHS finishes (or is aborted).
+			 */
+			req->sk = NULL;
+			req = NULL;
+		}
+		spin_unlock_bh(&queue->fastopenq.lock);
+	}
+	return req;
+}
+
 /*
  * This will accept the next outstanding connection.
  */
@@ -432,6 +500,17 @@ struct sock *inet_csk_accept(struct sock *sk, int flags, int *err, bool kern)
 	struct sock *newsk;
 	int error;
 
+	if (queue->rskq_percpu) {
+		req = inet_csk_accept_percpu(sk, flags, err);
+		if (!req)
+			return NULL;
+		newsk = req->sk;
+		req = inet_csk_take_child(sk, req);
+		if (req)
+			reqsk_put(req);
+		return newsk;
+	}
+
 	lock_sock(sk);
 
 	/* We need to make sure that this socket is listening,
@@ -456,22 +535,7 @@ struct sock *inet_csk_accept(struct sock *sk, int flags, int *err, bool kern)
 	}
 	req = reqsk_queue_remove(queue, sk);
 	newsk = req->sk;
-
-	if (sk->sk_protocol == IPPROTO_TCP &&
-	    tcp_rsk(req)->tfo_listener) {
-		spin_lock_bh(&queue->fastopenq.lock);
-		if (tcp_rsk(req)->tfo_listener) {
-			/* We are still waiting for the final ACK from 3WHS
-			 * so can't free req now. Instead, we set req->sk to
-			 * NULL to signify that the child socket is taken
-			 * so reqsk_fastopen_remove() will free the req
-			 * when 3WHS finishes (or is aborted).
-			 */
-			req->sk = NULL;
-			req = NULL;
-		}
-		spin_unlock_bh(&queue->fastopenq.lock);
-	}
+	req = inet_csk_take_child(sk, req);
 out:
 	release_sock(sk);
 	if (req)
@@ -866,6 +930,12 @@ int inet_csk_listen_start(struct sock *sk, int backlog)
 	int err = -EADDRINUSE;
 
 	reqsk_queue_alloc(&icsk->icsk_accept_queue);
+	if (icsk->icsk_accept_queue.rskq_percpu) {
+		err = reqsk_cpu_queues_alloc(&icsk->icsk_accept_queue);
+		if (err)
+			return err;
+		err = -EADDRINUSE;
+	}
 
 	sk->sk_max_ack_backlog = backlog;
 	sk->sk_ack_backlog = 0;
@@ -888,6 +958,7 @@ int inet_csk_listen_start(struct sock *sk, int backlog)
 	}
 
 	sk->sk_state = TCP_CLOSE;
+	reqsk_cpu_queues_free(&icsk->icsk_accept_queue);
 	return err;
 }
 EXPORT_SYMBOL_GPL(inet_csk_listen_start);
@@ -922,6 +993,41 @@ struct sock *inet_csk_reqsk_queue_add(struct sock *sk,
 				      struct sock *child)
 {
 	struct request_sock_queue *queue = &inet_csk(sk)->icsk_accept_queue;
+	struct reqsk_cpu_queues *cq;
+
+	rcu_read_lock();
+	cq = rcu_dereference(queue->rskq_cpu_queues);
+	if (cq) {
+		struct reqsk_cpu_queue *q = this_cpu_ptr(cq->cpu);
+
+		/* inet_csk_listen_stop() takes the lock of every cpu queue
+		 * after leaving TCP_LISTEN (reqsk_cpu_queues_splice()), so
+		 * checking the state under the same lock is enough to never
+		 * strand a child.
+		 */
+		spin_lock(&q->lock);
+		if (unlikely(sk->sk_state != TCP_LISTEN)) {
+			inet_child_forget(sk, req, child);
+			child = NULL;
+		} else {
+			req->sk = child;
+			req->dl_next = NULL;
+			if (!q->head)
+				q->head = req;
+			else
+				q->tail->dl_next = req;
+			q->tail = req;
+			/* Approximate, on purpose: sk_acceptq_is_full() and
+			 * the diag code only need an idea of the backlog.
+			 */
+			WRITE_ONCE(sk->sk_ack_backlog,
+				   atomic_inc_return(&cq->backlog));
+		}
+		spin_unlock(&q->lock);
+		rcu_read_unlock();
+		return child;
+	}
+	rcu_read_unlock();
 
 	spin_lock(&queue->rskq_lock);
 	if (unlikely(sk->sk_state != TCP_LISTEN)) {
@@ -966,7 +1072,7 @@ void inet_csk_listen_stop(struct sock *sk)
 {
 	struct inet_connection_sock *icsk = inet_csk(sk);
 	struct request_sock_queue *queue = &icsk->icsk_accept_queue;
-	struct request_sock *next, *req;
+	struct request_sock *next, *req, *cpu_reqs;
 
 	/* Following specs, it would be better either to send FIN
 	 * (and enter FIN-WAIT-1, it is normal close)
@@ -976,9 +1082,14 @@ void inet_csk_listen_stop(struct sock *sk)
 	 * To be honest, we are not able to make either
 	 * of the variants now.			--ANK
 	 */
-	while ((req = reqsk_queue_remove(queue, sk)) != NULL) {
+	cpu_reqs = reqsk_cpu_queues_splice(queue, sk);
+	while ((req = reqsk_queue_remove(queue, sk)) != NULL ||
+	       (req = cpu_reqs) != NULL) {
 		struct sock *child = req->sk;
 
+		if (req == cpu_reqs)
+			cpu_reqs = req->dl_next;
+
 		local_bh_disable();
 		bh_lock_sock(child);
 		WARN_ON(sock_owned_by_user(child));
@@ -1003,6 +1114,7 @@ void inet_csk_listen_stop(struct sock *sk)
 			req = next;
 		}
 	}
+	reqsk_cpu_queues_free(queue);
 	WARN_ON_ONCE(sk->sk_ack_backlog);
 }
 EXPORT_SYMBOL_GPL(inet_csk_listen_stop);
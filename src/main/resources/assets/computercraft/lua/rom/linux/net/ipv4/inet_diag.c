@@ -18,6 +18,7 @@
 #include <linux/cache.h>
 #include <linux/init.h>
 #include <linux/time.h>
+#include <linux/cred.h>
 
 #include <net/icmp.h>
 #include <net/tcp.h>
@@ -29,6 +30,8 @@
 #include <net/inet6_hashtables.h>
 #include <net/netlink.h>
 
+#include <asm/unaligned.h>
+
 #include <linux/inet.h>
 #include <linux/stddef.h>
 
@@ -46,6 +49,7 @@ struct inet_diag_entry {
 	u16 userlocks;
 	u32 ifindex;
 	u32 mark;
+	struct sock *sk;
 };
 
 static DEFINE_MUTEX(inet_diag_table_mutex);
@@ -523,6 +527,52 @@ static int bitstring_match(const __be32 *a1, const __be32 *a2, int bits)
 	return 1;
 }
 
+static u64 inet_diag_sk_field(struct sock *sk, u16 field)
+{
+	switch (field) {
+	case INET_DIAG_FIELD_STATE:
+		if (sk->sk_state == TCP_TIME_WAIT)
+			return inet_twsk(sk)->tw_substate;
+		return sk->sk_state;
+	case INET_DIAG_FIELD_UID:
+		if (!sk_fullsock(sk))
+			return 0;
+		return from_kuid_munged(current_user_ns(), sock_i_uid(sk));
+	case INET_DIAG_FIELD_INODE:
+		return sk_fullsock(sk) ? sock_i_ino(sk) : 0;
+	case INET_DIAG_FIELD_COOKIE:
+		return sock_gen_cookie(sk);
+	case INET_DIAG_FIELD_RMEM:
+		return sk_fullsock(sk) ? sk_rmem_alloc_get(sk) : 0;
+	case INET_DIAG_FIELD_WMEM:
+		return sk_fullsock(sk) ? sk_wmem_alloc_get(sk) : 0;
+	}
+	return 0;
+}
+
+static bool inet_diag_field_match(const struct inet_diag_fieldcond *cond,
+				  struct sock *sk)
+{
+	u64 val = inet_diag_sk_field(sk, cond->field);
+	u64 ref = get_unaligned(&cond->value);
+
+	switch (cond->cmp) {
+	case INET_DIAG_CMP_EQ:
+		return val == ref;
+	case INET_DIAG_CMP_NE:
+		return val != ref;
+	case INET_DIAG_CMP_LT:
+		return val < ref;
+	case INET_DIAG_CMP_LE:
+		return val <= ref;
+	case INET_DIAG_CMP_GT:
+		return val > ref;
+	case INET_DIAG_CMP_GE:
+		return val >= ref;
+	}
+	return false;
+}
+
 static int inet_diag_bc_run(const struct nlattr *_bc,
 			    const struct inet_diag_entry *entry)
 {
@@ -611,6 +661,10 @@ static int inet_diag_bc_run(const struct nlattr *_bc,
 				yes = 0;
 			break;
 		}
+		case INET_DIAG_BC_FIELD_COND:
+			yes = inet_diag_field_match((const void *)(op + 1),
+						    entry->sk);
+			break;
 		}
 
 		if (yes) {
@@ -661,6 +715,7 @@ int inet_diag_bc_sk(const struct nlattr *bc, struct sock *sk)
 		entry.mark = inet_rsk(inet_reqsk(sk))->ir_mark;
 	else
 		entry.mark = 0;
+	entry.sk = sk;
 
 	return inet_diag_bc_run(bc, &entry);
 }
@@ -750,6 +805,20 @@ static bool valid_markcond(const struct inet_diag_bc_op *op, int len,
 	return len >= *min_len;
 }
 
+static bool valid_fieldcond(const struct inet_diag_bc_op *op, int len,
+			    int *min_len)
+{
+	const struct inet_diag_fieldcond *cond;
+
+	*min_len += sizeof(struct inet_diag_fieldcond);
+	if (len < *min_len)
+		return false;
+	cond = (const struct inet_diag_fieldcond *)(op + 1);
+
+	return cond->field < __INET_DIAG_FIELD_MAX &&
+	       cond->cmp < __INET_DIAG_CMP_MAX;
+}
+
 static int inet_diag_bc_audit(const struct nlattr *attr,
 			      const struct sk_buff *skb)
 {
@@ -790,6 +859,10 @@ static int inet_diag_bc_audit(const struct nlattr *attr,
 			if (!valid_markcond(bc, len, &min_len))
 				return -EINVAL;
 			break;
+		case INET_DIAG_BC_FIELD_COND:
+			if (!valid_fieldcond(bc, len, &min_len))
+				return -EINVAL;
+			break;
 		case INET_DIAG_BC_AUTO:
 		case INET_DIAG_BC_JMP:
 		case INET_DIAG_BC_NOP:
@@ -857,14 +930,31 @@ static void twsk_build_assert(void)
 #endif
 }
 
+static const struct inet_diag_cursor *
+inet_diag_dump_cursor(const struct netlink_callback *cb)
+{
+	const struct nlattr *attr;
+
+	/* The compat requests have a different header and no cursor */
+	if (cb->nlh->nlmsg_type != SOCK_DIAG_BY_FAMILY)
+		return NULL;
+
+	attr = nlmsg_find_attr(cb->nlh, sizeof(struct inet_diag_req_v2),
+			       INET_DIAG_REQ_CURSOR);
+	if (!attr || nla_len(attr) < sizeof(struct inet_diag_cursor))
+		return NULL;
+	return nla_data(attr);
+}
+
 void inet_diag_dump_icsk(struct inet_hashinfo *hashinfo, struct sk_buff *skb,
 			 struct netlink_callback *cb,
 			 const struct inet_diag_req_v2 *r, struct nlattr *bc)
 {
 	bool net_admin = netlink_net_capable(cb->skb, CAP_NET_ADMIN);
+	const struct inet_diag_cursor *cursor = inet_diag_dump_cursor(cb);
 	struct net *net = sock_net(skb->sk);
 	u32 idiag_states = r->idiag_states;
-	int i, num, s_i, s_num;
+	int i, num, s_i, s_num, start, end;
 	struct sock *sk;
 
 	if (idiag_states & TCPF_SYN_RECV)
@@ -872,9 +962,25 @@ void inet_diag_dump_icsk(struct inet_hashinfo *hashinfo, struct sk_buff *skb,
 	s_i = cb->args[1];
 	s_num = num = cb->args[2];
 
+	/*
+	 * Established buckets are walked as [start, end) and masked, so a
+	 * cursor slice may wrap past the end of the table.
+	 */
+	start = 0;
+	end = hashinfo->ehash_mask + 1;
+	if (cursor) {
+		start = cursor->bucket & hashinfo->ehash_mask;
+		if (cursor->count && cursor->count <= hashinfo->ehash_mask)
+			end = start + cursor->count;
+		else
+			end += start;
+	}
+
 	if (cb->args[0] == 0) {
 		if (!(idiag_states & TCPF_LISTEN) || r->id.idiag_dport)
 			goto skip_listen_ht;
+		if (start && end <= hashinfo->ehash_mask + 1)
+			goto skip_listen_ht;
 
 		for (i = s_i; i < INET_LHTABLE_SIZE; i++) {
 			struct inet_listen_hashbucket *ilb;
@@ -916,22 +1022,28 @@ next_listen:
 		}
 skip_listen_ht:
 		cb->args[0] = 1;
-		s_i = num = s_num = 0;
+		s_i = start;
+		num = s_num = 0;
 	}
 
 	if (!(idiag_states & ~TCPF_LISTEN))
 		goto out;
 
 #define SKARR_SZ 16
-	for (i = s_i; i <= hashinfo->ehash_mask; i++) {
-		struct inet_ehash_bucket *head = &hashinfo->ehash[i];
-		spinlock_t *lock = inet_ehash_lockp(hashinfo, i);
+	for (i = s_i; i < end; i++) {
+		unsigned int bucket = i & hashinfo->ehash_mask;
+		spinlock_t *lock = inet_ehash_lockp(hashinfo, bucket);
+		struct inet_ehash_bucket *head;
 		struct hlist_nulls_node *node;
 		struct sock *sk_arr[SKARR_SZ];
 		int num_arr[SKARR_SZ];
 		int idx, accum, res;
 
-		if (hlist_nulls_empty(&head->chain))
+		rcu_read_lock();
+		head = inet_ehash_slot(hashinfo, bucket);
+		res = !head || hlist_nulls_empty(&head->chain);
+		rcu_read_unlock();
+		if (res)
 			continue;
 
 		if (i > s_i)
@@ -941,6 +1053,9 @@ next_chunk:
 		num = 0;
 		accum = 0;
 		spin_lock_bh(lock);
+		head = inet_ehash_slot(hashinfo, bucket);
+		if (!head)
+			goto unlock;
 		sk_nulls_for_each(sk, node, &head->chain) {
 			int state;
 
@@ -974,6 +1089,7 @@ next_chunk:
 next_normal:
 			++num;
 		}
+unlock:
 		spin_unlock_bh(lock);
 		res = 0;
 		for (idx = 0; idx < accum; idx++) {
@@ -1127,9 +1243,17 @@ static int inet_diag_handler_cmd(struct sk_buff *skb, struct nlmsghdr *h)
 
 			attr = nlmsg_find_attr(h, hdrlen,
 					       INET_DIAG_REQ_BYTECODE);
-			err = inet_diag_bc_audit(attr, skb);
-			if (err)
-				return err;
+			if (attr) {
+				err = inet_diag_bc_audit(attr, skb);
+				if (err)
+					return err;
+			}
+
+			attr = nlmsg_find_attr(h, hdrlen,
+					       INET_DIAG_REQ_CURSOR);
+			if (attr &&
+			    nla_len(attr) < sizeof(struct inet_diag_cursor))
+				return -EINVAL;
 		}
 		{
 			struct netlink_dump_control c = {
@@ -278,10 +278,13 @@ struct sock *__inet_lookup_established(struct net *net,
 	 * have wildcards anyways.
 	 */
 	unsigned int hash = inet_ehashfn(net, daddr, hnum, saddr, sport);
-	unsigned int slot = hash & hashinfo->ehash_mask;
-	struct inet_ehash_bucket *head = &hashinfo->ehash[slot];
+	struct inet_ehash_lock *el = inet_ehash_lockent(hashinfo, hash);
+	struct inet_ehash_bucket *head;
+	unsigned int slot, seq;
 
 begin:
+	seq = read_seqcount_begin(&el->seq);
+	head = __inet_ehash_bucket(hashinfo, hash, &slot);
 	sk_nulls_for_each_rcu(sk, node, &head->chain) {
 		if (sk->sk_hash != hash)
 			continue;
@@ -304,6 +307,9 @@ begin:
 	 */
 	if (get_nulls_value(node) != slot)
 		goto begin;
+	/* The chain may also have moved to a resized table under us */
+	if (read_seqcount_retry(&el->seq, seq))
+		goto begin;
 out:
 	sk = NULL;
 found:
@@ -326,13 +332,14 @@ static int __inet_check_established(struct inet_timewait_death_row *death_row,
 	struct net *net = sock_net(sk);
 	unsigned int hash = inet_ehashfn(net, daddr, lport,
 					 saddr, inet->inet_dport);
-	struct inet_ehash_bucket *head = inet_ehash_bucket(hinfo, hash);
 	spinlock_t *lock = inet_ehash_lockp(hinfo, hash);
+	struct inet_ehash_bucket *head;
 	struct sock *sk2;
 	const struct hlist_nulls_node *node;
 	struct inet_timewait_sock *tw = NULL;
 
 	spin_lock(lock);
+	head = inet_ehash_bucket(hinfo, hash);
 
 	sk_nulls_for_each(sk2, node, &head->chain) {
 		if (sk2->sk_hash != hash)
@@ -400,11 +407,11 @@ bool inet_ehash_insert(struct sock *sk, struct sock *osk)
 	WARN_ON_ONCE(!sk_unhashed(sk));
 
 	sk->sk_hash = sk_ehashfn(sk);
-	head = inet_ehash_bucket(hashinfo, sk->sk_hash);
-	list = &head->chain;
 	lock = inet_ehash_lockp(hashinfo, sk->sk_hash);
 
 	spin_lock(lock);
+	head = inet_ehash_bucket(hashinfo, sk->sk_hash);
+	list = &head->chain;
 	if (osk) {
 		WARN_ON_ONCE(sk->sk_hash != osk->sk_hash);
 		ret = sk_nulls_del_node_init_rcu(osk);
@@ -667,29 +674,172 @@ EXPORT_SYMBOL_GPL(inet_hashinfo_init);
 
 int inet_ehash_locks_alloc(struct inet_hashinfo *hashinfo)
 {
-	unsigned int locksz = sizeof(spinlock_t);
-	unsigned int i, nblocks = 1;
+	unsigned int locksz = sizeof(struct inet_ehash_lock);
+	unsigned int i, nblocks;
 
-	if (locksz != 0) {
-		/* allocate 2 cache lines or at least one spinlock per cpu */
-		nblocks = max(2U * L1_CACHE_BYTES / locksz, 1U);
-		nblocks = roundup_pow_of_two(nblocks * num_possible_cpus());
+	/* allocate 2 cache lines or at least one lock per cpu */
+	nblocks = max(2U * L1_CACHE_BYTES / locksz, 1U);
+	nblocks = roundup_pow_of_two(nblocks * num_possible_cpus());
 
-		/* no more locks than number of hash buckets */
-		nblocks = min(nblocks, hashinfo->ehash_mask + 1);
+	/* no more locks than number of hash buckets */
+	nblocks = min(nblocks, hashinfo->ehash_mask + 1);
 
-		hashinfo->ehash_locks =	kmalloc_array(nblocks, locksz,
-						      GFP_KERNEL | __GFP_NOWARN);
-		if (!hashinfo->ehash_locks)
-			hashinfo->ehash_locks = vmalloc(nblocks * locksz);
+	hashinfo->ehash_locks =	kmalloc_array(nblocks, locksz,
+					      GFP_KERNEL | __GFP_NOWARN);
+	if (!hashinfo->ehash_locks)
+		hashinfo->ehash_locks = vmalloc(nblocks * locksz);
 
-		if (!hashinfo->ehash_locks)
-			return -ENOMEM;
+	if (!hashinfo->ehash_locks)
+		return -ENOMEM;
 
-		for (i = 0; i < nblocks; i++)
-			spin_lock_init(&hashinfo->ehash_locks[i]);
+	for (i = 0; i < nblocks; i++) {
+		spin_lock_init(&hashinfo->ehash_locks[i].lock);
+		seqcount_init(&hashinfo->ehash_locks[i].seq);
+		hashinfo->ehash_locks[i].pending = false;
 	}
 	hashinfo->ehash_locks_mask = nblocks - 1;
 	return 0;
 }
 EXPORT_SYMBOL_GPL(inet_ehash_locks_alloc);
+
+/* Serializes resizes, and keeps them away from inet_twsk_purge() */
+DEFINE_MUTEX(inet_ehash_resize_mutex);
+EXPORT_SYMBOL_GPL(inet_ehash_resize_mutex);
+
+static void inet_ehash_move_chain(struct inet_ehash_bucket *from,
+				  struct inet_ehash_bucket *to,
+				  unsigned int mask)
+{
+	while (!hlist_nulls_empty(&from->chain)) {
+		struct hlist_nulls_node *node = from->chain.first;
+		struct sock *sk = hlist_nulls_entry(node, struct sock,
+						    sk_nulls_node);
+
+		/* Lockless readers still on the node follow it to its new
+		 * chain and either meet the wrong nulls value or notice
+		 * the seqcount, both are retried.
+		 */
+		hlist_nulls_del_rcu(node);
+		hlist_nulls_add_head_rcu(node, &to[sk->sk_hash & mask].chain);
+	}
+}
+
+/*
+ * Grow the established table of @hashinfo to @size buckets while it is in
+ * use.  The number of locks does not change, each lock moves the buckets
+ * it covers from the old table to the new one in turn, so writers and
+ * readers of the other locks are never held up.
+ */
+int inet_ehash_resize(struct inet_hashinfo *hashinfo, unsigned int size)
+{
+	unsigned int i, j, nblocks, old_mask;
+	struct inet_ehash_bucket *new, *old;
+	bool old_vmalloc;
+	int err = 0;
+
+	if (!size || size > (1U << 30) / sizeof(*new))
+		return -EINVAL;
+	size = roundup_pow_of_two(size);
+
+	mutex_lock(&inet_ehash_resize_mutex);
+
+	old = hashinfo->ehash;
+	old_mask = hashinfo->ehash_mask;
+	old_vmalloc = hashinfo->ehash_vmalloc;
+	if (size <= old_mask + 1) {
+		err = size == old_mask + 1 ? 0 : -EINVAL;
+		goto out;
+	}
+
+	new = vmalloc(size * sizeof(*new));
+	if (!new) {
+		err = -ENOMEM;
+		goto out;
+	}
+	for (i = 0; i < size; i++)
+		INIT_HLIST_NULLS_HEAD(&new[i].chain, i);
+
+	/* Point every lock at the old table, then wait for the lookups
+	 * that still index ehash with the old mask before switching it.
+	 */
+	hashinfo->ehash_old = old;
+	hashinfo->ehash_old_mask = old_mask;
+	nblocks = hashinfo->ehash_locks_mask + 1;
+	for (i = 0; i < nblocks; i++) {
+		struct inet_ehash_lock *el = &hashinfo->ehash_locks[i];
+
+		spin_lock_bh(&el->lock);
+		smp_store_release(&el->pending, true);
+		spin_unlock_bh(&el->lock);
+	}
+	synchronize_rcu();
+
+	WRITE_ONCE(hashinfo->ehash, new);
+	WRITE_ONCE(hashinfo->ehash_mask, size - 1);
+	hashinfo->ehash_vmalloc = true;
+
+	for (i = 0; i < nblocks; i++) {
+		struct inet_ehash_lock *el = &hashinfo->ehash_locks[i];
+
+		spin_lock_bh(&el->lock);
+		write_seqcount_begin(&el->seq);
+		for (j = i; j <= old_mask; j += nblocks)
+			inet_ehash_move_chain(&old[j], new, size - 1);
+		smp_store_release(&el->pending, false);
+		write_seqcount_end(&el->seq);
+		spin_unlock_bh(&el->lock);
+		cond_resched();
+	}
+	synchronize_rcu();
+
+	hashinfo->ehash_old = NULL;
+	/* The boot time table comes from the large system hash allocator,
+	 * it is not ours to free.
+	 */
+	if (old_vmalloc)
+		vfree(old);
+
+	pr_info("%s: established hash table resized to %u buckets\n",
+		__func__, size);
+out:
+	mutex_unlock(&inet_ehash_resize_mutex);
+	return err;
+}
+EXPORT_SYMBOL_GPL(inet_ehash_resize);
+
+void inet_ehash_chain_hist(struct inet_hashinfo *hashinfo,
+			   unsigned int hist[INET_EHASH_HIST_SIZE],
+			   unsigned int *max)
+{
+	unsigned int slot, mask = READ_ONCE(hashinfo->ehash_mask);
+
+	memset(hist, 0, INET_EHASH_HIST_SIZE * sizeof(*hist));
+	*max = 0;
+
+	rcu_read_lock();
+	for (slot = 0; slot <= mask; slot++) {
+		const struct hlist_nulls_node *node;
+		struct inet_ehash_bucket *head;
+		unsigned int len = 0;
+		struct sock *sk;
+
+		head = inet_ehash_slot(hashinfo, slot);
+		if (!head)
+			continue;
+		/* Racy but good enough for statistics */
+		sk_nulls_for_each_rcu(sk, node, &head->chain)
+			len++;
+
+		hist[min_t(unsigned int, len ? ilog2(len) + 1 : 0,
+			   INET_EHASH_HIST_SIZE - 1)]++;
+		*max = max(*max, len);
+
+		if ((slot & 1023) == 1023) {
+			rcu_read_unlock();
+			cond_resched();
+			rcu_read_lock();
+		}
+	}
+	rcu_read_unlock();
+}
+EXPORT_SYMBOL_GPL(inet_ehash_chain_hist);
@@ -103,8 +103,8 @@ void __inet_twsk_hashdance(struct inet_timewait_sock *tw, struct sock *sk,
 {
 	const struct inet_sock *inet = inet_sk(sk);
 	const struct inet_connection_sock *icsk = inet_csk(sk);
-	struct inet_ehash_bucket *ehead = inet_ehash_bucket(hashinfo, sk->sk_hash);
 	spinlock_t *lock = inet_ehash_lockp(hashinfo, sk->sk_hash);
+	struct inet_ehash_bucket *ehead;
 	struct inet_bind_hashbucket *bhead;
 	/* Step 1: Put TW into bind hash. Original socket stays there too.
 	   Note, that any socket with inet->num != 0 MUST be bound in
@@ -119,6 +119,7 @@ void __inet_twsk_hashdance(struct inet_timewait_sock *tw, struct sock *sk,
 	spin_unlock(&bhead->lock);
 
 	spin_lock(lock);
+	ehead = inet_ehash_bucket(hashinfo, sk->sk_hash);
 
 	/*
 	 * Step 2: Hash TW into tcp ehash chain.
@@ -264,6 +265,10 @@ void inet_twsk_purge(struct inet_hashinfo *hashinfo, int family)
 	struct hlist_nulls_node *node;
 	unsigned int slot;
 
+	/* Chains must not move to a resized table under us, we would
+	 * miss the timewait sockets of the dying netns.
+	 */
+	mutex_lock(&inet_ehash_resize_mutex);
 	for (slot = 0; slot <= hashinfo->ehash_mask; slot++) {
 		struct inet_ehash_bucket *head = &hashinfo->ehash[slot];
 restart_rcu:
@@ -301,5 +306,6 @@ restart:
 			goto restart;
 		rcu_read_unlock();
 	}
+	mutex_unlock(&inet_ehash_resize_mutex);
 }
 EXPORT_SYMBOL_GPL(inet_twsk_purge);
@@ -0,0 +1,272 @@
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/netfilter.h>
+#include <linux/ip.h>
+#include <linux/tcp.h>
+#include <linux/udp.h>
+#include <net/ip.h>
+#include <net/neighbour.h>
+#include <net/route.h>
+#include <net/netfilter/nf_flow_table.h>
+
+struct flow_ports {
+	__be16 source, dest;
+};
+
+static void nf_flow_nat_ip_l4proto(struct sk_buff *skb, struct iphdr *iph,
+				   unsigned int thoff, __be32 addr,
+				   __be32 new_addr)
+{
+	struct tcphdr *tcph;
+	struct udphdr *udph;
+
+	switch (iph->protocol) {
+	case IPPROTO_TCP:
+		tcph = (void *)(skb_network_header(skb) + thoff);
+		inet_proto_csum_replace4(&tcph->check, skb, addr, new_addr,
+					 true);
+		break;
+	case IPPROTO_UDP:
+		udph = (void *)(skb_network_header(skb) + thoff);
+		if (udph->check || skb->ip_summed == CHECKSUM_PARTIAL) {
+			inet_proto_csum_replace4(&udph->check, skb, addr,
+						 new_addr, true);
+			if (!udph->check)
+				udph->check = CSUM_MANGLED_0;
+		}
+		break;
+	}
+}
+
+static void nf_flow_nat_port(struct sk_buff *skb, struct iphdr *iph,
+			     unsigned int thoff, __be16 *port, __be16 new_port)
+{
+	struct tcphdr *tcph;
+	struct udphdr *udph;
+
+	switch (iph->protocol) {
+	case IPPROTO_TCP:
+		tcph = (void *)(skb_network_header(skb) + thoff);
+		inet_proto_csum_replace2(&tcph->check, skb, *port, new_port,
+					 false);
+		break;
+	case IPPROTO_UDP:
+		udph = (void *)(skb_network_header(skb) + thoff);
+		if (udph->check || skb->ip_summed == CHECKSUM_PARTIAL) {
+			inet_proto_csum_replace2(&udph->check, skb, *port,
+						 new_port, false);
+			if (!udph->check)
+				udph->check = CSUM_MANGLED_0;
+		}
+		break;
+	}
+	*port = new_port;
+}
+
+/* Rewrite the packet to what the slow path NAT would have made of it */
+static void nf_flow_snat(const struct flow_offload *flow, struct sk_buff *skb,
+			 struct iphdr *iph, unsigned int thoff,
+			 enum flow_offload_tuple_dir dir)
+{
+	struct flow_ports *ports = (void *)(skb_network_header(skb) + thoff);
+	__be32 addr, new_addr;
+
+	if (dir == FLOW_OFFLOAD_DIR_ORIGINAL) {
+		addr = iph->saddr;
+		new_addr = flow->tuplehash[FLOW_OFFLOAD_DIR_REPLY].tuple.dst_v4.s_addr;
+		iph->saddr = new_addr;
+	} else {
+		addr = iph->daddr;
+		new_addr = flow->tuplehash[FLOW_OFFLOAD_DIR_ORIGINAL].tuple.src_v4.s_addr;
+		iph->daddr = new_addr;
+	}
+	csum_replace4(&iph->check, addr, new_addr);
+	nf_flow_nat_ip_l4proto(skb, iph, thoff, addr, new_addr);
+
+	if (dir == FLOW_OFFLOAD_DIR_ORIGINAL)
+		nf_flow_nat_port(skb, iph, thoff, &ports->source,
+				 flow->tuplehash[FLOW_OFFLOAD_DIR_REPLY].tuple.dst_port);
+	else
+		nf_flow_nat_port(skb, iph, thoff, &ports->dest,
+				 flow->tuplehash[FLOW_OFFLOAD_DIR_ORIGINAL].tuple.src_port);
+}
+
+static void nf_flow_dnat(const struct flow_offload *flow, struct sk_buff *skb,
+			 struct iphdr *iph, unsigned int thoff,
+			 enum flow_offload_tuple_dir dir)
+{
+	struct flow_ports *ports = (void *)(skb_network_header(skb) + thoff);
+	__be32 addr, new_addr;
+
+	if (dir == FLOW_OFFLOAD_DIR_ORIGINAL) {
+		addr = iph->daddr;
+		new_addr = flow->tuplehash[FLOW_OFFLOAD_DIR_REPLY].tuple.src_v4.s_addr;
+		iph->daddr = new_addr;
+	} else {
+		addr = iph->saddr;
+		new_addr = flow->tuplehash[FLOW_OFFLOAD_DIR_ORIGINAL].tuple.dst_v4.s_addr;
+		iph->saddr = new_addr;
+	}
+	csum_replace4(&iph->check, addr, new_addr);
+	nf_flow_nat_ip_l4proto(skb, iph, thoff, addr, new_addr);
+
+	if (dir == FLOW_OFFLOAD_DIR_ORIGINAL)
+		nf_flow_nat_port(skb, iph, thoff, &ports->dest,
+				 flow->tuplehash[FLOW_OFFLOAD_DIR_REPLY].tuple.src_port);
+	else
+		nf_flow_nat_port(skb, iph, thoff, &ports->source,
+				 flow->tuplehash[FLOW_OFFLOAD_DIR_ORIGINAL].tuple.dst_port);
+}
+
+static unsigned int nf_flow_l4_hdrsize(u8 protocol)
+{
+	switch (protocol) {
+	case IPPROTO_TCP:
+		return sizeof(struct tcphdr);
+	case IPPROTO_UDP:
+		return sizeof(struct udphdr);
+	}
+	return 0;
+}
+
+/* Only plain TCP and UDP over IPv4 without options or fragments */
+static int nf_flow_tuple_ip(struct sk_buff *skb, const struct net_device *dev,
+			    struct flow_offload_tuple *tuple)
+{
+	unsigned int thoff, hdrsize;
+	struct flow_ports *ports;
+	struct iphdr *iph;
+
+	if (!pskb_may_pull(skb, sizeof(*iph)))
+		return -1;
+
+	iph = ip_hdr(skb);
+	thoff = iph->ihl * 4;
+
+	if (iph->version != 4 || ip_is_fragment(iph) ||
+	    unlikely(thoff != sizeof(struct iphdr)))
+		return -1;
+
+	hdrsize = nf_flow_l4_hdrsize(iph->protocol);
+	if (!hdrsize)
+		return -1;
+
+	if (!pskb_may_pull(skb, thoff + hdrsize))
+		return -1;
+
+	iph = ip_hdr(skb);
+	ports = (struct flow_ports *)(skb_network_header(skb) + thoff);
+
+	tuple->src_v4.s_addr	= iph->saddr;
+	tuple->dst_v4.s_addr	= iph->daddr;
+	tuple->src_port		= ports->source;
+	tuple->dst_port		= ports->dest;
+	tuple->l3proto		= AF_INET;
+	tuple->l4proto		= iph->protocol;
+	tuple->iifidx		= dev->ifindex;
+
+	return 0;
+}
+
+/* A closing TCP connection goes back to conntrack for the state changes */
+static bool nf_flow_tcp_closing(struct flow_offload *flow, struct sk_buff *skb,
+				unsigned int thoff)
+{
+	struct tcphdr *tcph;
+
+	if (ip_hdr(skb)->protocol != IPPROTO_TCP)
+		return false;
+
+	tcph = (void *)(skb_network_header(skb) + thoff);
+	if (unlikely(tcph->fin || tcph->rst)) {
+		flow_offload_teardown(flow);
+		return true;
+	}
+	return false;
+}
+
+static bool nf_flow_exceeds_mtu(const struct sk_buff *skb, unsigned int mtu)
+{
+	if (skb->len <= mtu)
+		return false;
+
+	if (skb_is_gso(skb) && skb_gso_validate_mtu(skb, mtu))
+		return false;
+
+	return true;
+}
+
+/**
+ *	nf_flow_offload_ip_hook - forward an IPv4 packet of an offloaded flow
+ *	@flow_table: flow table to look the packet up in
+ *	@skb: packet, at the netdev ingress hook
+ *
+ *	Returns NF_STOLEN if the packet was transmitted and NF_ACCEPT if it
+ *	has to take the regular path, e.g. because it needs fragmenting, an
+ *	ICMP error or it changes the TCP state.
+ */
+unsigned int nf_flow_offload_ip_hook(struct nf_flowtable *flow_table,
+				     struct sk_buff *skb)
+{
+	struct flow_offload_tuple_rhash *tuplehash;
+	struct flow_offload_tuple tuple = {};
+	enum flow_offload_tuple_dir dir;
+	struct flow_offload *flow;
+	struct net_device *outdev;
+	struct rtable *rt;
+	unsigned int thoff;
+	struct iphdr *iph;
+	__be32 nexthop;
+
+	if (skb->protocol != htons(ETH_P_IP))
+		return NF_ACCEPT;
+
+	if (nf_flow_tuple_ip(skb, skb->dev, &tuple) < 0)
+		return NF_ACCEPT;
+
+	tuplehash = flow_offload_lookup(flow_table, &tuple);
+	if (tuplehash == NULL)
+		return NF_ACCEPT;
+
+	dir = tuplehash->tuple.dir;
+	flow = container_of(tuplehash, struct flow_offload, tuplehash[dir]);
+	rt = (struct rtable *)tuplehash->tuple.dst_cache;
+	outdev = rt->dst.dev;
+
+	if (ip_hdr(skb)->ttl <= 1 ||
+	    unlikely(nf_flow_exceeds_mtu(skb, dst_mtu(&rt->dst))))
+		return NF_ACCEPT;
+
+	if (!dst_check(&rt->dst, 0)) {
+		flow_offload_teardown(flow);
+		return NF_ACCEPT;
+	}
+
+	thoff = ip_hdr(skb)->ihl * 4;
+	if (nf_flow_tcp_closing(flow, skb, thoff))
+		return NF_ACCEPT;
+
+	if (skb_try_make_writable(skb, thoff +
+				  nf_flow_l4_hdrsize(ip_hdr(skb)->protocol)))
+		return NF_DROP;
+
+	iph = ip_hdr(skb);
+	if (flow->flags & FLOW_OFFLOAD_SNAT)
+		nf_flow_snat(flow, skb, iph, thoff, dir);
+	if (flow->flags & FLOW_OFFLOAD_DNAT)
+		nf_flow_dnat(flow, skb, iph, thoff, dir);
+
+	flow->timeout = nf_flowtable_time_stamp + NF_FLOW_TIMEOUT;
+	ip_decrease_ttl(iph);
+
+	skb->dev = outdev;
+	nexthop = rt_nexthop(rt, flow->tuplehash[!dir].tuple.src_v4.s_addr);
+	skb_dst_set_noref(skb, &rt->dst);
+	neigh_xmit(NEIGH_ARP_TABLE, outdev, &nexthop, skb);
+
+	return NF_STOLEN;
+}
+EXPORT_SYMBOL_GPL(nf_flow_offload_ip_hook);
+
+MODULE_LICENSE("GPL");
@@ -51,6 +51,27 @@
 /*
  *	Report socket allocation statistics [mea@utu.fi]
  */
+/*
+ *	Chain lengths of the TCP established table.  Walking a large table
+ *	is not free, so the result is kept for a second.
+ */
+static void sockstat_ehash_show(struct seq_file *seq)
+{
+	static DEFINE_MUTEX(ehash_hist_mutex);
+	static unsigned int hist[INET_EHASH_HIST_SIZE], max;
+	static unsigned long stamp;
+
+	mutex_lock(&ehash_hist_mutex);
+	if (!stamp || time_after(jiffies, stamp + HZ)) {
+		inet_ehash_chain_hist(&tcp_hashinfo, hist, &max);
+		stamp = jiffies;
+	}
+	seq_printf(seq, "TCPEHASH: buckets %u empty %u 1 %u 2-3 %u 4-7 %u 8-15 %u 16+ %u max %u\n",
+		   tcp_hashinfo.ehash_mask + 1, hist[0], hist[1], hist[2],
+		   hist[3], hist[4], hist[5], max);
+	mutex_unlock(&ehash_hist_mutex);
+}
+
 static int sockstat_seq_show(struct seq_file *seq, void *v)
 {
 	struct net *net = seq->private;
@@ -74,6 +95,9 @@ static int sockstat_seq_show(struct seq_file *seq, void *v)
 		   sock_prot_inuse_get(net, &raw_prot));
 	frag_mem = ip_frag_mem(net);
 	seq_printf(seq,  "FRAG: inuse %u memory %u\n", !!frag_mem, frag_mem);
+	/* The established table is shared by all namespaces */
+	if (net_eq(net, &init_net))
+		sockstat_ehash_show(seq);
 	return 0;
 }
 
@@ -304,6 +328,8 @@ static const struct snmp_mib snmp4_net_list[] = {
 	SNMP_MIB_ITEM("TCPKeepAlive", LINUX_MIB_TCPKEEPALIVE),
 	SNMP_MIB_ITEM("TCPMTUPFail", LINUX_MIB_TCPMTUPFAIL),
 	SNMP_MIB_ITEM("TCPMTUPSuccess", LINUX_MIB_TCPMTUPSUCCESS),
+	SNMP_MIB_ITEM("TCPZeroCopyRxMapped", LINUX_MIB_TCPZEROCOPYRXMAPPED),
+	SNMP_MIB_ITEM("TCPZeroCopyRxSkip", LINUX_MIB_TCPZEROCOPYRXSKIP),
 	SNMP_MIB_SENTINEL
 };
 
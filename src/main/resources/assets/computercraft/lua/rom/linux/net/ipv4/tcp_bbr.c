@@ -53,7 +53,8 @@
  *   https://groups.google.com/forum/#!forum/bbr-dev
  *
  * NOTE: BBR *must* be used with the fq qdisc ("man tc-fq") with pacing enabled,
- * since pacing is integral to the BBR design and implementation.
+ * since pacing is integral to the BBR design and implementation.  BBR stamps
+ * each packet with its departure time (TCP_CONG_EDT), fq holds it until then.
  * BBR without pacing would not function properly, and may incur unnecessary
  * high packet loss rates.
  */
@@ -830,6 +831,8 @@ static void bbr_init(struct sock *sk)
 	bbr->cycle_idx = 0;
 	bbr_reset_lt_bw_sampling(sk);
 	bbr_reset_startup_mode(sk);
+
+	cmpxchg(&sk->sk_pacing_status, SK_PACING_NONE, SK_PACING_NEEDED);
 }
 
 static u32 bbr_sndbuf_expand(struct sock *sk)
@@ -890,7 +893,7 @@ static void bbr_set_state(struct sock *sk, u8 new_state)
 }
 
 static struct tcp_congestion_ops tcp_bbr_cong_ops __read_mostly = {
-	.flags		= TCP_CONG_NON_RESTRICTED,
+	.flags		= TCP_CONG_NON_RESTRICTED | TCP_CONG_EDT,
 	.name		= "bbr",
 	.owner		= THIS_MODULE,
 	.init		= bbr_init,
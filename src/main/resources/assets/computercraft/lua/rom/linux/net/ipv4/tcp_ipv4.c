@@ -1868,6 +1868,8 @@ void tcp_v4_destroy_sock(struct sock *sk)
 
 	tcp_cleanup_congestion_control(sk);
 
+	tcp_cleanup_ulp(sk);
+
 	/* Cleanup up the write buffer. */
 	tcp_write_queue_purge(sk);
 
@@ -1960,7 +1962,15 @@ static void *listening_get_idx(struct seq_file *seq, loff_t *pos)
 
 static inline bool empty_bucket(const struct tcp_iter_state *st)
 {
-	return hlist_nulls_empty(&tcp_hashinfo.ehash[st->bucket].chain);
+	struct inet_ehash_bucket *head;
+	bool empty;
+
+	rcu_read_lock();
+	head = inet_ehash_slot(&tcp_hashinfo, st->bucket);
+	empty = !head || hlist_nulls_empty(&head->chain);
+	rcu_read_unlock();
+
+	return empty;
 }
 
 /*
@@ -1977,6 +1987,7 @@ static void *established_get_first(struct seq_file *seq)
 	for (; st->bucket <= tcp_hashinfo.ehash_mask; ++st->bucket) {
 		struct sock *sk;
 		struct hlist_nulls_node *node;
+		struct inet_ehash_bucket *head;
 		spinlock_t *lock = inet_ehash_lockp(&tcp_hashinfo, st->bucket);
 
 		/* Lockless fast path for the common case of empty buckets */
@@ -1984,7 +1995,12 @@ static void *established_get_first(struct seq_file *seq)
 			continue;
 
 		spin_lock_bh(lock);
-		sk_nulls_for_each(sk, node, &tcp_hashinfo.ehash[st->bucket].chain) {
+		head = inet_ehash_slot(&tcp_hashinfo, st->bucket);
+		if (!head) {
+			spin_unlock_bh(lock);
+			continue;
+		}
+		sk_nulls_for_each(sk, node, &head->chain) {
 			if (sk->sk_family != st->family ||
 			    !net_eq(sock_net(sk), net)) {
 				continue;
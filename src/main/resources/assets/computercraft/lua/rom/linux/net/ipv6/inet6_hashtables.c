@@ -65,11 +65,13 @@ struct sock *__inet6_lookup_established(struct net *net,
 	 * have wildcards anyways.
 	 */
 	unsigned int hash = inet6_ehashfn(net, daddr, hnum, saddr, sport);
-	unsigned int slot = hash & hashinfo->ehash_mask;
-	struct inet_ehash_bucket *head = &hashinfo->ehash[slot];
-
+	struct inet_ehash_lock *el = inet_ehash_lockent(hashinfo, hash);
+	struct inet_ehash_bucket *head;
+	unsigned int slot, seq;
 
 begin:
+	seq = read_seqcount_begin(&el->seq);
+	head = __inet_ehash_bucket(hashinfo, hash, &slot);
 	sk_nulls_for_each_rcu(sk, node, &head->chain) {
 		if (sk->sk_hash != hash)
 			continue;
@@ -86,6 +88,8 @@ begin:
 	}
 	if (get_nulls_value(node) != slot)
 		goto begin;
+	if (read_seqcount_retry(&el->seq, seq))
+		goto begin;
 out:
 	sk = NULL;
 found:
@@ -191,13 +195,14 @@ static int __inet6_check_established(struct inet_timewait_death_row *death_row,
 	struct net *net = sock_net(sk);
 	const unsigned int hash = inet6_ehashfn(net, daddr, lport, saddr,
 						inet->inet_dport);
-	struct inet_ehash_bucket *head = inet_ehash_bucket(hinfo, hash);
 	spinlock_t *lock = inet_ehash_lockp(hinfo, hash);
+	struct inet_ehash_bucket *head;
 	struct sock *sk2;
 	const struct hlist_nulls_node *node;
 	struct inet_timewait_sock *tw = NULL;
 
 	spin_lock(lock);
+	head = inet_ehash_bucket(hinfo, hash);
 
 	sk_nulls_for_each(sk2, node, &head->chain) {
 		if (sk2->sk_hash != hash)
@@ -46,21 +46,34 @@
 #define CONFIG_IP_VS_TAB_BITS	12
 #endif
 
+#define IP_VS_CONN_TAB_MIN_BITS	8
+#define IP_VS_CONN_TAB_MAX_BITS	20
+
 /*
  * Connection hash size. Default is what was selected at compile time.
 */
 static int ip_vs_conn_tab_bits = CONFIG_IP_VS_TAB_BITS;
-module_param_named(conn_tab_bits, ip_vs_conn_tab_bits, int, 0444);
-MODULE_PARM_DESC(conn_tab_bits, "Set connections' hash size");
 
-/* size and mask values */
+/* size value, for reporting only */
 int ip_vs_conn_tab_size __read_mostly;
-static int ip_vs_conn_tab_mask __read_mostly;
 
 /*
  *  Connection hash table: for input and output packets lookups of IPVS
  */
-static struct hlist_head *ip_vs_conn_tab __read_mostly;
+struct ip_vs_conn_htable {
+	unsigned int		size;
+	unsigned int		mask;
+	struct hlist_head	buckets[];
+};
+
+static struct ip_vs_conn_htable __rcu *ip_vs_conn_tab __read_mostly;
+
+/*
+ * Bumped while the table is being resized.  Conns are moved to the new
+ * table one at a time, so a lookup that missed may have to be retried.
+ */
+static seqcount_t ip_vs_conn_tab_seq;
+static DEFINE_MUTEX(ip_vs_conn_tab_mutex);
 
 /*  SLAB cache for IPVS connections */
 static struct kmem_cache *ip_vs_conn_cachep __read_mostly;
@@ -104,10 +117,49 @@ static inline void ct_write_unlock_bh(unsigned int key)
 	spin_unlock_bh(&__ip_vs_conntbl_lock_array[key&CT_LOCKARRAY_MASK].l);
 }
 
+/* The table can't be replaced while any of the bucket locks is held */
+static inline struct hlist_head *ip_vs_conn_bucket_locked(unsigned int hash)
+{
+	struct ip_vs_conn_htable *t;
+
+	t = rcu_dereference_protected(ip_vs_conn_tab, 1);
+	return &t->buckets[hash & t->mask];
+}
+
+static inline struct hlist_head *ip_vs_conn_bucket(unsigned int hash)
+{
+	struct ip_vs_conn_htable *t = rcu_dereference(ip_vs_conn_tab);
+
+	return &t->buckets[hash & t->mask];
+}
+
+/* Called under rcu_read_lock(), check the sequence if the lookup missed */
+static inline struct hlist_head *ip_vs_conn_bucket_rcu(unsigned int hash,
+						       unsigned int *seq)
+{
+	*seq = raw_read_seqcount(&ip_vs_conn_tab_seq);
+	return ip_vs_conn_bucket(hash);
+}
+
+static inline bool ip_vs_conn_bucket_retry(unsigned int seq)
+{
+	return unlikely(seq & 1) ||
+	       read_seqcount_retry(&ip_vs_conn_tab_seq, seq);
+}
+
+/* Bucket @idx of the current table, NULL past its end */
+static inline struct hlist_head *ip_vs_conn_bucket_idx(unsigned int idx)
+{
+	struct ip_vs_conn_htable *t = rcu_dereference(ip_vs_conn_tab);
+
+	return idx < t->size ? &t->buckets[idx] : NULL;
+}
+
 static void ip_vs_conn_expire(unsigned long data);
 
 /*
- *	Returns hash value for IPVS connection entry
+ *	Returns hash value for IPVS connection entry.  It is not reduced to
+ *	the table size, so that it selects the same lock in any table.
  */
 static unsigned int ip_vs_conn_hashkey(struct netns_ipvs *ipvs, int af, unsigned int proto,
 				       const union nf_inet_addr *addr,
@@ -115,13 +167,13 @@ static unsigned int ip_vs_conn_hashkey(struct netns_ipvs *ipvs, int af, unsigned
 {
 #ifdef CONFIG_IP_VS_IPV6
 	if (af == AF_INET6)
-		return (jhash_3words(jhash(addr, 16, ip_vs_conn_rnd),
+		return jhash_3words(jhash(addr, 16, ip_vs_conn_rnd),
 				    (__force u32)port, proto, ip_vs_conn_rnd) ^
-			((size_t)ipvs>>8)) & ip_vs_conn_tab_mask;
+			((size_t)ipvs>>8);
 #endif
-	return (jhash_3words((__force u32)addr->ip, (__force u32)port, proto,
+	return jhash_3words((__force u32)addr->ip, (__force u32)port, proto,
 			    ip_vs_conn_rnd) ^
-		((size_t)ipvs>>8)) & ip_vs_conn_tab_mask;
+		((size_t)ipvs>>8);
 }
 
 static unsigned int ip_vs_conn_hashkey_param(const struct ip_vs_conn_param *p,
@@ -131,8 +183,7 @@ static unsigned int ip_vs_conn_hashkey_param(const struct ip_vs_conn_param *p,
 	__be16 port;
 
 	if (p->pe_data && p->pe->hashkey_raw)
-		return p->pe->hashkey_raw(p, ip_vs_conn_rnd, inverse) &
-			ip_vs_conn_tab_mask;
+		return p->pe->hashkey_raw(p, ip_vs_conn_rnd, inverse);
 
 	if (likely(!inverse)) {
 		addr = p->caddr;
@@ -182,7 +233,7 @@ static inline int ip_vs_conn_hash(struct ip_vs_conn *cp)
 	if (!(cp->flags & IP_VS_CONN_F_HASHED)) {
 		cp->flags |= IP_VS_CONN_F_HASHED;
 		atomic_inc(&cp->refcnt);
-		hlist_add_head_rcu(&cp->c_list, &ip_vs_conn_tab[hash]);
+		hlist_add_head_rcu(&cp->c_list, ip_vs_conn_bucket_locked(hash));
 		ret = 1;
 	} else {
 		pr_err("%s(): request for already hashed, called from %pF\n",
@@ -266,14 +317,15 @@ static inline bool ip_vs_conn_unlink(struct ip_vs_conn *cp)
 static inline struct ip_vs_conn *
 __ip_vs_conn_in_get(const struct ip_vs_conn_param *p)
 {
-	unsigned int hash;
+	unsigned int hash, seq;
 	struct ip_vs_conn *cp;
 
 	hash = ip_vs_conn_hashkey_param(p, false);
 
 	rcu_read_lock();
 
-	hlist_for_each_entry_rcu(cp, &ip_vs_conn_tab[hash], c_list) {
+retry:
+	hlist_for_each_entry_rcu(cp, ip_vs_conn_bucket_rcu(hash, &seq), c_list) {
 		if (p->cport == cp->cport && p->vport == cp->vport &&
 		    cp->af == p->af &&
 		    ip_vs_addr_equal(p->af, p->caddr, &cp->caddr) &&
@@ -289,6 +341,9 @@ __ip_vs_conn_in_get(const struct ip_vs_conn_param *p)
 		}
 	}
 
+	if (ip_vs_conn_bucket_retry(seq))
+		goto retry;
+
 	rcu_read_unlock();
 
 	return NULL;
@@ -352,14 +407,15 @@ EXPORT_SYMBOL_GPL(ip_vs_conn_in_get_proto);
 /* Get reference to connection template */
 struct ip_vs_conn *ip_vs_ct_in_get(const struct ip_vs_conn_param *p)
 {
-	unsigned int hash;
+	unsigned int hash, seq;
 	struct ip_vs_conn *cp;
 
 	hash = ip_vs_conn_hashkey_param(p, false);
 
 	rcu_read_lock();
 
-	hlist_for_each_entry_rcu(cp, &ip_vs_conn_tab[hash], c_list) {
+retry:
+	hlist_for_each_entry_rcu(cp, ip_vs_conn_bucket_rcu(hash, &seq), c_list) {
 		if (unlikely(p->pe_data && p->pe->ct_match)) {
 			if (cp->ipvs != p->ipvs)
 				continue;
@@ -384,6 +440,8 @@ struct ip_vs_conn *ip_vs_ct_in_get(const struct ip_vs_conn_param *p)
 				goto out;
 		}
 	}
+	if (ip_vs_conn_bucket_retry(seq))
+		goto retry;
 	cp = NULL;
 
   out:
@@ -404,7 +462,7 @@ struct ip_vs_conn *ip_vs_ct_in_get(const struct ip_vs_conn_param *p)
  *	p->vaddr, p->vport: pkt dest address (foreign host) */
 struct ip_vs_conn *ip_vs_conn_out_get(const struct ip_vs_conn_param *p)
 {
-	unsigned int hash;
+	unsigned int hash, seq;
 	struct ip_vs_conn *cp, *ret=NULL;
 
 	/*
@@ -414,7 +472,8 @@ struct ip_vs_conn *ip_vs_conn_out_get(const struct ip_vs_conn_param *p)
 
 	rcu_read_lock();
 
-	hlist_for_each_entry_rcu(cp, &ip_vs_conn_tab[hash], c_list) {
+retry:
+	hlist_for_each_entry_rcu(cp, ip_vs_conn_bucket_rcu(hash, &seq), c_list) {
 		if (p->vport == cp->cport && p->cport == cp->dport &&
 		    cp->af == p->af &&
 		    ip_vs_addr_equal(p->af, p->vaddr, &cp->caddr) &&
@@ -429,6 +488,9 @@ struct ip_vs_conn *ip_vs_conn_out_get(const struct ip_vs_conn_param *p)
 		}
 	}
 
+	if (!ret && ip_vs_conn_bucket_retry(seq))
+		goto retry;
+
 	rcu_read_unlock();
 
 	IP_VS_DBG_BUF(9, "lookup/out %s %s:%d->%s:%d %s\n",
@@ -570,8 +632,8 @@ static inline void ip_vs_bind_xmit_v6(struct ip_vs_conn *cp)
 
 static inline int ip_vs_dest_totalconns(struct ip_vs_dest *dest)
 {
-	return atomic_read(&dest->activeconns)
-		+ atomic_read(&dest->inactconns);
+	return ip_vs_dest_conns_read(&dest->activeconns)
+		+ ip_vs_dest_conns_read(&dest->inactconns);
 }
 
 /*
@@ -627,13 +689,13 @@ ip_vs_bind_dest(struct ip_vs_conn *cp, struct ip_vs_dest *dest)
 		 * update them on state change
 		 */
 		if (!(flags & IP_VS_CONN_F_INACTIVE))
-			atomic_inc(&dest->activeconns);
+			ip_vs_dest_conns_add(&dest->activeconns, 1);
 		else
-			atomic_inc(&dest->inactconns);
+			ip_vs_dest_conns_add(&dest->inactconns, 1);
 	} else {
 		/* It is a persistent connection/template, so increase
 		   the persistent connection counter */
-		atomic_inc(&dest->persistconns);
+		ip_vs_dest_conns_add(&dest->persistconns, 1);
 	}
 
 	if (dest->u_threshold != 0 &&
@@ -722,14 +784,14 @@ static inline void ip_vs_unbind_dest(struct ip_vs_conn *cp)
 		/* It is a normal connection, so decrease the inactconns
 		   or activeconns counter */
 		if (cp->flags & IP_VS_CONN_F_INACTIVE) {
-			atomic_dec(&dest->inactconns);
+			ip_vs_dest_conns_add(&dest->inactconns, -1);
 		} else {
-			atomic_dec(&dest->activeconns);
+			ip_vs_dest_conns_add(&dest->activeconns, -1);
 		}
 	} else {
 		/* It is a persistent connection/template, so decrease
 		   the persistent connection counter */
-		atomic_dec(&dest->persistconns);
+		ip_vs_dest_conns_add(&dest->persistconns, -1);
 	}
 
 	if (dest->l_threshold != 0) {
@@ -1001,22 +1063,24 @@ ip_vs_conn_new(const struct ip_vs_conn_param *p, int dest_af,
 #ifdef CONFIG_PROC_FS
 struct ip_vs_iter_state {
 	struct seq_net_private	p;
-	struct hlist_head	*l;
+	unsigned int		idx;
 };
 
+/* A resize in between reads may make the dump skip or repeat entries */
 static void *ip_vs_conn_array(struct seq_file *seq, loff_t pos)
 {
-	int idx;
+	unsigned int idx;
+	struct hlist_head *l;
 	struct ip_vs_conn *cp;
 	struct ip_vs_iter_state *iter = seq->private;
 
-	for (idx = 0; idx < ip_vs_conn_tab_size; idx++) {
-		hlist_for_each_entry_rcu(cp, &ip_vs_conn_tab[idx], c_list) {
+	for (idx = 0; (l = ip_vs_conn_bucket_idx(idx)); idx++) {
+		hlist_for_each_entry_rcu(cp, l, c_list) {
 			/* __ip_vs_conn_get() is not needed by
 			 * ip_vs_conn_seq_show and ip_vs_conn_sync_seq_show
 			 */
 			if (pos-- == 0) {
-				iter->l = &ip_vs_conn_tab[idx];
+				iter->idx = idx;
 				return cp;
 			}
 		}
@@ -1031,7 +1095,7 @@ static void *ip_vs_conn_seq_start(struct seq_file *seq, loff_t *pos)
 {
 	struct ip_vs_iter_state *iter = seq->private;
 
-	iter->l = NULL;
+	iter->idx = 0;
 	rcu_read_lock();
 	return *pos ? ip_vs_conn_array(seq, *pos - 1) :SEQ_START_TOKEN;
 }
@@ -1041,8 +1105,8 @@ static void *ip_vs_conn_seq_next(struct seq_file *seq, void *v, loff_t *pos)
 	struct ip_vs_conn *cp = v;
 	struct ip_vs_iter_state *iter = seq->private;
 	struct hlist_node *e;
-	struct hlist_head *l = iter->l;
-	int idx;
+	struct hlist_head *l;
+	unsigned int idx;
 
 	++*pos;
 	if (v == SEQ_START_TOKEN)
@@ -1053,15 +1117,15 @@ static void *ip_vs_conn_seq_next(struct seq_file *seq, void *v, loff_t *pos)
 	if (e)
 		return hlist_entry(e, struct ip_vs_conn, c_list);
 
-	idx = l - ip_vs_conn_tab;
-	while (++idx < ip_vs_conn_tab_size) {
-		hlist_for_each_entry_rcu(cp, &ip_vs_conn_tab[idx], c_list) {
-			iter->l = &ip_vs_conn_tab[idx];
+	idx = iter->idx;
+	while ((l = ip_vs_conn_bucket_idx(++idx))) {
+		hlist_for_each_entry_rcu(cp, l, c_list) {
+			iter->idx = idx;
 			return cp;
 		}
 		cond_resched_rcu();
 	}
-	iter->l = NULL;
+	iter->idx = 0;
 	return NULL;
 }
 
@@ -1282,10 +1346,10 @@ void ip_vs_random_dropentry(struct netns_ipvs *ipvs)
 	/*
 	 * Randomly scan 1/32 of the whole table every second
 	 */
-	for (idx = 0; idx < (ip_vs_conn_tab_size>>5); idx++) {
-		unsigned int hash = prandom_u32() & ip_vs_conn_tab_mask;
+	for (idx = 0; idx < (READ_ONCE(ip_vs_conn_tab_size)>>5); idx++) {
+		unsigned int hash = prandom_u32();
 
-		hlist_for_each_entry_rcu(cp, &ip_vs_conn_tab[hash], c_list) {
+		hlist_for_each_entry_rcu(cp, ip_vs_conn_bucket(hash), c_list) {
 			if (cp->ipvs != ipvs)
 				continue;
 			if (cp->flags & IP_VS_CONN_F_TEMPLATE) {
@@ -1349,14 +1413,15 @@ try_drop:
  */
 static void ip_vs_conn_flush(struct netns_ipvs *ipvs)
 {
-	int idx;
+	unsigned int idx;
+	struct hlist_head *l;
 	struct ip_vs_conn *cp, *cp_c;
 
 flush_again:
 	rcu_read_lock();
-	for (idx = 0; idx < ip_vs_conn_tab_size; idx++) {
+	for (idx = 0; (l = ip_vs_conn_bucket_idx(idx)); idx++) {
 
-		hlist_for_each_entry_rcu(cp, &ip_vs_conn_tab[idx], c_list) {
+		hlist_for_each_entry_rcu(cp, l, c_list) {
 			if (cp->ipvs != ipvs)
 				continue;
 			IP_VS_DBG(4, "del connection\n");
@@ -1380,6 +1445,106 @@ flush_again:
 		goto flush_again;
 	}
 }
+static struct ip_vs_conn_htable *ip_vs_conn_tab_alloc(int bits)
+{
+	struct ip_vs_conn_htable *t;
+	unsigned int idx, size;
+
+	if (bits < IP_VS_CONN_TAB_MIN_BITS || bits > IP_VS_CONN_TAB_MAX_BITS)
+		return NULL;
+
+	size = 1U << bits;
+	t = vmalloc(sizeof(*t) + size * sizeof(struct hlist_head));
+	if (!t)
+		return NULL;
+
+	t->size = size;
+	t->mask = size - 1;
+	for (idx = 0; idx < size; idx++)
+		INIT_HLIST_HEAD(&t->buckets[idx]);
+
+	return t;
+}
+
+/*
+ * Move all conns to a table of 2^bits buckets.  The lock of a conn only
+ * depends on its unreduced hash, so holding all of them keeps out every
+ * writer while lookups go on under RCU and retry when they miss.
+ */
+static int ip_vs_conn_tab_resize(int bits)
+{
+	struct ip_vs_conn_htable *t, *old;
+	struct ip_vs_conn *cp;
+	struct hlist_node *n;
+	unsigned int idx, hash;
+
+	if (bits < IP_VS_CONN_TAB_MIN_BITS || bits > IP_VS_CONN_TAB_MAX_BITS)
+		return -EINVAL;
+
+	t = ip_vs_conn_tab_alloc(bits);
+	if (!t)
+		return -ENOMEM;
+
+	mutex_lock(&ip_vs_conn_tab_mutex);
+	old = rcu_dereference_protected(ip_vs_conn_tab,
+					lockdep_is_held(&ip_vs_conn_tab_mutex));
+	if (old->size == t->size) {
+		mutex_unlock(&ip_vs_conn_tab_mutex);
+		vfree(t);
+		return 0;
+	}
+
+	local_bh_disable();
+	for (idx = 0; idx < CT_LOCKARRAY_SIZE; idx++)
+		spin_lock_nest_lock(&__ip_vs_conntbl_lock_array[idx].l,
+				    &ip_vs_conn_tab_mutex);
+	write_seqcount_begin(&ip_vs_conn_tab_seq);
+
+	for (idx = 0; idx < old->size; idx++) {
+		hlist_for_each_entry_safe(cp, n, &old->buckets[idx], c_list) {
+			hash = ip_vs_conn_hashkey_conn(cp);
+			hlist_del_rcu(&cp->c_list);
+			hlist_add_head_rcu(&cp->c_list,
+					   &t->buckets[hash & t->mask]);
+		}
+	}
+
+	rcu_assign_pointer(ip_vs_conn_tab, t);
+	ip_vs_conn_tab_size = t->size;
+	ip_vs_conn_tab_bits = bits;
+
+	write_seqcount_end(&ip_vs_conn_tab_seq);
+	for (idx = 0; idx < CT_LOCKARRAY_SIZE; idx++)
+		spin_unlock(&__ip_vs_conntbl_lock_array[idx].l);
+	local_bh_enable();
+	mutex_unlock(&ip_vs_conn_tab_mutex);
+
+	pr_info("Connection hash table resized (size=%d)\n", t->size);
+
+	synchronize_net();
+	vfree(old);
+	return 0;
+}
+
+static int ip_vs_conn_set_tab_bits(const char *val, struct kernel_param *kp)
+{
+	int bits, rc;
+
+	/* Before the table exists this is just the initial size */
+	if (!rcu_access_pointer(ip_vs_conn_tab))
+		return param_set_int(val, kp);
+
+	rc = kstrtoint(val, 0, &bits);
+	if (rc)
+		return rc;
+
+	return ip_vs_conn_tab_resize(bits);
+}
+
+module_param_call(conn_tab_bits, ip_vs_conn_set_tab_bits, param_get_int,
+		  &ip_vs_conn_tab_bits, 0644);
+MODULE_PARM_DESC(conn_tab_bits, "Set connections' hash size");
+
 /*
  * per netns init and exit
  */
@@ -1403,17 +1568,18 @@ void __net_exit ip_vs_conn_net_cleanup(struct netns_ipvs *ipvs)
 
 int __init ip_vs_conn_init(void)
 {
+	struct ip_vs_conn_htable *t;
 	int idx;
 
-	/* Compute size and mask */
-	ip_vs_conn_tab_size = 1 << ip_vs_conn_tab_bits;
-	ip_vs_conn_tab_mask = ip_vs_conn_tab_size - 1;
+	ip_vs_conn_tab_bits = clamp(ip_vs_conn_tab_bits,
+				    IP_VS_CONN_TAB_MIN_BITS,
+				    IP_VS_CONN_TAB_MAX_BITS);
 
 	/*
 	 * Allocate the connection hash table and initialize its list heads
 	 */
-	ip_vs_conn_tab = vmalloc(ip_vs_conn_tab_size * sizeof(*ip_vs_conn_tab));
-	if (!ip_vs_conn_tab)
+	t = ip_vs_conn_tab_alloc(ip_vs_conn_tab_bits);
+	if (!t)
 		return -ENOMEM;
 
 	/* Allocate ip_vs_conn slab cache */
@@ -1421,10 +1587,11 @@ int __init ip_vs_conn_init(void)
 					      sizeof(struct ip_vs_conn), 0,
 					      SLAB_HWCACHE_ALIGN, NULL);
 	if (!ip_vs_conn_cachep) {
-		vfree(ip_vs_conn_tab);
+		vfree(t);
 		return -ENOMEM;
 	}
 
+	ip_vs_conn_tab_size = t->size;
 	pr_info("Connection hash table configured "
 		"(size=%d, memory=%ldKbytes)\n",
 		ip_vs_conn_tab_size,
@@ -1432,8 +1599,8 @@ int __init ip_vs_conn_init(void)
 	IP_VS_DBG(0, "Each connection entry needs %zd bytes at least\n",
 		  sizeof(struct ip_vs_conn));
 
-	for (idx = 0; idx < ip_vs_conn_tab_size; idx++)
-		INIT_HLIST_HEAD(&ip_vs_conn_tab[idx]);
+	seqcount_init(&ip_vs_conn_tab_seq);
+	rcu_assign_pointer(ip_vs_conn_tab, t);
 
 	for (idx = 0; idx < CT_LOCKARRAY_SIZE; idx++)  {
 		spin_lock_init(&__ip_vs_conntbl_lock_array[idx].l);
@@ -1451,5 +1618,5 @@ void ip_vs_conn_cleanup(void)
 	rcu_barrier();
 	/* Release the empty cache */
 	kmem_cache_destroy(ip_vs_conn_cachep);
-	vfree(ip_vs_conn_tab);
+	vfree(rcu_dereference_protected(ip_vs_conn_tab, 1));
 }
@@ -729,6 +729,9 @@ static void ip_vs_dest_free(struct ip_vs_dest *dest)
 	__ip_vs_dst_cache_reset(dest);
 	__ip_vs_svc_put(svc, false);
 	free_percpu(dest->stats.cpustats);
+	percpu_counter_destroy(&dest->activeconns);
+	percpu_counter_destroy(&dest->inactconns);
+	percpu_counter_destroy(&dest->persistconns);
 	ip_vs_dest_put_and_free(dest);
 }
 
@@ -923,6 +926,13 @@ ip_vs_new_dest(struct ip_vs_service *svc, struct ip_vs_dest_user_kern *udest,
 		u64_stats_init(&ip_vs_dest_stats->syncp);
 	}
 
+	if (percpu_counter_init(&dest->activeconns, 0, GFP_KERNEL))
+		goto err_active;
+	if (percpu_counter_init(&dest->inactconns, 0, GFP_KERNEL))
+		goto err_inact;
+	if (percpu_counter_init(&dest->persistconns, 0, GFP_KERNEL))
+		goto err_persist;
+
 	dest->af = udest->af;
 	dest->protocol = svc->protocol;
 	dest->vaddr = svc->addr;
@@ -931,9 +941,6 @@ ip_vs_new_dest(struct ip_vs_service *svc, struct ip_vs_dest_user_kern *udest,
 	ip_vs_addr_copy(udest->af, &dest->addr, &udest->addr);
 	dest->port = udest->port;
 
-	atomic_set(&dest->activeconns, 0);
-	atomic_set(&dest->inactconns, 0);
-	atomic_set(&dest->persistconns, 0);
 	atomic_set(&dest->refcnt, 1);
 
 	INIT_HLIST_NODE(&dest->d_list);
@@ -946,6 +953,12 @@ ip_vs_new_dest(struct ip_vs_service *svc, struct ip_vs_dest_user_kern *udest,
 	LeaveFunction(2);
 	return 0;
 
+err_persist:
+	percpu_counter_destroy(&dest->inactconns);
+err_inact:
+	percpu_counter_destroy(&dest->activeconns);
+err_active:
+	free_percpu(dest->stats.cpustats);
 err_alloc:
 	kfree(dest);
 	return -ENOMEM;
@@ -2039,7 +2052,7 @@ static int ip_vs_info_seq_show(struct seq_file *seq, void *v)
 	} else {
 		const struct ip_vs_service *svc = v;
 		const struct ip_vs_iter *iter = seq->private;
-		const struct ip_vs_dest *dest;
+		struct ip_vs_dest *dest;
 		struct ip_vs_scheduler *sched = rcu_dereference(svc->scheduler);
 		char *sched_name = sched ? sched->name : "none";
 
@@ -2082,8 +2095,8 @@ static int ip_vs_info_seq_show(struct seq_file *seq, void *v)
 					   ntohs(dest->port),
 					   ip_vs_fwd_name(atomic_read(&dest->conn_flags)),
 					   atomic_read(&dest->weight),
-					   atomic_read(&dest->activeconns),
-					   atomic_read(&dest->inactconns));
+					   ip_vs_dest_conns_sum(&dest->activeconns),
+					   ip_vs_dest_conns_sum(&dest->inactconns));
 			else
 #endif
 				seq_printf(seq,
@@ -2093,8 +2106,8 @@ static int ip_vs_info_seq_show(struct seq_file *seq, void *v)
 					   ntohs(dest->port),
 					   ip_vs_fwd_name(atomic_read(&dest->conn_flags)),
 					   atomic_read(&dest->weight),
-					   atomic_read(&dest->activeconns),
-					   atomic_read(&dest->inactconns));
+					   ip_vs_dest_conns_sum(&dest->activeconns),
+					   ip_vs_dest_conns_sum(&dest->inactconns));
 
 		}
 	}
@@ -2604,9 +2617,9 @@ __ip_vs_get_dest_entries(struct netns_ipvs *ipvs, const struct ip_vs_get_dests *
 			entry.weight = atomic_read(&dest->weight);
 			entry.u_threshold = dest->u_threshold;
 			entry.l_threshold = dest->l_threshold;
-			entry.activeconns = atomic_read(&dest->activeconns);
-			entry.inactconns = atomic_read(&dest->inactconns);
-			entry.persistconns = atomic_read(&dest->persistconns);
+			entry.activeconns = ip_vs_dest_conns_sum(&dest->activeconns);
+			entry.inactconns = ip_vs_dest_conns_sum(&dest->inactconns);
+			entry.persistconns = ip_vs_dest_conns_sum(&dest->persistconns);
 			ip_vs_copy_stats(&kstats, &dest->stats);
 			ip_vs_export_stats_user(&entry.stats, &kstats);
 			if (copy_to_user(&uptr->entrytable[count],
@@ -3193,11 +3206,11 @@ static int ip_vs_genl_fill_dest(struct sk_buff *skb, struct ip_vs_dest *dest)
 	    nla_put_u32(skb, IPVS_DEST_ATTR_U_THRESH, dest->u_threshold) ||
 	    nla_put_u32(skb, IPVS_DEST_ATTR_L_THRESH, dest->l_threshold) ||
 	    nla_put_u32(skb, IPVS_DEST_ATTR_ACTIVE_CONNS,
-			atomic_read(&dest->activeconns)) ||
+			ip_vs_dest_conns_sum(&dest->activeconns)) ||
 	    nla_put_u32(skb, IPVS_DEST_ATTR_INACT_CONNS,
-			atomic_read(&dest->inactconns)) ||
+			ip_vs_dest_conns_sum(&dest->inactconns)) ||
 	    nla_put_u32(skb, IPVS_DEST_ATTR_PERSIST_CONNS,
-			atomic_read(&dest->persistconns)) ||
+			ip_vs_dest_conns_sum(&dest->persistconns)) ||
 	    nla_put_u16(skb, IPVS_DEST_ATTR_ADDR_FAMILY, dest->af))
 		goto nla_put_failure;
 	ip_vs_copy_stats(&kstats, &dest->stats);
@@ -46,7 +46,7 @@ ip_vs_fo_schedule(struct ip_vs_service *svc, const struct sk_buff *skb,
 		IP_VS_DBG_BUF(6, "FO: server %s:%u activeconns %d weight %d\n",
 			      IP_VS_DBG_ADDR(hweight->af, &hweight->addr),
 			      ntohs(hweight->port),
-			      atomic_read(&hweight->activeconns),
+			      ip_vs_dest_conns_read(&hweight->activeconns),
 			      atomic_read(&hweight->weight));
 		return hweight;
 	}
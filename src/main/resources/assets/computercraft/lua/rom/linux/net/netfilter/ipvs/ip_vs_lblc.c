@@ -447,7 +447,7 @@ __ip_vs_lblc_schedule(struct ip_vs_service *svc)
 		      "activeconns %d refcnt %d weight %d overhead %d\n",
 		      IP_VS_DBG_ADDR(least->af, &least->addr),
 		      ntohs(least->port),
-		      atomic_read(&least->activeconns),
+		      ip_vs_dest_conns_read(&least->activeconns),
 		      atomic_read(&least->refcnt),
 		      atomic_read(&least->weight), loh);
 
@@ -462,11 +462,12 @@ __ip_vs_lblc_schedule(struct ip_vs_service *svc)
 static inline int
 is_overloaded(struct ip_vs_dest *dest, struct ip_vs_service *svc)
 {
-	if (atomic_read(&dest->activeconns) > atomic_read(&dest->weight)) {
+	if (ip_vs_dest_conns_read(&dest->activeconns) >
+	    atomic_read(&dest->weight)) {
 		struct ip_vs_dest *d;
 
 		list_for_each_entry_rcu(d, &svc->destinations, n_list) {
-			if (atomic_read(&d->activeconns)*2
+			if (ip_vs_dest_conns_read(&d->activeconns)*2
 			    < atomic_read(&d->weight)) {
 				return 1;
 			}
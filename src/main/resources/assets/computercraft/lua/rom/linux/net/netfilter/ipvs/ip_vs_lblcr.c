@@ -203,7 +203,7 @@ static inline struct ip_vs_dest *ip_vs_dest_set_min(struct ip_vs_dest_set *set)
 		      __func__,
 		      IP_VS_DBG_ADDR(least->af, &least->addr),
 		      ntohs(least->port),
-		      atomic_read(&least->activeconns),
+		      ip_vs_dest_conns_read(&least->activeconns),
 		      atomic_read(&least->refcnt),
 		      atomic_read(&least->weight), loh);
 	return least;
@@ -248,7 +248,7 @@ static inline struct ip_vs_dest *ip_vs_dest_set_max(struct ip_vs_dest_set *set)
 		      "activeconns %d refcnt %d weight %d overhead %d\n",
 		      __func__,
 		      IP_VS_DBG_ADDR(most->af, &most->addr), ntohs(most->port),
-		      atomic_read(&most->activeconns),
+		      ip_vs_dest_conns_read(&most->activeconns),
 		      atomic_read(&most->refcnt),
 		      atomic_read(&most->weight), moh);
 	return most;
@@ -611,7 +611,7 @@ __ip_vs_lblcr_schedule(struct ip_vs_service *svc)
 		      "activeconns %d refcnt %d weight %d overhead %d\n",
 		      IP_VS_DBG_ADDR(least->af, &least->addr),
 		      ntohs(least->port),
-		      atomic_read(&least->activeconns),
+		      ip_vs_dest_conns_read(&least->activeconns),
 		      atomic_read(&least->refcnt),
 		      atomic_read(&least->weight), loh);
 
@@ -626,11 +626,12 @@ __ip_vs_lblcr_schedule(struct ip_vs_service *svc)
 static inline int
 is_overloaded(struct ip_vs_dest *dest, struct ip_vs_service *svc)
 {
-	if (atomic_read(&dest->activeconns) > atomic_read(&dest->weight)) {
+	if (ip_vs_dest_conns_read(&dest->activeconns) >
+	    atomic_read(&dest->weight)) {
 		struct ip_vs_dest *d;
 
 		list_for_each_entry_rcu(d, &svc->destinations, n_list) {
-			if (atomic_read(&d->activeconns)*2
+			if (ip_vs_dest_conns_read(&d->activeconns)*2
 			    < atomic_read(&d->weight)) {
 				return 1;
 			}
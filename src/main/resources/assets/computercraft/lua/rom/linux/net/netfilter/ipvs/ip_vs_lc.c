@@ -61,8 +61,8 @@ ip_vs_lc_schedule(struct ip_vs_service *svc, const struct sk_buff *skb,
 			      "inactconns %d\n",
 			      IP_VS_DBG_ADDR(least->af, &least->addr),
 			      ntohs(least->port),
-			      atomic_read(&least->activeconns),
-			      atomic_read(&least->inactconns));
+			      ip_vs_dest_conns_read(&least->activeconns),
+			      ip_vs_dest_conns_read(&least->inactconns));
 
 	return least;
 }
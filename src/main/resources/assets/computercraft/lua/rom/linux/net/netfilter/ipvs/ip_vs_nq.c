@@ -47,7 +47,7 @@ ip_vs_nq_dest_overhead(struct ip_vs_dest *dest)
 	 * We only use the active connection number in the cost
 	 * calculation here.
 	 */
-	return atomic_read(&dest->activeconns) + 1;
+	return ip_vs_dest_conns_read(&dest->activeconns) + 1;
 }
 
 
@@ -85,7 +85,7 @@ ip_vs_nq_schedule(struct ip_vs_service *svc, const struct sk_buff *skb,
 		doh = ip_vs_nq_dest_overhead(dest);
 
 		/* return the server directly if it is idle */
-		if (atomic_read(&dest->activeconns) == 0) {
+		if (ip_vs_dest_conns_read(&dest->activeconns) == 0) {
 			least = dest;
 			loh = doh;
 			goto out;
@@ -109,7 +109,7 @@ ip_vs_nq_schedule(struct ip_vs_service *svc, const struct sk_buff *skb,
 		      "activeconns %d refcnt %d weight %d overhead %d\n",
 		      IP_VS_DBG_ADDR(least->af, &least->addr),
 		      ntohs(least->port),
-		      atomic_read(&least->activeconns),
+		      ip_vs_dest_conns_read(&least->activeconns),
 		      atomic_read(&least->refcnt),
 		      atomic_read(&least->weight), loh);
 
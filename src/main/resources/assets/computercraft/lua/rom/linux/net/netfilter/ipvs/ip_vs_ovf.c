@@ -40,7 +40,7 @@ ip_vs_ovf_schedule(struct ip_vs_service *svc, const struct sk_buff *skb,
 	list_for_each_entry_rcu(dest, &svc->destinations, n_list) {
 		w = atomic_read(&dest->weight);
 		if ((dest->flags & IP_VS_DEST_F_OVERLOAD) ||
-		    atomic_read(&dest->activeconns) > w ||
+		    ip_vs_dest_conns_read(&dest->activeconns) > w ||
 		    w == 0)
 			continue;
 		if (!h || w > hw) {
@@ -53,7 +53,7 @@ ip_vs_ovf_schedule(struct ip_vs_service *svc, const struct sk_buff *skb,
 		IP_VS_DBG_BUF(6, "OVF: server %s:%u active %d w %d\n",
 			      IP_VS_DBG_ADDR(h->af, &h->addr),
 			      ntohs(h->port),
-			      atomic_read(&h->activeconns),
+			      ip_vs_dest_conns_read(&h->activeconns),
 			      atomic_read(&h->weight));
 		return h;
 	}
@@ -451,13 +451,13 @@ set_sctp_state(struct ip_vs_proto_data *pd, struct ip_vs_conn *cp,
 		if (dest) {
 			if (!(cp->flags & IP_VS_CONN_F_INACTIVE) &&
 				(next_state != IP_VS_SCTP_S_ESTABLISHED)) {
-				atomic_dec(&dest->activeconns);
-				atomic_inc(&dest->inactconns);
+				ip_vs_dest_conns_add(&dest->activeconns, -1);
+				ip_vs_dest_conns_add(&dest->inactconns, 1);
 				cp->flags |= IP_VS_CONN_F_INACTIVE;
 			} else if ((cp->flags & IP_VS_CONN_F_INACTIVE) &&
 				   (next_state == IP_VS_SCTP_S_ESTABLISHED)) {
-				atomic_inc(&dest->activeconns);
-				atomic_dec(&dest->inactconns);
+				ip_vs_dest_conns_add(&dest->activeconns, 1);
+				ip_vs_dest_conns_add(&dest->inactconns, -1);
 				cp->flags &= ~IP_VS_CONN_F_INACTIVE;
 			}
 		}
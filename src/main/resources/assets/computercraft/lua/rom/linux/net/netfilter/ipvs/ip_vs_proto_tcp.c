@@ -562,13 +562,13 @@ set_tcp_state(struct ip_vs_proto_data *pd, struct ip_vs_conn *cp,
 		if (dest) {
 			if (!(cp->flags & IP_VS_CONN_F_INACTIVE) &&
 			    !tcp_state_active(new_state)) {
-				atomic_dec(&dest->activeconns);
-				atomic_inc(&dest->inactconns);
+				ip_vs_dest_conns_add(&dest->activeconns, -1);
+				ip_vs_dest_conns_add(&dest->inactconns, 1);
 				cp->flags |= IP_VS_CONN_F_INACTIVE;
 			} else if ((cp->flags & IP_VS_CONN_F_INACTIVE) &&
 				   tcp_state_active(new_state)) {
-				atomic_inc(&dest->activeconns);
-				atomic_dec(&dest->inactconns);
+				ip_vs_dest_conns_add(&dest->activeconns, 1);
+				ip_vs_dest_conns_add(&dest->inactconns, -1);
 				cp->flags &= ~IP_VS_CONN_F_INACTIVE;
 			}
 		}
@@ -51,7 +51,7 @@ ip_vs_sed_dest_overhead(struct ip_vs_dest *dest)
 	 * We only use the active connection number in the cost
 	 * calculation here.
 	 */
-	return atomic_read(&dest->activeconns) + 1;
+	return ip_vs_dest_conns_read(&dest->activeconns) + 1;
 }
 
 
@@ -110,7 +110,7 @@ ip_vs_sed_schedule(struct ip_vs_service *svc, const struct sk_buff *skb,
 		      "activeconns %d refcnt %d weight %d overhead %d\n",
 		      IP_VS_DBG_ADDR(least->af, &least->addr),
 		      ntohs(least->port),
-		      atomic_read(&least->activeconns),
+		      ip_vs_dest_conns_read(&least->activeconns),
 		      atomic_read(&least->refcnt),
 		      atomic_read(&least->weight), loh);
 
@@ -877,11 +877,11 @@ static void ip_vs_proc_conn(struct netns_ipvs *ipvs, struct ip_vs_conn_param *pa
 		if ((cp->flags ^ flags) & IP_VS_CONN_F_INACTIVE &&
 		    !(flags & IP_VS_CONN_F_TEMPLATE) && dest) {
 			if (flags & IP_VS_CONN_F_INACTIVE) {
-				atomic_dec(&dest->activeconns);
-				atomic_inc(&dest->inactconns);
+				ip_vs_dest_conns_add(&dest->activeconns, -1);
+				ip_vs_dest_conns_add(&dest->inactconns, 1);
 			} else {
-				atomic_inc(&dest->activeconns);
-				atomic_dec(&dest->inactconns);
+				ip_vs_dest_conns_add(&dest->activeconns, 1);
+				ip_vs_dest_conns_add(&dest->inactconns, -1);
 			}
 		}
 		flags &= IP_VS_CONN_F_BACKUP_UPD_MASK;
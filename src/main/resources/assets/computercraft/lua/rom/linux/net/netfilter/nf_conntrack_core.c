@@ -35,6 +35,7 @@
 #include <linux/mm.h>
 #include <linux/nsproxy.h>
 #include <linux/rculist_nulls.h>
+#include <linux/log2.h>
 
 #include <net/netfilter/nf_conntrack.h>
 #include <net/netfilter/nf_conntrack_l3proto.h>
@@ -63,9 +64,12 @@ int (*nfnetlink_parse_nat_setup_hook)(struct nf_conn *ct,
 				      const struct nlattr *attr) __read_mostly;
 EXPORT_SYMBOL_GPL(nfnetlink_parse_nat_setup_hook);
 
-__cacheline_aligned_in_smp spinlock_t nf_conntrack_locks[CONNTRACK_LOCKS];
+spinlock_t *nf_conntrack_locks __read_mostly;
 EXPORT_SYMBOL_GPL(nf_conntrack_locks);
 
+unsigned int nf_conntrack_locks_count __read_mostly;
+EXPORT_SYMBOL_GPL(nf_conntrack_locks_count);
+
 __cacheline_aligned_in_smp DEFINE_SPINLOCK(nf_conntrack_expect_lock);
 EXPORT_SYMBOL_GPL(nf_conntrack_expect_lock);
 
@@ -76,7 +80,9 @@ struct conntrack_gc_work {
 	struct delayed_work	dwork;
 	u32			last_bucket;
 	bool			exiting;
+	bool			early_drop;
 	long			next_gc_run;
+	struct nf_conntrack_gc_stat stat;
 };
 
 static __read_mostly struct kmem_cache *nf_conntrack_cachep;
@@ -90,6 +96,8 @@ static __read_mostly bool nf_conntrack_locks_all;
 #define GC_MAX_SCAN_JIFFIES	(16u * HZ)
 /* desired ratio of entries found to be expired */
 #define GC_EVICT_RATIO	50u
+/* time budget of a single gc cycle */
+#define GC_MAX_RUN_JIFFIES	max(HZ / 100u, 1u)
 
 static struct conntrack_gc_work conntrack_gc_work;
 
@@ -113,8 +121,8 @@ EXPORT_SYMBOL_GPL(nf_conntrack_lock);
 
 static void nf_conntrack_double_unlock(unsigned int h1, unsigned int h2)
 {
-	h1 %= CONNTRACK_LOCKS;
-	h2 %= CONNTRACK_LOCKS;
+	h1 %= nf_conntrack_locks_count;
+	h2 %= nf_conntrack_locks_count;
 	spin_unlock(&nf_conntrack_locks[h1]);
 	if (h1 != h2)
 		spin_unlock(&nf_conntrack_locks[h2]);
@@ -124,8 +132,8 @@ static void nf_conntrack_double_unlock(unsigned int h1, unsigned int h2)
 static bool nf_conntrack_double_lock(struct net *net, unsigned int h1,
 				     unsigned int h2, unsigned int sequence)
 {
-	h1 %= CONNTRACK_LOCKS;
-	h2 %= CONNTRACK_LOCKS;
+	h1 %= nf_conntrack_locks_count;
+	h2 %= nf_conntrack_locks_count;
 	if (h1 <= h2) {
 		nf_conntrack_lock(&nf_conntrack_locks[h1]);
 		if (h1 != h2)
@@ -145,7 +153,7 @@ static bool nf_conntrack_double_lock(struct net *net, unsigned int h1,
 
 static void nf_conntrack_all_lock(void)
 {
-	int i;
+	unsigned int i;
 
 	spin_lock(&nf_conntrack_locks_all_lock);
 	nf_conntrack_locks_all = true;
@@ -158,7 +166,7 @@ static void nf_conntrack_all_lock(void)
 	 */
 	smp_mb(); /* spin_lock(&nf_conntrack_locks_all_lock) */
 
-	for (i = 0; i < CONNTRACK_LOCKS; i++) {
+	for (i = 0; i < nf_conntrack_locks_count; i++) {
 		spin_unlock_wait(&nf_conntrack_locks[i]);
 	}
 }
@@ -891,14 +899,14 @@ EXPORT_SYMBOL_GPL(nf_conntrack_tuple_taken);
 
 #define NF_CT_EVICTION_RANGE	8
 
-/* There's a small race here where we may free a just-assured
-   connection.  Too bad: we're in trouble anyway. */
-static unsigned int early_drop_list(struct net *net,
-				    struct hlist_nulls_head *head)
+/* Keep track of the unassured entry in @head closest to timing out */
+static struct nf_conn *early_drop_sample(struct net *net,
+					 struct hlist_nulls_head *head,
+					 struct nf_conn *victim,
+					 unsigned long *victim_expires)
 {
 	struct nf_conntrack_tuple_hash *h;
 	struct hlist_nulls_node *n;
-	unsigned int drops = 0;
 	struct nf_conn *tmp;
 
 	hlist_nulls_for_each_entry_rcu(h, n, head, hnnode) {
@@ -914,63 +922,102 @@ static unsigned int early_drop_list(struct net *net,
 		    nf_ct_is_dying(tmp))
 			continue;
 
-		if (!atomic_inc_not_zero(&tmp->ct_general.use))
-			continue;
-
-		/* kill only if still in same netns -- might have moved due to
-		 * SLAB_DESTROY_BY_RCU rules.
-		 *
-		 * We steal the timer reference.  If that fails timer has
-		 * already fired or someone else deleted it. Just drop ref
-		 * and move to next entry.
-		 */
-		if (net_eq(nf_ct_net(tmp), net) &&
-		    nf_ct_is_confirmed(tmp) &&
-		    nf_ct_delete(tmp, 0, 0))
-			drops++;
-
-		nf_ct_put(tmp);
+		if (!victim || nf_ct_expires(tmp) < *victim_expires) {
+			victim = tmp;
+			*victim_expires = nf_ct_expires(tmp);
+		}
 	}
 
-	return drops;
+	return victim;
 }
 
+/* Sample NF_CT_EVICTION_RANGE buckets spread over the whole table and
+ * drop the unassured entry with the least time left.  Neighbouring
+ * buckets of the new entry are no better than any others, and a flood
+ * hashing to one area would otherwise only ever evict its own entries.
+ *
+ * There's a small race here where we may free a just-assured
+ * connection.  Too bad: we're in trouble anyway.
+ */
 static noinline int early_drop(struct net *net, unsigned int _hash)
 {
-	unsigned int i;
+	unsigned long victim_expires = 0;
+	struct hlist_nulls_head *ct_hash;
+	struct nf_conn *victim = NULL;
+	unsigned int i, hash, hsize;
+	bool dropped = false;
+
+	rcu_read_lock();
+	nf_conntrack_get_ht(&ct_hash, &hsize);
 
 	for (i = 0; i < NF_CT_EVICTION_RANGE; i++) {
-		struct hlist_nulls_head *ct_hash;
-		unsigned int hash, hsize, drops;
+		hash = reciprocal_scale(_hash + i * (U32_MAX / NF_CT_EVICTION_RANGE),
+					hsize);
+		victim = early_drop_sample(net, &ct_hash[hash], victim,
+					   &victim_expires);
+	}
 
-		rcu_read_lock();
-		nf_conntrack_get_ht(&ct_hash, &hsize);
-		hash = reciprocal_scale(_hash++, hsize);
+	/* kill only if still in same netns and unassured -- might have been
+	 * reused due to SLAB_DESTROY_BY_RCU rules.
+	 *
+	 * We steal the timer reference.  If that fails timer has
+	 * already fired or someone else deleted it.
+	 */
+	if (victim && atomic_inc_not_zero(&victim->ct_general.use)) {
+		if (net_eq(nf_ct_net(victim), net) &&
+		    nf_ct_is_confirmed(victim) &&
+		    !test_bit(IPS_ASSURED_BIT, &victim->status) &&
+		    nf_ct_delete(victim, 0, 0))
+			dropped = true;
+
+		nf_ct_put(victim);
+	}
+	rcu_read_unlock();
 
-		drops = early_drop_list(net, &ct_hash[hash]);
-		rcu_read_unlock();
+	if (dropped) {
+		NF_CT_STAT_INC_ATOMIC(net, early_drop);
+		return true;
+	}
 
-		if (drops) {
-			NF_CT_STAT_ADD_ATOMIC(net, early_drop, drops);
-			return true;
-		}
+	/* Nothing to drop in the sample, have the gc worker sweep the table
+	 * for unassured entries as soon as possible.
+	 */
+	if (!READ_ONCE(conntrack_gc_work.early_drop)) {
+		WRITE_ONCE(conntrack_gc_work.early_drop, true);
+		mod_delayed_work(system_long_wq, &conntrack_gc_work.dwork, 0);
 	}
 
 	return false;
 }
 
+static bool gc_worker_can_early_drop(const struct nf_conn *ct)
+{
+	return !test_bit(IPS_ASSURED_BIT, &ct->status) &&
+	       nf_ct_is_confirmed(ct) && !nf_ct_is_dying(ct);
+}
+
 static void gc_worker(struct work_struct *work)
 {
 	unsigned int min_interval = max(HZ / GC_MAX_BUCKETS_DIV, 1u);
 	unsigned int i, goal, buckets = 0, expired_count = 0;
+	unsigned int early_drops = 0, max95 = 0;
 	struct conntrack_gc_work *gc_work;
 	unsigned int ratio, scanned = 0;
-	unsigned long next_run;
+	unsigned long next_run, end_time;
+	bool early_drop;
 
 	gc_work = container_of(work, struct conntrack_gc_work, dwork.work);
 
 	goal = nf_conntrack_htable_size / GC_MAX_BUCKETS_DIV;
 	i = gc_work->last_bucket;
+	end_time = jiffies + GC_MAX_RUN_JIFFIES;
+
+	/* Set again by early_drop() if the table is still full afterwards */
+	early_drop = READ_ONCE(gc_work->early_drop);
+	if (early_drop) {
+		WRITE_ONCE(gc_work->early_drop, false);
+		max95 = nf_conntrack_max / 100u * 95u;
+	}
 
 	do {
 		struct nf_conntrack_tuple_hash *h;
@@ -987,6 +1034,8 @@ static void gc_worker(struct work_struct *work)
 			i = 0;
 
 		hlist_nulls_for_each_entry_rcu(h, n, &ct_hash[i], hnnode) {
+			struct net *net;
+
 			tmp = nf_ct_tuplehash_to_ctrack(h);
 
 			scanned++;
@@ -995,6 +1044,26 @@ static void gc_worker(struct work_struct *work)
 				expired_count++;
 				continue;
 			}
+
+			if (!max95 || !gc_worker_can_early_drop(tmp))
+				continue;
+
+			net = nf_ct_net(tmp);
+			if (atomic_read(&net->ct.count) < max95)
+				continue;
+
+			/* need to take reference to avoid possible races */
+			if (!atomic_inc_not_zero(&tmp->ct_general.use))
+				continue;
+
+			if (net_eq(nf_ct_net(tmp), net) &&
+			    gc_worker_can_early_drop(tmp) &&
+			    nf_ct_delete(tmp, 0, 0)) {
+				NF_CT_STAT_INC_ATOMIC(net, early_drop);
+				early_drops++;
+			}
+
+			nf_ct_put(tmp);
 		}
 
 		/* could check get_nulls_value() here and restart if ct
@@ -1003,7 +1072,7 @@ static void gc_worker(struct work_struct *work)
 		 */
 		rcu_read_unlock();
 		cond_resched_rcu_qs();
-	} while (++buckets < goal);
+	} while (++buckets < goal && !time_after(jiffies, end_time));
 
 	if (gc_work->exiting)
 		return;
@@ -1013,20 +1082,23 @@ static void gc_worker(struct work_struct *work)
 	 * from this gc worker.
 	 *
 	 * This worker is only here to reap expired entries when system went
-	 * idle after a busy period.
+	 * idle after a busy period, and to help early_drop() out when the
+	 * table is full.
 	 *
 	 * The heuristics below are supposed to balance conflicting goals:
 	 *
 	 * 1. Minimize time until we notice a stale entry
 	 * 2. Maximize scan intervals to not waste cycles
+	 * 3. Don't hog the cpu on very large tables
 	 *
 	 * Normally, expire ratio will be close to 0.
 	 *
-	 * As soon as a sizeable fraction of the entries have expired
-	 * increase scan frequency.
+	 * As soon as a sizeable fraction of the entries have expired, the
+	 * table was found full, or the scan ran out of time before the goal
+	 * was reached, increase scan frequency.
 	 */
 	ratio = scanned ? expired_count * 100 / scanned : 0;
-	if (ratio > GC_EVICT_RATIO) {
+	if (ratio > GC_EVICT_RATIO || early_drop || buckets < goal) {
 		gc_work->next_gc_run = min_interval;
 	} else {
 		unsigned int max = GC_MAX_SCAN_JIFFIES / GC_MAX_BUCKETS_DIV;
@@ -1040,14 +1112,33 @@ static void gc_worker(struct work_struct *work)
 
 	next_run = gc_work->next_gc_run;
 	gc_work->last_bucket = i;
+
+	gc_work->stat.runs++;
+	gc_work->stat.scanned += scanned;
+	gc_work->stat.expired += expired_count;
+	gc_work->stat.early_drop += early_drops;
+	gc_work->stat.interval = next_run;
+
 	queue_delayed_work(system_long_wq, &gc_work->dwork, next_run);
 }
 
+void nf_conntrack_gc_stat_get(struct nf_conntrack_gc_stat *st)
+{
+	const struct nf_conntrack_gc_stat *gc = &conntrack_gc_work.stat;
+
+	st->runs	= READ_ONCE(gc->runs);
+	st->scanned	= READ_ONCE(gc->scanned);
+	st->expired	= READ_ONCE(gc->expired);
+	st->early_drop	= READ_ONCE(gc->early_drop);
+	st->interval	= READ_ONCE(gc->interval);
+}
+
 static void conntrack_gc_work_init(struct conntrack_gc_work *gc_work)
 {
 	INIT_DELAYED_WORK(&gc_work->dwork, gc_worker);
 	gc_work->next_gc_run = HZ;
 	gc_work->exiting = false;
+	gc_work->early_drop = false;
 }
 
 static struct nf_conn *
@@ -1559,7 +1650,7 @@ get_next_corpse(struct net *net, int (*iter)(struct nf_conn *i, void *data),
 	spinlock_t *lockp;
 
 	for (; *bucket < nf_conntrack_htable_size; (*bucket)++) {
-		lockp = &nf_conntrack_locks[*bucket % CONNTRACK_LOCKS];
+		lockp = nf_conntrack_bucket_lock(*bucket);
 		local_bh_disable();
 		nf_conntrack_lock(lockp);
 		if (*bucket < nf_conntrack_htable_size) {
@@ -1660,6 +1751,7 @@ void nf_conntrack_cleanup_end(void)
 
 	cancel_delayed_work_sync(&conntrack_gc_work.dwork);
 	nf_ct_free_hashtable(nf_conntrack_hash, nf_conntrack_htable_size);
+	kvfree(nf_conntrack_locks);
 
 	nf_conntrack_proto_fini();
 	nf_conntrack_seqadj_fini();
@@ -1839,17 +1931,40 @@ void nf_ct_untracked_status_or(unsigned long bits)
 }
 EXPORT_SYMBOL_GPL(nf_ct_untracked_status_or);
 
+/* One lock per CONNTRACK_LOCKS_BUCKETS buckets of the initial table.  The
+ * array is not resized along with the hash: lock holders index it without
+ * any other synchronisation, and the count only spreads contention.
+ */
+static int nf_conntrack_alloc_locks(unsigned int hsize)
+{
+	unsigned int i, count;
+
+	count = roundup_pow_of_two(max(hsize / CONNTRACK_LOCKS_BUCKETS, 1u));
+	count = clamp_t(unsigned int, count,
+			CONNTRACK_LOCKS_MIN, CONNTRACK_LOCKS_MAX);
+
+	nf_conntrack_locks = kmalloc_array(count, sizeof(spinlock_t),
+					   GFP_KERNEL | __GFP_NOWARN);
+	if (!nf_conntrack_locks)
+		nf_conntrack_locks = vmalloc(count * sizeof(spinlock_t));
+	if (!nf_conntrack_locks)
+		return -ENOMEM;
+
+	for (i = 0; i < count; i++)
+		spin_lock_init(&nf_conntrack_locks[i]);
+
+	nf_conntrack_locks_count = count;
+	return 0;
+}
+
 int nf_conntrack_init_start(void)
 {
 	int max_factor = 8;
 	int ret = -ENOMEM;
-	int i, cpu;
+	int cpu;
 
 	seqcount_init(&nf_conntrack_generation);
 
-	for (i = 0; i < CONNTRACK_LOCKS; i++)
-		spin_lock_init(&nf_conntrack_locks[i]);
-
 	if (!nf_conntrack_htable_size) {
 		/* Idea from tcp.c: use 1/16384 of memory.
 		 * On i386: 32MB machine has 512 buckets.
@@ -1873,9 +1988,12 @@ int nf_conntrack_init_start(void)
 		max_factor = 4;
 	}
 
+	if (nf_conntrack_alloc_locks(nf_conntrack_htable_size) < 0)
+		return -ENOMEM;
+
 	nf_conntrack_hash = nf_ct_alloc_hashtable(&nf_conntrack_htable_size, 1);
 	if (!nf_conntrack_hash)
-		return -ENOMEM;
+		goto err_hash;
 
 	nf_conntrack_max = max_factor * nf_conntrack_htable_size;
 
@@ -1886,9 +2004,9 @@ int nf_conntrack_init_start(void)
 	if (!nf_conntrack_cachep)
 		goto err_cachep;
 
-	printk(KERN_INFO "nf_conntrack version %s (%u buckets, %d max)\n",
+	printk(KERN_INFO "nf_conntrack version %s (%u buckets, %d max, %u locks)\n",
 	       NF_CONNTRACK_VERSION, nf_conntrack_htable_size,
-	       nf_conntrack_max);
+	       nf_conntrack_max, nf_conntrack_locks_count);
 
 	ret = nf_conntrack_expect_init();
 	if (ret < 0)
@@ -1960,6 +2078,8 @@ err_expect:
 	kmem_cache_destroy(nf_conntrack_cachep);
 err_cachep:
 	nf_ct_free_hashtable(nf_conntrack_hash, nf_conntrack_htable_size);
+err_hash:
+	kvfree(nf_conntrack_locks);
 	return ret;
 }
 
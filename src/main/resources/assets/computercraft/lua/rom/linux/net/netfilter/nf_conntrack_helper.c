@@ -473,7 +473,7 @@ void nf_conntrack_helper_unregister(struct nf_conntrack_helper *me)
 restart:
 	last_hsize = nf_conntrack_htable_size;
 	for (i = 0; i < last_hsize; i++) {
-		lock = &nf_conntrack_locks[i % CONNTRACK_LOCKS];
+		lock = nf_conntrack_bucket_lock(i);
 		nf_conntrack_lock(lock);
 		if (last_hsize != nf_conntrack_htable_size) {
 			spin_unlock(lock);
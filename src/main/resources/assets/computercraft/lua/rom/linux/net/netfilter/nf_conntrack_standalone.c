@@ -399,6 +399,38 @@ static const struct file_operations ct_cpu_seq_fops = {
 	.release = seq_release_net,
 };
 
+/* The hash table, its locks and the gc worker are shared by all netns */
+static int ct_gc_seq_show(struct seq_file *seq, void *v)
+{
+	struct nf_conntrack_gc_stat st;
+
+	nf_conntrack_gc_stat_get(&st);
+
+	seq_printf(seq, "buckets  locks    runs     scanned  expired  early_drop interval\n");
+	seq_printf(seq, "%08x %08x %08lx %08lx %08lx %08lx   %08lx\n",
+		   nf_conntrack_htable_size,
+		   nf_conntrack_locks_count,
+		   st.runs,
+		   st.scanned,
+		   st.expired,
+		   st.early_drop,
+		   st.interval);
+	return 0;
+}
+
+static int ct_gc_seq_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, ct_gc_seq_show, NULL);
+}
+
+static const struct file_operations ct_gc_seq_fops = {
+	.owner	 = THIS_MODULE,
+	.open	 = ct_gc_seq_open,
+	.read	 = seq_read,
+	.llseek	 = seq_lseek,
+	.release = single_release,
+};
+
 static int nf_conntrack_standalone_init_proc(struct net *net)
 {
 	struct proc_dir_entry *pde;
@@ -418,8 +450,17 @@ static int nf_conntrack_standalone_init_proc(struct net *net)
 			  &ct_cpu_seq_fops);
 	if (!pde)
 		goto out_stat_nf_conntrack;
+
+	if (net_eq(net, &init_net)) {
+		pde = proc_create("nf_conntrack_gc", S_IRUGO,
+				  net->proc_net_stat, &ct_gc_seq_fops);
+		if (!pde)
+			goto out_stat_nf_conntrack_gc;
+	}
 	return 0;
 
+out_stat_nf_conntrack_gc:
+	remove_proc_entry("nf_conntrack", net->proc_net_stat);
 out_stat_nf_conntrack:
 	remove_proc_entry("nf_conntrack", net->proc_net);
 out_nf_conntrack:
@@ -428,6 +469,8 @@ out_nf_conntrack:
 
 static void nf_conntrack_standalone_fini_proc(struct net *net)
 {
+	if (net_eq(net, &init_net))
+		remove_proc_entry("nf_conntrack_gc", net->proc_net_stat);
 	remove_proc_entry("nf_conntrack", net->proc_net_stat);
 	remove_proc_entry("nf_conntrack", net->proc_net);
 }
@@ -0,0 +1,349 @@
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/netfilter.h>
+#include <linux/rhashtable.h>
+#include <linux/netdevice.h>
+#include <net/netns/generic.h>
+#include <net/netfilter/nf_flow_table.h>
+#include <net/netfilter/nf_conntrack.h>
+#include <net/netfilter/nf_conntrack_core.h>
+#include <net/netfilter/nf_conntrack_l4proto.h>
+#include <net/netfilter/nf_conntrack_tuple.h>
+
+static unsigned int nf_flow_table_net_id __read_mostly;
+
+static const struct rhashtable_params nf_flow_offload_rhash_params = {
+	.head_offset		= offsetof(struct flow_offload_tuple_rhash, node),
+	.key_offset		= offsetof(struct flow_offload_tuple_rhash, tuple),
+	.key_len		= offsetof(struct flow_offload_tuple, dir),
+	.automatic_shrinking	= true,
+};
+
+static void
+flow_offload_fill_dir(struct flow_offload *flow, struct nf_conn *ct,
+		      struct nf_flow_route *route,
+		      enum flow_offload_tuple_dir dir)
+{
+	struct flow_offload_tuple *ft = &flow->tuplehash[dir].tuple;
+	struct nf_conntrack_tuple *ctt = &ct->tuplehash[dir].tuple;
+
+	ft->dir = dir;
+	ft->src_v4 = ctt->src.u3.in;
+	ft->dst_v4 = ctt->dst.u3.in;
+	ft->l3proto = ctt->src.l3num;
+	ft->l4proto = ctt->dst.protonum;
+	ft->src_port = ctt->src.u.tcp.port;
+	ft->dst_port = ctt->dst.u.tcp.port;
+
+	ft->iifidx = route->tuple[dir].ifindex;
+	ft->oifidx = route->tuple[!dir].ifindex;
+	ft->dst_cache = route->tuple[dir].dst;
+}
+
+/* Takes a reference to the conntrack entry and both routes */
+struct flow_offload *
+flow_offload_alloc(struct nf_conn *ct, struct nf_flow_route *route)
+{
+	struct flow_offload *flow;
+
+	if (unlikely(nf_ct_is_dying(ct) ||
+		     !atomic_inc_not_zero(&ct->ct_general.use)))
+		return NULL;
+
+	flow = kzalloc(sizeof(*flow), GFP_ATOMIC);
+	if (!flow)
+		goto err_ct_refcnt;
+
+	dst_hold(route->tuple[FLOW_OFFLOAD_DIR_ORIGINAL].dst);
+	dst_hold(route->tuple[FLOW_OFFLOAD_DIR_REPLY].dst);
+
+	flow->ct = ct;
+	flow_offload_fill_dir(flow, ct, route, FLOW_OFFLOAD_DIR_ORIGINAL);
+	flow_offload_fill_dir(flow, ct, route, FLOW_OFFLOAD_DIR_REPLY);
+
+	if (ct->status & IPS_SRC_NAT)
+		flow->flags |= FLOW_OFFLOAD_SNAT;
+	if (ct->status & IPS_DST_NAT)
+		flow->flags |= FLOW_OFFLOAD_DNAT;
+
+	return flow;
+
+err_ct_refcnt:
+	nf_ct_put(ct);
+	return NULL;
+}
+EXPORT_SYMBOL_GPL(flow_offload_alloc);
+
+static void flow_offload_free_rcu(struct rcu_head *head)
+{
+	struct flow_offload *flow;
+
+	flow = container_of(head, struct flow_offload, rcu_head);
+	dst_release(flow->tuplehash[FLOW_OFFLOAD_DIR_ORIGINAL].tuple.dst_cache);
+	dst_release(flow->tuplehash[FLOW_OFFLOAD_DIR_REPLY].tuple.dst_cache);
+	nf_ct_put(flow->ct);
+	kfree(flow);
+}
+
+void flow_offload_free(struct flow_offload *flow)
+{
+	call_rcu(&flow->rcu_head, flow_offload_free_rcu);
+}
+EXPORT_SYMBOL_GPL(flow_offload_free);
+
+int flow_offload_add(struct nf_flowtable *flow_table, struct flow_offload *flow)
+{
+	int err;
+
+	flow->timeout = nf_flowtable_time_stamp + NF_FLOW_TIMEOUT;
+
+	err = rhashtable_lookup_insert_fast(&flow_table->rhashtable,
+			&flow->tuplehash[FLOW_OFFLOAD_DIR_ORIGINAL].node,
+			nf_flow_offload_rhash_params);
+	if (err < 0)
+		return err;
+
+	err = rhashtable_lookup_insert_fast(&flow_table->rhashtable,
+			&flow->tuplehash[FLOW_OFFLOAD_DIR_REPLY].node,
+			nf_flow_offload_rhash_params);
+	if (err < 0) {
+		rhashtable_remove_fast(&flow_table->rhashtable,
+				&flow->tuplehash[FLOW_OFFLOAD_DIR_ORIGINAL].node,
+				nf_flow_offload_rhash_params);
+		return err;
+	}
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(flow_offload_add);
+
+/* Hand the connection back to the slow path: conntrack stopped seeing its
+ * packets, so give it a full timeout and let TCP window tracking pick up
+ * the sequence numbers again.
+ */
+static void flow_offload_fixup_ct(struct nf_conn *ct)
+{
+	const struct nf_conntrack_l4proto *l4proto;
+	unsigned int *timeouts;
+	unsigned int timeout;
+
+	rcu_read_lock();
+	l4proto = __nf_ct_l4proto_find(nf_ct_l3num(ct), nf_ct_protonum(ct));
+	timeouts = l4proto->get_timeouts(nf_ct_net(ct));
+	rcu_read_unlock();
+
+	if (nf_ct_protonum(ct) == IPPROTO_TCP) {
+		spin_lock_bh(&ct->lock);
+		ct->proto.tcp.seen[0].td_maxwin = 0;
+		ct->proto.tcp.seen[1].td_maxwin = 0;
+		spin_unlock_bh(&ct->lock);
+		timeout = timeouts[TCP_CONNTRACK_ESTABLISHED];
+	} else {
+		timeout = timeouts[UDP_CT_REPLIED];
+	}
+
+	ct->timeout = nfct_time_stamp + timeout;
+}
+
+static void flow_offload_del(struct nf_flowtable *flow_table,
+			     struct flow_offload *flow)
+{
+	rhashtable_remove_fast(&flow_table->rhashtable,
+			       &flow->tuplehash[FLOW_OFFLOAD_DIR_ORIGINAL].node,
+			       nf_flow_offload_rhash_params);
+	rhashtable_remove_fast(&flow_table->rhashtable,
+			       &flow->tuplehash[FLOW_OFFLOAD_DIR_REPLY].node,
+			       nf_flow_offload_rhash_params);
+
+	if (!nf_ct_is_dying(flow->ct))
+		flow_offload_fixup_ct(flow->ct);
+
+	flow_offload_free(flow);
+}
+
+/* Stop using the fast path for this flow, the gc removes it on its next run */
+void flow_offload_teardown(struct flow_offload *flow)
+{
+	flow->flags |= FLOW_OFFLOAD_TEARDOWN;
+}
+EXPORT_SYMBOL_GPL(flow_offload_teardown);
+
+struct flow_offload_tuple_rhash *
+flow_offload_lookup(struct nf_flowtable *flow_table,
+		    struct flow_offload_tuple *tuple)
+{
+	struct flow_offload_tuple_rhash *tuplehash;
+	struct flow_offload *flow;
+	int dir;
+
+	tuplehash = rhashtable_lookup_fast(&flow_table->rhashtable, tuple,
+					   nf_flow_offload_rhash_params);
+	if (!tuplehash)
+		return NULL;
+
+	dir = tuplehash->tuple.dir;
+	flow = container_of(tuplehash, struct flow_offload, tuplehash[dir]);
+	if (flow->flags & (FLOW_OFFLOAD_DYING | FLOW_OFFLOAD_TEARDOWN))
+		return NULL;
+
+	return tuplehash;
+}
+EXPORT_SYMBOL_GPL(flow_offload_lookup);
+
+static void nf_flow_offload_gc_step(struct nf_flowtable *flow_table,
+				    bool flush)
+{
+	struct flow_offload_tuple_rhash *tuplehash;
+	struct rhashtable_iter hti;
+	struct flow_offload *flow;
+	int err;
+
+	rhashtable_walk_enter(&flow_table->rhashtable, &hti);
+	err = rhashtable_walk_start(&hti);
+	if (err && err != -EAGAIN)
+		goto out;
+
+	while ((tuplehash = rhashtable_walk_next(&hti))) {
+		if (IS_ERR(tuplehash)) {
+			if (PTR_ERR(tuplehash) == -EAGAIN)
+				continue;
+			break;
+		}
+		/* Each flow is in the table twice, handle it once */
+		if (tuplehash->tuple.dir)
+			continue;
+
+		flow = container_of(tuplehash, struct flow_offload, tuplehash[0]);
+
+		if (flush || nf_flow_has_expired(flow) ||
+		    nf_ct_is_dying(flow->ct) ||
+		    (flow->flags & (FLOW_OFFLOAD_DYING |
+				    FLOW_OFFLOAD_TEARDOWN)))
+			flow_offload_del(flow_table, flow);
+		else
+			/* Conntrack sees none of the packets, keep it alive */
+			flow->ct->timeout = nfct_time_stamp + NF_FLOW_TIMEOUT;
+	}
+out:
+	rhashtable_walk_stop(&hti);
+	rhashtable_walk_exit(&hti);
+}
+
+static void nf_flow_offload_work_gc(struct work_struct *work)
+{
+	struct nf_flowtable *flow_table;
+
+	flow_table = container_of(work, struct nf_flowtable, gc_work.work);
+	nf_flow_offload_gc_step(flow_table, false);
+	queue_delayed_work(system_power_efficient_wq, &flow_table->gc_work, HZ);
+}
+
+struct nf_flowtable *nf_flow_table_get(struct net *net)
+{
+	return net_generic(net, nf_flow_table_net_id);
+}
+EXPORT_SYMBOL_GPL(nf_flow_table_get);
+
+static int nf_flow_table_dev_event(struct notifier_block *this,
+				   unsigned long event, void *ptr)
+{
+	struct net_device *dev = netdev_notifier_info_to_dev(ptr);
+	struct flow_offload_tuple_rhash *tuplehash;
+	struct nf_flowtable *flow_table;
+	struct rhashtable_iter hti;
+	struct flow_offload *flow;
+
+	if (event != NETDEV_DOWN)
+		return NOTIFY_DONE;
+
+	flow_table = nf_flow_table_get(dev_net(dev));
+
+	rhashtable_walk_enter(&flow_table->rhashtable, &hti);
+	rhashtable_walk_start(&hti);
+	while ((tuplehash = rhashtable_walk_next(&hti))) {
+		if (IS_ERR(tuplehash))
+			continue;
+
+		flow = container_of(tuplehash, struct flow_offload,
+				    tuplehash[tuplehash->tuple.dir]);
+		if (tuplehash->tuple.iifidx == dev->ifindex ||
+		    tuplehash->tuple.oifidx == dev->ifindex)
+			flow_offload_teardown(flow);
+	}
+	rhashtable_walk_stop(&hti);
+	rhashtable_walk_exit(&hti);
+
+	/* Drop the routes through this device before it goes away */
+	mod_delayed_work(system_power_efficient_wq, &flow_table->gc_work, 0);
+	flush_delayed_work(&flow_table->gc_work);
+
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block nf_flow_table_notifier = {
+	.notifier_call	= nf_flow_table_dev_event,
+};
+
+static int __net_init nf_flow_table_net_init(struct net *net)
+{
+	struct nf_flowtable *flow_table = nf_flow_table_get(net);
+	int err;
+
+	err = rhashtable_init(&flow_table->rhashtable,
+			      &nf_flow_offload_rhash_params);
+	if (err < 0)
+		return err;
+
+	INIT_DEFERRABLE_WORK(&flow_table->gc_work, nf_flow_offload_work_gc);
+	queue_delayed_work(system_power_efficient_wq, &flow_table->gc_work, HZ);
+	return 0;
+}
+
+static void __net_exit nf_flow_table_net_exit(struct net *net)
+{
+	struct nf_flowtable *flow_table = nf_flow_table_get(net);
+
+	cancel_delayed_work_sync(&flow_table->gc_work);
+	nf_flow_offload_gc_step(flow_table, true);
+	rhashtable_destroy(&flow_table->rhashtable);
+}
+
+static struct pernet_operations nf_flow_table_net_ops = {
+	.init	= nf_flow_table_net_init,
+	.exit	= nf_flow_table_net_exit,
+	.id	= &nf_flow_table_net_id,
+	.size	= sizeof(struct nf_flowtable),
+};
+
+static int __init nf_flow_table_module_init(void)
+{
+	int err;
+
+	err = register_pernet_subsys(&nf_flow_table_net_ops);
+	if (err < 0)
+		return err;
+
+	err = register_netdevice_notifier(&nf_flow_table_notifier);
+	if (err < 0)
+		goto err_notifier;
+
+	return 0;
+
+err_notifier:
+	unregister_pernet_subsys(&nf_flow_table_net_ops);
+	return err;
+}
+
+static void __exit nf_flow_table_module_exit(void)
+{
+	unregister_netdevice_notifier(&nf_flow_table_notifier);
+	unregister_pernet_subsys(&nf_flow_table_net_ops);
+	/* Wait for flow_offload_free_rcu() */
+	rcu_barrier();
+}
+
+module_init(nf_flow_table_module_init);
+module_exit(nf_flow_table_module_exit);
+
+MODULE_LICENSE("GPL");
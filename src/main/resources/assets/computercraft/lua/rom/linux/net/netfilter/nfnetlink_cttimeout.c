@@ -317,7 +317,7 @@ static void ctnl_untimeout(struct net *net, struct ctnl_timeout *timeout)
 restart:
 	last_hsize = nf_conntrack_htable_size;
 	for (i = 0; i < last_hsize; i++) {
-		lock = &nf_conntrack_locks[i % CONNTRACK_LOCKS];
+		lock = nf_conntrack_bucket_lock(i);
 		nf_conntrack_lock(lock);
 		if (last_hsize != nf_conntrack_htable_size) {
 			spin_unlock(lock);
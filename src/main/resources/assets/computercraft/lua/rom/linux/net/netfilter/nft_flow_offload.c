@@ -0,0 +1,228 @@
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/netlink.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter/nf_tables.h>
+#include <net/ip.h>
+#include <net/netfilter/nf_tables.h>
+#include <net/netfilter/nf_flow_table.h>
+#include <net/netfilter/nf_conntrack.h>
+#include <net/netfilter/nf_conntrack_core.h>
+#include <net/netfilter/nf_conntrack_helper.h>
+
+/*
+ * "flow_offload" goes into a forward chain and moves established
+ * connections to the flow table of the netns; "flow_forward" goes into a
+ * netdev ingress chain of the devices involved and forwards the packets of
+ * those flows without going through the inet hooks.
+ */
+
+static int nft_flow_route(const struct nft_pktinfo *pkt,
+			  const struct nf_conn *ct,
+			  struct nf_flow_route *route,
+			  enum ip_conntrack_dir dir)
+{
+	struct dst_entry *this_dst = skb_dst(pkt->skb);
+	struct dst_entry *other_dst = NULL;
+	const struct nf_afinfo *ai;
+	struct flowi fl;
+
+	memset(&fl, 0, sizeof(fl));
+	fl.u.ip4.daddr = ct->tuplehash[dir].tuple.src.u3.ip;
+
+	ai = nf_get_afinfo(NFPROTO_IPV4);
+	if (!ai)
+		return -ENOENT;
+
+	ai->route(nft_net(pkt), &other_dst, &fl, false);
+	if (!other_dst)
+		return -ENOENT;
+
+	route->tuple[dir].dst		= this_dst;
+	route->tuple[dir].ifindex	= nft_in(pkt)->ifindex;
+	route->tuple[!dir].dst		= other_dst;
+	route->tuple[!dir].ifindex	= this_dst->dev->ifindex;
+
+	return 0;
+}
+
+static bool nft_flow_offload_skip(struct nf_conn *ct,
+				  enum ip_conntrack_info ctinfo)
+{
+	if (ctinfo != IP_CT_ESTABLISHED && ctinfo != IP_CT_ESTABLISHED_REPLY)
+		return true;
+
+	/* Helpers need to see the payload */
+	if (nfct_help(ct))
+		return true;
+
+	switch (nf_ct_protonum(ct)) {
+	case IPPROTO_TCP:
+		return ct->proto.tcp.state != TCP_CONNTRACK_ESTABLISHED;
+	case IPPROTO_UDP:
+		return false;
+	}
+	return true;
+}
+
+static void nft_flow_offload_eval(const struct nft_expr *expr,
+				  struct nft_regs *regs,
+				  const struct nft_pktinfo *pkt)
+{
+	struct nf_flowtable *flow_table = nf_flow_table_get(nft_net(pkt));
+	enum ip_conntrack_info ctinfo;
+	struct nf_flow_route route;
+	struct flow_offload *flow;
+	enum ip_conntrack_dir dir;
+	struct nf_conn *ct;
+
+	if (nft_pf(pkt) != NFPROTO_IPV4)
+		goto out;
+
+	ct = nf_ct_get(pkt->skb, &ctinfo);
+	if (!ct || nft_flow_offload_skip(ct, ctinfo))
+		goto out;
+
+	dir = CTINFO2DIR(ctinfo);
+	if (nft_flow_route(pkt, ct, &route, dir) < 0)
+		goto out;
+
+	flow = flow_offload_alloc(ct, &route);
+	if (!flow)
+		goto err_flow_alloc;
+
+	/* -EEXIST if the flow is already offloaded */
+	if (flow_offload_add(flow_table, flow) < 0)
+		goto err_flow_add;
+
+	dst_release(route.tuple[!dir].dst);
+	return;
+
+err_flow_add:
+	flow_offload_free(flow);
+err_flow_alloc:
+	dst_release(route.tuple[!dir].dst);
+out:
+	regs->verdict.code = NFT_BREAK;
+}
+
+static int nft_flow_offload_validate(const struct nft_ctx *ctx,
+				     const struct nft_expr *expr,
+				     const struct nft_data **data)
+{
+	return nft_chain_validate_hooks(ctx->chain, (1 << NF_INET_FORWARD));
+}
+
+static int nft_flow_offload_init(const struct nft_ctx *ctx,
+				 const struct nft_expr *expr,
+				 const struct nlattr * const tb[])
+{
+	int err;
+
+	if (ctx->afi->family != NFPROTO_IPV4 &&
+	    ctx->afi->family != NFPROTO_INET)
+		return -EOPNOTSUPP;
+
+	err = nft_flow_offload_validate(ctx, expr, NULL);
+	if (err < 0)
+		return err;
+
+	return nf_ct_netns_get(ctx->net, ctx->afi->family);
+}
+
+static void nft_flow_offload_destroy(const struct nft_ctx *ctx,
+				     const struct nft_expr *expr)
+{
+	nf_ct_netns_put(ctx->net, ctx->afi->family);
+}
+
+static struct nft_expr_type nft_flow_offload_type;
+static const struct nft_expr_ops nft_flow_offload_ops = {
+	.type		= &nft_flow_offload_type,
+	.size		= NFT_EXPR_SIZE(0),
+	.eval		= nft_flow_offload_eval,
+	.init		= nft_flow_offload_init,
+	.destroy	= nft_flow_offload_destroy,
+	.validate	= nft_flow_offload_validate,
+};
+
+static struct nft_expr_type nft_flow_offload_type __read_mostly = {
+	.name		= "flow_offload",
+	.ops		= &nft_flow_offload_ops,
+	.owner		= THIS_MODULE,
+};
+
+static void nft_flow_forward_eval(const struct nft_expr *expr,
+				  struct nft_regs *regs,
+				  const struct nft_pktinfo *pkt)
+{
+	struct nf_flowtable *flow_table = nf_flow_table_get(nft_net(pkt));
+	unsigned int verdict;
+
+	verdict = nf_flow_offload_ip_hook(flow_table, pkt->skb);
+	if (verdict != NF_ACCEPT)
+		regs->verdict.code = verdict;
+}
+
+static int nft_flow_forward_validate(const struct nft_ctx *ctx,
+				     const struct nft_expr *expr,
+				     const struct nft_data **data)
+{
+	return nft_chain_validate_hooks(ctx->chain, (1 << NF_NETDEV_INGRESS));
+}
+
+static int nft_flow_forward_init(const struct nft_ctx *ctx,
+				 const struct nft_expr *expr,
+				 const struct nlattr * const tb[])
+{
+	return nft_flow_forward_validate(ctx, expr, NULL);
+}
+
+static struct nft_expr_type nft_flow_forward_type;
+static const struct nft_expr_ops nft_flow_forward_ops = {
+	.type		= &nft_flow_forward_type,
+	.size		= NFT_EXPR_SIZE(0),
+	.eval		= nft_flow_forward_eval,
+	.init		= nft_flow_forward_init,
+	.validate	= nft_flow_forward_validate,
+};
+
+static struct nft_expr_type nft_flow_forward_type __read_mostly = {
+	.family		= NFPROTO_NETDEV,
+	.name		= "flow_forward",
+	.ops		= &nft_flow_forward_ops,
+	.owner		= THIS_MODULE,
+};
+
+static int __init nft_flow_offload_module_init(void)
+{
+	int err;
+
+	err = nft_register_expr(&nft_flow_offload_type);
+	if (err < 0)
+		return err;
+
+	err = nft_register_expr(&nft_flow_forward_type);
+	if (err < 0)
+		goto err_forward;
+
+	return 0;
+
+err_forward:
+	nft_unregister_expr(&nft_flow_offload_type);
+	return err;
+}
+
+static void __exit nft_flow_offload_module_exit(void)
+{
+	nft_unregister_expr(&nft_flow_forward_type);
+	nft_unregister_expr(&nft_flow_offload_type);
+}
+
+module_init(nft_flow_offload_module_init);
+module_exit(nft_flow_offload_module_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_ALIAS_NFT_EXPR("flow_offload");
+MODULE_ALIAS_NFT_AF_EXPR(5, "flow_forward");
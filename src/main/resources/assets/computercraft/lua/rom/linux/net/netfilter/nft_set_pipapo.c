@@ -0,0 +1,747 @@
+/*
+ * Set of ranges on concatenated fields, "pile packet policies" style.
+ *
+ * Every element is a box: a range of values on each field of the key, for
+ * example an address range and a port range.  The start of the box is the
+ * key of a regular element, the inclusive end of each field is the key of
+ * the NFT_SET_ELEM_INTERVAL_END element that follows it in the same batch.
+ * A start without an end matches its key only.
+ *
+ * For the lookup, the range of each field is split into prefixes, and each
+ * prefix becomes a rule of that field.  A field is looked up four bits at a
+ * time: every group of four bits has 16 buckets, and the bucket for a value
+ * holds the bitmap of the rules that accept that value.  Intersecting the
+ * buckets selected by the key gives the rules of the field that match, and
+ * a mapping table takes each of them to the rules of the same elements in
+ * the next field, or to the element itself after the last field.  The cost
+ * of a lookup depends on the key length and on the number of rules, with
+ * no branches on the data, which is what makes it a good fit for the
+ * vectorized intersection in nft_set_pipapo_avx2.c.
+ *
+ * The matching data is rebuilt from the element list from a work item
+ * after changes are done; until then lookups walk the list.
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+#include <linux/netlink.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter/nf_tables.h>
+#include <net/netfilter/nf_tables.h>
+#include <asm/fpu/api.h>
+
+#include "nft_set_pipapo.h"
+
+struct nft_pipapo_elem {
+	struct list_head	list;
+	/* Start and end of the same box point to each other */
+	struct nft_pipapo_elem	*pair;
+	struct nft_set_ext	ext;
+};
+
+union nft_pipapo_map {
+	struct {
+		u32		to;
+		u32		n;
+	};
+	struct nft_pipapo_elem	*e;
+};
+
+struct nft_pipapo_field {
+	unsigned int		groups;
+	unsigned int		rules;
+	unsigned int		bsize;	/* longs in each bucket */
+	unsigned long		*lt;	/* groups * NFT_PIPAPO_BUCKETS buckets */
+	union nft_pipapo_map	*mt;
+};
+
+struct nft_pipapo_match {
+	struct rcu_head		rcu;
+	unsigned int		bsize_max;
+	unsigned long __percpu	*scratch;
+	int			field_count;
+	struct nft_pipapo_field	f[];
+};
+
+struct nft_pipapo {
+	struct nft_pipapo_match __rcu	*match;
+	struct list_head		elems;
+	/* Last start element inserted, waiting for its end */
+	struct nft_pipapo_elem		*last_start;
+	struct mutex			lock;
+	struct delayed_work		work;
+};
+
+static bool nft_pipapo_interval_end(const struct nft_pipapo_elem *e)
+{
+	return nft_set_ext_exists(&e->ext, NFT_SET_EXT_FLAGS) &&
+	       (*nft_set_ext_flags(&e->ext) & NFT_SET_ELEM_INTERVAL_END);
+}
+
+static const u8 *nft_pipapo_key(const struct nft_pipapo_elem *e)
+{
+	return (const u8 *)nft_set_ext_key(&e->ext)->data;
+}
+
+/* Upper bounds of the box, the start key itself if there is no end */
+static const u8 *nft_pipapo_key_end(const struct nft_pipapo_elem *e)
+{
+	const struct nft_pipapo_elem *end = READ_ONCE(e->pair);
+
+	return end ? nft_pipapo_key(end) : nft_pipapo_key(e);
+}
+
+static unsigned int nft_pipapo_field_size(const struct nft_set *set, int i)
+{
+	return round_up(set->field_len[i], sizeof(u32));
+}
+
+static const unsigned long *
+nft_pipapo_bucket(const struct nft_pipapo_field *f, int group, int v)
+{
+	return f->lt + (group * NFT_PIPAPO_BUCKETS + v) * f->bsize;
+}
+
+static int nft_pipapo_group_value(const u8 *data, int group)
+{
+	u8 byte = data[group / 2];
+
+	return group % 2 ? byte & 0xf : byte >> 4;
+}
+
+static void nft_pipapo_and_rows(unsigned long *res, const unsigned long **rows,
+				int n, unsigned int bsize)
+{
+	unsigned int k;
+	unsigned long v;
+	int j;
+
+	for (k = 0; k < bsize; k++) {
+		v = rows[0][k];
+		for (j = 1; j < n; j++)
+			v &= rows[j][k];
+		res[k] = v;
+	}
+}
+
+static struct nft_pipapo_elem *
+nft_pipapo_match(const struct nft_set *set, const struct nft_pipapo_match *m,
+		 const u32 *key, u8 genmask)
+{
+	const unsigned long *rows[NFT_PIPAPO_MAX_GROUPS + 1];
+	const struct nft_pipapo_field *f;
+	struct nft_pipapo_elem *e = NULL;
+	const u8 *data = (const u8 *)key;
+	unsigned long *res, *fill;
+	bool avx2 = false;
+	int i, g, n;
+	u32 b;
+
+	res = this_cpu_ptr(m->scratch);
+	fill = res + m->bsize_max;
+
+#ifdef NFT_PIPAPO_AVX2
+	avx2 = nft_pipapo_avx2_usable();
+	if (avx2)
+		kernel_fpu_begin();
+#endif
+
+	for (i = 0; i < m->field_count; i++) {
+		f = &m->f[i];
+
+		n = 0;
+		for (g = 0; g < f->groups; g++)
+			rows[n++] = nft_pipapo_bucket(f, g,
+					nft_pipapo_group_value(data, g));
+		/* Only the rules of elements matching the fields before */
+		if (i)
+			rows[n++] = fill;
+
+#ifdef NFT_PIPAPO_AVX2
+		if (avx2)
+			nft_pipapo_avx2_and_rows(res, rows, n, f->bsize);
+		else
+#endif
+			nft_pipapo_and_rows(res, rows, n, f->bsize);
+
+		data += nft_pipapo_field_size(set, i);
+		if (i == m->field_count - 1)
+			break;
+
+		memset(fill, 0, m->f[i + 1].bsize * sizeof(unsigned long));
+		for_each_set_bit(b, res, f->rules)
+			bitmap_set(fill, f->mt[b].to, f->mt[b].n);
+		if (bitmap_empty(fill, m->f[i + 1].rules))
+			goto out;
+	}
+
+	for_each_set_bit(b, res, f->rules) {
+		if (nft_set_elem_active(&f->mt[b].e->ext, genmask)) {
+			e = f->mt[b].e;
+			break;
+		}
+	}
+out:
+#ifdef NFT_PIPAPO_AVX2
+	if (avx2)
+		kernel_fpu_end();
+#endif
+	return e;
+}
+
+/* While the matching data is being rebuilt */
+static struct nft_pipapo_elem *
+nft_pipapo_match_slow(const struct nft_set *set, const struct nft_pipapo *priv,
+		      const u32 *key, u8 genmask)
+{
+	const u8 *data, *start, *end;
+	struct nft_pipapo_elem *e;
+	unsigned int off;
+	int i;
+
+	list_for_each_entry_rcu(e, &priv->elems, list) {
+		if (nft_pipapo_interval_end(e) ||
+		    !nft_set_elem_active(&e->ext, genmask))
+			continue;
+
+		data = (const u8 *)key;
+		start = nft_pipapo_key(e);
+		end = nft_pipapo_key_end(e);
+		for (i = 0, off = 0; i < set->field_count; i++) {
+			if (memcmp(data + off, start + off,
+				   set->field_len[i]) < 0 ||
+			    memcmp(data + off, end + off,
+				   set->field_len[i]) > 0)
+				break;
+			off += nft_pipapo_field_size(set, i);
+		}
+		if (i == set->field_count)
+			return e;
+	}
+	return NULL;
+}
+
+static bool nft_pipapo_lookup(const struct net *net, const struct nft_set *set,
+			      const u32 *key, const struct nft_set_ext **ext)
+{
+	struct nft_pipapo *priv = nft_set_priv(set);
+	u8 genmask = nft_genmask_cur(net);
+	const struct nft_pipapo_match *m;
+	struct nft_pipapo_elem *e;
+
+	m = rcu_dereference(priv->match);
+	if (unlikely(!m)) {
+		e = nft_pipapo_match_slow(set, priv, key, genmask);
+	} else {
+		/* Scratch maps are per cpu */
+		local_bh_disable();
+		e = nft_pipapo_match(set, m, key, genmask);
+		local_bh_enable();
+	}
+
+	if (!e)
+		return false;
+
+	*ext = &e->ext;
+	return true;
+}
+
+/* Number of trailing zero bits of a big endian number */
+static unsigned int nft_pipapo_trailing_zeros(const u8 *base, unsigned int len)
+{
+	unsigned int bits = 0;
+	int i;
+
+	for (i = len - 1; i >= 0; i--) {
+		if (base[i])
+			return bits + __ffs(base[i]);
+		bits += BITS_PER_BYTE;
+	}
+	return bits;
+}
+
+/* Whether the block of 2^step values from base goes past end */
+static bool nft_pipapo_after_end(const u8 *base, const u8 *end,
+				 unsigned int step, unsigned int len)
+{
+	u8 last[NFT_PIPAPO_MAX_BYTES];
+	int i;
+
+	memcpy(last, base, len);
+	for (i = len - 1; i >= 0 && step; i--) {
+		if (step >= BITS_PER_BYTE) {
+			last[i] = 0xff;
+			step -= BITS_PER_BYTE;
+		} else {
+			last[i] |= (1 << step) - 1;
+			step = 0;
+		}
+	}
+	return memcmp(last, end, len) > 0;
+}
+
+/* base += 2^step, returns true on overflow */
+static bool nft_pipapo_base_add(u8 *base, unsigned int step, unsigned int len)
+{
+	unsigned int carry;
+	int i;
+
+	if (step == len * BITS_PER_BYTE)
+		return true;
+
+	i = len - 1 - step / BITS_PER_BYTE;
+	carry = 1 << (step % BITS_PER_BYTE);
+	for (; i >= 0 && carry; i--) {
+		carry += base[i];
+		base[i] = carry & 0xff;
+		carry >>= BITS_PER_BYTE;
+	}
+	return carry;
+}
+
+/* Let rule accept the values matching the first plen bits of base */
+static void nft_pipapo_insert_prefix(struct nft_pipapo_field *f,
+				     unsigned int rule, const u8 *base,
+				     unsigned int plen)
+{
+	unsigned int first, mask;
+	int g, v, b;
+
+	for (g = 0; g < f->groups; g++) {
+		v = nft_pipapo_group_value(base, g);
+		first = g * NFT_PIPAPO_GROUP_BITS;
+
+		if (plen >= first + NFT_PIPAPO_GROUP_BITS)
+			mask = NFT_PIPAPO_BUCKETS - 1;
+		else if (plen <= first)
+			mask = 0;
+		else
+			mask = (NFT_PIPAPO_BUCKETS - 1) &
+			       ~((1 << (first + NFT_PIPAPO_GROUP_BITS - plen)) - 1);
+
+		for (b = 0; b < NFT_PIPAPO_BUCKETS; b++) {
+			if ((b & mask) == (v & mask))
+				__set_bit(rule, (unsigned long *)
+					  nft_pipapo_bucket(f, g, b));
+		}
+	}
+}
+
+/* Split [start, end] into prefixes, one rule each, and count them. With a
+ * NULL field, only count.
+ */
+static unsigned int nft_pipapo_expand(struct nft_pipapo_field *f,
+				      unsigned int rule, const u8 *start,
+				      const u8 *end, unsigned int len)
+{
+	unsigned int bits = len * BITS_PER_BYTE, step, n = 0;
+	u8 base[NFT_PIPAPO_MAX_BYTES];
+
+	memcpy(base, start, len);
+	while (memcmp(base, end, len) <= 0) {
+		step = min(nft_pipapo_trailing_zeros(base, len), bits);
+		while (step && nft_pipapo_after_end(base, end, step, len))
+			step--;
+
+		if (f)
+			nft_pipapo_insert_prefix(f, rule + n, base, bits - step);
+		n++;
+
+		if (nft_pipapo_base_add(base, step, len))
+			break;
+	}
+	return n;
+}
+
+static void nft_pipapo_match_free(struct nft_pipapo_match *m)
+{
+	int i;
+
+	for (i = 0; i < m->field_count; i++) {
+		vfree(m->f[i].lt);
+		vfree(m->f[i].mt);
+	}
+	free_percpu(m->scratch);
+	kfree(m);
+}
+
+static void nft_pipapo_match_free_rcu(struct rcu_head *rcu)
+{
+	nft_pipapo_match_free(container_of(rcu, struct nft_pipapo_match, rcu));
+}
+
+static struct nft_pipapo_match *nft_pipapo_build(const struct nft_set *set,
+						 struct nft_pipapo *priv)
+{
+	unsigned int base[NFT_REG32_COUNT], n[NFT_REG32_COUNT];
+	const u8 *start, *end;
+	struct nft_pipapo_match *m;
+	struct nft_pipapo_field *f;
+	struct nft_pipapo_elem *e;
+	unsigned int off, r;
+	int i;
+
+	m = kzalloc(sizeof(*m) + set->field_count * sizeof(m->f[0]),
+		    GFP_KERNEL);
+	if (!m)
+		return NULL;
+	m->field_count = set->field_count;
+
+	list_for_each_entry(e, &priv->elems, list) {
+		if (nft_pipapo_interval_end(e))
+			continue;
+
+		start = nft_pipapo_key(e);
+		end = nft_pipapo_key_end(e);
+		for (i = 0, off = 0; i < m->field_count; i++) {
+			m->f[i].rules += nft_pipapo_expand(NULL, 0, start + off,
+							   end + off,
+							   set->field_len[i]);
+			off += nft_pipapo_field_size(set, i);
+		}
+	}
+
+	for (i = 0; i < m->field_count; i++) {
+		f = &m->f[i];
+		f->groups = set->field_len[i] * BITS_PER_BYTE /
+			    NFT_PIPAPO_GROUP_BITS;
+		f->bsize = max_t(unsigned int, BITS_TO_LONGS(f->rules), 1);
+		m->bsize_max = max(m->bsize_max, f->bsize);
+
+		f->lt = vzalloc(f->groups * NFT_PIPAPO_BUCKETS * f->bsize *
+				sizeof(unsigned long));
+		f->mt = vzalloc(max_t(unsigned int, f->rules, 1) *
+				sizeof(union nft_pipapo_map));
+		if (!f->lt || !f->mt)
+			goto err;
+	}
+
+	m->scratch = __alloc_percpu(2 * m->bsize_max * sizeof(unsigned long),
+				    sizeof(unsigned long));
+	if (!m->scratch)
+		goto err;
+
+	memset(base, 0, sizeof(base));
+	list_for_each_entry(e, &priv->elems, list) {
+		if (nft_pipapo_interval_end(e))
+			continue;
+
+		start = nft_pipapo_key(e);
+		end = nft_pipapo_key_end(e);
+		for (i = 0, off = 0; i < m->field_count; i++) {
+			n[i] = nft_pipapo_expand(&m->f[i], base[i], start + off,
+						 end + off, set->field_len[i]);
+			off += nft_pipapo_field_size(set, i);
+		}
+
+		for (i = 0; i < m->field_count; i++) {
+			f = &m->f[i];
+			for (r = base[i]; r < base[i] + n[i]; r++) {
+				if (i == m->field_count - 1) {
+					f->mt[r].e = e;
+				} else {
+					f->mt[r].to = base[i + 1];
+					f->mt[r].n = n[i + 1];
+				}
+			}
+			base[i] += n[i];
+		}
+	}
+
+	return m;
+err:
+	nft_pipapo_match_free(m);
+	return NULL;
+}
+
+static void nft_pipapo_work(struct work_struct *work)
+{
+	struct nft_pipapo *priv = container_of(work, struct nft_pipapo,
+					       work.work);
+	struct nft_pipapo_match *m;
+
+	mutex_lock(&priv->lock);
+	if (rcu_access_pointer(priv->match))
+		goto out;
+
+	m = nft_pipapo_build(nft_set_container_of(priv), priv);
+	if (m)
+		rcu_assign_pointer(priv->match, m);
+	else
+		schedule_delayed_work(&priv->work, HZ);
+out:
+	mutex_unlock(&priv->lock);
+}
+
+/* Called with priv->lock held after any change to the element list */
+static void nft_pipapo_invalidate(struct nft_pipapo *priv)
+{
+	struct nft_pipapo_match *old;
+
+	old = rcu_dereference_protected(priv->match,
+					lockdep_is_held(&priv->lock));
+	if (old) {
+		RCU_INIT_POINTER(priv->match, NULL);
+		call_rcu(&old->rcu, nft_pipapo_match_free_rcu);
+	}
+	schedule_delayed_work(&priv->work, HZ / 10);
+}
+
+static bool nft_pipapo_key_equal(const struct nft_set *set,
+				 const struct nft_pipapo_elem *a,
+				 const struct nft_pipapo_elem *b)
+{
+	return !memcmp(nft_pipapo_key(a), nft_pipapo_key(b), set->klen);
+}
+
+/* Every field of the end must be at or after the same field of the start */
+static bool nft_pipapo_valid_end(const struct nft_set *set,
+				 const struct nft_pipapo_elem *start,
+				 const struct nft_pipapo_elem *end)
+{
+	unsigned int off;
+	int i;
+
+	for (i = 0, off = 0; i < set->field_count; i++) {
+		if (memcmp(nft_pipapo_key(start) + off,
+			   nft_pipapo_key(end) + off, set->field_len[i]) > 0)
+			return false;
+		off += nft_pipapo_field_size(set, i);
+	}
+	return true;
+}
+
+static int nft_pipapo_insert(const struct net *net, const struct nft_set *set,
+			     const struct nft_set_elem *elem,
+			     struct nft_set_ext **ext)
+{
+	struct nft_pipapo *priv = nft_set_priv(set);
+	struct nft_pipapo_elem *e = elem->priv, *start, *dup;
+	u8 genmask = nft_genmask_next(net);
+	int err = 0;
+
+	mutex_lock(&priv->lock);
+	if (nft_pipapo_interval_end(e)) {
+		start = priv->last_start;
+		if (!start || !nft_pipapo_valid_end(set, start, e)) {
+			err = -EINVAL;
+			goto out;
+		}
+		priv->last_start = NULL;
+		e->pair = start;
+	} else {
+		list_for_each_entry(dup, &priv->elems, list) {
+			if (!nft_pipapo_interval_end(dup) &&
+			    nft_set_elem_active(&dup->ext, genmask) &&
+			    nft_pipapo_key_equal(set, dup, e)) {
+				*ext = &dup->ext;
+				err = -EEXIST;
+				goto out;
+			}
+		}
+		priv->last_start = e;
+	}
+
+	list_add_tail_rcu(&e->list, &priv->elems);
+	if (e->pair)
+		WRITE_ONCE(e->pair->pair, e);
+	nft_pipapo_invalidate(priv);
+out:
+	mutex_unlock(&priv->lock);
+	return err;
+}
+
+static void nft_pipapo_remove(const struct net *net,
+			      const struct nft_set *set,
+			      const struct nft_set_elem *elem)
+{
+	struct nft_pipapo *priv = nft_set_priv(set);
+	struct nft_pipapo_elem *e = elem->priv;
+
+	mutex_lock(&priv->lock);
+	list_del_rcu(&e->list);
+	if (e->pair)
+		WRITE_ONCE(e->pair->pair, NULL);
+	if (priv->last_start == e)
+		priv->last_start = NULL;
+	nft_pipapo_invalidate(priv);
+	mutex_unlock(&priv->lock);
+}
+
+static void nft_pipapo_activate(const struct net *net,
+				const struct nft_set *set,
+				const struct nft_set_elem *elem)
+{
+	struct nft_pipapo_elem *e = elem->priv;
+
+	nft_set_elem_change_active(net, set, &e->ext);
+}
+
+static bool nft_pipapo_flush(const struct net *net,
+			     const struct nft_set *set, void *priv)
+{
+	struct nft_pipapo_elem *e = priv;
+
+	nft_set_elem_change_active(net, set, &e->ext);
+	return true;
+}
+
+static void *nft_pipapo_deactivate(const struct net *net,
+				   const struct nft_set *set,
+				   const struct nft_set_elem *elem)
+{
+	struct nft_pipapo *priv = nft_set_priv(set);
+	struct nft_pipapo_elem *e, *this = elem->priv, *found = NULL;
+	u8 genmask = nft_genmask_next(net);
+
+	list_for_each_entry(e, &priv->elems, list) {
+		if (nft_pipapo_interval_end(e) != nft_pipapo_interval_end(this) ||
+		    !nft_set_elem_active(&e->ext, genmask) ||
+		    memcmp(nft_pipapo_key(e), &elem->key.val, set->klen))
+			continue;
+
+		found = e;
+		/* Ends can be shared by boxes, take the one whose start
+		 * goes away in this transaction.
+		 */
+		if (!nft_pipapo_interval_end(e) || !e->pair ||
+		    !nft_set_elem_active(&e->pair->ext, genmask))
+			break;
+	}
+
+	if (found)
+		nft_pipapo_flush(net, set, found);
+	return found;
+}
+
+static void nft_pipapo_walk(const struct nft_ctx *ctx, struct nft_set *set,
+			    struct nft_set_iter *iter)
+{
+	struct nft_pipapo *priv = nft_set_priv(set);
+	struct nft_pipapo_elem *e;
+	struct nft_set_elem elem;
+
+	rcu_read_lock();
+	list_for_each_entry_rcu(e, &priv->elems, list) {
+		if (iter->count < iter->skip)
+			goto cont;
+		if (!nft_set_elem_active(&e->ext, iter->genmask))
+			goto cont;
+
+		elem.priv = e;
+
+		iter->err = iter->fn(ctx, set, iter, &elem);
+		if (iter->err < 0)
+			break;
+cont:
+		iter->count++;
+	}
+	rcu_read_unlock();
+}
+
+static unsigned int nft_pipapo_privsize(const struct nlattr * const nla[])
+{
+	return sizeof(struct nft_pipapo);
+}
+
+static int nft_pipapo_init(const struct nft_set *set,
+			   const struct nft_set_desc *desc,
+			   const struct nlattr * const nla[])
+{
+	struct nft_pipapo *priv = nft_set_priv(set);
+
+	RCU_INIT_POINTER(priv->match, NULL);
+	INIT_LIST_HEAD(&priv->elems);
+	priv->last_start = NULL;
+	mutex_init(&priv->lock);
+	INIT_DELAYED_WORK(&priv->work, nft_pipapo_work);
+	return 0;
+}
+
+static void nft_pipapo_destroy(const struct nft_set *set)
+{
+	struct nft_pipapo *priv = nft_set_priv(set);
+	struct nft_pipapo_elem *e, *next;
+	struct nft_pipapo_match *m;
+
+	cancel_delayed_work_sync(&priv->work);
+
+	m = rcu_dereference_protected(priv->match, true);
+	if (m)
+		nft_pipapo_match_free(m);
+
+	list_for_each_entry_safe(e, next, &priv->elems, list) {
+		list_del(&e->list);
+		nft_set_elem_destroy(set, e, true);
+	}
+}
+
+static bool nft_pipapo_estimate(const struct nft_set_desc *desc, u32 features,
+				struct nft_set_estimate *est)
+{
+	unsigned int nsize;
+	int i;
+
+	if (!(features & NFT_SET_INTERVAL) || desc->field_count < 2)
+		return false;
+
+	for (i = 0; i < desc->field_count; i++) {
+		if (desc->field_len[i] > NFT_PIPAPO_MAX_BYTES)
+			return false;
+	}
+
+	/* An element, and a few rules with their bucket bits on each field */
+	nsize = sizeof(struct nft_pipapo_elem) +
+		desc->klen * NFT_PIPAPO_BUCKETS / BITS_PER_BYTE;
+	if (desc->size)
+		est->size = sizeof(struct nft_pipapo) + desc->size * nsize;
+	else
+		est->size = nsize;
+
+	est->lookup = NFT_SET_CLASS_O_LOG_N;
+	est->space  = NFT_SET_CLASS_O_N;
+
+	return true;
+}
+
+static struct nft_set_ops nft_pipapo_ops __read_mostly = {
+	.privsize	= nft_pipapo_privsize,
+	.elemsize	= offsetof(struct nft_pipapo_elem, ext),
+	.estimate	= nft_pipapo_estimate,
+	.init		= nft_pipapo_init,
+	.destroy	= nft_pipapo_destroy,
+	.insert		= nft_pipapo_insert,
+	.remove		= nft_pipapo_remove,
+	.deactivate	= nft_pipapo_deactivate,
+	.flush		= nft_pipapo_flush,
+	.activate	= nft_pipapo_activate,
+	.lookup		= nft_pipapo_lookup,
+	.walk		= nft_pipapo_walk,
+	.features	= NFT_SET_INTERVAL | NFT_SET_MAP | NFT_SET_OBJECT,
+	.owner		= THIS_MODULE,
+};
+
+static int __init nft_pipapo_module_init(void)
+{
+	return nft_register_set(&nft_pipapo_ops);
+}
+
+static void __exit nft_pipapo_module_exit(void)
+{
+	nft_unregister_set(&nft_pipapo_ops);
+	/* Wait for nft_pipapo_match_free_rcu() */
+	rcu_barrier();
+}
+
+module_init(nft_pipapo_module_init);
+module_exit(nft_pipapo_module_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_ALIAS_NFT_SET();
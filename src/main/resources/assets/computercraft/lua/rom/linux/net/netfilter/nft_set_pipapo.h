@@ -0,0 +1,23 @@
+#ifndef _NFT_SET_PIPAPO_H
+#define _NFT_SET_PIPAPO_H
+
+#include <linux/types.h>
+
+/* Key bits looked up at a time, each group of bits selects one of 16 buckets */
+#define NFT_PIPAPO_GROUP_BITS		4
+#define NFT_PIPAPO_BUCKETS		(1 << NFT_PIPAPO_GROUP_BITS)
+
+/* Longest field, an IPv6 address */
+#define NFT_PIPAPO_MAX_BYTES		16
+#define NFT_PIPAPO_MAX_GROUPS		(NFT_PIPAPO_MAX_BYTES * BITS_PER_BYTE / \
+					 NFT_PIPAPO_GROUP_BITS)
+
+#if defined(CONFIG_X86_64) && defined(CONFIG_AS_AVX2)
+#define NFT_PIPAPO_AVX2
+
+bool nft_pipapo_avx2_usable(void);
+void nft_pipapo_avx2_and_rows(unsigned long *res, const unsigned long **rows,
+			      int n, unsigned int bsize);
+#endif
+
+#endif /* _NFT_SET_PIPAPO_H */
@@ -0,0 +1,51 @@
+/*
+ * AVX2 version of the bucket intersection of the nft_set_pipapo lookup.
+ *
+ * The kernel is built without AVX, so the compiler never allocates ymm
+ * registers and %ymm0 can be carried from one asm statement to the next.
+ * Callers wrap the lookup in kernel_fpu_begin()/kernel_fpu_end().
+ */
+
+#include <linux/kernel.h>
+#include <asm/cpufeature.h>
+#include <asm/fpu/api.h>
+
+#include "nft_set_pipapo.h"
+
+#ifdef NFT_PIPAPO_AVX2
+
+bool nft_pipapo_avx2_usable(void)
+{
+	return boot_cpu_has(X86_FEATURE_AVX2) && irq_fpu_usable();
+}
+
+#define NFT_PIPAPO_AVX2_LONGS	(32 / sizeof(unsigned long))
+
+/* res = rows[0] & rows[1] & ... & rows[n - 1], 256 bits at a time */
+void nft_pipapo_avx2_and_rows(unsigned long *res, const unsigned long **rows,
+			      int n, unsigned int bsize)
+{
+	unsigned int k;
+	unsigned long v;
+	int j;
+
+	for (k = 0; k + NFT_PIPAPO_AVX2_LONGS <= bsize;
+	     k += NFT_PIPAPO_AVX2_LONGS) {
+		asm volatile("vmovdqu %0, %%ymm0"
+			     : : "m" (*(const u8 (*)[32])(rows[0] + k)));
+		for (j = 1; j < n; j++)
+			asm volatile("vpand %0, %%ymm0, %%ymm0"
+				     : : "m" (*(const u8 (*)[32])(rows[j] + k)));
+		asm volatile("vmovdqu %%ymm0, %0"
+			     : "=m" (*(u8 (*)[32])(res + k)));
+	}
+
+	for (; k < bsize; k++) {
+		v = rows[0][k];
+		for (j = 1; j < n; j++)
+			v &= rows[j][k];
+		res[k] = v;
+	}
+}
+
+#endif /* NFT_PIPAPO_AVX2 */
@@ -284,6 +284,10 @@ static bool nft_rbtree_estimate(const struct nft_set_desc *desc, u32 features,
 {
 	unsigned int nsize;
 
+	/* Intervals are on the whole key, not on each field */
+	if (features & NFT_SET_INTERVAL && desc->field_count > 1)
+		return false;
+
 	nsize = sizeof(struct nft_rbtree_elem);
 	if (desc->size)
 		est->size = sizeof(struct nft_rbtree) + desc->size * nsize;
@@ -23,6 +23,7 @@
 #include <linux/if_arp.h>
 #include <linux/if_vlan.h>
 #include <linux/in.h>
+#include <linux/interrupt.h>
 #include <linux/ip.h>
 #include <linux/jhash.h>
 #include <linux/delay.h>
@@ -262,11 +263,13 @@ void ovs_dp_process_packet(struct sk_buff *skb, struct sw_flow_key *key)
 	struct dp_stats_percpu *stats;
 	u64 *stats_counter;
 	u32 n_mask_hit;
+	u32 n_cache_hit;
 
 	stats = this_cpu_ptr(dp->stats_percpu);
 
 	/* Look up flow. */
-	flow = ovs_flow_tbl_lookup_stats(&dp->table, key, &n_mask_hit);
+	flow = ovs_flow_tbl_lookup_stats(&dp->table, key, skb_get_hash(skb),
+					 &n_mask_hit, &n_cache_hit);
 	if (unlikely(!flow)) {
 		struct dp_upcall_info upcall;
 		int error;
@@ -295,6 +298,7 @@ out:
 	u64_stats_update_begin(&stats->syncp);
 	(*stats_counter)++;
 	stats->n_mask_hit += n_mask_hit;
+	stats->n_cache_hit += n_cache_hit;
 	u64_stats_update_end(&stats->syncp);
 }
 
@@ -335,7 +339,7 @@ static int queue_gso_packets(struct datapath *dp, struct sk_buff *skb,
 			     const struct dp_upcall_info *upcall_info,
 				 uint32_t cutlen)
 {
-	unsigned short gso_type = skb_shinfo(skb)->gso_type;
+	unsigned int gso_type = skb_shinfo(skb)->gso_type;
 	struct sw_flow_key later_key;
 	struct sk_buff *segs, *nskb;
 	int err;
@@ -417,15 +421,136 @@ static void pad_packet(struct datapath *dp, struct sk_buff *skb)
 	}
 }
 
+/* Upcalls of a datapath with OVS_DP_F_UPCALL_BATCH are built back to back
+ * in a per cpu buffer.  The buffer goes to Netlink in one piece when it is
+ * full, when the next upcall is for another socket or datapath, or from a
+ * tasklet once the softirq run that queued it is over.
+ */
+#define UPCALL_BATCH_SIZE	SKB_WITH_OVERHEAD(32768)
+#define UPCALL_BATCH_MAX	64
+
+struct upcall_batch {
+	struct sk_buff *skb;
+	struct net *net;
+	u32 portid;
+	int dp_ifindex;
+	unsigned int count;
+	struct tasklet_struct tasklet;
+};
+
+static DEFINE_PER_CPU(struct upcall_batch, upcall_batch);
+
+static void upcall_batch_flush(struct upcall_batch *batch)
+{
+	struct sk_buff *skb = batch->skb;
+	struct datapath *dp;
+	int err;
+
+	if (!skb)
+		return;
+	batch->skb = NULL;
+
+	err = genlmsg_unicast(batch->net, skb, batch->portid);
+	if (err) {
+		rcu_read_lock();
+		dp = get_dp_rcu(batch->net, batch->dp_ifindex);
+		if (dp) {
+			struct dp_stats_percpu *stats;
+
+			stats = this_cpu_ptr(dp->stats_percpu);
+			u64_stats_update_begin(&stats->syncp);
+			stats->n_lost += batch->count;
+			u64_stats_update_end(&stats->syncp);
+		}
+		rcu_read_unlock();
+	}
+	put_net(batch->net);
+}
+
+static void upcall_batch_tasklet(unsigned long data)
+{
+	upcall_batch_flush((struct upcall_batch *)data);
+}
+
+/* Called with BH disabled.  Returns the buffer to append an upcall of at
+ * most 'size' bytes to, or NULL if none can be allocated.
+ */
+static struct sk_buff *upcall_batch_reserve(struct datapath *dp, u32 portid,
+					    int dp_ifindex, size_t size)
+{
+	struct upcall_batch *batch = this_cpu_ptr(&upcall_batch);
+	struct net *net = ovs_dp_get_net(dp);
+
+	if (batch->skb &&
+	    (batch->portid != portid || batch->dp_ifindex != dp_ifindex ||
+	     !net_eq(batch->net, net) || batch->count >= UPCALL_BATCH_MAX ||
+	     skb_tailroom(batch->skb) < size))
+		upcall_batch_flush(batch);
+
+	if (!batch->skb) {
+		/* The buffer outlives this packet, pin the namespace */
+		if (!maybe_get_net(net))
+			return NULL;
+
+		batch->skb = alloc_skb(max_t(size_t, size, UPCALL_BATCH_SIZE),
+				       GFP_ATOMIC);
+		if (!batch->skb) {
+			put_net(net);
+			return NULL;
+		}
+		batch->net = net;
+		batch->portid = portid;
+		batch->dp_ifindex = dp_ifindex;
+		batch->count = 0;
+		tasklet_schedule(&batch->tasklet);
+	}
+
+	return batch->skb;
+}
+
+/* Pads the upcall just built so the next one starts NLMSG aligned. */
+static void upcall_batch_commit(struct sk_buff *skb)
+{
+	size_t plen = NLMSG_ALIGN(skb->len) - skb->len;
+
+	if (plen > 0)
+		memset(skb_put(skb, plen), 0, plen);
+	this_cpu_ptr(&upcall_batch)->count++;
+}
+
+static void upcall_batch_init(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct upcall_batch *batch = per_cpu_ptr(&upcall_batch, cpu);
+
+		tasklet_init(&batch->tasklet, upcall_batch_tasklet,
+			     (unsigned long)batch);
+	}
+}
+
+/* Waits for the pending batches to be sent. */
+static void upcall_batch_exit(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		tasklet_kill(&per_cpu_ptr(&upcall_batch, cpu)->tasklet);
+}
+
 static int queue_userspace_packet(struct datapath *dp, struct sk_buff *skb,
 				  const struct sw_flow_key *key,
 				  const struct dp_upcall_info *upcall_info,
 				  uint32_t cutlen)
 {
+	bool batch = dp->user_features & OVS_DP_F_UPCALL_BATCH;
 	struct ovs_header *upcall;
 	struct sk_buff *nskb = NULL;
 	struct sk_buff *user_skb = NULL; /* to be queued to userspace */
+	struct nlmsghdr *nlh;
 	struct nlattr *nla;
+	unsigned int start = 0;
 	size_t len;
 	unsigned int hlen;
 	int err, dp_ifindex;
@@ -459,19 +584,27 @@ static int queue_userspace_packet(struct datapath *dp, struct sk_buff *skb,
 	/* Older versions of OVS user space enforce alignment of the last
 	 * Netlink attribute to NLA_ALIGNTO which would require extensive
 	 * padding logic. Only perform zerocopy if padding is not required.
+	 * A batch is one linear buffer, so its upcalls are always copied.
 	 */
-	if (dp->user_features & OVS_DP_F_UNALIGNED)
+	if ((dp->user_features & OVS_DP_F_UNALIGNED) && !batch)
 		hlen = skb_zerocopy_headlen(skb);
 	else
 		hlen = skb->len;
 
 	len = upcall_msg_size(upcall_info, hlen - cutlen);
-	user_skb = genlmsg_new(len, GFP_ATOMIC);
+	if (batch) {
+		size_t size = nlmsg_total_size(genlmsg_total_size(len));
+
+		user_skb = upcall_batch_reserve(dp, upcall_info->portid,
+						dp_ifindex, size);
+	} else
+		user_skb = genlmsg_new(len, GFP_ATOMIC);
 	if (!user_skb) {
 		err = -ENOMEM;
 		goto out;
 	}
 
+	start = user_skb->len;
 	upcall = genlmsg_put(user_skb, 0, 0, &dp_packet_genl_family,
 			     0, upcall_info->cmd);
 	upcall->dp_ifindex = dp_ifindex;
@@ -538,13 +671,26 @@ static int queue_userspace_packet(struct datapath *dp, struct sk_buff *skb,
 	/* Pad OVS_PACKET_ATTR_PACKET if linear copy was performed */
 	pad_packet(dp, user_skb);
 
-	((struct nlmsghdr *) user_skb->data)->nlmsg_len = user_skb->len;
+	nlh = (struct nlmsghdr *)(user_skb->data + start);
+	nlh->nlmsg_len = user_skb->len - start;
+
+	if (batch) {
+		/* Delivery errors are accounted when the batch is flushed */
+		upcall_batch_commit(user_skb);
+		user_skb = NULL;
+		goto out;
+	}
 
 	err = genlmsg_unicast(ovs_dp_get_net(dp), user_skb, upcall_info->portid);
 	user_skb = NULL;
 out:
 	if (err)
 		skb_tx_error(skb);
+	if (batch && user_skb) {
+		/* Drop the partial upcall, the batch stays queued */
+		skb_trim(user_skb, start);
+		user_skb = NULL;
+	}
 	kfree_skb(user_skb);
 	kfree_skb(nskb);
 	return err;
@@ -698,6 +844,7 @@ static void get_dp_stats(const struct datapath *dp, struct ovs_dp_stats *stats,
 		stats->n_missed += local_stats.n_missed;
 		stats->n_lost += local_stats.n_lost;
 		mega_stats->n_mask_hit += local_stats.n_mask_hit;
+		mega_stats->n_cache_hit += local_stats.n_cache_hit;
 	}
 }
 
@@ -2279,12 +2426,30 @@ error:
 	return err;
 }
 
+static void ovs_dp_masks_rebalance(struct work_struct *work)
+{
+	struct ovs_net *ovs_net = container_of(work, struct ovs_net,
+					       masks_rebalance.work);
+	struct datapath *dp;
+
+	ovs_lock();
+	list_for_each_entry(dp, &ovs_net->dps, list_node)
+		ovs_flow_masks_rebalance(&dp->table);
+	ovs_unlock();
+
+	schedule_delayed_work(&ovs_net->masks_rebalance,
+			      msecs_to_jiffies(DP_MASKS_REBALANCE_INTERVAL));
+}
+
 static int __net_init ovs_init_net(struct net *net)
 {
 	struct ovs_net *ovs_net = net_generic(net, ovs_net_id);
 
 	INIT_LIST_HEAD(&ovs_net->dps);
 	INIT_WORK(&ovs_net->dp_notify_work, ovs_dp_notify_wq);
+	INIT_DELAYED_WORK(&ovs_net->masks_rebalance, ovs_dp_masks_rebalance);
+	schedule_delayed_work(&ovs_net->masks_rebalance,
+			      msecs_to_jiffies(DP_MASKS_REBALANCE_INTERVAL));
 	ovs_ct_init(net);
 	return 0;
 }
@@ -2320,6 +2485,7 @@ static void __net_exit ovs_exit_net(struct net *dnet)
 	struct net *net;
 	LIST_HEAD(head);
 
+	cancel_delayed_work_sync(&ovs_net->masks_rebalance);
 	ovs_ct_exit(dnet);
 	ovs_lock();
 	list_for_each_entry_safe(dp, dp_next, &ovs_net->dps, list_node)
@@ -2356,6 +2522,8 @@ static int __init dp_init(void)
 
 	pr_info("Open vSwitch switching datapath\n");
 
+	upcall_batch_init();
+
 	err = action_fifos_init();
 	if (err)
 		goto error;
@@ -2415,6 +2583,7 @@ static void dp_cleanup(void)
 	unregister_netdevice_notifier(&ovs_dp_device_notifier);
 	unregister_pernet_device(&ovs_net_ops);
 	rcu_barrier();
+	upcall_batch_exit();
 	ovs_vport_exit();
 	ovs_flow_exit();
 	ovs_internal_dev_rtnl_link_unregister();
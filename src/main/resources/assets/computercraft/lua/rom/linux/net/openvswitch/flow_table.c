@@ -42,6 +42,7 @@
 #include <linux/icmp.h>
 #include <linux/icmpv6.h>
 #include <linux/rculist.h>
+#include <linux/sort.h>
 #include <net/ip.h>
 #include <net/ipv6.h>
 #include <net/ndisc.h>
@@ -178,6 +179,61 @@ static void __table_instance_destroy(struct table_instance *ti)
 	kfree(ti);
 }
 
+static struct mask_array *tbl_mask_array_alloc(int size)
+{
+	struct mask_array *new;
+	size_t masks_size;
+	int cpu;
+
+	masks_size = ALIGN(sizeof(struct mask_array) +
+			   sizeof(struct sw_flow_mask *) * size,
+			   __alignof__(u64));
+	new = kzalloc(masks_size + sizeof(u64) * size, GFP_KERNEL);
+	if (!new)
+		return NULL;
+
+	new->masks_usage_zero_cntr = (u64 *)((u8 *)new + masks_size);
+	new->masks_usage_stats = __alloc_percpu(sizeof(struct mask_array_stats) +
+						sizeof(u64) * size,
+						__alignof__(u64));
+	if (!new->masks_usage_stats) {
+		kfree(new);
+		return NULL;
+	}
+
+	for_each_possible_cpu(cpu) {
+		struct mask_array_stats *stats;
+
+		stats = per_cpu_ptr(new->masks_usage_stats, cpu);
+		u64_stats_init(&stats->syncp);
+	}
+
+	return new;
+}
+
+static void __mask_array_destroy(struct mask_array *ma)
+{
+	free_percpu(ma->masks_usage_stats);
+	kfree(ma);
+}
+
+static void mask_array_rcu_cb(struct rcu_head *rcu)
+{
+	struct mask_array *ma = container_of(rcu, struct mask_array, rcu);
+
+	__mask_array_destroy(ma);
+}
+
+/* Must be called with OVS mutex held. */
+static void tbl_mask_array_replace(struct flow_table *tbl,
+				   struct mask_array *new)
+{
+	struct mask_array *old = ovsl_dereference(tbl->mask_array);
+
+	rcu_assign_pointer(tbl->mask_array, new);
+	call_rcu(&old->rcu, mask_array_rcu_cb);
+}
+
 static struct table_instance *table_instance_alloc(int new_size)
 {
 	struct table_instance *ti = kmalloc(sizeof(*ti), GFP_KERNEL);
@@ -202,11 +258,21 @@ static struct table_instance *table_instance_alloc(int new_size)
 int ovs_flow_tbl_init(struct flow_table *table)
 {
 	struct table_instance *ti, *ufid_ti;
+	struct mask_array *ma;
 
-	ti = table_instance_alloc(TBL_MIN_BUCKETS);
+	table->mask_cache = __alloc_percpu(sizeof(struct mask_cache_entry) *
+					   MC_HASH_ENTRIES,
+					   __alignof__(struct mask_cache_entry));
+	if (!table->mask_cache)
+		return -ENOMEM;
 
+	ma = tbl_mask_array_alloc(0);
+	if (!ma)
+		goto free_mask_cache;
+
+	ti = table_instance_alloc(TBL_MIN_BUCKETS);
 	if (!ti)
-		return -ENOMEM;
+		goto free_mask_array;
 
 	ufid_ti = table_instance_alloc(TBL_MIN_BUCKETS);
 	if (!ufid_ti)
@@ -214,7 +280,7 @@ int ovs_flow_tbl_init(struct flow_table *table)
 
 	rcu_assign_pointer(table->ti, ti);
 	rcu_assign_pointer(table->ufid_ti, ufid_ti);
-	INIT_LIST_HEAD(&table->mask_list);
+	rcu_assign_pointer(table->mask_array, ma);
 	table->last_rehash = jiffies;
 	table->count = 0;
 	table->ufid_count = 0;
@@ -222,6 +288,10 @@ int ovs_flow_tbl_init(struct flow_table *table)
 
 free_ti:
 	__table_instance_destroy(ti);
+free_mask_array:
+	__mask_array_destroy(ma);
+free_mask_cache:
+	free_percpu(table->mask_cache);
 	return -ENOMEM;
 }
 
@@ -278,6 +348,8 @@ void ovs_flow_tbl_destroy(struct flow_table *table)
 	struct table_instance *ti = rcu_dereference_raw(table->ti);
 	struct table_instance *ufid_ti = rcu_dereference_raw(table->ufid_ti);
 
+	free_percpu(table->mask_cache);
+	__mask_array_destroy(rcu_dereference_raw(table->mask_array));
 	table_instance_destroy(ti, ufid_ti, false);
 }
 
@@ -463,7 +535,8 @@ static bool ovs_flow_cmp_unmasked_key(const struct sw_flow *flow,
 
 static struct sw_flow *masked_flow_lookup(struct table_instance *ti,
 					  const struct sw_flow_key *unmasked,
-					  const struct sw_flow_mask *mask)
+					  const struct sw_flow_mask *mask,
+					  u32 *n_mask_hit)
 {
 	struct sw_flow *flow;
 	struct hlist_head *head;
@@ -471,6 +544,7 @@ static struct sw_flow *masked_flow_lookup(struct table_instance *ti,
 	struct sw_flow_key masked_key;
 
 	ovs_flow_mask_key(&masked_key, unmasked, false, mask);
+	(*n_mask_hit)++;
 	hash = flow_hash(&masked_key, &mask->range);
 	head = find_bucket(ti, hash);
 	hlist_for_each_entry_rcu(flow, head, flow_table.node[ti->node_ver]) {
@@ -481,42 +555,171 @@ static struct sw_flow *masked_flow_lookup(struct table_instance *ti,
 	return NULL;
 }
 
+static void mask_usage_inc(struct mask_array *ma, u32 index)
+{
+	struct mask_array_stats *stats = this_cpu_ptr(ma->masks_usage_stats);
+
+	u64_stats_update_begin(&stats->syncp);
+	stats->usage_cntrs[index]++;
+	u64_stats_update_end(&stats->syncp);
+}
+
+/* Flow lookup does full lookup on flow table. It starts with
+ * mask from index passed in *index.  Must be called with BH disabled.
+ */
+static struct sw_flow *flow_lookup(struct flow_table *tbl,
+				   struct table_instance *ti,
+				   struct mask_array *ma,
+				   const struct sw_flow_key *key,
+				   u32 *n_mask_hit,
+				   u32 *n_cache_hit,
+				   u32 *index)
+{
+	struct sw_flow_mask *mask;
+	struct sw_flow *flow;
+	int i;
+
+	if (likely(*index < ma->count)) {
+		mask = rcu_dereference_ovsl(ma->masks[*index]);
+		if (mask) {
+			flow = masked_flow_lookup(ti, key, mask, n_mask_hit);
+			if (flow) {
+				mask_usage_inc(ma, *index);
+				(*n_cache_hit)++;
+				return flow;
+			}
+		}
+	}
+
+	for (i = 0; i < ma->count; i++) {
+		if (i == *index)
+			continue;
+
+		mask = rcu_dereference_ovsl(ma->masks[i]);
+		if (unlikely(!mask))
+			continue;
+
+		flow = masked_flow_lookup(ti, key, mask, n_mask_hit);
+		if (flow) { /* Found */
+			mask_usage_inc(ma, i);
+			*index = i;
+			return flow;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * mask_cache maps flow to probable mask. This cache is not tightly
+ * coupled cache, It means updates to  mask list can result in inconsistent
+ * cache entry in mask cache.
+ * This is per cpu cache and is divided in MC_HASH_SEGS segments.
+ * In case of a hash collision the entry is hashed in next segment.
+ * A stale mask index only costs one extra masked lookup: the mask is
+ * always re-checked, so no flow is ever returned from the cache itself.
+ */
 struct sw_flow *ovs_flow_tbl_lookup_stats(struct flow_table *tbl,
-				    const struct sw_flow_key *key,
-				    u32 *n_mask_hit)
+					  const struct sw_flow_key *key,
+					  u32 skb_hash,
+					  u32 *n_mask_hit,
+					  u32 *n_cache_hit)
 {
+	struct mask_array *ma = rcu_dereference_ovsl(tbl->mask_array);
 	struct table_instance *ti = rcu_dereference_ovsl(tbl->ti);
-	struct sw_flow_mask *mask;
+	struct mask_cache_entry *entries, *ce;
 	struct sw_flow *flow;
+	u32 mask_index;
+	u32 hash;
+	int seg;
 
 	*n_mask_hit = 0;
-	list_for_each_entry_rcu(mask, &tbl->mask_list, list) {
-		(*n_mask_hit)++;
-		flow = masked_flow_lookup(ti, key, mask);
-		if (flow)  /* Found */
+	*n_cache_hit = 0;
+	mask_index = ma->count;
+	if (unlikely(!skb_hash))
+		return flow_lookup(tbl, ti, ma, key, n_mask_hit, n_cache_hit,
+				   &mask_index);
+
+	/* Pre and post recirulation flows usually have the same skb_hash
+	 * value. To avoid hash collisions, rehash the 'skb_hash' with
+	 * 'recirc_id'.
+	 */
+	if (key->recirc_id)
+		skb_hash = jhash_1word(skb_hash, key->recirc_id);
+
+	ce = NULL;
+	hash = skb_hash;
+	entries = this_cpu_ptr(tbl->mask_cache);
+
+	/* Find the cache entry 'ce' to operate on. */
+	for (seg = 0; seg < MC_HASH_SEGS; seg++) {
+		int index = hash & (MC_HASH_ENTRIES - 1);
+		struct mask_cache_entry *e;
+
+		e = &entries[index];
+		if (e->skb_hash == skb_hash) {
+			flow = flow_lookup(tbl, ti, ma, key, n_mask_hit,
+					   n_cache_hit, &e->mask_index);
+			if (!flow)
+				e->skb_hash = 0;
 			return flow;
+		}
+
+		if (!ce || e->skb_hash < ce->skb_hash)
+			ce = e;  /* A better replacement cache candidate. */
+
+		hash >>= MC_HASH_SHIFT;
 	}
-	return NULL;
+
+	/* Cache miss, do full lookup. */
+	flow = flow_lookup(tbl, ti, ma, key, n_mask_hit, n_cache_hit,
+			   &mask_index);
+	if (flow) {
+		ce->skb_hash = skb_hash;
+		ce->mask_index = mask_index;
+	}
+
+	return flow;
 }
 
 struct sw_flow *ovs_flow_tbl_lookup(struct flow_table *tbl,
 				    const struct sw_flow_key *key)
 {
+	struct table_instance *ti = rcu_dereference_ovsl(tbl->ti);
+	struct mask_array *ma = rcu_dereference_ovsl(tbl->mask_array);
 	u32 __always_unused n_mask_hit;
+	u32 __always_unused n_cache_hit;
+	struct sw_flow *flow;
+	u32 index = ma->count;
 
-	return ovs_flow_tbl_lookup_stats(tbl, key, &n_mask_hit);
+	/* This function gets called through the netlink interface and
+	 * therefore is preemptible.  flow_lookup() updates per cpu mask
+	 * counters, so it must run with BH disabled.
+	 */
+	local_bh_disable();
+	flow = flow_lookup(tbl, ti, ma, key, &n_mask_hit, &n_cache_hit, &index);
+	local_bh_enable();
+
+	return flow;
 }
 
 struct sw_flow *ovs_flow_tbl_lookup_exact(struct flow_table *tbl,
 					  const struct sw_flow_match *match)
 {
 	struct table_instance *ti = rcu_dereference_ovsl(tbl->ti);
+	struct mask_array *ma = ovsl_dereference(tbl->mask_array);
+	u32 __always_unused n_mask_hit;
 	struct sw_flow_mask *mask;
 	struct sw_flow *flow;
+	int i;
 
 	/* Always called under ovs-mutex. */
-	list_for_each_entry(mask, &tbl->mask_list, list) {
-		flow = masked_flow_lookup(ti, match->key, mask);
+	for (i = 0; i < ma->count; i++) {
+		mask = ovsl_dereference(ma->masks[i]);
+		if (!mask)
+			continue;
+
+		flow = masked_flow_lookup(ti, match->key, mask, &n_mask_hit);
 		if (flow && ovs_identifier_is_key(&flow->id) &&
 		    ovs_flow_cmp_unmasked_key(flow, match))
 			return flow;
@@ -566,11 +769,12 @@ struct sw_flow *ovs_flow_tbl_lookup_ufid(struct flow_table *tbl,
 
 int ovs_flow_tbl_num_masks(const struct flow_table *table)
 {
-	struct sw_flow_mask *mask;
-	int num = 0;
+	struct mask_array *ma = rcu_dereference_ovsl(table->mask_array);
+	int i, num = 0;
 
-	list_for_each_entry(mask, &table->mask_list, list)
-		num++;
+	for (i = 0; i < ma->count; i++)
+		if (rcu_access_pointer(ma->masks[i]))
+			num++;
 
 	return num;
 }
@@ -581,6 +785,24 @@ static struct table_instance *table_instance_expand(struct table_instance *ti,
 	return table_instance_rehash(ti, ti->n_buckets * 2, ufid);
 }
 
+/* Must be called with OVS mutex held. */
+static void tbl_mask_array_del_mask(struct flow_table *tbl,
+				    struct sw_flow_mask *mask)
+{
+	struct mask_array *ma = ovsl_dereference(tbl->mask_array);
+	int i;
+
+	/* Leave a hole rather than reallocate here, this path cannot fail */
+	for (i = 0; i < ma->count; i++) {
+		if (ovsl_dereference(ma->masks[i]) == mask) {
+			RCU_INIT_POINTER(ma->masks[i], NULL);
+			return;
+		}
+	}
+
+	WARN_ON_ONCE(1);
+}
+
 /* Remove 'mask' from the mask list, if it is not needed any more. */
 static void flow_mask_remove(struct flow_table *tbl, struct sw_flow_mask *mask)
 {
@@ -593,7 +815,7 @@ static void flow_mask_remove(struct flow_table *tbl, struct sw_flow_mask *mask)
 		mask->ref_count--;
 
 		if (!mask->ref_count) {
-			list_del_rcu(&mask->list);
+			tbl_mask_array_del_mask(tbl, mask);
 			kfree_rcu(mask, rcu);
 		}
 	}
@@ -644,18 +866,46 @@ static bool mask_equal(const struct sw_flow_mask *a,
 static struct sw_flow_mask *flow_mask_find(const struct flow_table *tbl,
 					   const struct sw_flow_mask *mask)
 {
-	struct list_head *ml;
+	struct mask_array *ma = ovsl_dereference(tbl->mask_array);
+	int i;
+
+	for (i = 0; i < ma->count; i++) {
+		struct sw_flow_mask *m = ovsl_dereference(ma->masks[i]);
 
-	list_for_each(ml, &tbl->mask_list) {
-		struct sw_flow_mask *m;
-		m = container_of(ml, struct sw_flow_mask, list);
-		if (mask_equal(mask, m))
+		if (m && mask_equal(mask, m))
 			return m;
 	}
 
 	return NULL;
 }
 
+/* Must be called with OVS mutex held.  Appends 'new' and squeezes out the
+ * holes left by removed masks.
+ */
+static int tbl_mask_array_add_mask(struct flow_table *tbl,
+				   struct sw_flow_mask *new)
+{
+	struct mask_array *ma = ovsl_dereference(tbl->mask_array);
+	struct mask_array *new_ma;
+	int i, count = 0;
+
+	new_ma = tbl_mask_array_alloc(ma->count + 1);
+	if (!new_ma)
+		return -ENOMEM;
+
+	for (i = 0; i < ma->count; i++) {
+		struct sw_flow_mask *mask = ovsl_dereference(ma->masks[i]);
+
+		if (mask)
+			RCU_INIT_POINTER(new_ma->masks[count++], mask);
+	}
+	RCU_INIT_POINTER(new_ma->masks[count++], new);
+	new_ma->count = count;
+
+	tbl_mask_array_replace(tbl, new_ma);
+	return 0;
+}
+
 /* Add 'mask' into the mask list, if it is not already there. */
 static int flow_mask_insert(struct flow_table *tbl, struct sw_flow *flow,
 			    const struct sw_flow_mask *new)
@@ -669,7 +919,12 @@ static int flow_mask_insert(struct flow_table *tbl, struct sw_flow *flow,
 			return -ENOMEM;
 		mask->key = new->key;
 		mask->range = new->range;
-		list_add_rcu(&mask->list, &tbl->mask_list);
+
+		/* Add mask to mask-list. */
+		if (tbl_mask_array_add_mask(tbl, mask)) {
+			kfree(mask);
+			return -ENOMEM;
+		}
 	} else {
 		BUG_ON(!mask->ref_count);
 		mask->ref_count++;
@@ -741,6 +996,101 @@ int ovs_flow_tbl_insert(struct flow_table *table, struct sw_flow *flow,
 	return 0;
 }
 
+struct mask_count {
+	int index;
+	u64 counter;
+};
+
+static int compare_mask_and_count(const void *a, const void *b)
+{
+	const struct mask_count *mc_a = a;
+	const struct mask_count *mc_b = b;
+
+	if (mc_a->counter < mc_b->counter)
+		return 1;
+	if (mc_a->counter > mc_b->counter)
+		return -1;
+	return 0;
+}
+
+/* Must be called with OVS mutex held.  Reorders the masks so the ones hit
+ * most often since the last call are tried first.
+ */
+void ovs_flow_masks_rebalance(struct flow_table *table)
+{
+	struct mask_array *ma = ovsl_dereference(table->mask_array);
+	struct mask_count *masks_and_count;
+	struct mask_array *new;
+	int masks_entries = 0;
+	int i;
+
+	if (!ma->count)
+		return;
+
+	/* Build array of all current entries with use counters. */
+	masks_and_count = kmalloc_array(ma->count, sizeof(*masks_and_count),
+					GFP_KERNEL);
+	if (!masks_and_count)
+		return;
+
+	for (i = 0; i < ma->count; i++) {
+		struct mask_count *mc = &masks_and_count[masks_entries];
+		int cpu;
+
+		if (!ovsl_dereference(ma->masks[i]))
+			continue;
+
+		mc->index = i;
+		mc->counter = 0;
+		for_each_possible_cpu(cpu) {
+			struct mask_array_stats *stats;
+			unsigned int start;
+			u64 counter;
+
+			stats = per_cpu_ptr(ma->masks_usage_stats, cpu);
+			do {
+				start = u64_stats_fetch_begin_irq(&stats->syncp);
+				counter = stats->usage_cntrs[i];
+			} while (u64_stats_fetch_retry_irq(&stats->syncp,
+							   start));
+
+			mc->counter += counter;
+		}
+
+		/* Only count the hits since the last rebalance. */
+		mc->counter -= ma->masks_usage_zero_cntr[i];
+		ma->masks_usage_zero_cntr[i] += mc->counter;
+		masks_entries++;
+	}
+
+	sort(masks_and_count, masks_entries, sizeof(*masks_and_count),
+	     compare_mask_and_count, NULL);
+
+	/* Nothing to do if the order holds and there are no holes. */
+	for (i = 0; i < masks_entries; i++)
+		if (masks_and_count[i].index != i)
+			break;
+	if (i == masks_entries && masks_entries == ma->count)
+		goto free_mask_entries;
+
+	new = tbl_mask_array_alloc(masks_entries);
+	if (!new)
+		goto free_mask_entries;
+
+	for (i = 0; i < masks_entries; i++) {
+		int index = masks_and_count[i].index;
+
+		RCU_INIT_POINTER(new->masks[i],
+				 ovsl_dereference(ma->masks[index]));
+	}
+	new->count = masks_entries;
+
+	tbl_mask_array_replace(table, new);
+
+free_mask_entries:
+	kfree(masks_and_count);
+}
+
 /* Initializes the flow module.
  * Returns zero if successful or a negative error code. */
 int ovs_flow_init(void)
@@ -14,6 +14,10 @@
 #include <linux/module.h>
 #include <linux/rhashtable.h>
 #include <linux/workqueue.h>
+#include <linux/jhash.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/sort.h>
 
 #include <linux/if_ether.h>
 #include <linux/in6.h>
@@ -57,17 +61,52 @@ struct fl_flow_mask_range {
 struct fl_flow_mask {
 	struct fl_flow_key key;
 	struct fl_flow_mask_range range;
-	struct rcu_head	rcu;
+	struct rhashtable ht;
+	struct rhashtable_params filter_ht_params;
+	struct flow_dissector dissector;
+	unsigned int refcnt;
+	u64 __percpu *hits;
+	u64 hits_last;
+	u64 usage;
+	union {
+		struct work_struct work;
+		struct rcu_head	rcu;
+	};
 };
 
-struct cls_fl_head {
-	struct rhashtable ht;
-	struct fl_flow_mask mask;
+/* Masks in use by the filters of one classifier instance, the most used
+ * ones first.  A removed mask leaves a NULL slot behind which goes away
+ * with the next rebuild.  @range and @dissector cover every mask, so that
+ * a packet is dissected once for all of them.
+ */
+struct fl_mask_array {
+	struct rcu_head rcu;
+	struct fl_flow_mask_range range;
 	struct flow_dissector dissector;
+	int count;
+	struct fl_flow_mask __rcu *masks[];
+};
+
+#define FL_MASK_CACHE_SIZE		256
+#define FL_MASKS_REBALANCE_INTERVAL	4000 /* msecs */
+
+/* Per-cpu cache of the mask index that last matched a given dissected key */
+struct fl_mask_cache_entry {
+	u32 hash;
+	u32 index;
+};
+
+struct fl_mask_cache {
+	struct fl_mask_cache_entry entries[FL_MASK_CACHE_SIZE];
+};
+
+struct cls_fl_head {
+	struct fl_mask_array __rcu *mask_array;
+	struct fl_mask_cache __percpu *mask_cache;
+	struct mutex masks_lock;	/* protects mask_array updates */
+	struct delayed_work rebalance_work;
 	u32 hgen;
-	bool mask_assigned;
 	struct list_head filters;
-	struct rhashtable_params ht_params;
 	union {
 		struct work_struct work;
 		struct rcu_head	rcu;
@@ -75,6 +114,7 @@ struct cls_fl_head {
 };
 
 struct cls_fl_filter {
+	struct fl_flow_mask *mask;
 	struct rhash_head ht_node;
 	struct fl_flow_key mkey;
 	struct tcf_exts exts;
@@ -128,33 +168,85 @@ static void fl_set_masked_key(struct fl_flow_key *mkey, struct fl_flow_key *key,
 		*lmkey++ = *lkey++ & *lmask++;
 }
 
-static void fl_clear_masked_range(struct fl_flow_key *key,
-				  struct fl_flow_mask *mask)
+static struct cls_fl_filter *fl_lookup(struct fl_flow_mask *mask,
+				       struct fl_flow_key *mkey)
 {
-	memset(fl_key_get_start(key, mask), 0, fl_mask_range(mask));
+	return rhashtable_lookup_fast(&mask->ht,
+				      fl_key_get_start(mkey, mask),
+				      mask->filter_ht_params);
 }
 
-static struct cls_fl_filter *fl_lookup(struct cls_fl_head *head,
-				       struct fl_flow_key *mkey)
+static struct cls_fl_filter *fl_lookup_mask(struct fl_flow_mask *mask,
+					    struct fl_flow_key *key)
 {
-	return rhashtable_lookup_fast(&head->ht,
-				      fl_key_get_start(mkey, &head->mask),
-				      head->ht_params);
+	struct fl_flow_key mkey;
+	struct cls_fl_filter *f;
+
+	fl_set_masked_key(&mkey, key, mask);
+	f = fl_lookup(mask, &mkey);
+	if (f)
+		this_cpu_inc(*mask->hits);
+	return f;
+}
+
+static struct cls_fl_filter *fl_lookup_masks(struct cls_fl_head *head,
+					     struct fl_mask_array *ma,
+					     struct fl_flow_key *key)
+{
+	unsigned short int len = ma->range.end - ma->range.start;
+	struct fl_mask_cache_entry *e;
+	struct fl_flow_mask *mask;
+	struct cls_fl_filter *f;
+	u32 hash;
+	int i;
+
+	if (ma->count == 1) {
+		mask = rcu_dereference_bh(ma->masks[0]);
+		return mask ? fl_lookup_mask(mask, key) : NULL;
+	}
+
+	hash = jhash2((u32 *)((u8 *)key + ma->range.start),
+		      len / sizeof(u32), 0);
+	e = &this_cpu_ptr(head->mask_cache)->entries[hash &
+						    (FL_MASK_CACHE_SIZE - 1)];
+	if (e->hash == hash && e->index < ma->count) {
+		mask = rcu_dereference_bh(ma->masks[e->index]);
+		if (mask) {
+			f = fl_lookup_mask(mask, key);
+			if (f)
+				return f;
+		}
+	}
+
+	for (i = 0; i < ma->count; i++) {
+		mask = rcu_dereference_bh(ma->masks[i]);
+		if (!mask)
+			continue;
+		f = fl_lookup_mask(mask, key);
+		if (f) {
+			e->hash = hash;
+			e->index = i;
+			return f;
+		}
+	}
+	return NULL;
 }
 
 static int fl_classify(struct sk_buff *skb, const struct tcf_proto *tp,
 		       struct tcf_result *res)
 {
 	struct cls_fl_head *head = rcu_dereference_bh(tp->root);
+	struct fl_mask_array *ma;
 	struct cls_fl_filter *f;
 	struct fl_flow_key skb_key;
-	struct fl_flow_key skb_mkey;
 	struct ip_tunnel_info *info;
 
-	if (!atomic_read(&head->ht.nelems))
+	ma = rcu_dereference_bh(head->mask_array);
+	if (!ma || !ma->count)
 		return -1;
 
-	fl_clear_masked_range(&skb_key, &head->mask);
+	memset((u8 *)&skb_key + ma->range.start, 0,
+	       ma->range.end - ma->range.start);
 
 	info = skb_tunnel_info(skb);
 	if (info) {
@@ -185,11 +277,9 @@ static int fl_classify(struct sk_buff *skb, const struct tcf_proto *tp,
 	 * so do it rather here.
 	 */
 	skb_key.basic.n_proto = skb->protocol;
-	skb_flow_dissect(skb, &head->dissector, &skb_key, 0);
-
-	fl_set_masked_key(&skb_mkey, &skb_key, &head->mask);
+	skb_flow_dissect(skb, &ma->dissector, &skb_key, 0);
 
-	f = fl_lookup(head, &skb_mkey);
+	f = fl_lookup_masks(head, ma, &skb_key);
 	if (f && !tc_skip_sw(f->flags)) {
 		*res = f->res;
 		return tcf_exts_exec(skb, &f->exts, res);
@@ -197,6 +287,8 @@ static int fl_classify(struct sk_buff *skb, const struct tcf_proto *tp,
 	return -1;
 }
 
+static void fl_masks_rebalance(struct work_struct *work);
+
 static int fl_init(struct tcf_proto *tp)
 {
 	struct cls_fl_head *head;
@@ -205,6 +297,14 @@ static int fl_init(struct tcf_proto *tp)
 	if (!head)
 		return -ENOBUFS;
 
+	head->mask_cache = alloc_percpu(struct fl_mask_cache);
+	if (!head->mask_cache) {
+		kfree(head);
+		return -ENOBUFS;
+	}
+
+	mutex_init(&head->masks_lock);
+	INIT_DELAYED_WORK(&head->rebalance_work, fl_masks_rebalance);
 	INIT_LIST_HEAD_RCU(&head->filters);
 	rcu_assign_pointer(tp->root, head);
 
@@ -301,12 +401,20 @@ static void fl_hw_update_stats(struct tcf_proto *tp, struct cls_fl_filter *f)
 	dev->netdev_ops->ndo_setup_tc(dev, tp->q->handle, tp->protocol, tc);
 }
 
+static void fl_mask_put(struct cls_fl_head *head, struct fl_flow_mask *mask);
+
 static void __fl_delete(struct tcf_proto *tp, struct cls_fl_filter *f)
 {
+	struct cls_fl_head *head = rtnl_dereference(tp->root);
+
+	if (!tc_skip_sw(f->flags))
+		rhashtable_remove_fast(&f->mask->ht, &f->ht_node,
+				       f->mask->filter_ht_params);
 	list_del_rcu(&f->list);
 	if (!tc_skip_hw(f->flags))
 		fl_hw_destroy_filter(tp, f);
 	tcf_unbind_filter(tp, &f->res);
+	fl_mask_put(head, f->mask);
 	call_rcu(&f->rcu, fl_destroy_filter);
 }
 
@@ -314,8 +422,10 @@ static void fl_destroy_sleepable(struct work_struct *work)
 {
 	struct cls_fl_head *head = container_of(work, struct cls_fl_head,
 						work);
-	if (head->mask_assigned)
-		rhashtable_destroy(&head->ht);
+
+	cancel_delayed_work_sync(&head->rebalance_work);
+	kfree(rcu_dereference_raw(head->mask_array));
+	free_percpu(head->mask_cache);
 	kfree(head);
 	module_put(THIS_MODULE);
 }
@@ -679,14 +789,13 @@ static const struct rhashtable_params fl_ht_params = {
 	.automatic_shrinking = true,
 };
 
-static int fl_init_hashtable(struct cls_fl_head *head,
-			     struct fl_flow_mask *mask)
+static int fl_init_hashtable(struct fl_flow_mask *mask)
 {
-	head->ht_params = fl_ht_params;
-	head->ht_params.key_len = fl_mask_range(mask);
-	head->ht_params.key_offset += mask->range.start;
+	mask->filter_ht_params = fl_ht_params;
+	mask->filter_ht_params.key_len = fl_mask_range(mask);
+	mask->filter_ht_params.key_offset += mask->range.start;
 
-	return rhashtable_init(&head->ht, &head->ht_params);
+	return rhashtable_init(&mask->ht, &mask->filter_ht_params);
 }
 
 #define FL_KEY_MEMBER_OFFSET(member) offsetof(struct fl_flow_key, member)
@@ -709,68 +818,264 @@ static int fl_init_hashtable(struct cls_fl_head *head,
 			FL_KEY_SET(keys, cnt, id, member);			\
 	} while(0);
 
-static void fl_init_dissector(struct cls_fl_head *head,
-			      struct fl_flow_mask *mask)
+static void fl_init_dissector(struct flow_dissector *dissector,
+			      struct fl_flow_key *mask)
 {
 	struct flow_dissector_key keys[FLOW_DISSECTOR_KEY_MAX];
 	size_t cnt = 0;
 
 	FL_KEY_SET(keys, cnt, FLOW_DISSECTOR_KEY_CONTROL, control);
 	FL_KEY_SET(keys, cnt, FLOW_DISSECTOR_KEY_BASIC, basic);
-	FL_KEY_SET_IF_MASKED(&mask->key, keys, cnt,
+	FL_KEY_SET_IF_MASKED(mask, keys, cnt,
 			     FLOW_DISSECTOR_KEY_ETH_ADDRS, eth);
-	FL_KEY_SET_IF_MASKED(&mask->key, keys, cnt,
+	FL_KEY_SET_IF_MASKED(mask, keys, cnt,
 			     FLOW_DISSECTOR_KEY_IPV4_ADDRS, ipv4);
-	FL_KEY_SET_IF_MASKED(&mask->key, keys, cnt,
+	FL_KEY_SET_IF_MASKED(mask, keys, cnt,
 			     FLOW_DISSECTOR_KEY_IPV6_ADDRS, ipv6);
-	FL_KEY_SET_IF_MASKED(&mask->key, keys, cnt,
+	FL_KEY_SET_IF_MASKED(mask, keys, cnt,
 			     FLOW_DISSECTOR_KEY_PORTS, tp);
-	FL_KEY_SET_IF_MASKED(&mask->key, keys, cnt,
+	FL_KEY_SET_IF_MASKED(mask, keys, cnt,
 			     FLOW_DISSECTOR_KEY_ICMP, icmp);
-	FL_KEY_SET_IF_MASKED(&mask->key, keys, cnt,
+	FL_KEY_SET_IF_MASKED(mask, keys, cnt,
 			     FLOW_DISSECTOR_KEY_ARP, arp);
-	FL_KEY_SET_IF_MASKED(&mask->key, keys, cnt,
+	FL_KEY_SET_IF_MASKED(mask, keys, cnt,
 			     FLOW_DISSECTOR_KEY_VLAN, vlan);
-	FL_KEY_SET_IF_MASKED(&mask->key, keys, cnt,
+	FL_KEY_SET_IF_MASKED(mask, keys, cnt,
 			     FLOW_DISSECTOR_KEY_ENC_KEYID, enc_key_id);
-	FL_KEY_SET_IF_MASKED(&mask->key, keys, cnt,
+	FL_KEY_SET_IF_MASKED(mask, keys, cnt,
 			     FLOW_DISSECTOR_KEY_ENC_IPV4_ADDRS, enc_ipv4);
-	FL_KEY_SET_IF_MASKED(&mask->key, keys, cnt,
+	FL_KEY_SET_IF_MASKED(mask, keys, cnt,
 			     FLOW_DISSECTOR_KEY_ENC_IPV6_ADDRS, enc_ipv6);
-	if (FL_KEY_IS_MASKED(&mask->key, enc_ipv4) ||
-	    FL_KEY_IS_MASKED(&mask->key, enc_ipv6))
+	if (FL_KEY_IS_MASKED(mask, enc_ipv4) ||
+	    FL_KEY_IS_MASKED(mask, enc_ipv6))
 		FL_KEY_SET(keys, cnt, FLOW_DISSECTOR_KEY_ENC_CONTROL,
 			   enc_control);
-	FL_KEY_SET_IF_MASKED(&mask->key, keys, cnt,
+	FL_KEY_SET_IF_MASKED(mask, keys, cnt,
 			     FLOW_DISSECTOR_KEY_ENC_PORTS, enc_tp);
 
-	skb_flow_dissector_init(&head->dissector, keys, cnt);
+	skb_flow_dissector_init(dissector, keys, cnt);
+}
+
+static struct fl_mask_array *fl_mask_array(struct cls_fl_head *head)
+{
+	return rcu_dereference_protected(head->mask_array,
+					 lockdep_is_held(&head->masks_lock));
+}
+
+static struct fl_flow_mask *fl_mask_array_get(struct cls_fl_head *head,
+					      struct fl_mask_array *ma, int i)
+{
+	return rcu_dereference_protected(ma->masks[i],
+					 lockdep_is_held(&head->masks_lock));
+}
+
+/* Set up the dissector and key range matching every mask in @ma */
+static void fl_mask_array_init(struct fl_mask_array *ma)
+{
+	unsigned short int start = sizeof(struct fl_flow_key), end = 0;
+	struct fl_flow_key key = {};
+	int i, j;
+
+	for (i = 0; i < ma->count; i++) {
+		struct fl_flow_mask *mask = rcu_dereference_raw(ma->masks[i]);
+		const long *lmask = (const long *) &mask->key;
+		long *lkey = (long *) &key;
+
+		for (j = 0; j < sizeof(key) / sizeof(long); j++)
+			lkey[j] |= lmask[j];
+		start = min(start, mask->range.start);
+		end = max(end, mask->range.end);
+	}
+	if (!end)
+		start = 0;
+	ma->range.start = start;
+	ma->range.end = end;
+
+	fl_init_dissector(&ma->dissector, &key);
+}
+
+static int fl_mask_cmp(const void *a, const void *b)
+{
+	const struct fl_flow_mask *ma = *(struct fl_flow_mask * const *) a;
+	const struct fl_flow_mask *mb = *(struct fl_flow_mask * const *) b;
+
+	if (ma->usage > mb->usage)
+		return -1;
+	if (ma->usage < mb->usage)
+		return 1;
+	return 0;
+}
+
+/* Replace the mask array with a copy that has no holes, optionally with
+ * @newmask appended or with the masks reordered by their recent hits.
+ * Called with masks_lock held.
+ */
+static int fl_mask_array_rebuild(struct cls_fl_head *head,
+				 struct fl_flow_mask *newmask, bool rebalance)
+{
+	struct fl_mask_array *old = fl_mask_array(head);
+	struct fl_mask_array *ma;
+	int i, count;
+
+	count = (old ? old->count : 0) + !!newmask;
+	ma = kzalloc(sizeof(*ma) + count * sizeof(ma->masks[0]), GFP_KERNEL);
+	if (!ma)
+		return -ENOMEM;
+
+	for (i = 0; old && i < old->count; i++) {
+		struct fl_flow_mask *mask = fl_mask_array_get(head, old, i);
+
+		if (!mask)
+			continue;
+		if (rebalance) {
+			u64 hits = 0;
+			int cpu;
+
+			for_each_possible_cpu(cpu)
+				hits += *per_cpu_ptr(mask->hits, cpu);
+			mask->usage = hits - mask->hits_last;
+			mask->hits_last = hits;
+		}
+		RCU_INIT_POINTER(ma->masks[ma->count++], mask);
+	}
+	if (newmask)
+		RCU_INIT_POINTER(ma->masks[ma->count++], newmask);
+	if (rebalance)
+		sort(ma->masks, ma->count, sizeof(ma->masks[0]),
+		     fl_mask_cmp, NULL);
+	fl_mask_array_init(ma);
+
+	rcu_assign_pointer(head->mask_array, ma);
+	if (old)
+		kfree_rcu(old, rcu);
+	return 0;
+}
+
+static void fl_masks_rebalance(struct work_struct *work)
+{
+	struct cls_fl_head *head = container_of(to_delayed_work(work),
+						struct cls_fl_head,
+						rebalance_work);
+	struct fl_mask_array *ma;
+
+	mutex_lock(&head->masks_lock);
+	/* on allocation failure just keep the current order */
+	fl_mask_array_rebuild(head, NULL, true);
+	ma = fl_mask_array(head);
+	if (ma && ma->count > 1)
+		schedule_delayed_work(&head->rebalance_work,
+				      msecs_to_jiffies(FL_MASKS_REBALANCE_INTERVAL));
+	mutex_unlock(&head->masks_lock);
+}
+
+static void fl_mask_free_work(struct work_struct *work)
+{
+	struct fl_flow_mask *mask = container_of(work, struct fl_flow_mask,
+						 work);
+
+	rhashtable_destroy(&mask->ht);
+	free_percpu(mask->hits);
+	kfree(mask);
+	module_put(THIS_MODULE);
+}
+
+static void fl_mask_free_rcu(struct rcu_head *rcu)
+{
+	struct fl_flow_mask *mask = container_of(rcu, struct fl_flow_mask,
+						 rcu);
+
+	INIT_WORK(&mask->work, fl_mask_free_work);
+	schedule_work(&mask->work);
+}
+
+static void fl_mask_put(struct cls_fl_head *head, struct fl_flow_mask *mask)
+{
+	struct fl_mask_array *ma;
+	int i;
+
+	if (--mask->refcnt)
+		return;
+
+	/* Leave a hole, the next rebuild will get rid of it */
+	mutex_lock(&head->masks_lock);
+	ma = fl_mask_array(head);
+	for (i = 0; i < ma->count; i++) {
+		if (rcu_access_pointer(ma->masks[i]) == mask) {
+			RCU_INIT_POINTER(ma->masks[i], NULL);
+			break;
+		}
+	}
+	mutex_unlock(&head->masks_lock);
+
+	__module_get(THIS_MODULE);
+	call_rcu(&mask->rcu, fl_mask_free_rcu);
 }
 
 static int fl_check_assign_mask(struct cls_fl_head *head,
+				struct cls_fl_filter *fnew,
 				struct fl_flow_mask *mask)
 {
-	int err;
-
-	if (head->mask_assigned) {
-		if (!fl_mask_eq(&head->mask, mask))
-			return -EINVAL;
-		else
-			return 0;
+	struct fl_flow_mask *newmask;
+	struct fl_mask_array *ma;
+	int i, err;
+
+	mutex_lock(&head->masks_lock);
+	ma = fl_mask_array(head);
+	for (i = 0; ma && i < ma->count; i++) {
+		struct fl_flow_mask *m = fl_mask_array_get(head, ma, i);
+
+		if (m && fl_mask_eq(m, mask)) {
+			m->refcnt++;
+			fnew->mask = m;
+			err = 0;
+			goto out_unlock;
+		}
 	}
 
-	/* Mask is not assigned yet. So assign it and init hashtable
+	/* No filter uses this mask yet. So create it and init hashtable
 	 * according to that.
 	 */
-	err = fl_init_hashtable(head, mask);
+	newmask = kzalloc(sizeof(*newmask), GFP_KERNEL);
+	if (!newmask) {
+		err = -ENOMEM;
+		goto out_unlock;
+	}
+	memcpy(&newmask->key, &mask->key, sizeof(newmask->key));
+	newmask->range = mask->range;
+
+	newmask->hits = alloc_percpu(u64);
+	if (!newmask->hits) {
+		err = -ENOMEM;
+		goto errout_free;
+	}
+
+	err = fl_init_hashtable(newmask);
 	if (err)
-		return err;
-	memcpy(&head->mask, mask, sizeof(head->mask));
-	head->mask_assigned = true;
+		goto errout_hits;
 
-	fl_init_dissector(head, mask);
+	fl_init_dissector(&newmask->dissector, &newmask->key);
 
+	err = fl_mask_array_rebuild(head, newmask, false);
+	if (err)
+		goto errout_ht;
+
+	newmask->refcnt = 1;
+	fnew->mask = newmask;
+	if (fl_mask_array(head)->count > 1)
+		schedule_delayed_work(&head->rebalance_work,
+				      msecs_to_jiffies(FL_MASKS_REBALANCE_INTERVAL));
+	mutex_unlock(&head->masks_lock);
 	return 0;
+
+errout_ht:
+	rhashtable_destroy(&newmask->ht);
+errout_hits:
+	free_percpu(newmask->hits);
+errout_free:
+	kfree(newmask);
+out_unlock:
+	mutex_unlock(&head->masks_lock);
+	return err;
 }
 
 static int fl_set_parms(struct net *net, struct tcf_proto *tp,
@@ -837,17 +1142,23 @@ static int fl_change(struct net *net, struct sk_buff *in_skb,
 	struct cls_fl_head *head = rtnl_dereference(tp->root);
 	struct cls_fl_filter *fold = (struct cls_fl_filter *) *arg;
 	struct cls_fl_filter *fnew;
+	struct fl_flow_mask *mask;
 	struct nlattr **tb;
-	struct fl_flow_mask mask = {};
 	int err;
 
 	if (!tca[TCA_OPTIONS])
 		return -EINVAL;
 
-	tb = kcalloc(TCA_FLOWER_MAX + 1, sizeof(struct nlattr *), GFP_KERNEL);
-	if (!tb)
+	mask = kzalloc(sizeof(*mask), GFP_KERNEL);
+	if (!mask)
 		return -ENOBUFS;
 
+	tb = kcalloc(TCA_FLOWER_MAX + 1, sizeof(struct nlattr *), GFP_KERNEL);
+	if (!tb) {
+		err = -ENOBUFS;
+		goto errout_mask_alloc;
+	}
+
 	err = nla_parse_nested(tb, TCA_FLOWER_MAX, tca[TCA_OPTIONS], fl_policy);
 	if (err < 0)
 		goto errout_tb;
@@ -885,33 +1196,33 @@ static int fl_change(struct net *net, struct sk_buff *in_skb,
 		}
 	}
 
-	err = fl_set_parms(net, tp, fnew, &mask, base, tb, tca[TCA_RATE], ovr);
+	err = fl_set_parms(net, tp, fnew, mask, base, tb, tca[TCA_RATE], ovr);
 	if (err)
 		goto errout;
 
-	err = fl_check_assign_mask(head, &mask);
+	err = fl_check_assign_mask(head, fnew, mask);
 	if (err)
 		goto errout;
 
 	if (!tc_skip_sw(fnew->flags)) {
-		if (!fold && fl_lookup(head, &fnew->mkey)) {
+		if (!fold && fl_lookup(fnew->mask, &fnew->mkey)) {
 			err = -EEXIST;
-			goto errout;
+			goto errout_mask;
 		}
 
-		err = rhashtable_insert_fast(&head->ht, &fnew->ht_node,
-					     head->ht_params);
+		err = rhashtable_insert_fast(&fnew->mask->ht, &fnew->ht_node,
+					     fnew->mask->filter_ht_params);
 		if (err)
-			goto errout;
+			goto errout_mask;
 	}
 
 	if (!tc_skip_hw(fnew->flags)) {
 		err = fl_hw_replace_filter(tp,
-					   &head->dissector,
-					   &mask.key,
+					   &fnew->mask->dissector,
+					   &fnew->mask->key,
 					   fnew);
 		if (err)
-			goto errout;
+			goto errout_ht;
 	}
 
 	if (!tc_in_hw(fnew->flags))
@@ -919,8 +1230,8 @@ static int fl_change(struct net *net, struct sk_buff *in_skb,
 
 	if (fold) {
 		if (!tc_skip_sw(fold->flags))
-			rhashtable_remove_fast(&head->ht, &fold->ht_node,
-					       head->ht_params);
+			rhashtable_remove_fast(&fold->mask->ht, &fold->ht_node,
+					       fold->mask->filter_ht_params);
 		if (!tc_skip_hw(fold->flags))
 			fl_hw_destroy_filter(tp, fold);
 	}
@@ -930,30 +1241,40 @@ static int fl_change(struct net *net, struct sk_buff *in_skb,
 	if (fold) {
 		list_replace_rcu(&fold->list, &fnew->list);
 		tcf_unbind_filter(tp, &fold->res);
+		fl_mask_put(head, fold->mask);
 		call_rcu(&fold->rcu, fl_destroy_filter);
 	} else {
 		list_add_tail_rcu(&fnew->list, &head->filters);
 	}
 
 	kfree(tb);
+	kfree(mask);
 	return 0;
 
+errout_ht:
+	/* the filter may already have been found by the classifier */
+	if (!tc_skip_sw(fnew->flags))
+		rhashtable_remove_fast(&fnew->mask->ht, &fnew->ht_node,
+				       fnew->mask->filter_ht_params);
+	fl_mask_put(head, fnew->mask);
+	call_rcu(&fnew->rcu, fl_destroy_filter);
+	goto errout_tb;
+errout_mask:
+	fl_mask_put(head, fnew->mask);
 errout:
 	tcf_exts_destroy(&fnew->exts);
 	kfree(fnew);
 errout_tb:
 	kfree(tb);
+errout_mask_alloc:
+	kfree(mask);
 	return err;
 }
 
 static int fl_delete(struct tcf_proto *tp, unsigned long arg)
 {
-	struct cls_fl_head *head = rtnl_dereference(tp->root);
 	struct cls_fl_filter *f = (struct cls_fl_filter *) arg;
 
-	if (!tc_skip_sw(f->flags))
-		rhashtable_remove_fast(&head->ht, &f->ht_node,
-				       head->ht_params);
 	__fl_delete(tp, f);
 	return 0;
 }
@@ -1056,7 +1377,6 @@ static int fl_dump_key_flags(struct sk_buff *skb, u32 flags_key, u32 flags_mask)
 static int fl_dump(struct net *net, struct tcf_proto *tp, unsigned long fh,
 		   struct sk_buff *skb, struct tcmsg *t)
 {
-	struct cls_fl_head *head = rtnl_dereference(tp->root);
 	struct cls_fl_filter *f = (struct cls_fl_filter *) fh;
 	struct nlattr *nest;
 	struct fl_flow_key *key, *mask;
@@ -1075,7 +1395,7 @@ static int fl_dump(struct net *net, struct tcf_proto *tp, unsigned long fh,
 		goto nla_put_failure;
 
 	key = &f->key;
-	mask = &head->mask.key;
+	mask = &f->mask->key;
 
 	if (mask->indev_ifindex) {
 		struct net_device *dev;
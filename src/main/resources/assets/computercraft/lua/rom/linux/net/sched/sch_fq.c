@@ -22,6 +22,13 @@
  *  bunch of packets, and this packet scheduler adds delay between
  *  packets to respect rate limitation.
  *
+ *  Transport can instead stamp each packet with its earliest departure
+ *  time in skb->tstamp (EDT), in which case we only hold packets until
+ *  that time and do no rate computation of our own.
+ *
+ *  Throttled flows wait in a hierarchical timer wheel, so throttling and
+ *  releasing a flow is O(1) however many flows are delayed.
+ *
  *  enqueue() :
  *   - lookup one RB tree (out of 1024 or more) to find the flow.
  *     If non existent flow, create it, add it to the tree.
@@ -45,6 +52,7 @@
 #include <linux/skbuff.h>
 #include <linux/slab.h>
 #include <linux/rbtree.h>
+#include <linux/bitops.h>
 #include <linux/hash.h>
 #include <linux/prefetch.h>
 #include <linux/vmalloc.h>
@@ -70,7 +78,7 @@ struct fq_flow {
 	u32		socket_hash;	/* sk_hash */
 	struct fq_flow *next;		/* next pointer in RR lists, or &detached */
 
-	struct rb_node  rate_node;	/* anchor in q->delayed tree */
+	struct fq_flow	*wheel_next;	/* next flow in the same wheel slot */
 	u64		time_next_packet;
 };
 
@@ -79,12 +87,39 @@ struct fq_flow_head {
 	struct fq_flow *last;
 };
 
+/*
+ * Timer wheel of throttled flows.
+ *
+ * Level 0 has 64 slots of 2^14 ns (~16 us), each level above has slots 64
+ * times as large, four levels reach ~4.6 minutes.  A flow goes to the
+ * lowest level whose slots can tell its time apart from now, and moves
+ * down (cascades) as the wheel turns and its slot becomes the current one
+ * in its level.  Flows only leave the wheel from the current level 0 slot,
+ * and only once their exact time has passed.
+ */
+#define FQ_WHEEL_GRAN		14
+#define FQ_WHEEL_BITS		6
+#define FQ_WHEEL_SIZE		(1 << FQ_WHEEL_BITS)
+#define FQ_WHEEL_MASK		(FQ_WHEEL_SIZE - 1)
+#define FQ_WHEEL_LEVELS		4
+
+struct fq_wheel {
+	u64		clk;		/* current level 0 slot, in ticks */
+	u64		pending[FQ_WHEEL_LEVELS];	/* non empty slots */
+	struct fq_flow	*slots[FQ_WHEEL_LEVELS][FQ_WHEEL_SIZE];
+};
+
+/* EDT stamps further away than this are not departure times: they come
+ * from received packets (forwarded, or looped back) and are ignored
+ */
+#define FQ_EDT_HORIZON		(10ULL * NSEC_PER_SEC)
+
 struct fq_sched_data {
 	struct fq_flow_head new_flows;
 
 	struct fq_flow_head old_flows;
 
-	struct rb_root	delayed;	/* for rate limited flows */
+	struct fq_wheel	delayed;	/* for rate limited flows */
 	u64		time_next_delayed_flow;
 	unsigned long	unthrottle_latency_ns;
 
@@ -128,22 +163,81 @@ static bool fq_flow_is_detached(const struct fq_flow *f)
 	return f->next == &detached;
 }
 
-static void fq_flow_set_throttled(struct fq_sched_data *q, struct fq_flow *f)
+static void fq_wheel_reset(struct fq_wheel *w, u64 now)
 {
-	struct rb_node **p = &q->delayed.rb_node, *parent = NULL;
+	memset(w, 0, sizeof(*w));
+	w->clk = now >> FQ_WHEEL_GRAN;
+}
 
-	while (*p) {
-		struct fq_flow *aux;
+static void fq_wheel_add(struct fq_wheel *w, struct fq_flow *f)
+{
+	u64 tick = max(f->time_next_packet >> FQ_WHEEL_GRAN, w->clk);
+	unsigned int lvl, shift = 0, idx;
 
-		parent = *p;
-		aux = rb_entry(parent, struct fq_flow, rate_node);
-		if (f->time_next_packet >= aux->time_next_packet)
-			p = &parent->rb_right;
-		else
-			p = &parent->rb_left;
+	for (lvl = 0; lvl < FQ_WHEEL_LEVELS - 1; lvl++) {
+		shift = lvl * FQ_WHEEL_BITS;
+		if ((tick >> shift) - (w->clk >> shift) < FQ_WHEEL_SIZE)
+			break;
 	}
-	rb_link_node(&f->rate_node, parent, p);
-	rb_insert_color(&f->rate_node, &q->delayed);
+	if (lvl == FQ_WHEEL_LEVELS - 1) {
+		/* Beyond the reach of the wheel, park in the furthest slot.
+		 * The flow comes out early and is simply throttled again.
+		 */
+		shift = lvl * FQ_WHEEL_BITS;
+		tick = min(tick, ((w->clk >> shift) + FQ_WHEEL_MASK) << shift);
+	}
+
+	idx = (tick >> shift) & FQ_WHEEL_MASK;
+	f->wheel_next = w->slots[lvl][idx];
+	w->slots[lvl][idx] = f;
+	w->pending[lvl] |= 1ULL << idx;
+}
+
+/* First tick after the current one at which a slot becomes current */
+static u64 fq_wheel_next(const struct fq_wheel *w)
+{
+	u64 next = ~0ULL;
+	unsigned int lvl;
+
+	for (lvl = 0; lvl < FQ_WHEEL_LEVELS; lvl++) {
+		unsigned int shift = lvl * FQ_WHEEL_BITS;
+		unsigned int cur = (w->clk >> shift) & FQ_WHEEL_MASK;
+		unsigned int rot = (cur + 1) & FQ_WHEEL_MASK;
+		u64 pend = w->pending[lvl];
+
+		if (!pend)
+			continue;
+		/* bit 0 of pend is now the slot after the current one */
+		if (rot)
+			pend = ror64(pend, rot);
+		next = min(next, ((w->clk >> shift) + __ffs64(pend) + 1) << shift);
+	}
+	return next;
+}
+
+/* Move the flows of the current slot of @lvl down the wheel */
+static void fq_wheel_cascade(struct fq_wheel *w, unsigned int lvl)
+{
+	unsigned int idx = (w->clk >> (lvl * FQ_WHEEL_BITS)) & FQ_WHEEL_MASK;
+	struct fq_flow *f = w->slots[lvl][idx];
+
+	w->slots[lvl][idx] = NULL;
+	w->pending[lvl] &= ~(1ULL << idx);
+	while (f) {
+		struct fq_flow *next = f->wheel_next;
+
+		fq_wheel_add(w, f);
+		f = next;
+	}
+}
+
+static void fq_flow_set_throttled(struct fq_sched_data *q, struct fq_flow *f,
+				  u64 now)
+{
+	/* Do not let an idle wheel lag behind, it would have to catch up */
+	if (!q->throttled_flows)
+		q->delayed.clk = now >> FQ_WHEEL_GRAN;
+	fq_wheel_add(&q->delayed, f);
 	q->throttled_flows++;
 	q->stat_throttled++;
 
@@ -267,6 +361,9 @@ static struct fq_flow *fq_classify(struct sk_buff *skb, struct fq_sched_data *q)
 				     f->socket_hash != sk->sk_hash)) {
 				f->credit = q->initial_quantum;
 				f->socket_hash = sk->sk_hash;
+				if (q->rate_enable)
+					smp_store_release(&sk->sk_pacing_status,
+							  SK_PACING_FQ);
 				f->time_next_packet = 0ULL;
 			}
 			return f;
@@ -284,8 +381,13 @@ static struct fq_flow *fq_classify(struct sk_buff *skb, struct fq_sched_data *q)
 	}
 	fq_flow_set_detached(f);
 	f->sk = sk;
-	if (skb->sk)
+	if (skb->sk) {
 		f->socket_hash = sk->sk_hash;
+		/* we pace this socket, tcp does not need to */
+		if (q->rate_enable)
+			smp_store_release(&sk->sk_pacing_status,
+					  SK_PACING_FQ);
+	}
 	f->credit = q->initial_quantum;
 
 	rb_link_node(&f->fq_node, parent, p);
@@ -407,10 +509,53 @@ static int fq_enqueue(struct sk_buff *skb, struct Qdisc *sch,
 	return NET_XMIT_SUCCESS;
 }
 
+/* Release the flows of the current level 0 slot whose time has come */
+static void fq_wheel_expire(struct fq_sched_data *q, u64 now)
+{
+	struct fq_wheel *w = &q->delayed;
+	unsigned int idx = w->clk & FQ_WHEEL_MASK;
+	struct fq_flow *f = w->slots[0][idx];
+
+	w->slots[0][idx] = NULL;
+	w->pending[0] &= ~(1ULL << idx);
+	while (f) {
+		struct fq_flow *next = f->wheel_next;
+
+		if (f->time_next_packet > now) {
+			f->wheel_next = w->slots[0][idx];
+			w->slots[0][idx] = f;
+			w->pending[0] |= 1ULL << idx;
+		} else {
+			q->throttled_flows--;
+			fq_flow_add_tail(&q->old_flows, f);
+		}
+		f = next;
+	}
+}
+
+/* When fq_check_throttled() has to look at the wheel again */
+static u64 fq_wheel_next_time(const struct fq_wheel *w)
+{
+	unsigned int idx = w->clk & FQ_WHEEL_MASK;
+	u64 next;
+
+	if (w->pending[0] & (1ULL << idx)) {
+		const struct fq_flow *f;
+
+		next = ~0ULL;
+		for (f = w->slots[0][idx]; f; f = f->wheel_next)
+			next = min(next, f->time_next_packet);
+		return next;
+	}
+	next = fq_wheel_next(w);
+	return next == ~0ULL ? next : next << FQ_WHEEL_GRAN;
+}
+
 static void fq_check_throttled(struct fq_sched_data *q, u64 now)
 {
+	struct fq_wheel *w = &q->delayed;
+	u64 target = now >> FQ_WHEEL_GRAN;
 	unsigned long sample;
-	struct rb_node *p;
 
 	if (q->time_next_delayed_flow > now)
 		return;
@@ -422,18 +567,38 @@ static void fq_check_throttled(struct fq_sched_data *q, u64 now)
 	q->unthrottle_latency_ns -= q->unthrottle_latency_ns >> 3;
 	q->unthrottle_latency_ns += sample >> 3;
 
-	q->time_next_delayed_flow = ~0ULL;
-	while ((p = rb_first(&q->delayed)) != NULL) {
-		struct fq_flow *f = rb_entry(p, struct fq_flow, rate_node);
+	for (;;) {
+		unsigned int lvl;
+		u64 next;
 
-		if (f->time_next_packet > now) {
-			q->time_next_delayed_flow = f->time_next_packet;
+		fq_wheel_expire(q, now);
+		if (w->clk >= target)
 			break;
+		/* Jump over the slots with nothing to do */
+		next = fq_wheel_next(w);
+		if (next > target) {
+			w->clk = target;
+			continue;
+		}
+		w->clk = next;
+		for (lvl = FQ_WHEEL_LEVELS - 1; lvl > 0; lvl--) {
+			if (!(next & ((1ULL << (lvl * FQ_WHEEL_BITS)) - 1)))
+				fq_wheel_cascade(w, lvl);
 		}
-		rb_erase(p, &q->delayed);
-		q->throttled_flows--;
-		fq_flow_add_tail(&q->old_flows, f);
 	}
+
+	q->time_next_delayed_flow = q->throttled_flows ?
+				    fq_wheel_next_time(w) : ~0ULL;
+}
+
+/* Departure time stamped by the transport, 0 if none */
+static u64 fq_skb_departure(const struct sk_buff *skb, u64 now)
+{
+	u64 tstamp = ktime_to_ns(skb->tstamp);
+
+	if (unlikely(tstamp > now + FQ_EDT_HORIZON))
+		return 0;
+	return tstamp;
 }
 
 static struct sk_buff *fq_dequeue(struct Qdisc *sch)
@@ -444,6 +609,7 @@ static struct sk_buff *fq_dequeue(struct Qdisc *sch)
 	struct sk_buff *skb;
 	struct fq_flow *f;
 	u32 rate, plen;
+	u64 edt = 0;
 
 	skb = fq_dequeue_head(sch, &q->internal);
 	if (skb)
@@ -470,11 +636,17 @@ begin:
 	}
 
 	skb = f->head;
-	if (unlikely(skb && now < f->time_next_packet &&
-		     !skb_is_tcp_pure_ack(skb))) {
-		head->first = f->next;
-		fq_flow_set_throttled(q, f);
-		goto begin;
+	if (skb && !skb_is_tcp_pure_ack(skb)) {
+		u64 time_next_packet;
+
+		edt = fq_skb_departure(skb, now);
+		time_next_packet = max(edt, f->time_next_packet);
+		if (now < time_next_packet) {
+			head->first = f->next;
+			f->time_next_packet = time_next_packet;
+			fq_flow_set_throttled(q, f, now);
+			goto begin;
+		}
 	}
 
 	skb = fq_dequeue_head(sch, f);
@@ -499,6 +671,10 @@ begin:
 	if (skb_is_tcp_pure_ack(skb))
 		goto out;
 
+	/* The transport paces itself */
+	if (edt)
+		goto out;
+
 	rate = q->flow_max_rate;
 	if (skb->sk)
 		rate = min(skb->sk->sk_pacing_rate, rate);
@@ -573,7 +749,8 @@ static void fq_reset(struct Qdisc *sch)
 	}
 	q->new_flows.first	= NULL;
 	q->old_flows.first	= NULL;
-	q->delayed		= RB_ROOT;
+	fq_wheel_reset(&q->delayed, ktime_get_ns());
+	q->time_next_delayed_flow = ~0ULL;
 	q->flows		= 0;
 	q->inactive_flows	= 0;
 	q->throttled_flows	= 0;
@@ -805,7 +982,7 @@ static int fq_init(struct Qdisc *sch, struct nlattr *opt)
 	q->rate_enable		= 1;
 	q->new_flows.first	= NULL;
 	q->old_flows.first	= NULL;
-	q->delayed		= RB_ROOT;
+	fq_wheel_reset(&q->delayed, ktime_get_ns());
 	q->fq_root		= NULL;
 	q->fq_trees_log		= ilog2(1024);
 	q->orphan_mask		= 1024 - 1;
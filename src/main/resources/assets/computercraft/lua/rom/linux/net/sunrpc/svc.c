@@ -416,6 +416,35 @@ __svc_init_bc(struct svc_serv *serv)
 }
 #endif
 
+/*
+ * Let svo_grow start a thread in each pool that asked for one since the
+ * work last ran.
+ */
+static void svc_grow_work(struct work_struct *work)
+{
+	struct svc_serv *serv = container_of(work, struct svc_serv,
+					     sv_grow_work);
+	unsigned int i;
+
+	for (i = 0; i < serv->sv_nrpools; i++) {
+		struct svc_pool *pool = &serv->sv_pools[i];
+
+		if (!test_bit(SP_GROW, &pool->sp_flags))
+			continue;
+		serv->sv_ops->svo_grow(serv, pool);
+		clear_bit(SP_GROW, &pool->sp_flags);
+	}
+}
+
+static void svc_free_pools(struct svc_serv *serv)
+{
+	unsigned int i;
+
+	for (i = 0; i < serv->sv_nrpools; i++)
+		free_percpu(serv->sv_pools[i].sp_queues);
+	kfree(serv->sv_pools);
+}
+
 /*
  * Create an RPC service
  */
@@ -457,6 +486,7 @@ __svc_create(struct svc_program *prog, unsigned int bufsize, int npools,
 	INIT_LIST_HEAD(&serv->sv_permsocks);
 	init_timer(&serv->sv_temptimer);
 	spin_lock_init(&serv->sv_lock);
+	INIT_WORK(&serv->sv_grow_work, svc_grow_work);
 
 	__svc_init_bc(serv);
 
@@ -471,12 +501,25 @@ __svc_create(struct svc_program *prog, unsigned int bufsize, int npools,
 
 	for (i = 0; i < serv->sv_nrpools; i++) {
 		struct svc_pool *pool = &serv->sv_pools[i];
+		int cpu;
 
 		dprintk("svc: initialising pool %u for %s\n",
 				i, serv->sv_name);
 
+		pool->sp_queues = alloc_percpu(struct svc_xprt_queue);
+		if (!pool->sp_queues) {
+			svc_free_pools(serv);
+			kfree(serv);
+			return NULL;
+		}
+		for_each_possible_cpu(cpu) {
+			struct svc_xprt_queue *queue;
+
+			queue = per_cpu_ptr(pool->sp_queues, cpu);
+			spin_lock_init(&queue->xq_lock);
+			INIT_LIST_HEAD(&queue->xq_sockets);
+		}
 		pool->sp_id = i;
-		INIT_LIST_HEAD(&pool->sp_sockets);
 		INIT_LIST_HEAD(&pool->sp_all_threads);
 		spin_lock_init(&pool->sp_lock);
 	}
@@ -538,6 +581,7 @@ svc_destroy(struct svc_serv *serv)
 		printk("svc_destroy: no threads for serv=%p!\n", serv);
 
 	del_timer_sync(&serv->sv_temptimer);
+	cancel_work_sync(&serv->sv_grow_work);
 
 	/*
 	 * The last user is gone and thus all sockets have to be destroyed to
@@ -551,7 +595,7 @@ svc_destroy(struct svc_serv *serv)
 	if (svc_serv_is_pooled(serv))
 		svc_pool_map_put();
 
-	kfree(serv->sv_pools);
+	svc_free_pools(serv);
 	kfree(serv);
 }
 EXPORT_SYMBOL_GPL(svc_destroy);
@@ -702,6 +746,42 @@ found_pool:
 	return task;
 }
 
+/*
+ * Start a service thread in @pool.  Threads started dynamically run
+ * svc_recv() with a short idle timeout and exit when it expires.
+ */
+static int
+svc_start_kthread(struct svc_serv *serv, struct svc_pool *pool, bool dynamic)
+{
+	struct svc_rqst	*rqstp;
+	struct task_struct *task;
+	int node;
+
+	node = svc_pool_map_get_node(pool->sp_id);
+	rqstp = svc_prepare_thread(serv, pool, node);
+	if (IS_ERR(rqstp))
+		return PTR_ERR(rqstp);
+
+	__module_get(serv->sv_ops->svo_module);
+	task = kthread_create_on_node(serv->sv_ops->svo_function, rqstp,
+				      node, "%s", serv->sv_name);
+	if (IS_ERR(task)) {
+		module_put(serv->sv_ops->svo_module);
+		svc_exit_thread(rqstp);
+		return PTR_ERR(task);
+	}
+
+	rqstp->rq_task = task;
+	if (dynamic)
+		set_bit(RQ_DYNAMIC, &rqstp->rq_flags);
+	if (serv->sv_nrpools > 1)
+		svc_pool_map_set_cpumask(task, pool->sp_id);
+
+	svc_sock_update_bufs(serv);
+	wake_up_process(task);
+	return 0;
+}
+
 /*
  * Create or destroy enough new threads to make the number
  * of threads the given number.  If `pool' is non-NULL, applies
@@ -719,12 +799,10 @@ found_pool:
 int
 svc_set_num_threads(struct svc_serv *serv, struct svc_pool *pool, int nrservs)
 {
-	struct svc_rqst	*rqstp;
 	struct task_struct *task;
 	struct svc_pool *chosen_pool;
 	int error = 0;
 	unsigned int state = serv->sv_nrthreads-1;
-	int node;
 
 	if (pool == NULL) {
 		/* The -1 assumes caller has done a svc_get() */
@@ -740,29 +818,9 @@ svc_set_num_threads(struct svc_serv *serv, struct svc_pool *pool, int nrservs)
 		nrservs--;
 		chosen_pool = choose_pool(serv, pool, &state);
 
-		node = svc_pool_map_get_node(chosen_pool->sp_id);
-		rqstp = svc_prepare_thread(serv, chosen_pool, node);
-		if (IS_ERR(rqstp)) {
-			error = PTR_ERR(rqstp);
+		error = svc_start_kthread(serv, chosen_pool, false);
+		if (error)
 			break;
-		}
-
-		__module_get(serv->sv_ops->svo_module);
-		task = kthread_create_on_node(serv->sv_ops->svo_function, rqstp,
-					      node, "%s", serv->sv_name);
-		if (IS_ERR(task)) {
-			error = PTR_ERR(task);
-			module_put(serv->sv_ops->svo_module);
-			svc_exit_thread(rqstp);
-			break;
-		}
-
-		rqstp->rq_task = task;
-		if (serv->sv_nrpools > 1)
-			svc_pool_map_set_cpumask(task, chosen_pool->sp_id);
-
-		svc_sock_update_bufs(serv);
-		wake_up_process(task);
 	}
 	/* destroy old threads */
 	while (nrservs < 0 &&
@@ -775,6 +833,20 @@ svc_set_num_threads(struct svc_serv *serv, struct svc_pool *pool, int nrservs)
 }
 EXPORT_SYMBOL_GPL(svc_set_num_threads);
 
+/*
+ * Add a thread to @pool on behalf of svo_grow, unless the service is
+ * already at sv_maxthreads.  Same locking rules as svc_set_num_threads.
+ */
+int
+svc_pool_add_thread(struct svc_serv *serv, struct svc_pool *pool)
+{
+	/* The -1 assumes caller has done a svc_get() */
+	if (serv->sv_nrthreads - 1 >= serv->sv_maxthreads)
+		return -EBUSY;
+	return svc_start_kthread(serv, pool, true);
+}
+EXPORT_SYMBOL_GPL(svc_pool_add_thread);
+
 /*
  * Called from a server thread as it's exiting. Caller must hold the "service
  * mutex" for the service.
@@ -38,6 +38,9 @@ static void svc_delete_xprt(struct svc_xprt *xprt);
  */
 static int svc_conn_age_period = 6*60;
 
+/* threads started by svo_grow exit after being idle this long */
+#define SVC_DYNAMIC_IDLE_TIMEOUT	(30 * HZ)
+
 /* List of registered transport classes */
 static DEFINE_SPINLOCK(svc_xprt_class_lock);
 static LIST_HEAD(svc_xprt_class_list);
@@ -45,6 +48,8 @@ static LIST_HEAD(svc_xprt_class_list);
 /* SMP locking strategy:
  *
  *	svc_pool->sp_lock protects most of the fields of that pool.
+ *	svc_xprt_queue->xq_lock protects one of the per-cpu queues of
+ *	transports of a pool, and sp_nqueued is only changed under it.
  *	svc_serv->sv_lock protects sv_tempsocks, sv_permsocks, sv_tmpcnt.
  *	when both need to be taken (rare), svc_serv->sv_lock is first.
  *	The "service mutex" protects svc_serv->sv_nrthread.
@@ -375,9 +380,25 @@ static bool svc_xprt_has_something_to_do(struct svc_xprt *xprt)
 	return false;
 }
 
+/*
+ * Called when a transport had to be queued because no thread of @pool
+ * was idle: ask svo_grow for another one, if the service allows that.
+ */
+static void svc_pool_grow(struct svc_serv *serv, struct svc_pool *pool)
+{
+	if (!serv->sv_ops->svo_grow || !pool->sp_nrthreads)
+		return;
+	/* sv_nrthreads counts a reference of the creator besides threads */
+	if (serv->sv_nrthreads > serv->sv_maxthreads)
+		return;
+	if (!test_and_set_bit(SP_GROW, &pool->sp_flags))
+		queue_work(system_unbound_wq, &serv->sv_grow_work);
+}
+
 void svc_xprt_do_enqueue(struct svc_xprt *xprt)
 {
 	struct svc_pool *pool;
+	struct svc_xprt_queue *queue;
 	struct svc_rqst	*rqstp = NULL;
 	int cpu;
 	bool queued = false;
@@ -446,13 +467,16 @@ redo_search:
 	if (!queued) {
 		queued = true;
 		dprintk("svc: transport %p put into queue\n", xprt);
-		spin_lock_bh(&pool->sp_lock);
-		list_add_tail(&xprt->xpt_ready, &pool->sp_sockets);
-		pool->sp_stats.sockets_queued++;
-		spin_unlock_bh(&pool->sp_lock);
+		queue = per_cpu_ptr(pool->sp_queues, cpu);
+		spin_lock_bh(&queue->xq_lock);
+		list_add_tail(&xprt->xpt_ready, &queue->xq_sockets);
+		atomic_inc(&pool->sp_nqueued);
+		spin_unlock_bh(&queue->xq_lock);
+		atomic_long_inc(&pool->sp_stats.sockets_queued);
 		goto redo_search;
 	}
 	rqstp = NULL;
+	svc_pool_grow(xprt->xpt_server, pool);
 	put_cpu();
 out:
 	trace_svc_xprt_do_enqueue(xprt, rqstp);
@@ -473,26 +497,57 @@ void svc_xprt_enqueue(struct svc_xprt *xprt)
 EXPORT_SYMBOL_GPL(svc_xprt_enqueue);
 
 /*
- * Dequeue the first transport, if there is one.
+ * Take the first transport off the queue of @pool for @cpu.
  */
-static struct svc_xprt *svc_xprt_dequeue(struct svc_pool *pool)
+static struct svc_xprt *svc_xprt_queue_pop(struct svc_pool *pool, int cpu)
 {
+	struct svc_xprt_queue *queue = per_cpu_ptr(pool->sp_queues, cpu);
 	struct svc_xprt	*xprt = NULL;
 
-	if (list_empty(&pool->sp_sockets))
-		goto out;
+	if (list_empty(&queue->xq_sockets))
+		return NULL;
 
-	spin_lock_bh(&pool->sp_lock);
-	if (likely(!list_empty(&pool->sp_sockets))) {
-		xprt = list_first_entry(&pool->sp_sockets,
+	spin_lock_bh(&queue->xq_lock);
+	if (likely(!list_empty(&queue->xq_sockets))) {
+		xprt = list_first_entry(&queue->xq_sockets,
 					struct svc_xprt, xpt_ready);
 		list_del_init(&xprt->xpt_ready);
+		atomic_dec(&pool->sp_nqueued);
 		svc_xprt_get(xprt);
 
 		dprintk("svc: transport %p dequeued, inuse=%d\n",
 			xprt, kref_read(&xprt->xpt_ref));
 	}
-	spin_unlock_bh(&pool->sp_lock);
+	spin_unlock_bh(&queue->xq_lock);
+	return xprt;
+}
+
+/*
+ * Dequeue a transport, if there is one: preferably the first one queued
+ * on this CPU, otherwise steal one that was queued on another CPU whose
+ * threads are all busy.
+ */
+static struct svc_xprt *svc_xprt_dequeue(struct svc_pool *pool)
+{
+	struct svc_xprt	*xprt = NULL;
+	int this_cpu, cpu;
+
+	if (!atomic_read(&pool->sp_nqueued))
+		goto out;
+
+	this_cpu = raw_smp_processor_id();
+	xprt = svc_xprt_queue_pop(pool, this_cpu);
+
+	/* Start right after this CPU so that thieves spread out */
+	cpu = this_cpu;
+	while (!xprt && atomic_read(&pool->sp_nqueued)) {
+		cpu = cpumask_next(cpu, cpu_possible_mask);
+		if (cpu >= nr_cpu_ids)
+			cpu = cpumask_first(cpu_possible_mask);
+		if (cpu == this_cpu)
+			break;
+		xprt = svc_xprt_queue_pop(pool, cpu);
+	}
 out:
 	trace_svc_xprt_dequeue(xprt);
 	return xprt;
@@ -703,7 +758,7 @@ rqst_should_sleep(struct svc_rqst *rqstp)
 		return false;
 
 	/* was a socket queued? */
-	if (!list_empty(&pool->sp_sockets))
+	if (atomic_read(&pool->sp_nqueued))
 		return false;
 
 	/* are we shutting down? */
@@ -752,6 +807,9 @@ static struct svc_xprt *svc_get_next_xprt(struct svc_rqst *rqstp, long timeout)
 	clear_bit(RQ_BUSY, &rqstp->rq_flags);
 	smp_mb();
 
+	if (test_bit(RQ_DYNAMIC, &rqstp->rq_flags))
+		timeout = min_t(long, timeout, SVC_DYNAMIC_IDLE_TIMEOUT);
+
 	if (likely(rqst_should_sleep(rqstp)))
 		time_left = schedule_timeout(timeout);
 	else
@@ -767,8 +825,12 @@ static struct svc_xprt *svc_get_next_xprt(struct svc_rqst *rqstp, long timeout)
 	if (xprt != NULL)
 		return xprt;
 
-	if (!time_left)
+	if (!time_left) {
 		atomic_long_inc(&pool->sp_stats.threads_timedout);
+		/* Nothing to do for a while, the extra thread can go */
+		if (test_bit(RQ_DYNAMIC, &rqstp->rq_flags))
+			return ERR_PTR(-EINTR);
+	}
 
 	if (signalled() || kthread_should_stop())
 		return ERR_PTR(-EINTR);
@@ -1109,22 +1171,28 @@ static int svc_close_list(struct svc_serv *serv, struct list_head *xprt_list, st
 static struct svc_xprt *svc_dequeue_net(struct svc_serv *serv, struct net *net)
 {
 	struct svc_pool *pool;
+	struct svc_xprt_queue *queue;
 	struct svc_xprt *xprt;
 	struct svc_xprt *tmp;
-	int i;
+	int i, cpu;
 
 	for (i = 0; i < serv->sv_nrpools; i++) {
 		pool = &serv->sv_pools[i];
 
-		spin_lock_bh(&pool->sp_lock);
-		list_for_each_entry_safe(xprt, tmp, &pool->sp_sockets, xpt_ready) {
-			if (xprt->xpt_net != net)
-				continue;
-			list_del_init(&xprt->xpt_ready);
-			spin_unlock_bh(&pool->sp_lock);
-			return xprt;
+		for_each_possible_cpu(cpu) {
+			queue = per_cpu_ptr(pool->sp_queues, cpu);
+			spin_lock_bh(&queue->xq_lock);
+			list_for_each_entry_safe(xprt, tmp, &queue->xq_sockets,
+						 xpt_ready) {
+				if (xprt->xpt_net != net)
+					continue;
+				list_del_init(&xprt->xpt_ready);
+				atomic_dec(&pool->sp_nqueued);
+				spin_unlock_bh(&queue->xq_lock);
+				return xprt;
+			}
+			spin_unlock_bh(&queue->xq_lock);
 		}
-		spin_unlock_bh(&pool->sp_lock);
 	}
 	return NULL;
 }
@@ -1439,7 +1507,7 @@ static int svc_pool_stats_show(struct seq_file *m, void *p)
 	seq_printf(m, "%u %lu %lu %lu %lu\n",
 		pool->sp_id,
 		(unsigned long)atomic_long_read(&pool->sp_stats.packets),
-		pool->sp_stats.sockets_queued,
+		(unsigned long)atomic_long_read(&pool->sp_stats.sockets_queued),
 		(unsigned long)atomic_long_read(&pool->sp_stats.threads_woken),
 		(unsigned long)atomic_long_read(&pool->sp_stats.threads_timedout));
 
@@ -486,6 +486,7 @@ static void unix_sock_destructor(struct sock *sk)
 	struct unix_sock *u = unix_sk(sk);
 
 	skb_queue_purge(&sk->sk_receive_queue);
+	skb_queue_purge(&sk->sk_error_queue);
 
 	WARN_ON(atomic_read(&sk->sk_wmem_alloc));
 	WARN_ON(!sk_unhashed(sk));
@@ -1840,6 +1841,32 @@ out:
  */
 #define UNIX_SKB_FRAGS_SZ (PAGE_SIZE << get_order(32768))
 
+/*
+ * Allocate the next skb of a stream send. While a wakeup of the peer is
+ * still owed, try without sleeping first: the peer has to be told about
+ * the data already queued before we wait for it to free send space.
+ */
+static struct sk_buff *unix_stream_alloc_skb(struct sock *sk,
+					     struct sock *other,
+					     unsigned long header_len,
+					     unsigned long data_len,
+					     int flags, bool *wake, int *err)
+{
+	struct sk_buff *skb;
+	int noblock = flags & MSG_DONTWAIT;
+	int order = data_len ? get_order(UNIX_SKB_FRAGS_SZ) : 0;
+
+	skb = sock_alloc_send_pskb(sk, header_len, data_len,
+				   noblock || *wake, err, order);
+	if (!skb && *wake && !noblock && *err == -EAGAIN) {
+		*wake = false;
+		other->sk_data_ready(other);
+		skb = sock_alloc_send_pskb(sk, header_len, data_len, 0,
+					   err, order);
+	}
+	return skb;
+}
+
 static int unix_stream_sendmsg(struct socket *sock, struct msghdr *msg,
 			       size_t len)
 {
@@ -1850,6 +1877,9 @@ static int unix_stream_sendmsg(struct socket *sock, struct msghdr *msg,
 	int sent = 0;
 	struct scm_cookie scm;
 	bool fds_sent = false;
+	struct ubuf_info *uarg = NULL;
+	bool wake = false;
+	bool was_empty;
 	int max_level;
 	int data_len;
 
@@ -1875,12 +1905,50 @@ static int unix_stream_sendmsg(struct socket *sock, struct msghdr *msg,
 	if (sk->sk_shutdown & SEND_SHUTDOWN)
 		goto pipe_err;
 
+	if (msg->msg_flags & MSG_ZEROCOPY && len &&
+	    sock_flag(sk, SOCK_ZEROCOPY)) {
+		uarg = sock_zerocopy_alloc(sk, len);
+		if (!uarg) {
+			err = -ENOBUFS;
+			goto out_err;
+		}
+	}
+
 	while (sent < len) {
 		size = len - sent;
 
 		/* Keep two messages in the pipe so it schedules better */
 		size = min_t(int, size, (sk->sk_sndbuf >> 1) - 64);
 
+		if (uarg) {
+			/* the user pages go into the frags, no copy */
+			size = min_t(int, size, MAX_SKB_FRAGS * PAGE_SIZE);
+			skb = unix_stream_alloc_skb(sk, other, 0, 0,
+						    msg->msg_flags, &wake,
+						    &err);
+			if (!skb)
+				goto out_err;
+
+			err = unix_scm_to_skb(&scm, skb, !fds_sent);
+			if (err < 0) {
+				kfree_skb(skb);
+				goto out_err;
+			}
+			max_level = err + 1;
+			fds_sent = true;
+
+			err = __zerocopy_sg_from_iter(NULL, skb,
+						      &msg->msg_iter, size);
+			if (err == -EFAULT || !skb->len) {
+				kfree_skb(skb);
+				err = -EFAULT;
+				goto out_err;
+			}
+			size = skb->len;
+			skb_zcopy_set(skb, uarg);
+			goto queue;
+		}
+
 		/* allow fallback to order-0 allocations */
 		size = min_t(int, size, SKB_MAX_HEAD(0) + UNIX_SKB_FRAGS_SZ);
 
@@ -1888,9 +1956,9 @@ static int unix_stream_sendmsg(struct socket *sock, struct msghdr *msg,
 
 		data_len = min_t(size_t, size, PAGE_ALIGN(data_len));
 
-		skb = sock_alloc_send_pskb(sk, size - data_len, data_len,
-					   msg->msg_flags & MSG_DONTWAIT, &err,
-					   get_order(UNIX_SKB_FRAGS_SZ));
+		skb = unix_stream_alloc_skb(sk, other, size - data_len,
+					    data_len, msg->msg_flags, &wake,
+					    &err);
 		if (!skb)
 			goto out_err;
 
@@ -1912,6 +1980,7 @@ static int unix_stream_sendmsg(struct socket *sock, struct msghdr *msg,
 			goto out_err;
 		}
 
+queue:
 		unix_state_lock(other);
 
 		if (sock_flag(other, SOCK_DEAD) ||
@@ -1919,14 +1988,31 @@ static int unix_stream_sendmsg(struct socket *sock, struct msghdr *msg,
 			goto pipe_err_free;
 
 		maybe_add_creds(skb, sock, other);
+		was_empty = skb_queue_empty(&other->sk_receive_queue);
 		skb_queue_tail(&other->sk_receive_queue, skb);
 		if (max_level > unix_sk(other)->recursion_level)
 			unix_sk(other)->recursion_level = max_level;
 		unix_state_unlock(other);
-		other->sk_data_ready(other);
+
+		/*
+		 * A reader that still has queued data to go through is
+		 * running and will find this skb on its own. Only wake it
+		 * when it may be idle, and once more before we leave or
+		 * block, so a long send costs a wakeup or two, not one per
+		 * skb.
+		 */
+		if (was_empty) {
+			wake = false;
+			other->sk_data_ready(other);
+		} else {
+			wake = true;
+		}
 		sent += size;
 	}
 
+	if (wake)
+		other->sk_data_ready(other);
+	sock_zerocopy_put(uarg);
 	scm_destroy(&scm);
 
 	return sent;
@@ -1939,6 +2025,12 @@ pipe_err:
 		send_sig(SIGPIPE, current, 0);
 	err = -EPIPE;
 out_err:
+	if (wake)
+		other->sk_data_ready(other);
+	if (sent)
+		sock_zerocopy_put(uarg);
+	else
+		sock_zerocopy_put_abort(uarg);
 	scm_destroy(&scm);
 	return sent ? : err;
 }
@@ -2484,6 +2576,10 @@ static int unix_stream_recvmsg(struct socket *sock, struct msghdr *msg,
 		.flags = flags
 	};
 
+	if (unlikely(flags & MSG_ERRQUEUE))
+		return sock_recv_errqueue(sock->sk, msg, size, SOL_SOCKET,
+					  SO_ZEROCOPY);
+
 	return unix_stream_read_generic(&state, true);
 }
 
@@ -2491,6 +2587,12 @@ static int unix_stream_splice_actor(struct sk_buff *skb,
 				    int skip, int chunk,
 				    struct unix_stream_read_state *state)
 {
+	/* the pipe would keep the sender's pages past its notification */
+	int err = skb_orphan_frags_rx(skb, GFP_KERNEL);
+
+	if (err)
+		return err;
+
 	return skb_splice_bits(skb, state->socket->sk,
 			       UNIXCB(skb).consumed + skip,
 			       state->pipe, chunk, state->splice_flags);
@@ -2668,7 +2770,7 @@ static unsigned int unix_poll(struct file *file, struct socket *sock, poll_table
 	mask = 0;
 
 	/* exceptional events? */
-	if (sk->sk_err)
+	if (sk->sk_err || !skb_queue_empty(&sk->sk_error_queue))
 		mask |= POLLERR;
 	if (sk->sk_shutdown == SHUTDOWN_MASK)
 		mask |= POLLHUP;
@@ -233,6 +233,26 @@ int snd_pcm_update_state(struct snd_pcm_substream *substream,
 	return 0;
 }
 
+/*
+ * With SNDRV_PCM_HW_PARAMS_NO_PERIOD_WAKEUP an application can run off
+ * its own timer and take the position straight from the mmap'd status
+ * page, extrapolating from hw_ptr and the timestamps taken with it.  To
+ * read those consistently without a syscall, updates of them bump the
+ * otherwise unused pad1 field before and after, like a seqcount: a reader
+ * retries while it is odd or if it changed across the read.
+ */
+static inline void snd_pcm_status_write_begin(struct snd_pcm_runtime *runtime)
+{
+	WRITE_ONCE(runtime->status->pad1, runtime->status->pad1 + 1);
+	smp_wmb();
+}
+
+static inline void snd_pcm_status_write_end(struct snd_pcm_runtime *runtime)
+{
+	smp_wmb();
+	WRITE_ONCE(runtime->status->pad1, runtime->status->pad1 + 1);
+}
+
 static void update_audio_tstamp(struct snd_pcm_substream *substream,
 				struct timespec *curr_tstamp,
 				struct timespec *audio_tstamp)
@@ -455,7 +475,9 @@ static int snd_pcm_update_hw_ptr0(struct snd_pcm_substream *substream,
 
  no_delta_check:
 	if (runtime->status->hw_ptr == new_hw_ptr) {
+		snd_pcm_status_write_begin(runtime);
 		update_audio_tstamp(substream, &curr_tstamp, &audio_tstamp);
+		snd_pcm_status_write_end(runtime);
 		return 0;
 	}
 
@@ -473,6 +495,7 @@ static int snd_pcm_update_hw_ptr0(struct snd_pcm_substream *substream,
 			runtime->hw_ptr_interrupt -= runtime->boundary;
 	}
 	runtime->hw_ptr_base = hw_base;
+	snd_pcm_status_write_begin(runtime);
 	runtime->status->hw_ptr = new_hw_ptr;
 	runtime->hw_ptr_jiffies = curr_jiffies;
 	if (crossed_boundary) {
@@ -481,6 +504,7 @@ static int snd_pcm_update_hw_ptr0(struct snd_pcm_substream *substream,
 	}
 
 	update_audio_tstamp(substream, &curr_tstamp, &audio_tstamp);
+	snd_pcm_status_write_end(runtime);
 
 	return snd_pcm_update_state(substream, runtime);
 }
@@ -1764,10 +1788,14 @@ static int snd_pcm_lib_ioctl_reset(struct snd_pcm_substream *substream,
 	unsigned long flags;
 	snd_pcm_stream_lock_irqsave(substream, flags);
 	if (snd_pcm_running(substream) &&
-	    snd_pcm_update_hw_ptr(substream) >= 0)
+	    snd_pcm_update_hw_ptr(substream) >= 0) {
+		snd_pcm_status_write_begin(runtime);
 		runtime->status->hw_ptr %= runtime->buffer_size;
-	else {
+		snd_pcm_status_write_end(runtime);
+	} else {
+		snd_pcm_status_write_begin(runtime);
 		runtime->status->hw_ptr = 0;
+		snd_pcm_status_write_end(runtime);
 		runtime->hw_ptr_wrap = 0;
 	}
 	snd_pcm_stream_unlock_irqrestore(substream, flags);
@@ -12,6 +12,7 @@
  * more details.
  */
 #include <linux/radix-tree.h>
+#include <linux/xarray.h>
 #include <linux/slab.h>
 #include <linux/errno.h>
 #include <time.h>
@@ -230,6 +231,55 @@ static void benchmark_join(unsigned long step)
 			1 << 10, step, nsec);
 }
 
+/*
+ * Marked entries of an XArray found one at a time, each step walking down
+ * from the root, against a single xa_extract() walk.
+ */
+static void benchmark_xarray(unsigned long size, unsigned long step)
+{
+	DEFINE_XARRAY(xa);
+	struct timespec start, finish;
+	unsigned long index, count = 0;
+	long long found, extract;
+	void *entry, *dst[64];
+	unsigned int n;
+
+	for (index = 0 ; index < size ; index += step) {
+		xa_store(&xa, index, item_create(index, 0), GFP_KERNEL);
+		if (!(index & 7))
+			xa_set_mark(&xa, index, XA_MARK_0);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	xa_for_each_marked(&xa, index, entry, XA_MARK_0)
+		count++;
+	clock_gettime(CLOCK_MONOTONIC, &finish);
+	found = (finish.tv_sec - start.tv_sec) * NSEC_PER_SEC +
+		(finish.tv_nsec - start.tv_nsec);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	index = 0;
+	while ((n = xa_extract(&xa, dst, index, ULONG_MAX, ARRAY_SIZE(dst),
+			       XA_MARK_0))) {
+		count -= n;
+		index = ((struct item *)dst[n - 1])->index + 1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &finish);
+	extract = (finish.tv_sec - start.tv_sec) * NSEC_PER_SEC +
+		  (finish.tv_nsec - start.tv_nsec);
+	assert(!count);
+
+	printv(2, "Size: %8ld, step: %8ld, xa_for_each_marked: %10lld ns\n",
+		size, step, found);
+	printv(2, "Size: %8ld, step: %8ld, xa_extract marked: %11lld ns\n",
+		size, step, extract);
+
+	xa_for_each(&xa, index, entry)
+		free(entry);
+	xa_destroy(&xa);
+	rcu_barrier();
+}
+
 void benchmark(void)
 {
 	unsigned long size[] = {1 << 10, 1 << 20, 0};
@@ -254,4 +304,8 @@ void benchmark(void)
 
 	for (s = 0; step[s]; s++)
 		benchmark_join(step[s]);
+
+	for (c = 0; size[c]; c++)
+		for (s = 0; step[s]; s++)
+			benchmark_xarray(size[c], step[s]);
 }
@@ -35,6 +35,7 @@ void multiorder_checks(void);
 void iteration_test(unsigned order, unsigned duration);
 void benchmark(void);
 void idr_checks(void);
+void xarray_checks(void);
 void ida_checks(void);
 void ida_thread_tests(void);
 
@@ -0,0 +1,197 @@
+/*
+ * xarray-test.c: Test the XArray API
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ */
+#include <linux/xarray.h>
+#include <linux/slab.h>
+#include <linux/kernel.h>
+#include <linux/errno.h>
+
+#include "test.h"
+
+static DEFINE_XARRAY(array);
+
+static void xa_store_test(void)
+{
+	unsigned long i;
+
+	assert(xa_empty(&array));
+	for (i = 0; i < 1000; i++) {
+		struct item *item = item_create(i, 0);
+
+		assert(xa_store(&array, i, item, GFP_KERNEL) == NULL);
+		assert(xa_load(&array, i) == item);
+	}
+	for (i = 0; i < 1000; i++) {
+		struct item *item = xa_erase(&array, i);
+
+		assert(item && item->index == i);
+		assert(xa_load(&array, i) == NULL);
+		free(item);
+	}
+	assert(xa_empty(&array));
+}
+
+static void xa_value_test(void)
+{
+	void *entry = xa_mk_value(12345);
+
+	assert(xa_is_value(entry));
+	assert(xa_to_value(entry) == 12345);
+	assert(!xa_err(entry));
+
+	assert(xa_store(&array, 7, entry, GFP_KERNEL) == NULL);
+	assert(xa_load(&array, 7) == entry);
+	assert(xa_store(&array, 7, NULL, GFP_KERNEL) == entry);
+	assert(xa_empty(&array));
+}
+
+static void xa_cmpxchg_test(void)
+{
+	struct item *a = item_create(5, 0);
+	struct item *b = item_create(5, 0);
+
+	assert(xa_cmpxchg(&array, 5, NULL, a, GFP_KERNEL) == NULL);
+	assert(xa_cmpxchg(&array, 5, NULL, b, GFP_KERNEL) == a);
+	assert(xa_load(&array, 5) == a);
+	assert(xa_cmpxchg(&array, 5, a, b, GFP_KERNEL) == a);
+	assert(xa_load(&array, 5) == b);
+	assert(xa_insert(&array, 5, a, GFP_KERNEL) == -EEXIST);
+	assert(xa_cmpxchg(&array, 5, b, NULL, GFP_KERNEL) == b);
+	assert(xa_empty(&array));
+
+	free(a);
+	free(b);
+}
+
+static void xa_mark_test(void)
+{
+	unsigned long index;
+	unsigned long i, count = 0;
+	struct item *item;
+
+	for (i = 0; i < 256; i++)
+		assert(!xa_insert(&array, i, item_create(i, 0), GFP_KERNEL));
+
+	xa_set_mark(&array, 1000, XA_MARK_0);
+	assert(!xa_get_mark(&array, 1000, XA_MARK_0));
+
+	for (i = 0; i < 256; i += 3)
+		xa_set_mark(&array, i, XA_MARK_1);
+	assert(xa_marked(&array, XA_MARK_1));
+	assert(!xa_marked(&array, XA_MARK_0));
+
+	xa_for_each_marked(&array, index, item, XA_MARK_1) {
+		assert(index % 3 == 0);
+		assert(item->index == index);
+		count++;
+	}
+	assert(count == 86);
+
+	xa_clear_mark(&array, 0, XA_MARK_1);
+	assert(!xa_get_mark(&array, 0, XA_MARK_1));
+
+	count = 0;
+	xa_for_each(&array, index, item) {
+		assert(item->index == index);
+		free(xa_erase(&array, index));
+		count++;
+	}
+	assert(count == 256);
+	assert(xa_empty(&array));
+	assert(!xa_marked(&array, XA_MARK_1));
+}
+
+static void xa_multi_index_test(unsigned long base, unsigned int order)
+{
+	struct item *item = item_create(base, order);
+	unsigned long index, i;
+	struct item *found;
+	void *dst[4];
+	int count = 0;
+
+	assert(!xa_insert_order(&array, base, order, item, GFP_KERNEL));
+	for (i = base; i < base + (1UL << order); i++) {
+		assert(xa_load(&array, i) == item);
+		assert(xa_insert(&array, i, item, GFP_KERNEL) == -EEXIST);
+	}
+	assert(xa_load(&array, base + (1UL << order)) == NULL);
+
+	xa_set_mark(&array, base + 1, XA_MARK_0);
+	assert(xa_get_mark(&array, base, XA_MARK_0));
+
+	xa_for_each_marked(&array, index, found, XA_MARK_0) {
+		assert(found == item);
+		count++;
+	}
+	assert(count == 1);
+	assert(xa_extract(&array, dst, 0, ULONG_MAX, 4, XA_PRESENT) == 1);
+	assert(dst[0] == item);
+
+	assert(xa_erase(&array, base + (1UL << order) - 1) == item);
+	for (i = base; i < base + (1UL << order); i++)
+		assert(xa_load(&array, i) == NULL);
+	assert(xa_empty(&array));
+	free(item);
+}
+
+static void xa_extract_test(void)
+{
+	void *dst[64];
+	unsigned long i;
+	unsigned int n;
+
+	for (i = 0; i < 1024; i += 16) {
+		assert(!xa_insert(&array, i, item_create(i, 0), GFP_KERNEL));
+		if (i % 64 == 0)
+			xa_set_mark(&array, i, XA_MARK_2);
+	}
+
+	n = xa_extract(&array, dst, 0, ULONG_MAX, 64, XA_PRESENT);
+	assert(n == 64);
+	for (i = 0; i < n; i++)
+		assert(((struct item *)dst[i])->index == i * 16);
+
+	n = xa_extract(&array, dst, 100, 600, 64, XA_MARK_2);
+	assert(n == 8);
+	for (i = 0; i < n; i++)
+		assert(((struct item *)dst[i])->index == 128 + i * 64);
+
+	for (i = 0; i < 1024; i += 16)
+		free(xa_erase(&array, i));
+	xa_destroy(&array);
+	assert(xa_empty(&array));
+}
+
+void xarray_checks(void)
+{
+	xa_store_test();
+	xa_value_test();
+	xa_cmpxchg_test();
+	xa_mark_test();
+	xa_extract_test();
+#ifdef CONFIG_RADIX_TREE_MULTIORDER
+	xa_multi_index_test(0, 4);
+	xa_multi_index_test(512, 9);
+	xa_multi_index_test(4096, 3);
+#endif
+	radix_tree_cpu_dead(1);
+}
+
+int __weak main(void)
+{
+	radix_tree_init();
+	xarray_checks();
+	rcu_barrier();
+	if (nr_allocated)
+		printf("nr_allocated = %d\n", nr_allocated);
+	return 0;
+}
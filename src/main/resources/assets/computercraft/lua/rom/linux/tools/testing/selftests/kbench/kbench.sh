@@ -0,0 +1,97 @@
+#!/bin/sh
+# Runs the kbench module (CONFIG_KBENCH) and, given a baseline written by an
+# earlier run with -o, fails if a benchmark got worse than the threshold.
+
+usage()
+{
+	echo "Usage: $0 [-b baseline] [-o output] [-t percent] [param=value ...]"
+	echo "-b:  results of an earlier run to compare with"
+	echo "-o:  where to save the results, default kbench.results"
+	echo "-t:  regression threshold in percent of the mean, default 10"
+	echo "The params are passed to the module, e.g. tests=spinlock,mutex"
+}
+
+baseline=
+output=kbench.results
+threshold=10
+
+while getopts "b:o:t:h" opt; do
+	case $opt in
+	b) baseline=$OPTARG ;;
+	o) output=$OPTARG ;;
+	t) threshold=$OPTARG ;;
+	*) usage; exit 1 ;;
+	esac
+done
+shift $((OPTIND - 1))
+
+if [ "$(id -u)" -ne 0 ]; then
+	echo "kbench: must be run as root [SKIP]"
+	exit 4
+fi
+
+if ! /sbin/modprobe -q -n kbench; then
+	echo "kbench: module kbench is not available [SKIP]"
+	exit 4
+fi
+
+marker="kbench.sh run $$"
+echo "$marker" > /dev/kmsg
+
+if ! /sbin/modprobe kbench "$@"; then
+	echo "kbench: loading the module failed [FAIL]"
+	exit 1
+fi
+/sbin/modprobe -r kbench
+
+dmesg | awk -v marker="$marker" '
+	index($0, marker) { found = 1; next }
+	found && /kbench: test=/ { sub(/.*kbench: /, ""); print }' > "$output"
+
+if [ ! -s "$output" ]; then
+	echo "kbench: no results in the kernel log [FAIL]"
+	exit 1
+fi
+cat "$output"
+
+if [ -z "$baseline" ]; then
+	echo "kbench: results saved in $output [PASS]"
+	exit 0
+fi
+
+awk -v threshold="$threshold" '
+	function parse(line, f,    i, n, kv, fields) {
+		n = split(line, fields, " ")
+		for (i = 1; i <= n; i++) {
+			split(fields[i], kv, "=")
+			f[kv[1]] = kv[2]
+		}
+	}
+	FNR == NR {
+		parse($0, f)
+		base[f["test"] "/" f["threads"]] = f["mean"]
+		next
+	}
+	{
+		parse($0, f)
+		key = f["test"] "/" f["threads"]
+		if (!(key in base) || base[key] == 0) {
+			printf "%s: no baseline\n", key
+			next
+		}
+		change = (f["mean"] - base[key]) * 100 / base[key]
+		worse = f["better"] == "higher" ? -change : change
+		verdict = worse > threshold ? "REGRESSION" : "ok"
+		if (worse > threshold)
+			failed = 1
+		printf "%s: %s -> %s %s (%+.1f%%) %s\n", key, base[key],
+		       f["mean"], f["metric"], change, verdict
+	}
+	END { exit failed }' "$baseline" "$output"
+
+if [ $? -ne 0 ]; then
+	echo "kbench: regressions against $baseline [FAIL]"
+	exit 1
+fi
+echo "kbench: no regressions against $baseline [PASS]"
+exit 0
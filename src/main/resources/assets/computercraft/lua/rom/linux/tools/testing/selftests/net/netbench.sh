@@ -0,0 +1,327 @@
+#!/bin/sh
+# Benchmarks the network data path between two network namespaces joined
+# by a veth pair, and, given a baseline written by an earlier run with -o,
+# fails if a result got worse than the threshold.
+#
+#   tx_qdisc  pktgen (queue_xmit) through the qdisc to a dummy device
+#   rx_stack  pktgen (netif_receive) into IP/UDP on the receiving veth
+#   rx_xdp    pktgen to the veth peer running the XDP program given by -x,
+#             which also exercises GRO when the program passes packets
+#   udp_rr    UDP request/response latency over the veth pair
+#   tcp_rr    TCP request/response latency over the veth pair
+#
+# pktgen tests report mpps, and cycles_per_pkt when perf is available; the
+# request/response tests report tps and latency percentiles.  Every result
+# is one line of key=value pairs:
+#
+#   test=rx_stack size=64 reps=3 metric=mpps better=higher min=... max=... mean=...
+
+usage()
+{
+	echo "Usage: $0 [-b baseline] [-o output] [-t percent] [-r reps]"
+	echo "       [-d seconds] [-s size] [-x xdp.o [-S section]] [test ...]"
+	echo "-b:  results of an earlier run to compare with"
+	echo "-o:  where to save the results, default netbench.results"
+	echo "-t:  regression threshold in percent of the mean, default 10"
+	echo "-r:  repetitions of each test, default 3"
+	echo "-d:  duration of each pktgen repetition, default 5 seconds"
+	echo "-s:  packet or request size in bytes, default 64"
+	echo "-x:  XDP object to load on the receiving veth for rx_xdp"
+	echo "-S:  section of the XDP object to load"
+	echo "Tests: tx_qdisc rx_stack rx_xdp udp_rr tcp_rr, default all"
+}
+
+baseline=
+output=netbench.results
+threshold=10
+reps=3
+duration=5
+size=64
+xdp_obj=
+xdp_sec=
+
+while getopts "b:o:t:r:d:s:x:S:h" opt; do
+	case $opt in
+	b) baseline=$OPTARG ;;
+	o) output=$OPTARG ;;
+	t) threshold=$OPTARG ;;
+	r) reps=$OPTARG ;;
+	d) duration=$OPTARG ;;
+	s) size=$OPTARG ;;
+	x) xdp_obj=$OPTARG ;;
+	S) xdp_sec=$OPTARG ;;
+	*) usage; exit 1 ;;
+	esac
+done
+shift $((OPTIND - 1))
+tests=${*:-"tx_qdisc rx_stack rx_xdp udp_rr tcp_rr"}
+
+NS_TX=nb_tx
+NS_RX=nb_rx
+ADDR_TX=10.201.0.1
+ADDR_RX=10.201.0.2
+ADDR_DUMMY=10.202.0.2
+RR_PORT=8765
+
+if [ "$(id -u)" -ne 0 ]; then
+	echo "netbench: must be run as root [SKIP]"
+	exit 4
+fi
+
+if ! ip -V > /dev/null 2>&1; then
+	echo "netbench: could not run test without the ip tool [SKIP]"
+	exit 4
+fi
+
+if ! /sbin/modprobe -q pktgen || [ ! -d /proc/net/pktgen ]; then
+	echo "netbench: pktgen is not available [SKIP]"
+	exit 4
+fi
+
+bin_dir=$(dirname "$0")
+raw=$(mktemp)
+
+cleanup()
+{
+	ip netns del $NS_TX 2> /dev/null
+	ip netns del $NS_RX 2> /dev/null
+	rm -f "$raw" "$raw.perf"
+}
+trap cleanup EXIT
+
+setup()
+{
+	ip netns add $NS_TX || return 1
+	ip netns add $NS_RX || return 1
+	ip -n $NS_TX link add nb0 type veth peer name nb1 netns $NS_RX ||
+		return 1
+	ip -n $NS_TX link add nbd0 type dummy || return 1
+
+	ip -n $NS_TX addr add $ADDR_TX/24 dev nb0
+	ip -n $NS_RX addr add $ADDR_RX/24 dev nb1
+	ip -n $NS_TX addr add 10.202.0.1/24 dev nbd0
+	ip -n $NS_TX link set nb0 up
+	ip -n $NS_RX link set nb1 up
+	ip -n $NS_TX link set nbd0 up
+	ip -n $NS_TX link set lo up
+	ip -n $NS_RX link set lo up
+}
+
+# record <test> <metric> <better> <value>
+record()
+{
+	echo "$1 $2 $3 $4" >> "$raw"
+}
+
+# pg <netns> <file> <command>
+pg()
+{
+	ip netns exec "$1" sh -c "echo '$3' > /proc/net/pktgen/$2" ||
+		echo "netbench: pktgen: $3 failed on $2" >&2
+}
+
+# run_pktgen <test> <netns> <dev> <mode> <dst> <dst_mac>
+run_pktgen()
+{
+	pg "$2" kpktgend_0 rem_device_all
+	pg "$2" kpktgend_0 "add_device $3"
+	pg "$2" "$3" "xmit_mode $4"
+	pg "$2" "$3" "count 0"
+	pg "$2" "$3" "delay 0"
+	pg "$2" "$3" "pkt_size $size"
+	pg "$2" "$3" "dst $5"
+	pg "$2" "$3" "dst_mac $6"
+	pg "$2" "$3" "udp_dst_min 9"
+	pg "$2" "$3" "udp_dst_max 9"
+
+	perf=
+	if command -v perf > /dev/null 2>&1; then
+		perf stat -a -x, -e cycles -o "$raw.perf" \
+			-- sleep "$duration" 2> /dev/null &
+		perf=$!
+	fi
+
+	ip netns exec "$2" sh -c 'echo start > /proc/net/pktgen/pgctrl' &
+	start=$!
+	sleep "$duration"
+	ip netns exec "$2" sh -c 'echo stop > /proc/net/pktgen/pgctrl'
+	wait $start
+	[ -n "$perf" ] && wait $perf
+
+	pps=$(ip netns exec "$2" sed -n 's/.* \([0-9]*\)pps .*/\1/p' \
+		/proc/net/pktgen/"$3")
+	pg "$2" kpktgend_0 rem_device_all
+	if [ -z "$pps" ] || [ "$pps" -eq 0 ]; then
+		echo "netbench: $1: pktgen sent nothing" >&2
+		return 1
+	fi
+
+	record "$1" mpps higher "$(awk -v pps="$pps" 'BEGIN { print pps / 1e6 }')"
+	if [ -n "$perf" ]; then
+		cycles=$(awk -F, '$3 ~ /^cycles/ { print $1 }' \
+			"$raw.perf")
+		case $cycles in
+		''|*[!0-9]*) ;;
+		*) record "$1" cycles_per_pkt lower "$(awk -v c="$cycles" \
+			-v pps="$pps" -v d="$duration" \
+			'BEGIN { print c / (pps * d) }')" ;;
+		esac
+	fi
+}
+
+# run_rr <test> <tcp flag>
+run_rr()
+{
+	if [ ! -x "$bin_dir"/netbench_rr ]; then
+		echo "netbench: $1: netbench_rr is not built" >&2
+		return 1
+	fi
+
+	ip netns exec $NS_RX "$bin_dir"/netbench_rr -S $2 -p $RR_PORT &
+	server=$!
+	sleep 1
+	line=$(ip netns exec $NS_TX "$bin_dir"/netbench_rr $2 -c $ADDR_RX \
+		-p $RR_PORT -s "$size")
+	kill $server
+	wait $server 2> /dev/null
+	if [ -z "$line" ]; then
+		echo "netbench: $1: no result" >&2
+		return 1
+	fi
+
+	for kv in $line; do
+		key=${kv%%=*}
+		val=${kv#*=}
+		case $key in
+		tps) record "$1" tps higher "$val" ;;
+		p*_us) record "$1" "$key" lower "$val" ;;
+		esac
+	done
+}
+
+run_test()
+{
+	rx_mac=$(ip -n $NS_RX -o link show nb1 |
+		sed -n 's/.*link\/ether \([0-9a-f:]*\).*/\1/p')
+
+	case $1 in
+	tx_qdisc)
+		run_pktgen "$1" $NS_TX nbd0 queue_xmit $ADDR_DUMMY \
+			02:00:00:00:00:02 ;;
+	rx_stack)
+		run_pktgen "$1" $NS_RX nb1 netif_receive $ADDR_RX "$rx_mac" ;;
+	rx_xdp)
+		run_pktgen "$1" $NS_TX nb0 queue_xmit $ADDR_RX "$rx_mac" ;;
+	udp_rr)
+		run_rr "$1" "" ;;
+	tcp_rr)
+		run_rr "$1" -T ;;
+	*)
+		echo "netbench: unknown test $1" >&2
+		return 1 ;;
+	esac
+}
+
+if ! setup; then
+	echo "netbench: could not set up the namespaces [FAIL]"
+	exit 1
+fi
+
+ret=0
+for test in $tests; do
+	if [ "$test" = rx_xdp ]; then
+		if [ -z "$xdp_obj" ]; then
+			echo "netbench: rx_xdp: no XDP object given with -x [SKIP]"
+			continue
+		fi
+		if ! ip -n $NS_RX link set dev nb1 xdp obj "$xdp_obj" \
+				${xdp_sec:+sec "$xdp_sec"}; then
+			echo "netbench: rx_xdp: could not load $xdp_obj [FAIL]"
+			ret=1
+			continue
+		fi
+	fi
+
+	i=0
+	while [ $i -lt "$reps" ]; do
+		run_test "$test" || ret=1
+		i=$((i + 1))
+	done
+
+	[ "$test" = rx_xdp ] && ip -n $NS_RX link set dev nb1 xdp off
+done
+
+awk -v size="$size" '
+	{
+		key = $1 " " $2
+		if (!(key in n)) {
+			order[++nkeys] = key
+			better[key] = $3
+			min[key] = max[key] = $4
+		}
+		n[key]++
+		sum[key] += $4
+		if ($4 < min[key])
+			min[key] = $4
+		if ($4 > max[key])
+			max[key] = $4
+	}
+	END {
+		for (i = 1; i <= nkeys; i++) {
+			key = order[i]
+			split(key, tm, " ")
+			printf "test=%s size=%s reps=%d metric=%s better=%s min=%s max=%s mean=%.4g\n",
+			       tm[1], size, n[key], tm[2], better[key],
+			       min[key], max[key], sum[key] / n[key]
+		}
+	}' "$raw" > "$output"
+
+if [ ! -s "$output" ]; then
+	echo "netbench: no results [FAIL]"
+	exit 1
+fi
+cat "$output"
+
+if [ -z "$baseline" ]; then
+	[ $ret -eq 0 ] && echo "netbench: results saved in $output [PASS]" ||
+		echo "netbench: results saved in $output, some tests failed [FAIL]"
+	exit $ret
+fi
+
+awk -v threshold="$threshold" '
+	function parse(line, f,    i, n, kv, fields) {
+		n = split(line, fields, " ")
+		for (i = 1; i <= n; i++) {
+			split(fields[i], kv, "=")
+			f[kv[1]] = kv[2]
+		}
+	}
+	FNR == NR {
+		parse($0, f)
+		base[f["test"] "/" f["size"] "/" f["metric"]] = f["mean"]
+		next
+	}
+	{
+		parse($0, f)
+		key = f["test"] "/" f["size"] "/" f["metric"]
+		if (!(key in base) || base[key] == 0) {
+			printf "%s: no baseline\n", key
+			next
+		}
+		change = (f["mean"] - base[key]) * 100 / base[key]
+		worse = f["better"] == "higher" ? -change : change
+		verdict = worse > threshold ? "REGRESSION" : "ok"
+		if (worse > threshold)
+			failed = 1
+		printf "%s: %s -> %s (%+.1f%%) %s\n", key, base[key],
+		       f["mean"], change, verdict
+	}
+	END { exit failed }' "$baseline" "$output"
+
+if [ $? -ne 0 ]; then
+	echo "netbench: regressions against $baseline [FAIL]"
+	exit 1
+fi
+[ $ret -eq 0 ] || exit 1
+echo "netbench: no regressions against $baseline [PASS]"
+exit 0
@@ -0,0 +1,251 @@
+/*
+ * Request/response latency over UDP or TCP, for netbench.sh.
+ *
+ *   netbench_rr -S [-T] [-p port]
+ *   netbench_rr -c addr [-T] [-p port] [-s size] [-n count] [-w warmup]
+ *
+ * The server echoes every request back. The client sends one request at
+ * a time, times each round trip and prints one line of key=value pairs:
+ *
+ *   test=udp_rr size=64 count=100000 tps=... p50_us=... p90_us=...
+ *   p99_us=... p999_us=...
+ *
+ * (on one line). The first @warmup round trips are not counted.
+ */
+
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char *cfg_addr;
+static int cfg_server;
+static int cfg_tcp;
+static int cfg_port = 8765;
+static size_t cfg_size = 64;
+static unsigned long cfg_count = 100000;
+static unsigned long cfg_warmup = 1000;
+
+static void error(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* TCP may split a request, keep reading until all of it is there */
+static int read_full(int fd, char *buf, size_t len)
+{
+	size_t done = 0;
+	ssize_t ret;
+
+	while (done < len) {
+		ret = read(fd, buf + done, len - done);
+		if (ret <= 0)
+			return ret < 0 ? -1 : 0;
+		done += ret;
+	}
+	return 1;
+}
+
+static void do_server(void)
+{
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_port = htons(cfg_port),
+		.sin_addr.s_addr = htonl(INADDR_ANY),
+	};
+	struct sockaddr_in peer;
+	socklen_t peerlen;
+	char buf[65536];
+	int fd, cfd, one = 1;
+	ssize_t ret;
+
+	fd = socket(AF_INET, cfg_tcp ? SOCK_STREAM : SOCK_DGRAM, 0);
+	if (fd < 0)
+		error("socket");
+	if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)))
+		error("setsockopt SO_REUSEADDR");
+	if (bind(fd, (void *)&addr, sizeof(addr)))
+		error("bind");
+
+	if (!cfg_tcp) {
+		for (;;) {
+			peerlen = sizeof(peer);
+			ret = recvfrom(fd, buf, sizeof(buf), 0,
+				       (void *)&peer, &peerlen);
+			if (ret < 0)
+				error("recvfrom");
+			if (sendto(fd, buf, ret, 0, (void *)&peer, peerlen) < 0)
+				error("sendto");
+		}
+	}
+
+	if (listen(fd, 1))
+		error("listen");
+	for (;;) {
+		cfd = accept(fd, NULL, NULL);
+		if (cfd < 0)
+			error("accept");
+		if (setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)))
+			error("setsockopt TCP_NODELAY");
+
+		/* every connection starts with the request size */
+		if (read_full(cfd, (char *)&cfg_size, sizeof(cfg_size)) <= 0 ||
+		    cfg_size > sizeof(buf)) {
+			close(cfd);
+			continue;
+		}
+		while (read_full(cfd, buf, cfg_size) > 0)
+			if (write(cfd, buf, cfg_size) != (ssize_t)cfg_size)
+				break;
+		close(cfd);
+	}
+}
+
+static int cmp_ull(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *)a;
+	unsigned long long y = *(const unsigned long long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double percentile_us(unsigned long long *lat, unsigned long n,
+			    unsigned int permille)
+{
+	unsigned long i = (n * permille) / 1000;
+
+	return lat[i < n ? i : n - 1] / 1000.0;
+}
+
+static void do_client(void)
+{
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_port = htons(cfg_port),
+	};
+	struct timeval timeout = { .tv_sec = 1 };
+	unsigned long long *lat, start, t;
+	unsigned long i, n = cfg_warmup + cfg_count;
+	char *buf;
+	int fd, one = 1;
+
+	if (inet_pton(AF_INET, cfg_addr, &addr.sin_addr) != 1) {
+		fprintf(stderr, "bad address %s\n", cfg_addr);
+		exit(1);
+	}
+
+	buf = calloc(1, cfg_size);
+	lat = calloc(cfg_count, sizeof(*lat));
+	if (!buf || !lat)
+		error("calloc");
+
+	fd = socket(AF_INET, cfg_tcp ? SOCK_STREAM : SOCK_DGRAM, 0);
+	if (fd < 0)
+		error("socket");
+	if (connect(fd, (void *)&addr, sizeof(addr)))
+		error("connect");
+	/* a lost UDP datagram would otherwise hang the client */
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)))
+		error("setsockopt SO_RCVTIMEO");
+	if (cfg_tcp) {
+		if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)))
+			error("setsockopt TCP_NODELAY");
+		if (write(fd, &cfg_size, sizeof(cfg_size)) != sizeof(cfg_size))
+			error("write");
+	}
+
+	start = 0;
+	for (i = 0; i < n; i++) {
+		if (i == cfg_warmup)
+			start = now_ns();
+		t = now_ns();
+		if (write(fd, buf, cfg_size) != (ssize_t)cfg_size)
+			error("write");
+		if (cfg_tcp) {
+			if (read_full(fd, buf, cfg_size) <= 0)
+				error("read");
+		} else if (read(fd, buf, cfg_size) < 0) {
+			error("read");
+		}
+		if (i >= cfg_warmup)
+			lat[i - cfg_warmup] = now_ns() - t;
+	}
+	t = now_ns() - start;
+
+	qsort(lat, cfg_count, sizeof(*lat), cmp_ull);
+	printf("test=%s size=%zu count=%lu tps=%.0f p50_us=%.1f p90_us=%.1f p99_us=%.1f p999_us=%.1f\n",
+	       cfg_tcp ? "tcp_rr" : "udp_rr", cfg_size, cfg_count,
+	       cfg_count * 1e9 / t,
+	       percentile_us(lat, cfg_count, 500),
+	       percentile_us(lat, cfg_count, 900),
+	       percentile_us(lat, cfg_count, 990),
+	       percentile_us(lat, cfg_count, 999));
+	close(fd);
+}
+
+int main(int argc, char **argv)
+{
+	int c;
+
+	while ((c = getopt(argc, argv, "c:n:p:s:STw:")) != -1) {
+		switch (c) {
+		case 'c':
+			cfg_addr = optarg;
+			break;
+		case 'n':
+			cfg_count = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			cfg_port = atoi(optarg);
+			break;
+		case 's':
+			cfg_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'S':
+			cfg_server = 1;
+			break;
+		case 'T':
+			cfg_tcp = 1;
+			break;
+		case 'w':
+			cfg_warmup = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			goto usage;
+		}
+	}
+
+	if (cfg_server == !!cfg_addr || !cfg_count || !cfg_size ||
+	    cfg_size > (cfg_tcp ? 65536 : 65507))
+		goto usage;
+
+	if (cfg_server)
+		do_server();
+	else
+		do_client();
+	return 0;
+
+usage:
+	fprintf(stderr,
+		"usage: %s -S [-T] [-p port]\n"
+		"       %s -c addr [-T] [-p port] [-s size] [-n count] [-w warmup]\n",
+		argv[0], argv[0]);
+	return 1;
+}
@@ -0,0 +1,182 @@
+/*
+ * Throughput of an AF_UNIX stream socketpair, with and without
+ * MSG_ZEROCOPY.
+ *
+ *   unix_stream_bench [-z] [-s send size] [-t seconds]
+ *
+ * The child reads everything and exits on EOF, the parent sends for the
+ * given time and reports MB/s. With -z the sender waits for its
+ * completion notifications before reusing the buffer, so the reported
+ * rate includes the notification round trip.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/errqueue.h>
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY	60
+#endif
+
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY	5
+#endif
+
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY	0x4000000
+#endif
+
+static size_t cfg_size = 64 * 1024;
+static int cfg_seconds = 3;
+static int cfg_zerocopy;
+
+static void error(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void do_recv(int fd)
+{
+	char *buf = malloc(cfg_size);
+	ssize_t ret;
+
+	if (!buf)
+		error("malloc");
+
+	do {
+		ret = read(fd, buf, cfg_size);
+	} while (ret > 0);
+
+	if (ret < 0)
+		error("read");
+	exit(0);
+}
+
+/* wait for the notifications covering ids [0, next) */
+static void wait_completions(int fd, unsigned int next, unsigned int *done)
+{
+	struct sock_extended_err *serr;
+	char control[128];
+	struct msghdr msg;
+	struct cmsghdr *cm;
+	struct pollfd pfd = { .fd = fd, .events = 0 };
+
+	while (*done < next) {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		if (recvmsg(fd, &msg, MSG_ERRQUEUE) < 0) {
+			if (errno != EAGAIN)
+				error("recvmsg errqueue");
+			if (poll(&pfd, 1, 1000) < 0)
+				error("poll");
+			continue;
+		}
+
+		for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+			serr = (void *)CMSG_DATA(cm);
+			if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+				continue;
+			*done = serr->ee_data + 1;
+		}
+	}
+}
+
+static void do_send(int fd)
+{
+	unsigned int next = 0, done = 0;
+	unsigned long long bytes = 0;
+	char *buf = malloc(cfg_size);
+	double start, stop;
+	int one = 1;
+	ssize_t ret;
+
+	if (!buf)
+		error("malloc");
+	memset(buf, 'a', cfg_size);
+
+	if (cfg_zerocopy &&
+	    setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)))
+		error("setsockopt SO_ZEROCOPY");
+
+	start = now();
+	stop = start + cfg_seconds;
+	while (now() < stop) {
+		ret = send(fd, buf, cfg_size, cfg_zerocopy ? MSG_ZEROCOPY : 0);
+		if (ret < 0)
+			error("send");
+		bytes += ret;
+
+		if (cfg_zerocopy) {
+			next++;
+			wait_completions(fd, next, &done);
+		}
+	}
+
+	printf("%s: %zu byte sends, %.1f MB/s\n",
+	       cfg_zerocopy ? "zerocopy" : "copy", cfg_size,
+	       bytes / (now() - start) / 1e6);
+}
+
+int main(int argc, char **argv)
+{
+	int fds[2], status, c;
+	pid_t pid;
+
+	while ((c = getopt(argc, argv, "s:t:z")) != -1) {
+		switch (c) {
+		case 's':
+			cfg_size = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			cfg_seconds = atoi(optarg);
+			break;
+		case 'z':
+			cfg_zerocopy = 1;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-z] [-s size] [-t secs]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds))
+		error("socketpair");
+
+	pid = fork();
+	if (pid < 0)
+		error("fork");
+	if (!pid) {
+		close(fds[0]);
+		do_recv(fds[1]);
+	}
+
+	close(fds[1]);
+	do_send(fds[0]);
+	close(fds[0]);
+
+	if (waitpid(pid, &status, 0) < 0)
+		error("waitpid");
+	return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
@@ -0,0 +1,359 @@
+/*
+ * Multi-threaded page fault and mmap benchmarks, for mm_bench.sh.
+ *
+ *   mm_bench -t test [-n threads] [-r reps] [-d ms] [-s MB] [-f file]
+ *
+ * Tests:
+ *   page_fault         each thread faults its own private anon mapping
+ *   page_fault_shared  all threads fault slices of one anon mapping
+ *   thp_fault          like page_fault, in MADV_HUGEPAGE mappings
+ *   mmap_munmap        each thread maps, touches and unmaps 16 pages
+ *   file_fault         all threads read slices of a shared mapping of
+ *                      @file, which mm_bench.sh runs in a memory cgroup
+ *                      smaller than the file to exercise reclaim
+ *
+ * The fault tests touch every page (every huge page for thp_fault) of
+ * their mapping, then drop them with MADV_DONTNEED and start over.  Each
+ * repetition runs for @ms, and the results are printed as one line of
+ * key=value pairs, in the same format as the kbench module:
+ *
+ *   test=page_fault threads=4 reps=5 metric=faults_per_sec better=higher
+ *   min=... max=... mean=... stddev=...
+ *
+ * (on one line).  Exits with 4 if the test can't run on this system.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define KSFT_SKIP	4
+#define HPAGE_SIZE	(2UL << 20)
+#define MMAP_PAGES	16
+#define MAX_REPS	100
+
+#define ARRAY_SIZE(a)	(int)(sizeof(a) / sizeof((a)[0]))
+
+enum test {
+	TEST_PAGE_FAULT,
+	TEST_PAGE_FAULT_SHARED,
+	TEST_THP_FAULT,
+	TEST_MMAP_MUNMAP,
+	TEST_FILE_FAULT,
+};
+
+static const struct {
+	const char *name;
+	const char *metric;
+} tests[] = {
+	[TEST_PAGE_FAULT]		= { "page_fault", "faults_per_sec" },
+	[TEST_PAGE_FAULT_SHARED]	= { "page_fault_shared", "faults_per_sec" },
+	[TEST_THP_FAULT]		= { "thp_fault", "faults_per_sec" },
+	[TEST_MMAP_MUNMAP]		= { "mmap_munmap", "ops_per_sec" },
+	[TEST_FILE_FAULT]		= { "file_fault", "pages_per_sec" },
+};
+
+static int cfg_test = -1;
+static const char *cfg_file;
+static int cfg_threads = 1;
+static int cfg_reps = 5;
+static int cfg_ms = 1000;
+static size_t cfg_size = 64 << 20;
+
+static size_t page_size;
+static char *shared_map;
+static size_t shared_len;
+static volatile int running;
+static pthread_barrier_t barrier;
+
+struct thread {
+	pthread_t tid;
+	int idx;
+	unsigned long long ops;
+};
+
+static void error(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *map_anon(size_t len, size_t align)
+{
+	char *p, *start;
+
+	/* over-allocate to align the start, for huge pages */
+	p = mmap(NULL, len + align, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		error("mmap");
+	if (!align)
+		return p;
+
+	start = (char *)(((unsigned long)p + align - 1) & ~(align - 1));
+	if (start > p)
+		munmap(p, start - p);
+	munmap(start + len, p + align - start);
+	return start;
+}
+
+/*
+ * Touch [p, p + len) every @step bytes, then zap it so that the next
+ * pass faults again.  File pages stay in the page cache, unless the
+ * memory cgroup limit had them reclaimed meanwhile.
+ */
+static unsigned long long fault_pass(char *p, size_t len, size_t step,
+				     int write)
+{
+	unsigned long long n = 0;
+	volatile char *v = p;
+	size_t off;
+
+	for (off = 0; off < len && running; off += step, n++) {
+		if (write)
+			v[off] = 1;
+		else
+			(void)v[off];
+	}
+	if (madvise(p, len, MADV_DONTNEED))
+		error("madvise MADV_DONTNEED");
+	return n;
+}
+
+static unsigned long long mmap_munmap_pass(void)
+{
+	char *p;
+
+	p = mmap(NULL, MMAP_PAGES * page_size, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		error("mmap");
+	p[0] = 1;
+	if (munmap(p, MMAP_PAGES * page_size))
+		error("munmap");
+	return 1;
+}
+
+static void *thread_fn(void *arg)
+{
+	struct thread *t = arg;
+	/* slices of the shared mappings must stay page aligned for madvise */
+	size_t len = (shared_len / cfg_threads) & ~(page_size - 1);
+	unsigned long long ops = 0;
+	char *p = NULL;
+
+	switch (cfg_test) {
+	case TEST_PAGE_FAULT:
+		len = cfg_size;
+		p = map_anon(len, 0);
+		break;
+	case TEST_THP_FAULT:
+		len = cfg_size;
+		p = map_anon(len, HPAGE_SIZE);
+		if (madvise(p, len, MADV_HUGEPAGE))
+			error("madvise MADV_HUGEPAGE");
+		break;
+	case TEST_PAGE_FAULT_SHARED:
+	case TEST_FILE_FAULT:
+		p = shared_map + t->idx * len;
+		break;
+	}
+
+	/* set up, then wait for the start */
+	pthread_barrier_wait(&barrier);
+	pthread_barrier_wait(&barrier);
+
+	while (running) {
+		switch (cfg_test) {
+		case TEST_PAGE_FAULT:
+		case TEST_PAGE_FAULT_SHARED:
+			ops += fault_pass(p, len, page_size, 1);
+			break;
+		case TEST_THP_FAULT:
+			ops += fault_pass(p, len, HPAGE_SIZE, 1);
+			break;
+		case TEST_MMAP_MUNMAP:
+			ops += mmap_munmap_pass();
+			break;
+		case TEST_FILE_FAULT:
+			ops += fault_pass(p, len, page_size, 0);
+			break;
+		}
+	}
+
+	if (cfg_test == TEST_PAGE_FAULT || cfg_test == TEST_THP_FAULT)
+		munmap(p, len);
+	t->ops = ops;
+	return NULL;
+}
+
+static double run_rep(void)
+{
+	struct thread *threads;
+	unsigned long long ops = 0;
+	double start, elapsed;
+	int i;
+
+	threads = calloc(cfg_threads, sizeof(*threads));
+	if (!threads)
+		error("calloc");
+	if (pthread_barrier_init(&barrier, NULL, cfg_threads + 1))
+		error("pthread_barrier_init");
+
+	running = 1;
+	for (i = 0; i < cfg_threads; i++) {
+		threads[i].idx = i;
+		if (pthread_create(&threads[i].tid, NULL, thread_fn,
+				   &threads[i]))
+			error("pthread_create");
+	}
+
+	/* all set up, start them together */
+	pthread_barrier_wait(&barrier);
+	start = now();
+	pthread_barrier_wait(&barrier);
+	usleep(cfg_ms * 1000);
+	running = 0;
+
+	for (i = 0; i < cfg_threads; i++) {
+		pthread_join(threads[i].tid, NULL);
+		ops += threads[i].ops;
+	}
+	elapsed = now() - start;
+
+	pthread_barrier_destroy(&barrier);
+	free(threads);
+	return ops / elapsed;
+}
+
+static void setup_shared(void)
+{
+	struct stat st;
+	int fd;
+
+	if (cfg_test == TEST_PAGE_FAULT_SHARED) {
+		shared_len = cfg_size * cfg_threads;
+		shared_map = map_anon(shared_len, 0);
+		return;
+	}
+
+	if (!cfg_file) {
+		fprintf(stderr, "file_fault needs a file, see -f\n");
+		exit(1);
+	}
+	fd = open(cfg_file, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st))
+		error(cfg_file);
+	shared_len = st.st_size;
+	if (shared_len < page_size * cfg_threads) {
+		fprintf(stderr, "%s is too small\n", cfg_file);
+		exit(1);
+	}
+	shared_map = mmap(NULL, shared_len, PROT_READ, MAP_SHARED, fd, 0);
+	if (shared_map == MAP_FAILED)
+		error("mmap");
+	close(fd);
+}
+
+static void report(double *samples, int n)
+{
+	double lo = samples[0], hi = samples[0], sum = 0, var = 0, mean;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (samples[i] < lo)
+			lo = samples[i];
+		if (samples[i] > hi)
+			hi = samples[i];
+		sum += samples[i];
+	}
+	mean = sum / n;
+	for (i = 0; i < n; i++)
+		var += (samples[i] - mean) * (samples[i] - mean) / n;
+
+	printf("test=%s threads=%d reps=%d metric=%s better=higher min=%.0f max=%.0f mean=%.0f stddev=%.0f\n",
+	       tests[cfg_test].name, cfg_threads, n, tests[cfg_test].metric,
+	       lo, hi, mean, sqrt(var));
+}
+
+int main(int argc, char **argv)
+{
+	double samples[MAX_REPS];
+	int c, i;
+
+	while ((c = getopt(argc, argv, "d:f:n:r:s:t:")) != -1) {
+		switch (c) {
+		case 'd':
+			cfg_ms = atoi(optarg);
+			break;
+		case 'f':
+			cfg_file = optarg;
+			break;
+		case 'n':
+			cfg_threads = atoi(optarg);
+			break;
+		case 'r':
+			cfg_reps = atoi(optarg);
+			break;
+		case 's':
+			cfg_size = strtoul(optarg, NULL, 0) << 20;
+			break;
+		case 't':
+			for (i = 0; i < ARRAY_SIZE(tests); i++)
+				if (!strcmp(optarg, tests[i].name))
+					cfg_test = i;
+			if (cfg_test < 0)
+				goto usage;
+			break;
+		default:
+			goto usage;
+		}
+	}
+
+	if (cfg_test < 0 || cfg_threads < 1 || cfg_reps < 1 ||
+	    cfg_reps > MAX_REPS || cfg_ms < 1 || !cfg_size)
+		goto usage;
+
+	page_size = sysconf(_SC_PAGESIZE);
+	if (cfg_test == TEST_THP_FAULT) {
+		if (access("/sys/kernel/mm/transparent_hugepage/enabled", F_OK)) {
+			fprintf(stderr, "thp_fault: no transparent hugepages [SKIP]\n");
+			return KSFT_SKIP;
+		}
+		cfg_size = (cfg_size + HPAGE_SIZE - 1) & ~(HPAGE_SIZE - 1);
+	}
+
+	if (cfg_test == TEST_PAGE_FAULT_SHARED || cfg_test == TEST_FILE_FAULT)
+		setup_shared();
+
+	for (i = 0; i < cfg_reps; i++)
+		samples[i] = run_rep();
+	report(samples, cfg_reps);
+	return 0;
+
+usage:
+	fprintf(stderr,
+		"usage: %s -t test [-n threads] [-r reps] [-d ms] [-s MB] [-f file]\n"
+		"tests:", argv[0]);
+	for (i = 0; i < ARRAY_SIZE(tests); i++)
+		fprintf(stderr, " %s", tests[i].name);
+	fprintf(stderr, "\n");
+	return 1;
+}
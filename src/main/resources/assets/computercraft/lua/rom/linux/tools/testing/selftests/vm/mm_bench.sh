@@ -0,0 +1,191 @@
+#!/bin/sh
+# Runs the mm benchmarks and, given a baseline written by an earlier run
+# with -o, fails if a benchmark got worse than the threshold:
+#
+#  - mm_bench page fault, THP fault and mmap/munmap tests, for each of the
+#    thread counts given with -n
+#  - mm_bench file_fault over a file twice the size of the memory cgroup
+#    it runs in, so that every pass goes through reclaim
+#  - the kmalloc, kmem_cache and page_alloc tests of the kbench module,
+#    through ../kbench/kbench.sh, when the module is available
+#
+# All the results are lines of key=value pairs, in the kbench format.
+
+usage()
+{
+	echo "Usage: $0 [-b baseline] [-o output] [-t percent] [-n threads]"
+	echo "       [-r reps] [-d ms] [-D dir] [-m MB]"
+	echo "-b:  results of an earlier run to compare with"
+	echo "-o:  where to save the results, default mm_bench.results"
+	echo "-t:  regression threshold in percent of the mean, default 10"
+	echo "-n:  thread counts to run, default \"1 <online cpus>\""
+	echo "-r:  repetitions of each benchmark, default 5"
+	echo "-d:  duration of each repetition in ms, default 1000"
+	echo "-D:  directory for the reclaim test file, not on tmpfs,"
+	echo "     default the current directory"
+	echo "-m:  size of the reclaim test file in MB, default 512"
+}
+
+baseline=
+output=mm_bench.results
+threshold=10
+cpus=$(getconf _NPROCESSORS_ONLN)
+threads="1 $cpus"
+[ "$cpus" -eq 1 ] && threads=1
+reps=5
+duration=1000
+dir=.
+file_mb=512
+
+while getopts "b:o:t:n:r:d:D:m:h" opt; do
+	case $opt in
+	b) baseline=$OPTARG ;;
+	o) output=$OPTARG ;;
+	t) threshold=$OPTARG ;;
+	n) threads=$OPTARG ;;
+	r) reps=$OPTARG ;;
+	d) duration=$OPTARG ;;
+	D) dir=$OPTARG ;;
+	m) file_mb=$OPTARG ;;
+	*) usage; exit 1 ;;
+	esac
+done
+
+if [ "$(id -u)" -ne 0 ]; then
+	echo "mm_bench: must be run as root [SKIP]"
+	exit 4
+fi
+
+bin_dir=$(cd "$(dirname "$0")" && pwd)
+if [ ! -x "$bin_dir"/mm_bench ]; then
+	echo "mm_bench: mm_bench is not built [FAIL]"
+	exit 1
+fi
+
+ret=0
+: > "$output"
+
+# bench <mm_bench args>
+bench()
+{
+	"$bin_dir"/mm_bench -r "$reps" -d "$duration" "$@" >> "$output"
+	case $? in
+	0) ;;
+	4) ;;
+	*) echo "mm_bench: mm_bench $* failed" >&2; ret=1 ;;
+	esac
+}
+
+for n in $threads; do
+	for test in page_fault page_fault_shared thp_fault mmap_munmap; do
+		bench -t $test -n "$n"
+	done
+done
+
+# Reclaim: a memory cgroup limited to half of the file read through it
+memcg_create()
+{
+	cg_root=$(awk '$3 == "cgroup2" { print $2; exit }' /proc/mounts)
+	if [ -n "$cg_root" ] && grep -qw memory "$cg_root"/cgroup.controllers; then
+		echo +memory > "$cg_root"/cgroup.subtree_control 2> /dev/null
+		limit_file=memory.max
+	else
+		cg_root=$(awk '$3 == "cgroup" && $4 ~ /(^|,)memory(,|$)/ {
+			print $2; exit }' /proc/mounts)
+		limit_file=memory.limit_in_bytes
+	fi
+	[ -n "$cg_root" ] || return 1
+
+	cg=$cg_root/mm_bench.$$
+	mkdir "$cg" || return 1
+	echo $((file_mb / 2 * 1024 * 1024)) > "$cg/$limit_file"
+}
+
+reclaim_file=$dir/mm_bench.reclaim.$$
+if [ "$(stat -f -c %T "$dir")" = tmpfs ]; then
+	echo "mm_bench: reclaim: $dir is on tmpfs [SKIP]"
+elif ! memcg_create; then
+	echo "mm_bench: reclaim: no memory cgroup [SKIP]"
+elif ! dd if=/dev/zero of="$reclaim_file" bs=1M count="$file_mb" \
+		status=none; then
+	echo "mm_bench: reclaim: could not write $reclaim_file [FAIL]"
+	ret=1
+else
+	sync
+	echo 1 > /proc/sys/vm/drop_caches
+	for n in $threads; do
+		# Move a subshell into the cgroup, then run the benchmark from it
+		sh -c 'echo $$ > "$1"/cgroup.procs && shift && exec "$@"' \
+			sh "$cg" "$bin_dir"/mm_bench -r "$reps" -d "$duration" \
+			-t file_fault -f "$reclaim_file" -n "$n" >> "$output" ||
+			ret=1
+	done
+fi
+rm -f "$reclaim_file"
+[ -n "$cg" ] && [ -d "$cg" ] && rmdir "$cg"
+
+# Slab and page allocator microbenchmarks
+if [ -x "$bin_dir"/../kbench/kbench.sh ]; then
+	slab=$(mktemp)
+	for n in $threads; do
+		"$bin_dir"/../kbench/kbench.sh -o "$slab" \
+			tests=kmalloc,kmem_cache,page_alloc nr_threads="$n" \
+			reps="$reps" duration_ms="$duration" > /dev/null
+		case $? in
+		0) cat "$slab" >> "$output" ;;
+		4) echo "mm_bench: kbench is not available [SKIP]"; break ;;
+		*) echo "mm_bench: kbench failed" >&2; ret=1 ;;
+		esac
+	done
+	rm -f "$slab"
+fi
+
+if [ ! -s "$output" ]; then
+	echo "mm_bench: no results [FAIL]"
+	exit 1
+fi
+cat "$output"
+
+if [ -z "$baseline" ]; then
+	[ $ret -eq 0 ] && echo "mm_bench: results saved in $output [PASS]" ||
+		echo "mm_bench: results saved in $output, some tests failed [FAIL]"
+	exit $ret
+fi
+
+awk -v threshold="$threshold" '
+	function parse(line, f,    i, n, kv, fields) {
+		n = split(line, fields, " ")
+		for (i = 1; i <= n; i++) {
+			split(fields[i], kv, "=")
+			f[kv[1]] = kv[2]
+		}
+	}
+	FNR == NR {
+		parse($0, f)
+		base[f["test"] "/" f["threads"]] = f["mean"]
+		next
+	}
+	{
+		parse($0, f)
+		key = f["test"] "/" f["threads"]
+		if (!(key in base) || base[key] == 0) {
+			printf "%s: no baseline\n", key
+			next
+		}
+		change = (f["mean"] - base[key]) * 100 / base[key]
+		worse = f["better"] == "higher" ? -change : change
+		verdict = worse > threshold ? "REGRESSION" : "ok"
+		if (worse > threshold)
+			failed = 1
+		printf "%s: %s -> %s %s (%+.1f%%) %s\n", key, base[key],
+		       f["mean"], f["metric"], change, verdict
+	}
+	END { exit failed }' "$baseline" "$output"
+
+if [ $? -ne 0 ]; then
+	echo "mm_bench: regressions against $baseline [FAIL]"
+	exit 1
+fi
+[ $ret -eq 0 ] || exit 1
+echo "mm_bench: no regressions against $baseline [PASS]"
+exit 0